@@ -0,0 +1,462 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BENCHMARKCOMMON_H
+#define BENCHMARKCOMMON_H
+
+#include<iostream>
+#include<algorithm>
+#include<fstream>
+#include<iomanip>
+#include<sstream>
+#include<string>
+#include<vector>
+#include<cmath>
+
+#include<opencv2/core/core.hpp>
+#include<opencv2/imgproc/imgproc.hpp>
+
+#include<Eigen/Core>
+#include<Eigen/Geometry>
+
+#include<System.h>
+#include"ImuTypes.h"
+
+// Sequence loading, stereo rectification and trajectory accuracy shared by the benchmark drivers
+// (slam_benchmark for one sequence, slam_batch for many in parallel)
+
+struct Sequence
+{
+    // One image per frame (monocular) or two (stereo)
+    std::vector<std::vector<std::string> > vvstrImages;
+    std::vector<double> vTimestamps;
+    std::vector<ORB_SLAM3::IMU::Point> vImu;
+
+    // How the images are read, TUM-VI images are also equalized
+    int imreadFlag;
+    bool bClahe;
+};
+
+struct Position
+{
+    double t;
+    Eigen::Vector3d p;
+};
+
+struct AteStats
+{
+    int matched;
+    double rmse, mean, median, max, scale;
+};
+
+struct Distribution
+{
+    double mean, p50, p90, p99, max;
+};
+
+// Stereo rectification maps, empty when the settings have no rectification
+struct Rectification
+{
+    cv::Mat M1l, M2l, M1r, M2r;
+};
+
+inline bool FileExists(const std::string &strFile);
+inline bool LoadEuRoCCamera(const std::string &strCamPath, std::vector<std::string> &vstrImages, std::vector<double> &vTimestamps);
+inline bool LoadTimes(const std::string &strTimesFile, const std::string &strImagePath, std::vector<std::string> &vstrImages, std::vector<double> &vTimestamps);
+inline bool LoadEuRoCImu(const std::string &strImuFile, std::vector<ORB_SLAM3::IMU::Point> &vImu);
+inline bool LoadKitti(const std::string &strSequence, const bool bStereo, Sequence &seq);
+
+// mono | stereo | mono_inertial | stereo_inertial
+inline bool ParseSensor(const std::string &strSensor, ORB_SLAM3::System::eSensor &sensor)
+{
+    if(strSensor=="mono")
+        sensor = ORB_SLAM3::System::MONOCULAR;
+    else if(strSensor=="stereo")
+        sensor = ORB_SLAM3::System::STEREO;
+    else if(strSensor=="mono_inertial")
+        sensor = ORB_SLAM3::System::IMU_MONOCULAR;
+    else if(strSensor=="stereo_inertial")
+        sensor = ORB_SLAM3::System::IMU_STEREO;
+    else
+        return false;
+    return true;
+}
+
+// Sequence in the EuRoC, TUM-VI or KITTI layout (strTimes optional). strGroundTruth is set to the
+// ground truth of the dataset when empty and the sequence has one. On failure strError says why
+inline bool LoadSequence(const std::string &strDataset, const ORB_SLAM3::System::eSensor sensor, const std::string &strSequence,
+                         const std::string &strTimes, Sequence &seq, std::string &strGroundTruth, std::string &strError)
+{
+    const bool bStereo = (sensor==ORB_SLAM3::System::STEREO || sensor==ORB_SLAM3::System::IMU_STEREO);
+    const bool bInertial = (sensor==ORB_SLAM3::System::IMU_MONOCULAR || sensor==ORB_SLAM3::System::IMU_STEREO);
+
+    seq.imreadFlag = cv::IMREAD_UNCHANGED;
+    seq.bClahe = false;
+    if(strDataset=="euroc" || strDataset=="tumvi")
+    {
+        // TUM-VI is distributed in the EuRoC layout, the examples equalize its images
+        if(strDataset=="tumvi")
+        {
+            seq.imreadFlag = cv::IMREAD_GRAYSCALE;
+            seq.bClahe = true;
+        }
+
+        std::vector<std::string> vstrLeft, vstrRight;
+        std::vector<double> vTimestampsRight;
+        bool bOk;
+        if(!strTimes.empty())
+        {
+            bOk = LoadTimes(strTimes, strSequence + "/mav0/cam0/data", vstrLeft, seq.vTimestamps);
+            if(bStereo)
+                bOk = bOk && LoadTimes(strTimes, strSequence + "/mav0/cam1/data", vstrRight, vTimestampsRight);
+        }
+        else
+        {
+            bOk = LoadEuRoCCamera(strSequence + "/mav0/cam0", vstrLeft, seq.vTimestamps);
+            if(bStereo)
+                bOk = bOk && LoadEuRoCCamera(strSequence + "/mav0/cam1", vstrRight, vTimestampsRight);
+        }
+        if(!bOk || (bStereo && vstrRight.size()!=vstrLeft.size()))
+        {
+            strError = "Failed to load the images of " + strSequence;
+            return false;
+        }
+
+        seq.vvstrImages.resize(vstrLeft.size());
+        for(size_t i=0; i<vstrLeft.size(); i++)
+        {
+            seq.vvstrImages[i].push_back(vstrLeft[i]);
+            if(bStereo)
+                seq.vvstrImages[i].push_back(vstrRight[i]);
+        }
+
+        if(bInertial && !LoadEuRoCImu(strSequence + "/mav0/imu0/data.csv", seq.vImu))
+        {
+            strError = "Failed to load the IMU data of " + strSequence;
+            return false;
+        }
+
+        if(strGroundTruth.empty())
+        {
+            const std::string strDefault = strSequence + (strDataset=="euroc" ? "/mav0/state_groundtruth_estimate0/data.csv" : "/mav0/mocap0/data.csv");
+            if(FileExists(strDefault))
+                strGroundTruth = strDefault;
+        }
+    }
+    else if(strDataset=="kitti")
+    {
+        if(bInertial)
+        {
+            strError = "KITTI sequences have no IMU data";
+            return false;
+        }
+        if(!LoadKitti(strSequence, bStereo, seq))
+        {
+            strError = "Failed to load the images of " + strSequence;
+            return false;
+        }
+    }
+    else
+    {
+        strError = "Unknown dataset: " + strDataset;
+        return false;
+    }
+
+    if(seq.vvstrImages.empty())
+    {
+        strError = "No images in " + strSequence;
+        return false;
+    }
+    return true;
+}
+
+// Stereo rectification, as in the EuRoC examples, when the settings have it
+inline bool LoadRectification(const std::string &strSettings, Rectification &rect)
+{
+    cv::FileStorage fsSettings(strSettings, cv::FileStorage::READ);
+    if(!fsSettings.isOpened())
+        return false;
+
+    cv::Mat K_l, K_r, P_l, P_r, R_l, R_r, D_l, D_r;
+    fsSettings["LEFT.K"] >> K_l;
+    fsSettings["RIGHT.K"] >> K_r;
+    fsSettings["LEFT.P"] >> P_l;
+    fsSettings["RIGHT.P"] >> P_r;
+    fsSettings["LEFT.R"] >> R_l;
+    fsSettings["RIGHT.R"] >> R_r;
+    fsSettings["LEFT.D"] >> D_l;
+    fsSettings["RIGHT.D"] >> D_r;
+
+    int rows_l = fsSettings["LEFT.height"];
+    int cols_l = fsSettings["LEFT.width"];
+    int rows_r = fsSettings["RIGHT.height"];
+    int cols_r = fsSettings["RIGHT.width"];
+
+    if(!K_l.empty() && !K_r.empty() && !P_l.empty() && !P_r.empty() && !R_l.empty() && !R_r.empty() && !D_l.empty() && !D_r.empty() &&
+            rows_l>0 && rows_r>0 && cols_l>0 && cols_r>0)
+    {
+        cv::initUndistortRectifyMap(K_l,D_l,R_l,P_l.rowRange(0,3).colRange(0,3),cv::Size(cols_l,rows_l),CV_32F,rect.M1l,rect.M2l);
+        cv::initUndistortRectifyMap(K_r,D_r,R_r,P_r.rowRange(0,3).colRange(0,3),cv::Size(cols_r,rows_r),CV_32F,rect.M1r,rect.M2r);
+    }
+    return true;
+}
+
+inline bool FileExists(const std::string &strFile)
+{
+    std::ifstream f(strFile.c_str());
+    return f.good();
+}
+
+// data.csv of an EuRoC camera: "timestamp [ns],filename"
+inline bool LoadEuRoCCamera(const std::string &strCamPath, std::vector<std::string> &vstrImages, std::vector<double> &vTimestamps)
+{
+    std::ifstream f((strCamPath + "/data.csv").c_str());
+    if(!f.is_open())
+        return false;
+
+    std::string s;
+    while(std::getline(f,s))
+    {
+        if(s.empty() || s[0]=='#')
+            continue;
+
+        const size_t pos = s.find(',');
+        if(pos==std::string::npos)
+            continue;
+
+        std::string strName = s.substr(pos+1);
+        strName.erase(strName.find_last_not_of(" \r\n\t")+1);
+        vstrImages.push_back(strCamPath + "/data/" + strName);
+        vTimestamps.push_back(std::stod(s.substr(0,pos))/1e9);
+    }
+    return !vstrImages.empty();
+}
+
+// Times file of the examples: one timestamp [ns] per line, images named after it
+inline bool LoadTimes(const std::string &strTimesFile, const std::string &strImagePath, std::vector<std::string> &vstrImages, std::vector<double> &vTimestamps)
+{
+    std::ifstream f(strTimesFile.c_str());
+    if(!f.is_open())
+        return false;
+
+    std::string s;
+    while(std::getline(f,s))
+    {
+        s.erase(s.find_last_not_of(" \r\n\t")+1);
+        if(s.empty() || s[0]=='#')
+            continue;
+        vstrImages.push_back(strImagePath + "/" + s + ".png");
+        vTimestamps.push_back(std::stod(s)/1e9);
+    }
+    return !vstrImages.empty();
+}
+
+// "timestamp [ns],w_x,w_y,w_z,a_x,a_y,a_z"
+inline bool LoadEuRoCImu(const std::string &strImuFile, std::vector<ORB_SLAM3::IMU::Point> &vImu)
+{
+    std::ifstream f(strImuFile.c_str());
+    if(!f.is_open())
+        return false;
+
+    std::string s;
+    while(std::getline(f,s))
+    {
+        if(s.empty() || s[0]=='#')
+            continue;
+
+        std::replace(s.begin(), s.end(), ',', ' ');
+        std::stringstream ss(s);
+        double data[7];
+        int count = 0;
+        while(count<7 && ss >> data[count])
+            count++;
+        if(count<7)
+            continue;
+
+        vImu.push_back(ORB_SLAM3::IMU::Point(cv::Point3f(data[4],data[5],data[6]), cv::Point3f(data[1],data[2],data[3]), data[0]/1e9));
+    }
+    return !vImu.empty();
+}
+
+inline bool LoadKitti(const std::string &strSequence, const bool bStereo, Sequence &seq)
+{
+    std::ifstream f((strSequence + "/times.txt").c_str());
+    if(!f.is_open())
+        return false;
+
+    std::string s;
+    while(std::getline(f,s))
+    {
+        if(s.empty())
+            continue;
+        seq.vTimestamps.push_back(std::stod(s));
+    }
+
+    seq.vvstrImages.resize(seq.vTimestamps.size());
+    for(size_t i=0; i<seq.vTimestamps.size(); i++)
+    {
+        std::stringstream ss;
+        ss << std::setfill('0') << std::setw(6) << i;
+        seq.vvstrImages[i].push_back(strSequence + "/image_0/" + ss.str() + ".png");
+        if(bStereo)
+            seq.vvstrImages[i].push_back(strSequence + "/image_1/" + ss.str() + ".png");
+    }
+    return true;
+}
+
+// Positions of a trajectory in any of the formats of the datasets and of SaveTrajectoryEuRoC:
+// timestamp first (ns or s, comma or space separated) followed by the position, or KITTI poses
+// (12 values per line, no timestamp) which go with the frame timestamps in order
+inline bool LoadPositions(const std::string &strFile, const std::vector<double> &vFrameTimestamps, std::vector<Position> &vPositions)
+{
+    std::ifstream f(strFile.c_str());
+    if(!f.is_open())
+        return false;
+
+    std::string s;
+    size_t nLine = 0;
+    while(std::getline(f,s))
+    {
+        if(s.empty() || s[0]=='#')
+            continue;
+
+        std::replace(s.begin(), s.end(), ',', ' ');
+        std::stringstream ss(s);
+        std::vector<double> v;
+        double x;
+        while(ss >> x)
+            v.push_back(x);
+
+        Position pos;
+        if(v.size()==12)
+        {
+            if(nLine>=vFrameTimestamps.size())
+                break;
+            pos.t = vFrameTimestamps[nLine];
+            pos.p = Eigen::Vector3d(v[3], v[7], v[11]);
+        }
+        else if(v.size()>=4)
+        {
+            pos.t = v[0]>1e12 ? v[0]/1e9 : v[0];
+            pos.p = Eigen::Vector3d(v[1], v[2], v[3]);
+        }
+        else
+            continue;
+
+        vPositions.push_back(pos);
+        nLine++;
+    }
+    return !vPositions.empty();
+}
+
+// Estimated positions are associated to the closest ground truth (at most 20 ms away) and aligned
+// with Umeyama, with scale for monocular
+inline bool ComputeATE(const std::vector<Position> &vEstimated, const std::vector<Position> &vGroundTruth, const bool bScale, AteStats &stats)
+{
+    const double maxDiff = 0.02;
+
+    std::vector<double> vGtTimestamps(vGroundTruth.size());
+    for(size_t i=0; i<vGroundTruth.size(); i++)
+        vGtTimestamps[i] = vGroundTruth[i].t;
+
+    std::vector<std::pair<Eigen::Vector3d,Eigen::Vector3d> > vMatches;
+    for(size_t i=0; i<vEstimated.size(); i++)
+    {
+        const double t = vEstimated[i].t;
+        const std::vector<double>::const_iterator it = std::lower_bound(vGtTimestamps.begin(), vGtTimestamps.end(), t);
+        int best = -1;
+        double bestDiff = maxDiff;
+        if(it!=vGtTimestamps.end() && *it-t<=bestDiff)
+        {
+            best = it-vGtTimestamps.begin();
+            bestDiff = *it-t;
+        }
+        if(it!=vGtTimestamps.begin() && t-*(it-1)<=bestDiff)
+            best = (it-1)-vGtTimestamps.begin();
+
+        if(best>=0)
+            vMatches.push_back(std::make_pair(vEstimated[i].p, vGroundTruth[best].p));
+    }
+
+    if(vMatches.size()<3)
+    {
+        std::cerr << "ERROR: Only " << vMatches.size() << " poses associated with the ground truth" << std::endl;
+        return false;
+    }
+
+    Eigen::Matrix3Xd est(3,vMatches.size()), gt(3,vMatches.size());
+    for(size_t i=0; i<vMatches.size(); i++)
+    {
+        est.col(i) = vMatches[i].first;
+        gt.col(i) = vMatches[i].second;
+    }
+
+    const Eigen::Matrix4d T = Eigen::umeyama(est, gt, bScale);
+    const Eigen::Matrix3d sR = T.topLeftCorner<3,3>();
+
+    std::vector<double> vErrors(vMatches.size());
+    double sum = 0, sum2 = 0;
+    for(size_t i=0; i<vMatches.size(); i++)
+    {
+        vErrors[i] = (sR*est.col(i) + T.topRightCorner<3,1>() - gt.col(i)).norm();
+        sum += vErrors[i];
+        sum2 += vErrors[i]*vErrors[i];
+    }
+    std::sort(vErrors.begin(), vErrors.end());
+
+    stats.matched = vMatches.size();
+    stats.rmse = std::sqrt(sum2/vErrors.size());
+    stats.mean = sum/vErrors.size();
+    stats.median = vErrors[vErrors.size()/2];
+    stats.max = vErrors.back();
+    stats.scale = std::pow(sR.determinant(), 1.0/3.0);
+    return true;
+}
+
+inline Distribution ComputeDistribution(std::vector<double> v)
+{
+    Distribution d = {0, 0, 0, 0, 0};
+    if(v.empty())
+        return d;
+
+    std::sort(v.begin(), v.end());
+    double sum = 0;
+    for(size_t i=0; i<v.size(); i++)
+        sum += v[i];
+
+    d.mean = sum/v.size();
+    d.p50 = v[(v.size()-1)*50/100];
+    d.p90 = v[(v.size()-1)*90/100];
+    d.p99 = v[(v.size()-1)*99/100];
+    d.max = v.back();
+    return d;
+}
+
+inline std::string JsonString(const std::string &s)
+{
+    std::string out = "\"";
+    for(size_t i=0; i<s.size(); i++)
+    {
+        if(s[i]=='"' || s[i]=='\\')
+            out += '\\';
+        out += s[i];
+    }
+    return out + "\"";
+}
+
+#endif // BENCHMARKCOMMON_H
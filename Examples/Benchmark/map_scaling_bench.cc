@@ -0,0 +1,889 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include<iostream>
+#include<algorithm>
+#include<fstream>
+#include<iomanip>
+#include<sstream>
+#include<chrono>
+#include<functional>
+#include<random>
+#include<thread>
+#include<cmath>
+
+#include<opencv2/core/core.hpp>
+
+#include<System.h>
+#include<Map.h>
+#include<KeyFrame.h>
+#include<MapPoint.h>
+#include<KeyFrameDatabase.h>
+#include<LoopClosing.h>
+#include<Optimizer.h>
+#include<Converter.h>
+#include<SystemContext.h>
+#include<ThreadPool.h>
+#include"CameraModels/Pinhole.h"
+
+using namespace std;
+
+// Scaling benchmark of the back-end on synthetic maps, so that the growth of the cost with the size of
+// the map can be followed from release to release without recording sequences of every length.
+// For every size a map is generated: a camera moving around a circle and looking outwards at a
+// cylindrical wall of points, keypoints at the noisy projections of the points with descriptors
+// derived from a descriptor per point, and bags of words with words of the real vocabulary (one per
+// point, so that the views of a place share words). Keyframes are connected in order as Local Mapping
+// would (covisibility and spanning tree), poses and points start slightly off their true values.
+// On every map and thread count it times KeyFrameDatabase queries (place recognition and
+// relocalization), LocalBundleAdjustment, OptimizeEssentialGraph and GlobalBundleAdjustemnt, and
+// fits the exponent of the time against the number of keyframes (time ~ size^exponent).
+// The bundle adjustments also report the RMS error of the keyframe centres against their true
+// positions, to compare the accuracy of the BA engines and precisions.
+
+struct BenchResult
+{
+    string name;
+    int size;
+    int threads;
+    int iterations;
+    double mean, median, min; // us
+    string info;
+};
+
+BenchResult RunBenchmark(const string &name, const int nIterations, const function<void()> &run,
+                         const function<void()> &reset = function<void()>());
+string JsonString(const string &s);
+vector<int> ParseList(const string &s);
+
+// Camera and map generation parameters
+struct SyntheticParams
+{
+    int nFeatures;          // observations per keyframe (mean)
+    float fObsPerPoint;     // observations per point (mean)
+    float fSpacing;         // distance between consecutive keyframes (m)
+    float fMinDepth, fMaxDepth;
+    float fPixelNoise;      // keypoint noise at level 0 (pixels)
+    float fPoseNoise;       // initial error of the keyframe positions (m)
+    float fPointNoise;      // initial error of the points (m)
+    unsigned int nSeed;
+};
+
+// Synthetic map and everything it was built from. The keyframes and points are owned by the map
+// generator, the map and the database do not delete them.
+struct SyntheticMap
+{
+    ORB_SLAM3::SystemContext context;
+    ORB_SLAM3::GeometricCamera* pCamera;
+    ORB_SLAM3::Map* pMap;
+    ORB_SLAM3::KeyFrameDatabase* pKFDB;
+    vector<ORB_SLAM3::KeyFrame*> vpKFs;
+    vector<ORB_SLAM3::MapPoint*> vpMPs;
+    // Frames seen between keyframes, for the relocalization queries
+    vector<ORB_SLAM3::Frame> vQueryFrames;
+    // True camera centre of every keyframe
+    vector<cv::Matx31f> vTrueCenters;
+};
+
+// RMS distance (mm) between the estimated and the true keyframe centres
+double CenterError(const SyntheticMap* pSMap);
+
+class SyntheticMapBuilder
+{
+public:
+    SyntheticMapBuilder(ORB_SLAM3::ORBVocabulary* pVoc, const SyntheticParams &params);
+
+    // Map of nKeyFrames keyframes and nQueryFrames frames for relocalization. nShortlist is given to
+    // KeyFrameDatabase::SetGlobalShortlist (0: inverted file)
+    SyntheticMap* Build(const int nKeyFrames, const int nQueryFrames, const int nShortlist);
+    static void Release(SyntheticMap* pSMap);
+
+protected:
+    struct Landmark
+    {
+        cv::Point3f pos;
+        float azimuth;
+        unsigned int wordId;
+        unsigned int nodeId;
+        unsigned char desc[32];
+    };
+
+    // True pose of the camera at the position of keyframe s (s real for the frames in between)
+    cv::Matx44f TruePose(const double s) const;
+
+    // Fills the frame with the observations of the landmarks seen from Tcw (indices in vLandmarkIds)
+    void MakeFrame(const cv::Matx44f &Tcw, const double timestamp, SyntheticMap* pSMap,
+                   ORB_SLAM3::Frame &F, vector<int> &vLandmarkIds);
+
+    ORB_SLAM3::ORBVocabulary* mpVoc;
+    SyntheticParams mParams;
+    mt19937 mRng;
+
+    // Pinhole camera, EuRoC size
+    float fx, fy, cx, cy;
+    int mnWidth, mnHeight;
+    int mnLevels;
+    vector<float> mvScaleFactors, mvInvScaleFactors, mvLevelSigma2, mvInvLevelSigma2;
+
+    // Current map: radius of the trajectory, landmarks sorted by azimuth and observation probability
+    double mRadius;
+    int mnKeyFrames;
+    vector<Landmark> mvLandmarks;
+    vector<float> mvAzimuths;
+    float mfObsProb;
+};
+
+int main(int argc, char **argv)
+{
+    if(argc < 2)
+    {
+        cerr << endl << "Usage: ./map_scaling_bench path_to_vocabulary [--sizes 1000,3000,10000,30000] [--threads 1,4] "
+             << "[--features N] [--queries N] [--iterations N] [--global-iterations N] [--max-gba-size N] "
+             << "[--ba g2o|native] [--ba-precision double|single] [--shortlist N] [--seed N] [--report path_to_report]" << endl;
+        return 1;
+    }
+
+    const string strVocabulary(argv[1]);
+    vector<int> vSizes = {1000, 3000, 10000, 30000};
+    vector<int> vThreads = {1, max(1,(int)thread::hardware_concurrency())};
+    string strReport;
+    int nQueries = 100;
+    int nIterations = 10;
+    int nGlobalIterations = 3;
+    int nMaxGBASize = 30000;
+    int nShortlist = 0;
+    ORB_SLAM3::OptimizerSettings::eVisualBAEngine baEngine = ORB_SLAM3::OptimizerSettings::VISUAL_BA_G2O;
+    bool bSinglePrecision = false;
+
+    SyntheticParams params;
+    params.nFeatures = 300;
+    params.fObsPerPoint = 6.f;
+    params.fSpacing = 0.5f;
+    params.fMinDepth = 4.f;
+    params.fMaxDepth = 8.f;
+    params.fPixelNoise = 1.f;
+    params.fPoseNoise = 0.02f;
+    params.fPointNoise = 0.05f;
+    params.nSeed = 42;
+
+    for(int i=2; i<argc; i++)
+    {
+        const string arg(argv[i]);
+        if(arg=="--sizes" && i+1<argc)
+            vSizes = ParseList(argv[++i]);
+        else if(arg=="--threads" && i+1<argc)
+            vThreads = ParseList(argv[++i]);
+        else if(arg=="--features" && i+1<argc)
+            params.nFeatures = max(10, atoi(argv[++i]));
+        else if(arg=="--queries" && i+1<argc)
+            nQueries = max(1, atoi(argv[++i]));
+        else if(arg=="--iterations" && i+1<argc)
+            nIterations = max(1, atoi(argv[++i]));
+        else if(arg=="--global-iterations" && i+1<argc)
+            nGlobalIterations = max(1, atoi(argv[++i]));
+        else if(arg=="--max-gba-size" && i+1<argc)
+            nMaxGBASize = atoi(argv[++i]);
+        else if(arg=="--shortlist" && i+1<argc)
+            nShortlist = max(0, atoi(argv[++i]));
+        else if(arg=="--seed" && i+1<argc)
+            params.nSeed = atoi(argv[++i]);
+        else if(arg=="--report" && i+1<argc)
+            strReport = argv[++i];
+        else if(arg=="--ba" && i+1<argc)
+        {
+            const string strEngine(argv[++i]);
+            if(strEngine=="native")
+                baEngine = ORB_SLAM3::OptimizerSettings::VISUAL_BA_NATIVE;
+            else if(strEngine!="g2o")
+            {
+                cerr << "Unknown BA engine: " << strEngine << endl;
+                return 1;
+            }
+        }
+        else if(arg=="--ba-precision" && i+1<argc)
+        {
+            const string strPrecision(argv[++i]);
+            if(strPrecision=="single")
+                bSinglePrecision = true;
+            else if(strPrecision!="double")
+            {
+                cerr << "Unknown BA precision: " << strPrecision << endl;
+                return 1;
+            }
+        }
+        else
+        {
+            cerr << "Unknown argument: " << arg << endl;
+            return 1;
+        }
+    }
+    sort(vSizes.begin(),vSizes.end());
+    vSizes.erase(remove_if(vSizes.begin(),vSizes.end(),[](int n){return n<100;}),vSizes.end());
+    vThreads.erase(remove_if(vThreads.begin(),vThreads.end(),[](int n){return n<1;}),vThreads.end());
+    if(vSizes.empty() || vThreads.empty())
+    {
+        cerr << "ERROR: Sizes must be at least 100 keyframes and thread counts at least 1" << endl;
+        return 1;
+    }
+
+    ORB_SLAM3::ORBVocabulary* pVocabulary = ORB_SLAM3::System::LoadVocabulary(strVocabulary);
+    if(!pVocabulary)
+        return 1;
+
+    SyntheticMapBuilder builder(pVocabulary, params);
+    vector<BenchResult> vResults;
+
+    for(size_t s=0; s<vSizes.size(); s++)
+    {
+        const int nKFs = vSizes[s];
+        cout << "Building a synthetic map of " << nKFs << " keyframes..." << endl;
+        const std::chrono::steady_clock::time_point tb1 = std::chrono::steady_clock::now();
+        SyntheticMap* pSMap = builder.Build(nKFs, min(nQueries+1,nKFs), nShortlist);
+        const std::chrono::steady_clock::time_point tb2 = std::chrono::steady_clock::now();
+
+        size_t nObs = 0;
+        for(size_t i=0; i<pSMap->vpMPs.size(); i++)
+            nObs += pSMap->vpMPs[i]->Observations();
+        cout << "  " << pSMap->vpKFs.size() << " keyframes, " << pSMap->vpMPs.size() << " points, " << nObs << " observations, inverted file "
+             << pSMap->pKFDB->InvertedFileMemory()/(1024*1024) << " MB, built in "
+             << std::chrono::duration_cast<std::chrono::duration<double> >(tb2 - tb1).count() << " s" << endl;
+
+        ORB_SLAM3::Map* pMap = pSMap->pMap;
+        // The optimizer settings of the synthetic map. Only the native engine has a single-precision path
+        ORB_SLAM3::OptimizerSettings &optimizerSettings = pSMap->context.mOptimizer;
+        optimizerSettings.visualBAEngine = baEngine;
+        optimizerSettings.bVisualBASingle = bSinglePrecision;
+        const vector<ORB_SLAM3::KeyFrame*> &vpKFs = pSMap->vpKFs;
+        const vector<ORB_SLAM3::MapPoint*> &vpMPs = pSMap->vpMPs;
+
+        // Query keyframes: every query uses a different keyframe, the database marks the keyframes it
+        // visits with the id of the query
+        vector<ORB_SLAM3::KeyFrame*> vpQueryKFs(vpKFs.begin(), vpKFs.end());
+        shuffle(vpQueryKFs.begin(), vpQueryKFs.end(), mt19937(params.nSeed));
+        vpQueryKFs.resize(min((size_t)nQueries+1, vpQueryKFs.size()));
+
+        // Poses and positions to restore after the optimizations that write them
+        vector<cv::Mat> vKFPoses(vpKFs.size()), vMPPositions(vpMPs.size());
+        for(size_t i=0; i<vpKFs.size(); i++)
+            vKFPoses[i] = vpKFs[i]->GetPose();
+        for(size_t i=0; i<vpMPs.size(); i++)
+            vMPPositions[i] = vpMPs[i]->GetWorldPos();
+        auto RestoreMap = [&]{
+            for(size_t i=0; i<vpKFs.size(); i++)
+            {
+                vpKFs[i]->SetPose(vKFPoses[i]);
+                vpKFs[i]->mnBALocalForKF = 0;
+                vpKFs[i]->mnBAFixedForKF = 0;
+            }
+            for(size_t i=0; i<vpMPs.size(); i++)
+            {
+                vpMPs[i]->SetWorldPos(vMPPositions[i]);
+                vpMPs[i]->mnBALocalForKF = 0;
+            }
+        };
+
+        // Loop of the essential graph: the last keyframe closes with the first one, its covisible window
+        // corrected by a drift of 1% of the trajectory
+        ORB_SLAM3::KeyFrame* pLoopKF = vpKFs.front();
+        ORB_SLAM3::KeyFrame* pCurKF = vpKFs.back();
+        ORB_SLAM3::LoopClosing::KeyFrameAndPose NonCorrectedSim3, CorrectedSim3;
+        {
+            const Eigen::Vector3d drift(0.01*nKFs*params.fSpacing, 0.0, 0.0);
+            vector<ORB_SLAM3::KeyFrame*> vpWindow = pCurKF->GetVectorCovisibleKeyFrames();
+            vpWindow.push_back(pCurKF);
+            for(size_t i=0; i<vpWindow.size(); i++)
+            {
+                const Eigen::Matrix3d Rcw = ORB_SLAM3::Converter::toMatrix3d(vpWindow[i]->GetRotation());
+                const Eigen::Vector3d tcw = ORB_SLAM3::Converter::toVector3d(vpWindow[i]->GetTranslation());
+                NonCorrectedSim3[vpWindow[i]] = g2o::Sim3(Rcw,tcw,1.0);
+                CorrectedSim3[vpWindow[i]] = g2o::Sim3(Rcw,tcw-Rcw*drift,1.0);
+            }
+        }
+        map<ORB_SLAM3::KeyFrame*, set<ORB_SLAM3::KeyFrame*> > LoopConnections;
+        {
+            const vector<ORB_SLAM3::KeyFrame*> vpLoopWindow = pLoopKF->GetVectorCovisibleKeyFrames();
+            LoopConnections[pCurKF].insert(pLoopKF);
+            LoopConnections[pCurKF].insert(vpLoopWindow.begin(), vpLoopWindow.end());
+        }
+
+        // Keyframe of the local BA, away from the loop
+        ORB_SLAM3::KeyFrame* pLocalKF = vpKFs[vpKFs.size()/2];
+
+        for(size_t t=0; t<vThreads.size(); t++)
+        {
+            const int nThreads = vThreads[t];
+            ORB_SLAM3::ThreadPool* pThreadPool = nThreads>1 ? new ORB_SLAM3::ThreadPool(nThreads) : static_cast<ORB_SLAM3::ThreadPool*>(NULL);
+            pSMap->pKFDB->SetThreadPool(pThreadPool);
+            optimizerSettings.pThreadPool = pThreadPool;
+
+            // KeyFrameDatabase::DetectNBestCandidates, as Loop Closing queries every new keyframe
+            {
+                size_t q = 0, nCandidates = 0;
+                vector<ORB_SLAM3::KeyFrame*> vpLoopCand, vpMergeCand;
+                BenchResult r = RunBenchmark("DetectNBestCandidates", min(nQueries,(int)vpQueryKFs.size()-1), [&]{
+                    pSMap->pKFDB->DetectNBestCandidates(vpQueryKFs[q], vpLoopCand, vpMergeCand, 3);
+                    nCandidates += vpLoopCand.size();
+                }, [&]{
+                    // The query keyframes are rotated (the warm-up takes the first one)
+                    q = (q+1)%vpQueryKFs.size();
+                    vpLoopCand.clear();
+                    vpMergeCand.clear();
+                });
+                r.info = to_string(nCandidates/(r.iterations+1)) + " candidates";
+                r.size = nKFs;
+                r.threads = nThreads;
+                vResults.push_back(r);
+            }
+
+            // KeyFrameDatabase::DetectRelocalizationCandidates on the frames between keyframes
+            {
+                size_t q = 0, nCandidates = 0;
+                BenchResult r = RunBenchmark("DetectRelocalizationCandidates", min(nQueries,(int)pSMap->vQueryFrames.size()-1), [&]{
+                    nCandidates += pSMap->pKFDB->DetectRelocalizationCandidates(&pSMap->vQueryFrames[q], pMap).size();
+                }, [&]{
+                    // Each query needs a new frame id
+                    q = (q+1)%pSMap->vQueryFrames.size();
+                    pSMap->vQueryFrames[q].mnId = pSMap->context.mnNextFrameId++;
+                });
+                r.info = to_string(nCandidates/(r.iterations+1)) + " candidates";
+                r.size = nKFs;
+                r.threads = nThreads;
+                vResults.push_back(r);
+            }
+
+            // Optimizer::LocalBundleAdjustment, from the same poses and positions every run
+            {
+                bool bStopFlag = false;
+                int num_fixedKF, num_OptKF, num_MPs, num_edges;
+                BenchResult r = RunBenchmark("LocalBundleAdjustment", nIterations, [&]{
+                    ORB_SLAM3::Optimizer::LocalBundleAdjustment(pLocalKF,&bStopFlag,pMap,num_fixedKF,num_OptKF,num_MPs,num_edges);
+                }, RestoreMap);
+                r.info = to_string(num_OptKF) + " local KFs, " + to_string(num_fixedKF) + " fixed KFs, " + to_string(num_MPs) + " points, " +
+                         to_string(CenterError(pSMap)) + " mm RMS";
+                r.size = nKFs;
+                r.threads = nThreads;
+                vResults.push_back(r);
+            }
+
+            // Optimizer::OptimizeEssentialGraph. The optimized poses are returned, the map is not modified.
+            // Runs after the warm-up reuse the essential graph cached in the map, as later loop corrections do
+            {
+                ORB_SLAM3::LoopClosing::KeyFrameAndPose InitialSim3, OptimizedSim3;
+                BenchResult r = RunBenchmark("OptimizeEssentialGraph", nGlobalIterations, [&]{
+                    ORB_SLAM3::Optimizer::OptimizeEssentialGraph(pMap, pLoopKF, pCurKF, NonCorrectedSim3, CorrectedSim3,
+                                                                 LoopConnections, false, &InitialSim3, &OptimizedSim3);
+                }, [&]{
+                    InitialSim3.clear();
+                    OptimizedSim3.clear();
+                });
+                r.info = to_string(OptimizedSim3.size()) + " KFs";
+                r.size = nKFs;
+                r.threads = nThreads;
+                vResults.push_back(r);
+            }
+
+            // Optimizer::GlobalBundleAdjustemnt (10 iterations, as after a loop), up to nMaxGBASize keyframes
+            if(nKFs<=nMaxGBASize)
+            {
+                BenchResult r = RunBenchmark("GlobalBundleAdjustemnt", nGlobalIterations, [&]{
+                    ORB_SLAM3::Optimizer::GlobalBundleAdjustemnt(pMap,10,NULL,0,false);
+                }, RestoreMap);
+                r.info = to_string(vpKFs.size()) + " KFs, " + to_string(vpMPs.size()) + " points, " + to_string(nObs) + " edges, " +
+                         to_string(CenterError(pSMap)) + " mm RMS";
+                r.size = nKFs;
+                r.threads = nThreads;
+                vResults.push_back(r);
+            }
+            RestoreMap();
+
+            pSMap->pKFDB->SetThreadPool(static_cast<ORB_SLAM3::ThreadPool*>(NULL));
+            optimizerSettings.pThreadPool = static_cast<ORB_SLAM3::ThreadPool*>(NULL);
+            delete pThreadPool;
+        }
+
+        SyntheticMapBuilder::Release(pSMap);
+    }
+
+    // Exponent of the median time against the size (least squares in log-log) of every benchmark and
+    // thread count measured on at least two sizes
+    struct Complexity
+    {
+        string name;
+        int threads;
+        int nSizes;
+        double exponent;
+    };
+    vector<Complexity> vComplexity;
+    for(size_t i=0; i<vResults.size(); i++)
+    {
+        bool bDone = false;
+        for(size_t j=0; j<vComplexity.size() && !bDone; j++)
+            bDone = vComplexity[j].name==vResults[i].name && vComplexity[j].threads==vResults[i].threads;
+        if(bDone)
+            continue;
+
+        double sx = 0, sy = 0, sxx = 0, sxy = 0;
+        int n = 0;
+        for(size_t j=i; j<vResults.size(); j++)
+        {
+            const BenchResult &r = vResults[j];
+            if(r.name!=vResults[i].name || r.threads!=vResults[i].threads || r.median<=0)
+                continue;
+            const double x = log((double)r.size), y = log(r.median);
+            sx += x; sy += y; sxx += x*x; sxy += x*y;
+            n++;
+        }
+        if(n<2)
+            continue;
+        Complexity c;
+        c.name = vResults[i].name;
+        c.threads = vResults[i].threads;
+        c.nSizes = n;
+        c.exponent = (n*sxy - sx*sy)/(n*sxx - sx*sx);
+        vComplexity.push_back(c);
+    }
+
+    // Report
+    cout << endl << left << setw(32) << "benchmark" << right << setw(9) << "KFs" << setw(8) << "threads" << setw(6) << "runs"
+         << setw(14) << "mean_us" << setw(14) << "median_us" << setw(14) << "min_us" << "  info" << endl;
+    cout << fixed << setprecision(1);
+    for(size_t i=0; i<vResults.size(); i++)
+    {
+        const BenchResult &r = vResults[i];
+        cout << left << setw(32) << r.name << right << setw(9) << r.size << setw(8) << r.threads << setw(6) << r.iterations
+             << setw(14) << r.mean << setw(14) << r.median << setw(14) << r.min << "  " << r.info << endl;
+    }
+
+    cout << endl << left << setw(32) << "benchmark" << right << setw(8) << "threads" << setw(8) << "sizes" << setw(10) << "exponent" << endl;
+    cout << setprecision(2);
+    for(size_t i=0; i<vComplexity.size(); i++)
+    {
+        const Complexity &c = vComplexity[i];
+        cout << left << setw(32) << c.name << right << setw(8) << c.threads << setw(8) << c.nSizes << setw(10) << c.exponent << endl;
+    }
+
+    if(!strReport.empty())
+    {
+        ofstream f(strReport.c_str());
+        f << fixed << setprecision(3);
+        f << "{" << endl;
+        f << "  \"features_per_keyframe\": " << params.nFeatures << "," << endl;
+        f << "  \"ba_engine\": " << JsonString(baEngine==ORB_SLAM3::OptimizerSettings::VISUAL_BA_NATIVE ? "native" : "g2o") << "," << endl;
+        f << "  \"ba_precision\": " << JsonString(bSinglePrecision ? "single" : "double") << "," << endl;
+        f << "  \"global_shortlist\": " << nShortlist << "," << endl;
+        f << "  \"seed\": " << params.nSeed << "," << endl;
+        f << "  \"benchmarks\": [";
+        for(size_t i=0; i<vResults.size(); i++)
+        {
+            const BenchResult &r = vResults[i];
+            f << (i==0 ? "" : ",") << endl;
+            f << "    {\"name\": " << JsonString(r.name) << ", \"keyframes\": " << r.size << ", \"threads\": " << r.threads
+              << ", \"iterations\": " << r.iterations << ", \"mean_us\": " << r.mean << ", \"median_us\": " << r.median
+              << ", \"min_us\": " << r.min << ", \"info\": " << JsonString(r.info) << "}";
+        }
+        f << endl << "  ]," << endl;
+        f << "  \"complexity\": [";
+        for(size_t i=0; i<vComplexity.size(); i++)
+        {
+            const Complexity &c = vComplexity[i];
+            f << (i==0 ? "" : ",") << endl;
+            f << "    {\"name\": " << JsonString(c.name) << ", \"threads\": " << c.threads << ", \"sizes\": " << c.nSizes
+              << ", \"exponent\": " << c.exponent << "}";
+        }
+        f << endl << "  ]" << endl << "}" << endl;
+        if(!f.good())
+        {
+            cerr << "ERROR: Cannot write the report " << strReport << endl;
+            return 1;
+        }
+        cout << "Scaling report saved to " << strReport << endl;
+    }
+
+    delete pVocabulary;
+    return 0;
+}
+
+SyntheticMapBuilder::SyntheticMapBuilder(ORB_SLAM3::ORBVocabulary* pVoc, const SyntheticParams &params):
+    mpVoc(pVoc), mParams(params), mRng(params.nSeed), fx(458.654f), fy(457.296f), cx(367.215f), cy(248.375f),
+    mnWidth(752), mnHeight(480), mnLevels(8), mRadius(0), mnKeyFrames(0), mfObsProb(1.f)
+{
+    mvScaleFactors.resize(mnLevels);
+    mvInvScaleFactors.resize(mnLevels);
+    mvLevelSigma2.resize(mnLevels);
+    mvInvLevelSigma2.resize(mnLevels);
+    for(int i=0; i<mnLevels; i++)
+    {
+        mvScaleFactors[i] = i==0 ? 1.f : mvScaleFactors[i-1]*1.2f;
+        mvInvScaleFactors[i] = 1.f/mvScaleFactors[i];
+        mvLevelSigma2[i] = mvScaleFactors[i]*mvScaleFactors[i];
+        mvInvLevelSigma2[i] = 1.f/mvLevelSigma2[i];
+    }
+}
+
+cv::Matx44f SyntheticMapBuilder::TruePose(const double s) const
+{
+    // Camera on the circle at azimuth theta, optical axis outwards, y axis down, height wobbling
+    const double theta = 2.0*M_PI*s/mnKeyFrames;
+    const double c = cos(theta), sn = sin(theta);
+    const cv::Matx31f Ow(mRadius*c, mRadius*sn, 0.3*sin(7.0*theta));
+    const cv::Matx33f Rwc(sn, 0.f, c,
+                          -c, 0.f, sn,
+                          0.f, -1.f, 0.f);
+    const cv::Matx33f Rcw = Rwc.t();
+    const cv::Matx31f tcw = -Rcw*Ow;
+    return cv::Matx44f(Rcw(0,0),Rcw(0,1),Rcw(0,2),tcw(0),
+                       Rcw(1,0),Rcw(1,1),Rcw(1,2),tcw(1),
+                       Rcw(2,0),Rcw(2,1),Rcw(2,2),tcw(2),
+                       0.f,0.f,0.f,1.f);
+}
+
+SyntheticMap* SyntheticMapBuilder::Build(const int nKeyFrames, const int nQueryFrames, const int nShortlist)
+{
+    SyntheticMap* pSMap = new SyntheticMap();
+    pSMap->pCamera = new ORB_SLAM3::Pinhole(vector<float>{fx,fy,cx,cy});
+    pSMap->pMap = new ORB_SLAM3::Map();
+    pSMap->pMap->SetSystemContext(&pSMap->context);
+    pSMap->pKFDB = new ORB_SLAM3::KeyFrameDatabase(*mpVoc);
+    pSMap->pKFDB->SetGlobalShortlist(nShortlist, 0);
+
+    mnKeyFrames = nKeyFrames;
+    mRadius = nKeyFrames*mParams.fSpacing/(2.0*M_PI);
+
+    // Wall between fMinDepth and fMaxDepth from the trajectory, as high as the image at mean depth. Each
+    // point would be seen by nSeen keyframes, it is observed by fObsPerPoint of them; the density gives
+    // nFeatures observations per keyframe
+    const float fMeanDepth = 0.5f*(mParams.fMinDepth+mParams.fMaxDepth);
+    const float fHalfWidth = fMeanDepth*cx/fx;
+    const float fHalfHeight = fMeanDepth*cy/fy;
+    const float nSeen = max(1.f, 2.f*fHalfWidth/mParams.fSpacing);
+    mfObsProb = min(1.f, mParams.fObsPerPoint/nSeen);
+    const float fDensity = mParams.nFeatures/(mfObsProb*4.f*fHalfWidth*fHalfHeight);
+    const size_t nLandmarks = fDensity*2.0*M_PI*(mRadius+fMeanDepth)*2.f*fHalfHeight;
+
+    uniform_real_distribution<float> uniform(0.f,1.f);
+    uniform_int_distribution<int> randomByte(0,255);
+    const unsigned int nWords = mpVoc->size();
+    mvLandmarks.resize(nLandmarks);
+    for(size_t i=0; i<nLandmarks; i++)
+    {
+        Landmark &l = mvLandmarks[i];
+        l.azimuth = 2.f*M_PI*uniform(mRng);
+        const float r = mRadius + mParams.fMinDepth + (mParams.fMaxDepth-mParams.fMinDepth)*uniform(mRng);
+        l.pos = cv::Point3f(r*cos(l.azimuth), r*sin(l.azimuth), fHalfHeight*(2.f*uniform(mRng)-1.f));
+        // Some words are much more frequent than others, as in real images
+        const float u = uniform(mRng);
+        l.wordId = min(nWords-1, (unsigned int)(nWords*u*u));
+        l.nodeId = mpVoc->getParentNode(l.wordId, 4);
+        for(int b=0; b<32; b++)
+            l.desc[b] = randomByte(mRng);
+    }
+    sort(mvLandmarks.begin(), mvLandmarks.end(), [](const Landmark &a, const Landmark &b){ return a.azimuth<b.azimuth; });
+    mvAzimuths.resize(nLandmarks);
+    for(size_t i=0; i<nLandmarks; i++)
+        mvAzimuths[i] = mvLandmarks[i].azimuth;
+
+    // Keyframes in order. A point is created at its second observation, with the first observer as
+    // reference, and the connections of each keyframe are updated once its observations are in, so
+    // the parent in the spanning tree is always an older keyframe
+    normal_distribution<float> poseNoise(0.f, mParams.fPoseNoise);
+    normal_distribution<float> pointNoise(0.f, mParams.fPointNoise);
+    vector<ORB_SLAM3::MapPoint*> vpLandmarkMPs(nLandmarks, static_cast<ORB_SLAM3::MapPoint*>(NULL));
+    vector<pair<ORB_SLAM3::KeyFrame*,int> > vFirstObservation(nLandmarks, make_pair(static_cast<ORB_SLAM3::KeyFrame*>(NULL),-1));
+    pSMap->vpKFs.reserve(nKeyFrames);
+    for(int k=0; k<nKeyFrames; k++)
+    {
+        ORB_SLAM3::Frame F;
+        vector<int> vLandmarkIds;
+        const cv::Matx44f Tcw = TruePose(k);
+        MakeFrame(Tcw, k*0.5, pSMap, F, vLandmarkIds);
+
+        // Estimated pose, slightly off (the first keyframe is the origin of the map)
+        if(k>0)
+        {
+            cv::Matx44f Tcw_ = Tcw;
+            const cv::Matx31f dt(poseNoise(mRng), poseNoise(mRng), poseNoise(mRng));
+            const cv::Matx31f tcw = Tcw.get_minor<3,1>(0,3) - Tcw.get_minor<3,3>(0,0)*dt;
+            Tcw_(0,3) = tcw(0); Tcw_(1,3) = tcw(1); Tcw_(2,3) = tcw(2);
+            F.mTcw = cv::Mat(Tcw_).clone();
+        }
+
+        ORB_SLAM3::KeyFrame* pKF = new ORB_SLAM3::KeyFrame(F, pSMap->pMap, pSMap->pKFDB);
+        pSMap->pMap->AddKeyFrame(pKF);
+        if(k==0)
+            pSMap->pMap->mvpKeyFrameOrigins.push_back(pKF);
+        pSMap->vpKFs.push_back(pKF);
+        pSMap->vTrueCenters.push_back(-Tcw.get_minor<3,3>(0,0).t()*Tcw.get_minor<3,1>(0,3));
+
+        for(size_t i=0; i<vLandmarkIds.size(); i++)
+        {
+            const int l = vLandmarkIds[i];
+            ORB_SLAM3::MapPoint* pMP = vpLandmarkMPs[l];
+            if(!pMP)
+            {
+                if(!vFirstObservation[l].first)
+                {
+                    vFirstObservation[l] = make_pair(pKF,(int)i);
+                    continue;
+                }
+                const cv::Point3f &X = mvLandmarks[l].pos;
+                const cv::Mat x3D = (cv::Mat_<float>(3,1) << X.x+pointNoise(mRng), X.y+pointNoise(mRng), X.z+pointNoise(mRng));
+                ORB_SLAM3::KeyFrame* pRefKF = vFirstObservation[l].first;
+                pMP = new ORB_SLAM3::MapPoint(x3D, pRefKF, pSMap->pMap);
+                pMP->AddObservation(pRefKF, vFirstObservation[l].second);
+                pRefKF->AddMapPoint(pMP, vFirstObservation[l].second);
+                pSMap->pMap->AddMapPoint(pMP);
+                pSMap->vpMPs.push_back(pMP);
+                vpLandmarkMPs[l] = pMP;
+            }
+            pMP->AddObservation(pKF, i);
+            pKF->AddMapPoint(pMP, i);
+        }
+        pKF->UpdateConnections();
+    }
+
+    // Final weights of the covisibility graph, then the points and the database as after Local Mapping
+    for(size_t i=0; i<pSMap->vpKFs.size(); i++)
+        pSMap->vpKFs[i]->UpdateConnections(false);
+    for(size_t i=0; i<pSMap->vpMPs.size(); i++)
+    {
+        pSMap->vpMPs[i]->ComputeDistinctiveDescriptors();
+        pSMap->vpMPs[i]->UpdateNormalAndDepth();
+    }
+    for(size_t i=0; i<pSMap->vpKFs.size(); i++)
+        pSMap->pKFDB->add(pSMap->vpKFs[i]);
+
+    // Frames halfway between keyframes, for relocalization. Built in place, frames are not copied
+    uniform_int_distribution<int> keyframe(0, nKeyFrames-1);
+    pSMap->vQueryFrames.reserve(nQueryFrames);
+    for(int q=0; q<nQueryFrames; q++)
+    {
+        const double s = keyframe(mRng) + 0.5;
+        pSMap->vQueryFrames.emplace_back();
+        vector<int> vLandmarkIds;
+        MakeFrame(TruePose(s), s*0.5, pSMap, pSMap->vQueryFrames.back(), vLandmarkIds);
+    }
+
+    mvLandmarks.clear();
+    mvAzimuths.clear();
+    return pSMap;
+}
+
+void SyntheticMapBuilder::MakeFrame(const cv::Matx44f &Tcw, const double timestamp, SyntheticMap* pSMap,
+                                    ORB_SLAM3::Frame &F, vector<int> &vLandmarkIds)
+{
+    const cv::Matx33f Rcw = Tcw.get_minor<3,3>(0,0);
+    const cv::Matx31f tcw = Tcw.get_minor<3,1>(0,3);
+    const cv::Matx31f Ow = -Rcw.t()*tcw;
+
+    // Landmarks in the azimuth range that can be in the image
+    const float azimuth = atan2(Ow(1),Ow(0));
+    const float fHalfRange = min((float)M_PI, (float)((mParams.fMaxDepth*cx/fx + 1.0)/mRadius));
+    vector<pair<float,float> > vRanges;
+    float a0 = azimuth - fHalfRange, a1 = azimuth + fHalfRange;
+    if(a0<0)
+        a0 += 2.f*M_PI, a1 += 2.f*M_PI;
+    if(a1>2.f*M_PI)
+    {
+        vRanges.push_back(make_pair(a0,(float)(2.f*M_PI)));
+        vRanges.push_back(make_pair(0.f,a1-(float)(2.f*M_PI)));
+    }
+    else
+        vRanges.push_back(make_pair(a0,a1));
+
+    uniform_real_distribution<float> uniform(0.f,1.f);
+    normal_distribution<float> pixelNoise(0.f, mParams.fPixelNoise);
+    // Octave 0 for half of the keypoints, then fewer at each level
+    vector<double> vLevelWeights(mnLevels);
+    for(int i=0; i<mnLevels; i++)
+        vLevelWeights[i] = pow(0.5,i);
+    discrete_distribution<int> octave(vLevelWeights.begin(), vLevelWeights.end());
+    uniform_int_distribution<int> bit(0,255);
+
+    vector<cv::KeyPoint> vKeys;
+    vLandmarkIds.clear();
+    for(size_t r=0; r<vRanges.size(); r++)
+    {
+        const size_t begin = lower_bound(mvAzimuths.begin(), mvAzimuths.end(), vRanges[r].first) - mvAzimuths.begin();
+        const size_t end = upper_bound(mvAzimuths.begin(), mvAzimuths.end(), vRanges[r].second) - mvAzimuths.begin();
+        for(size_t i=begin; i<end; i++)
+        {
+            const cv::Point3f &X = mvLandmarks[i].pos;
+            const cv::Matx31f x3Dc = Rcw*cv::Matx31f(X.x,X.y,X.z) + tcw;
+            if(x3Dc(2)<0.1f)
+                continue;
+            const float u = fx*x3Dc(0)/x3Dc(2) + cx;
+            const float v = fy*x3Dc(1)/x3Dc(2) + cy;
+            if(u<0 || u>=mnWidth || v<0 || v>=mnHeight || uniform(mRng)>mfObsProb)
+                continue;
+
+            const int level = octave(mRng);
+            const float scale = mvScaleFactors[level];
+            const float un = min(max(u + scale*pixelNoise(mRng), 0.f), mnWidth-1.f);
+            const float vn = min(max(v + scale*pixelNoise(mRng), 0.f), mnHeight-1.f);
+            vKeys.push_back(cv::KeyPoint(un, vn, 31.f*scale, 360.f*uniform(mRng), 1.f, level));
+            vLandmarkIds.push_back(i);
+        }
+    }
+
+    const int N = vKeys.size();
+    F.mpContext = &pSMap->context;
+    F.mnId = pSMap->context.mnNextFrameId++;
+    F.mTimeStamp = timestamp;
+    F.mpORBvocabulary = mpVoc;
+    F.mpCamera = pSMap->pCamera;
+    F.mpCamera2 = static_cast<ORB_SLAM3::GeometricCamera*>(NULL);
+    F.mK = static_cast<ORB_SLAM3::Pinhole*>(pSMap->pCamera)->toK();
+    F.mDistCoef = cv::Mat::zeros(4,1,CV_32F);
+    F.fx = fx; F.fy = fy; F.cx = cx; F.cy = cy;
+    F.invfx = 1.f/fx; F.invfy = 1.f/fy;
+    F.mbf = 0.f; F.mb = 0.f; F.mThDepth = 0.f;
+    F.mnMinX = 0.f; F.mnMaxX = mnWidth; F.mnMinY = 0.f; F.mnMaxY = mnHeight;
+    F.mnGridCols = FRAME_GRID_COLS; F.mnGridRows = FRAME_GRID_ROWS;
+    F.mfGridElementWidthInv = static_cast<float>(F.mnGridCols)/mnWidth;
+    F.mfGridElementHeightInv = static_cast<float>(F.mnGridRows)/mnHeight;
+    F.mnScaleLevels = mnLevels;
+    F.mfScaleFactor = 1.2f;
+    F.mfLogScaleFactor = log(1.2f);
+    F.mvScaleFactors = mvScaleFactors;
+    F.mvInvScaleFactors = mvInvScaleFactors;
+    F.mvLevelSigma2 = mvLevelSigma2;
+    F.mvInvLevelSigma2 = mvInvLevelSigma2;
+    F.mnDataset = 0;
+    F.Nleft = -1;
+    F.Nright = -1;
+    F.mTlr = cv::Mat::eye(4,4,CV_32F);
+    F.mTcw = cv::Mat(Tcw).clone();
+
+    F.N = N;
+    F.mvKeys = vKeys;
+    F.mvKeysUn = F.mvKeys;
+    F.mvuRight = vector<float>(N,-1.f);
+    F.mvDepth = vector<float>(N,-1.f);
+    F.mvpMapPoints = vector<ORB_SLAM3::MapPoint*>(N,static_cast<ORB_SLAM3::MapPoint*>(NULL));
+    F.mvbOutlier = vector<bool>(N,false);
+
+    // Descriptor of the landmark with a few bits flipped, and its word
+    F.mDescriptors.create(N,32,CV_8U);
+    for(int i=0; i<N; i++)
+    {
+        const Landmark &l = mvLandmarks[vLandmarkIds[i]];
+        unsigned char* pDesc = F.mDescriptors.ptr<unsigned char>(i);
+        for(int b=0; b<32; b++)
+            pDesc[b] = l.desc[b];
+        for(int f=0; f<8; f++)
+        {
+            const int nBit = bit(mRng);
+            pDesc[nBit/8] ^= (unsigned char)(1 << (nBit%8));
+        }
+        F.mBowVec.addWeight(l.wordId, mpVoc->getWordWeight(l.wordId));
+        F.mFeatVec.addFeature(l.nodeId, i);
+    }
+    F.mBowVec.normalize(DBoW2::L1);
+    F.mFlatFeatVec.Build(F.mFeatVec);
+
+    // Grid, as Frame::AssignFeaturesToGrid
+    F.mKeysSoA.Assign(F.mvKeysUn);
+    vector<int> vCells(N);
+    for(int i=0; i<N; i++)
+    {
+        int nGridPosX, nGridPosY;
+        vCells[i] = F.PosInGrid(vKeys[i],nGridPosX,nGridPosY) ? nGridPosX*F.mnGridRows + nGridPosY : -1;
+    }
+    F.mGrid.Build(F.mnGridCols, F.mnGridRows, vCells.data(), N);
+}
+
+void SyntheticMapBuilder::Release(SyntheticMap* pSMap)
+{
+    delete pSMap->pKFDB;
+    delete pSMap->pMap;
+    for(size_t i=0; i<pSMap->vpMPs.size(); i++)
+        delete pSMap->vpMPs[i];
+    for(size_t i=0; i<pSMap->vpKFs.size(); i++)
+        delete pSMap->vpKFs[i];
+    delete pSMap->pCamera;
+    delete pSMap;
+}
+
+BenchResult RunBenchmark(const string &name, const int nIterations, const function<void()> &run, const function<void()> &reset)
+{
+    vector<double> vTimes;
+    vTimes.reserve(nIterations);
+
+    // First run to warm up
+    for(int i=-1; i<nIterations; i++)
+    {
+        if(reset)
+            reset();
+
+        const std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+        run();
+        const std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+
+        if(i>=0)
+            vTimes.push_back(std::chrono::duration_cast<std::chrono::duration<double,std::micro> >(t2 - t1).count());
+    }
+
+    BenchResult r;
+    r.name = name;
+    r.size = 0;
+    r.threads = 1;
+    r.iterations = nIterations;
+    double sum = 0;
+    for(size_t i=0; i<vTimes.size(); i++)
+        sum += vTimes[i];
+    r.mean = sum/vTimes.size();
+    sort(vTimes.begin(), vTimes.end());
+    r.median = vTimes[vTimes.size()/2];
+    r.min = vTimes.front();
+    return r;
+}
+
+double CenterError(const SyntheticMap* pSMap)
+{
+    double sum = 0.0;
+    for(size_t i=0; i<pSMap->vpKFs.size(); i++)
+    {
+        const cv::Matx31f Ow = pSMap->vpKFs[i]->GetCameraCenter_();
+        const cv::Matx31f d = Ow - pSMap->vTrueCenters[i];
+        sum += d.dot(d);
+    }
+    return pSMap->vpKFs.empty() ? 0.0 : 1000.0*sqrt(sum/pSMap->vpKFs.size());
+}
+
+string JsonString(const string &s)
+{
+    string out = "\"";
+    for(size_t i=0; i<s.size(); i++)
+    {
+        if(s[i]=='"' || s[i]=='\\')
+            out += '\\';
+        out += s[i];
+    }
+    return out + "\"";
+}
+
+vector<int> ParseList(const string &s)
+{
+    vector<int> v;
+    stringstream ss(s);
+    string item;
+    while(getline(ss, item, ','))
+        if(!item.empty())
+            v.push_back(atoi(item.c_str()));
+    return v;
+}
@@ -0,0 +1,534 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include<iostream>
+#include<algorithm>
+#include<fstream>
+#include<iomanip>
+#include<sstream>
+#include<chrono>
+#include<functional>
+#include<set>
+
+#include<opencv2/core/core.hpp>
+#include<opencv2/imgproc/imgproc.hpp>
+#include<opencv2/highgui/highgui.hpp>
+
+#include<System.h>
+#include<ORBextractor.h>
+#include<ORBmatcher.h>
+#include<Optimizer.h>
+#include<Converter.h>
+#include"CameraModels/Pinhole.h"
+
+using namespace std;
+
+// Microbenchmarks of the feature and optimization kernels on captured inputs, so that results are
+// comparable between builds: an image (or a rectified stereo pair) and, optionally, an atlas saved
+// with System::SaveAtlas from the same sequence. The image kernels run on the image; the matching
+// and optimization kernels run on the atlas, and those that need a frame on the image localized in
+// the atlas. Every kernel runs once to warm up and then nIterations times; state modified by a
+// kernel (poses, matches) is restored before each run, outside of the timed section.
+
+struct BenchResult
+{
+    string name;
+    int iterations;
+    double mean, median, min; // us
+    string info;
+};
+
+BenchResult RunBenchmark(const string &name, const int nIterations, const function<void()> &run,
+                         const function<void()> &reset = function<void()>());
+string JsonString(const string &s);
+
+int main(int argc, char **argv)
+{
+    if(argc < 4)
+    {
+        cerr << endl << "Usage: ./orb_microbench path_to_vocabulary path_to_settings path_to_image_left [path_to_image_right] "
+             << "[--atlas path_to_atlas] [--iterations N] [--report path_to_report]" << endl;
+        return 1;
+    }
+
+    const string strVocabulary(argv[1]);
+    const string strSettings(argv[2]);
+    const string strImageLeft(argv[3]);
+    string strImageRight, strAtlas, strReport;
+    int nIterations = 100;
+    for(int i=4; i<argc; i++)
+    {
+        const string arg(argv[i]);
+        if(arg=="--atlas" && i+1<argc)
+            strAtlas = argv[++i];
+        else if(arg=="--iterations" && i+1<argc)
+            nIterations = max(1, atoi(argv[++i]));
+        else if(arg=="--report" && i+1<argc)
+            strReport = argv[++i];
+        else if(strImageRight.empty() && arg.compare(0,2,"--")!=0)
+            strImageRight = arg;
+        else
+        {
+            cerr << "Unknown argument: " << arg << endl;
+            return 1;
+        }
+    }
+    const bool bStereo = !strImageRight.empty();
+
+    // Input images
+    cv::Mat imLeft = cv::imread(strImageLeft, cv::IMREAD_GRAYSCALE);
+    cv::Mat imRight;
+    if(bStereo)
+        imRight = cv::imread(strImageRight, cv::IMREAD_GRAYSCALE);
+    if(imLeft.empty() || (bStereo && imRight.empty()))
+    {
+        cerr << "ERROR: Failed to load the images" << endl;
+        return 1;
+    }
+
+    // Calibration and extractor parameters (pinhole cameras only)
+    cv::FileStorage fsSettings(strSettings, cv::FileStorage::READ);
+    if(!fsSettings.isOpened())
+    {
+        cerr << "ERROR: Wrong path to settings" << endl;
+        return 1;
+    }
+    const string strCameraType = fsSettings["Camera.type"];
+    if(strCameraType!="PinHole")
+    {
+        cerr << "ERROR: Only pinhole cameras are supported" << endl;
+        return 1;
+    }
+
+    const float fx = fsSettings["Camera.fx"];
+    const float fy = fsSettings["Camera.fy"];
+    const float cx = fsSettings["Camera.cx"];
+    const float cy = fsSettings["Camera.cy"];
+
+    cv::Mat K = cv::Mat::eye(3,3,CV_32F);
+    K.at<float>(0,0) = fx;
+    K.at<float>(1,1) = fy;
+    K.at<float>(0,2) = cx;
+    K.at<float>(1,2) = cy;
+
+    cv::Mat DistCoef(4,1,CV_32F);
+    DistCoef.at<float>(0) = fsSettings["Camera.k1"];
+    DistCoef.at<float>(1) = fsSettings["Camera.k2"];
+    DistCoef.at<float>(2) = fsSettings["Camera.p1"];
+    DistCoef.at<float>(3) = fsSettings["Camera.p2"];
+    const float k3 = fsSettings["Camera.k3"];
+    if(k3!=0)
+    {
+        DistCoef.resize(5);
+        DistCoef.at<float>(4) = k3;
+    }
+
+    float bf = 0, thDepth = 0;
+    if(bStereo)
+    {
+        bf = fsSettings["Camera.bf"];
+        const float th = fsSettings["ThDepth"];
+        thDepth = bf*th/fx;
+
+        // Rectify as the EuRoC examples when the settings have it
+        cv::Mat K_l, K_r, P_l, P_r, R_l, R_r, D_l, D_r;
+        fsSettings["LEFT.K"] >> K_l;
+        fsSettings["RIGHT.K"] >> K_r;
+        fsSettings["LEFT.P"] >> P_l;
+        fsSettings["RIGHT.P"] >> P_r;
+        fsSettings["LEFT.R"] >> R_l;
+        fsSettings["RIGHT.R"] >> R_r;
+        fsSettings["LEFT.D"] >> D_l;
+        fsSettings["RIGHT.D"] >> D_r;
+
+        int rows_l = fsSettings["LEFT.height"];
+        int cols_l = fsSettings["LEFT.width"];
+        int rows_r = fsSettings["RIGHT.height"];
+        int cols_r = fsSettings["RIGHT.width"];
+
+        if(!K_l.empty() && !K_r.empty() && !P_l.empty() && !P_r.empty() && !R_l.empty() && !R_r.empty() && !D_l.empty() && !D_r.empty() &&
+                rows_l>0 && rows_r>0 && cols_l>0 && cols_r>0)
+        {
+            cv::Mat M1l,M2l,M1r,M2r;
+            cv::initUndistortRectifyMap(K_l,D_l,R_l,P_l.rowRange(0,3).colRange(0,3),cv::Size(cols_l,rows_l),CV_32F,M1l,M2l);
+            cv::initUndistortRectifyMap(K_r,D_r,R_r,P_r.rowRange(0,3).colRange(0,3),cv::Size(cols_r,rows_r),CV_32F,M1r,M2r);
+
+            cv::Mat imLeftRect, imRightRect;
+            cv::remap(imLeft,imLeftRect,M1l,M2l,cv::INTER_LINEAR);
+            cv::remap(imRight,imRightRect,M1r,M2r,cv::INTER_LINEAR);
+            imLeft = imLeftRect;
+            imRight = imRightRect;
+        }
+    }
+
+    const int nFeatures = fsSettings["ORBextractor.nFeatures"];
+    const float fScaleFactor = fsSettings["ORBextractor.scaleFactor"];
+    const int nLevels = fsSettings["ORBextractor.nLevels"];
+    const int fIniThFAST = fsSettings["ORBextractor.iniThFAST"];
+    const int fMinThFAST = fsSettings["ORBextractor.minThFAST"];
+
+    // The system loads the vocabulary and the atlas, no frame is tracked
+    const ORB_SLAM3::System::eSensor sensor = bStereo ? ORB_SLAM3::System::STEREO : ORB_SLAM3::System::MONOCULAR;
+    ORB_SLAM3::System SLAM(strVocabulary,strSettings,sensor,false,0,string(),strAtlas);
+    ORB_SLAM3::ORBVocabulary* pVocabulary = SLAM.GetVocabulary();
+
+    vector<BenchResult> vResults;
+
+    // ORBextractor::operator()
+    {
+        ORB_SLAM3::ORBextractor extractor(nFeatures,fScaleFactor,nLevels,fIniThFAST,fMinThFAST);
+        vector<cv::KeyPoint> vKeys;
+        cv::Mat descriptors;
+        vector<int> vLapping = {0,1000};
+        BenchResult r = RunBenchmark("ORBextractor", nIterations, [&]{
+            extractor(imLeft,cv::Mat(),vKeys,descriptors,vLapping);
+        });
+        r.info = to_string(vKeys.size()) + " keypoints";
+        vResults.push_back(r);
+    }
+
+    // Frame of the input images, for the frame kernels
+    ORB_SLAM3::ORBextractor extractorLeft(nFeatures,fScaleFactor,nLevels,fIniThFAST,fMinThFAST);
+    ORB_SLAM3::ORBextractor extractorRight(nFeatures,fScaleFactor,nLevels,fIniThFAST,fMinThFAST);
+    vector<float> vCamCalib{fx,fy,cx,cy};
+    ORB_SLAM3::GeometricCamera* pCamera = new ORB_SLAM3::Pinhole(vCamCalib);
+
+    ORB_SLAM3::Frame F;
+    if(bStereo)
+        F = ORB_SLAM3::Frame(imLeft,imRight,0.0,&extractorLeft,&extractorRight,pVocabulary,K,DistCoef,bf,thDepth,pCamera);
+    else
+        F = ORB_SLAM3::Frame(imLeft,0.0,&extractorLeft,pVocabulary,pCamera,DistCoef,bf,thDepth);
+
+    // ORBmatcher::DescriptorDistance, between the descriptors of the two images (or the left one)
+    {
+        const cv::Mat &A = F.mDescriptors;
+        const cv::Mat &B = bStereo ? F.mDescriptorsRight : F.mDescriptors;
+        const int nA = min(A.rows, 500);
+        const int nB = min(B.rows, 500);
+        int sum = 0;
+        BenchResult r = RunBenchmark("DescriptorDistance", nIterations, [&]{
+            for(int i=0; i<nA; i++)
+                for(int j=0; j<nB; j++)
+                    sum += ORB_SLAM3::ORBmatcher::DescriptorDistance(A.row(i),B.row(j));
+        });
+        r.info = to_string(nA*nB) + " pairs per run";
+        vResults.push_back(r);
+    }
+
+    // Frame::ComputeStereoMatches
+    if(bStereo)
+    {
+        BenchResult r = RunBenchmark("ComputeStereoMatches", nIterations, [&]{
+            F.ComputeStereoMatches();
+        });
+        int nDepth = 0;
+        for(int i=0; i<F.N; i++)
+            if(F.mvDepth[i]>0)
+                nDepth++;
+        r.info = to_string(nDepth) + " of " + to_string(F.N) + " matched";
+        vResults.push_back(r);
+    }
+
+    // TemplatedVocabulary::transform
+    {
+        const vector<cv::Mat> vDesc = ORB_SLAM3::Converter::toDescriptorVector(F.mDescriptors);
+        DBoW2::BowVector bowVec;
+        DBoW2::FeatureVector featVec;
+        BenchResult r = RunBenchmark("Vocabulary::transform", nIterations, [&]{
+            pVocabulary->transform(vDesc,bowVec,featVec,4);
+        });
+        r.info = to_string(vDesc.size()) + " descriptors";
+        vResults.push_back(r);
+    }
+    F.ComputeBoW();
+
+    // Map kernels on the biggest map of the atlas
+    ORB_SLAM3::Map* pMap = NULL;
+    if(!strAtlas.empty())
+    {
+        vector<ORB_SLAM3::Map*> vpMaps = SLAM.GetAtlas()->GetAllMaps();
+        for(size_t i=0; i<vpMaps.size(); i++)
+            if(!pMap || vpMaps[i]->KeyFramesInMap()>pMap->KeyFramesInMap())
+                pMap = vpMaps[i];
+        if(pMap && pMap->KeyFramesInMap()<2)
+            pMap = NULL;
+        if(!pMap)
+            cerr << "The atlas has no map with keyframes, map kernels skipped" << endl;
+    }
+
+    if(pMap)
+    {
+        vector<ORB_SLAM3::KeyFrame*> vpKFs = pMap->GetAllKeyFrames();
+        sort(vpKFs.begin(),vpKFs.end(),ORB_SLAM3::KeyFrame::lId);
+
+        // Keyframe with the largest covisibility, as a local window in the middle of the map
+        ORB_SLAM3::KeyFrame* pKF = NULL;
+        for(size_t i=0; i<vpKFs.size(); i++)
+            if(!vpKFs[i]->isBad() && (!pKF || vpKFs[i]->GetVectorCovisibleKeyFrames().size()>pKF->GetVectorCovisibleKeyFrames().size()))
+                pKF = vpKFs[i];
+        const vector<ORB_SLAM3::KeyFrame*> vpCovKFs = pKF->GetBestCovisibilityKeyFrames(10);
+
+        // ORBmatcher::SearchByBoW between covisible keyframes (loop closing, map merging)
+        if(!vpCovKFs.empty())
+        {
+            ORB_SLAM3::ORBmatcher matcher(0.75,true);
+            vector<ORB_SLAM3::MapPoint*> vpMatches;
+            int nMatches = 0;
+            BenchResult r = RunBenchmark("SearchByBoW(KF,KF)", nIterations, [&]{
+                nMatches = matcher.SearchByBoW(pKF,vpCovKFs[0],vpMatches);
+            });
+            r.info = to_string(nMatches) + " matches";
+            vResults.push_back(r);
+        }
+
+        // ORBmatcher::SearchByProjection of the covisible map points into a keyframe (loop closing)
+        {
+            set<ORB_SLAM3::MapPoint*> sPoints;
+            for(size_t i=0; i<vpCovKFs.size(); i++)
+            {
+                const vector<ORB_SLAM3::MapPoint*> vpMPs = vpCovKFs[i]->GetMapPointMatches();
+                for(size_t j=0; j<vpMPs.size(); j++)
+                    if(vpMPs[j] && !vpMPs[j]->isBad())
+                        sPoints.insert(vpMPs[j]);
+            }
+            const vector<ORB_SLAM3::MapPoint*> vpPoints(sPoints.begin(),sPoints.end());
+            const cv::Mat Scw = pKF->GetPose();
+
+            ORB_SLAM3::ORBmatcher matcher(0.75,true);
+            vector<ORB_SLAM3::MapPoint*> vpMatched;
+            int nMatches = 0;
+            BenchResult r = RunBenchmark("SearchByProjection(KF)", nIterations, [&]{
+                nMatches = matcher.SearchByProjection(pKF,Scw,vpPoints,vpMatched,10);
+            }, [&]{
+                vpMatched.assign(pKF->GetMapPointMatches().size(),static_cast<ORB_SLAM3::MapPoint*>(NULL));
+            });
+            r.info = to_string(nMatches) + " of " + to_string(vpPoints.size()) + " points";
+            vResults.push_back(r);
+        }
+
+        // Frame kernels on the input image, localized against the keyframe with most BoW matches
+        ORB_SLAM3::KeyFrame* pRefKF = NULL;
+        vector<ORB_SLAM3::MapPoint*> vpRefMatches;
+        {
+            ORB_SLAM3::ORBmatcher matcher(0.75,true);
+            int nBest = 0;
+            for(size_t i=0; i<vpKFs.size(); i++)
+            {
+                if(vpKFs[i]->isBad())
+                    continue;
+                vector<ORB_SLAM3::MapPoint*> vpMatches;
+                const int n = matcher.SearchByBoW(vpKFs[i],F,vpMatches);
+                if(n>nBest)
+                {
+                    nBest = n;
+                    pRefKF = vpKFs[i];
+                    vpRefMatches = vpMatches;
+                }
+            }
+            if(nBest<15)
+            {
+                cerr << "The image could not be localized in the atlas (" << nBest << " matches), frame kernels skipped" << endl;
+                pRefKF = NULL;
+            }
+        }
+
+        if(pRefKF)
+        {
+            // ORBmatcher::SearchByBoW between keyframe and frame (relocalization, reference keyframe tracking)
+            {
+                ORB_SLAM3::ORBmatcher matcher(0.7,true);
+                vector<ORB_SLAM3::MapPoint*> vpMatches;
+                int nMatches = 0;
+                BenchResult r = RunBenchmark("SearchByBoW(KF,Frame)", nIterations, [&]{
+                    nMatches = matcher.SearchByBoW(pRefKF,F,vpMatches);
+                });
+                r.info = to_string(nMatches) + " matches";
+                vResults.push_back(r);
+            }
+
+            // Optimizer::PoseOptimization from the reference keyframe pose
+            const cv::Mat Tcw0 = pRefKF->GetPose();
+            int nInliers = 0;
+            {
+                BenchResult r = RunBenchmark("PoseOptimization", nIterations, [&]{
+                    nInliers = ORB_SLAM3::Optimizer::PoseOptimization(&F);
+                }, [&]{
+                    F.SetPose(Tcw0);
+                    F.mvpMapPoints = vpRefMatches;
+                    F.mvbOutlier.assign(F.N,false);
+                });
+                r.info = to_string(nInliers) + " inliers";
+                vResults.push_back(r);
+            }
+
+            // ORBmatcher::SearchByProjection of the local map into the frame (track local map)
+            cv::Mat Tcw;
+            F.GetPose(Tcw);
+            vector<ORB_SLAM3::MapPoint*> vpInliers = F.mvpMapPoints;
+            for(int i=0; i<F.N; i++)
+                if(F.mvbOutlier[i])
+                    vpInliers[i] = static_cast<ORB_SLAM3::MapPoint*>(NULL);
+
+            set<ORB_SLAM3::MapPoint*> sLocalPoints;
+            vector<ORB_SLAM3::KeyFrame*> vpLocalKFs = pRefKF->GetBestCovisibilityKeyFrames(10);
+            vpLocalKFs.push_back(pRefKF);
+            for(size_t i=0; i<vpLocalKFs.size(); i++)
+            {
+                const vector<ORB_SLAM3::MapPoint*> vpMPs = vpLocalKFs[i]->GetMapPointMatches();
+                for(size_t j=0; j<vpMPs.size(); j++)
+                    if(vpMPs[j] && !vpMPs[j]->isBad())
+                        sLocalPoints.insert(vpMPs[j]);
+            }
+            const vector<ORB_SLAM3::MapPoint*> vpLocalPoints(sLocalPoints.begin(),sLocalPoints.end());
+            const set<ORB_SLAM3::MapPoint*> sInliers(vpInliers.begin(),vpInliers.end());
+
+            {
+                ORB_SLAM3::ORBmatcher matcher(0.8);
+                int nMatches = 0;
+                BenchResult r = RunBenchmark("SearchByProjection(Frame)", nIterations, [&]{
+                    nMatches = matcher.SearchByProjection(F,vpLocalPoints,3);
+                }, [&]{
+                    F.SetPose(Tcw);
+                    F.mvpMapPoints = vpInliers;
+                    for(size_t i=0; i<vpLocalPoints.size(); i++)
+                    {
+                        ORB_SLAM3::MapPoint* pMP = vpLocalPoints[i];
+                        pMP->mbTrackInViewR = false;
+                        pMP->mbTrackInView = !sInliers.count(pMP) && F.isInFrustum(pMP,0.5);
+                    }
+                });
+                r.info = to_string(nMatches) + " of " + to_string(vpLocalPoints.size()) + " points";
+                vResults.push_back(r);
+            }
+        }
+
+        // Optimizer::LocalBundleAdjustment on the window of pKF. The warm-up run removes the outlier
+        // observations, later runs start from the same poses and positions.
+        {
+            const vector<ORB_SLAM3::MapPoint*> vpMPs = pMap->GetAllMapPoints();
+            vector<cv::Mat> vKFPoses(vpKFs.size()), vMPPositions(vpMPs.size());
+            for(size_t i=0; i<vpKFs.size(); i++)
+                vKFPoses[i] = vpKFs[i]->GetPose();
+            for(size_t i=0; i<vpMPs.size(); i++)
+                vMPPositions[i] = vpMPs[i]->GetWorldPos();
+
+            bool bStopFlag = false;
+            int num_fixedKF, num_OptKF, num_MPs, num_edges;
+            BenchResult r = RunBenchmark("LocalBundleAdjustment", nIterations, [&]{
+                ORB_SLAM3::Optimizer::LocalBundleAdjustment(pKF,&bStopFlag,pMap,num_fixedKF,num_OptKF,num_MPs,num_edges);
+            }, [&]{
+                for(size_t i=0; i<vpKFs.size(); i++)
+                {
+                    vpKFs[i]->SetPose(vKFPoses[i]);
+                    vpKFs[i]->mnBALocalForKF = 0;
+                    vpKFs[i]->mnBAFixedForKF = 0;
+                }
+                for(size_t i=0; i<vpMPs.size(); i++)
+                {
+                    vpMPs[i]->SetWorldPos(vMPPositions[i]);
+                    vpMPs[i]->mnBALocalForKF = 0;
+                }
+            });
+            r.info = to_string(num_OptKF) + " local KFs, " + to_string(num_fixedKF) + " fixed KFs, " + to_string(num_MPs) + " points";
+            vResults.push_back(r);
+        }
+    }
+
+    SLAM.Shutdown();
+
+    // Report
+    cout << endl << left << setw(28) << "benchmark" << right << setw(8) << "runs" << setw(14) << "mean_us"
+         << setw(14) << "median_us" << setw(14) << "min_us" << "  info" << endl;
+    cout << fixed << setprecision(1);
+    for(size_t i=0; i<vResults.size(); i++)
+    {
+        const BenchResult &r = vResults[i];
+        cout << left << setw(28) << r.name << right << setw(8) << r.iterations << setw(14) << r.mean
+             << setw(14) << r.median << setw(14) << r.min << "  " << r.info << endl;
+    }
+
+    if(!strReport.empty())
+    {
+        ofstream f(strReport.c_str());
+        f << fixed << setprecision(3);
+        f << "{" << endl;
+        f << "  \"image\": " << JsonString(strImageLeft) << "," << endl;
+        f << "  \"atlas\": " << JsonString(strAtlas) << "," << endl;
+        f << "  \"benchmarks\": [";
+        for(size_t i=0; i<vResults.size(); i++)
+        {
+            const BenchResult &r = vResults[i];
+            f << (i==0 ? "" : ",") << endl;
+            f << "    {\"name\": " << JsonString(r.name) << ", \"iterations\": " << r.iterations << ", \"mean_us\": " << r.mean
+              << ", \"median_us\": " << r.median << ", \"min_us\": " << r.min << ", \"info\": " << JsonString(r.info) << "}";
+        }
+        f << endl << "  ]" << endl << "}" << endl;
+        if(!f.good())
+        {
+            cerr << "ERROR: Cannot write the report " << strReport << endl;
+            return 1;
+        }
+        cout << "Microbenchmark report saved to " << strReport << endl;
+    }
+
+    return 0;
+}
+
+BenchResult RunBenchmark(const string &name, const int nIterations, const function<void()> &run, const function<void()> &reset)
+{
+    vector<double> vTimes;
+    vTimes.reserve(nIterations);
+
+    // First run to warm up
+    for(int i=-1; i<nIterations; i++)
+    {
+        if(reset)
+            reset();
+
+        const std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+        run();
+        const std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+
+        if(i>=0)
+            vTimes.push_back(std::chrono::duration_cast<std::chrono::duration<double,std::micro> >(t2 - t1).count());
+    }
+
+    BenchResult r;
+    r.name = name;
+    r.iterations = nIterations;
+    double sum = 0;
+    for(size_t i=0; i<vTimes.size(); i++)
+        sum += vTimes[i];
+    r.mean = sum/vTimes.size();
+    sort(vTimes.begin(), vTimes.end());
+    r.median = vTimes[vTimes.size()/2];
+    r.min = vTimes.front();
+    return r;
+}
+
+string JsonString(const string &s)
+{
+    string out = "\"";
+    for(size_t i=0; i<s.size(); i++)
+    {
+        if(s[i]=='"' || s[i]=='\\')
+            out += '\\';
+        out += s[i];
+    }
+    return out + "\"";
+}
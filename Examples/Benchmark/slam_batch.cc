@@ -0,0 +1,385 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include<iostream>
+#include<algorithm>
+#include<fstream>
+#include<iomanip>
+#include<sstream>
+#include<chrono>
+#include<cstdlib>
+#include<thread>
+#include<mutex>
+#include<atomic>
+#include<pthread.h>
+#include<sched.h>
+#include<sys/resource.h>
+
+#include<opencv2/core/core.hpp>
+#include<opencv2/imgproc/imgproc.hpp>
+
+#include<System.h>
+#include<ImagePrefetcher.h>
+#include"ImuTypes.h"
+#include"BenchmarkCommon.h"
+
+using namespace std;
+
+// Headless runs of many sequences at once, for nightly regression. Each sequence gets its own
+// System, all sharing one vocabulary, and --jobs of them run concurrently. With --pin every job
+// slot is bound to its own block of --cores-per-job cores (the SLAM threads of the System inherit
+// the affinity of the thread that creates it). The report (JSON) has the timing and ATE of every
+// sequence and their aggregate.
+//
+// Sequence list: one sequence per line, "dataset sensor path_to_settings path_to_sequence [path_to_groundtruth]",
+// with the datasets and sensors of slam_benchmark. Lines starting with # are ignored.
+
+struct BatchEntry
+{
+    string strDataset, strSensor, strSettings, strSequence, strGroundTruth;
+};
+
+struct BatchResult
+{
+    bool bOk;
+    string strError;
+    int nFrames, nUntracked;
+    double wallTime;
+    vector<double> vTrackMs;
+    bool bAte;
+    AteStats ate;
+};
+
+bool LoadSequenceList(const string &strFile, vector<BatchEntry> &vEntries);
+void RunSequence(ORB_SLAM3::ORBVocabulary* pVocabulary, const BatchEntry &entry, const string &strTrajectory, BatchResult &result);
+bool PinToCores(const int nFirst, const int nCores, const int nTotalCores);
+
+int main(int argc, char **argv)
+{
+    if(argc < 3)
+    {
+        cerr << endl << "Usage: ./slam_batch path_to_vocabulary path_to_sequence_list "
+             << "[--jobs N] [--cores-per-job N] [--pin] [--output-dir path] [--report path_to_report]" << endl
+             << "  sequence list lines: dataset sensor path_to_settings path_to_sequence [path_to_groundtruth]" << endl
+             << "  jobs default to the number of cores over cores-per-job (default 4)" << endl;
+        return 1;
+    }
+
+    const string strVocabulary(argv[1]);
+    const string strList(argv[2]);
+
+    const int nTotalCores = max(1, (int)thread::hardware_concurrency());
+    int nJobs = 0, nCoresPerJob = 4;
+    bool bPin = false;
+    string strOutputDir(".");
+    string strReport;
+    for(int i=3; i<argc; i++)
+    {
+        const string arg(argv[i]);
+        if(arg=="--pin")
+            bPin = true;
+        else if(arg=="--jobs" && i+1<argc)
+            nJobs = atoi(argv[++i]);
+        else if(arg=="--cores-per-job" && i+1<argc)
+            nCoresPerJob = atoi(argv[++i]);
+        else if(arg=="--output-dir" && i+1<argc)
+            strOutputDir = argv[++i];
+        else if(arg=="--report" && i+1<argc)
+            strReport = argv[++i];
+        else
+        {
+            cerr << "Unknown argument: " << arg << endl;
+            return 1;
+        }
+    }
+    nCoresPerJob = max(1, min(nCoresPerJob, nTotalCores));
+    if(nJobs<=0)
+        nJobs = max(1, nTotalCores/nCoresPerJob);
+
+    vector<BatchEntry> vEntries;
+    if(!LoadSequenceList(strList, vEntries))
+    {
+        cerr << "ERROR: No sequences in " << strList << endl;
+        return 1;
+    }
+    nJobs = min(nJobs, (int)vEntries.size());
+    cout << vEntries.size() << " sequences, " << nJobs << " jobs of " << nCoresPerJob << " cores"
+         << (bPin ? " (pinned)" : "") << " on " << nTotalCores << " cores" << endl;
+
+    // One vocabulary for all the systems
+    ORB_SLAM3::ORBVocabulary* pVocabulary = ORB_SLAM3::System::LoadVocabulary(strVocabulary);
+    if(!pVocabulary)
+        return 1;
+
+    // Every job slot takes the next sequence of the list until there are none left
+    vector<BatchResult> vResults(vEntries.size());
+    atomic<size_t> nNext(0);
+    const chrono::steady_clock::time_point tStart = chrono::steady_clock::now();
+
+    vector<thread> vJobs;
+    for(int j=0; j<nJobs; j++)
+    {
+        vJobs.push_back(thread([&, j]()
+        {
+            if(bPin && !PinToCores(j*nCoresPerJob, nCoresPerJob, nTotalCores))
+                cerr << "Could not pin job " << j << " to its cores" << endl;
+
+            for(size_t i=nNext++; i<vEntries.size(); i=nNext++)
+            {
+                stringstream ss;
+                ss << strOutputDir << "/sequence" << setfill('0') << setw(3) << i << ".trajectory.txt";
+                RunSequence(pVocabulary, vEntries[i], ss.str(), vResults[i]);
+            }
+        }));
+    }
+    for(size_t j=0; j<vJobs.size(); j++)
+        vJobs[j].join();
+
+    const double wallTime = chrono::duration_cast<chrono::duration<double> >(chrono::steady_clock::now() - tStart).count();
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    const double peakRssMB = usage.ru_maxrss/1024.0; // kB on Linux
+
+    // Report
+    int nOk = 0, nFrames = 0, nUntracked = 0;
+    double sequenceTime = 0;
+    vector<double> vAllTrackMs, vRmse;
+    for(size_t i=0; i<vResults.size(); i++)
+    {
+        const BatchResult &r = vResults[i];
+        if(!r.bOk)
+            continue;
+        nOk++;
+        nFrames += r.nFrames;
+        nUntracked += r.nUntracked;
+        sequenceTime += r.wallTime;
+        vAllTrackMs.insert(vAllTrackMs.end(), r.vTrackMs.begin(), r.vTrackMs.end());
+        if(r.bAte)
+            vRmse.push_back(r.ate.rmse);
+    }
+
+    stringstream report;
+    report << fixed << setprecision(4);
+    report << "{" << endl;
+    report << "  \"jobs\": " << nJobs << "," << endl;
+    report << "  \"cores_per_job\": " << nCoresPerJob << "," << endl;
+    report << "  \"pinned\": " << (bPin ? "true" : "false") << "," << endl;
+    report << "  \"sequences\": [";
+    for(size_t i=0; i<vResults.size(); i++)
+    {
+        const BatchEntry &e = vEntries[i];
+        const BatchResult &r = vResults[i];
+        report << (i==0 ? "" : ",") << endl;
+        report << "    {\"dataset\": " << JsonString(e.strDataset) << ", \"sensor\": " << JsonString(e.strSensor)
+               << ", \"sequence\": " << JsonString(e.strSequence) << ", \"settings\": " << JsonString(e.strSettings);
+        if(!r.bOk)
+        {
+            report << ", \"error\": " << JsonString(r.strError) << "}";
+            continue;
+        }
+        const Distribution track = ComputeDistribution(r.vTrackMs);
+        report << ", \"frames\": " << r.nFrames << ", \"untracked_frames\": " << r.nUntracked
+               << ", \"wall_time_s\": " << r.wallTime << ", \"fps\": " << r.nFrames/r.wallTime
+               << ", \"frame_latency_ms\": {\"mean\": " << track.mean << ", \"p50\": " << track.p50 << ", \"p90\": " << track.p90
+               << ", \"p99\": " << track.p99 << ", \"max\": " << track.max << "}";
+        if(r.bAte)
+            report << ", \"ate\": {\"matched\": " << r.ate.matched << ", \"rmse_m\": " << r.ate.rmse << ", \"mean_m\": " << r.ate.mean
+                   << ", \"median_m\": " << r.ate.median << ", \"max_m\": " << r.ate.max << ", \"scale\": " << r.ate.scale << "}}";
+        else
+            report << ", \"ate\": null}";
+    }
+    report << endl << "  ]," << endl;
+
+    const Distribution track = ComputeDistribution(vAllTrackMs);
+    const Distribution rmse = ComputeDistribution(vRmse);
+    report << "  \"summary\": {\"completed\": " << nOk << ", \"failed\": " << vResults.size()-nOk
+           << ", \"frames\": " << nFrames << ", \"untracked_frames\": " << nUntracked
+           << ", \"wall_time_s\": " << wallTime << ", \"sequence_time_s\": " << sequenceTime
+           << ", \"speedup\": " << (wallTime>0 ? sequenceTime/wallTime : 0.0) << ", \"fps\": " << nFrames/wallTime
+           << ", \"peak_rss_mb\": " << peakRssMB << "," << endl
+           << "    \"frame_latency_ms\": {\"mean\": " << track.mean << ", \"p50\": " << track.p50 << ", \"p90\": " << track.p90
+           << ", \"p99\": " << track.p99 << ", \"max\": " << track.max << "}," << endl
+           << "    \"ate_rmse_m\": {\"sequences\": " << vRmse.size() << ", \"mean\": " << rmse.mean << ", \"p50\": " << rmse.p50
+           << ", \"max\": " << rmse.max << "}}" << endl;
+    report << "}" << endl;
+
+    if(strReport.empty())
+        cout << report.str();
+    else
+    {
+        ofstream f(strReport.c_str());
+        f << report.str();
+        if(!f.good())
+        {
+            cerr << "ERROR: Cannot write the report " << strReport << endl;
+            return 1;
+        }
+        cout << "Batch report saved to " << strReport << endl;
+    }
+
+    return nOk==(int)vResults.size() ? 0 : 1;
+}
+
+bool LoadSequenceList(const string &strFile, vector<BatchEntry> &vEntries)
+{
+    ifstream f(strFile.c_str());
+    if(!f.is_open())
+        return false;
+
+    string s;
+    while(getline(f,s))
+    {
+        if(s.empty() || s[0]=='#')
+            continue;
+
+        stringstream ss(s);
+        BatchEntry entry;
+        if(!(ss >> entry.strDataset >> entry.strSensor >> entry.strSettings >> entry.strSequence))
+            continue;
+        ss >> entry.strGroundTruth;
+        vEntries.push_back(entry);
+    }
+    return !vEntries.empty();
+}
+
+// Blocks of nCores consecutive cores, wrapping around when there are more job slots than cores
+bool PinToCores(const int nFirst, const int nCores, const int nTotalCores)
+{
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    for(int c=0; c<nCores; c++)
+        CPU_SET((nFirst+c)%nTotalCores, &cpuset);
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset)==0;
+}
+
+// Same run as slam_benchmark, without real-time pacing
+void RunSequence(ORB_SLAM3::ORBVocabulary* pVocabulary, const BatchEntry &entry, const string &strTrajectory, BatchResult &result)
+{
+    result.bOk = false;
+    result.bAte = false;
+    result.nFrames = 0;
+    result.nUntracked = 0;
+    result.wallTime = 0;
+
+    ORB_SLAM3::System::eSensor sensor;
+    if(!ParseSensor(entry.strSensor, sensor))
+    {
+        result.strError = "Unknown sensor: " + entry.strSensor;
+        return;
+    }
+    const bool bStereo = (sensor==ORB_SLAM3::System::STEREO || sensor==ORB_SLAM3::System::IMU_STEREO);
+    const bool bInertial = (sensor==ORB_SLAM3::System::IMU_MONOCULAR || sensor==ORB_SLAM3::System::IMU_STEREO);
+
+    Sequence seq;
+    string strGroundTruth = entry.strGroundTruth;
+    if(!LoadSequence(entry.strDataset, sensor, entry.strSequence, string(), seq, strGroundTruth, result.strError))
+        return;
+
+    Rectification rect;
+    if(bStereo && !LoadRectification(entry.strSettings, rect))
+    {
+        result.strError = "Wrong path to settings " + entry.strSettings;
+        return;
+    }
+
+    const int nImages = seq.vvstrImages.size();
+
+    // First IMU measurement to be considered, supposing IMU measurements start first
+    size_t nextImu = 0;
+    if(bInertial)
+    {
+        while(nextImu<seq.vImu.size() && seq.vImu[nextImu].t<=seq.vTimestamps[0])
+            nextImu++;
+        if(nextImu>0)
+            nextImu--;
+    }
+
+    ORB_SLAM3::System SLAM(pVocabulary,entry.strSettings,sensor,false);
+
+    ORB_SLAM3::ImagePrefetcher images(seq.vvstrImages, seq.imreadFlag);
+    cv::Ptr<cv::CLAHE> clahe = cv::createCLAHE(3.0, cv::Size(8, 8));
+
+    result.vTrackMs.reserve(nImages);
+
+    cv::Mat imLeft, imRight;
+    vector<ORB_SLAM3::IMU::Point> vImuMeas;
+    const chrono::steady_clock::time_point tStart = chrono::steady_clock::now();
+    for(int ni=0; ni<nImages; ni++)
+    {
+        images.Get(ni, imLeft, imRight);
+        if(imLeft.empty() || (bStereo && imRight.empty()))
+        {
+            result.strError = "Failed to load image at: " + seq.vvstrImages[ni][0];
+            SLAM.Shutdown();
+            return;
+        }
+
+        const double tframe = seq.vTimestamps[ni];
+
+        vImuMeas.clear();
+        if(bInertial)
+        {
+            while(nextImu<seq.vImu.size() && seq.vImu[nextImu].t<=tframe)
+                vImuMeas.push_back(seq.vImu[nextImu++]);
+        }
+
+        const chrono::steady_clock::time_point t1 = chrono::steady_clock::now();
+
+        if(seq.bClahe)
+        {
+            clahe->apply(imLeft,imLeft);
+            if(bStereo)
+                clahe->apply(imRight,imRight);
+        }
+        if(bStereo && !rect.M1l.empty())
+        {
+            cv::Mat imLeftRect, imRightRect;
+            cv::remap(imLeft,imLeftRect,rect.M1l,rect.M2l,cv::INTER_LINEAR);
+            cv::remap(imRight,imRightRect,rect.M1r,rect.M2r,cv::INTER_LINEAR);
+            imLeft = imLeftRect;
+            imRight = imRightRect;
+        }
+
+        cv::Mat Tcw;
+        if(bStereo)
+            Tcw = SLAM.TrackStereo(imLeft,imRight,tframe,vImuMeas);
+        else
+            Tcw = SLAM.TrackMonocular(imLeft,tframe,vImuMeas);
+
+        const chrono::steady_clock::time_point t2 = chrono::steady_clock::now();
+        result.vTrackMs.push_back(1e3*chrono::duration_cast<chrono::duration<double> >(t2 - t1).count());
+        if(Tcw.empty())
+            result.nUntracked++;
+    }
+    result.wallTime = chrono::duration_cast<chrono::duration<double> >(chrono::steady_clock::now() - tStart).count();
+    result.nFrames = nImages;
+
+    SLAM.Shutdown();
+    SLAM.SaveTrajectoryEuRoC(strTrajectory);
+
+    // ATE of the frame trajectory, with scale for monocular
+    if(!strGroundTruth.empty())
+    {
+        vector<Position> vEstimated, vGroundTruth;
+        if(LoadPositions(strTrajectory, seq.vTimestamps, vEstimated) && LoadPositions(strGroundTruth, seq.vTimestamps, vGroundTruth))
+            result.bAte = ComputeATE(vEstimated, vGroundTruth, sensor==ORB_SLAM3::System::MONOCULAR, result.ate);
+    }
+
+    result.bOk = true;
+}
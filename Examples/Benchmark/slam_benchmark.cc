@@ -0,0 +1,308 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include<iostream>
+#include<algorithm>
+#include<fstream>
+#include<iomanip>
+#include<sstream>
+#include<chrono>
+#include<cstring>
+#include<unistd.h>
+#include<sys/resource.h>
+
+#include<opencv2/core/core.hpp>
+#include<opencv2/imgproc/imgproc.hpp>
+
+#include<System.h>
+#include<ImagePrefetcher.h>
+#include<Metrics.h>
+#include"ImuTypes.h"
+#include"BenchmarkCommon.h"
+
+using namespace std;
+
+// Headless run of one sequence (EuRoC, TUM-VI or KITTI layout) for regression tracking. Frames are
+// processed as fast as possible unless --realtime is given. The report (JSON) has the per-frame
+// tracking latency, the stage latencies of the SLAM threads (System::GetMetrics), throughput,
+// peak RSS and the ATE of the frame trajectory against the ground truth, when available.
+
+int main(int argc, char **argv)
+{
+    if(argc < 6)
+    {
+        cerr << endl << "Usage: ./slam_benchmark path_to_vocabulary path_to_settings dataset sensor path_to_sequence "
+             << "[--times path_to_times_file] [--gt path_to_groundtruth] [--report path_to_report] [--realtime]" << endl
+             << "  dataset: euroc | tumvi | kitti" << endl
+             << "  sensor: mono | stereo | mono_inertial | stereo_inertial (euroc and tumvi), mono | stereo (kitti)" << endl;
+        return 1;
+    }
+
+    const string strVocabulary(argv[1]);
+    const string strSettings(argv[2]);
+    const string strDataset(argv[3]);
+    const string strSensor(argv[4]);
+    const string strSequence(argv[5]);
+
+    string strTimes, strGroundTruth, strReport;
+    bool bRealTime = false;
+    for(int i=6; i<argc; i++)
+    {
+        const string arg(argv[i]);
+        if(arg=="--realtime")
+            bRealTime = true;
+        else if(arg=="--times" && i+1<argc)
+            strTimes = argv[++i];
+        else if(arg=="--gt" && i+1<argc)
+            strGroundTruth = argv[++i];
+        else if(arg=="--report" && i+1<argc)
+            strReport = argv[++i];
+        else
+        {
+            cerr << "Unknown argument: " << arg << endl;
+            return 1;
+        }
+    }
+
+    ORB_SLAM3::System::eSensor sensor;
+    if(!ParseSensor(strSensor, sensor))
+    {
+        cerr << "Unknown sensor: " << strSensor << endl;
+        return 1;
+    }
+    const bool bStereo = (sensor==ORB_SLAM3::System::STEREO || sensor==ORB_SLAM3::System::IMU_STEREO);
+    const bool bInertial = (sensor==ORB_SLAM3::System::IMU_MONOCULAR || sensor==ORB_SLAM3::System::IMU_STEREO);
+
+    // Load the sequence
+    Sequence seq;
+    string strError;
+    if(!LoadSequence(strDataset, sensor, strSequence, strTimes, seq, strGroundTruth, strError))
+    {
+        cerr << "ERROR: " << strError << endl;
+        return 1;
+    }
+
+    const int nImages = seq.vvstrImages.size();
+    cout << "Images in the sequence: " << nImages << endl;
+
+    // Stereo rectification, as in the EuRoC examples, when the settings have it
+    Rectification rect;
+    if(bStereo && !LoadRectification(strSettings, rect))
+    {
+        cerr << "ERROR: Wrong path to settings" << endl;
+        return -1;
+    }
+
+    // First IMU measurement to be considered, supposing IMU measurements start first
+    size_t nextImu = 0;
+    if(bInertial)
+    {
+        while(nextImu<seq.vImu.size() && seq.vImu[nextImu].t<=seq.vTimestamps[0])
+            nextImu++;
+        if(nextImu>0)
+            nextImu--;
+    }
+
+    // Create SLAM system without viewer
+    ORB_SLAM3::System SLAM(strVocabulary,strSettings,sensor,false);
+
+    ORB_SLAM3::ImagePrefetcher images(seq.vvstrImages, seq.imreadFlag);
+    cv::Ptr<cv::CLAHE> clahe = cv::createCLAHE(3.0, cv::Size(8, 8));
+
+    vector<double> vTrackMs;
+    vTrackMs.reserve(nImages);
+    int nUntracked = 0;
+
+    cv::Mat imLeft, imRight;
+    vector<ORB_SLAM3::IMU::Point> vImuMeas;
+    const std::chrono::steady_clock::time_point tStart = std::chrono::steady_clock::now();
+    for(int ni=0; ni<nImages; ni++)
+    {
+        images.Get(ni, imLeft, imRight);
+        if(imLeft.empty() || (bStereo && imRight.empty()))
+        {
+            cerr << endl << "Failed to load image at: " << seq.vvstrImages[ni][0] << endl;
+            return 1;
+        }
+
+        const double tframe = seq.vTimestamps[ni];
+
+        vImuMeas.clear();
+        if(bInertial)
+        {
+            while(nextImu<seq.vImu.size() && seq.vImu[nextImu].t<=tframe)
+                vImuMeas.push_back(seq.vImu[nextImu++]);
+        }
+
+        const std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+
+        if(seq.bClahe)
+        {
+            clahe->apply(imLeft,imLeft);
+            if(bStereo)
+                clahe->apply(imRight,imRight);
+        }
+        if(bStereo && !rect.M1l.empty())
+        {
+            cv::Mat imLeftRect, imRightRect;
+            cv::remap(imLeft,imLeftRect,rect.M1l,rect.M2l,cv::INTER_LINEAR);
+            cv::remap(imRight,imRightRect,rect.M1r,rect.M2r,cv::INTER_LINEAR);
+            imLeft = imLeftRect;
+            imRight = imRightRect;
+        }
+
+        cv::Mat Tcw;
+        if(bStereo)
+            Tcw = SLAM.TrackStereo(imLeft,imRight,tframe,vImuMeas);
+        else
+            Tcw = SLAM.TrackMonocular(imLeft,tframe,vImuMeas);
+
+        const std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+
+        const double ttrack = std::chrono::duration_cast<std::chrono::duration<double> >(t2 - t1).count();
+        vTrackMs.push_back(1e3*ttrack);
+        if(Tcw.empty())
+            nUntracked++;
+
+        if(bRealTime)
+        {
+            double T=0;
+            if(ni<nImages-1)
+                T = seq.vTimestamps[ni+1]-tframe;
+            else if(ni>0)
+                T = tframe-seq.vTimestamps[ni-1];
+
+            if(ttrack<T)
+                usleep((T-ttrack)*1e6);
+        }
+    }
+    const double wallTime = std::chrono::duration_cast<std::chrono::duration<double> >(std::chrono::steady_clock::now() - tStart).count();
+
+    // Stop all threads
+    SLAM.Shutdown();
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    const double peakRssMB = usage.ru_maxrss/1024.0; // kB on Linux
+
+    // ATE of the frame trajectory, with scale for monocular
+    const string strTrajectory = (strReport.empty() ? string("Benchmark") : strReport) + ".trajectory.txt";
+    SLAM.SaveTrajectoryEuRoC(strTrajectory);
+
+    AteStats ate;
+    bool bAte = false;
+    if(!strGroundTruth.empty())
+    {
+        vector<Position> vEstimated, vGroundTruth;
+        if(!LoadPositions(strTrajectory, seq.vTimestamps, vEstimated) || !LoadPositions(strGroundTruth, seq.vTimestamps, vGroundTruth))
+            cerr << "ERROR: Failed to load the trajectory or the ground truth " << strGroundTruth << endl;
+        else
+            bAte = ComputeATE(vEstimated, vGroundTruth, sensor==ORB_SLAM3::System::MONOCULAR, ate);
+    }
+
+    // Report
+    const Distribution track = ComputeDistribution(vTrackMs);
+    const vector<ORB_SLAM3::Metrics::StageSnapshot> vStages = SLAM.GetMetrics()->GetStageSnapshots();
+    const vector<ORB_SLAM3::LockProfiler::LockSnapshot> vLocks = SLAM.GetMetrics()->GetLockSnapshots();
+    const vector<ORB_SLAM3::AllocationProfiler::SpanSnapshot> vAllocations = SLAM.GetMetrics()->GetAllocationSnapshots();
+
+    stringstream report;
+    report << fixed << setprecision(4);
+    report << "{" << endl;
+    report << "  \"dataset\": " << JsonString(strDataset) << "," << endl;
+    report << "  \"sensor\": " << JsonString(strSensor) << "," << endl;
+    report << "  \"sequence\": " << JsonString(strSequence) << "," << endl;
+    report << "  \"settings\": " << JsonString(strSettings) << "," << endl;
+    report << "  \"realtime\": " << (bRealTime ? "true" : "false") << "," << endl;
+    report << "  \"frames\": " << nImages << "," << endl;
+    report << "  \"untracked_frames\": " << nUntracked << "," << endl;
+    report << "  \"wall_time_s\": " << wallTime << "," << endl;
+    report << "  \"fps\": " << nImages/wallTime << "," << endl;
+    report << "  \"peak_rss_mb\": " << peakRssMB << "," << endl;
+    report << "  \"frame_latency_ms\": {\"mean\": " << track.mean << ", \"p50\": " << track.p50 << ", \"p90\": " << track.p90
+           << ", \"p99\": " << track.p99 << ", \"max\": " << track.max << "}," << endl;
+    report << "  \"stages\": [";
+    for(size_t i=0; i<vStages.size(); i++)
+    {
+        const ORB_SLAM3::Metrics::StageSnapshot &s = vStages[i];
+        report << (i==0 ? "" : ",") << endl;
+        report << "    {\"name\": " << JsonString(s.name) << ", \"count\": " << s.count
+               << ", \"mean_ms\": " << (s.count>0 ? s.sum/s.count : 0.0) << ", \"p50_ms\": " << s.p50
+               << ", \"p90_ms\": " << s.p90 << ", \"p99_ms\": " << s.p99 << ", \"max_ms\": " << s.max << "}";
+    }
+    report << endl << "  ]," << endl;
+    // Only in builds with WITH_LOCK_PROFILING
+    if(!vLocks.empty())
+    {
+        report << "  \"locks\": [";
+        for(size_t i=0; i<vLocks.size(); i++)
+        {
+            const ORB_SLAM3::LockProfiler::LockSnapshot &l = vLocks[i];
+            report << (i==0 ? "" : ",") << endl;
+            report << "    {\"name\": " << JsonString(l.name) << ", \"acquisitions\": " << l.acquisitions
+                   << ", \"contended\": " << l.contended << ", \"wait_sum_ms\": " << l.waitSum
+                   << ", \"wait_p50_ms\": " << l.waitP50 << ", \"wait_p99_ms\": " << l.waitP99 << ", \"wait_max_ms\": " << l.waitMax
+                   << ", \"hold_sum_ms\": " << l.holdSum << ", \"hold_p99_ms\": " << l.holdP99 << ", \"hold_max_ms\": " << l.holdMax
+                   << ", \"holders\": [";
+            for(size_t j=0; j<l.vHolders.size(); j++)
+                report << (j==0 ? "" : ", ") << "{\"thread\": " << JsonString(l.vHolders[j].thread)
+                       << ", \"count\": " << l.vHolders[j].count << ", \"wait_ms\": " << l.vHolders[j].wait << "}";
+            report << "]}";
+        }
+        report << endl << "  ]," << endl;
+    }
+    // Only in builds with WITH_ALLOC_PROFILING
+    if(!vAllocations.empty())
+    {
+        report << "  \"allocations\": [";
+        for(size_t i=0; i<vAllocations.size(); i++)
+        {
+            const ORB_SLAM3::AllocationProfiler::SpanSnapshot &a = vAllocations[i];
+            report << (i==0 ? "" : ",") << endl;
+            report << "    {\"span\": " << JsonString(a.name) << ", \"thread\": " << JsonString(a.thread)
+                   << ", \"count\": " << a.count << ", \"allocations\": " << a.allocations << ", \"bytes\": " << a.bytes
+                   << ", \"mean_allocations\": " << (a.count>0 ? double(a.allocations)/a.count : 0.0)
+                   << ", \"mean_bytes\": " << (a.count>0 ? double(a.bytes)/a.count : 0.0)
+                   << ", \"max_allocations\": " << a.maxAllocations << "}";
+        }
+        report << endl << "  ]," << endl;
+    }
+    if(bAte)
+        report << "  \"ate\": {\"alignment\": " << (sensor==ORB_SLAM3::System::MONOCULAR ? "\"sim3\"" : "\"se3\"")
+               << ", \"matched\": " << ate.matched << ", \"rmse_m\": " << ate.rmse << ", \"mean_m\": " << ate.mean
+               << ", \"median_m\": " << ate.median << ", \"max_m\": " << ate.max << ", \"scale\": " << ate.scale << "}" << endl;
+    else
+        report << "  \"ate\": null" << endl;
+    report << "}" << endl;
+
+    if(strReport.empty())
+        cout << report.str();
+    else
+    {
+        ofstream f(strReport.c_str());
+        f << report.str();
+        if(!f.good())
+        {
+            cerr << "ERROR: Cannot write the report " << strReport << endl;
+            return 1;
+        }
+        cout << "Benchmark report saved to " << strReport << endl;
+    }
+
+    return 0;
+}
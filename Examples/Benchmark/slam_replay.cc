@@ -0,0 +1,119 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include<iostream>
+#include<algorithm>
+#include<chrono>
+
+#include<opencv2/core/core.hpp>
+
+#include<System.h>
+#include<ReplayLog.h>
+
+using namespace std;
+
+// Replays a run recorded with the System.RecordDir setting. The threads are serialized with the
+// recorded decisions (see ReplayLog), so two replays build the same keyframes and map and their
+// timings can be compared directly. Images are loaded outside of the timed tracking calls.
+
+int main(int argc, char **argv)
+{
+    if(argc < 4)
+    {
+        cerr << endl << "Usage: ./slam_replay path_to_vocabulary path_to_settings path_to_recording "
+             << "[--keyframes path_to_keyframe_trajectory]" << endl;
+        return 1;
+    }
+
+    const string strRecording(argv[3]);
+    string strKeyFrames;
+    for(int i=4; i<argc; i++)
+    {
+        const string arg(argv[i]);
+        if(arg=="--keyframes" && i+1<argc)
+            strKeyFrames = argv[++i];
+        else
+        {
+            cerr << "Unknown argument: " << arg << endl;
+            return 1;
+        }
+    }
+
+    // The sensor is taken from the recording
+    int nSensor;
+    {
+        ORB_SLAM3::ReplayLog* pLog = ORB_SLAM3::ReplayLog::Open(strRecording, ORB_SLAM3::ReplayLog::REPLAY, -1);
+        if(!pLog)
+            return 1;
+        nSensor = pLog->GetSensor();
+        delete pLog;
+    }
+    const ORB_SLAM3::System::eSensor sensor = static_cast<ORB_SLAM3::System::eSensor>(nSensor);
+
+    ORB_SLAM3::System SLAM(argv[1],argv[2],sensor,false);
+    ORB_SLAM3::ReplayLog* pReplay = SLAM.StartReplay(strRecording);
+    if(!pReplay)
+        return 1;
+
+    const size_t nFrames = pReplay->NumFrames();
+    vector<double> vTrackMs;
+    vTrackMs.reserve(nFrames);
+
+    const chrono::steady_clock::time_point tStart = chrono::steady_clock::now();
+    vector<cv::Mat> vIms;
+    for(size_t ni=0; ni<nFrames; ni++)
+    {
+        const ORB_SLAM3::ReplayLog::Frame &frame = pReplay->GetFrame(ni);
+        pReplay->LoadImages(ni, vIms);
+
+        const chrono::steady_clock::time_point t1 = chrono::steady_clock::now();
+        if(sensor==ORB_SLAM3::System::MONOCULAR || sensor==ORB_SLAM3::System::IMU_MONOCULAR)
+            SLAM.TrackMonocular(vIms[0], frame.timestamp, frame.vImu);
+        else if(sensor==ORB_SLAM3::System::RGBD)
+            SLAM.TrackRGBD(vIms[0], vIms[1], frame.timestamp);
+        else
+            SLAM.TrackStereo(vIms[0], vIms[1], frame.timestamp, frame.vImu);
+        const chrono::steady_clock::time_point t2 = chrono::steady_clock::now();
+
+        vTrackMs.push_back(chrono::duration_cast<chrono::duration<double,milli> >(t2 - t1).count());
+    }
+    const double wallTime = chrono::duration_cast<chrono::duration<double> >(chrono::steady_clock::now() - tStart).count();
+
+    SLAM.Shutdown();
+
+    if(!strKeyFrames.empty())
+        SLAM.SaveKeyFrameTrajectoryEuRoC(strKeyFrames);
+
+    // Tracking time includes the work of the other threads that was handed the turn before the frame
+    double totalMs = 0;
+    for(size_t i=0; i<vTrackMs.size(); i++)
+        totalMs += vTrackMs[i];
+    sort(vTrackMs.begin(), vTrackMs.end());
+
+    cout << "-------" << endl << endl;
+    cout << "frames: " << nFrames << endl;
+    cout << "wall time: " << wallTime << " s" << endl;
+    if(nFrames>0)
+    {
+        cout << "tracking + serialized work: " << totalMs/1000.0 << " s" << endl;
+        cout << "median frame: " << vTrackMs[nFrames/2] << " ms" << endl;
+        cout << "max frame: " << vTrackMs.back() << " ms" << endl;
+    }
+
+    return 0;
+}
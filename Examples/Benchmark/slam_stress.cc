@@ -0,0 +1,556 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include<iostream>
+#include<algorithm>
+#include<fstream>
+#include<iomanip>
+#include<sstream>
+#include<chrono>
+#include<thread>
+#include<mutex>
+#include<atomic>
+#include<unistd.h>
+
+#include<opencv2/core/core.hpp>
+#include<opencv2/imgproc/imgproc.hpp>
+
+#include<System.h>
+#include<Atlas.h>
+#include<ImagePrefetcher.h>
+#include<Metrics.h>
+#include"ImuTypes.h"
+#include"BenchmarkCommon.h"
+
+using namespace std;
+
+// Concurrency stress run: one sequence (layouts of slam_benchmark) is played --passes times in a
+// row, as fast as possible or --speed times faster than real time, so that Local Mapping, Loop
+// Closing and the global BA work under load at the same time. Every pass starts a new map
+// (System::ChangeDataset), which is merged with the previous ones when the place is recognized, and
+// revisits inside a pass close loops. --gap-every drops frames to lose the tracking on purpose, and
+// --toggle-localization-ms switches the localization mode from another thread, which stops and
+// releases Local Mapping (RequestStop/Release) while it is busy.
+//
+// A watchdog thread measures the stalls of every SLAM thread: Tracking calls longer than --stall-ms,
+// and periods of --stall-ms or more in which Local Mapping or Loop Closing had queued keyframes but
+// did not finish any. A thread that makes no progress for --deadlock-s is reported as deadlocked:
+// the report is written with what was measured and the process exits with code 2, as the threads
+// cannot be joined. The report (JSON) has the throughput of every pass, the frame latency, the
+// stalls, the stage latencies (System::GetMetrics), the loops and merges and, in builds with
+// WITH_LOCK_PROFILING, the lock wait times by lock and holding thread.
+
+struct StallStats
+{
+    string name;
+    unsigned long count;
+    double sum, max;    // ms
+};
+
+// Stalls of a thread that processes a queue: no progress while there is work queued
+class QueueWatch
+{
+public:
+    QueueWatch(const string &name, const ORB_SLAM3::Metrics::Stage progress, const ORB_SLAM3::Metrics::Gauge queue):
+        mProgress(progress), mQueue(queue), mnLastCount(0), mbStalled(false)
+    {
+        mStats.name = name;
+        mStats.count = 0;
+        mStats.sum = mStats.max = 0;
+        mtLastProgress = chrono::steady_clock::now();
+    }
+
+    // Returns the time (s) without progress while there is work queued, 0 if it is progressing
+    double Poll(const ORB_SLAM3::Metrics* pMetrics, const chrono::steady_clock::time_point &tNow, const double stallMs)
+    {
+        const unsigned long count = pMetrics->GetHistogram(mProgress).Count();
+        const bool bPending = pMetrics->GetGauge(mQueue)>0;
+        if(count!=mnLastCount || !bPending)
+        {
+            if(mbStalled)
+            {
+                const double ms = ElapsedMs(mtLastProgress, tNow);
+                mStats.count++;
+                mStats.sum += ms;
+                mStats.max = max(mStats.max, ms);
+                mbStalled = false;
+            }
+            mnLastCount = count;
+            mtLastProgress = tNow;
+            return 0;
+        }
+
+        const double ms = ElapsedMs(mtLastProgress, tNow);
+        if(ms>=stallMs)
+            mbStalled = true;
+        return ms/1000.0;
+    }
+
+    const StallStats& Stats() const { return mStats; }
+
+    static double ElapsedMs(const chrono::steady_clock::time_point &t1, const chrono::steady_clock::time_point &t2)
+    {
+        return chrono::duration_cast<chrono::duration<double,milli> >(t2 - t1).count();
+    }
+
+private:
+    const ORB_SLAM3::Metrics::Stage mProgress;
+    const ORB_SLAM3::Metrics::Gauge mQueue;
+    unsigned long mnLastCount;
+    chrono::steady_clock::time_point mtLastProgress;
+    bool mbStalled;
+    StallStats mStats;
+};
+
+struct PassStats
+{
+    int frames;
+    int untracked;
+    double wallTime;
+};
+
+string BuildReport(const string &strSettings, const string &strSequence, const string &strSensor, const double speed,
+                   const vector<PassStats> &vPasses, const vector<double> &vTrackMs, const vector<StallStats> &vStalls,
+                   ORB_SLAM3::System &SLAM, const int nMaps, const unsigned long nToggles, const string &strDeadlock);
+
+int main(int argc, char **argv)
+{
+    if(argc < 6)
+    {
+        cerr << endl << "Usage: ./slam_stress path_to_vocabulary path_to_settings dataset sensor path_to_sequence "
+             << "[--times path_to_times_file] [--passes N] [--speed X] [--gap-every N] [--gap-frames N] "
+             << "[--toggle-localization-ms N] [--stall-ms N] [--deadlock-s N] [--report path_to_report]" << endl
+             << "  dataset: euroc | tumvi | kitti" << endl
+             << "  sensor: mono | stereo | mono_inertial | stereo_inertial (euroc and tumvi), mono | stereo (kitti)" << endl
+             << "  speed: times real time, 0 (default) as fast as possible" << endl;
+        return 1;
+    }
+
+    const string strVocabulary(argv[1]);
+    const string strSettings(argv[2]);
+    const string strDataset(argv[3]);
+    const string strSensor(argv[4]);
+    const string strSequence(argv[5]);
+
+    string strTimes, strReport;
+    int nPasses = 3;
+    double speed = 0;
+    int nGapEvery = 0, nGapFrames = 20;
+    int nToggleMs = 0;
+    double stallMs = 500;
+    double deadlockS = 60;
+    for(int i=6; i<argc; i++)
+    {
+        const string arg(argv[i]);
+        if(arg=="--times" && i+1<argc)
+            strTimes = argv[++i];
+        else if(arg=="--passes" && i+1<argc)
+            nPasses = max(1, atoi(argv[++i]));
+        else if(arg=="--speed" && i+1<argc)
+            speed = max(0.0, atof(argv[++i]));
+        else if(arg=="--gap-every" && i+1<argc)
+            nGapEvery = max(0, atoi(argv[++i]));
+        else if(arg=="--gap-frames" && i+1<argc)
+            nGapFrames = max(1, atoi(argv[++i]));
+        else if(arg=="--toggle-localization-ms" && i+1<argc)
+            nToggleMs = max(0, atoi(argv[++i]));
+        else if(arg=="--stall-ms" && i+1<argc)
+            stallMs = max(1.0, atof(argv[++i]));
+        else if(arg=="--deadlock-s" && i+1<argc)
+            deadlockS = max(1.0, atof(argv[++i]));
+        else if(arg=="--report" && i+1<argc)
+            strReport = argv[++i];
+        else
+        {
+            cerr << "Unknown argument: " << arg << endl;
+            return 1;
+        }
+    }
+    if(nGapEvery>0 && nGapFrames>=nGapEvery)
+    {
+        cerr << "ERROR: --gap-frames must be smaller than --gap-every" << endl;
+        return 1;
+    }
+
+    ORB_SLAM3::System::eSensor sensor;
+    if(!ParseSensor(strSensor, sensor))
+    {
+        cerr << "Unknown sensor: " << strSensor << endl;
+        return 1;
+    }
+    const bool bStereo = (sensor==ORB_SLAM3::System::STEREO || sensor==ORB_SLAM3::System::IMU_STEREO);
+    const bool bInertial = (sensor==ORB_SLAM3::System::IMU_MONOCULAR || sensor==ORB_SLAM3::System::IMU_STEREO);
+
+    Sequence seq;
+    string strError;
+    if(!LoadSequence(strDataset, sensor, strSequence, strTimes, seq, string(), strError))
+    {
+        cerr << "ERROR: " << strError << endl;
+        return 1;
+    }
+
+    Rectification rect;
+    if(bStereo && !LoadRectification(strSettings, rect))
+    {
+        cerr << "ERROR: Wrong path to settings" << endl;
+        return -1;
+    }
+
+    // Frames of all the passes, without the gaps. The timestamps of every pass are shifted after
+    // the previous one so that they keep increasing
+    const int nImages = seq.vTimestamps.size();
+    const double duration = seq.vTimestamps.back() - seq.vTimestamps.front();
+    vector<int> vFrameIndex, vFramePass;
+    vector<vector<string> > vvstrImages;
+    for(int p=0; p<nPasses; p++)
+    {
+        for(int ni=0; ni<nImages; ni++)
+        {
+            if(nGapEvery>0 && ni>0 && ni%nGapEvery>=nGapEvery-nGapFrames)
+                continue;
+            vFrameIndex.push_back(ni);
+            vFramePass.push_back(p);
+            vvstrImages.push_back(seq.vvstrImages[ni]);
+        }
+    }
+    const int nFrames = vFrameIndex.size();
+    cout << nImages << " images in the sequence, " << nFrames << " frames in " << nPasses << " passes" << endl;
+
+    ORB_SLAM3::System SLAM(strVocabulary,strSettings,sensor,false);
+    ORB_SLAM3::Metrics* pMetrics = SLAM.GetMetrics();
+
+    // Start of the System call in progress from this thread (ns since the epoch of steady_clock, 0 if
+    // none) and its name
+    atomic<long long> tCallStartNs(0);
+    atomic<const char*> pCallName("Tracking");
+    atomic<bool> bFinished(false), bStopToggler(false);
+    mutex mutexReport;
+    vector<PassStats> vPasses(nPasses);
+    vector<double> vTrackMs;
+    vTrackMs.reserve(nFrames);
+    StallStats trackingStalls;
+    trackingStalls.name = "Tracking";
+    trackingStalls.count = 0;
+    trackingStalls.sum = trackingStalls.max = 0;
+    atomic<unsigned long> nToggles(0);
+
+    // Watchdog: stalls of Local Mapping and Loop Closing, and deadlocks of any thread
+    QueueWatch localMappingWatch("LocalMapping", ORB_SLAM3::Metrics::KEYFRAME_PROCESSING, ORB_SLAM3::Metrics::LOCAL_MAPPING_QUEUE);
+    QueueWatch loopClosingWatch("LoopClosing", ORB_SLAM3::Metrics::LOOP_DETECTION, ORB_SLAM3::Metrics::LOOP_CLOSING_QUEUE);
+    thread watchdog([&]{
+        const int pollMs = max(1, min(50, (int)(stallMs/4)));
+        while(!bFinished)
+        {
+            this_thread::sleep_for(chrono::milliseconds(pollMs));
+            const chrono::steady_clock::time_point tNow = chrono::steady_clock::now();
+
+            string strDeadlock;
+            double stuckS = 0;
+            {
+                unique_lock<mutex> lock(mutexReport);
+                const long long tCall = tCallStartNs.load();
+                if(tCall>0)
+                {
+                    const double callS = (tNow.time_since_epoch().count() - tCall)*1e-9;
+                    if(callS>=deadlockS)
+                    {
+                        strDeadlock = pCallName.load();
+                        stuckS = callS;
+                    }
+                }
+                const double localMappingS = localMappingWatch.Poll(pMetrics, tNow, stallMs);
+                const double loopClosingS = loopClosingWatch.Poll(pMetrics, tNow, stallMs);
+                if(strDeadlock.empty() && localMappingS>=deadlockS)
+                {
+                    strDeadlock = "LocalMapping";
+                    stuckS = localMappingS;
+                }
+                if(strDeadlock.empty() && loopClosingS>=deadlockS)
+                {
+                    strDeadlock = "LoopClosing";
+                    stuckS = loopClosingS;
+                }
+            }
+            if(strDeadlock.empty())
+                continue;
+
+            // The threads cannot be joined: report what was measured and leave
+            cerr << "DEADLOCK: " << strDeadlock << " made no progress for " << stuckS << " s (local mapping queue "
+                 << pMetrics->GetGauge(ORB_SLAM3::Metrics::LOCAL_MAPPING_QUEUE) << ", loop closing queue "
+                 << pMetrics->GetGauge(ORB_SLAM3::Metrics::LOOP_CLOSING_QUEUE) << ")" << endl;
+            unique_lock<mutex> lock(mutexReport);
+            vector<StallStats> vStalls = {trackingStalls, localMappingWatch.Stats(), loopClosingWatch.Stats()};
+            const string report = BuildReport(strSettings, strSequence, strSensor, speed, vPasses, vTrackMs, vStalls,
+                                              SLAM, -1, nToggles, strDeadlock);
+            if(strReport.empty())
+                cout << report;
+            else
+                ofstream(strReport.c_str()) << report;
+            _exit(2);
+        }
+    });
+
+    // Localization mode switches: Local Mapping is stopped and released while it works
+    thread toggler;
+    if(nToggleMs>0)
+    {
+        toggler = thread([&]{
+            while(!bStopToggler)
+            {
+                this_thread::sleep_for(chrono::milliseconds(nToggleMs));
+                if(bStopToggler)
+                    break;
+                SLAM.ActivateLocalizationMode();
+                this_thread::sleep_for(chrono::milliseconds(max(1,nToggleMs/4)));
+                SLAM.DeactivateLocalizationMode();
+                nToggles++;
+            }
+        });
+    }
+
+    ORB_SLAM3::ImagePrefetcher images(vvstrImages, seq.imreadFlag);
+    cv::Ptr<cv::CLAHE> clahe = cv::createCLAHE(3.0, cv::Size(8, 8));
+
+    cv::Mat imLeft, imRight;
+    vector<ORB_SLAM3::IMU::Point> vImuMeas;
+    size_t nextImu = 0;
+    chrono::steady_clock::time_point tPassStart;
+    for(int nf=0; nf<nFrames; nf++)
+    {
+        const int ni = vFrameIndex[nf];
+        const int p = vFramePass[nf];
+        const double offset = p*(duration + 1.0);
+        const double tframe = seq.vTimestamps[ni] + offset;
+
+        if(nf==0 || p!=vFramePass[nf-1])
+        {
+            if(p>0)
+            {
+                vPasses[p-1].wallTime = QueueWatch::ElapsedMs(tPassStart, chrono::steady_clock::now())/1000.0;
+                cout << "Pass " << p << ": " << vPasses[p-1].frames/vPasses[p-1].wallTime << " fps, starting a new map" << endl;
+                SLAM.ChangeDataset();
+            }
+            vPasses[p].frames = vPasses[p].untracked = 0;
+            tPassStart = chrono::steady_clock::now();
+
+            // First IMU measurement to be considered, supposing IMU measurements start first
+            nextImu = 0;
+            if(bInertial)
+            {
+                while(nextImu<seq.vImu.size() && seq.vImu[nextImu].t<=seq.vTimestamps[0])
+                    nextImu++;
+                if(nextImu>0)
+                    nextImu--;
+            }
+        }
+
+        images.Get(nf, imLeft, imRight);
+        if(imLeft.empty() || (bStereo && imRight.empty()))
+        {
+            cerr << endl << "Failed to load image at: " << vvstrImages[nf][0] << endl;
+            bFinished = bStopToggler = true;
+            watchdog.join();
+            if(toggler.joinable())
+                toggler.join();
+            return 1;
+        }
+
+        vImuMeas.clear();
+        if(bInertial)
+        {
+            while(nextImu<seq.vImu.size() && seq.vImu[nextImu].t<=seq.vTimestamps[ni])
+            {
+                vImuMeas.push_back(seq.vImu[nextImu++]);
+                vImuMeas.back().t += offset;
+            }
+        }
+
+        if(seq.bClahe)
+        {
+            clahe->apply(imLeft,imLeft);
+            if(bStereo)
+                clahe->apply(imRight,imRight);
+        }
+        if(bStereo && !rect.M1l.empty())
+        {
+            cv::Mat imLeftRect, imRightRect;
+            cv::remap(imLeft,imLeftRect,rect.M1l,rect.M2l,cv::INTER_LINEAR);
+            cv::remap(imRight,imRightRect,rect.M1r,rect.M2r,cv::INTER_LINEAR);
+            imLeft = imLeftRect;
+            imRight = imRightRect;
+        }
+
+        // Accelerated real time: frame ni is due (t_ni - t_0)/speed after the start of the pass
+        if(speed>0)
+        {
+            const double due = (seq.vTimestamps[ni]-seq.vTimestamps[0])/speed;
+            const double elapsed = QueueWatch::ElapsedMs(tPassStart, chrono::steady_clock::now())/1000.0;
+            if(due>elapsed)
+                usleep((due-elapsed)*1e6);
+        }
+
+        const chrono::steady_clock::time_point t1 = chrono::steady_clock::now();
+        tCallStartNs = t1.time_since_epoch().count();
+
+        cv::Mat Tcw;
+        if(bStereo)
+            Tcw = SLAM.TrackStereo(imLeft,imRight,tframe,vImuMeas);
+        else
+            Tcw = SLAM.TrackMonocular(imLeft,tframe,vImuMeas);
+
+        const chrono::steady_clock::time_point t2 = chrono::steady_clock::now();
+        const double ms = QueueWatch::ElapsedMs(t1, t2);
+        {
+            unique_lock<mutex> lock(mutexReport);
+            tCallStartNs = 0;
+            vTrackMs.push_back(ms);
+            if(ms>=stallMs)
+            {
+                trackingStalls.count++;
+                trackingStalls.sum += ms;
+                trackingStalls.max = max(trackingStalls.max, ms);
+            }
+            vPasses[p].frames++;
+            if(Tcw.empty())
+                vPasses[p].untracked++;
+        }
+    }
+    vPasses[nPasses-1].wallTime = QueueWatch::ElapsedMs(tPassStart, chrono::steady_clock::now())/1000.0;
+    cout << "Pass " << nPasses << ": " << vPasses[nPasses-1].frames/vPasses[nPasses-1].wallTime << " fps" << endl;
+
+    // Shutdown is watched too: it waits for Local Mapping, Loop Closing and the global BA
+    if(toggler.joinable())
+    {
+        bStopToggler = true;
+        toggler.join();
+    }
+    const chrono::steady_clock::time_point tShutdown = chrono::steady_clock::now();
+    pCallName = "Shutdown";
+    tCallStartNs = tShutdown.time_since_epoch().count();
+    SLAM.Shutdown();
+    bFinished = true;
+    watchdog.join();
+    cout << "Shutdown in " << QueueWatch::ElapsedMs(tShutdown, chrono::steady_clock::now()) << " ms" << endl;
+
+    vector<StallStats> vStalls = {trackingStalls, localMappingWatch.Stats(), loopClosingWatch.Stats()};
+    const string report = BuildReport(strSettings, strSequence, strSensor, speed, vPasses, vTrackMs, vStalls,
+                                      SLAM, SLAM.GetAtlas()->CountMaps(), nToggles, string());
+
+    if(strReport.empty())
+        cout << report;
+    else
+    {
+        ofstream f(strReport.c_str());
+        f << report;
+        if(!f.good())
+        {
+            cerr << "ERROR: Cannot write the report " << strReport << endl;
+            return 1;
+        }
+        cout << "Stress report saved to " << strReport << endl;
+    }
+
+    return 0;
+}
+
+string BuildReport(const string &strSettings, const string &strSequence, const string &strSensor, const double speed,
+                   const vector<PassStats> &vPasses, const vector<double> &vTrackMs, const vector<StallStats> &vStalls,
+                   ORB_SLAM3::System &SLAM, const int nMaps, const unsigned long nToggles, const string &strDeadlock)
+{
+    const ORB_SLAM3::Metrics* pMetrics = SLAM.GetMetrics();
+    const Distribution track = ComputeDistribution(vTrackMs);
+    const vector<ORB_SLAM3::Metrics::StageSnapshot> vStages = pMetrics->GetStageSnapshots();
+    const vector<ORB_SLAM3::LockProfiler::LockSnapshot> vLocks = pMetrics->GetLockSnapshots();
+
+    int nFrames = 0, nUntracked = 0;
+    double wallTime = 0;
+    for(size_t i=0; i<vPasses.size(); i++)
+    {
+        nFrames += vPasses[i].frames;
+        nUntracked += vPasses[i].untracked;
+        wallTime += vPasses[i].wallTime;
+    }
+
+    stringstream report;
+    report << fixed << setprecision(4);
+    report << "{" << endl;
+    report << "  \"sensor\": " << JsonString(strSensor) << "," << endl;
+    report << "  \"sequence\": " << JsonString(strSequence) << "," << endl;
+    report << "  \"settings\": " << JsonString(strSettings) << "," << endl;
+    report << "  \"speed\": " << speed << "," << endl;
+    report << "  \"deadlock\": " << (strDeadlock.empty() ? string("null") : JsonString(strDeadlock)) << "," << endl;
+    report << "  \"frames\": " << nFrames << "," << endl;
+    report << "  \"untracked_frames\": " << nUntracked << "," << endl;
+    report << "  \"fps\": " << (wallTime>0 ? nFrames/wallTime : 0.0) << "," << endl;
+    report << "  \"passes\": [";
+    for(size_t i=0; i<vPasses.size(); i++)
+    {
+        report << (i==0 ? "" : ",") << endl;
+        report << "    {\"frames\": " << vPasses[i].frames << ", \"untracked_frames\": " << vPasses[i].untracked
+               << ", \"wall_time_s\": " << vPasses[i].wallTime
+               << ", \"fps\": " << (vPasses[i].wallTime>0 ? vPasses[i].frames/vPasses[i].wallTime : 0.0) << "}";
+    }
+    report << endl << "  ]," << endl;
+    report << "  \"maps\": " << nMaps << "," << endl;
+    report << "  \"loop_corrections\": " << pMetrics->GetHistogram(ORB_SLAM3::Metrics::LOOP_CORRECTION).Count() << "," << endl;
+    report << "  \"map_merges\": " << pMetrics->GetHistogram(ORB_SLAM3::Metrics::MAP_MERGE).Count() << "," << endl;
+    report << "  \"localization_toggles\": " << nToggles << "," << endl;
+    report << "  \"frame_latency_ms\": {\"mean\": " << track.mean << ", \"p50\": " << track.p50 << ", \"p90\": " << track.p90
+           << ", \"p99\": " << track.p99 << ", \"max\": " << track.max << "}," << endl;
+    report << "  \"stalls\": [";
+    for(size_t i=0; i<vStalls.size(); i++)
+    {
+        const StallStats &s = vStalls[i];
+        report << (i==0 ? "" : ",") << endl;
+        report << "    {\"thread\": " << JsonString(s.name) << ", \"count\": " << s.count << ", \"sum_ms\": " << s.sum
+               << ", \"max_ms\": " << s.max << "}";
+    }
+    report << endl << "  ]," << endl;
+    report << "  \"stages\": [";
+    for(size_t i=0; i<vStages.size(); i++)
+    {
+        const ORB_SLAM3::Metrics::StageSnapshot &s = vStages[i];
+        report << (i==0 ? "" : ",") << endl;
+        report << "    {\"name\": " << JsonString(s.name) << ", \"count\": " << s.count
+               << ", \"mean_ms\": " << (s.count>0 ? s.sum/s.count : 0.0) << ", \"p50_ms\": " << s.p50
+               << ", \"p90_ms\": " << s.p90 << ", \"p99_ms\": " << s.p99 << ", \"max_ms\": " << s.max << "}";
+    }
+    report << endl << "  ]";
+    // Only in builds with WITH_LOCK_PROFILING
+    if(!vLocks.empty())
+    {
+        report << "," << endl << "  \"locks\": [";
+        for(size_t i=0; i<vLocks.size(); i++)
+        {
+            const ORB_SLAM3::LockProfiler::LockSnapshot &l = vLocks[i];
+            report << (i==0 ? "" : ",") << endl;
+            report << "    {\"name\": " << JsonString(l.name) << ", \"acquisitions\": " << l.acquisitions
+                   << ", \"contended\": " << l.contended << ", \"wait_sum_ms\": " << l.waitSum
+                   << ", \"wait_p50_ms\": " << l.waitP50 << ", \"wait_p99_ms\": " << l.waitP99 << ", \"wait_max_ms\": " << l.waitMax
+                   << ", \"hold_sum_ms\": " << l.holdSum << ", \"hold_p99_ms\": " << l.holdP99 << ", \"hold_max_ms\": " << l.holdMax
+                   << ", \"holders\": [";
+            for(size_t j=0; j<l.vHolders.size(); j++)
+                report << (j==0 ? "" : ", ") << "{\"thread\": " << JsonString(l.vHolders[j].thread)
+                       << ", \"count\": " << l.vHolders[j].count << ", \"wait_ms\": " << l.vHolders[j].wait << "}";
+            report << "]}";
+        }
+        report << endl << "  ]";
+    }
+    report << endl << "}" << endl;
+    return report.str();
+}
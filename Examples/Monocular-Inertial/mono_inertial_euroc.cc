@@ -27,6 +27,7 @@
 #include<opencv2/core/core.hpp>
 
 #include<System.h>
+#include<ImagePrefetcher.h>
 #include "ImuTypes.h"
 
 using namespace std;
@@ -39,10 +40,12 @@ void LoadIMU(const string &strImuPath, vector<double> &vTimeStamps, vector<cv::P
 double ttrack_tot = 0;
 int main(int argc, char *argv[])
 {
+    const bool bFast = ORB_SLAM3::ImagePrefetcher::ParseFastMode(argc, argv);
+
 
     if(argc < 5)
     {
-        cerr << endl << "Usage: ./mono_inertial_euroc path_to_vocabulary path_to_settings path_to_sequence_folder_1 path_to_times_file_1 (path_to_image_folder_2 path_to_times_file_2 ... path_to_image_folder_N path_to_times_file_N) " << endl;
+        cerr << endl << "Usage: ./mono_inertial_euroc path_to_vocabulary path_to_settings path_to_sequence_folder_1 path_to_times_file_1 (path_to_image_folder_2 path_to_times_file_2 ... path_to_image_folder_N path_to_times_file_N)  [--fast]" << endl;
         return 1;
     }
 
@@ -125,10 +128,15 @@ int main(int argc, char *argv[])
         cv::Mat im;
         vector<ORB_SLAM3::IMU::Point> vImuMeas;
         proccIm = 0;
+        vector<vector<string> > vvstrImages(nImages[seq]);
+        for(int ni=0; ni<nImages[seq]; ni++)
+            vvstrImages[ni].push_back(vstrImageFilenames[seq][ni]);
+        ORB_SLAM3::ImagePrefetcher images(vvstrImages, cv::IMREAD_UNCHANGED);
+
         for(int ni=0; ni<nImages[seq]; ni++, proccIm++)
         {
             // Read image from file
-            im = cv::imread(vstrImageFilenames[seq][ni],cv::IMREAD_UNCHANGED);
+            im = images.Get(ni);
 
             double tframe = vTimestampsCam[seq][ni];
 
@@ -186,7 +194,7 @@ int main(int argc, char *argv[])
             else if(ni>0)
                 T = tframe-vTimestampsCam[seq][ni-1];
 
-            if(ttrack<T)
+            if(!bFast && ttrack<T)
                 usleep((T-ttrack)*1e6);
         }
         if(seq < num_seq - 1)
@@ -26,6 +26,7 @@
 #include<opencv2/core/core.hpp>
 
 #include<System.h>
+#include<ImagePrefetcher.h>
 #include "ImuTypes.h"
 
 using namespace std;
@@ -38,6 +39,8 @@ void LoadIMU(const string &strImuPath, vector<double> &vTimeStamps, vector<cv::P
 double ttrack_tot = 0;
 int main(int argc, char **argv)
 {
+    const bool bFast = ORB_SLAM3::ImagePrefetcher::ParseFastMode(argc, argv);
+
     const int num_seq = (argc-3)/3;
     cout << "num_seq = " << num_seq << endl;
     bool bFileName= ((argc % 3) == 1);
@@ -51,7 +54,7 @@ int main(int argc, char **argv)
 
     if(argc < 6)
     {
-        cerr << endl << "Usage: ./mono_inertial_tum_vi path_to_vocabulary path_to_settings path_to_image_folder_1 path_to_times_file_1 path_to_imu_data_1 (path_to_image_folder_2 path_to_times_file_2 path_to_imu_data_2 ... path_to_image_folder_N path_to_times_file_N path_to_imu_data_N) (trajectory_file_name)" << endl;
+        cerr << endl << "Usage: ./mono_inertial_tum_vi path_to_vocabulary path_to_settings path_to_image_folder_1 path_to_times_file_1 path_to_imu_data_1 (path_to_image_folder_2 path_to_times_file_2 path_to_imu_data_2 ... path_to_image_folder_N path_to_times_file_N path_to_imu_data_N) (trajectory_file_name) [--fast]" << endl;
         return 1;
     }
 
@@ -122,11 +125,16 @@ int main(int argc, char **argv)
         vector<ORB_SLAM3::IMU::Point> vImuMeas;
         proccIm = 0;
         cv::Ptr<cv::CLAHE> clahe = cv::createCLAHE(3.0, cv::Size(8, 8));
+        vector<vector<string> > vvstrImages(nImages[seq]);
+        for(int ni=0; ni<nImages[seq]; ni++)
+            vvstrImages[ni].push_back(vstrImageFilenames[seq][ni]);
+        ORB_SLAM3::ImagePrefetcher images(vvstrImages, cv::IMREAD_GRAYSCALE);
+
         for(int ni=0; ni<nImages[seq]; ni++, proccIm++)
         {
 
             // Read image from file
-            im = cv::imread(vstrImageFilenames[seq][ni],cv::IMREAD_GRAYSCALE);
+            im = images.Get(ni);
 
             // clahe
             clahe->apply(im,im);
@@ -183,7 +191,7 @@ int main(int argc, char **argv)
             else if(ni>0)
                 T = tframe-vTimestampsCam[seq][ni-1];
 
-            if(ttrack<T)
+            if(!bFast && ttrack<T)
                 usleep((T-ttrack)*1e6);
 
         }
@@ -26,6 +26,7 @@
 #include<opencv2/core/core.hpp>
 
 #include<System.h>
+#include<ImagePrefetcher.h>
 
 using namespace std;
 
@@ -34,9 +35,11 @@ void LoadImages(const string &strImagePath, const string &strPathTimes,
 
 int main(int argc, char **argv)
 {  
+    const bool bFast = ORB_SLAM3::ImagePrefetcher::ParseFastMode(argc, argv);
+
     if(argc < 5)
     {
-        cerr << endl << "Usage: ./mono_euroc path_to_vocabulary path_to_settings path_to_sequence_folder_1 path_to_times_file_1 (path_to_image_folder_2 path_to_times_file_2 ... path_to_image_folder_N path_to_times_file_N) (trajectory_file_name)" << endl;
+        cerr << endl << "Usage: ./mono_euroc path_to_vocabulary path_to_settings path_to_sequence_folder_1 path_to_times_file_1 (path_to_image_folder_2 path_to_times_file_2 ... path_to_image_folder_N path_to_times_file_N) (trajectory_file_name) [--fast]" << endl;
         return 1;
     }
 
@@ -87,11 +90,16 @@ int main(int argc, char **argv)
         // Main loop
         cv::Mat im;
         int proccIm = 0;
+        vector<vector<string> > vvstrImages(nImages[seq]);
+        for(int ni=0; ni<nImages[seq]; ni++)
+            vvstrImages[ni].push_back(vstrImageFilenames[seq][ni]);
+        ORB_SLAM3::ImagePrefetcher images(vvstrImages, cv::IMREAD_UNCHANGED);
+
         for(int ni=0; ni<nImages[seq]; ni++, proccIm++)
         {
 
             // Read image from file
-            im = cv::imread(vstrImageFilenames[seq][ni],cv::IMREAD_UNCHANGED);
+            im = images.Get(ni);
             double tframe = vTimestampsCam[seq][ni];
 
             if(im.empty())
@@ -132,7 +140,7 @@ int main(int argc, char **argv)
             else if(ni>0)
                 T = tframe-vTimestampsCam[seq][ni-1];
 
-            if(ttrack<T)
+            if(!bFast && ttrack<T)
                 usleep((T-ttrack)*1e6);
         }
 
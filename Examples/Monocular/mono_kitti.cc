@@ -25,6 +25,7 @@
 #include<opencv2/core/core.hpp>
 
 #include"System.h"
+#include"ImagePrefetcher.h"
 
 using namespace std;
 
@@ -33,9 +34,11 @@ void LoadImages(const string &strSequence, vector<string> &vstrImageFilenames,
 
 int main(int argc, char **argv)
 {
+    const bool bFast = ORB_SLAM3::ImagePrefetcher::ParseFastMode(argc, argv);
+
     if(argc != 4)
     {
-        cerr << endl << "Usage: ./mono_kitti path_to_vocabulary path_to_settings path_to_sequence" << endl;
+        cerr << endl << "Usage: ./mono_kitti path_to_vocabulary path_to_settings path_to_sequence [--fast]" << endl;
         return 1;
     }
 
@@ -55,10 +58,15 @@ int main(int argc, char **argv)
 
     // Main loop
     cv::Mat im;
+    vector<vector<string> > vvstrImages(nImages);
+    for(int ni=0; ni<nImages; ni++)
+        vvstrImages[ni].push_back(vstrImageFilenames[ni]);
+    ORB_SLAM3::ImagePrefetcher images(vvstrImages, cv::IMREAD_UNCHANGED);
+
     for(int ni=0; ni<nImages; ni++)
     {
         // Read image from file
-        im = cv::imread(vstrImageFilenames[ni],cv::IMREAD_UNCHANGED);
+        im = images.Get(ni);
         double tframe = vTimestamps[ni];
 
         if(im.empty())
@@ -93,7 +101,7 @@ int main(int argc, char **argv)
         else if(ni>0)
             T = tframe-vTimestamps[ni-1];
 
-        if(ttrack<T)
+        if(!bFast && ttrack<T)
             usleep((T-ttrack)*1e6);
     }
 
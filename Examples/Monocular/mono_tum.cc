@@ -26,6 +26,7 @@
 #include<opencv2/core/core.hpp>
 
 #include<System.h>
+#include<ImagePrefetcher.h>
 
 using namespace std;
 
@@ -34,9 +35,11 @@ void LoadImages(const string &strFile, vector<string> &vstrImageFilenames,
 
 int main(int argc, char **argv)
 {
+    const bool bFast = ORB_SLAM3::ImagePrefetcher::ParseFastMode(argc, argv);
+
     if(argc != 4)
     {
-        cerr << endl << "Usage: ./mono_tum path_to_vocabulary path_to_settings path_to_sequence" << endl;
+        cerr << endl << "Usage: ./mono_tum path_to_vocabulary path_to_settings path_to_sequence [--fast]" << endl;
         return 1;
     }
 
@@ -57,10 +60,15 @@ int main(int argc, char **argv)
 
     // Main loop
     cv::Mat im;
+    vector<vector<string> > vvstrImages(nImages);
+    for(int ni=0; ni<nImages; ni++)
+        vvstrImages[ni].push_back(string(argv[3])+"/"+vstrImageFilenames[ni]);
+    ORB_SLAM3::ImagePrefetcher images(vvstrImages, cv::IMREAD_UNCHANGED);
+
     for(int ni=0; ni<nImages; ni++)
     {
         // Read image from file
-        im = cv::imread(string(argv[3])+"/"+vstrImageFilenames[ni],cv::IMREAD_UNCHANGED);
+        im = images.Get(ni);
         double tframe = vTimestamps[ni];
 
         if(im.empty())
@@ -96,7 +104,7 @@ int main(int argc, char **argv)
         else if(ni>0)
             T = tframe-vTimestamps[ni-1];
 
-        if(ttrack<T)
+        if(!bFast && ttrack<T)
             usleep((T-ttrack)*1e6);
     }
 
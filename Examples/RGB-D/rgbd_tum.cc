@@ -24,6 +24,7 @@
 #include<opencv2/core/core.hpp>
 
 #include<System.h>
+#include<ImagePrefetcher.h>
 
 using namespace std;
 
@@ -32,9 +33,11 @@ void LoadImages(const string &strAssociationFilename, vector<string> &vstrImageF
 
 int main(int argc, char **argv)
 {
+    const bool bFast = ORB_SLAM3::ImagePrefetcher::ParseFastMode(argc, argv);
+
     if(argc != 5)
     {
-        cerr << endl << "Usage: ./rgbd_tum path_to_vocabulary path_to_settings path_to_sequence path_to_association" << endl;
+        cerr << endl << "Usage: ./rgbd_tum path_to_vocabulary path_to_settings path_to_sequence path_to_association [--fast]" << endl;
         return 1;
     }
 
@@ -67,11 +70,18 @@ int main(int argc, char **argv)
 
     // Main loop
     cv::Mat imRGB, imD;
+    vector<vector<string> > vvstrImages(nImages);
+    for(int ni=0; ni<nImages; ni++)
+    {
+        vvstrImages[ni].push_back(string(argv[3])+"/"+vstrImageFilenamesRGB[ni]);
+        vvstrImages[ni].push_back(string(argv[3])+"/"+vstrImageFilenamesD[ni]);
+    }
+    ORB_SLAM3::ImagePrefetcher images(vvstrImages, cv::IMREAD_UNCHANGED);
+
     for(int ni=0; ni<nImages; ni++)
     {
         // Read image and depthmap from file
-        imRGB = cv::imread(string(argv[3])+"/"+vstrImageFilenamesRGB[ni],cv::IMREAD_UNCHANGED); //,cv::IMREAD_UNCHANGED);
-        imD = cv::imread(string(argv[3])+"/"+vstrImageFilenamesD[ni],cv::IMREAD_UNCHANGED); //,cv::IMREAD_UNCHANGED);
+        images.Get(ni, imRGB, imD);
         double tframe = vTimestamps[ni];
 
         if(imRGB.empty())
@@ -107,7 +117,7 @@ int main(int argc, char **argv)
         else if(ni>0)
             T = tframe-vTimestamps[ni-1];
 
-        if(ttrack<T)
+        if(!bFast && ttrack<T)
             usleep((T-ttrack)*1e6);
     }
 
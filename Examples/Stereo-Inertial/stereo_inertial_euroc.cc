@@ -28,6 +28,7 @@
 
 
 #include<System.h>
+#include<ImagePrefetcher.h>
 #include "ImuTypes.h"
 #include "Optimizer.h"
 
@@ -41,9 +42,11 @@ void LoadIMU(const string &strImuPath, vector<double> &vTimeStamps, vector<cv::P
 
 int main(int argc, char **argv)
 {
+    const bool bFast = ORB_SLAM3::ImagePrefetcher::ParseFastMode(argc, argv);
+
     if(argc < 5)
     {
-        cerr << endl << "Usage: ./stereo_inertial_euroc path_to_vocabulary path_to_settings path_to_sequence_folder_1 path_to_times_file_1 (path_to_image_folder_2 path_to_times_file_2 ... path_to_image_folder_N path_to_times_file_N) " << endl;
+        cerr << endl << "Usage: ./stereo_inertial_euroc path_to_vocabulary path_to_settings path_to_sequence_folder_1 path_to_times_file_1 (path_to_image_folder_2 path_to_times_file_2 ... path_to_image_folder_N path_to_times_file_N) [--fast]" << endl;
         return 1;
     }
 
@@ -146,6 +149,9 @@ int main(int argc, char **argv)
         return -1;
     }
 
+    // With Stereo.Rectify the library rectifies the images itself
+    const bool bRectifyInSystem = !fsSettings["Stereo.Rectify"].empty() && (int)fsSettings["Stereo.Rectify"] != 0;
+
     cv::Mat M1l,M2l,M1r,M2r;
     cv::initUndistortRectifyMap(K_l,D_l,R_l,P_l.rowRange(0,3).colRange(0,3),cv::Size(cols_l,rows_l),CV_32F,M1l,M2l);
     cv::initUndistortRectifyMap(K_r,D_r,R_r,P_r.rowRange(0,3).colRange(0,3),cv::Size(cols_r,rows_r),CV_32F,M1r,M2r);
@@ -170,11 +176,18 @@ int main(int argc, char **argv)
         double t_track = 0;
         int num_rect = 0;
         int proccIm = 0;
+        vector<vector<string> > vvstrImages(nImages[seq]);
+        for(int ni=0; ni<nImages[seq]; ni++)
+        {
+            vvstrImages[ni].push_back(vstrImageLeft[seq][ni]);
+            vvstrImages[ni].push_back(vstrImageRight[seq][ni]);
+        }
+        ORB_SLAM3::ImagePrefetcher images(vvstrImages, cv::IMREAD_UNCHANGED);
+
         for(int ni=0; ni<nImages[seq]; ni++, proccIm++)
         {
             // Read left and right images from file
-            imLeft = cv::imread(vstrImageLeft[seq][ni],cv::IMREAD_UNCHANGED);
-            imRight = cv::imread(vstrImageRight[seq][ni],cv::IMREAD_UNCHANGED);
+            images.Get(ni, imLeft, imRight);
 
             if(imLeft.empty())
             {
@@ -198,8 +211,16 @@ int main(int argc, char **argv)
             std::chrono::monotonic_clock::time_point t_Start_Rect = std::chrono::monotonic_clock::now();
     #endif
 #endif
-            cv::remap(imLeft,imLeftRect,M1l,M2l,cv::INTER_LINEAR);
-            cv::remap(imRight,imRightRect,M1r,M2r,cv::INTER_LINEAR);
+            if(bRectifyInSystem)
+            {
+                imLeftRect = imLeft;
+                imRightRect = imRight;
+            }
+            else
+            {
+                cv::remap(imLeft,imLeftRect,M1l,M2l,cv::INTER_LINEAR);
+                cv::remap(imRight,imRightRect,M1r,M2r,cv::INTER_LINEAR);
+            }
 
 #ifdef REGISTER_TIMES
     #ifdef COMPILEDWITHC11
@@ -255,7 +276,7 @@ int main(int argc, char **argv)
             else if(ni>0)
                 T = tframe-vTimestampsCam[seq][ni-1];
 
-            if(ttrack<T)
+            if(!bFast && ttrack<T)
                 usleep((T-ttrack)*1e6); // 1e6
         }
 
@@ -0,0 +1,256 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include<iostream>
+#include<algorithm>
+#include<chrono>
+#include<cmath>
+#include<deque>
+#include<mutex>
+#include<atomic>
+#include<condition_variable>
+#include<signal.h>
+
+#include <opencv2/core/core.hpp>
+#include <librealsense2/rs.hpp>
+
+#include<System.h>
+#include "ImuTypes.h"
+
+using namespace std;
+
+static atomic<bool> bExit(false);
+
+void ExitHandler(int)
+{
+    bExit = true;
+}
+
+// The D435i gives the accelerometer and the gyroscope as separate streams at different rates. The
+// accelerometer is interpolated at the gyroscope timestamps and every measurement is given to the
+// system as it arrives (System::GrabImuData).
+class ImuAligner
+{
+public:
+    ImuAligner(ORB_SLAM3::System* pSLAM): mpSLAM(pSLAM), mnAccel(0) {}
+
+    void AddGyro(const double &t, const rs2_vector &w)
+    {
+        mlGyro.push_back(make_pair(t,w));
+        Flush();
+    }
+
+    void AddAccel(const double &t, const rs2_vector &a)
+    {
+        mPrevAccel = mAccel;
+        mAccel = make_pair(t,a);
+        mnAccel++;
+        Flush();
+    }
+
+protected:
+    // Gyroscope measurements between the last two accelerometer measurements
+    void Flush()
+    {
+        while(!mlGyro.empty() && mnAccel>0 && mlGyro.front().first<=mAccel.first)
+        {
+            const double t = mlGyro.front().first;
+            const rs2_vector &w = mlGyro.front().second;
+            if(mnAccel>1 && t>=mPrevAccel.first)
+            {
+                const double dt = mAccel.first-mPrevAccel.first;
+                const float s = dt>0 ? float((t-mPrevAccel.first)/dt) : 1.f;
+                const rs2_vector &a0 = mPrevAccel.second;
+                const rs2_vector &a1 = mAccel.second;
+                mpSLAM->GrabImuData(ORB_SLAM3::IMU::Point(a0.x+s*(a1.x-a0.x), a0.y+s*(a1.y-a0.y), a0.z+s*(a1.z-a0.z),
+                                                          w.x, w.y, w.z, t));
+            }
+            mlGyro.pop_front();
+        }
+    }
+
+    ORB_SLAM3::System* mpSLAM;
+    deque<pair<double,rs2_vector> > mlGyro;
+    pair<double,rs2_vector> mPrevAccel, mAccel;
+    int mnAccel;
+};
+
+int main(int argc, char **argv)
+{
+    if(argc < 3 || argc > 4)
+    {
+        cerr << endl << "Usage: ./stereo_inertial_realsense_D435i path_to_vocabulary path_to_settings (trajectory_file_name)" << endl;
+        return 1;
+    }
+
+    string file_name;
+    if(argc == 4)
+        file_name = string(argv[3]);
+
+    // The image size and rate are those of the settings file
+    cv::FileStorage fsSettings(argv[2], cv::FileStorage::READ);
+    if(!fsSettings.isOpened())
+    {
+        cerr << "ERROR: Wrong path to settings" << endl;
+        return -1;
+    }
+    const int width = fsSettings["Camera.width"];
+    const int height = fsSettings["Camera.height"];
+    const int fps = int(fsSettings["Camera.fps"].real());
+    fsSettings.release();
+
+    rs2::context ctx;
+    rs2::device_list devices = ctx.query_devices();
+    if(devices.size() == 0)
+    {
+        cerr << "No RealSense device connected" << endl;
+        return 1;
+    }
+    rs2::device device = devices[0];
+    cout << "Using " << device.get_info(RS2_CAMERA_INFO_NAME) << " " << device.get_info(RS2_CAMERA_INFO_SERIAL_NUMBER) << endl;
+
+    vector<rs2::sensor> sensors = device.query_sensors();
+    for(size_t i=0; i<sensors.size(); i++)
+    {
+        // Timestamps of the device clock, for images and IMU alike, not converted to the host clock
+        if(sensors[i].supports(RS2_OPTION_GLOBAL_TIME_ENABLED))
+            sensors[i].set_option(RS2_OPTION_GLOBAL_TIME_ENABLED, 0.f);
+        // The projected pattern moves with the camera, it would be tracked as texture
+        if(sensors[i].is<rs2::depth_sensor>() && sensors[i].supports(RS2_OPTION_EMITTER_ENABLED))
+            sensors[i].set_option(RS2_OPTION_EMITTER_ENABLED, 0.f);
+    }
+
+    rs2::config cfg;
+    cfg.enable_device(device.get_info(RS2_CAMERA_INFO_SERIAL_NUMBER));
+    cfg.enable_stream(RS2_STREAM_INFRARED, 1, width, height, RS2_FORMAT_Y8, fps);
+    cfg.enable_stream(RS2_STREAM_INFRARED, 2, width, height, RS2_FORMAT_Y8, fps);
+    cfg.enable_stream(RS2_STREAM_ACCEL, RS2_FORMAT_MOTION_XYZ32F, 250);
+    cfg.enable_stream(RS2_STREAM_GYRO, RS2_FORMAT_MOTION_XYZ32F, 200);
+
+    // Create SLAM system. It initializes all system threads and gets ready to process frames.
+    ORB_SLAM3::System SLAM(argv[1],argv[2],ORB_SLAM3::System::IMU_STEREO, true);
+
+    ImuAligner aligner(&SLAM);
+    mutex mutexImu;
+
+    // Newest frameset not tracked yet. It is kept by reference: the images are tracked from the
+    // librealsense buffers and given back to its pool when the next frameset is taken
+    mutex mutexFrames;
+    condition_variable cvFrames;
+    rs2::frameset pendingFrames;
+    bool bNewFrames = false;
+    unsigned long nDropped = 0;
+    atomic<bool> bDomainChecked(false);
+
+    auto callback = [&](const rs2::frame &frame)
+    {
+        if(!bDomainChecked.exchange(true) && frame.get_frame_timestamp_domain() != RS2_TIMESTAMP_DOMAIN_HARDWARE_CLOCK)
+            cerr << "WARNING: frames without hardware timestamps, images and IMU may be misaligned" << endl;
+
+        if(rs2::frameset fs = frame.as<rs2::frameset>())
+        {
+            unique_lock<mutex> lock(mutexFrames);
+            if(bNewFrames)
+                nDropped++;
+            pendingFrames = fs;
+            bNewFrames = true;
+            cvFrames.notify_one();
+        }
+        else if(rs2::motion_frame motion = frame.as<rs2::motion_frame>())
+        {
+            // Device timestamps in ms
+            const double t = motion.get_timestamp()*1e-3;
+            unique_lock<mutex> lock(mutexImu);
+            if(motion.get_profile().stream_type() == RS2_STREAM_GYRO)
+                aligner.AddGyro(t, motion.get_motion_data());
+            else
+                aligner.AddAccel(t, motion.get_motion_data());
+        }
+    };
+
+    rs2::pipeline pipe(ctx);
+    rs2::pipeline_profile profile = pipe.start(cfg, callback);
+
+    // Calibration of the device, for the settings file
+    rs2::video_stream_profile left = profile.get_stream(RS2_STREAM_INFRARED, 1).as<rs2::video_stream_profile>();
+    rs2::stream_profile right = profile.get_stream(RS2_STREAM_INFRARED, 2);
+    rs2::stream_profile imu = profile.get_stream(RS2_STREAM_GYRO);
+    const rs2_intrinsics K = left.get_intrinsics();
+    const rs2_extrinsics Tlr = left.get_extrinsics_to(right);
+    const rs2_extrinsics Tbc = left.get_extrinsics_to(imu);
+    cout << "Camera.fx: " << K.fx << " Camera.fy: " << K.fy << " Camera.cx: " << K.ppx << " Camera.cy: " << K.ppy << endl;
+    cout << "Camera.bf: " << K.fx*fabs(Tlr.translation[0]) << endl;
+    // rs2_extrinsics rotations are column major
+    cout << "Tbc: [";
+    for(int i=0; i<3; i++)
+        cout << Tbc.rotation[i] << ", " << Tbc.rotation[3+i] << ", " << Tbc.rotation[6+i] << ", " << Tbc.translation[i] << ", ";
+    cout << "0.0, 0.0, 0.0, 1.0]" << endl;
+
+    signal(SIGINT, ExitHandler);
+    cout << endl << "-------" << endl;
+    cout << "Tracking, Ctrl-C to stop" << endl;
+
+    while(!bExit)
+    {
+        rs2::frameset fs;
+        {
+            unique_lock<mutex> lock(mutexFrames);
+            if(!cvFrames.wait_for(lock, chrono::milliseconds(1000), [&]{return bNewFrames;}))
+            {
+                cerr << "No images from the camera" << endl;
+                continue;
+            }
+            fs = pendingFrames;
+            pendingFrames = rs2::frameset();
+            bNewFrames = false;
+        }
+
+        rs2::video_frame imLeft = fs.get_infrared_frame(1);
+        rs2::video_frame imRight = fs.get_infrared_frame(2);
+        if(!imLeft || !imRight)
+            continue;
+
+        // The infrared images are rectified by the device. They are tracked from the frame buffers
+        // without copies, IMU measurements up to their timestamp are waited for by the system
+        const double tframe = imLeft.get_timestamp()*1e-3;
+        SLAM.TrackStereo(static_cast<const unsigned char*>(imLeft.get_data()), static_cast<const unsigned char*>(imRight.get_data()),
+                         imLeft.get_width(), imLeft.get_height(), imLeft.get_stride_in_bytes(), tframe);
+    }
+
+    pipe.stop();
+    cout << "Images dropped while tracking: " << nDropped << endl;
+
+    // Stop all threads
+    SLAM.Shutdown();
+
+    // Save camera trajectory
+    if(!file_name.empty())
+    {
+        const string kf_file =  "kf_" + file_name + ".txt";
+        const string f_file =  "f_" + file_name + ".txt";
+        SLAM.SaveTrajectoryEuRoC(f_file);
+        SLAM.SaveKeyFrameTrajectoryEuRoC(kf_file);
+    }
+    else
+    {
+        SLAM.SaveTrajectoryEuRoC("CameraTrajectory.txt");
+        SLAM.SaveKeyFrameTrajectoryEuRoC("KeyFrameTrajectory.txt");
+    }
+
+    return 0;
+}
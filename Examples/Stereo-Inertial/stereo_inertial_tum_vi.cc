@@ -26,6 +26,7 @@
 #include<opencv2/core/core.hpp>
 
 #include<System.h>
+#include<ImagePrefetcher.h>
 #include "ImuTypes.h"
 
 using namespace std;
@@ -38,6 +39,8 @@ void LoadIMU(const string &strImuPath, vector<double> &vTimeStamps, vector<cv::P
 double ttrack_tot = 0;
 int main(int argc, char **argv)
 {
+    const bool bFast = ORB_SLAM3::ImagePrefetcher::ParseFastMode(argc, argv);
+
     const int num_seq = (argc-3)/4;
     cout << "num_seq = " << num_seq << endl;
     bool bFileName= (((argc-3) % 4) == 1);
@@ -47,7 +50,7 @@ int main(int argc, char **argv)
 
     if(argc < 7) 
     {
-        cerr << endl << "Usage: ./stereo_inertial_tum_vi path_to_vocabulary path_to_settings path_to_image_folder_1 path_to_image_folder_2 path_to_times_file path_to_imu_data (trajectory_file_name)" << endl;
+        cerr << endl << "Usage: ./stereo_inertial_tum_vi path_to_vocabulary path_to_settings path_to_image_folder_1 path_to_image_folder_2 path_to_times_file path_to_imu_data (trajectory_file_name) [--fast]" << endl;
         return 1;
     }
 
@@ -126,12 +129,19 @@ int main(int argc, char **argv)
         vector<ORB_SLAM3::IMU::Point> vImuMeas;
         proccIm = 0;
         cv::Ptr<cv::CLAHE> clahe = cv::createCLAHE(3.0, cv::Size(8, 8));
+        vector<vector<string> > vvstrImages(nImages[seq]);
+        for(int ni=0; ni<nImages[seq]; ni++)
+        {
+            vvstrImages[ni].push_back(vstrImageLeftFilenames[seq][ni]);
+            vvstrImages[ni].push_back(vstrImageRightFilenames[seq][ni]);
+        }
+        ORB_SLAM3::ImagePrefetcher images(vvstrImages, cv::IMREAD_GRAYSCALE);
+
         for(int ni=0; ni<nImages[seq]; ni++, proccIm++)
         {
 
             // Read image from file
-            imLeft = cv::imread(vstrImageLeftFilenames[seq][ni],cv::IMREAD_GRAYSCALE);
-            imRight = cv::imread(vstrImageRightFilenames[seq][ni],cv::IMREAD_GRAYSCALE);
+            images.Get(ni, imLeft, imRight);
 
             // clahe
             clahe->apply(imLeft,imLeft);
@@ -189,7 +199,7 @@ int main(int argc, char **argv)
             else if(ni>0)
                 T = tframe-vTimestampsCam[seq][ni-1];
 
-            if(ttrack<T)
+            if(!bFast && ttrack<T)
                 usleep((T-ttrack)*1e6);
         }
         if(seq < num_seq - 1)
@@ -25,6 +25,7 @@
 #include<opencv2/core/core.hpp>
 
 #include<System.h>
+#include<ImagePrefetcher.h>
 
 using namespace std;
 
@@ -33,9 +34,11 @@ void LoadImages(const string &strPathToSequence, vector<string> &vstrImageLeft,
 
 int main(int argc, char **argv)
 {
+    const bool bFast = ORB_SLAM3::ImagePrefetcher::ParseFastMode(argc, argv);
+
     if(argc != 4)
     {
-        cerr << endl << "Usage: ./stereo_kitti path_to_vocabulary path_to_settings path_to_sequence" << endl;
+        cerr << endl << "Usage: ./stereo_kitti path_to_vocabulary path_to_settings path_to_sequence [--fast]" << endl;
         return 1;
     }
 
@@ -47,6 +50,14 @@ int main(int argc, char **argv)
 
     const int nImages = vstrImageLeft.size();
 
+    vector<vector<string> > vvstrImages(nImages);
+    for(int ni=0; ni<nImages; ni++)
+    {
+        vvstrImages[ni].push_back(vstrImageLeft[ni]);
+        vvstrImages[ni].push_back(vstrImageRight[ni]);
+    }
+    ORB_SLAM3::ImagePrefetcher images(vvstrImages, cv::IMREAD_UNCHANGED);
+
     // Create SLAM system. It initializes all system threads and gets ready to process frames.
     ORB_SLAM3::System SLAM(argv[1],argv[2],ORB_SLAM3::System::STEREO,true);
 
@@ -59,8 +70,7 @@ int main(int argc, char **argv)
     for(int ni=0; ni<nImages; ni++)
     {
         // Read left and right images from file
-        imLeft = cv::imread(vstrImageLeft[ni],cv::IMREAD_UNCHANGED);
-        imRight = cv::imread(vstrImageRight[ni],cv::IMREAD_UNCHANGED);
+        images.Get(ni, imLeft, imRight);
         double tframe = vTimestamps[ni];
 
         if(imLeft.empty())
@@ -96,7 +106,7 @@ int main(int argc, char **argv)
         else if(ni>0)
             T = tframe-vTimestamps[ni-1];
 
-        if(ttrack<T)
+        if(!bFast && ttrack<T)
             usleep((T-ttrack)*1e6);
     }
 
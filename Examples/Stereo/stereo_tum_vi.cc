@@ -27,6 +27,7 @@
 #include<opencv2/core/core.hpp>
 
 #include<System.h>
+#include<ImagePrefetcher.h>
 
 using namespace std;
 
@@ -36,6 +37,8 @@ void LoadImages(const string &strPathLeft, const string &strPathRight, const str
 double ttrack_tot = 0;
 int main(int argc, char **argv)
 {
+    const bool bFast = ORB_SLAM3::ImagePrefetcher::ParseFastMode(argc, argv);
+
     const int num_seq = (argc-3)/3;
     cout << "num_seq = " << num_seq << endl;
     bool bFileName= (((argc-3) % 3) == 1);
@@ -45,7 +48,7 @@ int main(int argc, char **argv)
 
     if(argc < 6)
     {
-        cerr << endl << "Usage: ./stereo_tum_vi path_to_vocabulary path_to_settings path_to_image_folder1_1 path_to_image_folder2_1 path_to_times_file_1 (path_to_image_folder1_2 path_to_image_folder2_2 path_to_times_file_2 ... path_to_image_folder1_N path_to_image_folder2_N path_to_times_file_N) (trajectory_file_name)" << endl;
+        cerr << endl << "Usage: ./stereo_tum_vi path_to_vocabulary path_to_settings path_to_image_folder1_1 path_to_image_folder2_1 path_to_times_file_1 (path_to_image_folder1_2 path_to_image_folder2_2 path_to_times_file_2 ... path_to_image_folder1_N path_to_image_folder2_N path_to_times_file_N) (trajectory_file_name) [--fast]" << endl;
         return 1;
     }
 
@@ -104,12 +107,19 @@ int main(int argc, char **argv)
     {
         // Main loop
         proccIm = 0;
+        vector<vector<string> > vvstrImages(nImages[seq]);
+        for(int ni=0; ni<nImages[seq]; ni++)
+        {
+            vvstrImages[ni].push_back(vstrImageLeftFilenames[seq][ni]);
+            vvstrImages[ni].push_back(vstrImageRightFilenames[seq][ni]);
+        }
+        ORB_SLAM3::ImagePrefetcher images(vvstrImages, cv::IMREAD_GRAYSCALE);
+
         for(int ni=0; ni<nImages[seq]; ni++, proccIm++)
         {
 
             // Read image from file
-            imLeft = cv::imread(vstrImageLeftFilenames[seq][ni],cv::IMREAD_GRAYSCALE);
-            imRight = cv::imread(vstrImageRightFilenames[seq][ni],cv::IMREAD_GRAYSCALE);
+            images.Get(ni, imLeft, imRight);
 
             double tframe = vTimestampsCam[seq][ni];
 
@@ -147,7 +157,7 @@ int main(int argc, char **argv)
             else if(ni>0)
                 T = tframe-vTimestampsCam[seq][ni-1];
 
-            if(ttrack<T)
+            if(!bFast && ttrack<T)
                 usleep((T-ttrack)*1e6);
         }
         if(seq < num_seq - 1)
@@ -0,0 +1,68 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include<iostream>
+#include<chrono>
+
+#include"ORBVocabulary.h"
+
+using namespace std;
+
+int main(int argc, char **argv)
+{
+    if(argc != 3)
+    {
+        cerr << endl << "Usage: ./bin_vocabulary path_to_vocabulary_txt path_to_vocabulary_bin" << endl;
+        return 1;
+    }
+
+    ORB_SLAM3::ORBVocabulary voc;
+
+    cout << "Loading text vocabulary from " << argv[1] << " ..." << endl;
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    if(!voc.loadFromTextFile(argv[1]))
+    {
+        cerr << "Failed to open at: " << argv[1] << endl;
+        return 1;
+    }
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+    cout << voc << endl;
+    cout << "Text load time: " << std::chrono::duration_cast<std::chrono::duration<double> >(t1 - t0).count() << " s" << endl;
+
+    if(!voc.saveToBinaryFile(argv[2]))
+    {
+        cerr << "Failed to write binary vocabulary at: " << argv[2] << endl;
+        return 1;
+    }
+
+    // Check the written file
+    ORB_SLAM3::ORBVocabulary vocBin;
+    std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+    if(!vocBin.loadFromBinaryFile(argv[2]) || vocBin.size() != voc.size())
+    {
+        cerr << "Binary vocabulary check failed" << endl;
+        return 1;
+    }
+    std::chrono::steady_clock::time_point t3 = std::chrono::steady_clock::now();
+    cout << "Binary load time: " << std::chrono::duration_cast<std::chrono::duration<double> >(t3 - t2).count() << " s" << endl;
+
+    cout << "Binary vocabulary saved at: " << argv[2] << endl;
+
+    return 0;
+}
@@ -0,0 +1,96 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include<iostream>
+#include<cstdlib>
+#include<cstring>
+#include<string>
+
+#include"System.h"
+
+using namespace std;
+
+static bool ParseSensor(const string &strSensor, ORB_SLAM3::System::eSensor &sensor)
+{
+    if(strSensor=="mono")
+        sensor = ORB_SLAM3::System::MONOCULAR;
+    else if(strSensor=="stereo")
+        sensor = ORB_SLAM3::System::STEREO;
+    else if(strSensor=="rgbd")
+        sensor = ORB_SLAM3::System::RGBD;
+    else if(strSensor=="mono_inertial")
+        sensor = ORB_SLAM3::System::IMU_MONOCULAR;
+    else if(strSensor=="stereo_inertial")
+        sensor = ORB_SLAM3::System::IMU_STEREO;
+    else
+        return false;
+    return true;
+}
+
+// Offline refinement of a saved atlas: loads it, fuses duplicated map points, culls redundant
+// keyframes and runs a long global BA on all the cores, then saves the result.
+// Set Optimizer.LinearSolver: "cholmod" in the settings for the multi-threaded sparse solver
+int main(int argc, char **argv)
+{
+    if(argc < 6)
+    {
+        cerr << endl << "Usage: ./map_refine path_to_vocabulary path_to_settings mono|stereo|rgbd|mono_inertial|stereo_inertial"
+             << " input_atlas output_atlas [--iterations N] [--no-fusion] [--no-culling]" << endl;
+        return 1;
+    }
+
+    ORB_SLAM3::System::eSensor sensor;
+    if(!ParseSensor(argv[3], sensor))
+    {
+        cerr << "Unknown sensor " << argv[3] << endl;
+        return 1;
+    }
+
+    int nIterations = 100;
+    bool bFuse = true;
+    bool bCull = true;
+    for(int i=6; i<argc; i++)
+    {
+        if(!strcmp(argv[i], "--iterations") && i+1<argc)
+            nIterations = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--no-fusion"))
+            bFuse = false;
+        else if(!strcmp(argv[i], "--no-culling"))
+            bCull = false;
+        else
+        {
+            cerr << "Unknown option " << argv[i] << endl;
+            return 1;
+        }
+    }
+
+    ORB_SLAM3::System SLAM(argv[1], argv[2], sensor, false, 0, string(), argv[4]);
+
+    const int nMaps = SLAM.RefineAtlas(nIterations, bFuse, bCull);
+    cout << nMaps << " maps refined" << endl;
+
+    SLAM.Shutdown();
+
+    if(!SLAM.SaveAtlas(argv[5]))
+    {
+        cerr << "Failed to save the atlas to " << argv[5] << endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,82 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include<iostream>
+#include<csignal>
+#include<cstdlib>
+#include<thread>
+#include<unistd.h>
+
+#include"ORBVocabulary.h"
+#include"MapServer.h"
+
+using namespace std;
+
+static volatile sig_atomic_t bStop = 0;
+
+static void HandleSignal(int)
+{
+    bStop = 1;
+}
+
+int main(int argc, char **argv)
+{
+    if(argc < 3 || argc > 4)
+    {
+        cerr << endl << "Usage: ./map_server path_to_vocabulary port [min_inliers]" << endl;
+        return 1;
+    }
+
+    const string strVocFile = argv[1];
+    ORB_SLAM3::ORBVocabulary voc;
+    cout << "Loading ORB Vocabulary from " << strVocFile << " ..." << endl;
+    bool bVocLoad;
+    if(strVocFile.size() > 4 && strVocFile.compare(strVocFile.size() - 4, 4, ".bin") == 0)
+        bVocLoad = voc.loadFromBinaryFile(strVocFile);
+    else
+        bVocLoad = voc.loadFromTextFile(strVocFile);
+    if(!bVocLoad)
+    {
+        cerr << "Failed to open at: " << strVocFile << endl;
+        return 1;
+    }
+
+    const int nMinInliers = argc == 4 ? atoi(argv[3]) : 20;
+    ORB_SLAM3::MapServer server(&voc, atoi(argv[2]), nMinInliers);
+
+    signal(SIGINT, HandleSignal);
+    signal(SIGTERM, HandleSignal);
+
+    thread tServer(&ORB_SLAM3::MapServer::Run, &server);
+    while(!bStop && !server.isFinished())
+        usleep(100000);
+
+    server.RequestFinish();
+    tServer.join();
+
+    const vector<ORB_SLAM3::MapServer::Alignment> vAlignments = server.GetAlignments();
+    cout << server.KeyFramesInServer() << " keyframes received, " << vAlignments.size() << " map overlaps found" << endl;
+    for(size_t i=0; i<vAlignments.size(); i++)
+    {
+        const ORB_SLAM3::MapServer::Alignment &a = vAlignments[i];
+        cout << "  agent " << a.nAgent1 << " map " << a.nMap1 << " <- agent " << a.nAgent2 << " map " << a.nMap2
+             << ": s=" << a.s << " t=" << a.t.t() << " (" << a.nInliers << " inliers)" << endl;
+    }
+
+    return 0;
+}
@@ -13,10 +13,18 @@
 #include <vector>
 #include <string>
 #include <sstream>
+#include <algorithm>
+#include <cstring>
 #include <stdint-gcc.h>
 
 #include "FORB.h"
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
 using namespace std;
 
 namespace DBoW2 {
@@ -100,6 +108,51 @@ int FORB::distance(const FORB::TDescriptor &a,
   return dist;
 }
 
+// --------------------------------------------------------------------------
+
+void FORB::distances(const unsigned char *a, const unsigned char *b,
+  int N, int *dists)
+{
+  // ORB descriptors are 32 bytes: one AVX2 register
+#if defined(__AVX2__)
+  // Per byte popcount with a nibble lookup table, summed by _mm256_sad_epu8
+  const __m256i lut = _mm256_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,
+                                       0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+  const __m256i low = _mm256_set1_epi8(0x0f);
+  const __m256i va = _mm256_loadu_si256((const __m256i*)a);
+  for(int i = 0; i < N; ++i, b += 32)
+  {
+    const __m256i v = _mm256_xor_si256(va, _mm256_loadu_si256((const __m256i*)b));
+    const __m256i cnt = _mm256_add_epi8(
+      _mm256_shuffle_epi8(lut, _mm256_and_si256(v, low)),
+      _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(v, 4), low)));
+    const __m256i sum = _mm256_sad_epu8(cnt, _mm256_setzero_si256());
+    const __m128i sum128 = _mm_add_epi64(_mm256_castsi256_si128(sum),
+      _mm256_extracti128_si256(sum, 1));
+    dists[i] = _mm_cvtsi128_si32(sum128) + _mm_extract_epi32(sum128, 2);
+  }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  const uint8x16_t a0 = vld1q_u8(a), a1 = vld1q_u8(a + 16);
+  for(int i = 0; i < N; ++i, b += 32)
+  {
+    const uint8x16_t c = vaddq_u8(vcntq_u8(veorq_u8(a0, vld1q_u8(b))),
+      vcntq_u8(veorq_u8(a1, vld1q_u8(b + 16))));
+    const uint64x2_t s = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(c)));
+    dists[i] = (int)(vgetq_lane_u64(s, 0) + vgetq_lane_u64(s, 1));
+  }
+#else
+  uint64_t va[4];
+  memcpy(va, a, 32);
+  for(int i = 0; i < N; ++i, b += 32)
+  {
+    uint64_t vb[4];
+    memcpy(vb, b, 32);
+    dists[i] = __builtin_popcountll(va[0] ^ vb[0]) + __builtin_popcountll(va[1] ^ vb[1]) +
+      __builtin_popcountll(va[2] ^ vb[2]) + __builtin_popcountll(va[3] ^ vb[3]);
+  }
+#endif
+}
+
 // --------------------------------------------------------------------------
   
 std::string FORB::toString(const FORB::TDescriptor &a)
@@ -136,6 +189,29 @@ void FORB::fromString(FORB::TDescriptor &a, const std::string &s)
 
 // --------------------------------------------------------------------------
 
+void FORB::toBinary(const FORB::TDescriptor &a, unsigned char *p)
+{
+  const unsigned char *d = a.ptr<unsigned char>();
+  std::copy(d, d + FORB::L, p);
+}
+
+// --------------------------------------------------------------------------
+
+void FORB::fromBinary(FORB::TDescriptor &a, const unsigned char *p)
+{
+  a.create(1, FORB::L, CV_8U);
+  std::copy(p, p + FORB::L, a.ptr<unsigned char>());
+}
+
+// --------------------------------------------------------------------------
+
+void FORB::wrapBinary(FORB::TDescriptor &a, unsigned char *p)
+{
+  a = cv::Mat(1, FORB::L, CV_8U, p);
+}
+
+// --------------------------------------------------------------------------
+
 void FORB::toMat32F(const std::vector<TDescriptor> &descriptors, 
   cv::Mat &mat)
 {
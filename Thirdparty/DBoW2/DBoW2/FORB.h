@@ -46,6 +46,17 @@ public:
    */
   static int distance(const TDescriptor &a, const TDescriptor &b);
 
+  /**
+   * Calculates the distances between a descriptor and N descriptors
+   * stored one after the other (SIMD when available)
+   * @param a descriptor (L bytes)
+   * @param b N descriptors of L bytes each, contiguous
+   * @param N
+   * @param dists (out) N distances
+   */
+  static void distances(const unsigned char *a, const unsigned char *b,
+    int N, int *dists);
+
   /**
    * Returns a string version of the descriptor
    * @param a descriptor
@@ -60,6 +71,28 @@ public:
    */
   static void fromString(TDescriptor &a, const std::string &s);
 
+  /**
+   * Writes the L bytes of a descriptor into a buffer
+   * @param a descriptor
+   * @param p (out) buffer of at least L bytes
+   */
+  static void toBinary(const TDescriptor &a, unsigned char *p);
+
+  /**
+   * Returns a descriptor from L bytes (data is copied)
+   * @param a descriptor
+   * @param p buffer of at least L bytes
+   */
+  static void fromBinary(TDescriptor &a, const unsigned char *p);
+
+  /**
+   * Returns a descriptor that uses the given L bytes in place (no copy).
+   * The buffer must outlive the descriptor
+   * @param a descriptor
+   * @param p buffer of at least L bytes
+   */
+  static void wrapBinary(TDescriptor &a, unsigned char *p);
+
   /**
    * Returns a mat with the descriptors in float format
    * @param descriptors
@@ -3,6 +3,9 @@
  * Added functions: Save and Load from text files without using cv::FileStorage.
  * Date: August 2015
  * Raúl Mur-Artal
+ *
+ * Added functions: Save and Load from a binary file that can be memory mapped,
+ * so that node descriptors are used in place instead of being parsed.
  */
 
 /**
@@ -26,6 +29,13 @@
 #include <algorithm>
 #include <opencv2/core/core.hpp>
 #include <limits>
+#include <cstring>
+#include <stdint.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "FeatureVector.h"
 #include "BowVector.h"
@@ -145,6 +155,20 @@ public:
   virtual void transform(const std::vector<TDescriptor>& features,
     BowVector &v, FeatureVector &fv, int levelsup) const;
 
+  /**
+   * Transform a set of descriptors given as rows of F::L bytes (e.g. the
+   * descriptor matrix of an image) into a bow vector and a feature vector,
+   * without building a TDescriptor per feature
+   * @param descriptors first byte of the first descriptor
+   * @param stride bytes between consecutive descriptors
+   * @param N number of descriptors
+   * @param v (out) bow vector
+   * @param fv (out) feature vector of nodes and feature indexes
+   * @param levelsup levels to go up the vocabulary tree to get the node index
+   */
+  void transform(const unsigned char *descriptors, size_t stride, int N,
+    BowVector &v, FeatureVector &fv, int levelsup) const;
+
   /**
    * Transforms a single feature into a word (without weight)
    * @param feature
@@ -246,6 +270,42 @@ public:
    */
   void saveToTextFile(const std::string &filename) const;  
 
+  /**
+   * Loads the vocabulary from a binary file written by saveToBinaryFile.
+   * When bMap is true the file is memory mapped and the node descriptors
+   * point directly into the mapping (no parsing and no per-node copy).
+   * The mapping lives as long as the vocabulary.
+   * @param filename
+   * @param bMap map the file instead of copying the descriptors
+   * @return false if the file cannot be opened or is not a valid binary
+   *   vocabulary
+   */
+  bool loadFromBinaryFile(const std::string &filename, bool bMap = true);
+
+  /**
+   * Saves the vocabulary into a binary file
+   * @param filename
+   * @return false if the file could not be written
+   */
+  bool saveToBinaryFile(const std::string &filename) const;
+
+  /**
+   * Returns whether the node descriptors are backed by a file mapping
+   */
+  inline bool isMapped() const { return m_mapping != NULL; }
+
+  /**
+   * Returns the size of the file mapping (0 if not mapped)
+   */
+  inline size_t mappedSize() const { return m_mapping_size; }
+
+  /**
+   * Returns the approximate heap memory used by the vocabulary in bytes:
+   * tree nodes, word index, flattened tree and the node descriptors unless
+   * they live in the file mapping (see mappedSize)
+   */
+  size_t memoryUsage() const;
+
   /**
    * Saves the vocabulary into a file
    * @param filename
@@ -401,7 +461,63 @@ protected:
    * @param features
    */
   void setNodeWeights(const vector<vector<TDescriptor> > &features);
-  
+
+  /**
+   * Unmaps the binary vocabulary file, if any. Node descriptors must not be
+   * referenced after calling this
+   */
+  void releaseMapping();
+
+  /**
+   * Builds the flattened tree used to transform features from m_nodes.
+   * Must be called whenever the tree structure or descriptors change
+   */
+  void createFlatTree();
+
+  /**
+   * Propagates a feature down the flattened tree
+   * @param feature F::L bytes
+   * @param nid (out) if given, id of the node "levelsup" levels up
+   * @param levelsup
+   * @param dists buffer of at least m_flat_max_children distances
+   * @return id of the leaf node
+   */
+  NodeId descend(const unsigned char *feature, NodeId *nid, int levelsup,
+    int *dists) const;
+
+  /// Children of a node in the flattened tree
+  struct FlatNode
+  {
+    /// Slot of the first child (children are in consecutive slots)
+    uint32_t first;
+    /// Number of children (0 for leaves)
+    uint32_t count;
+
+    FlatNode(): first(0), count(0){}
+  };
+
+  /// Header of the binary vocabulary format. The header is followed by
+  /// the node arrays (root excluded), each one starting at an offset
+  /// multiple of 8: weights (double), parents (uint32), word ids (uint32,
+  /// BINARY_NO_WORD for inner nodes) and descriptors (descriptor_bytes each)
+  struct BinaryHeader
+  {
+    char magic[8];
+    uint32_t version;
+    int32_t k;
+    int32_t L;
+    int32_t scoring;
+    int32_t weighting;
+    uint32_t nodes;
+    uint32_t words;
+    uint32_t descriptor_bytes;
+  };
+
+  static const uint32_t BINARY_VERSION = 1;
+  static const uint32_t BINARY_NO_WORD = 0xFFFFFFFF;
+
+  static inline size_t binaryAlign(size_t n) { return (n + 7) & ~(size_t)7; }
+
 protected:
 
   /// Branching factor
@@ -425,6 +541,27 @@ protected:
   /// Words of the vocabulary (tree leaves)
   /// this condition holds: m_words[wid]->word_id == wid
   std::vector<Node*> m_words;
+
+  /// Memory mapped binary vocabulary (NULL if not mapped)
+  void *m_mapping;
+  size_t m_mapping_size;
+  /// Descriptor block of the mapping, node nid at (nid-1)*F::L
+  unsigned char *m_mapped_descriptors;
+
+  /// Flattened tree, indexed by node id. The children of each node are in
+  /// consecutive slots, their descriptors (F::L bytes each) contiguous in
+  /// m_flat_descriptor_data, so that F::distances evaluates all of them at
+  /// once instead of following the Node children vectors and descriptors.
+  /// When the children of every node have consecutive ids, slot s is node
+  /// s+1: the data is the descriptor block of the mapping (or a copy in
+  /// m_flat_descriptors if not mapped) and m_flat_child_ids is empty.
+  /// Otherwise m_flat_child_ids gives the node of each slot and the
+  /// descriptors are copied in slot order
+  std::vector<FlatNode> m_flat_nodes;
+  std::vector<NodeId> m_flat_child_ids;
+  std::vector<unsigned char> m_flat_descriptors;
+  const unsigned char *m_flat_descriptor_data;
+  uint32_t m_flat_max_children;
   
 };
 
@@ -434,7 +571,8 @@ template<class TDescriptor, class F>
 TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
   (int k, int L, WeightingType weighting, ScoringType scoring)
   : m_k(k), m_L(L), m_weighting(weighting), m_scoring(scoring),
-  m_scoring_object(NULL)
+  m_scoring_object(NULL), m_mapping(NULL), m_mapping_size(0), m_mapped_descriptors(NULL),
+  m_flat_descriptor_data(NULL), m_flat_max_children(0)
 {
   createScoringObject();
 }
@@ -443,7 +581,9 @@ TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
 
 template<class TDescriptor, class F>
 TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
-  (const std::string &filename): m_scoring_object(NULL)
+  (const std::string &filename): m_scoring_object(NULL),
+  m_mapping(NULL), m_mapping_size(0), m_mapped_descriptors(NULL),
+  m_flat_descriptor_data(NULL), m_flat_max_children(0)
 {
   load(filename);
 }
@@ -452,7 +592,9 @@ TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
 
 template<class TDescriptor, class F>
 TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
-  (const char *filename): m_scoring_object(NULL)
+  (const char *filename): m_scoring_object(NULL),
+  m_mapping(NULL), m_mapping_size(0), m_mapped_descriptors(NULL),
+  m_flat_descriptor_data(NULL), m_flat_max_children(0)
 {
   load(filename);
 }
@@ -516,7 +658,8 @@ void TemplatedVocabulary<TDescriptor,F>::setWeightingType(WeightingType type)
 template<class TDescriptor, class F>
 TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary(
   const TemplatedVocabulary<TDescriptor, F> &voc)
-  : m_scoring_object(NULL)
+  : m_scoring_object(NULL), m_mapping(NULL), m_mapping_size(0), m_mapped_descriptors(NULL),
+  m_flat_descriptor_data(NULL), m_flat_max_children(0)
 {
   *this = voc;
 }
@@ -527,6 +670,7 @@ template<class TDescriptor, class F>
 TemplatedVocabulary<TDescriptor,F>::~TemplatedVocabulary()
 {
   delete m_scoring_object;
+  releaseMapping();
 }
 
 // --------------------------------------------------------------------------
@@ -536,6 +680,8 @@ TemplatedVocabulary<TDescriptor, F>&
 TemplatedVocabulary<TDescriptor,F>::operator=
   (const TemplatedVocabulary<TDescriptor, F> &voc)
 {  
+  if(this == &voc) return *this;
+
   this->m_k = voc.m_k;
   this->m_L = voc.m_L;
   this->m_scoring = voc.m_scoring;
@@ -545,9 +691,24 @@ TemplatedVocabulary<TDescriptor,F>::operator=
   
   this->m_nodes.clear();
   this->m_words.clear();
+  this->releaseMapping();
   
   this->m_nodes = voc.m_nodes;
+
+  // descriptors of a mapped vocabulary belong to its mapping
+  if(voc.isMapped())
+  {
+    vector<unsigned char> buffer(F::L);
+    typename vector<Node>::iterator nit;
+    for(nit = this->m_nodes.begin() + 1; nit != this->m_nodes.end(); ++nit)
+    {
+      F::toBinary(nit->descriptor, &buffer[0]);
+      F::fromBinary(nit->descriptor, &buffer[0]);
+    }
+  }
+
   this->createWords();
+  this->createFlatTree();
   
   return *this;
 }
@@ -560,6 +721,7 @@ void TemplatedVocabulary<TDescriptor,F>::create(
 {
   m_nodes.clear();
   m_words.clear();
+  releaseMapping();
   
   // expected_nodes = Sum_{i=0..L} ( k^i )
 	int expected_nodes = 
@@ -580,6 +742,7 @@ void TemplatedVocabulary<TDescriptor,F>::create(
 
   // create the words
   createWords();
+  createFlatTree();
 
   // and set the weight of each node of the tree
   setNodeWeights(training_features);
@@ -1005,6 +1168,27 @@ inline unsigned int TemplatedVocabulary<TDescriptor,F>::size() const
 
 // --------------------------------------------------------------------------
 
+template<class TDescriptor, class F>
+size_t TemplatedVocabulary<TDescriptor,F>::memoryUsage() const
+{
+  size_t bytes = m_nodes.capacity() * sizeof(Node);
+  for(typename std::vector<Node>::const_iterator nit = m_nodes.begin();
+    nit != m_nodes.end(); ++nit)
+  {
+    bytes += nit->children.capacity() * sizeof(NodeId);
+  }
+  if(!isMapped())
+    bytes += m_nodes.size() * F::L;
+
+  bytes += m_words.capacity() * sizeof(Node*);
+  bytes += m_flat_nodes.capacity() * sizeof(FlatNode);
+  bytes += m_flat_child_ids.capacity() * sizeof(NodeId);
+  bytes += m_flat_descriptors.capacity();
+  return bytes;
+}
+
+// --------------------------------------------------------------------------
+
 template<class TDescriptor, class F>
 inline bool TemplatedVocabulary<TDescriptor,F>::empty() const
 {
@@ -1127,6 +1311,22 @@ template<class TDescriptor, class F>
 void TemplatedVocabulary<TDescriptor,F>::transform(
   const std::vector<TDescriptor>& features,
   BowVector &v, FeatureVector &fv, int levelsup) const
+{
+  // pack the descriptors and transform them all at once
+  vector<unsigned char> buffer(features.size() * F::L);
+  for(size_t i = 0; i < features.size(); ++i)
+    F::toBinary(features[i], &buffer[i * F::L]);
+
+  transform(buffer.empty() ? NULL : &buffer[0], F::L, (int)features.size(),
+    v, fv, levelsup);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F> 
+void TemplatedVocabulary<TDescriptor,F>::transform(
+  const unsigned char *descriptors, size_t stride, int N,
+  BowVector &v, FeatureVector &fv, int levelsup) const
 {
   v.clear();
   fv.clear();
@@ -1139,24 +1339,22 @@ void TemplatedVocabulary<TDescriptor,F>::transform(
   // normalize 
   LNorm norm;
   bool must = m_scoring_object->mustNormalize(norm);
-  
-  typename vector<TDescriptor>::const_iterator fit;
+
+  vector<int> dists(m_flat_max_children);
   
   if(m_weighting == TF || m_weighting == TF_IDF)
   {
-    unsigned int i_feature = 0;
-    for(fit = features.begin(); fit < features.end(); ++fit, ++i_feature)
+    for(int i_feature = 0; i_feature < N; ++i_feature)
     {
-      WordId id;
       NodeId nid;
-      WordValue w; 
+      const Node &leaf = m_nodes[descend(descriptors + i_feature * stride,
+        &nid, levelsup, &dists[0])];
       // w is the idf value if TF_IDF, 1 if TF
-      
-      transform(*fit, id, w, &nid, levelsup);
+      const WordValue w = leaf.weight;
       
       if(w > 0) // not stopped
       { 
-        v.addWeight(id, w);
+        v.addWeight(leaf.word_id, w);
         fv.addFeature(nid, i_feature);
       }
     }
@@ -1172,19 +1370,17 @@ void TemplatedVocabulary<TDescriptor,F>::transform(
   }
   else // IDF || BINARY
   {
-    unsigned int i_feature = 0;
-    for(fit = features.begin(); fit < features.end(); ++fit, ++i_feature)
+    for(int i_feature = 0; i_feature < N; ++i_feature)
     {
-      WordId id;
       NodeId nid;
-      WordValue w;
+      const Node &leaf = m_nodes[descend(descriptors + i_feature * stride,
+        &nid, levelsup, &dists[0])];
       // w is idf if IDF, or 1 if BINARY
-      
-      transform(*fit, id, w, &nid, levelsup);
+      const WordValue w = leaf.weight;
       
       if(w > 0) // not stopped
       {
-        v.addIfNotExist(id, w);
+        v.addIfNotExist(leaf.word_id, w);
         fv.addFeature(nid, i_feature);
       }
     }
@@ -1218,10 +1414,23 @@ template<class TDescriptor, class F>
 void TemplatedVocabulary<TDescriptor,F>::transform(const TDescriptor &feature, 
   WordId &word_id, WordValue &weight, NodeId *nid, int levelsup) const
 { 
-  // propagate the feature down the tree
-  vector<NodeId> nodes;
-  typename vector<NodeId>::const_iterator nit;
+  vector<unsigned char> buffer(F::L);
+  F::toBinary(feature, &buffer[0]);
 
+  vector<int> dists(m_flat_max_children);
+  const Node &leaf = m_nodes[descend(&buffer[0], nid, levelsup, &dists[0])];
+
+  // turn node id into word id
+  word_id = leaf.word_id;
+  weight = leaf.weight;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+NodeId TemplatedVocabulary<TDescriptor,F>::descend(const unsigned char *feature,
+  NodeId *nid, int levelsup, int *dists) const
+{
   // level at which the node must be stored in nid, if given
   const int nid_level = m_L - levelsup;
   if(nid_level <= 0 && nid != NULL) *nid = 0; // root
@@ -1232,30 +1441,95 @@ void TemplatedVocabulary<TDescriptor,F>::transform(const TDescriptor &feature,
   do
   {
     ++current_level;
-    nodes = m_nodes[final_id].children;
-    final_id = nodes[0];
- 
-    double best_d = F::distance(feature, m_nodes[final_id].descriptor);
+    const FlatNode &node = m_flat_nodes[final_id];
 
-    for(nit = nodes.begin() + 1; nit != nodes.end(); ++nit)
+    F::distances(feature, m_flat_descriptor_data + (size_t)node.first * F::L,
+      node.count, dists);
+
+    // first closest child, as the children are visited in order
+    uint32_t best = 0;
+    for(uint32_t c = 1; c < node.count; ++c)
     {
-      NodeId id = *nit;
-      double d = F::distance(feature, m_nodes[id].descriptor);
-      if(d < best_d)
-      {
-        best_d = d;
-        final_id = id;
-      }
+      if(dists[c] < dists[best])
+        best = c;
     }
+    final_id = m_flat_child_ids.empty() ? (NodeId)(node.first + best + 1) :
+      m_flat_child_ids[node.first + best];
     
     if(nid != NULL && current_level == nid_level)
       *nid = final_id;
     
-  } while( !m_nodes[final_id].isLeaf() );
+  } while(m_flat_nodes[final_id].count > 0);
 
-  // turn node id into word id
-  word_id = m_nodes[final_id].word_id;
-  weight = m_nodes[final_id].weight;
+  return final_id;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::createFlatTree()
+{
+  m_flat_nodes.assign(m_nodes.size(), FlatNode());
+  m_flat_child_ids.clear();
+  m_flat_descriptors.clear();
+  m_flat_descriptor_data = NULL;
+  m_flat_max_children = 0;
+
+  if(m_nodes.size() < 2) return;
+
+  // create() and the loaders add the children of a node one after the other
+  bool consecutive = true;
+  for(size_t i = 0; i < m_nodes.size() && consecutive; ++i)
+  {
+    const vector<NodeId> &children = m_nodes[i].children;
+    for(size_t c = 1; c < children.size() && consecutive; ++c)
+      consecutive = children[c] == children[0] + c;
+  }
+
+  if(consecutive)
+  {
+    for(size_t i = 0; i < m_nodes.size(); ++i)
+    {
+      const vector<NodeId> &children = m_nodes[i].children;
+      FlatNode &node = m_flat_nodes[i];
+      node.first = children.empty() ? 0 : children[0] - 1;
+      node.count = children.size();
+      m_flat_max_children = std::max(m_flat_max_children, node.count);
+    }
+
+    // The binary file stores the descriptors in node order, nothing to copy
+    if(m_mapped_descriptors)
+    {
+      m_flat_descriptor_data = m_mapped_descriptors;
+      return;
+    }
+
+    m_flat_descriptors.resize((m_nodes.size() - 1) * F::L);
+    for(size_t i = 1; i < m_nodes.size(); ++i)
+      F::toBinary(m_nodes[i].descriptor, &m_flat_descriptors[(i - 1) * F::L]);
+    m_flat_descriptor_data = &m_flat_descriptors[0];
+    return;
+  }
+
+  m_flat_child_ids.reserve(m_nodes.size() - 1);
+  m_flat_descriptors.resize((m_nodes.size() - 1) * F::L);
+
+  for(size_t i = 0; i < m_nodes.size(); ++i)
+  {
+    const vector<NodeId> &children = m_nodes[i].children;
+    FlatNode &node = m_flat_nodes[i];
+    node.first = m_flat_child_ids.size();
+    node.count = children.size();
+    m_flat_max_children = std::max(m_flat_max_children, node.count);
+
+    for(size_t c = 0; c < children.size(); ++c)
+    {
+      F::toBinary(m_nodes[children[c]].descriptor,
+        &m_flat_descriptors[m_flat_child_ids.size() * F::L]);
+      m_flat_child_ids.push_back(children[c]);
+    }
+  }
+  m_flat_descriptor_data = &m_flat_descriptors[0];
 }
 
 // --------------------------------------------------------------------------
@@ -1345,6 +1619,7 @@ bool TemplatedVocabulary<TDescriptor,F>::loadFromTextFile(const std::string &fil
 
     m_words.clear();
     m_nodes.clear();
+    releaseMapping();
 
     string s;
     getline(f,s);
@@ -1419,6 +1694,8 @@ bool TemplatedVocabulary<TDescriptor,F>::loadFromTextFile(const std::string &fil
         }
     }
 
+    createFlatTree();
+
     return true;
 
 }
@@ -1450,6 +1727,186 @@ void TemplatedVocabulary<TDescriptor,F>::saveToTextFile(const std::string &filen
 
 // --------------------------------------------------------------------------
 
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::releaseMapping()
+{
+  if(m_mapping)
+  {
+    munmap(m_mapping, m_mapping_size);
+    m_mapping = NULL;
+    m_mapping_size = 0;
+    m_mapped_descriptors = NULL;
+
+    // The flattened tree may point into the mapping
+    m_flat_nodes.clear();
+    m_flat_child_ids.clear();
+    m_flat_descriptors.clear();
+    m_flat_descriptor_data = NULL;
+  }
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+bool TemplatedVocabulary<TDescriptor,F>::saveToBinaryFile(const std::string &filename) const
+{
+    if(m_nodes.empty())
+        return false;
+
+    ofstream f(filename.c_str(), ios_base::out | ios_base::binary);
+    if(!f.is_open())
+        return false;
+
+    const uint32_t N = m_nodes.size() - 1; // root is not stored
+
+    BinaryHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "DBOW2BV", 8);
+    header.version = BINARY_VERSION;
+    header.k = m_k;
+    header.L = m_L;
+    header.scoring = m_scoring;
+    header.weighting = m_weighting;
+    header.nodes = N;
+    header.words = m_words.size();
+    header.descriptor_bytes = F::L;
+
+    const char zeros[8] = {0,0,0,0,0,0,0,0};
+    f.write((const char*)&header, sizeof(header));
+    f.write(zeros, binaryAlign(sizeof(header)) - sizeof(header));
+
+    vector<double> weights(N);
+    vector<uint32_t> parents(N), word_ids(N);
+    vector<unsigned char> descriptors((size_t)N * F::L);
+    for(uint32_t i = 0; i < N; ++i)
+    {
+        const Node &node = m_nodes[i+1];
+        weights[i] = node.weight;
+        parents[i] = node.parent;
+        word_ids[i] = node.isLeaf() ? (uint32_t)node.word_id : BINARY_NO_WORD;
+        F::toBinary(node.descriptor, &descriptors[(size_t)i * F::L]);
+    }
+
+    f.write((const char*)&weights[0], N * sizeof(double));
+    f.write((const char*)&parents[0], N * sizeof(uint32_t));
+    f.write(zeros, binaryAlign(N * sizeof(uint32_t)) - N * sizeof(uint32_t));
+    f.write((const char*)&word_ids[0], N * sizeof(uint32_t));
+    f.write(zeros, binaryAlign(N * sizeof(uint32_t)) - N * sizeof(uint32_t));
+    f.write((const char*)&descriptors[0], descriptors.size());
+
+    return f.good();
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+bool TemplatedVocabulary<TDescriptor,F>::loadFromBinaryFile(const std::string &filename, bool bMap)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if(fd < 0)
+        return false;
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(BinaryHeader))
+    {
+        close(fd);
+        return false;
+    }
+
+    const size_t size = st.st_size;
+    // Private writable mapping: pages are shared with the page cache until
+    // (if ever) a descriptor is modified in place
+    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED)
+        return false;
+
+    const BinaryHeader &header = *(const BinaryHeader*)data;
+    const uint32_t N = header.nodes;
+    const size_t offWeights = binaryAlign(sizeof(BinaryHeader));
+    const size_t offParents = offWeights + (size_t)N * sizeof(double);
+    const size_t offWords = offParents + binaryAlign((size_t)N * sizeof(uint32_t));
+    const size_t offDescriptors = offWords + binaryAlign((size_t)N * sizeof(uint32_t));
+    const size_t expected = offDescriptors + (size_t)N * header.descriptor_bytes;
+
+    if(memcmp(header.magic, "DBOW2BV", 8) != 0 || header.version != BINARY_VERSION ||
+       header.descriptor_bytes != (uint32_t)F::L || expected != size ||
+       header.k < 0 || header.k > 20 || header.L < 1 || header.L > 10 ||
+       header.scoring < 0 || header.scoring > 5 || header.weighting < 0 || header.weighting > 3)
+    {
+        std::cerr << "Vocabulary loading failure: This is not a correct binary file!" << endl;
+        munmap(data, size);
+        return false;
+    }
+
+    m_words.clear();
+    m_nodes.clear();
+    releaseMapping();
+
+    m_k = header.k;
+    m_L = header.L;
+    m_scoring = (ScoringType)header.scoring;
+    m_weighting = (WeightingType)header.weighting;
+    createScoringObject();
+
+    unsigned char *base = (unsigned char*)data;
+    const double *weights = (const double*)(base + offWeights);
+    const uint32_t *parents = (const uint32_t*)(base + offParents);
+    const uint32_t *word_ids = (const uint32_t*)(base + offWords);
+    unsigned char *descriptors = base + offDescriptors;
+
+    m_nodes.resize(N + 1);
+    m_nodes[0].id = 0;
+    m_words.resize(header.words);
+
+    for(uint32_t i = 0; i < N; ++i)
+    {
+        const NodeId nid = i + 1;
+        Node &node = m_nodes[nid];
+        node.id = nid;
+        node.parent = parents[i];
+        node.weight = weights[i];
+        if(node.parent >= nid || (word_ids[i] != BINARY_NO_WORD && word_ids[i] >= header.words))
+        {
+            std::cerr << "Vocabulary loading failure: Corrupted binary file!" << endl;
+            m_nodes.clear();
+            m_words.clear();
+            munmap(data, size);
+            return false;
+        }
+        m_nodes[node.parent].children.push_back(nid);
+
+        unsigned char *d = descriptors + (size_t)i * F::L;
+        if(bMap)
+            F::wrapBinary(node.descriptor, d);
+        else
+            F::fromBinary(node.descriptor, d);
+
+        if(word_ids[i] != BINARY_NO_WORD)
+        {
+            node.word_id = word_ids[i];
+            m_words[node.word_id] = &node;
+        }
+    }
+
+    if(bMap)
+    {
+        m_mapping = data;
+        m_mapping_size = size;
+        m_mapped_descriptors = descriptors;
+    }
+    else
+    {
+        munmap(data, size);
+    }
+
+    createFlatTree();
+
+    return true;
+}
+
+// --------------------------------------------------------------------------
+
 template<class TDescriptor, class F>
 void TemplatedVocabulary<TDescriptor,F>::save(const std::string &filename) const
 {
@@ -1575,6 +2032,7 @@ void TemplatedVocabulary<TDescriptor,F>::load(const cv::FileStorage &fs,
 {
   m_words.clear();
   m_nodes.clear();
+  releaseMapping();
   
   cv::FileNode fvoc = fs[name];
   
@@ -1619,6 +2077,8 @@ void TemplatedVocabulary<TDescriptor,F>::load(const cv::FileStorage &fs,
     m_nodes[nid].word_id = wid;
     m_words[wid] = &m_nodes[nid];
   }
+
+  createFlatTree();
 }
 
 // --------------------------------------------------------------------------
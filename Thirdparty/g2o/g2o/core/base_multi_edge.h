@@ -88,6 +88,9 @@ namespace g2o {
 
       virtual void mapHessianMemory(double* d, int i, int j, bool rowMajor);
 
+      //! Jacobian w.r.t. the i-th vertex from the last linearizeOplus()
+      const JacobianType& jacobianOplus(int i) const { return _jacobianOplus[i];}
+
       using BaseEdge<D,E>::computeError;
 
     protected:
@@ -376,7 +376,7 @@ bool BlockSolver<Traits>::solve(){
   //_DInvSchur->clear();
   memset (_coefficients, 0, _sizePoses*sizeof(double));
 # ifdef G2O_OPENMP
-# pragma omp parallel for default (shared) schedule(dynamic, 10)
+# pragma omp parallel for default (shared) schedule(dynamic, 10) if (_Hll->blockCols().size() > 100)
 # endif
   for (int landmarkIndex = 0; landmarkIndex < static_cast<int>(_Hll->blockCols().size()); ++landmarkIndex) {
     const typename SparseBlockMatrix<LandmarkMatrixType>::IntBlockMap& marginalizeColumn = _Hll->blockCols()[landmarkIndex];
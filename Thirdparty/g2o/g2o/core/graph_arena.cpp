@@ -0,0 +1,99 @@
+// g2o - General Graph Optimization
+// Copyright (C) 2011 R. Kuemmerle, G. Grisetti, W. Burgard
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "graph_arena.h"
+
+#include <Eigen/Core>
+
+namespace g2o {
+
+  namespace {
+    // every block starts with the owning arena (NULL for heap blocks), padded to keep
+    // the payload 16 byte aligned
+    const size_t kHeaderSize = 16;
+
+#if defined(_MSC_VER)
+    __declspec(thread) GraphArena* activeArena = 0;
+#else
+    __thread GraphArena* activeArena = 0;
+#endif
+  }
+
+  GraphArena::GraphArena(size_t chunkSize) :
+    _chunkSize(chunkSize), _current(0), _remaining(0), _bytesUsed(0), _previous(activeArena)
+  {
+    activeArena = this;
+  }
+
+  GraphArena::~GraphArena()
+  {
+    activeArena = _previous;
+    for (size_t i = 0; i < _chunks.size(); ++i)
+      Eigen::internal::aligned_free(_chunks[i]);
+  }
+
+  void* GraphArena::allocateChunk(size_t size)
+  {
+    char* chunk = static_cast<char*>(Eigen::internal::aligned_malloc(size));
+    _chunks.push_back(chunk);
+    return chunk;
+  }
+
+  void* GraphArena::allocate(size_t size)
+  {
+    const size_t blockSize = kHeaderSize + ((size + 15) & ~static_cast<size_t>(15));
+    GraphArena* arena = activeArena;
+    char* block;
+    if (! arena) {
+      block = static_cast<char*>(Eigen::internal::aligned_malloc(blockSize));
+    } else if (blockSize > arena->_chunkSize / 4) {
+      // large requests get a chunk of their own so they do not waste the current one
+      block = static_cast<char*>(arena->allocateChunk(blockSize));
+      arena->_bytesUsed += blockSize;
+    } else {
+      if (blockSize > arena->_remaining) {
+        arena->_current = static_cast<char*>(arena->allocateChunk(arena->_chunkSize));
+        arena->_remaining = arena->_chunkSize;
+      }
+      block = arena->_current;
+      arena->_current += blockSize;
+      arena->_remaining -= blockSize;
+      arena->_bytesUsed += blockSize;
+    }
+    *reinterpret_cast<GraphArena**>(block) = arena;
+    return block + kHeaderSize;
+  }
+
+  void GraphArena::deallocate(void* ptr)
+  {
+    if (! ptr)
+      return;
+    char* block = static_cast<char*>(ptr) - kHeaderSize;
+    if (! *reinterpret_cast<GraphArena**>(block))
+      Eigen::internal::aligned_free(block);
+  }
+
+} // end namespace
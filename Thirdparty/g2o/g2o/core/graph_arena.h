@@ -0,0 +1,92 @@
+// g2o - General Graph Optimization
+// Copyright (C) 2011 R. Kuemmerle, G. Grisetti, W. Burgard
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef G2O_GRAPH_ARENA_H
+#define G2O_GRAPH_ARENA_H
+
+#include <cstddef>
+#include <vector>
+
+namespace g2o {
+
+  /**
+   * \brief bump allocator for the vertices, edges and kernels of one optimization
+   *
+   * While an arena is alive it is the active arena of the thread that created it,
+   * and every type declared with G2O_MAKE_POOLED_OPERATOR_NEW that is created on that
+   * thread is carved out of a few large chunks. Deleting such an object only runs its
+   * destructor; the memory is returned when the arena is destroyed. Hence the arena
+   * must outlive the graph, i.e. it is declared before the SparseOptimizer.
+   * Without an active arena the objects come from the (aligned) heap as before.
+   * Arenas nest: destroying one re-activates the previous one.
+   */
+  class GraphArena
+  {
+    public:
+      explicit GraphArena(size_t chunkSize = 1 << 20);
+      ~GraphArena();
+
+      //! allocate size bytes, 16 byte aligned, from the active arena or the heap
+      static void* allocate(size_t size);
+      //! release memory from allocate(); a no-op for arena memory
+      static void deallocate(void* ptr);
+
+      //! number of bytes handed out by this arena
+      size_t bytesUsed() const { return _bytesUsed;}
+
+    protected:
+      void* allocateChunk(size_t size);
+
+      size_t _chunkSize;
+      std::vector<char*> _chunks;
+      char* _current;
+      size_t _remaining;
+      size_t _bytesUsed;
+      GraphArena* _previous;
+
+    private:
+      GraphArena(const GraphArena&);
+      GraphArena& operator=(const GraphArena&);
+  };
+
+} // end namespace
+
+/**
+ * Replacement of EIGEN_MAKE_ALIGNED_OPERATOR_NEW for graph elements that are created
+ * by the thousands per optimization. Keeps the 16 byte alignment Eigen requires.
+ */
+#define G2O_MAKE_POOLED_OPERATOR_NEW \
+  void* operator new(std::size_t size) { return g2o::GraphArena::allocate(size);} \
+  void* operator new[](std::size_t size) { return g2o::GraphArena::allocate(size);} \
+  void operator delete(void* ptr) throw() { g2o::GraphArena::deallocate(ptr);} \
+  void operator delete[](void* ptr) throw() { g2o::GraphArena::deallocate(ptr);} \
+  static void* operator new(std::size_t, void* ptr) { return ptr;} \
+  static void* operator new[](std::size_t, void* ptr) { return ptr;} \
+  void operator delete(void*, void*) throw() {} \
+  void operator delete[](void*, void*) throw() {} \
+  typedef void eigen_aligned_operator_new_marker_type;
+
+#endif
@@ -39,6 +39,7 @@
 #include "parameter.h"
 #include "parameter_container.h"
 #include "jacobian_workspace.h"
+#include "graph_arena.h"
 
 #include "../stuff/macros.h"
 
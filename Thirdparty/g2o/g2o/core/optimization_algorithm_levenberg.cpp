@@ -30,6 +30,7 @@
 #include "optimization_algorithm_levenberg.h"
 
 #include <iostream>
+#include <cmath>
 
 #include "../stuff/timeutil.h"
 
@@ -52,6 +53,8 @@ namespace g2o {
     _ni=2.;
     _levenbergIterations = 0;
     _nBad = 0;
+    _minRelativeDecrease = 0.;
+    _minUpdateNorm = 0.;
   }
 
   OptimizationAlgorithmLevenberg::~OptimizationAlgorithmLevenberg()
@@ -97,6 +100,7 @@ namespace g2o {
     }
 
     double rho=0;
+    double updateNorm=0;
     int& qmax = _levenbergIterations;
     qmax = 0;
     do {
@@ -139,6 +143,12 @@ namespace g2o {
         _currentLambda *= scaleFactor;
         _ni = 2;
         currentChi=tempChi;
+        if (_minUpdateNorm > 0) {
+          double sqNorm = 0.;
+          for (size_t j=0; j < _solver->vectorSize(); j++)
+            sqNorm += _solver->x()[j] * _solver->x()[j];
+          updateNorm = std::sqrt(sqNorm);
+        }
         _optimizer->discardTop();
       } else {
         _currentLambda*=_ni;
@@ -165,6 +175,11 @@ namespace g2o {
         return Terminate;
     }
 
+    // Convergence criteria (off by default)
+    if ((_minRelativeDecrease > 0 && (iniChi-currentChi) < _minRelativeDecrease*iniChi) ||
+        (_minUpdateNorm > 0 && updateNorm < _minUpdateNorm))
+      return Terminate;
+
     return OK;
   }
 
@@ -193,6 +208,12 @@ namespace g2o {
     return scale;
   }
 
+  void OptimizationAlgorithmLevenberg::setConvergenceCriteria(double minRelativeDecrease, double minUpdateNorm)
+  {
+    _minRelativeDecrease = minRelativeDecrease;
+    _minUpdateNorm = minUpdateNorm;
+  }
+
   void OptimizationAlgorithmLevenberg::setMaxTrialsAfterFailure(int max_trials)
   {
     _maxTrialsAfterFailure->setValue(max_trials);
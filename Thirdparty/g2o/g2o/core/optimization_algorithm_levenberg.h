@@ -65,6 +65,10 @@ namespace g2o {
       //! return the number of levenberg iterations performed in the last round
       int levenbergIteration() { return _levenbergIterations;}
 
+      //! terminate after an accepted step that decreases chi^2 by less than minRelativeDecrease
+      //! (fraction of chi^2) or whose update norm is below minUpdateNorm, 0 disables a criterion
+      void setConvergenceCriteria(double minRelativeDecrease, double minUpdateNorm);
+
     protected:
       // Levenberg parameters
       Property<int>* _maxTrialsAfterFailure;
@@ -77,6 +81,8 @@ namespace g2o {
       int _levenbergIterations;   ///< the numer of levenberg iterations performed to accept the last step
       //RAUL
       int _nBad;
+      double _minRelativeDecrease;
+      double _minUpdateNorm;
 
       /**
        * helper for Levenberg, this function computes the initial damping factor, if the user did not
@@ -0,0 +1,156 @@
+// g2o - General Graph Optimization
+// Copyright (C) 2011 R. Kuemmerle, G. Grisetti, W. Burgard
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef G2O_LINEAR_SOLVER_CHOLMOD_H
+#define G2O_LINEAR_SOLVER_CHOLMOD_H
+
+#include <Eigen/Sparse>
+#include <Eigen/CholmodSupport>
+
+#include "../core/linear_solver.h"
+#include "../core/batch_stats.h"
+#include "../stuff/timeutil.h"
+
+#include "../core/eigen_types.h"
+
+#include <iostream>
+#include <vector>
+
+namespace g2o {
+
+/**
+ * \brief linear solver which uses the supernodal Cholesky factorization of CHOLMOD
+ *
+ * Requires SuiteSparse (build with G2O_HAVE_CHOLMOD and link against cholmod).
+ * Same interface as LinearSolverEigen, but the factorization works on dense
+ * supernodes, which pays off on the large problems (full BA, essential graph).
+ * The symbolic analysis is done once per structure, like in LinearSolverEigen.
+ */
+template <typename MatrixType>
+class LinearSolverCholmod: public LinearSolver<MatrixType>
+{
+  public:
+    typedef Eigen::SparseMatrix<double, Eigen::ColMajor> SparseMatrix;
+    typedef Eigen::Triplet<double> Triplet;
+    typedef Eigen::CholmodSupernodalLLT<SparseMatrix, Eigen::Upper> CholeskyDecomposition;
+
+  public:
+    LinearSolverCholmod() :
+      LinearSolver<MatrixType>(),
+      _init(true), _writeDebug(false)
+    {
+    }
+
+    virtual ~LinearSolverCholmod()
+    {
+    }
+
+    virtual bool init()
+    {
+      _init = true;
+      return true;
+    }
+
+    bool solve(const SparseBlockMatrix<MatrixType>& A, double* x, double* b)
+    {
+      if (_init)
+        _sparseMatrix.resize(A.rows(), A.cols());
+      fillSparseMatrix(A, !_init);
+      if (_init) { // compute the symbolic composition once
+        double t=get_monotonic_time();
+        _cholesky.analyzePattern(_sparseMatrix);
+        G2OBatchStatistics* globalStats = G2OBatchStatistics::globalStats();
+        if (globalStats)
+          globalStats->timeSymbolicDecomposition = get_monotonic_time() - t;
+      }
+      _init = false;
+
+      double t=get_monotonic_time();
+      _cholesky.factorize(_sparseMatrix);
+      if (_cholesky.info() != Eigen::Success) { // the matrix is not positive definite
+        if (_writeDebug) {
+          std::cerr << "Cholesky failure, writing debug.txt (Hessian loadable by Octave)" << std::endl;
+          A.writeOctave("debug.txt");
+        }
+        return false;
+      }
+
+      // Solving the system
+      VectorXD::MapType xx(x, _sparseMatrix.cols());
+      VectorXD::ConstMapType bb(b, _sparseMatrix.cols());
+      xx = _cholesky.solve(bb);
+      G2OBatchStatistics* globalStats = G2OBatchStatistics::globalStats();
+      if (globalStats)
+        globalStats->timeNumericDecomposition = get_monotonic_time() - t;
+
+      return true;
+    }
+
+    //! write a debug dump of the system matrix if it is not SPD in solve
+    virtual bool writeDebug() const { return _writeDebug;}
+    virtual void setWriteDebug(bool b) { _writeDebug = b;}
+
+  protected:
+    bool _init;
+    bool _writeDebug;
+    SparseMatrix _sparseMatrix;
+    CholeskyDecomposition _cholesky;
+
+    void fillSparseMatrix(const SparseBlockMatrix<MatrixType>& A, bool onlyValues)
+    {
+      if (onlyValues) {
+        A.fillCCS(_sparseMatrix.valuePtr(), true);
+      } else {
+
+        // create from triplet structure (upper triangle only)
+        std::vector<Triplet> triplets;
+        triplets.reserve(A.nonZeros());
+        for (size_t c = 0; c < A.blockCols().size(); ++c) {
+          int colBaseOfBlock = A.colBaseOfBlock(c);
+          const typename SparseBlockMatrix<MatrixType>::IntBlockMap& column = A.blockCols()[c];
+          for (typename SparseBlockMatrix<MatrixType>::IntBlockMap::const_iterator it = column.begin(); it != column.end(); ++it) {
+            int rowBaseOfBlock = A.rowBaseOfBlock(it->first);
+            const MatrixType& m = *(it->second);
+            for (int cc = 0; cc < m.cols(); ++cc) {
+              int aux_c = colBaseOfBlock + cc;
+              for (int rr = 0; rr < m.rows(); ++rr) {
+                int aux_r = rowBaseOfBlock + rr;
+                if (aux_r > aux_c)
+                  break;
+                triplets.push_back(Triplet(aux_r, aux_c, m(rr, cc)));
+              }
+            }
+          }
+        }
+        _sparseMatrix.setFromTriplets(triplets.begin(), triplets.end());
+
+      }
+    }
+};
+
+} // end namespace
+
+#endif
@@ -0,0 +1,180 @@
+// g2o - General Graph Optimization
+// Copyright (C) 2011 R. Kuemmerle, G. Grisetti, W. Burgard
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef G2O_LINEAR_SOLVER_PCG_H
+#define G2O_LINEAR_SOLVER_PCG_H
+
+#include <Eigen/Core>
+#include <Eigen/LU>
+#include <Eigen/StdVector>
+
+#include "../core/linear_solver.h"
+#include "../core/batch_stats.h"
+#include "../stuff/timeutil.h"
+
+#include "../core/eigen_types.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace g2o {
+
+/**
+ * \brief linear solver using preconditioned conjugate gradient
+ *
+ * Block Jacobi preconditioner (inverses of the diagonal blocks) and products with the
+ * block matrix itself, so there is no factorization and no fill-in: memory stays linear in
+ * the non-zero blocks, which suits very large maps. The solution is approximate, the
+ * iterations stop once the residual norm is below tolerance times the norm of b.
+ */
+template <typename MatrixType>
+class LinearSolverPCG : public LinearSolver<MatrixType>
+{
+  public:
+    LinearSolverPCG() :
+      LinearSolver<MatrixType>(),
+      _tolerance(1e-6), _maxIter(-1), _iterations(0), _residual(-1.0)
+    {
+    }
+
+    virtual ~LinearSolverPCG()
+    {
+    }
+
+    virtual bool init()
+    {
+      _iterations = 0;
+      _residual = -1.0;
+      return true;
+    }
+
+    bool solve(const SparseBlockMatrix<MatrixType>& A, double* x, double* b)
+    {
+      double t=get_monotonic_time();
+      const int n = A.cols();
+      const int nBlocks = A.blockCols().size();
+
+      // block Jacobi preconditioner
+      _diagInv.resize(nBlocks);
+      for (int c = 0; c < nBlocks; ++c) {
+        const typename SparseBlockMatrix<MatrixType>::IntBlockMap& column = A.blockCols()[c];
+        typename SparseBlockMatrix<MatrixType>::IntBlockMap::const_iterator it = column.find(c);
+        if (it == column.end())
+          return false;
+        _diagInv[c] = it->second->inverse();
+      }
+
+      VectorXD::MapType xx(x, n);
+      VectorXD::ConstMapType bb(b, n);
+      xx.setZero();
+
+      _r = bb;
+      applyPreconditioner(A, _r, _z);
+      _p = _z;
+      double rz = _r.dot(_z);
+
+      const double threshold = _tolerance*_tolerance*bb.squaredNorm();
+      const int maxIter = _maxIter<0 ? n : std::min(_maxIter, n);
+      int iter = 0;
+      for (; iter < maxIter && _r.squaredNorm() > threshold; ++iter) {
+        mult(A, _p, _Ap);
+        const double pAp = _p.dot(_Ap);
+        if (pAp <= 0.)
+          break;
+        const double alpha = rz / pAp;
+        xx += alpha * _p;
+        _r -= alpha * _Ap;
+        applyPreconditioner(A, _r, _z);
+        const double rzNew = _r.dot(_z);
+        _p = _z + (rzNew / rz) * _p;
+        rz = rzNew;
+      }
+      _iterations = iter;
+      _residual = _r.norm();
+
+      G2OBatchStatistics* globalStats = G2OBatchStatistics::globalStats();
+      if (globalStats) {
+        globalStats->timeNumericDecomposition = get_monotonic_time() - t;
+        globalStats->iterationsLinearSolver = iter;
+      }
+
+      return xx.allFinite();
+    }
+
+    //! relative tolerance on the residual norm
+    double tolerance() const { return _tolerance;}
+    void setTolerance(double tolerance) { _tolerance = tolerance;}
+
+    //! maximum number of iterations, -1 for the dimension of the system
+    int maxIterations() const { return _maxIter;}
+    void setMaxIterations(int maxIter) { _maxIter = maxIter;}
+
+    //! iterations and residual norm of the last solve
+    int iterations() const { return _iterations;}
+    double residual() const { return _residual;}
+
+  protected:
+    double _tolerance;
+    int _maxIter;
+    int _iterations;
+    double _residual;
+
+    std::vector<MatrixType, Eigen::aligned_allocator<MatrixType> > _diagInv;
+    VectorXD _r, _z, _p, _Ap;
+
+    void applyPreconditioner(const SparseBlockMatrix<MatrixType>& A, const VectorXD& src, VectorXD& dest) const
+    {
+      dest.resize(src.size());
+      for (size_t c = 0; c < _diagInv.size(); ++c) {
+        const int base = A.colBaseOfBlock(c);
+        const int size = A.colsOfBlock(c);
+        dest.segment(base, size) = _diagInv[c] * src.segment(base, size);
+      }
+    }
+
+    //! dest = A * src, with A symmetric and only its upper triangle stored
+    void mult(const SparseBlockMatrix<MatrixType>& A, const VectorXD& src, VectorXD& dest) const
+    {
+      dest.setZero(src.size());
+      for (size_t c = 0; c < A.blockCols().size(); ++c) {
+        const int colBase = A.colBaseOfBlock(c);
+        const int cols = A.colsOfBlock(c);
+        const typename SparseBlockMatrix<MatrixType>::IntBlockMap& column = A.blockCols()[c];
+        for (typename SparseBlockMatrix<MatrixType>::IntBlockMap::const_iterator it = column.begin(); it != column.end(); ++it) {
+          const int rowBase = A.rowBaseOfBlock(it->first);
+          const int rows = A.rowsOfBlock(it->first);
+          const MatrixType& m = *(it->second);
+          dest.segment(rowBase, rows).noalias() += m * src.segment(colBase, cols);
+          if (it->first != (int)c)
+            dest.segment(colBase, cols).noalias() += m.transpose() * src.segment(rowBase, rows);
+        }
+      }
+    }
+};
+
+}// end namespace
+
+#endif
@@ -40,7 +40,7 @@ namespace g2o {
  class VertexSBAPointXYZ : public BaseVertex<3, Vector3d>
 {
   public:
-    EIGEN_MAKE_ALIGNED_OPERATOR_NEW    
+    G2O_MAKE_POOLED_OPERATOR_NEW
     VertexSBAPointXYZ();
     virtual bool read(std::istream& is);
     virtual bool write(std::ostream& os) const;
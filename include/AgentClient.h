@@ -0,0 +1,132 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef AGENTCLIENT_H
+#define AGENTCLIENT_H
+
+#include "KeyFrameWire.h"
+
+#include <opencv2/core/core.hpp>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace ORB_SLAM3
+{
+
+class Atlas;
+class KeyFrame;
+class Map;
+
+// Connection of an agent to the map server (see MapServer), enabled with Agent.ServerHost,
+// Agent.ServerPort and Agent.Id. Local Mapping hands over each keyframe once it is done with it,
+// the keyframe is encoded right away (KeyFrameWire) and sent from the client thread, so a slow or
+// lost connection never blocks mapping. Every Agent.UpdatePeriod seconds, if the current map
+// changed, the client thread also sends the poses and positions of the keyframes and map points
+// already sent that moved since (local BA, loop closure, merge), delta encoded.
+// Up to MAX_QUEUED messages wait for a reconnection, the oldest ones are dropped (the next update
+// then sends full values). The server answers with the alignments of our maps with the maps of
+// the other agents.
+class AgentClient
+{
+public:
+    AgentClient(Atlas* pAtlas, const std::string &strHost, const int port, const unsigned int nAgentId,
+                const float fUpdatePeriod = 1.f);
+
+    // Main thread function
+    void Run();
+
+    // Called by Local Mapping
+    void SendKeyFrame(KeyFrame* pKF);
+
+    // Sim3 (s, R, t) that maps points of the map of the other agent into our map
+    struct Alignment
+    {
+        unsigned long long nMapId;
+        unsigned int nOtherAgentId;
+        unsigned long long nOtherMapId;
+        int nInliers;
+        float s;
+        cv::Mat R;
+        cv::Mat t;
+    };
+    std::vector<Alignment> GetAlignments();
+
+    void RequestFinish();
+    bool isFinished();
+
+    static const size_t MAX_QUEUED = 500;
+
+protected:
+    // Queues the changes of the current map since the last update
+    void CollectUpdates();
+    // Queues a message, the oldest one is dropped if the queue is full. Called with mMutexState
+    void Enqueue(std::vector<char> &buffer);
+
+    bool Connect();
+    void Close();
+    bool Send(const std::vector<char> &buffer);
+    // Reads what the server sent, false if the connection was closed
+    bool Receive();
+
+    bool CheckFinish();
+    void SetFinish();
+
+    Atlas* mpAtlas;
+    std::string mStrHost;
+    int mnPort;
+    unsigned int mnAgentId;
+    float mfUpdatePeriod;
+
+    int mSocket;
+    std::vector<char> mvReceived;
+
+    // References of the delta encoding, also locked while a message is queued so that the
+    // messages are in the order in which the references changed
+    std::mutex mMutexState;
+    MapUpdateState mState;
+    bool mbResync;  // a message was dropped, the references are not the ones of the server
+
+    // Current map when the last update was collected
+    Map* mpUpdatedMap;
+    int mnUpdatedChange;
+    long unsigned int mnUpdatedKFs;
+
+    std::mutex mMutexQueue;
+    std::condition_variable mcvQueue;
+    std::deque<std::vector<char> > mqMessages;
+
+    // Sent so far
+    size_t mnSentKeyFrames;
+    size_t mnSentUpdates;
+    size_t mnSentBytes;
+
+    std::mutex mMutexAlignments;
+    std::vector<Alignment> mvAlignments;
+
+    std::mutex mMutexFinish;
+    bool mbFinishRequested;
+    bool mbFinished;
+};
+
+} //namespace ORB_SLAM3
+
+#endif // AGENTCLIENT_H
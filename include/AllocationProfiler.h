@@ -0,0 +1,81 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ALLOCATIONPROFILER_H
+#define ALLOCATIONPROFILER_H
+
+#include <string>
+#include <vector>
+
+namespace ORB_SLAM3
+{
+
+// Heap allocations of the SLAM threads, counted by replacing the global operator new and
+// operator delete when the library is built with ORB_SLAM3_ALLOC_PROFILING
+// (cmake -DWITH_ALLOC_PROFILING=ON, which also builds the tracing spans). Every thread counts its
+// allocations in thread-local counters; the TraceScope spans (Tracer.h) take the difference between
+// their start and end, so the statistics of a span include its nested spans. Memory allocated with
+// malloc (cv::Mat, Eigen aligned types) is not counted.
+class AllocationProfiler
+{
+public:
+    struct Counters
+    {
+        unsigned long long allocations;
+        unsigned long long bytes;
+        unsigned long long frees;
+    };
+
+    struct SpanSnapshot
+    {
+        std::string name;
+        std::string thread;
+        unsigned long count;
+        unsigned long long allocations;
+        unsigned long long bytes;
+        // Allocations of the span that allocated most
+        unsigned long long maxAllocations;
+    };
+
+    struct ThreadSnapshot
+    {
+        std::string thread;
+        unsigned long long allocations;
+        unsigned long long bytes;
+        unsigned long long frees;
+    };
+
+    // Counters of the calling thread since it started. Zero unless built with ORB_SLAM3_ALLOC_PROFILING
+    static Counters ThreadCounters();
+
+    // Name of the calling thread in the snapshots. name must be a string literal
+    static void SetThreadName(const char* name);
+
+    // Allocations done by the calling thread in a span. name must be a string literal
+    static void RecordSpan(const char* name, const Counters &start, const Counters &end);
+
+    // Spans sorted by thread and name
+    static std::vector<SpanSnapshot> GetSpanSnapshots();
+    // Totals of the threads that recorded spans
+    static std::vector<ThreadSnapshot> GetThreadSnapshots();
+    static void Reset();
+};
+
+} //namespace ORB_SLAM3
+
+#endif // ALLOCATIONPROFILER_H
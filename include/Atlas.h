@@ -25,9 +25,15 @@
 #include "GeometricCamera.h"
 #include "Pinhole.h"
 #include "KannalaBrandt8.h"
+#include "LockProfiler.h"
+#include "MapEvents.h"
+#include "AtlasArchive.h"
 
 #include <set>
+#include <map>
 #include <mutex>
+#include <condition_variable>
+#include <string>
 #include <boost/serialization/vector.hpp>
 #include <boost/serialization/export.hpp>
 
@@ -42,9 +48,22 @@ class KeyFrameDatabase;
 class Frame;
 class KannalaBrandt8;
 class Pinhole;
+class SystemContext;
+class ThreadPool;
 
 class Atlas
 {
+    friend class boost::serialization::access;
+
+    template<class Archive>
+    void serialize(Archive &ar, const unsigned int version)
+    {
+        // Cameras are stored by their concrete type, so no class export is needed
+        ar & mvpBackupCamPin;
+        ar & mvpBackupCamKan;
+        ar & mvpBackupMaps;
+        ar & mnLastInitKFidMap;
+    }
 
 public:
     Atlas();
@@ -101,27 +120,117 @@ public:
     void SetORBVocabulary(ORBVocabulary* pORBVoc);
     ORBVocabulary* GetORBVocabulary();
 
+    // Frame and keyframe counters (moved past the loaded ids in PostLoad) and settings of the System,
+    // handed to every map of the atlas
+    void SetSystemContext(SystemContext* pContext);
+
+    // Incremental map changes for the subscribers, reported by every map of the atlas (NULL: none)
+    void SetMapEvents(MapEvents* pEvents);
+    MapEvents* GetMapEvents();
+    // Sends the changes collected since the last batch, at the end of a unit of work of the caller
+    void PublishMapEvents(const MapEvents::Cause cause);
+
     long unsigned int GetNumLivedKF();
 
     long unsigned int GetNumLivedMP();
 
+    // Memory budget for the keyframe features (keypoints, descriptors and feature vectors).
+    // When exceeded, the least recently used inactive maps write their features to strSpillDir
+    // and release them. A budget of 0 disables spilling.
+    void SetMemoryBudget(size_t nMaxBytes, const std::string &strSpillDir);
+    // Memory of the keyframes and map points of all the maps
+    MemoryUsage GetMemoryUsage();
+    // Spills the least recently used maps until the budget is met. Maps with a residency lease and
+    // maps used since the last call are left resident.
+    void EnforceMemoryBudget();
+    // Marks pMap as used and loads its features back if they were spilled
+    void EnsureResident(Map* pMap);
+    bool IsSpilled(Map* pMap);
+    // EnsureResident, and pMap is not spilled until the lease is released (one release per acquire)
+    void AcquireResident(Map* pMap);
+    void ReleaseResident(Map* pMap);
+
+    // Leases the added maps for the lifetime of the object
+    struct ResidencyLease
+    {
+        ResidencyLease(Atlas* pAtlas) : mpAtlas(pAtlas) {}
+        ~ResidencyLease()
+        {
+            for(size_t i=0; i<mvpMaps.size(); i++)
+                mpAtlas->ReleaseResident(mvpMaps[i]);
+        }
+        void Add(Map* pMap)
+        {
+            if(!pMap)
+                return;
+            mpAtlas->AcquireResident(pMap);
+            mvpMaps.push_back(pMap);
+        }
+
+        ResidencyLease(const ResidencyLease&) = delete;
+        ResidencyLease& operator=(const ResidencyLease&) = delete;
+
+        Atlas* mpAtlas;
+        std::vector<Map*> mvpMaps;
+    };
+
+    // Serialization. PreSave prepares every map for saving, PostLoad rebuilds the pointers
+    // from the stored ids and moves the id counters past the loaded elements.
+    void PreSave();
+    void PostLoad();
+
+    // Sections of the chunked atlas file, added after PreSave: "atlas" (maps, cameras and keyframe
+    // metadata) and for every map "map<id>/" followed by "mappoints", "observations", "bow",
+    // "keypoints" and "descriptors"
+    void AddSections(AtlasArchive &archive);
+    // Reads them before PostLoad. With bLazy the keypoints and descriptors are left in the file:
+    // the maps start as spilled and read them the first time they are used (EnsureResident)
+    bool ReadSections(AtlasArchive &archive, ThreadPool* pPool, const bool bLazy);
+
 protected:
 
     std::set<Map*> mspMaps;
     std::set<Map*> mspBadMaps;
+    // Only used while the atlas is being saved or loaded
+    std::vector<Map*> mvpBackupMaps;
     Map* mpCurrentMap;
 
     std::vector<GeometricCamera*> mvpCameras;
     std::vector<KannalaBrandt8*> mvpBackupCamKan;
     std::vector<Pinhole*> mvpBackupCamPin;
 
-    std::mutex mMutexAtlas;
+    AtlasMutex mMutexAtlas;
+    // Notified when the current map changes
+    AtlasCondition mcvCurrentMap;
 
     unsigned long int mnLastInitKFidMap;
 
+    SystemContext* mpContext;
+
+    MapEvents* mpMapEvents;
+
     Viewer* mpViewer;
     bool mHasViewer;
 
+    // Spilling of inactive maps
+    bool SpillMap(Map* pMap);
+    bool LoadSpilledMap(Map* pMap);
+    std::string SpillFileName(Map* pMap);
+    // Maps of a lazily loaded atlas whose features are still in the atlas file
+    bool LoadArchivedMap(Map* pMap, const std::string &strFile);
+    std::map<Map*, std::string> mmArchivedMaps;
+    ThreadPool* mpArchivePool;
+
+    size_t mnMaxFeaturesBytes;
+    std::string mStrSpillDir;
+    std::set<Map*> mspSpilledMaps;
+    std::map<Map*, unsigned long int> mmMapLastUse;
+    unsigned long int mnUseCounter;
+    // Use counter when EnforceMemoryBudget last ran
+    unsigned long int mnLastEnforceUse;
+    std::map<Map*, int> mmMapLeases;
+    std::mutex mMutexSpill;
+
     // Class references for the map reconstruction from the save file
     KeyFrameDatabase* mpKeyFrameDB;
     ORBVocabulary* mpORBVocabulary;
@@ -0,0 +1,120 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ATLASARCHIVE_H
+#define ATLASARCHIVE_H
+
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace ORB_SLAM3
+{
+
+class ThreadPool;
+
+// Chunked file of the binary atlas (System::SaveAtlas). The file holds named sections (keyframe
+// metadata, keypoints, descriptors, map points, observations, BoW vectors, database postings, see
+// Atlas::AddSections), followed by an index with their position. Every section is split in blocks
+// of BLOCK_SIZE bytes compressed independently, so the sections are encoded, compressed,
+// decompressed and decoded in parallel on the thread pool, and any subset of them can be read
+// without touching the rest of the file.
+//
+// Layout (little endian): "ORBATLAS", format version (uint32), index offset (uint64), the blocks,
+// then the index: number of sections (uint32) and for every section its name and blocks (offset,
+// stored size, raw size and codec of each).
+class AtlasArchive
+{
+public:
+    // Fills / reads one section. Called from the thread pool, the functions of the sections
+    // written or read in the same call must not modify the same data
+    typedef std::function<void(std::ostream&)> Encoder;
+    typedef std::function<void(std::istream&)> Decoder;
+
+    // While alive in a thread, the serialize functions of Map, KeyFrame and MapPoint called from
+    // it leave out what the chunked file stores in separate sections
+    class SkeletonScope
+    {
+    public:
+        SkeletonScope();
+        ~SkeletonScope();
+        static bool Active();
+    private:
+        bool mbPrevious;
+    };
+
+    AtlasArchive();
+
+    static bool IsArchive(const std::string &filename);
+
+    // Writing. The sections are stored in the order they were added
+    void AddSection(const std::string &strName, const Encoder &encoder);
+    bool Write(const std::string &filename, ThreadPool* pPool);
+
+    // Reading. Open only reads the index
+    bool Open(const std::string &filename);
+    const std::string& GetFileName() const { return mStrFile; }
+    bool HasSection(const std::string &strName) const;
+    std::vector<std::string> GetSectionNames() const;
+    // Reads, decompresses and decodes the given sections. False if one is missing or corrupt
+    bool Read(const std::vector<std::pair<std::string, Decoder> > &vDecoders, ThreadPool* pPool);
+
+    // Raw and stored bytes of the sections in the file (after Write or Open)
+    uint64_t GetRawBytes() const;
+    uint64_t GetStoredBytes() const;
+
+    static const size_t BLOCK_SIZE = 4*1024*1024;
+
+protected:
+
+    enum eCodec
+    {
+        CODEC_NONE=0,
+        CODEC_ZLIB=1
+    };
+
+    struct Block
+    {
+        uint64_t offset;
+        uint64_t storedSize;
+        uint64_t rawSize;
+        uint8_t codec;
+    };
+
+    struct SectionInfo
+    {
+        std::string name;
+        std::vector<Block> vBlocks;
+        uint64_t RawSize() const;
+    };
+
+    int FindSection(const std::string &strName) const;
+
+    std::string mStrFile;
+    std::vector<SectionInfo> mvSections;
+
+    // Sections to write
+    std::vector<std::pair<std::string, Encoder> > mvEncoders;
+};
+
+} //namespace ORB_SLAM3
+
+#endif // ATLASARCHIVE_H
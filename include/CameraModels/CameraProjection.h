@@ -0,0 +1,65 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef CAMERAMODELS_CAMERAPROJECTION_H
+#define CAMERAMODELS_CAMERAPROJECTION_H
+
+#include <Eigen/Core>
+
+#include "GeometricCamera.h"
+#include "Pinhole.h"
+#include "KannalaBrandt8.h"
+
+namespace ORB_SLAM3 {
+
+    // Projection and Jacobian of the camera through the static functions of its model, used by the
+    // optimization edges. With a concrete CameraModel the call is inlined. With GeometricCamera
+    // it dispatches on the type tag of the camera, which still avoids the virtual call.
+    template<class CameraModel>
+    inline Eigen::Vector2d CameraProject(GeometricCamera* pCamera, const Eigen::Vector3d &Xc)
+    {
+        return CameraModel::Project(pCamera->getParameters(), Xc);
+    }
+
+    template<class CameraModel>
+    inline Eigen::Matrix<double,2,3> CameraProjectJac(GeometricCamera* pCamera, const Eigen::Vector3d &Xc)
+    {
+        return CameraModel::ProjectJac(pCamera->getParameters(), Xc);
+    }
+
+    template<>
+    inline Eigen::Vector2d CameraProject<GeometricCamera>(GeometricCamera* pCamera, const Eigen::Vector3d &Xc)
+    {
+        if(pCamera->GetType() == pCamera->CAM_PINHOLE)
+            return Pinhole::Project(pCamera->getParameters(), Xc);
+        else
+            return KannalaBrandt8::Project(pCamera->getParameters(), Xc);
+    }
+
+    template<>
+    inline Eigen::Matrix<double,2,3> CameraProjectJac<GeometricCamera>(GeometricCamera* pCamera, const Eigen::Vector3d &Xc)
+    {
+        if(pCamera->GetType() == pCamera->CAM_PINHOLE)
+            return Pinhole::ProjectJac(pCamera->getParameters(), Xc);
+        else
+            return KannalaBrandt8::ProjectJac(pCamera->getParameters(), Xc);
+    }
+}
+
+#endif //CAMERAMODELS_CAMERAPROJECTION_H
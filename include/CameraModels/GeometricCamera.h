@@ -33,9 +33,21 @@
 
 #include <Eigen/Geometry>
 
+#include <atomic>
+
 namespace ORB_SLAM3 {
     class GeometricCamera {
 
+        friend class boost::serialization::access;
+
+        template<class Archive>
+        void serialize(Archive& ar, const unsigned int version)
+        {
+            ar & mnId;
+            ar & mnType;
+            ar & mvParameters;
+        }
+
     public:
         GeometricCamera() {}
         GeometricCamera(const std::vector<float> &_vParameters) : mvParameters(_vParameters) {}
@@ -56,6 +68,11 @@ namespace ORB_SLAM3 {
         virtual cv::Mat projectJac(const cv::Point3f &p3D) = 0;
         virtual Eigen::Matrix<double,2,3> projectJac(const Eigen::Vector3d& v3D) = 0;
 
+        // Batch projection over contiguous arrays (one virtual call per batch). unprojectMany
+        // returns the x,y of the bearing rays, whose z is 1 as in unproject.
+        virtual void projectMany(const float* pX, const float* pY, const float* pZ, const int N, float* pU, float* pV) = 0;
+        virtual void unprojectMany(const float* pU, const float* pV, const int N, float* pX, float* pY) = 0;
+
         virtual cv::Mat unprojectJac(const cv::Point2f &p2D) = 0;
 
         virtual bool ReconstructWithTwoViews(const std::vector<cv::KeyPoint>& vKeys1, const std::vector<cv::KeyPoint>& vKeys2, const std::vector<int> &vMatches12,
@@ -68,6 +85,7 @@ namespace ORB_SLAM3 {
         virtual bool epipolarConstrain_(GeometricCamera* otherCamera, const cv::KeyPoint& kp1, const cv::KeyPoint& kp2, const cv::Matx33f& R12, const cv::Matx31f& t12, const float sigmaLevel, const float unc) = 0;
 
         float getParameter(const int i){return mvParameters[i];}
+        const float* getParameters() const {return mvParameters.data();}
         void setParameter(const float p, const size_t i){mvParameters[i] = p;}
 
         size_t size(){return mvParameters.size();}
@@ -81,10 +99,16 @@ namespace ORB_SLAM3 {
 
         unsigned int GetType() { return mnType; }
 
+        // Keypoint grid (cells) of the frames of this camera, 0 for the default of Frame
+        void SetFeatureGrid(const int nCols, const int nRows){mnGridCols = nCols; mnGridRows = nRows;}
+        int GetGridCols() const {return mnGridCols;}
+        int GetGridRows() const {return mnGridRows;}
+
         const unsigned int CAM_PINHOLE = 0;
         const unsigned int CAM_FISHEYE = 1;
 
-        static long unsigned int nNextId;
+        // Process-wide, ids only have to be unique (shared by all the Systems)
+        static std::atomic<long unsigned int> nNextId;
 
     protected:
         std::vector<float> mvParameters;
@@ -92,8 +116,13 @@ namespace ORB_SLAM3 {
         unsigned int mnId;
 
         unsigned int mnType;
+
+        int mnGridCols = 0;
+        int mnGridRows = 0;
     };
 }
 
 
+BOOST_SERIALIZATION_ASSUME_ABSTRACT(ORB_SLAM3::GeometricCamera)
+
 #endif //CAMERAMODELS_GEOMETRICCAMERA_H
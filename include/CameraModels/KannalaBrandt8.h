@@ -35,25 +35,36 @@
 namespace ORB_SLAM3 {
     class KannalaBrandt8 final : public GeometricCamera {
 
+        friend class boost::serialization::access;
+
+        template<class Archive>
+        void serialize(Archive& ar, const unsigned int version)
+        {
+            ar & boost::serialization::base_object<GeometricCamera>(*this);
+            ar & const_cast<float&>(precision);
+            ar & mvLappingArea;
+        }
+
     public:
-        KannalaBrandt8() : precision(1e-6) {
+        KannalaBrandt8() : precision(1e-6), mvLappingArea(2,0), tvr(nullptr), mfInvLUTStep(0.f) {
             mvParameters.resize(8);
             mnId=nNextId++;
             mnType = CAM_FISHEYE;
         }
-        KannalaBrandt8(const std::vector<float> _vParameters) : GeometricCamera(_vParameters), precision(1e-6), mvLappingArea(2,0) ,tvr(nullptr) {
+        KannalaBrandt8(const std::vector<float> _vParameters) : GeometricCamera(_vParameters), precision(1e-6), mvLappingArea(2,0) ,tvr(nullptr), mfInvLUTStep(0.f) {
             assert(mvParameters.size() == 8);
             mnId=nNextId++;
             mnType = CAM_FISHEYE;
         }
 
         KannalaBrandt8(const std::vector<float> _vParameters, const float _precision) : GeometricCamera(_vParameters),
-                                                                                        precision(_precision), mvLappingArea(2,0) {
+                                                                                        precision(_precision), mvLappingArea(2,0), tvr(nullptr), mfInvLUTStep(0.f) {
             assert(mvParameters.size() == 8);
             mnId=nNextId++;
             mnType = CAM_FISHEYE;
         }
-        KannalaBrandt8(KannalaBrandt8* pKannala) : GeometricCamera(pKannala->mvParameters), precision(pKannala->precision), mvLappingArea(2,0) ,tvr(nullptr) {
+        KannalaBrandt8(KannalaBrandt8* pKannala) : GeometricCamera(pKannala->mvParameters), precision(pKannala->precision), mvLappingArea(2,0) ,tvr(nullptr),
+                                                   mvThetaLUT(pKannala->mvThetaLUT), mfInvLUTStep(pKannala->mfInvLUTStep) {
             assert(mvParameters.size() == 8);
             mnId=nNextId++;
             mnType = CAM_FISHEYE;
@@ -76,6 +87,62 @@ namespace ORB_SLAM3 {
 
         cv::Mat unprojectJac(const cv::Point2f &p2D);
 
+        void projectMany(const float* pX, const float* pY, const float* pZ, const int N, float* pU, float* pV);
+        void unprojectMany(const float* pU, const float* pV, const int N, float* pX, float* pY);
+
+        // Tabulates the inverse of the distortion polynomial (theta as a function of theta_d) on
+        // nSamples intervals over [0, pi/2]. unproject then interpolates it instead of running
+        // the Newton solve per point. Must be called before the camera is used by other threads.
+        void BuildUnprojectLUT(const int nSamples);
+
+        // Static versions taking the parameter vector, for callers that already know the model
+        template<typename T>
+        static Eigen::Matrix<T,2,1> Project(const float* K, const Eigen::Matrix<T,3,1> &v3D) {
+            const T x2_plus_y2 = v3D[0] * v3D[0] + v3D[1] * v3D[1];
+            const T theta = std::atan2(std::sqrt(x2_plus_y2), v3D[2]);
+            const T psi = std::atan2(v3D[1], v3D[0]);
+
+            const T theta2 = theta * theta;
+            const T theta3 = theta * theta2;
+            const T theta5 = theta3 * theta2;
+            const T theta7 = theta5 * theta2;
+            const T theta9 = theta7 * theta2;
+            const T r = theta + K[4] * theta3 + K[5] * theta5 + K[6] * theta7 + K[7] * theta9;
+
+            Eigen::Matrix<T,2,1> res;
+            res[0] = K[0] * r * std::cos(psi) + K[2];
+            res[1] = K[1] * r * std::sin(psi) + K[3];
+            return res;
+        }
+
+        template<typename T>
+        static Eigen::Matrix<T,2,3> ProjectJac(const float* K, const Eigen::Matrix<T,3,1> &v3D) {
+            const T x2 = v3D[0] * v3D[0], y2 = v3D[1] * v3D[1], z2 = v3D[2] * v3D[2];
+            const T r2 = x2 + y2;
+            const T r = std::sqrt(r2);
+            const T r3 = r2 * r;
+            const T theta = std::atan2(r, v3D[2]);
+
+            const T theta2 = theta * theta, theta3 = theta2 * theta;
+            const T theta4 = theta2 * theta2, theta5 = theta4 * theta;
+            const T theta6 = theta2 * theta4, theta7 = theta6 * theta;
+            const T theta8 = theta4 * theta4, theta9 = theta8 * theta;
+
+            const T f = theta + theta3 * K[4] + theta5 * K[5] + theta7 * K[6] + theta9 * K[7];
+            const T fd = 1 + 3 * K[4] * theta2 + 5 * K[5] * theta4 + 7 * K[6] * theta6 + 9 * K[7] * theta8;
+
+            Eigen::Matrix<T,2,3> Jac;
+            Jac(0, 0) = K[0] * (fd * v3D[2] * x2 / (r2 * (r2 + z2)) + f * y2 / r3);
+            Jac(1, 0) = K[1] * (fd * v3D[2] * v3D[1] * v3D[0] / (r2 * (r2 + z2)) - f * v3D[1] * v3D[0] / r3);
+
+            Jac(0, 1) = K[0] * (fd * v3D[2] * v3D[1] * v3D[0] / (r2 * (r2 + z2)) - f * v3D[1] * v3D[0] / r3);
+            Jac(1, 1) = K[1] * (fd * v3D[2] * y2 / (r2 * (r2 + z2)) + f * x2 / r3);
+
+            Jac(0, 2) = -K[0] * fd * v3D[0] / (r2 + z2);
+            Jac(1, 2) = -K[1] * fd * v3D[1] / (r2 + z2);
+            return Jac;
+        }
+
         bool ReconstructWithTwoViews(const std::vector<cv::KeyPoint>& vKeys1, const std::vector<cv::KeyPoint>& vKeys2, const std::vector<int> &vMatches12,
                                      cv::Mat &R21, cv::Mat &t21, std::vector<cv::Point3f> &vP3D, std::vector<bool> &vbTriangulated);
 
@@ -106,6 +173,12 @@ namespace ORB_SLAM3 {
 
         TwoViewReconstruction* tvr;
 
+        // Undistorted angle theta at evenly spaced theta_d, empty if not built
+        std::vector<float> mvThetaLUT;
+        float mfInvLUTStep;
+
+        float SolveTheta(const float theta_d);
+
         void Triangulate(const cv::Point2f &p1, const cv::Point2f &p2, const cv::Mat &Tcw1, const cv::Mat &Tcw2,cv::Mat &x3D);
         void Triangulate_(const cv::Point2f &p1, const cv::Point2f &p2, const cv::Matx44f &Tcw1, const cv::Matx44f &Tcw2,cv::Matx31f &x3D);
     };
@@ -35,8 +35,16 @@
 namespace ORB_SLAM3 {
     class Pinhole : public GeometricCamera {
 
+        friend class boost::serialization::access;
+
+        template<class Archive>
+        void serialize(Archive& ar, const unsigned int version)
+        {
+            ar & boost::serialization::base_object<GeometricCamera>(*this);
+        }
+
     public:
-        Pinhole() {
+        Pinhole() : tvr(nullptr) {
             mvParameters.resize(4);
             mnId=nNextId++;
             mnType = CAM_PINHOLE;
@@ -76,6 +84,30 @@ namespace ORB_SLAM3 {
 
         cv::Mat unprojectJac(const cv::Point2f &p2D);
 
+        void projectMany(const float* pX, const float* pY, const float* pZ, const int N, float* pU, float* pV);
+        void unprojectMany(const float* pU, const float* pV, const int N, float* pX, float* pY);
+
+        // Static versions taking the parameter vector, for callers that already know the model
+        template<typename T>
+        static Eigen::Matrix<T,2,1> Project(const float* K, const Eigen::Matrix<T,3,1> &v3D) {
+            Eigen::Matrix<T,2,1> res;
+            res[0] = K[0] * v3D[0] / v3D[2] + K[2];
+            res[1] = K[1] * v3D[1] / v3D[2] + K[3];
+            return res;
+        }
+
+        template<typename T>
+        static Eigen::Matrix<T,2,3> ProjectJac(const float* K, const Eigen::Matrix<T,3,1> &v3D) {
+            Eigen::Matrix<T,2,3> Jac;
+            Jac(0, 0) = K[0] / v3D[2];
+            Jac(0, 1) = T(0);
+            Jac(0, 2) = -K[0] * v3D[0] / (v3D[2] * v3D[2]);
+            Jac(1, 0) = T(0);
+            Jac(1, 1) = K[1] / v3D[2];
+            Jac(1, 2) = -K[1] * v3D[1] / (v3D[2] * v3D[2]);
+            return Jac;
+        }
+
         bool ReconstructWithTwoViews(const std::vector<cv::KeyPoint>& vKeys1, const std::vector<cv::KeyPoint>& vKeys2, const std::vector<int> &vMatches12,
                                              cv::Mat &R21, cv::Mat &t21, std::vector<cv::Point3f> &vP3D, std::vector<bool> &vbTriangulated);
 
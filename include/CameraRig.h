@@ -0,0 +1,82 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef CAMERARIG_H
+#define CAMERARIG_H
+
+#include <vector>
+#include <future>
+#include <opencv2/core/core.hpp>
+
+#include "Frame.h"
+
+namespace ORB_SLAM3
+{
+
+class GeometricCamera;
+class FeatureExtractor;
+class ThreadPool;
+
+// Additional cameras rigidly mounted with the main camera (or stereo pair) of the Tracking, e.g. the
+// side and rear cameras of a surround rig. Their images are extracted on the worker pool while the
+// main images are, and their features are matched to the local map and used by the pose
+// optimization: the rig is tracked as one body, whose pose is the one of the main camera. The
+// keyframes keep these matches for the local and global bundle adjustment (g2o engine). The points
+// are still created from the main camera only (initialization, new points), and the inertial
+// optimizations and the localization mode do not use the rig cameras.
+class CameraRig
+{
+public:
+    // Rig.nCameras and, for every rig camera i from 0: Rig.Camera<i>.type ("PinHole" or
+    // "KannalaBrandt8"), .fx .fy .cx .cy, the distortion .k1 .k2 .p1 .p2 [.k3] (pinhole) or .k1 .k2 .k3
+    // .k4 (fisheye), and .Tc0, the 4x4 transformation from the main camera to this one. The extractors
+    // take the ORBextractor.* parameters. NULL if there are no rig cameras or a camera is incomplete.
+    static CameraRig* FromSettings(cv::FileStorage &fSettings);
+
+    ~CameraRig();
+
+    int size() const { return mvCameras.size(); }
+
+    // Starts the extraction of the images of the rig cameras (one per camera, gray or color in RGB
+    // or BGR order) on the pool, or extracts them in this thread without workers. CollectFeatures
+    // waits for them and gives the features to the frame.
+    void ExtractAsync(const std::vector<cv::Mat> &vIms, const bool bRGB, ThreadPool* pThreadPool);
+    void CollectFeatures(Frame &F);
+
+protected:
+    struct RigCamera
+    {
+        GeometricCamera* pCamera;
+        cv::Mat distCoef;
+        cv::Matx44f Tcb;
+        FeatureExtractor* pExtractor;
+    };
+
+    CameraRig() {}
+
+    void Extract(const int i, const cv::Mat &im, const bool bRGB);
+
+    std::vector<RigCamera> mvCameras;
+
+    // Views being extracted and their tasks
+    std::vector<RigView> mvViews;
+    std::vector<std::future<void> > mvExtractions;
+};
+
+} //namespace ORB_SLAM
+
+#endif // CAMERARIG_H
@@ -35,6 +35,7 @@ public:
     static std::vector<cv::Mat> toDescriptorVector(const cv::Mat &Descriptors);
 
     static g2o::SE3Quat toSE3Quat(const cv::Mat &cvT);
+    static g2o::SE3Quat toSE3Quat(const cv::Matx44f &cvT);
     static g2o::SE3Quat toSE3Quat(const g2o::Sim3 &gSim3);
 
     static cv::Mat toCvMat(const g2o::SE3Quat &SE3);
@@ -44,12 +45,17 @@ public:
     static cv::Mat toCvMat(const Eigen::Matrix<double,3,1> &m);
     static cv::Mat toCvMat(const Eigen::MatrixXd &m);
 
+    static cv::Matx44f toMatx44f(const g2o::SE3Quat &SE3);
+    static cv::Matx31f toMatx31f(const Eigen::Matrix<double,3,1> &m);
+
     static cv::Mat toCvSE3(const Eigen::Matrix<double,3,3> &R, const Eigen::Matrix<double,3,1> &t);
     static cv::Mat tocvSkewMatrix(const cv::Mat &v);
 
     static Eigen::Matrix<double,3,1> toVector3d(const cv::Mat &cvVector);
     static Eigen::Matrix<double,3,1> toVector3d(const cv::Point3f &cvPoint);
     static Eigen::Matrix<double,3,3> toMatrix3d(const cv::Mat &cvMat3);
+    static Eigen::Matrix<double,3,1> toVector3d(const cv::Matx31f &cvVector);
+    static Eigen::Matrix<double,3,3> toMatrix3d(const cv::Matx33f &cvMat3);
     static Eigen::Matrix<double,4,4> toMatrix4d(const cv::Mat &cvMat4);
     static std::vector<float> toQuaternion(const cv::Mat &M);
 
@@ -0,0 +1,191 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ENTITYSTORE_H
+#define ENTITYSTORE_H
+
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+
+namespace ORB_SLAM3
+{
+
+// Stable reference to a keyframe or map point inside the store of its map: slot index and generation
+// of the slot when the entity was inserted. A handle whose entity has been erased never resolves to the
+// entity that reuses the slot later.
+struct EntityHandle
+{
+    uint32_t index;
+    uint32_t generation;
+
+    EntityHandle(): index(0), generation(0) {}
+    EntityHandle(uint32_t idx, uint32_t gen): index(idx), generation(gen) {}
+
+    // Generations start at 1, a default constructed handle is never valid
+    bool IsValid() const { return generation!=0; }
+
+    // Packed form, so that entities can keep their handle in a single atomic
+    uint64_t Pack() const { return (static_cast<uint64_t>(generation)<<32) | index; }
+    static EntityHandle Unpack(uint64_t v) { return EntityHandle(static_cast<uint32_t>(v), static_cast<uint32_t>(v>>32)); }
+
+    bool operator==(const EntityHandle &other) const { return index==other.index && generation==other.generation; }
+    bool operator!=(const EntityHandle &other) const { return !(*this==other); }
+};
+
+// Set of entities (KeyFrame, MapPoint) with handle access. Slots map handles to a dense array of the
+// live entities, so iteration runs over contiguous memory in insertion order (erasing moves the last
+// entity into the hole) and does not depend on where the entities were allocated.
+// T must provide GetHandle() and SetHandle(EntityHandle). Not thread safe, the owner (Map) takes care of locking.
+template<class T>
+class EntityStore
+{
+public:
+    typedef typename std::vector<T*>::const_iterator const_iterator;
+
+    EntityStore(): mnVersion(0), mnGenerationBase(0), mnMaxGeneration(0) {}
+
+    const_iterator begin() const { return mvpDense.begin(); }
+    const_iterator end() const { return mvpDense.end(); }
+    size_t size() const { return mvpDense.size(); }
+    bool empty() const { return mvpDense.empty(); }
+
+    // Changes every time an entity is inserted or erased
+    uint64_t Version() const { return mnVersion; }
+
+    // Inserting an entity that is already in the store returns its current handle
+    EntityHandle Insert(T* p)
+    {
+        const EntityHandle h = p->GetHandle();
+        if(Get(h)==p)
+            return h;
+
+        uint32_t idx;
+        if(!mvFreeSlots.empty())
+        {
+            idx = mvFreeSlots.back();
+            mvFreeSlots.pop_back();
+        }
+        else
+        {
+            idx = mvSlots.size();
+            mvSlots.push_back(Slot());
+            mvSlots.back().generation = mnGenerationBase;
+        }
+
+        Slot &slot = mvSlots[idx];
+        NextGeneration(slot);
+        slot.dense = mvpDense.size();
+        mvpDense.push_back(p);
+        mvDenseSlot.push_back(idx);
+
+        const EntityHandle hNew(idx,slot.generation);
+        p->SetHandle(hNew);
+        mnVersion++;
+        return hNew;
+    }
+
+    // Returns false if the entity is not in the store. The handle of the entity is the one of the last
+    // store it was inserted in, entities moved to another store (map merges) are erased from this one first
+    bool Erase(T* p)
+    {
+        const EntityHandle h = p->GetHandle();
+        if(Get(h)!=p)
+            return false;
+
+        Slot &slot = mvSlots[h.index];
+        const size_t dense = slot.dense;
+        const size_t last = mvpDense.size()-1;
+        if(dense!=last)
+        {
+            mvpDense[dense] = mvpDense[last];
+            mvDenseSlot[dense] = mvDenseSlot[last];
+            mvSlots[mvDenseSlot[dense]].dense = dense;
+        }
+        mvpDense.pop_back();
+        mvDenseSlot.pop_back();
+
+        // Bumping the generation invalidates every handle to the erased entity
+        NextGeneration(slot);
+        slot.dense = INVALID;
+        mvFreeSlots.push_back(h.index);
+
+        p->SetHandle(EntityHandle());
+        mnVersion++;
+        return true;
+    }
+
+    // NULL for stale or invalid handles
+    T* Get(const EntityHandle &h) const
+    {
+        if(!h.IsValid() || h.index>=mvSlots.size())
+            return static_cast<T*>(NULL);
+        const Slot &slot = mvSlots[h.index];
+        if(slot.generation!=h.generation || slot.dense==INVALID)
+            return static_cast<T*>(NULL);
+        return mvpDense[slot.dense];
+    }
+
+    // Constant time, the entities are not touched (they keep their now stale handle). The new slots
+    // start past every generation given out so far, so that the old handles stay stale
+    void Clear()
+    {
+        std::vector<Slot>().swap(mvSlots);
+        std::vector<uint32_t>().swap(mvFreeSlots);
+        std::vector<T*>().swap(mvpDense);
+        std::vector<uint32_t>().swap(mvDenseSlot);
+        mnGenerationBase = mnMaxGeneration;
+        mnVersion++;
+    }
+
+private:
+    static const size_t INVALID = static_cast<size_t>(-1);
+
+    struct Slot
+    {
+        Slot(): generation(0), dense(INVALID) {}
+        uint32_t generation;
+        size_t dense;
+    };
+
+    void NextGeneration(Slot &slot)
+    {
+        slot.generation++;
+        if(slot.generation==0)
+            slot.generation = 1;
+        if(slot.generation>mnMaxGeneration)
+            mnMaxGeneration = slot.generation;
+    }
+
+    std::vector<Slot> mvSlots;
+    std::vector<uint32_t> mvFreeSlots;
+
+    // Live entities and the slot of each of them
+    std::vector<T*> mvpDense;
+    std::vector<uint32_t> mvDenseSlot;
+
+    uint64_t mnVersion;
+
+    // Generation of the slots created after the last Clear, and the largest one given out
+    uint32_t mnGenerationBase;
+    uint32_t mnMaxGeneration;
+};
+
+} //namespace ORB_SLAM
+
+#endif // ENTITYSTORE_H
@@ -0,0 +1,101 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef EPOCHMANAGER_H
+#define EPOCHMANAGER_H
+
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <cstddef>
+#include <stdint.h>
+
+namespace ORB_SLAM3
+{
+
+// Deferred reclamation of the entities shared between threads (quiescent state based).
+// The threads that touch map entities (tracking, local mapping, loop closing, global BA, viewer,
+// map streamer, agent client, trajectory writer) register and call Quiescent() at a point of their
+// loop where they hold no pointer obtained in a previous iteration. The global epoch advances once
+// every registered thread has passed such a point, and an entity retired in epoch e is reclaimed
+// when the epoch reaches e+2+grace. The grace period covers the few pointers that are kept one
+// iteration longer (last frame, drawers). It is given with each entity, from the settings of the
+// System that retires it (SystemContext), since the Systems of a process share the manager.
+class EpochManager
+{
+public:
+    // Quiescent() registers the calling thread if needed. A registered thread that stops calling
+    // Quiescent() blocks every reclamation, threads that finish must unregister.
+    static void RegisterThread();
+    static void UnregisterThread();
+
+    // Registers the calling thread for the lifetime of the object
+    struct ThreadRegistration
+    {
+        ThreadRegistration() { RegisterThread(); }
+        ~ThreadRegistration() { UnregisterThread(); }
+    };
+
+    // Declare that the calling thread holds no pointer to retired entities. Ready entities are
+    // reclaimed in this call unless bReclaim is false (latency sensitive threads).
+    static void Quiescent(bool bReclaim = true);
+
+    static const int DEFAULT_GRACE_PERIOD = 2;
+
+    // reclaim(p) runs once no registered thread can reach p anymore, nGracePeriod epochs later
+    // than the earliest safe point
+    static void Retire(void* p, void (*reclaim)(void*), int nGracePeriod = DEFAULT_GRACE_PERIOD);
+
+    template<class T>
+    static void Retire(T* p, int nGracePeriod = DEFAULT_GRACE_PERIOD)
+    {
+        Retire(p, &DeleteObject<T>, nGracePeriod);
+    }
+
+    // Retired entities still waiting to be reclaimed
+    static size_t Pending();
+
+private:
+    template<class T>
+    static void DeleteObject(void* p)
+    {
+        delete static_cast<T*>(p);
+    }
+
+    struct Retired
+    {
+        void* p;
+        void (*reclaim)(void*);
+        // Epoch from which it can be reclaimed
+        uint64_t nReclaimEpoch;
+    };
+
+    static void TryAdvance();
+
+    static std::mutex mMutex;
+    static uint64_t mnEpoch;
+    // Last epoch observed by every registered thread
+    static std::map<std::thread::id, uint64_t> mmThreadEpochs;
+    static std::deque<Retired> mqRetired;
+};
+
+} //namespace ORB_SLAM
+
+#endif // EPOCHMANAGER_H
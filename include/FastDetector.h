@@ -0,0 +1,60 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FASTDETECTOR_H
+#define FASTDETECTOR_H
+
+#include <cstddef>
+#include <vector>
+
+namespace ORB_SLAM3
+{
+
+struct FastCorner
+{
+    int x;
+    int y;
+    int score;
+};
+
+// FAST-9 corners (16 pixel circle of radius 3) over a whole image region in one pass, with the
+// same test, score and 3x3 non maximum suppression as cv::FAST(image, keypoints, threshold, true).
+// Rows are scanned 16 pixels at a time (SSE2 or NEON): the four compass pixels of the circle
+// discard most pixels and only the remaining ones get the full arc test and the score.
+class FastDetector
+{
+public:
+    // Corners with score>=threshold in [x0,x1) x [y0,y1) of an 8-bit image, in raster order.
+    // The 3 pixels around the region are read. The score of a corner is the largest threshold
+    // at which it is still a corner, so one pass at a low threshold gives the corners at any
+    // higher threshold as well (same suppression, the weaker corners never suppress them).
+    static void Detect(const unsigned char* pImage, const size_t step, const int x0, const int y0,
+                       const int x1, const int y1, const int threshold, std::vector<FastCorner> &vCorners);
+
+    // Score of the pixel at p (as cv::FAST), -1 if it is not a corner at threshold
+    static int Score(const unsigned char* p, const int* pOffsets, const int threshold);
+
+protected:
+    // Scores of a row in pScores (0 if not a corner), corner columns in vColumns
+    static void ScoreRow(const unsigned char* pRow, const int* pOffsets, const int x0, const int x1,
+                         const int threshold, unsigned char* pScores, std::vector<int> &vColumns);
+};
+
+} //namespace ORB_SLAM3
+
+#endif // FASTDETECTOR_H
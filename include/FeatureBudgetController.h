@@ -0,0 +1,74 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FEATUREBUDGETCONTROLLER_H
+#define FEATUREBUDGETCONTROLLER_H
+
+#include <atomic>
+#include <chrono>
+
+namespace ORB_SLAM3
+{
+
+// Number of features and pyramid levels of the extractors, adapted frame by frame so that
+// extraction plus tracking fits in fBudget ms. Over the budget the features shrink in
+// proportion, and below nMinFeatures the top pyramid levels are dropped. With spare time the
+// levels come back first and then the features grow. They also grow while the tracked inliers
+// are few, as long as there is time for it. Nothing grows while the CPU is saturated
+// (1 minute load average per core), since the measured times would soon get worse.
+// Update is called by Tracking, the extraction thread reads the values.
+class FeatureBudgetController
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    FeatureBudgetController(const float fBudget, const int nFeatures, const int nMinFeatures, const int nMaxFeatures,
+                            const int nLevels, const int nMinLevels);
+
+    // After each tracked frame: time of extraction and tracking (ms) and the tracked inliers
+    void Update(const double frameMs, const int nInliers);
+
+    int GetFeatures() const { return mnFeatures.load(std::memory_order_relaxed); }
+    int GetLevels() const { return mnLevels.load(std::memory_order_relaxed); }
+
+    double GetFrameTime() const { return mFrameTime; }
+
+protected:
+    // Load average per core, read at most once per second
+    double CpuLoad();
+
+    float mfBudget;
+    int mnMinFeatures, mnMaxFeatures;
+    int mnMinLevels, mnMaxLevels;
+
+    // Averaged frame time, and frames left before the next change
+    double mFrameTime;
+    bool mbMeasured;
+    int mnHold;
+
+    double mCpuLoad;
+    Clock::time_point mTimeLoad;
+    int mnCores;
+
+    std::atomic<int> mnFeatures;
+    std::atomic<int> mnLevels;
+};
+
+} //namespace ORB_SLAM
+
+#endif // FEATUREBUDGETCONTROLLER_H
@@ -0,0 +1,91 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef FEATUREEXTRACTOR_H
+#define FEATUREEXTRACTOR_H
+
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+namespace ORB_SLAM3
+{
+
+class ThreadPool;
+class PyramidRowSource;
+
+// Interface between Frame and the feature detector/descriptor back end. Implementations
+// must produce ORB compatible output (256 bit descriptors, octave in the keypoints) on the
+// scale pyramid they report, and leave that pyramid in mvImagePyramid for the stereo search.
+// ORBextractor computes everything on the CPU, ORBextractorOCL builds the pyramid on an OpenCL
+// device (ORBextractor.Backend in the settings file).
+class FeatureExtractor
+{
+public:
+    virtual ~FeatureExtractor(){}
+
+    // Compute the features and descriptors on an image
+    virtual int operator()( cv::InputArray _image, cv::InputArray _mask,
+                            std::vector<cv::KeyPoint>& _keypoints,
+                            cv::OutputArray _descriptors, std::vector<int> &vLappingArea) = 0;
+
+    virtual int GetLevels() = 0;
+    virtual float GetScaleFactor() = 0;
+    virtual std::vector<float> GetScaleFactors() = 0;
+    virtual std::vector<float> GetInverseScaleFactors() = 0;
+    virtual std::vector<float> GetScaleSigmaSquares() = 0;
+    virtual std::vector<float> GetInverseScaleSigmaSquares() = 0;
+
+    virtual void SetThreadPool(ThreadPool* pThreadPool, const bool bParallelLevels) = 0;
+    virtual ThreadPool* GetThreadPool() = 0;
+
+    // Number of features and of pyramid levels with features, at most those of construction.
+    // Extractors without a budget ignore it.
+    virtual void SetFeatureBudget(const int nFeatures, const int nLevels) {}
+
+    // Restrict the next extractions to the cells set in mask (CV_8U, one element per
+    // nCellSize x nCellSize pixels of the image) and to about fCoverage of the other cells, a
+    // different share every image. An empty mask extracts on the whole image again.
+    // Extractors without it ignore it and always report full extractions.
+    virtual void SetFocusMask(const cv::Mat &mask, const int nCellSize, const float fCoverage) {}
+    // Whether the last extraction was restricted by a focus mask
+    virtual bool IsFocused() { return false; }
+
+    // Leave out the pyramid levels below nFirstLevel in the next extractions (0: full resolution).
+    // They are neither built nor searched, the pyramid starts at nFirstLevel resized from the input
+    // image and the scale pyramid reported to the frames is unchanged. Extractors without it ignore
+    // it and always report full resolution extractions.
+    virtual void SetFirstLevel(const int nFirstLevel) {}
+    // First pyramid level of the last extraction
+    virtual int GetFirstLevel() { return 0; }
+
+    // Take the rows of the next extracted image from pSource (e.g. rectified and converted to gray from
+    // the input) while building the first pyramid level; the image given then only sets the size.
+    // Returns false if the extractor needs the image itself. Applies to one extraction only.
+    virtual bool SetImageRowSource(PyramidRowSource* pSource) { return false; }
+
+    // Image pyramid of the last extracted image. Levels are 8-bit views with a 19 pixel
+    // border around them (ORBextractor EDGE_THRESHOLD), which the stereo patch search relies on.
+    std::vector<cv::Mat> mvImagePyramid;
+    // Size of the last extracted image (level 0, also when that level was left out)
+    cv::Size mImageSize;
+};
+
+} //namespace ORB_SLAM
+
+#endif // FEATUREEXTRACTOR_H
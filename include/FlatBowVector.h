@@ -0,0 +1,59 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FLATBOWVECTOR_H
+#define FLATBOWVECTOR_H
+
+#include <vector>
+#include <cstddef>
+
+#include "Thirdparty/DBoW2/DBoW2/BowVector.h"
+
+namespace ORB_SLAM3
+{
+
+// DBoW2::BowVector (word id -> weight) laid out in two arrays: the sorted word ids and their
+// weights as floats. Two bags of words are compared with a merge of the arrays (4 words at a time
+// with SSE2/NEON) instead of walking two std::map trees, and take 8 bytes per word instead of a
+// tree node. Built once per frame or keyframe, next to the BowVector.
+class FlatBowVector
+{
+public:
+    void Build(const DBoW2::BowVector &bowVec);
+    void Clear();
+
+    size_t Size() const { return mvWordIds.size(); }
+    bool Empty() const { return mvWordIds.empty(); }
+
+    DBoW2::WordId WordId(const size_t n) const { return mvWordIds[n]; }
+    float Weight(const size_t n) const { return mvWeights[n]; }
+
+    // Common words of v1 and v2 and their L1 score, the sum of the smallest weight of every common
+    // word (DBoW2::L1Scoring of two L1-normalized vectors)
+    static float L1Score(const FlatBowVector &v1, const FlatBowVector &v2, int &nCommonWords);
+
+    size_t MemoryBytes() const;
+
+protected:
+    std::vector<DBoW2::WordId> mvWordIds;
+    std::vector<float> mvWeights;
+};
+
+} //namespace ORB_SLAM
+
+#endif // FLATBOWVECTOR_H
@@ -0,0 +1,63 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FLATFEATUREVECTOR_H
+#define FLATFEATUREVECTOR_H
+
+#include <vector>
+#include <cstddef>
+
+#include "Thirdparty/DBoW2/DBoW2/FeatureVector.h"
+
+namespace ORB_SLAM3
+{
+
+// DBoW2::FeatureVector (vocabulary node -> keypoint indices) laid out in three arrays: the sorted
+// node ids, the offset of the indices of every node and the indices themselves. The feature
+// vectors of two images are intersected with a merge over contiguous memory instead of walking
+// two std::map trees. Built once per frame or keyframe, next to the FeatureVector.
+class FlatFeatureVector
+{
+public:
+    void Build(const DBoW2::FeatureVector &featVec);
+    void Clear();
+
+    size_t Nodes() const { return mvNodeIds.size(); }
+    bool Empty() const { return mvNodeIds.empty(); }
+
+    DBoW2::NodeId NodeId(const size_t n) const { return mvNodeIds[n]; }
+    // Keypoint indices of node n: [Begin(n),End(n))
+    const unsigned int* Begin(const size_t n) const { return mvIndices.data()+mvOffsets[n]; }
+    const unsigned int* End(const size_t n) const { return mvIndices.data()+mvOffsets[n+1]; }
+    size_t Size(const size_t n) const { return mvOffsets[n+1]-mvOffsets[n]; }
+
+    // First node at or after n whose id is not less than nodeId (Nodes() if none). Gallops from n,
+    // as consecutive calls of a merge move forward by a few nodes.
+    size_t LowerBound(const size_t n, const DBoW2::NodeId nodeId) const;
+
+    size_t MemoryBytes() const;
+
+protected:
+    std::vector<DBoW2::NodeId> mvNodeIds;
+    std::vector<unsigned int> mvOffsets;
+    std::vector<unsigned int> mvIndices;
+};
+
+} //namespace ORB_SLAM
+
+#endif // FLATFEATUREVECTOR_H
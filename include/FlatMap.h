@@ -0,0 +1,109 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FLATMAP_H
+#define FLATMAP_H
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+
+namespace ORB_SLAM3
+{
+
+// Associative container stored as a vector of pairs sorted by key, for the small pointer-keyed maps of
+// map points and keyframes (observations, covisibility weights). Lookups are binary searches over contiguous
+// memory and a copy is a single allocation. Same interface as the std::map subset used in the code, but
+// insertions and erasures invalidate iterators.
+template<class K, class V>
+class FlatMap
+{
+public:
+    typedef K key_type;
+    typedef V mapped_type;
+    typedef std::pair<K,V> value_type;
+    typedef typename std::vector<value_type>::iterator iterator;
+    typedef typename std::vector<value_type>::const_iterator const_iterator;
+
+    iterator begin() { return mvData.begin(); }
+    iterator end() { return mvData.end(); }
+    const_iterator begin() const { return mvData.begin(); }
+    const_iterator end() const { return mvData.end(); }
+
+    size_t size() const { return mvData.size(); }
+    bool empty() const { return mvData.empty(); }
+    void clear() { mvData.clear(); }
+    void reserve(size_t n) { mvData.reserve(n); }
+
+    iterator find(const K &key)
+    {
+        iterator it = LowerBound(key);
+        return (it!=mvData.end() && it->first==key) ? it : mvData.end();
+    }
+
+    const_iterator find(const K &key) const
+    {
+        const_iterator it = std::lower_bound(mvData.begin(),mvData.end(),key,KeyLess());
+        return (it!=mvData.end() && it->first==key) ? it : mvData.end();
+    }
+
+    size_t count(const K &key) const { return find(key)!=end(); }
+
+    V& operator[](const K &key)
+    {
+        iterator it = LowerBound(key);
+        if(it==mvData.end() || it->first!=key)
+            it = mvData.insert(it,value_type(key,V()));
+        return it->second;
+    }
+
+    std::pair<iterator,bool> insert(const value_type &value)
+    {
+        iterator it = LowerBound(value.first);
+        if(it!=mvData.end() && it->first==value.first)
+            return std::make_pair(it,false);
+        return std::make_pair(mvData.insert(it,value),true);
+    }
+
+    size_t erase(const K &key)
+    {
+        iterator it = find(key);
+        if(it==mvData.end())
+            return 0;
+        mvData.erase(it);
+        return 1;
+    }
+
+    iterator erase(iterator it) { return mvData.erase(it); }
+
+private:
+    struct KeyLess
+    {
+        bool operator()(const value_type &a, const K &b) const { return std::less<K>()(a.first,b); }
+    };
+
+    iterator LowerBound(const K &key) { return std::lower_bound(mvData.begin(),mvData.end(),key,KeyLess()); }
+
+    std::vector<value_type> mvData;
+};
+
+} //namespace ORB_SLAM
+
+#endif // FLATMAP_H
@@ -28,8 +28,14 @@
 #include "ImuTypes.h"
 #include "ORBVocabulary.h"
 #include "Config.h"
+#include "SharedVector.h"
+#include "FlatFeatureVector.h"
+#include "FlatBowVector.h"
+#include "SensorConfig.h"
 
 #include <mutex>
+#include <memory>
+#include <chrono>
 #include <opencv2/opencv.hpp>
 
 namespace ORB_SLAM3
@@ -41,31 +47,142 @@ class MapPoint;
 class KeyFrame;
 class ConstraintPoseImu;
 class GeometricCamera;
-class ORBextractor;
+class FeatureExtractor;
+class ThreadPool;
+class SystemContext;
+
+// Structure-of-arrays copy of the keypoints of a frame for the hot loops (grid search,
+// projection matching, pose optimization), which only need a few fields of cv::KeyPoint.
+// Entry i is the keypoint used for matching feature i: mvKeysUn[i] with one camera,
+// mvKeys[i] or mvKeysRight[i-Nleft] with the two cameras of a stereo fisheye rig.
+struct KeyPointsSoA
+{
+    typedef std::vector<float, Eigen::aligned_allocator<float> > FloatArray;
+    typedef std::vector<int, Eigen::aligned_allocator<int> > IntArray;
+
+    void Assign(const std::vector<cv::KeyPoint> &vKeys, const std::vector<cv::KeyPoint> &vKeysRight = std::vector<cv::KeyPoint>());
+
+    size_t size() const { return mvX.size(); }
+
+    FloatArray mvX;
+    FloatArray mvY;
+    FloatArray mvAngle;
+    IntArray mvOctave;
+};
+
+// Keypoint indices bucketed by grid cell in CSR form: one contiguous index array plus the
+// offset of the first index of every cell. Cells are stored column by column
+// (cell = col*nRows + row), so the cells of one column between two rows are a single range.
+// The arrays are shared between copies of the grid.
+class FeatureGrid
+{
+public:
+    FeatureGrid() : mnCols(0), mnRows(0) {}
+
+    // Resolution that keeps the keypoints per cell of the default grid (FRAME_GRID_COLS x
+    // FRAME_GRID_ROWS for 1000 features), so that the cost of a query does not grow with the image.
+    static void SizeFor(const int nWidth, const int nHeight, const int nFeatures, int &nCols, int &nRows);
+
+    // pCells[i] is the cell of keypoint i, or -1 to leave it out of the grid.
+    void Build(const int nCols, const int nRows, const int* pCells, const size_t n);
+    void Clear();
+
+    bool empty() const { return mvCellStart.empty(); }
+
+    // Indices of the cells (ix, iyMin) .. (ix, iyMax), all inclusive.
+    inline void ColumnRange(const int ix, const int iyMin, const int iyMax, const unsigned int* &begin, const unsigned int* &end) const
+    {
+        const unsigned int* pIndices = mvIndices.data();
+        begin = pIndices + mvCellStart[ix*mnRows + iyMin];
+        end = pIndices + mvCellStart[ix*mnRows + iyMax + 1];
+    }
+
+    int mnCols, mnRows;
+    SharedVector<unsigned int> mvCellStart;
+    SharedVector<unsigned int> mvIndices;
+};
+
+// Features of one of the additional cameras of a CameraRig in a frame, and their matches with the
+// map. The camera sees the world from Tcb*Tcw, with Tcw the pose of the frame (main camera). Kept
+// apart from the features of the main camera: they constrain the pose (tracking) and, through the
+// keyframes (KeyFrame::GetRigObservations), the bundle adjustments, but no point is created from them.
+struct RigView
+{
+    RigView() : nCamera(-1), pCamera(NULL), mnGridCols(FRAME_GRID_COLS), mnGridRows(FRAME_GRID_ROWS),
+                mfGridElementWidthInv(0), mfGridElementHeightInv(0), mnMinX(0), mnMaxX(0), mnMinY(0), mnMaxY(0) {}
+
+    // Keypoints undistorted with distCoef (pinhole cameras, empty for none), image bounds and grid
+    void Build(const std::vector<cv::KeyPoint> &vKeys, const cv::Mat &descriptors, const cv::Mat &distCoef, const cv::Size &imSize);
+
+    int size() const { return mvKeysUn.size(); }
+
+    // Same as Frame::GetFeaturesInArea
+    void GetFeaturesInArea(const float x, const float y, const float r, std::vector<size_t> &vIndices, const int minLevel, const int maxLevel) const;
+
+    // Camera in the rig and its pose relative to the main camera
+    int nCamera;
+    GeometricCamera* pCamera;
+    cv::Matx33f Rcb;
+    cv::Matx31f tcb;
+
+    SharedVector<cv::KeyPoint> mvKeysUn;
+    cv::Mat mDescriptors;
+
+    int mnGridCols, mnGridRows;
+    float mfGridElementWidthInv, mfGridElementHeightInv;
+    float mnMinX, mnMaxX, mnMinY, mnMaxY;
+    FeatureGrid mGrid;
+
+    // Map points matched to the keypoints (NULL if none), outliers of the pose optimization
+    std::vector<MapPoint*> mvpMapPoints;
+    std::vector<bool> mvbOutlier;
+};
 
 class Frame
 {
 public:
     Frame();
 
-    // Copy constructor.
+    // Copy constructor. Keypoints, descriptors and grid are shared with the copied frame.
     Frame(const Frame &frame);
+    Frame(Frame &&frame) = default;
+    Frame& operator=(const Frame &frame) = default;
+    Frame& operator=(Frame &&frame) = default;
 
     // Constructor for stereo cameras.
-    Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeStamp, ORBextractor* extractorLeft, ORBextractor* extractorRight, ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth, GeometricCamera* pCamera,Frame* pPrevF = static_cast<Frame*>(NULL), const IMU::Calib &ImuCalib = IMU::Calib());
+    Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeStamp, FeatureExtractor* extractorLeft, FeatureExtractor* extractorRight, ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth, GeometricCamera* pCamera, SystemContext* pContext, Frame* pPrevF = static_cast<Frame*>(NULL), const IMU::Calib &ImuCalib = IMU::Calib());
+
+    // Constructor for RGB-D cameras. imDepth is CV_16U or CV_32F, depthFactor converts its values to meters.
+    Frame(const cv::Mat &imGray, const cv::Mat &imDepth, const float depthFactor, const double &timeStamp, FeatureExtractor* extractor,ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth, GeometricCamera* pCamera, SystemContext* pContext, Frame* pPrevF = static_cast<Frame*>(NULL), const IMU::Calib &ImuCalib = IMU::Calib());
 
-    // Constructor for RGB-D cameras.
-    Frame(const cv::Mat &imGray, const cv::Mat &imDepth, const double &timeStamp, ORBextractor* extractor,ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth, GeometricCamera* pCamera,Frame* pPrevF = static_cast<Frame*>(NULL), const IMU::Calib &ImuCalib = IMU::Calib());
+    // Constructor for stereo cameras that compute the disparity or depth on the device. Same as the RGB-D
+    // one, with imDepth a disparity map in pixels (once scaled by depthFactor) if bDisparity. The right
+    // image is never read: no right keypoints are extracted nor matched.
+    Frame(const cv::Mat &imGray, const cv::Mat &imDepth, const float depthFactor, const bool bDisparity, const double &timeStamp, FeatureExtractor* extractor,ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth, GeometricCamera* pCamera, SystemContext* pContext, Frame* pPrevF = static_cast<Frame*>(NULL), const IMU::Calib &ImuCalib = IMU::Calib());
 
     // Constructor for Monocular cameras.
-    Frame(const cv::Mat &imGray, const double &timeStamp, ORBextractor* extractor,ORBVocabulary* voc, GeometricCamera* pCamera, cv::Mat &distCoef, const float &bf, const float &thDepth, Frame* pPrevF = static_cast<Frame*>(NULL), const IMU::Calib &ImuCalib = IMU::Calib());
+    Frame(const cv::Mat &imGray, const double &timeStamp, FeatureExtractor* extractor,ORBVocabulary* voc, GeometricCamera* pCamera, cv::Mat &distCoef, const float &bf, const float &thDepth, SystemContext* pContext, Frame* pPrevF = static_cast<Frame*>(NULL), const IMU::Calib &ImuCalib = IMU::Calib());
+
+    // Constructor for frames tracked by optical flow from lastFrame (single camera): the features
+    // vIndices of lastFrame moved to vPoints, keeping their levels, descriptors and map points.
+    // No extraction and no stereo information.
+    Frame(const Frame &lastFrame, const double &timeStamp, const std::vector<int> &vIndices, const std::vector<cv::Point2f> &vPoints, Frame* pPrevF = static_cast<Frame*>(NULL));
 
     // Extract ORB on the image. 0 for left image and 1 for right image.
     void ExtractORB(int flag, const cv::Mat &im, const int x0, const int x1);
 
-    // Compute Bag of Words representation.
+    // Extract ORB on both stereo images in parallel (on the extractor thread pool if available).
+    void ExtractORBStereo(const cv::Mat &imLeft, const cv::Mat &imRight, const int x0Left, const int x1Left, const int x0Right, const int x1Right);
+
+    // Compute Bag of Words representation. Computed once: later calls (and the copies of the
+    // frame) reuse it, or wait for the one started by ComputeBoWAsync.
     void ComputeBoW();
 
+    // Starts computing the Bag of Words in the pool, for frames known to need it soon
+    // (relocalization, tracking against the reference keyframe). ComputeBoW collects it.
+    void ComputeBoWAsync(ThreadPool* pThreadPool);
+    bool isBoWPending() const;
+
     // Set the camera pose. (Imu pose is not modified!)
     void SetPose(cv::Mat Tcw);
     void GetPose(cv::Mat &Tcw);
@@ -73,6 +190,10 @@ public:
     // Set IMU velocity
     void SetVelocity(const cv::Mat &Vwb);
 
+    // Links a frame built without its predecessor (pipelined tracking) to the previous frame,
+    // as if pPrevF had been given to the constructor.
+    void SetPrevFrame(Frame* pPrevF);
+
     // Set IMU pose and velocity (implicitly changes camera pose)
     void SetImuPoseVelocity(const cv::Mat &Rwb, const cv::Mat &twb, const cv::Mat &Vwb);
 
@@ -100,6 +221,11 @@ public:
     // and fill variables of the MapPoint to be used by the tracking
     bool isInFrustum(MapPoint* pMP, float viewingCosLimit);
 
+    // Same test for a whole set of points. Positions and normals are gathered into
+    // contiguous arrays so the transform and culling run as one vectorizable pass.
+    // vbInFrustum[i] holds the result of isInFrustum(vpMPs[i]); returns the number of hits.
+    int isInFrustum(const std::vector<MapPoint*> &vpMPs, float viewingCosLimit, std::vector<bool> &vbInFrustum);
+
     bool ProjectPointDistort(MapPoint* pMP, cv::Point2f &kp, float &u, float &v);
 
     cv::Mat inRefCoordinates(cv::Mat pCw);
@@ -108,13 +234,17 @@ public:
     bool PosInGrid(const cv::KeyPoint &kp, int &posX, int &posY);
 
     vector<size_t> GetFeaturesInArea(const float &x, const float  &y, const float  &r, const int minLevel=-1, const int maxLevel=-1, const bool bRight = false) const;
+    // Same as above but fills a caller-owned buffer, so it can be reused across queries.
+    void GetFeaturesInArea(const float &x, const float  &y, const float  &r, vector<size_t> &vIndices, const int minLevel=-1, const int maxLevel=-1, const bool bRight = false) const;
 
     // Search a match for each keypoint in the left image to a keypoint in the right image.
     // If there is a match, depth is computed and the right coordinate associated to the left keypoint is stored.
     void ComputeStereoMatches();
 
     // Associate a "right" coordinate to a keypoint if there is valid depth in the depthmap.
-    void ComputeStereoFromRGBD(const cv::Mat &imDepth);
+    // Only the depth at the keypoints is read and scaled by depthFactor (CV_16U or CV_32F map).
+    // With bDisparity the map holds disparities, depth = bf/disparity.
+    void ComputeStereoFromRGBD(const cv::Mat &imDepth, const float depthFactor, const bool bDisparity = false);
 
     // Backprojects a keypoint (if stereo/depth info available) into 3D world coordinates.
     cv::Mat UnprojectStereo(const int &i);
@@ -131,19 +261,19 @@ public:
     ORBVocabulary* mpORBvocabulary;
 
     // Feature extractor. The right is used only in the stereo case.
-    ORBextractor* mpORBextractorLeft, *mpORBextractorRight;
+    FeatureExtractor* mpORBextractorLeft, *mpORBextractorRight;
 
     // Frame timestamp.
     double mTimeStamp;
 
     // Calibration matrix and OpenCV distortion parameters.
     cv::Mat mK;
-    static float fx;
-    static float fy;
-    static float cx;
-    static float cy;
-    static float invfx;
-    static float invfy;
+    float fx;
+    float fy;
+    float cx;
+    float cy;
+    float invfx;
+    float invfy;
     cv::Mat mDistCoef;
 
     // Stereo baseline multiplied by fx.
@@ -162,8 +292,12 @@ public:
     // Vector of keypoints (original for visualization) and undistorted (actually used by the system).
     // In the stereo case, mvKeysUn is redundant as images must be rectified.
     // In the RGB-D case, RGB images can be distorted.
-    std::vector<cv::KeyPoint> mvKeys, mvKeysRight;
-    std::vector<cv::KeyPoint> mvKeysUn;
+    // Shared between the copies of the frame, written only while the frame is built.
+    SharedVector<cv::KeyPoint> mvKeys, mvKeysRight;
+    SharedVector<cv::KeyPoint> mvKeysUn;
+
+    // Compact copy of the keypoints used for matching, built with the grid.
+    KeyPointsSoA mKeysSoA;
 
     // Corresponding stereo coordinate and depth for each keypoint.
     std::vector<MapPoint*> mvpMapPoints;
@@ -174,6 +308,10 @@ public:
     // Bag of Words Vector structures.
     DBoW2::BowVector mBowVec;
     DBoW2::FeatureVector mFeatVec;
+    // mFeatVec as flat arrays, for SearchByBoW
+    FlatFeatureVector mFlatFeatVec;
+    // mBowVec as flat arrays, for the KeyFrameDatabase scores
+    FlatBowVector mFlatBowVec;
 
     // ORB descriptor, each row associated to a keypoint.
     cv::Mat mDescriptors, mDescriptorsRight;
@@ -184,9 +322,12 @@ public:
     int mnCloseMPs;
 
     // Keypoints are assigned to cells in a grid to reduce matching complexity when projecting MapPoints.
-    static float mfGridElementWidthInv;
-    static float mfGridElementHeightInv;
-    std::vector<std::size_t> mGrid[FRAME_GRID_COLS][FRAME_GRID_ROWS];
+    // Its resolution comes from the camera (GeometricCamera::SetFeatureGrid).
+    int mnGridCols;
+    int mnGridRows;
+    float mfGridElementWidthInv;
+    float mfGridElementHeightInv;
+    FeatureGrid mGrid;
 
 
     // Camera pose.
@@ -212,9 +353,9 @@ public:
     Frame* mpPrevFrame;
     IMU::Preintegrated* mpImuPreintegratedFrame;
 
-    // Current and Next Frame id.
-    static long unsigned int nNextId;
+    // Frame id, from the counters of the System that built the frame
     long unsigned int mnId;
+    SystemContext* mpContext;
 
     // Reference Keyframe.
     KeyFrame* mpReferenceKF;
@@ -228,13 +369,11 @@ public:
     vector<float> mvLevelSigma2;
     vector<float> mvInvLevelSigma2;
 
-    // Undistorted Image Bounds (computed once).
-    static float mnMinX;
-    static float mnMaxX;
-    static float mnMinY;
-    static float mnMaxY;
-
-    static bool mbInitialComputations;
+    // Undistorted Image Bounds.
+    float mnMinX;
+    float mnMaxX;
+    float mnMinY;
+    float mnMaxY;
 
     map<long unsigned int, cv::Point2f> mmProjectPoints;
     map<long unsigned int, cv::Point2f> mmMatchedInImage;
@@ -243,10 +382,23 @@ public:
 
     int mnDataset;
 
-#ifdef REGISTER_TIMES
+    // Duration (ms) of the ORB extraction and stereo matching of this frame, reported by the Tracking
     double mTimeORB_Ext;
     double mTimeStereoMatch;
-#endif
+    // When the features were ready (steady clock), unset for frames not preprocessed apart
+    std::chrono::steady_clock::time_point mTimeExtracted;
+
+    // Keypoints detected only around the predicted map point projections (non-keyframe extraction)
+    bool mbFocusedExtraction;
+
+    // Keypoints detected without the first pyramid level (non-keyframe extraction at reduced resolution)
+    bool mbReducedResolution;
+
+    // Features tracked by optical flow from the last frame instead of extracted
+    bool mbFlowTracked;
+
+    // Additional cameras of a CameraRig (empty without rig), filled by CameraRig::CollectFeatures
+    std::vector<RigView> mvRigViews;
 
 private:
 
@@ -258,6 +410,9 @@ private:
     // Computes image bounds for the undistorted image (called in the constructor).
     void ComputeImageBounds(const cv::Mat &imLeft);
 
+    // Image bounds, grid cell size and intrinsics of mK (called in the constructor).
+    void ComputeCalibration(const cv::Mat &im);
+
     // Assign keypoints to the grid for speed up feature matching (called in the constructor).
     void AssignFeaturesToGrid();
 
@@ -274,31 +429,34 @@ private:
 
     std::mutex *mpMutexImu;
 
+    // Bag of Words started by ComputeBoWAsync and not collected yet (shared by the copies)
+    struct PendingBoW;
+    std::shared_ptr<PendingBoW> mpPendingBoW;
+
 public:
     GeometricCamera* mpCamera, *mpCamera2;
 
     //Number of KeyPoints extracted in the left and right images
     int Nleft, Nright;
+    // Monocular, rectified (stereo, RGB-D) or split in two cameras, see SensorConfig.h
+    CameraSetup mCameraSetup;
     //Number of Non Lapping Keypoints
     int monoLeft, monoRight;
 
     //For stereo matching
     std::vector<int> mvLeftToRightMatch, mvRightToLeftMatch;
 
-    //For stereo fisheye matching
-    static cv::BFMatcher BFmatcher;
-
     //Triangulated stereo observations using as reference the left camera. These are
     //computed during ComputeStereoFishEyeMatches
     std::vector<cv::Mat> mvStereo3Dpoints;
 
     //Grid for the right image
-    std::vector<std::size_t> mGridRight[FRAME_GRID_COLS][FRAME_GRID_ROWS];
+    FeatureGrid mGridRight;
 
     cv::Mat mTlr, mRlr, mtlr, mTrl;
     cv::Matx34f mTrlx, mTlrx;
 
-    Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeStamp, ORBextractor* extractorLeft, ORBextractor* extractorRight, ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth, GeometricCamera* pCamera, GeometricCamera* pCamera2, cv::Mat& Tlr,Frame* pPrevF = static_cast<Frame*>(NULL), const IMU::Calib &ImuCalib = IMU::Calib());
+    Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeStamp, FeatureExtractor* extractorLeft, FeatureExtractor* extractorRight, ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth, GeometricCamera* pCamera, GeometricCamera* pCamera2, cv::Mat& Tlr, SystemContext* pContext, Frame* pPrevF = static_cast<Frame*>(NULL), const IMU::Calib &ImuCalib = IMU::Calib());
 
     //Stereo fisheye
     void ComputeStereoFishEyeMatches();
@@ -307,8 +465,6 @@ public:
 
     cv::Mat UnprojectStereoFishEye(const int &i);
 
-    cv::Mat imgLeft, imgRight;
-
     void PrintPointDistribution(){
         int left = 0, right = 0;
         int Nlim = (Nleft != -1) ? Nleft : N;
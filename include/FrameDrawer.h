@@ -53,34 +53,50 @@ public:
 
 protected:
 
+    // Info of the frame to be drawn
+    struct FrameData
+    {
+        FrameData();
+
+        cv::Mat mIm, mImRight;
+        int N;
+        vector<cv::KeyPoint> mvCurrentKeys,mvCurrentKeysRight;
+        vector<bool> mvbMap, mvbVO;
+        bool mbOnlyTracking;
+        vector<cv::KeyPoint> mvIniKeys;
+        vector<int> mvIniMatches;
+        int mState;
+
+        vector<pair<cv::Point2f, cv::Point2f> > mvTracks;
+
+        Frame mCurrentFrame;
+        vector<MapPoint*> mvpLocalMap;
+        vector<cv::KeyPoint> mvMatchedKeys;
+        vector<MapPoint*> mvpMatchedMPs;
+        vector<cv::KeyPoint> mvOutlierKeys;
+        vector<MapPoint*> mvpOutlierMPs;
+
+        map<long unsigned int, cv::Point2f> mmProjectPoints;
+        map<long unsigned int, cv::Point2f> mmMatchedInImage;
+    };
+
     void DrawTextInfo(cv::Mat &im, int nState, cv::Mat &imText);
 
-    // Info of the frame to be drawn
-    cv::Mat mIm, mImRight;
-    int N;
-    vector<cv::KeyPoint> mvCurrentKeys,mvCurrentKeysRight;
-    vector<bool> mvbMap, mvbVO;
-    bool mbOnlyTracking;
+    // Triple buffer: Tracking fills mpWrite and swaps it with mpReady, the viewer swaps mpReady
+    // with mpRead and draws from it. Tracking only fills a new frame once the viewer has taken
+    // the previous one (or the tracking state changes), so the copy runs at the viewer rate.
+    FrameData mvBuffers[3];
+    FrameData* mpWrite;
+    FrameData* mpReady;
+    FrameData* mpRead;
+    bool mbNewData;
+    int mReadyState;
+
     int mnTracked, mnTrackedVO;
-    vector<cv::KeyPoint> mvIniKeys;
-    vector<int> mvIniMatches;
-    int mState;
 
     Atlas* mpAtlas;
 
     std::mutex mMutex;
-    vector<pair<cv::Point2f, cv::Point2f> > mvTracks;
-
-    Frame mCurrentFrame;
-    vector<MapPoint*> mvpLocalMap;
-    vector<cv::KeyPoint> mvMatchedKeys;
-    vector<MapPoint*> mvpMatchedMPs;
-    vector<cv::KeyPoint> mvOutlierKeys;
-    vector<MapPoint*> mvpOutlierMPs;
-
-    map<long unsigned int, cv::Point2f> mmProjectPoints;
-    map<long unsigned int, cv::Point2f> mmMatchedInImage;
-
 };
 
 } //namespace ORB_SLAM
@@ -0,0 +1,123 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FROZENMAP_H
+#define FROZENMAP_H
+
+#include <opencv2/core/core.hpp>
+
+#include <unordered_map>
+#include <vector>
+
+namespace ORB_SLAM3
+{
+
+class Map;
+class MapPoint;
+class KeyFrame;
+class Frame;
+
+// Read-only snapshot of a map for the localization mode. With Local Mapping stopped the map does
+// not change, so Tracking reads the points and the covisibility graph from contiguous arrays
+// (no mutex per accessor, no std::set or std::map traversal, no bad flag checks): positions,
+// normals and scale distances as structure of arrays, one descriptor matrix, and the per point
+// observations, per keyframe matches and graph links as offset arrays (entries of element i in
+// [mvXStart[i], mvXStart[i+1])). Bad keyframes and points are left out when it is built.
+// The snapshot is built under the map update mutex and rebuilt by Tracking when IsStale().
+class FrozenMap
+{
+public:
+    FrozenMap(Map* pMap);
+
+    // The map changed (loop correction, global BA, new keyframes) since the snapshot was built
+    bool IsStale(Map* pMap);
+
+    Map* GetMap() const { return mpMap; }
+
+    // Index in the snapshot, -1 if it is not in it (bad or created after the snapshot)
+    int PointIndex(MapPoint* pMP) const;
+    int KeyFrameIndex(KeyFrame* pKF) const;
+
+    // Per thread scratch state of the local map queries. Elements are marked with a stamp instead
+    // of being cleared for every frame.
+    struct LocalWindow
+    {
+        LocalWindow(): mnStamp(0), mnKFMax(-1) {}
+
+        unsigned long mnStamp;
+        std::vector<unsigned long> mvKFStamp;
+        std::vector<unsigned long> mvPointStamp;
+        std::vector<int> mvVotes;
+        std::vector<int> mvVoted;
+
+        // Local keyframes and points (snapshot indices) and keyframe sharing most points
+        std::vector<int> mvKeyFrames;
+        std::vector<int> mvPoints;
+        int mnKFMax;
+
+        // Local points in the frustum of the frame, as MapPoint::mTrackProj* for isInFrustum
+        std::vector<int> mvProjPoint;
+        std::vector<float> mvProjU, mvProjV, mvProjUR, mvProjDepth, mvProjViewCos;
+        std::vector<int> mvProjLevel;
+
+        // Keypoints of the frame already matched to a point of the snapshot
+        std::vector<unsigned char> mvbKeyMatched;
+    };
+
+    // Local keyframes as Tracking::UpdateLocalKeyFrames (keyframes observing the points matched in
+    // F, some of their neighbours and, if bTemporal, the last temporal keyframes from pLastKF)
+    // followed by their points as Tracking::UpdateLocalPoints.
+    void UpdateLocalWindow(const Frame &F, KeyFrame* pLastKF, const bool bTemporal, LocalWindow &w) const;
+
+    // Frustum test (Frame::isInFrustum) of the local points not matched in F. Fills w.mvProj*
+    // and w.mvbKeyMatched, returns the number of points in the frustum.
+    int ProjectLocalPoints(const Frame &F, const float viewingCosLimit, LocalWindow &w) const;
+
+    Map* mpMap;
+    int mnChangeIndex;
+    long unsigned int mnKFsInMap;
+    long unsigned int mnMPsInMap;
+
+    // Points
+    std::vector<MapPoint*> mvpMapPoints;
+    std::vector<float> mvX, mvY, mvZ;
+    std::vector<float> mvNx, mvNy, mvNz;
+    // Scale invariance region (0.8*min, 1.2*max) and max distance used to predict the scale
+    std::vector<float> mvMinDist, mvMaxDist, mvScaleDist;
+    cv::Mat mDescriptors;
+    // Keyframes observing each point
+    std::vector<int> mvObsStart, mvObsKF;
+
+    // Keyframes
+    std::vector<KeyFrame*> mvpKeyFrames;
+    // Point index (-1 if none) and MapPoint (NULL if none) of every keypoint
+    std::vector<int> mvMatchStart, mvMatchPoint;
+    std::vector<MapPoint*> mvpMatchMapPoints;
+    // Best 10 covisible keyframes, spanning tree children, parent and previous keyframe (-1 if none)
+    std::vector<int> mvCovStart, mvCovKF;
+    std::vector<int> mvChildStart, mvChildKF;
+    std::vector<int> mvParent, mvPrevKF;
+
+protected:
+    std::unordered_map<MapPoint*,int> mmPointIndex;
+    std::unordered_map<KeyFrame*,int> mmKeyFrameIndex;
+};
+
+} //namespace ORB_SLAM3
+
+#endif // FROZENMAP_H
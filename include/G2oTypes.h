@@ -36,6 +36,7 @@
 #include <KeyFrame.h>
 
 #include"Converter.h"
+#include "CameraModels/CameraProjection.h"
 #include <math.h>
 
 namespace ORB_SLAM3
@@ -84,6 +85,22 @@ public:
     void UpdateW(const double *pu); // update in the world reference
     Eigen::Vector2d Project(const Eigen::Vector3d &Xw, int cam_idx=0) const; // Mono
     Eigen::Vector3d ProjectStereo(const Eigen::Vector3d &Xw, int cam_idx=0) const; // Stereo
+    // Same with the camera model known at compile time (see CameraProject)
+    template<class CameraModel>
+    Eigen::Vector2d ProjectT(const Eigen::Vector3d &Xw, int cam_idx=0) const
+    {
+        const Eigen::Vector3d Xc = Rcw[cam_idx]*Xw+tcw[cam_idx];
+        return CameraProject<CameraModel>(pCamera[cam_idx],Xc);
+    }
+    template<class CameraModel>
+    Eigen::Vector3d ProjectStereoT(const Eigen::Vector3d &Xw, int cam_idx=0) const
+    {
+        const Eigen::Vector3d Pc = Rcw[cam_idx]*Xw+tcw[cam_idx];
+        Eigen::Vector3d pc;
+        pc.head(2) = CameraProject<CameraModel>(pCamera[cam_idx],Pc);
+        pc(2) = pc(0) - bf/Pc(2);
+        return pc;
+    }
     bool isDepthPositive(const Eigen::Vector3d &Xw, int cam_idx=0) const;
 
 public:
@@ -127,7 +144,7 @@ public:
 class VertexPose : public g2o::BaseVertex<6,ImuCamPose>
 {
 public:
-    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    G2O_MAKE_POOLED_OPERATOR_NEW
     VertexPose(){}
     VertexPose(KeyFrame* pKF){
         setEstimate(ImuCamPose(pKF));
@@ -153,7 +170,7 @@ class VertexPose4DoF : public g2o::BaseVertex<4,ImuCamPose>
 {
     // Translation and yaw are the only optimizable variables
 public:
-    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    G2O_MAKE_POOLED_OPERATOR_NEW
     VertexPose4DoF(){}
     VertexPose4DoF(KeyFrame* pKF){
         setEstimate(ImuCamPose(pKF));
@@ -188,7 +205,7 @@ public:
 class VertexVelocity : public g2o::BaseVertex<3,Eigen::Vector3d>
 {
 public:
-    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    G2O_MAKE_POOLED_OPERATOR_NEW
     VertexVelocity(){}
     VertexVelocity(KeyFrame* pKF);
     VertexVelocity(Frame* pF);
@@ -209,7 +226,7 @@ public:
 class VertexGyroBias : public g2o::BaseVertex<3,Eigen::Vector3d>
 {
 public:
-    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    G2O_MAKE_POOLED_OPERATOR_NEW
     VertexGyroBias(){}
     VertexGyroBias(KeyFrame* pKF);
     VertexGyroBias(Frame* pF);
@@ -231,7 +248,7 @@ public:
 class VertexAccBias : public g2o::BaseVertex<3,Eigen::Vector3d>
 {
 public:
-    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    G2O_MAKE_POOLED_OPERATOR_NEW
     VertexAccBias(){}
     VertexAccBias(KeyFrame* pKF);
     VertexAccBias(Frame* pF);
@@ -271,7 +288,7 @@ public:
 class VertexGDir : public g2o::BaseVertex<2,GDirection>
 {
 public:
-    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    G2O_MAKE_POOLED_OPERATOR_NEW
     VertexGDir(){}
     VertexGDir(Eigen::Matrix3d pRwg){
         setEstimate(GDirection(pRwg));
@@ -293,7 +310,7 @@ public:
 class VertexScale : public g2o::BaseVertex<1,double>
 {
 public:
-    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    G2O_MAKE_POOLED_OPERATOR_NEW
     VertexScale(){
         setEstimate(1.0);
     }
@@ -318,7 +335,7 @@ public:
 class VertexInvDepth : public g2o::BaseVertex<1,InvDepthPoint>
 {
 public:
-    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    G2O_MAKE_POOLED_OPERATOR_NEW
     VertexInvDepth(){}
     VertexInvDepth(double invDepth, double u, double v, KeyFrame* pHostKF){
         setEstimate(InvDepthPoint(invDepth, u, v, pHostKF));
@@ -339,7 +356,7 @@ public:
 class EdgeMono : public g2o::BaseBinaryEdge<2,Eigen::Vector2d,g2o::VertexSBAPointXYZ,VertexPose>
 {
 public:
-    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    G2O_MAKE_POOLED_OPERATOR_NEW
 
     EdgeMono(int cam_idx_=0): cam_idx(cam_idx_){
     }
@@ -356,6 +373,9 @@ public:
 
 
     virtual void linearizeOplus();
+    // Jacobians with the projection of CameraModel (GeometricCamera dispatches on the type tag)
+    template<class CameraModel>
+    void linearizeOplusT();
 
     bool isDepthPositive()
     {
@@ -384,10 +404,31 @@ public:
     const int cam_idx;
 };
 
+// EdgeMono with the camera model fixed at compile time, so that projection and Jacobian inline
+template<class CameraModel>
+class EdgeMonoT : public EdgeMono
+{
+public:
+    G2O_MAKE_POOLED_OPERATOR_NEW
+
+    EdgeMonoT(int cam_idx_=0): EdgeMono(cam_idx_){}
+
+    void computeError(){
+        const g2o::VertexSBAPointXYZ* VPoint = static_cast<const g2o::VertexSBAPointXYZ*>(_vertices[0]);
+        const VertexPose* VPose = static_cast<const VertexPose*>(_vertices[1]);
+        const Eigen::Vector2d obs(_measurement);
+        _error = obs - VPose->estimate().template ProjectT<CameraModel>(VPoint->estimate(),cam_idx);
+    }
+
+    virtual void linearizeOplus(){
+        this->template linearizeOplusT<CameraModel>();
+    }
+};
+
 class EdgeMonoOnlyPose : public g2o::BaseUnaryEdge<2,Eigen::Vector2d,VertexPose>
 {
 public:
-    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    G2O_MAKE_POOLED_OPERATOR_NEW
 
     EdgeMonoOnlyPose(const cv::Mat &Xw_, int cam_idx_=0):Xw(Converter::toVector3d(Xw_)),
         cam_idx(cam_idx_){}
@@ -402,6 +443,9 @@ public:
     }
 
     virtual void linearizeOplus();
+    // Jacobians with the projection of CameraModel (GeometricCamera dispatches on the type tag)
+    template<class CameraModel>
+    void linearizeOplusT();
 
     bool isDepthPositive()
     {
@@ -419,10 +463,29 @@ public:
     const int cam_idx;
 };
 
+template<class CameraModel>
+class EdgeMonoOnlyPoseT : public EdgeMonoOnlyPose
+{
+public:
+    G2O_MAKE_POOLED_OPERATOR_NEW
+
+    EdgeMonoOnlyPoseT(const cv::Mat &Xw_, int cam_idx_=0): EdgeMonoOnlyPose(Xw_,cam_idx_){}
+
+    void computeError(){
+        const VertexPose* VPose = static_cast<const VertexPose*>(_vertices[0]);
+        const Eigen::Vector2d obs(_measurement);
+        _error = obs - VPose->estimate().template ProjectT<CameraModel>(Xw,cam_idx);
+    }
+
+    virtual void linearizeOplus(){
+        this->template linearizeOplusT<CameraModel>();
+    }
+};
+
 class EdgeStereo : public g2o::BaseBinaryEdge<3,Eigen::Vector3d,g2o::VertexSBAPointXYZ,VertexPose>
 {
 public:
-    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    G2O_MAKE_POOLED_OPERATOR_NEW
 
     EdgeStereo(int cam_idx_=0): cam_idx(cam_idx_){}
 
@@ -438,6 +501,9 @@ public:
 
 
     virtual void linearizeOplus();
+    // Jacobians with the projection of CameraModel (GeometricCamera dispatches on the type tag)
+    template<class CameraModel>
+    void linearizeOplusT();
 
     Eigen::Matrix<double,3,9> GetJacobian(){
         linearizeOplus();
@@ -459,11 +525,31 @@ public:
     const int cam_idx;
 };
 
+template<class CameraModel>
+class EdgeStereoT : public EdgeStereo
+{
+public:
+    G2O_MAKE_POOLED_OPERATOR_NEW
+
+    EdgeStereoT(int cam_idx_=0): EdgeStereo(cam_idx_){}
+
+    void computeError(){
+        const g2o::VertexSBAPointXYZ* VPoint = static_cast<const g2o::VertexSBAPointXYZ*>(_vertices[0]);
+        const VertexPose* VPose = static_cast<const VertexPose*>(_vertices[1]);
+        const Eigen::Vector3d obs(_measurement);
+        _error = obs - VPose->estimate().template ProjectStereoT<CameraModel>(VPoint->estimate(),cam_idx);
+    }
+
+    virtual void linearizeOplus(){
+        this->template linearizeOplusT<CameraModel>();
+    }
+};
+
 
 class EdgeStereoOnlyPose : public g2o::BaseUnaryEdge<3,Eigen::Vector3d,VertexPose>
 {
 public:
-    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    G2O_MAKE_POOLED_OPERATOR_NEW
 
     EdgeStereoOnlyPose(const cv::Mat &Xw_, int cam_idx_=0):
         Xw(Converter::toVector3d(Xw_)), cam_idx(cam_idx_){}
@@ -478,6 +564,9 @@ public:
     }
 
     virtual void linearizeOplus();
+    // Jacobians with the projection of CameraModel (GeometricCamera dispatches on the type tag)
+    template<class CameraModel>
+    void linearizeOplusT();
 
     Eigen::Matrix<double,6,6> GetHessian(){
         linearizeOplus();
@@ -489,10 +578,35 @@ public:
     const int cam_idx;
 };
 
+template<class CameraModel>
+class EdgeStereoOnlyPoseT : public EdgeStereoOnlyPose
+{
+public:
+    G2O_MAKE_POOLED_OPERATOR_NEW
+
+    EdgeStereoOnlyPoseT(const cv::Mat &Xw_, int cam_idx_=0): EdgeStereoOnlyPose(Xw_,cam_idx_){}
+
+    void computeError(){
+        const VertexPose* VPose = static_cast<const VertexPose*>(_vertices[0]);
+        const Eigen::Vector3d obs(_measurement);
+        _error = obs - VPose->estimate().template ProjectStereoT<CameraModel>(Xw,cam_idx);
+    }
+
+    virtual void linearizeOplus(){
+        this->template linearizeOplusT<CameraModel>();
+    }
+};
+
+// Visual edges specialized on the model of pCamera, the camera the vertex uses for cam_idx
+EdgeMono* NewEdgeMono(GeometricCamera* pCamera, int cam_idx=0);
+EdgeMonoOnlyPose* NewEdgeMonoOnlyPose(GeometricCamera* pCamera, const cv::Mat &Xw, int cam_idx=0);
+EdgeStereo* NewEdgeStereo(GeometricCamera* pCamera, int cam_idx=0);
+EdgeStereoOnlyPose* NewEdgeStereoOnlyPose(GeometricCamera* pCamera, const cv::Mat &Xw, int cam_idx=0);
+
 class EdgeInertial : public g2o::BaseMultiEdge<9,Vector9d>
 {
 public:
-    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    G2O_MAKE_POOLED_OPERATOR_NEW
 
     EdgeInertial(IMU::Preintegrated* pInt);
 
@@ -538,6 +652,20 @@ public:
     IMU::Preintegrated* mpInt;
     const double dt;
     Eigen::Vector3d g;
+
+    // Preintegrated deltas and bias of the integration, copied when the edge is built
+    Eigen::Matrix3d dR0;
+    Eigen::Vector3d dV0, dP0;
+    Eigen::Vector3d bg0, ba0;
+
+private:
+    // Bias corrected deltas, only recomputed when the bias estimate changes
+    void UpdateDeltas(const Eigen::Vector3d &bg, const Eigen::Vector3d &ba);
+
+    bool mbDeltasReady;
+    Eigen::Vector3d mbg, mba;
+    Eigen::Matrix3d mdR;
+    Eigen::Vector3d mdV, mdP, mdbg;
 };
 
 
@@ -545,7 +673,7 @@ public:
 class EdgeInertialGS : public g2o::BaseMultiEdge<9,Vector9d>
 {
 public:
-    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    G2O_MAKE_POOLED_OPERATOR_NEW
 
     // EdgeInertialGS(IMU::Preintegrated* pInt);
     EdgeInertialGS(IMU::Preintegrated* pInt);
@@ -562,6 +690,11 @@ public:
     const double dt;
     Eigen::Vector3d g, gI;
 
+    // Preintegrated deltas and bias of the integration, copied when the edge is built
+    Eigen::Matrix3d dR0;
+    Eigen::Vector3d dV0, dP0;
+    Eigen::Vector3d bg0, ba0;
+
     Eigen::Matrix<double,27,27> GetHessian(){
         linearizeOplus();
         Eigen::Matrix<double,9,27> J;
@@ -625,6 +758,15 @@ public:
         Eigen::Matrix<double,9,2> J = _jacobianOplus[6];
         return J.transpose()*information()*J;
     }
+
+private:
+    // Bias corrected deltas, only recomputed when the bias estimate changes
+    void UpdateDeltas(const Eigen::Vector3d &bg, const Eigen::Vector3d &ba);
+
+    bool mbDeltasReady;
+    Eigen::Vector3d mbg, mba;
+    Eigen::Matrix3d mdR;
+    Eigen::Vector3d mdV, mdP, mdbg;
 };
 
 
@@ -632,7 +774,7 @@ public:
 class EdgeGyroRW : public g2o::BaseBinaryEdge<3,Eigen::Vector3d,VertexGyroBias,VertexGyroBias>
 {
 public:
-    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    G2O_MAKE_POOLED_OPERATOR_NEW
 
     EdgeGyroRW(){}
 
@@ -668,7 +810,7 @@ public:
 class EdgeAccRW : public g2o::BaseBinaryEdge<3,Eigen::Vector3d,VertexAccBias,VertexAccBias>
 {
 public:
-    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    G2O_MAKE_POOLED_OPERATOR_NEW
 
     EdgeAccRW(){}
 
@@ -748,7 +890,7 @@ public:
 class EdgePriorPoseImu : public g2o::BaseMultiEdge<15,Vector15d>
 {
 public:
-        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+        G2O_MAKE_POOLED_OPERATOR_NEW
         EdgePriorPoseImu(ConstraintPoseImu* c);
 
         virtual bool read(std::istream& is){return false;}
@@ -775,7 +917,7 @@ public:
             J.block<15,3>(0,6) = _jacobianOplus[3];
             return J.transpose()*information()*J;
         }
-        Eigen::Matrix3d Rwb;
+        Eigen::Matrix3d Rwb, Rbw;
         Eigen::Vector3d twb, vwb;
         Eigen::Vector3d bg, ba;
 };
@@ -784,7 +926,7 @@ public:
 class EdgePriorAcc : public g2o::BaseUnaryEdge<3,Eigen::Vector3d,VertexAccBias>
 {
 public:
-    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    G2O_MAKE_POOLED_OPERATOR_NEW
 
     EdgePriorAcc(const cv::Mat &bprior_):bprior(Converter::toVector3d(bprior_)){}
 
@@ -808,7 +950,7 @@ public:
 class EdgePriorGyro : public g2o::BaseUnaryEdge<3,Eigen::Vector3d,VertexGyroBias>
 {
 public:
-    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    G2O_MAKE_POOLED_OPERATOR_NEW
 
     EdgePriorGyro(const cv::Mat &bprior_):bprior(Converter::toVector3d(bprior_)){}
 
@@ -833,7 +975,7 @@ public:
 class Edge4DoF : public g2o::BaseBinaryEdge<6,Vector6d,VertexPose4DoF,VertexPose4DoF>
 {
 public:
-    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    G2O_MAKE_POOLED_OPERATOR_NEW
 
     Edge4DoF(const Eigen::Matrix4d &deltaT){
         dTij = deltaT;
@@ -851,7 +993,7 @@ public:
                  VPi->estimate().Rcw[0]*(-VPj->estimate().Rcw[0].transpose()*VPj->estimate().tcw[0])+VPi->estimate().tcw[0] - dtij;
     }
 
-    // virtual void linearizeOplus(); // numerical implementation
+    virtual void linearizeOplus();
 
     Eigen::Matrix4d dTij;
     Eigen::Matrix3d dRij;
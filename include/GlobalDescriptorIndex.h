@@ -0,0 +1,103 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GLOBALDESCRIPTORINDEX_H
+#define GLOBALDESCRIPTORINDEX_H
+
+#include <vector>
+#include <unordered_map>
+#include <random>
+
+#include "Thirdparty/DBoW2/DBoW2/BowVector.h"
+
+namespace ORB_SLAM3
+{
+
+class KeyFrame;
+
+// Approximate nearest neighbour index (HNSW graph) of compact global descriptors of keyframes,
+// used by the KeyFrameDatabase to shortlist place recognition candidates in large maps. The
+// descriptor of a bag of words is a signed hashing sketch of its weights in nDim floats, L2
+// normalized: the inner product of two descriptors estimates the one of their bags of words.
+// Not thread safe, the database serializes the calls.
+class GlobalDescriptorIndex
+{
+public:
+    GlobalDescriptorIndex(const int nDim, const int M=16, const int efConstruction=100);
+
+    static void ComputeDescriptor(const DBoW2::BowVector &vBowVec, const int nDim, std::vector<float> &vDesc);
+
+    void Add(KeyFrame* pKF, const std::vector<float> &vDesc);
+    // The node stays in the graph to route the searches until more than half of them are removed
+    void Remove(KeyFrame* pKF);
+
+    // Up to nK keyframes with the most similar descriptors, most similar first. ef (>= nK) is the
+    // number of candidates kept while walking the bottom layer
+    void Search(const std::vector<float> &vQuery, const int nK, const int ef, std::vector<KeyFrame*> &vpKFs) const;
+
+    // Keyframes in the index (not removed)
+    void GetKeyFrames(std::vector<KeyFrame*> &vpKFs) const;
+    size_t Size() const { return mmNodes.size(); }
+
+    size_t Memory() const;
+
+protected:
+
+    struct Node
+    {
+        KeyFrame* pKF;
+        bool bRemoved;
+        // Neighbours in each layer, from 0 (all the nodes) to the top layer of the node
+        std::vector<std::vector<int> > vvNeighbours;
+    };
+
+    const float* Data(const int n) const { return &mvData[size_t(n)*mnDim]; }
+    float Distance(const float* a, const float* b) const;
+
+    // Greedy search of layer level from the entry nodes, keeping the ef closest (distance, node),
+    // closest first
+    void SearchLayer(const float* q, const std::vector<int> &vEntry, const int ef, const int level,
+                     std::vector<std::pair<float,int> > &vResult) const;
+    // Up to nM of the candidates (closest first) that are not closer to an already selected one
+    void SelectNeighbours(const std::vector<std::pair<float,int> > &vCandidates, const int nM, std::vector<int> &vSelected) const;
+    void Insert(const int n);
+    void Rebuild();
+
+    int mnDim;
+    int mnM;
+    int mnEfConstruction;
+    double mfLevelMult;
+
+    std::vector<float> mvData;
+    std::vector<Node> mvNodes;
+    std::unordered_map<KeyFrame*,int> mmNodes;
+    size_t mnRemoved;
+
+    int mnEntry;
+    int mnMaxLevel;
+
+    std::mt19937 mRng;
+
+    // Visit marks of the searches (stamp per node)
+    mutable std::vector<unsigned int> mvVisited;
+    mutable unsigned int mnVisitStamp;
+};
+
+} //namespace ORB_SLAM3
+
+#endif // GLOBALDESCRIPTORINDEX_H
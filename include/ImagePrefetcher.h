@@ -0,0 +1,82 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef IMAGEPREFETCHER_H
+#define IMAGEPREFETCHER_H
+
+#include <opencv2/core/core.hpp>
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ORB_SLAM3
+{
+
+// Image source for the example drivers. The images of a sequence are decoded by background threads
+// ahead of the tracking loop, at most nQueue frames ahead of the last one taken, so that
+// cv::imread (PNG decode) overlaps with tracking instead of adding to it.
+// Frame i may have several images (left/right, rgb/depth), all read with the same imread flag.
+class ImagePrefetcher
+{
+public:
+    ImagePrefetcher(const std::vector<std::vector<std::string> > &vvFilenames, const int flag,
+                    const int nThreads=2, const int nQueue=8);
+    ~ImagePrefetcher();
+
+    // Blocks until frame ni is decoded. Frames are taken in increasing order, skipped frames are
+    // dropped. An image that could not be read is returned empty, as cv::imread does.
+    void Get(const size_t ni, std::vector<cv::Mat> &vIms);
+
+    // Single image per frame
+    cv::Mat Get(const size_t ni);
+    // Two images per frame
+    void Get(const size_t ni, cv::Mat &im1, cv::Mat &im2);
+
+    size_t Size() const { return mvvFilenames.size(); }
+
+    // Removes "--fast" from the arguments and returns whether it was there. In fast mode the
+    // examples do not wait for the timestamp of the next frame (offline reprocessing).
+    static bool ParseFastMode(int &argc, char **argv);
+
+protected:
+    void Run();
+
+    const std::vector<std::vector<std::string> > mvvFilenames;
+    const int mFlag;
+    const size_t mnQueue;
+
+    std::mutex mMutex;
+    std::condition_variable mcvDecoded;
+    std::condition_variable mcvSpace;
+    // Next frame to decode and first frame not taken yet
+    size_t mnNext;
+    size_t mnFirst;
+    std::map<size_t, std::vector<cv::Mat> > mmDecoded;
+    bool mbFinish;
+
+    std::vector<std::thread> mvThreads;
+};
+
+} //namespace ORB_SLAM3
+
+#endif // IMAGEPREFETCHER_H
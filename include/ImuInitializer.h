@@ -0,0 +1,98 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMUINITIALIZER_H
+#define IMUINITIALIZER_H
+
+#include <Eigen/Core>
+#include <Eigen/StdVector>
+
+#include <vector>
+
+namespace ORB_SLAM3
+{
+
+class KeyFrame;
+
+// Closed-form visual-inertial initialization from the preintegrations between consecutive keyframes,
+// used by LocalMapping::InitializeIMU as the starting point of the inertial-only optimization.
+// The gyroscope bias is found by linear least squares on the rotation increments; then the
+// keyframe velocities, the gravity and the scale (monocular) by linear least squares on the
+// velocity and position increments, taking the accelerometer bias as zero. The gravity is refined
+// on its tangent plane with the known magnitude, and the solution is rejected if the scale is not
+// observable enough from the motion so far.
+class ImuInitializer
+{
+public:
+    ImuInitializer();
+
+    // Keyframes in temporal order, each one linked to the previous by mPrevKF and its
+    // preintegration. With bFixScale (stereo, RGB-D) the scale is 1. Returns false if
+    // there is no well conditioned solution, otherwise the getters below are valid.
+    bool Solve(const std::vector<KeyFrame*> &vpKF, const bool bFixScale);
+
+    // Rotation of the world (gravity aligned) frame to the map, as in InertialOptimization
+    const Eigen::Matrix3d& GetRwg() const { return mRwg; }
+    double GetScale() const { return mScale; }
+    const Eigen::Vector3d& GetGyroBias() const { return mbg; }
+
+    // Standard deviation of the scale relative to its value (0 with fixed scale)
+    double GetScaleUncertainty() const { return mScaleSigma; }
+
+    // Velocities (in the map, i.e. divided by the scale) and biases of the keyframes given to Solve
+    void Apply(const std::vector<KeyFrame*> &vpKF) const;
+
+    // Largest relative standard deviation of the scale accepted (default 0.1)
+    double mThScaleSigma;
+
+protected:
+    // Least squares of the velocity and position increments for the current gyroscope bias. If
+    // bRefineGravity, the gravity is mg plus a correction on its tangent plane, otherwise free.
+    bool SolveVelocitiesGravityScale(const bool bRefineGravity);
+
+    typedef std::vector<Eigen::Matrix3d,Eigen::aligned_allocator<Eigen::Matrix3d> > Matrices3d;
+    typedef std::vector<Eigen::Vector3d,Eigen::aligned_allocator<Eigen::Vector3d> > Vectors3d;
+
+    bool mbFixScale;
+
+    // Per keyframe: IMU orientation, camera center and IMU position minus camera center (metric)
+    Matrices3d mvRwb;
+    Vectors3d mvOw;
+    Vectors3d mvLever;
+
+    // Per interval k (keyframe k to k+1): preintegration at its original bias and the bias jacobians
+    std::vector<double> mvdT;
+    Matrices3d mvdR, mvJRg, mvJVg, mvJVa, mvJPg, mvJPa;
+    Vectors3d mvdV, mvdP;
+    Vectors3d mvbg0, mvba0;
+
+    // Solution
+    Eigen::Matrix3d mRwg;
+    Eigen::Vector3d mg;
+    double mScale;
+    double mScaleSigma;
+    Eigen::Vector3d mbg;
+    Vectors3d mvVelocities;
+
+public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+} //namespace ORB_SLAM3
+
+#endif // IMUINITIALIZER_H
@@ -0,0 +1,141 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMUPREINTEGRATOR_H
+#define IMUPREINTEGRATOR_H
+
+#include <vector>
+#include <mutex>
+#include <functional>
+
+#include "ImuTypes.h"
+#include "ImuQueue.h"
+
+namespace ORB_SLAM3
+{
+
+namespace IMU
+{
+
+// Preintegration of the IMU measurements between two frames while they arrive. A worker thread
+// drains the measurement queue and integrates every measurement of the current interval in the
+// preintegration of the frame and in a copy of the preintegration from the last keyframe, so
+// that only the last partial step is left when the frame comes in. Steps are integrated exactly
+// as Tracking::PreintegrateIMU would do it. When the work done ahead does not match the frame
+// (different bias or start, keyframe preintegration changed meanwhile, measurement after the
+// frame timestamp) the interval is integrated from scratch at the frame. Without the worker
+// thread everything is integrated at the frame.
+class Preintegrator
+{
+public:
+    // Called from the worker thread for every integrated measurement with the propagated body
+    // pose (Twb, 4x4) and velocity (3x1). Must not block, it delays the integration.
+    typedef std::function<void(const double&, const cv::Mat&, const cv::Mat&)> PoseCallback;
+
+    Preintegrator(MeasurementQueue* pQueue);
+    ~Preintegrator();
+
+    // Worker thread main function
+    void Run();
+
+    void RequestFinish();
+    bool isFinished();
+
+    // Tracking thread: starts the interval that follows the frame at tStart once its bias and
+    // keyframe preintegration are final. The state of the frame is used for the prediction
+    // between frames, it may be empty (IMU not initialized).
+    void StartInterval(const double &tStart, const Bias &bias, const Calib &calib, Preintegrated* pKFPreintegrated,
+                       const cv::Mat &Rwb = cv::Mat(), const cv::Mat &twb = cv::Mat(), const cv::Mat &Vwb = cv::Mat());
+
+    // Tracking thread: preintegration of the interval (tStart,tEnd) with the given bias, which is
+    // also integrated into pKFPreintegrated. The measurements of the interval are appended to vPoints.
+    // Returns NULL if there are no measurements.
+    Preintegrated* FinishInterval(const double &tStart, const double &tEnd, const Bias &bias, const Calib &calib,
+                                  Preintegrated* pKFPreintegrated, std::vector<Point> &vPoints);
+
+    // IMU state propagated from the start of the interval with the measurements integrated so far
+    bool GetPrediction(double &timestamp, cv::Matx33f &Rwb, cv::Matx31f &twb, cv::Matx31f &Vwb);
+
+    // An empty callback disables the publication
+    void SetPoseCallback(const PoseCallback &callback);
+
+    // Tracking thread: discards the pending measurements and the current interval
+    void Clear();
+
+private:
+    // Integration inputs of step i of the interval, n is the index of the first measurement
+    // after tEnd (last measurement of the interval)
+    static void ComputeStep(const std::vector<Point> &vPoints, const int i, const int n, const double &tStart, const double &tEnd,
+                            cv::Point3f &acc, cv::Point3f &angVel, float &tstep);
+
+    struct Prediction
+    {
+        double t;
+        cv::Matx33f Rwb;
+        cv::Matx31f twb, Vwb;
+    };
+
+    // Moves the measurements of the queue to mvPoints and integrates ahead the steps that end
+    // before tLimit. The state after each step is appended to pvPredictions if given. Called under mMutex.
+    void Update(const double tLimit, std::vector<Prediction>* pvPredictions = static_cast<std::vector<Prediction>*>(NULL));
+
+    // Called under mMutex
+    bool Predict(Prediction &prediction);
+
+    void ResetInterval();
+
+    bool CheckFinish();
+    void SetFinish();
+
+    MeasurementQueue* mpQueue;
+
+    std::mutex mMutex;
+
+    // Measurements from the first one of the interval (the last measurement of the previous interval)
+    std::vector<Point> mvPoints;
+
+    // Current interval, valid once started
+    bool mbStarted;
+    double mtStart;
+    Bias mBias;
+    Preintegrated* mpFramePreintegrated;
+    Preintegrated* mpKFSource;
+    Preintegrated* mpKFPreintegrated;
+    float mKFBaseDT;
+    Bias mKFBaseOriginalBias, mKFBaseUpdatedBias;
+    // Steps integrated ahead
+    int mnSteps;
+
+    // State at the start of the interval
+    bool mbStateValid;
+    cv::Matx33f mRwb;
+    cv::Matx31f mtwb, mVwb;
+
+    PoseCallback mPoseCallback;
+    std::mutex mMutexCallback;
+
+    bool mbFinishRequested;
+    bool mbFinished;
+    std::mutex mMutexFinish;
+};
+
+} //namespace IMU
+
+} //namespace ORB_SLAM
+
+#endif // IMUPREINTEGRATOR_H
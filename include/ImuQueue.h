@@ -0,0 +1,85 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMUQUEUE_H
+#define IMUQUEUE_H
+
+#include <vector>
+#include <atomic>
+#include <cstddef>
+
+#include "ImuTypes.h"
+
+namespace ORB_SLAM3
+{
+
+namespace IMU
+{
+
+// Lock-free single producer / single consumer ring buffer of IMU measurements. The producer
+// (the thread that grabs the IMU data) never waits for the tracking thread, which is the only
+// consumer. Measurements are pushed in timestamp order.
+class MeasurementQueue
+{
+public:
+    // Capacity is rounded up to a power of two
+    explicit MeasurementQueue(size_t capacity = 16384);
+
+    // Producer. Returns false and drops the measurement if the queue is full.
+    bool Push(const Point &point);
+
+    // Consumer. Discards the measurements older than tStart, appends to vPoints the measurements
+    // up to tEnd and the first one after it, which stays in the queue for the next interval.
+    // Same 1 ms tolerance as the frame timestamps. Returns the number of measurements appended.
+    size_t Extract(const double tStart, const double tEnd, std::vector<Point> &vPoints);
+
+    // Consumer. Appends every measurement currently in the queue to vPoints.
+    size_t PopAll(std::vector<Point> &vPoints);
+
+    // Consumer. Discards every measurement currently in the queue.
+    void Clear();
+
+    // Approximate when called concurrently with the producer
+    size_t Size() const;
+    bool Empty() const { return Size()==0; }
+
+    // Measurements dropped because the queue was full
+    size_t Dropped() const { return mnDropped.load(std::memory_order_relaxed); }
+
+    // Timestamp of the last measurement pushed, -1 if none
+    double LastTimestamp() const { return mLastTimestamp.load(std::memory_order_acquire); }
+
+private:
+    std::vector<Point> mvBuffer;
+    size_t mnMask;
+
+    // Producer and consumer indices on different cache lines
+    char mPad0[64];
+    std::atomic<size_t> mnHead; // next slot to write, written by the producer
+    char mPad1[64];
+    std::atomic<size_t> mnTail; // next slot to read, written by the consumer
+    char mPad2[64];
+    std::atomic<size_t> mnDropped;
+    std::atomic<double> mLastTimestamp;
+};
+
+} //namespace IMU
+
+} //namespace ORB_SLAM
+
+#endif // IMUQUEUE_H
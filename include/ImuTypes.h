@@ -31,6 +31,8 @@
 #include <boost/serialization/serialization.hpp>
 #include <boost/serialization/vector.hpp>
 
+#include "SerializationUtils.h"
+
 namespace ORB_SLAM3
 {
 
@@ -147,37 +149,40 @@ public:
 
 public:
     float deltaT; //integration time
-    cv::Mat deltaR; //integrated rotation
-    cv::Mat rightJ; // right jacobian
+    cv::Matx33f deltaR; //integrated rotation
+    cv::Matx33f rightJ; // right jacobian
 };
 
 //Preintegration of Imu Measurements
+//Fixed size matrices, integrating a measurement does not allocate memory
 class Preintegrated
 {
-    template<class Archive>
-    void serializeMatrix(Archive &ar, cv::Mat& mat, const unsigned int version)
+    // Same layout as the cv::Mat serialization (header and continuous data), an empty matrix
+    // is saved for a matrix that is not valid.
+    template<class Archive, int m, int n>
+    void serializeMatx(Archive &ar, cv::Matx<float,m,n>& mat, bool &bValid, const unsigned int version)
     {
         int cols, rows, type;
         bool continuous;
 
         if (Archive::is_saving::value) {
-            cols = mat.cols; rows = mat.rows; type = mat.type();
-            continuous = mat.isContinuous();
+            cols = bValid ? n : 0; rows = bValid ? m : 0; type = CV_32F;
+            continuous = true;
         }
 
         ar & cols & rows & type & continuous;
         if (Archive::is_loading::value)
-            mat.create(rows, cols, type);
+            bValid = (rows==m && cols==n);
 
-        if (continuous) {
-            const unsigned int data_size = rows * cols * mat.elemSize();
-            ar & boost::serialization::make_array(mat.ptr(), data_size);
-        } else {
-            const unsigned int row_size = cols*mat.elemSize();
-            for (int i = 0; i < rows; i++) {
-                ar & boost::serialization::make_array(mat.ptr(i), row_size);
-            }
-        }
+        if (bValid)
+            ar & boost::serialization::make_array(reinterpret_cast<unsigned char*>(mat.val), m*n*sizeof(float));
+    }
+
+    template<class Archive, int m, int n>
+    void serializeMatx(Archive &ar, cv::Matx<float,m,n>& mat, const unsigned int version)
+    {
+        bool bValid = true;
+        serializeMatx(ar,mat,bValid,version);
     }
 
     friend class boost::serialization::access;
@@ -185,37 +190,42 @@ class Preintegrated
     void serialize(Archive & ar, const unsigned int version)
     {
         ar & dT;
-        serializeMatrix(ar,C,version);
-        serializeMatrix(ar,Info,version);
-        serializeMatrix(ar,Nga,version);
-        serializeMatrix(ar,NgaWalk,version);
+        serializeMatx(ar,C,version);
+        serializeMatx(ar,Info,mbInfoReady,version);
+        serializeMatx(ar,Nga,version);
+        serializeMatx(ar,NgaWalk,version);
         ar & b;
-        serializeMatrix(ar,dR,version);
-        serializeMatrix(ar,dV,version);
-        serializeMatrix(ar,dP,version);
-        serializeMatrix(ar,JRg,version);
-        serializeMatrix(ar,JVg,version);
-        serializeMatrix(ar,JVa,version);
-        serializeMatrix(ar,JPg,version);
-        serializeMatrix(ar,JPa,version);
-        serializeMatrix(ar,avgA,version);
-        serializeMatrix(ar,avgW,version);
+        serializeMatx(ar,dR,version);
+        serializeMatx(ar,dV,version);
+        serializeMatx(ar,dP,version);
+        serializeMatx(ar,JRg,version);
+        serializeMatx(ar,JVg,version);
+        serializeMatx(ar,JVa,version);
+        serializeMatx(ar,JPg,version);
+        serializeMatx(ar,JPa,version);
+        serializeMatx(ar,avgA,version);
+        serializeMatx(ar,avgW,version);
 
         ar & bu;
-        serializeMatrix(ar,db,version);
+        serializeMatx(ar,db,version);
         ar & mvMeasurements;
     }
 
 public:
     Preintegrated(const Bias &b_, const Calib &calib);
     Preintegrated(Preintegrated* pImuPre);
-    Preintegrated() {}
+    Preintegrated(): mbInfoReady(false) {}
     ~Preintegrated() {}
     void CopyFrom(Preintegrated* pImuPre);
     void Initialize(const Bias &b_);
     void IntegrateNewMeasurement(const cv::Point3f &acceleration, const cv::Point3f &angVel, const float &dt);
     void Reintegrate();
+    // Reintegrates only if the rotation correction predicted by the bias jacobian is larger
+    // than thRot (rad), the first order update is accurate enough otherwise.
+    bool ReintegrateIfNeeded(const float thRot);
     void MergePrevious(Preintegrated* pPrev);
+    // Approximate size in bytes, measurements included
+    size_t Memory();
     void SetNewBias(const Bias &bu_);
     IMU::Bias GetDeltaBias(const Bias &b_);
     cv::Mat GetDeltaRotation(const Bias &b_);
@@ -232,18 +242,30 @@ public:
     Bias GetOriginalBias();
     Bias GetUpdatedBias();
 
+    // Fixed size versions of the getters
+    cv::Matx33f GetDeltaRotation_(const Bias &b_);
+    cv::Matx31f GetDeltaVelocity_(const Bias &b_);
+    cv::Matx31f GetDeltaPosition_(const Bias &b_);
+    cv::Matx33f GetUpdatedDeltaRotation_();
+    cv::Matx31f GetUpdatedDeltaVelocity_();
+    cv::Matx31f GetUpdatedDeltaPosition_();
+    cv::Matx33f GetOriginalDeltaRotation_();
+    cv::Matx31f GetOriginalDeltaVelocity_();
+    cv::Matx31f GetOriginalDeltaPosition_();
+
 public:
     float dT;
-    cv::Mat C;
-    cv::Mat Info;
-    cv::Mat Nga, NgaWalk;
+    cv::Matx<float,15,15> C;
+    cv::Matx<float,15,15> Info;
+    cv::Matx66f Nga, NgaWalk;
 
     // Values for the original bias (when integration was computed)
     Bias b;
-    cv::Mat dR, dV, dP;
-    cv::Mat JRg, JVg, JVa, JPg, JPa;
-    cv::Mat avgA;
-    cv::Mat avgW;
+    cv::Matx33f dR;
+    cv::Matx31f dV, dP;
+    cv::Matx33f JRg, JVg, JVa, JPg, JPa;
+    cv::Matx31f avgA;
+    cv::Matx31f avgW;
 
 
 private:
@@ -251,10 +273,22 @@ private:
     Bias bu;
     // Dif between original and updated bias
     // This is used to compute the updated values of the preintegration
-    cv::Mat db;
+    cv::Matx<float,6,1> db;
+
+    // Info is computed from C on demand
+    bool mbInfoReady;
 
     struct integrable
     {
+        template<class Archive>
+        void serialize(Archive & ar, const unsigned int version)
+        {
+            ar & a;
+            ar & w;
+            ar & t;
+        }
+
+        integrable(){}
         integrable(const cv::Point3f &a_, const cv::Point3f &w_ , const float &t_):a(a_),w(w_),t(t_){}
         cv::Point3f a;
         cv::Point3f w;
@@ -278,6 +312,13 @@ cv::Mat InverseRightJacobianSO3(const cv::Mat &v);
 cv::Mat Skew(const cv::Mat &v);
 cv::Mat NormalizeRotation(const cv::Mat &R);
 
+// Fixed size versions
+cv::Matx33f ExpSO3_(const float &x, const float &y, const float &z);
+cv::Matx33f ExpSO3_(const cv::Matx31f &v);
+cv::Matx33f RightJacobianSO3_(const float &x, const float &y, const float &z);
+cv::Matx33f RightJacobianSO3_(const cv::Matx31f &v);
+cv::Matx33f NormalizeRotation_(const cv::Matx33f &R);
+
 }
 
 } //namespace ORB_SLAM2
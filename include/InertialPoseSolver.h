@@ -0,0 +1,263 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef INERTIALPOSESOLVER_H
+#define INERTIALPOSESOLVER_H
+
+#include "Thirdparty/g2o/g2o/core/base_unary_edge.h"
+#include "Thirdparty/g2o/g2o/core/base_binary_edge.h"
+#include "Thirdparty/g2o/g2o/core/base_multi_edge.h"
+#include "Thirdparty/g2o/g2o/core/jacobian_workspace.h"
+#include "Thirdparty/g2o/g2o/core/robust_kernel.h"
+
+#include <Eigen/Core>
+#include <Eigen/Cholesky>
+
+#include <vector>
+
+namespace ORB_SLAM3
+{
+
+// Gauss-Newton for the visual-inertial pose tracking problems (PoseInertialOptimizationLastFrame
+// with D=30 and PoseInertialOptimizationLastKeyFrame with D=15). The g2o vertices and edges are
+// used as they are (error and Jacobians), but instead of a SparseOptimizer with BlockSolverX
+// the D x D system is accumulated in a fixed-size matrix and solved with LDLT, as
+// g2o::LinearSolverDense does. Like the optimizer, the solver owns what is added to it.
+template<int D>
+class InertialPoseSolver
+{
+public:
+    typedef Eigen::Matrix<double,D,D> MatrixD;
+    typedef Eigen::Matrix<double,D,1> VectorD;
+
+    InertialPoseSolver() : mbWorkspaceReady(false)
+    {
+        mvpVertices.reserve(8);
+    }
+
+    ~InertialPoseSolver()
+    {
+        for(size_t i=0; i<mvEdges.size(); i++)
+            delete mvEdges[i].pEdge;
+        for(size_t i=0; i<mvpVertices.size(); i++)
+            delete mvpVertices[i];
+    }
+
+    // A free vertex takes the block of the state starting at offset, fixed vertices are not estimated
+    void AddVertex(g2o::OptimizableGraph::Vertex* pV, const int offset)
+    {
+        pV->setHessianIndex(pV->fixed() ? -1 : offset);
+        pV->setColInHessian(pV->fixed() ? -1 : offset);
+        mvpVertices.push_back(pV);
+    }
+
+    template<int E, class M, class VI>
+    void AddEdge(g2o::BaseUnaryEdge<E,M,VI>* pE)
+    {
+        AddEdge(pE, &AccumulateUnary<E,M,VI>);
+    }
+
+    template<int E, class M, class VI, class VJ>
+    void AddEdge(g2o::BaseBinaryEdge<E,M,VI,VJ>* pE)
+    {
+        AddEdge(pE, &AccumulateBinary<E,M,VI,VJ>);
+    }
+
+    template<int E, class M>
+    void AddEdge(g2o::BaseMultiEdge<E,M>* pE)
+    {
+        AddEdge(pE, &AccumulateMulti<E,M>);
+    }
+
+    // Number of edges, at any level
+    size_t NumEdges() const { return mvEdges.size(); }
+
+    // nIterations of Gauss-Newton on the edges of level 0 (as optimizer.initializeOptimization(0)
+    // followed by optimize()). Stops early if the system is not positive definite.
+    void Optimize(const int nIterations)
+    {
+        if(!mbWorkspaceReady)
+        {
+            mJacobianWorkspace.allocate();
+            mbWorkspaceReady = true;
+        }
+
+        for(int iter=0; iter<nIterations; iter++)
+        {
+            mH.setZero();
+            mg.setZero();
+
+            int nActive = 0;
+            for(size_t i=0; i<mvEdges.size(); i++)
+            {
+                g2o::OptimizableGraph::Edge* pE = mvEdges[i].pEdge;
+                if(pE->level()!=0)
+                    continue;
+
+                pE->computeError();
+                pE->linearizeOplus(mJacobianWorkspace);
+
+                double w = 1.0;
+                if(pE->robustKernel())
+                {
+                    Eigen::Vector3d rho;
+                    pE->robustKernel()->robustify(pE->chi2(), rho);
+                    w = rho[1];
+                }
+
+                mvEdges[i].pfAccumulate(pE, w, mH, mg);
+                nActive++;
+            }
+
+            if(nActive==0)
+                break;
+
+            mLDLT.compute(mH);
+            if(mLDLT.info()!=Eigen::Success || !mLDLT.isPositive())
+                break;
+
+            mdx = mLDLT.solve(-mg);
+
+            for(size_t i=0; i<mvpVertices.size(); i++)
+            {
+                g2o::OptimizableGraph::Vertex* pV = mvpVertices[i];
+                if(pV->hessianIndex()>=0)
+                    pV->oplus(mdx.data()+pV->hessianIndex());
+            }
+        }
+
+        // Leave the errors at the final estimate, as the optimizer does
+        for(size_t i=0; i<mvEdges.size(); i++)
+            if(mvEdges[i].pEdge->level()==0)
+                mvEdges[i].pEdge->computeError();
+    }
+
+protected:
+    typedef void (*AccumulateFunction)(g2o::OptimizableGraph::Edge*, const double, MatrixD&, VectorD&);
+
+    struct EdgeEntry
+    {
+        g2o::OptimizableGraph::Edge* pEdge;
+        AccumulateFunction pfAccumulate;
+    };
+
+    void AddEdge(g2o::OptimizableGraph::Edge* pE, AccumulateFunction pfAccumulate)
+    {
+        EdgeEntry entry;
+        entry.pEdge = pE;
+        entry.pfAccumulate = pfAccumulate;
+        mvEdges.push_back(entry);
+
+        mJacobianWorkspace.updateSize(pE);
+        mbWorkspaceReady = false;
+    }
+
+    static int Offset(g2o::OptimizableGraph::Edge* pE, const int i)
+    {
+        return static_cast<g2o::OptimizableGraph::Vertex*>(pE->vertex(i))->hessianIndex();
+    }
+
+    // H += J'*w*Info*J and g += J'*w*Info*e, for the blocks of the free vertices
+    template<int E, class M, class VI>
+    static void AccumulateUnary(g2o::OptimizableGraph::Edge* pEdge, const double w, MatrixD &H, VectorD &g)
+    {
+        g2o::BaseUnaryEdge<E,M,VI>* pE = static_cast<g2o::BaseUnaryEdge<E,M,VI>*>(pEdge);
+        const int o = Offset(pE,0);
+        if(o<0)
+            return;
+
+        const Eigen::Matrix<double,VI::Dimension,E> JtW = pE->jacobianOplusXi().transpose()*(w*pE->information());
+        H.template block<VI::Dimension,VI::Dimension>(o,o).noalias() += JtW*pE->jacobianOplusXi();
+        g.template segment<VI::Dimension>(o).noalias() += JtW*pE->error();
+    }
+
+    template<int E, class M, class VI, class VJ>
+    static void AccumulateBinary(g2o::OptimizableGraph::Edge* pEdge, const double w, MatrixD &H, VectorD &g)
+    {
+        g2o::BaseBinaryEdge<E,M,VI,VJ>* pE = static_cast<g2o::BaseBinaryEdge<E,M,VI,VJ>*>(pEdge);
+        const int oi = Offset(pE,0);
+        const int oj = Offset(pE,1);
+        const Eigen::Matrix<double,E,E> Info = w*pE->information();
+
+        if(oi>=0)
+        {
+            const Eigen::Matrix<double,VI::Dimension,E> JtW = pE->jacobianOplusXi().transpose()*Info;
+            H.template block<VI::Dimension,VI::Dimension>(oi,oi).noalias() += JtW*pE->jacobianOplusXi();
+            g.template segment<VI::Dimension>(oi).noalias() += JtW*pE->error();
+            if(oj>=0)
+            {
+                const Eigen::Matrix<double,VI::Dimension,VJ::Dimension> Hij = JtW*pE->jacobianOplusXj();
+                H.template block<VI::Dimension,VJ::Dimension>(oi,oj) += Hij;
+                H.template block<VJ::Dimension,VI::Dimension>(oj,oi) += Hij.transpose();
+            }
+        }
+        if(oj>=0)
+        {
+            const Eigen::Matrix<double,VJ::Dimension,E> JtW = pE->jacobianOplusXj().transpose()*Info;
+            H.template block<VJ::Dimension,VJ::Dimension>(oj,oj).noalias() += JtW*pE->jacobianOplusXj();
+            g.template segment<VJ::Dimension>(oj).noalias() += JtW*pE->error();
+        }
+    }
+
+    template<int E, class M>
+    static void AccumulateMulti(g2o::OptimizableGraph::Edge* pEdge, const double w, MatrixD &H, VectorD &g)
+    {
+        g2o::BaseMultiEdge<E,M>* pE = static_cast<g2o::BaseMultiEdge<E,M>*>(pEdge);
+        const Eigen::Matrix<double,E,E> Info = w*pE->information();
+
+        const int nVertices = pE->vertices().size();
+        for(int k=0; k<nVertices; k++)
+        {
+            const int ok = Offset(pE,k);
+            if(ok<0)
+                continue;
+            const int dk = static_cast<g2o::OptimizableGraph::Vertex*>(pE->vertex(k))->dimension();
+
+            // Bounded by D, so no heap allocation
+            const Eigen::Matrix<double,Eigen::Dynamic,E,0,D,E> JtW = pE->jacobianOplus(k).transpose()*Info;
+            g.segment(ok,dk).noalias() += JtW*pE->error();
+
+            for(int l=0; l<nVertices; l++)
+            {
+                const int ol = Offset(pE,l);
+                if(ol<0)
+                    continue;
+                const int dl = static_cast<g2o::OptimizableGraph::Vertex*>(pE->vertex(l))->dimension();
+                H.block(ok,ol,dk,dl).noalias() += JtW*pE->jacobianOplus(l);
+            }
+        }
+    }
+
+    std::vector<g2o::OptimizableGraph::Vertex*> mvpVertices;
+    std::vector<EdgeEntry> mvEdges;
+
+    g2o::JacobianWorkspace mJacobianWorkspace;
+    bool mbWorkspaceReady;
+
+    MatrixD mH;
+    VectorD mg;
+    VectorD mdx;
+    Eigen::LDLT<MatrixD> mLDLT;
+
+public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+} //namespace ORB_SLAM3
+
+#endif // INERTIALPOSESOLVER_H
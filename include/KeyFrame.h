@@ -32,10 +32,23 @@
 #include "GeometricCamera.h"
 
 #include <mutex>
+#include <boost/thread/shared_mutex.hpp>
+#include <atomic>
+#include <memory>
 
 #include <boost/serialization/base_object.hpp>
 #include <boost/serialization/vector.hpp>
 #include <boost/serialization/map.hpp>
+#include <boost/serialization/string.hpp>
+
+#include "SerializationUtils.h"
+#include "FlatMap.h"
+#include "EntityStore.h"
+#include "MemoryUsage.h"
+#include "FlatFeatureVector.h"
+#include "FlatBowVector.h"
+#include "RelocalizationCache.h"
+#include "AtlasArchive.h"
 
 
 namespace ORB_SLAM3
@@ -43,20 +56,158 @@ namespace ORB_SLAM3
 
 class Map;
 class MapPoint;
+class KeyFrame;
 class Frame;
 class KeyFrameDatabase;
 
 class GeometricCamera;
+class ConstraintPoseImu;
+
+// Covisible keyframes and the number of map points shared with each of them
+typedef FlatMap<KeyFrame*,int> KeyFrameWeights;
+
+// Per pyramid level table (scale factors, sigmas) shared by all the keyframes extracted with the
+// same settings instead of being copied into each of them. Reads like a const std::vector<float>.
+class ScaleTable
+{
+public:
+    ScaleTable() {}
+    ScaleTable(const std::vector<float> &vTable): mpTable(Intern(vTable)) {}
+
+    const float& operator[](const size_t i) const { return (*mpTable)[i]; }
+    size_t size() const { return mpTable ? mpTable->size() : 0; }
+    std::vector<float> ToVector() const { return mpTable ? *mpTable : std::vector<float>(); }
+
+private:
+    // Returns the stored table equal to vTable, adding it if there is none
+    static std::shared_ptr<const std::vector<float> > Intern(const std::vector<float> &vTable);
+
+    std::shared_ptr<const std::vector<float> > mpTable;
+};
 
 class KeyFrame
 {
+    friend class boost::serialization::access;
+
+    template<class Archive>
+    void serialize(Archive& ar, const unsigned int version)
+    {
+        ar & mnId;
+        ar & const_cast<long unsigned int&>(mnFrameId);
+        ar & const_cast<double&>(mTimeStamp);
+        ar & mnOriginMapId;
+        ar & bImu;
+
+        // Grid layout. The cells are not stored, they are rebuilt on first use
+        ar & const_cast<int&>(mnGridCols);
+        ar & const_cast<int&>(mnGridRows);
+        ar & const_cast<float&>(mfGridElementWidthInv);
+        ar & const_cast<float&>(mfGridElementHeightInv);
+
+        // Calibration
+        ar & const_cast<float&>(fx);
+        ar & const_cast<float&>(fy);
+        ar & const_cast<float&>(cx);
+        ar & const_cast<float&>(cy);
+        ar & const_cast<float&>(invfx);
+        ar & const_cast<float&>(invfy);
+        ar & const_cast<float&>(mbf);
+        ar & const_cast<float&>(mb);
+        ar & const_cast<float&>(mThDepth);
+        ar & mDistCoef;
+        ar & const_cast<cv::Mat&>(mK);
+        ar & const_cast<int&>(mnMinX);
+        ar & const_cast<int&>(mnMinY);
+        ar & const_cast<int&>(mnMaxX);
+        ar & const_cast<int&>(mnMaxY);
+
+        // Features. BoW vectors are stored so that loading does not need the vocabulary transform.
+        // The chunked atlas file keeps them in their own sections (SerializeKeyPoints...)
+        ar & const_cast<int&>(N);
+        const bool bSkeleton = AtlasArchive::SkeletonScope::Active();
+        if(!bSkeleton)
+        {
+            ar & const_cast<std::vector<cv::KeyPoint>&>(mvKeys);
+            ar & const_cast<std::vector<cv::KeyPoint>&>(mvKeysUn);
+            ar & const_cast<std::vector<float>&>(mvuRight);
+            ar & const_cast<std::vector<float>&>(mvDepth);
+            ar & const_cast<cv::Mat&>(mDescriptors);
+            ar & mBowVec;
+            ar & mFeatVec;
+        }
+
+        // Scale
+        ar & const_cast<int&>(mnScaleLevels);
+        ar & const_cast<float&>(mfScaleFactor);
+        ar & const_cast<float&>(mfLogScaleFactor);
+        SerializeScaleTable(ar, const_cast<ScaleTable&>(mvScaleFactors));
+        SerializeScaleTable(ar, const_cast<ScaleTable&>(mvLevelSigma2));
+        SerializeScaleTable(ar, const_cast<ScaleTable&>(mvInvLevelSigma2));
+
+        // Pose and inertial state
+        ar & Tcw_;
+        ar & mTcp;
+        ar & Vw;
+        ar & mImuBias;
+        ar & mImuCalib;
+        ar & mpImuPreintegrated;
+        ar & mbHasHessian;
+        ar & mHessianPose;
+
+        // Pointers are stored as ids and restored in PostLoad
+        if(!bSkeleton)
+            ar & mvBackupMapPointsId;
+        ar & mBackupConnectedKeyFrameIdWeights;
+        ar & mBackupParentId;
+        ar & mvBackupChildrensId;
+        ar & mvBackupLoopEdgesId;
+        ar & mvBackupMergeEdgesId;
+        ar & mBackupPrevKFId;
+        ar & mBackupNextKFId;
+        ar & mnBackupIdCamera;
+        ar & mnBackupIdCamera2;
+
+        ar & mbFirstConnection;
+        ar & mHalfBaseline;
+        ar & mNameFile;
+        ar & mnDataset;
+
+        // Stereo fisheye
+        ar & mvLeftToRightMatch;
+        ar & mvRightToLeftMatch;
+        ar & mTlr;
+        ar & mTrl;
+        if(!bSkeleton)
+            ar & const_cast<std::vector<cv::KeyPoint>&>(mvKeysRight);
+        ar & const_cast<int&>(NLeft);
+        ar & const_cast<int&>(NRight);
+
+        // Files written before the distorted keypoints were shared store them twice
+        if(Archive::is_loading::value)
+            ShareUndistortedKeys();
+    }
+
+    // Stored as a plain vector, the loaded tables are shared again
+    template<class Archive>
+    static void SerializeScaleTable(Archive& ar, ScaleTable &table)
+    {
+        std::vector<float> vTable = table.ToVector();
+        ar & vTable;
+        if(Archive::is_loading::value)
+            table = ScaleTable(vTable);
+    }
 
 public:
     KeyFrame();
     KeyFrame(Frame &F, Map* pMap, KeyFrameDatabase* pKFDB);
 
-    // Pose functions
+    // Storage comes from ObjectPool<KeyFrame>
+    static void* operator new(size_t size);
+    static void operator delete(void* p, size_t size);
+
+    // Pose functions. The pose is stored in fixed-size matrices, the cv::Mat versions copy from them
     void SetPose(const cv::Mat &Tcw);
+    void SetPose_(const cv::Matx44f &Tcw);
     void SetVelocity(const cv::Mat &Vw_);
 
     cv::Mat GetPose();
@@ -78,6 +229,7 @@ public:
     cv::Matx44f GetRightPose_();
     cv::Matx31f GetRightCameraCenter_();
     cv::Matx44f GetPose_();
+    cv::Matx44f GetPoseInverse_();
 
 
     // Bag of Words Representation
@@ -87,12 +239,27 @@ public:
     void AddConnection(KeyFrame* pKF, const int &weight);
     void EraseConnection(KeyFrame* pKF);
 
+    // Rebuilds the covisibility edges of this keyframe from the shared map point counters below
     void UpdateConnections(bool upParent=true);
+    // Map points seen by pKF among those of this keyframe (one per keypoint slot). Maintained by MapPoint
+    // as observations are added and removed, n can be negative
+    void IncreaseCovisibility(KeyFrame* pKF, int n);
     void UpdateBestCovisibles();
     std::set<KeyFrame *> GetConnectedKeyFrames();
+    // Calls f(pKF, weight) for every covisible keyframe under the connections lock, without copying them.
+    // f must not call back into this keyframe
+    template<class F>
+    void VisitConnectedKeyFrames(F f)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(mMutexConnections);
+        for(KeyFrameWeights::const_iterator mit=mConnectedKeyFrameWeights.begin(), mend=mConnectedKeyFrameWeights.end(); mit!=mend; mit++)
+            f(mit->first, mit->second);
+    }
     std::vector<KeyFrame* > GetVectorCovisibleKeyFrames();
     std::vector<KeyFrame*> GetBestCovisibilityKeyFrames(const int &N);
     std::vector<KeyFrame*> GetCovisiblesByWeight(const int &w);
+    // Covisible keyframes by decreasing weight and their weights, read together
+    void GetOrderedCovisibles(std::vector<KeyFrame*> &vpKFs, std::vector<int> &vWeights);
     int GetWeight(KeyFrame* pKF);
 
     // Spanning tree functions
@@ -123,8 +290,15 @@ public:
     int TrackedMapPoints(const int &minObs);
     MapPoint* GetMapPoint(const size_t &idx);
 
+    // Counters bumped when the covisibility links, spanning tree or loop edges of the keyframe
+    // change, and when its map point matches change. Tracking keeps its local map while they hold
+    unsigned long GetGraphVersion() const { return mnGraphVersion; }
+    unsigned long GetMatchesVersion() const { return mnMatchesVersion; }
+
     // KeyPoint functions
     std::vector<size_t> GetFeaturesInArea(const float &x, const float  &y, const float  &r, const bool bRight = false) const;
+    // Fills a caller-owned buffer instead of allocating one per query
+    void GetFeaturesInArea(const float &x, const float  &y, const float  &r, std::vector<size_t> &vIndices, const bool bRight = false) const;
     cv::Mat UnprojectStereo(int i);
     cv::Matx31f UnprojectStereo_(int i);
 
@@ -139,6 +313,10 @@ public:
     void SetBadFlag();
     bool isBad();
 
+    // Drops the map point matches, descriptors and BoW vectors of a bad keyframe.
+    // Called by the epoch manager once the keyframe has been retired.
+    void ReleaseRetiredFeatures();
+
     // Compute Scene Depth (q=2 median). Used in monocular.
     float ComputeSceneMedianDepth(const int q);
 
@@ -164,12 +342,87 @@ public:
     void SetORBVocabulary(ORBVocabulary* pORBVoc);
     void SetKeyFrameDatabase(KeyFrameDatabase* pKFDB);
 
+    // Serialization: pointers are translated to ids before saving and back after loading.
+    // References to keyframes or map points outside the saved sets are dropped.
+    void PreSave(std::set<KeyFrame*>& spKF, std::set<MapPoint*>& spMP, std::set<GeometricCamera*>& spCam);
+    void PostLoad(std::map<long unsigned int, KeyFrame*>& mpKFid, std::map<long unsigned int, MapPoint*>& mpMPid, std::map<unsigned int, GeometricCamera*>& mpCamId);
+
+    // Handle of the keyframe in the entity store of its map, set by Map::AddKeyFrame
+    EntityHandle GetHandle() const { return EntityHandle::Unpack(mnHandle); }
+    void SetHandle(const EntityHandle &h) { mnHandle = h.Pack(); }
+
+    // Keypoints, descriptors and feature vector of a keyframe in an inactive map can be moved to
+    // disk (see Atlas::EnforceMemoryBudget). The BoW vector, pose, covisibility and map point
+    // associations always stay in memory, so the keyframe can still be found by the database.
+    template<class Archive>
+    void SaveFeatures(Archive& ar)
+    {
+        SerializeFeatures(ar);
+    }
+    template<class Archive>
+    void LoadFeatures(Archive& ar)
+    {
+        SerializeFeatures(ar);
+        mFlatFeatVec.Build(mFeatVec);
+        mbFeaturesReleased = false;
+    }
+    void ReleaseFeatures();
+    bool AreFeaturesReleased() const { return mbFeaturesReleased; }
+
+    // Sections of the chunked atlas file (see Atlas::AddSections). Descriptors go with the feature
+    // vector that indexes them, the observations are the map point ids of PreSave
+    template<class Archive>
+    void SerializeKeyPoints(Archive& ar)
+    {
+        ar & const_cast<std::vector<cv::KeyPoint>&>(mvKeys);
+        ar & const_cast<std::vector<cv::KeyPoint>&>(mvKeysUn);
+        ar & const_cast<std::vector<cv::KeyPoint>&>(mvKeysRight);
+        ar & const_cast<std::vector<float>&>(mvuRight);
+        ar & const_cast<std::vector<float>&>(mvDepth);
+    }
+    template<class Archive>
+    void SerializeDescriptors(Archive& ar)
+    {
+        ar & const_cast<cv::Mat&>(mDescriptors);
+        ar & mFeatVec;
+    }
+    template<class Archive>
+    void SerializeBow(Archive& ar)
+    {
+        ar & mBowVec;
+    }
+    template<class Archive>
+    void SerializeObservations(Archive& ar)
+    {
+        ar & mvBackupMapPointsId;
+    }
+    // The keypoints and descriptors of a released keyframe were read back from the sections above
+    void SetFeaturesLoaded();
+
+    // Keypoint idx as extracted (distorted), see mvKeys
+    const cv::KeyPoint& GetKeyPoint(const size_t &idx) const { return mvKeys.empty() ? mvKeysUn[idx] : mvKeys[idx]; }
+    // Approximate size in bytes of what ReleaseFeatures frees
+    size_t FeaturesMemory() const;
+    // Adds the memory of the keyframe to usage (keyframe, features and IMU preintegration)
+    void AccumulateMemory(MemoryUsage &usage);
+
+    // Descriptors of the most observed points for the relocalization ranking, built on first use
+    // (the features must be resident then) and kept when the features are released. NULL if it
+    // was never built and the features are released
+    std::shared_ptr<const RelocalizationCache> GetRelocalizationCache();
+
+    // Marginal prior left by the fixed-lag inertial smoother when it dropped the previous keyframe.
+    // It is only returned while the map has not been corrected since (loop, merge or full BA)
+    void SetInertialPrior(const std::shared_ptr<ConstraintPoseImu> &pPrior);
+    std::shared_ptr<ConstraintPoseImu> GetInertialPrior();
+    void ResetInertialPrior();
+
     bool bImu;
 
     // The following variables are accesed from only 1 thread or never change (no mutex needed).
 public:
 
-    static long unsigned int nNextId;
+    // From the keyframe counter of the System of the frame
     long unsigned int mnId;
     const long unsigned int mnFrameId;
 
@@ -188,6 +441,8 @@ public:
     // Variables used by the local mapping
     long unsigned int mnBALocalForKF;
     long unsigned int mnBAFixedForKF;
+    // Camera centre displacement applied by the last local inertial BA (-1 if never optimized)
+    float mfInertialBAUpdate;
 
     //Number of optimizations by BA(amount of iterations in BA)
     long unsigned int mnNumberOfOpt;
@@ -217,6 +472,9 @@ public:
     IMU::Bias mBiasGBA;
     long unsigned int mnBAGlobalForKF;
 
+    // Submap of the keyframe in its map (Map::GetSubmapKeyFrames), -1 without submaps
+    long int mnSubmapId;
+
     // Variables used by merging
     cv::Mat mTcwMerge;
     cv::Mat mTcwBefMerge;
@@ -238,7 +496,9 @@ public:
     // Number of KeyPoints
     const int N;
 
-    // KeyPoints, stereo coordinate and descriptors (all associated by an index)
+    // KeyPoints, stereo coordinate and descriptors (all associated by an index).
+    // mvKeys is left empty when the keypoints are not distorted (same as mvKeysUn),
+    // use GetKeyPoint to read them.
     const std::vector<cv::KeyPoint> mvKeys;
     const std::vector<cv::KeyPoint> mvKeysUn;
     const std::vector<float> mvuRight; // negative value for monocular points
@@ -248,6 +508,10 @@ public:
     //BoW
     DBoW2::BowVector mBowVec;
     DBoW2::FeatureVector mFeatVec;
+    // mFeatVec as flat arrays, for SearchByBoW (not stored, rebuilt on load)
+    FlatFeatureVector mFlatFeatVec;
+    // mBowVec as flat arrays, for the KeyFrameDatabase scores (not stored, rebuilt on load)
+    FlatBowVector mFlatBowVec;
 
     // Pose relative to parent (this is computed when bad flag is activated)
     cv::Mat mTcp;
@@ -256,9 +520,9 @@ public:
     const int mnScaleLevels;
     const float mfScaleFactor;
     const float mfLogScaleFactor;
-    const std::vector<float> mvScaleFactors;
-    const std::vector<float> mvLevelSigma2;
-    const std::vector<float> mvInvLevelSigma2;
+    const ScaleTable mvScaleFactors;
+    const ScaleTable mvLevelSigma2;
+    const ScaleTable mvInvLevelSigma2;
 
     // Image bounds and calibration
     const int mnMinX;
@@ -291,13 +555,9 @@ public:
 protected:
 
     // SE3 Pose and camera center
-    cv::Mat Tcw;
-    cv::Mat Twc;
-    cv::Mat Ow;
-    cv::Mat Cw; // Stereo middel point. Only for visualization
-
     cv::Matx44f Tcw_, Twc_, Tlr_;
     cv::Matx31f Ow_;
+    cv::Matx31f Cw_; // Stereo middel point. Only for visualization
 
     // IMU position
     cv::Mat Owb;
@@ -315,11 +575,43 @@ protected:
     KeyFrameDatabase* mpKeyFrameDB;
     ORBVocabulary* mpORBvocabulary;
 
-    // Grid over the image to speed up feature matching
-    std::vector< std::vector <std::vector<size_t> > > mGrid;
+    // Grid over the image to speed up feature matching.
+    // Copied from the frame on creation, rebuilt on first use after loading.
+    mutable FeatureGrid mGrid;
+    mutable std::atomic<bool> mbGridReady;
+
+    // Written by the maps that hold the keyframe, possibly two of them during a merge
+    std::atomic<uint64_t> mnHandle{0};
+
+    std::atomic<unsigned long> mnGraphVersion{0};
+    std::atomic<unsigned long> mnMatchesVersion{0};
+    mutable std::mutex mMutexGrid;
+    void AssignFeaturesToGrid() const;
+
+    template<class Archive>
+    void SerializeFeatures(Archive& ar)
+    {
+        SerializeKeyPoints(ar);
+        SerializeDescriptors(ar);
+    }
+    bool mbFeaturesReleased;
+
+    std::shared_ptr<const RelocalizationCache> mpRelocCache;
+    std::mutex mMutexRelocCache;
+
+    std::shared_ptr<ConstraintPoseImu> mpInertialPrior;
+    Map* mpInertialPriorMap;
+    int mnInertialPriorChangeIdx;
+
+    // Drops mvKeys when it is a copy of mvKeysUn
+    void ShareUndistortedKeys();
 
-    std::map<KeyFrame*,int> mConnectedKeyFrameWeights;
+    KeyFrameWeights mConnectedKeyFrameWeights;
     std::vector<KeyFrame*> mvpOrderedConnectedKeyFrames;
+
+    // Shared map point count with every other keyframe, whatever its state or map
+    KeyFrameWeights mCovisibilityCounts;
+    std::mutex mMutexCovisibility;
     std::vector<int> mvOrderedWeights;
 
     // Spanning Tree and Loop Edges
@@ -338,11 +630,15 @@ protected:
 
     Map* mpMap;
 
-    std::mutex mMutexPose; // for pose, velocity and biases
-    std::mutex mMutexConnections;
-    std::mutex mMutexFeatures;
+    // Reader-writer locks: the getters only take them shared
+    boost::shared_mutex mMutexPose; // for pose, velocity and biases
+    boost::shared_mutex mMutexConnections;
+    boost::shared_mutex mMutexFeatures;
     std::mutex mMutexMap;
 
+    // Bumps the graph version, which invalidates the rows of this keyframe in the map keyframe graph
+    void SetEssentialGraphDirty();
+
 public:
     GeometricCamera* mpCamera, *mpCamera2;
 
@@ -358,7 +654,46 @@ public:
 
     const int NLeft, NRight;
 
-    std::vector< std::vector <std::vector<size_t> > > mGridRight;
+    mutable FeatureGrid mGridRight;
+
+    // Additional cameras of a CameraRig (Frame::mvRigViews), empty without rig. A rig camera sees the
+    // world from Tcb*Tcw
+    struct RigCamera
+    {
+        GeometricCamera* pCamera;
+        cv::Matx44f Tcb;
+    };
+    std::vector<RigCamera> mvRigCameras;
+
+    // Inlier matches of the rig cameras when the keyframe was created, used by the bundle adjustments.
+    // They are not observations of the points (covisibility, culling and fusion only see the main
+    // camera) and are not saved. The handle tells whether the point is still in the map of the keyframe.
+    struct RigObservation
+    {
+        int nCamera; // index in mvRigCameras
+        cv::KeyPoint kpUn;
+        MapPoint* pMP;
+        EntityHandle hMapPoint;
+    };
+    // The observations whose point is still in the map of the keyframe and not bad
+    std::vector<RigObservation> GetRigObservations();
+    void EraseRigObservation(const int nCamera, MapPoint* pMP);
+
+protected:
+    std::vector<RigObservation> mvRigObservations;
+    std::mutex mMutexRigObservations;
+
+public:
+    // Ids used only while the keyframe is being saved or loaded (-1 stands for NULL)
+    std::vector<long long int> mvBackupMapPointsId;
+    std::map<long unsigned int, int> mBackupConnectedKeyFrameIdWeights;
+    long long int mBackupParentId;
+    std::vector<long unsigned int> mvBackupChildrensId;
+    std::vector<long unsigned int> mvBackupLoopEdgesId;
+    std::vector<long unsigned int> mvBackupMergeEdgesId;
+    long long int mBackupPrevKFId;
+    long long int mBackupNextKFId;
+    long long int mnBackupIdCamera, mnBackupIdCamera2;
 
     cv::Mat GetRightPose();
     cv::Mat GetRightPoseInverse();
@@ -367,8 +702,6 @@ public:
     cv::Mat GetRightRotation();
     cv::Mat GetRightTranslation();
 
-    cv::Mat imgLeft, imgRight;
-
     void PrintPointDistribution(){
         int left = 0, right = 0;
         int Nlim = (NLeft != -1) ? NLeft : N;
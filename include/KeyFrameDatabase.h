@@ -28,12 +28,18 @@
 #include "Frame.h"
 #include "ORBVocabulary.h"
 #include "Map.h"
+#include "LockProfiler.h"
+#include "GlobalDescriptorIndex.h"
 
 #include <boost/serialization/base_object.hpp>
 #include <boost/serialization/vector.hpp>
 #include <boost/serialization/list.hpp>
 
 #include<mutex>
+#include<map>
+#include<deque>
+#include<unordered_map>
+#include<atomic>
 
 
 namespace ORB_SLAM3
@@ -42,13 +48,63 @@ namespace ORB_SLAM3
 class KeyFrame;
 class Frame;
 class Map;
+class ThreadPool;
 
 
 class KeyFrameDatabase
 {
+    friend class boost::serialization::access;
+
+    template<class Archive>
+    void serialize(Archive& ar, const unsigned int version)
+    {
+        // Inverted file in compressed form: the words that have entries, the offset of
+        // their first entry and the ids of the keyframes of every entry
+        ar & mvBackupInvertedFileWords;
+        ar & mvBackupInvertedFileOffsets;
+        ar & mvBackupInvertedFileKFIds;
+    }
 
 public:
 
+    // Keyframes considered by a query, relative to the map of the query
+    enum eMapScope
+    {
+        ALL_MAPS=0,
+        ONLY_MAP,
+        OTHER_MAPS
+    };
+
+    // State kept between the consecutive DetectNBestCandidates queries of one thread: the words of
+    // the last query and the common words of every keyframe with them. The next query only reads
+    // the posting lists of the words that entered or left it, and the keyframes added since.
+    // The thread that queries must also be the one that adds the keyframes (LoopClosing).
+    class QuerySession
+    {
+    public:
+        QuerySession() : mnGeneration(0), mnAddedSeq(0), mbValid(false) {}
+
+        void Reset() { mbValid = false; mvWords.clear(); mmCommonWords.clear(); }
+
+    private:
+        friend class KeyFrameDatabase;
+
+        struct CommonWords
+        {
+            KeyFrame* pKF;
+            int nWords;
+        };
+
+        // Sorted words of the last query
+        std::vector<unsigned int> mvWords;
+        // Keyframes (by id) sharing words with the last query, in all the maps
+        std::unordered_map<long unsigned int, CommonWords> mmCommonWords;
+        // Database state the counts correspond to
+        unsigned long mnGeneration;
+        unsigned long mnAddedSeq;
+        bool mbValid;
+    };
+
     KeyFrameDatabase(const ORBVocabulary &voc);
 
    void add(KeyFrame* pKF);
@@ -58,29 +114,161 @@ public:
    void clear();
    void clearMap(Map* pMap);
 
+   // Moves the entries of the keyframes that left pMap (map merges) to the partition of their map
+   void RepartitionMap(Map* pMap);
+
    // Loop Detection(DEPRECATED)
    std::vector<KeyFrame *> DetectLoopCandidates(KeyFrame* pKF, float minScore);
 
    // Loop and Merge Detection
    void DetectCandidates(KeyFrame* pKF, float minScore,vector<KeyFrame*>& vpLoopCand, vector<KeyFrame*>& vpMergeCand);
    void DetectBestCandidates(KeyFrame *pKF, vector<KeyFrame*> &vpLoopCand, vector<KeyFrame*> &vpMergeCand, int nMinWords);
-   void DetectNBestCandidates(KeyFrame *pKF, vector<KeyFrame*> &vpLoopCand, vector<KeyFrame*> &vpMergeCand, int nNumCandidates);
+   // Loop candidates come from the map of pKF and merge candidates from the other maps. The scope
+   // restricts the query to one of them. With a session the common words are updated from the
+   // previous query of the session instead of counted again
+   void DetectNBestCandidates(KeyFrame *pKF, vector<KeyFrame*> &vpLoopCand, vector<KeyFrame*> &vpMergeCand, int nNumCandidates,
+                              const eMapScope scope=ALL_MAPS, QuerySession* pSession=static_cast<QuerySession*>(NULL));
 
-   // Relocalization
-   std::vector<KeyFrame*> DetectRelocalizationCandidates(Frame* F, Map* pMap);
+   // Relocalization, by default in pMap only. OTHER_MAPS looks for F in the rest of the Atlas
+   std::vector<KeyFrame*> DetectRelocalizationCandidates(Frame* F, Map* pMap, const eMapScope scope=ONLY_MAP);
 
    void SetORBVocabulary(ORBVocabulary* pORBVoc);
 
+   // Approximate memory of the inverted file in bytes
+   size_t InvertedFileMemory();
+
+   // Worker pool used to score the candidates of large queries in parallel
+   void SetThreadPool(ThreadPool* pThreadPool);
+
+   // First stage of DetectNBestCandidates and DetectRelocalizationCandidates for large maps: only
+   // the nShortlist keyframes of each map whose global descriptor (nDim floats, see
+   // GlobalDescriptorIndex) is most similar to the query are scored, instead of every keyframe
+   // sharing a word with it. 0 (default) uses the inverted file. Set before adding keyframes.
+   void SetGlobalShortlist(const int nShortlist, const int nDim);
+
+   // Serialization: the inverted file is stored with keyframe ids and rebuilt from them
+   void PreSave();
+   void PostLoad(std::map<long unsigned int, KeyFrame*> &mpKFid);
+
 protected:
 
+  // Number of shards of the inverted file. Word i is protected by mvShardMutex[i%NUM_SHARDS]
+  static const int NUM_SHARDS = 64;
+
+  KeyFrameDatabaseMutex& WordMutex(const size_t wordId) { return mvShardMutex[wordId%NUM_SHARDS]; }
+
+  // Posting list entry: a keyframe that contains the word and the weight of the word in it.
+  // Erased keyframes leave a tombstone (pKF==NULL) until the list is compacted
+  struct InvertedFileEntry
+  {
+      KeyFrame* pKF;
+      long unsigned int nKFId;
+      float weight;
+  };
+
+  // Entries of a word for the keyframes of one map
+  struct PostingList
+  {
+      PostingList() : mpMap(static_cast<Map*>(NULL)), mnErased(0) {}
+
+      // Remove the tombstones
+      void Compact();
+
+      Map* mpMap;
+      std::vector<InvertedFileEntry> mvEntries;
+      size_t mnErased;
+  };
+
+  // Posting lists of a word, one per map, so that queries skip the maps they do not target
+  struct WordPostings
+  {
+      // Created on first use
+      PostingList& Partition(Map* pMap);
+
+      std::vector<PostingList> mvPartitions;
+  };
+
+  // Calls f(entry) for the entries (tombstones included) of word wordId in the partitions of
+  // the scope. The word must be locked
+  template<class F>
+  void ForEachEntry(const unsigned int wordId, const eMapScope scope, const Map* pMap, F f) const
+  {
+      const std::vector<PostingList> &vPartitions = mvInvertedFile[wordId].mvPartitions;
+      for(size_t p=0, pend=vPartitions.size(); p<pend; p++)
+      {
+          const PostingList &posting = vPartitions[p];
+          if((scope==ONLY_MAP && posting.mpMap!=pMap) || (scope==OTHER_MAPS && posting.mpMap==pMap))
+              continue;
+
+          for(std::vector<InvertedFileEntry>::const_iterator lit=posting.mvEntries.begin(), lend=posting.mvEntries.end(); lit!=lend; lit++)
+              f(*lit);
+      }
+  }
+
+  // Keyframes of the maps of the scope most similar to vBowVec by global descriptor (all of them
+  // in maps up to mnGlobalShortlist keyframes). False if the shortlist is disabled
+  bool GlobalShortlist(const DBoW2::BowVector &vBowVec, const eMapScope scope, const Map* pMap, std::vector<KeyFrame*> &vpKFs);
+  // Common words and L1 score (sum of the smallest weights of the common words) of two bags of words
+  static void CompareBow(const FlatBowVector &v1, const FlatBowVector &v2, int &nCommonWords, float &score);
+  // Global descriptor index of the map, created on first use (mMutexGlobalIndex locked)
+  GlobalDescriptorIndex& GlobalIndex(Map* pMap);
+  void AddToGlobalIndex(KeyFrame* pKF);
+
+  // Brings the common words of the session to the query vBowVec, by the word delta with its last
+  // query or from scratch if the database changed too much since
+  void UpdateSession(QuerySession &session, const FlatBowVector &vBowVec);
+
+  // Similarity of vBowVec with the bag of words of every keyframe. With L1 scoring it is the
+  // score accumulated in pAccScore while the posting lists were read
+  void ComputeScores(const DBoW2::BowVector &vBowVec, const std::vector<KeyFrame*> &vpKFs, float KeyFrame::*pAccScore, std::vector<float> &vScores) const;
+
+  // Partition of pMap in word wordId (locked), recording the words of each map
+  PostingList& MapPartition(const unsigned int wordId, Map* pMap);
+  // Words where pMap has a partition (or had one), by shard. bForget drops the record
+  void GetMapWords(const Map* pMap, const bool bForget, std::vector<unsigned int> vWords[NUM_SHARDS]);
+
+  // Sizes the inverted file once the vocabulary is loaded (it may be loading in the background,
+  // see VocabularyLoader). Called before reading or writing a word
+  void EnsureInvertedFile();
+  // Words of the inverted file, 0 while it is not sized
+  size_t InvertedFileWords() const;
+
   // Associated vocabulary
   const ORBVocabulary* mpVoc;
 
-  // Inverted file
-  std::vector<list<KeyFrame*> > mvInvertedFile;
+  ThreadPool* mpThreadPool;
+
+  // Inverted file, one contiguous posting list per word and map
+  std::vector<WordPostings> mvInvertedFile;
+  std::once_flag mInvertedFileOnce;
+
+  // Words where each map has a partition, so that clearing or repartitioning a map only visits
+  // those instead of the whole vocabulary
+  std::unordered_map<const Map*, std::vector<unsigned int> > mmMapWords;
+  std::mutex mMutexMapWords;
+  std::atomic<bool> mbInvertedFileReady;
+
+  // Only used while the database is being saved or loaded
+  std::vector<unsigned int> mvBackupInvertedFileWords;
+  std::vector<unsigned int> mvBackupInvertedFileOffsets;
+  std::vector<long unsigned int> mvBackupInvertedFileKFIds;
+
+  // Queries only lock the words they read, so they do not block add/erase from other threads
+  KeyFrameDatabaseMutex mvShardMutex[NUM_SHARDS];
+
+  // Global descriptor shortlist (SetGlobalShortlist), one index per map
+  int mnGlobalShortlist;
+  int mnGlobalDim;
+  std::map<Map*, GlobalDescriptorIndex> mmGlobalIndex;
+  std::mutex mMutexGlobalIndex;
 
-  // Mutex
-  std::mutex mMutex;
+  // For the query sessions: the last keyframes added (mnAddedSeq in total) and a generation bumped
+  // whenever keyframes leave the database other than by erase (clear, clearMap, load)
+  static const size_t ADDED_LOG_SIZE = 256;
+  std::deque<KeyFrame*> mdpAddedLog;
+  unsigned long mnAddedSeq;
+  unsigned long mnGeneration;
+  std::mutex mMutexSessions;
 };
 
 } //namespace ORB_SLAM
@@ -0,0 +1,174 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef KEYFRAMEWIRE_H
+#define KEYFRAMEWIRE_H
+
+#include "ImuTypes.h"
+
+#include <opencv2/core/core.hpp>
+
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+namespace ORB_SLAM3
+{
+
+class KeyFrame;
+
+// Inertial state of a keyframe and its preintegration from the previous keyframe
+struct InertialMessage
+{
+    cv::Mat Vw;                                 // velocity, 3x1 CV_32F
+    IMU::Bias bias;
+    float dT;                                   // preintegration: time, bias and deltas
+    IMU::Bias preintegrationBias;
+    cv::Mat dR, dV, dP;
+    cv::Mat JRg, JVg, JVa, JPg, JPa;            // Jacobians of the deltas wrt the bias
+    cv::Mat C;                                  // 15x15 covariance
+};
+
+// What an agent sends of a keyframe to the map server (see MapServer)
+struct KeyFrameMessage
+{
+    unsigned int nAgentId;
+    unsigned long long nKFId;
+    unsigned long long nMapId;
+    double timestamp;
+    cv::Mat Tcw;                                // 4x4 CV_32F
+    float fx, fy, cx, cy;
+    float fScaleFactor;                         // of the ORB pyramid
+    std::vector<cv::KeyPoint> vKeysUn;          // undistorted, only pt, octave and angle
+    cv::Mat descriptors;                        // one 32 byte ORB descriptor per keypoint
+    std::vector<int> vPointIdx;                 // per keypoint index into vPointIds, -1 if none
+    std::vector<unsigned long long> vPointIds;  // map points seen by the keyframe
+    std::vector<cv::Point3f> vPoints;           // and their world positions
+    bool bImu;
+    InertialMessage imu;                        // only with bImu
+};
+
+// Keyframe poses and map point positions of a map that changed since they were last sent
+struct MapUpdateMessage
+{
+    unsigned int nAgentId;
+    unsigned long long nMapId;
+    std::vector<unsigned long long> vKFIds;
+    std::vector<cv::Mat> vKFPoses;              // Tcw, 4x4 CV_32F
+    std::vector<unsigned long long> vPointIds;
+    std::vector<cv::Point3f> vPoints;
+};
+
+// Reference values of the delta encoding of MapUpdateMessage, kept by the encoder and the
+// decoder. Both hold the values as decoded, so that the quantization errors do not add up.
+struct MapUpdateState
+{
+    std::unordered_map<unsigned long long, cv::Matx44f> mKFPoses;
+    std::unordered_map<unsigned long long, cv::Point3f> mPoints;
+
+    // The keyframe message sets the references of the keyframe and its points
+    void Add(const KeyFrameMessage &msg);
+    void Clear() { mKFPoses.clear(); mPoints.clear(); }
+};
+
+// Compact binary encoding of the keyframes and map updates exchanged between agents and the map
+// server. Messages are a char type and a uint32 payload size followed by the payload, in host
+// byte order:
+//   'H'  hello, first message of an agent      uint32 agent id, uint16 VERSION
+//   'K'  keyframe                              see below
+//   'U'  map update                            see below
+//   'A'  alignment of two maps (server)        uint32 agent, uint64 map id, uint32 other agent,
+//                                              uint64 other map id, uint32 inliers,
+//                                              13 floats: scale, R (3x3 row major), t
+//                                              (Sim3 from the other map to the map of the agent)
+// A keyframe is uint32 agent, uint64 keyframe id, uint64 map id, double timestamp, 12 floats Tcw
+// (3x4 row major), 5 floats fx fy cx cy and pyramid scale factor, uint32 N and N keypoints of 40
+// bytes: uint16 x and y in 1/8 pixel, uint8 octave, uint8 angle in 1/256 turn, 32 descriptor
+// bytes, uint16 map point index (0xffff: none). Then uint32 M and M map points: uint64 id and 3
+// floats world position. A keypoint with its map point takes 60 bytes instead of ~150 in memory.
+// The BoW vectors are not sent, the receiver computes them with its vocabulary. Last a uint8,
+// 1 if the inertial state follows: 3 floats velocity, 6 floats bias, and of the preintegration
+// dT, 6 floats bias, dR as a quaternion (x y z, w>=0), dV, dP, the 5 Jacobians (45 floats) and
+// the upper triangle of the covariance (120 floats), 760 bytes.
+// A map update is uint32 agent, uint64 map id, uint32 K, K keyframe poses, uint32 P, P points.
+// Ids are sorted and sent as LEB128 varints of (difference with the previous id)<<1 | full.
+// When the change since the reference is small it is sent as a delta: a pose as int16 x3
+// translation in 0.1 mm and int16 x3 rotation vector in 1e-5 rad (6+6 bytes), a point as int16
+// x3 in 0.1 mm (6 bytes). Otherwise (full) a pose is 12 floats and a point 3 floats.
+class KeyFrameWire
+{
+public:
+    // Appends the message of a keyframe to buffer. With pState, the pose and map point positions
+    // sent become the references of the following map updates
+    static void EncodeKeyFrame(KeyFrame* pKF, const unsigned int nAgentId, std::vector<char> &buffer,
+                               MapUpdateState* pState = static_cast<MapUpdateState*>(NULL));
+    static bool DecodeKeyFrame(const char* data, const size_t size, KeyFrameMessage &msg);
+
+    // The update references of the receiver are set by MapUpdateState::Add
+    static void EncodeMapUpdate(const MapUpdateMessage &msg, MapUpdateState &state, std::vector<char> &buffer);
+    // Entries that are a delta without reference (e.g. after a dropped message) are left out
+    static bool DecodeMapUpdate(const char* data, const size_t size, MapUpdateState &state, MapUpdateMessage &msg);
+
+    // False if the version of the sender is not ours
+    static void EncodeHello(const unsigned int nAgentId, std::vector<char> &buffer);
+    static bool DecodeHello(const char* data, const size_t size, unsigned int &nAgentId);
+
+    // S12 maps points of the other map into the map of the agent (4x4 CV_32F, sR|t)
+    static void EncodeAlignment(const unsigned int nAgentId, const unsigned long long nMapId,
+                                const unsigned int nOtherAgentId, const unsigned long long nOtherMapId,
+                                const unsigned int nInliers, const float s, const cv::Mat &R, const cv::Mat &t,
+                                std::vector<char> &buffer);
+    static bool DecodeAlignment(const char* data, const size_t size, unsigned int &nAgentId, unsigned long long &nMapId,
+                                unsigned int &nOtherAgentId, unsigned long long &nOtherMapId, unsigned int &nInliers,
+                                float &s, cv::Mat &R, cv::Mat &t);
+
+    // Splits the complete messages at the front of buffer. f(type, payload, size) is called for each
+    // one and the consumed bytes are removed. Returns false if a message is malformed (too large).
+    template<class F>
+    static bool ConsumeMessages(std::vector<char> &buffer, F f)
+    {
+        size_t pos = 0;
+        while(buffer.size()-pos >= HEADER_SIZE)
+        {
+            unsigned int size;
+            memcpy(&size, &buffer[pos+1], sizeof(size));
+            if(size>MAX_MESSAGE_SIZE)
+                return false;
+            if(buffer.size()-pos-HEADER_SIZE < size)
+                break;
+
+            f(buffer[pos], buffer.data()+pos+HEADER_SIZE, static_cast<size_t>(size));
+            pos += HEADER_SIZE+size;
+        }
+        buffer.erase(buffer.begin(), buffer.begin()+pos);
+        return true;
+    }
+
+    static const unsigned short VERSION = 2;
+    static const size_t HEADER_SIZE = 1+sizeof(unsigned int);
+    static const unsigned int MAX_MESSAGE_SIZE = 64<<20;
+
+protected:
+    // Writes the header with a size to patch once the payload is written, returns its position
+    static size_t BeginMessage(const char type, std::vector<char> &buffer);
+    static void EndMessage(const size_t pos, std::vector<char> &buffer);
+};
+
+} //namespace ORB_SLAM3
+
+#endif // KEYFRAMEWIRE_H
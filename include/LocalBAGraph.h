@@ -0,0 +1,124 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LOCALBAGRAPH_H
+#define LOCALBAGRAPH_H
+
+#include "Thirdparty/g2o/g2o/core/sparse_optimizer.h"
+#include "Thirdparty/g2o/g2o/core/block_solver.h"
+#include "Thirdparty/g2o/g2o/core/optimization_algorithm_levenberg.h"
+#include "Thirdparty/g2o/g2o/core/robust_kernel_impl.h"
+#include "Thirdparty/g2o/g2o/types/types_six_dof_expmap.h"
+
+#include <map>
+#include <tuple>
+
+namespace ORB_SLAM3
+{
+
+class KeyFrame;
+class MapPoint;
+class GeometricCamera;
+
+// Local BA problem kept alive between successive LocalBundleAdjustment calls of Local Mapping.
+// Consecutive windows share most of their keyframes, points and observations, so vertices,
+// edges and the solver are reused and only the part of the graph that left the window is freed.
+class LocalBAGraph
+{
+public:
+    enum eEdgeType{
+        MONO=0,
+        STEREO=1,
+        BODY=2,
+        RIG=3       // RIG+i for the rig camera i of the keyframe (KeyFrame::mvRigCameras)
+    };
+
+    LocalBAGraph();
+    ~LocalBAGraph();
+
+    // Start a new window. Anything not requested again before EndWindow() is removed.
+    void BeginWindow();
+    // Remove the vertices and edges that were not used in the current window.
+    void EndWindow();
+    // Drop the whole graph (e.g. after a map reset).
+    void Clear();
+
+    // Vertex of the keyframe / map point, created on first use. The estimate is not refreshed.
+    g2o::VertexSE3Expmap* KeyFrameVertex(KeyFrame* pKF);
+    g2o::VertexSBAPointXYZ* MapPointVertex(MapPoint* pMP);
+
+    // Edge between the point and the keyframe of the given eEdgeType, created on first use with a
+    // Huber kernel. Measurement, information and camera parameters are left to the caller.
+    template<class EdgeT>
+    EdgeT* GetEdge(KeyFrame* pKF, MapPoint* pMP, int type)
+    {
+        return GetEdge<EdgeT>(pKF, pMP, type, &NewDefaultEdge<EdgeT>, static_cast<GeometricCamera*>(NULL));
+    }
+
+    // Same, but a new edge is created by pfNew(pCamera), e.g. NewEdgeSE3ProjectXYZ to get the
+    // specialization for the camera model. The camera of a keyframe does not change, so an
+    // edge found in the graph is still of the right type.
+    template<class EdgeT>
+    EdgeT* GetEdge(KeyFrame* pKF, MapPoint* pMP, int type, EdgeT* (*pfNew)(GeometricCamera*), GeometricCamera* pCamera)
+    {
+        g2o::VertexSBAPointXYZ* vPoint = MapPointVertex(pMP);
+        g2o::VertexSE3Expmap* vSE3 = KeyFrameVertex(pKF);
+
+        const EdgeKey key(vSE3->id(), vPoint->id(), type);
+        std::map<EdgeKey, std::pair<g2o::OptimizableGraph::Edge*, unsigned long> >::iterator it = mmEdges.find(key);
+        if(it != mmEdges.end())
+        {
+            it->second.second = mnGeneration;
+            return static_cast<EdgeT*>(it->second.first);
+        }
+
+        EdgeT* e = pfNew(pCamera);
+        e->setVertex(0, vPoint);
+        e->setVertex(1, vSE3);
+        e->setRobustKernel(new g2o::RobustKernelHuber);
+        mOptimizer.addEdge(e);
+        mmEdges[key] = std::make_pair(static_cast<g2o::OptimizableGraph::Edge*>(e), mnGeneration);
+        return e;
+    }
+
+    g2o::SparseOptimizer& GetOptimizer() { return mOptimizer; }
+    g2o::OptimizationAlgorithmLevenberg* GetAlgorithm() { return mpAlgorithm; }
+
+    int KeyFrameId(KeyFrame* pKF) const;
+    int MapPointId(MapPoint* pMP) const;
+
+protected:
+    typedef std::tuple<unsigned long, unsigned long, int> EdgeKey;
+
+    template<class EdgeT>
+    static EdgeT* NewDefaultEdge(GeometricCamera* pCamera) { return new EdgeT(); }
+
+    g2o::SparseOptimizer mOptimizer;
+    g2o::OptimizationAlgorithmLevenberg* mpAlgorithm;
+
+    // mnId -> (vertex, last window it was used in)
+    std::map<unsigned long, std::pair<g2o::VertexSE3Expmap*, unsigned long> > mmKFVertices;
+    std::map<unsigned long, std::pair<g2o::VertexSBAPointXYZ*, unsigned long> > mmMPVertices;
+    std::map<EdgeKey, std::pair<g2o::OptimizableGraph::Edge*, unsigned long> > mmEdges;
+
+    unsigned long mnGeneration;
+};
+
+} //namespace ORB_SLAM3
+
+#endif // LOCALBAGRAPH_H
@@ -0,0 +1,102 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LOCALMAPMIRROR_H
+#define LOCALMAPMIRROR_H
+
+#include <opencv2/core/core.hpp>
+
+#include <vector>
+
+namespace ORB_SLAM3
+{
+
+class MapPoint;
+class Frame;
+
+// Contiguous copy of the local map points of Tracking for the projection search: positions,
+// normals and scale distances as structure of arrays and one descriptor matrix, in the order of
+// Tracking::mvpLocalMapPoints. Unlike FrozenMap the points keep changing, so each copy carries the
+// MapPoint::GetViewVersion it was taken at. Refresh reads again (locks, descriptor copy) only the
+// points that are new in the local map or whose version moved, the others are copied from the
+// previous arrays.
+class LocalMapMirror
+{
+public:
+    LocalMapMirror();
+
+    struct Points
+    {
+        std::vector<MapPoint*> mvpMapPoints;
+        std::vector<long unsigned int> mvnId;
+        std::vector<unsigned int> mvnVersion;
+        std::vector<float> mvX, mvY, mvZ;
+        std::vector<float> mvNx, mvNy, mvNz;
+        // Scale invariance region (0.8*min, 1.2*max) and max distance used to predict the scale
+        std::vector<float> mvMinDist, mvMaxDist, mvScaleDist;
+        // Only the first size() rows are valid, the matrix only grows
+        cv::Mat mDescriptors;
+
+        size_t size() const { return mvpMapPoints.size(); }
+        void resize(size_t n);
+    };
+
+    // Per frame projection of the mirror, as the projection part of FrozenMap::LocalWindow
+    struct Projection
+    {
+        Projection(): mnStamp(0) {}
+
+        unsigned long mnStamp;
+        std::vector<unsigned long> mvPointStamp;
+
+        // Mirror points in the frustum of the frame, as MapPoint::mTrackProj* for isInFrustum
+        std::vector<int> mvProjPoint;
+        std::vector<float> mvProjU, mvProjV, mvProjUR, mvProjDepth, mvProjViewCos;
+        std::vector<int> mvProjLevel;
+
+        // Keypoints of the frame already matched to a point with observations
+        std::vector<unsigned char> mvbKeyMatched;
+
+        // Keeps only the entries vKeep (increasing) of the projection
+        void Keep(const std::vector<int> &vKeep);
+    };
+
+    // Mirror of vpMapPoints (not NULL, not bad). Returns the number of points read from the MapPoint.
+    int Refresh(const std::vector<MapPoint*> &vpMapPoints);
+
+    // Forget every copy (the points may have been deleted)
+    void Clear();
+
+    // Index of pMP in the mirror, -1 if it is not in it
+    int PointIndex(MapPoint* pMP) const;
+
+    // Frustum test (Frame::isInFrustum) of the mirror points not matched in F. Fills p.mvProj*
+    // and p.mvbKeyMatched, returns the number of points in the frustum. Only for frames with a
+    // single camera (Nleft==-1).
+    int ProjectPoints(const Frame &F, const float viewingCosLimit, Projection &p) const;
+
+    Points mPoints;
+
+protected:
+    // Arrays of the previous Refresh, reused as the next output
+    Points mPrevPoints;
+};
+
+} //namespace ORB_SLAM3
+
+#endif // LOCALMAPMIRROR_H
@@ -26,8 +26,14 @@
 #include "Tracking.h"
 #include "KeyFrameDatabase.h"
 #include "Initializer.h"
+#include "LocalMappingScheduler.h"
+#include "ThreadScheduling.h"
 
 #include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <future>
+#include <map>
 
 
 namespace ORB_SLAM3
@@ -37,16 +43,81 @@ class System;
 class Tracking;
 class LoopClosing;
 class Atlas;
+class ThreadPool;
+class Metrics;
+class ReplayLog;
+class LocalBAGraph;
+class AgentClient;
+class PowerGovernor;
+class TrajectoryStore;
 
 class LocalMapping
 {
 public:
     LocalMapping(System* pSys, Atlas* pAtlas, const float bMonocular, bool bInertial, const string &_strSeqName=std::string());
+    ~LocalMapping();
 
     void SetLoopCloser(LoopClosing* pLoopCloser);
 
     void SetTracker(Tracking* pTracker);
 
+    /* !
+     * @brief System이 소유한 worker thread pool을 설정하는 함수
+     * @param pThreadPool 공유 thread pool
+     * @return void
+    */
+    void SetThreadPool(ThreadPool* pThreadPool);
+
+    /* !
+     * @brief System의 TrajectoryStore를 설정하는 함수 (queue에서 삭제되는 keyframe을 reference로 쓰는 frame 정리)
+     * @param pTrajectoryStore store (NULL: 없음)
+     * @return void
+    */
+    void SetTrajectoryStore(TrajectoryStore* pTrajectoryStore);
+
+    /* !
+     * @brief System이 소유한 runtime metrics를 설정하는 함수
+     * @param pMetrics 공유 metrics (stage latency, queue 길이)
+     * @return void
+    */
+    void SetMetrics(Metrics* pMetrics);
+
+    /* !
+     * @brief record/replay log를 설정하는 함수 (System::StartReplay, System.RecordDir)
+     * @param pReplayLog keyframe 처리 중의 queue 확인과 scheduler 결정을 기록하거나 재현
+     * @return void
+    */
+    void SetReplayLog(ReplayLog* pReplayLog);
+
+    /* !
+     * @brief Local Mapping thread의 CPU affinity와 scheduling 설정 (Thread.LocalMapping.*). Run 시작 시 적용되므로 thread 시작 전에 호출
+     * @param sched 적용할 설정
+     * @return void
+    */
+    void SetThreadScheduling(const ThreadScheduling &sched);
+
+    /* !
+     * @brief 처리가 끝난 KeyFrame을 map server로 보내는 AgentClient를 설정하는 함수 (Agent.ServerHost)
+     * @param pAgentClient server 연결, NULL이면 보내지 않음
+     * @return void
+    */
+    void SetAgentClient(AgentClient* pAgentClient);
+
+    /* !
+     * @brief queue 길이와 측정된 stage 시간에 따라 SearchInNeighbors, Local BA, KeyFrameCulling을
+     *        실행하거나 idle 시간으로 미루는 scheduler를 사용하도록 설정하는 함수
+     * @param fKeyFrameBudget 다른 KeyFrame이 대기 중일 때 KeyFrame 하나에 쓸 수 있는 시간 (ms)
+     * @return void
+    */
+    void EnableScheduler(const float fKeyFrameBudget);
+
+    /* !
+     * @brief Low-power mode에서 KeyFrame들을 모아서 한 번에(burst) 처리하도록 설정하는 함수
+     * @param pGovernor burst 크기와 최대 대기 시간을 정하는 governor (NULL: 도착하는 대로 처리)
+     * @return void
+    */
+    void SetPowerGovernor(PowerGovernor* pGovernor);
+
     // Main function
     /* !
      * @brief local mapping 구동시 main function이 되는 함수입니다.
@@ -108,6 +179,13 @@ public:
     */
     bool isStopped();
 
+    /* !
+     * @brief local mapping이 실제로 stop(또는 종료)될 때까지 대기하는 함수. RequestStop() 후에 호출
+     * @param None
+     * @return void
+    */
+    void WaitUntilStopped();
+
     /* !
      * @brief stop이 requested가 되었는지 확인할때 사용하는 함수
      * @param None
@@ -184,6 +262,14 @@ public:
     */
     KeyFrame* GetCurrKF();
 
+    /* !
+     * @brief Key Frame이 보는 Map Point 중 redundant_th 비율 이상이 다른 3개 이상의 Key Frame에서
+     *        (동일하거나 더 미세한 scale로) 관찰되는지 확인하는 함수. Map을 읽기만 하므로 병렬로 호출 가능
+     * @param pKF 확인할 Key Frame, redundant_th 중복 비율
+     * @return 중복된 Key Frame이면 true
+    */
+    bool IsRedundantKeyFrame(KeyFrame* pKF, const float redundant_th);
+
     std::mutex mMutexImuInit;
 
     Eigen::MatrixXd mcovInertial;
@@ -210,6 +296,31 @@ public:
     bool mbFarPoints;
     float mThFarPoints;
 
+    // Relinearization threshold of the local inertial BA (0 solves the whole window every time)
+    float mThInertialRelin;
+
+    // Window of the local inertial BA run as a fixed-lag smoother (0 keeps the fixed-boundary window)
+    int mnInertialSmootherWindow;
+
+    // Time budget of the keyframe culling redundancy check in ms (0 means no limit)
+    float mThKFCullingBudget;
+
+    // Compute the bag of words of queued keyframes on the thread pool while the previous keyframe
+    // is being processed (needs a pool with worker threads)
+    bool mbSpeculativePreprocessing;
+
+    // Keyframes and map points per map past which the least informative ones of the whole map are
+    // removed (0 means no limit), see EnforceMapBudget
+    int mnMaxKeyFrames;
+    int mnMaxMapPoints;
+
+    // Closed-form IMU initialization (ImuInitializer) from this many seconds of keyframes, refined by the
+    // inertial optimizations as usual. 0 means disabled: the first initialization waits 2s (mono) or 1s
+    float mFastImuInitTime;
+
+    // Offline map building: local BA is neither skipped nor aborted because keyframes are queued
+    bool mbOfflineMapping;
+
 #ifdef REGISTER_TIMES
     vector<double> vdKFInsert_ms;
     vector<double> vdMPCulling_ms;
@@ -233,6 +344,37 @@ protected:
     bool CheckNewKeyFrames();
     void ProcessNewKeyFrame();
 
+    /* !
+    * @brief scheduler가 stage를 지금 실행할지 결정 (replay log가 있으면 기록/재현)
+    * @param stage SearchInNeighbors, Local BA, KeyFrameCulling
+    * @return bool
+    */
+    bool ShouldRun(const LocalMappingScheduler::Stage stage);
+
+    /* !
+    * @brief 새로운 KeyFrame이 들어오거나 stop/reset/finish 요청이 올 때까지 대기 (usleep polling 대신 사용)
+    *        사용되는 위치: LocalMapping::Run();
+    * @param None
+    * @return void
+    */
+    void WaitForWork();
+
+    /* !
+    * @brief WaitForWork()에서 대기 중인 Run()을 깨움. 요청 flag를 설정한 뒤에 호출
+    * @param None
+    * @return void
+    */
+    void WakeUp();
+
+    /* !
+    * @brief Low-power mode에서 queue에 있는 KeyFrame들을 처리할 때가 되었는지 확인
+    *        (burst 크기만큼 모였거나, 가장 오래된 KeyFrame이 최대 대기 시간을 넘었거나, burst 진행 중)
+    *        mMutexNewKFs를 잡은 상태에서 호출
+    * @param None
+    * @return bool
+    */
+    bool BurstDue();
+
     /* !
     * @brief Current KeyFrame을 기준으로 인접한 Keyframe을 이용하여 triangulation을 수행하여 3D point를 생성하고
     *        Atlas-map과 current-map 객체에 3D point를 등록
@@ -243,7 +385,7 @@ protected:
     void CreateNewMapPoints();
 
     /* !
-     * @brief mlpRecentAddedMapPoints의 담겨있는 Map point의 상태를 확안 후, 조건에 맞지 않는 Map point를 걸러내기 위한 함수
+     * @brief mlRecentAddedMapPoints의 담겨있는 Map point의 상태를 확안 후, 조건에 맞지 않는 Map point를 걸러내기 위한 함수
      * @param None
      * @return void
     */
@@ -263,6 +405,28 @@ protected:
     */
     void KeyFrameCulling();
 
+    /* !
+     * @brief Map의 Key Frame 또는 Map Point 수가 mnMaxKeyFrames, mnMaxMapPoints를 넘으면 Map 전체에서
+     *        정보가 가장 적은 것부터 제거하는 함수 (local window는 제외, 한 번에 일부만 제거)
+     * @param None
+     * @return void
+    */
+    void EnforceMapBudget();
+
+    /* !
+     * @brief Key Frame이 없으면 관찰이 thObs 미만으로 줄어드는 Map Point의 수 (Map의 coverage에 대한 기여)
+     * @param pKF 확인할 Key Frame. Map을 읽기만 하므로 병렬로 호출 가능
+     * @return 기여하는 Map Point 수
+    */
+    int KeyFrameContribution(KeyFrame* pKF);
+
+    /* !
+     * @brief 미뤄둔 fusion/culling 작업 하나를 처리하는 함수 (새로운 KeyFrame이 없을 때 호출)
+     * @param None
+     * @return void
+    */
+    void ProcessDeferredWork();
+
     cv::Mat ComputeF12(KeyFrame* &pKF1, KeyFrame* &pKF2);       // tracking.cc의 Compute12와 동일합니다. 
     cv::Matx33f ComputeF12_(KeyFrame* &pKF1, KeyFrame* &pKF2);  // tracking.cc의 Compute12_와 동일합니다. 
 
@@ -295,6 +459,7 @@ protected:
     bool mbResetRequestedActiveMap;
     Map* mpMapToReset;
     std::mutex mMutexReset;
+    std::condition_variable mcvReset;   // ResetIfRequested()에서 reset이 끝나면 notify
 
     /* !
      * @brief Local Mapper가 종료요청을 받았는지 확인하는 함수
@@ -317,14 +482,50 @@ protected:
 
     LoopClosing* mpLoopCloser;
     Tracking* mpTracker;
+    ThreadPool* mpThreadPool;
+    TrajectoryStore* mpTrajectoryStore;
+    Metrics* mpMetrics;
+    ReplayLog* mpReplayLog;
+    ThreadScheduling mThreadScheduling;
+    AgentClient* mpAgentClient;
+    // keyframe 또는 deferred work를 처리 중 (이때의 queue 확인만 replay log에 기록)
+    bool mbReplayTurn;
+
+    // Local BA graph reused between iterations (only touched by the Local Mapping thread)
+    LocalBAGraph* mpLocalBAGraph;
+
+    // Stage scheduler (NULL: fixed order as in the original system) and the fusion/culling work
+    // it postponed to idle periods, oldest first (only touched by the Local Mapping thread)
+    struct DeferredWork
+    {
+        KeyFrame* pKF;
+        bool bFuse;
+        bool bCull;
+    };
+    LocalMappingScheduler* mpScheduler;
+    std::list<DeferredWork> mlDeferredWork;
 
     std::list<KeyFrame*> mlNewKeyFrames;
 
+    // Pending speculative work of the queued keyframes (guarded by mMutexNewKFs). Only the bag of
+    // words is speculated: point updates and triangulation depend on the keyframes before it
+    std::map<KeyFrame*, std::future<void> > mmSpeculativeWork;
+    void WaitSpeculativeWork();
+
+    // Low-power mode (NULL: keyframes are processed as they arrive). Queued keyframes wait until
+    // the burst is complete or the first of them is too old, then the whole queue is processed
+    PowerGovernor* mpPowerGovernor;
+    bool mbInBurst;
+    std::chrono::steady_clock::time_point mTimeFirstQueued;
+
     KeyFrame* mpCurrentKeyFrame;
 
-    std::list<MapPoint*> mlpRecentAddedMapPoints;
+    // Points created in the last keyframes, kept as handles since they may be culled and reclaimed by other threads
+    std::list<std::pair<Map*,EntityHandle> > mlRecentAddedMapPoints;
 
     std::mutex mMutexNewKFs;
+    std::condition_variable mcvNewKFs;  // mlNewKeyFrames에 KeyFrame이 추가되거나 WakeUp()이 호출되면 notify
+    bool mbWakeUp;
 
     bool mbAbortBA;
 
@@ -332,6 +533,7 @@ protected:
     bool mbStopRequested;
     bool mbNotStop;
     std::mutex mMutexStop;
+    std::condition_variable mcvStop;    // mbStopped가 바뀌면 notify
 
     bool mbAcceptKeyFrames;
     std::mutex mMutexAccept;
@@ -352,6 +554,13 @@ protected:
     */
     void ScaleRefinement();
 
+    /* !
+    * @brief bias가 크게 바뀐 KeyFrame의 IMU preintegration을 thread pool에서 병렬로 다시 적분
+    * @param vpKFs 검사할 KeyFrame들, bias 변화가 작으면 1차 근사(bias Jacobian)를 그대로 사용
+    * @return None
+    */
+    void ReintegrateKeyFrames(const vector<KeyFrame*> &vpKFs);
+
     bool bInitializing;
 
     Eigen::MatrixXd infoInertial;
@@ -0,0 +1,69 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LOCALMAPPINGSCHEDULER_H
+#define LOCALMAPPINGSCHEDULER_H
+
+#include <chrono>
+
+namespace ORB_SLAM3
+{
+
+// Decides which of the optional Local Mapping stages (fusion, local BA, keyframe culling) fit in
+// the time left for the current keyframe. With nQueued keyframes waiting, a keyframe gets
+// budget/nQueued ms, so the stages shrink as the queue backs up. The cost of a stage is its
+// measured duration (exponential moving average). With an empty queue everything runs.
+class LocalMappingScheduler
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    enum Stage
+    {
+        SEARCH_IN_NEIGHBORS=0,
+        LOCAL_BA,
+        KEYFRAME_CULLING,
+        NUM_STAGES
+    };
+
+    // fBudget: time (ms) a keyframe may take while another one is waiting
+    LocalMappingScheduler(const float fBudget);
+
+    // Start of the processing of a new keyframe
+    void BeginKeyFrame();
+
+    // Whether the stage fits in what is left of the budget of the current keyframe
+    bool ShouldRun(const Stage stage, const int nQueued) const;
+
+    // Time elapsed since tStart spent in the stage
+    void Record(const Stage stage, const Clock::time_point &tStart);
+
+    double GetStageCost(const Stage stage) const { return mvCost[stage]; }
+
+protected:
+    float mfBudget;
+
+    double mvCost[NUM_STAGES];
+    bool mvbMeasured[NUM_STAGES];
+
+    Clock::time_point mTimeStartKF;
+};
+
+} //namespace ORB_SLAM
+
+#endif // LOCALMAPPINGSCHEDULER_H
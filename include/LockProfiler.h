@@ -0,0 +1,166 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LOCKPROFILER_H
+#define LOCKPROFILER_H
+
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+
+namespace ORB_SLAM3
+{
+
+// Contention statistics of the locks that serialize the SLAM threads. The mutexes are declared
+// with the typedefs at the end of this file, which are plain std::mutex unless the library is
+// built with ORB_SLAM3_LOCK_PROFILING (cmake -DWITH_LOCK_PROFILING=ON). Statistics are kept per
+// kind of lock (all the maps share MAP_UPDATE) and reported through Metrics.
+class LockProfiler
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    enum Lock
+    {
+        MAP_UPDATE=0,
+        ATLAS,
+        KEYFRAME_DATABASE,
+        NUM_LOCKS
+    };
+
+    // Threads are identified by a slot, the last one is shared by the threads that do not fit
+    static const int MAX_THREADS = 16;
+
+    struct HolderSnapshot
+    {
+        std::string thread;
+        unsigned long count;
+        double wait;
+    };
+
+    struct LockSnapshot
+    {
+        std::string name;
+        unsigned long acquisitions;
+        unsigned long contended;
+        // Time blocked in lock() by the contended acquisitions (ms)
+        double waitSum, waitP50, waitP90, waitP99, waitMax;
+        // Time between lock() and unlock() (ms)
+        double holdSum, holdP99, holdMax;
+        // Contended acquisitions and time waited, by the thread that held the lock
+        std::vector<HolderSnapshot> vHolders;
+    };
+
+    // Name of the calling thread in the holder statistics. name must be a string literal
+    static void SetThreadName(const char* name);
+    // Slot of the calling thread, assigned on first use
+    static int ThreadSlot();
+
+    static void RecordAcquisition(const Lock lock);
+    static void RecordWait(const Lock lock, const double ms, const int holder);
+    static void RecordHold(const Lock lock, const double ms);
+
+    static std::vector<LockSnapshot> GetSnapshots();
+    static void Reset();
+
+    static const char* LockName(const Lock lock);
+
+    static inline double ElapsedMs(const Clock::time_point &tStart, const Clock::time_point &tEnd){
+        return std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(tEnd - tStart).count();
+    }
+};
+
+// Drop-in replacement of std::mutex (Lockable) that records its contention under L. The
+// uncontended path costs a try_lock and two clock reads.
+template<LockProfiler::Lock L>
+class ProfiledMutex
+{
+public:
+    ProfiledMutex() : mnHolder(-1) {}
+
+    ProfiledMutex(const ProfiledMutex&) = delete;
+    ProfiledMutex& operator=(const ProfiledMutex&) = delete;
+
+    void lock()
+    {
+        if(!mMutex.try_lock())
+        {
+            const int holder = mnHolder.load(std::memory_order_relaxed);
+            const LockProfiler::Clock::time_point t0 = LockProfiler::Clock::now();
+            mMutex.lock();
+            mtAcquired = LockProfiler::Clock::now();
+            LockProfiler::RecordWait(L, LockProfiler::ElapsedMs(t0, mtAcquired), holder);
+        }
+        else
+            mtAcquired = LockProfiler::Clock::now();
+
+        Acquired();
+    }
+
+    bool try_lock()
+    {
+        if(!mMutex.try_lock())
+            return false;
+        mtAcquired = LockProfiler::Clock::now();
+        Acquired();
+        return true;
+    }
+
+    void unlock()
+    {
+        const double hold = LockProfiler::ElapsedMs(mtAcquired, LockProfiler::Clock::now());
+        mnHolder.store(-1, std::memory_order_relaxed);
+        mMutex.unlock();
+        LockProfiler::RecordHold(L, hold);
+    }
+
+private:
+    void Acquired()
+    {
+        mnHolder.store(LockProfiler::ThreadSlot(), std::memory_order_relaxed);
+        LockProfiler::RecordAcquisition(L);
+    }
+
+    std::mutex mMutex;
+    // Slot of the thread holding the lock, read by the waiters without synchronization
+    std::atomic<int> mnHolder;
+    // Only accessed by the holder
+    LockProfiler::Clock::time_point mtAcquired;
+};
+
+#ifdef ORB_SLAM3_LOCK_PROFILING
+typedef ProfiledMutex<LockProfiler::MAP_UPDATE> MapUpdateMutex;
+typedef ProfiledMutex<LockProfiler::ATLAS> AtlasMutex;
+typedef ProfiledMutex<LockProfiler::KEYFRAME_DATABASE> KeyFrameDatabaseMutex;
+// Condition variable waited with an AtlasMutex lock
+typedef std::condition_variable_any AtlasCondition;
+#define ORB_LOCK_THREAD_NAME(name) ORB_SLAM3::LockProfiler::SetThreadName(name)
+#else
+typedef std::mutex MapUpdateMutex;
+typedef std::mutex AtlasMutex;
+typedef std::mutex KeyFrameDatabaseMutex;
+typedef std::condition_variable AtlasCondition;
+#define ORB_LOCK_THREAD_NAME(name) do{}while(0)
+#endif
+
+} //namespace ORB_SLAM3
+
+#endif // LOCKPROFILER_H
@@ -26,12 +26,15 @@
 #include "ORBVocabulary.h"
 #include "Tracking.h"
 #include "Config.h"
+#include "ThreadScheduling.h"
 
 #include "KeyFrameDatabase.h"
 
 #include <boost/algorithm/string.hpp>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <chrono>
 #include "Thirdparty/g2o/g2o/types/types_seven_dof_expmap.h"
 
 namespace ORB_SLAM3
@@ -41,6 +44,11 @@ class Tracking;
 class LocalMapping;
 class KeyFrameDatabase;
 class Map;
+class ThreadPool;
+class Metrics;
+class ReplayLog;
+class PlaceRecognitionScheduler;
+class PowerGovernor;
 
 
 class LoopClosing
@@ -50,6 +58,9 @@ public:
     typedef pair<set<KeyFrame*>,int> ConsistentGroup;    
     typedef map<KeyFrame*,g2o::Sim3,std::less<KeyFrame*>,
         Eigen::aligned_allocator<std::pair<KeyFrame* const, g2o::Sim3> > > KeyFrameAndPose;
+    // Siw of the anchor of every submap (Map::GetSubmapAnchor), by submap id
+    typedef map<long int,g2o::Sim3,std::less<long int>,
+        Eigen::aligned_allocator<std::pair<const long int, g2o::Sim3> > > SubmapAndPose;
     // aligned_allocator는 STL library와 Eigen을 같이 쓸 때 사용하는 연산자.
     //  map<KeyFrame*, g2o::Sim3>를 Line 51~52와 같이 쓴 것을 알 수 있다.
     // 출처 : https://eigen.tuxfamily.org/dox/group__TopicStlContainers.html
@@ -74,6 +85,54 @@ public:
     */
     void SetLocalMapper(LocalMapping* pLocalMapper);
 
+    /* !
+    * @brief System이 소유한 worker thread pool을 설정하는 함수
+    * @call system::System()
+    * @param pThreadPool 공유 thread pool
+    * @return None
+    */
+    void SetThreadPool(ThreadPool* pThreadPool);
+
+    /* !
+    * @brief System이 소유한 runtime metrics를 설정하는 함수
+    * @call system::System()
+    * @param pMetrics 공유 metrics (loop detection/correction latency, queue 길이)
+    * @return None
+    */
+    void SetMetrics(Metrics* pMetrics);
+
+    /* !
+    * @brief record/replay log를 설정하는 함수
+    * @call system::StartReplay()
+    * @param pReplayLog keyframe 처리와 GBA 완료 시점을 기록하거나 재현
+    * @return None
+    */
+    void SetReplayLog(ReplayLog* pReplayLog);
+
+    /* !
+    * @brief Loop Closing thread와 GBA thread의 CPU affinity와 scheduling 설정 (Thread.LoopClosing.*, Thread.GBA.*)
+    * @call System 생성자, thread 시작 전
+    * @param sched Loop Closing thread, schedGBA 매번 새로 시작되는 GBA thread
+    * @return None
+    */
+    void SetThreadScheduling(const ThreadScheduling &sched, const ThreadScheduling &schedGBA);
+
+    /* !
+    * @brief place recognition query를 keyframe당 시간 안으로 제한하는 scheduler를 설정하는 함수
+    * @call system::System()
+    * @param fKeyFrameBudget keyframe 하나의 query에 허용되는 시간 (ms). Queue가 밀리면 keyframe들을 하나의 query로 합침
+    * @return None
+    */
+    void EnableScheduler(const float fKeyFrameBudget);
+
+    /* !
+    * @brief Low-power mode에서 keyframe들을 모아서 그 중 하나로만 place recognition query를 하도록 설정하는 함수
+    * @call system::System()
+    * @param pGovernor query 간격(stride)과 최대 대기 시간을 정하는 governor (NULL: 모든 keyframe을 query)
+    * @return None
+    */
+    void SetPowerGovernor(PowerGovernor* pGovernor);
+
     // Main function
     void Run();
 
@@ -108,6 +167,15 @@ public:
 
     Viewer* mpViewer;
 
+    // Local Mapping keeps running while the essential graph of a loop or a merge is optimized, and a merge only
+    // stops it for the welding (System settings)
+    bool mbNonBlockingCorrection;
+
+    // Iterations of each round of the GBA (System settings, 0: all at once). After every round the
+    // estimate is published to the map and the next round is built from the map, so it also takes the
+    // keyframes and points that Local Mapping added meanwhile
+    int mnGBARoundIterations;
+
     EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
 #ifdef REGISTER_TIMES
@@ -141,6 +209,31 @@ protected:
     */
     bool CheckNewKeyFrames();
 
+    /* !
+    * @brief Low-power mode에서 queue에 있는 keyframe들을 query할 때가 되었는지 확인
+    *        (stride만큼 모였거나, 가장 오래된 keyframe이 최대 대기 시간을 넘었거나, 공통 영역 검증 중)
+    *        mMutexLoopQueue를 잡은 상태에서 호출
+    * @call  LoopClosing::Run(), LoopClosing::WaitForWork()
+    * @param None
+    * @return bool
+    */
+    bool QueryDue();
+
+    /* !
+    * @brief 새로운 KeyFrame이 들어오거나 reset/finish 요청이 올 때까지 대기 (usleep polling 대신 사용)
+    * @call  LoopClosing::Run()
+    * @param None
+    * @return void
+    */
+    void WaitForWork();
+
+    /* !
+    * @brief WaitForWork()에서 대기 중인 Run()을 깨움. 요청 flag를 설정한 뒤에 호출
+    * @param None
+    * @return void
+    */
+    void WakeUp();
+
 
     //Methods to implement the new place recognition algorithm
     /* !
@@ -163,8 +256,28 @@ protected:
     * @param vpMatchedMPs   Matched된 Map point를 담고 있는 vector (pointer로)
     * @return 추출된 map point의 갯수가 nProjMatchesRep보다 클때 true, 그렇지 않으면 false
     */
+    // Map points searched by FindMatchesByProjection around a matched keyframe (the keyframe, its
+    // best covisibles and theirs). Loop and merge verifications of consecutive keyframes keep the
+    // same matched keyframe, so the region is kept between them and collected again only when
+    // one of its keyframes changed its covisibility (graph version) or its matches.
+    struct ProjectionRegion
+    {
+        ProjectionRegion(): pMatchedKF(static_cast<KeyFrame*>(NULL)), nGraphKFs(0) {}
+
+        KeyFrame* pMatchedKF;
+        // Keyframes of the region, the first nGraphKFs are the ones whose covisibility defines it
+        std::vector<KeyFrame*> vpKFs;
+        size_t nGraphKFs;
+        std::vector<unsigned long> vnGraphVersions;
+        std::vector<unsigned long> vnMatchesVersions;
+        std::vector<MapPoint*> vpMapPoints;
+    };
+
+    // Region of pMatchedKF in region, collected again if stale (bad points are dropped either way)
+    void UpdateProjectionRegion(KeyFrame* pMatchedKF, ProjectionRegion &region);
+
     bool DetectAndReffineSim3FromLastKF(KeyFrame* pCurrentKF, KeyFrame* pMatchedKF, g2o::Sim3 &gScw, int &nNumProjMatches,
-                                        std::vector<MapPoint*> &vpMPs, std::vector<MapPoint*> &vpMatchedMPs);
+                                        std::vector<MapPoint*> &vpMPs, std::vector<MapPoint*> &vpMatchedMPs, ProjectionRegion &region);
 
     bool DetectCommonRegionsFromBoW(std::vector<KeyFrame*> &vpBowCand, KeyFrame* &pMatchedKF, KeyFrame* &pLastCurrentKF, g2o::Sim3 &g2oScw,
                                      int &nNumCoincidences, std::vector<MapPoint*> &vpMPs, std::vector<MapPoint*> &vpMatchedMPs);
@@ -180,7 +293,7 @@ protected:
     * @return boolean
     */
     bool DetectCommonRegionsFromLastKF(KeyFrame* pCurrentKF, KeyFrame* pMatchedKF, g2o::Sim3 &gScw, int &nNumProjMatches,
-                                            std::vector<MapPoint*> &vpMPs, std::vector<MapPoint*> &vpMatchedMPs);
+                                            std::vector<MapPoint*> &vpMPs, std::vector<MapPoint*> &vpMatchedMPs, ProjectionRegion &region);
 
     /* !
     * @brief MatchedKF과 CurrentKF에서 Matched MPs를 이용하여 유효한 MPs의 num을 추출하는 함수.
@@ -190,15 +303,18 @@ protected:
     * @param spMatchedMPinOrigin 쓰이지 않음
     * @param vpMapPoints Map point를 담고 있는 vector (pointer로)
     * @param vpMatchedMapPoints Matched된 Map point를 담고 있는 vector (pointer로)
+    * @param region pMatchedKFw 주변 map point들 (이전 검증에서 모은 것을 재사용)
     * @return 유효한 Map point의 갯수
     */
     int FindMatchesByProjection(KeyFrame* pCurrentKF, KeyFrame* pMatchedKFw, g2o::Sim3 &g2oScw,
                                 set<MapPoint*> &spMatchedMPinOrigin, vector<MapPoint*> &vpMapPoints,
-                                vector<MapPoint*> &vpMatchedMapPoints);
+                                vector<MapPoint*> &vpMatchedMapPoints, ProjectionRegion &region);
 
 
     void SearchAndFuse(const KeyFrameAndPose &CorrectedPosesMap, vector<MapPoint*> &vpMapPoints);
     void SearchAndFuse(const vector<KeyFrame*> &vConectedKFs, vector<MapPoint*> &vpMapPoints);
+    // Fuses the points into every keyframe, seen from the Scw given for it, using the thread pool
+    void SearchAndFuse(const vector<KeyFrame*> &vpKFs, const vector<cv::Mat> &vScw, vector<MapPoint*> &vpMapPoints);
 
     /* !
     * @brief Loop를 Detect 했을 때, 찾을 Loop를 활용하여 Key Frame의 Sim3를 최적화하고, Map point도 최적화
@@ -207,21 +323,83 @@ protected:
     */
     void CorrectLoop();
 
+    /* !
+    * @brief Local Mapping을 멈추지 않고 최적화한 essential graph의 결과를 map에 반영 (non-blocking correction)
+    * @brief 각 Key Frame의 보정량(최적화 전/후 Sim3의 차이)을 현재 pose에 적용하므로, 최적화 도중 Local BA가 수정한 값도 유지됨
+    * @brief 최적화 도중 생성된 Key Frame은 spanning tree상 가장 가까운 조상 Key Frame의 보정량을 따름
+    * @call  CorrectLoop()
+    * @param pMap 보정할 map
+    * @param InitialSim3 최적화 초기값 Siw
+    * @param OptimizedSim3 최적화 결과 Siw
+    * @param b4DoF 4DoF 최적화의 결과인지 (map point는 최적화와 같은 reference keyframe으로 보정)
+    * @return None
+    */
+    void ApplyEssentialGraphCorrection(Map* pMap, const KeyFrameAndPose &InitialSim3, const KeyFrameAndPose &OptimizedSim3, const bool b4DoF);
+
+    /* !
+    * @brief Submap anchor graph의 최적화 결과를 반영. 각 submap은 anchor의 보정량으로 rigid하게 이동
+    * @brief Loop window와 loop 반대편의 submap은 바로 보정하고, 나머지는 mlPendingSubmaps에 넣어 Run()에서 가까운 submap부터 나눠서 보정
+    * @call  CorrectLoop()
+    * @param pMap 보정할 map
+    * @param NonCorrectedSim3, CorrectedSim3 loop window Key Frame의 loop 보정 전/후 Siw
+    * @param InitialSim3 최적화 초기값 (anchor의 Siw)
+    * @param OptimizedSim3 최적화 결과 (anchor의 Siw)
+    * @return None
+    */
+    void ApplySubmapCorrection(Map* pMap, const KeyFrameAndPose &NonCorrectedSim3, const KeyFrameAndPose &CorrectedSim3,
+                               const SubmapAndPose &InitialSim3, const SubmapAndPose &OptimizedSim3);
+
+    /* !
+    * @brief 보정이 남은 submap을 최대 nMax개 (음수이면 전부) 보정. 모두 끝나면 미뤄둔 GBA를 시작
+    * @call  Run(), CorrectLoop(), MergeLocal(), MergeLocal2()
+    */
+    void ApplyPendingSubmaps(const int nMax);
+
+    // Starts the GBA thread on pMap after the loop closed at nLoopKF
+    void LaunchGlobalBundleAdjustment(Map* pMap, unsigned long nLoopKF);
+
+    // Moves a keyframe (Siw*Correction^-1) or a map point (Correction applied to it) with the world similarity Correction
+    static void CorrectKeyFrame(KeyFrame* pKF, const g2o::Sim3 &Correction);
+    static void CorrectMapPoint(MapPoint* pMP, const g2o::Sim3 &Correction);
+
+    // Visual merge. The current map is moved into the merge map with one similarity, applied with the thread pool.
+    // With mbNonBlockingCorrection the welding window is selected and the essential graph optimized while Local
+    // Mapping goes on: it is only stopped to weld the window (fuse and merge BA included) and to apply the
+    // essential graph result (ApplyEssentialGraphCorrection), and Tracking only waits for the welding
     void MergeLocal();
 
     /* !
     * @brief Merge할 부분을 찾았을 때 IMU를 활용해서 Current Map에 있는 정보들(Key Frame, Map point, Essential Graph)을
     * @brief Merge Map에 있는 정보들과 합치고 최적화 
+    * @brief mbNonBlockingCorrection이고 Current Map이 BA1까지 끝났으면 추적 중인 Current Map 대신 Merge Map을 옮기므로,
+    * @brief 그동안 Tracking과 Local Mapping은 멈추지 않음
     * @param None
     * @return None
     */
     void MergeLocal2();
 
+    /* !
+    * @brief 실행 중인 GBA를 중단. 진행 중인 iteration이 끝날 때까지 기다리고 그때까지의 결과는 map에 반영하므로,
+    * @brief 다음 GBA는 처음 상태가 아니라 중단된 GBA가 refine한 map에서 이어서 시작함. Local Mapping은 stop 요청된 상태로 남음
+    * @call  CorrectLoop(), MergeLocal(), MergeLocal2()
+    * @param None
+    * @return GBA가 실행 중이었으면 true
+    */
+    bool StopGBA();
+
+    /* !
+    * @brief GBA 결과 (mTcwGBA, mPosGBA)를 map에 반영. GBA에 포함되지 않은 keyframe과 map point는 spanning tree를 따라 보정
+    * @brief 반영하는 동안 Local Mapping을 stop하고 map을 lock함 (release는 호출하는 쪽에서). bIntermediate이면 다음 round를 위해 map point의 GBA 표시를 지움
+    * @call  RunGlobalBundleAdjustment()
+    */
+    void ApplyGlobalBundleAdjustment(Map* pActiveMap, unsigned long nLoopKF, const bool bIntermediate);
+
     void ResetIfRequested();
     bool mbResetRequested;
     bool mbResetActiveMapRequested;
     Map* mpMapToReset;
     std::mutex mMutexReset;
+    std::condition_variable mcvReset;   // ResetIfRequested()에서 reset이 끝나면 notify
 
     bool CheckFinish();
     void SetFinish();
@@ -233,13 +411,27 @@ protected:
     Tracking* mpTracker;
 
     KeyFrameDatabase* mpKeyFrameDB;
+    // Consecutive place recognition queries share most of their words
+    KeyFrameDatabase::QuerySession mBowSession;
     ORBVocabulary* mpORBVocabulary;
 
     LocalMapping *mpLocalMapper;
 
+    ThreadPool* mpThreadPool;
+    Metrics* mpMetrics;
+    ReplayLog* mpReplayLog;
+    ThreadScheduling mThreadScheduling;
+    ThreadScheduling mGBAThreadScheduling;
+    PlaceRecognitionScheduler* mpScheduler;
+    PowerGovernor* mpPowerGovernor;
+
     std::list<KeyFrame*> mlpLoopKeyFrameQueue;
 
     std::mutex mMutexLoopQueue;
+    std::condition_variable mcvLoopQueue; // mlpLoopKeyFrameQueue에 KeyFrame이 추가되거나 WakeUp()이 호출되면 notify
+    bool mbWakeUp;
+    // When the oldest keyframe of the queue was inserted (low-power mode)
+    std::chrono::steady_clock::time_point mTimeFirstQueued;
 
     // Loop detector parameters
     float mnCovisibilityConsistencyTh;
@@ -268,6 +460,7 @@ protected:
     KeyFrame* mpLoopMatchedKF;
     std::vector<MapPoint*> mvpLoopMPs;
     std::vector<MapPoint*> mvpLoopMatchedMPs;
+    ProjectionRegion mLoopRegion;
     bool mbMergeDetected;
     int mnMergeNumCoincidences;
     int mnMergeNumNotFound;
@@ -278,6 +471,7 @@ protected:
     KeyFrame* mpMergeMatchedKF;
     std::vector<MapPoint*> mvpMergeMPs;
     std::vector<MapPoint*> mvpMergeMatchedMPs;
+    ProjectionRegion mMergeRegion;
     std::vector<KeyFrame*> mvpMergeConnectedKFs;
 
     g2o::Sim3 mSold_new;
@@ -295,6 +489,23 @@ protected:
     // Fix scale in the stereo/RGB-D case
     bool mbFixScale;
 
+    // Submaps still to be moved by the last loop correction (Correction: world similarity, Siw*Correction^-1)
+    // with the handles of their map points, nearest to the loop first. Only used by the Loop Closing thread
+    struct PendingSubmap
+    {
+        Map* pMap;
+        long int nSubmap;
+        g2o::Sim3 Correction;
+        std::vector<EntityHandle> vMapPoints;
+
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    };
+    std::list<PendingSubmap, Eigen::aligned_allocator<PendingSubmap> > mlPendingSubmaps;
+
+    // GBA of the loop, launched once its submaps are all corrected
+    Map* mpDeferredGBAMap;
+    unsigned long mnDeferredGBALoopKF;
+
 
     bool mnFullBAIdx;
 
@@ -51,6 +51,7 @@
 
 #include "MapPoint.h"
 #include "Frame.h"
+#include "RansacSampler.h"
 
 #include<Eigen/Dense>
 #include<Eigen/Sparse>
@@ -58,13 +59,24 @@
 namespace ORB_SLAM3{
     class MLPnPsolver {
     public:
+        // Empty solver, to be set up with Reset
+        MLPnPsolver();
+
         MLPnPsolver(const Frame &F, const vector<MapPoint*> &vpMapPointMatches);
 
         ~MLPnPsolver();
 
+        // Set up the solver for new matches, reusing the buffers of the previous ones (the RANSAC
+        // parameters and sampling strategy go back to their defaults). Once the buffers have grown
+        // to the number of correspondences, the RANSAC iterations do not allocate memory.
+        void Reset(const Frame &F, const vector<MapPoint*> &vpMapPointMatches);
+
         void SetRansacParameters(double probability = 0.99, int minInliers = 8, int maxIterations = 300, int minSet = 6, float epsilon = 0.4,
                                  float th2 = 5.991);
 
+        // Guided (PROSAC) sampling by descriptor distance and/or SPRT evaluation of the hypotheses. Default is uniform.
+        void SetSamplingStrategy(RansacSampler::eSampling sampling, bool bSPRT);
+
         cv::Mat iterate(int nIterations, bool &bNoMore, vector<bool> &vbInliers, int &nInliers);
 
         //Type definitions needed by the original code
@@ -118,10 +130,34 @@ namespace ORB_SLAM3{
         /** A 3-vector describing a translation/camera position */
         typedef Eigen::Vector3d translation_t;
 
+        /** The 2 vectors spanning the tangent space of a bearing vector (its nullspace) */
+        typedef Eigen::Matrix<double,3,2> nullspace_t;
+
+        /** An array of nullspaces */
+        typedef std::vector<nullspace_t, Eigen::aligned_allocator<nullspace_t> >
+                nullspaces_t;
+
+        /** The rodrigues parameters and translation of a pose */
+        typedef Eigen::Matrix<double,6,1> pose_vector_t;
+
+        /** The 2 residuals of an observation in its nullspace, and their jacobian w.r.t. the pose */
+        typedef Eigen::Vector2d residual_t;
+        typedef std::vector<residual_t, Eigen::aligned_allocator<residual_t> >
+                residuals_t;
+        typedef Eigen::Matrix<double,2,6> jacobian_t;
+        typedef std::vector<jacobian_t, Eigen::aligned_allocator<jacobian_t> >
+                jacobians_t;
+
+        /** An array of 2D weight matrices (inverse covariances in the nullspaces) */
+        typedef std::vector<cov2_mat_t, Eigen::aligned_allocator<cov2_mat_t> >
+                cov2_mats_t;
+
 
 
     private:
-        void CheckInliers();
+        // Returns false if bSPRT and the hypothesis was rejected early
+        bool CheckInliers(bool bSPRT = false);
+        void ConfigureSampler();
         bool Refine();
 
         //Functions from de original MLPnP code
@@ -129,7 +165,9 @@ namespace ORB_SLAM3{
         /*
          * Computes the camera pose given 3D points coordinates (in the camera reference
          * system), the camera rays and (optionally) the covariance matrix of those camera rays.
-         * Result is stored in solution
+         * Result is stored in solution. Only the correspondences in indices are used.
+         * The design matrix and the normal equations are fixed-size (accumulated per
+         * correspondence), the per correspondence data goes to the buffers of the solver.
          */
         void computePose(
                 const bearingVectors_t & f,
@@ -138,18 +176,18 @@ namespace ORB_SLAM3{
                 const std::vector<int>& indices,
                 transformation_t & result);
 
-        void mlpnp_gn(Eigen::VectorXd& x,
+        void mlpnp_gn(pose_vector_t& x,
                       const points_t& pts,
-                      const std::vector<Eigen::MatrixXd>& nullspaces,
-                      const Eigen::SparseMatrix<double> Kll,
+                      const nullspaces_t& nullspaces,
+                      const cov2_mats_t& Kll,
                       bool use_cov);
 
         void mlpnp_residuals_and_jacs(
-                const Eigen::VectorXd& x,
+                const pose_vector_t& x,
                 const points_t& pts,
-                const std::vector<Eigen::MatrixXd>& nullspaces,
-                Eigen::VectorXd& r,
-                Eigen::MatrixXd& fjac,
+                const nullspaces_t& nullspaces,
+                residuals_t& r,
+                jacobians_t& fjac,
                 bool getJacs);
 
         void mlpnpJacs(
@@ -158,7 +196,7 @@ namespace ORB_SLAM3{
             const Eigen::Vector3d& nullspace_s,
             const rodrigues_t& w,
             const translation_t& t,
-            Eigen::MatrixXd& jacs);
+            jacobian_t& jacs);
 
         //Auxiliar methods
 
@@ -242,8 +280,29 @@ namespace ORB_SLAM3{
         // Max square error associated with scale level. Max error = th*th*sigma(level)*sigma(level)
         vector<float> mvMaxError;
 
+        // Descriptor distance of each correspondence, used to rank them for PROSAC
+        vector<float> mvQuality;
+
+        // Sampling of the minimal sets and evaluation of the hypotheses
+        RansacSampler mSampler;
+        RansacSampler::eSampling mSampling;
+        bool mbSPRT;
+
         GeometricCamera* mpCamera;
 
+        // Buffers reused from iteration to iteration (and from Reset to Reset): minimal set and
+        // refinement indices, and per correspondence points, nullspaces, weights, residuals and
+        // jacobians of computePose. No covariance information is used by the moment (empty)
+        vector<size_t> mvSample;
+        vector<int> mvMinSetIndices;
+        vector<int> mvRefineIndices;
+        cov3_mats_t mvCovariances;
+        points_t mvPoints3;
+        nullspaces_t mvNullspaces;
+        cov2_mats_t mvWeights;
+        residuals_t mvResiduals;
+        jacobians_t mvJacobians;
+
     };
 
 }
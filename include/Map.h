@@ -22,12 +22,21 @@
 
 #include "MapPoint.h"
 #include "KeyFrame.h"
+#include "ORBVocabulary.h"
+#include "SpatialIndex.h"
+#include "EntityStore.h"
+#include "LockProfiler.h"
+#include "AtlasArchive.h"
 
 #include <set>
 #include <pangolin/pangolin.h>
 #include <mutex>
+#include <atomic>
+#include <memory>
+#include <boost/thread/shared_mutex.hpp>
 
 #include <boost/serialization/base_object.hpp>
+#include <boost/serialization/vector.hpp>
 
 
 namespace ORB_SLAM3
@@ -38,9 +47,37 @@ class KeyFrame;
 class Atlas;
 class KeyFrameDatabase;
 class GeometricCamera;
+class MapEvents;
+class SystemContext;
+struct OptimizerSettings;
 
 class Map
 {
+    friend class boost::serialization::access;
+
+    template<class Archive>
+    void serialize(Archive &ar, const unsigned int version)
+    {
+        ar & mnId;
+        ar & mnInitKFid;
+        ar & mnMaxKFid;
+        ar & mnLastLoopKFid;
+        ar & mnBigChangeIdx;
+
+        // Sets are stored as vectors, origins and initial keyframes as ids. The chunked atlas file
+        // keeps the map points in their own section (SerializeMapPoints)
+        ar & mvpBackupKeyFrames;
+        if(!AtlasArchive::SkeletonScope::Active())
+            ar & mvpBackupMapPoints;
+        ar & mvBackupKeyFrameOriginsId;
+        ar & mnBackupKFinitialID;
+        ar & mnBackupKFlowerID;
+
+        ar & mbImuInitialized;
+        ar & mbIsInertial;
+        ar & mbIMU_BA1;
+        ar & mbIMU_BA2;
+    }
 
 public:
     Map();
@@ -57,8 +94,23 @@ public:
 
     std::vector<KeyFrame*> GetAllKeyFrames();
     std::vector<MapPoint*> GetAllMapPoints();
+
+    // Read-only copies of the keyframes and map points shared by all the callers until the map
+    // gains or loses an element (then the next call builds a new one). Cheaper than GetAll* for
+    // the callers that only iterate: no copy, and the map lock is only held to build the snapshot.
+    typedef std::shared_ptr<const std::vector<KeyFrame*> > KeyFramesSnapshot;
+    typedef std::shared_ptr<const std::vector<MapPoint*> > MapPointsSnapshot;
+    KeyFramesSnapshot GetKeyFramesSnapshot();
+    MapPointsSnapshot GetMapPointsSnapshot();
     std::vector<MapPoint*> GetReferenceMapPoints();
 
+    // Adds the memory of the keyframes and map points of the map to usage
+    void AccumulateMemory(MemoryUsage &usage);
+
+    // Handle lookups, NULL if the entity has been erased from the map (or never belonged to it)
+    KeyFrame* GetKeyFrame(const EntityHandle &h);
+    MapPoint* GetMapPoint(const EntityHandle &h);
+
     long unsigned int MapPointsInMap();
     long unsigned  KeyFramesInMap();
 
@@ -101,14 +153,100 @@ public:
 
     void PrintEssentialGraph();
     bool CheckEssentialGraph();
+
+    // Edges of the essential graph that a keyframe contributes towards older keyframes (lower id).
+    // Covisibles excludes the parent, children and loop edges and keeps the ones with weight >= nMinFeat.
+    // bParentCovisible tells whether the parent would have been kept, for graphs without tree edges.
+    struct EssentialEdges
+    {
+        KeyFrame* pParent;
+        bool bParentCovisible;
+        std::vector<KeyFrame*> vpLoopEdges;
+        std::vector<KeyFrame*> vpCovisibles;
+    };
+
+    // Edges of the given keyframes, scanned from the keyframe graph below
+    void GetEssentialGraph(const int nMinFeat, const std::vector<KeyFrame*> &vpKFs, std::vector<EssentialEdges> &vEdges);
+
+    // Compact adjacency of the keyframes of the map for bulk traversals (essential graph, loop
+    // correction), instead of the sets and maps of every keyframe under their mutexes. Keyframes by
+    // increasing id; links as indices into them, in CSR arrays (row i in [vXBegin[i], vXBegin[i+1])):
+    // parent in the spanning tree (-1: root), children, loop edges, and covisibles by decreasing
+    // weight with their weights. Links to keyframes out of the graph are dropped. Never modified
+    // once returned.
+    struct KeyFrameGraph
+    {
+        std::vector<KeyFrame*> vpKeyFrames;
+        std::vector<long unsigned int> vnIds;
+        // KeyFrame::GetGraphVersion() of every keyframe, read before its rows
+        std::vector<unsigned long> vnVersions;
+        std::vector<int> vParent;
+        std::vector<int> vChildBegin, vChildren;
+        std::vector<int> vLoopBegin, vLoopEdges;
+        std::vector<int> vCovBegin, vCovisibles, vCovWeights;
+
+        int size() const { return vpKeyFrames.size(); }
+        // Index of the keyframe, -1 if it is not in the graph
+        int Index(const KeyFrame* pKF) const;
+    };
+    typedef std::shared_ptr<const KeyFrameGraph> KeyFrameGraphSnapshot;
+
+    // Shared by all the callers until a keyframe is added or erased or changes its links. The next
+    // call then rebuilds it, reading again only the rows of the keyframes whose graph version
+    // changed and copying the others from the previous one.
+    KeyFrameGraphSnapshot GetKeyFrameGraph();
+
+    // Submaps: runs of KeyFramesPerSubmap consecutive keyframes, each one represented by its anchor
+    // (first keyframe of the submap still in the map). Loop corrections optimize the graph of the
+    // anchors and then move every submap rigidly (System settings, 0: no submaps)
+    int GetKeyFramesPerSubmap();
+    int NumSubmaps();
+    std::vector<KeyFrame*> GetSubmapKeyFrames(const long int nSubmap);
+    KeyFrame* GetSubmapAnchor(const long int nSubmap);
+
+    // Spatial index over the map point positions and the keyframe camera centers. It follows
+    // AddMapPoint/EraseMapPoint, AddKeyFrame/EraseKeyFrame, MapPoint::SetWorldPos and KeyFrame::SetPose
+    // (reported here, also forwarded to the map events).
+    void UpdateMapPointPosition(MapPoint* pMP, const cv::Matx31f &pos);
+    void UpdateKeyFramePosition(KeyFrame* pKF);
+    std::vector<MapPoint*> GetMapPointsInRadius(const cv::Matx31f &center, const float r);
+    // Points in front of the camera Tcw, closer than maxDepth and projecting inside the given image bounds
+    std::vector<MapPoint*> GetMapPointsInFrustum(const cv::Matx44f &Tcw, GeometricCamera* pCamera, const float minX, const float maxX,
+                                                 const float minY, const float maxY, const float maxDepth);
+    // Removes from vpMPs the points whose cell none of the cameras can see
+    void FilterMapPointsInFrustum(const std::vector<SpatialIndex<MapPoint>::Frustum> &vFrustums, std::vector<MapPoint*> &vpMPs);
+    std::vector<KeyFrame*> GetKeyFramesInRadius(const cv::Matx31f &center, const float r);
     void ChangeId(long unsigned int nId);
 
+    // Receives every change of the keyframes and map points of the map (set by the Atlas)
+    void SetMapEvents(MapEvents* pEvents);
+
+    // Settings of the System the map belongs to (set by the Atlas, defaults while there is none)
+    void SetSystemContext(SystemContext* pContext);
+    const OptimizerSettings& GetOptimizerSettings();
+    int GetMaxDescriptorObservations();
+    int GetReclaimGracePeriod();
+
     unsigned int GetLowerKFID();
 
+    // Serialization. PreSave collects the cameras used by the keyframes of the map,
+    // PostLoad restores every pointer and attaches the keyframes to the database and vocabulary.
+    void PreSave(std::set<GeometricCamera*> &spCams);
+    void PostLoad(KeyFrameDatabase* pKFDB, ORBVocabulary* pORBVoc, std::map<unsigned int, GeometricCamera*> &mpCams);
+
+    // Elements stored by PreSave or loaded before PostLoad, for the sections of the chunked atlas file
+    const std::vector<KeyFrame*>& GetBackupKeyFrames() const { return mvpBackupKeyFrames; }
+    const std::vector<MapPoint*>& GetBackupMapPoints() const { return mvpBackupMapPoints; }
+    template<class Archive>
+    void SerializeMapPoints(Archive& ar)
+    {
+        ar & mvpBackupMapPoints;
+    }
+
     vector<KeyFrame*> mvpKeyFrameOrigins;
     vector<unsigned long int> mvBackupKeyFrameOriginsId;
     KeyFrame* mpFirstRegionKF;
-    std::mutex mMutexMapUpdate;
+    MapUpdateMutex mMutexMapUpdate;
 
     // This avoid that two points are created simultaneously in separate threads (id conflict)
     std::mutex mMutexPointCreation;
@@ -119,14 +257,22 @@ public:
     static const int THUMB_WIDTH = 512;
     static const int THUMB_HEIGHT = 512;
 
-    static long unsigned int nNextId;
+    // Process-wide, ids only have to be unique (shared by all the Systems)
+    static std::atomic<long unsigned int> nNextId;
 
 protected:
 
     long unsigned int mnId;
 
-    std::set<MapPoint*> mspMapPoints;
-    std::set<KeyFrame*> mspKeyFrames;
+    // Keyframes and map points of the map, iterated in insertion order and reachable through their handles
+    EntityStore<MapPoint> mMapPoints;
+    EntityStore<KeyFrame> mKeyFrames;
+
+    // Only used while the map is being saved or loaded
+    std::vector<MapPoint*> mvpBackupMapPoints;
+    std::vector<KeyFrame*> mvpBackupKeyFrames;
+    long long int mnBackupKFinitialID;
+    long long int mnBackupKFlowerID;
 
     KeyFrame* mpKFinitial;
     KeyFrame* mpKFlowerID;
@@ -157,7 +303,38 @@ protected:
     bool mbIMU_BA1;
     bool mbIMU_BA2;
 
-    std::mutex mMutexMap;
+    // Reader-writer lock: the getters only take it shared
+    boost::shared_mutex mMutexMap;
+
+    // Last snapshots and the store versions they were built from, never serialized
+    KeyFramesSnapshot mpKeyFramesSnapshot;
+    MapPointsSnapshot mpMapPointsSnapshot;
+    uint64_t mnKeyFramesSnapshotVersion;
+    uint64_t mnMapPointsSnapshotVersion;
+    std::mutex mMutexSnapshots;
+
+    // Last keyframe graph, never serialized (rebuilt on the first query after loading).
+    // The mutex also serializes the rebuilds.
+    KeyFrameGraphSnapshot mpKeyFrameGraph;
+    std::mutex mMutexKeyFrameGraph;
+
+    // Keyframes of every submap in insertion order, not serialized (filled again by PostLoad)
+    void AddToSubmap(KeyFrame* pKF);
+    std::vector<std::vector<KeyFrame*> > mvvpSubmapKeyFrames;
+    std::mutex mMutexSubmaps;
+
+    // Not serialized either, filled again by PostLoad
+    SpatialIndex<MapPoint> mMapPointIndex;
+    SpatialIndex<KeyFrame> mKeyFrameIndex;
+    boost::shared_mutex mMutexSpatialIndex;
+
+    // Orders the added and moved events of an entity with the position they carry
+    std::mutex mMutexPositionEvents;
+
+    // Owned by the System, not serialized (set again by the Atlas)
+    MapEvents* mpEvents;
+    SystemContext* mpContext;
+    const SystemContext& Context();
 };
 
 } //namespace ORB_SLAM3
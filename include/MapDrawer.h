@@ -26,6 +26,7 @@
 #include<pangolin/pangolin.h>
 
 #include<mutex>
+#include<unordered_map>
 
 namespace ORB_SLAM3
 {
@@ -49,6 +50,31 @@ private:
 
     bool ParseViewerParamFile(cv::FileStorage &fSettings);
 
+    // Immediate mode frustum of a keyframe (first keyframes of a map and keyframes of other maps)
+    void DrawKeyFrameFrustum(KeyFrame* pKF);
+
+    // The points, keyframes and graph of the current map are kept in vertex buffers (viewer thread
+    // only). They are refreshed when the map, its change index (Map::GetMapChangeIndex) or its number
+    // of points/keyframes changes, instead of being copied and sent to the GPU every render frame.
+    // For the points only the slots whose position changed are uploaded.
+    void UpdatePointsBuffer(Map* pMap);
+    void UpdateKeyFramesBuffer(Map* pMap);
+
+    Map* mpPointsMap;
+    int mnPointsChange;
+    long unsigned int mnPoints;
+    std::unordered_map<MapPoint*,size_t> mmPointSlots;
+    std::vector<MapPoint*> mvpSlotPoints;
+    std::vector<float> mvSlotPos;
+    pangolin::GlBuffer mPointsVbo;
+
+    Map* mpKeyFramesMap;
+    int mnKeyFramesChange;
+    long unsigned int mnKeyFrames;
+    std::vector<KeyFrame*> mvpFirstKFs;
+    std::vector<float> mvFrustumPos, mvFrustumColor, mvGraphPos, mvInertialPos;
+    pangolin::GlBuffer mFrustumVbo, mFrustumColorVbo, mGraphVbo, mInertialVbo;
+
     float mKeyFrameSize;
     float mKeyFrameLineWidth;
     float mGraphLineWidth;
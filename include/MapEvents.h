@@ -0,0 +1,151 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MAPEVENTS_H
+#define MAPEVENTS_H
+
+#include <opencv2/core/core.hpp>
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace ORB_SLAM3
+{
+
+class Atlas;
+class Map;
+
+// Incremental changes of the maps for the subscribers of System::SubscribeMapEvents, so that they
+// can follow the map without polling MapChanged() and copying it. The maps report every change of
+// their keyframes and map points as it happens (only while someone is subscribed); the changes are
+// merged per element (a point moved by every local BA is sent once, with its last position) and
+// published in one batch when a SLAM thread finishes a unit of work: a keyframe in Local Mapping,
+// a loop correction, a map merge, a global BA update or a reset.
+// Ids are unique across maps, every update carries the map the element is in, so an element
+// that changed map (merge) comes as an update of its map id, not as a removal.
+class MapEvents
+{
+public:
+    // Work that published the batch. The batch also carries what other threads changed meanwhile
+    enum Cause
+    {
+        SNAPSHOT=0,     // first batch of a subscriber: the whole atlas
+        LOCAL_MAPPING,
+        LOOP_CORRECTION,
+        MAP_MERGE,
+        GLOBAL_BA,
+        RESET
+    };
+
+    struct PointUpdate
+    {
+        long unsigned int nId;
+        long unsigned int nMapId;
+        cv::Matx31f pos;
+    };
+
+    struct KeyFrameUpdate
+    {
+        long unsigned int nId;
+        long unsigned int nMapId;
+        cv::Matx44f Tcw;
+    };
+
+    struct MapMerge
+    {
+        long unsigned int nMergedMapId;     // map removed by the merge
+        long unsigned int nIntoMapId;       // map that has its elements now
+    };
+
+    struct Batch
+    {
+        unsigned long int nSeq;
+        Cause cause;
+        // Added and moved are both new positions, an element may be reported as added again after a
+        // merge or a reset
+        std::vector<PointUpdate> vPointsAdded;
+        std::vector<PointUpdate> vPointsMoved;
+        std::vector<long unsigned int> vPointsRemoved;
+        std::vector<KeyFrameUpdate> vKeyFramesAdded;
+        std::vector<KeyFrameUpdate> vKeyFramesMoved;
+        std::vector<long unsigned int> vKeyFramesRemoved;
+        std::vector<MapMerge> vMerges;
+        // Maps emptied by a reset or removed after a merge: everything they had is gone. Applied
+        // before the updates of the batch
+        std::vector<long unsigned int> vMapsCleared;
+
+        bool empty() const;
+    };
+
+    // Runs on the SLAM thread that publishes the batch (one batch at a time): it should copy what it
+    // needs and return. It must not subscribe or unsubscribe
+    typedef std::function<void(const Batch&)> Callback;
+
+    MapEvents();
+
+    // With pAtlas, the first batch given to the callback (before returning) is a snapshot of all the maps
+    int Subscribe(const Callback &callback, Atlas* pAtlas = static_cast<Atlas*>(NULL));
+    void Unsubscribe(const int nId);
+
+    // Changes are only collected while there are subscribers
+    inline bool IsActive() const { return mbActive.load(std::memory_order_relaxed); }
+
+    // Reported by the maps
+    void PointAdded(const long unsigned int nId, const long unsigned int nMapId, const cv::Matx31f &pos);
+    void PointMoved(const long unsigned int nId, const long unsigned int nMapId, const cv::Matx31f &pos);
+    void PointRemoved(const long unsigned int nId, const long unsigned int nMapId);
+    void KeyFrameAdded(const long unsigned int nId, const long unsigned int nMapId, const cv::Matx44f &Tcw);
+    void KeyFrameMoved(const long unsigned int nId, const long unsigned int nMapId, const cv::Matx44f &Tcw);
+    void KeyFrameRemoved(const long unsigned int nId, const long unsigned int nMapId);
+    void MapCleared(const long unsigned int nMapId);
+    // Reported by Loop Closing
+    void MapMerged(const long unsigned int nMergedMapId, const long unsigned int nIntoMapId);
+
+    // Sends the changes collected so far, if any, to the subscribers
+    void Publish(const Cause cause);
+
+protected:
+    static void AppendMap(Map* pMap, Batch &batch);
+
+    std::atomic<bool> mbActive;
+
+    // Changes since the last batch, by element id
+    std::mutex mMutexPending;
+    std::unordered_map<long unsigned int, PointUpdate> mmPointsAdded;
+    std::unordered_map<long unsigned int, PointUpdate> mmPointsMoved;
+    std::unordered_set<long unsigned int> msPointsRemoved;
+    std::unordered_map<long unsigned int, KeyFrameUpdate> mmKeyFramesAdded;
+    std::unordered_map<long unsigned int, KeyFrameUpdate> mmKeyFramesMoved;
+    std::unordered_set<long unsigned int> msKeyFramesRemoved;
+    std::vector<MapMerge> mvMerges;
+    std::vector<long unsigned int> mvMapsCleared;
+
+    // Held while a batch is delivered, so that the subscribers get the batches in order
+    std::mutex mMutexPublish;
+    std::vector<std::pair<int, Callback> > mvSubscribers;
+    int mnNextSubscriber;
+    unsigned long int mnSeq;
+};
+
+} //namespace ORB_SLAM3
+
+#endif // MAPEVENTS_H
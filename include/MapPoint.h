@@ -23,14 +23,27 @@
 #include"KeyFrame.h"
 #include"Frame.h"
 #include"Map.h"
+#include"MemoryUsage.h"
 
 #include<opencv2/core/core.hpp>
 #include<mutex>
+#include<atomic>
+#include<vector>
+#include<set>
+#include<tuple>
+#include<stdint.h>
+#include <boost/thread/shared_mutex.hpp>
 
 #include <boost/serialization/serialization.hpp>
 #include <boost/serialization/array.hpp>
 #include <boost/serialization/map.hpp>
 
+#include "SerializationUtils.h"
+#include "FlatMap.h"
+#include "EntityStore.h"
+#include "LockProfiler.h"
+#include "AtlasArchive.h"
+
 namespace ORB_SLAM3
 {
 
@@ -38,18 +51,70 @@ class KeyFrame;
 class Map;
 class Frame;
 
+// Keyframes observing a map point and the (left, right) keypoint index in each of them
+typedef FlatMap<KeyFrame*,std::tuple<int,int> > ObservationMap;
+
 class MapPoint
 {
+    friend class boost::serialization::access;
+
+    template<class Archive>
+    void serialize(Archive & ar, const unsigned int version)
+    {
+        ar & mnId;
+        ar & mnFirstKFid;
+        ar & mnFirstFrame;
+        ar & nObs;
+        ar & mnOriginMapId;
+
+        ar & mWorldPosx;
+        ar & mNormalVectorx;
+        ar & mDescriptor;
+
+        // Pointers are stored as ids and restored in PostLoad. The chunked atlas file keeps the
+        // observations in their own section (SerializeObservations)
+        if(!AtlasArchive::SkeletonScope::Active())
+        {
+            ar & mBackupObservationsId1;
+            ar & mBackupObservationsId2;
+        }
+        ar & mBackupRefKFId;
+        ar & mBackupHostKFId;
+
+        ar & mnVisible;
+        ar & mnFound;
+        ar & mfMinDistance;
+        ar & mfMaxDistance;
+
+        ar & mInvDepth;
+        ar & mInitU;
+        ar & mInitV;
+    }
 
 public:
+    // Section of the chunked atlas file with the observation ids of PreSave (see Atlas::AddSections)
+    template<class Archive>
+    void SerializeObservations(Archive& ar)
+    {
+        ar & mBackupObservationsId1;
+        ar & mBackupObservationsId2;
+    }
+
     MapPoint();
 
     MapPoint(const cv::Mat &Pos, KeyFrame* pRefKF, Map* pMap);
     MapPoint(const double invDepth, cv::Point2f uv_init, KeyFrame* pRefKF, KeyFrame* pHostKF, Map* pMap);
     MapPoint(const cv::Mat &Pos,  Map* pMap, Frame* pFrame, const int &idxF);
 
+    // Storage comes from ObjectPool<MapPoint>
+    static void* operator new(size_t size);
+    static void operator delete(void* p, size_t size);
+
+    // Position and normal are stored in fixed-size vectors, the cv::Mat versions copy from them
     void SetWorldPos(const cv::Mat &Pos);
+    void SetWorldPos2(const cv::Matx31f &Pos);
 
+    // Optimistic reads, they do not block on position updates of this or any other point
     cv::Mat GetWorldPos();
 
     cv::Mat GetNormal();
@@ -58,9 +123,26 @@ public:
 
     cv::Matx31f GetNormal2();
 
+    // Position, normal and scale invariance distances read under a single lock
+    void GetViewingGeometry(cv::Matx31f &Pos, cv::Matx31f &Normal, float &minDistance, float &maxDistance);
+
+    // Bumped after every change of the position, normal, scale invariance distances or descriptor.
+    // Read it before the data: a copy taken with this version is stale as soon as it differs.
+    unsigned int GetViewVersion() const { return mnViewVersion.load(std::memory_order_acquire); }
+
     KeyFrame* GetReferenceKeyFrame();
 
-    std::map<KeyFrame*,std::tuple<int,int>> GetObservations();
+    ObservationMap GetObservations();
+
+    // Calls f(pKF, indexes) for every observation under the feature lock, without copying them.
+    // f must not call back into this map point
+    template<class F>
+    void VisitObservations(F f)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(mMutexFeatures);
+        for(ObservationMap::const_iterator mit=mObservations.begin(), mend=mObservations.end(); mit!=mend; mit++)
+            f(mit->first, mit->second);
+    }
     int Observations();
 
     void AddObservation(KeyFrame* pKF,int idx);
@@ -82,13 +164,26 @@ public:
         return mnFound;
     }
 
+    // Descriptor with the least median distance to the other observed descriptors. Distances are
+    // cached between calls, so only observations added since the last call are compared (O(n) each,
+    // plus the O(n^2) eviction of the farthest sample once Map::GetMaxDescriptorObservations is reached)
     void ComputeDistinctiveDescriptors();
 
     cv::Mat GetDescriptor();
 
+    // Adds the memory of the point to usage (point and descriptors)
+    void AccumulateMemory(MemoryUsage &usage);
+
+    // Mean viewing direction and scale invariance distances. While the point does not move and no
+    // observation is erased, only the observations added since the last call are integrated
     void UpdateNormalAndDepth();
     void SetNormalVector(cv::Mat& normal);
 
+    // Normal, scale invariance distances and descriptor from the observation idxF of a frame with
+    // a pose, without locking: only for a point that no other thread can reach yet. For a point
+    // with that single observation it gives what UpdateNormalAndDepth and ComputeDistinctiveDescriptors do.
+    void InitFromObservation(Frame* pFrame, const int &idxF);
+
     float GetMinDistanceInvariance();
     float GetMaxDistanceInvariance();
     int PredictScale(const float &currentDist, KeyFrame*pKF);
@@ -97,9 +192,19 @@ public:
     Map* GetMap();
     void UpdateMap(Map* pMap);
 
+    // Serialization: pointers are translated to ids before saving and back after loading.
+    // Observations of keyframes outside spKF are dropped.
+    void PreSave(std::set<KeyFrame*>& spKF, std::set<MapPoint*>& spMP);
+    void PostLoad(std::map<long unsigned int, KeyFrame*>& mpKFid, std::map<long unsigned int, MapPoint*>& mpMPid);
+
+    // Handle of the map point in the entity store of its map, set by Map::AddMapPoint
+    EntityHandle GetHandle() const { return EntityHandle::Unpack(mnHandle); }
+    void SetHandle(const EntityHandle &h) { mnHandle = h.Pack(); }
+
 public:
     long unsigned int mnId;
-    static long unsigned int nNextId;
+    // Process-wide, ids only have to be unique (shared by all the Systems)
+    static std::atomic<long unsigned int> nNextId;
     long int mnFirstKFid;
     long int mnFirstFrame;
     int nObs;
@@ -116,6 +221,8 @@ public:
     float mTrackViewCos, mTrackViewCosR;
     long unsigned int mnTrackReferenceForFrame;
     long unsigned int mnLastFrameSeen;
+    // Index in the LocalMapMirror of the tracking (checked against the mirror, -1 if never mirrored)
+    int mnTrackMirrorIndex;
 
     // Variables used by local mapping
     long unsigned int mnBALocalForKF;
@@ -140,26 +247,57 @@ public:
     double mInitV;
     KeyFrame* mpHostKF;
 
-    static std::mutex mGlobalMutex;
-
     unsigned int mnOriginMapId;
 
 protected:    
 
-     // Position in absolute coordinates
-     cv::Mat mWorldPos;
+     // Position in absolute coordinates. Writers hold mMutexPos and bump mnPosVersion to an odd value
+     // while writing, GetWorldPos reads without locking and retries if the version changed
      cv::Matx31f mWorldPosx;
+     std::atomic<unsigned int> mnPosVersion{0};
+
+     // See GetViewVersion
+     std::atomic<unsigned int> mnViewVersion{0};
+
+     // Written by the maps that hold the point, possibly two of them during a merge
+     std::atomic<uint64_t> mnHandle{0};
 
      // Keyframes observing the point and associated index in keyframe
-     std::map<KeyFrame*,std::tuple<int,int> > mObservations;
+     ObservationMap mObservations;
 
      // Mean viewing direction
-     cv::Mat mNormalVector;
      cv::Matx31f mNormalVectorx;
 
      // Best descriptor to fast matching
      cv::Mat mDescriptor;
 
+     // Observed descriptors taken into account for mDescriptor and their distances to each other
+     // (vDists[j] is the distance to the j-th sample, 0 for itself)
+     struct DescriptorSample
+     {
+         KeyFrame* pKF;
+         int idx;
+         cv::Mat descriptor;
+         std::vector<uint16_t> vDists;
+     };
+     std::vector<DescriptorSample> mvDescriptorSamples;
+     // Observations evicted over the max number of samples, not sampled again while they are observed
+     std::set<std::pair<KeyFrame*,int> > msDescriptorEvicted;
+     std::mutex mMutexDescriptorSamples;
+
+     // Erases the i-th sample and its distance from the others (mMutexDescriptorSamples held)
+     void EraseDescriptorSample(const size_t i);
+     static int MedianDistance(const std::vector<uint16_t> &vDists, std::vector<uint16_t> &vTmp);
+
+     // Sum of the unit viewing rays integrated into mNormalVector, observations (keyframe, right camera)
+     // added since the last UpdateNormalAndDepth, and a counter bumped whenever the sum becomes stale
+     cv::Matx31f mNormalSum;
+     int mnNormalSum;
+     bool mbNormalSumValid;
+     unsigned long mnNormalVersion;
+     std::vector<std::pair<KeyFrame*,bool> > mvPendingNormalObs;
+     std::mutex mMutexNormalSum;
+
      // Reference KeyFrame
      KeyFrame* mpRefKF;
 
@@ -177,8 +315,15 @@ protected:
 
      Map* mpMap;
 
-     std::mutex mMutexPos;
-     std::mutex mMutexFeatures;
+     // Ids used only while the map point is being saved or loaded
+     std::map<long unsigned int, int> mBackupObservationsId1;
+     std::map<long unsigned int, int> mBackupObservationsId2;
+     long long int mBackupRefKFId;
+     long long int mBackupHostKFId;
+
+     // Reader-writer locks: the getters only take them shared
+     boost::shared_mutex mMutexPos;
+     boost::shared_mutex mMutexFeatures;
      std::mutex mMutexMap;
 };
 
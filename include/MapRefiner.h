@@ -0,0 +1,66 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MAPREFINER_H
+#define MAPREFINER_H
+
+namespace ORB_SLAM3
+{
+
+class Map;
+class LocalMapping;
+class ThreadPool;
+
+// Offline refinement of a map (see Examples/Tools/map_refine): duplicated map points of covisible
+// keyframes are fused, redundant keyframes (visual maps only, inertial maps keep their IMU chain)
+// and points left with less than two observations are culled, and the map goes through a global
+// BA (full inertial BA once the IMU is initialized) with many more iterations than online.
+// Nothing else may use the map meanwhile.
+class MapRefiner
+{
+public:
+    struct Stats
+    {
+        int nFused;
+        int nCulledKeyFrames;
+        int nCulledMapPoints;
+    };
+
+    // pLocalMapper provides the keyframe redundancy test of the online culling
+    MapRefiner(LocalMapping* pLocalMapper, ThreadPool* pThreadPool, const int nBAIterations);
+
+    Stats Refine(Map* pMap, const bool bFuse, const bool bCullKeyFrames);
+
+protected:
+    // Fusion of the points of the 20 best covisible keyframes of every keyframe into it
+    int FuseMapPoints(Map* pMap);
+    int CullKeyFrames(Map* pMap);
+    int CullMapPoints(Map* pMap);
+    void GlobalBundleAdjustment(Map* pMap);
+
+    // Descriptors, normals and depths of all the points, and covisibility of all the keyframes
+    void UpdateMap(Map* pMap, const bool bDescriptors);
+
+    LocalMapping* mpLocalMapper;
+    ThreadPool* mpThreadPool;
+    int mnBAIterations;
+};
+
+} //namespace ORB_SLAM
+
+#endif // MAPREFINER_H
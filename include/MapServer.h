@@ -0,0 +1,148 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MAPSERVER_H
+#define MAPSERVER_H
+
+#include "KeyFrameWire.h"
+#include "ORBVocabulary.h"
+#include "Thirdparty/DBoW2/DBoW2/BowVector.h"
+#include "Thirdparty/DBoW2/DBoW2/FeatureVector.h"
+
+#include <opencv2/core/core.hpp>
+
+#include <deque>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace ORB_SLAM3
+{
+
+// Server shared by several agents (robots running their own System with Agent.ServerHost set).
+// Every agent sends its keyframes once Local Mapping is done with them (see AgentClient), the
+// server keeps the keyframes of all agents in one place recognition database and looks for the
+// places seen by two agents: BoW candidates of the other agents are verified with a Sim3 RANSAC
+// on the matched map points, with the poses and positions of the last map updates of the
+// agents. When the maps of two agents overlap, both are sent the Sim3 between them ('A' message
+// of KeyFrameWire), once per pair of maps.
+// Tracking, Local Mapping and Loop Closing still run on each agent, on its own maps.
+class MapServer
+{
+public:
+    MapServer(ORBVocabulary* pVoc, const int port, const int nMinInliers = 20);
+    ~MapServer();
+
+    // Main thread function
+    void Run();
+
+    void RequestFinish();
+    bool isFinished();
+
+    // S12 maps points of map 2 (of agent 2) into map 1 (of agent 1)
+    struct Alignment
+    {
+        unsigned int nAgent1;
+        unsigned long long nMap1;
+        unsigned int nAgent2;
+        unsigned long long nMap2;
+        int nInliers;
+        float s;
+        cv::Mat R;
+        cv::Mat t;
+    };
+    std::vector<Alignment> GetAlignments();
+
+    size_t KeyFramesInServer();
+
+protected:
+    struct ServerKeyFrame
+    {
+        KeyFrameMessage msg;
+        DBoW2::BowVector mBowVec;
+        DBoW2::FeatureVector mFeatVec;
+
+        // Place recognition query in which the keyframe was last seen, and shared words
+        unsigned long int mnQuery;
+        int mnWords;
+    };
+
+    // Current keyframe poses and map point positions of an agent (references of the map updates)
+    struct AgentState
+    {
+        MapUpdateState references;
+        std::unordered_map<unsigned long long, ServerKeyFrame*> mKeyFrames;
+    };
+
+    struct Connection
+    {
+        int socket;
+        int nAgentId;   // -1 until the hello message
+        std::vector<char> vBuffer;
+    };
+
+    bool Listen();
+    void AcceptClient();
+    // False if the connection was closed or sent a malformed message
+    bool Receive(Connection &connection);
+    void CloseConnection(Connection &connection);
+    bool Send(const int socket, const std::vector<char> &buffer);
+
+    void ProcessMessage(Connection &connection, const char type, const char* data, const size_t size);
+
+    // Adds the keyframe to the database and aligns it with the places seen by the other agents
+    void ProcessKeyFrame(const KeyFrameMessage &msg);
+    // Moves the keyframes and map points of the agent
+    void ProcessMapUpdate(const unsigned int nAgentId, const char* data, const size_t size);
+    // Best BoW candidates among the keyframes of the other agents whose maps are not aligned yet
+    std::vector<ServerKeyFrame*> DetectCandidates(ServerKeyFrame* pKF);
+    // Sim3 RANSAC on the map points of the BoW matches, S12 maps pKF2 map into pKF1 map
+    bool ComputeAlignment(ServerKeyFrame* pKF1, ServerKeyFrame* pKF2, Alignment &alignment);
+    bool IsAligned(const unsigned int nAgent1, const unsigned long long nMap1, const unsigned int nAgent2, const unsigned long long nMap2);
+    void Notify(const Alignment &alignment);
+
+    bool CheckFinish();
+    void SetFinish();
+
+    ORBVocabulary* mpVocabulary;
+    int mnPort;
+    int mnMinInliers;
+
+    int mListenSocket;
+    std::vector<Connection> mvConnections;
+
+    // Keyframes of all the agents and inverted file (word id -> keyframes)
+    std::deque<ServerKeyFrame> mdKeyFrames;
+    std::vector<std::vector<ServerKeyFrame*> > mvInvertedFile;
+    unsigned long int mnQuery;
+
+    std::map<unsigned int, AgentState> mmAgents;
+
+    std::mutex mMutexAlignments;
+    std::vector<Alignment> mvAlignments;
+    size_t mnKeyFrames;
+
+    std::mutex mMutexFinish;
+    bool mbFinishRequested;
+    bool mbFinished;
+};
+
+} //namespace ORB_SLAM3
+
+#endif // MAPSERVER_H
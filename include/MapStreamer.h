@@ -0,0 +1,107 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MAPSTREAMER_H
+#define MAPSTREAMER_H
+
+#include <opencv2/core/core.hpp>
+
+#include <array>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace ORB_SLAM3
+{
+
+class Atlas;
+class Map;
+
+// Compact stream of the current map for a remote viewer, enabled with Viewer.StreamPort when the
+// system runs without the local viewer. One TCP client is served at a time. At Viewer.StreamFPS
+// it receives what changed since the previous update (everything after connecting or when the
+// current map changes):
+//   'C'  current camera pose             count=1, 12 floats (Tcw, 3x4 row major)
+//   'K'  keyframes whose pose changed    count=n, n x (uint64 id, 12 floats Tcw)
+//   'P'  new or moved map points         count=n, n x (uint64 id, 3 floats world position)
+//   'M'  current map changed             count=1, uint64 map id (the client drops what it has)
+// Each message is a char type followed by a uint32 count, all in host byte order.
+class MapStreamer
+{
+public:
+    MapStreamer(Atlas* pAtlas, const int port, const float fps);
+
+    // Main thread function
+    void Run();
+
+    // Called by Tracking with the pose of every tracked frame
+    void SetCurrentCameraPose(const cv::Mat &Tcw);
+
+    void RequestFinish();
+    bool isFinished();
+
+protected:
+    bool Listen();
+    void AcceptClient();
+    void CloseClient();
+    bool Send(const char* data, size_t size);
+
+    // Append the changes since the last update to mvBuffer
+    void CollectUpdates();
+
+    template<class T>
+    void Append(const T &value)
+    {
+        const char* p = reinterpret_cast<const char*>(&value);
+        mvBuffer.insert(mvBuffer.end(), p, p+sizeof(T));
+    }
+    // Message header, returns the position of the count to patch it later
+    size_t AppendHeader(const char type, const unsigned int count);
+
+    bool CheckFinish();
+    void SetFinish();
+
+    Atlas* mpAtlas;
+    int mnPort;
+    float mfFPS;
+
+    int mListenSocket;
+    int mClientSocket;
+
+    std::mutex mMutexPose;
+    cv::Mat mCameraPose;
+    bool mbNewPose;
+
+    // State already sent to the client
+    Map* mpSentMap;
+    int mnSentChange;
+    long unsigned int mnSentKFs;
+    long unsigned int mnSentMPs;
+    std::unordered_map<long unsigned int, std::array<float,12> > mmSentKFPoses;
+    std::unordered_map<long unsigned int, std::array<float,3> > mmSentMPPositions;
+
+    std::vector<char> mvBuffer;
+
+    std::mutex mMutexFinish;
+    bool mbFinishRequested;
+    bool mbFinished;
+};
+
+} //namespace ORB_SLAM3
+
+#endif // MAPSTREAMER_H
@@ -0,0 +1,71 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MEMORYUSAGE_H
+#define MEMORYUSAGE_H
+
+#include <cstddef>
+
+namespace ORB_SLAM3
+{
+
+// Approximate memory in bytes of the SLAM data by subsystem (System::GetMemoryUsage). Sizes are
+// computed from the sizes of the objects and the capacities of their containers, allocator
+// overhead is only estimated for the tree (std::map, std::set) nodes.
+struct MemoryUsage
+{
+    // Per node overhead of std::map and std::set (color and three links)
+    static const size_t TREE_NODE_OVERHEAD = 32;
+
+    MemoryUsage():
+        nKeyFrames(0), nKeyFrameFeatures(0), nImuPreintegration(0), nMapPoints(0), nMapPointDescriptors(0),
+        nKeyFrameDatabase(0), nVocabulary(0), nVocabularyMapped(0), nMaps(0), nKeyFrameCount(0), nMapPointCount(0)
+    {}
+
+    // Keyframe objects, BoW vectors, map point associations, covisibility graph and spanning tree
+    size_t nKeyFrames;
+    // Keypoints, descriptors, feature vectors and grids of the keyframes (released by the
+    // Atlas memory budget, see KeyFrame::FeaturesMemory)
+    size_t nKeyFrameFeatures;
+    // IMU preintegration of the keyframes, with the measurements kept for reintegration
+    size_t nImuPreintegration;
+    // Map point objects, positions, normals and observations
+    size_t nMapPoints;
+    // Distinctive descriptors and the observed descriptor samples they are chosen from
+    size_t nMapPointDescriptors;
+    // Inverted file of the keyframe database
+    size_t nKeyFrameDatabase;
+    // Vocabulary tree in the heap, and the file mapping it reads the descriptors from (page cache,
+    // not counted in Total)
+    size_t nVocabulary;
+    size_t nVocabularyMapped;
+
+    unsigned long nMaps;
+    unsigned long nKeyFrameCount;
+    unsigned long nMapPointCount;
+
+    size_t Total() const
+    {
+        return nKeyFrames + nKeyFrameFeatures + nImuPreintegration + nMapPoints + nMapPointDescriptors +
+               nKeyFrameDatabase + nVocabulary;
+    }
+};
+
+} //namespace ORB_SLAM
+
+#endif // MEMORYUSAGE_H
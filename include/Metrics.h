@@ -0,0 +1,219 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+#include "LockProfiler.h"
+#include "AllocationProfiler.h"
+#include "MemoryUsage.h"
+
+namespace ORB_SLAM3
+{
+
+// Lock-free latency histogram with log-spaced buckets (4 per octave, 1us to ~4 min).
+// Percentiles are read from the bucket bounds, so they carry an error below 19%.
+class LatencyHistogram
+{
+public:
+    static const int NUM_BUCKETS = 112;
+
+    LatencyHistogram();
+
+    void Record(const double ms);
+    void Reset();
+
+    unsigned long Count() const;
+    double Sum() const;
+    double Max() const;
+    // q in [0,1]. Returns 0 if nothing was recorded
+    double Percentile(const double q) const;
+
+    // Upper bound (ms) of bucket i
+    static double BucketBound(const int i);
+
+private:
+    std::atomic<unsigned long> mvBuckets[NUM_BUCKETS];
+    std::atomic<unsigned long> mnCount;
+    std::atomic<unsigned long long> mnSumNs;
+    std::atomic<unsigned long long> mnMaxNs;
+};
+
+// Always-on runtime metrics of the SLAM threads, owned by the System. Stages are timed
+// with Record() from the thread that runs them and can be polled at any time.
+class Metrics
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    enum Stage
+    {
+        ORB_EXTRACTION=0,
+        STEREO_MATCH,
+        POSE_PREDICTION,
+        TRACK_LOCAL_MAP,
+        POSE_OPTIMIZATION,
+        NEW_KEYFRAME,
+        TRACK_TOTAL,
+        KEYFRAME_PROCESSING,
+        LOCAL_BA,
+        LOCAL_MAPPING_TOTAL,
+        LOOP_DETECTION,
+        LOOP_CORRECTION,
+        MAP_MERGE,
+        // End-to-end, per frame (see FrameTelemetry)
+        INPUT_TO_POSE,
+        CAPTURE_TO_POSE,
+        POSE_TO_MAP_UPDATE,
+        MAP_AGE,
+        NUM_STAGES
+    };
+
+    enum Gauge
+    {
+        LOCAL_MAPPING_QUEUE=0,
+        LOOP_CLOSING_QUEUE,
+        TRACKED_MAP_POINTS,
+        // TrackingDeadline::Degradation bit mask of the last frame
+        TRACKING_DEGRADATIONS,
+        // Memory (bytes) by subsystem, see MemoryUsage. Updated by System::GetMemoryUsage
+        MEMORY_KEYFRAMES,
+        MEMORY_KEYFRAME_FEATURES,
+        MEMORY_IMU_PREINTEGRATION,
+        MEMORY_MAP_POINTS,
+        MEMORY_MAP_POINT_DESCRIPTORS,
+        MEMORY_KEYFRAME_DATABASE,
+        MEMORY_VOCABULARY,
+        MEMORY_VOCABULARY_MAPPED,
+        MEMORY_TOTAL,
+        // Low-power mode: averaged CPU time (ms) of the process per frame and PowerGovernor level
+        FRAME_CPU_TIME,
+        POWER_LEVEL,
+        // Iterations of the last run, see Optimizer::GetLastIterationStats
+        POSE_OPTIMIZATION_ITERATIONS,
+        LOCAL_BA_ITERATIONS,
+        ESSENTIAL_GRAPH_ITERATIONS,
+        NUM_GAUGES
+    };
+
+    struct StageSnapshot
+    {
+        std::string name;
+        unsigned long count;
+        double sum;
+        double p50, p90, p99, max;
+    };
+
+    // Timeline of a tracked frame. Times are ms since the Metrics were created, -1 if not reached
+    struct FrameTelemetry
+    {
+        unsigned long frameId;
+        double timestamp;           // timestamp of the images (s)
+        double tInput;              // images given to the System (Track*, Submit*)
+        double tExtracted;          // features extracted and matched
+        double tTracked;            // pose output
+        bool bKeyFrame;
+        double tKeyFrameInserted;   // keyframe in the map (Local Mapping processed it)
+        double tMapUpdated;         // Local Mapping done with the keyframe: its points and local BA are
+                                    // seen by the next frames
+        double captureToPose;       // pose output - timestamp, only for system clock timestamps
+        double mapAge;              // time since the last map update when the frame was tracked
+        int localMappingQueue;      // keyframes waiting for Local Mapping when the frame was tracked
+    };
+
+    // Frames kept for GetFrameTelemetry
+    static const int FRAME_HISTORY = 2048;
+
+    Metrics();
+
+    inline void Record(const Stage stage, const double ms){
+        mvStages[stage].Record(ms);
+    }
+    // Time elapsed since tStart
+    inline void Record(const Stage stage, const Clock::time_point &tStart){
+        Record(stage, std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(Clock::now() - tStart).count());
+    }
+
+    inline void SetGauge(const Gauge gauge, const double value){
+        mvGauges[gauge].store(value, std::memory_order_relaxed);
+    }
+    inline double GetGauge(const Gauge gauge) const{
+        return mvGauges[gauge].load(std::memory_order_relaxed);
+    }
+
+    // Sets the MEMORY_* gauges
+    void SetMemoryUsage(const MemoryUsage &usage);
+
+    const LatencyHistogram& GetHistogram(const Stage stage) const { return mvStages[stage]; }
+    std::vector<StageSnapshot> GetStageSnapshots() const;
+
+    // The timeline of every frame is recorded when it is tracked and completed by Local Mapping for
+    // keyframes. tInput and tExtracted may be unset (time_point()) when not known
+    void RecordFrameTracked(const unsigned long frameId, const double timestamp, const Clock::time_point &tInput,
+                            const Clock::time_point &tExtracted, const bool bKeyFrame);
+    void RecordKeyFrameInserted(const unsigned long frameId);
+    void RecordMapUpdated(const unsigned long frameId);
+
+    // Timestamps are system clock times (seconds since the UNIX epoch, System.TimestampClock: "system"),
+    // so the latency from the capture can be measured. Otherwise only from the System call
+    void SetSystemClockTimestamps(const bool bSystemClock);
+
+    // Last FRAME_HISTORY tracked frames, oldest first
+    std::vector<FrameTelemetry> GetFrameTelemetry() const;
+
+    // Contention of the core locks. Empty unless built with ORB_SLAM3_LOCK_PROFILING
+    std::vector<LockProfiler::LockSnapshot> GetLockSnapshots() const;
+
+    // Heap allocations by tracing span and by thread. Empty unless built with ORB_SLAM3_ALLOC_PROFILING
+    std::vector<AllocationProfiler::SpanSnapshot> GetAllocationSnapshots() const;
+    std::vector<AllocationProfiler::ThreadSnapshot> GetThreadAllocationSnapshots() const;
+
+    // Prometheus text exposition format: one summary per stage, one gauge per queue and the
+    // lock contention and allocations when they are profiled
+    std::string ExportPrometheus() const;
+
+    void Reset();
+
+    static const char* StageName(const Stage stage);
+    static const char* GaugeName(const Gauge gauge);
+
+private:
+    double ElapsedMs(const Clock::time_point &t) const;
+
+    LatencyHistogram mvStages[NUM_STAGES];
+    std::atomic<double> mvGauges[NUM_GAUGES];
+
+    const Clock::time_point mtStart;
+    std::atomic<bool> mbSystemClockTimestamps;
+    // Steady clock time (ns since epoch) of the last map update, 0 before the first one
+    std::atomic<long long> mnLastMapUpdateNs;
+
+    // Ring of the last frames, indexed by frame id
+    std::vector<FrameTelemetry> mvFrames;
+    mutable std::mutex mMutexFrames;
+};
+
+} //namespace ORB_SLAM
+
+#endif // METRICS_H
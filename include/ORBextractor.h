@@ -21,26 +21,43 @@
 
 #include <vector>
 #include <list>
+#include <algorithm>
 #include <opencv2/opencv.hpp>
 
+#include "FeatureExtractor.h"
+#include "OrbDescriptor.h"
+#include "PyramidBuilder.h"
+#include "FastDetector.h"
+
 
 namespace ORB_SLAM3
 {
 
+class ThreadPool;
+
+// Node of the tree used to distribute the keypoints. Nodes live in one array and are linked
+// by index; instead of a vector of their own they hold a range [nBegin,nEnd) of a shared
+// buffer of keypoint indices, which DivideNode splits in place.
 class ExtractorNode
 {
 public:
-    ExtractorNode():bNoMore(false){}
+    ExtractorNode():nBegin(0),nEnd(0),prev(-1),next(-1),bNoMore(false){}
+
+    // Boundaries of the four children and their ranges (same order of the keypoints, vScratch is
+    // working memory of twice the size of vIndices)
+    void DivideNode(ExtractorNode &n1, ExtractorNode &n2, ExtractorNode &n3, ExtractorNode &n4,
+                    const std::vector<cv::KeyPoint> &vKeys, std::vector<int> &vIndices, std::vector<int> &vScratch) const;
 
-    void DivideNode(ExtractorNode &n1, ExtractorNode &n2, ExtractorNode &n3, ExtractorNode &n4);
+    int size() const { return nEnd-nBegin; }
 
-    std::vector<cv::KeyPoint> vKeys;
     cv::Point2i UL, UR, BL, BR;
-    std::list<ExtractorNode>::iterator lit;
+    int nBegin, nEnd;
+    // Neighbours in the list of nodes, -1 at the ends
+    int prev, next;
     bool bNoMore;
 };
 
-class ORBextractor
+class ORBextractor : public FeatureExtractor
 {
 public:
     
@@ -56,36 +73,85 @@ public:
     // Mask is ignored in the current implementation.
     int operator()( cv::InputArray _image, cv::InputArray _mask,
                     std::vector<cv::KeyPoint>& _keypoints,
-                    cv::OutputArray _descriptors, std::vector<int> &vLappingArea);
+                    cv::OutputArray _descriptors, std::vector<int> &vLappingArea) override;
 
-    int inline GetLevels(){
+    int inline GetLevels() override {
         return nlevels;}
 
-    float inline GetScaleFactor(){
+    float inline GetScaleFactor() override {
         return scaleFactor;}
 
-    std::vector<float> inline GetScaleFactors(){
+    std::vector<float> inline GetScaleFactors() override {
         return mvScaleFactor;
     }
 
-    std::vector<float> inline GetInverseScaleFactors(){
+    std::vector<float> inline GetInverseScaleFactors() override {
         return mvInvScaleFactor;
     }
 
-    std::vector<float> inline GetScaleSigmaSquares(){
+    std::vector<float> inline GetScaleSigmaSquares() override {
         return mvLevelSigma2;
     }
 
-    std::vector<float> inline GetInverseScaleSigmaSquares(){
+    std::vector<float> inline GetInverseScaleSigmaSquares() override {
         return mvInvLevelSigma2;
     }
 
-    std::vector<cv::Mat> mvImagePyramid;
+    // Worker pool shared with the rest of the system. If bParallelLevels is true the pyramid
+    // levels are processed on the pool (FAST, octree distribution, orientation and descriptors),
+    // otherwise extraction is sequential in the calling thread.
+    void SetThreadPool(ThreadPool* pThreadPool, const bool bParallelLevels) override {
+        mpThreadPool = pThreadPool;
+        mbParallelLevels = bParallelLevels && pThreadPool;
+    }
+
+    ThreadPool* GetThreadPool() override {
+        return mpThreadPool;
+    }
+
+    // Features and number of pyramid levels used from the next image on. The scale pyramid
+    // reported to the frames keeps all the levels, the ones above nLevels just get no keypoints.
+    void SetFeatureBudget(const int nFeatures, const int nLevels) override;
+
+    // Detection restricted to the cells of the pyramid levels that overlap the mask, plus every
+    // 1/fCoverage-th of the others (rotating from image to image)
+    void SetFocusMask(const cv::Mat &mask, const int nCellSize, const float fCoverage) override;
+
+    bool IsFocused() override {
+        return !mFocusMask.empty();
+    }
+
+    // Levels below nFirstLevel are left out from the next image on
+    void SetFirstLevel(const int nFirstLevel) override {
+        mnFirstLevel = std::min(std::max(nFirstLevel, 0), nlevels-1);
+    }
+
+    int GetFirstLevel() override {
+        return FirstLevel();
+    }
+
+    // The row source feeds the first level only, not available at reduced resolution
+    bool SetImageRowSource(PyramidRowSource* pSource) override {
+        if(mnFirstLevel > 0)
+            return false;
+        mpRowSource = pSource;
+        return true;
+    }
 
 protected:
 
-    void ComputePyramid(cv::Mat image);
+    // First level built, below the last level with features
+    int FirstLevel() const { return std::min(mnFirstLevel, mnActiveLevels-1); }
+
+    // Levels and blurred levels of the image (ORBextractorOCL builds them on an OpenCL device)
+    virtual void ComputePyramid(cv::Mat image);
+    void ComputeFeaturesPerLevel();
     void ComputeKeyPointsOctTree(std::vector<std::vector<cv::KeyPoint> >& allKeypoints);    
+    void ComputeKeyPointsOctTreeLevel(const int level, std::vector<cv::KeyPoint> &keypoints);
+    // FAST corners of the focused cells of a level (cells of the detection area [x0,x1)x[y0,y1))
+    void DetectFocused(const int level, const int x0, const int y0, const int x1, const int y1,
+                       const int nCols, const int nRows, const int wCell, const int hCell, std::vector<FastCorner> &vCorners);
+    void ComputeDescriptorsLevel(const int level, const std::vector<cv::KeyPoint> &keypoints, const std::vector<int> &vOutputRows, cv::Mat &descriptors);
     std::vector<cv::KeyPoint> DistributeOctTree(const std::vector<cv::KeyPoint>& vToDistributeKeys, const int &minX,
                                            const int &maxX, const int &minY, const int &maxY, const int &nFeatures, const int &level);
 
@@ -98,14 +164,42 @@ protected:
     int iniThFAST;
     int minThFAST;
 
+    // Levels where keypoints are detected (nlevels unless reduced by SetFeatureBudget), from
+    // mnFirstLevel on (0 unless reduced by SetFirstLevel)
+    int mnActiveLevels;
+    int mnFirstLevel;
+
+    // Focus mask of the first level (empty: whole image), and image counter for the coverage
+    cv::Mat mFocusMask;
+    int mnFocusCellSize;
+    float mfFocusCoverage;
+    int mnFocusPhase;
+
     std::vector<int> mnFeaturesPerLevel;
 
     std::vector<int> umax;
 
+    // Orientation and descriptors, with the tables built from pattern and umax
+    OrbDescriptor mOrbDescriptor;
+
     std::vector<float> mvScaleFactor;
     std::vector<float> mvInvScaleFactor;    
     std::vector<float> mvLevelSigma2;
     std::vector<float> mvInvLevelSigma2;
+
+    ThreadPool* mpThreadPool;
+    bool mbParallelLevels;
+
+    // Rows of the next image (NULL: read from the image), see SetImageRowSource
+    PyramidRowSource* mpRowSource;
+
+    // Working buffers reused from frame to frame: bordered pyramid levels (mvImagePyramid
+    // are views into them), blurred levels, per level keypoints and their output rows
+    std::vector<cv::Mat> mvPyramidBuffers;
+    std::vector<cv::Mat> mvBlurBuffers;
+    PyramidBuilder mPyramidBuilder;
+    std::vector<std::vector<cv::KeyPoint> > mvvAllKeypoints;
+    std::vector<std::vector<int> > mvvOutputRows;
 };
 
 } //namespace ORB_SLAM
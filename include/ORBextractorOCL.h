@@ -0,0 +1,62 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ORBEXTRACTOROCL_H
+#define ORBEXTRACTOROCL_H
+
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+#include "ORBextractor.h"
+
+namespace ORB_SLAM3
+{
+
+// ORBextractor with the scale pyramid and the blurred levels computed on an OpenCL device through
+// the OpenCV transparent API (cv::UMat). Resize (INTER_LINEAR), border (BORDER_REFLECT_101) and the
+// 7x7 Gaussian blur are the operations the CPU PyramidBuilder reproduces, so the keypoints and
+// descriptors are those of ORBextractor up to the rounding of the device kernels. FAST, the octree distribution, orientation and rBRIEF run
+// on the CPU as in ORBextractor (on the thread pool if set), reading the levels downloaded from
+// the device. Without an OpenCL device OpenCV runs the same calls on the CPU.
+class ORBextractorOCL : public ORBextractor
+{
+public:
+    ORBextractorOCL(int nfeatures, float scaleFactor, int nlevels,
+                    int iniThFAST, int minThFAST);
+
+    // Whether OpenCV can use an OpenCL device (and enables it), checked before building one
+    static bool IsAvailable();
+
+    // The pyramid is built from the uploaded image, rows can not be streamed
+    bool SetImageRowSource(PyramidRowSource* pSource) override {
+        return false;
+    }
+
+protected:
+    void ComputePyramid(cv::Mat image) override;
+
+    // Device buffers kept between frames: input image, levels, bordered levels and blurred levels
+    cv::UMat mUImage;
+    std::vector<cv::UMat> mvULevels;
+    std::vector<cv::UMat> mvUBordered;
+    std::vector<cv::UMat> mvUBlur;
+};
+
+} //namespace ORB_SLAM
+
+#endif // ORBEXTRACTOROCL_H
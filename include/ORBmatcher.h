@@ -27,6 +27,8 @@
 #include"MapPoint.h"
 #include"KeyFrame.h"
 #include"Frame.h"
+#include"FrozenMap.h"
+#include"LocalMapMirror.h"
 
 
 namespace ORB_SLAM3
@@ -39,12 +41,40 @@ public:
     ORBmatcher(float nnratio=0.6, bool checkOri=true);
 
     // Computes the Hamming distance between two ORB descriptors
+    // (SIMD kernel selected at runtime: AVX-512 VPOPCNTDQ, AVX2, POPCNT or NEON)
     static int DescriptorDistance(const cv::Mat &a, const cv::Mat &b);
 
+    // Computes the Hamming distance between descriptor a and every row of B.
+    // pDists must have room for B.rows values.
+    static void DescriptorDistances(const cv::Mat &a, const cv::Mat &B, int *pDists);
+
+    // Same as above for N contiguous descriptors of DESCRIPTOR_BYTES bytes in pB.
+    static void DescriptorDistances(const unsigned char *pa, const unsigned char *pB, const int N, int *pDists);
+
+    // Best and second best Hamming distance from a query descriptor to N contiguous candidate
+    // descriptors (DESCRIPTOR_BYTES each). Indices are positions in the block (-1 if not found,
+    // distance 256). Ties keep the first candidate, as the sequential search loops did.
+    static void BestDescriptorMatches(const unsigned char *pQuery, const unsigned char *pCandidates, const int N,
+                                      int &bestDist, int &bestIdx, int &bestDist2, int &bestIdx2);
+
+    // Name of the Hamming distance kernel in use (for logging)
+    static const char* DescriptorDistanceKernel();
+
     // Search matches between Frame keypoints and projected MapPoints. Returns number of matches
     // Used to track the local map (Tracking)
     int SearchByProjection(Frame &F, const std::vector<MapPoint*> &vpMapPoints, const float th=3, const bool bFarPoints = false, const float thFarPoints = 50.0f);
 
+    // Same for the local points of a frozen map in the frustum of the frame (FrozenMap::ProjectLocalPoints).
+    // Used to track the local map in localization mode (Tracking, without stereo fisheye)
+    int SearchByProjection(Frame &F, const FrozenMap &map, FrozenMap::LocalWindow &w, const float th=3, const bool bFarPoints = false, const float thFarPoints = 50.0f);
+
+    // Same for the local map mirrored by Tracking (LocalMapMirror::ProjectPoints), without stereo fisheye
+    int SearchByProjection(Frame &F, const LocalMapMirror &mirror, LocalMapMirror::Projection &p, const float th=3, const bool bFarPoints = false, const float thFarPoints = 50.0f);
+
+    // Same for the additional cameras of a rig frame (F.mvRigViews): the points are projected in every
+    // camera of the rig and matched to its features. Used to track the local map with a CameraRig
+    int SearchByProjectionRig(Frame &F, const std::vector<MapPoint*> &vpMapPoints, const float th=3);
+
     // Project MapPoints tracked in last frame into the current frame and search matches.
     // Used to track from previous frame (Tracking)
     int SearchByProjection(Frame &CurrentFrame, const Frame &LastFrame, const float th, const bool bMono);
@@ -52,6 +82,8 @@ public:
     // Project MapPoints seen in KeyFrame into the Frame and search matches.
     // Used in relocalisation (Tracking)
     int SearchByProjection(Frame &CurrentFrame, KeyFrame* pKF, const std::set<MapPoint*> &sAlreadyFound, const float th, const int ORBdist);
+    // Same with the keyframe nKF of a frozen map (relocalisation in localization mode)
+    int SearchByProjection(Frame &CurrentFrame, const FrozenMap &map, const int nKF, const std::set<MapPoint*> &sAlreadyFound, const float th, const int ORBdist);
 
     // Project MapPoints using a Similarity Transformation and search matches.
     // Used in loop detection (Loop Closing)
@@ -65,10 +97,13 @@ public:
     // Brute force constrained to ORB that belong to the same vocabulary node (at a certain level)
     // Used in Relocalisation and Loop Detection
     int SearchByBoW(KeyFrame *pKF, Frame &F, std::vector<MapPoint*> &vpMapPointMatches);
+    int SearchByBoW(const FrozenMap &map, const int nKF, Frame &F, std::vector<MapPoint*> &vpMapPointMatches);
     int SearchByBoW(KeyFrame *pKF1, KeyFrame* pKF2, std::vector<MapPoint*> &vpMatches12);
 
-    // Matching for the Map Initialization (only used in the monocular case)
-    int SearchForInitialization(Frame &F1, Frame &F2, std::vector<cv::Point2f> &vbPrevMatched, std::vector<int> &vnMatches12, int windowSize=10);
+    // Matching for the Map Initialization (only used in the monocular case). With trackWindowSize>0 the
+    // keypoints of F1 matched in the previous call (vnMatches12 on input) are only searched within
+    // trackWindowSize of their last position, the others within windowSize.
+    int SearchForInitialization(Frame &F1, Frame &F2, std::vector<cv::Point2f> &vbPrevMatched, std::vector<int> &vnMatches12, int windowSize=10, int trackWindowSize=0);
 
     // Matching to triangulate new MapPoints. Check Epipolar Constraint.
     int SearchForTriangulation(KeyFrame *pKF1, KeyFrame* pKF2, cv::Mat F12,
@@ -85,7 +120,10 @@ public:
     int SearchBySim3(KeyFrame* pKF1, KeyFrame* pKF2, std::vector<MapPoint *> &vpMatches12, const float &s12, const cv::Mat &R12, const cv::Mat &t12, const float th);
 
     // Project MapPoints into KeyFrame and search for duplicated MapPoints.
-    int Fuse(KeyFrame* pKF, const vector<MapPoint *> &vpMapPoints, const float th=3.0, const bool bRight = false);
+    // If pvReplacements is given the duplicated pairs (projected point, point in the keyframe) are returned
+    // instead of being replaced, new observations are still added to the keyframe.
+    int Fuse(KeyFrame* pKF, const vector<MapPoint *> &vpMapPoints, const float th=3.0, const bool bRight = false,
+             vector<pair<MapPoint*,MapPoint*> >* pvReplacements = NULL);
 
     // Project MapPoints into KeyFrame using a given Sim3 and search for duplicated MapPoints.
     int Fuse(KeyFrame* pKF, cv::Mat Scw, const std::vector<MapPoint*> &vpPoints, float th, vector<MapPoint *> &vpReplacePoint);
@@ -95,6 +133,7 @@ public:
     static const int TH_LOW;
     static const int TH_HIGH;
     static const int HISTO_LENGTH;
+    static const int DESCRIPTOR_BYTES;
 
 
 protected:
@@ -106,8 +145,69 @@ protected:
 
     void ComputeThreeMaxima(std::vector<int>* histo, const int L, int &ind1, int &ind2, int &ind3);
 
+    // Working buffers of the searches. There is one set per thread, shared by all the matchers
+    // the thread creates, so that the searches do not allocate once the buffers have grown
+    // (a search never calls another one while it uses them). A matcher must therefore be used
+    // only by the thread that created it
+    struct Scratch
+    {
+        std::vector<std::vector<int> > vRotHist;
+        std::vector<int> vnMatches1, vnMatches2;
+        std::vector<bool> vbMatched1, vbMatched2;
+        std::vector<size_t> vCandidateIdx;
+        std::vector<unsigned char> vCandidateDesc;
+        std::vector<size_t> vAreaIndices;
+        // Candidates of SearchForTriangulation_: position, epipolar threshold (3.84 sigma^2), if
+        // they are monocular points near the epipole, and the epipolar and descriptor distances
+        std::vector<float> vCandidateX, vCandidateY, vCandidateTh;
+        std::vector<unsigned char> vCandidateNearEpipole, vCandidateEpipolarOK;
+        std::vector<int> vCandidateDist;
+    };
+    static Scratch& ThreadScratch();
+
+    // Empty rotation histogram of HISTO_LENGTH bins from the scratch buffers
+    std::vector<int>* RotationHistogram();
+
+    // Bodies of the SearchByProjection of the local map, of projected point arrays (frozen map or
+    // local map mirror: descriptor rows and points indexed by w.mvProjPoint) and of the last frame
+    // for each camera configuration of the frame (SensorConfig.h), selected by F.mCameraSetup
+    template<int Setup>
+    int SearchByProjectionLocal(Frame &F, const std::vector<MapPoint*> &vpMapPoints, const float th, const bool bFarPoints, const float thFarPoints);
+    template<int Setup, class Window>
+    int SearchByProjectionArrays(Frame &F, const cv::Mat &descriptors, const std::vector<MapPoint*> &vpMapPoints, Window &w, const float th, const bool bFarPoints, const float thFarPoints);
+    template<int Setup>
+    int SearchByProjectionLast(Frame &CurrentFrame, const Frame &LastFrame, const float th, const bool bMono);
+
+    // SearchByBoW over the map points of the keypoints of pKF given in vpMapPointsKF
+    int SearchByBoW(KeyFrame* pKF, MapPoint* const* vpMapPointsKF, const bool bCheckBad, Frame &F, std::vector<MapPoint*> &vpMapPointMatches);
+
+    // Candidate block used by the search loops: descriptor rows are gathered contiguously
+    // so that they are matched in one call (the buffers are reused between queries)
+    void ClearCandidates();
+    void AddCandidate(const cv::Mat &descriptors, const size_t row, const size_t idx);
+    inline void AddCandidate(const cv::Mat &descriptors, const size_t idx){
+        AddCandidate(descriptors,idx,idx);
+    }
+    // Same as BestDescriptorMatches over the candidate block, but returned indices are the ones
+    // given to AddCandidate
+    void MatchCandidates(const cv::Mat &query, int &bestDist, int &bestIdx, int &bestDist2, int &bestIdx2) const;
+
+    // SearchForTriangulation_ with pinhole cameras: the keypoints of a BoW node of pKF2 become the
+    // candidate block, then each keypoint of pKF1 is checked against all of them at once, with its
+    // epipolar line l = x1'*F12. Returns the index of the best candidate in pKF2 (-1 if none)
+    void AddTriangulationCandidates(KeyFrame* pKF2, const std::vector<unsigned int> &vIndices2, const cv::Point2f &ep, const bool bOnlyStereo);
+    int BestTriangulationCandidate(const unsigned char* pDesc1, const cv::Point2f &x1, const cv::Matx33f &F12, const bool bStereo1, const bool bCoarse);
+
     float mfNNratio;
     bool mbCheckOrientation;
+
+    Scratch &mScratch;
+
+    std::vector<size_t> &mvCandidateIdx;
+    std::vector<unsigned char> &mvCandidateDesc;
+
+    // Output of GetFeaturesInArea, reused between the queries of a search
+    std::vector<size_t> &mvAreaIndices;
 };
 
 }// namespace ORB_SLAM
@@ -0,0 +1,150 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef OBJECTPOOL_H
+#define OBJECTPOOL_H
+
+#include <vector>
+#include <mutex>
+#include <new>
+#include <cstddef>
+#include <type_traits>
+#include <algorithm>
+#include <functional>
+
+namespace ORB_SLAM3
+{
+
+// Fixed size allocator for the objects created at a high rate (KeyFrame, MapPoint). Memory is taken
+// from the system in chunks of CHUNK objects and freed blocks are kept in a free list for the next
+// allocations, so allocation latency does not depend on the state of the heap and the memory of
+// reclaimed objects is reused. Only the raw storage is managed, the classes route their
+// operator new/delete here. Thread safe.
+template<class T>
+class ObjectPool
+{
+public:
+    static const size_t CHUNK = 256;
+
+    static ObjectPool& Instance()
+    {
+        static ObjectPool pool;
+        return pool;
+    }
+
+    void* Allocate()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        if(!mpFree)
+            Grow();
+        Block* pBlock = mpFree;
+        mpFree = pBlock->pNext;
+        mnInUse++;
+        return pBlock;
+    }
+
+    void Deallocate(void* p)
+    {
+        if(!p)
+            return;
+        std::unique_lock<std::mutex> lock(mMutex);
+        Block* pBlock = static_cast<Block*>(p);
+        pBlock->pNext = mpFree;
+        mpFree = pBlock;
+        mnInUse--;
+        mnFreedSinceSort++;
+    }
+
+    // Put the free list in address order, so that the objects allocated next (e.g. the points
+    // triangulated from one keyframe) are neighbours in memory instead of taking the holes left by
+    // the last reclaimed objects in reverse order. O(F log F) on the free blocks, call it before a
+    // batch of allocations from a thread that is not latency sensitive. Nothing to do if no block
+    // was freed since the last call.
+    void SortFreeList()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        if(mnFreedSinceSort==0)
+            return;
+
+        mvpSortBuffer.clear();
+        for(Block* pBlock=mpFree; pBlock; pBlock=pBlock->pNext)
+            mvpSortBuffer.push_back(pBlock);
+        std::sort(mvpSortBuffer.begin(), mvpSortBuffer.end(), std::less<Block*>());
+
+        mpFree = static_cast<Block*>(NULL);
+        for(size_t i=mvpSortBuffer.size(); i>0; i--)
+        {
+            mvpSortBuffer[i-1]->pNext = mpFree;
+            mpFree = mvpSortBuffer[i-1];
+        }
+        mnFreedSinceSort = 0;
+    }
+
+    // Objects currently allocated and total capacity of the pool
+    size_t InUse()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        return mnInUse;
+    }
+
+    size_t Capacity()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        return mvpChunks.size()*CHUNK;
+    }
+
+private:
+    union Block
+    {
+        Block* pNext;
+        typename std::aligned_storage<sizeof(T), std::alignment_of<T>::value>::type storage;
+    };
+
+    ObjectPool(): mpFree(static_cast<Block*>(NULL)), mnInUse(0), mnFreedSinceSort(0) {}
+
+    ~ObjectPool()
+    {
+        for(size_t i=0; i<mvpChunks.size(); i++)
+            delete[] mvpChunks[i];
+    }
+
+    ObjectPool(const ObjectPool&);
+    ObjectPool& operator=(const ObjectPool&);
+
+    void Grow()
+    {
+        Block* pChunk = new Block[CHUNK];
+        mvpChunks.push_back(pChunk);
+        for(size_t i=CHUNK; i>0; i--)
+        {
+            pChunk[i-1].pNext = mpFree;
+            mpFree = &pChunk[i-1];
+        }
+    }
+
+    std::mutex mMutex;
+    std::vector<Block*> mvpChunks;
+    Block* mpFree;
+    size_t mnInUse;
+    size_t mnFreedSinceSort;
+    std::vector<Block*> mvpSortBuffer;
+};
+
+} //namespace ORB_SLAM
+
+#endif // OBJECTPOOL_H
@@ -25,12 +25,13 @@
 
 #include <Eigen/Geometry>
 #include <include/CameraModels/GeometricCamera.h>
+#include <include/CameraModels/CameraProjection.h>
 
 
 namespace ORB_SLAM3 {
 class  EdgeSE3ProjectXYZOnlyPose: public  g2o::BaseUnaryEdge<2, Eigen::Vector2d, g2o::VertexSE3Expmap>{
 public:
-    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    G2O_MAKE_POOLED_OPERATOR_NEW
 
     EdgeSE3ProjectXYZOnlyPose(){}
 
@@ -51,14 +52,37 @@ public:
 
 
     virtual void linearizeOplus();
+    // Jacobian with the projection of CameraModel (GeometricCamera dispatches on the type tag)
+    template<class CameraModel>
+    void linearizeOplusT();
 
     Eigen::Vector3d Xw;
     GeometricCamera* pCamera;
 };
 
+// EdgeSE3ProjectXYZOnlyPose with the camera model fixed at compile time, so that projection and
+// Jacobian inline instead of going through the virtual GeometricCamera interface
+template<class CameraModel>
+class  EdgeSE3ProjectXYZOnlyPoseT: public EdgeSE3ProjectXYZOnlyPose{
+public:
+    G2O_MAKE_POOLED_OPERATOR_NEW
+
+    EdgeSE3ProjectXYZOnlyPoseT(){}
+
+    void computeError()  {
+        const g2o::VertexSE3Expmap* v1 = static_cast<const g2o::VertexSE3Expmap*>(_vertices[0]);
+        Eigen::Vector2d obs(_measurement);
+        _error = obs-CameraProject<CameraModel>(pCamera,v1->estimate().map(Xw));
+    }
+
+    virtual void linearizeOplus(){
+        linearizeOplusT<CameraModel>();
+    }
+};
+
 class  EdgeSE3ProjectXYZOnlyPoseToBody: public  g2o::BaseUnaryEdge<2, Eigen::Vector2d, g2o::VertexSE3Expmap>{
 public:
-    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    G2O_MAKE_POOLED_OPERATOR_NEW
 
     EdgeSE3ProjectXYZOnlyPoseToBody(){}
 
@@ -88,7 +112,7 @@ public:
 
 class  EdgeSE3ProjectXYZ: public  g2o::BaseBinaryEdge<2, Eigen::Vector2d, g2o::VertexSBAPointXYZ, g2o::VertexSE3Expmap>{
 public:
-    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    G2O_MAKE_POOLED_OPERATOR_NEW
 
     EdgeSE3ProjectXYZ();
 
@@ -110,13 +134,38 @@ public:
     }
 
     virtual void linearizeOplus();
+    template<class CameraModel>
+    void linearizeOplusT();
 
     GeometricCamera* pCamera;
 };
 
+template<class CameraModel>
+class  EdgeSE3ProjectXYZT: public EdgeSE3ProjectXYZ{
+public:
+    G2O_MAKE_POOLED_OPERATOR_NEW
+
+    EdgeSE3ProjectXYZT(){}
+
+    void computeError()  {
+        const g2o::VertexSE3Expmap* v1 = static_cast<const g2o::VertexSE3Expmap*>(_vertices[1]);
+        const g2o::VertexSBAPointXYZ* v2 = static_cast<const g2o::VertexSBAPointXYZ*>(_vertices[0]);
+        Eigen::Vector2d obs(_measurement);
+        _error = obs-CameraProject<CameraModel>(pCamera,v1->estimate().map(v2->estimate()));
+    }
+
+    virtual void linearizeOplus(){
+        linearizeOplusT<CameraModel>();
+    }
+};
+
+// Edges specialized on the model of pCamera, which is also set as their camera
+EdgeSE3ProjectXYZOnlyPose* NewEdgeSE3ProjectXYZOnlyPose(GeometricCamera* pCamera);
+EdgeSE3ProjectXYZ* NewEdgeSE3ProjectXYZ(GeometricCamera* pCamera);
+
 class  EdgeSE3ProjectXYZToBody: public  g2o::BaseBinaryEdge<2, Eigen::Vector2d, g2o::VertexSBAPointXYZ, g2o::VertexSE3Expmap>{
 public:
-    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    G2O_MAKE_POOLED_OPERATOR_NEW
 
     EdgeSE3ProjectXYZToBody();
 
@@ -146,7 +195,7 @@ public:
 class VertexSim3Expmap : public g2o::BaseVertex<7, g2o::Sim3>
 {
 public:
-    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    G2O_MAKE_POOLED_OPERATOR_NEW
     VertexSim3Expmap();
     virtual bool read(std::istream& is);
     virtual bool write(std::ostream& os) const;
@@ -175,7 +224,7 @@ public:
 class EdgeSim3ProjectXYZ : public  g2o::BaseBinaryEdge<2, Eigen::Vector2d, g2o::VertexSBAPointXYZ, ORB_SLAM3::VertexSim3Expmap>
 {
 public:
-    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    G2O_MAKE_POOLED_OPERATOR_NEW
     EdgeSim3ProjectXYZ();
     virtual bool read(std::istream& is);
     virtual bool write(std::ostream& os) const;
@@ -196,7 +245,7 @@ public:
 class EdgeInverseSim3ProjectXYZ : public  g2o::BaseBinaryEdge<2, Eigen::Vector2d,  g2o::VertexSBAPointXYZ, VertexSim3Expmap>
 {
 public:
-    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    G2O_MAKE_POOLED_OPERATOR_NEW
     EdgeInverseSim3ProjectXYZ();
     virtual bool read(std::istream& is);
     virtual bool write(std::ostream& os) const;
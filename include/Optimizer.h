@@ -25,8 +25,11 @@
 #include "KeyFrame.h"
 #include "LoopClosing.h"
 #include "Frame.h"
+#include "LocalBAGraph.h"
+#include "OptimizerSettings.h"
 
 #include <math.h>
+#include <list>
 
 #include "Thirdparty/g2o/g2o/types/types_seven_dof_expmap.h"
 #include "Thirdparty/g2o/g2o/core/sparse_block_matrix.h"
@@ -37,11 +40,16 @@
 #include "Thirdparty/g2o/g2o/types/types_six_dof_expmap.h"
 #include "Thirdparty/g2o/g2o/core/robust_kernel_impl.h"
 #include "Thirdparty/g2o/g2o/solvers/linear_solver_dense.h"
+#include "Thirdparty/g2o/g2o/solvers/linear_solver_pcg.h"
+#ifdef G2O_HAVE_CHOLMOD
+#include "Thirdparty/g2o/g2o/solvers/linear_solver_cholmod.h"
+#endif
 
 namespace ORB_SLAM3
 {
 
 class LoopClosing;
+class ThreadPool;
 
 class Optimizer
 {
@@ -55,7 +63,8 @@ public:
     void static FullInertialBA(Map *pMap, int its, const bool bFixLocal=false, const unsigned long nLoopKF=0, bool *pbStopFlag=NULL, bool bInit=false, float priorG = 1e2, float priorA=1e6, Eigen::VectorXd *vSingVal = NULL, bool *bHess=NULL);
 
     void static LocalBundleAdjustment(KeyFrame* pKF, bool *pbStopFlag, vector<KeyFrame*> &vpNonEnoughOptKFs);
-    void static LocalBundleAdjustment(KeyFrame* pKF, bool *pbStopFlag, Map *pMap, int& num_fixedKF, int& num_OptKF, int& num_MPs, int& num_edges);
+    void static LocalBundleAdjustment(KeyFrame* pKF, bool *pbStopFlag, Map *pMap, int& num_fixedKF, int& num_OptKF, int& num_MPs, int& num_edges,
+                                      LocalBAGraph* pGraph=NULL);
 
     void static MergeBundleAdjustmentVisual(KeyFrame* pCurrentKF, vector<KeyFrame*> vpWeldingKFs, vector<KeyFrame*> vpFixedKFs, bool *pbStopFlag);
 
@@ -65,15 +74,34 @@ public:
     int static PoseInertialOptimizationLastFrame(Frame *pFrame, bool bRecInit = false);
 
     // if bFixScale is true, 6DoF optimization (stereo,rgbd), 7DoF otherwise (mono)
+    // If pOptimizedSim3 is given the map is left untouched: the initial and optimized Siw of every keyframe
+    // in the graph are returned so that the caller can apply them later (the map may change meanwhile)
     void static OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* pCurKF,
                                        const LoopClosing::KeyFrameAndPose &NonCorrectedSim3,
                                        const LoopClosing::KeyFrameAndPose &CorrectedSim3,
                                        const map<KeyFrame *, set<KeyFrame *> > &LoopConnections,
-                                       const bool &bFixScale);
+                                       const bool &bFixScale,
+                                       LoopClosing::KeyFrameAndPose* pInitialSim3=NULL,
+                                       LoopClosing::KeyFrameAndPose* pOptimizedSim3=NULL);
+    // Essential graph reduced to the anchors of the submaps of the map (Map::GetSubmapAnchor): the keyframe edges
+    // between two submaps become one edge between their anchors. The submaps with keyframes of the loop window
+    // (CorrectedSim3) start corrected by the loop. The map is left untouched, the initial and optimized Siw of
+    // every anchor are returned. False if the map has too few submaps for it
+    bool static OptimizeSubmapGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* pCurKF,
+                                    const LoopClosing::KeyFrameAndPose &NonCorrectedSim3,
+                                    const LoopClosing::KeyFrameAndPose &CorrectedSim3,
+                                    const map<KeyFrame *, set<KeyFrame *> > &LoopConnections,
+                                    const bool &bFixScale,
+                                    LoopClosing::SubmapAndPose &InitialSim3,
+                                    LoopClosing::SubmapAndPose &OptimizedSim3);
     void static OptimizeEssentialGraph6DoF(KeyFrame* pCurKF, vector<KeyFrame*> &vpFixedKFs, vector<KeyFrame*> &vpFixedCorrectedKFs,
                                            vector<KeyFrame*> &vpNonFixedKFs, vector<MapPoint*> &vpNonCorrectedMPs, double scale);
+    // Merge: the keyframes outside the welding window, with the welded ones fixed. If pOptimizedSim3 is given the
+    // map is left untouched and the initial and optimized Siw of the free keyframes are returned, as above
     void static OptimizeEssentialGraph(KeyFrame* pCurKF, vector<KeyFrame*> &vpFixedKFs, vector<KeyFrame*> &vpFixedCorrectedKFs,
-                                       vector<KeyFrame*> &vpNonFixedKFs, vector<MapPoint*> &vpNonCorrectedMPs);
+                                       vector<KeyFrame*> &vpNonFixedKFs, vector<MapPoint*> &vpNonCorrectedMPs,
+                                       LoopClosing::KeyFrameAndPose* pInitialSim3=NULL,
+                                       LoopClosing::KeyFrameAndPose* pOptimizedSim3=NULL);
     void static OptimizeEssentialGraph(KeyFrame* pCurKF,
                                        const LoopClosing::KeyFrameAndPose &NonCorrectedSim3,
                                        const LoopClosing::KeyFrameAndPose &CorrectedSim3);
@@ -81,7 +109,9 @@ public:
     void static OptimizeEssentialGraph4DoF(Map* pMap, KeyFrame* pLoopKF, KeyFrame* pCurKF,
                                        const LoopClosing::KeyFrameAndPose &NonCorrectedSim3,
                                        const LoopClosing::KeyFrameAndPose &CorrectedSim3,
-                                       const map<KeyFrame *, set<KeyFrame *> > &LoopConnections);
+                                       const map<KeyFrame *, set<KeyFrame *> > &LoopConnections,
+                                       LoopClosing::KeyFrameAndPose* pInitialSim3=NULL,
+                                       LoopClosing::KeyFrameAndPose* pOptimizedSim3=NULL);
 
     // if bFixScale is true, optimize SE3 (stereo,rgbd), Sim3 otherwise (mono) (OLD)
     static int OptimizeSim3(KeyFrame* pKF1, KeyFrame* pKF2, std::vector<MapPoint *> &vpMatches1,
@@ -96,7 +126,11 @@ public:
 
     // For inertial systems
 
-    void static LocalInertialBA(KeyFrame* pKF, bool *pbStopFlag, Map *pMap, int& num_fixedKF, int& num_OptKF, int& num_MPs, int& num_edges, bool bLarge = false, bool bRecInit = false);
+    // thRelin > 0 keeps keyframes of the window whose last update was below thRelin (metres) fixed.
+    // nSmootherWindow > 0 runs it as a fixed-lag smoother of that many keyframes: the keyframe leaving
+    // the window is marginalized into a prior instead of being fixed
+    void static LocalInertialBA(KeyFrame* pKF, bool *pbStopFlag, Map *pMap, int& num_fixedKF, int& num_OptKF, int& num_MPs, int& num_edges, bool bLarge = false, bool bRecInit = false,
+                                float thRelin = 0.f, int nSmootherWindow = 0);
 
     void static MergeInertialBA(KeyFrame* pCurrKF, KeyFrame* pMergeKF, bool *pbStopFlag, Map *pMap, LoopClosing::KeyFrameAndPose &corrPoses);
 
@@ -106,16 +140,55 @@ public:
     // Marginalize block element (start:end,start:end). Perform Schur complement.
     // Marginalized elements are filled with zeros.
     static Eigen::MatrixXd Marginalize(const Eigen::MatrixXd &H, const int &start, const int &end);
+    // Marginalize the previous frame (states 0:14) of the 30x30 Hessian of PoseInertialOptimizationLastFrame.
+    // Same as Marginalize(H,0,14).block<15,15>(15,15), using the zero blocks between the current
+    // biases and the previous pose, velocity and other bias.
+    static Eigen::Matrix<double,15,15> MarginalizePreviousFrame(const Eigen::Matrix<double,30,30> &H);
     // Condition block element (start:end,start:end). Fill with zeros.
     static Eigen::MatrixXd Condition(const Eigen::MatrixXd &H, const int &start, const int &end);
     // Remove link between element 1 and 2. Given elements 1,2 and 3 must define the whole matrix.
     static Eigen::MatrixXd Sparsify(const Eigen::MatrixXd &H, const int &start1, const int &end1, const int &start2, const int &end2);
 
     // Inertial pose-graph
-    void static InertialOptimization(Map *pMap, Eigen::Matrix3d &Rwg, double &scale, Eigen::Vector3d &bg, Eigen::Vector3d &ba, bool bMono, Eigen::MatrixXd  &covInertial, bool bFixedVel=false, bool bGauss=false, float priorG = 1e2, float priorA = 1e6);
+    // nIterations can be lower when Rwg, scale, the velocities and biases of the keyframes come from a closed-form initialization
+    void static InertialOptimization(Map *pMap, Eigen::Matrix3d &Rwg, double &scale, Eigen::Vector3d &bg, Eigen::Vector3d &ba, bool bMono, Eigen::MatrixXd  &covInertial, bool bFixedVel=false, bool bGauss=false, float priorG = 1e2, float priorA = 1e6, int nIterations = 200);
     void static InertialOptimization(Map *pMap, Eigen::Vector3d &bg, Eigen::Vector3d &ba, float priorG = 1e2, float priorA = 1e6);
     void static InertialOptimization(vector<KeyFrame*> vpKFs, Eigen::Vector3d &bg, Eigen::Vector3d &ba, float priorG = 1e2, float priorA = 1e6);
     void static InertialOptimization(Map *pMap, Eigen::Matrix3d &Rwg, double &scale);
+
+    // Sparse linear solver of the large problems (full BA and essential graph) of the System settings
+    template<class BlockSolverT>
+    static typename BlockSolverT::LinearSolverType* NewSparseLinearSolver(const OptimizerSettings &settings)
+    {
+#ifdef G2O_HAVE_CHOLMOD
+        if(settings.linearSolver == OptimizerSettings::LINEAR_SOLVER_CHOLMOD)
+            return new g2o::LinearSolverCholmod<typename BlockSolverT::PoseMatrixType>();
+#endif
+        if(settings.linearSolver == OptimizerSettings::LINEAR_SOLVER_PCG)
+            return new g2o::LinearSolverPCG<typename BlockSolverT::PoseMatrixType>();
+        return new g2o::LinearSolverEigen<typename BlockSolverT::PoseMatrixType>();
+    }
+
+    // Iterations and rounds (optimization passes between outlier checks) of the last
+    // PoseOptimization, LocalBundleAdjustment or OptimizeEssentialGraph run by the calling thread
+    struct IterationStats
+    {
+        IterationStats(): nIterations(0), nRounds(0) {}
+
+        int nIterations;
+        int nRounds;
+    };
+
+    static IterationStats GetLastIterationStats();
+
+protected:
+    // Same as BundleAdjustment and the last part of LocalBundleAdjustment, solved with VisualBASolver
+    void static BundleAdjustmentNative(const std::vector<KeyFrame*> &vpKF, const std::vector<MapPoint*> &vpMP,
+                                       int nIterations, bool *pbStopFlag, const unsigned long nLoopKF, const bool bRobust);
+    void static LocalBundleAdjustmentNative(KeyFrame* pKF, bool *pbStopFlag, Map *pMap, const std::list<KeyFrame*> &lLocalKeyFrames,
+                                            const std::list<KeyFrame*> &lFixedCameras, const std::list<MapPoint*> &lLocalMapPoints, int& num_edges);
+
+    static thread_local IterationStats mstLastStats;
 };
 
 } //namespace ORB_SLAM3
@@ -0,0 +1,84 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef OPTIMIZERSETTINGS_H
+#define OPTIMIZERSETTINGS_H
+
+#include <cstddef>
+
+namespace ORB_SLAM3
+{
+
+class ThreadPool;
+
+// Options of the optimizations of one System, set from the settings file. The Optimizer reads
+// them from the SystemContext of the map it works on (defaults when the map has none).
+struct OptimizerSettings
+{
+    // Sparse linear solver of the large problems (full BA and essential graph)
+    enum eLinearSolverType{
+        LINEAR_SOLVER_EIGEN=0,
+        LINEAR_SOLVER_CHOLMOD=1,
+        LINEAR_SOLVER_PCG=2     // no factorization, for maps too large for the sparse Cholesky
+    };
+
+    // Engine of the visual-only BundleAdjustment and LocalBundleAdjustment
+    enum eVisualBAEngine{
+        VISUAL_BA_G2O=0,
+        VISUAL_BA_NATIVE=1      // VisualBASolver, parallel on the thread pool if given
+    };
+
+    // Early termination of the Levenberg-Marquardt runs of PoseOptimization, LocalBundleAdjustment
+    // (g2o engine) and OptimizeEssentialGraph. A run stops after an accepted step that decreases the
+    // cost by less than relativeDecrease (fraction of the cost) or whose update norm is below
+    // updateNorm, 0 disables a criterion (fixed iteration counts).
+    struct ConvergenceCriteria
+    {
+        ConvergenceCriteria(): relativeDecrease(0.0), updateNorm(0.0) {}
+        bool Enabled() const { return relativeDecrease>0.0 || updateNorm>0.0; }
+
+        double relativeDecrease;
+        double updateNorm;
+    };
+
+    OptimizerSettings(): linearSolver(LINEAR_SOLVER_EIGEN), visualBAEngine(VISUAL_BA_G2O),
+        bVisualBASingle(false), pThreadPool(static_cast<ThreadPool*>(NULL)) {}
+
+    // Returns false (and keeps the current solver) if the type was not compiled in
+    bool SetLinearSolverType(eLinearSolverType type)
+    {
+#ifndef G2O_HAVE_CHOLMOD
+        if(type == LINEAR_SOLVER_CHOLMOD)
+            return false;
+#endif
+        linearSolver = type;
+        return true;
+    }
+
+    eLinearSolverType linearSolver;
+    eVisualBAEngine visualBAEngine;
+    // Single-precision residuals and Jacobians in the native visual BA (VisualBASolver::SINGLE)
+    bool bVisualBASingle;
+    // Workers of the native visual BA (NULL: serial), owned by the System
+    ThreadPool* pThreadPool;
+    ConvergenceCriteria convergence;
+};
+
+} //namespace ORB_SLAM3
+
+#endif // OPTIMIZERSETTINGS_H
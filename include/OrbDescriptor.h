@@ -0,0 +1,69 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ORBDESCRIPTOR_H
+#define ORBDESCRIPTOR_H
+
+#include <opencv2/core/core.hpp>
+
+#include <vector>
+
+namespace ORB_SLAM3
+{
+
+// Orientation (intensity centroid) and rBRIEF descriptors of the keypoints of a pyramid level.
+// The moments of the circular patch are accumulated 8 pixels at a time (SSE2 or NEON) with
+// per row weight tables that already contain the circular mask, giving the same integers as
+// the scalar loops. The 256 tests are steered with the pattern rotated in advance to
+// ANGLE_BINS angles, as the original ORB does, instead of rotating and rounding every point
+// for every keypoint, and are compared 16 at a time.
+class OrbDescriptor
+{
+public:
+    // Steering resolution, 1 degree: the rotated points are at most 0.16 pixels away from the
+    // exactly rotated ones, so nearly all of them round to the same pixel (a coarser table, as
+    // the 12 degrees of the original ORB, changes a noticeable number of bits)
+    static const int ANGLE_BINS = 360;
+
+    // pattern holds the 512 points of the 256 tests, umax the end of each row of the patch
+    void Init(const std::vector<cv::Point> &pattern, const std::vector<int> &umax);
+
+    // Angle in degrees (as cv::fastAtan2) of every keypoint
+    void ComputeOrientation(const cv::Mat &image, std::vector<cv::KeyPoint> &keypoints) const;
+
+    // Descriptor of keypoints[i] in row vOutputRows[i] of descriptors (image already blurred)
+    void ComputeDescriptors(const cv::Mat &image, const std::vector<cv::KeyPoint> &keypoints,
+                            const std::vector<int> &vOutputRows, cv::Mat &descriptors) const;
+
+protected:
+    void Moments(const unsigned char* pCenter, const int step, int &m01, int &m10) const;
+
+    std::vector<int> mvUMax;
+
+    // Per row v of the patch, 32 weights for u in [-15,16]: u (m_10) and v (m_01) inside the
+    // circle, 0 outside
+    std::vector<short> mvWeightU;
+    std::vector<short> mvWeightV;
+
+    // Test points (x,y) rotated to every angle bin, 1024 per bin
+    std::vector<signed char> mvRotatedPattern;
+};
+
+} //namespace ORB_SLAM3
+
+#endif // ORBDESCRIPTOR_H
@@ -0,0 +1,77 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PLACERECOGNITIONSCHEDULER_H
+#define PLACERECOGNITIONSCHEDULER_H
+
+#include "ORBVocabulary.h"
+#include "FlatBowVector.h"
+
+#include <chrono>
+#include <vector>
+
+namespace ORB_SLAM3
+{
+
+class KeyFrame;
+
+// Keeps place recognition within fBudget ms per keyframe when keyframes arrive faster than the
+// database can be queried. The cost of a query is measured per BoW candidate (exponential moving
+// average), since the geometric verification of the candidates dominates it.
+//  - A query takes as many candidates (up to three) as fit in the budget.
+//  - When the queued keyframes would take more than the budget to query, the queue is coalesced:
+//    only the most novel keyframe (least similar to the last queried one) is queried and the rest
+//    are just added to the database.
+class PlaceRecognitionScheduler
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    static const int MAX_CANDIDATES = 3;
+
+    // fBudget: time (ms) the query of a keyframe may take
+    PlaceRecognitionScheduler(const float fBudget);
+
+    // Whether the nQueued keyframes (the next one included) should be coalesced into one query
+    bool ShouldCoalesce(const int nQueued) const;
+
+    // Index in vpKFs of the keyframe least similar to the last queried one
+    int SelectKeyFrame(const std::vector<KeyFrame*> &vpKFs, ORBVocabulary* pVoc) const;
+
+    // Number of BoW candidates per query (loop and merge) that fit in the budget
+    int NumCandidates() const;
+
+    // A query of pKF with nCandidates started at tStart
+    void Record(KeyFrame* pKF, const int nCandidates, const Clock::time_point &tStart);
+
+    double GetCandidateCost() const { return mCandidateCost; }
+
+protected:
+    float mfBudget;
+
+    double mCandidateCost;
+    bool mbMeasured;
+
+    // BoW of the last queried keyframe, the keyframe itself may be culled meanwhile
+    DBoW2::BowVector mLastBowVec;
+    FlatBowVector mLastFlatBowVec;
+};
+
+} //namespace ORB_SLAM
+
+#endif // PLACERECOGNITIONSCHEDULER_H
@@ -0,0 +1,138 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef POSESOLVER_H
+#define POSESOLVER_H
+
+#include <Eigen/Core>
+
+#include <vector>
+
+namespace ORB_SLAM3
+{
+
+class GeometricCamera;
+
+// Pose-only bundle adjustment of a single frame (6 DoF), used by Optimizer::PoseOptimization.
+// It solves the same problem as the one-vertex g2o graph (VertexSE3Expmap with the OnlyPose
+// edges): Levenberg-Marquardt with the g2o damping strategy, left update exp(dx)*Tcw and Huber
+// kernel. The 6x6 system is accumulated directly, so there is no graph to build, and the
+// observation buffers keep their capacity from one frame to the next.
+class PoseSolver
+{
+public:
+    typedef Eigen::Matrix<double,6,6> Matrix6d;
+    typedef Eigen::Matrix<double,6,1> Vector6d;
+
+    enum eObsType{
+        MONO=0,         // left camera, 2D
+        MONO_RIGHT=1,   // right camera of a rigid rig (through Trl), 2D
+        STEREO=2,       // rectified stereo (u, v, uRight), 3D
+        MONO_RIG=3      // additional camera of a CameraRig (through its Rcb/tcb), 2D
+    };
+
+    PoseSolver();
+
+    // Start a new problem. pCamera2/Rrl/trl are only used by MONO_RIGHT observations and the
+    // pinhole parameters only by STEREO observations.
+    void Reset(GeometricCamera* pCamera, GeometricCamera* pCamera2,
+               const Eigen::Matrix3d &Rrl, const Eigen::Vector3d &trl,
+               const double fx, const double fy, const double cx, const double cy, const double bf,
+               const double deltaMono, const double deltaStereo);
+
+    // Add an observation with isotropic information invSigma2. Returns its index in the solver.
+    // ur is ignored by MONO and MONO_RIGHT observations.
+    int AddObservation(const eObsType type, const Eigen::Vector3d &Xw, const double u, const double v, const double ur,
+                       const double invSigma2);
+
+    // Camera of a rig for the MONO_RIG observations (pose Rcb/tcb relative to the optimized camera),
+    // returns its index for AddRigObservation
+    int AddRigCamera(GeometricCamera* pCamera, const Eigen::Matrix3d &Rcb, const Eigen::Vector3d &tcb);
+    int AddRigObservation(const int nRigCamera, const Eigen::Vector3d &Xw, const double u, const double v, const double invSigma2);
+
+    int NumObservations() const { return mvType.size(); }
+    eObsType GetType(const int i) const { return static_cast<eObsType>(mvType[i]); }
+
+    // Inactive observations do not take part in the optimization (g2o level 1)
+    void SetActive(const int i, const bool bActive) { mvbActive[i] = bActive; }
+    bool IsActive(const int i) const { return mvbActive[i]; }
+    void SetRobust(const bool bRobust) { mbRobust = bRobust; }
+    bool IsRobust() const { return mbRobust; }
+
+    // Stop an Optimize run after an accepted step that decreases the robust cost by less than
+    // minRelativeDecrease (fraction of the cost) or whose update norm is below minUpdateNorm.
+    // 0 disables a criterion (the default).
+    void SetConvergence(const double minRelativeDecrease, const double minUpdateNorm)
+    {
+        mMinRelativeDecrease = minRelativeDecrease;
+        mMinUpdateNorm = minUpdateNorm;
+    }
+
+    // Run up to nIterations of Levenberg-Marquardt starting from (Rcw, tcw), which receive the result.
+    // Afterwards Chi2() is valid for every observation, active or not. Returns the iterations run.
+    int Optimize(Eigen::Matrix3d &Rcw, Eigen::Vector3d &tcw, const int nIterations);
+
+    // e'*Info*e of the observation at the last optimized pose, without robust kernel
+    double Chi2(const int i) const { return mvChi2[i]; }
+
+    // Same as g2o::SE3Quat::exp, update = (omega, upsilon)
+    static void ExpSE3(const Vector6d &update, Eigen::Matrix3d &R, Eigen::Vector3d &t);
+
+protected:
+    // Points in the camera frame for the pose (Rcw, tcw)
+    void TransformPoints(const Eigen::Matrix3d &Rcw, const Eigen::Vector3d &tcw);
+    // Unweighted chi2 of every observation for the transformed points
+    void ComputeChi2();
+    // Robust cost of the active observations. If pH is not NULL the Gauss-Newton system
+    // H dx = -g is accumulated as well.
+    double Linearize(Matrix6d* pH, Vector6d* pg);
+    // Residual (obs - projection) of observation i, the third row is zero for 2D observations.
+    // The Jacobian w.r.t. the left update is written to pJ if not NULL.
+    void Residual(const int i, Eigen::Vector3d &e, Eigen::Matrix<double,3,6>* pJ) const;
+    double Robustify(const double chi2, const double delta, double &w) const;
+
+    GeometricCamera* mpCamera;
+    GeometricCamera* mpCamera2;
+    Eigen::Matrix3d mRrl;
+    Eigen::Vector3d mtrl;
+    double mfx, mfy, mcx, mcy, mbf;
+    double mDeltaMono, mDeltaStereo;
+    bool mbRobust;
+    double mMinRelativeDecrease, mMinUpdateNorm;
+
+    // Rig cameras of the MONO_RIG observations
+    std::vector<GeometricCamera*> mvpRigCameras;
+    std::vector<Eigen::Matrix3d> mvRigRcb;
+    std::vector<Eigen::Vector3d> mvRigtcb;
+
+    // Observations as structure of arrays (mvRigCamera: rig camera of MONO_RIG observations)
+    std::vector<unsigned char> mvType;
+    std::vector<int> mvRigCamera;
+    std::vector<bool> mvbActive;
+    std::vector<double> mvXw, mvYw, mvZw;
+    std::vector<double> mvU, mvV, mvUr;
+    std::vector<double> mvInfo;
+    std::vector<double> mvChi2;
+
+    // Points in the camera frame at the pose being evaluated
+    std::vector<double> mvXc, mvYc, mvZc;
+};
+
+} //namespace ORB_SLAM3
+
+#endif // POSESOLVER_H
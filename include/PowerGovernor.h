@@ -0,0 +1,69 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef POWERGOVERNOR_H
+#define POWERGOVERNOR_H
+
+#include <atomic>
+
+namespace ORB_SLAM3
+{
+
+// Low-power (duty-cycled) operation. The CPU time of the process per tracked frame, averaged, is
+// kept under fBudget ms by delaying the background work rather than the frames: at level L Local
+// Mapping waits for L+1 queued keyframes and processes them in one burst (the thread sleeps in
+// between), and place recognition queries one of every L+1 keyframes (the others are only added
+// to the database). Over the budget the level goes up, with spare time it comes back down.
+// Update is called by Tracking, Local Mapping and Loop Closing read the level.
+class PowerGovernor
+{
+public:
+    // nMaxLevel: largest burst minus one. fMaxDelay: longest time (s) a keyframe waits for its burst
+    PowerGovernor(const float fBudget, const int nMaxLevel, const float fMaxDelay);
+
+    // After each tracked frame
+    void Update();
+
+    int GetLevel() const { return mnLevel.load(std::memory_order_relaxed); }
+    int GetBurstSize() const { return GetLevel()+1; }
+    int GetLoopStride() const { return GetLevel()+1; }
+    float GetMaxDelay() const { return mfMaxDelay; }
+
+    // Averaged CPU time (ms) of the process per frame
+    double GetFrameCpuTime() const { return mFrameCpuTime; }
+
+protected:
+    // CPU time (ms) used by all the threads of the process
+    static double ProcessCpuTime();
+
+    float mfBudget;
+    int mnMaxLevel;
+    float mfMaxDelay;
+
+    double mLastCpuTime;
+    double mFrameCpuTime;
+    bool mbMeasured;
+    // Frames left before the next change
+    int mnHold;
+
+    std::atomic<int> mnLevel;
+};
+
+} //namespace ORB_SLAM
+
+#endif // POWERGOVERNOR_H
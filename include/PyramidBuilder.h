@@ -0,0 +1,79 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PYRAMIDBUILDER_H
+#define PYRAMIDBUILDER_H
+
+#include <cstddef>
+#include <vector>
+
+namespace ORB_SLAM3
+{
+
+// Rows of an image produced on demand instead of read from memory, for instance rectified from
+// the input image, so that the first pyramid level is built without the intermediate image
+class PyramidRowSource
+{
+public:
+    virtual ~PyramidRowSource(){}
+
+    // Row y of the image (its width of pixels) into pRow
+    virtual void GetRow(const int y, unsigned char* pRow) = 0;
+};
+
+// Builds a pyramid level and its blurred copy in one pass over the rows of the level. Every
+// row is resized (or copied), its border is reflected, and it goes through the horizontal
+// blur while it is still in cache. The vertical blur runs 3 rows behind on a ring of 7
+// horizontally blurred rows. The vertical resize and both blur passes use SSE2 or NEON. The
+// working rows are kept between calls, so once the sizes settle nothing is allocated.
+class PyramidBuilder
+{
+public:
+    // dw x dh level in pDst, resized from the sw x sh image at pSrc. The resize is bilinear
+    // with the geometry and 11 bit coefficients of cv::resize(INTER_LINEAR), and a plain copy
+    // when the sizes are equal. The border pixels around pDst are filled as BORDER_REFLECT_101.
+    // The level blurred with a 7x7 Gaussian (sigma 2) goes to pBlur, with its borders
+    // reflected within the level, as GaussianBlur with BORDER_REFLECT_101+BORDER_ISOLATED.
+    // Levels must be larger than the border, and border>=3. If the sizes are equal and pRowSource
+    // is given, the rows are taken from it instead of pSrc.
+    void Build(const unsigned char* pSrc, const size_t srcStep, const int sw, const int sh,
+               unsigned char* pDst, const size_t dstStep, const int dw, const int dh, const int border,
+               unsigned char* pBlur, const size_t blurStep, PyramidRowSource* pRowSource = NULL);
+
+protected:
+    // Slot of the two cached rows with source row sy horizontally resized, as (value*2048)>>4.
+    // A missing row replaces the oldest one, never the one in avoidSlot.
+    int ResizedRow(const unsigned char* pSrc, const size_t srcStep, const int sy, const int dw, const int avoidSlot);
+
+    void BlurRowHorizontal(const unsigned char* pRow, const int w, unsigned short* pOut);
+    void BlurRowVertical(const unsigned short* const* pRows, const int w, unsigned char* pOut);
+
+    // Horizontal resize: first source pixel and the two weights of every column
+    std::vector<int> mvXOffset;
+    std::vector<short> mvXAlpha;
+
+    std::vector<short> mvResizedRows;
+    int mnResizedRow[2];
+
+    // Ring of horizontally blurred rows
+    std::vector<unsigned short> mvBlurRows;
+};
+
+} //namespace ORB_SLAM3
+
+#endif // PYRAMIDBUILDER_H
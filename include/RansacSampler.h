@@ -0,0 +1,195 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RANSACSAMPLER_H
+#define RANSACSAMPLER_H
+
+#include <algorithm>
+#include <vector>
+#include <cstddef>
+
+namespace ORB_SLAM3
+{
+
+// Minimal set sampling and hypothesis evaluation shared by the RANSAC solvers (MLPnPsolver, Sim3Solver).
+// UNIFORM draws every minimal set at random from all correspondences. PROSAC draws them from a progressively
+// growing set of the best-ranked correspondences (Chum and Matas, CVPR 2005), so good hypotheses show up in
+// the first iterations. With SPRT each hypothesis is verified with Wald's sequential probability ratio test
+// (Matas and Chum, ICCV 2005) and bad hypotheses are rejected after a few correspondences.
+class RansacSampler
+{
+public:
+    enum eSampling{
+        UNIFORM=0,
+        PROSAC=1
+    };
+
+    RansacSampler();
+
+    // vQuality holds one score per correspondence, lower is better (e.g. descriptor distance).
+    // nMaxIts is the number of samples after which PROSAC has grown to all correspondences.
+    // epsilon is the expected inlier ratio and modelCost the cost of one hypothesis in correspondence checks.
+    void Configure(eSampling sampling, bool bSPRT, const std::vector<float> &vQuality, int nMinSet, int nMaxIts,
+                   float epsilon, float modelCost);
+
+    // Draw the next minimal set (indices into the correspondences)
+    void Sample(std::vector<size_t> &vSample);
+
+    // Check the correspondences of a hypothesis. isConsistent(i) tells whether correspondence i is an inlier.
+    // Returns false if the hypothesis was rejected by SPRT before all correspondences were checked,
+    // in that case vbInliers and nInliers are incomplete and must not be used.
+    template<class F>
+    bool Evaluate(F isConsistent, std::vector<bool> &vbInliers, int &nInliers, bool bSPRT = true)
+    {
+        nInliers = 0;
+
+        if(!bSPRT || !mbSPRT)
+        {
+            for(int i=0; i<N; i++)
+            {
+                vbInliers[i] = isConsistent(i);
+                if(vbInliers[i])
+                    nInliers++;
+            }
+            return true;
+        }
+
+        double lambda = 1.0;
+        for(int j=0; j<N; j++)
+        {
+            const size_t i = mvVerificationOrder[j];
+            if(isConsistent(i))
+            {
+                vbInliers[i] = true;
+                nInliers++;
+                lambda *= mdDelta/mdEpsilon;
+            }
+            else
+            {
+                vbInliers[i] = false;
+                lambda *= (1.0-mdDelta)/(1.0-mdEpsilon);
+            }
+
+            if(lambda>mdA)
+            {
+                RejectHypothesis(nInliers,j+1);
+                return false;
+            }
+        }
+
+        AcceptHypothesis(nInliers);
+        return true;
+    }
+
+    // Same as Evaluate, but the correspondences are checked nBlock at a time so that the check can be
+    // vectorized: checkBlock(pIndices,n,pbConsistent) sets pbConsistent[k] for correspondence pIndices[k],
+    // k<n<=nBlock. With SPRT the rest of the block is wasted when a hypothesis is rejected in the middle.
+    template<class F>
+    bool EvaluateBlocks(F checkBlock, const int nBlock, std::vector<bool> &vbInliers, int &nInliers, bool bSPRT = true)
+    {
+        nInliers = 0;
+        mvBlockConsistent.resize(nBlock);
+        unsigned char* pbConsistent = mvBlockConsistent.data();
+
+        if(!bSPRT || !mbSPRT)
+        {
+            for(int j=0; j<N; j+=nBlock)
+            {
+                const int n = std::min(nBlock,N-j);
+                checkBlock(&mvSequence[j],n,pbConsistent);
+                for(int k=0; k<n; k++)
+                {
+                    vbInliers[j+k] = pbConsistent[k];
+                    if(pbConsistent[k])
+                        nInliers++;
+                }
+            }
+            return true;
+        }
+
+        double lambda = 1.0;
+        for(int j=0; j<N; j+=nBlock)
+        {
+            const int n = std::min(nBlock,N-j);
+            checkBlock(&mvVerificationOrder[j],n,pbConsistent);
+            for(int k=0; k<n; k++)
+            {
+                const size_t i = mvVerificationOrder[j+k];
+                if(pbConsistent[k])
+                {
+                    vbInliers[i] = true;
+                    nInliers++;
+                    lambda *= mdDelta/mdEpsilon;
+                }
+                else
+                {
+                    vbInliers[i] = false;
+                    lambda *= (1.0-mdDelta)/(1.0-mdEpsilon);
+                }
+
+                if(lambda>mdA)
+                {
+                    RejectHypothesis(nInliers,j+k+1);
+                    return false;
+                }
+            }
+        }
+
+        AcceptHypothesis(nInliers);
+        return true;
+    }
+
+protected:
+
+    void RejectHypothesis(int nConsistent, int nTested);
+    void AcceptHypothesis(int nInliers);
+
+    // SPRT decision threshold for the current epsilon and delta
+    void ComputeThreshold();
+
+    eSampling mSampling;
+    bool mbSPRT;
+
+    int N;
+    int mnMinSet;
+
+    // PROSAC: correspondences sorted by quality, size of the current subset and
+    // sample number at which the subset of each size is reached
+    std::vector<size_t> mvOrder;
+    // Correspondences in their order (EvaluateBlocks without SPRT) and consistency of the current block
+    std::vector<size_t> mvSequence;
+    std::vector<unsigned char> mvBlockConsistent;
+    std::vector<int> mvGrowth;
+    int mnSubset;
+    int mnSamples;
+
+    // SPRT: random verification order, inlier ratio of good hypotheses (epsilon),
+    // probability of a correspondence being consistent with a bad hypothesis (delta) and threshold
+    std::vector<size_t> mvVerificationOrder;
+    double mdEpsilon;
+    double mdDelta;
+    double mdA;
+    double mdModelCost;
+    double mdDeltaThreshold;
+    double mdSumDelta;
+    int mnRejected;
+};
+
+} //namespace ORB_SLAM
+
+#endif // RANSACSAMPLER_H
@@ -0,0 +1,75 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RELOCALIZATIONCACHE_H
+#define RELOCALIZATIONCACHE_H
+
+#include <vector>
+#include <memory>
+#include <cstddef>
+
+#include "Thirdparty/DBoW2/DBoW2/BowVector.h"
+
+namespace ORB_SLAM3
+{
+
+class Frame;
+class KeyFrame;
+class FlatFeatureVector;
+
+// Compact copy of a keyframe for the first pass of the relocalization: the descriptors of the
+// keypoints whose map points have the most observations, packed contiguously and sorted by
+// vocabulary node. Candidates are ranked by how many of these descriptors find a close frame
+// descriptor in the same node, reading a couple of KB per candidate instead of its features,
+// and only the best ones go through SearchByBoW and MLPnP.
+class RelocalizationCache
+{
+public:
+    // Descriptors kept per keyframe
+    static const int MAX_POINTS = 64;
+
+    // Descriptors of a frame in the order of its FlatFeatureVector, so that the descriptors of
+    // every node are contiguous. Built once per relocalization
+    class Query
+    {
+    public:
+        explicit Query(const Frame &F);
+
+    protected:
+        friend class RelocalizationCache;
+        const FlatFeatureVector &mFeatVec;
+        std::vector<unsigned char> mvDescriptors;
+    };
+
+    // Built from the features of pKF, which must be resident
+    static std::shared_ptr<const RelocalizationCache> Build(KeyFrame* pKF);
+
+    // Cached descriptors with a frame descriptor of the same node closer than thDist
+    int Score(const Query &query, const int thDist) const;
+
+    size_t Size() const { return mvNodeIds.size(); }
+    size_t MemoryBytes() const;
+
+protected:
+    std::vector<DBoW2::NodeId> mvNodeIds;
+    std::vector<unsigned char> mvDescriptors;
+};
+
+} //namespace ORB_SLAM
+
+#endif // RELOCALIZATIONCACHE_H
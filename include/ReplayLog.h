@@ -0,0 +1,165 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef REPLAYLOG_H
+#define REPLAYLOG_H
+
+#include "ImuTypes.h"
+
+#include <opencv2/core/core.hpp>
+
+#include <condition_variable>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace ORB_SLAM3
+{
+
+// Record and deterministic replay of a run, to compare performance changes on exactly the same
+// work. A recording (directory) holds the input frames (lossless images and IMU) and the decisions
+// that depend on the thread timing:
+//  - the keyframe decision of Tracking and the queue checks and scheduler decisions made by
+//    Local Mapping while it processes a keyframe,
+//  - the place recognition scheduling of Loop Closing (coalesced keyframes, number of candidates),
+//  - for every unit of work of the other threads (a keyframe of Local Mapping or Loop Closing,
+//    deferred work, a finished global BA), the number of frames Tracking had started when it ended.
+// On replay the decisions are taken from the log and the threads are serialized: before every
+// frame Tracking hands the turn, in the recorded order, to the work that ended before that frame
+// and waits for it. Local BA is therefore never aborted by a new keyframe, so replays reproduce
+// each other (same keyframes, same map) rather than the interleaving of the recorded run.
+// If the replay diverges (a thread does not get its work done) it continues without serializing.
+class ReplayLog
+{
+public:
+    enum eMode
+    {
+        RECORD=0,
+        REPLAY
+    };
+
+    // Work units of the threads other than Tracking
+    enum eWork
+    {
+        LOCAL_MAPPING_KEYFRAME=0,
+        LOCAL_MAPPING_DEFERRED,
+        LOOP_CLOSING_KEYFRAME,
+        GLOBAL_BA,
+        NUM_WORK
+    };
+
+    enum eDecision
+    {
+        NEW_KEYFRAME=0,
+        LOCAL_MAPPING_QUEUE,
+        LOCAL_MAPPING_FUSE,
+        LOCAL_MAPPING_BA,
+        LOCAL_MAPPING_CULLING,
+        LOOP_CLOSING_COALESCE,
+        LOOP_CLOSING_CANDIDATES,
+        NUM_DECISIONS
+    };
+
+    // Input of Tracking for one frame
+    struct Frame
+    {
+        double timestamp;
+        std::vector<std::string> vstrImages;
+        std::vector<IMU::Point> vImu;
+    };
+
+    // NULL if the directory cannot be created (record) or does not hold a recording (replay)
+    static ReplayLog* Open(const std::string &strDir, const eMode mode, const int sensor);
+    ~ReplayLog();
+
+    eMode GetMode() const { return mMode; }
+    int GetSensor() const { return mnSensor; }
+
+    // Recorded frames (replay)
+    size_t NumFrames() const { return mvFrames.size(); }
+    const Frame& GetFrame(const size_t i) const { return mvFrames[i]; }
+    // Images of frame i, as they were passed to the system
+    void LoadImages(const size_t i, std::vector<cv::Mat> &vIms) const;
+
+    // Saves the input of a frame (record)
+    void RecordInput(const std::vector<cv::Mat> &vIms, const double timestamp, const std::vector<IMU::Point> &vImu);
+
+    // Called by the tracking thread before every frame. Counts the frame when recording, hands
+    // the turn to the recorded work when replaying
+    void BeginFrame();
+
+    // Recorded value of a decision that depends on the thread timing (bValue when recording, or
+    // when the log is exhausted)
+    bool Decide(const eDecision decision, const bool bValue);
+    int Decide(const eDecision decision, const int nValue);
+
+    // Whether the thread may do the work now (always when recording)
+    bool HasTurn(const eWork work);
+    // Blocks until the work has the turn or *pbCancel is set
+    void WaitTurn(const eWork work, const bool* pbCancel);
+    // The thread finished a unit of work
+    void WorkDone(const eWork work);
+
+    // Wakes the thread that does the work when it gets the turn
+    void SetWakeUp(const eWork work, const std::function<void()> &wakeUp);
+
+    // Stops serializing the threads, e.g. on shutdown
+    void Release();
+
+protected:
+    ReplayLog(const std::string &strDir, const eMode mode, const int sensor);
+
+    bool Load();
+    void WriteImage(const cv::Mat &im, const std::string &strFile);
+
+    struct Event
+    {
+        int work;
+        unsigned long nFrame;
+    };
+
+    const std::string mStrDir;
+    const eMode mMode;
+    int mnSensor;
+
+    std::mutex mMutex;
+    std::condition_variable mcvTurn;
+    // Frames started by Tracking
+    unsigned long mnFrame;
+
+    // Record
+    std::ofstream mLog;
+    unsigned long mnInputs;
+
+    // Replay
+    std::vector<Frame> mvFrames;
+    std::vector<Event> mvEvents;
+    size_t mnNextEvent;
+    std::vector<int> mvDecisions[NUM_DECISIONS];
+    size_t mvnNextDecision[NUM_DECISIONS];
+    // Work that has the turn (-1 if none)
+    int mnTurn;
+    bool mbReleased;
+    std::function<void()> mvWakeUp[NUM_WORK];
+};
+
+} //namespace ORB_SLAM3
+
+#endif // REPLAYLOG_H
@@ -0,0 +1,52 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SENSORCONFIG_H
+#define SENSORCONFIG_H
+
+namespace ORB_SLAM3
+{
+
+// Camera configuration of a frame as seen by the loops over its keypoints, fixed when the frame
+// is built (Frame::mCameraSetup):
+//  CAMERA_MONOCULAR: one camera, no right coordinates (mvuRight is -1 everywhere)
+//  CAMERA_RECTIFIED: one camera with right coordinates where known (rectified stereo, RGB-D)
+//  CAMERA_SPLIT: two cameras (stereo fisheye), keypoints [0,Nleft) in the left image and [Nleft,N)
+//                in the right one
+// The inertial sensors do not change the per-keypoint work, so they are not part of it.
+enum CameraSetup
+{
+    CAMERA_MONOCULAR=0,
+    CAMERA_RECTIFIED=1,
+    CAMERA_SPLIT=2
+};
+
+// What each configuration needs from a keypoint, for the search and optimization loops templated
+// on the configuration: the branches of the other configurations compile out of them.
+template<int Setup>
+struct CameraSetupTraits
+{
+    // mvuRight may hold a right coordinate
+    static const bool bRightCoords = (Setup==CAMERA_RECTIFIED);
+    // Right camera keypoints after the left ones (Nleft, mvLeftToRightMatch, mvRightToLeftMatch)
+    static const bool bSplit = (Setup==CAMERA_SPLIT);
+};
+
+} //namespace ORB_SLAM3
+
+#endif // SENSORCONFIG_H
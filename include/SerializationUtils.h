@@ -0,0 +1,130 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SERIALIZATION_UTILS_H
+#define SERIALIZATION_UTILS_H
+
+#include <opencv2/core/core.hpp>
+
+#include <boost/serialization/serialization.hpp>
+#include <boost/serialization/split_free.hpp>
+#include <boost/serialization/array.hpp>
+#include <boost/serialization/tracking.hpp>
+#include <boost/serialization/level.hpp>
+
+// Free boost serialization functions for the OpenCV types stored in the Atlas.
+// Matrix data is written as one raw block so binary archives can load it with a
+// single read, and none of these types are tracked (they are never shared through pointers).
+
+namespace boost
+{
+namespace serialization
+{
+
+template<class Archive>
+void save(Archive &ar, const cv::Mat &mat, const unsigned int version)
+{
+    int rows = mat.rows, cols = mat.cols, type = mat.type();
+    ar & rows & cols & type;
+    if(mat.empty())
+        return;
+
+    cv::Mat matCont = mat.isContinuous() ? mat : mat.clone();
+    const unsigned int data_size = matCont.total() * matCont.elemSize();
+    ar & boost::serialization::make_array(matCont.ptr(), data_size);
+}
+
+template<class Archive>
+void load(Archive &ar, cv::Mat &mat, const unsigned int version)
+{
+    int rows, cols, type;
+    ar & rows & cols & type;
+    if(rows <= 0 || cols <= 0)
+    {
+        mat.release();
+        return;
+    }
+
+    mat.create(rows, cols, type);
+    const unsigned int data_size = mat.total() * mat.elemSize();
+    ar & boost::serialization::make_array(mat.ptr(), data_size);
+}
+
+template<class Archive>
+void serialize(Archive &ar, cv::Mat &mat, const unsigned int version)
+{
+    boost::serialization::split_free(ar, mat, version);
+}
+
+// Fixed-size matrices have no header, only their elements
+template<class Archive, typename T, int m, int n>
+void serialize(Archive &ar, cv::Matx<T,m,n> &mat, const unsigned int version)
+{
+    ar & boost::serialization::make_array(mat.val, m*n);
+}
+
+template<class Archive>
+void serialize(Archive &ar, cv::KeyPoint &kp, const unsigned int version)
+{
+    ar & kp.pt.x & kp.pt.y;
+    ar & kp.size & kp.angle & kp.response;
+    ar & kp.octave & kp.class_id;
+}
+
+template<class Archive>
+void serialize(Archive &ar, cv::Point3f &p, const unsigned int version)
+{
+    ar & p.x & p.y & p.z;
+}
+
+} // namespace serialization
+} // namespace boost
+
+// BOOST_CLASS_IMPLEMENTATION and BOOST_CLASS_TRACKING for the cv::Matx template
+namespace boost
+{
+namespace serialization
+{
+
+template<typename T, int m, int n>
+struct implementation_level_impl<const cv::Matx<T,m,n> >
+{
+    typedef mpl::integral_c_tag tag;
+    typedef mpl::int_<object_serializable> type;
+    BOOST_STATIC_CONSTANT(int, value = implementation_level_impl::type::value);
+};
+
+template<typename T, int m, int n>
+struct tracking_level<cv::Matx<T,m,n> >
+{
+    typedef mpl::integral_c_tag tag;
+    typedef mpl::int_<track_never> type;
+    BOOST_STATIC_CONSTANT(int, value = tracking_level::type::value);
+};
+
+} // namespace serialization
+} // namespace boost
+
+BOOST_CLASS_IMPLEMENTATION(cv::Mat, boost::serialization::object_serializable)
+BOOST_CLASS_TRACKING(cv::Mat, boost::serialization::track_never)
+BOOST_CLASS_IMPLEMENTATION(cv::KeyPoint, boost::serialization::object_serializable)
+BOOST_CLASS_TRACKING(cv::KeyPoint, boost::serialization::track_never)
+BOOST_CLASS_IMPLEMENTATION(cv::Point3f, boost::serialization::object_serializable)
+BOOST_CLASS_TRACKING(cv::Point3f, boost::serialization::track_never)
+
+#endif // SERIALIZATION_UTILS_H
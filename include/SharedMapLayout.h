@@ -0,0 +1,204 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SHAREDMAPLAYOUT_H
+#define SHAREDMAPLAYOUT_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace ORB_SLAM3
+{
+
+// Shared memory region written by SharedMapPublisher (SharedMemory.Name) and read by other
+// processes with SharedMapReader. This header only needs the C++ standard library and POSIX, so
+// that the consumers can include it alone.
+//
+// One writer, any number of readers, no lock: the pose and the map are double buffered and every
+// buffer has a sequence number, odd while the writer is filling it. The writer fills the buffer
+// that is not current and then makes it current; a reader copies the current buffer and retries
+// if its sequence number changed meanwhile. Readers never block the SLAM threads.
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "the shared memory layout needs lock-free 64 bit atomics");
+
+struct SharedPose
+{
+    double timestamp;
+    int32_t trackingState;      // Tracking::eTrackingState
+    int32_t valid;              // 0 if tracking failed (Tcw is then the identity)
+    float Tcw[16];              // row major
+};
+
+struct SharedMapPoint
+{
+    uint64_t id;
+    uint64_t mapId;
+    float pos[3];
+    float pad;
+};
+
+struct SharedKeyFrame
+{
+    uint64_t id;
+    uint64_t mapId;
+    float Tcw[16];              // row major
+};
+
+struct SharedMapHeader
+{
+    static const uint32_t MAGIC = 0x4F53334D;   // "OS3M"
+    static const uint32_t LAYOUT_VERSION = 1;
+
+    uint32_t magic;
+    uint32_t layoutVersion;
+    uint64_t maxMapPoints;
+    uint64_t maxKeyFrames;
+    uint64_t mapBufferOffset[2];    // from the start of the region: points then keyframes
+    uint64_t regionSize;
+
+    // Number of poses / map snapshots published, the current buffer is (count-1)%2
+    std::atomic<uint64_t> nPoses;
+    std::atomic<uint64_t> nMaps;
+    std::atomic<uint64_t> poseSeq[2];
+    std::atomic<uint64_t> mapSeq[2];
+
+    SharedPose pose[2];
+    uint64_t nMapPoints[2];
+    uint64_t nKeyFrames[2];
+    // 1 if the map had more elements than the region holds
+    uint32_t truncated[2];
+};
+
+inline size_t SharedMapRegionSize(const uint64_t nMaxMapPoints, const uint64_t nMaxKeyFrames)
+{
+    return sizeof(SharedMapHeader) + 2*(nMaxMapPoints*sizeof(SharedMapPoint) + nMaxKeyFrames*sizeof(SharedKeyFrame));
+}
+
+// Reader side, for the processes that consume the region
+class SharedMapReader
+{
+public:
+    SharedMapReader(): mpHeader(static_cast<SharedMapHeader*>(NULL)), mnSize(0) {}
+    ~SharedMapReader() { Close(); }
+
+    // False if the region does not exist (yet) or has another layout
+    bool Open(const std::string &strName)
+    {
+        Close();
+        const int fd = shm_open(strName.c_str(), O_RDONLY, 0);
+        if(fd < 0)
+            return false;
+        struct stat st;
+        if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SharedMapHeader))
+        {
+            close(fd);
+            return false;
+        }
+        void* p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if(p == MAP_FAILED)
+            return false;
+
+        mpHeader = static_cast<SharedMapHeader*>(p);
+        mnSize = st.st_size;
+        if(mpHeader->magic != SharedMapHeader::MAGIC || mpHeader->layoutVersion != SharedMapHeader::LAYOUT_VERSION ||
+           mpHeader->regionSize != mnSize)
+        {
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    void Close()
+    {
+        if(mpHeader)
+            munmap(mpHeader, mnSize);
+        mpHeader = static_cast<SharedMapHeader*>(NULL);
+        mnSize = 0;
+    }
+
+    // Last pose. Returns its number (0: none published yet)
+    uint64_t ReadPose(SharedPose &pose) const
+    {
+        while(true)
+        {
+            const uint64_t n = mpHeader->nPoses.load(std::memory_order_acquire);
+            if(n == 0)
+                return 0;
+            const int b = (n-1)%2;
+            const uint64_t s1 = mpHeader->poseSeq[b].load(std::memory_order_acquire);
+            if(s1 & 1)
+                continue;
+            std::memcpy(&pose, (const void*)&mpHeader->pose[b], sizeof(SharedPose));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(mpHeader->poseSeq[b].load(std::memory_order_relaxed) == s1)
+                return n;
+        }
+    }
+
+    // Last map snapshot. Returns its number (0: none published yet), nLastMap skips the copy if
+    // that snapshot was already read
+    uint64_t ReadMap(std::vector<SharedMapPoint> &vPoints, std::vector<SharedKeyFrame> &vKeyFrames,
+                     bool &bTruncated, const uint64_t nLastMap = 0) const
+    {
+        while(true)
+        {
+            const uint64_t n = mpHeader->nMaps.load(std::memory_order_acquire);
+            if(n == 0 || n == nLastMap)
+                return n;
+            const int b = (n-1)%2;
+            const uint64_t s1 = mpHeader->mapSeq[b].load(std::memory_order_acquire);
+            if(s1 & 1)
+                continue;
+
+            const char* pBuffer = reinterpret_cast<const char*>(mpHeader) + mpHeader->mapBufferOffset[b];
+            const uint64_t nPoints = std::min(mpHeader->nMapPoints[b], mpHeader->maxMapPoints);
+            const uint64_t nKFs = std::min(mpHeader->nKeyFrames[b], mpHeader->maxKeyFrames);
+            vPoints.resize(nPoints);
+            vKeyFrames.resize(nKFs);
+            if(nPoints)
+                std::memcpy(vPoints.data(), pBuffer, nPoints*sizeof(SharedMapPoint));
+            if(nKFs)
+                std::memcpy(vKeyFrames.data(), pBuffer + mpHeader->maxMapPoints*sizeof(SharedMapPoint), nKFs*sizeof(SharedKeyFrame));
+            bTruncated = mpHeader->truncated[b] != 0;
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(mpHeader->mapSeq[b].load(std::memory_order_relaxed) == s1)
+                return n;
+        }
+    }
+
+private:
+    SharedMapHeader* mpHeader;
+    size_t mnSize;
+};
+
+} //namespace ORB_SLAM3
+
+#endif // SHAREDMAPLAYOUT_H
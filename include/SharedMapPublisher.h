@@ -0,0 +1,86 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SHAREDMAPPUBLISHER_H
+#define SHAREDMAPPUBLISHER_H
+
+#include "SharedMapLayout.h"
+#include "MapEvents.h"
+
+#include <opencv2/core/core.hpp>
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace ORB_SLAM3
+{
+
+// Publishes the last camera pose and a snapshot of the maps in a POSIX shared memory region
+// (SharedMemory.Name) for the other processes of the robot, read with SharedMapReader without
+// any serialization or SLAM lock. The pose is written by the tracking thread after every frame.
+// The map is followed through the map events (System::SubscribeMapEvents) and written by this
+// thread at most SharedMemory.MapFPS times per second, only when it changed.
+class SharedMapPublisher
+{
+public:
+    SharedMapPublisher(const std::string &strName, const size_t nMaxMapPoints, const size_t nMaxKeyFrames, const float fMapFPS);
+    // Removes the region
+    ~SharedMapPublisher();
+
+    bool IsOpen() const { return mpHeader != static_cast<SharedMapHeader*>(NULL); }
+
+    // Main thread function
+    void Run();
+
+    // Tracking thread, empty Tcw if tracking failed
+    void PublishPose(const double timestamp, const cv::Mat &Tcw, const int trackingState);
+
+    // MapEvents subscriber
+    void OnMapEvents(const MapEvents::Batch &batch);
+
+    void RequestFinish();
+    bool isFinished();
+
+protected:
+    void WriteMap();
+
+    bool CheckFinish();
+    void SetFinish();
+
+    std::string mStrName;
+    SharedMapHeader* mpHeader;
+    size_t mnSize;
+    float mfMapFPS;
+
+    // Current content of the maps, by id
+    std::mutex mMutexMap;
+    std::condition_variable mcvMap;
+    std::unordered_map<long unsigned int, SharedMapPoint> mmPoints;
+    std::unordered_map<long unsigned int, SharedKeyFrame> mmKeyFrames;
+    bool mbMapChanged;
+
+    std::mutex mMutexFinish;
+    bool mbFinishRequested;
+    bool mbFinished;
+};
+
+} //namespace ORB_SLAM3
+
+#endif // SHAREDMAPPUBLISHER_H
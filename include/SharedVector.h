@@ -0,0 +1,91 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SHAREDVECTOR_H
+#define SHAREDVECTOR_H
+
+#include <vector>
+#include <memory>
+#include <cstddef>
+
+namespace ORB_SLAM3
+{
+
+// Reference counted vector for the per-image data that is written once and then only read
+// (keypoints, feature grid). Copies share the storage, so copying a frame into the last frame or
+// into a keyframe does not copy its features. Read access only, writers go through Mutable(),
+// which copies the storage first if it is shared, or Replace() when the contents are rebuilt.
+// Converts to const std::vector<T>& so it can be passed where a vector is expected.
+template<class T>
+class SharedVector
+{
+public:
+    typedef T value_type;
+    typedef typename std::vector<T>::const_iterator const_iterator;
+
+    SharedVector(): mpData(std::make_shared<std::vector<T> >()) {}
+    explicit SharedVector(const std::vector<T> &v): mpData(std::make_shared<std::vector<T> >(v)) {}
+
+    // No move operations, a moved from object keeps sharing the storage instead of losing it
+    SharedVector(const SharedVector &other) = default;
+    SharedVector& operator=(const SharedVector &other) = default;
+
+    const T& operator[](size_t i) const { return (*mpData)[i]; }
+    size_t size() const { return mpData->size(); }
+    bool empty() const { return mpData->empty(); }
+    const_iterator begin() const { return mpData->begin(); }
+    const_iterator end() const { return mpData->end(); }
+    const T* data() const { return mpData->data(); }
+
+    operator const std::vector<T>&() const { return *mpData; }
+    const std::vector<T>& get() const { return *mpData; }
+
+    SharedVector& operator=(const std::vector<T> &v)
+    {
+        Replace() = v;
+        return *this;
+    }
+
+    // Writable storage, the current contents are copied if another object shares them
+    std::vector<T>& Mutable()
+    {
+        if(mpData.use_count()>1)
+            mpData = std::make_shared<std::vector<T> >(*mpData);
+        return *mpData;
+    }
+
+    // Empty writable storage, for contents that are rebuilt from scratch. Keeps the capacity
+    // when the storage is not shared.
+    std::vector<T>& Replace()
+    {
+        if(mpData.use_count()>1)
+            mpData = std::make_shared<std::vector<T> >();
+        else
+            mpData->clear();
+        return *mpData;
+    }
+
+    void clear() { Replace(); }
+
+private:
+    std::shared_ptr<std::vector<T> > mpData;
+};
+
+} //namespace ORB_SLAM
+
+#endif // SHAREDVECTOR_H
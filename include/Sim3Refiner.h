@@ -0,0 +1,100 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SIM3REFINER_H
+#define SIM3REFINER_H
+
+#include <Eigen/Core>
+
+#include <vector>
+
+namespace ORB_SLAM3
+{
+
+class GeometricCamera;
+
+// Refinement of the similarity S12 between two keyframes (7 DoF, or 6 with fixed scale), used by
+// Optimizer::OptimizeSim3. It solves the same problem as the g2o graph of one VertexSim3Expmap and
+// fixed points (EdgeSim3ProjectXYZ and EdgeInverseSim3ProjectXYZ): every correspondence has a point
+// X2 of camera 2 observed in image 1 through S12 and a point X1 of camera 1 observed in image 2
+// through S12^-1. Levenberg-Marquardt with the g2o damping strategy, Huber kernel, analytic
+// Jacobians and left update S12 <- exp(dx)*S12. The 7x7 system is accumulated directly and the
+// buffers keep their capacity from one problem to the next.
+class Sim3Refiner
+{
+public:
+    typedef Eigen::Matrix<double,7,7> Matrix7d;
+    typedef Eigen::Matrix<double,7,1> Vector7d;
+
+    Sim3Refiner();
+
+    // Start a new problem
+    void Reset(GeometricCamera* pCamera1, GeometricCamera* pCamera2, const bool bFixScale, const double delta);
+
+    // Add a correspondence, X1 and X2 in the frame of their camera. Returns its index in the solver.
+    int AddCorrespondence(const Eigen::Vector3d &X1, const Eigen::Vector3d &X2,
+                          const Eigen::Vector2d &obs1, const double invSigma2_1,
+                          const Eigen::Vector2d &obs2, const double invSigma2_2);
+
+    int NumCorrespondences() const { return mvbActive.size(); }
+
+    // Inactive correspondences do not take part in the optimization (removed edges)
+    void SetActive(const int i, const bool bActive) { mvbActive[i] = bActive; }
+    bool IsActive(const int i) const { return mvbActive[i]; }
+    void SetRobust(const bool bRobust) { mbRobust = bRobust; }
+
+    // Run nIterations of Levenberg-Marquardt starting from x1 = s12*R12*x2 + t12, which receive the result.
+    // Afterwards Chi2 is valid for every correspondence, active or not.
+    void Optimize(Eigen::Matrix3d &R12, Eigen::Vector3d &t12, double &s12, const int nIterations);
+
+    // e'*Info*e of the projection in image 1 (of X2) and in image 2 (of X1) at the last optimized
+    // similarity, without robust kernel
+    double Chi2Image1(const int i) const { return mvChi2_1[i]; }
+    double Chi2Image2(const int i) const { return mvChi2_2[i]; }
+
+protected:
+    // X2 in camera 1 and X1 in camera 2 for the similarity (R12, t12, s12)
+    void TransformPoints(const Eigen::Matrix3d &R12, const Eigen::Vector3d &t12, const double s12);
+    void ComputeChi2();
+    // Robust cost of the active correspondences. If pH is not NULL the Gauss-Newton system
+    // H dx = -g is accumulated as well.
+    double Linearize(const Eigen::Matrix3d &R12, const double s12, Matrix7d* pH, Vector7d* pg);
+    double Robustify(const double chi2, double &w) const;
+
+    GeometricCamera* mpCamera1;
+    GeometricCamera* mpCamera2;
+    bool mbFixScale;
+    double mDelta;
+    bool mbRobust;
+
+    // Correspondences as structure of arrays
+    std::vector<bool> mvbActive;
+    std::vector<double> mvX1, mvY1, mvZ1;
+    std::vector<double> mvX2, mvY2, mvZ2;
+    std::vector<double> mvU1, mvV1, mvInfo1;
+    std::vector<double> mvU2, mvV2, mvInfo2;
+    std::vector<double> mvChi2_1, mvChi2_2;
+
+    // X2 in camera 1 (S12*X2) and X1 in camera 2 (S12^-1*X1) at the similarity being evaluated
+    std::vector<double> mvX21, mvY21, mvZ21;
+    std::vector<double> mvX12, mvY12, mvZ12;
+};
+
+} //namespace ORB_SLAM3
+
+#endif // SIM3REFINER_H
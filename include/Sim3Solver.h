@@ -21,9 +21,11 @@
 #define SIM3SOLVER_H
 
 #include <opencv2/opencv.hpp>
+#include <Eigen/Core>
 #include <vector>
 
 #include "KeyFrame.h"
+#include "RansacSampler.h"
 
 
 
@@ -39,6 +41,9 @@ public:
 
     void SetRansacParameters(double probability = 0.99, int minInliers = 6 , int maxIterations = 300);
 
+    // Guided (PROSAC) sampling by descriptor distance and/or SPRT evaluation of the hypotheses. Default is uniform.
+    void SetSamplingStrategy(RansacSampler::eSampling sampling, bool bSPRT);
+
     cv::Mat find(std::vector<bool> &vbInliers12, int &nInliers);
 
     cv::Mat iterate(int nIterations, bool &bNoMore, std::vector<bool> &vbInliers, int &nInliers);
@@ -51,14 +56,22 @@ public:
 
 protected:
 
-    void ComputeCentroid(cv::Mat &P, cv::Mat &Pr, cv::Mat &C);
+    // Horn's closed form on the minimal set, columns of P1 and P2 (points in camera 1 and 2)
+    void ComputeSim3(const Eigen::Matrix3f &P1, const Eigen::Matrix3f &P2);
+
+    // Returns false if bSPRT and the hypothesis was rejected early
+    bool CheckInliers(bool bSPRT = false);
 
-    void ComputeSim3(cv::Mat &P1, cv::Mat &P2);
+    // Reprojection of n correspondences in both images with the current hypothesis: the points are
+    // transformed in plain loops over the arrays and projected with one projectMany call per camera
+    void CheckBlock(const size_t* pIndices, const int n, unsigned char* pbConsistent);
 
-    void CheckInliers();
+    // Copy the current hypothesis to the best one
+    void StoreBest();
+
+    void ConfigureSampler();
 
     void Project(const std::vector<cv::Mat> &vP3Dw, std::vector<cv::Mat> &vP2D, cv::Mat Tcw, GeometricCamera* pCamera);
-    void FromCameraToImage(const std::vector<cv::Mat> &vP3Dc, std::vector<cv::Mat> &vP2D, GeometricCamera* pCamera);
 
 
 protected:
@@ -67,8 +80,11 @@ protected:
     KeyFrame* mpKF1;
     KeyFrame* mpKF2;
 
-    std::vector<cv::Mat> mvX3Dc1;
-    std::vector<cv::Mat> mvX3Dc2;
+    // Points in the camera of each keyframe and their projections, as structure of arrays
+    std::vector<float> mvX1, mvY1, mvZ1;
+    std::vector<float> mvX2, mvY2, mvZ2;
+    std::vector<float> mvU1, mvV1;
+    std::vector<float> mvU2, mvV2;
     std::vector<MapPoint*> mvpMapPoints1;
     std::vector<MapPoint*> mvpMapPoints2;
     std::vector<MapPoint*> mvpMatches12;
@@ -82,11 +98,13 @@ protected:
     int mN1;
 
     // Current Estimation
-    cv::Mat mR12i;
-    cv::Mat mt12i;
+    Eigen::Matrix3f mR12i;
+    Eigen::Vector3f mt12i;
     float ms12i;
-    cv::Mat mT12i;
-    cv::Mat mT21i;
+    // x1 = sR12*x2 + t12 and x2 = sR21*x1 + t21
+    Eigen::Matrix3f msR12i;
+    Eigen::Matrix3f msR21i;
+    Eigen::Vector3f mt21i;
     std::vector<bool> mvbInliersi;
     int mnInliersi;
 
@@ -104,10 +122,15 @@ protected:
 
     // Indices for random selection
     std::vector<size_t> mvAllIndices;
+    std::vector<size_t> mvSample;
+
+    // Descriptor distance of each correspondence, used to rank them for PROSAC
+    std::vector<float> mvQuality;
 
-    // Projections
-    std::vector<cv::Mat> mvP1im1;
-    std::vector<cv::Mat> mvP2im2;
+    // Sampling of the minimal sets and evaluation of the hypotheses
+    RansacSampler mSampler;
+    RansacSampler::eSampling mSampling;
+    bool mbSPRT;
 
     // RANSAC probability
     double mRansacProb;
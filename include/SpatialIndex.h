@@ -0,0 +1,295 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SPATIALINDEX_H
+#define SPATIALINDEX_H
+
+#include "CameraModels/GeometricCamera.h"
+
+#include <opencv2/core/core.hpp>
+
+#include <vector>
+#include <utility>
+#include <unordered_map>
+#include <cmath>
+
+namespace ORB_SLAM3
+{
+
+// Voxel hash over world positions (map points, keyframe camera centers). Items are bucketed in
+// cubic cells of side cellSize, queries only visit the cells that can intersect the query volume.
+// Not thread safe, the owner (Map) takes care of locking.
+template<class T>
+class SpatialIndex
+{
+public:
+    SpatialIndex(const float cellSize=1.0f): mfCellSize(cellSize), mfInvCellSize(1.0f/cellSize), mfCellRadius(0.5f*std::sqrt(3.0f)*cellSize) {}
+
+    // Camera Tcw seeing the points closer than maxDepth that project inside [minX,maxX]x[minY,maxY]
+    struct Frustum
+    {
+        Frustum(const cv::Matx44f &Tcw, GeometricCamera* pCam, const float minx, const float maxx,
+                const float miny, const float maxy, const float maxd):
+            Rcw(Tcw.get_minor<3,3>(0,0)), tcw(Tcw.get_minor<3,1>(0,3)), pCamera(pCam), fx(pCam->getParameter(0)),
+            minX(minx), maxX(maxx), minY(miny), maxY(maxy), maxDepth(maxd) {}
+
+        cv::Matx33f Rcw;
+        cv::Matx31f tcw;
+        GeometricCamera* pCamera;
+        float fx;
+        float minX, maxX, minY, maxY, maxDepth;
+    };
+
+    // Insert the item or move it to its new position
+    void Insert(T* p, const cv::Matx31f &pos)
+    {
+        const CellKey key = Key(pos);
+        typename std::unordered_map<T*,CellKey>::iterator it = mmItemCells.find(p);
+        if(it!=mmItemCells.end())
+        {
+            if(it->second==key)
+            {
+                Cell &cell = mmCells[key];
+                for(size_t i=0; i<cell.size(); i++)
+                    if(cell[i].first==p)
+                        cell[i].second = pos;
+                return;
+            }
+            EraseFromCell(p,it->second);
+            it->second = key;
+        }
+        else
+            mmItemCells[p] = key;
+
+        mmCells[key].push_back(std::make_pair(p,pos));
+    }
+
+    // Update the position of an item only if it is already indexed
+    void Update(T* p, const cv::Matx31f &pos)
+    {
+        if(mmItemCells.count(p))
+            Insert(p,pos);
+    }
+
+    void Erase(T* p)
+    {
+        typename std::unordered_map<T*,CellKey>::iterator it = mmItemCells.find(p);
+        if(it==mmItemCells.end())
+            return;
+        EraseFromCell(p,it->second);
+        mmItemCells.erase(it);
+    }
+
+    void Clear()
+    {
+        mmCells.clear();
+        mmItemCells.clear();
+    }
+
+    // Exchanges the items (not the cell size) in constant time, e.g. to free them somewhere else
+    void Swap(SpatialIndex &other)
+    {
+        mmCells.swap(other.mmCells);
+        mmItemCells.swap(other.mmItemCells);
+    }
+
+    size_t Size() const { return mmItemCells.size(); }
+
+    // Items closer than r to center
+    void GetInRadius(const cv::Matx31f &center, const float r, std::vector<T*> &vpItems) const
+    {
+        const float r2 = r*r;
+        const int minX = Coord(center(0)-r), maxX = Coord(center(0)+r);
+        const int minY = Coord(center(1)-r), maxY = Coord(center(1)+r);
+        const int minZ = Coord(center(2)-r), maxZ = Coord(center(2)+r);
+
+        // A large radius on a sparse map is cheaper going through the occupied cells
+        const double nQueryCells = double(maxX-minX+1)*double(maxY-minY+1)*double(maxZ-minZ+1);
+        if(nQueryCells>mmCells.size())
+        {
+            for(typename CellMap::const_iterator mit=mmCells.begin(); mit!=mmCells.end(); mit++)
+                AddInRadius(mit->second,center,r2,vpItems);
+            return;
+        }
+
+        for(int x=minX; x<=maxX; x++)
+            for(int y=minY; y<=maxY; y++)
+                for(int z=minZ; z<=maxZ; z++)
+                {
+                    typename CellMap::const_iterator mit = mmCells.find(Key(x,y,z));
+                    if(mit!=mmCells.end())
+                        AddInRadius(mit->second,center,r2,vpItems);
+                }
+    }
+
+    // Items in front of the camera Tcw, closer than maxDepth and projecting inside [minX,maxX]x[minY,maxY].
+    // Only the cells around the camera center closer than maxDepth are visited (or all the occupied
+    // cells when there are fewer), each one first tested as a whole with its bounding sphere.
+    void GetInFrustum(const cv::Matx44f &Tcw, GeometricCamera* pCamera, const float minX, const float maxX,
+                      const float minY, const float maxY, const float maxDepth, std::vector<T*> &vpItems) const
+    {
+        const Frustum frustum(Tcw,pCamera,minX,maxX,minY,maxY,maxDepth);
+
+        // A deep frustum on a sparse map is cheaper going through the occupied cells
+        const double nSide = 2.0*double(maxDepth)*mfInvCellSize+2.0;
+        if(nSide*nSide*nSide>mmCells.size())
+        {
+            for(typename CellMap::const_iterator mit=mmCells.begin(); mit!=mmCells.end(); mit++)
+                if(CellInFrustum(mit->first,frustum))
+                    AddInFrustum(mit->second,frustum,vpItems);
+            return;
+        }
+
+        const cv::Matx31f Ow = -frustum.Rcw.t()*frustum.tcw;
+        const int minCX = Coord(Ow(0)-maxDepth), maxCX = Coord(Ow(0)+maxDepth);
+        const int minCY = Coord(Ow(1)-maxDepth), maxCY = Coord(Ow(1)+maxDepth);
+        const int minCZ = Coord(Ow(2)-maxDepth), maxCZ = Coord(Ow(2)+maxDepth);
+
+        for(int x=minCX; x<=maxCX; x++)
+            for(int y=minCY; y<=maxCY; y++)
+                for(int z=minCZ; z<=maxCZ; z++)
+                {
+                    const CellKey key = Key(x,y,z);
+                    typename CellMap::const_iterator mit = mmCells.find(key);
+                    if(mit!=mmCells.end() && CellInFrustum(key,frustum))
+                        AddInFrustum(mit->second,frustum,vpItems);
+                }
+    }
+
+    // Keeps the items of vpItems whose cell can be seen by one of the cameras (same test as
+    // GetInFrustum), so that only those are projected one by one. Items not in the index are kept.
+    void FilterInFrustum(const std::vector<Frustum> &vFrustums, std::vector<T*> &vpItems) const
+    {
+        // The items of a local map fall in a few cells, each one is tested once
+        std::unordered_map<CellKey,bool> mCellVisible;
+        size_t nKept = 0;
+        for(size_t i=0; i<vpItems.size(); i++)
+        {
+            typename std::unordered_map<T*,CellKey>::const_iterator it = mmItemCells.find(vpItems[i]);
+            if(it!=mmItemCells.end())
+            {
+                std::pair<typename std::unordered_map<CellKey,bool>::iterator,bool> ins = mCellVisible.insert(std::make_pair(it->second,false));
+                if(ins.second)
+                    for(size_t j=0; j<vFrustums.size() && !ins.first->second; j++)
+                        ins.first->second = CellInFrustum(it->second,vFrustums[j]);
+                if(!ins.first->second)
+                    continue;
+            }
+            vpItems[nKept++] = vpItems[i];
+        }
+        vpItems.resize(nKept);
+    }
+
+private:
+    typedef long long int CellKey;
+    typedef std::vector<std::pair<T*,cv::Matx31f> > Cell;
+    typedef std::unordered_map<CellKey,Cell> CellMap;
+
+    int Coord(const float v) const { return int(std::floor(v*mfInvCellSize)); }
+
+    // Whether some point of the cell can be in the frustum, with the bounding sphere of the cell
+    bool CellInFrustum(const CellKey key, const Frustum &f) const
+    {
+        const cv::Matx31f Pc = f.Rcw*CellCenter(key)+f.tcw;
+        if(Pc(2)+mfCellRadius<=0 || Pc(2)-mfCellRadius>f.maxDepth)
+            return false;
+
+        // The whole cell is in front of the camera: its projection is inside a circle around the center's
+        if(Pc(2)>mfCellRadius)
+        {
+            const cv::Point2f uv = f.pCamera->project(Pc);
+            const float margin = f.fx*mfCellRadius/(Pc(2)-mfCellRadius);
+            if(uv.x+margin<f.minX || uv.x-margin>f.maxX || uv.y+margin<f.minY || uv.y-margin>f.maxY)
+                return false;
+        }
+        return true;
+    }
+
+    static void AddInFrustum(const Cell &cell, const Frustum &f, std::vector<T*> &vpItems)
+    {
+        for(size_t i=0; i<cell.size(); i++)
+        {
+            const cv::Matx31f Xc = f.Rcw*cell[i].second+f.tcw;
+            if(Xc(2)<=0 || Xc(2)>f.maxDepth)
+                continue;
+            const cv::Point2f uv = f.pCamera->project(Xc);
+            if(uv.x<f.minX || uv.x>f.maxX || uv.y<f.minY || uv.y>f.maxY)
+                continue;
+            vpItems.push_back(cell[i].first);
+        }
+    }
+
+    // 21 bits per axis, enough for +-1e6 cells
+    static CellKey Key(const int x, const int y, const int z)
+    {
+        const CellKey mask = (CellKey(1)<<21)-1;
+        return ((CellKey(x)&mask)<<42) | ((CellKey(y)&mask)<<21) | (CellKey(z)&mask);
+    }
+
+    CellKey Key(const cv::Matx31f &pos) const { return Key(Coord(pos(0)),Coord(pos(1)),Coord(pos(2))); }
+
+    cv::Matx31f CellCenter(const CellKey key) const
+    {
+        // Sign-extend the 21 bit coordinates
+        const int x = int((key<<1)>>43);
+        const int y = int((key<<22)>>43);
+        const int z = int((key<<43)>>43);
+        return cv::Matx31f((x+0.5f)*mfCellSize,(y+0.5f)*mfCellSize,(z+0.5f)*mfCellSize);
+    }
+
+    void EraseFromCell(T* p, const CellKey key)
+    {
+        typename CellMap::iterator mit = mmCells.find(key);
+        if(mit==mmCells.end())
+            return;
+        Cell &cell = mit->second;
+        for(size_t i=0; i<cell.size(); i++)
+        {
+            if(cell[i].first==p)
+            {
+                cell[i] = cell.back();
+                cell.pop_back();
+                break;
+            }
+        }
+        if(cell.empty())
+            mmCells.erase(mit);
+    }
+
+    static void AddInRadius(const Cell &cell, const cv::Matx31f &center, const float r2, std::vector<T*> &vpItems)
+    {
+        for(size_t i=0; i<cell.size(); i++)
+        {
+            const cv::Matx31f d = cell[i].second-center;
+            if(d.dot(d)<=r2)
+                vpItems.push_back(cell[i].first);
+        }
+    }
+
+    float mfCellSize;
+    float mfInvCellSize;
+    // Radius of the sphere bounding a cell
+    float mfCellRadius;
+
+    CellMap mmCells;
+    std::unordered_map<T*,CellKey> mmItemCells;
+};
+
+} //namespace ORB_SLAM3
+
+#endif // SPATIALINDEX_H
@@ -0,0 +1,83 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef STEREORECTIFIER_H
+#define STEREORECTIFIER_H
+
+#include <opencv2/core/core.hpp>
+
+#include "PyramidBuilder.h"
+
+namespace ORB_SLAM3
+{
+
+// Rectification of the stereo images inside the library (Stereo.Rectify), with the LEFT.* and
+// RIGHT.* calibration of the settings that the examples used to rectify with cv::remap. The maps
+// of cv::initUndistortRectifyMap are kept in fixed point (source pixel and 5 bit fractions, as
+// cv::convertMaps to CV_16SC2 and CV_16UC1) and the rectified rows are produced on demand, with the
+// gray conversion of color inputs done on the source pixels. The feature extractors take them as
+// the rows of their first pyramid level, so there is no rectified nor gray intermediate image.
+// The interpolation is bilinear with a constant 0 border, as cv::remap(INTER_LINEAR).
+class StereoRectifier
+{
+public:
+    // Rectified images have the size of the inputs
+    StereoRectifier(const cv::Mat &K_l, const cv::Mat &D_l, const cv::Mat &R_l, const cv::Mat &P_l, const cv::Size &size_l,
+                    const cv::Mat &K_r, const cv::Mat &D_r, const cv::Mat &R_r, const cv::Mat &P_r, const cv::Size &size_r);
+
+    // From LEFT.K, LEFT.D, LEFT.R, LEFT.P, LEFT.width, LEFT.height and the same for RIGHT. NULL if
+    // any of them is missing.
+    static StereoRectifier* FromSettings(cv::FileStorage &fSettings);
+
+    // Rectified gray rows of image im of camera 0 (left) or 1 (right): 8-bit gray, or 3/4 channel
+    // color in RGB or BGR order. The source refers to im and is valid until the next call for the camera.
+    PyramidRowSource* Source(const int cam, const cv::Mat &im, const bool bRGB);
+
+    // Whole rectified gray image, for the users of the image itself
+    void Rectify(const int cam, const cv::Mat &im, const bool bRGB, cv::Mat &imRect);
+
+    cv::Size GetSize(const int cam) const { return mCams[cam].size; }
+
+protected:
+    struct Camera
+    {
+        cv::Size size;
+        // Source pixel (x,y) and fractions (fy*32+fx) of every rectified pixel
+        cv::Mat map1, map2;
+    };
+
+    class RowSource : public PyramidRowSource
+    {
+    public:
+        RowSource(): mpCam(static_cast<const Camera*>(NULL)), mbRGB(false) {}
+        void Set(const Camera* pCam, const cv::Mat &im, const bool bRGB);
+        void GetRow(const int y, unsigned char* pRow) override;
+
+    protected:
+        const Camera* mpCam;
+        cv::Mat mIm;
+        bool mbRGB;
+    };
+
+    Camera mCams[2];
+    RowSource mSources[2];
+};
+
+} //namespace ORB_SLAM3
+
+#endif // STEREORECTIFIER_H
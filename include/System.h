@@ -25,6 +25,11 @@
 #include<stdlib.h>
 #include<string>
 #include<thread>
+#include<list>
+#include<condition_variable>
+#include<atomic>
+#include<functional>
+#include<chrono>
 #include<opencv2/core/core.hpp>
 
 #include "Tracking.h"
@@ -38,6 +43,8 @@
 #include "Viewer.h"
 #include "ImuTypes.h"
 #include "Config.h"
+#include "SystemContext.h"
+#include "MemoryUsage.h"
 
 
 namespace ORB_SLAM3
@@ -72,10 +79,20 @@ public:
 
 class Viewer;
 class FrameDrawer;
+class MapStreamer;
+class TileStreamer;
+class TrajectoryWriter;
+class TrajectoryStore;
+class AgentClient;
+class SharedMapPublisher;
 class Atlas;
 class Tracking;
 class LocalMapping;
 class LoopClosing;
+class ThreadPool;
+class Metrics;
+class ReplayLog;
+class PowerGovernor;
 
 class System
 {
@@ -89,6 +106,14 @@ public:
         IMU_STEREO=4
     };
 
+    // What Submit* does when the pipeline input queue (System.InputQueueSize) is full
+    enum eDropPolicy{
+        BLOCK=0,                    // wait for room
+        DROP_OLDEST=1,              // drop the oldest queued images
+        KEEP_LATEST=2,              // drop all the queued images, only the newest wait
+        KEEP_KEYFRAME_CANDIDATES=3  // drop the oldest queued images that are not keyframe candidates
+    };
+
     // File type
     enum eFileType{
         TEXT_FILE=0,
@@ -98,8 +123,20 @@ public:
 public:
 
     // Initialize the SLAM system. It launches the Local Mapping, Loop Closing and Viewer threads.
+    // The vocabulary is loaded in the background (see LoadVocabularyAsync).
     System(const string &strVocFile, const string &strSettingsFile, const eSensor sensor, const bool bUseViewer = true, const int initFr = 0, const string &strSequence = std::string(), const string &strLoadingFile = std::string());
 
+    // Same with a vocabulary loaded by the caller (see LoadVocabulary), which several systems can share
+    // as it is only read. It must outlive the Shutdown() of all of them.
+    System(ORBVocabulary* pVocabulary, const string &strSettingsFile, const eSensor sensor, const bool bUseViewer = true, const int initFr = 0, const string &strSequence = std::string(), const string &strLoadingFile = std::string());
+
+    // Text or binary (.bin, memory mapped) vocabulary. NULL if it cannot be loaded.
+    static ORBVocabulary* LoadVocabulary(const string &strVocFile);
+
+    // Same, returning while the file is read by another thread (see VocabularyLoader). NULL if it
+    // cannot be opened.
+    static ORBVocabulary* LoadVocabularyAsync(const string &strVocFile);
+
     // Proccess the given stereo frame. Images must be synchronized and rectified.
     // Input images: RGB (CV_8UC3) or grayscale (CV_8U). RGB is converted to grayscale.
     // Returns the camera pose (empty if tracking fails).
@@ -111,11 +148,53 @@ public:
     // Returns the camera pose (empty if tracking fails).
     cv::Mat TrackRGBD(const cv::Mat &im, const cv::Mat &depthmap, const double &timestamp, string filename="");
 
+    // Process a stereo frame whose disparity or depth was computed by the camera. imDepth is registered
+    // to the rectified left image: disparity in pixels if bDisparity, depth in meters otherwise, both
+    // after division by DepthMapFactor (optional for stereo, default 1). CV_16U, CV_32F or CV_8U; zero
+    // or negative values are invalid. The right image is not needed: neither its ORB extraction nor
+    // the stereo matching are run. Pinhole stereo (Stereo and Stereo-Inertial) only.
+    // Returns the camera pose (empty if tracking fails).
+    cv::Mat TrackStereoDepth(const cv::Mat &imLeft, const cv::Mat &imDepth, const bool bDisparity, const double &timestamp, const vector<IMU::Point>& vImuMeas = vector<IMU::Point>(), string filename="");
+
     // Proccess the given monocular frame and optionally imu data
     // Input images: RGB (CV_8UC3) or grayscale (CV_8U). RGB is converted to grayscale.
     // Returns the camera pose (empty if tracking fails).
     cv::Mat TrackMonocular(const cv::Mat &im, const double &timestamp, const vector<IMU::Point>& vImuMeas = vector<IMU::Point>(), string filename="");
 
+    // TrackStereo/TrackMonocular with a camera rig (Rig.* settings): vImRig holds the images of the
+    // additional cameras, taken at the same time, in the order of the settings. Their features are
+    // extracted in parallel and constrain the pose and the bundle adjustments; the points are
+    // created from the main camera(s) only.
+    // Not available in the pipelined Submit* calls.
+    cv::Mat TrackStereoRig(const cv::Mat &imLeft, const cv::Mat &imRight, const vector<cv::Mat> &vImRig, const double &timestamp, const vector<IMU::Point>& vImuMeas = vector<IMU::Point>(), string filename="");
+    cv::Mat TrackMonocularRig(const cv::Mat &im, const vector<cv::Mat> &vImRig, const double &timestamp, const vector<IMU::Point>& vImuMeas = vector<IMU::Point>(), string filename="");
+
+    // Zero-copy versions for grayscale (8 bit) images in buffers owned by the caller, e.g. the
+    // camera driver or a mapped DMA/shared memory buffer. step is the row stride in bytes
+    // (depth rows hold floats). The buffers are wrapped, not copied: they are only read during
+    // the call and must not be modified until it returns. After that the system keeps no
+    // reference to them and the caller can reuse or free them.
+    cv::Mat TrackStereo(const unsigned char* pLeft, const unsigned char* pRight, const int width, const int height, const size_t step, const double &timestamp, const vector<IMU::Point>& vImuMeas = vector<IMU::Point>(), string filename="");
+    cv::Mat TrackRGBD(const unsigned char* pIm, const size_t step, const float* pDepth, const size_t depthStep, const int width, const int height, const double &timestamp, string filename="");
+    cv::Mat TrackMonocular(const unsigned char* pIm, const int width, const int height, const size_t step, const double &timestamp, const vector<IMU::Point>& vImuMeas = vector<IMU::Point>(), string filename="");
+
+
+    // Pipelined tracking (stereo, stereo-inertial and RGB-D). Submit* queues the images and returns
+    // as soon as there is room in the pipeline, while one thread builds the frame (ORB extraction,
+    // stereo matching) of the next images and another one tracks the previous frame. The poses are
+    // returned in submission order by GetNextResult, which returns false when nothing is pending or,
+    // without bWait, when the next pose is not ready yet. The images are not copied: they must stay
+    // unmodified until their pose has been returned. Do not mix with the synchronous Track* calls.
+    // Localization mode changes and resets are applied once the frames in flight have been tracked.
+    // With System.DropPolicy, Submit* does not wait when the input queue is full but drops queued
+    // images instead (see GetDroppedFrames).
+    void SubmitStereo(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timestamp, const vector<IMU::Point>& vImuMeas = vector<IMU::Point>(), string filename="");
+    void SubmitRGBD(const cv::Mat &im, const cv::Mat &depthmap, const double &timestamp, string filename="");
+    bool GetNextResult(double &timestamp, cv::Mat &Tcw, bool bWait=true);
+
+    // Images dropped by Submit* under backlog (System.DropPolicy). They get no pose from
+    // GetNextResult and are released when dropped; their IMU measurements go to the next images.
+    unsigned long GetDroppedFrames();
 
     // This stops local mapping thread (map building) and performs only camera tracking.
     void ActivateLocalizationMode();
@@ -156,16 +235,77 @@ public:
     // See format details at: http://www.cvlibs.net/datasets/kitti/eval_odometry.php
     void SaveTrajectoryKITTI(const string &filename);
 
-    // TODO: Save/Load functions
-    // SaveMap(const string &filename);
-    // LoadMap(const string &filename);
+    // Save frame / keyframe poses of every map in the binary format of TrajectoryFile
+    // (fixed-size records with keyframe and map ids, and a timestamp index).
+    // Poses are of the IMU body with inertial sensors and of the camera otherwise.
+    // Call first Shutdown()
+    void SaveTrajectoryBinary(const string &filename);
+    void SaveKeyFrameTrajectoryBinary(const string &filename);
+
+    // Save the whole Atlas (every map with its keyframes, map points, covisibility and
+    // essential graph) together with the place recognition database to reuse it in a later
+    // session. The file is loaded at start-up when given with strLoadingFile or with the
+    // System.LoadAtlasFromFile setting. Binary files are chunked by section (AtlasArchive).
+    // Call first Shutdown()
+    bool SaveAtlas(const string &filename, const int type = BINARY_FILE);
+
+    // Offline refinement of every map of the Atlas with at least 3 keyframes (MapRefiner): point
+    // fusion, keyframe and point culling and a global BA of nIterations on all the cores. Local
+    // Mapping is stopped meanwhile, no frame may be tracked. Call it before Shutdown(), returns
+    // the number of maps refined
+    int RefineAtlas(const int nIterations, const bool bFuse = true, const bool bCullKeyFrames = true);
+
+    // Save the spans recorded by the SLAM threads in the Chrome trace format (chrome://tracing,
+    // Perfetto). Only in builds with WITH_TRACING, also done on Shutdown() when System.TraceFile
+    // is set. Call first Shutdown()
+    bool SaveTrace(const string &filename);
 
     // Information from most recent processed frame
     // You can call this right after TrackMonocular (or stereo or RGBD)
+    // Culled map points are reclaimed a few frames later, do not keep the tracked map points
+    // beyond the next call to TrackMonocular (or stereo or RGBD)
     int GetTrackingState();
+    // Degradations applied to meet Tracking.Deadline (TrackingDeadline::Degradation bit mask)
+    int GetTrackingDegradations();
     std::vector<MapPoint*> GetTrackedMapPoints();
     std::vector<cv::KeyPoint> GetTrackedKeyPointsUn();
 
+    // IMU prediction of the body pose and velocity at the last integrated measurement, between
+    // two frames. Requires IMU.IncrementalPreintegration, returns false otherwise or while the
+    // inertial state is not available
+    bool GetImuPrediction(double &timestamp, cv::Mat &Twb, cv::Mat &Vwb);
+
+    // Camera pose (Tcw) at any timestamp between the last System.TrajectoryStoreSize tracked frames,
+    // e.g. to deskew lidar scans. Interpolated on SE3 between the frames around it and composed with
+    // the current pose of their reference keyframes, so it includes the later local BA and loop
+    // corrections. Safe from any thread. False if disabled or outside the stored time range
+    bool GetPoseAtTime(const double timestamp, cv::Mat &Tcw);
+    bool GetTrajectoryTimeRange(double &firstTime, double &lastTime);
+
+    // Publishes the IMU propagated body pose (Twb) and velocity at IMU rate, from the state and
+    // bias of the last tracked frame. The callback runs on the preintegration thread, which is
+    // started if needed, and must return quickly. False for the sensors without IMU.
+    bool SetImuPoseCallback(const IMU::Preintegrator::PoseCallback &callback);
+
+    // Intra-process IMU input, e.g. the IMU callback of a ROS nodelet or ROS2 component sharing the
+    // process with the image driver. The measurements go to the tracking queue as they arrive instead
+    // of being batched with the images, which are then given no vImuMeas. Call from a single thread
+    // (the queue has one producer) in timestamp order. Each image waits up to System.ImuWaitMs for
+    // the first measurement after it. These measurements are not recorded by System.RecordDir.
+    void GrabImuData(const IMU::Point &imuMeasurement);
+
+    // Called on the tracking thread after every frame with its timestamp and the pose returned by
+    // Track* or GetNextResult (empty if tracking failed), which is not copied for it. It must return
+    // quickly. An empty function disables it.
+    typedef std::function<void(const double&, const cv::Mat&)> TrackedPoseCallback;
+    void SetTrackedPoseCallback(const TrackedPoseCallback &callback);
+
+    // Incremental changes of the maps (map points added, moved or removed, keyframe poses, merges,
+    // resets) in batches, instead of polling MapChanged() and copying the map. The first batch, given
+    // before returning, holds the whole atlas. See MapEvents for when the batches come
+    int SubscribeMapEvents(const MapEvents::Callback &callback);
+    void UnsubscribeMapEvents(const int nId);
+
     // For debugging
     double GetTimeFromIMUInit();
     bool isLost();
@@ -173,6 +313,28 @@ public:
 
     void ChangeDataset();
 
+    ThreadPool* GetThreadPool();
+
+    // Atlas (loaded from file or being built) and vocabulary, for offline tools such as the
+    // microbenchmarks. The map must not be modified while frames are being tracked.
+    Atlas* GetAtlas();
+    ORBVocabulary* GetVocabulary();
+
+    // Runtime latency histograms and queue depths of the SLAM threads. They are always
+    // recorded and can be polled at any time from another thread.
+    Metrics* GetMetrics();
+    // Current metrics in Prometheus text exposition format, memory usage included
+    std::string ExportMetrics();
+
+    // Approximate memory of the keyframes, map points, keyframe database and vocabulary. It walks
+    // all the maps (a few ms for large atlases) and also updates the MEMORY_* metrics gauges
+    MemoryUsage GetMemoryUsage();
+
+    // Replay a run recorded with the System.RecordDir setting (see ReplayLog). Call before the
+    // first frame, then track the frames of the returned log. NULL if strDir does not hold a
+    // recording of this sensor
+    ReplayLog* StartReplay(const string &strDir);
+
 #ifdef REGISTER_TIMES
     void InsertRectTime(double& time);
 
@@ -181,9 +343,65 @@ public:
 
 private:
 
+    void SetReplayLog(ReplayLog* pReplayLog);
+
+    bool LoadAtlas(const string &filename, const int type = BINARY_FILE);
+
+    // Applies the pending localization mode change and reset requests to the tracker
+    void CheckModeChangeAndReset();
+    bool isModeChangeOrResetRequested();
+
+    // Pipelined tracking stages (see SubmitStereo)
+    struct PipelineInput
+    {
+        cv::Mat im;
+        cv::Mat imRight;    // right image, or depth map for RGB-D
+        double timestamp;
+        vector<IMU::Point> vImuMeas;
+        string filename;
+        bool bKeyFrameCandidate;
+        std::chrono::steady_clock::time_point tInput;  // when it was submitted
+    };
+
+    struct PipelineFrame
+    {
+        Frame frame;
+        cv::Mat imGray;
+        cv::Mat imRight;
+        vector<IMU::Point> vImuMeas;
+        std::chrono::steady_clock::time_point tInput;
+    };
+
+    void SubmitToPipeline(const PipelineInput &input);
+    // Removes the queued images it, moving their IMU measurements to the images after them (newInput
+    // if it is the last queued)
+    void DropPipelineInput(std::list<PipelineInput>::iterator it, PipelineInput &newInput);
+    void RunPipelinePreprocess();
+    void RunPipelineTracking();
+    void StopPipeline();
+
+    // Launches the IMU preintegration thread if it is not running
+    void StartImuPreintegration();
+
+    // Waits for the measurements given to GrabImuData up to the image timestamp
+    void WaitForStreamedImu(const double &timestamp);
+    void PublishTrackedPose(const double &timestamp, const cv::Mat &Tcw);
+
+    // Fingerprint of the vocabulary. Word ids of a saved atlas are only valid with the same one
+    string CalculateCheckSum();
+
     // Input sensor
     eSensor mSensor;
 
+    // Atlas files loaded at start-up and saved on Shutdown() (empty if not used)
+    string mStrLoadAtlasFromFile;
+    string mStrSaveAtlasToFile;
+    // Keypoints and descriptors of the loaded maps are read when a map is first used
+    bool mbLazyAtlasLoad;
+
+    // Span trace saved on Shutdown() (empty if not used)
+    string mStrTraceFile;
+
     // ORB vocabulary used for place recognition and feature matching.
     ORBVocabulary* mpVocabulary;
 
@@ -193,6 +411,9 @@ private:
     // Atlas structure that stores the pointers to all KeyFrames and MapPoints.
     Atlas* mpAtlas;
 
+    // Frame and keyframe counters of this System (several Systems can run in one process)
+    SystemContext mContext;
+
     // Tracker. It receives a frame and computes the associated camera pose.
     // It also decides when to insert a new keyframe, create some new MapPoints and
     // performs relocalization if tracking fails.
@@ -211,12 +432,74 @@ private:
     FrameDrawer* mpFrameDrawer;
     MapDrawer* mpMapDrawer;
 
+    // Stream of the map for a remote viewer (Viewer.StreamPort), NULL if disabled
+    MapStreamer* mpMapStreamer;
+    std::thread* mptMapStreamer;
+
+    // Tiled map of the localization mode (Atlas.TileSize), NULL if disabled
+    TileStreamer* mpTileStreamer;
+    std::thread* mptTileStreamer;
+
+    // Trajectory written while running (System.TrajectoryStream), NULL if disabled
+    TrajectoryWriter* mpTrajectoryWriter;
+    std::thread* mptTrajectoryWriter;
+
+    // Last frames indexed by time for GetPoseAtTime (System.TrajectoryStoreSize), NULL if disabled
+    TrajectoryStore* mpTrajectoryStore;
+
+    // Connection to the map server (Agent.ServerHost), NULL if disabled
+    AgentClient* mpAgentClient;
+    std::thread* mptAgentClient;
+
+    // Pose and map in shared memory for other processes (SharedMemory.Name), NULL if disabled
+    SharedMapPublisher* mpSharedMap;
+    std::thread* mptSharedMap;
+    int mnSharedMapSubscription;
+
     // System threads: Local Mapping, Loop Closing, Viewer.
     // The Tracking thread "lives" in the main execution thread that creates the System object.
     std::thread* mptLocalMapping;
     std::thread* mptLoopClosing;
     std::thread* mptViewer;
 
+    // Integrates the IMU measurements as they arrive, between frames (IMU.IncrementalPreintegration)
+    std::thread* mptImuPreintegration;
+    std::mutex mMutexImuPreintegration;
+
+    // Pipelined tracking threads, started by the first Submit* call
+    std::thread* mptPipelinePreprocess;
+    std::thread* mptPipelineTracking;
+
+    std::mutex mMutexPipeline;
+    std::condition_variable mcvPipeline;    // notified whenever a pipeline queue or flag changes
+    std::list<PipelineInput> mlPipelineInput;
+    std::list<PipelineFrame> mlPipelineFrames;
+    std::list<std::pair<double,cv::Mat> > mlPipelineResults;
+    int mnPipelinePending;  // submitted frames whose pose has not been returned yet
+    bool mbPipelineTracking;
+    bool mbPipelinePreprocessDone;
+    bool mbFinishPipeline;
+    // Backlog policy of the pipeline input (System.DropPolicy, System.InputQueueSize). Keyframe
+    // candidates are the images at least mfCandidateInterval seconds after the previous candidate
+    eDropPolicy mDropPolicy;
+    size_t mnInputQueueSize;
+    double mfCandidateInterval;
+    double mfLastCandidateTime;
+    unsigned long mnDroppedFrames;
+
+    // Long-lived worker pool shared by Tracking, Local Mapping and Loop Closing
+    // (ORB extraction, parallel matching and optimization stages).
+    ThreadPool* mpThreadPool;
+
+    // Stage latencies and queue depths reported by Tracking, Local Mapping and Loop Closing.
+    Metrics* mpMetrics;
+
+    // Recording (System.RecordDir) or replay of the run, NULL if not used
+    ReplayLog* mpReplayLog;
+
+    // Low-power mode (System.LowPower), NULL if not used
+    PowerGovernor* mpPowerGovernor;
+
     // Reset flag
     std::mutex mMutexReset;
     bool mbReset;
@@ -227,8 +510,18 @@ private:
     bool mbActivateLocalizationMode;
     bool mbDeactivateLocalizationMode;
 
+    // IMU measurements given through GrabImuData instead of with the images (System.ImuWaitMs)
+    std::atomic<bool> mbImuStreamed;
+    double mfImuWaitTime;
+
+    TrackedPoseCallback mTrackedPoseCallback;
+    std::mutex mMutexPoseCallback;
+
+    MapEvents* mpMapEvents;
+
     // Tracking state
     int mTrackingState;
+    int mTrackingDegradations;
     std::vector<MapPoint*> mTrackedMapPoints;
     std::vector<cv::KeyPoint> mTrackedKeyPointsUn;
     std::mutex mMutexState;
@@ -0,0 +1,60 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SYSTEMCONTEXT_H
+#define SYSTEMCONTEXT_H
+
+#include "OptimizerSettings.h"
+#include "EpochManager.h"
+
+#include <atomic>
+
+namespace ORB_SLAM3
+{
+
+// State of one System that used to be global: the frame and keyframe counters and the settings of
+// the map, the map points, the reclamation and the optimizer. Each System owns one and hands it to
+// the frames it builds and to the maps of its atlas, so several Systems can run in the same process,
+// each numbering its frames and keyframes from 0 (Tracking relies on the ids being consecutive) and
+// with its own configuration. Map points, maps and cameras only need unique ids and keep
+// process-wide atomic counters.
+class SystemContext
+{
+public:
+    SystemContext(): mnNextFrameId(0), mnNextKeyFrameId(0), mnKeyFramesPerSubmap(0),
+        mnMaxDescriptorObservations(32), mnReclaimGracePeriod(EpochManager::DEFAULT_GRACE_PERIOD) {}
+
+    SystemContext(const SystemContext&) = delete;
+    SystemContext& operator=(const SystemContext&) = delete;
+
+    std::atomic<long unsigned int> mnNextFrameId;
+    std::atomic<long unsigned int> mnNextKeyFrameId;
+
+    // Settings, written by the System before its threads start
+    // Keyframes per submap of the loop corrections (0: whole essential graph)
+    int mnKeyFramesPerSubmap;
+    // Observed descriptors considered for the distinctive descriptor of a map point (0: all)
+    int mnMaxDescriptorObservations;
+    // Extra epochs a culled keyframe or map point is kept before its memory is reclaimed
+    int mnReclaimGracePeriod;
+    OptimizerSettings mOptimizer;
+};
+
+} //namespace ORB_SLAM3
+
+#endif // SYSTEMCONTEXT_H
@@ -0,0 +1,112 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <atomic>
+
+namespace ORB_SLAM3
+{
+
+// Fixed set of long-lived worker threads executing submitted tasks, shared by Tracking, Local
+// Mapping, Loop Closing and the global BA. Each worker has its own queue: the tasks submitted from
+// a worker go to its queue, taken newest first by the worker and oldest first by the idle workers
+// that steal them. Tasks from other threads go to a shared queue. Every worker runs the tasks of
+// the highest priority available first, wherever they are queued.
+class ThreadPool
+{
+public:
+    // Priority of the tasks that a thread submits. A running task is not interrupted, but a worker
+    // that finishes one takes the most urgent waiting task. Tasks run with the priority they were
+    // submitted with, so the work they submit in turn inherits it.
+    enum Priority
+    {
+        TRACKING=0,     // Threads that did not set one (the caller of System::Track*)
+        MAPPING=1,      // Local Mapping and Loop Closing
+        BACKGROUND=2,   // Global BA
+        NUM_PRIORITIES
+    };
+
+    // Sets the priority of the calling thread for the lifetime of the object
+    class PriorityScope
+    {
+    public:
+        PriorityScope(const Priority priority);
+        ~PriorityScope();
+    private:
+        Priority mPrevious;
+    };
+
+    static Priority GetThreadPriority();
+
+    // nThreads workers are created (0 means tasks run inline in the caller).
+    ThreadPool(int nThreads);
+    ~ThreadPool();
+
+    int GetNumThreads() const { return mvThreads.size(); }
+
+    // Queue a task. The returned future becomes ready when the task has run.
+    std::future<void> Submit(const std::function<void()> &task);
+
+    // Run f(i) for i in [begin,end) and wait for all of them. The calling thread also
+    // executes iterations, so it is safe to call it from inside a pool task.
+    void ParallelFor(int begin, int end, const std::function<void(int)> &f);
+
+private:
+    typedef std::packaged_task<void()> Task;
+
+    struct Worker
+    {
+        std::mutex mMutex;
+        std::deque<Task> mvqTasks[NUM_PRIORITIES];
+    };
+
+    void Run(const int nWorker);
+
+    // Queues the task with the priority of the calling thread. The workers are not woken up
+    void Push(Task &&task);
+    void Notify(const int nTasks);
+
+    // Most urgent task for the worker: its own queue, the shared queue, then the other workers
+    bool Pop(const int nWorker, Task &task, Priority &priority);
+
+    std::vector<std::thread> mvThreads;
+    std::vector<std::unique_ptr<Worker> > mvpWorkers;
+
+    // Tasks submitted from threads out of the pool (mMutexQueue)
+    std::deque<Task> mvqShared[NUM_PRIORITIES];
+    // Tasks in all the queues, the workers sleep while it is 0
+    std::atomic<int> mnQueued;
+
+    std::mutex mMutexQueue;
+    std::condition_variable mcvTasks;
+    bool mbFinish;
+};
+
+} //namespace ORB_SLAM
+
+#endif // THREADPOOL_H
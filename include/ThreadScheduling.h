@@ -0,0 +1,64 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef THREADSCHEDULING_H
+#define THREADSCHEDULING_H
+
+#include <string>
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+namespace ORB_SLAM3
+{
+
+// CPU affinity, scheduling policy and nice value of one of the SLAM threads (Tracking,
+// LocalMapping, LoopClosing, Viewer, GBA), read from the Thread.<name>.* settings:
+//   Thread.<name>.Cpus: "4-7" or "0,2" (CPUs the thread may run on, default any)
+//   Thread.<name>.Policy: "other", "batch", "idle", "fifo" or "rr" (default unchanged)
+//   Thread.<name>.Priority: real-time priority of fifo and rr (1-99)
+//   Thread.<name>.Nice: nice value of other and batch (-20 to 19)
+// Real-time policies and negative nice values need CAP_SYS_NICE (or root), failures are reported
+// and the thread keeps running with the default scheduling.
+class ThreadScheduling
+{
+public:
+    ThreadScheduling();
+
+    static ThreadScheduling Read(const cv::FileStorage &fsSettings, const std::string &strThread);
+
+    // True when no setting was given, Apply does nothing then
+    bool IsDefault() const;
+
+    // Applies the settings to the calling thread
+    bool Apply() const;
+
+    // "cpus 4-7, fifo 10" style summary
+    std::string ToString() const;
+
+    std::string mStrThread;
+    std::vector<int> mvCpus;
+    // SCHED_* policy, -1 to keep the current one
+    int mnPolicy;
+    int mnPriority;
+    bool mbNice;
+    int mnNice;
+};
+
+} //namespace ORB_SLAM
+
+#endif // THREADSCHEDULING_H
@@ -0,0 +1,141 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TILESTREAMER_H
+#define TILESTREAMER_H
+
+#include <opencv2/core/core.hpp>
+
+#include <array>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace ORB_SLAM3
+{
+
+class Map;
+class KeyFrame;
+
+// Streaming of the keyframe features of a large map in localization mode, enabled with
+// Atlas.TileSize. The keyframes of the current map are grouped in cubic tiles by their camera
+// center. The features (keypoints, descriptors and feature vectors) of the tiles within
+// Atlas.TileRadius of the camera, or of where it will be in Atlas.TilePrefetch seconds at its
+// current velocity, are kept in memory; the other tiles are written to Atlas.SpillDirectory and
+// released. The BoW vectors, poses, covisibility and map points stay in memory, so the keyframe
+// database still finds relocalization candidates in any tile (they are loaded on demand).
+//
+// The streamer thread writes and loads the tiles. The features are only released by the tracking
+// thread (Update), which is the one reading them, and only for tiles already written to disk.
+class TileStreamer
+{
+public:
+    TileStreamer(const float fTileSize, const float fRadius, const float fPrefetch, const std::string &strDir);
+
+    // Main thread function
+    void Run();
+
+    // Called by Tracking in localization mode with the camera center of every tracked frame. The
+    // tiles of pMap are built on the first call (or when the map changes).
+    void Update(Map* pMap, const cv::Matx31f &Ow, const double &timestamp);
+
+    // Blocks until the features of pKF are in memory
+    void EnsureResident(KeyFrame* pKF);
+
+    // Loads all the tiles back and forgets the tiling (leaving localization mode, saving the atlas)
+    void LoadAll();
+    // Forgets the tiling without loading anything (the map is being reset)
+    void Clear();
+
+    void RequestFinish();
+    bool isFinished();
+
+protected:
+
+    enum eTileState
+    {
+        RESIDENT=0,     // features in memory
+        WRITING=1,      // features in memory, being written by the streamer
+        WRITTEN=2,      // features in memory and on disk, Update releases them if still far
+        SPILLED=3,      // features only on disk
+        LOADING=4       // being read from disk
+    };
+
+    struct Tile
+    {
+        Tile(): mState(RESIDENT), mbOnDisk(false) {}
+
+        std::vector<KeyFrame*> mvpKeyFrames;
+        eTileState mState;
+        // The features do not change in localization mode, so a file once written stays valid
+        bool mbOnDisk;
+    };
+
+    typedef std::array<int,3> TileKey;
+
+    void BuildTiles(Map* pMap);
+    // Loads the spilled tiles if bLoad, removes the files and the tiles (mMutexTiles locked)
+    void DropTiles(std::unique_lock<std::mutex> &lock, const bool bLoad);
+
+    // Distance from the box of a tile to p
+    float DistanceToTile(const TileKey &key, const cv::Matx31f &p) const;
+    // Within the radius of the current or the predicted position
+    bool IsWanted(const TileKey &key, const float fRadius) const;
+
+    std::string TileFileName(const TileKey &key) const;
+    bool WriteTile(const TileKey &key, const std::vector<KeyFrame*> &vpKFs);
+    bool ReadTile(const TileKey &key, const std::vector<KeyFrame*> &vpKFs);
+    // Reads a spilled tile with mMutexTiles unlocked meanwhile
+    void LoadTile(std::unique_lock<std::mutex> &lock, const TileKey &key, Tile &tile);
+
+    bool CheckFinish();
+    void SetFinish();
+
+    float mfTileSize;
+    float mfRadius;
+    float mfPrefetch;
+    std::string mStrDir;
+
+    std::mutex mMutexTiles;
+    // Notified when a tile is loaded or written
+    std::condition_variable mcvTiles;
+    Map* mpMap;
+    unsigned long int mnMapId;
+    std::map<TileKey, Tile> mmTiles;
+    std::map<KeyFrame*, TileKey> mmKFTile;
+    // Tiles being written or read with mMutexTiles unlocked
+    int mnBusy;
+    // A write failed (directory not writable or full): the streamer only loads from then on
+    bool mbWriteError;
+
+    // Camera position and smoothed velocity
+    cv::Matx31f mPos;
+    cv::Matx31f mVel;
+    double mLastTimestamp;
+    bool mbHasPos;
+
+    std::mutex mMutexFinish;
+    bool mbFinishRequested;
+    bool mbFinished;
+};
+
+} //namespace ORB_SLAM3
+
+#endif // TILESTREAMER_H
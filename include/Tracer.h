@@ -0,0 +1,108 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <chrono>
+#include <string>
+
+#include "AllocationProfiler.h"
+
+namespace ORB_SLAM3
+{
+
+// Span tracing of the SLAM threads, saved in the Chrome trace event format (chrome://tracing,
+// Perfetto). Every thread records its spans in its own ring buffer (the last BUFFER_SIZE spans are
+// kept) without locks. The instrumentation macros are compiled only with ORB_SLAM3_TRACING
+// (cmake -DWITH_TRACING=ON), otherwise they expand to nothing. With ORB_SLAM3_ALLOC_PROFILING the
+// spans also count the heap allocations of their thread (AllocationProfiler.h).
+class Tracer
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    static const size_t BUFFER_SIZE = 1<<16;
+
+    // Name of the calling thread in the trace. name must be a string literal
+    static void SetThreadName(const char* name);
+
+    // name must be a string literal, only the pointer is stored
+    static void Record(const char* name, const Clock::time_point &tStart, const Clock::time_point &tEnd);
+
+    // Spans recorded while saving may be missing or torn, save when the threads are idle or finished
+    static bool SaveChromeTrace(const std::string &filename);
+};
+
+// Records the span from construction to End() or destruction
+class TraceScope
+{
+public:
+    explicit TraceScope(const char* name) : mName(name), mtStart(Tracer::Clock::now()), mbOpen(true)
+    {
+#ifdef ORB_SLAM3_ALLOC_PROFILING
+        mAllocStart = AllocationProfiler::ThreadCounters();
+#endif
+    }
+    ~TraceScope() { End(); }
+
+    void End()
+    {
+        if(mbOpen)
+        {
+#ifdef ORB_SLAM3_ALLOC_PROFILING
+            AllocationProfiler::RecordSpan(mName, mAllocStart, AllocationProfiler::ThreadCounters());
+#endif
+            Tracer::Record(mName, mtStart, Tracer::Clock::now());
+            mbOpen = false;
+        }
+    }
+
+private:
+    const char* mName;
+    Tracer::Clock::time_point mtStart;
+    bool mbOpen;
+#ifdef ORB_SLAM3_ALLOC_PROFILING
+    AllocationProfiler::Counters mAllocStart;
+#endif
+};
+
+} //namespace ORB_SLAM3
+
+#ifdef ORB_SLAM3_TRACING
+#define ORB_TRACE_CONCAT_(a,b) a##b
+#define ORB_TRACE_CONCAT(a,b) ORB_TRACE_CONCAT_(a,b)
+// Span until the end of the enclosing scope
+#define ORB_TRACE_SCOPE(name) ORB_SLAM3::TraceScope ORB_TRACE_CONCAT(traceScope_,__LINE__)(name)
+// Span closed explicitly, e.g. the wait for a lock
+#define ORB_TRACE_BEGIN(var,name) ORB_SLAM3::TraceScope var(name)
+#define ORB_TRACE_END(var) var.End()
+#ifdef ORB_SLAM3_ALLOC_PROFILING
+#define ORB_TRACE_THREAD_NAME(name) do{ ORB_SLAM3::Tracer::SetThreadName(name); ORB_SLAM3::AllocationProfiler::SetThreadName(name); }while(0)
+#else
+#define ORB_TRACE_THREAD_NAME(name) ORB_SLAM3::Tracer::SetThreadName(name)
+#endif
+#else
+#define ORB_TRACE_SCOPE(name) do{}while(0)
+#define ORB_TRACE_BEGIN(var,name) do{}while(0)
+#define ORB_TRACE_END(var) do{}while(0)
+#define ORB_TRACE_THREAD_NAME(name) do{}while(0)
+#endif
+
+#endif // TRACER_H
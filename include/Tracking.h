@@ -37,10 +37,17 @@
 #include "MapDrawer.h"
 #include "System.h"
 #include "ImuTypes.h"
+#include "ImuQueue.h"
+#include "ImuPreintegrator.h"
+#include "FrozenMap.h"
+#include "LocalMapMirror.h"
+#include "ThreadScheduling.h"
 
 #include "GeometricCamera.h"
 
 #include <mutex>
+#include <future>
+#include <atomic>
 #include <unordered_set>
 
 namespace ORB_SLAM3
@@ -52,13 +59,26 @@ class Atlas;
 class LocalMapping;
 class LoopClosing;
 class System;
+class ThreadPool;
+class Metrics;
+class ReplayLog;
+class MapStreamer;
+class PowerGovernor;
+class TileStreamer;
+class TrajectoryWriter;
+class TrajectoryStore;
+class FeatureBudgetController;
+class TrackingDeadline;
+class StereoRectifier;
+class CameraRig;
+class SystemContext;
 
 class Tracking
 {  
 
 public:
     Tracking(System* pSys, ORBVocabulary* pVoc, FrameDrawer* pFrameDrawer, MapDrawer* pMapDrawer, Atlas* pAtlas,
-             KeyFrameDatabase* pKFDB, const string &strSettingPath, const int sensor, const string &_nameSeq=std::string());
+             KeyFrameDatabase* pKFDB, SystemContext* pContext, const string &strSettingPath, const int sensor, const string &_nameSeq=std::string());
 
     ~Tracking();
 
@@ -93,16 +113,61 @@ public:
 
     cv::Mat GrabImageRGBD(const cv::Mat &imRGB,const cv::Mat &imD, const double &timestamp, string filename);
 
+    // GrabImageStereo with the disparity or depth map computed by the camera instead of the right
+    // image (see System::TrackStereoDepth). Pinhole stereo only
+    cv::Mat GrabImageStereoDepth(const cv::Mat &imRectLeft, const cv::Mat &imDepth, const bool bDisparity, const double &timestamp, string filename);
+
     cv::Mat GrabImageMonocular(const cv::Mat &im, const double &timestamp, string filename);
     // cv::Mat GrabImageImuMonocular(const cv::Mat &im, const double &timestamp);
 
+    // Drops the references to the last input images (mImGray, mImRight), for inputs that
+    // wrap memory owned by the caller
+    void ReleaseInputImages();
+
+    // Images of the additional rig cameras (Rig.*) for the next GrabImageStereo/GrabImageMonocular,
+    // one per camera in the order of the settings. Ignored without a rig
+    void SetRigImages(const std::vector<cv::Mat> &vIms) { mvImRig = vIms; }
+
+    // When the images of the next tracked frame were given to the System, for its telemetry
+    // (Metrics::FrameTelemetry). Used by the next GrabImage*/TrackPreprocessed call only
+    void SetInputTime(const std::chrono::steady_clock::time_point &tInput) { mTimeInput = tInput; }
+
+    // The two halves of GrabImageStereo/GrabImageRGBD, so that the frame of the next image can
+    // be built (color conversion, ORB extraction, stereo matching) while the current one is
+    // being tracked. Preprocess* only reads the settings and extractors and builds the frame
+    // without the link to the last frame; TrackPreprocessed sets that link and calls Track().
+    // imGray is the converted left image, imRight the right input image as given (both are
+    // shown by the frame drawer). Preprocess* and TrackPreprocessed may run concurrently on
+    // different frames, but two Preprocess* calls may not (they share the extractors).
+    void PreprocessStereo(const cv::Mat &imRectLeft, const cv::Mat &imRectRight, const double &timestamp, string filename, Frame &frame, cv::Mat &imGray);
+    void PreprocessRGBD(const cv::Mat &imRGB, const cv::Mat &imD, const double &timestamp, string filename, Frame &frame, cv::Mat &imGray);
+    void PreprocessStereoDepth(const cv::Mat &imRectLeft, const cv::Mat &imDepth, const bool bDisparity, const double &timestamp, string filename, Frame &frame, cv::Mat &imGray);
+    cv::Mat TrackPreprocessed(const Frame &frame, const cv::Mat &imGray, const cv::Mat &imRight = cv::Mat());
+
     /* !
      * @brief IMU data를 queue형태로 저장합니다. 
      * @param None
-     * @return mutex mlQueueImuData
+     * @return lock-free queue mImuQueue (producer는 하나의 thread만 가능)
     */
     void GrabImuData(const IMU::Point &imuMeasurement);
 
+    /* !
+     * @brief timestamp 이후의 IMU data가 queue에 들어올 때까지 최대 timeout(초) 동안 기다립니다.
+     * @param None
+     * @return 기다리는 IMU data가 들어왔으면 true, timeout이면 false
+    */
+    bool WaitForImu(const double &timestamp, const double &timeout);
+
+    /* !
+     * @brief imu 데이터를 frame 사이에 미리 preintegration 하는 worker (thread는 System이 실행합니다)
+     */
+    IMU::Preintegrator* GetImuPreintegrator() { return &mImuPreintegrator; }
+
+    /* !
+     * @brief 마지막 frame 이후 도착한 imu 데이터로 예측한 body pose (Twb)와 velocity. 예측이 불가능하면 false
+     */
+    bool GetImuPrediction(double &timestamp, cv::Mat &Twb, cv::Mat &Vwb);
+
     /* !
     * @brief LocalMapping Class를 Pointer로 설정해주기 위한 함수
     * @param None
@@ -117,6 +182,34 @@ public:
     */
     void SetLoopClosing(LoopClosing* pLoopClosing);
 
+    /* !
+    * @brief System이 소유한 ThreadPool을 설정하는 함수 (ORB extractor들도 이 pool을 사용)
+    * @param pThreadPool 공유 worker thread pool
+    * @return None
+    */
+    void SetThreadPool(ThreadPool* pThreadPool);
+
+    /* !
+    * @brief System이 소유한 Metrics를 설정하는 함수 (stage별 latency 기록)
+    * @param pMetrics 공유 runtime metrics
+    * @return None
+    */
+    void SetMetrics(Metrics* pMetrics);
+
+    /* !
+    * @brief record/replay log를 설정하는 함수 (keyframe 생성 결정을 기록하거나 재현)
+    * @param pReplayLog System이 소유한 log
+    * @return None
+    */
+    void SetReplayLog(ReplayLog* pReplayLog);
+
+    /* !
+    * @brief Tracking을 실행하는 thread의 CPU affinity와 scheduling 설정 (Thread.Tracking.*)
+    * @param sched Track을 호출하는 thread (caller 또는 pipeline thread)에 처음 호출될 때 적용
+    * @return None
+    */
+    void SetThreadScheduling(const ThreadScheduling &sched);
+
     /* !
     * @brief Viewer Class를 Pointer로 설정해주기 위한 함수
     * @param None
@@ -124,6 +217,43 @@ public:
     */
     void SetViewer(Viewer* pViewer);
 
+    /* !
+    * @brief 원격 viewer로 map을 보내는 MapStreamer Class를 Pointer로 설정해주기 위한 함수
+    * @param None
+    * @return None
+    */
+    void SetMapStreamer(MapStreamer* pMapStreamer);
+
+    /* !
+    * @brief Low-power mode의 governor를 설정해주기 위한 함수. 매 frame의 CPU 사용량을 알려줌
+    * @param pGovernor (NULL: low-power mode 아님)
+    * @return None
+    */
+    void SetPowerGovernor(PowerGovernor* pGovernor);
+
+    /* !
+    * @brief Localization mode에서 map을 tile 단위로 disk와 주고받는 TileStreamer Class를 Pointer로 설정해주기 위한 함수
+    * @param None
+    * @return None
+    */
+    void SetTileStreamer(TileStreamer* pTileStreamer);
+
+    /* !
+    * @brief frame pose를 파일로 바로 쓰는 TrajectoryWriter를 설정하는 함수.
+    *        설정되면 mlRelativeFramePoses 등의 list에는 마지막 nHistory개의 frame만 남긴다.
+    * @param pTrajectoryWriter writer, nHistory list에 남길 frame 수
+    * @return None
+    */
+    void SetTrajectoryWriter(TrajectoryWriter* pTrajectoryWriter, const int nHistory);
+
+    /* !
+    * @brief 시간으로 frame pose를 찾는 TrajectoryStore를 설정하는 함수.
+    *        mlRelativeFramePoses에 저장되는 frame이 같이 저장된다.
+    * @param pTrajectoryStore store
+    * @return None
+    */
+    void SetTrajectoryStore(TrajectoryStore* pTrajectoryStore);
+
     /* !
     * @brief Bool 타입을 변수를 통해 클래스 멤버 변수 'bStepByStep'의 상태를 바꿔주는 함수
     * @param None
@@ -148,6 +278,20 @@ public:
     */
     void InformOnlyTracking(const bool &flag);
 
+    /* !
+    * @brief Offline map building (System.OfflineMapping): keyframe을 버리지 않고 Local Mapping이 따라올 때까지 기다림
+    * @param bOffline
+    * @return None
+    */
+    void SetOfflineMapping(const bool bOffline);
+
+    /* !
+    * @brief IMU 초기화 전 Inertial 모드의 keyframe 간격 (기본 0.25s, closed-form IMU 초기화에서 더 짧게)
+    * @param interval seconds
+    * @return None
+    */
+    void SetImuInitKeyFrameInterval(const float interval);
+
     /* !
     * @brief IMU와 관련된 값들을 Key Frame에 update (Local mapping, Loop closing에서 쓰임) 
     * @param scale
@@ -173,6 +317,10 @@ public:
     void NewDataset();
     int GetNumberDataset();
     int GetMatchesInliers();
+
+    // Degradations applied to meet Tracking.Deadline in the last tracked frame
+    // (TrackingDeadline::Degradation bit mask, 0 if none)
+    int GetDegradations() const { return mnDegradations; }
 public:
 
     // Tracking states
@@ -212,6 +360,14 @@ public:
     list<double> mlFrameTimes;
     list<bool> mlbLost;
 
+    // With a trajectory writer the full trajectory goes to its file and the lists above only
+    // keep the last mnTrajectoryHistory frames
+    TrajectoryWriter* mpTrajectoryWriter;
+    int mnTrajectoryHistory;
+
+    // Bounded copy of the same frames indexed by time, for the pose queries of System
+    TrajectoryStore* mpTrajectoryStore;
+
     // frames with estimated pose
     int mTrackedFr;
     bool mbStep;
@@ -276,6 +432,77 @@ protected:
     // Main tracking function. It is independent of the input sensor.
     void Track();
 
+    // Current camera pose to the map drawer (only with viewer) and to the map stream
+    void PublishCameraPose(const cv::Mat &Tcw);
+
+    /* !
+    * @brief Feature budget을 extractor에 적용하는 함수 (frame 생성 전, extraction thread에서 호출)
+    * @param None
+    * @return None
+    */
+    void ApplyFeatureBudget();
+
+    /* !
+    * @brief 방금 track한 frame의 시간과 inlier 수로 feature budget을 갱신하는 함수
+    * @param extractMs: ORB extraction + stereo matching 시간 (ms)
+    * @param trackMs: tracking 시간 (ms)
+    * @return None
+    */
+    void UpdateFeatureBudget(const double extractMs, const double trackMs);
+
+    /* !
+    * @brief 방금 track한 frame까지의 CPU 사용량으로 low-power mode의 level을 갱신하는 함수
+    * @param None
+    * @return None
+    */
+    void UpdatePowerGovernor();
+
+    /* !
+    * @brief 다음 frame의 focus mask(예측된 map point 투영 주변)를 extractor에 적용하는 함수 (extraction thread에서 호출)
+    * @param None
+    * @return None
+    */
+    void ApplyFocusMask();
+
+    /* !
+    * @brief Constant velocity model로 다음 frame에서 map point가 보일 위치를 예측해 focus mask를 만드는 함수
+    * @param None
+    * @return None
+    */
+    void UpdateFocusRegions();
+
+    /* !
+    * @brief 다음 frame을 reduced resolution(첫 pyramid level 제외)으로 추출할지 extractor에 적용하는 함수 (extraction thread에서 호출)
+    * @param None
+    * @return None
+    */
+    void ApplyResolution();
+
+    /* !
+    * @brief 방금 track한 frame의 상태로 다음 frame의 resolution을 정하는 함수
+    * @param None
+    * @return None
+    */
+    void UpdateResolution();
+
+    /* !
+    * @brief 다음 frame을 ORB extraction 대신 last frame의 map point를 optical flow로 추적해 만드는 함수
+    * @param im: 입력 image (left)
+    * @param timestamp: image의 timestamp
+    * @param filename: image 파일 이름
+    * @param frame: 생성된 frame
+    * @param imGray: gray scale로 변환된 image
+    * @return Flow tracking이 가능해서 frame을 만들었으면 true, extraction이 필요하면 false
+    */
+    bool BuildFlowFrame(const cv::Mat &im, const double &timestamp, const string &filename, Frame &frame, cv::Mat &imGray);
+
+    /* !
+    * @brief 방금 track한 frame 이후 다음 frame에 optical flow를 쓸지 결정하고 image pyramid를 보관하는 함수
+    * @param None
+    * @return None
+    */
+    void UpdateFlowState();
+
     // Map initialization for stereo and RGB-D
     /* !
     * @brief Stereo 초기화 함수 (Stereo or Stereo-IMU)
@@ -307,6 +534,41 @@ protected:
     */
     bool TrackWithMotionModel();
 
+    /* !
+    * @brief Optical flow로 추적된 frame의 pose를 motion model 예측에서 최적화하는 함수 (local map search 없음)
+    * @param None
+    * @return 충분한 inlier가 남으면 true, 아니면 false
+    */
+    bool TrackWithFlow();
+
+    /* !
+    * @brief Deadline 초과로 local map을 track하지 않을 때 motion model의 pose와 match로 inlier를 세는 함수
+    * @param None
+    * @return 충분한 inlier가 있으면 true, 아니면 false
+    */
+    bool TrackMotionModelOnly();
+
+    /* !
+    * @brief 방금 track한 frame에 적용된 degradation을 저장하고 metrics에 보고하는 함수
+    * @param None
+    * @return None
+    */
+    void ReportDegradations();
+
+    /* !
+    * @brief 방금 track한 frame의 timeline (input, extraction, pose 출력)을 metrics에 기록하는 함수
+    * @param None
+    * @return None
+    */
+    void RecordFrameTelemetry();
+
+    /* !
+    * @brief Offline mapping에서 Local Mapping의 queue가 찼거나 loop 보정, IMU 초기화 중일 때 기다리는 함수 (map lock 전에 호출)
+    * @param None
+    * @return None
+    */
+    void WaitForLocalMapping();
+
     /* !
     * @brief IMU data의 변화량을 이용하여 현재 imu state를 예측하는 함수입니다. 
     * @param None
@@ -316,10 +578,16 @@ protected:
 
     /* !
     * @brief  Tracking이 LOST 되었을 때, Relocalization 시켜주는 함수
-    * @param  None
+    * @param  scope: 후보 KeyFrame을 찾을 map (기본: current map)
+    * @param  ppMatchedKF: 성공했을 때 pose를 준 KeyFrame (NULL이면 무시)
     * @return Boolean
     */
-    bool Relocalization();
+    bool Relocalization(const KeyFrameDatabase::eMapScope scope=KeyFrameDatabase::ONLY_MAP,
+                        KeyFrame** ppMatchedKF=static_cast<KeyFrame**>(NULL));
+    // Relocalizes in the other maps of the Atlas and makes the map found the active one
+    bool RelocalizationInAtlas();
+    // Keeps the mnRelocCandidates candidates whose RelocalizationCache best matches the current frame
+    void RankRelocalizationCandidates(std::vector<KeyFrame*> &vpCandidateKFs);
 
     /* !
     * @brief Local Map을 Update하기 위해 사용하는 함수
@@ -342,6 +610,14 @@ protected:
     */
     void UpdateLocalKeyFrames();
 
+    /* !
+    * @brief Spatial index에서 현재 camera 주변의 keyframe (mvpSpatialKFs) 또는 frustum 안의 map point를 찾는 함수
+    * @param None
+    * @return None
+    */
+    void QuerySpatialKeyFrames();
+    void AddSpatialLocalPoints();
+
     /* !
     * @brief Local Map을 Tracking하고 있는지 판단하기 위한 함수 (Map points의 Inlier의 갯수를 활용)
     * @param None
@@ -358,6 +634,34 @@ protected:
     */
     void SearchLocalPoints();
 
+    /* !
+    * @brief  Localization mode에서 frozen map의 local point들과 Current Frame을 매칭 (SearchLocalPoints와 동일, lock 없음)
+    * @param  None
+    * @return None
+    */
+    void SearchLocalPointsFrozen();
+
+    /* !
+    * @brief  Local map point들의 연속 복사본(LocalMapMirror)으로 Current Frame과 매칭 (SearchLocalPoints와 동일, pointer 순회 없음)
+    * @param  None
+    * @return None
+    */
+    void SearchLocalPointsMirror();
+
+    /* !
+    * @brief  SearchLocalPoints의 search window 크기 (sensor, IMU, tracking 상태에 따라 다름)
+    * @param  None
+    * @return threshold
+    */
+    int LocalPointsSearchThreshold();
+
+    /* !
+    * @brief  Localization mode에서 current map의 read-only snapshot을 만들거나, map이 바뀌었으면 다시 만든다
+    * @param  current_map
+    * @return None
+    */
+    void UpdateFrozenMap(Map* pMap);
+
     /* !
     * @brief 새로운 KeyFrame이 필요한지 판단하기 위한 함수
     * @param None
@@ -379,6 +683,9 @@ protected:
     */
     void PreintegrateIMU();
 
+    // Starts the preintegration ahead of the interval after mLastFrame
+    void StartImuPreintegration();
+
     // Reset IMU biases and compute frame velocity
     /* !
     * @brief  imu의 gyro bias를 재설정하는 함수입니다. 각 프레임 1번, 2번의 imu rotation, delta rotation 데이터를 통해 bias를 구하고 최신화합니다. 
@@ -400,12 +707,12 @@ protected:
     // Imu preintegration from last frame
     IMU::Preintegrated *mpImuPreintegratedFromLastKF;
 
-    // Queue of IMU measurements between frames
-    std::list<IMU::Point> mlQueueImuData;
+    // Queue of IMU measurements between frames (GrabImuData produces, mImuPreintegrator consumes)
+    IMU::MeasurementQueue mImuQueue;
+    IMU::Preintegrator mImuPreintegrator;
 
     // Vector of IMU measurements from previous to current frame (to be filled by PreintegrateIMU)
     std::vector<IMU::Point> mvImuFromLastFrame;
-    std::mutex mMutexImuQueue;
 
     // Imu calibration parameters
     IMU::Calib *mpImuCalib;
@@ -424,27 +731,154 @@ protected:
     LoopClosing* mpLoopClosing;
 
     //ORB
-    ORBextractor* mpORBextractorLeft, *mpORBextractorRight;
-    ORBextractor* mpIniORBextractor;
+    FeatureExtractor* mpORBextractorLeft, *mpORBextractorRight;
+    FeatureExtractor* mpIniORBextractor;
+    bool mbParallelExtraction;
+
+    // Features and pyramid levels adapted to ORBextractor.FrameBudget (NULL if fixed)
+    FeatureBudgetController* mpFeatureBudget;
+
+    // Low-power mode, owned by System (NULL if disabled)
+    PowerGovernor* mpPowerGovernor;
+
+    // Non-keyframe extraction around the predicted projections of the map points (radius in
+    // pixels, 0 disables it) plus this fraction of the rest of the image
+    float mfFocusRadius;
+    float mfFocusCoverage;
+    std::mutex mMutexFocus;
+    cv::Mat mFocusMaskLeft, mFocusMaskRight;
+    // A keyframe was deferred, the next frame is extracted on the whole image
+    bool mbFocusFullFrame;
+
+    // Dual resolution front end (ORBextractor.DualResolution): while tracking is good the frames are
+    // extracted without the first pyramid level, and a keyframe due on such a frame is taken from the
+    // next one, extracted at full resolution. mbReducedNext is read by the extraction thread
+    bool mbDualResolution;
+    std::atomic<bool> mbReducedNext;
+    bool mbFullResolutionNext;
+
+    // Offline map building: Local Mapping is treated as idle for the keyframe decision and the
+    // frames wait for it instead (backpressure)
+    bool mbOfflineMapping;
+
+    // Built-in rectification of the stereo images (Stereo.Rectify, NULL if the inputs are rectified)
+    StereoRectifier* mpStereoRectifier;
+
+    // Additional cameras of the rig (Rig.*, NULL without them) and their images for the next frame
+    CameraRig* mpCameraRig;
+    std::vector<cv::Mat> mvImRig;
+
+    // Extraction of the rig images on the pool while the main frame is built, and their features
+    void BeginRigExtraction();
+    void EndRigExtraction(Frame &frame);
+    // Matches of the rig cameras with the local map points
+    void SearchRigPoints();
+
+    // Time between keyframes in the inertial modes until the IMU is initialized (seconds)
+    float mfImuInitKFInterval;
+
+    // Frames between keyframes tracked with pyramidal Lucas-Kanade instead of extracted
+    // (ORBextractor.OpticalFlow). mbFlowNext: the next frame may be a flow frame; mbFlowExtractNext:
+    // a keyframe was deferred from a flow frame. Pyramids of the last frame and of the one being built.
+    // Per-frame time budget (Tracking.Deadline, NULL if none) and the degradations applied to the
+    // last frame (TrackingDeadline::Degradation bit mask); local map points searched in the frame
+    TrackingDeadline* mpDeadline;
+    int mnDegradations;
+    int mnLocalPointsSearched;
+
+    bool mbFlowTracking;
+    int mnFlowMinPoints;
+    bool mbFlowNext;
+    bool mbFlowExtractNext;
+    std::vector<cv::Mat> mvFlowPyramid, mvFlowPyramidNext;
+
+    // Worker pool owned by System
+    ThreadPool* mpThreadPool;
+
+    // Runtime metrics owned by System
+    Metrics* mpMetrics;
+    // Input time of the frame being tracked (see SetInputTime), unset if not given
+    std::chrono::steady_clock::time_point mTimeInput;
+
+    // Record/replay of the keyframe decisions, owned by System (NULL if not used)
+    ReplayLog* mpReplayLog;
+
+    // Scheduling of the thread that tracks, applied again when Track is called from another thread
+    ThreadScheduling mThreadScheduling;
+    std::thread::id mScheduledThread;
 
     //BoW
     ORBVocabulary* mpORBVocabulary;
     KeyFrameDatabase* mpKeyFrameDB;
 
+    // Frame and keyframe counters, owned by System
+    SystemContext* mpContext;
+
     // Initalization (only for monocular)
     Initializer* mpInitializer;
     bool mbSetInit;
 
+    // Two-view reconstruction of mInitialFrame and mIniCandidateFrame running on the thread pool
+    // (monocular without IMU). Matching goes on with the next frames meanwhile; the result is
+    // abandoned (not waited for) when the initializer is reset.
+    struct IniReconstruction
+    {
+        std::vector<int> vMatches;
+        cv::Mat Rcw, tcw;
+        std::vector<cv::Point3f> vP3D;
+        std::vector<bool> vbTriangulated;
+        bool bOK;
+    };
+    std::shared_ptr<IniReconstruction> mpIniReconstruction;
+    std::future<void> mIniReconstructionDone;
+    Frame mIniCandidateFrame;
+
+    // Drops the monocular initializer, its matches and any pending reconstruction
+    void ResetMonocularInitializer();
+    // Poses of the initial and current frames from the reconstruction, then the initial map
+    void InitializeFromTwoViews(const cv::Mat &Rcw, const cv::Mat &tcw, const std::vector<bool> &vbTriangulated);
+
     //Local Map
     KeyFrame* mpReferenceKF;
     std::vector<KeyFrame*> mvpLocalKeyFrames;
     std::vector<MapPoint*> mvpLocalMapPoints;
+
+    //^ 이전 frame의 local map 재사용 여부: 투표받은 keyframe들, 가장 많이 투표받은 keyframe, (IMU) 마지막 keyframe과
+    //^ local keyframe들의 graph version이 그대로면 local keyframe을, 그 match version까지 그대로면 local map point를 재사용한다
+    bool mbLocalMapCached;
+    bool mbLocalKeyFramesReused;
+    std::vector<KeyFrame*> mvpLocalMapVotedKFs, mvpVotedKFs;
+    KeyFrame* mpLocalMapKFmax;
+    KeyFrame* mpLocalMapLastKF;
+    std::vector<unsigned long> mvnLocalKFGraphVersions;
+    std::vector<unsigned long> mvnLocalKFMatchesVersions;
+
+    //^ Map의 spatial index로 고르는 local map 후보 (Tracking.SpatialLocalMap, 0이면 사용 안 함): 현재 camera에서
+    //^ 이 반경 안의 keyframe과 frustum 안의 map point를 covisibility로 찾은 local map에 더한다
+    float mfSpatialLocalMapRadius;
+    std::vector<KeyFrame*> mvpLocalMapSpatialKFs, mvpSpatialKFs;
+    //^ mvpLocalMapPoints 중 local keyframe에서 온 앞부분의 길이 (나머지는 매 frame 다시 찾는 spatial point)
+    size_t mnLocalKFMapPoints;
+
+    //^ projection 검색용 local map point 연속 복사본과 그 frame (single camera). UpdateLocalMap마다
+    //^ 새로 들어온 point와 view version이 바뀐 point만 MapPoint에서 다시 읽는다
+    LocalMapMirror mLocalMirror;
+    LocalMapMirror::Projection mLocalProjection;
+    long unsigned int mnLocalMirrorFrameId;
+
+    // Read-only snapshot of the current map in localization mode (NULL otherwise) and the
+    // scratch state of the local map queries on it
+    FrozenMap* mpFrozenMap;
+    FrozenMap::LocalWindow mFrozenWindow;
     
     // System
     System* mpSystem;
     
     //Drawers
     Viewer* mpViewer;
+    MapStreamer* mpMapStreamer;
+    // Tiled map of the localization mode (Atlas.TileSize), NULL if disabled
+    TileStreamer* mpTileStreamer;
     FrameDrawer* mpFrameDrawer;
     MapDrawer* mpMapDrawer;
     bool bStepByStep;
@@ -479,6 +913,11 @@ protected:
     KeyFrame* mpLastKeyFrame;
     unsigned int mnLastKeyFrameId;
     unsigned int mnLastRelocFrameId;
+    // Relocalization candidates verified with SearchByBoW and MLPnP after the RelocalizationCache
+    // ranking (0: all of them)
+    int mnRelocCandidates;
+    // When lost, relocalize in the other maps of the Atlas before starting a new one
+    bool mbAtlasRelocalization;
     double mTimeStampLost;
     double time_recently_lost;
     double time_recently_lost_visual;
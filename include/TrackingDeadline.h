@@ -0,0 +1,89 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TRACKINGDEADLINE_H
+#define TRACKINGDEADLINE_H
+
+#include <chrono>
+#include <string>
+
+namespace ORB_SLAM3
+{
+
+// Time budget of one frame in the Tracking, from the start of its extraction to the end of its
+// tracking. The optional work (the wider projection search after the motion model, the local
+// map) is sized to what is left of it, with costs measured on the previous frames (exponential
+// moving average). The degradations applied to the current frame are kept as a bit mask.
+class TrackingDeadline
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    enum Degradation
+    {
+        NONE=0,
+        // No second, wider projection search when the motion model finds few matches
+        SKIP_WIDE_SEARCH=1,
+        // Only the local map points that fit in the budget are searched
+        SHRINK_LOCAL_MAP=2,
+        // The local map is not tracked, the pose of the motion model is the output
+        SKIP_LOCAL_MAP=4
+    };
+
+    // fDeadline: time (ms) a frame may take; nMinLocalPoints: fewer local map points than this
+    // are not worth searching
+    TrackingDeadline(const float fDeadline, const int nMinLocalPoints);
+
+    // Start of the tracking of a frame whose extraction took fSpentMs
+    void BeginFrame(const double fSpentMs);
+
+    // Time (ms) left for the current frame, negative once late
+    double Remaining() const;
+
+    bool FitsWideSearch() const;
+    void RecordWideSearch(const Clock::time_point &tStart);
+
+    // Local map points that can be searched in the remaining time, -1 if there is no limit
+    // (cost unknown yet) and 0 if not even nMinLocalPoints fit
+    int LocalPointsBudget() const;
+    // Time elapsed since tStart tracking the local map, with nPoints points searched
+    void RecordLocalMap(const Clock::time_point &tStart, const int nPoints);
+
+    void Apply(const Degradation degradation) { mnApplied |= degradation; }
+    int GetApplied() const { return mnApplied; }
+
+    // "skip_wide_search,shrink_local_map" style list of a bit mask of degradations ("none" if empty)
+    static std::string ToString(const int nDegradations);
+
+protected:
+    float mfDeadline;
+    int mnMinLocalPoints;
+
+    double mfWideSearchCost;
+    bool mbWideSearchMeasured;
+    // Cost (ms) of the local map tracking per searched point
+    double mfLocalPointCost;
+    bool mbLocalPointMeasured;
+
+    Clock::time_point mTimeStart;
+    int mnApplied;
+};
+
+} //namespace ORB_SLAM
+
+#endif // TRACKINGDEADLINE_H
@@ -0,0 +1,91 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TRAJECTORYFILE_H
+#define TRAJECTORYFILE_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace ORB_SLAM3
+{
+
+// Binary trajectory export (System::SaveTrajectoryBinary, System::SaveKeyFrameTrajectoryBinary).
+// Fixed-size records in host byte order, meant to be mmap'ed:
+//   Header                       64 bytes
+//   Record x nRecords            64 bytes each, sorted by timestamp
+//   IndexEntry x nIndex          16 bytes each, timestamp of every indexStride-th record
+// A time query binary searches the index and then scans at most indexStride records.
+// Poses are world poses of each map (no common origin), see the map id of the record.
+class TrajectoryFile
+{
+public:
+    static const uint32_t VERSION = 1;
+    static const uint32_t INDEX_STRIDE = 1024;
+
+    // Header flags
+    enum eHeaderFlags
+    {
+        BODY_FRAME=1        // Poses of the IMU body (Twb) instead of the camera (Twc)
+    };
+
+    // Record flags
+    enum eRecordFlags
+    {
+        KEYFRAME=1          // The record is the keyframe itself, not a frame referred to it
+    };
+
+    struct Header
+    {
+        char magic[8];          // "ORBS3TRJ"
+        uint32_t version;
+        uint32_t recordSize;
+        uint64_t nRecords;
+        uint64_t indexOffset;   // Bytes from the start of the file
+        uint64_t nIndex;
+        uint32_t indexStride;
+        uint32_t flags;
+        double tFirst;
+        double tLast;
+    };
+
+    struct Record
+    {
+        double timestamp;
+        uint64_t keyFrameId;    // Keyframe, or reference keyframe of the frame
+        uint32_t mapId;
+        uint32_t flags;
+        float t[3];             // Translation of Twc (Twb)
+        float q[4];             // Rotation of Twc (Twb), x y z w
+        float reserved[3];
+    };
+
+    struct IndexEntry
+    {
+        double timestamp;
+        uint64_t record;
+    };
+
+    // Sorts the records by timestamp and writes the file. False if it cannot be written
+    static bool Save(const std::string &filename, std::vector<Record> &vRecords, const uint32_t flags);
+};
+
+} //namespace ORB_SLAM
+
+#endif // TRAJECTORYFILE_H
@@ -0,0 +1,83 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TRAJECTORYSTORE_H
+#define TRAJECTORYSTORE_H
+
+#include <opencv2/core/core.hpp>
+
+#include <mutex>
+#include <vector>
+
+namespace ORB_SLAM3
+{
+
+class KeyFrame;
+class Map;
+
+// Last tracked frames indexed by time, for the pose of the camera at any timestamp between them
+// (e.g. to deskew lidar scans) without walking the lists of Tracking (System.TrajectoryStoreSize).
+// The frames are kept in a ring of fixed capacity, in timestamp order, with their pose relative to
+// the reference keyframe as in Tracking::mlRelativeFramePoses. The world pose is composed at query
+// time, so it follows the local BA, loop closures and merges that move the keyframes.
+// Safe to query from any thread while Tracking adds frames.
+class TrajectoryStore
+{
+public:
+    TrajectoryStore(const size_t nCapacity);
+
+    // Tracking, for every tracked frame. A timestamp not after the last one (new dataset) starts over
+    void AddFrame(const double timestamp, KeyFrame* pRefKF, const cv::Mat &Tcr);
+    // Tracking::UpdateFrameIMU
+    void ScaleMap(Map* pMap, const float s);
+    // Before the keyframes of the map are deleted (NULL: the whole atlas)
+    void ResetMap(Map* pMap);
+    // Before a keyframe that may be a reference is deleted. Its frames are moved to its parent
+    // (set by KeyFrame::SetBadFlag), or dropped if it has none
+    void EraseKeyFrame(KeyFrame* pKF);
+
+    // Camera pose (Tcw) at the timestamp, interpolated on SE3 between the two stored frames around
+    // it. False outside the stored time range
+    bool GetPose(const double timestamp, cv::Mat &Tcw);
+    // Time range of the stored frames. False if there are none
+    bool GetTimeRange(double &firstTime, double &lastTime);
+    size_t Size();
+
+protected:
+    struct Entry
+    {
+        double timestamp;
+        KeyFrame* pRefKF;
+        cv::Matx44f Tcr;
+    };
+
+    Entry& At(const size_t i) { return mvEntries[(mnFirst+i)%mvEntries.size()]; }
+    // Keep only the entries for which bKeep is set, in order
+    void Compact(const std::vector<bool> &vbKeep);
+    // Tcw of the entry, through the parents of its reference keyframe if it was culled
+    static cv::Matx44f WorldPose(const Entry &e);
+
+    std::mutex mMutex;
+    std::vector<Entry> mvEntries;
+    size_t mnFirst;
+    size_t mnSize;
+};
+
+} //namespace ORB_SLAM
+
+#endif // TRAJECTORYSTORE_H
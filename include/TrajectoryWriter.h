@@ -0,0 +1,120 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TRAJECTORYWRITER_H
+#define TRAJECTORYWRITER_H
+
+#include <opencv2/core/core.hpp>
+
+#include <array>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace ORB_SLAM3
+{
+
+class KeyFrame;
+class Map;
+
+// Streams the camera trajectory to a text file while the system runs, so that Tracking only has
+// to keep the last frames in memory (System.TrajectoryStream). Frame poses are written relative to
+// their reference keyframe and the keyframe poses are written again whenever they change
+// (local BA, loop closure, map merge, culling), so the last record of each keyframe is the final
+// one. Poses are "tx ty tz qx qy qz qw" with setprecision(9), one record per line:
+//   K <keyframe id> <map id> <Twk>    world pose of the keyframe (first use or change)
+//   F <timestamp> <keyframe id> <Tkc> camera pose relative to the keyframe (lost frames skipped)
+//   S <map id> <scale>                scale the translation of the F records written so far whose
+//                                     keyframe is in the map (inertial initialization)
+//   R <map id>                        map reset: drop its frames (-1: every map)
+// The camera pose of a frame is Twc = Twk*Tkc with the last K record of its keyframe.
+class TrajectoryWriter
+{
+public:
+    TrajectoryWriter(const std::string &strFile);
+
+    bool IsOpen() const { return mFile.is_open(); }
+
+    // Main thread function
+    void Run();
+
+    // Called by Tracking for every frame stored in mlRelativeFramePoses
+    void AddFrame(const double timestamp, KeyFrame* pRefKF, const cv::Mat &Tcr, const bool bLost);
+    // Tracking::UpdateFrameIMU
+    void ScaleMap(Map* pMap, const float s);
+    // Map reset in Tracking (NULL: the whole atlas)
+    void ResetMap(Map* pMap);
+
+    void RequestFinish();
+    bool isFinished();
+
+protected:
+    enum eRecordType
+    {
+        FRAME=0,
+        SCALE,
+        RESET
+    };
+
+    struct Record
+    {
+        eRecordType type;
+        double timestamp;
+        KeyFrame* pKF;
+        cv::Mat Tcr;
+        long int nMapId;
+        float scale;
+    };
+
+    // Write the queued records
+    void WriteRecords();
+    // Write again the keyframes whose pose or map changed
+    void UpdateKeyFrames();
+    // Write the keyframe if new or changed. False if it is not in any map
+    bool WriteKeyFrame(KeyFrame* pKF);
+
+    void WritePose(const cv::Mat &T);
+
+    bool CheckFinish();
+    void SetFinish();
+
+    std::ofstream mFile;
+
+    std::mutex mMutexQueue;
+    std::condition_variable mcvQueue;
+    std::deque<Record> mqRecords;
+
+    // Last pose (Twk, 12 floats) and map id written for each keyframe
+    struct WrittenKeyFrame
+    {
+        std::array<float,12> pose;
+        long int nMapId;
+    };
+    std::unordered_map<KeyFrame*, WrittenKeyFrame> mmWrittenKFs;
+
+    std::mutex mMutexFinish;
+    bool mbFinishRequested;
+    bool mbFinished;
+};
+
+} //namespace ORB_SLAM
+
+#endif // TRAJECTORYWRITER_H
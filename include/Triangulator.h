@@ -0,0 +1,53 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TRIANGULATOR_H
+#define TRIANGULATOR_H
+
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+namespace ORB_SLAM3
+{
+
+// Linear (DLT) triangulation of a point seen by two cameras, shared by the map point creation and
+// the two view initialization. As with the SVD of the 4x4 DLT matrix A, the homogeneous point is
+// the null vector of A, here found in double precision by inverse iteration on A^T*A with its
+// LDL^T factorization (4 iterations from w=1, which agree with the SVD to 1e-5 for rays with any
+// parallax). There are no branches nor square roots, so the batch version is vectorized by the
+// compiler. The projection matrices are 3x4 (or 4x4, the last row is ignored): Tcw with normalized
+// coordinates or K*[R|t] with pixels.
+class Triangulator
+{
+public:
+    // False for a point at infinity (no Euclidean coordinates)
+    static bool Triangulate(const cv::Matx44f &P1, const cv::Matx44f &P2, const cv::Point2f &x1, const cv::Point2f &x2, cv::Matx31f &x3D);
+    static bool Triangulate(const cv::Mat &P1, const cv::Mat &P2, const cv::Point2f &x1, const cv::Point2f &x2, cv::Mat &x3D);
+
+    // All the pairs vx1[i], vx2[i] with the same cameras, vbOK[i] as returned by the single version
+    static void Triangulate(const cv::Mat &P1, const cv::Mat &P2, const std::vector<cv::Point2f> &vx1, const std::vector<cv::Point2f> &vx2,
+                            std::vector<cv::Point3f> &vx3D, std::vector<bool> &vbOK);
+
+protected:
+    // n points, P1 and P2 row major 3x4. Points at infinity get non finite coordinates
+    static void Kernel(const double* P1, const double* P2, const cv::Point2f* px1, const cv::Point2f* px2, const int n, cv::Point3f* px3D);
+};
+
+} //namespace ORB_SLAM
+
+#endif // TRIANGULATOR_H
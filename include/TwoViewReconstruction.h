@@ -36,21 +36,24 @@ public:
     TwoViewReconstruction(cv::Mat& k, float sigma = 1.0, int iterations = 200);
 
     // Computes in parallel a fundamental matrix and a homography
-    // Selects a model and tries to recover the motion and the structure from motion
+    // Selects a model and tries to recover the motion and the structure from motion.
+    // The best homography and fundamental matrix of the previous call are scored first, so that
+    // retries with the same reference frame stop RANSAC as soon as they are confidently beaten.
     bool Reconstruct(const std::vector<cv::KeyPoint>& vKeys1, const std::vector<cv::KeyPoint>& vKeys2, const std::vector<int> &vMatches12,
                     cv::Mat &R21, cv::Mat &t21, std::vector<cv::Point3f> &vP3D, std::vector<bool> &vbTriangulated);
 
 private:
 
-    void FindHomography(std::vector<bool> &vbMatchesInliers, float &score, cv::Mat &H21);
-    void FindFundamental(std::vector<bool> &vbInliers, float &score, cv::Mat &F21);
+    // Run the RANSAC iterations [itBegin,itEnd) and keep the hypothesis with the highest score
+    void FindHomography(int itBegin, int itEnd, std::vector<unsigned char> &vbMatchesInliers, float &score, cv::Mat &H21);
+    void FindFundamental(int itBegin, int itEnd, std::vector<unsigned char> &vbInliers, float &score, cv::Mat &F21);
 
     cv::Mat ComputeH21(const std::vector<cv::Point2f> &vP1, const std::vector<cv::Point2f> &vP2);
     cv::Mat ComputeF21(const std::vector<cv::Point2f> &vP1, const std::vector<cv::Point2f> &vP2);
 
-    float CheckHomography(const cv::Mat &H21, const cv::Mat &H12, std::vector<bool> &vbMatchesInliers, float sigma);
+    float CheckHomography(const cv::Mat &H21, const cv::Mat &H12, std::vector<unsigned char> &vbMatchesInliers, float sigma);
 
-    float CheckFundamental(const cv::Mat &F21, std::vector<bool> &vbMatchesInliers, float sigma);
+    float CheckFundamental(const cv::Mat &F21, std::vector<unsigned char> &vbMatchesInliers, float sigma);
 
     bool ReconstructF(std::vector<bool> &vbMatchesInliers, cv::Mat &F21, cv::Mat &K,
                       cv::Mat &R21, cv::Mat &t21, std::vector<cv::Point3f> &vP3D, std::vector<bool> &vbTriangulated, float minParallax, int minTriangulated);
@@ -58,8 +61,6 @@ private:
     bool ReconstructH(std::vector<bool> &vbMatchesInliers, cv::Mat &H21, cv::Mat &K,
                       cv::Mat &R21, cv::Mat &t21, std::vector<cv::Point3f> &vP3D,std:: vector<bool> &vbTriangulated, float minParallax, int minTriangulated);
 
-    void Triangulate(const cv::KeyPoint &kp1, const cv::KeyPoint &kp2, const cv::Mat &P1, const cv::Mat &P2, cv::Mat &x3D);
-
     void Normalize(const std::vector<cv::KeyPoint> &vKeys, std::vector<cv::Point2f> &vNormalizedPoints, cv::Mat &T);
 
 
@@ -80,6 +81,14 @@ private:
     std::vector<Match> mvMatches12;
     std::vector<bool> mvbMatched1;
 
+    // Pixel coordinates of the matched keypoints, one array per coordinate so the
+    // hypotheses are scored over contiguous memory (reference u1,v1 and current u2,v2)
+    std::vector<float> mvU1, mvV1, mvU2, mvV2;
+
+    // Normalized keypoints (shared by the homography and fundamental RANSAC)
+    std::vector<cv::Point2f> mvPn1, mvPn2;
+    cv::Mat mT1, mT2;
+
     // Calibration
     cv::Mat mK;
 
@@ -92,6 +101,10 @@ private:
     // Ransac sets
     std::vector<std::vector<size_t> > mvSets;
 
+    // Best hypotheses of the previous call, and the inliers they have on the current matches
+    cv::Mat mPrevH21, mPrevF21;
+    int mnWarmInliersH, mnWarmInliersF;
+
 };
 
 } //namespace ORB_SLAM
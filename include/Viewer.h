@@ -24,8 +24,10 @@
 #include "MapDrawer.h"
 #include "Tracking.h"
 #include "System.h"
+#include "ThreadScheduling.h"
 
 #include <mutex>
+#include <condition_variable>
 
 namespace ORB_SLAM3
 {
@@ -52,12 +54,18 @@ public:
 
     bool isStopped();
 
+    // Blocks until the viewer has stopped after RequestStop()
+    void WaitUntilStopped();
+
     bool isStepByStep();
 
     void Release();
 
     void SetTrackingPause();
 
+    // CPU affinity and scheduling of the viewer thread (Thread.Viewer.*), applied when Run starts
+    void SetThreadScheduling(const ThreadScheduling &sched);
+
     bool both;
 private:
 
@@ -70,6 +78,8 @@ private:
     MapDrawer* mpMapDrawer;
     Tracking* mpTracker;
 
+    ThreadScheduling mThreadScheduling;
+
     // 1/fps in ms
     double mT;
     float mImageWidth, mImageHeight;
@@ -85,6 +95,7 @@ private:
     bool mbStopped;
     bool mbStopRequested;
     std::mutex mMutexStop;
+    std::condition_variable mcvStop; // notified whenever mbStopped changes or finish is requested
 
     bool mbStopTrack;
 
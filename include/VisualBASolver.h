@@ -0,0 +1,238 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef VISUALBASOLVER_H
+#define VISUALBASOLVER_H
+
+#include <Eigen/Core>
+#include <Eigen/SparseCore>
+#include <Eigen/SparseCholesky>
+
+#include <functional>
+#include <vector>
+
+namespace ORB_SLAM3
+{
+
+class GeometricCamera;
+class ThreadPool;
+
+// Bundle adjustment of keyframe poses and points with reprojection errors, used by
+// Optimizer::BundleAdjustment and Optimizer::LocalBundleAdjustment when Optimizer.VisualBA is
+// "native". It solves the same problem as their g2o graphs (VertexSE3Expmap, VertexSBAPointXYZ and
+// the EdgeSE3ProjectXYZ, EdgeSE3ProjectXYZToBody and EdgeStereoSE3ProjectXYZ edges with Huber
+// kernel) with the Levenberg-Marquardt of g2o, but without graph: the observations are arrays
+// evaluated in batches, the points are eliminated with a Schur complement built block by block on
+// the thread pool, and the reduced camera system is solved with a sparse Cholesky factorization
+// whose pattern is analysed once per problem, or with block Jacobi preconditioned conjugate
+// gradient, whose products are also split on the thread pool.
+class VisualBASolver
+{
+public:
+    typedef Eigen::Matrix<double,6,6> Matrix6d;
+    typedef Eigen::Matrix<double,6,1> Vector6d;
+
+    // Same observations as PoseSolver
+    enum eObsType{
+        MONO=0,         // left camera, 2D
+        MONO_RIGHT=1,   // right camera of a rigid rig (through Trl), 2D
+        STEREO=2        // rectified stereo (u, v, uRight), 3D
+    };
+
+    // Solver of the reduced camera system
+    enum eLinearSolver{
+        CHOLESKY=0,     // sparse LDLT, exact
+        PCG=1           // no factorization nor fill-in, approximate (relative residual 1e-6)
+    };
+
+    // Arithmetic of the residuals and their derivatives. SINGLE evaluates them in float, twice the
+    // SIMD lanes and half the memory traffic of the per-observation arrays; the estimate, the costs
+    // and the Hessian blocks, accumulated from them, stay in double.
+    enum ePrecision{
+        DOUBLE=0,
+        SINGLE=1
+    };
+
+    VisualBASolver();
+
+    // Start a new problem. Without thread pool everything runs in the calling thread.
+    void Reset(ThreadPool* pThreadPool);
+
+    // pCamera2/Rrl/trl are only used by MONO_RIGHT observations and the pinhole parameters only by
+    // STEREO observations. Returns the index of the keyframe in the solver.
+    int AddKeyFrame(const Eigen::Matrix3d &Rcw, const Eigen::Vector3d &tcw, const bool bFixed,
+                    GeometricCamera* pCamera, GeometricCamera* pCamera2,
+                    const Eigen::Matrix3d &Rrl, const Eigen::Vector3d &trl,
+                    const double fx, const double fy, const double cx, const double cy, const double bf);
+
+    // Returns the index of the point in the solver
+    int AddPoint(const Eigen::Vector3d &Xw);
+
+    // Observation of point nPoint from keyframe nKF with isotropic information invSigma2 and Huber
+    // threshold delta (0: no robust kernel). ur is ignored by MONO and MONO_RIGHT observations.
+    int AddObservation(const eObsType type, const int nKF, const int nPoint, const double u, const double v, const double ur,
+                       const double invSigma2, const double delta);
+
+    void SetLinearSolver(const eLinearSolver solver) { mLinearSolver = solver; mbStructure = false; }
+    void SetPrecision(const ePrecision precision) { mPrecision = precision; mbStructure = false; }
+
+    // Initial damping (0: 1e-5 times the largest element of the Hessian diagonal, as g2o without user lambda)
+    void SetLambdaInit(const double lambda) { mLambdaInit = lambda; }
+    // Optimize() stops before the next iteration once *pbStopFlag is true
+    void SetStopFlag(bool* pbStopFlag) { mpbStopFlag = pbStopFlag; }
+
+    // Run up to nIterations of Levenberg-Marquardt from the current estimate. As a new call to
+    // g2o::SparseOptimizer::optimize, the damping starts again. Afterwards Chi2() and IsDepthPositive()
+    // are valid for every observation. Returns the number of iterations done.
+    int Optimize(const int nIterations);
+
+    int NumKeyFrames() const { return mvbFixed.size(); }
+    int NumPoints() const { return mvX.size(); }
+    int NumObservations() const { return mvType.size(); }
+    eObsType GetType(const int i) const { return static_cast<eObsType>(mvType[i]); }
+
+    void GetPose(const int i, Eigen::Matrix3d &Rcw, Eigen::Vector3d &tcw) const;
+    Eigen::Vector3d GetPoint(const int i) const { return Eigen::Vector3d(mvX[i], mvY[i], mvZ[i]); }
+
+    // e'*Info*e of the observation at the current estimate, without robust kernel
+    double Chi2(const int i) const { return mvChi2[i]; }
+    // Whether the point is in front of the camera of the observation (the right one for MONO_RIGHT)
+    bool IsDepthPositive(const int i) const { return mvbDepthPositive[i]; }
+
+protected:
+    struct Calibration
+    {
+        GeometricCamera* pCamera;
+        GeometricCamera* pCamera2;
+        Eigen::Matrix3d Rrl;
+        Eigen::Vector3d trl;
+        double fx, fy, cx, cy, bf;
+    };
+
+    // Linearization of the observations in the precision of the evaluation: point in the camera
+    // frame, weighted information, residual (3) and derivative of the residual w.r.t. the point in
+    // the camera frame (3x3). Below DOUBLE, the estimate converted for the evaluation.
+    template<class Scalar>
+    struct Linearization
+    {
+        void resize(const int nObs)
+        {
+            vXc.resize(nObs); vYc.resize(nObs); vZc.resize(nObs);
+            vWeight.resize(nObs); vErr.resize(3*nObs); vDe.resize(9*nObs);
+        }
+
+        std::vector<Scalar> vXc, vYc, vZc;
+        std::vector<Scalar> vWeight, vErr, vDe;
+        std::vector<Scalar> vPose, vX, vY, vZ;
+    };
+
+    // Observations by point and by keyframe, blocks of the reduced camera system and its pattern
+    void BuildStructure();
+    // Sparse pattern of the blocks for the Cholesky factorization
+    void BuildPattern(const int nCams, const int nBlocks);
+    // Robust cost of the observations at the given estimate (poses as Rcw row-major and tcw, 12
+    // values per keyframe). With bJacobians the weighted residuals and the derivatives w.r.t. the
+    // point in the camera frame are kept for BuildSystem().
+    double Evaluate(const std::vector<double> &vPose, const std::vector<double> &vX,
+                    const std::vector<double> &vY, const std::vector<double> &vZ, const bool bJacobians);
+    template<class Scalar>
+    double Evaluate(const std::vector<double> &vPose, const std::vector<double> &vX,
+                    const std::vector<double> &vY, const std::vector<double> &vZ, const bool bJacobians,
+                    Linearization<Scalar> &lin);
+    // Camera and point blocks of the Gauss-Newton system H dx = -g
+    void BuildSystem();
+    template<class Scalar>
+    void BuildSystem(const Linearization<Scalar> &lin);
+    double MaxDiagonal() const;
+    // Damped step: Schur complement, reduced camera system and point back-substitution.
+    // Returns false if the factorization failed.
+    bool Solve(const double lambda);
+    // Reduced camera system solved into mdc with preconditioned conjugate gradient
+    bool SolvePCG();
+    // y = S*x with the blocks of the reduced camera system
+    void MultiplyReduced(const Eigen::VectorXd &x, Eigen::VectorXd &y);
+    // Step applied to the current estimate into the candidate arrays
+    void Update();
+    // dx'*(lambda*dx - g), the decrease predicted by the linearization
+    double PredictedDecrease(const double lambda) const;
+    // f(begin,end) on chunks of [0,n) of nGrain elements, on the thread pool if there is more than one
+    void ParallelRange(const int n, const int nGrain, const std::function<void(int,int)> &f);
+
+    ThreadPool* mpThreadPool;
+    bool* mpbStopFlag;
+    double mLambdaInit;
+    eLinearSolver mLinearSolver;
+    ePrecision mPrecision;
+    bool mbStructure;
+
+    // Keyframes: poses (Rcw row-major, tcw), fixed flag, calibration and index in the reduced system (-1 if fixed)
+    std::vector<double> mvPose, mvPoseNew;
+    std::vector<unsigned char> mvbFixed;
+    std::vector<Calibration> mvCalib;
+    std::vector<int> mvCamIdx;
+    std::vector<int> mvCamKF;
+
+    // Points as structure of arrays
+    std::vector<double> mvX, mvY, mvZ;
+    std::vector<double> mvXNew, mvYNew, mvZNew;
+
+    // Observations as structure of arrays
+    std::vector<unsigned char> mvType;
+    std::vector<int> mvObsKF, mvObsPoint;
+    std::vector<double> mvU, mvV, mvUr;
+    std::vector<double> mvInfo, mvDelta;
+    std::vector<double> mvChi2, mvCost;
+    std::vector<unsigned char> mvbDepthPositive;
+
+    // Linearization of the observations (the one of mPrecision is used), camera-point blocks
+    // W = Jc'*w*Jp (6x3) and W*inv(Hpp) (6x3)
+    Linearization<double> mLinDouble;
+    Linearization<float> mLinSingle;
+    std::vector<double> mvW, mvWHinv;
+
+    // Observations of each point and of each keyframe (compressed rows)
+    std::vector<int> mvPointObsBegin, mvPointObs;
+    std::vector<int> mvKFObsBegin, mvKFObs;
+
+    // Point blocks (3x3, 3) and their damped inverses, camera blocks (6x6, 6) and the steps
+    std::vector<double> mvHpp, mvgp, mvHppInv, mvdp;
+    std::vector<double> mvHcc, mvgc;
+
+    // Blocks (cam1<=cam2) of the reduced camera system: the observation pairs (a of cam1, b of cam2,
+    // same point) that contribute -W_a*inv(Hpp)*W_b' and the position of each element in the
+    // values of mS (-1 below the diagonal)
+    std::vector<int> mvBlockCam1, mvBlockCam2;
+    std::vector<int> mvBlockPairBegin, mvPairA, mvPairB;
+    std::vector<int> mvBlockValue;
+
+    Eigen::SparseMatrix<double> mS;
+    Eigen::SimplicialLDLT<Eigen::SparseMatrix<double>, Eigen::Upper> mLDLT;
+    Eigen::VectorXd mRhs, mdc;
+
+    // PCG: dense blocks (6x6) of the reduced camera system, blocks of each camera (as cam1 or cam2),
+    // diagonal block and its inverse (preconditioner) per camera, and the iteration vectors
+    std::vector<double> mvSBlock;
+    std::vector<int> mvCamBlockBegin, mvCamBlocks;
+    std::vector<int> mvDiagBlock;
+    std::vector<double> mvPrecond;
+    Eigen::VectorXd mr, mz, mp, mAp;
+};
+
+} //namespace ORB_SLAM3
+
+#endif // VISUALBASOLVER_H
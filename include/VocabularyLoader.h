@@ -0,0 +1,52 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef VOCABULARYLOADER_H
+#define VOCABULARYLOADER_H
+
+#include "ORBVocabulary.h"
+
+#include <string>
+
+namespace ORB_SLAM3
+{
+
+// Background loading of the vocabulary, so that the system starts tracking while it is read.
+// Initialization does not need the vocabulary, the components that compute or index BoW vectors
+// (Frame::ComputeBoW, KeyFrame::ComputeBoW, KeyFrameDatabase) wait for it the first time only.
+// A vocabulary that was not loaded through LoadAsync counts as loaded.
+class VocabularyLoader
+{
+public:
+    // Text or binary (.bin, memory mapped) file. False if it cannot be loaded
+    static bool Load(ORBVocabulary* pVoc, const std::string &strFile);
+
+    // Starts loading the file into pVoc, which must not be used before WaitUntilLoaded. A file that
+    // cannot be opened gives false at once, one that cannot be parsed ends the process as the
+    // synchronous loading would have
+    static bool LoadAsync(ORBVocabulary* pVoc, const std::string &strFile);
+
+    static bool IsLoaded(const ORBVocabulary* pVoc);
+
+    // Blocks until pVoc is loaded (returns at once when it is)
+    static void WaitUntilLoaded(const ORBVocabulary* pVoc);
+};
+
+} //namespace ORB_SLAM
+
+#endif // VOCABULARYLOADER_H
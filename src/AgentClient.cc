@@ -0,0 +1,384 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "AgentClient.h"
+#include "Atlas.h"
+#include "Map.h"
+#include "KeyFrame.h"
+#include "MapPoint.h"
+#include "EpochManager.h"
+
+#include <sys/socket.h>
+#include <netdb.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+namespace ORB_SLAM3
+{
+
+AgentClient::AgentClient(Atlas* pAtlas, const std::string &strHost, const int port, const unsigned int nAgentId,
+                         const float fUpdatePeriod):
+    mpAtlas(pAtlas), mStrHost(strHost), mnPort(port), mnAgentId(nAgentId), mfUpdatePeriod(fUpdatePeriod), mSocket(-1),
+    mbResync(false), mpUpdatedMap(static_cast<Map*>(NULL)), mnUpdatedChange(-1), mnUpdatedKFs(0),
+    mnSentKeyFrames(0), mnSentUpdates(0), mnSentBytes(0), mbFinishRequested(false), mbFinished(false)
+{
+}
+
+void AgentClient::Run()
+{
+    std::vector<std::vector<char> > vToSend;
+    std::chrono::steady_clock::time_point tLastUpdate = std::chrono::steady_clock::now();
+
+    // CollectUpdates walks map points and keyframes of the current map
+    EpochManager::ThreadRegistration epochRegistration;
+
+    while(!CheckFinish())
+    {
+        EpochManager::Quiescent();
+
+        if(mSocket<0 && !Connect())
+        {
+            // Retry every second, the keyframes keep being queued
+            std::unique_lock<std::mutex> lock(mMutexQueue);
+            mcvQueue.wait_for(lock, std::chrono::seconds(1));
+            continue;
+        }
+
+        const std::chrono::steady_clock::time_point tNow = std::chrono::steady_clock::now();
+        if(std::chrono::duration_cast<std::chrono::duration<float> >(tNow - tLastUpdate).count() >= mfUpdatePeriod)
+        {
+            CollectUpdates();
+            tLastUpdate = tNow;
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(mMutexQueue);
+            if(mqMessages.empty())
+                mcvQueue.wait_for(lock, std::chrono::milliseconds(100));
+            vToSend.assign(mqMessages.begin(), mqMessages.end());
+            mqMessages.clear();
+        }
+
+        for(size_t i=0; i<vToSend.size(); i++)
+        {
+            if(!Send(vToSend[i]))
+            {
+                // Requeue what was not sent, in order
+                std::unique_lock<std::mutex> lockState(mMutexState);
+                std::unique_lock<std::mutex> lock(mMutexQueue);
+                mqMessages.insert(mqMessages.begin(), vToSend.begin()+i, vToSend.end());
+                if(mqMessages.size()>MAX_QUEUED)
+                {
+                    mqMessages.erase(mqMessages.begin(), mqMessages.end()-MAX_QUEUED);
+                    mbResync = true;
+                }
+                Close();
+                break;
+            }
+
+            if(vToSend[i][0]=='K')
+                mnSentKeyFrames++;
+            else
+                mnSentUpdates++;
+            mnSentBytes += vToSend[i].size();
+        }
+        vToSend.clear();
+
+        if(mSocket>=0 && !Receive())
+            Close();
+    }
+
+    // What Local Mapping queued before finishing
+    if(mSocket>=0)
+    {
+        std::unique_lock<std::mutex> lock(mMutexQueue);
+        while(!mqMessages.empty() && Send(mqMessages.front()))
+        {
+            if(mqMessages.front()[0]=='K')
+                mnSentKeyFrames++;
+            else
+                mnSentUpdates++;
+            mnSentBytes += mqMessages.front().size();
+            mqMessages.pop_front();
+        }
+    }
+
+    Close();
+    std::cout << "Agent " << mnAgentId << ": " << mnSentKeyFrames << " keyframes and " << mnSentUpdates << " map updates sent, "
+              << mnSentBytes/1024 << " KB" << std::endl;
+    SetFinish();
+}
+
+void AgentClient::SendKeyFrame(KeyFrame* pKF)
+{
+    if(pKF->isBad() || pKF->AreFeaturesReleased())
+        return;
+
+    std::vector<char> buffer;
+    std::unique_lock<std::mutex> lock(mMutexState);
+    KeyFrameWire::EncodeKeyFrame(pKF, mnAgentId, buffer, &mState);
+    Enqueue(buffer);
+}
+
+void AgentClient::Enqueue(std::vector<char> &buffer)
+{
+    std::unique_lock<std::mutex> lock(mMutexQueue);
+    mqMessages.push_back(std::vector<char>());
+    mqMessages.back().swap(buffer);
+    if(mqMessages.size()>MAX_QUEUED)
+    {
+        mqMessages.pop_front();
+        mbResync = true;
+    }
+    mcvQueue.notify_one();
+}
+
+void AgentClient::CollectUpdates()
+{
+    Map* pMap = mpAtlas->GetCurrentMap();
+    if(!pMap)
+        return;
+
+    std::unique_lock<std::mutex> lock(mMutexState);
+
+    // As MapStreamer, the poses only move on map changes or when keyframes are added (local BA)
+    const int nChange = pMap->GetMapChangeIndex();
+    const long unsigned int nKFs = pMap->KeyFramesInMap();
+    if(!mbResync && pMap==mpUpdatedMap && nChange==mnUpdatedChange && nKFs==mnUpdatedKFs)
+        return;
+
+    mpUpdatedMap = pMap;
+    mnUpdatedChange = nChange;
+    mnUpdatedKFs = nKFs;
+
+    // Smaller changes are not worth sending (the delta encoding step)
+    const float th = 1e-4f;
+
+    MapUpdateMessage msg;
+    msg.nAgentId = mnAgentId;
+    msg.nMapId = pMap->GetId();
+
+    const Map::KeyFramesSnapshot pKFs = pMap->GetKeyFramesSnapshot();
+    const std::vector<KeyFrame*> &vpKFs = *pKFs;
+    for(size_t i=0; i<vpKFs.size(); i++)
+    {
+        KeyFrame* pKF = vpKFs[i];
+        if(pKF->isBad())
+            continue;
+
+        // Only the keyframes already sent
+        std::unordered_map<unsigned long long, cv::Matx44f>::const_iterator it = mState.mKFPoses.find(pKF->mnId);
+        if(it==mState.mKFPoses.end())
+            continue;
+
+        const cv::Mat Tcw = pKF->GetPose();
+        bool bChanged = mbResync;
+        for(int r=0; r<3 && !bChanged; r++)
+            for(int c=0; c<4 && !bChanged; c++)
+                bChanged = fabs(Tcw.at<float>(r,c)-it->second(r,c))>th;
+
+        if(bChanged)
+        {
+            msg.vKFIds.push_back(pKF->mnId);
+            msg.vKFPoses.push_back(Tcw);
+        }
+    }
+
+    const Map::MapPointsSnapshot pMPs = pMap->GetMapPointsSnapshot();
+    const std::vector<MapPoint*> &vpMPs = *pMPs;
+    for(size_t i=0; i<vpMPs.size(); i++)
+    {
+        MapPoint* pMP = vpMPs[i];
+        if(pMP->isBad())
+            continue;
+
+        std::unordered_map<unsigned long long, cv::Point3f>::const_iterator it = mState.mPoints.find(pMP->mnId);
+        if(it==mState.mPoints.end())
+            continue;
+
+        const cv::Mat Xw = pMP->GetWorldPos();
+        const cv::Point3f X(Xw.at<float>(0), Xw.at<float>(1), Xw.at<float>(2));
+        if(mbResync || fabs(X.x-it->second.x)>th || fabs(X.y-it->second.y)>th || fabs(X.z-it->second.z)>th)
+        {
+            msg.vPointIds.push_back(pMP->mnId);
+            msg.vPoints.push_back(X);
+        }
+    }
+
+    // Without references everything is sent in full
+    if(mbResync)
+    {
+        mState.Clear();
+        mbResync = false;
+    }
+
+    if(msg.vKFIds.empty() && msg.vPointIds.empty())
+        return;
+
+    std::vector<char> buffer;
+    KeyFrameWire::EncodeMapUpdate(msg, mState, buffer);
+    Enqueue(buffer);
+}
+
+bool AgentClient::Connect()
+{
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    std::stringstream ssPort;
+    ssPort << mnPort;
+
+    addrinfo* pResult = NULL;
+    if(getaddrinfo(mStrHost.c_str(), ssPort.str().c_str(), &hints, &pResult)!=0)
+        return false;
+
+    for(addrinfo* p=pResult; p!=NULL; p=p->ai_next)
+    {
+        mSocket = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+        if(mSocket<0)
+            continue;
+        if(connect(mSocket, p->ai_addr, p->ai_addrlen)==0)
+            break;
+        close(mSocket);
+        mSocket = -1;
+    }
+    freeaddrinfo(pResult);
+
+    if(mSocket<0)
+        return false;
+
+    std::vector<char> hello;
+    KeyFrameWire::EncodeHello(mnAgentId, hello);
+    if(!Send(hello))
+    {
+        Close();
+        return false;
+    }
+
+    // What was sent before the disconnection may not have arrived
+    {
+        std::unique_lock<std::mutex> lock(mMutexState);
+        mbResync = true;
+    }
+
+    mvReceived.clear();
+    std::cout << "Agent " << mnAgentId << ": connected to the map server " << mStrHost << ":" << mnPort << std::endl;
+    return true;
+}
+void AgentClient::Close()
+{
+    if(mSocket<0)
+        return;
+
+    close(mSocket);
+    mSocket = -1;
+    std::cout << "Agent " << mnAgentId << ": disconnected from the map server" << std::endl;
+}
+
+bool AgentClient::Send(const std::vector<char> &buffer)
+{
+    const char* data = buffer.data();
+    size_t size = buffer.size();
+    while(size>0)
+    {
+        const ssize_t n = send(mSocket, data, size, MSG_NOSIGNAL);
+        if(n<=0)
+            return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool AgentClient::Receive()
+{
+    char data[4096];
+    while(true)
+    {
+        const ssize_t n = recv(mSocket, data, sizeof(data), MSG_DONTWAIT);
+        if(n==0)
+            return false;
+        if(n<0)
+            break;
+        mvReceived.insert(mvReceived.end(), data, data+n);
+    }
+
+    return KeyFrameWire::ConsumeMessages(mvReceived, [&](const char type, const char* payload, const size_t size)
+        {
+            if(type!='A')
+                return;
+
+            unsigned int nAgentId;
+            Alignment alignment;
+            unsigned int nInliers;
+            if(!KeyFrameWire::DecodeAlignment(payload, size, nAgentId, alignment.nMapId, alignment.nOtherAgentId,
+                                              alignment.nOtherMapId, nInliers, alignment.s, alignment.R, alignment.t) ||
+               nAgentId!=mnAgentId)
+                return;
+            alignment.nInliers = nInliers;
+
+            std::cout << "Agent " << mnAgentId << ": map " << alignment.nMapId << " overlaps map " << alignment.nOtherMapId
+                      << " of agent " << alignment.nOtherAgentId << std::endl;
+
+            std::unique_lock<std::mutex> lock(mMutexAlignments);
+            mvAlignments.push_back(alignment);
+        });
+}
+
+std::vector<AgentClient::Alignment> AgentClient::GetAlignments()
+{
+    std::unique_lock<std::mutex> lock(mMutexAlignments);
+    return mvAlignments;
+}
+
+void AgentClient::RequestFinish()
+{
+    {
+        std::unique_lock<std::mutex> lock(mMutexFinish);
+        mbFinishRequested = true;
+    }
+    std::unique_lock<std::mutex> lock(mMutexQueue);
+    mcvQueue.notify_one();
+}
+
+bool AgentClient::CheckFinish()
+{
+    std::unique_lock<std::mutex> lock(mMutexFinish);
+    return mbFinishRequested;
+}
+
+void AgentClient::SetFinish()
+{
+    std::unique_lock<std::mutex> lock(mMutexFinish);
+    mbFinished = true;
+}
+
+bool AgentClient::isFinished()
+{
+    std::unique_lock<std::mutex> lock(mMutexFinish);
+    return mbFinished;
+}
+
+} //namespace ORB_SLAM3
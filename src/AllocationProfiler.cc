@@ -0,0 +1,280 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "AllocationProfiler.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+
+namespace ORB_SLAM3
+{
+
+namespace
+{
+
+// Only touched by its thread. Plain data, so that operator new can use it before anything is
+// constructed and while the thread exits
+thread_local AllocationProfiler::Counters tCounters = {0, 0, 0};
+
+struct SpanStats
+{
+    SpanStats() : count(0), allocations(0), bytes(0), maxAllocations(0) {}
+
+    unsigned long count;
+    unsigned long long allocations;
+    unsigned long long bytes;
+    unsigned long long maxAllocations;
+};
+
+// Statistics of a thread, kept after the thread finishes
+struct ThreadRecord
+{
+    ThreadRecord() : name(NULL), bReset(false)
+    {
+        last.allocations = last.bytes = last.frees = 0;
+        base = last;
+    }
+
+    std::mutex mutex;
+    const char* name;
+    std::map<const char*, SpanStats> mSpans;
+    // Counters of the thread at its last span and at the last Reset
+    AllocationProfiler::Counters last;
+    AllocationProfiler::Counters base;
+    bool bReset;
+};
+
+std::mutex& RegistryMutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+std::vector<std::unique_ptr<ThreadRecord> >& Registry()
+{
+    static std::vector<std::unique_ptr<ThreadRecord> > records;
+    return records;
+}
+
+ThreadRecord* GetThreadRecord()
+{
+    static thread_local ThreadRecord* pRecord = NULL;
+    if(!pRecord)
+    {
+        std::unique_lock<std::mutex> lock(RegistryMutex());
+        Registry().push_back(std::unique_ptr<ThreadRecord>(new ThreadRecord()));
+        pRecord = Registry().back().get();
+    }
+    return pRecord;
+}
+
+std::string ThreadName(const ThreadRecord* pRecord, const size_t i)
+{
+    return pRecord->name ? std::string(pRecord->name) : "Thread " + std::to_string(i+1);
+}
+
+} // namespace
+
+AllocationProfiler::Counters AllocationProfiler::ThreadCounters()
+{
+    return tCounters;
+}
+
+void AllocationProfiler::SetThreadName(const char* name)
+{
+    ThreadRecord* pRecord = GetThreadRecord();
+    std::unique_lock<std::mutex> lock(pRecord->mutex);
+    pRecord->name = name;
+}
+
+void AllocationProfiler::RecordSpan(const char* name, const Counters &start, const Counters &end)
+{
+    ThreadRecord* pRecord = GetThreadRecord();
+    std::unique_lock<std::mutex> lock(pRecord->mutex);
+    if(pRecord->bReset)
+    {
+        pRecord->base = start;
+        pRecord->bReset = false;
+    }
+    pRecord->last = end;
+
+    SpanStats &stats = pRecord->mSpans[name];
+    const unsigned long long allocations = end.allocations - start.allocations;
+    stats.count++;
+    stats.allocations += allocations;
+    stats.bytes += end.bytes - start.bytes;
+    stats.maxAllocations = std::max(stats.maxAllocations, allocations);
+}
+
+std::vector<AllocationProfiler::SpanSnapshot> AllocationProfiler::GetSpanSnapshots()
+{
+    std::vector<SpanSnapshot> vSnapshots;
+
+    std::unique_lock<std::mutex> lock(RegistryMutex());
+    const std::vector<std::unique_ptr<ThreadRecord> > &records = Registry();
+    for(size_t i=0; i<records.size(); i++)
+    {
+        ThreadRecord* pRecord = records[i].get();
+        std::unique_lock<std::mutex> lockRecord(pRecord->mutex);
+        const std::string thread = ThreadName(pRecord, i);
+        const size_t nFirst = vSnapshots.size();
+        for(std::map<const char*, SpanStats>::const_iterator it=pRecord->mSpans.begin(); it!=pRecord->mSpans.end(); it++)
+        {
+            if(it->second.count==0)
+                continue;
+
+            // The same literal may have several addresses (one per translation unit)
+            size_t j = nFirst;
+            while(j<vSnapshots.size() && vSnapshots[j].name!=it->first)
+                j++;
+            if(j==vSnapshots.size())
+            {
+                SpanSnapshot s;
+                s.name = it->first;
+                s.thread = thread;
+                s.count = 0;
+                s.allocations = s.bytes = s.maxAllocations = 0;
+                vSnapshots.push_back(s);
+            }
+
+            SpanSnapshot &s = vSnapshots[j];
+            s.count += it->second.count;
+            s.allocations += it->second.allocations;
+            s.bytes += it->second.bytes;
+            s.maxAllocations = std::max(s.maxAllocations, it->second.maxAllocations);
+        }
+    }
+
+    std::sort(vSnapshots.begin(), vSnapshots.end(), [](const SpanSnapshot &a, const SpanSnapshot &b){
+        return a.thread!=b.thread ? a.thread<b.thread : a.name<b.name;
+    });
+    return vSnapshots;
+}
+
+std::vector<AllocationProfiler::ThreadSnapshot> AllocationProfiler::GetThreadSnapshots()
+{
+    std::vector<ThreadSnapshot> vSnapshots;
+
+    std::unique_lock<std::mutex> lock(RegistryMutex());
+    const std::vector<std::unique_ptr<ThreadRecord> > &records = Registry();
+    for(size_t i=0; i<records.size(); i++)
+    {
+        ThreadRecord* pRecord = records[i].get();
+        std::unique_lock<std::mutex> lockRecord(pRecord->mutex);
+        if(pRecord->bReset)
+            continue;
+
+        ThreadSnapshot s;
+        s.thread = ThreadName(pRecord, i);
+        s.allocations = pRecord->last.allocations - pRecord->base.allocations;
+        s.bytes = pRecord->last.bytes - pRecord->base.bytes;
+        s.frees = pRecord->last.frees - pRecord->base.frees;
+        vSnapshots.push_back(s);
+    }
+    return vSnapshots;
+}
+
+void AllocationProfiler::Reset()
+{
+    std::unique_lock<std::mutex> lock(RegistryMutex());
+    const std::vector<std::unique_ptr<ThreadRecord> > &records = Registry();
+    for(size_t i=0; i<records.size(); i++)
+    {
+        std::unique_lock<std::mutex> lockRecord(records[i]->mutex);
+        records[i]->mSpans.clear();
+        records[i]->bReset = true;
+    }
+}
+
+} //namespace ORB_SLAM3
+
+#ifdef ORB_SLAM3_ALLOC_PROFILING
+
+//^ 전역 operator new/delete 교체: 스레드별 카운터만 증가시킨다
+namespace
+{
+
+inline void* CountedAlloc(std::size_t size)
+{
+    ORB_SLAM3::tCounters.allocations++;
+    ORB_SLAM3::tCounters.bytes += size;
+    return std::malloc(size ? size : 1);
+}
+
+inline void CountedFree(void* ptr)
+{
+    if(!ptr)
+        return;
+    ORB_SLAM3::tCounters.frees++;
+    std::free(ptr);
+}
+
+} // namespace
+
+void* operator new(std::size_t size)
+{
+    void* ptr = CountedAlloc(size);
+    if(!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void* operator new[](std::size_t size)
+{
+    void* ptr = CountedAlloc(size);
+    if(!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    return CountedAlloc(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    return CountedAlloc(size);
+}
+
+void operator delete(void* ptr) noexcept
+{
+    CountedFree(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+    CountedFree(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept
+{
+    CountedFree(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept
+{
+    CountedFree(ptr);
+}
+
+#endif // ORB_SLAM3_ALLOC_PROFILING
@@ -22,15 +22,32 @@
 #include "GeometricCamera.h"
 #include "Pinhole.h"
 #include "KannalaBrandt8.h"
+#include "SystemContext.h"
+#include "ThreadPool.h"
+
+#include <fstream>
+#include <cstdio>
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
 
 namespace ORB_SLAM3
 {
 
-Atlas::Atlas(){
+// Moves an id counter to at least nId (other Systems may be creating elements meanwhile)
+static void RaiseId(std::atomic<long unsigned int> &nNextId, const long unsigned int nId)
+{
+    long unsigned int nCurrent = nNextId.load();
+    while(nCurrent < nId && !nNextId.compare_exchange_weak(nCurrent, nId));
+}
+
+Atlas::Atlas(): mnLastInitKFidMap(0), mpContext(static_cast<SystemContext*>(NULL)), mpMapEvents(static_cast<MapEvents*>(NULL)), mHasViewer(false),
+    mnMaxFeaturesBytes(0), mnUseCounter(0), mnLastEnforceUse(0), mpArchivePool(static_cast<ThreadPool*>(NULL))
+{
     mpCurrentMap = static_cast<Map*>(NULL);
 }
 
-Atlas::Atlas(int initKFid): mnLastInitKFidMap(initKFid), mHasViewer(false)
+Atlas::Atlas(int initKFid): mnLastInitKFidMap(initKFid), mpContext(static_cast<SystemContext*>(NULL)), mpMapEvents(static_cast<MapEvents*>(NULL)), mHasViewer(false),
+    mnMaxFeaturesBytes(0), mnUseCounter(0), mnLastEnforceUse(0), mpArchivePool(static_cast<ThreadPool*>(NULL))
 {
     mpCurrentMap = static_cast<Map*>(NULL);
     CreateNewMap();
@@ -57,8 +74,8 @@ Atlas::~Atlas()
 
 void Atlas::CreateNewMap()
 {
-    unique_lock<mutex> lock(mMutexAtlas);
-    cout << "Creation of new map with id: " << Map::nNextId << endl;
+    unique_lock<AtlasMutex> lock(mMutexAtlas);
+    cout << "Creation of new map with id: " << Map::nNextId.load() << endl;
     if(mpCurrentMap){
         cout << "Exits current map " << endl;
         if(!mspMaps.empty() && mnLastInitKFidMap < mpCurrentMap->GetMaxKFid())
@@ -73,13 +90,18 @@ void Atlas::CreateNewMap()
     cout << "Creation of new map with last KF id: " << mnLastInitKFidMap << endl;
 
     mpCurrentMap = new Map(mnLastInitKFidMap);
+    mpCurrentMap->SetMapEvents(mpMapEvents);
+    mpCurrentMap->SetSystemContext(mpContext);
     mpCurrentMap->SetCurrentMap();
     mspMaps.insert(mpCurrentMap);
+    mcvCurrentMap.notify_all();
 }
 
 void Atlas::ChangeMap(Map* pMap)
 {
-    unique_lock<mutex> lock(mMutexAtlas);
+    EnsureResident(pMap);
+
+    unique_lock<AtlasMutex> lock(mMutexAtlas);
     cout << "Chage to map with id: " << pMap->GetId() << endl;
     if(mpCurrentMap){
         mpCurrentMap->SetStoredMap();
@@ -87,11 +109,12 @@ void Atlas::ChangeMap(Map* pMap)
 
     mpCurrentMap = pMap;
     mpCurrentMap->SetCurrentMap();
+    mcvCurrentMap.notify_all();
 }
 
 unsigned long int Atlas::GetLastInitKFid()
 {
-    unique_lock<mutex> lock(mMutexAtlas);
+    unique_lock<AtlasMutex> lock(mMutexAtlas);
     return mnLastInitKFidMap;
 }
 
@@ -120,55 +143,55 @@ void Atlas::AddCamera(GeometricCamera* pCam)
 
 void Atlas::SetReferenceMapPoints(const std::vector<MapPoint*> &vpMPs)
 {
-    unique_lock<mutex> lock(mMutexAtlas);
+    unique_lock<AtlasMutex> lock(mMutexAtlas);
     mpCurrentMap->SetReferenceMapPoints(vpMPs);
 }
 
 void Atlas::InformNewBigChange()
 {
-    unique_lock<mutex> lock(mMutexAtlas);
+    unique_lock<AtlasMutex> lock(mMutexAtlas);
     mpCurrentMap->InformNewBigChange();
 }
 
 int Atlas::GetLastBigChangeIdx()
 {
-    unique_lock<mutex> lock(mMutexAtlas);
+    unique_lock<AtlasMutex> lock(mMutexAtlas);
     return mpCurrentMap->GetLastBigChangeIdx();
 }
 
 long unsigned int Atlas::MapPointsInMap()
 {
-    unique_lock<mutex> lock(mMutexAtlas);
+    unique_lock<AtlasMutex> lock(mMutexAtlas);
     return mpCurrentMap->MapPointsInMap();
 }
 
 long unsigned Atlas::KeyFramesInMap()
 {
-    unique_lock<mutex> lock(mMutexAtlas);
+    unique_lock<AtlasMutex> lock(mMutexAtlas);
     return mpCurrentMap->KeyFramesInMap();
 }
 
 std::vector<KeyFrame*> Atlas::GetAllKeyFrames()
 {
-    unique_lock<mutex> lock(mMutexAtlas);
+    unique_lock<AtlasMutex> lock(mMutexAtlas);
     return mpCurrentMap->GetAllKeyFrames();
 }
 
 std::vector<MapPoint*> Atlas::GetAllMapPoints()
 {
-    unique_lock<mutex> lock(mMutexAtlas);
+    unique_lock<AtlasMutex> lock(mMutexAtlas);
     return mpCurrentMap->GetAllMapPoints();
 }
 
 std::vector<MapPoint*> Atlas::GetReferenceMapPoints()
 {
-    unique_lock<mutex> lock(mMutexAtlas);
+    unique_lock<AtlasMutex> lock(mMutexAtlas);
     return mpCurrentMap->GetReferenceMapPoints();
 }
 
 vector<Map*> Atlas::GetAllMaps()
 {
-    unique_lock<mutex> lock(mMutexAtlas);
+    unique_lock<AtlasMutex> lock(mMutexAtlas);
     struct compFunctor
     {
         inline bool operator()(Map* elem1 ,Map* elem2)
@@ -183,24 +206,29 @@ vector<Map*> Atlas::GetAllMaps()
 
 int Atlas::CountMaps()
 {
-    unique_lock<mutex> lock(mMutexAtlas);
+    unique_lock<AtlasMutex> lock(mMutexAtlas);
     return mspMaps.size();
 }
 
 void Atlas::clearMap()
 {
-    unique_lock<mutex> lock(mMutexAtlas);
+    unique_lock<AtlasMutex> lock(mMutexAtlas);
     mpCurrentMap->clear();
 }
 
 void Atlas::clearAtlas()
 {
-    unique_lock<mutex> lock(mMutexAtlas);
+    unique_lock<AtlasMutex> lock(mMutexAtlas);
     /*for(std::set<Map*>::iterator it=mspMaps.begin(), send=mspMaps.end(); it!=send; it++)
     {
         (*it)->clear();
         delete *it;
     }*/
+    if(mpMapEvents)
+    {
+        for(std::set<Map*>::iterator it=mspMaps.begin(), send=mspMaps.end(); it!=send; it++)
+            mpMapEvents->MapCleared((*it)->GetId());
+    }
     mspMaps.clear();
     mpCurrentMap = static_cast<Map*>(NULL);
     mnLastInitKFidMap = 0;
@@ -208,11 +236,11 @@ void Atlas::clearAtlas()
 
 Map* Atlas::GetCurrentMap()
 {
-    unique_lock<mutex> lock(mMutexAtlas);
+    unique_lock<AtlasMutex> lock(mMutexAtlas);
     if(!mpCurrentMap)
         CreateNewMap();
-    while(mpCurrentMap->IsBad())
-        usleep(3000);
+    // Releases the atlas mutex while waiting, so that the map can actually be replaced
+    mcvCurrentMap.wait(lock, [this]{ return !mpCurrentMap->IsBad(); });
 
     return mpCurrentMap;
 }
@@ -221,6 +249,9 @@ void Atlas::SetMapBad(Map* pMap)
 {
     mspMaps.erase(pMap);
     pMap->SetBad();
+    // What was not moved to other maps is gone
+    if(mpMapEvents)
+        mpMapEvents->MapCleared(pMap->GetId());
 
     mspBadMaps.insert(pMap);
 }
@@ -237,25 +268,25 @@ void Atlas::RemoveBadMaps()
 
 bool Atlas::isInertial()
 {
-    unique_lock<mutex> lock(mMutexAtlas);
+    unique_lock<AtlasMutex> lock(mMutexAtlas);
     return mpCurrentMap->IsInertial();
 }
 
 void Atlas::SetInertialSensor()
 {
-    unique_lock<mutex> lock(mMutexAtlas);
+    unique_lock<AtlasMutex> lock(mMutexAtlas);
     mpCurrentMap->SetInertialSensor();
 }
 
 void Atlas::SetImuInitialized()
 {
-    unique_lock<mutex> lock(mMutexAtlas);
+    unique_lock<AtlasMutex> lock(mMutexAtlas);
     mpCurrentMap->SetImuInitialized();
 }
 
 bool Atlas::isImuInitialized()
 {
-    unique_lock<mutex> lock(mMutexAtlas);
+    unique_lock<AtlasMutex> lock(mMutexAtlas);
     return mpCurrentMap->isImuInitialized();
 }
 
@@ -279,26 +310,648 @@ ORBVocabulary* Atlas::GetORBVocabulary()
     return mpORBVocabulary;
 }
 
+void Atlas::SetSystemContext(SystemContext* pContext)
+{
+    unique_lock<AtlasMutex> lock(mMutexAtlas);
+    mpContext = pContext;
+    for(std::set<Map*>::iterator it=mspMaps.begin(), send=mspMaps.end(); it!=send; it++)
+        (*it)->SetSystemContext(pContext);
+}
+
+void Atlas::SetMapEvents(MapEvents* pEvents)
+{
+    unique_lock<AtlasMutex> lock(mMutexAtlas);
+    mpMapEvents = pEvents;
+    for(std::set<Map*>::iterator it=mspMaps.begin(), send=mspMaps.end(); it!=send; it++)
+        (*it)->SetMapEvents(pEvents);
+}
+
+MapEvents* Atlas::GetMapEvents()
+{
+    return mpMapEvents;
+}
+
+void Atlas::PublishMapEvents(const MapEvents::Cause cause)
+{
+    if(mpMapEvents)
+        mpMapEvents->Publish(cause);
+}
+
 long unsigned int Atlas::GetNumLivedKF()
 {
-    unique_lock<mutex> lock(mMutexAtlas);
+    unique_lock<AtlasMutex> lock(mMutexAtlas);
     long unsigned int num = 0;
     for(Map* mMAPi : mspMaps)
     {
-        num += mMAPi->GetAllKeyFrames().size();
+        num += mMAPi->KeyFramesInMap();
     }
 
     return num;
 }
 
 long unsigned int Atlas::GetNumLivedMP() {
-    unique_lock<mutex> lock(mMutexAtlas);
+    unique_lock<AtlasMutex> lock(mMutexAtlas);
     long unsigned int num = 0;
     for (Map *mMAPi : mspMaps) {
-        num += mMAPi->GetAllMapPoints().size();
+        num += mMAPi->MapPointsInMap();
     }
 
     return num;
 }
 
+void Atlas::PreSave()
+{
+    // The save file contains the features of every keyframe
+    for(Map* pMi : GetAllMaps())
+        EnsureResident(pMi);
+
+    unique_lock<AtlasMutex> lock(mMutexAtlas);
+
+    struct compFunctor
+    {
+        inline bool operator()(Map* elem1 ,Map* elem2)
+        {
+            return elem1->GetId() < elem2->GetId();
+        }
+    };
+
+    // Empty maps (usually a just created current map) are not worth saving
+    mvpBackupMaps.clear();
+    for(set<Map*>::iterator it=mspMaps.begin(), end=mspMaps.end(); it!=end; ++it)
+        if((*it)->KeyFramesInMap() > 0)
+            mvpBackupMaps.push_back(*it);
+    sort(mvpBackupMaps.begin(), mvpBackupMaps.end(), compFunctor());
+
+    set<GeometricCamera*> spCams(mvpCameras.begin(), mvpCameras.end());
+    for(size_t i=0; i<mvpBackupMaps.size(); i++)
+        mvpBackupMaps[i]->PreSave(spCams);
+
+    mvpBackupCamPin.clear();
+    mvpBackupCamKan.clear();
+    for(set<GeometricCamera*>::iterator it=spCams.begin(), end=spCams.end(); it!=end; ++it)
+    {
+        GeometricCamera* pCam = *it;
+        if(pCam->GetType() == pCam->CAM_PINHOLE)
+            mvpBackupCamPin.push_back(static_cast<Pinhole*>(pCam));
+        else if(pCam->GetType() == pCam->CAM_FISHEYE)
+            mvpBackupCamKan.push_back(static_cast<KannalaBrandt8*>(pCam));
+    }
+}
+
+void Atlas::PostLoad()
+{
+    unique_lock<AtlasMutex> lock(mMutexAtlas);
+
+    map<unsigned int, GeometricCamera*> mpCams;
+    mvpCameras.clear();
+    for(size_t i=0; i<mvpBackupCamPin.size(); i++)
+    {
+        mpCams[mvpBackupCamPin[i]->GetId()] = mvpBackupCamPin[i];
+        mvpCameras.push_back(mvpBackupCamPin[i]);
+    }
+    for(size_t i=0; i<mvpBackupCamKan.size(); i++)
+    {
+        mpCams[mvpBackupCamKan[i]->GetId()] = mvpBackupCamKan[i];
+        mvpCameras.push_back(mvpBackupCamKan[i]);
+    }
+
+    long unsigned int nMaxKFid = 0, nMaxFrameId = 0, nMaxMPid = 0, nMaxMapId = 0;
+    mspMaps.clear();
+    mpCurrentMap = static_cast<Map*>(NULL);
+    for(size_t i=0; i<mvpBackupMaps.size(); i++)
+    {
+        Map* pMi = mvpBackupMaps[i];
+        // Before PostLoad, which rebuilds the submaps with the settings of the System
+        pMi->SetSystemContext(mpContext);
+        pMi->PostLoad(mpKeyFrameDB, mpORBVocabulary, mpCams);
+        pMi->SetStoredMap();
+        pMi->SetMapEvents(mpMapEvents);
+        mspMaps.insert(pMi);
+
+        nMaxMapId = max(nMaxMapId, pMi->GetId());
+        nMaxKFid = max(nMaxKFid, pMi->GetMaxKFid());
+
+        const Map::KeyFramesSnapshot pKFs = pMi->GetKeyFramesSnapshot();
+        const vector<KeyFrame*> &vpKFs = *pKFs;
+        for(size_t j=0; j<vpKFs.size(); j++)
+            nMaxFrameId = max(nMaxFrameId, vpKFs[j]->mnFrameId);
+
+        const Map::MapPointsSnapshot pMPs = pMi->GetMapPointsSnapshot();
+        const vector<MapPoint*> &vpMPs = *pMPs;
+        for(size_t j=0; j<vpMPs.size(); j++)
+            nMaxMPid = max(nMaxMPid, vpMPs[j]->mnId);
+    }
+
+    unsigned int nMaxCamId = 0;
+    for(size_t i=0; i<mvpCameras.size(); i++)
+        nMaxCamId = max(nMaxCamId, mvpCameras[i]->GetId());
+
+    // New elements must not reuse the ids of the loaded ones
+    if(!mspMaps.empty())
+    {
+        if(mpContext)
+        {
+            RaiseId(mpContext->mnNextKeyFrameId, nMaxKFid+1);
+            RaiseId(mpContext->mnNextFrameId, nMaxFrameId+1);
+            mnLastInitKFidMap = mpContext->mnNextKeyFrameId;
+        }
+        RaiseId(MapPoint::nNextId, nMaxMPid+1);
+        RaiseId(Map::nNextId, nMaxMapId+1);
+    }
+    if(!mvpCameras.empty())
+        RaiseId(GeometricCamera::nNextId, (long unsigned int)nMaxCamId+1);
+
+    mvpBackupMaps.clear();
+    mvpBackupCamPin.clear();
+    mvpBackupCamKan.clear();
+}
+
+void Atlas::SetMemoryBudget(size_t nMaxBytes, const string &strSpillDir)
+{
+    unique_lock<mutex> lock(mMutexSpill);
+    mnMaxFeaturesBytes = nMaxBytes;
+    mStrSpillDir = strSpillDir;
+    if(!mStrSpillDir.empty() && mStrSpillDir[mStrSpillDir.size()-1] != '/')
+        mStrSpillDir += "/";
+}
+
+MemoryUsage Atlas::GetMemoryUsage()
+{
+    vector<Map*> vpMaps;
+    {
+        unique_lock<AtlasMutex> lock(mMutexAtlas);
+        vpMaps.assign(mspMaps.begin(), mspMaps.end());
+    }
+
+    MemoryUsage usage;
+    for(Map* pMi : vpMaps)
+        pMi->AccumulateMemory(usage);
+    return usage;
+}
+
+void Atlas::EnforceMemoryBudget()
+{
+    vector<Map*> vpMaps;
+    Map* pCurrentMap;
+    {
+        unique_lock<AtlasMutex> lock(mMutexAtlas);
+        vpMaps.assign(mspMaps.begin(), mspMaps.end());
+        pCurrentMap = mpCurrentMap;
+    }
+
+    unique_lock<mutex> lock(mMutexSpill);
+    if(mnMaxFeaturesBytes == 0)
+        return;
+
+    size_t nResidentBytes = 0;
+    vector<pair<unsigned long int, Map*> > vCandidates;
+    for(Map* pMi : vpMaps)
+    {
+        if(mspSpilledMaps.count(pMi))
+            continue;
+
+        size_t nMapBytes = 0;
+        const Map::KeyFramesSnapshot pKFs = pMi->GetKeyFramesSnapshot();
+        const vector<KeyFrame*> &vpKFs = *pKFs;
+        for(size_t i=0; i<vpKFs.size(); i++)
+            nMapBytes += vpKFs[i]->FeaturesMemory();
+        nResidentBytes += nMapBytes;
+
+        // Leased maps are being matched by another thread and maps used since the last call
+        // (candidates just loaded back) are likely to be used again
+        const unsigned long int nLastUse = mmMapLastUse[pMi];
+        if(pMi != pCurrentMap && !pMi->IsBad() && nMapBytes > 0 && !mmMapLeases.count(pMi) && nLastUse <= mnLastEnforceUse)
+            vCandidates.push_back(make_pair(nLastUse, pMi));
+    }
+    mnLastEnforceUse = mnUseCounter;
+
+    if(nResidentBytes <= mnMaxFeaturesBytes)
+        return;
+
+    // Least recently used maps first
+    sort(vCandidates.begin(), vCandidates.end());
+    for(size_t i=0; i<vCandidates.size() && nResidentBytes > mnMaxFeaturesBytes; i++)
+    {
+        Map* pMi = vCandidates[i].second;
+
+        size_t nMapBytes = 0;
+        const Map::KeyFramesSnapshot pKFs = pMi->GetKeyFramesSnapshot();
+        const vector<KeyFrame*> &vpKFs = *pKFs;
+        for(size_t j=0; j<vpKFs.size(); j++)
+            nMapBytes += vpKFs[j]->FeaturesMemory();
+
+        if(!SpillMap(pMi))
+            break;
+
+        mspSpilledMaps.insert(pMi);
+        nResidentBytes -= min(nResidentBytes, nMapBytes);
+        cout << "Map " << pMi->GetId() << " spilled to disk (" << nMapBytes/(1024*1024) << " MB)" << endl;
+    }
+}
+
+void Atlas::EnsureResident(Map* pMap)
+{
+    if(!pMap)
+        return;
+
+    unique_lock<mutex> lock(mMutexSpill);
+    mmMapLastUse[pMap] = ++mnUseCounter;
+
+    if(!mspSpilledMaps.count(pMap))
+        return;
+
+    if(LoadSpilledMap(pMap))
+    {
+        mspSpilledMaps.erase(pMap);
+        cout << "Map " << pMap->GetId() << " loaded back from disk" << endl;
+    }
+}
+
+void Atlas::AcquireResident(Map* pMap)
+{
+    EnsureResident(pMap);
+
+    unique_lock<mutex> lock(mMutexSpill);
+    mmMapLeases[pMap]++;
+}
+
+void Atlas::ReleaseResident(Map* pMap)
+{
+    unique_lock<mutex> lock(mMutexSpill);
+    map<Map*, int>::iterator it = mmMapLeases.find(pMap);
+    if(it != mmMapLeases.end() && --(it->second) == 0)
+        mmMapLeases.erase(it);
+}
+
+bool Atlas::IsSpilled(Map* pMap)
+{
+    unique_lock<mutex> lock(mMutexSpill);
+    return mspSpilledMaps.count(pMap) > 0;
+}
+
+string Atlas::SpillFileName(Map* pMap)
+{
+    return mStrSpillDir + "map_" + to_string(pMap->GetId()) + ".spill";
+}
+
+bool Atlas::SpillMap(Map* pMap)
+{
+    const string strFile = SpillFileName(pMap);
+    std::ofstream ofs(strFile.c_str(), std::ios::binary);
+    if(!ofs.is_open())
+    {
+        cerr << "Cannot write spill file " << strFile << endl;
+        return false;
+    }
+
+    vector<KeyFrame*> vpKFs;
+    const Map::KeyFramesSnapshot pAllKFs = pMap->GetKeyFramesSnapshot();
+    const vector<KeyFrame*> &vpAllKFs = *pAllKFs;
+    for(size_t i=0; i<vpAllKFs.size(); i++)
+        if(!vpAllKFs[i]->isBad() && !vpAllKFs[i]->AreFeaturesReleased())
+            vpKFs.push_back(vpAllKFs[i]);
+
+    {
+        boost::archive::binary_oarchive oa(ofs);
+        size_t nKFs = vpKFs.size();
+        oa << nKFs;
+        for(size_t i=0; i<vpKFs.size(); i++)
+        {
+            long unsigned int nId = vpKFs[i]->mnId;
+            oa << nId;
+            vpKFs[i]->SaveFeatures(oa);
+        }
+    }
+
+    if(!ofs.good())
+    {
+        cerr << "Failed to write spill file " << strFile << endl;
+        ofs.close();
+        std::remove(strFile.c_str());
+        return false;
+    }
+    ofs.close();
+
+    for(size_t i=0; i<vpKFs.size(); i++)
+        vpKFs[i]->ReleaseFeatures();
+
+    return true;
+}
+
+bool Atlas::LoadSpilledMap(Map* pMap)
+{
+    map<Map*, string>::iterator itArchive = mmArchivedMaps.find(pMap);
+    if(itArchive != mmArchivedMaps.end())
+    {
+        if(!LoadArchivedMap(pMap, itArchive->second))
+            return false;
+        mmArchivedMaps.erase(itArchive);
+        return true;
+    }
+
+    const string strFile = SpillFileName(pMap);
+    std::ifstream ifs(strFile.c_str(), std::ios::binary);
+    if(!ifs.is_open())
+    {
+        cerr << "Cannot read spill file " << strFile << endl;
+        return false;
+    }
+
+    // Keyframes may have been erased or moved to another map since the map was spilled
+    map<long unsigned int, KeyFrame*> mpKFid;
+    const Map::KeyFramesSnapshot pKFs = pMap->GetKeyFramesSnapshot();
+    const vector<KeyFrame*> &vpKFs = *pKFs;
+    for(size_t i=0; i<vpKFs.size(); i++)
+        mpKFid[vpKFs[i]->mnId] = vpKFs[i];
+
+    {
+        boost::archive::binary_iarchive ia(ifs);
+        size_t nKFs;
+        ia >> nKFs;
+        KeyFrame discarded;
+        for(size_t i=0; i<nKFs; i++)
+        {
+            long unsigned int nId;
+            ia >> nId;
+            map<long unsigned int, KeyFrame*>::iterator it = mpKFid.find(nId);
+            if(it != mpKFid.end() && it->second->AreFeaturesReleased())
+                it->second->LoadFeatures(ia);
+            else
+                discarded.LoadFeatures(ia);
+        }
+    }
+    ifs.close();
+
+    std::remove(strFile.c_str());
+    return true;
+}
+
+// Sections of the chunked atlas file
+
+static string MapSection(Map* pMap, const char* strPart)
+{
+    return "map" + to_string(pMap->GetId()) + "/" + strPart;
+}
+
+enum eKeyFramePart
+{
+    KF_KEYPOINTS=0,
+    KF_DESCRIPTORS,
+    KF_BOW
+};
+
+template<class Archive>
+static void SerializeKeyFramePart(KeyFrame* pKF, Archive &ar, const int nPart)
+{
+    if(nPart == KF_KEYPOINTS)
+        pKF->SerializeKeyPoints(ar);
+    else if(nPart == KF_DESCRIPTORS)
+        pKF->SerializeDescriptors(ar);
+    else
+        pKF->SerializeBow(ar);
+}
+
+// Number of keyframes, then the id and the part of every keyframe
+static void WriteKeyFramePart(std::ostream &os, const vector<KeyFrame*> &vpKFs, const int nPart)
+{
+    boost::archive::binary_oarchive oa(os);
+    size_t nKFs = vpKFs.size();
+    oa << nKFs;
+    for(size_t i=0; i<vpKFs.size(); i++)
+    {
+        long unsigned int nId = vpKFs[i]->mnId;
+        oa << nId;
+        SerializeKeyFramePart(vpKFs[i], oa, nPart);
+    }
+}
+
+// Keyframes not in mpKFid (erased since the file was written) are read and dropped
+static void ReadKeyFramePart(std::istream &is, const map<long unsigned int, KeyFrame*> &mpKFid, const int nPart)
+{
+    boost::archive::binary_iarchive ia(is);
+    size_t nKFs;
+    ia >> nKFs;
+    KeyFrame discarded;
+    for(size_t i=0; i<nKFs; i++)
+    {
+        long unsigned int nId;
+        ia >> nId;
+        map<long unsigned int, KeyFrame*>::const_iterator it = mpKFid.find(nId);
+        SerializeKeyFramePart(it != mpKFid.end() ? it->second : &discarded, ia, nPart);
+    }
+}
+
+// Map point ids of every keyframe and keyframe ids of every map point
+static void WriteObservations(std::ostream &os, Map* pMap)
+{
+    boost::archive::binary_oarchive oa(os);
+    const vector<KeyFrame*> &vpKFs = pMap->GetBackupKeyFrames();
+    size_t nKFs = vpKFs.size();
+    oa << nKFs;
+    for(size_t i=0; i<nKFs; i++)
+    {
+        long unsigned int nId = vpKFs[i]->mnId;
+        oa << nId;
+        vpKFs[i]->SerializeObservations(oa);
+    }
+
+    const vector<MapPoint*> &vpMPs = pMap->GetBackupMapPoints();
+    size_t nMPs = vpMPs.size();
+    oa << nMPs;
+    for(size_t i=0; i<nMPs; i++)
+    {
+        long unsigned int nId = vpMPs[i]->mnId;
+        oa << nId;
+        vpMPs[i]->SerializeObservations(oa);
+    }
+}
+
+static void ReadObservations(std::istream &is, const map<long unsigned int, KeyFrame*> &mpKFid, const map<long unsigned int, MapPoint*> &mpMPid)
+{
+    boost::archive::binary_iarchive ia(is);
+    size_t nKFs;
+    ia >> nKFs;
+    KeyFrame discardedKF;
+    for(size_t i=0; i<nKFs; i++)
+    {
+        long unsigned int nId;
+        ia >> nId;
+        map<long unsigned int, KeyFrame*>::const_iterator it = mpKFid.find(nId);
+        (it != mpKFid.end() ? it->second : &discardedKF)->SerializeObservations(ia);
+    }
+
+    size_t nMPs;
+    ia >> nMPs;
+    MapPoint discardedMP;
+    for(size_t i=0; i<nMPs; i++)
+    {
+        long unsigned int nId;
+        ia >> nId;
+        map<long unsigned int, MapPoint*>::const_iterator it = mpMPid.find(nId);
+        (it != mpMPid.end() ? it->second : &discardedMP)->SerializeObservations(ia);
+    }
+}
+
+void Atlas::AddSections(AtlasArchive &archive)
+{
+    archive.AddSection("atlas", [this](std::ostream &os)
+    {
+        AtlasArchive::SkeletonScope skeleton;
+        boost::archive::binary_oarchive oa(os);
+        oa << *this;
+    });
+
+    for(size_t i=0; i<mvpBackupMaps.size(); i++)
+    {
+        Map* pMi = mvpBackupMaps[i];
+        archive.AddSection(MapSection(pMi, "mappoints"), [pMi](std::ostream &os)
+        {
+            AtlasArchive::SkeletonScope skeleton;
+            boost::archive::binary_oarchive oa(os);
+            pMi->SerializeMapPoints(oa);
+        });
+        archive.AddSection(MapSection(pMi, "observations"), [pMi](std::ostream &os)
+        {
+            WriteObservations(os, pMi);
+        });
+        archive.AddSection(MapSection(pMi, "bow"), [pMi](std::ostream &os)
+        {
+            WriteKeyFramePart(os, pMi->GetBackupKeyFrames(), KF_BOW);
+        });
+        archive.AddSection(MapSection(pMi, "keypoints"), [pMi](std::ostream &os)
+        {
+            WriteKeyFramePart(os, pMi->GetBackupKeyFrames(), KF_KEYPOINTS);
+        });
+        archive.AddSection(MapSection(pMi, "descriptors"), [pMi](std::ostream &os)
+        {
+            WriteKeyFramePart(os, pMi->GetBackupKeyFrames(), KF_DESCRIPTORS);
+        });
+    }
+}
+
+bool Atlas::ReadSections(AtlasArchive &archive, ThreadPool* pPool, const bool bLazy)
+{
+    typedef vector<pair<string, AtlasArchive::Decoder> > Decoders;
+
+    // Maps, cameras and keyframes
+    Decoders vDecoders;
+    vDecoders.push_back(make_pair(string("atlas"), AtlasArchive::Decoder([this](std::istream &is)
+    {
+        AtlasArchive::SkeletonScope skeleton;
+        boost::archive::binary_iarchive ia(is);
+        ia >> *this;
+    })));
+    if(!archive.Read(vDecoders, pPool))
+        return false;
+
+    const size_t nMaps = mvpBackupMaps.size();
+    vector<map<long unsigned int, KeyFrame*> > vmpKFid(nMaps);
+    for(size_t i=0; i<nMaps; i++)
+    {
+        const vector<KeyFrame*> &vpKFs = mvpBackupMaps[i]->GetBackupKeyFrames();
+        for(size_t j=0; j<vpKFs.size(); j++)
+            vmpKFid[i][vpKFs[j]->mnId] = vpKFs[j];
+    }
+
+    // Map points and keyframe features. Every section writes different objects or members
+    vDecoders.clear();
+    for(size_t i=0; i<nMaps; i++)
+    {
+        Map* pMi = mvpBackupMaps[i];
+        const map<long unsigned int, KeyFrame*>* pmpKFid = &vmpKFid[i];
+        vDecoders.push_back(make_pair(MapSection(pMi, "mappoints"), AtlasArchive::Decoder([pMi](std::istream &is)
+        {
+            AtlasArchive::SkeletonScope skeleton;
+            boost::archive::binary_iarchive ia(is);
+            pMi->SerializeMapPoints(ia);
+        })));
+        vDecoders.push_back(make_pair(MapSection(pMi, "bow"), AtlasArchive::Decoder([pmpKFid](std::istream &is)
+        {
+            ReadKeyFramePart(is, *pmpKFid, KF_BOW);
+        })));
+        if(bLazy)
+            continue;
+        vDecoders.push_back(make_pair(MapSection(pMi, "keypoints"), AtlasArchive::Decoder([pmpKFid](std::istream &is)
+        {
+            ReadKeyFramePart(is, *pmpKFid, KF_KEYPOINTS);
+        })));
+        vDecoders.push_back(make_pair(MapSection(pMi, "descriptors"), AtlasArchive::Decoder([pmpKFid](std::istream &is)
+        {
+            ReadKeyFramePart(is, *pmpKFid, KF_DESCRIPTORS);
+        })));
+    }
+    if(!archive.Read(vDecoders, pPool))
+        return false;
+
+    // Observations, once the map points exist
+    vector<map<long unsigned int, MapPoint*> > vmpMPid(nMaps);
+    vDecoders.clear();
+    for(size_t i=0; i<nMaps; i++)
+    {
+        Map* pMi = mvpBackupMaps[i];
+        const vector<MapPoint*> &vpMPs = pMi->GetBackupMapPoints();
+        for(size_t j=0; j<vpMPs.size(); j++)
+            vmpMPid[i][vpMPs[j]->mnId] = vpMPs[j];
+
+        const map<long unsigned int, KeyFrame*>* pmpKFid = &vmpKFid[i];
+        const map<long unsigned int, MapPoint*>* pmpMPid = &vmpMPid[i];
+        vDecoders.push_back(make_pair(MapSection(pMi, "observations"), AtlasArchive::Decoder([pmpKFid,pmpMPid](std::istream &is)
+        {
+            ReadObservations(is, *pmpKFid, *pmpMPid);
+        })));
+    }
+    if(!archive.Read(vDecoders, pPool))
+        return false;
+
+    if(bLazy)
+    {
+        unique_lock<mutex> lock(mMutexSpill);
+        mpArchivePool = pPool;
+        for(size_t i=0; i<nMaps; i++)
+        {
+            Map* pMi = mvpBackupMaps[i];
+            const vector<KeyFrame*> &vpKFs = pMi->GetBackupKeyFrames();
+            for(size_t j=0; j<vpKFs.size(); j++)
+                vpKFs[j]->ReleaseFeatures();
+            mspSpilledMaps.insert(pMi);
+            mmArchivedMaps[pMi] = archive.GetFileName();
+        }
+    }
+
+    return true;
+}
+
+bool Atlas::LoadArchivedMap(Map* pMap, const string &strFile)
+{
+    AtlasArchive archive;
+    if(!archive.Open(strFile))
+        return false;
+
+    // Keyframes may have been erased or moved to another map since the atlas was loaded
+    map<long unsigned int, KeyFrame*> mpKFid;
+    const Map::KeyFramesSnapshot pKFs = pMap->GetKeyFramesSnapshot();
+    const vector<KeyFrame*> &vpKFs = *pKFs;
+    for(size_t i=0; i<vpKFs.size(); i++)
+        if(vpKFs[i]->AreFeaturesReleased())
+            mpKFid[vpKFs[i]->mnId] = vpKFs[i];
+
+    const map<long unsigned int, KeyFrame*>* pmpKFid = &mpKFid;
+    vector<pair<string, AtlasArchive::Decoder> > vDecoders;
+    vDecoders.push_back(make_pair(MapSection(pMap, "keypoints"), AtlasArchive::Decoder([pmpKFid](std::istream &is)
+    {
+        ReadKeyFramePart(is, *pmpKFid, KF_KEYPOINTS);
+    })));
+    vDecoders.push_back(make_pair(MapSection(pMap, "descriptors"), AtlasArchive::Decoder([pmpKFid](std::istream &is)
+    {
+        ReadKeyFramePart(is, *pmpKFid, KF_DESCRIPTORS);
+    })));
+    if(!archive.Read(vDecoders, mpArchivePool))
+        return false;
+
+    for(map<long unsigned int, KeyFrame*>::iterator it=mpKFid.begin(); it!=mpKFid.end(); ++it)
+        it->second->SetFeaturesLoaded();
+
+    return true;
+}
+
 } //namespace ORB_SLAM3
@@ -0,0 +1,450 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "AtlasArchive.h"
+#include "ThreadPool.h"
+
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#ifdef ORB_SLAM3_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+using namespace std;
+
+namespace ORB_SLAM3
+{
+
+static const char ARCHIVE_MAGIC[8] = {'O','R','B','A','T','L','A','S'};
+static const uint32_t ARCHIVE_VERSION = 1;
+// Offset of the index offset in the header
+static const uint64_t ARCHIVE_INDEX_POS = sizeof(ARCHIVE_MAGIC)+sizeof(uint32_t);
+
+const size_t AtlasArchive::BLOCK_SIZE;
+
+static thread_local bool sbSkeleton = false;
+
+AtlasArchive::SkeletonScope::SkeletonScope() : mbPrevious(sbSkeleton)
+{
+    sbSkeleton = true;
+}
+
+AtlasArchive::SkeletonScope::~SkeletonScope()
+{
+    sbSkeleton = mbPrevious;
+}
+
+bool AtlasArchive::SkeletonScope::Active()
+{
+    return sbSkeleton;
+}
+
+// Read-only stream over a decompressed section, so it is not copied into a stringstream
+class MemoryBuffer : public std::streambuf
+{
+public:
+    MemoryBuffer(char* data, const size_t size)
+    {
+        setg(data, data, data+size);
+    }
+};
+
+template<typename T>
+static void WritePod(std::ostream &os, const T &value)
+{
+    os.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template<typename T>
+static bool ReadPod(std::istream &is, T &value)
+{
+    is.read(reinterpret_cast<char*>(&value), sizeof(T));
+    return is.good();
+}
+
+// Runs f(i) for i in [0,n) on the pool, or in the caller without one
+static void ForEach(ThreadPool* pPool, const int n, const std::function<void(int)> &f)
+{
+    if(pPool)
+        pPool->ParallelFor(0, n, f);
+    else
+        for(int i=0; i<n; i++)
+            f(i);
+}
+
+// First error reported by the parallel tasks (empty if none)
+static string FirstError(const vector<string> &vErrors)
+{
+    for(size_t i=0; i<vErrors.size(); i++)
+        if(!vErrors[i].empty())
+            return vErrors[i];
+    return string();
+}
+
+uint64_t AtlasArchive::SectionInfo::RawSize() const
+{
+    uint64_t nBytes = 0;
+    for(size_t i=0; i<vBlocks.size(); i++)
+        nBytes += vBlocks[i].rawSize;
+    return nBytes;
+}
+
+AtlasArchive::AtlasArchive()
+{
+}
+
+bool AtlasArchive::IsArchive(const string &filename)
+{
+    std::ifstream ifs(filename.c_str(), std::ios::binary);
+    char magic[sizeof(ARCHIVE_MAGIC)];
+    ifs.read(magic, sizeof(magic));
+    return ifs.good() && memcmp(magic, ARCHIVE_MAGIC, sizeof(magic)) == 0;
+}
+
+void AtlasArchive::AddSection(const string &strName, const Encoder &encoder)
+{
+    mvEncoders.push_back(make_pair(strName, encoder));
+}
+
+bool AtlasArchive::Write(const string &filename, ThreadPool* pPool)
+{
+    const int nSections = mvEncoders.size();
+
+    // Encode
+    vector<string> vData(nSections);
+    vector<string> vErrors(nSections);
+    ForEach(pPool, nSections, [&](int i)
+    {
+        try
+        {
+            std::ostringstream oss(std::ios::binary);
+            mvEncoders[i].second(oss);
+            vData[i] = oss.str();
+        }
+        catch(const std::exception &e)
+        {
+            vErrors[i] = "section " + mvEncoders[i].first + ": " + e.what();
+        }
+    });
+    string strError = FirstError(vErrors);
+    if(!strError.empty())
+    {
+        cerr << "ERROR: the atlas sections could not be encoded, " << strError << endl;
+        return false;
+    }
+
+    // Compress the blocks of all the sections. A block that does not get smaller is stored as is
+    // (the descriptors are close to random bits)
+    vector<pair<int, size_t> > vBlockStarts;
+    for(int i=0; i<nSections; i++)
+        for(size_t begin=0; begin<vData[i].size(); begin+=BLOCK_SIZE)
+            vBlockStarts.push_back(make_pair(i, begin));
+
+    const int nBlocks = vBlockStarts.size();
+    vector<string> vStored(nBlocks);
+    vector<uint64_t> vRawSize(nBlocks);
+    vector<uint8_t> vCodec(nBlocks, CODEC_NONE);
+    vErrors.assign(nBlocks, string());
+    ForEach(pPool, nBlocks, [&](int b)
+    {
+        const string &data = vData[vBlockStarts[b].first];
+        const size_t begin = vBlockStarts[b].second;
+        const size_t size = min(BLOCK_SIZE, data.size()-begin);
+        vRawSize[b] = size;
+#ifdef ORB_SLAM3_HAVE_ZLIB
+        uLongf nCompressed = compressBound(size);
+        vStored[b].resize(nCompressed);
+        if(compress2(reinterpret_cast<Bytef*>(&vStored[b][0]), &nCompressed,
+                     reinterpret_cast<const Bytef*>(data.data()+begin), size, Z_DEFAULT_COMPRESSION) == Z_OK
+           && nCompressed < size)
+        {
+            vStored[b].resize(nCompressed);
+            vCodec[b] = CODEC_ZLIB;
+            return;
+        }
+#endif
+        vStored[b].assign(data, begin, size);
+    });
+    vector<string>().swap(vData);
+
+    std::ofstream ofs(filename.c_str(), std::ios::binary);
+    if(!ofs.is_open())
+    {
+        cerr << "ERROR: cannot write the atlas file " << filename << endl;
+        return false;
+    }
+
+    ofs.write(ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC));
+    WritePod(ofs, ARCHIVE_VERSION);
+    WritePod(ofs, uint64_t(0));
+
+    mvSections.assign(nSections, SectionInfo());
+    for(int i=0; i<nSections; i++)
+        mvSections[i].name = mvEncoders[i].first;
+
+    uint64_t offset = ARCHIVE_INDEX_POS+sizeof(uint64_t);
+    for(int b=0; b<nBlocks; b++)
+    {
+        Block block;
+        block.offset = offset;
+        block.storedSize = vStored[b].size();
+        block.rawSize = vRawSize[b];
+        block.codec = vCodec[b];
+        mvSections[vBlockStarts[b].first].vBlocks.push_back(block);
+
+        ofs.write(vStored[b].data(), vStored[b].size());
+        offset += vStored[b].size();
+        string().swap(vStored[b]);
+    }
+
+    // Index
+    const uint64_t indexOffset = offset;
+    WritePod(ofs, uint32_t(nSections));
+    for(int i=0; i<nSections; i++)
+    {
+        const SectionInfo &section = mvSections[i];
+        WritePod(ofs, uint32_t(section.name.size()));
+        ofs.write(section.name.data(), section.name.size());
+        WritePod(ofs, uint32_t(section.vBlocks.size()));
+        for(size_t j=0; j<section.vBlocks.size(); j++)
+        {
+            WritePod(ofs, section.vBlocks[j].offset);
+            WritePod(ofs, section.vBlocks[j].storedSize);
+            WritePod(ofs, section.vBlocks[j].rawSize);
+            WritePod(ofs, section.vBlocks[j].codec);
+        }
+    }
+    ofs.seekp(ARCHIVE_INDEX_POS);
+    WritePod(ofs, indexOffset);
+
+    if(!ofs.good())
+    {
+        cerr << "ERROR: failed to write the atlas file " << filename << endl;
+        return false;
+    }
+
+    mStrFile = filename;
+    mvEncoders.clear();
+    return true;
+}
+
+bool AtlasArchive::Open(const string &filename)
+{
+    mvSections.clear();
+    mStrFile = filename;
+
+    std::ifstream ifs(filename.c_str(), std::ios::binary);
+    if(!ifs.is_open())
+    {
+        cerr << "ERROR: the atlas file " << filename << " does not exist" << endl;
+        return false;
+    }
+
+    char magic[sizeof(ARCHIVE_MAGIC)];
+    ifs.read(magic, sizeof(magic));
+    uint32_t nVersion = 0;
+    uint64_t indexOffset = 0;
+    if(!ifs.good() || memcmp(magic, ARCHIVE_MAGIC, sizeof(magic)) != 0 || !ReadPod(ifs, nVersion) || !ReadPod(ifs, indexOffset))
+    {
+        cerr << "ERROR: " << filename << " is not a chunked atlas file" << endl;
+        return false;
+    }
+    if(nVersion != ARCHIVE_VERSION)
+    {
+        cerr << "ERROR: " << filename << " has version " << nVersion << " of the chunked format, expected " << ARCHIVE_VERSION << endl;
+        return false;
+    }
+
+    ifs.seekg(0, std::ios::end);
+    const uint64_t fileSize = ifs.tellg();
+    ifs.seekg(indexOffset);
+
+    uint32_t nSections = 0;
+    bool bOk = indexOffset < fileSize && ReadPod(ifs, nSections);
+    for(uint32_t i=0; bOk && i<nSections; i++)
+    {
+        SectionInfo section;
+        uint32_t nNameLength = 0, nBlocks = 0;
+        bOk = ReadPod(ifs, nNameLength) && nNameLength <= 4096;
+        if(!bOk)
+            break;
+        section.name.resize(nNameLength);
+        ifs.read(&section.name[0], nNameLength);
+        bOk = ReadPod(ifs, nBlocks);
+        for(uint32_t j=0; bOk && j<nBlocks; j++)
+        {
+            Block block;
+            bOk = ReadPod(ifs, block.offset) && ReadPod(ifs, block.storedSize) && ReadPod(ifs, block.rawSize) && ReadPod(ifs, block.codec);
+            bOk = bOk && block.offset+block.storedSize <= indexOffset && block.rawSize <= BLOCK_SIZE;
+            section.vBlocks.push_back(block);
+        }
+        mvSections.push_back(section);
+    }
+
+    if(!bOk)
+    {
+        cerr << "ERROR: the index of the atlas file " << filename << " is corrupt" << endl;
+        mvSections.clear();
+        return false;
+    }
+
+    return true;
+}
+
+int AtlasArchive::FindSection(const string &strName) const
+{
+    for(size_t i=0; i<mvSections.size(); i++)
+        if(mvSections[i].name == strName)
+            return i;
+    return -1;
+}
+
+bool AtlasArchive::HasSection(const string &strName) const
+{
+    return FindSection(strName) >= 0;
+}
+
+vector<string> AtlasArchive::GetSectionNames() const
+{
+    vector<string> vNames;
+    for(size_t i=0; i<mvSections.size(); i++)
+        vNames.push_back(mvSections[i].name);
+    return vNames;
+}
+
+bool AtlasArchive::Read(const vector<pair<string, Decoder> > &vDecoders, ThreadPool* pPool)
+{
+    const int nSections = vDecoders.size();
+
+    vector<int> vIdx(nSections);
+    for(int k=0; k<nSections; k++)
+    {
+        vIdx[k] = FindSection(vDecoders[k].first);
+        if(vIdx[k] < 0)
+        {
+            cerr << "ERROR: the atlas file " << mStrFile << " has no section " << vDecoders[k].first << endl;
+            return false;
+        }
+    }
+
+    // Blocks of the requested sections and their position in the decompressed section
+    vector<string> vData(nSections);
+    vector<pair<int, int> > vBlocks;
+    vector<uint64_t> vRawOffset;
+    for(int k=0; k<nSections; k++)
+    {
+        const SectionInfo &section = mvSections[vIdx[k]];
+        vData[k].resize(section.RawSize());
+        uint64_t rawOffset = 0;
+        for(size_t j=0; j<section.vBlocks.size(); j++)
+        {
+            vBlocks.push_back(make_pair(k, (int)j));
+            vRawOffset.push_back(rawOffset);
+            rawOffset += section.vBlocks[j].rawSize;
+        }
+    }
+
+    // Every task reads its blocks with its own stream
+    const int nBlocks = vBlocks.size();
+    vector<string> vErrors(nBlocks);
+    ForEach(pPool, nBlocks, [&](int b)
+    {
+        const int k = vBlocks[b].first;
+        const Block &block = mvSections[vIdx[k]].vBlocks[vBlocks[b].second];
+        char* pDst = &vData[k][0] + vRawOffset[b];
+
+        std::ifstream ifs(mStrFile.c_str(), std::ios::binary);
+        ifs.seekg(block.offset);
+        if(block.codec == CODEC_NONE)
+        {
+            ifs.read(pDst, block.rawSize);
+            if(!ifs.good() || block.storedSize != block.rawSize)
+                vErrors[b] = "truncated block in section " + vDecoders[k].first;
+            return;
+        }
+
+        string stored(block.storedSize, '\0');
+        ifs.read(&stored[0], block.storedSize);
+        if(!ifs.good())
+        {
+            vErrors[b] = "truncated block in section " + vDecoders[k].first;
+            return;
+        }
+#ifdef ORB_SLAM3_HAVE_ZLIB
+        uLongf nRaw = block.rawSize;
+        if(block.codec != CODEC_ZLIB ||
+           uncompress(reinterpret_cast<Bytef*>(pDst), &nRaw, reinterpret_cast<const Bytef*>(stored.data()), stored.size()) != Z_OK ||
+           nRaw != block.rawSize)
+            vErrors[b] = "corrupt block in section " + vDecoders[k].first;
+#else
+        vErrors[b] = "section " + vDecoders[k].first + " is compressed and ORB-SLAM3 was built without zlib";
+#endif
+    });
+    string strError = FirstError(vErrors);
+    if(!strError.empty())
+    {
+        cerr << "ERROR: cannot read the atlas file " << mStrFile << ": " << strError << endl;
+        return false;
+    }
+
+    // Decode
+    vErrors.assign(nSections, string());
+    ForEach(pPool, nSections, [&](int k)
+    {
+        try
+        {
+            MemoryBuffer buffer(vData[k].empty() ? static_cast<char*>(NULL) : &vData[k][0], vData[k].size());
+            std::istream is(&buffer);
+            vDecoders[k].second(is);
+        }
+        catch(const std::exception &e)
+        {
+            vErrors[k] = "section " + vDecoders[k].first + ": " + e.what();
+        }
+        string().swap(vData[k]);
+    });
+    strError = FirstError(vErrors);
+    if(!strError.empty())
+    {
+        cerr << "ERROR: cannot read the atlas file " << mStrFile << ": " << strError << endl;
+        return false;
+    }
+
+    return true;
+}
+
+uint64_t AtlasArchive::GetRawBytes() const
+{
+    uint64_t nBytes = 0;
+    for(size_t i=0; i<mvSections.size(); i++)
+        nBytes += mvSections[i].RawSize();
+    return nBytes;
+}
+
+uint64_t AtlasArchive::GetStoredBytes() const
+{
+    uint64_t nBytes = 0;
+    for(size_t i=0; i<mvSections.size(); i++)
+        for(size_t j=0; j<mvSections[i].vBlocks.size(); j++)
+            nBytes += mvSections[i].vBlocks[j].storedSize;
+    return nBytes;
+}
+
+} //namespace ORB_SLAM3
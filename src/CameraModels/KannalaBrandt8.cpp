@@ -17,6 +17,7 @@
 */
 
 #include "KannalaBrandt8.h"
+#include "Triangulator.h"
 
 #include <boost/serialization/export.hpp>
 
@@ -51,23 +52,7 @@ namespace ORB_SLAM3 {
     }
 
     Eigen::Vector2d KannalaBrandt8::project(const Eigen::Vector3d &v3D) {
-        const double x2_plus_y2 = v3D[0] * v3D[0] + v3D[1] * v3D[1];
-        const double theta = atan2f(sqrtf(x2_plus_y2), v3D[2]);
-        const double psi = atan2f(v3D[1], v3D[0]);
-
-        const double theta2 = theta * theta;
-        const double theta3 = theta * theta2;
-        const double theta5 = theta3 * theta2;
-        const double theta7 = theta5 * theta2;
-        const double theta9 = theta7 * theta2;
-        const double r = theta + mvParameters[4] * theta3 + mvParameters[5] * theta5
-                        + mvParameters[6] * theta7 + mvParameters[7] * theta9;
-
-        Eigen::Vector2d res;
-        res[0] = mvParameters[0] * r * cos(psi) + mvParameters[2];
-        res[1] = mvParameters[1] * r * sin(psi) + mvParameters[3];
-
-        return res;
+        return Project(mvParameters.data(), v3D);
     }
 
     cv::Mat KannalaBrandt8::projectMat(const cv::Point3f &p3D) {
@@ -101,20 +86,16 @@ namespace ORB_SLAM3 {
         theta_d = fminf(fmaxf(-CV_PI / 2.f, theta_d), CV_PI / 2.f);
 
         if (theta_d > 1e-8) {
-            //Compensate distortion iteratively
-            float theta = theta_d;
-
-            for (int j = 0; j < 10; j++) {
-                float theta2 = theta * theta, theta4 = theta2 * theta2, theta6 = theta4 * theta2, theta8 =
-                        theta4 * theta4;
-                float k0_theta2 = mvParameters[4] * theta2, k1_theta4 = mvParameters[5] * theta4;
-                float k2_theta6 = mvParameters[6] * theta6, k3_theta8 = mvParameters[7] * theta8;
-                float theta_fix = (theta * (1 + k0_theta2 + k1_theta4 + k2_theta6 + k3_theta8) - theta_d) /
-                                  (1 + 3 * k0_theta2 + 5 * k1_theta4 + 7 * k2_theta6 + 9 * k3_theta8);
-                theta = theta - theta_fix;
-                if (fabsf(theta_fix) < precision)
-                    break;
+            float theta;
+            if (!mvThetaLUT.empty()) {
+                const float pos = theta_d * mfInvLUTStep;
+                const int idx = std::min(static_cast<int>(pos), static_cast<int>(mvThetaLUT.size()) - 2);
+                const float w = pos - idx;
+                theta = (1.f - w) * mvThetaLUT[idx] + w * mvThetaLUT[idx + 1];
             }
+            else
+                theta = SolveTheta(theta_d);
+
             //scale = theta - theta_d;
             scale = std::tan(theta) / theta_d;
         }
@@ -122,6 +103,36 @@ namespace ORB_SLAM3 {
         return cv::Point3f(pw.x * scale, pw.y * scale, 1.f);
     }
 
+    float KannalaBrandt8::SolveTheta(const float theta_d) {
+        //Compensate distortion iteratively
+        float theta = theta_d;
+
+        for (int j = 0; j < 10; j++) {
+            float theta2 = theta * theta, theta4 = theta2 * theta2, theta6 = theta4 * theta2, theta8 =
+                    theta4 * theta4;
+            float k0_theta2 = mvParameters[4] * theta2, k1_theta4 = mvParameters[5] * theta4;
+            float k2_theta6 = mvParameters[6] * theta6, k3_theta8 = mvParameters[7] * theta8;
+            float theta_fix = (theta * (1 + k0_theta2 + k1_theta4 + k2_theta6 + k3_theta8) - theta_d) /
+                              (1 + 3 * k0_theta2 + 5 * k1_theta4 + 7 * k2_theta6 + 9 * k3_theta8);
+            theta = theta - theta_fix;
+            if (fabsf(theta_fix) < precision)
+                break;
+        }
+
+        return theta;
+    }
+
+    void KannalaBrandt8::BuildUnprojectLUT(const int nSamples) {
+        const float step = (CV_PI / 2.f) / nSamples;
+
+        std::vector<float> vThetaLUT(nSamples + 1);
+        for (int i = 0; i <= nSamples; i++)
+            vThetaLUT[i] = SolveTheta(i * step);
+
+        mfInvLUTStep = 1.f / step;
+        mvThetaLUT.swap(vThetaLUT);
+    }
+
     cv::Mat KannalaBrandt8::projectJac(const cv::Point3f &p3D) {
         float x2 = p3D.x * p3D.x, y2 = p3D.y * p3D.y, z2 = p3D.z * p3D.z;
         float r2 = x2 + y2;
@@ -157,41 +168,29 @@ namespace ORB_SLAM3 {
     }
 
     Eigen::Matrix<double, 2, 3> KannalaBrandt8::projectJac(const Eigen::Vector3d &v3D) {
-        double x2 = v3D[0] * v3D[0], y2 = v3D[1] * v3D[1], z2 = v3D[2] * v3D[2];
-        double r2 = x2 + y2;
-        double r = sqrt(r2);
-        double r3 = r2 * r;
-        double theta = atan2(r, v3D[2]);
-
-        double theta2 = theta * theta, theta3 = theta2 * theta;
-        double theta4 = theta2 * theta2, theta5 = theta4 * theta;
-        double theta6 = theta2 * theta4, theta7 = theta6 * theta;
-        double theta8 = theta4 * theta4, theta9 = theta8 * theta;
-
-        double f = theta + theta3 * mvParameters[4] + theta5 * mvParameters[5] + theta7 * mvParameters[6] +
-                  theta9 * mvParameters[7];
-        double fd = 1 + 3 * mvParameters[4] * theta2 + 5 * mvParameters[5] * theta4 + 7 * mvParameters[6] * theta6 +
-                   9 * mvParameters[7] * theta8;
-
-        Eigen::Matrix<double, 2, 3> JacGood;
-        JacGood(0, 0) = mvParameters[0] * (fd * v3D[2] * x2 / (r2 * (r2 + z2)) + f * y2 / r3);
-        JacGood(1, 0) =
-                mvParameters[1] * (fd * v3D[2] * v3D[1] * v3D[0] / (r2 * (r2 + z2)) - f * v3D[1] * v3D[0] / r3);
-
-        JacGood(0, 1) =
-                mvParameters[0] * (fd * v3D[2] * v3D[1] * v3D[0] / (r2 * (r2 + z2)) - f * v3D[1] * v3D[0] / r3);
-        JacGood(1, 1) = mvParameters[1] * (fd * v3D[2] * y2 / (r2 * (r2 + z2)) + f * x2 / r3);
-
-        JacGood(0, 2) = -mvParameters[0] * fd * v3D[0] / (r2 + z2);
-        JacGood(1, 2) = -mvParameters[1] * fd * v3D[1] / (r2 + z2);
-
-        return JacGood;
+        return ProjectJac(mvParameters.data(), v3D);
     }
 
     cv::Mat KannalaBrandt8::unprojectJac(const cv::Point2f &p2D) {
         return cv::Mat();
     }
 
+    void KannalaBrandt8::projectMany(const float* pX, const float* pY, const float* pZ, const int N, float* pU, float* pV) {
+        for(int i=0; i<N; i++){
+            const cv::Point2f uv = KannalaBrandt8::project(cv::Point3f(pX[i],pY[i],pZ[i]));
+            pU[i] = uv.x;
+            pV[i] = uv.y;
+        }
+    }
+
+    void KannalaBrandt8::unprojectMany(const float* pU, const float* pV, const int N, float* pX, float* pY) {
+        for(int i=0; i<N; i++){
+            const cv::Point3f ray = KannalaBrandt8::unproject(cv::Point2f(pU[i],pV[i]));
+            pX[i] = ray.x;
+            pY[i] = ray.y;
+        }
+    }
+
     bool KannalaBrandt8::ReconstructWithTwoViews(const std::vector<cv::KeyPoint>& vKeys1, const std::vector<cv::KeyPoint>& vKeys2, const std::vector<int> &vMatches12,
                                           cv::Mat &R21, cv::Mat &t21, std::vector<cv::Point3f> &vP3D, std::vector<bool> &vbTriangulated){
         if(!tvr){
@@ -498,39 +497,14 @@ namespace ORB_SLAM3 {
 
     void KannalaBrandt8::Triangulate(const cv::Point2f &p1, const cv::Point2f &p2, const cv::Mat &Tcw1, const cv::Mat &Tcw2, cv::Mat &x3D)
     {
-        cv::Mat A(4,4,CV_32F);
-
-        A.row(0) = p1.x*Tcw1.row(2)-Tcw1.row(0);
-        A.row(1) = p1.y*Tcw1.row(2)-Tcw1.row(1);
-        A.row(2) = p2.x*Tcw2.row(2)-Tcw2.row(0);
-        A.row(3) = p2.y*Tcw2.row(2)-Tcw2.row(1);
-
-        cv::Mat u,w,vt;
-        cv::SVD::compute(A,w,u,vt,cv::SVD::MODIFY_A| cv::SVD::FULL_UV);
-        x3D = vt.row(3).t();
-        x3D = x3D.rowRange(0,3)/x3D.at<float>(3);
+        // A point at infinity is given as the origin, which is not in front of the cameras
+        if(!Triangulator::Triangulate(Tcw1,Tcw2,p1,p2,x3D))
+            x3D = cv::Mat::zeros(3,1,CV_32F);
     }
 
     void KannalaBrandt8::Triangulate_(const cv::Point2f &p1, const cv::Point2f &p2, const cv::Matx44f &Tcw1, const cv::Matx44f &Tcw2, cv::Matx31f &x3D)
     {
-        cv::Matx14f A0, A1, A2, A3;
-
-
-        A0 = p1.x * Tcw1.row(2) - Tcw1.row(0);
-        A1 = p1.y * Tcw1.row(2) - Tcw1.row(1);
-        A2 = p2.x * Tcw2.row(2) - Tcw2.row(0);
-        A3 = p2.y * Tcw2.row(2) - Tcw2.row(1);
-        cv::Matx44f A{A0(0), A0(1), A0(2), A0(3),
-                      A1(0), A1(1), A1(2), A1(3),
-                      A2(0), A2(1), A2(2), A2(3),
-                      A3(0), A3(1), A3(2), A3(3)};
-
-        // cv::Mat u,w,vt;
-        cv::Matx44f u, vt;
-        cv::Matx41f w;
-
-        cv::SVD::compute(A,w,u,vt,cv::SVD::MODIFY_A| cv::SVD::FULL_UV);
-        cv::Matx41f x3D_h = vt.row(3).t();
-        x3D = x3D_h.get_minor<3,1>(0,0) / x3D_h(3);
+        if(!Triangulator::Triangulate(Tcw1,Tcw2,p1,p2,x3D))
+            x3D = cv::Matx31f::zeros();
     }
 }
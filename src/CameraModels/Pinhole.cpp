@@ -22,7 +22,7 @@
 
 namespace ORB_SLAM3 {
 
-    long unsigned int GeometricCamera::nNextId=0;
+    std::atomic<long unsigned int> GeometricCamera::nNextId(0);
 
     cv::Point2f Pinhole::project(const cv::Point3f &p3D) {
         return cv::Point2f(mvParameters[0] * p3D.x / p3D.z + mvParameters[2],
@@ -40,11 +40,7 @@ namespace ORB_SLAM3 {
     }
 
     Eigen::Vector2d Pinhole::project(const Eigen::Vector3d &v3D) {
-        Eigen::Vector2d res;
-        res[0] = mvParameters[0] * v3D[0] / v3D[2] + mvParameters[2];
-        res[1] = mvParameters[1] * v3D[1] / v3D[2] + mvParameters[3];
-
-        return res;
+        return Project(mvParameters.data(), v3D);
     }
 
     cv::Mat Pinhole::projectMat(const cv::Point3f &p3D) {
@@ -86,15 +82,7 @@ namespace ORB_SLAM3 {
     }
 
     Eigen::Matrix<double, 2, 3> Pinhole::projectJac(const Eigen::Vector3d &v3D) {
-        Eigen::Matrix<double, 2, 3> Jac;
-        Jac(0, 0) = mvParameters[0] / v3D[2];
-        Jac(0, 1) = 0.f;
-        Jac(0, 2) = -mvParameters[0] * v3D[0] / (v3D[2] * v3D[2]);
-        Jac(1, 0) = 0.f;
-        Jac(1, 1) = mvParameters[1] / v3D[2];
-        Jac(1, 2) = -mvParameters[1] * v3D[1] / (v3D[2] * v3D[2]);
-
-        return Jac;
+        return ProjectJac(mvParameters.data(), v3D);
     }
 
     cv::Mat Pinhole::unprojectJac(const cv::Point2f &p2D) {
@@ -109,6 +97,24 @@ namespace ORB_SLAM3 {
         return Jac;
     }
 
+    void Pinhole::projectMany(const float* pX, const float* pY, const float* pZ, const int N, float* pU, float* pV) {
+        const float fx = mvParameters[0], fy = mvParameters[1], cx = mvParameters[2], cy = mvParameters[3];
+        for(int i=0; i<N; i++){
+            const float invz = 1.f / pZ[i];
+            pU[i] = fx * pX[i] * invz + cx;
+            pV[i] = fy * pY[i] * invz + cy;
+        }
+    }
+
+    void Pinhole::unprojectMany(const float* pU, const float* pV, const int N, float* pX, float* pY) {
+        const float invfx = 1.f / mvParameters[0], invfy = 1.f / mvParameters[1];
+        const float cx = mvParameters[2], cy = mvParameters[3];
+        for(int i=0; i<N; i++){
+            pX[i] = (pU[i] - cx) * invfx;
+            pY[i] = (pV[i] - cy) * invfy;
+        }
+    }
+
     bool Pinhole::ReconstructWithTwoViews(const std::vector<cv::KeyPoint>& vKeys1, const std::vector<cv::KeyPoint>& vKeys2, const std::vector<int> &vMatches12,
                                  cv::Mat &R21, cv::Mat &t21, std::vector<cv::Point3f> &vP3D, std::vector<bool> &vbTriangulated){
         if(!tvr){
@@ -0,0 +1,188 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "CameraRig.h"
+#include "ORBextractor.h"
+#include "ThreadPool.h"
+#include "CameraModels/Pinhole.h"
+#include "CameraModels/KannalaBrandt8.h"
+
+#include <iostream>
+#include <opencv2/imgproc/imgproc.hpp>
+
+using namespace std;
+
+namespace ORB_SLAM3
+{
+
+// Real number of the settings, false if missing
+static bool ReadReal(cv::FileStorage &fSettings, const string &name, float &value)
+{
+    cv::FileNode node = fSettings[name];
+    if(node.empty() || !node.isReal())
+        return false;
+    value = node.real();
+    return true;
+}
+
+CameraRig* CameraRig::FromSettings(cv::FileStorage &fSettings)
+{
+    cv::FileNode node = fSettings["Rig.nCameras"];
+    if(node.empty() || !node.isInt() || node.operator int()<=0)
+        return static_cast<CameraRig*>(NULL);
+    const int nCameras = node.operator int();
+
+    const int nFeatures = fSettings["ORBextractor.nFeatures"];
+    const float fScaleFactor = fSettings["ORBextractor.scaleFactor"];
+    const int nLevels = fSettings["ORBextractor.nLevels"];
+    const int fIniThFAST = fSettings["ORBextractor.iniThFAST"];
+    const int fMinThFAST = fSettings["ORBextractor.minThFAST"];
+
+    CameraRig* pRig = new CameraRig();
+    for(int i=0; i<nCameras; i++)
+    {
+        const string prefix = "Rig.Camera" + to_string(i) + ".";
+
+        RigCamera cam;
+        cam.pCamera = static_cast<GeometricCamera*>(NULL);
+        cam.pExtractor = static_cast<FeatureExtractor*>(NULL);
+
+        vector<float> vCalib(4);
+        bool bOK = ReadReal(fSettings,prefix+"fx",vCalib[0]) && ReadReal(fSettings,prefix+"fy",vCalib[1]) &&
+                   ReadReal(fSettings,prefix+"cx",vCalib[2]) && ReadReal(fSettings,prefix+"cy",vCalib[3]);
+
+        const string type = fSettings[prefix+"type"];
+        if(bOK && type=="KannalaBrandt8")
+        {
+            vCalib.resize(8);
+            bOK = ReadReal(fSettings,prefix+"k1",vCalib[4]) && ReadReal(fSettings,prefix+"k2",vCalib[5]) &&
+                  ReadReal(fSettings,prefix+"k3",vCalib[6]) && ReadReal(fSettings,prefix+"k4",vCalib[7]);
+            if(bOK)
+                cam.pCamera = new KannalaBrandt8(vCalib);
+        }
+        else if(bOK && type=="PinHole")
+        {
+            float k[5] = {0.f, 0.f, 0.f, 0.f, 0.f};
+            bOK = ReadReal(fSettings,prefix+"k1",k[0]) && ReadReal(fSettings,prefix+"k2",k[1]) &&
+                  ReadReal(fSettings,prefix+"p1",k[2]) && ReadReal(fSettings,prefix+"p2",k[3]);
+            const bool bK3 = ReadReal(fSettings,prefix+"k3",k[4]) && k[4]!=0.f;
+            if(bOK)
+            {
+                cam.pCamera = new Pinhole(vCalib);
+                cam.distCoef = cv::Mat(bK3 ? 5 : 4,1,CV_32F,k).clone();
+            }
+        }
+        else
+            bOK = false;
+
+        cv::Mat Tcb;
+        fSettings[prefix+"Tc0"] >> Tcb;
+        if(bOK && (Tcb.rows<3 || Tcb.cols!=4))
+            bOK = false;
+
+        if(!bOK)
+        {
+            cerr << "*" << prefix << " is missing or incomplete, the camera rig is not used*" << endl;
+            delete cam.pCamera;
+            delete pRig;
+            return static_cast<CameraRig*>(NULL);
+        }
+
+        Tcb.convertTo(Tcb,CV_32F);
+        cam.Tcb = cv::Matx44f::eye();
+        for(int r=0; r<3; r++)
+            for(int c=0; c<4; c++)
+                cam.Tcb(r,c) = Tcb.at<float>(r,c);
+
+        cam.pExtractor = new ORBextractor(nFeatures,fScaleFactor,nLevels,fIniThFAST,fMinThFAST);
+        pRig->mvCameras.push_back(cam);
+    }
+
+    cout << endl << "Camera rig: " << nCameras << " additional cameras" << endl;
+    return pRig;
+}
+
+CameraRig::~CameraRig()
+{
+    for(size_t i=0; i<mvExtractions.size(); i++)
+        if(mvExtractions[i].valid())
+            mvExtractions[i].wait();
+
+    for(size_t i=0; i<mvCameras.size(); i++)
+    {
+        delete mvCameras[i].pCamera;
+        delete mvCameras[i].pExtractor;
+    }
+}
+
+void CameraRig::Extract(const int i, const cv::Mat &im, const bool bRGB)
+{
+    cv::Mat imGray = im;
+    if(im.channels()==3)
+        cv::cvtColor(im,imGray,bRGB ? cv::COLOR_RGB2GRAY : cv::COLOR_BGR2GRAY);
+    else if(im.channels()==4)
+        cv::cvtColor(im,imGray,bRGB ? cv::COLOR_RGBA2GRAY : cv::COLOR_BGRA2GRAY);
+
+    RigCamera &cam = mvCameras[i];
+    vector<cv::KeyPoint> vKeys;
+    cv::Mat descriptors;
+    vector<int> vLapping = {0,0};
+    (*cam.pExtractor)(imGray,cv::Mat(),vKeys,descriptors,vLapping);
+
+    RigView &view = mvViews[i];
+    view.nCamera = i;
+    view.pCamera = cam.pCamera;
+    view.Rcb = cam.Tcb.get_minor<3,3>(0,0);
+    view.tcb = cam.Tcb.get_minor<3,1>(0,3);
+    view.Build(vKeys,descriptors,cam.distCoef,imGray.size());
+}
+
+void CameraRig::ExtractAsync(const vector<cv::Mat> &vIms, const bool bRGB, ThreadPool* pThreadPool)
+{
+    CV_Assert(vIms.size()==mvCameras.size());
+
+    // The extractors and views are reused, the previous frame must have been collected
+    CV_Assert(mvExtractions.empty());
+
+    const int nCameras = mvCameras.size();
+    mvViews.assign(nCameras,RigView());
+    if(!pThreadPool || pThreadPool->GetNumThreads()==0)
+    {
+        for(int i=0; i<nCameras; i++)
+            Extract(i,vIms[i],bRGB);
+        return;
+    }
+
+    mvExtractions.reserve(nCameras);
+    for(int i=0; i<nCameras; i++)
+    {
+        const cv::Mat im = vIms[i];
+        mvExtractions.push_back(pThreadPool->Submit([this,i,im,bRGB]{ Extract(i,im,bRGB); }));
+    }
+}
+
+void CameraRig::CollectFeatures(Frame &F)
+{
+    for(size_t i=0; i<mvExtractions.size(); i++)
+        mvExtractions[i].get();
+    mvExtractions.clear();
+
+    F.mvRigViews.swap(mvViews);
+    mvViews.clear();
+}
+
+} //namespace ORB_SLAM
@@ -43,6 +43,18 @@ g2o::SE3Quat Converter::toSE3Quat(const cv::Mat &cvT)
     return g2o::SE3Quat(R,t);
 }
 
+g2o::SE3Quat Converter::toSE3Quat(const cv::Matx44f &cvT)
+{
+    Eigen::Matrix<double,3,3> R;
+    R << cvT(0,0), cvT(0,1), cvT(0,2),
+         cvT(1,0), cvT(1,1), cvT(1,2),
+         cvT(2,0), cvT(2,1), cvT(2,2);
+
+    Eigen::Matrix<double,3,1> t(cvT(0,3), cvT(1,3), cvT(2,3));
+
+    return g2o::SE3Quat(R,t);
+}
+
 cv::Mat Converter::toCvMat(const g2o::SE3Quat &SE3)
 {
     Eigen::Matrix<double,4,4> eigMat = SE3.to_homogeneous_matrix();
@@ -96,6 +108,20 @@ cv::Mat Converter::toCvMat(const Eigen::Matrix<double,3,1> &m)
     return cvMat.clone();
 }
 
+cv::Matx44f Converter::toMatx44f(const g2o::SE3Quat &SE3)
+{
+    const Eigen::Matrix<double,4,4> m = SE3.to_homogeneous_matrix();
+    return cv::Matx44f(m(0,0),m(0,1),m(0,2),m(0,3),
+                       m(1,0),m(1,1),m(1,2),m(1,3),
+                       m(2,0),m(2,1),m(2,2),m(2,3),
+                       m(3,0),m(3,1),m(3,2),m(3,3));
+}
+
+cv::Matx31f Converter::toMatx31f(const Eigen::Matrix<double,3,1> &m)
+{
+    return cv::Matx31f(m(0),m(1),m(2));
+}
+
 cv::Mat Converter::toCvSE3(const Eigen::Matrix<double,3,3> &R, const Eigen::Matrix<double,3,1> &t)
 {
     cv::Mat cvMat = cv::Mat::eye(4,4,CV_32F);
@@ -141,6 +167,25 @@ Eigen::Matrix<double,3,3> Converter::toMatrix3d(const cv::Mat &cvMat3)
     return M;
 }
 
+Eigen::Matrix<double,3,1> Converter::toVector3d(const cv::Matx31f &cvVector)
+{
+    Eigen::Matrix<double,3,1> v;
+    v << cvVector(0), cvVector(1), cvVector(2);
+
+    return v;
+}
+
+Eigen::Matrix<double,3,3> Converter::toMatrix3d(const cv::Matx33f &cvMat3)
+{
+    Eigen::Matrix<double,3,3> M;
+
+    M << cvMat3(0,0), cvMat3(0,1), cvMat3(0,2),
+         cvMat3(1,0), cvMat3(1,1), cvMat3(1,2),
+         cvMat3(2,0), cvMat3(2,1), cvMat3(2,2);
+
+    return M;
+}
+
 Eigen::Matrix<double,4,4> Converter::toMatrix4d(const cv::Mat &cvMat4)
 {
     Eigen::Matrix<double,4,4> M;
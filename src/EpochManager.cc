@@ -0,0 +1,95 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "EpochManager.h"
+
+namespace ORB_SLAM3
+{
+
+std::mutex EpochManager::mMutex;
+const int EpochManager::DEFAULT_GRACE_PERIOD;
+uint64_t EpochManager::mnEpoch = 0;
+std::map<std::thread::id, uint64_t> EpochManager::mmThreadEpochs;
+std::deque<EpochManager::Retired> EpochManager::mqRetired;
+
+void EpochManager::RegisterThread()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    mmThreadEpochs[std::this_thread::get_id()] = mnEpoch;
+}
+
+void EpochManager::UnregisterThread()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    mmThreadEpochs.erase(std::this_thread::get_id());
+    TryAdvance();
+}
+
+void EpochManager::Quiescent(bool bReclaim)
+{
+    std::vector<Retired> vReady;
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mmThreadEpochs[std::this_thread::get_id()] = mnEpoch;
+        TryAdvance();
+
+        if(!bReclaim)
+            return;
+
+        // Entities are retired in epoch order. One with a shorter grace period than the entities
+        // before it waits for them, which only delays its reclamation
+        while(!mqRetired.empty() && mqRetired.front().nReclaimEpoch<=mnEpoch)
+        {
+            vReady.push_back(mqRetired.front());
+            mqRetired.pop_front();
+        }
+    }
+
+    // Destructors may take entity mutexes, they run without the manager lock
+    for(size_t i=0; i<vReady.size(); i++)
+        vReady[i].reclaim(vReady[i].p);
+}
+
+void EpochManager::Retire(void *p, void (*reclaim)(void *), int nGracePeriod)
+{
+    if(!p)
+        return;
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    Retired r;
+    r.p = p;
+    r.reclaim = reclaim;
+    r.nReclaimEpoch = mnEpoch+2+(nGracePeriod<0 ? 0 : nGracePeriod);
+    mqRetired.push_back(r);
+}
+
+size_t EpochManager::Pending()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    return mqRetired.size();
+}
+
+void EpochManager::TryAdvance()
+{
+    for(std::map<std::thread::id, uint64_t>::const_iterator it=mmThreadEpochs.begin(); it!=mmThreadEpochs.end(); ++it)
+        if(it->second!=mnEpoch)
+            return;
+    mnEpoch++;
+}
+
+} //namespace ORB_SLAM
@@ -0,0 +1,217 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "FastDetector.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+namespace ORB_SLAM3
+{
+
+// Circle of radius 3 in the order of cv::FAST (x,y)
+static const int CIRCLE[16][2] = {{0,3}, {1,3}, {2,2}, {3,1}, {3,0}, {3,-1}, {2,-2}, {1,-3},
+                                  {0,-3}, {-1,-3}, {-2,-2}, {-3,-1}, {-3,0}, {-3,1}, {-2,2}, {-1,3}};
+
+// Nine contiguous bits (circularly) in a 16 bit mask
+static inline bool HasArc(const unsigned int mask)
+{
+    const unsigned int m = mask | (mask<<16);
+    unsigned int r = m;
+    for(int i=1; i<9; i++)
+        r &= m>>i;
+    return r!=0;
+}
+
+int FastDetector::Score(const unsigned char* p, const int* pOffsets, const int threshold)
+{
+    const int v = p[0];
+    unsigned int bright = 0, dark = 0;
+    int d[25];
+    for(int k=0; k<16; k++)
+    {
+        const int c = p[pOffsets[k]];
+        if(c>v+threshold)
+            bright |= 1u<<k;
+        else if(c<v-threshold)
+            dark |= 1u<<k;
+        d[k] = v-c;
+    }
+
+    if(!HasArc(bright) && !HasArc(dark))
+        return -1;
+
+    for(int k=16; k<25; k++)
+        d[k] = d[k-16];
+
+    // Largest minimum absolute difference over the arcs of 9 pixels, minus one (cornerScore<16>)
+    int a0 = threshold, b0 = threshold;
+    for(int k=0; k<16; k++)
+    {
+        int a = d[k], b = -d[k];
+        for(int i=1; i<9; i++)
+        {
+            a = std::min(a,d[k+i]);
+            b = std::min(b,-d[k+i]);
+        }
+        a0 = std::max(a0,a);
+        b0 = std::max(b0,b);
+    }
+
+    return std::max(a0,b0)-1;
+}
+
+void FastDetector::ScoreRow(const unsigned char* pRow, const int* pOffsets, const int x0, const int x1,
+                            const int threshold, unsigned char* pScores, std::vector<int> &vColumns)
+{
+    int x = x0;
+
+#if defined(__SSE2__) || defined(__ARM_NEON) || defined(__ARM_NEON__)
+    // A corner has at least two of the compass pixels (0,4,8,12) on the same side of the arc
+    const int th = std::min(threshold,255);
+#if defined(__SSE2__)
+    const __m128i vTh = _mm_set1_epi8(static_cast<char>(th));
+    const __m128i vZero = _mm_setzero_si128();
+    const __m128i vThree = _mm_set1_epi8(3);
+#else
+    const uint8x16_t vTh = vdupq_n_u8(static_cast<uint8_t>(th));
+    const uint8x16_t vTwo = vdupq_n_u8(2);
+#endif
+    for(; x+16<=x1; x+=16)
+    {
+        const unsigned char* p = pRow+x;
+        int mask;
+#if defined(__SSE2__)
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        const __m128i vHi = _mm_adds_epu8(v,vTh);
+        const __m128i vLo = _mm_subs_epu8(v,vTh);
+        // Number of compass pixels that are not brighter (darker), one per 0xFF mask
+        __m128i nNotBright = vZero, nNotDark = vZero;
+        for(int k=0; k<16; k+=4)
+        {
+            const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p+pOffsets[k]));
+            nNotBright = _mm_sub_epi8(nNotBright,_mm_cmpeq_epi8(_mm_subs_epu8(c,vHi),vZero));
+            nNotDark = _mm_sub_epi8(nNotDark,_mm_cmpeq_epi8(_mm_subs_epu8(vLo,c),vZero));
+        }
+        mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmplt_epi8(nNotBright,vThree),_mm_cmplt_epi8(nNotDark,vThree)));
+#else
+        const uint8x16_t v = vld1q_u8(p);
+        const uint8x16_t vHi = vqaddq_u8(v,vTh);
+        const uint8x16_t vLo = vqsubq_u8(v,vTh);
+        uint8x16_t nBright = vdupq_n_u8(0), nDark = vdupq_n_u8(0);
+        for(int k=0; k<16; k+=4)
+        {
+            const uint8x16_t c = vld1q_u8(p+pOffsets[k]);
+            nBright = vsubq_u8(nBright,vcgtq_u8(c,vHi));
+            nDark = vsubq_u8(nDark,vcltq_u8(c,vLo));
+        }
+        const uint8x16_t vCand = vorrq_u8(vcgeq_u8(nBright,vTwo),vcgeq_u8(nDark,vTwo));
+        unsigned char cand[16];
+        vst1q_u8(cand,vCand);
+        mask = 0;
+        for(int i=0; i<16; i++)
+            mask |= (cand[i]&1)<<i;
+#endif
+        while(mask)
+        {
+            const int i = __builtin_ctz(mask);
+            mask &= mask-1;
+            const int score = Score(p+i,pOffsets,threshold);
+            if(score>=0)
+            {
+                pScores[x+i-x0] = static_cast<unsigned char>(std::min(score,255));
+                vColumns.push_back(x+i);
+            }
+        }
+    }
+#endif
+
+    for(; x<x1; x++)
+    {
+        const int score = Score(pRow+x,pOffsets,threshold);
+        if(score>=0)
+        {
+            pScores[x-x0] = static_cast<unsigned char>(std::min(score,255));
+            vColumns.push_back(x);
+        }
+    }
+}
+
+void FastDetector::Detect(const unsigned char* pImage, const size_t step, const int x0, const int y0,
+                          const int x1, const int y1, const int threshold, std::vector<FastCorner> &vCorners)
+{
+    vCorners.clear();
+    const int w = x1-x0;
+    if(w<=0 || y1<=y0)
+        return;
+
+    int offsets[16];
+    for(int k=0; k<16; k++)
+        offsets[k] = CIRCLE[k][1]*static_cast<int>(step) + CIRCLE[k][0];
+
+    // Scores of the last three rows with a zero column at each side, non corners are 0
+    std::vector<unsigned char> vBuffer(3*(w+2),0);
+    unsigned char* pPrev2 = &vBuffer[0];
+    unsigned char* pPrev = pPrev2+(w+2);
+    unsigned char* pCur = pPrev+(w+2);
+
+    std::vector<int> vPrevColumns, vCurColumns;
+    vPrevColumns.reserve(w);
+    vCurColumns.reserve(w);
+
+    // One extra row to suppress the last one
+    for(int y=y0; y<=y1; y++)
+    {
+        unsigned char* pOldest = pPrev2;
+        pPrev2 = pPrev;
+        pPrev = pCur;
+        pCur = pOldest;
+        std::swap(vPrevColumns,vCurColumns);
+        memset(pCur,0,w+2);
+        vCurColumns.clear();
+
+        if(y<y1)
+            ScoreRow(pImage+y*step,offsets,x0,x1,threshold,pCur+1,vCurColumns);
+
+        // Non maximum suppression of the previous row
+        for(size_t i=0; i<vPrevColumns.size(); i++)
+        {
+            const int x = vPrevColumns[i];
+            const int j = x-x0+1;
+            const int s = pPrev[j];
+            if(s>pPrev[j-1] && s>pPrev[j+1] &&
+               s>pPrev2[j-1] && s>pPrev2[j] && s>pPrev2[j+1] &&
+               s>pCur[j-1] && s>pCur[j] && s>pCur[j+1])
+            {
+                FastCorner corner;
+                corner.x = x;
+                corner.y = y-1;
+                corner.score = s;
+                vCorners.push_back(corner);
+            }
+        }
+    }
+}
+
+} //namespace ORB_SLAM3
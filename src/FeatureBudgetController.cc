@@ -0,0 +1,129 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "FeatureBudgetController.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <thread>
+
+namespace ORB_SLAM3
+{
+
+// Weight of the last frame in the averaged frame time
+static const double TIME_SMOOTHING = 0.3;
+// Frames to wait after a change, so that the average reflects it
+static const int FEATURES_HOLD = 5;
+static const int LEVELS_HOLD = 15;
+// Largest change of the features per step, and spare time needed to grow
+static const double MAX_SHRINK = 0.8;
+static const double MAX_GROW = 1.1;
+static const double GROW_MARGIN = 1.15;
+// Below these inliers the features grow faster (and without GROW_MARGIN)
+static const int MIN_INLIERS = 100;
+static const double WEAK_GROW = 1.2;
+// Load per core at which nothing grows
+static const double SATURATED_LOAD = 0.9;
+
+FeatureBudgetController::FeatureBudgetController(const float fBudget, const int nFeatures, const int nMinFeatures, const int nMaxFeatures,
+                                                 const int nLevels, const int nMinLevels):
+    mfBudget(fBudget), mnMinFeatures(std::max(nMinFeatures,1)), mnMaxFeatures(std::max(nMaxFeatures,mnMinFeatures)),
+    mnMinLevels(std::min(std::max(nMinLevels,1),nLevels)), mnMaxLevels(nLevels), mFrameTime(0.0), mbMeasured(false), mnHold(0),
+    mCpuLoad(0.0), mTimeLoad(Clock::now()-std::chrono::seconds(1)), mnCores(std::max(1u,std::thread::hardware_concurrency())),
+    mnFeatures(std::min(std::max(nFeatures,mnMinFeatures),mnMaxFeatures)), mnLevels(nLevels)
+{
+}
+
+double FeatureBudgetController::CpuLoad()
+{
+    const Clock::time_point now = Clock::now();
+    if(now-mTimeLoad>=std::chrono::seconds(1))
+    {
+        double load;
+        if(getloadavg(&load,1)==1)
+            mCpuLoad = load/mnCores;
+        mTimeLoad = now;
+    }
+    return mCpuLoad;
+}
+
+void FeatureBudgetController::Update(const double frameMs, const int nInliers)
+{
+    if(!mbMeasured)
+    {
+        mFrameTime = frameMs;
+        mbMeasured = true;
+    }
+    else
+        mFrameTime = (1.0-TIME_SMOOTHING)*mFrameTime + TIME_SMOOTHING*frameMs;
+
+    if(mnHold>0)
+    {
+        mnHold--;
+        return;
+    }
+
+    int nFeatures = mnFeatures.load(std::memory_order_relaxed);
+    int nLevels = mnLevels.load(std::memory_order_relaxed);
+    const double headroom = mfBudget/std::max(mFrameTime,1e-3);
+
+    if(headroom<1.0)
+    {
+        // Late: fewer features, and fewer levels once at the minimum
+        const int n = static_cast<int>(nFeatures*std::max(MAX_SHRINK,headroom));
+        if(n>=mnMinFeatures)
+        {
+            nFeatures = n;
+            mnHold = FEATURES_HOLD;
+        }
+        else if(nFeatures>mnMinFeatures)
+        {
+            nFeatures = mnMinFeatures;
+            mnHold = FEATURES_HOLD;
+        }
+        else if(nLevels>mnMinLevels)
+        {
+            nLevels--;
+            mnHold = LEVELS_HOLD;
+        }
+    }
+    else
+    {
+        const bool bWeak = nInliers<MIN_INLIERS;
+        if((headroom>=GROW_MARGIN || bWeak) && CpuLoad()<SATURATED_LOAD)
+        {
+            if(nLevels<mnMaxLevels)
+            {
+                nLevels++;
+                mnHold = LEVELS_HOLD;
+            }
+            else if(nFeatures<mnMaxFeatures)
+            {
+                const double growth = bWeak ? WEAK_GROW : std::min(MAX_GROW,headroom);
+                nFeatures = std::min(mnMaxFeatures,static_cast<int>(std::ceil(nFeatures*growth)));
+                mnHold = FEATURES_HOLD;
+            }
+        }
+    }
+
+    mnFeatures.store(nFeatures, std::memory_order_relaxed);
+    mnLevels.store(nLevels, std::memory_order_relaxed);
+}
+
+} //namespace ORB_SLAM
@@ -0,0 +1,152 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "FlatBowVector.h"
+
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+namespace ORB_SLAM3
+{
+
+void FlatBowVector::Build(const DBoW2::BowVector &bowVec)
+{
+    Clear();
+    mvWordIds.reserve(bowVec.size());
+    mvWeights.reserve(bowVec.size());
+    for(DBoW2::BowVector::const_iterator it=bowVec.begin(), end=bowVec.end(); it!=end; it++)
+    {
+        mvWordIds.push_back(it->first);
+        mvWeights.push_back(it->second);
+    }
+}
+
+void FlatBowVector::Clear()
+{
+    mvWordIds.clear();
+    mvWeights.clear();
+}
+
+float FlatBowVector::L1Score(const FlatBowVector &v1, const FlatBowVector &v2, int &nCommonWords)
+{
+    const DBoW2::WordId* id1 = v1.mvWordIds.data();
+    const DBoW2::WordId* id2 = v2.mvWordIds.data();
+    const float* w1 = v1.mvWeights.data();
+    const float* w2 = v2.mvWeights.data();
+    const size_t N1 = v1.mvWordIds.size(), N2 = v2.mvWordIds.size();
+
+    size_t i = 0, j = 0;
+    float score = 0.f;
+    nCommonWords = 0;
+
+#if defined(__SSE2__) || defined(__ARM_NEON) || defined(__ARM_NEON__)
+    //^ 4개 단어 블록끼리 비교: 한 블록을 회전시키며 4x4 쌍을 모두 비교하고, 최댓값이 작은 블록을 전진
+    // Words are unique in a vector, so every common word matches in exactly one of the 4 rotations
+    if(N1>=4 && N2>=4)
+    {
+#if defined(__SSE2__)
+        __m128 acc = _mm_setzero_ps();
+        while(i+4<=N1 && j+4<=N2)
+        {
+            const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(id1+i));
+            const __m128 wa = _mm_loadu_ps(w1+i);
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(id2+j));
+            __m128 wb = _mm_loadu_ps(w2+j);
+            for(int r=0; r<4; r++)
+            {
+                const __m128 eq = _mm_castsi128_ps(_mm_cmpeq_epi32(a,b));
+                acc = _mm_add_ps(acc, _mm_and_ps(eq, _mm_min_ps(wa,wb)));
+                nCommonWords += __builtin_popcount(_mm_movemask_ps(eq));
+                b = _mm_shuffle_epi32(b, _MM_SHUFFLE(0,3,2,1));
+                wb = _mm_shuffle_ps(wb, wb, _MM_SHUFFLE(0,3,2,1));
+            }
+
+            const DBoW2::WordId max1 = id1[i+3], max2 = id2[j+3];
+            if(max1<=max2)
+                i += 4;
+            if(max2<=max1)
+                j += 4;
+        }
+        float vAcc[4];
+        _mm_storeu_ps(vAcc, acc);
+        score = (vAcc[0]+vAcc[1]) + (vAcc[2]+vAcc[3]);
+#else
+        float32x4_t acc = vdupq_n_f32(0.f);
+        uint32x4_t count = vdupq_n_u32(0);
+        while(i+4<=N1 && j+4<=N2)
+        {
+            const uint32x4_t a = vld1q_u32(id1+i);
+            const float32x4_t wa = vld1q_f32(w1+i);
+            uint32x4_t b = vld1q_u32(id2+j);
+            float32x4_t wb = vld1q_f32(w2+j);
+            for(int r=0; r<4; r++)
+            {
+                const uint32x4_t eq = vceqq_u32(a,b);
+                acc = vaddq_f32(acc, vreinterpretq_f32_u32(vandq_u32(eq, vreinterpretq_u32_f32(vminq_f32(wa,wb)))));
+                // eq lanes are all ones (-1)
+                count = vsubq_u32(count, eq);
+                b = vextq_u32(b, b, 1);
+                wb = vextq_f32(wb, wb, 1);
+            }
+
+            const DBoW2::WordId max1 = id1[i+3], max2 = id2[j+3];
+            if(max1<=max2)
+                i += 4;
+            if(max2<=max1)
+                j += 4;
+        }
+        float vAcc[4];
+        uint32_t vCount[4];
+        vst1q_f32(vAcc, acc);
+        vst1q_u32(vCount, count);
+        score = (vAcc[0]+vAcc[1]) + (vAcc[2]+vAcc[3]);
+        nCommonWords = vCount[0]+vCount[1]+vCount[2]+vCount[3];
+#endif
+    }
+#endif
+
+    // Remaining words, or all of them without SIMD
+    while(i<N1 && j<N2)
+    {
+        if(id1[i]<id2[j])
+            i++;
+        else if(id2[j]<id1[i])
+            j++;
+        else
+        {
+            nCommonWords++;
+            score += std::min(w1[i],w2[j]);
+            i++;
+            j++;
+        }
+    }
+
+    return score;
+}
+
+size_t FlatBowVector::MemoryBytes() const
+{
+    return mvWordIds.capacity()*sizeof(DBoW2::WordId) + mvWeights.capacity()*sizeof(float);
+}
+
+} //namespace ORB_SLAM
@@ -0,0 +1,78 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "FlatFeatureVector.h"
+
+#include <algorithm>
+
+namespace ORB_SLAM3
+{
+
+void FlatFeatureVector::Build(const DBoW2::FeatureVector &featVec)
+{
+    Clear();
+    mvNodeIds.reserve(featVec.size());
+    mvOffsets.reserve(featVec.size()+1);
+
+    size_t nIndices = 0;
+    for(DBoW2::FeatureVector::const_iterator it=featVec.begin(), end=featVec.end(); it!=end; it++)
+        nIndices += it->second.size();
+    mvIndices.reserve(nIndices);
+
+    mvOffsets.push_back(0);
+    for(DBoW2::FeatureVector::const_iterator it=featVec.begin(), end=featVec.end(); it!=end; it++)
+    {
+        mvNodeIds.push_back(it->first);
+        mvIndices.insert(mvIndices.end(),it->second.begin(),it->second.end());
+        mvOffsets.push_back(mvIndices.size());
+    }
+}
+
+void FlatFeatureVector::Clear()
+{
+    mvNodeIds.clear();
+    mvOffsets.clear();
+    mvIndices.clear();
+}
+
+size_t FlatFeatureVector::LowerBound(const size_t n, const DBoW2::NodeId nodeId) const
+{
+    const size_t N = mvNodeIds.size();
+    if(n>=N || mvNodeIds[n]>=nodeId)
+        return n;
+
+    // Exponential search for a node past nodeId, then binary search in the last step
+    size_t lo = n, step = 1;
+    size_t hi = n+step;
+    while(hi<N && mvNodeIds[hi]<nodeId)
+    {
+        lo = hi;
+        step *= 2;
+        hi = lo+step;
+    }
+    hi = std::min(hi,N);
+
+    return std::lower_bound(mvNodeIds.begin()+lo+1,mvNodeIds.begin()+hi,nodeId)-mvNodeIds.begin();
+}
+
+size_t FlatFeatureVector::MemoryBytes() const
+{
+    return mvNodeIds.capacity()*sizeof(DBoW2::NodeId) + (mvOffsets.capacity()+mvIndices.capacity())*sizeof(unsigned int);
+}
+
+} //namespace ORB_SLAM
@@ -25,59 +25,66 @@
 #include "Converter.h"
 #include "ORBmatcher.h"
 #include "GeometricCamera.h"
+#include "ThreadPool.h"
+#include "SystemContext.h"
+#include "VocabularyLoader.h"
+#include "Tracer.h"
 
 #include <thread>
+#include <chrono>
 #include <include/CameraModels/Pinhole.h>
 #include <include/CameraModels/KannalaBrandt8.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
 namespace ORB_SLAM3
 {
 
-long unsigned int Frame::nNextId=0;
-bool Frame::mbInitialComputations=true;
-float Frame::cx, Frame::cy, Frame::fx, Frame::fy, Frame::invfx, Frame::invfy;
-float Frame::mnMinX, Frame::mnMinY, Frame::mnMaxX, Frame::mnMaxY;
-float Frame::mfGridElementWidthInv, Frame::mfGridElementHeightInv;
-
-//For stereo fisheye matching
-cv::BFMatcher Frame::BFmatcher = cv::BFMatcher(cv::NORM_HAMMING);
-
-Frame::Frame(): mpcpi(NULL), mpImuPreintegrated(NULL), mpPrevFrame(NULL), mpImuPreintegratedFrame(NULL), mpReferenceKF(static_cast<KeyFrame*>(NULL)), mbImuPreintegrated(false)
+Frame::Frame(): mpcpi(NULL), mpContext(NULL), mpImuPreintegrated(NULL), mpPrevFrame(NULL), mpImuPreintegratedFrame(NULL), mpReferenceKF(static_cast<KeyFrame*>(NULL)), mbImuPreintegrated(false)
 {
-#ifdef REGISTER_TIMES
+    mnGridCols = FRAME_GRID_COLS;
+    mnGridRows = FRAME_GRID_ROWS;
     mTimeStereoMatch = 0;
     mTimeORB_Ext = 0;
-#endif
+    mbFocusedExtraction = false;
+    mbReducedResolution = false;
+    mbFlowTracked = false;
+    mCameraSetup = CAMERA_MONOCULAR;
 }
 
 
 //Copy Constructor
+// Keypoints, descriptors and grids are never modified once the frame is built, the copy shares them
 Frame::Frame(const Frame &frame)
     :mpcpi(frame.mpcpi),mpORBvocabulary(frame.mpORBvocabulary), mpORBextractorLeft(frame.mpORBextractorLeft), mpORBextractorRight(frame.mpORBextractorRight),
      mTimeStamp(frame.mTimeStamp), mK(frame.mK.clone()), mDistCoef(frame.mDistCoef.clone()),
      mbf(frame.mbf), mb(frame.mb), mThDepth(frame.mThDepth), N(frame.N), mvKeys(frame.mvKeys),
-     mvKeysRight(frame.mvKeysRight), mvKeysUn(frame.mvKeysUn), mvuRight(frame.mvuRight),
-     mvDepth(frame.mvDepth), mBowVec(frame.mBowVec), mFeatVec(frame.mFeatVec),
-     mDescriptors(frame.mDescriptors.clone()), mDescriptorsRight(frame.mDescriptorsRight.clone()),
+     mvKeysRight(frame.mvKeysRight), mvKeysUn(frame.mvKeysUn), mKeysSoA(frame.mKeysSoA), mvuRight(frame.mvuRight),
+     mvDepth(frame.mvDepth), mBowVec(frame.mBowVec), mFeatVec(frame.mFeatVec), mFlatFeatVec(frame.mFlatFeatVec), mFlatBowVec(frame.mFlatBowVec),
+     mDescriptors(frame.mDescriptors), mDescriptorsRight(frame.mDescriptorsRight),
      mvpMapPoints(frame.mvpMapPoints), mvbOutlier(frame.mvbOutlier), mImuCalib(frame.mImuCalib), mnCloseMPs(frame.mnCloseMPs),
      mpImuPreintegrated(frame.mpImuPreintegrated), mpImuPreintegratedFrame(frame.mpImuPreintegratedFrame), mImuBias(frame.mImuBias),
-     mnId(frame.mnId), mpReferenceKF(frame.mpReferenceKF), mnScaleLevels(frame.mnScaleLevels),
+     mnId(frame.mnId), mpContext(frame.mpContext), mpReferenceKF(frame.mpReferenceKF), mnScaleLevels(frame.mnScaleLevels),
      mfScaleFactor(frame.mfScaleFactor), mfLogScaleFactor(frame.mfLogScaleFactor),
      mvScaleFactors(frame.mvScaleFactors), mvInvScaleFactors(frame.mvInvScaleFactors), mNameFile(frame.mNameFile), mnDataset(frame.mnDataset),
-     mvLevelSigma2(frame.mvLevelSigma2), mvInvLevelSigma2(frame.mvInvLevelSigma2), mpPrevFrame(frame.mpPrevFrame), mpLastKeyFrame(frame.mpLastKeyFrame), mbImuPreintegrated(frame.mbImuPreintegrated), mpMutexImu(frame.mpMutexImu),
-     mpCamera(frame.mpCamera), mpCamera2(frame.mpCamera2), Nleft(frame.Nleft), Nright(frame.Nright),
+     mvLevelSigma2(frame.mvLevelSigma2), mvInvLevelSigma2(frame.mvInvLevelSigma2), mpPrevFrame(frame.mpPrevFrame), mpLastKeyFrame(frame.mpLastKeyFrame), mbImuPreintegrated(frame.mbImuPreintegrated), mpMutexImu(frame.mpMutexImu), mpPendingBoW(frame.mpPendingBoW),
+     mpCamera(frame.mpCamera), mpCamera2(frame.mpCamera2), Nleft(frame.Nleft), Nright(frame.Nright), mCameraSetup(frame.mCameraSetup),
      monoLeft(frame.monoLeft), monoRight(frame.monoRight), mvLeftToRightMatch(frame.mvLeftToRightMatch),
      mvRightToLeftMatch(frame.mvRightToLeftMatch), mvStereo3Dpoints(frame.mvStereo3Dpoints),
      mTlr(frame.mTlr.clone()), mRlr(frame.mRlr.clone()), mtlr(frame.mtlr.clone()), mTrl(frame.mTrl.clone()),
-     mTrlx(frame.mTrlx), mTlrx(frame.mTlrx), mOwx(frame.mOwx), mRcwx(frame.mRcwx), mtcwx(frame.mtcwx)
+     mTrlx(frame.mTrlx), mTlrx(frame.mTlrx), mOwx(frame.mOwx), mRcwx(frame.mRcwx), mtcwx(frame.mtcwx),
+     fx(frame.fx), fy(frame.fy), cx(frame.cx), cy(frame.cy), invfx(frame.invfx), invfy(frame.invfy),
+     mnGridCols(frame.mnGridCols), mnGridRows(frame.mnGridRows),
+     mfGridElementWidthInv(frame.mfGridElementWidthInv), mfGridElementHeightInv(frame.mfGridElementHeightInv),
+     mnMinX(frame.mnMinX), mnMaxX(frame.mnMaxX), mnMinY(frame.mnMinY), mnMaxY(frame.mnMaxY)
 {
-    for(int i=0;i<FRAME_GRID_COLS;i++)
-        for(int j=0; j<FRAME_GRID_ROWS; j++){
-            mGrid[i][j]=frame.mGrid[i][j];
-            if(frame.Nleft > 0){
-                mGridRight[i][j] = frame.mGridRight[i][j];
-            }
-        }
+    mGrid = frame.mGrid;
+    if(frame.Nleft > 0)
+        mGridRight = frame.mGridRight;
 
     if(!frame.mTcw.empty())
         SetPose(frame.mTcw);
@@ -88,20 +95,24 @@ Frame::Frame(const Frame &frame)
     mmProjectPoints = frame.mmProjectPoints;
     mmMatchedInImage = frame.mmMatchedInImage;
 
-#ifdef REGISTER_TIMES
     mTimeStereoMatch = frame.mTimeStereoMatch;
     mTimeORB_Ext = frame.mTimeORB_Ext;
-#endif
+    mTimeExtracted = frame.mTimeExtracted;
+    mbFocusedExtraction = frame.mbFocusedExtraction;
+    mbReducedResolution = frame.mbReducedResolution;
+    mbFlowTracked = frame.mbFlowTracked;
+    mvRigViews = frame.mvRigViews;
 }
 
 
-Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeStamp, ORBextractor* extractorLeft, ORBextractor* extractorRight, ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth, GeometricCamera* pCamera, Frame* pPrevF, const IMU::Calib &ImuCalib)
-    :mpcpi(NULL), mpORBvocabulary(voc),mpORBextractorLeft(extractorLeft),mpORBextractorRight(extractorRight), mTimeStamp(timeStamp), mK(K.clone()), mDistCoef(distCoef.clone()), mbf(bf), mThDepth(thDepth),
+Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeStamp, FeatureExtractor* extractorLeft, FeatureExtractor* extractorRight, ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth, GeometricCamera* pCamera, SystemContext* pContext, Frame* pPrevF, const IMU::Calib &ImuCalib)
+    :mpcpi(NULL), mpContext(pContext), mpORBvocabulary(voc),mpORBextractorLeft(extractorLeft),mpORBextractorRight(extractorRight), mTimeStamp(timeStamp), mK(K.clone()), mDistCoef(distCoef.clone()), mbf(bf), mThDepth(thDepth),
      mImuCalib(ImuCalib), mpImuPreintegrated(NULL), mpPrevFrame(pPrevF),mpImuPreintegratedFrame(NULL), mpReferenceKF(static_cast<KeyFrame*>(NULL)), mbImuPreintegrated(false),
      mpCamera(pCamera) ,mpCamera2(nullptr)
 {
+    ORB_TRACE_SCOPE("Frame::Frame");
     // Frame ID
-    mnId=nNextId++;
+    mnId=mpContext->mnNextFrameId++;
 
     // Scale Level Info
     mnScaleLevels = mpORBextractorLeft->GetLevels();
@@ -112,19 +123,18 @@ Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeSt
     mvLevelSigma2 = mpORBextractorLeft->GetScaleSigmaSquares();
     mvInvLevelSigma2 = mpORBextractorLeft->GetInverseScaleSigmaSquares();
 
+    // Calibration of this frame (each System may have its own camera)
+    ComputeCalibration(imLeft);
+
     // ORB extraction
-#ifdef REGISTER_TIMES
     std::chrono::steady_clock::time_point time_StartExtORB = std::chrono::steady_clock::now();
-#endif
-    thread threadLeft(&Frame::ExtractORB,this,0,imLeft,0,0);
-    thread threadRight(&Frame::ExtractORB,this,1,imRight,0,0);
-    threadLeft.join();
-    threadRight.join();
-#ifdef REGISTER_TIMES
+    ExtractORBStereo(imLeft,imRight,0,0,0,0);
     std::chrono::steady_clock::time_point time_EndExtORB = std::chrono::steady_clock::now();
 
     mTimeORB_Ext = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(time_EndExtORB - time_StartExtORB).count();
-#endif
+    mbFocusedExtraction = mpORBextractorLeft->IsFocused();
+    mbReducedResolution = mpORBextractorLeft->GetFirstLevel()>0;
+    mbFlowTracked = false;
 
 
     N = mvKeys.size();
@@ -133,15 +143,11 @@ Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeSt
 
     UndistortKeyPoints();
 
-#ifdef REGISTER_TIMES
     std::chrono::steady_clock::time_point time_StartStereoMatches = std::chrono::steady_clock::now();
-#endif
     ComputeStereoMatches();
-#ifdef REGISTER_TIMES
     std::chrono::steady_clock::time_point time_EndStereoMatches = std::chrono::steady_clock::now();
 
     mTimeStereoMatch = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(time_EndStereoMatches - time_StartStereoMatches).count();
-#endif
 
 
     mvpMapPoints = vector<MapPoint*>(N,static_cast<MapPoint*>(NULL));
@@ -150,26 +156,6 @@ Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeSt
     mmMatchedInImage.clear();
 
 
-    // This is done only for the first Frame (or after a change in the calibration)
-    if(mbInitialComputations)
-    {
-        ComputeImageBounds(imLeft);
-
-        mfGridElementWidthInv=static_cast<float>(FRAME_GRID_COLS)/(mnMaxX-mnMinX);
-        mfGridElementHeightInv=static_cast<float>(FRAME_GRID_ROWS)/(mnMaxY-mnMinY);
-
-
-
-        fx = K.at<float>(0,0);
-        fy = K.at<float>(1,1);
-        cx = K.at<float>(0,2);
-        cy = K.at<float>(1,2);
-        invfx = 1.0f/fx;
-        invfy = 1.0f/fy;
-
-        mbInitialComputations=false;
-    }
-
     mb = mbf/fx;
 
     if(pPrevF)
@@ -188,6 +174,7 @@ Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeSt
 
     //Set no stereo fisheye information
     Nleft = -1;
+    mCameraSetup = CAMERA_RECTIFIED;
     Nright = -1;
     mvLeftToRightMatch = vector<int>(0);
     mvRightToLeftMatch = vector<int>(0);
@@ -198,14 +185,20 @@ Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeSt
     monoRight = -1;
 }
 
-Frame::Frame(const cv::Mat &imGray, const cv::Mat &imDepth, const double &timeStamp, ORBextractor* extractor,ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth, GeometricCamera* pCamera,Frame* pPrevF, const IMU::Calib &ImuCalib)
-    :mpcpi(NULL),mpORBvocabulary(voc),mpORBextractorLeft(extractor),mpORBextractorRight(static_cast<ORBextractor*>(NULL)),
+Frame::Frame(const cv::Mat &imGray, const cv::Mat &imDepth, const float depthFactor, const double &timeStamp, FeatureExtractor* extractor,ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth, GeometricCamera* pCamera, SystemContext* pContext, Frame* pPrevF, const IMU::Calib &ImuCalib)
+    :Frame(imGray,imDepth,depthFactor,false,timeStamp,extractor,voc,K,distCoef,bf,thDepth,pCamera,pContext,pPrevF,ImuCalib)
+{
+}
+
+Frame::Frame(const cv::Mat &imGray, const cv::Mat &imDepth, const float depthFactor, const bool bDisparity, const double &timeStamp, FeatureExtractor* extractor,ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth, GeometricCamera* pCamera, SystemContext* pContext, Frame* pPrevF, const IMU::Calib &ImuCalib)
+    :mpcpi(NULL), mpContext(pContext), mpORBvocabulary(voc),mpORBextractorLeft(extractor),mpORBextractorRight(static_cast<FeatureExtractor*>(NULL)),
      mTimeStamp(timeStamp), mK(K.clone()),mDistCoef(distCoef.clone()), mbf(bf), mThDepth(thDepth),
      mImuCalib(ImuCalib), mpImuPreintegrated(NULL), mpPrevFrame(pPrevF), mpImuPreintegratedFrame(NULL), mpReferenceKF(static_cast<KeyFrame*>(NULL)), mbImuPreintegrated(false),
      mpCamera(pCamera),mpCamera2(nullptr)
 {
+    ORB_TRACE_SCOPE("Frame::Frame");
     // Frame ID
-    mnId=nNextId++;
+    mnId=mpContext->mnNextFrameId++;
 
     // Scale Level Info
     mnScaleLevels = mpORBextractorLeft->GetLevels();
@@ -216,16 +209,18 @@ Frame::Frame(const cv::Mat &imGray, const cv::Mat &imDepth, const double &timeSt
     mvLevelSigma2 = mpORBextractorLeft->GetScaleSigmaSquares();
     mvInvLevelSigma2 = mpORBextractorLeft->GetInverseScaleSigmaSquares();
 
+    // Calibration of this frame (each System may have its own camera)
+    ComputeCalibration(imGray);
+
     // ORB extraction
-#ifdef REGISTER_TIMES
     std::chrono::steady_clock::time_point time_StartExtORB = std::chrono::steady_clock::now();
-#endif
     ExtractORB(0,imGray,0,0);
-#ifdef REGISTER_TIMES
     std::chrono::steady_clock::time_point time_EndExtORB = std::chrono::steady_clock::now();
 
     mTimeORB_Ext = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(time_EndExtORB - time_StartExtORB).count();
-#endif
+    mbFocusedExtraction = mpORBextractorLeft->IsFocused();
+    mbReducedResolution = mpORBextractorLeft->GetFirstLevel()>0;
+    mbFlowTracked = false;
 
 
     N = mvKeys.size();
@@ -235,7 +230,7 @@ Frame::Frame(const cv::Mat &imGray, const cv::Mat &imDepth, const double &timeSt
 
     UndistortKeyPoints();
 
-    ComputeStereoFromRGBD(imDepth);
+    ComputeStereoFromRGBD(imDepth,depthFactor,bDisparity);
 
     mvpMapPoints = vector<MapPoint*>(N,static_cast<MapPoint*>(NULL));
 
@@ -244,30 +239,13 @@ Frame::Frame(const cv::Mat &imGray, const cv::Mat &imDepth, const double &timeSt
 
     mvbOutlier = vector<bool>(N,false);
 
-    // This is done only for the first Frame (or after a change in the calibration)
-    if(mbInitialComputations)
-    {
-        ComputeImageBounds(imGray);
-
-        mfGridElementWidthInv=static_cast<float>(FRAME_GRID_COLS)/static_cast<float>(mnMaxX-mnMinX);
-        mfGridElementHeightInv=static_cast<float>(FRAME_GRID_ROWS)/static_cast<float>(mnMaxY-mnMinY);
-
-        fx = K.at<float>(0,0);
-        fy = K.at<float>(1,1);
-        cx = K.at<float>(0,2);
-        cy = K.at<float>(1,2);
-        invfx = 1.0f/fx;
-        invfy = 1.0f/fy;
-
-        mbInitialComputations=false;
-    }
-
     mb = mbf/fx;
 
     mpMutexImu = new std::mutex();
 
     //Set no stereo fisheye information
     Nleft = -1;
+    mCameraSetup = CAMERA_RECTIFIED;
     Nright = -1;
     mvLeftToRightMatch = vector<int>(0);
     mvRightToLeftMatch = vector<int>(0);
@@ -281,14 +259,15 @@ Frame::Frame(const cv::Mat &imGray, const cv::Mat &imDepth, const double &timeSt
 }
 
 
-Frame::Frame(const cv::Mat &imGray, const double &timeStamp, ORBextractor* extractor,ORBVocabulary* voc, GeometricCamera* pCamera, cv::Mat &distCoef, const float &bf, const float &thDepth, Frame* pPrevF, const IMU::Calib &ImuCalib)
-    :mpcpi(NULL),mpORBvocabulary(voc),mpORBextractorLeft(extractor),mpORBextractorRight(static_cast<ORBextractor*>(NULL)),
+Frame::Frame(const cv::Mat &imGray, const double &timeStamp, FeatureExtractor* extractor,ORBVocabulary* voc, GeometricCamera* pCamera, cv::Mat &distCoef, const float &bf, const float &thDepth, SystemContext* pContext, Frame* pPrevF, const IMU::Calib &ImuCalib)
+    :mpcpi(NULL), mpContext(pContext), mpORBvocabulary(voc),mpORBextractorLeft(extractor),mpORBextractorRight(static_cast<FeatureExtractor*>(NULL)),
      mTimeStamp(timeStamp), mK(static_cast<Pinhole*>(pCamera)->toK()), mDistCoef(distCoef.clone()), mbf(bf), mThDepth(thDepth),
      mImuCalib(ImuCalib), mpImuPreintegrated(NULL),mpPrevFrame(pPrevF),mpImuPreintegratedFrame(NULL), mpReferenceKF(static_cast<KeyFrame*>(NULL)), mbImuPreintegrated(false), mpCamera(pCamera),
      mpCamera2(nullptr)
 {
+    ORB_TRACE_SCOPE("Frame::Frame");
     // Frame ID
-    mnId=nNextId++;
+    mnId=mpContext->mnNextFrameId++;
 
     // Scale Level Info
     mnScaleLevels = mpORBextractorLeft->GetLevels();
@@ -299,16 +278,18 @@ Frame::Frame(const cv::Mat &imGray, const double &timeStamp, ORBextractor* extra
     mvLevelSigma2 = mpORBextractorLeft->GetScaleSigmaSquares();
     mvInvLevelSigma2 = mpORBextractorLeft->GetInverseScaleSigmaSquares();
 
+    // Calibration of this frame (each System may have its own camera)
+    ComputeCalibration(imGray);
+
     // ORB extraction
-#ifdef REGISTER_TIMES
     std::chrono::steady_clock::time_point time_StartExtORB = std::chrono::steady_clock::now();
-#endif
     ExtractORB(0,imGray,0,1000);
-#ifdef REGISTER_TIMES
     std::chrono::steady_clock::time_point time_EndExtORB = std::chrono::steady_clock::now();
 
     mTimeORB_Ext = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(time_EndExtORB - time_StartExtORB).count();
-#endif
+    mbFocusedExtraction = mpORBextractorLeft->IsFocused();
+    mbReducedResolution = mpORBextractorLeft->GetFirstLevel()>0;
+    mbFlowTracked = false;
 
 
     N = mvKeys.size();
@@ -329,29 +310,12 @@ Frame::Frame(const cv::Mat &imGray, const double &timeStamp, ORBextractor* extra
 
     mvbOutlier = vector<bool>(N,false);
 
-    // This is done only for the first Frame (or after a change in the calibration)
-    if(mbInitialComputations)
-    {
-        ComputeImageBounds(imGray);
-
-        mfGridElementWidthInv=static_cast<float>(FRAME_GRID_COLS)/static_cast<float>(mnMaxX-mnMinX);
-        mfGridElementHeightInv=static_cast<float>(FRAME_GRID_ROWS)/static_cast<float>(mnMaxY-mnMinY);
-
-        fx = static_cast<Pinhole*>(mpCamera)->toK().at<float>(0,0);
-        fy = static_cast<Pinhole*>(mpCamera)->toK().at<float>(1,1);
-        cx = static_cast<Pinhole*>(mpCamera)->toK().at<float>(0,2);
-        cy = static_cast<Pinhole*>(mpCamera)->toK().at<float>(1,2);
-        invfx = 1.0f/fx;
-        invfy = 1.0f/fy;
-
-        mbInitialComputations=false;
-    }
-
 
     mb = mbf/fx;
 
     //Set no stereo fisheye information
     Nleft = -1;
+    mCameraSetup = CAMERA_MONOCULAR;
     Nright = -1;
     mvLeftToRightMatch = vector<int>(0);
     mvRightToLeftMatch = vector<int>(0);
@@ -377,23 +341,153 @@ Frame::Frame(const cv::Mat &imGray, const double &timeStamp, ORBextractor* extra
 }
 
 
-void Frame::AssignFeaturesToGrid()
+Frame::Frame(const Frame &lastFrame, const double &timeStamp, const std::vector<int> &vIndices, const std::vector<cv::Point2f> &vPoints, Frame* pPrevF)
+    :Frame(lastFrame)
 {
-    // Fill matrix with points
-    const int nCells = FRAME_GRID_COLS*FRAME_GRID_ROWS;
+    // Frame ID
+    mnId=mpContext->mnNextFrameId++;
+
+    mTimeStamp = timeStamp;
+    mpcpi = NULL;
+    mpPrevFrame = pPrevF;
+    mpReferenceKF = static_cast<KeyFrame*>(NULL);
+    mpImuPreintegrated = NULL;
+    mpImuPreintegratedFrame = NULL;
+    mbImuPreintegrated = false;
+    mBowVec.clear();
+    mFeatVec.clear();
+    mFlatFeatVec.Clear();
+    mFlatBowVec.Clear();
+    mpPendingBoW.reset();
+    mTcw = cv::Mat();
+    mmProjectPoints.clear();
+    mmMatchedInImage.clear();
 
-    int nReserve = 0.5f*N/(nCells);
+    mTimeORB_Ext = 0;
+    mTimeStereoMatch = 0;
+    mbFocusedExtraction = false;
+    mbReducedResolution = false;
+    mbFlowTracked = true;
+
+    // Tracked features, with the level, angle and descriptor they had when extracted
+    N = vIndices.size();
+    vector<cv::KeyPoint> &vKeys = mvKeys.Replace();
+    vKeys.resize(N);
+    mDescriptors = cv::Mat(N,lastFrame.mDescriptors.cols,lastFrame.mDescriptors.type());
+    mvpMapPoints = vector<MapPoint*>(N,static_cast<MapPoint*>(NULL));
+    for(int i=0; i<N; i++)
+    {
+        const int idx = vIndices[i];
+        vKeys[i] = lastFrame.mvKeys[idx];
+        vKeys[i].pt = vPoints[i];
+        lastFrame.mDescriptors.row(idx).copyTo(mDescriptors.row(i));
+        mvpMapPoints[i] = lastFrame.mvpMapPoints[idx];
+    }
+    mvKeysRight.clear();
+    mDescriptorsRight = cv::Mat();
 
-    for(unsigned int i=0; i<FRAME_GRID_COLS;i++)
-        for (unsigned int j=0; j<FRAME_GRID_ROWS;j++){
-            mGrid[i][j].reserve(nReserve);
-            if(Nleft != -1){
-                mGridRight[i][j].reserve(nReserve);
-            }
-        }
+    UndistortKeyPoints();
+
+    // Set no stereo information
+    mvuRight = vector<float>(N,-1);
+    mvDepth = vector<float>(N,-1);
+    mnCloseMPs = 0;
+    mvbOutlier = vector<bool>(N,false);
+
+    AssignFeaturesToGrid();
+
+    if(pPrevF && !pPrevF->mVw.empty())
+        mVw = pPrevF->mVw.clone();
+    else
+        mVw = cv::Mat::zeros(3,1,CV_32F);
+
+    mpMutexImu = new std::mutex();
+}
+
+
+void KeyPointsSoA::Assign(const std::vector<cv::KeyPoint> &vKeys, const std::vector<cv::KeyPoint> &vKeysRight)
+{
+    const size_t nLeft = vKeys.size();
+    const size_t nTotal = nLeft + vKeysRight.size();
+    mvX.resize(nTotal);
+    mvY.resize(nTotal);
+    mvAngle.resize(nTotal);
+    mvOctave.resize(nTotal);
+
+    for(size_t i=0; i<nTotal; i++)
+    {
+        const cv::KeyPoint &kp = (i < nLeft) ? vKeys[i] : vKeysRight[i - nLeft];
+        mvX[i] = kp.pt.x;
+        mvY[i] = kp.pt.y;
+        mvAngle[i] = kp.angle;
+        mvOctave[i] = kp.octave;
+    }
+}
+
+void FeatureGrid::Build(const int nCols, const int nRows, const int* pCells, const size_t n)
+{
+    mnCols = nCols;
+    mnRows = nRows;
+    const int nCells = nCols*nRows;
+
+    // Counting sort of the keypoints by cell, keeping their order inside every cell
+    // Copies of the grid keep the previous arrays
+    vector<unsigned int> &vCellStart = mvCellStart.Replace();
+    vCellStart.assign(nCells+1, 0);
+    for(size_t i=0; i<n; i++)
+        if(pCells[i] >= 0)
+            vCellStart[pCells[i]+1]++;
+
+    for(int c=0; c<nCells; c++)
+        vCellStart[c+1] += vCellStart[c];
+
+    vector<unsigned int> &vIndices = mvIndices.Replace();
+    vIndices.resize(vCellStart[nCells]);
+    vector<unsigned int> vFill(vCellStart.begin(), vCellStart.end()-1);
+    for(size_t i=0; i<n; i++)
+        if(pCells[i] >= 0)
+            vIndices[vFill[pCells[i]]++] = i;
+}
+
+void FeatureGrid::SizeFor(const int nWidth, const int nHeight, const int nFeatures, int &nCols, int &nRows)
+{
+    const float fCells = nFeatures*(FRAME_GRID_COLS*FRAME_GRID_ROWS/1000.f);
+    const float fAspect = static_cast<float>(nWidth)/nHeight;
+    nCols = max(1,(int)round(sqrt(fCells*fAspect)));
+    nRows = max(1,(int)round(fCells/nCols));
+}
+
+// Grid of the frames of a camera, the default one unless it was set in the camera
+static void CameraGridSize(GeometricCamera* pCamera, int &nCols, int &nRows)
+{
+    if(pCamera && pCamera->GetGridCols()>0 && pCamera->GetGridRows()>0)
+    {
+        nCols = pCamera->GetGridCols();
+        nRows = pCamera->GetGridRows();
+    }
+    else
+    {
+        nCols = FRAME_GRID_COLS;
+        nRows = FRAME_GRID_ROWS;
+    }
+}
 
+void FeatureGrid::Clear()
+{
+    mnCols = mnRows = 0;
+    mvCellStart.clear();
+    mvIndices.clear();
+}
 
+void Frame::AssignFeaturesToGrid()
+{
+    if(Nleft == -1)
+        mKeysSoA.Assign(mvKeysUn);
+    else
+        mKeysSoA.Assign(mvKeys, mvKeysRight);
 
+    // Cell of every keypoint. Right keypoints go to their own grid, indexed from 0
+    vector<int> vCells(N);
     for(int i=0;i<N;i++)
     {
         const cv::KeyPoint &kp = (Nleft == -1) ? mvKeysUn[i]
@@ -401,22 +495,47 @@ void Frame::AssignFeaturesToGrid()
                                                                  : mvKeysRight[i - Nleft];
 
         int nGridPosX, nGridPosY;
-        if(PosInGrid(kp,nGridPosX,nGridPosY)){
-            if(Nleft == -1 || i < Nleft)
-                mGrid[nGridPosX][nGridPosY].push_back(i);
-            else
-                mGridRight[nGridPosX][nGridPosY].push_back(i - Nleft);
-        }
+        if(PosInGrid(kp,nGridPosX,nGridPosY))
+            vCells[i] = nGridPosX*mnGridRows + nGridPosY;
+        else
+            vCells[i] = -1;
     }
+
+    const int nLeft = (Nleft == -1) ? N : Nleft;
+    mGrid.Build(mnGridCols, mnGridRows, vCells.data(), nLeft);
+    if(Nleft != -1)
+        mGridRight.Build(mnGridCols, mnGridRows, vCells.data() + Nleft, N - Nleft);
 }
 
 void Frame::ExtractORB(int flag, const cv::Mat &im, const int x0, const int x1)
 {
     vector<int> vLapping = {x0,x1};
     if(flag==0)
-        monoLeft = (*mpORBextractorLeft)(im,cv::Mat(),mvKeys,mDescriptors,vLapping);
+        monoLeft = (*mpORBextractorLeft)(im,cv::Mat(),mvKeys.Mutable(),mDescriptors,vLapping);
+    else
+        monoRight = (*mpORBextractorRight)(im,cv::Mat(),mvKeysRight.Mutable(),mDescriptorsRight,vLapping);
+}
+
+void Frame::ExtractORBStereo(const cv::Mat &imLeft, const cv::Mat &imRight, const int x0Left, const int x1Left, const int x0Right, const int x1Right)
+{
+    ThreadPool* pThreadPool = mpORBextractorLeft->GetThreadPool();
+    if(pThreadPool)
+    {
+        // The right image is offered to a worker, the left one is extracted in this thread
+        pThreadPool->ParallelFor(0,2,[&](int i){
+            if(i==0)
+                ExtractORB(0,imLeft,x0Left,x1Left);
+            else
+                ExtractORB(1,imRight,x0Right,x1Right);
+        });
+    }
     else
-        monoRight = (*mpORBextractorRight)(im,cv::Mat(),mvKeysRight,mDescriptorsRight,vLapping);
+    {
+        thread threadLeft(&Frame::ExtractORB,this,0,imLeft,x0Left,x1Left);
+        thread threadRight(&Frame::ExtractORB,this,1,imRight,x0Right,x1Right);
+        threadLeft.join();
+        threadRight.join();
+    }
 }
 
 void Frame::SetPose(cv::Mat Tcw)
@@ -442,6 +561,20 @@ void Frame::SetVelocity(const cv::Mat &Vwb)
     mVw = Vwb.clone();
 }
 
+void Frame::SetPrevFrame(Frame* pPrevF)
+{
+    mpPrevFrame = pPrevF;
+
+    // The fisheye constructor does not take the velocity from the previous frame
+    if(Nleft == -1 && pPrevF)
+    {
+        if(!pPrevF->mVw.empty())
+            mVw = pPrevF->mVw.clone();
+        else
+            mVw = cv::Mat();
+    }
+}
+
 void Frame::SetImuPoseVelocity(const cv::Mat &Rwb, const cv::Mat &twb, const cv::Mat &Vwb)
 {
     mVw = Vwb.clone();
@@ -571,6 +704,95 @@ bool Frame::isInFrustum(MapPoint *pMP, float viewingCosLimit)
     }
 }
 
+int Frame::isInFrustum(const std::vector<MapPoint*> &vpMPs, float viewingCosLimit, std::vector<bool> &vbInFrustum)
+{
+    const int N = vpMPs.size();
+    vbInFrustum.assign(N,false);
+
+    if(Nleft != -1)
+    {
+        int nInFrustum = 0;
+        for(int i=0; i<N; i++)
+        {
+            vbInFrustum[i] = isInFrustum(vpMPs[i],viewingCosLimit);
+            if(vbInFrustum[i])
+                nInFrustum++;
+        }
+        return nInFrustum;
+    }
+
+    // Gather the point data into structure-of-arrays (one lock per point)
+    std::vector<float> vX(N), vY(N), vZ(N), vNx(N), vNy(N), vNz(N), vMinDist(N), vMaxDist(N);
+    for(int i=0; i<N; i++)
+    {
+        cv::Matx31f Px, Pn;
+        vpMPs[i]->GetViewingGeometry(Px,Pn,vMinDist[i],vMaxDist[i]);
+        vX[i] = Px(0); vY[i] = Px(1); vZ[i] = Px(2);
+        vNx[i] = Pn(0); vNy[i] = Pn(1); vNz[i] = Pn(2);
+    }
+
+    const float r00 = mRcwx(0,0), r01 = mRcwx(0,1), r02 = mRcwx(0,2);
+    const float r10 = mRcwx(1,0), r11 = mRcwx(1,1), r12 = mRcwx(1,2);
+    const float r20 = mRcwx(2,0), r21 = mRcwx(2,1), r22 = mRcwx(2,2);
+    const float tx = mtcwx(0), ty = mtcwx(1), tz = mtcwx(2);
+    const float ox = mOwx(0), oy = mOwx(1), oz = mOwx(2);
+
+    std::vector<float> vPcX(N), vPcY(N), vPcZ(N), vDist(N), vViewCos(N);
+    for(int i=0; i<N; i++)
+    {
+        vPcX[i] = r00*vX[i] + r01*vY[i] + r02*vZ[i] + tx;
+        vPcY[i] = r10*vX[i] + r11*vY[i] + r12*vZ[i] + ty;
+        vPcZ[i] = r20*vX[i] + r21*vY[i] + r22*vZ[i] + tz;
+
+        const float pox = vX[i]-ox, poy = vY[i]-oy, poz = vZ[i]-oz;
+        const float dist = std::sqrt(pox*pox + poy*poy + poz*poz);
+        vDist[i] = dist;
+        vViewCos[i] = (pox*vNx[i] + poy*vNy[i] + poz*vNz[i])/dist;
+    }
+
+    std::vector<float> vU(N), vV(N);
+    mpCamera->projectMany(vPcX.data(),vPcY.data(),vPcZ.data(),N,vU.data(),vV.data());
+
+    const float minX = mnMinX, maxX = mnMaxX, minY = mnMinY, maxY = mnMaxY;
+    std::vector<unsigned char> vbInImage(N), vbValid(N);
+    for(int i=0; i<N; i++)
+    {
+        const bool bInImage = vPcZ[i]>=0.0f && vU[i]>=minX && vU[i]<=maxX && vV[i]>=minY && vV[i]<=maxY;
+        vbInImage[i] = bInImage;
+        vbValid[i] = bInImage && vDist[i]>=vMinDist[i] && vDist[i]<=vMaxDist[i] && vViewCos[i]>=viewingCosLimit;
+    }
+
+    int nInFrustum = 0;
+    for(int i=0; i<N; i++)
+    {
+        MapPoint* pMP = vpMPs[i];
+        pMP->mbTrackInView = false;
+        pMP->mTrackProjX = -1;
+        pMP->mTrackProjY = -1;
+
+        if(!vbInImage[i])
+            continue;
+
+        pMP->mTrackProjX = vU[i];
+        pMP->mTrackProjY = vV[i];
+
+        if(!vbValid[i])
+            continue;
+
+        // Data used by the tracking
+        pMP->mbTrackInView = true;
+        pMP->mTrackProjXR = vU[i] - mbf/vPcZ[i];
+        pMP->mTrackDepth = std::sqrt(vPcX[i]*vPcX[i] + vPcY[i]*vPcY[i] + vPcZ[i]*vPcZ[i]);
+        pMP->mnTrackScaleLevel = pMP->PredictScale(vDist[i],this);
+        pMP->mTrackViewCos = vViewCos[i];
+
+        vbInFrustum[i] = true;
+        nInFrustum++;
+    }
+
+    return nInFrustum;
+}
+
 bool Frame::ProjectPointDistort(MapPoint* pMP, cv::Point2f &kp, float &u, float &v)
 {
 
@@ -644,68 +866,83 @@ vector<size_t> Frame::GetFeaturesInArea(const float &x, const float  &y, const f
 {
     vector<size_t> vIndices;
     vIndices.reserve(N);
+    GetFeaturesInArea(x, y, r, vIndices, minLevel, maxLevel, bRight);
+    return vIndices;
+}
+
+void Frame::GetFeaturesInArea(const float &x, const float  &y, const float  &r, vector<size_t> &vIndices, const int minLevel, const int maxLevel, const bool bRight) const
+{
+    vIndices.clear();
 
     float factorX = r;
     float factorY = r;
 
     const int nMinCellX = max(0,(int)floor((x-mnMinX-factorX)*mfGridElementWidthInv));
-    if(nMinCellX>=FRAME_GRID_COLS)
+    if(nMinCellX>=mnGridCols)
     {
-        return vIndices;
+        return;
     }
 
-    const int nMaxCellX = min((int)FRAME_GRID_COLS-1,(int)ceil((x-mnMinX+factorX)*mfGridElementWidthInv));
+    const int nMaxCellX = min(mnGridCols-1,(int)ceil((x-mnMinX+factorX)*mfGridElementWidthInv));
     if(nMaxCellX<0)
     {
-        return vIndices;
+        return;
     }
 
     const int nMinCellY = max(0,(int)floor((y-mnMinY-factorY)*mfGridElementHeightInv));
-    if(nMinCellY>=FRAME_GRID_ROWS)
+    if(nMinCellY>=mnGridRows)
     {
-        return vIndices;
+        return;
     }
 
-    const int nMaxCellY = min((int)FRAME_GRID_ROWS-1,(int)ceil((y-mnMinY+factorY)*mfGridElementHeightInv));
+    const int nMaxCellY = min(mnGridRows-1,(int)ceil((y-mnMinY+factorY)*mfGridElementHeightInv));
     if(nMaxCellY<0)
     {
-        return vIndices;
+        return;
     }
 
     const bool bCheckLevels = (minLevel>0) || (maxLevel>=0);
 
+    // Right cell indices start at 0, the compact keypoints of the right camera after Nleft
+    const float* pX = mKeysSoA.mvX.data();
+    const float* pY = mKeysSoA.mvY.data();
+    const int* pOctave = mKeysSoA.mvOctave.data();
+    if(bRight)
+    {
+        pX += Nleft;
+        pY += Nleft;
+        pOctave += Nleft;
+    }
+
+    const FeatureGrid &grid = (!bRight) ? mGrid : mGridRight;
+    if(grid.empty())
+        return;
+
+    // The cells of one column between nMinCellY and nMaxCellY are contiguous
     for(int ix = nMinCellX; ix<=nMaxCellX; ix++)
     {
-        for(int iy = nMinCellY; iy<=nMaxCellY; iy++)
-        {
-            const vector<size_t> vCell = (!bRight) ? mGrid[ix][iy] : mGridRight[ix][iy];
-            if(vCell.empty())
-                continue;
+        const unsigned int *pIdx, *pEnd;
+        grid.ColumnRange(ix, nMinCellY, nMaxCellY, pIdx, pEnd);
 
-            for(size_t j=0, jend=vCell.size(); j<jend; j++)
+        for(; pIdx!=pEnd; pIdx++)
+        {
+            const unsigned int idx = *pIdx;
+            if(bCheckLevels)
             {
-                const cv::KeyPoint &kpUn = (Nleft == -1) ? mvKeysUn[vCell[j]]
-                                                         : (!bRight) ? mvKeys[vCell[j]]
-                                                                     : mvKeysRight[vCell[j]];
-                if(bCheckLevels)
-                {
-                    if(kpUn.octave<minLevel)
+                if(pOctave[idx]<minLevel)
+                    continue;
+                if(maxLevel>=0)
+                    if(pOctave[idx]>maxLevel)
                         continue;
-                    if(maxLevel>=0)
-                        if(kpUn.octave>maxLevel)
-                            continue;
-                }
+            }
 
-                const float distx = kpUn.pt.x-x;
-                const float disty = kpUn.pt.y-y;
+            const float distx = pX[idx]-x;
+            const float disty = pY[idx]-y;
 
-                if(fabs(distx)<factorX && fabs(disty)<factorY)
-                    vIndices.push_back(vCell[j]);
-            }
+            if(fabs(distx)<factorX && fabs(disty)<factorY)
+                vIndices.push_back(idx);
         }
     }
-
-    return vIndices;
 }
 
 bool Frame::PosInGrid(const cv::KeyPoint &kp, int &posX, int &posY)
@@ -714,76 +951,211 @@ bool Frame::PosInGrid(const cv::KeyPoint &kp, int &posX, int &posY)
     posY = round((kp.pt.y-mnMinY)*mfGridElementHeightInv);
 
     //Keypoint's coordinates are undistorted, which could cause to go out of the image
-    if(posX<0 || posX>=FRAME_GRID_COLS || posY<0 || posY>=FRAME_GRID_ROWS)
+    if(posX<0 || posX>=mnGridCols || posY<0 || posY>=mnGridRows)
         return false;
 
     return true;
 }
 
+void RigView::GetFeaturesInArea(const float x, const float y, const float r, vector<size_t> &vIndices, const int minLevel, const int maxLevel) const
+{
+    vIndices.clear();
+    if(mGrid.empty())
+        return;
+
+    const int nMinCellX = max(0,(int)floor((x-mnMinX-r)*mfGridElementWidthInv));
+    const int nMaxCellX = min(mnGridCols-1,(int)ceil((x-mnMinX+r)*mfGridElementWidthInv));
+    const int nMinCellY = max(0,(int)floor((y-mnMinY-r)*mfGridElementHeightInv));
+    const int nMaxCellY = min(mnGridRows-1,(int)ceil((y-mnMinY+r)*mfGridElementHeightInv));
+    if(nMinCellX>=mnGridCols || nMaxCellX<0 || nMinCellY>=mnGridRows || nMaxCellY<0)
+        return;
+
+    for(int ix = nMinCellX; ix<=nMaxCellX; ix++)
+    {
+        const unsigned int *pIdx, *pEnd;
+        mGrid.ColumnRange(ix, nMinCellY, nMaxCellY, pIdx, pEnd);
+
+        for(; pIdx!=pEnd; pIdx++)
+        {
+            const cv::KeyPoint &kp = mvKeysUn[*pIdx];
+            if(kp.octave<minLevel || (maxLevel>=0 && kp.octave>maxLevel))
+                continue;
+
+            if(fabs(kp.pt.x-x)<r && fabs(kp.pt.y-y)<r)
+                vIndices.push_back(*pIdx);
+        }
+    }
+}
+
+
+// Whoever claims it first computes it: the pool task, or ComputeBoW if the task has not
+// started yet (so a busy pool never makes the tracking wait longer than computing inline).
+struct Frame::PendingBoW
+{
+    std::atomic<bool> bClaimed;
+    std::promise<void> computed;
+    std::shared_future<void> done;
+    DBoW2::BowVector mBowVec;
+    DBoW2::FeatureVector mFeatVec;
+    FlatFeatureVector mFlatFeatVec;
+    FlatBowVector mFlatBowVec;
+
+    PendingBoW(): bClaimed(false), done(computed.get_future().share()) {}
+
+    void Compute(ORBVocabulary* pVoc, const cv::Mat &descriptors)
+    {
+        pVoc->transform(descriptors.ptr<unsigned char>(),descriptors.step,descriptors.rows,mBowVec,mFeatVec,4);
+        mFlatFeatVec.Build(mFeatVec);
+        mFlatBowVec.Build(mBowVec);
+        computed.set_value();
+    }
+};
 
 void Frame::ComputeBoW()
 {
+    if(mpPendingBoW)
+    {
+        std::shared_ptr<PendingBoW> pPending = mpPendingBoW;
+        mpPendingBoW.reset();
+
+        if(!pPending->bClaimed.exchange(true))
+            pPending->Compute(mpORBvocabulary,mDescriptors);
+        else
+            pPending->done.wait();
+
+        mBowVec = pPending->mBowVec;
+        mFeatVec = pPending->mFeatVec;
+        mFlatFeatVec = pPending->mFlatFeatVec;
+        mFlatBowVec = pPending->mFlatBowVec;
+        return;
+    }
+
     if(mBowVec.empty())
     {
-        vector<cv::Mat> vCurrentDesc = Converter::toDescriptorVector(mDescriptors);
-        mpORBvocabulary->transform(vCurrentDesc,mBowVec,mFeatVec,4);
+        VocabularyLoader::WaitUntilLoaded(mpORBvocabulary);
+        mpORBvocabulary->transform(mDescriptors.ptr<unsigned char>(),mDescriptors.step,mDescriptors.rows,mBowVec,mFeatVec,4);
+        mFlatFeatVec.Build(mFeatVec);
+        mFlatBowVec.Build(mBowVec);
     }
 }
 
-void Frame::UndistortKeyPoints()
+void Frame::ComputeBoWAsync(ThreadPool* pThreadPool)
 {
-    if(mDistCoef.at<float>(0)==0.0)
-    {
-        mvKeysUn=mvKeys;
+    if(!mBowVec.empty() || mpPendingBoW || !pThreadPool || pThreadPool->GetNumThreads()==0)
+        return;
+    // A worker would only wait for the vocabulary, ComputeBoW does it if the BoW is needed
+    if(!VocabularyLoader::IsLoaded(mpORBvocabulary))
         return;
-    }
 
-    // Fill matrix with points
-    cv::Mat mat(N,2,CV_32F);
+    // The task only holds the shared state, the frame can be copied or destroyed meanwhile
+    std::shared_ptr<PendingBoW> pPending = std::make_shared<PendingBoW>();
+    ORBVocabulary* pVoc = mpORBvocabulary;
+    const cv::Mat descriptors = mDescriptors;
+    pThreadPool->Submit([pPending,pVoc,descriptors]
+    {
+        if(!pPending->bClaimed.exchange(true))
+            pPending->Compute(pVoc,descriptors);
+    });
 
-    for(int i=0; i<N; i++)
+    mpPendingBoW = pPending;
+}
+
+bool Frame::isBoWPending() const
+{
+    return static_cast<bool>(mpPendingBoW);
+}
+
+// Inverse of the radial-tangential distortion with the fixed-point iteration of cv::undistortPoints
+// (5 steps, no rotation), in double as OpenCV does. Applied point by point, so nothing is allocated
+// per frame. K is the distorted camera, P the output camera matrix.
+struct RadTanUndistorter
+{
+    RadTanUndistorter(const cv::Matx33f &K, const cv::Mat &distCoef, const cv::Mat &P)
     {
-        mat.at<float>(i,0)=mvKeys[i].pt.x;
-        mat.at<float>(i,1)=mvKeys[i].pt.y;
+        ifx = 1.0/K(0,0); ify = 1.0/K(1,1);
+        cx = K(0,2); cy = K(1,2);
+        pfx = P.at<float>(0,0); pfy = P.at<float>(1,1);
+        pcx = P.at<float>(0,2); pcy = P.at<float>(1,2);
+
+        k1 = distCoef.at<float>(0);
+        k2 = distCoef.at<float>(1);
+        p1 = distCoef.at<float>(2);
+        p2 = distCoef.at<float>(3);
+        k3 = distCoef.total() == 5 ? distCoef.at<float>(4) : 0.0;
     }
 
-    // Undistort points
-    mat=mat.reshape(2);
-    cv::undistortPoints(mat,mat, static_cast<Pinhole*>(mpCamera)->toK(),mDistCoef,cv::Mat(),mK);
-    mat=mat.reshape(1);
+    cv::Point2f operator()(const cv::Point2f &pt) const
+    {
+        const double x0 = (pt.x-cx)*ifx;
+        const double y0 = (pt.y-cy)*ify;
+        double x = x0, y = y0;
+        for(int j=0; j<5; j++)
+        {
+            const double r2 = x*x + y*y;
+            const double icdist = 1.0/(1.0 + ((k3*r2 + k2)*r2 + k1)*r2);
+            const double deltaX = 2.0*p1*x*y + p2*(r2 + 2.0*x*x);
+            const double deltaY = p1*(r2 + 2.0*y*y) + 2.0*p2*x*y;
+            x = (x0 - deltaX)*icdist;
+            y = (y0 - deltaY)*icdist;
+        }
+        return cv::Point2f(x*pfx + pcx, y*pfy + pcy);
+    }
+
+    double ifx, ify, cx, cy, pfx, pfy, pcx, pcy;
+    double k1, k2, p1, p2, k3;
+};
+
+void Frame::UndistortKeyPoints()
+{
+    if(mDistCoef.at<float>(0)==0.0)
+    {
+        mvKeysUn=mvKeys;
+        return;
+    }
 
+    const RadTanUndistorter undistort(static_cast<Pinhole*>(mpCamera)->toK_(),mDistCoef,mK);
 
     // Fill undistorted keypoint vector
-    mvKeysUn.resize(N);
+    vector<cv::KeyPoint> &vKeysUn = mvKeysUn.Replace();
+    vKeysUn.resize(N);
     for(int i=0; i<N; i++)
     {
-        cv::KeyPoint kp = mvKeys[i];
-        kp.pt.x=mat.at<float>(i,0);
-        kp.pt.y=mat.at<float>(i,1);
-        mvKeysUn[i]=kp;
+        vKeysUn[i] = mvKeys[i];
+        vKeysUn[i].pt = undistort(mvKeys[i].pt);
     }
+}
 
+void Frame::ComputeCalibration(const cv::Mat &im)
+{
+    ComputeImageBounds(im);
+
+    CameraGridSize(mpCamera,mnGridCols,mnGridRows);
+    mfGridElementWidthInv=static_cast<float>(mnGridCols)/static_cast<float>(mnMaxX-mnMinX);
+    mfGridElementHeightInv=static_cast<float>(mnGridRows)/static_cast<float>(mnMaxY-mnMinY);
+
+    fx = mK.at<float>(0,0);
+    fy = mK.at<float>(1,1);
+    cx = mK.at<float>(0,2);
+    cy = mK.at<float>(1,2);
+    invfx = 1.0f/fx;
+    invfy = 1.0f/fy;
 }
 
 void Frame::ComputeImageBounds(const cv::Mat &imLeft)
 {
     if(mDistCoef.at<float>(0)!=0.0)
     {
-        cv::Mat mat(4,2,CV_32F);
-        mat.at<float>(0,0)=0.0; mat.at<float>(0,1)=0.0;
-        mat.at<float>(1,0)=imLeft.cols; mat.at<float>(1,1)=0.0;
-        mat.at<float>(2,0)=0.0; mat.at<float>(2,1)=imLeft.rows;
-        mat.at<float>(3,0)=imLeft.cols; mat.at<float>(3,1)=imLeft.rows;
-
-        mat=mat.reshape(2);
-        cv::undistortPoints(mat,mat,static_cast<Pinhole*>(mpCamera)->toK(),mDistCoef,cv::Mat(),mK);
-        mat=mat.reshape(1);
+        const RadTanUndistorter undistort(static_cast<Pinhole*>(mpCamera)->toK_(),mDistCoef,mK);
 
         // Undistort corners
-        mnMinX = min(mat.at<float>(0,0),mat.at<float>(2,0));
-        mnMaxX = max(mat.at<float>(1,0),mat.at<float>(3,0));
-        mnMinY = min(mat.at<float>(0,1),mat.at<float>(1,1));
-        mnMaxY = max(mat.at<float>(2,1),mat.at<float>(3,1));
+        const cv::Point2f tl = undistort(cv::Point2f(0.0f,0.0f));
+        const cv::Point2f tr = undistort(cv::Point2f((float)imLeft.cols,0.0f));
+        const cv::Point2f bl = undistort(cv::Point2f(0.0f,(float)imLeft.rows));
+        const cv::Point2f br = undistort(cv::Point2f((float)imLeft.cols,(float)imLeft.rows));
+        mnMinX = min(tl.x,bl.x);
+        mnMaxX = max(tr.x,br.x);
+        mnMinY = min(tl.y,tr.y);
+        mnMaxY = max(bl.y,br.y);
     }
     else
     {
@@ -794,6 +1166,89 @@ void Frame::ComputeImageBounds(const cv::Mat &imLeft)
     }
 }
 
+void RigView::Build(const vector<cv::KeyPoint> &vKeys, const cv::Mat &descriptors, const cv::Mat &distCoef, const cv::Size &imSize)
+{
+    const int N = vKeys.size();
+    vector<cv::KeyPoint> &vKeysUn = mvKeysUn.Replace();
+    vKeysUn = vKeys;
+    mDescriptors = descriptors;
+
+    mnMinX = 0.0f;
+    mnMaxX = imSize.width;
+    mnMinY = 0.0f;
+    mnMaxY = imSize.height;
+
+    // Pinhole cameras with distortion: keypoints and image bounds undistorted as in the main camera
+    if(!distCoef.empty() && distCoef.at<float>(0)!=0.0f)
+    {
+        const cv::Matx33f K = static_cast<Pinhole*>(pCamera)->toK_();
+        const RadTanUndistorter undistort(K,distCoef,cv::Mat(K));
+
+        for(int i=0; i<N; i++)
+            vKeysUn[i].pt = undistort(vKeys[i].pt);
+
+        const cv::Point2f tl = undistort(cv::Point2f(0.0f,0.0f));
+        const cv::Point2f tr = undistort(cv::Point2f((float)imSize.width,0.0f));
+        const cv::Point2f bl = undistort(cv::Point2f(0.0f,(float)imSize.height));
+        const cv::Point2f br = undistort(cv::Point2f((float)imSize.width,(float)imSize.height));
+        mnMinX = min(tl.x,bl.x);
+        mnMaxX = max(tr.x,br.x);
+        mnMinY = min(tl.y,tr.y);
+        mnMaxY = max(bl.y,br.y);
+    }
+
+    CameraGridSize(pCamera,mnGridCols,mnGridRows);
+    mfGridElementWidthInv = static_cast<float>(mnGridCols)/(mnMaxX-mnMinX);
+    mfGridElementHeightInv = static_cast<float>(mnGridRows)/(mnMaxY-mnMinY);
+
+    vector<int> vCells(N);
+    for(int i=0; i<N; i++)
+    {
+        const int posX = round((vKeysUn[i].pt.x-mnMinX)*mfGridElementWidthInv);
+        const int posY = round((vKeysUn[i].pt.y-mnMinY)*mfGridElementHeightInv);
+        if(posX<0 || posX>=mnGridCols || posY<0 || posY>=mnGridRows)
+            vCells[i] = -1;
+        else
+            vCells[i] = posX*mnGridRows + posY;
+    }
+    mGrid.Build(mnGridCols, mnGridRows, vCells.data(), N);
+
+    mvpMapPoints.assign(N,static_cast<MapPoint*>(NULL));
+    mvbOutlier.assign(N,false);
+}
+
+// Sum of absolute differences between two 11x11 patches of 8-bit images, given by their
+// top-left pixel. Each row is read as 16 bytes and masked down to 11, which relies on the
+// EDGE_THRESHOLD border the ORB extractor keeps around every pyramid level.
+static inline int PatchSAD11(const unsigned char* pL, const size_t stepL, const unsigned char* pR, const size_t stepR)
+{
+#if defined(__SSE2__)
+    const __m128i mask = _mm_setr_epi8(-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,0,0,0,0,0);
+    __m128i acc = _mm_setzero_si128();
+    for(int r=0; r<11; r++, pL+=stepL, pR+=stepR)
+    {
+        const __m128i l = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pL)),mask);
+        const __m128i rr = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pR)),mask);
+        acc = _mm_add_epi64(acc,_mm_sad_epu8(l,rr));
+    }
+    return _mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc,8));
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    static const uint8_t maskBytes[16] = {255,255,255,255,255,255,255,255,255,255,255,0,0,0,0,0};
+    const uint8x16_t mask = vld1q_u8(maskBytes);
+    uint16x8_t acc = vdupq_n_u16(0);
+    for(int r=0; r<11; r++, pL+=stepL, pR+=stepR)
+        acc = vpadalq_u8(acc,vandq_u8(vabdq_u8(vld1q_u8(pL),vld1q_u8(pR)),mask));
+    const uint64x2_t sum = vpaddlq_u32(vpaddlq_u16(acc));
+    return (int)(vgetq_lane_u64(sum,0) + vgetq_lane_u64(sum,1));
+#else
+    int sad = 0;
+    for(int r=0; r<11; r++, pL+=stepL, pR+=stepR)
+        for(int c=0; c<11; c++)
+            sad += abs((int)pL[c]-(int)pR[c]);
+    return sad;
+#endif
+}
+
 void Frame::ComputeStereoMatches()
 {
     mvuRight = vector<float>(N,-1.0f);
@@ -801,7 +1256,7 @@ void Frame::ComputeStereoMatches()
 
     const int thOrbDist = (ORBmatcher::TH_HIGH+ORBmatcher::TH_LOW)/2;
 
-    const int nRows = mpORBextractorLeft->mvImagePyramid[0].rows;
+    const int nRows = mpORBextractorLeft->mImageSize.height;
 
     //Assign keypoints to row table
     vector<vector<size_t> > vRowIndices(nRows,vector<size_t>());
@@ -828,11 +1283,11 @@ void Frame::ComputeStereoMatches()
     const float minD = 0;
     const float maxD = mbf/minZ;
 
-    // For each left keypoint search a match in the right image
-    vector<pair<int, int> > vDistIdx;
-    vDistIdx.reserve(N);
+    // For each left keypoint search a match in the right image. Every keypoint only writes
+    // its own entries, so they are searched in parallel and the SAD scores gathered after.
+    vector<int> vBestSAD(N,-1);
 
-    for(int iL=0; iL<N; iL++)
+    auto matchKeyPoint = [&](int iL)
     {
         const cv::KeyPoint &kpL = mvKeys[iL];
         const int &levelL = kpL.octave;
@@ -842,13 +1297,13 @@ void Frame::ComputeStereoMatches()
         const vector<size_t> &vCandidates = vRowIndices[vL];
 
         if(vCandidates.empty())
-            continue;
+            return;
 
         const float minU = uL-maxD;
         const float maxU = uL-minD;
 
         if(maxU<0)
-            continue;
+            return;
 
         int bestDist = ORBmatcher::TH_HIGH;
         size_t bestIdxR = 0;
@@ -891,24 +1346,24 @@ void Frame::ComputeStereoMatches()
 
             // sliding window search
             const int w = 5;
-            cv::Mat IL = mpORBextractorLeft->mvImagePyramid[kpL.octave].rowRange(scaledvL-w,scaledvL+w+1).colRange(scaleduL-w,scaleduL+w+1);
+            const cv::Mat &imL = mpORBextractorLeft->mvImagePyramid[kpL.octave];
+            const cv::Mat &imR = mpORBextractorRight->mvImagePyramid[kpL.octave];
+            const unsigned char* pIL = imL.ptr<unsigned char>(scaledvL-w) + (int)scaleduL-w;
 
             int bestDist = INT_MAX;
             int bestincR = 0;
             const int L = 5;
-            vector<float> vDists;
-            vDists.resize(2*L+1);
+            float vDists[2*L+1];
 
             const float iniu = scaleduR0+L-w;
             const float endu = scaleduR0+L+w+1;
-            if(iniu<0 || endu >= mpORBextractorRight->mvImagePyramid[kpL.octave].cols)
-                continue;
+            if(iniu<0 || endu >= imR.cols)
+                return;
 
+            const unsigned char* pIR0 = imR.ptr<unsigned char>(scaledvL-w) + (int)scaleduR0-w;
             for(int incR=-L; incR<=+L; incR++)
             {
-                cv::Mat IR = mpORBextractorRight->mvImagePyramid[kpL.octave].rowRange(scaledvL-w,scaledvL+w+1).colRange(scaleduR0+incR-w,scaleduR0+incR+w+1);
-
-                float dist = cv::norm(IL,IR,cv::NORM_L1);
+                const int dist = PatchSAD11(pIL,imL.step,pIR0+incR,imR.step);
                 if(dist<bestDist)
                 {
                     bestDist =  dist;
@@ -919,7 +1374,7 @@ void Frame::ComputeStereoMatches()
             }
 
             if(bestincR==-L || bestincR==L)
-                continue;
+                return;
 
             // Sub-pixel match (Parabola fitting)
             const float dist1 = vDists[L+bestincR-1];
@@ -929,7 +1384,7 @@ void Frame::ComputeStereoMatches()
             const float deltaR = (dist1-dist3)/(2.0f*(dist1+dist3-2.0f*dist2));
 
             if(deltaR<-1 || deltaR>1)
-                continue;
+                return;
 
             // Re-scaled coordinate
             float bestuR = mvScaleFactors[kpL.octave]*((float)scaleduR0+(float)bestincR+deltaR);
@@ -945,11 +1400,27 @@ void Frame::ComputeStereoMatches()
                 }
                 mvDepth[iL]=mbf/disparity;
                 mvuRight[iL] = bestuR;
-                vDistIdx.push_back(pair<int,int>(bestDist,iL));
+                vBestSAD[iL] = bestDist;
             }
         }
+    };
+
+    ThreadPool* pThreadPool = mpORBextractorLeft->GetThreadPool();
+    if(pThreadPool && N>1)
+        pThreadPool->ParallelFor(0,N,matchKeyPoint);
+    else
+    {
+        for(int iL=0; iL<N; iL++)
+            matchKeyPoint(iL);
     }
 
+    vector<pair<int, int> > vDistIdx;
+    vDistIdx.reserve(N);
+    for(int iL=0; iL<N; iL++)
+        if(vBestSAD[iL]>=0)
+            vDistIdx.push_back(pair<int,int>(vBestSAD[iL],iL));
+
+
     sort(vDistIdx.begin(),vDistIdx.end());
     const float median = vDistIdx[vDistIdx.size()/2].first;
     const float thDist = 1.5f*1.4f*median;
@@ -967,25 +1438,96 @@ void Frame::ComputeStereoMatches()
 }
 
 
-void Frame::ComputeStereoFromRGBD(const cv::Mat &imDepth)
+void Frame::ComputeStereoFromRGBD(const cv::Mat &imDepth, const float depthFactor, const bool bDisparity)
 {
-    mvuRight = vector<float>(N,-1);
-    mvDepth = vector<float>(N,-1);
+    mvuRight.resize(N);
+    mvDepth.resize(N);
 
-    for(int i=0; i<N; i++)
+    // Raw depth at the keypoints and their undistorted x, gathered into contiguous arrays so that
+    // the conversion below runs on 4 keypoints at a time
+    vector<float> vRaw(N), vUn(N);
+    if(imDepth.type()==CV_16U)
     {
-        const cv::KeyPoint &kp = mvKeys[i];
-        const cv::KeyPoint &kpU = mvKeysUn[i];
-
-        const float &v = kp.pt.y;
-        const float &u = kp.pt.x;
+        for(int i=0; i<N; i++)
+        {
+            const cv::Point2f &pt = mvKeys[i].pt;
+            vRaw[i] = imDepth.ptr<unsigned short>((int)pt.y)[(int)pt.x];
+            vUn[i] = mvKeysUn[i].pt.x;
+        }
+    }
+    else
+    {
+        CV_Assert(imDepth.type()==CV_32F);
+        for(int i=0; i<N; i++)
+        {
+            const cv::Point2f &pt = mvKeys[i].pt;
+            vRaw[i] = imDepth.ptr<float>((int)pt.y)[(int)pt.x];
+            vUn[i] = mvKeysUn[i].pt.x;
+        }
+    }
 
-        const float d = imDepth.at<float>(v,u);
+    // Disparity maps (in pixels once scaled by depthFactor) are turned into depths here, at the
+    // keypoints only, so that the conversion below is the same for both
+    float factor = depthFactor;
+    if(bDisparity)
+    {
+        for(int i=0; i<N; i++)
+        {
+            const float disparity = vRaw[i]*depthFactor;
+            vRaw[i] = disparity>0 ? mbf/disparity : 0.0f;
+        }
+        factor = 1.0f;
+    }
 
+    // depth = raw*factor, uRight = uUn-bf/depth, both -1 where the depth is not positive (or NaN)
+    float* pDepth = mvDepth.data();
+    float* pRight = mvuRight.data();
+    int i=0;
+#if defined(__SSE2__)
+    const __m128 vFactor = _mm_set1_ps(factor);
+    const __m128 bf = _mm_set1_ps(mbf);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 invalid = _mm_set1_ps(-1.0f);
+    for(; i+4<=N; i+=4)
+    {
+        const __m128 d = _mm_mul_ps(_mm_loadu_ps(&vRaw[i]),vFactor);
+        const __m128 valid = _mm_cmpgt_ps(d,zero);
+        // Division by 1 where invalid, the lane is discarded anyway
+        const __m128 uR = _mm_sub_ps(_mm_loadu_ps(&vUn[i]),_mm_div_ps(bf,_mm_or_ps(_mm_and_ps(valid,d),_mm_andnot_ps(valid,_mm_set1_ps(1.0f)))));
+        _mm_storeu_ps(pDepth+i,_mm_or_ps(_mm_and_ps(valid,d),_mm_andnot_ps(valid,invalid)));
+        _mm_storeu_ps(pRight+i,_mm_or_ps(_mm_and_ps(valid,uR),_mm_andnot_ps(valid,invalid)));
+    }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    const float32x4_t bf = vdupq_n_f32(mbf);
+    const float32x4_t zero = vdupq_n_f32(0.0f);
+    const float32x4_t one = vdupq_n_f32(1.0f);
+    const float32x4_t invalid = vdupq_n_f32(-1.0f);
+    for(; i+4<=N; i+=4)
+    {
+        const float32x4_t d = vmulq_n_f32(vld1q_f32(&vRaw[i]),factor);
+        const uint32x4_t valid = vcgtq_f32(d,zero);
+        // Reciprocal estimate refined by two Newton steps (full float precision)
+        const float32x4_t den = vbslq_f32(valid,d,one);
+        float32x4_t inv = vrecpeq_f32(den);
+        inv = vmulq_f32(inv,vrecpsq_f32(den,inv));
+        inv = vmulq_f32(inv,vrecpsq_f32(den,inv));
+        const float32x4_t uR = vsubq_f32(vld1q_f32(&vUn[i]),vmulq_f32(bf,inv));
+        vst1q_f32(pDepth+i,vbslq_f32(valid,d,invalid));
+        vst1q_f32(pRight+i,vbslq_f32(valid,uR,invalid));
+    }
+#endif
+    for(; i<N; i++)
+    {
+        const float d = vRaw[i]*factor;
         if(d>0)
         {
-            mvDepth[i] = d;
-            mvuRight[i] = kpU.pt.x-mbf/d;
+            pDepth[i] = d;
+            pRight[i] = vUn[i]-mbf/d;
+        }
+        else
+        {
+            pDepth[i] = -1;
+            pRight[i] = -1;
         }
     }
 }
@@ -1018,15 +1560,13 @@ void Frame::setIntegrated()
     mbImuPreintegrated = true;
 }
 
-Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeStamp, ORBextractor* extractorLeft, ORBextractor* extractorRight, ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth, GeometricCamera* pCamera, GeometricCamera* pCamera2, cv::Mat& Tlr,Frame* pPrevF, const IMU::Calib &ImuCalib)
-        :mpcpi(NULL), mpORBvocabulary(voc),mpORBextractorLeft(extractorLeft),mpORBextractorRight(extractorRight), mTimeStamp(timeStamp), mK(K.clone()), mDistCoef(distCoef.clone()), mbf(bf), mThDepth(thDepth),
+Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeStamp, FeatureExtractor* extractorLeft, FeatureExtractor* extractorRight, ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth, GeometricCamera* pCamera, GeometricCamera* pCamera2, cv::Mat& Tlr, SystemContext* pContext, Frame* pPrevF, const IMU::Calib &ImuCalib)
+        :mpcpi(NULL), mpContext(pContext), mpORBvocabulary(voc),mpORBextractorLeft(extractorLeft),mpORBextractorRight(extractorRight), mTimeStamp(timeStamp), mK(K.clone()), mDistCoef(distCoef.clone()), mbf(bf), mThDepth(thDepth),
          mImuCalib(ImuCalib), mpImuPreintegrated(NULL), mpPrevFrame(pPrevF),mpImuPreintegratedFrame(NULL), mpReferenceKF(static_cast<KeyFrame*>(NULL)), mbImuPreintegrated(false), mpCamera(pCamera), mpCamera2(pCamera2), mTlr(Tlr)
 {
-    imgLeft = imLeft.clone();
-    imgRight = imRight.clone();
-
+    ORB_TRACE_SCOPE("Frame::Frame");
     // Frame ID
-    mnId=nNextId++;
+    mnId=mpContext->mnNextFrameId++;
 
     // Scale Level Info
     mnScaleLevels = mpORBextractorLeft->GetLevels();
@@ -1037,45 +1577,28 @@ Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeSt
     mvLevelSigma2 = mpORBextractorLeft->GetScaleSigmaSquares();
     mvInvLevelSigma2 = mpORBextractorLeft->GetInverseScaleSigmaSquares();
 
+    // Calibration of this frame (each System may have its own camera)
+    ComputeCalibration(imLeft);
+
     // ORB extraction
-#ifdef REGISTER_TIMES
     std::chrono::steady_clock::time_point time_StartExtORB = std::chrono::steady_clock::now();
-#endif
-    thread threadLeft(&Frame::ExtractORB,this,0,imLeft,static_cast<KannalaBrandt8*>(mpCamera)->mvLappingArea[0],static_cast<KannalaBrandt8*>(mpCamera)->mvLappingArea[1]);
-    thread threadRight(&Frame::ExtractORB,this,1,imRight,static_cast<KannalaBrandt8*>(mpCamera2)->mvLappingArea[0],static_cast<KannalaBrandt8*>(mpCamera2)->mvLappingArea[1]);
-    threadLeft.join();
-    threadRight.join();
-#ifdef REGISTER_TIMES
+    ExtractORBStereo(imLeft,imRight,static_cast<KannalaBrandt8*>(mpCamera)->mvLappingArea[0],static_cast<KannalaBrandt8*>(mpCamera)->mvLappingArea[1],
+                     static_cast<KannalaBrandt8*>(mpCamera2)->mvLappingArea[0],static_cast<KannalaBrandt8*>(mpCamera2)->mvLappingArea[1]);
     std::chrono::steady_clock::time_point time_EndExtORB = std::chrono::steady_clock::now();
 
     mTimeORB_Ext = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(time_EndExtORB - time_StartExtORB).count();
-#endif
+    mbFocusedExtraction = mpORBextractorLeft->IsFocused();
+    mbReducedResolution = mpORBextractorLeft->GetFirstLevel()>0;
+    mbFlowTracked = false;
 
     Nleft = mvKeys.size();
+    mCameraSetup = CAMERA_SPLIT;
     Nright = mvKeysRight.size();
     N = Nleft + Nright;
 
     if(N == 0)
         return;
 
-    // This is done only for the first Frame (or after a change in the calibration)
-    if(mbInitialComputations)
-    {
-        ComputeImageBounds(imLeft);
-
-        mfGridElementWidthInv=static_cast<float>(FRAME_GRID_COLS)/(mnMaxX-mnMinX);
-        mfGridElementHeightInv=static_cast<float>(FRAME_GRID_ROWS)/(mnMaxY-mnMinY);
-
-        fx = K.at<float>(0,0);
-        fy = K.at<float>(1,1);
-        cx = K.at<float>(0,2);
-        cy = K.at<float>(1,2);
-        invfx = 1.0f/fx;
-        invfy = 1.0f/fy;
-
-        mbInitialComputations=false;
-    }
-
     mb = mbf / fx;
 
     mRlr = mTlr.rowRange(0,3).colRange(0,3);
@@ -1093,15 +1616,11 @@ Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeSt
                         mRlr.at<float>(1,0), mRlr.at<float>(1,1), mRlr.at<float>(1,2), mtlr.at<float>(1),
                         mRlr.at<float>(2,0), mRlr.at<float>(2,1), mRlr.at<float>(2,2), mtlr.at<float>(2));
 
-#ifdef REGISTER_TIMES
     std::chrono::steady_clock::time_point time_StartStereoMatches = std::chrono::steady_clock::now();
-#endif
     ComputeStereoFishEyeMatches();
-#ifdef REGISTER_TIMES
     std::chrono::steady_clock::time_point time_EndStereoMatches = std::chrono::steady_clock::now();
 
     mTimeStereoMatch = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(time_EndStereoMatches - time_StartStereoMatches).count();
-#endif
 
     //Put all descriptors in the same matrix
     cv::vconcat(mDescriptors,mDescriptorsRight,mDescriptors);
@@ -1116,13 +1635,17 @@ Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeSt
     UndistortKeyPoints();
 }
 
+// Epipolar search of the stereo fisheye matches: pixel error (at level 0) allowed between a
+// keypoint and the epipolar plane, and minimum sine of the angle between a right bearing and the
+// baseline for it to be looked up by its angle around the baseline (rays closer to the epipole
+// are few and are checked one by one)
+const float FISHEYE_EPIPOLAR_TH = 3.0f;
+const float FISHEYE_MIN_SIN_BASELINE = 0.2f;
+
 void Frame::ComputeStereoFishEyeMatches() {
     //Speed it up by matching keypoints in the lapping area
-    vector<cv::KeyPoint> stereoLeft(mvKeys.begin() + monoLeft, mvKeys.end());
-    vector<cv::KeyPoint> stereoRight(mvKeysRight.begin() + monoRight, mvKeysRight.end());
-
-    cv::Mat stereoDescLeft = mDescriptors.rowRange(monoLeft, mDescriptors.rows);
-    cv::Mat stereoDescRight = mDescriptorsRight.rowRange(monoRight, mDescriptorsRight.rows);
+    const int nStereoLeft = Nleft - monoLeft;
+    const int nStereoRight = Nright - monoRight;
 
     mvLeftToRightMatch = vector<int>(Nleft,-1);
     mvRightToLeftMatch = vector<int>(Nright,-1);
@@ -1131,29 +1654,144 @@ void Frame::ComputeStereoFishEyeMatches() {
     mvStereo3Dpoints = vector<cv::Mat>(Nleft);
     mnCloseMPs = 0;
 
-    //Perform a brute force between Keypoint in the left and right image
-    vector<vector<cv::DMatch>> matches;
+    if(nStereoLeft<=0 || nStereoRight<=0)
+        return;
+
+    // Every epipolar plane contains the baseline, so it is given by its angle around it. Seen
+    // from the right camera the baseline points to the left camera centre trl, and a point with
+    // positive depth on a left ray keeps the angle of the ray: matches lie in the same half plane.
+    // A bearing at angle a and sine s from the baseline is s*sin(a-a') away from the plane a'.
+    const cv::Matx33f Rrl = mTrlx.get_minor<3,3>(0,0);
+    const cv::Matx31f trl = mTrlx.get_minor<3,1>(0,3);
+    const cv::Vec3f b = cv::normalize(cv::Vec3f(trl(0),trl(1),trl(2)));
+    cv::Vec3f e1 = std::abs(b[0])<0.9f ? cv::Vec3f(1,0,0) : cv::Vec3f(0,1,0);
+    e1 = cv::normalize(e1-b*e1.dot(b));
+    const cv::Vec3f e2 = b.cross(e1);
+
+    // Angle around the baseline and sine of the angle to it of a bearing
+    auto baselineCoords = [&](const cv::Vec3f &ray, float &angle, float &sinBaseline)
+    {
+        const cv::Vec3f f = cv::normalize(ray);
+        const float c1 = f.dot(e1), c2 = f.dot(e2);
+        angle = std::atan2(c2,c1);
+        sinBaseline = std::sqrt(c1*c1+c2*c2);
+    };
+
+    // Right bearings, sorted by angle unless they are close to the epipole
+    vector<float> vAngleRight(nStereoRight), vSinRight(nStereoRight);
+    vector<pair<float,int> > vSortedRight;
+    vector<int> vNearEpipoleRight;
+    vSortedRight.reserve(nStereoRight);
+    for(int r=0; r<nStereoRight; r++)
+    {
+        const cv::Point3f ray = mpCamera2->unproject(mvKeysRight[monoRight+r].pt);
+        baselineCoords(cv::Vec3f(ray.x,ray.y,ray.z),vAngleRight[r],vSinRight[r]);
+        if(vSinRight[r]>=FISHEYE_MIN_SIN_BASELINE)
+            vSortedRight.push_back(make_pair(vAngleRight[r],r));
+        else
+            vNearEpipoleRight.push_back(r);
+    }
+    sort(vSortedRight.begin(),vSortedRight.end());
 
-    BFmatcher.knnMatch(stereoDescLeft,stereoDescRight,matches,2);
+    // Allowed angle (radians) between a keypoint and the plane, per pyramid level
+    const float invFocal = 1.0f/mpCamera->getParameter(0);
+    vector<float> vLevelError(mnScaleLevels);
+    for(int i=0; i<mnScaleLevels; i++)
+        vLevelError[i] = FISHEYE_EPIPOLAR_TH*mvScaleFactors[i]*invFocal;
+    const float maxErrorRight = vLevelError.back()/FISHEYE_MIN_SIN_BASELINE;
+
+    const int descBytes = ORBmatcher::DESCRIPTOR_BYTES;
+    vector<int> vCandidates;
+    vector<unsigned char> vCandidateDesc;
+    vCandidates.reserve(nStereoRight);
+    vCandidateDesc.reserve(nStereoRight*descBytes);
 
     int nMatches = 0;
     int descMatches = 0;
 
-    //Check matches using Lowe's ratio
-    for(vector<vector<cv::DMatch>>::iterator it = matches.begin(); it != matches.end(); ++it){
-        if((*it).size() >= 2 && (*it)[0].distance < (*it)[1].distance * 0.7){
-            //For every good match, check parallax and reprojection error to discard spurious matches
-            cv::Mat p3D;
-            descMatches++;
-            float sigma1 = mvLevelSigma2[mvKeys[(*it)[0].queryIdx + monoLeft].octave], sigma2 = mvLevelSigma2[mvKeysRight[(*it)[0].trainIdx + monoRight].octave];
-            float depth = static_cast<KannalaBrandt8*>(mpCamera)->TriangulateMatches(mpCamera2,mvKeys[(*it)[0].queryIdx + monoLeft],mvKeysRight[(*it)[0].trainIdx + monoRight],mRlr,mtlr,sigma1,sigma2,p3D);
-            if(depth > 0.0001f){
-                mvLeftToRightMatch[(*it)[0].queryIdx + monoLeft] = (*it)[0].trainIdx + monoRight;
-                mvRightToLeftMatch[(*it)[0].trainIdx + monoRight] = (*it)[0].queryIdx + monoLeft;
-                mvStereo3Dpoints[(*it)[0].queryIdx + monoLeft] = p3D.clone();
-                mvDepth[(*it)[0].queryIdx + monoLeft] = depth;
-                nMatches++;
+    for(int l=0; l<nStereoLeft; l++)
+    {
+        const int idxL = monoLeft+l;
+        const cv::KeyPoint &kpL = mvKeys[idxL];
+        const cv::Point3f ray = mpCamera->unproject(kpL.pt);
+        const cv::Matx31f rayRight = Rrl*cv::Matx31f(ray.x,ray.y,ray.z);
+        float angleL, sinL;
+        baselineCoords(cv::Vec3f(rayRight(0),rayRight(1),rayRight(2)),angleL,sinL);
+
+        // Errors of the left ray turn the plane by err/sinL, those of the right one by err/sinR
+        const float tolL = vLevelError[kpL.octave]/std::max(sinL,1e-6f);
+
+        vCandidates.clear();
+        vCandidateDesc.clear();
+        auto checkCandidate = [&](const int r)
+        {
+            float dAngle = std::abs(vAngleRight[r]-angleL);
+            if(dAngle>CV_PI)
+                dAngle = 2*CV_PI-dAngle;
+            if(dAngle>=CV_PI/2)
+                return;
+            const float tol = tolL + vLevelError[mvKeysRight[monoRight+r].octave]/std::max(vSinRight[r],1e-6f);
+            if(std::sin(dAngle)>=tol)
+                return;
+            vCandidates.push_back(r);
+            const unsigned char* pDesc = mDescriptorsRight.ptr<unsigned char>(monoRight+r);
+            vCandidateDesc.insert(vCandidateDesc.end(),pDesc,pDesc+descBytes);
+        };
+
+        const float maxTol = tolL + maxErrorRight;
+        if(maxTol>=1.0f)
+        {
+            for(size_t k=0; k<vSortedRight.size(); k++)
+                checkCandidate(vSortedRight[k].second);
+        }
+        else
+        {
+            // Angle window of the sorted bearings, which wraps around at +-pi
+            const float window = std::asin(maxTol);
+            float ranges[3][2] = {{max(angleL-window,-float(CV_PI)),min(angleL+window,float(CV_PI))},{1,0},{1,0}};
+            if(angleL-window<-CV_PI)
+            {
+                ranges[1][0] = angleL-window+2*CV_PI;
+                ranges[1][1] = CV_PI;
+            }
+            if(angleL+window>CV_PI)
+            {
+                ranges[2][0] = -CV_PI;
+                ranges[2][1] = angleL+window-2*CV_PI;
             }
+            for(int k=0; k<3; k++)
+            {
+                vector<pair<float,int> >::const_iterator it = lower_bound(vSortedRight.begin(),vSortedRight.end(),make_pair(ranges[k][0],-1));
+                for(; it!=vSortedRight.end() && it->first<=ranges[k][1]; ++it)
+                    checkCandidate(it->second);
+            }
+        }
+        for(size_t k=0; k<vNearEpipoleRight.size(); k++)
+            checkCandidate(vNearEpipoleRight[k]);
+
+        if(vCandidates.empty())
+            continue;
+
+        int bestDist, bestIdx, bestDist2, bestIdx2;
+        ORBmatcher::BestDescriptorMatches(mDescriptors.ptr<unsigned char>(idxL),vCandidateDesc.data(),vCandidates.size(),
+                                          bestDist,bestIdx,bestDist2,bestIdx2);
+
+        //Check matches using Lowe's ratio (against the second best in the band)
+        if(bestIdx<0 || bestDist >= bestDist2*0.7f)
+            continue;
+
+        //For every good match, check parallax and reprojection error to discard spurious matches
+        const int idxR = monoRight+vCandidates[bestIdx];
+        cv::Mat p3D;
+        descMatches++;
+        float sigma1 = mvLevelSigma2[kpL.octave], sigma2 = mvLevelSigma2[mvKeysRight[idxR].octave];
+        float depth = static_cast<KannalaBrandt8*>(mpCamera)->TriangulateMatches(mpCamera2,kpL,mvKeysRight[idxR],mRlr,mtlr,sigma1,sigma2,p3D);
+        if(depth > 0.0001f){
+            mvLeftToRightMatch[idxL] = idxR;
+            mvRightToLeftMatch[idxR] = idxL;
+            mvStereo3Dpoints[idxL] = p3D.clone();
+            mvDepth[idxL] = depth;
+            nMatches++;
         }
     }
 }
@@ -27,70 +27,49 @@
 namespace ORB_SLAM3
 {
 
-FrameDrawer::FrameDrawer(Atlas* pAtlas):both(false),mpAtlas(pAtlas)
+FrameDrawer::FrameData::FrameData(): N(0), mbOnlyTracking(false), mState(Tracking::SYSTEM_NOT_READY)
 {
-    mState=Tracking::SYSTEM_NOT_READY;
     mIm = cv::Mat(480,640,CV_8UC3, cv::Scalar(0,0,0));
     mImRight = cv::Mat(480,640,CV_8UC3, cv::Scalar(0,0,0));
 }
 
+FrameDrawer::FrameDrawer(Atlas* pAtlas):both(false), mpWrite(&mvBuffers[0]), mpReady(&mvBuffers[1]), mpRead(&mvBuffers[2]),
+    mbNewData(false), mReadyState(Tracking::SYSTEM_NOT_READY), mnTracked(0), mnTrackedVO(0), mpAtlas(pAtlas)
+{
+}
+
 cv::Mat FrameDrawer::DrawFrame(bool bOldFeatures)
 {
-    cv::Mat im;
-    vector<cv::KeyPoint> vIniKeys; // Initialization: KeyPoints in reference frame
-    vector<int> vMatches; // Initialization: correspondeces with reference keypoints
-    vector<cv::KeyPoint> vCurrentKeys; // KeyPoints in current frame
-    vector<bool> vbVO, vbMap; // Tracked MapPoints in current frame
-    vector<pair<cv::Point2f, cv::Point2f> > vTracks;
-    int state; // Tracking state
-
-    Frame currentFrame;
-    vector<MapPoint*> vpLocalMap;
-    vector<cv::KeyPoint> vMatchesKeys;
-    vector<MapPoint*> vpMatchedMPs;
-    vector<cv::KeyPoint> vOutlierKeys;
-    vector<MapPoint*> vpOutlierMPs;
-    map<long unsigned int, cv::Point2f> mProjectPoints;
-    map<long unsigned int, cv::Point2f> mMatchedInImage;
-
-    //Copy variables within scoped mutex
+    //Take the last frame published by Tracking, if any. mpRead is only used by the viewer thread
     {
         unique_lock<mutex> lock(mMutex);
-        state=mState;
-        if(mState==Tracking::SYSTEM_NOT_READY)
-            mState=Tracking::NO_IMAGES_YET;
-
-        mIm.copyTo(im);
-
-        if(mState==Tracking::NOT_INITIALIZED)
-        {
-            vCurrentKeys = mvCurrentKeys;
-            vIniKeys = mvIniKeys;
-            vMatches = mvIniMatches;
-            vTracks = mvTracks;
-        }
-        else if(mState==Tracking::OK)
-        {
-            vCurrentKeys = mvCurrentKeys;
-            vbVO = mvbVO;
-            vbMap = mvbMap;
-
-            currentFrame = mCurrentFrame;
-            vpLocalMap = mvpLocalMap;
-            vMatchesKeys = mvMatchedKeys;
-            vpMatchedMPs = mvpMatchedMPs;
-            vOutlierKeys = mvOutlierKeys;
-            vpOutlierMPs = mvpOutlierMPs;
-            mProjectPoints = mmProjectPoints;
-            mMatchedInImage = mmMatchedInImage;
-
-        }
-        else if(mState==Tracking::LOST)
+        if(mbNewData)
         {
-            vCurrentKeys = mvCurrentKeys;
+            std::swap(mpRead,mpReady);
+            mbNewData = false;
         }
     }
 
+    FrameData &f = *mpRead;
+    const int state = f.mState; // Tracking state
+    if(f.mState==Tracking::SYSTEM_NOT_READY)
+        f.mState=Tracking::NO_IMAGES_YET;
+
+    cv::Mat im;
+    f.mIm.copyTo(im);
+
+    const vector<cv::KeyPoint> &vIniKeys = f.mvIniKeys; // Initialization: KeyPoints in reference frame
+    const vector<int> &vMatches = f.mvIniMatches; // Initialization: correspondeces with reference keypoints
+    const vector<cv::KeyPoint> &vCurrentKeys = f.mvCurrentKeys; // KeyPoints in current frame
+    const vector<bool> &vbVO = f.mvbVO, &vbMap = f.mvbMap; // Tracked MapPoints in current frame
+    const vector<pair<cv::Point2f, cv::Point2f> > &vTracks = f.mvTracks;
+
+    Frame &currentFrame = f.mCurrentFrame;
+    const vector<cv::KeyPoint> &vOutlierKeys = f.mvOutlierKeys;
+    const vector<MapPoint*> &vpOutlierMPs = f.mvpOutlierMPs;
+    const map<long unsigned int, cv::Point2f> &mProjectPoints = f.mmProjectPoints;
+    const map<long unsigned int, cv::Point2f> &mMatchedInImage = f.mmMatchedInImage;
+
     if(im.channels()<3) //this should be always true
         cvtColor(im,im,cv::COLOR_GRAY2BGR);
 
@@ -105,7 +84,7 @@ cv::Mat FrameDrawer::DrawFrame(bool bOldFeatures)
                         cv::Scalar(0,255,0));
             }
         }
-        for(vector<pair<cv::Point2f, cv::Point2f> >::iterator it=vTracks.begin(); it!=vTracks.end(); it++)
+        for(vector<pair<cv::Point2f, cv::Point2f> >::const_iterator it=vTracks.begin(); it!=vTracks.end(); it++)
             cv::line(im,(*it).first,(*it).second, cv::Scalar(0,255,0),5);
 
     }
@@ -159,7 +138,7 @@ cv::Mat FrameDrawer::DrawFrame(bool bOldFeatures)
             }
         }
 
-        map<long unsigned int, cv::Point2f>::iterator it_match = mMatchedInImage.begin();
+        map<long unsigned int, cv::Point2f>::const_iterator it_match = mMatchedInImage.begin();
         while(it_match != mMatchedInImage.end())
         {
             long unsigned int mp_id = it_match->first;
@@ -167,7 +146,7 @@ cv::Mat FrameDrawer::DrawFrame(bool bOldFeatures)
 
             if(mProjectPoints.find(mp_id) != mProjectPoints.end())
             {
-                cv::Point2f p_proj = mMatchedInImage[mp_id];
+                cv::Point2f p_proj = it_match->second;
                 cv::line(im, p_proj, p_image, cv::Scalar(0, 255, 0), 2);
                 nTracked2++;
             }
@@ -202,39 +181,17 @@ cv::Mat FrameDrawer::DrawFrame(bool bOldFeatures)
 
 cv::Mat FrameDrawer::DrawRightFrame()
 {
-    cv::Mat im;
-    vector<cv::KeyPoint> vIniKeys; // Initialization: KeyPoints in reference frame
-    vector<int> vMatches; // Initialization: correspondeces with reference keypoints
-    vector<cv::KeyPoint> vCurrentKeys; // KeyPoints in current frame
-    vector<bool> vbVO, vbMap; // Tracked MapPoints in current frame
-    int state; // Tracking state
+    // Same frame as the last DrawFrame
+    const FrameData &f = *mpRead;
+    const int state = f.mState; // Tracking state
 
-    //Copy variables within scoped mutex
-    {
-        unique_lock<mutex> lock(mMutex);
-        state=mState;
-        if(mState==Tracking::SYSTEM_NOT_READY)
-            mState=Tracking::NO_IMAGES_YET;
+    cv::Mat im;
+    f.mImRight.copyTo(im);
 
-        mImRight.copyTo(im);
-
-        if(mState==Tracking::NOT_INITIALIZED)
-        {
-            vCurrentKeys = mvCurrentKeysRight;
-            vIniKeys = mvIniKeys;
-            vMatches = mvIniMatches;
-        }
-        else if(mState==Tracking::OK)
-        {
-            vCurrentKeys = mvCurrentKeysRight;
-            vbVO = mvbVO;
-            vbMap = mvbMap;
-        }
-        else if(mState==Tracking::LOST)
-        {
-            vCurrentKeys = mvCurrentKeysRight;
-        }
-    } // destroy scoped mutex -> release mutex
+    const vector<cv::KeyPoint> &vIniKeys = f.mvIniKeys; // Initialization: KeyPoints in reference frame
+    const vector<int> &vMatches = f.mvIniMatches; // Initialization: correspondeces with reference keypoints
+    const vector<cv::KeyPoint> &vCurrentKeys = f.mvCurrentKeysRight; // KeyPoints in current frame
+    const vector<bool> &vbVO = f.mvbVO, &vbMap = f.mvbMap; // Tracked MapPoints in current frame
 
     if(im.channels()<3) //this should be always true
         cvtColor(im,im,cv::COLOR_GRAY2BGR);
@@ -256,30 +213,30 @@ cv::Mat FrameDrawer::DrawRightFrame()
         mnTracked=0;
         mnTrackedVO=0;
         const float r = 5;
-        const int n = mvCurrentKeysRight.size();
-        const int Nleft = mvCurrentKeys.size();
+        const int n = vCurrentKeys.size();
+        const int Nleft = f.mvCurrentKeys.size();
 
         for(int i=0;i<n;i++)
         {
             if(vbVO[i + Nleft] || vbMap[i + Nleft])
             {
                 cv::Point2f pt1,pt2;
-                pt1.x=mvCurrentKeysRight[i].pt.x-r;
-                pt1.y=mvCurrentKeysRight[i].pt.y-r;
-                pt2.x=mvCurrentKeysRight[i].pt.x+r;
-                pt2.y=mvCurrentKeysRight[i].pt.y+r;
+                pt1.x=vCurrentKeys[i].pt.x-r;
+                pt1.y=vCurrentKeys[i].pt.y-r;
+                pt2.x=vCurrentKeys[i].pt.x+r;
+                pt2.y=vCurrentKeys[i].pt.y+r;
 
                 // This is a match to a MapPoint in the map
                 if(vbMap[i + Nleft])
                 {
                     cv::rectangle(im,pt1,pt2,cv::Scalar(0,255,0));
-                    cv::circle(im,mvCurrentKeysRight[i].pt,2,cv::Scalar(0,255,0),-1);
+                    cv::circle(im,vCurrentKeys[i].pt,2,cv::Scalar(0,255,0),-1);
                     mnTracked++;
                 }
                 else // This is match to a "visual odometry" MapPoint created in the last frame
                 {
                     cv::rectangle(im,pt1,pt2,cv::Scalar(255,0,0));
-                    cv::circle(im,mvCurrentKeysRight[i].pt,2,cv::Scalar(255,0,0),-1);
+                    cv::circle(im,vCurrentKeys[i].pt,2,cv::Scalar(255,0,0),-1);
                     mnTrackedVO++;
                 }
             }
@@ -303,7 +260,7 @@ void FrameDrawer::DrawTextInfo(cv::Mat &im, int nState, cv::Mat &imText)
         s << " TRYING TO INITIALIZE ";
     else if(nState==Tracking::OK)
     {
-        if(!mbOnlyTracking)
+        if(!mpRead->mbOnlyTracking)
             s << "SLAM MODE |  ";
         else
             s << "LOCALIZATION | ";
@@ -335,42 +292,53 @@ void FrameDrawer::DrawTextInfo(cv::Mat &im, int nState, cv::Mat &imText)
 
 void FrameDrawer::Update(Tracking *pTracker)
 {
-    unique_lock<mutex> lock(mMutex);
-    pTracker->mImGray.copyTo(mIm);
-    mvCurrentKeys=pTracker->mCurrentFrame.mvKeys;
+    const int state = static_cast<int>(pTracker->mLastProcessedState);
+
+    // The viewer has not taken the last frame yet, skip this one unless the state changed
+    {
+        unique_lock<mutex> lock(mMutex);
+        if(mbNewData && state==mReadyState)
+            return;
+    }
+
+    // mpWrite is only used by the tracking thread, no lock while copying
+    FrameData &f = *mpWrite;
+    pTracker->mImGray.copyTo(f.mIm);
+    f.mvCurrentKeys=pTracker->mCurrentFrame.mvKeys;
 
     if(both){
-        mvCurrentKeysRight = pTracker->mCurrentFrame.mvKeysRight;
-        pTracker->mImRight.copyTo(mImRight);
-        N = mvCurrentKeys.size() + mvCurrentKeysRight.size();
+        f.mvCurrentKeysRight = pTracker->mCurrentFrame.mvKeysRight;
+        pTracker->mImRight.copyTo(f.mImRight);
+        f.N = f.mvCurrentKeys.size() + f.mvCurrentKeysRight.size();
     }
     else{
-        N = mvCurrentKeys.size();
+        f.N = f.mvCurrentKeys.size();
     }
 
-    mvbVO = vector<bool>(N,false);
-    mvbMap = vector<bool>(N,false);
-    mbOnlyTracking = pTracker->mbOnlyTracking;
+    const int N = f.N;
+    f.mvbVO.assign(N,false);
+    f.mvbMap.assign(N,false);
+    f.mbOnlyTracking = pTracker->mbOnlyTracking;
 
     //Variables for the new visualization
-    mCurrentFrame = pTracker->mCurrentFrame;
-    mmProjectPoints = mCurrentFrame.mmProjectPoints;
-    mmMatchedInImage.clear();
-
-    mvpLocalMap = pTracker->GetLocalMapMPS();
-    mvMatchedKeys.clear();
-    mvMatchedKeys.reserve(N);
-    mvpMatchedMPs.clear();
-    mvpMatchedMPs.reserve(N);
-    mvOutlierKeys.clear();
-    mvOutlierKeys.reserve(N);
-    mvpOutlierMPs.clear();
-    mvpOutlierMPs.reserve(N);
+    f.mCurrentFrame = pTracker->mCurrentFrame;
+    f.mmProjectPoints = f.mCurrentFrame.mmProjectPoints;
+    f.mmMatchedInImage.clear();
+
+    f.mvpLocalMap = pTracker->GetLocalMapMPS();
+    f.mvMatchedKeys.clear();
+    f.mvMatchedKeys.reserve(N);
+    f.mvpMatchedMPs.clear();
+    f.mvpMatchedMPs.reserve(N);
+    f.mvOutlierKeys.clear();
+    f.mvOutlierKeys.reserve(N);
+    f.mvpOutlierMPs.clear();
+    f.mvpOutlierMPs.reserve(N);
 
     if(pTracker->mLastProcessedState==Tracking::NOT_INITIALIZED)
     {
-        mvIniKeys=pTracker->mInitialFrame.mvKeys;
-        mvIniMatches=pTracker->mvIniMatches;
+        f.mvIniKeys=pTracker->mInitialFrame.mvKeys;
+        f.mvIniMatches=pTracker->mvIniMatches;
     }
     else if(pTracker->mLastProcessedState==Tracking::OK)
     {
@@ -382,23 +350,29 @@ void FrameDrawer::Update(Tracking *pTracker)
                 if(!pTracker->mCurrentFrame.mvbOutlier[i])
                 {
                     if(pMP->Observations()>0)
-                        mvbMap[i]=true;
+                        f.mvbMap[i]=true;
                     else
-                        mvbVO[i]=true;
+                        f.mvbVO[i]=true;
 
-                    mmMatchedInImage[pMP->mnId] = mvCurrentKeys[i].pt;
+                    f.mmMatchedInImage[pMP->mnId] = f.mvCurrentKeys[i].pt;
 
                 }
                 else
                 {
-                    mvpOutlierMPs.push_back(pMP);
-                    mvOutlierKeys.push_back(mvCurrentKeys[i]);
+                    f.mvpOutlierMPs.push_back(pMP);
+                    f.mvOutlierKeys.push_back(f.mvCurrentKeys[i]);
                 }
             }
         }
 
     }
-    mState=static_cast<int>(pTracker->mLastProcessedState);
+    f.mState=state;
+
+    // Publish
+    unique_lock<mutex> lock(mMutex);
+    std::swap(mpWrite,mpReady);
+    mbNewData = true;
+    mReadyState = state;
 }
 
 } //namespace ORB_SLAM
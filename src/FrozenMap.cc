@@ -0,0 +1,374 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "FrozenMap.h"
+#include "Map.h"
+#include "MapPoint.h"
+#include "KeyFrame.h"
+#include "Frame.h"
+#include "ORBmatcher.h"
+#include "GeometricCamera.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+namespace ORB_SLAM3
+{
+
+FrozenMap::FrozenMap(Map* pMap): mpMap(pMap)
+{
+    mnChangeIndex = pMap->GetMapChangeIndex();
+    mnKFsInMap = pMap->KeyFramesInMap();
+    mnMPsInMap = pMap->MapPointsInMap();
+
+    // Points
+    const Map::MapPointsSnapshot pMPs = pMap->GetMapPointsSnapshot();
+    const std::vector<MapPoint*> &vpMPs = *pMPs;
+    mvpMapPoints.reserve(vpMPs.size());
+    for(size_t i=0; i<vpMPs.size(); i++)
+    {
+        MapPoint* pMP = vpMPs[i];
+        if(!pMP || pMP->isBad())
+            continue;
+        mmPointIndex[pMP] = mvpMapPoints.size();
+        mvpMapPoints.push_back(pMP);
+    }
+
+    const int nPoints = mvpMapPoints.size();
+    mvX.resize(nPoints); mvY.resize(nPoints); mvZ.resize(nPoints);
+    mvNx.resize(nPoints); mvNy.resize(nPoints); mvNz.resize(nPoints);
+    mvMinDist.resize(nPoints); mvMaxDist.resize(nPoints); mvScaleDist.resize(nPoints);
+    mDescriptors = cv::Mat::zeros(nPoints,ORBmatcher::DESCRIPTOR_BYTES,CV_8U);
+    for(int i=0; i<nPoints; i++)
+    {
+        MapPoint* pMP = mvpMapPoints[i];
+        cv::Matx31f Pos, Normal;
+        pMP->GetViewingGeometry(Pos,Normal,mvMinDist[i],mvMaxDist[i]);
+        mvX[i] = Pos(0); mvY[i] = Pos(1); mvZ[i] = Pos(2);
+        mvNx[i] = Normal(0); mvNy[i] = Normal(1); mvNz[i] = Normal(2);
+        mvScaleDist[i] = mvMaxDist[i]/1.2f;
+
+        const cv::Mat descriptor = pMP->GetDescriptor();
+        if(!descriptor.empty())
+            descriptor.copyTo(mDescriptors.row(i));
+    }
+
+    // Keyframes, sorted by address so that they are visited in the order of KeyFrameWeights
+    const Map::KeyFramesSnapshot pKFs = pMap->GetKeyFramesSnapshot();
+    const std::vector<KeyFrame*> &vpKFs = *pKFs;
+    mvpKeyFrames.reserve(vpKFs.size());
+    for(size_t i=0; i<vpKFs.size(); i++)
+        if(vpKFs[i] && !vpKFs[i]->isBad())
+            mvpKeyFrames.push_back(vpKFs[i]);
+    std::sort(mvpKeyFrames.begin(),mvpKeyFrames.end(),std::less<KeyFrame*>());
+
+    const int nKFs = mvpKeyFrames.size();
+    for(int i=0; i<nKFs; i++)
+        mmKeyFrameIndex[mvpKeyFrames[i]] = i;
+
+    mvMatchStart.reserve(nKFs+1);
+    mvCovStart.reserve(nKFs+1);
+    mvChildStart.reserve(nKFs+1);
+    mvParent.resize(nKFs);
+    mvPrevKF.resize(nKFs);
+    for(int i=0; i<nKFs; i++)
+    {
+        KeyFrame* pKF = mvpKeyFrames[i];
+
+        mvMatchStart.push_back(mvMatchPoint.size());
+        const std::vector<MapPoint*> vpMatches = pKF->GetMapPointMatches();
+        for(size_t j=0; j<vpMatches.size(); j++)
+        {
+            const int ip = vpMatches[j] ? PointIndex(vpMatches[j]) : -1;
+            mvMatchPoint.push_back(ip);
+            mvpMatchMapPoints.push_back(ip>=0 ? vpMatches[j] : static_cast<MapPoint*>(NULL));
+        }
+
+        mvCovStart.push_back(mvCovKF.size());
+        const std::vector<KeyFrame*> vpNeighs = pKF->GetBestCovisibilityKeyFrames(10);
+        for(size_t j=0; j<vpNeighs.size(); j++)
+        {
+            const int k = KeyFrameIndex(vpNeighs[j]);
+            if(k>=0)
+                mvCovKF.push_back(k);
+        }
+
+        mvChildStart.push_back(mvChildKF.size());
+        const std::set<KeyFrame*> spChilds = pKF->GetChilds();
+        for(std::set<KeyFrame*>::const_iterator sit=spChilds.begin(); sit!=spChilds.end(); sit++)
+        {
+            const int k = KeyFrameIndex(*sit);
+            if(k>=0)
+                mvChildKF.push_back(k);
+        }
+
+        KeyFrame* pParent = pKF->GetParent();
+        mvParent[i] = pParent ? KeyFrameIndex(pParent) : -1;
+        mvPrevKF[i] = pKF->mPrevKF ? KeyFrameIndex(pKF->mPrevKF) : -1;
+    }
+    mvMatchStart.push_back(mvMatchPoint.size());
+    mvCovStart.push_back(mvCovKF.size());
+    mvChildStart.push_back(mvChildKF.size());
+
+    // Observations
+    mvObsStart.reserve(nPoints+1);
+    for(int i=0; i<nPoints; i++)
+    {
+        mvObsStart.push_back(mvObsKF.size());
+        mvpMapPoints[i]->VisitObservations([this](KeyFrame* pKFi, const std::tuple<int,int>&)
+        {
+            const int k = KeyFrameIndex(pKFi);
+            if(k>=0)
+                mvObsKF.push_back(k);
+        });
+    }
+    mvObsStart.push_back(mvObsKF.size());
+}
+
+bool FrozenMap::IsStale(Map* pMap)
+{
+    return pMap!=mpMap || pMap->GetMapChangeIndex()!=mnChangeIndex ||
+           pMap->KeyFramesInMap()!=mnKFsInMap || pMap->MapPointsInMap()!=mnMPsInMap;
+}
+
+int FrozenMap::PointIndex(MapPoint* pMP) const
+{
+    std::unordered_map<MapPoint*,int>::const_iterator it = mmPointIndex.find(pMP);
+    return it==mmPointIndex.end() ? -1 : it->second;
+}
+
+int FrozenMap::KeyFrameIndex(KeyFrame* pKF) const
+{
+    std::unordered_map<KeyFrame*,int>::const_iterator it = mmKeyFrameIndex.find(pKF);
+    return it==mmKeyFrameIndex.end() ? -1 : it->second;
+}
+
+void FrozenMap::UpdateLocalWindow(const Frame &F, KeyFrame* pLastKF, const bool bTemporal, LocalWindow &w) const
+{
+    const size_t nKFs = mvpKeyFrames.size();
+    if(w.mvKFStamp.size()!=nKFs)
+    {
+        w.mvKFStamp.assign(nKFs,0);
+        w.mvVotes.assign(nKFs,0);
+    }
+    if(w.mvPointStamp.size()!=mvpMapPoints.size())
+        w.mvPointStamp.assign(mvpMapPoints.size(),0);
+
+    const unsigned long stamp = ++w.mnStamp;
+
+    // Each map point votes for the keyframes in which it has been observed
+    w.mvVoted.clear();
+    for(int i=0; i<F.N; i++)
+    {
+        MapPoint* pMP = F.mvpMapPoints[i];
+        if(!pMP)
+            continue;
+        const int ip = PointIndex(pMP);
+        if(ip<0)
+            continue;
+        for(int k=mvObsStart[ip]; k<mvObsStart[ip+1]; k++)
+        {
+            const int kf = mvObsKF[k];
+            if(w.mvVotes[kf]==0)
+                w.mvVoted.push_back(kf);
+            w.mvVotes[kf]++;
+        }
+    }
+    std::sort(w.mvVoted.begin(),w.mvVoted.end());
+
+    // All keyframes that observe a map point are included in the local map. Also check which keyframe shares most points
+    int max = 0;
+    w.mnKFMax = -1;
+    w.mvKeyFrames.clear();
+    for(size_t i=0; i<w.mvVoted.size(); i++)
+    {
+        const int kf = w.mvVoted[i];
+        if(w.mvVotes[kf]>max)
+        {
+            max = w.mvVotes[kf];
+            w.mnKFMax = kf;
+        }
+        w.mvVotes[kf] = 0;
+        w.mvKeyFrames.push_back(kf);
+        w.mvKFStamp[kf] = stamp;
+    }
+
+    // Include also some not-already-included keyframes that are neighbors to already-included keyframes
+    const size_t nVoted = w.mvKeyFrames.size();
+    for(size_t i=0; i<nVoted; i++)
+    {
+        // Limit the number of keyframes
+        if(w.mvKeyFrames.size()>80)
+            break;
+
+        const int kf = w.mvKeyFrames[i];
+
+        for(int k=mvCovStart[kf]; k<mvCovStart[kf+1]; k++)
+        {
+            const int kfn = mvCovKF[k];
+            if(w.mvKFStamp[kfn]!=stamp)
+            {
+                w.mvKeyFrames.push_back(kfn);
+                w.mvKFStamp[kfn] = stamp;
+                break;
+            }
+        }
+
+        for(int k=mvChildStart[kf]; k<mvChildStart[kf+1]; k++)
+        {
+            const int kfc = mvChildKF[k];
+            if(w.mvKFStamp[kfc]!=stamp)
+            {
+                w.mvKeyFrames.push_back(kfc);
+                w.mvKFStamp[kfc] = stamp;
+                break;
+            }
+        }
+
+        // As in Tracking::UpdateLocalKeyFrames, adding the parent ends the search
+        const int kfp = mvParent[kf];
+        if(kfp>=0 && w.mvKFStamp[kfp]!=stamp)
+        {
+            w.mvKeyFrames.push_back(kfp);
+            w.mvKFStamp[kfp] = stamp;
+            break;
+        }
+    }
+
+    // Add the last temporal keyframes (mainly for IMU)
+    if(bTemporal && w.mvKeyFrames.size()<80)
+    {
+        int kf = pLastKF ? KeyFrameIndex(pLastKF) : -1;
+        for(int i=0; i<20 && kf>=0 && w.mvKFStamp[kf]!=stamp; i++)
+        {
+            w.mvKeyFrames.push_back(kf);
+            w.mvKFStamp[kf] = stamp;
+            kf = mvPrevKF[kf];
+        }
+    }
+
+    // Local points, from the newest keyframes
+    w.mvPoints.clear();
+    for(std::vector<int>::const_reverse_iterator it=w.mvKeyFrames.rbegin(); it!=w.mvKeyFrames.rend(); ++it)
+    {
+        const int kf = *it;
+        for(int j=mvMatchStart[kf]; j<mvMatchStart[kf+1]; j++)
+        {
+            const int ip = mvMatchPoint[j];
+            if(ip<0 || w.mvPointStamp[ip]==stamp)
+                continue;
+            w.mvPoints.push_back(ip);
+            w.mvPointStamp[ip] = stamp;
+        }
+    }
+}
+
+int FrozenMap::ProjectLocalPoints(const Frame &F, const float viewingCosLimit, LocalWindow &w) const
+{
+    if(w.mvPointStamp.size()!=mvpMapPoints.size())
+        w.mvPointStamp.assign(mvpMapPoints.size(),0);
+
+    // Do not search map points already matched
+    const unsigned long stamp = ++w.mnStamp;
+    w.mvbKeyMatched.assign(F.N,0);
+    for(int i=0; i<F.N; i++)
+    {
+        MapPoint* pMP = F.mvpMapPoints[i];
+        if(!pMP)
+            continue;
+        const int ip = PointIndex(pMP);
+        if(ip<0)
+            continue;
+        w.mvPointStamp[ip] = stamp;
+        w.mvbKeyMatched[i] = 1;
+    }
+
+    std::vector<int> &vPoints = w.mvProjPoint;
+    vPoints.clear();
+    for(size_t i=0; i<w.mvPoints.size(); i++)
+        if(w.mvPointStamp[w.mvPoints[i]]!=stamp)
+            vPoints.push_back(w.mvPoints[i]);
+
+    const int N = vPoints.size();
+    w.mvProjU.resize(N); w.mvProjV.resize(N); w.mvProjUR.resize(N);
+    w.mvProjDepth.resize(N); w.mvProjViewCos.resize(N); w.mvProjLevel.resize(N);
+    if(N==0)
+        return 0;
+
+    const cv::Mat Rcw = F.mTcw.rowRange(0,3).colRange(0,3);
+    const cv::Mat tcw = F.mTcw.rowRange(0,3).col(3);
+    const cv::Mat Ow = -Rcw.t()*tcw;
+
+    const float r00 = Rcw.at<float>(0,0), r01 = Rcw.at<float>(0,1), r02 = Rcw.at<float>(0,2);
+    const float r10 = Rcw.at<float>(1,0), r11 = Rcw.at<float>(1,1), r12 = Rcw.at<float>(1,2);
+    const float r20 = Rcw.at<float>(2,0), r21 = Rcw.at<float>(2,1), r22 = Rcw.at<float>(2,2);
+    const float tx = tcw.at<float>(0), ty = tcw.at<float>(1), tz = tcw.at<float>(2);
+    const float ox = Ow.at<float>(0), oy = Ow.at<float>(1), oz = Ow.at<float>(2);
+
+    std::vector<float> vPcX(N), vPcY(N), vPcZ(N), vDist(N);
+    for(int j=0; j<N; j++)
+    {
+        const int i = vPoints[j];
+        vPcX[j] = r00*mvX[i] + r01*mvY[i] + r02*mvZ[i] + tx;
+        vPcY[j] = r10*mvX[i] + r11*mvY[i] + r12*mvZ[i] + ty;
+        vPcZ[j] = r20*mvX[i] + r21*mvY[i] + r22*mvZ[i] + tz;
+
+        const float pox = mvX[i]-ox, poy = mvY[i]-oy, poz = mvZ[i]-oz;
+        const float dist = std::sqrt(pox*pox + poy*poy + poz*poz);
+        vDist[j] = dist;
+        w.mvProjViewCos[j] = (pox*mvNx[i] + poy*mvNy[i] + poz*mvNz[i])/dist;
+    }
+
+    F.mpCamera->projectMany(vPcX.data(),vPcY.data(),vPcZ.data(),N,w.mvProjU.data(),w.mvProjV.data());
+
+    // Keep the points in the frustum, in place
+    int n = 0;
+    for(int j=0; j<N; j++)
+    {
+        const int i = vPoints[j];
+        const float u = w.mvProjU[j], v = w.mvProjV[j];
+        if(vPcZ[j]<0.0f || u<F.mnMinX || u>F.mnMaxX || v<F.mnMinY || v>F.mnMaxY)
+            continue;
+        if(vDist[j]<mvMinDist[i] || vDist[j]>mvMaxDist[i] || w.mvProjViewCos[j]<viewingCosLimit)
+            continue;
+
+        int nScale = std::ceil(std::log(mvScaleDist[i]/vDist[j])/F.mfLogScaleFactor);
+        if(nScale<0)
+            nScale = 0;
+        else if(nScale>=F.mnScaleLevels)
+            nScale = F.mnScaleLevels-1;
+
+        vPoints[n] = i;
+        w.mvProjU[n] = u;
+        w.mvProjV[n] = v;
+        w.mvProjUR[n] = u - F.mbf/vPcZ[j];
+        w.mvProjDepth[n] = std::sqrt(vPcX[j]*vPcX[j] + vPcY[j]*vPcY[j] + vPcZ[j]*vPcZ[j]);
+        w.mvProjViewCos[n] = w.mvProjViewCos[j];
+        w.mvProjLevel[n] = nScale;
+        n++;
+    }
+
+    vPoints.resize(n);
+    w.mvProjU.resize(n); w.mvProjV.resize(n); w.mvProjUR.resize(n);
+    w.mvProjDepth.resize(n); w.mvProjViewCos.resize(n); w.mvProjLevel.resize(n);
+
+    return n;
+}
+
+} //namespace ORB_SLAM3
@@ -44,8 +44,8 @@ ImuCamPose::ImuCamPose(KeyFrame *pKF):its(0)
     pCamera.resize(num_cams);
 
     // Left camera
-    tcw[0] = Converter::toVector3d(pKF->GetTranslation());
-    Rcw[0] = Converter::toMatrix3d(pKF->GetRotation());
+    tcw[0] = Converter::toVector3d(pKF->GetTranslation_());
+    Rcw[0] = Converter::toMatrix3d(pKF->GetRotation_());
     tcb[0] = Converter::toVector3d(pKF->mImuCalib.Tcb.rowRange(0,3).col(3));
     Rcb[0] = Converter::toMatrix3d(pKF->mImuCalib.Tcb.rowRange(0,3).colRange(0,3));
     Rbc[0] = Rcb[0].transpose();
@@ -169,19 +169,12 @@ void ImuCamPose::SetParam(const std::vector<Eigen::Matrix3d> &_Rcw, const std::v
 
 Eigen::Vector2d ImuCamPose::Project(const Eigen::Vector3d &Xw, int cam_idx) const
 {
-    Eigen::Vector3d Xc = Rcw[cam_idx]*Xw+tcw[cam_idx];
-
-    return pCamera[cam_idx]->project(Xc);
+    return ProjectT<GeometricCamera>(Xw,cam_idx);
 }
 
 Eigen::Vector3d ImuCamPose::ProjectStereo(const Eigen::Vector3d &Xw, int cam_idx) const
 {
-    Eigen::Vector3d Pc = Rcw[cam_idx]*Xw+tcw[cam_idx];
-    Eigen::Vector3d pc;
-    double invZ = 1/Pc(2);
-    pc.head(2) = pCamera[cam_idx]->project(Pc);
-    pc(2) = pc(0) - bf*invZ;
-    return pc;
+    return ProjectStereoT<GeometricCamera>(Xw,cam_idx);
 }
 
 bool ImuCamPose::isDepthPositive(const Eigen::Vector3d &Xw, int cam_idx) const
@@ -347,6 +340,12 @@ bool VertexPose::write(std::ostream& os) const
 
 
 void EdgeMono::linearizeOplus()
+{
+    linearizeOplusT<GeometricCamera>();
+}
+
+template<class CameraModel>
+void EdgeMono::linearizeOplusT()
 {
     const VertexPose* VPose = static_cast<const VertexPose*>(_vertices[1]);
     const g2o::VertexSBAPointXYZ* VPoint = static_cast<const g2o::VertexSBAPointXYZ*>(_vertices[0]);
@@ -357,7 +356,7 @@ void EdgeMono::linearizeOplus()
     const Eigen::Vector3d Xb = VPose->estimate().Rbc[cam_idx]*Xc+VPose->estimate().tbc[cam_idx];
     const Eigen::Matrix3d &Rcb = VPose->estimate().Rcb[cam_idx];
 
-    const Eigen::Matrix<double,2,3> proj_jac = VPose->estimate().pCamera[cam_idx]->projectJac(Xc);
+    const Eigen::Matrix<double,2,3> proj_jac = CameraProjectJac<CameraModel>(VPose->estimate().pCamera[cam_idx],Xc);
     _jacobianOplusXi = -proj_jac * Rcw;
 
     Eigen::Matrix<double,3,6> SE3deriv;
@@ -373,6 +372,12 @@ void EdgeMono::linearizeOplus()
 }
 
 void EdgeMonoOnlyPose::linearizeOplus()
+{
+    linearizeOplusT<GeometricCamera>();
+}
+
+template<class CameraModel>
+void EdgeMonoOnlyPose::linearizeOplusT()
 {
     const VertexPose* VPose = static_cast<const VertexPose*>(_vertices[0]);
 
@@ -382,7 +387,7 @@ void EdgeMonoOnlyPose::linearizeOplus()
     const Eigen::Vector3d Xb = VPose->estimate().Rbc[cam_idx]*Xc+VPose->estimate().tbc[cam_idx];
     const Eigen::Matrix3d &Rcb = VPose->estimate().Rcb[cam_idx];
 
-    Eigen::Matrix<double,2,3> proj_jac = VPose->estimate().pCamera[cam_idx]->projectJac(Xc);
+    Eigen::Matrix<double,2,3> proj_jac = CameraProjectJac<CameraModel>(VPose->estimate().pCamera[cam_idx],Xc);
 
     Eigen::Matrix<double,3,6> SE3deriv;
     double x = Xb(0);
@@ -395,6 +400,12 @@ void EdgeMonoOnlyPose::linearizeOplus()
 }
 
 void EdgeStereo::linearizeOplus()
+{
+    linearizeOplusT<GeometricCamera>();
+}
+
+template<class CameraModel>
+void EdgeStereo::linearizeOplusT()
 {
     const VertexPose* VPose = static_cast<const VertexPose*>(_vertices[1]);
     const g2o::VertexSBAPointXYZ* VPoint = static_cast<const g2o::VertexSBAPointXYZ*>(_vertices[0]);
@@ -408,7 +419,7 @@ void EdgeStereo::linearizeOplus()
     const double inv_z2 = 1.0/(Xc(2)*Xc(2));
 
     Eigen::Matrix<double,3,3> proj_jac;
-    proj_jac.block<2,3>(0,0) = VPose->estimate().pCamera[cam_idx]->projectJac(Xc);
+    proj_jac.block<2,3>(0,0) = CameraProjectJac<CameraModel>(VPose->estimate().pCamera[cam_idx],Xc);
     proj_jac.block<1,3>(2,0) = proj_jac.block<1,3>(0,0);
     proj_jac(2,2) += bf*inv_z2;
 
@@ -427,6 +438,12 @@ void EdgeStereo::linearizeOplus()
 }
 
 void EdgeStereoOnlyPose::linearizeOplus()
+{
+    linearizeOplusT<GeometricCamera>();
+}
+
+template<class CameraModel>
+void EdgeStereoOnlyPose::linearizeOplusT()
 {
     const VertexPose* VPose = static_cast<const VertexPose*>(_vertices[0]);
 
@@ -439,7 +456,7 @@ void EdgeStereoOnlyPose::linearizeOplus()
     const double inv_z2 = 1.0/(Xc(2)*Xc(2));
 
     Eigen::Matrix<double,3,3> proj_jac;
-    proj_jac.block<2,3>(0,0) = VPose->estimate().pCamera[cam_idx]->projectJac(Xc);
+    proj_jac.block<2,3>(0,0) = CameraProjectJac<CameraModel>(VPose->estimate().pCamera[cam_idx],Xc);
     proj_jac.block<1,3>(2,0) = proj_jac.block<1,3>(0,0);
     proj_jac(2,2) += bf*inv_z2;
 
@@ -453,6 +470,47 @@ void EdgeStereoOnlyPose::linearizeOplus()
     _jacobianOplusXi = proj_jac * Rcb * SE3deriv;
 }
 
+template void EdgeMono::linearizeOplusT<Pinhole>();
+template void EdgeMono::linearizeOplusT<KannalaBrandt8>();
+template void EdgeMonoOnlyPose::linearizeOplusT<Pinhole>();
+template void EdgeMonoOnlyPose::linearizeOplusT<KannalaBrandt8>();
+template void EdgeStereo::linearizeOplusT<Pinhole>();
+template void EdgeStereo::linearizeOplusT<KannalaBrandt8>();
+template void EdgeStereoOnlyPose::linearizeOplusT<Pinhole>();
+template void EdgeStereoOnlyPose::linearizeOplusT<KannalaBrandt8>();
+
+EdgeMono* NewEdgeMono(GeometricCamera* pCamera, int cam_idx)
+{
+    if(pCamera->GetType() == pCamera->CAM_PINHOLE)
+        return new EdgeMonoT<Pinhole>(cam_idx);
+    else
+        return new EdgeMonoT<KannalaBrandt8>(cam_idx);
+}
+
+EdgeMonoOnlyPose* NewEdgeMonoOnlyPose(GeometricCamera* pCamera, const cv::Mat &Xw, int cam_idx)
+{
+    if(pCamera->GetType() == pCamera->CAM_PINHOLE)
+        return new EdgeMonoOnlyPoseT<Pinhole>(Xw,cam_idx);
+    else
+        return new EdgeMonoOnlyPoseT<KannalaBrandt8>(Xw,cam_idx);
+}
+
+EdgeStereo* NewEdgeStereo(GeometricCamera* pCamera, int cam_idx)
+{
+    if(pCamera->GetType() == pCamera->CAM_PINHOLE)
+        return new EdgeStereoT<Pinhole>(cam_idx);
+    else
+        return new EdgeStereoT<KannalaBrandt8>(cam_idx);
+}
+
+EdgeStereoOnlyPose* NewEdgeStereoOnlyPose(GeometricCamera* pCamera, const cv::Mat &Xw, int cam_idx)
+{
+    if(pCamera->GetType() == pCamera->CAM_PINHOLE)
+        return new EdgeStereoOnlyPoseT<Pinhole>(Xw,cam_idx);
+    else
+        return new EdgeStereoOnlyPoseT<KannalaBrandt8>(Xw,cam_idx);
+}
+
 VertexVelocity::VertexVelocity(KeyFrame* pKF)
 {
     setEstimate(Converter::toVector3d(pKF->GetVelocity()));
@@ -491,16 +549,23 @@ VertexAccBias::VertexAccBias(Frame *pF)
 
 EdgeInertial::EdgeInertial(IMU::Preintegrated *pInt):JRg(Converter::toMatrix3d(pInt->JRg)),
     JVg(Converter::toMatrix3d(pInt->JVg)), JPg(Converter::toMatrix3d(pInt->JPg)), JVa(Converter::toMatrix3d(pInt->JVa)),
-    JPa(Converter::toMatrix3d(pInt->JPa)), mpInt(pInt), dt(pInt->dT)
+    JPa(Converter::toMatrix3d(pInt->JPa)), mpInt(pInt), dt(pInt->dT), mbDeltasReady(false)
 {
+    dR0 = Converter::toMatrix3d(pInt->GetOriginalDeltaRotation_());
+    dV0 = Converter::toVector3d(pInt->GetOriginalDeltaVelocity_());
+    dP0 = Converter::toVector3d(pInt->GetOriginalDeltaPosition_());
+    const IMU::Bias b0 = pInt->GetOriginalBias();
+    bg0 << b0.bwx, b0.bwy, b0.bwz;
+    ba0 << b0.bax, b0.bay, b0.baz;
+
     // This edge links 6 vertices
     resize(6);
     g << 0, 0, -IMU::GRAVITY_VALUE;
-    cv::Mat cvInfo = pInt->C.rowRange(0,9).colRange(0,9).inv(cv::DECOMP_SVD);
+    const cv::Matx<float,9,9> cvInfo = pInt->C.get_minor<9,9>(0,0).inv(cv::DECOMP_SVD);
     Matrix9d Info;
     for(int r=0;r<9;r++)
         for(int c=0;c<9;c++)
-            Info(r,c)=cvInfo.at<float>(r,c);
+            Info(r,c)=cvInfo(r,c);
     Info = (Info+Info.transpose())/2;
     Eigen::SelfAdjointEigenSolver<Eigen::Matrix<double,9,9> > es(Info);
      Eigen::Matrix<double,9,1> eigs = es.eigenvalues();
@@ -514,6 +579,22 @@ EdgeInertial::EdgeInertial(IMU::Preintegrated *pInt):JRg(Converter::toMatrix3d(p
 
 
 
+void EdgeInertial::UpdateDeltas(const Eigen::Vector3d &bg, const Eigen::Vector3d &ba)
+{
+    if(mbDeltasReady && bg==mbg && ba==mba)
+        return;
+
+    mbg = bg;
+    mba = ba;
+    mdbg = bg-bg0;
+    const Eigen::Vector3d dba = ba-ba0;
+    // dR0 and the exponential are rotations, their product does not need to be normalized
+    mdR = dR0*ExpSO3(JRg*mdbg);
+    mdV = dV0 + JVg*mdbg + JVa*dba;
+    mdP = dP0 + JPg*mdbg + JPa*dba;
+    mbDeltasReady = true;
+}
+
 void EdgeInertial::computeError()
 {
     // TODO Maybe Reintegrate inertial measurments when difference between linearization point and current estimate is too big
@@ -523,15 +604,13 @@ void EdgeInertial::computeError()
     const VertexAccBias* VA1= static_cast<const VertexAccBias*>(_vertices[3]);
     const VertexPose* VP2 = static_cast<const VertexPose*>(_vertices[4]);
     const VertexVelocity* VV2 = static_cast<const VertexVelocity*>(_vertices[5]);
-    const IMU::Bias b1(VA1->estimate()[0],VA1->estimate()[1],VA1->estimate()[2],VG1->estimate()[0],VG1->estimate()[1],VG1->estimate()[2]);
-    const Eigen::Matrix3d dR = Converter::toMatrix3d(mpInt->GetDeltaRotation(b1));
-    const Eigen::Vector3d dV = Converter::toVector3d(mpInt->GetDeltaVelocity(b1));
-    const Eigen::Vector3d dP = Converter::toVector3d(mpInt->GetDeltaPosition(b1));
+    UpdateDeltas(VG1->estimate(),VA1->estimate());
 
-    const Eigen::Vector3d er = LogSO3(dR.transpose()*VP1->estimate().Rwb.transpose()*VP2->estimate().Rwb);
-    const Eigen::Vector3d ev = VP1->estimate().Rwb.transpose()*(VV2->estimate() - VV1->estimate() - g*dt) - dV;
-    const Eigen::Vector3d ep = VP1->estimate().Rwb.transpose()*(VP2->estimate().twb - VP1->estimate().twb
-                                                               - VV1->estimate()*dt - g*dt*dt/2) - dP;
+    const Eigen::Matrix3d Rbw1 = VP1->estimate().Rwb.transpose();
+    const Eigen::Vector3d er = LogSO3(mdR.transpose()*Rbw1*VP2->estimate().Rwb);
+    const Eigen::Vector3d ev = Rbw1*(VV2->estimate() - VV1->estimate() - g*dt) - mdV;
+    const Eigen::Vector3d ep = Rbw1*(VP2->estimate().twb - VP1->estimate().twb
+                                     - VV1->estimate()*dt - g*dt*dt/2) - mdP;
 
     _error << er, ev, ep;
 }
@@ -544,17 +623,13 @@ void EdgeInertial::linearizeOplus()
     const VertexAccBias* VA1= static_cast<const VertexAccBias*>(_vertices[3]);
     const VertexPose* VP2 = static_cast<const VertexPose*>(_vertices[4]);
     const VertexVelocity* VV2= static_cast<const VertexVelocity*>(_vertices[5]);
-    const IMU::Bias b1(VA1->estimate()[0],VA1->estimate()[1],VA1->estimate()[2],VG1->estimate()[0],VG1->estimate()[1],VG1->estimate()[2]);
-    const IMU::Bias db = mpInt->GetDeltaBias(b1);
-    Eigen::Vector3d dbg;
-    dbg << db.bwx, db.bwy, db.bwz;
+    UpdateDeltas(VG1->estimate(),VA1->estimate());
 
     const Eigen::Matrix3d Rwb1 = VP1->estimate().Rwb;
     const Eigen::Matrix3d Rbw1 = Rwb1.transpose();
     const Eigen::Matrix3d Rwb2 = VP2->estimate().Rwb;
 
-    const Eigen::Matrix3d dR = Converter::toMatrix3d(mpInt->GetDeltaRotation(b1));
-    const Eigen::Matrix3d eR = dR.transpose()*Rbw1*Rwb2;
+    const Eigen::Matrix3d eR = mdR.transpose()*Rbw1*Rwb2;
     const Eigen::Vector3d er = LogSO3(eR);
     const Eigen::Matrix3d invJr = InverseRightJacobianSO3(er);
 
@@ -575,7 +650,7 @@ void EdgeInertial::linearizeOplus()
 
     // Jacobians wrt Gyro 1
     _jacobianOplus[2].setZero();
-    _jacobianOplus[2].block<3,3>(0,0) = -invJr*eR.transpose()*RightJacobianSO3(JRg*dbg)*JRg; // OK
+    _jacobianOplus[2].block<3,3>(0,0) = -invJr*eR.transpose()*RightJacobianSO3(JRg*mdbg)*JRg; // OK
     _jacobianOplus[2].block<3,3>(3,0) = -JVg; // OK
     _jacobianOplus[2].block<3,3>(6,0) = -JPg; // OK
 
@@ -598,16 +673,23 @@ void EdgeInertial::linearizeOplus()
 
 EdgeInertialGS::EdgeInertialGS(IMU::Preintegrated *pInt):JRg(Converter::toMatrix3d(pInt->JRg)),
     JVg(Converter::toMatrix3d(pInt->JVg)), JPg(Converter::toMatrix3d(pInt->JPg)), JVa(Converter::toMatrix3d(pInt->JVa)),
-    JPa(Converter::toMatrix3d(pInt->JPa)), mpInt(pInt), dt(pInt->dT)
+    JPa(Converter::toMatrix3d(pInt->JPa)), mpInt(pInt), dt(pInt->dT), mbDeltasReady(false)
 {
+    dR0 = Converter::toMatrix3d(pInt->GetOriginalDeltaRotation_());
+    dV0 = Converter::toVector3d(pInt->GetOriginalDeltaVelocity_());
+    dP0 = Converter::toVector3d(pInt->GetOriginalDeltaPosition_());
+    const IMU::Bias b0 = pInt->GetOriginalBias();
+    bg0 << b0.bwx, b0.bwy, b0.bwz;
+    ba0 << b0.bax, b0.bay, b0.baz;
+
     // This edge links 8 vertices
     resize(8);
     gI << 0, 0, -IMU::GRAVITY_VALUE;
-    cv::Mat cvInfo = pInt->C.rowRange(0,9).colRange(0,9).inv(cv::DECOMP_SVD);
+    const cv::Matx<float,9,9> cvInfo = pInt->C.get_minor<9,9>(0,0).inv(cv::DECOMP_SVD);
     Matrix9d Info;
     for(int r=0;r<9;r++)
         for(int c=0;c<9;c++)
-            Info(r,c)=cvInfo.at<float>(r,c);
+            Info(r,c)=cvInfo(r,c);
     Info = (Info+Info.transpose())/2;
     Eigen::SelfAdjointEigenSolver<Eigen::Matrix<double,9,9> > es(Info);
      Eigen::Matrix<double,9,1> eigs = es.eigenvalues();
@@ -620,6 +702,21 @@ EdgeInertialGS::EdgeInertialGS(IMU::Preintegrated *pInt):JRg(Converter::toMatrix
 
 
 
+void EdgeInertialGS::UpdateDeltas(const Eigen::Vector3d &bg, const Eigen::Vector3d &ba)
+{
+    if(mbDeltasReady && bg==mbg && ba==mba)
+        return;
+
+    mbg = bg;
+    mba = ba;
+    mdbg = bg-bg0;
+    const Eigen::Vector3d dba = ba-ba0;
+    mdR = dR0*ExpSO3(JRg*mdbg);
+    mdV = dV0 + JVg*mdbg + JVa*dba;
+    mdP = dP0 + JPg*mdbg + JPa*dba;
+    mbDeltasReady = true;
+}
+
 void EdgeInertialGS::computeError()
 {
     // TODO Maybe Reintegrate inertial measurments when difference between linearization point and current estimate is too big
@@ -631,16 +728,14 @@ void EdgeInertialGS::computeError()
     const VertexVelocity* VV2 = static_cast<const VertexVelocity*>(_vertices[5]);
     const VertexGDir* VGDir = static_cast<const VertexGDir*>(_vertices[6]);
     const VertexScale* VS = static_cast<const VertexScale*>(_vertices[7]);
-    const IMU::Bias b(VA->estimate()[0],VA->estimate()[1],VA->estimate()[2],VG->estimate()[0],VG->estimate()[1],VG->estimate()[2]);
+    UpdateDeltas(VG->estimate(),VA->estimate());
     g = VGDir->estimate().Rwg*gI;
     const double s = VS->estimate();
-    const Eigen::Matrix3d dR = Converter::toMatrix3d(mpInt->GetDeltaRotation(b));
-    const Eigen::Vector3d dV = Converter::toVector3d(mpInt->GetDeltaVelocity(b));
-    const Eigen::Vector3d dP = Converter::toVector3d(mpInt->GetDeltaPosition(b));
 
-    const Eigen::Vector3d er = LogSO3(dR.transpose()*VP1->estimate().Rwb.transpose()*VP2->estimate().Rwb);
-    const Eigen::Vector3d ev = VP1->estimate().Rwb.transpose()*(s*(VV2->estimate() - VV1->estimate()) - g*dt) - dV;
-    const Eigen::Vector3d ep = VP1->estimate().Rwb.transpose()*(s*(VP2->estimate().twb - VP1->estimate().twb - VV1->estimate()*dt) - g*dt*dt/2) - dP;
+    const Eigen::Matrix3d Rbw1 = VP1->estimate().Rwb.transpose();
+    const Eigen::Vector3d er = LogSO3(mdR.transpose()*Rbw1*VP2->estimate().Rwb);
+    const Eigen::Vector3d ev = Rbw1*(s*(VV2->estimate() - VV1->estimate()) - g*dt) - mdV;
+    const Eigen::Vector3d ep = Rbw1*(s*(VP2->estimate().twb - VP1->estimate().twb - VV1->estimate()*dt) - g*dt*dt/2) - mdP;
 
     _error << er, ev, ep;
 }
@@ -655,23 +750,18 @@ void EdgeInertialGS::linearizeOplus()
     const VertexVelocity* VV2 = static_cast<const VertexVelocity*>(_vertices[5]);
     const VertexGDir* VGDir = static_cast<const VertexGDir*>(_vertices[6]);
     const VertexScale* VS = static_cast<const VertexScale*>(_vertices[7]);
-    const IMU::Bias b(VA->estimate()[0],VA->estimate()[1],VA->estimate()[2],VG->estimate()[0],VG->estimate()[1],VG->estimate()[2]);
-    const IMU::Bias db = mpInt->GetDeltaBias(b);
-
-    Eigen::Vector3d dbg;
-    dbg << db.bwx, db.bwy, db.bwz;
+    UpdateDeltas(VG->estimate(),VA->estimate());
 
     const Eigen::Matrix3d Rwb1 = VP1->estimate().Rwb;
     const Eigen::Matrix3d Rbw1 = Rwb1.transpose();
     const Eigen::Matrix3d Rwb2 = VP2->estimate().Rwb;
     const Eigen::Matrix3d Rwg = VGDir->estimate().Rwg;
-    Eigen::MatrixXd Gm = Eigen::MatrixXd::Zero(3,2);
+    Eigen::Matrix<double,3,2> Gm = Eigen::Matrix<double,3,2>::Zero();
     Gm(0,1) = -IMU::GRAVITY_VALUE;
     Gm(1,0) = IMU::GRAVITY_VALUE;
     const double s = VS->estimate();
-    const Eigen::MatrixXd dGdTheta = Rwg*Gm;
-    const Eigen::Matrix3d dR = Converter::toMatrix3d(mpInt->GetDeltaRotation(b));
-    const Eigen::Matrix3d eR = dR.transpose()*Rbw1*Rwb2;
+    const Eigen::Matrix<double,3,2> dGdTheta = Rwg*Gm;
+    const Eigen::Matrix3d eR = mdR.transpose()*Rbw1*Rwb2;
     const Eigen::Vector3d er = LogSO3(eR);
     const Eigen::Matrix3d invJr = InverseRightJacobianSO3(er);
 
@@ -692,7 +782,7 @@ void EdgeInertialGS::linearizeOplus()
 
     // Jacobians wrt Gyro bias
     _jacobianOplus[2].setZero();
-    _jacobianOplus[2].block<3,3>(0,0) = -invJr*eR.transpose()*RightJacobianSO3(JRg*dbg)*JRg;
+    _jacobianOplus[2].block<3,3>(0,0) = -invJr*eR.transpose()*RightJacobianSO3(JRg*mdbg)*JRg;
     _jacobianOplus[2].block<3,3>(3,0) = -JVg;
     _jacobianOplus[2].block<3,3>(6,0) = -JPg;
 
@@ -727,6 +817,7 @@ EdgePriorPoseImu::EdgePriorPoseImu(ConstraintPoseImu *c)
 {
     resize(4);
     Rwb = c->Rwb;
+    Rbw = Rwb.transpose();
     twb = c->twb;
     vwb = c->vwb;
     bg = c->bg;
@@ -741,8 +832,8 @@ void EdgePriorPoseImu::computeError()
     const VertexGyroBias* VG = static_cast<const VertexGyroBias*>(_vertices[2]);
     const VertexAccBias* VA = static_cast<const VertexAccBias*>(_vertices[3]);
 
-    const Eigen::Vector3d er = LogSO3(Rwb.transpose()*VP->estimate().Rwb);
-    const Eigen::Vector3d et = Rwb.transpose()*(VP->estimate().twb-twb);
+    const Eigen::Vector3d er = LogSO3(Rbw*VP->estimate().Rwb);
+    const Eigen::Vector3d et = Rbw*(VP->estimate().twb-twb);
     const Eigen::Vector3d ev = VV->estimate() - vwb;
     const Eigen::Vector3d ebg = VG->estimate() - bg;
     const Eigen::Vector3d eba = VA->estimate() - ba;
@@ -753,10 +844,11 @@ void EdgePriorPoseImu::computeError()
 void EdgePriorPoseImu::linearizeOplus()
 {
     const VertexPose* VP = static_cast<const VertexPose*>(_vertices[0]);
-    const Eigen::Vector3d er = LogSO3(Rwb.transpose()*VP->estimate().Rwb);
+    const Eigen::Matrix3d Rbb = Rbw*VP->estimate().Rwb;
+    const Eigen::Vector3d er = LogSO3(Rbb);
     _jacobianOplus[0].setZero();
     _jacobianOplus[0].block<3,3>(0,0) = InverseRightJacobianSO3(er);
-    _jacobianOplus[0].block<3,3>(3,3) = Rwb.transpose()*VP->estimate().Rwb;
+    _jacobianOplus[0].block<3,3>(3,3) = Rbb;
     _jacobianOplus[1].setZero();
     _jacobianOplus[1].block<3,3>(6,0) = Eigen::Matrix3d::Identity();
     _jacobianOplus[2].setZero();
@@ -765,6 +857,35 @@ void EdgePriorPoseImu::linearizeOplus()
     _jacobianOplus[3].block<3,3>(12,0) = Eigen::Matrix3d::Identity();
 }
 
+void Edge4DoF::linearizeOplus()
+{
+    // Yaw and translation are applied in the world frame: Rwb <- Exp(yaw*ez)*Rwb, twb <- twb+t
+    const VertexPose4DoF* VPi = static_cast<const VertexPose4DoF*>(_vertices[0]);
+    const VertexPose4DoF* VPj = static_cast<const VertexPose4DoF*>(_vertices[1]);
+    const Eigen::Matrix3d &Ri = VPi->estimate().Rcw[0];
+    const Eigen::Matrix3d &Rj = VPj->estimate().Rcw[0];
+    const Eigen::Vector3d er = LogSO3(Ri*Rj.transpose()*dRij.transpose());
+    const Eigen::Matrix3d invJr = InverseRightJacobianSO3(er);
+    const Eigen::Vector3d dRRjz = dRij*Rj.col(2);
+
+    // Camera center of j relative to the body of i, expressed in the world frame
+    const Eigen::Vector3d Rjtcbj = Rj.transpose()*VPj->estimate().tcb[0];
+    const Eigen::Vector3d v = VPj->estimate().twb - VPi->estimate().twb - Rjtcbj;
+    const Eigen::Vector3d ez(0.0,0.0,1.0);
+
+    // Jacobians wrt Pose i
+    _jacobianOplusXi.setZero();
+    _jacobianOplusXi.block<3,1>(0,0) = -invJr*dRRjz;
+    _jacobianOplusXi.block<3,1>(3,0) = Ri*Skew(v)*ez;
+    _jacobianOplusXi.block<3,3>(3,1) = -Ri;
+
+    // Jacobians wrt Pose j
+    _jacobianOplusXj.setZero();
+    _jacobianOplusXj.block<3,1>(0,0) = invJr*dRRjz;
+    _jacobianOplusXj.block<3,1>(3,0) = Ri*Skew(Rjtcbj)*ez;
+    _jacobianOplusXj.block<3,3>(3,1) = Ri;
+}
+
 void EdgePriorAcc::linearizeOplus()
 {
     // Jacobian wrt bias
@@ -791,16 +912,12 @@ Eigen::Matrix3d ExpSO3(const double x, const double y, const double z)
     const double d = sqrt(d2);
     Eigen::Matrix3d W;
     W << 0.0, -z, y,z, 0.0, -x,-y,  x, 0.0;
+    // Both expressions are orthonormal to double precision (the truncation error of the
+    // small angle one is below 1e-15), so no SVD normalization through cv::Mat is needed
     if(d<1e-5)
-    {
-        Eigen::Matrix3d res = Eigen::Matrix3d::Identity() + W +0.5*W*W;
-        return Converter::toMatrix3d(IMU::NormalizeRotation(Converter::toCvMat(res)));
-    }
+        return Eigen::Matrix3d::Identity() + W +0.5*W*W;
     else
-    {
-        Eigen::Matrix3d res =Eigen::Matrix3d::Identity() + W*sin(d)/d + W*W*(1.0-cos(d))/d2;
-        return Converter::toMatrix3d(IMU::NormalizeRotation(Converter::toCvMat(res)));
-    }
+        return Eigen::Matrix3d::Identity() + W*sin(d)/d + W*W*(1.0-cos(d))/d2;
 }
 
 Eigen::Vector3d LogSO3(const Eigen::Matrix3d &R)
@@ -0,0 +1,325 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "GlobalDescriptorIndex.h"
+
+#include <algorithm>
+#include <cmath>
+#include <queue>
+#include <stdint.h>
+
+namespace ORB_SLAM3
+{
+
+// Word id hash (splitmix64 finalizer)
+static inline uint64_t HashWord(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+GlobalDescriptorIndex::GlobalDescriptorIndex(const int nDim, const int M, const int efConstruction):
+    mnDim(nDim>0 ? nDim : 256), mnM(M>1 ? M : 16), mnEfConstruction(std::max(efConstruction, M)),
+    mfLevelMult(1.0/std::log(double(M>1 ? M : 16))), mnRemoved(0), mnEntry(-1), mnMaxLevel(-1),
+    mRng(5489u), mnVisitStamp(0)
+{
+}
+
+void GlobalDescriptorIndex::ComputeDescriptor(const DBoW2::BowVector &vBowVec, const int nDim, std::vector<float> &vDesc)
+{
+    vDesc.assign(nDim, 0.f);
+    for(DBoW2::BowVector::const_iterator vit=vBowVec.begin(), vend=vBowVec.end(); vit!=vend; vit++)
+    {
+        // Each word adds its weight to one component, with a sign, both from its hash
+        const uint64_t h = HashWord(vit->first);
+        const float w = float(vit->second);
+        vDesc[h%nDim] += (h>>63) ? -w : w;
+    }
+
+    float norm = 0;
+    for(int i=0; i<nDim; i++)
+        norm += vDesc[i]*vDesc[i];
+    if(norm>0)
+    {
+        const float invNorm = 1.f/std::sqrt(norm);
+        for(int i=0; i<nDim; i++)
+            vDesc[i] *= invNorm;
+    }
+}
+
+float GlobalDescriptorIndex::Distance(const float* a, const float* b) const
+{
+    float dot = 0;
+    for(int i=0; i<mnDim; i++)
+        dot += a[i]*b[i];
+    return 1.f-dot;
+}
+
+void GlobalDescriptorIndex::Add(KeyFrame* pKF, const std::vector<float> &vDesc)
+{
+    if(int(vDesc.size())!=mnDim || mmNodes.count(pKF))
+        return;
+
+    const int n = mvNodes.size();
+    mvData.insert(mvData.end(), vDesc.begin(), vDesc.end());
+
+    // Top layer drawn from an exponential distribution, as in HNSW
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    const int level = int(-std::log(1.0-uniform(mRng))*mfLevelMult);
+
+    mvNodes.push_back(Node());
+    Node &node = mvNodes.back();
+    node.pKF = pKF;
+    node.bRemoved = false;
+    node.vvNeighbours.resize(level+1);
+    mmNodes[pKF] = n;
+
+    Insert(n);
+}
+
+void GlobalDescriptorIndex::Insert(const int n)
+{
+    const int level = mvNodes[n].vvNeighbours.size()-1;
+    if(mnEntry<0)
+    {
+        mnEntry = n;
+        mnMaxLevel = level;
+        return;
+    }
+
+    const float* q = Data(n);
+    std::vector<int> vEntry(1, mnEntry);
+    std::vector<std::pair<float,int> > vResult;
+
+    // Greedy descent through the layers above the one of the node
+    for(int l=mnMaxLevel; l>level; l--)
+    {
+        SearchLayer(q, vEntry, 1, l, vResult);
+        vEntry[0] = vResult[0].second;
+    }
+
+    std::vector<int> vSelected;
+    std::vector<std::pair<float,int> > vCandidates;
+    for(int l=std::min(level,mnMaxLevel); l>=0; l--)
+    {
+        SearchLayer(q, vEntry, mnEfConstruction, l, vResult);
+        SelectNeighbours(vResult, mnM, vSelected);
+        mvNodes[n].vvNeighbours[l] = vSelected;
+
+        // Links back, pruning the neighbours that exceed the maximum degree of the layer
+        const size_t nMaxDegree = l==0 ? 2*mnM : mnM;
+        for(size_t i=0; i<vSelected.size(); i++)
+        {
+            const int m = vSelected[i];
+            std::vector<int> &vNeighbours = mvNodes[m].vvNeighbours[l];
+            vNeighbours.push_back(n);
+            if(vNeighbours.size()<=nMaxDegree)
+                continue;
+
+            vCandidates.clear();
+            for(size_t k=0; k<vNeighbours.size(); k++)
+                vCandidates.push_back(std::make_pair(Distance(Data(m),Data(vNeighbours[k])), vNeighbours[k]));
+            std::sort(vCandidates.begin(), vCandidates.end());
+            std::vector<int> vPruned;
+            SelectNeighbours(vCandidates, nMaxDegree, vPruned);
+            mvNodes[m].vvNeighbours[l].swap(vPruned);
+        }
+
+        vEntry.clear();
+        for(size_t i=0; i<vResult.size(); i++)
+            vEntry.push_back(vResult[i].second);
+    }
+
+    if(level>mnMaxLevel)
+    {
+        mnMaxLevel = level;
+        mnEntry = n;
+    }
+}
+
+void GlobalDescriptorIndex::SearchLayer(const float* q, const std::vector<int> &vEntry, const int ef, const int level,
+                                        std::vector<std::pair<float,int> > &vResult) const
+{
+    if(mvVisited.size()<mvNodes.size())
+        mvVisited.resize(mvNodes.size(), 0);
+    if(++mnVisitStamp==0)
+    {
+        std::fill(mvVisited.begin(), mvVisited.end(), 0);
+        mnVisitStamp = 1;
+    }
+
+    typedef std::pair<float,int> DistNode;
+    // Candidates to expand, closest on top, and best found, farthest on top
+    std::priority_queue<DistNode, std::vector<DistNode>, std::greater<DistNode> > candidates;
+    std::priority_queue<DistNode> best;
+
+    for(size_t i=0; i<vEntry.size(); i++)
+    {
+        const int e = vEntry[i];
+        if(mvVisited[e]==mnVisitStamp)
+            continue;
+        mvVisited[e] = mnVisitStamp;
+        const float d = Distance(q, Data(e));
+        candidates.push(DistNode(d,e));
+        best.push(DistNode(d,e));
+        if(int(best.size())>ef)
+            best.pop();
+    }
+
+    while(!candidates.empty())
+    {
+        const DistNode c = candidates.top();
+        if(int(best.size())>=ef && c.first>best.top().first)
+            break;
+        candidates.pop();
+
+        const std::vector<int> &vNeighbours = mvNodes[c.second].vvNeighbours[level];
+        for(size_t i=0; i<vNeighbours.size(); i++)
+        {
+            const int k = vNeighbours[i];
+            if(mvVisited[k]==mnVisitStamp)
+                continue;
+            mvVisited[k] = mnVisitStamp;
+
+            const float d = Distance(q, Data(k));
+            if(int(best.size())<ef || d<best.top().first)
+            {
+                candidates.push(DistNode(d,k));
+                best.push(DistNode(d,k));
+                if(int(best.size())>ef)
+                    best.pop();
+            }
+        }
+    }
+
+    vResult.resize(best.size());
+    for(int i=int(best.size())-1; i>=0; i--)
+    {
+        vResult[i] = best.top();
+        best.pop();
+    }
+}
+
+void GlobalDescriptorIndex::SelectNeighbours(const std::vector<std::pair<float,int> > &vCandidates, const int nM, std::vector<int> &vSelected) const
+{
+    // A candidate closer to a selected neighbour than to the node is reached through it. The
+    // skipped ones fill the remaining links so that small graphs stay connected
+    vSelected.clear();
+    std::vector<int> vSkipped;
+    for(size_t i=0; i<vCandidates.size() && int(vSelected.size())<nM; i++)
+    {
+        const int c = vCandidates[i].second;
+        bool bDiverse = true;
+        for(size_t j=0; j<vSelected.size() && bDiverse; j++)
+            bDiverse = Distance(Data(c),Data(vSelected[j])) >= vCandidates[i].first;
+        if(bDiverse)
+            vSelected.push_back(c);
+        else
+            vSkipped.push_back(c);
+    }
+
+    for(size_t i=0; i<vSkipped.size() && int(vSelected.size())<nM; i++)
+        vSelected.push_back(vSkipped[i]);
+}
+
+void GlobalDescriptorIndex::Remove(KeyFrame* pKF)
+{
+    std::unordered_map<KeyFrame*,int>::iterator it = mmNodes.find(pKF);
+    if(it==mmNodes.end())
+        return;
+
+    mvNodes[it->second].bRemoved = true;
+    mmNodes.erase(it);
+    mnRemoved++;
+
+    if(mvNodes.size()>64 && 2*mnRemoved>mvNodes.size())
+        Rebuild();
+}
+
+void GlobalDescriptorIndex::Rebuild()
+{
+    std::vector<Node> vOldNodes;
+    std::vector<float> vOldData;
+    vOldNodes.swap(mvNodes);
+    vOldData.swap(mvData);
+
+    mmNodes.clear();
+    mnRemoved = 0;
+    mnEntry = -1;
+    mnMaxLevel = -1;
+    mvVisited.clear();
+
+    std::vector<float> vDesc(mnDim);
+    for(size_t n=0; n<vOldNodes.size(); n++)
+    {
+        if(vOldNodes[n].bRemoved)
+            continue;
+        std::copy(vOldData.begin()+n*mnDim, vOldData.begin()+(n+1)*mnDim, vDesc.begin());
+        Add(vOldNodes[n].pKF, vDesc);
+    }
+}
+
+void GlobalDescriptorIndex::Search(const std::vector<float> &vQuery, const int nK, const int ef, std::vector<KeyFrame*> &vpKFs) const
+{
+    vpKFs.clear();
+    if(mnEntry<0 || mmNodes.empty() || int(vQuery.size())!=mnDim || nK<=0)
+        return;
+
+    const float* q = vQuery.data();
+    std::vector<int> vEntry(1, mnEntry);
+    std::vector<std::pair<float,int> > vResult;
+    for(int l=mnMaxLevel; l>0; l--)
+    {
+        SearchLayer(q, vEntry, 1, l, vResult);
+        vEntry[0] = vResult[0].second;
+    }
+
+    // Removed nodes are walked through but not returned
+    SearchLayer(q, vEntry, std::max(ef,nK), 0, vResult);
+    for(size_t i=0; i<vResult.size() && int(vpKFs.size())<nK; i++)
+    {
+        const Node &node = mvNodes[vResult[i].second];
+        if(!node.bRemoved)
+            vpKFs.push_back(node.pKF);
+    }
+}
+
+void GlobalDescriptorIndex::GetKeyFrames(std::vector<KeyFrame*> &vpKFs) const
+{
+    vpKFs.clear();
+    vpKFs.reserve(mmNodes.size());
+    for(std::unordered_map<KeyFrame*,int>::const_iterator it=mmNodes.begin(); it!=mmNodes.end(); it++)
+        vpKFs.push_back(it->first);
+}
+
+size_t GlobalDescriptorIndex::Memory() const
+{
+    size_t nBytes = mvData.capacity()*sizeof(float) + mvNodes.capacity()*sizeof(Node) + mvVisited.capacity()*sizeof(unsigned int);
+    for(size_t n=0; n<mvNodes.size(); n++)
+    {
+        nBytes += mvNodes[n].vvNeighbours.capacity()*sizeof(std::vector<int>);
+        for(size_t l=0; l<mvNodes[n].vvNeighbours.size(); l++)
+            nBytes += mvNodes[n].vvNeighbours[l].capacity()*sizeof(int);
+    }
+    nBytes += mmNodes.size()*(sizeof(KeyFrame*)+sizeof(int)+2*sizeof(void*));
+    return nBytes;
+}
+
+} //namespace ORB_SLAM3
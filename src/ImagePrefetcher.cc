@@ -0,0 +1,144 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "ImagePrefetcher.h"
+
+#include <opencv2/highgui/highgui.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+namespace ORB_SLAM3
+{
+
+ImagePrefetcher::ImagePrefetcher(const std::vector<std::vector<std::string> > &vvFilenames, const int flag,
+                                 const int nThreads, const int nQueue):
+    mvvFilenames(vvFilenames), mFlag(flag), mnQueue(nQueue>0 ? nQueue : 1), mnNext(0), mnFirst(0), mbFinish(false)
+{
+    const int n = std::max(1, nThreads);
+    for(int i=0; i<n; i++)
+        mvThreads.push_back(std::thread(&ImagePrefetcher::Run, this));
+}
+
+ImagePrefetcher::~ImagePrefetcher()
+{
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mbFinish = true;
+    }
+    mcvSpace.notify_all();
+    for(size_t i=0; i<mvThreads.size(); i++)
+        mvThreads[i].join();
+}
+
+void ImagePrefetcher::Run()
+{
+    while(true)
+    {
+        size_t ni;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mcvSpace.wait(lock, [this]{ return mbFinish || mnNext>=mvvFilenames.size() || mnNext<mnFirst+mnQueue; });
+            if(mbFinish || mnNext>=mvvFilenames.size())
+                return;
+            ni = mnNext++;
+        }
+
+        std::vector<cv::Mat> vIms(mvvFilenames[ni].size());
+        for(size_t j=0; j<vIms.size(); j++)
+            vIms[j] = cv::imread(mvvFilenames[ni][j], mFlag);
+
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            if(ni>=mnFirst)
+                mmDecoded[ni].swap(vIms);
+        }
+        mcvDecoded.notify_all();
+    }
+}
+
+void ImagePrefetcher::Get(const size_t ni, std::vector<cv::Mat> &vIms)
+{
+    vIms.clear();
+    if(ni>=mvvFilenames.size())
+        return;
+
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+
+        // Frames before ni are not needed anymore
+        if(ni>mnFirst)
+        {
+            mmDecoded.erase(mmDecoded.begin(), mmDecoded.lower_bound(ni));
+            mnFirst = ni;
+            if(mnNext<ni)
+                mnNext = ni;
+        }
+        mcvSpace.notify_all();
+
+        if(ni<mnFirst)
+        {
+            // Already taken, read it again
+            lock.unlock();
+            vIms.resize(mvvFilenames[ni].size());
+            for(size_t j=0; j<vIms.size(); j++)
+                vIms[j] = cv::imread(mvvFilenames[ni][j], mFlag);
+            return;
+        }
+
+        mcvDecoded.wait(lock, [this,ni]{ return mmDecoded.count(ni)>0; });
+        vIms.swap(mmDecoded[ni]);
+        mmDecoded.erase(ni);
+        mnFirst = ni+1;
+    }
+    mcvSpace.notify_all();
+}
+
+cv::Mat ImagePrefetcher::Get(const size_t ni)
+{
+    std::vector<cv::Mat> vIms;
+    Get(ni, vIms);
+    return vIms.empty() ? cv::Mat() : vIms[0];
+}
+
+void ImagePrefetcher::Get(const size_t ni, cv::Mat &im1, cv::Mat &im2)
+{
+    std::vector<cv::Mat> vIms;
+    Get(ni, vIms);
+    im1 = vIms.size()>0 ? vIms[0] : cv::Mat();
+    im2 = vIms.size()>1 ? vIms[1] : cv::Mat();
+}
+
+bool ImagePrefetcher::ParseFastMode(int &argc, char **argv)
+{
+    bool bFast = false;
+    int n = 1;
+    for(int i=1; i<argc; i++)
+    {
+        if(strcmp(argv[i], "--fast")==0)
+            bFast = true;
+        else
+            argv[n++] = argv[i];
+    }
+    argc = n;
+    argv[argc] = NULL;
+    return bFast;
+}
+
+} //namespace ORB_SLAM3
@@ -0,0 +1,240 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ImuInitializer.h"
+#include "KeyFrame.h"
+#include "ImuTypes.h"
+#include "Converter.h"
+
+#include <Eigen/Dense>
+
+#include <algorithm>
+#include <cmath>
+
+namespace ORB_SLAM3
+{
+
+static inline Eigen::Matrix3d ExpSO3(const Eigen::Vector3d &w)
+{
+    return IMU::ExpSO3(w(0),w(1),w(2));
+}
+
+static inline Eigen::Vector3d LogSO3(const Eigen::Matrix3d &R)
+{
+    const Eigen::AngleAxisd aa(R);
+    return aa.angle()*aa.axis();
+}
+
+ImuInitializer::ImuInitializer(): mThScaleSigma(0.1), mbFixScale(false), mRwg(Eigen::Matrix3d::Identity()),
+    mg(Eigen::Vector3d::Zero()), mScale(1.0), mScaleSigma(0.0), mbg(Eigen::Vector3d::Zero())
+{
+}
+
+bool ImuInitializer::Solve(const std::vector<KeyFrame*> &vpKF, const bool bFixScale)
+{
+    mbFixScale = bFixScale;
+
+    // 3N+4 unknowns (velocities, gravity and scale) for 6(N-1) equations
+    const int N = vpKF.size();
+    if(N<4)
+        return false;
+
+    mvRwb.resize(N);
+    mvOw.resize(N);
+    mvLever.resize(N);
+    mvdT.resize(N-1);
+    mvdR.resize(N-1);
+    mvdV.resize(N-1);
+    mvdP.resize(N-1);
+    mvJRg.resize(N-1);
+    mvJVg.resize(N-1);
+    mvJVa.resize(N-1);
+    mvJPg.resize(N-1);
+    mvJPa.resize(N-1);
+    mvbg0.resize(N-1);
+    mvba0.resize(N-1);
+
+    for(int i=0; i<N; i++)
+    {
+        KeyFrame* pKF = vpKF[i];
+        if(i>0 && (!pKF->mpImuPreintegrated || pKF->mPrevKF!=vpKF[i-1]))
+            return false;
+
+        mvRwb[i] = Converter::toMatrix3d(pKF->GetImuRotation());
+        mvOw[i] = Converter::toVector3d(pKF->GetCameraCenter());
+        mvLever[i] = Converter::toVector3d(pKF->GetImuPosition())-mvOw[i];
+        if(i==0)
+            continue;
+
+        IMU::Preintegrated* pInt = pKF->mpImuPreintegrated;
+        const int k = i-1;
+        mvdT[k] = pInt->dT;
+        mvdR[k] = Converter::toMatrix3d(pInt->GetOriginalDeltaRotation_());
+        mvdV[k] = Converter::toVector3d(pInt->GetOriginalDeltaVelocity_());
+        mvdP[k] = Converter::toVector3d(pInt->GetOriginalDeltaPosition_());
+        mvJRg[k] = Converter::toMatrix3d(pInt->JRg);
+        mvJVg[k] = Converter::toMatrix3d(pInt->JVg);
+        mvJVa[k] = Converter::toMatrix3d(pInt->JVa);
+        mvJPg[k] = Converter::toMatrix3d(pInt->JPg);
+        mvJPa[k] = Converter::toMatrix3d(pInt->JPa);
+        const IMU::Bias b0 = pInt->GetOriginalBias();
+        mvbg0[k] << b0.bwx, b0.bwy, b0.bwz;
+        mvba0[k] << b0.bax, b0.bay, b0.baz;
+    }
+
+    // Gyroscope bias: dR(bg) = dR*Exp(JRg*(bg-bg0)) has to match Rwb_k^T*Rwb_k+1
+    mbg.setZero();
+    for(int it=0; it<2; it++)
+    {
+        Eigen::Matrix3d H = Eigen::Matrix3d::Zero();
+        Eigen::Vector3d r = Eigen::Vector3d::Zero();
+        for(int k=0; k<N-1; k++)
+        {
+            const Eigen::Matrix3d dR = mvdR[k]*ExpSO3(mvJRg[k]*(mbg-mvbg0[k]));
+            const Eigen::Vector3d e = LogSO3(dR.transpose()*mvRwb[k].transpose()*mvRwb[k+1]);
+            H += mvJRg[k].transpose()*mvJRg[k];
+            r += mvJRg[k].transpose()*e;
+        }
+        mbg += H.ldlt().solve(r);
+    }
+
+    // Free gravity first, its magnitude tells whether the solution makes sense
+    if(!SolveVelocitiesGravityScale(false))
+        return false;
+    if(std::fabs(mg.norm()-IMU::GRAVITY_VALUE)>0.2*IMU::GRAVITY_VALUE)
+        return false;
+
+    for(int it=0; it<4; it++)
+        if(!SolveVelocitiesGravityScale(true))
+            return false;
+
+    if(!mbFixScale && (mScale<=0.0 || mScaleSigma>mThScaleSigma))
+        return false;
+
+    // Same parametrization as the direction of gravity in LocalMapping::InitializeIMU
+    const Eigen::Vector3d dirG = mg.normalized();
+    const Eigen::Vector3d gI(0.0,0.0,-1.0);
+    const Eigen::Vector3d v = gI.cross(dirG);
+    const double nv = v.norm();
+    if(nv<1e-9)
+        mRwg = gI.dot(dirG)>0.0 ? Eigen::Matrix3d::Identity() : IMU::ExpSO3(M_PI,0.0,0.0);
+    else
+        mRwg = ExpSO3(v*std::acos(std::max(-1.0,std::min(1.0,gI.dot(dirG))))/nv);
+
+    return true;
+}
+
+bool ImuInitializer::SolveVelocitiesGravityScale(const bool bRefineGravity)
+{
+    const int N = mvRwb.size();
+    const int nG = bRefineGravity ? 2 : 3;
+    const int nS = mbFixScale ? 0 : 1;
+    const int n = 3*N+nG+nS;
+    const int m = 6*(N-1);
+
+    // Gravity mg + B*w with B a basis of the tangent plane, or the free vector
+    Eigen::MatrixXd B = Eigen::MatrixXd::Identity(3,nG);
+    Eigen::Vector3d g0 = Eigen::Vector3d::Zero();
+    if(bRefineGravity)
+    {
+        const Eigen::Vector3d dirG = mg.normalized();
+        g0 = IMU::GRAVITY_VALUE*dirG;
+        Eigen::Vector3d a = Eigen::Vector3d::UnitX();
+        if(std::fabs(dirG.dot(a))>0.9)
+            a = Eigen::Vector3d::UnitZ();
+        const Eigen::Vector3d b1 = (a-dirG*dirG.dot(a)).normalized();
+        B.col(0) = b1;
+        B.col(1) = dirG.cross(b1);
+    }
+
+    // IMU positions p = s*Ow + lever, for each interval:
+    //   s*(Ow_k+1 - Ow_k) - v_k*dt - 0.5*g*dt^2 = Rwb_k*dP - lever_k+1 + lever_k
+    //   v_k+1 - v_k - g*dt = Rwb_k*dV
+    Eigen::MatrixXd A = Eigen::MatrixXd::Zero(m,n);
+    Eigen::VectorXd b(m);
+    for(int k=0; k<N-1; k++)
+    {
+        const double dt = mvdT[k];
+        const Eigen::Vector3d dbg = mbg-mvbg0[k];
+        const Eigen::Vector3d dba = -mvba0[k];
+        const Eigen::Vector3d dV = mvdV[k]+mvJVg[k]*dbg+mvJVa[k]*dba;
+        const Eigen::Vector3d dP = mvdP[k]+mvJPg[k]*dbg+mvJPa[k]*dba;
+        const Eigen::Vector3d dOw = mvOw[k+1]-mvOw[k];
+        const int row = 6*k;
+
+        A.block<3,3>(row,3*k) = -dt*Eigen::Matrix3d::Identity();
+        A.block(row,3*N,3,nG) = -0.5*dt*dt*B;
+        b.segment<3>(row) = mvRwb[k]*dP-mvLever[k+1]+mvLever[k]+0.5*dt*dt*g0;
+        if(nS)
+            A.block<3,1>(row,3*N+nG) = dOw;
+        else
+            b.segment<3>(row) -= dOw;
+
+        A.block<3,3>(row+3,3*k) = -Eigen::Matrix3d::Identity();
+        A.block<3,3>(row+3,3*(k+1)) = Eigen::Matrix3d::Identity();
+        A.block(row+3,3*N,3,nG) = -dt*B;
+        b.segment<3>(row+3) = mvRwb[k]*dV+dt*g0;
+    }
+
+    const Eigen::MatrixXd H = A.transpose()*A;
+    const Eigen::LDLT<Eigen::MatrixXd> ldlt(H);
+    if(ldlt.info()!=Eigen::Success)
+        return false;
+    const Eigen::VectorXd x = ldlt.solve(A.transpose()*b);
+    if(!x.allFinite())
+        return false;
+
+    mvVelocities.resize(N);
+    for(int i=0; i<N; i++)
+        mvVelocities[i] = x.segment<3>(3*i);
+
+    if(bRefineGravity)
+        mg = IMU::GRAVITY_VALUE*(g0+B*x.segment<2>(3*N)).normalized();
+    else
+        mg = x.segment<3>(3*N);
+
+    mScale = 1.0;
+    mScaleSigma = 0.0;
+    if(nS)
+    {
+        mScale = x(n-1);
+
+        // Covariance of the scale from the residual of the fit
+        const int dof = m-n;
+        if(dof<=0)
+            return false;
+        const double sigma2 = (A*x-b).squaredNorm()/dof;
+        const Eigen::VectorXd Hinv_s = ldlt.solve(Eigen::VectorXd::Unit(n,n-1));
+        mScaleSigma = std::sqrt(std::max(0.0,sigma2*Hinv_s(n-1)))/std::fabs(mScale);
+    }
+
+    return true;
+}
+
+void ImuInitializer::Apply(const std::vector<KeyFrame*> &vpKF) const
+{
+    const IMU::Bias b(0,0,0,mbg(0),mbg(1),mbg(2));
+    for(size_t i=0; i<vpKF.size() && i<mvVelocities.size(); i++)
+    {
+        const Eigen::Vector3d v = mvVelocities[i]/mScale;
+        vpKF[i]->SetVelocity(Converter::toCvMat(v));
+        vpKF[i]->SetNewBias(b);
+    }
+}
+
+} //namespace ORB_SLAM3
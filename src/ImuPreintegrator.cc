@@ -0,0 +1,344 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ImuPreintegrator.h"
+
+#include <limits>
+#include <iostream>
+#include <unistd.h>
+
+namespace ORB_SLAM3
+{
+
+namespace IMU
+{
+
+static bool SameBias(const Bias &b1, const Bias &b2)
+{
+    return b1.bax==b2.bax && b1.bay==b2.bay && b1.baz==b2.baz &&
+           b1.bwx==b2.bwx && b1.bwy==b2.bwy && b1.bwz==b2.bwz;
+}
+
+Preintegrator::Preintegrator(MeasurementQueue* pQueue):
+    mpQueue(pQueue), mbStarted(false), mtStart(0), mpFramePreintegrated(static_cast<Preintegrated*>(NULL)),
+    mpKFSource(static_cast<Preintegrated*>(NULL)), mpKFPreintegrated(static_cast<Preintegrated*>(NULL)), mKFBaseDT(0),
+    mnSteps(0), mbStateValid(false), mbFinishRequested(false), mbFinished(true)
+{
+}
+
+Preintegrator::~Preintegrator()
+{
+    ResetInterval();
+}
+
+void Preintegrator::Run()
+{
+    {
+        std::unique_lock<std::mutex> lock(mMutexFinish);
+        mbFinished = false;
+    }
+
+    std::vector<Prediction> vPredictions;
+    while(!CheckFinish())
+    {
+        PoseCallback callback;
+        {
+            std::unique_lock<std::mutex> lock(mMutexCallback);
+            callback = mPoseCallback;
+        }
+
+        vPredictions.clear();
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            Update(std::numeric_limits<double>::infinity(), callback ? &vPredictions : static_cast<std::vector<Prediction>*>(NULL));
+        }
+
+        // Published without the lock, the callback may ask for the prediction
+        for(size_t i=0; i<vPredictions.size(); i++)
+        {
+            const Prediction &pred = vPredictions[i];
+            cv::Mat Twb = cv::Mat::eye(4,4,CV_32F);
+            cv::Mat(pred.Rwb).copyTo(Twb.rowRange(0,3).colRange(0,3));
+            cv::Mat(pred.twb).copyTo(Twb.rowRange(0,3).col(3));
+            callback(pred.t, Twb, cv::Mat(pred.Vwb));
+        }
+
+        usleep(1000);
+    }
+
+    SetFinish();
+}
+
+void Preintegrator::RequestFinish()
+{
+    std::unique_lock<std::mutex> lock(mMutexFinish);
+    mbFinishRequested = true;
+}
+
+bool Preintegrator::CheckFinish()
+{
+    std::unique_lock<std::mutex> lock(mMutexFinish);
+    return mbFinishRequested;
+}
+
+void Preintegrator::SetFinish()
+{
+    std::unique_lock<std::mutex> lock(mMutexFinish);
+    mbFinished = true;
+}
+
+bool Preintegrator::isFinished()
+{
+    std::unique_lock<std::mutex> lock(mMutexFinish);
+    return mbFinished;
+}
+
+void Preintegrator::ComputeStep(const std::vector<Point> &vPoints, const int i, const int n, const double &tStart, const double &tEnd,
+                                cv::Point3f &acc, cv::Point3f &angVel, float &tstep)
+{
+    if((i==0) && (i<(n-1)))
+    {
+        // First step, from the start of the interval to the second measurement
+        float tab = vPoints[i+1].t-vPoints[i].t;
+        float tini = vPoints[i].t-tStart;
+        acc = (vPoints[i].a+vPoints[i+1].a-(vPoints[i+1].a-vPoints[i].a)*(tini/tab))*0.5f;
+        angVel = (vPoints[i].w+vPoints[i+1].w-(vPoints[i+1].w-vPoints[i].w)*(tini/tab))*0.5f;
+        tstep = vPoints[i+1].t-tStart;
+    }
+    else if(i<(n-1))
+    {
+        acc = (vPoints[i].a+vPoints[i+1].a)*0.5f;
+        angVel = (vPoints[i].w+vPoints[i+1].w)*0.5f;
+        tstep = vPoints[i+1].t-vPoints[i].t;
+    }
+    else if((i>0) && (i==(n-1)))
+    {
+        // Last step, up to the end of the interval
+        float tab = vPoints[i+1].t-vPoints[i].t;
+        float tend = vPoints[i+1].t-tEnd;
+        acc = (vPoints[i].a+vPoints[i+1].a-(vPoints[i+1].a-vPoints[i].a)*(tend/tab))*0.5f;
+        angVel = (vPoints[i].w+vPoints[i+1].w-(vPoints[i+1].w-vPoints[i].w)*(tend/tab))*0.5f;
+        tstep = tEnd-vPoints[i].t;
+    }
+    else if((i==0) && (i==(n-1)))
+    {
+        acc = vPoints[i].a;
+        angVel = vPoints[i].w;
+        tstep = tEnd-tStart;
+    }
+}
+
+void Preintegrator::Update(const double tLimit, std::vector<Prediction>* pvPredictions)
+{
+    mpQueue->PopAll(mvPoints);
+
+    if(!mbStarted)
+        return;
+
+    // Steps that are not the last one if the frame comes after tLimit
+    while(mnSteps+1<static_cast<int>(mvPoints.size()) && mvPoints[mnSteps+1].t<tLimit-0.001l)
+    {
+        cv::Point3f acc, angVel;
+        float tstep;
+        ComputeStep(mvPoints,mnSteps,std::numeric_limits<int>::max(),mtStart,0,acc,angVel,tstep);
+        mpFramePreintegrated->IntegrateNewMeasurement(acc,angVel,tstep);
+        mpKFPreintegrated->IntegrateNewMeasurement(acc,angVel,tstep);
+        mnSteps++;
+
+        Prediction pred;
+        if(pvPredictions && Predict(pred))
+            pvPredictions->push_back(pred);
+    }
+}
+
+void Preintegrator::ResetInterval()
+{
+    delete mpFramePreintegrated;
+    delete mpKFPreintegrated;
+    mpFramePreintegrated = static_cast<Preintegrated*>(NULL);
+    mpKFPreintegrated = static_cast<Preintegrated*>(NULL);
+    mpKFSource = static_cast<Preintegrated*>(NULL);
+    mnSteps = 0;
+    mbStarted = false;
+    mbStateValid = false;
+}
+
+void Preintegrator::StartInterval(const double &tStart, const Bias &bias, const Calib &calib, Preintegrated* pKFPreintegrated,
+                                  const cv::Mat &Rwb, const cv::Mat &twb, const cv::Mat &Vwb)
+{
+    // Nothing is integrated ahead without the worker thread
+    if(isFinished() || !pKFPreintegrated)
+        return;
+
+    // Copied before taking the lock, the keyframe preintegration belongs to the tracking thread
+    Preintegrated* pKFCopy = new Preintegrated(pKFPreintegrated);
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    ResetInterval();
+    mpQueue->PopAll(mvPoints);
+
+    size_t nOld = 0;
+    while(nOld<mvPoints.size() && mvPoints[nOld].t<tStart-0.001l)
+        nOld++;
+    mvPoints.erase(mvPoints.begin(),mvPoints.begin()+nOld);
+
+    mtStart = tStart;
+    mBias = bias;
+    mpFramePreintegrated = new Preintegrated(bias,calib);
+    mpKFSource = pKFPreintegrated;
+    mpKFPreintegrated = pKFCopy;
+    mKFBaseDT = pKFCopy->dT;
+    mKFBaseOriginalBias = pKFCopy->GetOriginalBias();
+    mKFBaseUpdatedBias = pKFCopy->GetUpdatedBias();
+    mnSteps = 0;
+    mbStarted = true;
+
+    mbStateValid = !Rwb.empty() && !twb.empty() && !Vwb.empty();
+    if(mbStateValid)
+    {
+        mRwb = Rwb;
+        mtwb = twb;
+        mVwb = Vwb;
+    }
+}
+
+Preintegrated* Preintegrator::FinishInterval(const double &tStart, const double &tEnd, const Bias &bias, const Calib &calib,
+                                             Preintegrated* pKFPreintegrated, std::vector<Point> &vPoints)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    Update(tEnd);
+
+    if(mvPoints.empty())
+    {
+        ResetInterval();
+        return static_cast<Preintegrated*>(NULL);
+    }
+
+    bool bAhead = mbStarted && mtStart==tStart && SameBias(mBias,bias) && pKFPreintegrated==mpKFSource;
+    if(bAhead)
+    {
+        // The keyframe preintegration may have been reset or given a new bias meanwhile
+        bAhead = pKFPreintegrated->dT==mKFBaseDT && SameBias(pKFPreintegrated->GetOriginalBias(),mKFBaseOriginalBias) &&
+                 SameBias(pKFPreintegrated->GetUpdatedBias(),mKFBaseUpdatedBias);
+    }
+
+    size_t nOld = 0;
+    while(nOld<mvPoints.size() && mvPoints[nOld].t<tStart-0.001l)
+        nOld++;
+    if(nOld>0)
+    {
+        bAhead = false;
+        mvPoints.erase(mvPoints.begin(),mvPoints.begin()+nOld);
+    }
+
+    // Last measurement of the interval: first one after tEnd, or the last one received
+    int n = static_cast<int>(mvPoints.size())-1;
+    for(size_t i=0; i<mvPoints.size(); i++)
+    {
+        if(!(mvPoints[i].t<tEnd-0.001l))
+        {
+            n = i;
+            break;
+        }
+    }
+
+    // Steps integrated ahead are valid only if none of them is the last one
+    if(bAhead && mnSteps>n-1)
+        bAhead = false;
+
+    if(!bAhead)
+    {
+        ResetInterval();
+        mpFramePreintegrated = new Preintegrated(bias,calib);
+    }
+
+    Preintegrated* pKFTarget = bAhead ? mpKFPreintegrated : pKFPreintegrated;
+    if(!pKFTarget)
+        std::cout << "mpImuPreintegratedFromLastKF does not exist" << std::endl;
+
+    for(int i=mnSteps; i<n; i++)
+    {
+        cv::Point3f acc, angVel;
+        float tstep;
+        ComputeStep(mvPoints,i,n,tStart,tEnd,acc,angVel,tstep);
+        if(pKFTarget)
+            pKFTarget->IntegrateNewMeasurement(acc,angVel,tstep);
+        mpFramePreintegrated->IntegrateNewMeasurement(acc,angVel,tstep);
+    }
+
+    if(bAhead)
+        pKFPreintegrated->CopyFrom(mpKFPreintegrated);
+
+    // The last measurement starts the next interval
+    if(n>=0)
+    {
+        vPoints.insert(vPoints.end(),mvPoints.begin(),mvPoints.begin()+n+1);
+        mvPoints.erase(mvPoints.begin(),mvPoints.begin()+n);
+    }
+
+    Preintegrated* pFramePreintegrated = mpFramePreintegrated;
+    mpFramePreintegrated = static_cast<Preintegrated*>(NULL);
+    ResetInterval();
+    return pFramePreintegrated;
+}
+
+bool Preintegrator::Predict(Prediction &prediction)
+{
+    if(!mbStarted || !mbStateValid)
+        return false;
+
+    const cv::Matx31f Gz(0, 0, -GRAVITY_VALUE);
+    const float t12 = mpFramePreintegrated->dT;
+    prediction.Rwb = NormalizeRotation_(mRwb*mpFramePreintegrated->GetOriginalDeltaRotation_());
+    prediction.twb = mtwb + mVwb*t12 + 0.5f*t12*t12*Gz + mRwb*mpFramePreintegrated->GetOriginalDeltaPosition_();
+    prediction.Vwb = mVwb + t12*Gz + mRwb*mpFramePreintegrated->GetOriginalDeltaVelocity_();
+    prediction.t = mtStart + t12;
+    return true;
+}
+
+bool Preintegrator::GetPrediction(double &timestamp, cv::Matx33f &Rwb, cv::Matx31f &twb, cv::Matx31f &Vwb)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    Prediction pred;
+    if(!Predict(pred))
+        return false;
+
+    timestamp = pred.t;
+    Rwb = pred.Rwb;
+    twb = pred.twb;
+    Vwb = pred.Vwb;
+    return true;
+}
+
+void Preintegrator::SetPoseCallback(const PoseCallback &callback)
+{
+    std::unique_lock<std::mutex> lock(mMutexCallback);
+    mPoseCallback = callback;
+}
+
+void Preintegrator::Clear()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    ResetInterval();
+    mpQueue->Clear();
+    mvPoints.clear();
+}
+
+} //namespace IMU
+
+} //namespace ORB_SLAM
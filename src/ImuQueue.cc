@@ -0,0 +1,112 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ImuQueue.h"
+
+namespace ORB_SLAM3
+{
+
+namespace IMU
+{
+
+static size_t NextPowerOfTwo(size_t n)
+{
+    size_t p = 1;
+    while(p<n)
+        p <<= 1;
+    return p;
+}
+
+MeasurementQueue::MeasurementQueue(size_t capacity):
+    mvBuffer(NextPowerOfTwo(capacity<2 ? 2 : capacity), Point(0,0,0,0,0,0,0)), mnHead(0), mnTail(0), mnDropped(0), mLastTimestamp(-1.0)
+{
+    mnMask = mvBuffer.size()-1;
+}
+
+bool MeasurementQueue::Push(const Point &point)
+{
+    const size_t head = mnHead.load(std::memory_order_relaxed);
+    const size_t tail = mnTail.load(std::memory_order_acquire);
+    if(head-tail>mnMask)
+    {
+        mnDropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    mvBuffer[head & mnMask] = point;
+    mnHead.store(head+1, std::memory_order_release);
+    mLastTimestamp.store(point.t, std::memory_order_release);
+    return true;
+}
+
+size_t MeasurementQueue::Extract(const double tStart, const double tEnd, std::vector<Point> &vPoints)
+{
+    const size_t head = mnHead.load(std::memory_order_acquire);
+    size_t tail = mnTail.load(std::memory_order_relaxed);
+    size_t nAdded = 0;
+
+    while(tail!=head)
+    {
+        const Point &point = mvBuffer[tail & mnMask];
+        if(point.t < tStart-0.001l)
+        {
+            tail++;
+        }
+        else if(point.t < tEnd-0.001l)
+        {
+            vPoints.push_back(point);
+            nAdded++;
+            tail++;
+        }
+        else
+        {
+            vPoints.push_back(point);
+            nAdded++;
+            break;
+        }
+    }
+
+    mnTail.store(tail, std::memory_order_release);
+    return nAdded;
+}
+
+size_t MeasurementQueue::PopAll(std::vector<Point> &vPoints)
+{
+    const size_t head = mnHead.load(std::memory_order_acquire);
+    const size_t tail = mnTail.load(std::memory_order_relaxed);
+    for(size_t i=tail; i!=head; i++)
+        vPoints.push_back(mvBuffer[i & mnMask]);
+    mnTail.store(head, std::memory_order_release);
+    return head-tail;
+}
+
+void MeasurementQueue::Clear()
+{
+    mnTail.store(mnHead.load(std::memory_order_acquire), std::memory_order_release);
+}
+
+size_t MeasurementQueue::Size() const
+{
+    const size_t tail = mnTail.load(std::memory_order_acquire);
+    const size_t head = mnHead.load(std::memory_order_acquire);
+    return head-tail;
+}
+
+} //namespace IMU
+
+} //namespace ORB_SLAM
@@ -149,6 +149,67 @@ cv::Mat InverseRightJacobianSO3(const cv::Mat &v)
 }
 
 
+cv::Matx33f NormalizeRotation_(const cv::Matx33f &R)
+{
+    // Fixed size Eigen SVD on the data of the Matx (row major)
+    typedef Eigen::Matrix<float,3,3,Eigen::RowMajor> Matrix3fRow;
+    Eigen::JacobiSVD<Eigen::Matrix3f> svd(Eigen::Map<const Matrix3fRow>(R.val), Eigen::ComputeFullU | Eigen::ComputeFullV);
+    cv::Matx33f Rn;
+    Eigen::Map<Matrix3fRow>(Rn.val) = svd.matrixU()*svd.matrixV().transpose();
+    return Rn;
+}
+
+cv::Matx33f ExpSO3_(const float &x, const float &y, const float &z)
+{
+    const cv::Matx33f I = cv::Matx33f::eye();
+    const float d2 = x*x+y*y+z*z;
+    const float d = sqrt(d2);
+    const cv::Matx33f W(0, -z, y,
+                        z, 0, -x,
+                        -y,  x, 0);
+    if(d<eps)
+        return (I + W + 0.5f*W*W);
+    else
+        return (I + W*(sin(d)/d) + W*W*((1.0f-cos(d))/d2));
+}
+
+cv::Matx33f ExpSO3_(const cv::Matx31f &v)
+{
+    return ExpSO3_(v(0),v(1),v(2));
+}
+
+cv::Matx33f RightJacobianSO3_(const float &x, const float &y, const float &z)
+{
+    const cv::Matx33f I = cv::Matx33f::eye();
+    const float d2 = x*x+y*y+z*z;
+    const float d = sqrt(d2);
+    const cv::Matx33f W(0, -z, y,
+                        z, 0, -x,
+                        -y,  x, 0);
+    if(d<eps)
+    {
+        return I;
+    }
+    else
+    {
+        return I - W*((1.0f-cos(d))/d2) + W*W*((d-sin(d))/(d2*d));
+    }
+}
+
+cv::Matx33f RightJacobianSO3_(const cv::Matx31f &v)
+{
+    return RightJacobianSO3_(v(0),v(1),v(2));
+}
+
+// Block copies between fixed size matrices
+template<int m, int n, int p, int q>
+static inline void SetBlock(cv::Matx<float,m,n> &M, const int r0, const int c0, const cv::Matx<float,p,q> &B)
+{
+    for(int r=0; r<p; r++)
+        for(int c=0; c<q; c++)
+            M(r0+r,c0+c) = B(r,c);
+}
+
 IntegratedRotation::IntegratedRotation(const cv::Point3f &angVel, const Bias &imuBias, const float &time):
     deltaT(time)
 {
@@ -156,88 +217,91 @@ IntegratedRotation::IntegratedRotation(const cv::Point3f &angVel, const Bias &im
     const float y = (angVel.y-imuBias.bwy)*time;
     const float z = (angVel.z-imuBias.bwz)*time;
 
-    cv::Mat I = cv::Mat::eye(3,3,CV_32F);
+    const cv::Matx33f I = cv::Matx33f::eye();
 
     const float d2 = x*x+y*y+z*z;
     const float d = sqrt(d2);
 
-    cv::Mat W = (cv::Mat_<float>(3,3) << 0, -z, y,
-                 z, 0, -x,
-                 -y,  x, 0);
+    const cv::Matx33f W(0, -z, y,
+                        z, 0, -x,
+                        -y,  x, 0);
     if(d<eps)
     {
         deltaR = I + W;
-        rightJ = cv::Mat::eye(3,3,CV_32F);
+        rightJ = I;
     }
     else
     {
-        deltaR = I + W*sin(d)/d + W*W*(1.0f-cos(d))/d2;
-        rightJ = I - W*(1.0f-cos(d))/d2 + W*W*(d-sin(d))/(d2*d);
+        deltaR = I + W*(sin(d)/d) + W*W*((1.0f-cos(d))/d2);
+        rightJ = I - W*((1.0f-cos(d))/d2) + W*W*((d-sin(d))/(d2*d));
     }
 }
 
 Preintegrated::Preintegrated(const Bias &b_, const Calib &calib)
 {
-    Nga = calib.Cov.clone();
-    NgaWalk = calib.CovWalk.clone();
+    Nga = calib.Cov;
+    NgaWalk = calib.CovWalk;
     Initialize(b_);
 }
 
 // Copy constructor
-Preintegrated::Preintegrated(Preintegrated* pImuPre): dT(pImuPre->dT), C(pImuPre->C.clone()), Info(pImuPre->Info.clone()),
-    Nga(pImuPre->Nga.clone()), NgaWalk(pImuPre->NgaWalk.clone()), b(pImuPre->b), dR(pImuPre->dR.clone()), dV(pImuPre->dV.clone()),
-    dP(pImuPre->dP.clone()), JRg(pImuPre->JRg.clone()), JVg(pImuPre->JVg.clone()), JVa(pImuPre->JVa.clone()), JPg(pImuPre->JPg.clone()),
-    JPa(pImuPre->JPa.clone()), avgA(pImuPre->avgA.clone()), avgW(pImuPre->avgW.clone()), bu(pImuPre->bu), db(pImuPre->db.clone()), mvMeasurements(pImuPre->mvMeasurements)
+Preintegrated::Preintegrated(Preintegrated* pImuPre): dT(pImuPre->dT), C(pImuPre->C), Info(pImuPre->Info),
+    Nga(pImuPre->Nga), NgaWalk(pImuPre->NgaWalk), b(pImuPre->b), dR(pImuPre->dR), dV(pImuPre->dV),
+    dP(pImuPre->dP), JRg(pImuPre->JRg), JVg(pImuPre->JVg), JVa(pImuPre->JVa), JPg(pImuPre->JPg),
+    JPa(pImuPre->JPa), avgA(pImuPre->avgA), avgW(pImuPre->avgW), bu(pImuPre->bu), db(pImuPre->db), mbInfoReady(pImuPre->mbInfoReady),
+    mvMeasurements(pImuPre->mvMeasurements)
 {
 
 }
 
 void Preintegrated::CopyFrom(Preintegrated* pImuPre)
 {
-    std::cout << "Preintegrated: start clone" << std::endl;
     dT = pImuPre->dT;
-    C = pImuPre->C.clone();
-    Info = pImuPre->Info.clone();
-    Nga = pImuPre->Nga.clone();
-    NgaWalk = pImuPre->NgaWalk.clone();
-    std::cout << "Preintegrated: first clone" << std::endl;
+    C = pImuPre->C;
+    Info = pImuPre->Info;
+    mbInfoReady = pImuPre->mbInfoReady;
+    Nga = pImuPre->Nga;
+    NgaWalk = pImuPre->NgaWalk;
     b.CopyFrom(pImuPre->b);
-    dR = pImuPre->dR.clone();
-    dV = pImuPre->dV.clone();
-    dP = pImuPre->dP.clone();
-    JRg = pImuPre->JRg.clone();
-    JVg = pImuPre->JVg.clone();
-    JVa = pImuPre->JVa.clone();
-    JPg = pImuPre->JPg.clone();
-    JPa = pImuPre->JPa.clone();
-    avgA = pImuPre->avgA.clone();
-    avgW = pImuPre->avgW.clone();
-    std::cout << "Preintegrated: second clone" << std::endl;
+    dR = pImuPre->dR;
+    dV = pImuPre->dV;
+    dP = pImuPre->dP;
+    JRg = pImuPre->JRg;
+    JVg = pImuPre->JVg;
+    JVa = pImuPre->JVa;
+    JPg = pImuPre->JPg;
+    JPa = pImuPre->JPa;
+    avgA = pImuPre->avgA;
+    avgW = pImuPre->avgW;
     bu.CopyFrom(pImuPre->bu);
-    db = pImuPre->db.clone();
-    std::cout << "Preintegrated: third clone" << std::endl;
+    db = pImuPre->db;
     mvMeasurements = pImuPre->mvMeasurements;
-    std::cout << "Preintegrated: end clone" << std::endl;
 }
 
 
+size_t Preintegrated::Memory()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    return sizeof(Preintegrated) + mvMeasurements.capacity()*sizeof(integrable);
+}
+
 void Preintegrated::Initialize(const Bias &b_)
 {
-    dR = cv::Mat::eye(3,3,CV_32F);
-    dV = cv::Mat::zeros(3,1,CV_32F);
-    dP = cv::Mat::zeros(3,1,CV_32F);
-    JRg = cv::Mat::zeros(3,3,CV_32F);
-    JVg = cv::Mat::zeros(3,3,CV_32F);
-    JVa = cv::Mat::zeros(3,3,CV_32F);
-    JPg = cv::Mat::zeros(3,3,CV_32F);
-    JPa = cv::Mat::zeros(3,3,CV_32F);
-    C = cv::Mat::zeros(15,15,CV_32F);
-    Info=cv::Mat();
-    db = cv::Mat::zeros(6,1,CV_32F);
+    dR = cv::Matx33f::eye();
+    dV = cv::Matx31f::zeros();
+    dP = cv::Matx31f::zeros();
+    JRg = cv::Matx33f::zeros();
+    JVg = cv::Matx33f::zeros();
+    JVa = cv::Matx33f::zeros();
+    JPg = cv::Matx33f::zeros();
+    JPa = cv::Matx33f::zeros();
+    C = cv::Matx<float,15,15>::zeros();
+    mbInfoReady = false;
+    db = cv::Matx<float,6,1>::zeros();
     b=b_;
     bu=b_;
-    avgA = cv::Mat::zeros(3,1,CV_32F);
-    avgW = cv::Mat::zeros(3,1,CV_32F);
+    avgA = cv::Matx31f::zeros();
+    avgW = cv::Matx31f::zeros();
     dT=0.0f;
     mvMeasurements.clear();
 }
@@ -251,6 +315,21 @@ void Preintegrated::Reintegrate()
         IntegrateNewMeasurement(aux[i].a,aux[i].w,aux[i].t);
 }
 
+bool Preintegrated::ReintegrateIfNeeded(const float thRot)
+{
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        // Velocity and position are linear in the acc bias, only the gyro bias enters
+        // through the rotation, so its correction bounds the linearization error
+        const cv::Matx31f dRcorr = JRg*db.get_minor<3,1>(0,0);
+        if(cv::norm(dRcorr)<thRot)
+            return false;
+    }
+
+    Reintegrate();
+    return true;
+}
+
 void Preintegrated::IntegrateNewMeasurement(const cv::Point3f &acceleration, const cv::Point3f &angVel, const float &dt)
 {
     mvMeasurements.push_back(integrable(acceleration,angVel,dt));
@@ -260,28 +339,28 @@ void Preintegrated::IntegrateNewMeasurement(const cv::Point3f &acceleration, con
     // Rotation is the last to be updated.
 
     //Matrices to compute covariance
-    cv::Mat A = cv::Mat::eye(9,9,CV_32F);
-    cv::Mat B = cv::Mat::zeros(9,6,CV_32F);
+    cv::Matx<float,9,9> A = cv::Matx<float,9,9>::eye();
+    cv::Matx<float,9,6> B = cv::Matx<float,9,6>::zeros();
 
-    cv::Mat acc = (cv::Mat_<float>(3,1) << acceleration.x-b.bax,acceleration.y-b.bay, acceleration.z-b.baz);
-    cv::Mat accW = (cv::Mat_<float>(3,1) << angVel.x-b.bwx, angVel.y-b.bwy, angVel.z-b.bwz);
+    const cv::Matx31f acc(acceleration.x-b.bax,acceleration.y-b.bay, acceleration.z-b.baz);
+    const cv::Matx31f accW(angVel.x-b.bwx, angVel.y-b.bwy, angVel.z-b.bwz);
 
-    avgA = (dT*avgA + dR*acc*dt)/(dT+dt);
-    avgW = (dT*avgW + accW*dt)/(dT+dt);
+    avgA = (dT*avgA + dR*acc*dt)*(1.0f/(dT+dt));
+    avgW = (dT*avgW + accW*dt)*(1.0f/(dT+dt));
 
     // Update delta position dP and velocity dV (rely on no-updated delta rotation)
     dP = dP + dV*dt + 0.5f*dR*acc*dt*dt;
     dV = dV + dR*acc*dt;
 
     // Compute velocity and position parts of matrices A and B (rely on non-updated delta rotation)
-    cv::Mat Wacc = (cv::Mat_<float>(3,3) << 0, -acc.at<float>(2), acc.at<float>(1),
-                                                   acc.at<float>(2), 0, -acc.at<float>(0),
-                                                   -acc.at<float>(1), acc.at<float>(0), 0);
-    A.rowRange(3,6).colRange(0,3) = -dR*dt*Wacc;
-    A.rowRange(6,9).colRange(0,3) = -0.5f*dR*dt*dt*Wacc;
-    A.rowRange(6,9).colRange(3,6) = cv::Mat::eye(3,3,CV_32F)*dt;
-    B.rowRange(3,6).colRange(3,6) = dR*dt;
-    B.rowRange(6,9).colRange(3,6) = 0.5f*dR*dt*dt;
+    const cv::Matx33f Wacc(0, -acc(2), acc(1),
+                           acc(2), 0, -acc(0),
+                           -acc(1), acc(0), 0);
+    SetBlock(A,3,0,-dR*dt*Wacc);
+    SetBlock(A,6,0,-0.5f*dR*dt*dt*Wacc);
+    SetBlock(A,6,3,cv::Matx33f::eye()*dt);
+    SetBlock(B,3,3,dR*dt);
+    SetBlock(B,6,3,0.5f*dR*dt*dt);
 
     // Update position and velocity jacobians wrt bias correction
     JPa = JPa + JVa*dt -0.5f*dR*dt*dt;
@@ -291,15 +370,16 @@ void Preintegrated::IntegrateNewMeasurement(const cv::Point3f &acceleration, con
 
     // Update delta rotation
     IntegratedRotation dRi(angVel,b,dt);
-    dR = NormalizeRotation(dR*dRi.deltaR);
+    dR = NormalizeRotation_(dR*dRi.deltaR);
 
     // Compute rotation parts of matrices A and B
-    A.rowRange(0,3).colRange(0,3) = dRi.deltaR.t();
-    B.rowRange(0,3).colRange(0,3) = dRi.rightJ*dt;
+    SetBlock(A,0,0,dRi.deltaR.t());
+    SetBlock(B,0,0,dRi.rightJ*dt);
 
     // Update covariance
-    C.rowRange(0,9).colRange(0,9) = A*C.rowRange(0,9).colRange(0,9)*A.t() + B*Nga*B.t();
-    C.rowRange(9,15).colRange(9,15) = C.rowRange(9,15).colRange(9,15) + NgaWalk;
+    const cv::Matx<float,9,9> C9 = C.get_minor<9,9>(0,0);
+    SetBlock(C,0,0,A*C9*A.t() + B*Nga*B.t());
+    SetBlock(C,9,9,C.get_minor<6,6>(9,9) + NgaWalk);
 
     // Update rotation jacobian wrt bias correction
     JRg = dRi.deltaR.t()*JRg - dRi.rightJ*dt;
@@ -339,12 +419,12 @@ void Preintegrated::SetNewBias(const Bias &bu_)
     std::unique_lock<std::mutex> lock(mMutex);
     bu = bu_;
 
-    db.at<float>(0) = bu_.bwx-b.bwx;
-    db.at<float>(1) = bu_.bwy-b.bwy;
-    db.at<float>(2) = bu_.bwz-b.bwz;
-    db.at<float>(3) = bu_.bax-b.bax;
-    db.at<float>(4) = bu_.bay-b.bay;
-    db.at<float>(5) = bu_.baz-b.baz;
+    db(0) = bu_.bwx-b.bwx;
+    db(1) = bu_.bwy-b.bwy;
+    db(2) = bu_.bwz-b.bwz;
+    db(3) = bu_.bax-b.bax;
+    db(4) = bu_.bay-b.bay;
+    db(5) = bu_.baz-b.baz;
 }
 
 IMU::Bias Preintegrated::GetDeltaBias(const Bias &b_)
@@ -353,63 +433,108 @@ IMU::Bias Preintegrated::GetDeltaBias(const Bias &b_)
     return IMU::Bias(b_.bax-b.bax,b_.bay-b.bay,b_.baz-b.baz,b_.bwx-b.bwx,b_.bwy-b.bwy,b_.bwz-b.bwz);
 }
 
-cv::Mat Preintegrated::GetDeltaRotation(const Bias &b_)
+cv::Matx33f Preintegrated::GetDeltaRotation_(const Bias &b_)
 {
     std::unique_lock<std::mutex> lock(mMutex);
-    cv::Mat dbg = (cv::Mat_<float>(3,1) << b_.bwx-b.bwx,b_.bwy-b.bwy,b_.bwz-b.bwz);
-    return NormalizeRotation(dR*ExpSO3(JRg*dbg));
+    const cv::Matx31f dbg(b_.bwx-b.bwx,b_.bwy-b.bwy,b_.bwz-b.bwz);
+    return NormalizeRotation_(dR*ExpSO3_(JRg*dbg));
 }
 
-cv::Mat Preintegrated::GetDeltaVelocity(const Bias &b_)
+cv::Matx31f Preintegrated::GetDeltaVelocity_(const Bias &b_)
 {
     std::unique_lock<std::mutex> lock(mMutex);
-    cv::Mat dbg = (cv::Mat_<float>(3,1) << b_.bwx-b.bwx,b_.bwy-b.bwy,b_.bwz-b.bwz);
-    cv::Mat dba = (cv::Mat_<float>(3,1) << b_.bax-b.bax,b_.bay-b.bay,b_.baz-b.baz);
+    const cv::Matx31f dbg(b_.bwx-b.bwx,b_.bwy-b.bwy,b_.bwz-b.bwz);
+    const cv::Matx31f dba(b_.bax-b.bax,b_.bay-b.bay,b_.baz-b.baz);
     return dV + JVg*dbg + JVa*dba;
 }
 
-cv::Mat Preintegrated::GetDeltaPosition(const Bias &b_)
+cv::Matx31f Preintegrated::GetDeltaPosition_(const Bias &b_)
 {
     std::unique_lock<std::mutex> lock(mMutex);
-    cv::Mat dbg = (cv::Mat_<float>(3,1) << b_.bwx-b.bwx,b_.bwy-b.bwy,b_.bwz-b.bwz);
-    cv::Mat dba = (cv::Mat_<float>(3,1) << b_.bax-b.bax,b_.bay-b.bay,b_.baz-b.baz);
+    const cv::Matx31f dbg(b_.bwx-b.bwx,b_.bwy-b.bwy,b_.bwz-b.bwz);
+    const cv::Matx31f dba(b_.bax-b.bax,b_.bay-b.bay,b_.baz-b.baz);
     return dP + JPg*dbg + JPa*dba;
 }
 
-cv::Mat Preintegrated::GetUpdatedDeltaRotation()
+cv::Matx33f Preintegrated::GetUpdatedDeltaRotation_()
 {
     std::unique_lock<std::mutex> lock(mMutex);
-    return NormalizeRotation(dR*ExpSO3(JRg*db.rowRange(0,3)));
+    return NormalizeRotation_(dR*ExpSO3_(JRg*db.get_minor<3,1>(0,0)));
 }
 
-cv::Mat Preintegrated::GetUpdatedDeltaVelocity()
+cv::Matx31f Preintegrated::GetUpdatedDeltaVelocity_()
 {
     std::unique_lock<std::mutex> lock(mMutex);
-    return dV + JVg*db.rowRange(0,3) + JVa*db.rowRange(3,6);
+    return dV + JVg*db.get_minor<3,1>(0,0) + JVa*db.get_minor<3,1>(3,0);
 }
 
-cv::Mat Preintegrated::GetUpdatedDeltaPosition()
+cv::Matx31f Preintegrated::GetUpdatedDeltaPosition_()
 {
     std::unique_lock<std::mutex> lock(mMutex);
-    return dP + JPg*db.rowRange(0,3) + JPa*db.rowRange(3,6);
+    return dP + JPg*db.get_minor<3,1>(0,0) + JPa*db.get_minor<3,1>(3,0);
 }
 
-cv::Mat Preintegrated::GetOriginalDeltaRotation()
+cv::Matx33f Preintegrated::GetOriginalDeltaRotation_()
 {
     std::unique_lock<std::mutex> lock(mMutex);
-    return dR.clone();
+    return dR;
 }
 
-cv::Mat Preintegrated::GetOriginalDeltaVelocity()
+cv::Matx31f Preintegrated::GetOriginalDeltaVelocity_()
 {
     std::unique_lock<std::mutex> lock(mMutex);
-    return dV.clone();
+    return dV;
 }
 
-cv::Mat Preintegrated::GetOriginalDeltaPosition()
+cv::Matx31f Preintegrated::GetOriginalDeltaPosition_()
 {
     std::unique_lock<std::mutex> lock(mMutex);
-    return dP.clone();
+    return dP;
+}
+
+cv::Mat Preintegrated::GetDeltaRotation(const Bias &b_)
+{
+    return cv::Mat(GetDeltaRotation_(b_));
+}
+
+cv::Mat Preintegrated::GetDeltaVelocity(const Bias &b_)
+{
+    return cv::Mat(GetDeltaVelocity_(b_));
+}
+
+cv::Mat Preintegrated::GetDeltaPosition(const Bias &b_)
+{
+    return cv::Mat(GetDeltaPosition_(b_));
+}
+
+cv::Mat Preintegrated::GetUpdatedDeltaRotation()
+{
+    return cv::Mat(GetUpdatedDeltaRotation_());
+}
+
+cv::Mat Preintegrated::GetUpdatedDeltaVelocity()
+{
+    return cv::Mat(GetUpdatedDeltaVelocity_());
+}
+
+cv::Mat Preintegrated::GetUpdatedDeltaPosition()
+{
+    return cv::Mat(GetUpdatedDeltaPosition_());
+}
+
+cv::Mat Preintegrated::GetOriginalDeltaRotation()
+{
+    return cv::Mat(GetOriginalDeltaRotation_());
+}
+
+cv::Mat Preintegrated::GetOriginalDeltaVelocity()
+{
+    return cv::Mat(GetOriginalDeltaVelocity_());
+}
+
+cv::Mat Preintegrated::GetOriginalDeltaPosition()
+{
+    return cv::Mat(GetOriginalDeltaPosition_());
 }
 
 Bias Preintegrated::GetOriginalBias()
@@ -427,24 +552,25 @@ Bias Preintegrated::GetUpdatedBias()
 cv::Mat Preintegrated::GetDeltaBias()
 {
     std::unique_lock<std::mutex> lock(mMutex);
-    return db.clone();
+    return cv::Mat(db);
 }
 
 Eigen::Matrix<double,15,15> Preintegrated::GetInformationMatrix()
 {
     std::unique_lock<std::mutex> lock(mMutex);
-    if(Info.empty())
+    if(!mbInfoReady)
     {
-        Info = cv::Mat::zeros(15,15,CV_32F);
-        Info.rowRange(0,9).colRange(0,9)=C.rowRange(0,9).colRange(0,9).inv(cv::DECOMP_SVD);
+        Info = cv::Matx<float,15,15>::zeros();
+        SetBlock(Info,0,0,C.get_minor<9,9>(0,0).inv(cv::DECOMP_SVD));
         for(int i=9;i<15;i++)
-            Info.at<float>(i,i)=1.0f/C.at<float>(i,i);
+            Info(i,i)=1.0f/C(i,i);
+        mbInfoReady = true;
     }
 
     Eigen::Matrix<double,15,15> EI;
     for(int i=0;i<15;i++)
         for(int j=0;j<15;j++)
-            EI(i,j)=Info.at<float>(i,j);
+            EI(i,j)=Info(i,j);
     return EI;
 }
 
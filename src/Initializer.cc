@@ -22,6 +22,7 @@
 
 #include "Optimizer.h"
 #include "ORBmatcher.h"
+#include "Triangulator.h"
 
 #include<thread>
 #include <include/CameraModels/Pinhole.h>
@@ -736,21 +737,6 @@ bool Initializer::ReconstructH(vector<bool> &vbMatchesInliers, cv::Mat &H21, cv:
     return false;
 }
 
-void Initializer::Triangulate(const cv::KeyPoint &kp1, const cv::KeyPoint &kp2, const cv::Mat &P1, const cv::Mat &P2, cv::Mat &x3D)
-{
-    cv::Mat A(4,4,CV_32F);
-
-    A.row(0) = kp1.pt.x*P1.row(2)-P1.row(0);
-    A.row(1) = kp1.pt.y*P1.row(2)-P1.row(1);
-    A.row(2) = kp2.pt.x*P2.row(2)-P2.row(0);
-    A.row(3) = kp2.pt.y*P2.row(2)-P2.row(1);
-
-    cv::Mat u,w,vt;
-    cv::SVD::compute(A,w,u,vt,cv::SVD::MODIFY_A| cv::SVD::FULL_UV);
-    x3D = vt.row(3).t();
-    x3D = x3D.rowRange(0,3)/x3D.at<float>(3);
-}
-
 void Initializer::Normalize(const vector<cv::KeyPoint> &vKeys, vector<cv::Point2f> &vNormalizedPoints, cv::Mat &T)
 {
     float meanX = 0;
@@ -824,25 +810,41 @@ int Initializer::CheckRT(const cv::Mat &R, const cv::Mat &t, const vector<cv::Ke
 
     cv::Mat O2 = -R.t()*t;
 
+    // Triangulate all the inliers at once
+    vector<cv::Point2f> vx1, vx2;
+    vx1.reserve(vMatches12.size());
+    vx2.reserve(vMatches12.size());
+    for(size_t i=0, iend=vMatches12.size();i<iend;i++)
+    {
+        if(!vbMatchesInliers[i])
+            continue;
+        vx1.push_back(vKeys1[vMatches12[i].first].pt);
+        vx2.push_back(vKeys2[vMatches12[i].second].pt);
+    }
+
+    vector<cv::Point3f> vx3D;
+    vector<bool> vbFinite;
+    Triangulator::Triangulate(P1,P2,vx1,vx2,vx3D,vbFinite);
+
     int nGood=0;
 
-    for(size_t i=0, iend=vMatches12.size();i<iend;i++)
+    for(size_t i=0, iend=vMatches12.size(), j=0;i<iend;i++)
     {
         if(!vbMatchesInliers[i])
             continue;
 
         const cv::KeyPoint &kp1 = vKeys1[vMatches12[i].first];
         const cv::KeyPoint &kp2 = vKeys2[vMatches12[i].second];
-        cv::Mat p3dC1;
+        const size_t iTri = j++;
 
-        Triangulate(kp1,kp2,P1,P2,p3dC1);
-
-        if(!isfinite(p3dC1.at<float>(0)) || !isfinite(p3dC1.at<float>(1)) || !isfinite(p3dC1.at<float>(2)))
+        if(!vbFinite[iTri])
         {
             vbGood[vMatches12[i].first]=false;
             continue;
         }
 
+        cv::Mat p3dC1(vx3D[iTri]);
+
         // Check parallax
         cv::Mat normal1 = p3dC1 - O1;
         float dist1 = cv::norm(normal1);
@@ -20,12 +20,78 @@
 #include "Converter.h"
 #include "ORBmatcher.h"
 #include "ImuTypes.h"
+#include "ObjectPool.h"
+#include "EpochManager.h"
+#include "SystemContext.h"
+#include "VocabularyLoader.h"
 #include<mutex>
+#include<algorithm>
 
 namespace ORB_SLAM3
 {
 
-long unsigned int KeyFrame::nNextId=0;
+
+static void ReleaseBadKeyFrame(void* p)
+{
+    static_cast<KeyFrame*>(p)->ReleaseRetiredFeatures();
+}
+
+void* KeyFrame::operator new(size_t size)
+{
+    // Derived classes do not fit in the pool blocks
+    if(size!=sizeof(KeyFrame))
+        return ::operator new(size);
+    return ObjectPool<KeyFrame>::Instance().Allocate();
+}
+
+void KeyFrame::operator delete(void* p, size_t size)
+{
+    if(size!=sizeof(KeyFrame))
+        ::operator delete(p);
+    else
+        ObjectPool<KeyFrame>::Instance().Deallocate(p);
+}
+
+std::shared_ptr<const std::vector<float> > ScaleTable::Intern(const std::vector<float> &vTable)
+{
+    // Only a handful of different tables exist (one per extractor configuration)
+    static std::mutex mutexTables;
+    static std::vector<std::weak_ptr<const std::vector<float> > > vTables;
+
+    unique_lock<mutex> lock(mutexTables);
+    for(size_t i=0; i<vTables.size(); )
+    {
+        std::shared_ptr<const std::vector<float> > pTable = vTables[i].lock();
+        if(!pTable)
+        {
+            vTables[i] = vTables.back();
+            vTables.pop_back();
+            continue;
+        }
+        if(*pTable == vTable)
+            return pTable;
+        i++;
+    }
+
+    std::shared_ptr<const std::vector<float> > pTable = std::make_shared<const std::vector<float> >(vTable);
+    vTables.push_back(pTable);
+    return pTable;
+}
+
+static bool SameKeyPoints(const vector<cv::KeyPoint> &vKeys1, const vector<cv::KeyPoint> &vKeys2)
+{
+    if(vKeys1.size() != vKeys2.size())
+        return false;
+
+    for(size_t i=0; i<vKeys1.size(); i++)
+    {
+        const cv::KeyPoint &kp1 = vKeys1[i], &kp2 = vKeys2[i];
+        if(kp1.pt != kp2.pt || kp1.size != kp2.size || kp1.angle != kp2.angle ||
+           kp1.response != kp2.response || kp1.octave != kp2.octave || kp1.class_id != kp2.class_id)
+            return false;
+    }
+    return true;
+}
 
 KeyFrame::KeyFrame():
         mnFrameId(0),  mTimeStamp(0), mnGridCols(FRAME_GRID_COLS), mnGridRows(FRAME_GRID_ROWS),
@@ -36,24 +102,34 @@ KeyFrame::KeyFrame():
         mbf(0), mb(0), mThDepth(0), N(0), mvKeys(static_cast<vector<cv::KeyPoint> >(NULL)), mvKeysUn(static_cast<vector<cv::KeyPoint> >(NULL)),
         mvuRight(static_cast<vector<float> >(NULL)), mvDepth(static_cast<vector<float> >(NULL)), /*mDescriptors(NULL),*/
         /*mBowVec(NULL), mFeatVec(NULL),*/ mnScaleLevels(0), mfScaleFactor(0),
-        mfLogScaleFactor(0), mvScaleFactors(0), mvLevelSigma2(0),
-        mvInvLevelSigma2(0), mnMinX(0), mnMinY(0), mnMaxX(0),
+        mfLogScaleFactor(0), mvScaleFactors(), mvLevelSigma2(),
+        mvInvLevelSigma2(), mnMinX(0), mnMinY(0), mnMaxX(0),
         mnMaxY(0), /*mK(NULL),*/  mPrevKF(static_cast<KeyFrame*>(NULL)), mNextKF(static_cast<KeyFrame*>(NULL)), mbFirstConnection(true), mpParent(NULL), mbNotErase(false),
         mbToBeErased(false), mbBad(false), mHalfBaseline(0), mbCurrentPlaceRecognition(false), mbHasHessian(false), mnMergeCorrectedForKF(0),
         NLeft(0),NRight(0), mnNumberOfOpt(0)
 {
-
+    mpImuPreintegrated = static_cast<IMU::Preintegrated*>(NULL);
+    mpCamera = mpCamera2 = static_cast<GeometricCamera*>(NULL);
+    mpMap = static_cast<Map*>(NULL);
+    mpKeyFrameDB = static_cast<KeyFrameDatabase*>(NULL);
+    mpORBvocabulary = static_cast<ORBVocabulary*>(NULL);
+    mbGridReady = false;
+    mbFeaturesReleased = false;
+    mfInertialBAUpdate = -1.f;
+    mpInertialPriorMap = static_cast<Map*>(NULL);
+    mnInertialPriorChangeIdx = -1;
+    mnSubmapId = -1;
 }
 
 KeyFrame::KeyFrame(Frame &F, Map *pMap, KeyFrameDatabase *pKFDB):
-    bImu(pMap->isImuInitialized()), mnFrameId(F.mnId),  mTimeStamp(F.mTimeStamp), mnGridCols(FRAME_GRID_COLS), mnGridRows(FRAME_GRID_ROWS),
+    bImu(pMap->isImuInitialized()), mnFrameId(F.mnId),  mTimeStamp(F.mTimeStamp), mnGridCols(F.mnGridCols), mnGridRows(F.mnGridRows),
     mfGridElementWidthInv(F.mfGridElementWidthInv), mfGridElementHeightInv(F.mfGridElementHeightInv),
     mnTrackReferenceForFrame(0), mnFuseTargetForKF(0), mnBALocalForKF(0), mnBAFixedForKF(0), mnBALocalForMerge(0),
     mnLoopQuery(0), mnLoopWords(0), mnRelocQuery(0), mnRelocWords(0), mnBAGlobalForKF(0), mnPlaceRecognitionQuery(0), mnPlaceRecognitionWords(0), mPlaceRecognitionScore(0),
     fx(F.fx), fy(F.fy), cx(F.cx), cy(F.cy), invfx(F.invfx), invfy(F.invfy),
-    mbf(F.mbf), mb(F.mb), mThDepth(F.mThDepth), N(F.N), mvKeys(F.mvKeys), mvKeysUn(F.mvKeysUn),
-    mvuRight(F.mvuRight), mvDepth(F.mvDepth), mDescriptors(F.mDescriptors.clone()),
-    mBowVec(F.mBowVec), mFeatVec(F.mFeatVec), mnScaleLevels(F.mnScaleLevels), mfScaleFactor(F.mfScaleFactor),
+    mbf(F.mbf), mb(F.mb), mThDepth(F.mThDepth), N(F.N), mvKeys(SameKeyPoints(F.mvKeys,F.mvKeysUn) ? vector<cv::KeyPoint>() : F.mvKeys), mvKeysUn(F.mvKeysUn),
+    mvuRight(F.mvuRight), mvDepth(F.mvDepth), mDescriptors(F.mDescriptors),
+    mBowVec(F.mBowVec), mFeatVec(F.mFeatVec), mFlatFeatVec(F.mFlatFeatVec), mFlatBowVec(F.mFlatBowVec), mnScaleLevels(F.mnScaleLevels), mfScaleFactor(F.mfScaleFactor),
     mfLogScaleFactor(F.mfLogScaleFactor), mvScaleFactors(F.mvScaleFactors), mvLevelSigma2(F.mvLevelSigma2),
     mvInvLevelSigma2(F.mvInvLevelSigma2), mnMinX(F.mnMinX), mnMinY(F.mnMinY), mnMaxX(F.mnMaxX),
     mnMaxY(F.mnMaxY), mK(F.mK), mPrevKF(NULL), mNextKF(NULL), mpImuPreintegrated(F.mpImuPreintegrated),
@@ -64,27 +140,45 @@ KeyFrame::KeyFrame(Frame &F, Map *pMap, KeyFrameDatabase *pKFDB):
     mvLeftToRightMatch(F.mvLeftToRightMatch),mvRightToLeftMatch(F.mvRightToLeftMatch),mTlr(F.mTlr.clone()),
     mvKeysRight(F.mvKeysRight), NLeft(F.Nleft), NRight(F.Nright), mTrl(F.mTrl), mnNumberOfOpt(0)
 {
-
-    imgLeft = F.imgLeft.clone();
-    imgRight = F.imgRight.clone();
-
-    mnId=nNextId++;
-
-    mGrid.resize(mnGridCols);
-    if(F.Nleft != -1)  mGridRight.resize(mnGridCols);
-    for(int i=0; i<mnGridCols;i++)
+    mnId=F.mpContext->mnNextKeyFrameId++;
+
+    mGrid = F.mGrid;
+    if(F.Nleft != -1)
+        mGridRight = F.mGridRight;
+    mbGridReady = true;
+    mbFeaturesReleased = false;
+    mfInertialBAUpdate = -1.f;
+    mpInertialPriorMap = static_cast<Map*>(NULL);
+    mnInertialPriorChangeIdx = -1;
+    mnSubmapId = -1;
+
+    // Rig cameras: only their inlier matches are kept, for the bundle adjustments
+    mvRigCameras.resize(F.mvRigViews.size());
+    for(size_t v=0; v<F.mvRigViews.size(); v++)
     {
-        mGrid[i].resize(mnGridRows);
-        if(F.Nleft != -1) mGridRight[i].resize(mnGridRows);
-        for(int j=0; j<mnGridRows; j++){
-            mGrid[i][j] = F.mGrid[i][j];
-            if(F.Nleft != -1){
-                mGridRight[i][j] = F.mGridRight[i][j];
-            }
+        const RigView &view = F.mvRigViews[v];
+        mvRigCameras[v].pCamera = view.pCamera;
+        mvRigCameras[v].Tcb = cv::Matx44f::eye();
+        for(int r=0; r<3; r++)
+        {
+            for(int c=0; c<3; c++)
+                mvRigCameras[v].Tcb(r,c) = view.Rcb(r,c);
+            mvRigCameras[v].Tcb(r,3) = view.tcb(r);
         }
-    }
-
 
+        for(size_t i=0; i<view.mvpMapPoints.size(); i++)
+        {
+            MapPoint* pMP = view.mvpMapPoints[i];
+            if(!pMP || view.mvbOutlier[i])
+                continue;
+            RigObservation obs;
+            obs.nCamera = v;
+            obs.kpUn = view.mvKeysUn[i];
+            obs.pMP = pMP;
+            obs.hMapPoint = pMP->GetHandle();
+            mvRigObservations.push_back(obs);
+        }
+    }
 
     if(F.mVw.empty())
         Vw = cv::Mat::zeros(3,1,CV_32F);
@@ -106,116 +200,116 @@ void KeyFrame::ComputeBoW()
 {
     if(mBowVec.empty() || mFeatVec.empty())
     {
-        vector<cv::Mat> vCurrentDesc = Converter::toDescriptorVector(mDescriptors);
         // Feature vector associate features with nodes in the 4th level (from leaves up)
         // We assume the vocabulary tree has 6 levels, change the 4 otherwise
-        mpORBvocabulary->transform(vCurrentDesc,mBowVec,mFeatVec,4);
+        VocabularyLoader::WaitUntilLoaded(mpORBvocabulary);
+        mpORBvocabulary->transform(mDescriptors.ptr<unsigned char>(),mDescriptors.step,mDescriptors.rows,mBowVec,mFeatVec,4);
+        mFlatFeatVec.Build(mFeatVec);
+        mFlatBowVec.Build(mBowVec);
     }
 }
 
-void KeyFrame::SetPose(const cv::Mat &Tcw_)
+void KeyFrame::SetPose(const cv::Mat &Tcw)
 {
-    unique_lock<mutex> lock(mMutexPose);
-    Tcw_.copyTo(Tcw);
-    cv::Mat Rcw = Tcw.rowRange(0,3).colRange(0,3);
-    cv::Mat tcw = Tcw.rowRange(0,3).col(3);
-    cv::Mat Rwc = Rcw.t();
-    Ow = -Rwc*tcw;
-    if (!mImuCalib.Tcb.empty())
-        Owb = Rwc*mImuCalib.Tcb.rowRange(0,3).col(3)+Ow;
-
+    cv::Matx44f Tcwx;
+    cv::Mat TcwxHeader(4,4,CV_32F,Tcwx.val);
+    Tcw.copyTo(TcwxHeader);
+    SetPose_(Tcwx);
+}
 
-    Twc = cv::Mat::eye(4,4,Tcw.type());
-    Rwc.copyTo(Twc.rowRange(0,3).colRange(0,3));
-    Ow.copyTo(Twc.rowRange(0,3).col(3));
-    cv::Mat center = (cv::Mat_<float>(4,1) << mHalfBaseline, 0 , 0, 1);
-    Cw = Twc*center;
+void KeyFrame::SetPose_(const cv::Matx44f &Tcw)
+{
+    unique_lock<boost::shared_mutex> lock(mMutexPose);
+    Tcw_ = Tcw;
+    const cv::Matx33f Rwc = Tcw_.get_minor<3,3>(0,0).t();
+    Ow_ = -Rwc*Tcw_.get_minor<3,1>(0,3);
+    if (!mImuCalib.Tcb.empty())
+        Owb = cv::Mat(Rwc)*mImuCalib.Tcb.rowRange(0,3).col(3)+cv::Mat(Ow_);
 
-    //Static matrices
-    this->Tcw_ = cv::Matx44f(Tcw.at<float>(0,0),Tcw.at<float>(0,1),Tcw.at<float>(0,2),Tcw.at<float>(0,3),
-                       Tcw.at<float>(1,0),Tcw.at<float>(1,1),Tcw.at<float>(1,2),Tcw.at<float>(1,3),
-                       Tcw.at<float>(2,0),Tcw.at<float>(2,1),Tcw.at<float>(2,2),Tcw.at<float>(2,3),
-                       Tcw.at<float>(3,0),Tcw.at<float>(3,1),Tcw.at<float>(3,2),Tcw.at<float>(3,3));
+    Twc_ = cv::Matx44f(Rwc(0,0),Rwc(0,1),Rwc(0,2),Ow_(0),
+                       Rwc(1,0),Rwc(1,1),Rwc(1,2),Ow_(1),
+                       Rwc(2,0),Rwc(2,1),Rwc(2,2),Ow_(2),
+                       0.f,0.f,0.f,1.f);
+    Cw_ = Rwc*cv::Matx31f(mHalfBaseline,0.f,0.f)+Ow_;
 
-    this->Twc_ = cv::Matx44f(Twc.at<float>(0,0),Twc.at<float>(0,1),Twc.at<float>(0,2),Twc.at<float>(0,3),
-                             Twc.at<float>(1,0),Twc.at<float>(1,1),Twc.at<float>(1,2),Twc.at<float>(1,3),
-                             Twc.at<float>(2,0),Twc.at<float>(2,1),Twc.at<float>(2,2),Twc.at<float>(2,3),
-                                     Twc.at<float>(3,0),Twc.at<float>(3,1),Twc.at<float>(3,2),Twc.at<float>(3,3));
+    lock.unlock();
 
-    this->Ow_ = cv::Matx31f(Ow.at<float>(0),Ow.at<float>(1),Ow.at<float>(2));
+    Map* pMap = GetMap();
+    if(pMap)
+        pMap->UpdateKeyFramePosition(this);
 }
 
 void KeyFrame::SetVelocity(const cv::Mat &Vw_)
 {
-    unique_lock<mutex> lock(mMutexPose);
+    unique_lock<boost::shared_mutex> lock(mMutexPose);
     Vw_.copyTo(Vw);
 }
 
 
 cv::Mat KeyFrame::GetPose()
 {
-    unique_lock<mutex> lock(mMutexPose);
-    return Tcw.clone();
+    boost::shared_lock<boost::shared_mutex> lock(mMutexPose);
+    return cv::Mat(Tcw_);
 }
 
 cv::Mat KeyFrame::GetPoseInverse()
 {
-    unique_lock<mutex> lock(mMutexPose);
-    return Twc.clone();
+    boost::shared_lock<boost::shared_mutex> lock(mMutexPose);
+    return cv::Mat(Twc_);
 }
 
 cv::Mat KeyFrame::GetCameraCenter()
 {
-    unique_lock<mutex> lock(mMutexPose);
-    return Ow.clone();
+    boost::shared_lock<boost::shared_mutex> lock(mMutexPose);
+    return cv::Mat(Ow_);
 }
 
 cv::Mat KeyFrame::GetStereoCenter()
 {
-    unique_lock<mutex> lock(mMutexPose);
-    return Cw.clone();
+    boost::shared_lock<boost::shared_mutex> lock(mMutexPose);
+    return (cv::Mat_<float>(4,1) << Cw_(0), Cw_(1), Cw_(2), 1.f);
 }
 
 cv::Mat KeyFrame::GetImuPosition()
 {
-    unique_lock<mutex> lock(mMutexPose);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexPose);
     return Owb.clone();
 }
 
 cv::Mat KeyFrame::GetImuRotation()
 {
-    unique_lock<mutex> lock(mMutexPose);
-    return Twc.rowRange(0,3).colRange(0,3)*mImuCalib.Tcb.rowRange(0,3).colRange(0,3);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexPose);
+    return cv::Mat(Twc_.get_minor<3,3>(0,0))*mImuCalib.Tcb.rowRange(0,3).colRange(0,3);
 }
 
 cv::Mat KeyFrame::GetImuPose()
 {
-    unique_lock<mutex> lock(mMutexPose);
-    return Twc*mImuCalib.Tcb;
+    boost::shared_lock<boost::shared_mutex> lock(mMutexPose);
+    return cv::Mat(Twc_)*mImuCalib.Tcb;
 }
 
 cv::Mat KeyFrame::GetRotation()
 {
-    unique_lock<mutex> lock(mMutexPose);
-    return Tcw.rowRange(0,3).colRange(0,3).clone();
+    boost::shared_lock<boost::shared_mutex> lock(mMutexPose);
+    return cv::Mat(Tcw_.get_minor<3,3>(0,0));
 }
 
 cv::Mat KeyFrame::GetTranslation()
 {
-    unique_lock<mutex> lock(mMutexPose);
-    return Tcw.rowRange(0,3).col(3).clone();
+    boost::shared_lock<boost::shared_mutex> lock(mMutexPose);
+    return cv::Mat(Tcw_.get_minor<3,1>(0,3));
 }
 
 cv::Mat KeyFrame::GetVelocity()
 {
-    unique_lock<mutex> lock(mMutexPose);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexPose);
     return Vw.clone();
 }
 
 void KeyFrame::AddConnection(KeyFrame *pKF, const int &weight)
 {
     {
-        unique_lock<mutex> lock(mMutexConnections);
+        unique_lock<boost::shared_mutex> lock(mMutexConnections);
         if(!mConnectedKeyFrameWeights.count(pKF))
             mConnectedKeyFrameWeights[pKF]=weight;
         else if(mConnectedKeyFrameWeights[pKF]!=weight)
@@ -229,10 +323,10 @@ void KeyFrame::AddConnection(KeyFrame *pKF, const int &weight)
 
 void KeyFrame::UpdateBestCovisibles()
 {
-    unique_lock<mutex> lock(mMutexConnections);
+    unique_lock<boost::shared_mutex> lock(mMutexConnections);
     vector<pair<int,KeyFrame*> > vPairs;
     vPairs.reserve(mConnectedKeyFrameWeights.size());
-    for(map<KeyFrame*,int>::iterator mit=mConnectedKeyFrameWeights.begin(), mend=mConnectedKeyFrameWeights.end(); mit!=mend; mit++)
+    for(KeyFrameWeights::iterator mit=mConnectedKeyFrameWeights.begin(), mend=mConnectedKeyFrameWeights.end(); mit!=mend; mit++)
        vPairs.push_back(make_pair(mit->second,mit->first));
 
     sort(vPairs.begin(),vPairs.end());
@@ -249,26 +343,36 @@ void KeyFrame::UpdateBestCovisibles()
 
     mvpOrderedConnectedKeyFrames = vector<KeyFrame*>(lKFs.begin(),lKFs.end());
     mvOrderedWeights = vector<int>(lWs.begin(), lWs.end());
+    lock.unlock();
+
+    SetEssentialGraphDirty();
 }
 
 set<KeyFrame*> KeyFrame::GetConnectedKeyFrames()
 {
-    unique_lock<mutex> lock(mMutexConnections);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexConnections);
     set<KeyFrame*> s;
-    for(map<KeyFrame*,int>::iterator mit=mConnectedKeyFrameWeights.begin();mit!=mConnectedKeyFrameWeights.end();mit++)
+    for(KeyFrameWeights::iterator mit=mConnectedKeyFrameWeights.begin();mit!=mConnectedKeyFrameWeights.end();mit++)
         s.insert(mit->first);
     return s;
 }
 
 vector<KeyFrame*> KeyFrame::GetVectorCovisibleKeyFrames()
 {
-    unique_lock<mutex> lock(mMutexConnections);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexConnections);
     return mvpOrderedConnectedKeyFrames;
 }
 
+void KeyFrame::GetOrderedCovisibles(vector<KeyFrame*> &vpKFs, vector<int> &vWeights)
+{
+    boost::shared_lock<boost::shared_mutex> lock(mMutexConnections);
+    vpKFs = mvpOrderedConnectedKeyFrames;
+    vWeights = mvOrderedWeights;
+}
+
 vector<KeyFrame*> KeyFrame::GetBestCovisibilityKeyFrames(const int &N)
 {
-    unique_lock<mutex> lock(mMutexConnections);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexConnections);
     if((int)mvpOrderedConnectedKeyFrames.size()<N)
         return mvpOrderedConnectedKeyFrames;
     else
@@ -278,7 +382,7 @@ vector<KeyFrame*> KeyFrame::GetBestCovisibilityKeyFrames(const int &N)
 
 vector<KeyFrame*> KeyFrame::GetCovisiblesByWeight(const int &w)
 {
-    unique_lock<mutex> lock(mMutexConnections);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexConnections);
 
     if(mvpOrderedConnectedKeyFrames.empty())
     {
@@ -301,16 +405,17 @@ vector<KeyFrame*> KeyFrame::GetCovisiblesByWeight(const int &w)
 
 int KeyFrame::GetWeight(KeyFrame *pKF)
 {
-    unique_lock<mutex> lock(mMutexConnections);
-    if(mConnectedKeyFrameWeights.count(pKF))
-        return mConnectedKeyFrameWeights[pKF];
+    boost::shared_lock<boost::shared_mutex> lock(mMutexConnections);
+    KeyFrameWeights::const_iterator it = mConnectedKeyFrameWeights.find(pKF);
+    if(it != mConnectedKeyFrameWeights.end())
+        return it->second;
     else
         return 0;
 }
 
 int KeyFrame::GetNumberMPs()
 {
-    unique_lock<mutex> lock(mMutexFeatures);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexFeatures);
     int numberMPs = 0;
     for(size_t i=0, iend=mvpMapPoints.size(); i<iend; i++)
     {
@@ -323,14 +428,16 @@ int KeyFrame::GetNumberMPs()
 
 void KeyFrame::AddMapPoint(MapPoint *pMP, const size_t &idx)
 {
-    unique_lock<mutex> lock(mMutexFeatures);
+    unique_lock<boost::shared_mutex> lock(mMutexFeatures);
     mvpMapPoints[idx]=pMP;
+    mnMatchesVersion++;
 }
 
 void KeyFrame::EraseMapPointMatch(const int &idx)
 {
-    unique_lock<mutex> lock(mMutexFeatures);
+    unique_lock<boost::shared_mutex> lock(mMutexFeatures);
     mvpMapPoints[idx]=static_cast<MapPoint*>(NULL);
+    mnMatchesVersion++;
 }
 
 void KeyFrame::EraseMapPointMatch(MapPoint* pMP)
@@ -341,17 +448,56 @@ void KeyFrame::EraseMapPointMatch(MapPoint* pMP)
         mvpMapPoints[leftIndex]=static_cast<MapPoint*>(NULL);
     if(rightIndex != -1)
         mvpMapPoints[rightIndex]=static_cast<MapPoint*>(NULL);
+    mnMatchesVersion++;
 }
 
 
 void KeyFrame::ReplaceMapPointMatch(const int &idx, MapPoint* pMP)
 {
     mvpMapPoints[idx]=pMP;
+    mnMatchesVersion++;
+}
+
+vector<KeyFrame::RigObservation> KeyFrame::GetRigObservations()
+{
+    vector<RigObservation> vObs;
+    {
+        unique_lock<mutex> lock(mMutexRigObservations);
+        if(mvRigObservations.empty())
+            return vObs;
+        vObs = mvRigObservations;
+    }
+
+    // A point erased or moved to another map (merge) does not have the handle anymore
+    Map* pMap = GetMap();
+    size_t nKept = 0;
+    for(size_t i=0; i<vObs.size(); i++)
+    {
+        if(!pMap || pMap->GetMapPoint(vObs[i].hMapPoint)!=vObs[i].pMP || vObs[i].pMP->isBad())
+            continue;
+        vObs[nKept++] = vObs[i];
+    }
+    vObs.resize(nKept);
+    return vObs;
+}
+
+void KeyFrame::EraseRigObservation(const int nCamera, MapPoint* pMP)
+{
+    unique_lock<mutex> lock(mMutexRigObservations);
+    for(size_t i=0; i<mvRigObservations.size(); i++)
+    {
+        if(mvRigObservations[i].nCamera==nCamera && mvRigObservations[i].pMP==pMP)
+        {
+            mvRigObservations[i] = mvRigObservations.back();
+            mvRigObservations.pop_back();
+            return;
+        }
+    }
 }
 
 set<MapPoint*> KeyFrame::GetMapPoints()
 {
-    unique_lock<mutex> lock(mMutexFeatures);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexFeatures);
     set<MapPoint*> s;
     for(size_t i=0, iend=mvpMapPoints.size(); i<iend; i++)
     {
@@ -366,7 +512,7 @@ set<MapPoint*> KeyFrame::GetMapPoints()
 
 int KeyFrame::TrackedMapPoints(const int &minObs)
 {
-    unique_lock<mutex> lock(mMutexFeatures);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexFeatures);
 
     int nPoints=0;
     const bool bCheckObs = minObs>0;
@@ -393,48 +539,33 @@ int KeyFrame::TrackedMapPoints(const int &minObs)
 
 vector<MapPoint*> KeyFrame::GetMapPointMatches()
 {
-    unique_lock<mutex> lock(mMutexFeatures);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexFeatures);
     return mvpMapPoints;
 }
 
 MapPoint* KeyFrame::GetMapPoint(const size_t &idx)
 {
-    unique_lock<mutex> lock(mMutexFeatures);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexFeatures);
     return mvpMapPoints[idx];
 }
 
 void KeyFrame::UpdateConnections(bool upParent)
 {
-    map<KeyFrame*,int> KFcounter;
-
-    vector<MapPoint*> vpMP;
+    KeyFrameWeights KFcounter;
 
     {
-        unique_lock<mutex> lockMPs(mMutexFeatures);
-        vpMP = mvpMapPoints;
+        unique_lock<mutex> lockCovis(mMutexCovisibility);
+        KFcounter = mCovisibilityCounts;
     }
 
-    //For all map points in keyframe check in which other keyframes are they seen
-    //Increase counter for those keyframes
-    for(vector<MapPoint*>::iterator vit=vpMP.begin(), vend=vpMP.end(); vit!=vend; vit++)
+    //The counters already hold, for each keyframe, how many of our map points it observes.
+    //Skip only the keyframes that are not valid neighbours anymore
+    for(KeyFrameWeights::iterator mit=KFcounter.begin(); mit!=KFcounter.end(); )
     {
-        MapPoint* pMP = *vit;
-
-        if(!pMP)
-            continue;
-
-        if(pMP->isBad())
-            continue;
-
-        map<KeyFrame*,tuple<int,int>> observations = pMP->GetObservations();
-
-        for(map<KeyFrame*,tuple<int,int>>::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
-        {
-            if(mit->first->mnId==mnId || mit->first->isBad() || mit->first->GetMap() != mpMap)
-                continue;
-            KFcounter[mit->first]++;
-
-        }
+        if(mit->second<=0 || mit->first->mnId==mnId || mit->first->isBad() || mit->first->GetMap() != mpMap)
+            mit = KFcounter.erase(mit);
+        else
+            mit++;
     }
 
     // This should not happen
@@ -451,7 +582,7 @@ void KeyFrame::UpdateConnections(bool upParent)
     vPairs.reserve(KFcounter.size());
     if(!upParent)
         cout << "UPDATE_CONN: current KF " << mnId << endl;
-    for(map<KeyFrame*,int>::iterator mit=KFcounter.begin(), mend=KFcounter.end(); mit!=mend; mit++)
+    for(KeyFrameWeights::iterator mit=KFcounter.begin(), mend=KFcounter.end(); mit!=mend; mit++)
     {
         if(!upParent)
             cout << "  UPDATE_CONN: KF " << mit->first->mnId << " ; num matches: " << mit->second << endl;
@@ -483,7 +614,7 @@ void KeyFrame::UpdateConnections(bool upParent)
     }
 
     {
-        unique_lock<mutex> lockCon(mMutexConnections);
+        unique_lock<boost::shared_mutex> lockCon(mMutexConnections);
 
         mConnectedKeyFrameWeights = KFcounter;
         mvpOrderedConnectedKeyFrames = vector<KeyFrame*>(lKFs.begin(),lKFs.end());
@@ -497,23 +628,40 @@ void KeyFrame::UpdateConnections(bool upParent)
         }
 
     }
+
+    SetEssentialGraphDirty();
+}
+
+void KeyFrame::IncreaseCovisibility(KeyFrame *pKF, int n)
+{
+    unique_lock<mutex> lockCovis(mMutexCovisibility);
+    int &count = mCovisibilityCounts[pKF];
+    count += n;
+    if(count<=0)
+        mCovisibilityCounts.erase(pKF);
 }
 
 void KeyFrame::AddChild(KeyFrame *pKF)
 {
-    unique_lock<mutex> lockCon(mMutexConnections);
-    mspChildrens.insert(pKF);
+    {
+        unique_lock<boost::shared_mutex> lockCon(mMutexConnections);
+        mspChildrens.insert(pKF);
+    }
+    SetEssentialGraphDirty();
 }
 
 void KeyFrame::EraseChild(KeyFrame *pKF)
 {
-    unique_lock<mutex> lockCon(mMutexConnections);
-    mspChildrens.erase(pKF);
+    {
+        unique_lock<boost::shared_mutex> lockCon(mMutexConnections);
+        mspChildrens.erase(pKF);
+    }
+    SetEssentialGraphDirty();
 }
 
 void KeyFrame::ChangeParent(KeyFrame *pKF)
 {
-    unique_lock<mutex> lockCon(mMutexConnections);
+    unique_lock<boost::shared_mutex> lockCon(mMutexConnections);
 
     if(pKF == this)
     {
@@ -523,68 +671,74 @@ void KeyFrame::ChangeParent(KeyFrame *pKF)
 
     mpParent = pKF;
     pKF->AddChild(this);
+    lockCon.unlock();
+
+    SetEssentialGraphDirty();
 }
 
 set<KeyFrame*> KeyFrame::GetChilds()
 {
-    unique_lock<mutex> lockCon(mMutexConnections);
+    boost::shared_lock<boost::shared_mutex> lockCon(mMutexConnections);
     return mspChildrens;
 }
 
 KeyFrame* KeyFrame::GetParent()
 {
-    unique_lock<mutex> lockCon(mMutexConnections);
+    boost::shared_lock<boost::shared_mutex> lockCon(mMutexConnections);
     return mpParent;
 }
 
 bool KeyFrame::hasChild(KeyFrame *pKF)
 {
-    unique_lock<mutex> lockCon(mMutexConnections);
+    boost::shared_lock<boost::shared_mutex> lockCon(mMutexConnections);
     return mspChildrens.count(pKF);
 }
 
 void KeyFrame::SetFirstConnection(bool bFirst)
 {
-    unique_lock<mutex> lockCon(mMutexConnections);
+    unique_lock<boost::shared_mutex> lockCon(mMutexConnections);
     mbFirstConnection=bFirst;
 }
 
 void KeyFrame::AddLoopEdge(KeyFrame *pKF)
 {
-    unique_lock<mutex> lockCon(mMutexConnections);
-    mbNotErase = true;
-    mspLoopEdges.insert(pKF);
+    {
+        unique_lock<boost::shared_mutex> lockCon(mMutexConnections);
+        mbNotErase = true;
+        mspLoopEdges.insert(pKF);
+    }
+    SetEssentialGraphDirty();
 }
 
 set<KeyFrame*> KeyFrame::GetLoopEdges()
 {
-    unique_lock<mutex> lockCon(mMutexConnections);
+    boost::shared_lock<boost::shared_mutex> lockCon(mMutexConnections);
     return mspLoopEdges;
 }
 
 void KeyFrame::AddMergeEdge(KeyFrame* pKF)
 {
-    unique_lock<mutex> lockCon(mMutexConnections);
+    unique_lock<boost::shared_mutex> lockCon(mMutexConnections);
     mbNotErase = true;
     mspMergeEdges.insert(pKF);
 }
 
 set<KeyFrame*> KeyFrame::GetMergeEdges()
 {
-    unique_lock<mutex> lockCon(mMutexConnections);
+    boost::shared_lock<boost::shared_mutex> lockCon(mMutexConnections);
     return mspMergeEdges;
 }
 
 void KeyFrame::SetNotErase()
 {
-    unique_lock<mutex> lock(mMutexConnections);
+    unique_lock<boost::shared_mutex> lock(mMutexConnections);
     mbNotErase = true;
 }
 
 void KeyFrame::SetErase()
 {
     {
-        unique_lock<mutex> lock(mMutexConnections);
+        unique_lock<boost::shared_mutex> lock(mMutexConnections);
         if(mspLoopEdges.empty())
         {
             mbNotErase = false;
@@ -599,8 +753,9 @@ void KeyFrame::SetErase()
 
 void KeyFrame::SetBadFlag()
 {
+    bool bWasBad;
     {
-        unique_lock<mutex> lock(mMutexConnections);
+        unique_lock<boost::shared_mutex> lock(mMutexConnections);
         if(mnId==mpMap->GetInitKFid())
         {
             return;
@@ -612,7 +767,7 @@ void KeyFrame::SetBadFlag()
         }
     }
 
-    for(map<KeyFrame*,int>::iterator mit = mConnectedKeyFrameWeights.begin(), mend=mConnectedKeyFrameWeights.end(); mit!=mend; mit++)
+    for(KeyFrameWeights::iterator mit = mConnectedKeyFrameWeights.begin(), mend=mConnectedKeyFrameWeights.end(); mit!=mend; mit++)
     {
         mit->first->EraseConnection(this);
     }
@@ -626,8 +781,8 @@ void KeyFrame::SetBadFlag()
     }
 
     {
-        unique_lock<mutex> lock(mMutexConnections);
-        unique_lock<mutex> lock1(mMutexFeatures);
+        unique_lock<boost::shared_mutex> lock(mMutexConnections);
+        unique_lock<boost::shared_mutex> lock1(mMutexFeatures);
 
         mConnectedKeyFrameWeights.clear();
         mvpOrderedConnectedKeyFrames.clear();
@@ -695,19 +850,43 @@ void KeyFrame::SetBadFlag()
 
         if(mpParent){
             mpParent->EraseChild(this);
-            mTcp = Tcw*mpParent->GetPoseInverse();
+            mTcp = cv::Mat(GetPose_()*mpParent->GetPoseInverse_());
         }
+        bWasBad = mbBad;
         mbBad = true;
+        mnGraphVersion++;
     }
 
 
     mpMap->EraseKeyFrame(this);
     mpKeyFrameDB->erase(this);
+
+    // The keyframe itself is still needed for the trajectory (pose relative to the parent),
+    // only its features go once no thread can be matching against them
+    if(!bWasBad)
+        EpochManager::Retire(this, &ReleaseBadKeyFrame, mpMap->GetReclaimGracePeriod());
+}
+
+void KeyFrame::ReleaseRetiredFeatures()
+{
+    unique_lock<boost::shared_mutex> lock(mMutexFeatures);
+
+    // The map points erased this keyframe from their observations when it was set bad,
+    // they are not reachable from here anymore once they are reclaimed
+    std::fill(mvpMapPoints.begin(),mvpMapPoints.end(),static_cast<MapPoint*>(NULL));
+    mBowVec.clear();
+    mFeatVec.clear();
+    mFlatFeatVec.Clear();
+    mFlatBowVec.Clear();
+    const_cast<cv::Mat&>(mDescriptors).release();
+
+    unique_lock<mutex> lockCache(mMutexRelocCache);
+    mpRelocCache.reset();
 }
 
 bool KeyFrame::isBad()
 {
-    unique_lock<mutex> lock(mMutexConnections);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexConnections);
     return mbBad;
 }
 
@@ -715,7 +894,7 @@ void KeyFrame::EraseConnection(KeyFrame* pKF)
 {
     bool bUpdate = false;
     {
-        unique_lock<mutex> lock(mMutexConnections);
+        unique_lock<boost::shared_mutex> lock(mMutexConnections);
         if(mConnectedKeyFrameWeights.count(pKF))
         {
             mConnectedKeyFrameWeights.erase(pKF);
@@ -732,46 +911,58 @@ vector<size_t> KeyFrame::GetFeaturesInArea(const float &x, const float &y, const
 {
     vector<size_t> vIndices;
     vIndices.reserve(N);
+    GetFeaturesInArea(x, y, r, vIndices, bRight);
+    return vIndices;
+}
+
+void KeyFrame::GetFeaturesInArea(const float &x, const float &y, const float &r, vector<size_t> &vIndices, const bool bRight) const
+{
+    vIndices.clear();
+
+    if(!mbGridReady)
+        AssignFeaturesToGrid();
 
     float factorX = r;
     float factorY = r;
 
     const int nMinCellX = max(0,(int)floor((x-mnMinX-factorX)*mfGridElementWidthInv));
     if(nMinCellX>=mnGridCols)
-        return vIndices;
+        return;
 
     const int nMaxCellX = min((int)mnGridCols-1,(int)ceil((x-mnMinX+factorX)*mfGridElementWidthInv));
     if(nMaxCellX<0)
-        return vIndices;
+        return;
 
     const int nMinCellY = max(0,(int)floor((y-mnMinY-factorY)*mfGridElementHeightInv));
     if(nMinCellY>=mnGridRows)
-        return vIndices;
+        return;
 
     const int nMaxCellY = min((int)mnGridRows-1,(int)ceil((y-mnMinY+factorY)*mfGridElementHeightInv));
     if(nMaxCellY<0)
-        return vIndices;
+        return;
+
+    const FeatureGrid &grid = (!bRight) ? mGrid : mGridRight;
+    if(grid.empty())
+        return;
 
+    // The cells of one column between nMinCellY and nMaxCellY are contiguous
     for(int ix = nMinCellX; ix<=nMaxCellX; ix++)
     {
-        for(int iy = nMinCellY; iy<=nMaxCellY; iy++)
+        const unsigned int *pIdx, *pEnd;
+        grid.ColumnRange(ix, nMinCellY, nMaxCellY, pIdx, pEnd);
+
+        for(; pIdx!=pEnd; pIdx++)
         {
-            const vector<size_t> vCell = (!bRight) ? mGrid[ix][iy] : mGridRight[ix][iy];
-            for(size_t j=0, jend=vCell.size(); j<jend; j++)
-            {
-                const cv::KeyPoint &kpUn = (NLeft == -1) ? mvKeysUn[vCell[j]]
-                                                         : (!bRight) ? mvKeys[vCell[j]]
-                                                                     : mvKeysRight[vCell[j]];
-                const float distx = kpUn.pt.x-x;
-                const float disty = kpUn.pt.y-y;
-
-                if(fabs(distx)<r && fabs(disty)<r)
-                    vIndices.push_back(vCell[j]);
-            }
+            const cv::KeyPoint &kpUn = (NLeft == -1) ? mvKeysUn[*pIdx]
+                                                     : (!bRight) ? GetKeyPoint(*pIdx)
+                                                                 : mvKeysRight[*pIdx];
+            const float distx = kpUn.pt.x-x;
+            const float disty = kpUn.pt.y-y;
+
+            if(fabs(distx)<r && fabs(disty)<r)
+                vIndices.push_back(*pIdx);
         }
     }
-
-    return vIndices;
 }
 
 bool KeyFrame::IsInImage(const float &x, const float &y) const
@@ -784,14 +975,15 @@ cv::Mat KeyFrame::UnprojectStereo(int i)
     const float z = mvDepth[i];
     if(z>0)
     {
-        const float u = mvKeys[i].pt.x;
-        const float v = mvKeys[i].pt.y;
+        const cv::KeyPoint &kp = GetKeyPoint(i);
+        const float u = kp.pt.x;
+        const float v = kp.pt.y;
         const float x = (u-cx)*z*invfx;
         const float y = (v-cy)*z*invfy;
-        cv::Mat x3Dc = (cv::Mat_<float>(3,1) << x, y, z);
+        const cv::Matx31f x3Dc(x, y, z);
 
-        unique_lock<mutex> lock(mMutexPose);
-        return Twc.rowRange(0,3).colRange(0,3)*x3Dc+Twc.rowRange(0,3).col(3);
+        boost::shared_lock<boost::shared_mutex> lock(mMutexPose);
+        return cv::Mat(Twc_.get_minor<3,3>(0,0)*x3Dc+Twc_.get_minor<3,1>(0,3));
     }
     else
         return cv::Mat();
@@ -800,25 +992,24 @@ cv::Mat KeyFrame::UnprojectStereo(int i)
 float KeyFrame::ComputeSceneMedianDepth(const int q)
 {
     vector<MapPoint*> vpMapPoints;
-    cv::Mat Tcw_;
+    cv::Matx44f Tcw;
     {
-        unique_lock<mutex> lock(mMutexFeatures);
-        unique_lock<mutex> lock2(mMutexPose);
+        boost::shared_lock<boost::shared_mutex> lock(mMutexFeatures);
+        boost::shared_lock<boost::shared_mutex> lock2(mMutexPose);
         vpMapPoints = mvpMapPoints;
-        Tcw_ = Tcw.clone();
+        Tcw = Tcw_;
     }
 
     vector<float> vDepths;
     vDepths.reserve(N);
-    cv::Mat Rcw2 = Tcw_.row(2).colRange(0,3);
-    Rcw2 = Rcw2.t();
-    float zcw = Tcw_.at<float>(2,3);
+    const cv::Matx31f Rcw2(Tcw(2,0), Tcw(2,1), Tcw(2,2));
+    const float zcw = Tcw(2,3);
     for(int i=0; i<N; i++)
     {
         if(mvpMapPoints[i])
         {
             MapPoint* pMP = mvpMapPoints[i];
-            cv::Mat x3Dw = pMP->GetWorldPos();
+            const cv::Matx31f x3Dw = pMP->GetWorldPos2();
             float z = Rcw2.dot(x3Dw)+zcw;
             vDepths.push_back(z);
         }
@@ -831,7 +1022,7 @@ float KeyFrame::ComputeSceneMedianDepth(const int q)
 
 void KeyFrame::SetNewBias(const IMU::Bias &b)
 {
-    unique_lock<mutex> lock(mMutexPose);
+    unique_lock<boost::shared_mutex> lock(mMutexPose);
     mImuBias = b;
     if(mpImuPreintegrated)
         mpImuPreintegrated->SetNewBias(b);
@@ -839,19 +1030,19 @@ void KeyFrame::SetNewBias(const IMU::Bias &b)
 
 cv::Mat KeyFrame::GetGyroBias()
 {
-    unique_lock<mutex> lock(mMutexPose);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexPose);
     return (cv::Mat_<float>(3,1) << mImuBias.bwx, mImuBias.bwy, mImuBias.bwz);
 }
 
 cv::Mat KeyFrame::GetAccBias()
 {
-    unique_lock<mutex> lock(mMutexPose);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexPose);
     return (cv::Mat_<float>(3,1) << mImuBias.bax, mImuBias.bay, mImuBias.baz);
 }
 
 IMU::Bias KeyFrame::GetImuBias()
 {
-    unique_lock<mutex> lock(mMutexPose);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexPose);
     return mImuBias;
 }
 
@@ -867,19 +1058,23 @@ void KeyFrame::UpdateMap(Map* pMap)
     mpMap = pMap;
 }
 
+void KeyFrame::SetEssentialGraphDirty()
+{
+    mnGraphVersion++;
+}
+
 bool KeyFrame::ProjectPointDistort(MapPoint* pMP, cv::Point2f &kp, float &u, float &v)
 {
 
     // 3D in absolute coordinates
-    cv::Mat P = pMP->GetWorldPos();
-    cv::Mat Rcw = Tcw.rowRange(0, 3).colRange(0, 3);
-    cv::Mat tcw = Tcw.rowRange(0, 3).col(3);
+    const cv::Matx31f P = pMP->GetWorldPos2();
+    const cv::Matx44f Tcw = GetPose_();
 
     // 3D in camera coordinates
-    cv::Mat Pc = Rcw*P+tcw;
-    float &PcX = Pc.at<float>(0);
-    float &PcY= Pc.at<float>(1);
-    float &PcZ = Pc.at<float>(2);
+    const cv::Matx31f Pc = Tcw.get_minor<3,3>(0,0)*P+Tcw.get_minor<3,1>(0,3);
+    const float PcX = Pc(0);
+    const float PcY = Pc(1);
+    const float PcZ = Pc(2);
 
     // Check positive depth
     if(PcZ<0.0f)
@@ -936,14 +1131,13 @@ bool KeyFrame::ProjectPointUnDistort(MapPoint* pMP, cv::Point2f &kp, float &u, f
 {
 
     // 3D in absolute coordinates
-    cv::Mat P = pMP->GetWorldPos();
-    cv::Mat Rcw = Tcw.rowRange(0, 3).colRange(0, 3);
-    cv::Mat tcw = Tcw.rowRange(0, 3).col(3);
+    const cv::Matx31f P = pMP->GetWorldPos2();
+    const cv::Matx44f Tcw = GetPose_();
     // 3D in camera coordinates
-    cv::Mat Pc = Rcw*P+tcw;
-    float &PcX = Pc.at<float>(0);
-    float &PcY= Pc.at<float>(1);
-    float &PcZ = Pc.at<float>(2);
+    const cv::Matx31f Pc = Tcw.get_minor<3,3>(0,0)*P+Tcw.get_minor<3,1>(0,3);
+    const float PcX = Pc(0);
+    const float PcY = Pc(1);
+    const float PcZ = Pc(2);
 
     // Check positive depth
     if(PcZ<0.0f)
@@ -970,120 +1164,354 @@ bool KeyFrame::ProjectPointUnDistort(MapPoint* pMP, cv::Point2f &kp, float &u, f
 }
 
 cv::Mat KeyFrame::GetRightPose() {
-    unique_lock<mutex> lock(mMutexPose);
+    return cv::Mat(GetRightPose_()).rowRange(0,3).clone();
+}
 
-    cv::Mat Rrl = mTlr.rowRange(0,3).colRange(0,3).t();
-    cv::Mat Rlw = Tcw.rowRange(0,3).colRange(0,3).clone();
-    cv::Mat Rrw = Rrl * Rlw;
+cv::Mat KeyFrame::GetRightPoseInverse() {
+    return GetRightPoseInverseH().rowRange(0,3).clone();
+}
 
-    cv::Mat tlw = Tcw.rowRange(0,3).col(3).clone();
-    cv::Mat trl = - Rrl * mTlr.rowRange(0,3).col(3);
+cv::Mat KeyFrame::GetRightPoseInverseH() {
+    boost::shared_lock<boost::shared_mutex> lock(mMutexPose);
+    const cv::Matx33f Rrl = Tlr_.get_minor<3,3>(0,0).t();
+    const cv::Matx33f Rwl = Tcw_.get_minor<3,3>(0,0).t();
+    const cv::Matx33f Rwr = Rwl*Rrl.t();
+    const cv::Matx31f twr = Rwl*Tlr_.get_minor<3,1>(0,3) + Ow_;
 
-    cv::Mat trw = Rrl * tlw + trl;
+    const cv::Matx44f Twr(Rwr(0,0),Rwr(0,1),Rwr(0,2),twr(0),
+                          Rwr(1,0),Rwr(1,1),Rwr(1,2),twr(1),
+                          Rwr(2,0),Rwr(2,1),Rwr(2,2),twr(2),
+                          0.f,0.f,0.f,1.f);
+    return cv::Mat(Twr);
+}
 
-    cv::Mat Trw;
-    cv::hconcat(Rrw,trw,Trw);
+cv::Mat KeyFrame::GetRightCameraCenter() {
+    return cv::Mat(GetRightCameraCenter_());
+}
 
-    return Trw.clone();
+cv::Mat KeyFrame::GetRightRotation() {
+    return cv::Mat(GetRightRotation_());
 }
 
-cv::Mat KeyFrame::GetRightPoseInverse() {
-    unique_lock<mutex> lock(mMutexPose);
-    cv::Mat Rrl = mTlr.rowRange(0,3).colRange(0,3).t();
-    cv::Mat Rlw = Tcw.rowRange(0,3).colRange(0,3).clone();
-    cv::Mat Rwr = (Rrl * Rlw).t();
+cv::Mat KeyFrame::GetRightTranslation() {
+    return cv::Mat(GetRightTranslation_());
+}
 
-    cv::Mat Rwl = Tcw.rowRange(0,3).colRange(0,3).t();
-    cv::Mat tlr = mTlr.rowRange(0,3).col(3);
-    cv::Mat twl = GetCameraCenter();
+void KeyFrame::SetORBVocabulary(ORBVocabulary* pORBVoc)
+{
+    mpORBvocabulary = pORBVoc;
+}
 
-    cv::Mat twr = Rwl * tlr + twl;
+void KeyFrame::SetKeyFrameDatabase(KeyFrameDatabase* pKFDB)
+{
+    mpKeyFrameDB = pKFDB;
+}
 
-    cv::Mat Twr;
-    cv::hconcat(Rwr,twr,Twr);
+void KeyFrame::ReleaseFeatures()
+{
+    unique_lock<mutex> lock(mMutexGrid);
 
-    return Twr.clone();
-}
+    vector<cv::KeyPoint>().swap(const_cast<vector<cv::KeyPoint>&>(mvKeys));
+    vector<cv::KeyPoint>().swap(const_cast<vector<cv::KeyPoint>&>(mvKeysUn));
+    vector<cv::KeyPoint>().swap(const_cast<vector<cv::KeyPoint>&>(mvKeysRight));
+    vector<float>().swap(const_cast<vector<float>&>(mvuRight));
+    vector<float>().swap(const_cast<vector<float>&>(mvDepth));
+    const_cast<cv::Mat&>(mDescriptors).release();
+    mFeatVec.clear();
+    mFlatFeatVec.Clear();
 
-cv::Mat KeyFrame::GetRightPoseInverseH() {
-    unique_lock<mutex> lock(mMutexPose);
-    cv::Mat Rrl = mTlr.rowRange(0,3).colRange(0,3).t();
-    cv::Mat Rlw = Tcw.rowRange(0,3).colRange(0,3).clone();
-    cv::Mat Rwr = (Rrl * Rlw).t();
+    // The grid is rebuilt from the keypoints on first use after they are loaded back
+    mGrid.Clear();
+    mGridRight.Clear();
+    mbGridReady = false;
 
-    cv::Mat Rwl = Tcw.rowRange(0,3).colRange(0,3).t();
-    cv::Mat tlr = mTlr.rowRange(0,3).col(3);
-    cv::Mat twl = Ow.clone();
+    mbFeaturesReleased = true;
+}
 
-    cv::Mat twr = Rwl * tlr + twl;
+void KeyFrame::SetFeaturesLoaded()
+{
+    mFlatFeatVec.Build(mFeatVec);
+    mbFeaturesReleased = false;
+}
 
-    cv::Mat Twr;
-    cv::hconcat(Rwr,twr,Twr);
-    cv::Mat h(1,4,CV_32F,cv::Scalar(0.0f)); h.at<float>(3) = 1.0f;
-    cv::vconcat(Twr,h,Twr);
+std::shared_ptr<const RelocalizationCache> KeyFrame::GetRelocalizationCache()
+{
+    unique_lock<mutex> lock(mMutexRelocCache);
+    if(!mpRelocCache && !mbFeaturesReleased && !mFlatFeatVec.Empty())
+        mpRelocCache = RelocalizationCache::Build(this);
+    return mpRelocCache;
+}
 
-    return Twr.clone();
+void KeyFrame::SetInertialPrior(const std::shared_ptr<ConstraintPoseImu> &pPrior)
+{
+    Map* pMap = GetMap();
+    unique_lock<mutex> lock(mMutexPose);
+    mpInertialPrior = pPrior;
+    mpInertialPriorMap = pMap;
+    mnInertialPriorChangeIdx = pMap ? pMap->GetLastBigChangeIdx() : -1;
 }
 
-cv::Mat KeyFrame::GetRightCameraCenter() {
+std::shared_ptr<ConstraintPoseImu> KeyFrame::GetInertialPrior()
+{
+    Map* pMap = GetMap();
     unique_lock<mutex> lock(mMutexPose);
-    cv::Mat Rwl = Tcw.rowRange(0,3).colRange(0,3).t();
-    cv::Mat tlr = mTlr.rowRange(0,3).col(3);
-    cv::Mat twl = Ow.clone();
+    if(!mpInertialPrior || pMap!=mpInertialPriorMap || pMap->GetLastBigChangeIdx()!=mnInertialPriorChangeIdx)
+        return std::shared_ptr<ConstraintPoseImu>();
+    return mpInertialPrior;
+}
 
-    cv::Mat twr = Rwl * tlr + twl;
+void KeyFrame::ResetInertialPrior()
+{
+    unique_lock<mutex> lock(mMutexPose);
+    mpInertialPrior.reset();
+}
 
-    return twr.clone();
+void KeyFrame::ShareUndistortedKeys()
+{
+    if(!mvKeys.empty() && SameKeyPoints(mvKeys,mvKeysUn))
+        vector<cv::KeyPoint>().swap(const_cast<vector<cv::KeyPoint>&>(mvKeys));
 }
 
-cv::Mat KeyFrame::GetRightRotation() {
-    unique_lock<mutex> lock(mMutexPose);
-    cv::Mat Rrl = mTlr.rowRange(0,3).colRange(0,3).t();
-    cv::Mat Rlw = Tcw.rowRange(0,3).colRange(0,3).clone();
-    cv::Mat Rrw = Rrl * Rlw;
+size_t KeyFrame::FeaturesMemory() const
+{
+    if(mbFeaturesReleased)
+        return 0;
+
+    size_t nBytes = (mvKeys.size() + mvKeysUn.size() + mvKeysRight.size())*sizeof(cv::KeyPoint);
+    nBytes += (mvuRight.size() + mvDepth.size())*sizeof(float);
+    nBytes += mDescriptors.total()*mDescriptors.elemSize();
+    // Every keypoint index is stored once in the feature vector
+    nBytes += N*sizeof(unsigned int) + mFlatFeatVec.MemoryBytes();
+    nBytes += (mGrid.mvIndices.size() + mGridRight.mvIndices.size())*sizeof(unsigned int);
+    return nBytes;
+}
 
-    return Rrw.clone();
+void KeyFrame::AccumulateMemory(MemoryUsage &usage)
+{
+    size_t nBytes = sizeof(KeyFrame);
+    nBytes += mBowVec.size()*(sizeof(DBoW2::BowVector::value_type) + MemoryUsage::TREE_NODE_OVERHEAD) + mFlatBowVec.MemoryBytes();
+    {
+        unique_lock<mutex> lock(mMutexRelocCache);
+        if(mpRelocCache)
+            nBytes += mpRelocCache->MemoryBytes();
+    }
+    nBytes += (mvLeftToRightMatch.capacity() + mvRightToLeftMatch.capacity())*sizeof(int);
+    {
+        boost::shared_lock<boost::shared_mutex> lock(mMutexFeatures);
+        nBytes += mvpMapPoints.capacity()*sizeof(MapPoint*);
+    }
+    {
+        boost::shared_lock<boost::shared_mutex> lock(mMutexConnections);
+        nBytes += mConnectedKeyFrameWeights.size()*sizeof(KeyFrameWeights::value_type);
+        nBytes += mvpOrderedConnectedKeyFrames.capacity()*sizeof(KeyFrame*) + mvOrderedWeights.capacity()*sizeof(int);
+        nBytes += (mspChildrens.size() + mspLoopEdges.size() + mspMergeEdges.size())*(sizeof(KeyFrame*) + MemoryUsage::TREE_NODE_OVERHEAD);
+    }
+    {
+        unique_lock<mutex> lock(mMutexCovisibility);
+        nBytes += mCovisibilityCounts.size()*sizeof(KeyFrameWeights::value_type);
+    }
 
+    usage.nKeyFrames += nBytes;
+    usage.nKeyFrameFeatures += FeaturesMemory();
+    if(mpImuPreintegrated)
+        usage.nImuPreintegration += mpImuPreintegrated->Memory();
+    usage.nKeyFrameCount++;
 }
 
-cv::Mat KeyFrame::GetRightTranslation() {
-    unique_lock<mutex> lock(mMutexPose);
-    cv::Mat Rrl = mTlr.rowRange(0,3).colRange(0,3).t();
-    cv::Mat tlw = Tcw.rowRange(0,3).col(3).clone();
-    cv::Mat trl = - Rrl * mTlr.rowRange(0,3).col(3);
+void KeyFrame::AssignFeaturesToGrid() const
+{
+    unique_lock<mutex> lock(mMutexGrid);
+    if(mbGridReady)
+        return;
+
+    // Same cell assignment as Frame::AssignFeaturesToGrid
+    vector<int> vCells(N);
+    for(int i=0; i<N; i++)
+    {
+        const cv::KeyPoint &kp = (NLeft == -1) ? mvKeysUn[i]
+                                               : (i < NLeft) ? GetKeyPoint(i)
+                                                             : mvKeysRight[i - NLeft];
+
+        const int nGridPosX = round((kp.pt.x-mnMinX)*mfGridElementWidthInv);
+        const int nGridPosY = round((kp.pt.y-mnMinY)*mfGridElementHeightInv);
+
+        //Keypoint's coordinates are undistorted, which could cause to go out of the image
+        if(nGridPosX<0 || nGridPosX>=mnGridCols || nGridPosY<0 || nGridPosY>=mnGridRows)
+            vCells[i] = -1;
+        else
+            vCells[i] = nGridPosX*mnGridRows + nGridPosY;
+    }
 
-    cv::Mat trw = Rrl * tlw + trl;
+    const int nLeft = (NLeft == -1) ? N : NLeft;
+    mGrid.Build(mnGridCols, mnGridRows, vCells.data(), nLeft);
+    if(NLeft != -1)
+        mGridRight.Build(mnGridCols, mnGridRows, vCells.data() + NLeft, N - NLeft);
 
-    return trw.clone();
+    mbGridReady = true;
 }
 
-void KeyFrame::SetORBVocabulary(ORBVocabulary* pORBVoc)
+void KeyFrame::PreSave(set<KeyFrame*>& spKF, set<MapPoint*>& spMP, set<GeometricCamera*>& spCam)
 {
-    mpORBvocabulary = pORBVoc;
+    {
+        unique_lock<boost::shared_mutex> lock(mMutexFeatures);
+        mvBackupMapPointsId.clear();
+        mvBackupMapPointsId.reserve(N);
+        for(int i=0; i<N; i++)
+        {
+            MapPoint* pMPi = mvpMapPoints[i];
+            if(pMPi && spMP.count(pMPi))
+                mvBackupMapPointsId.push_back(pMPi->mnId);
+            else
+                mvBackupMapPointsId.push_back(-1);
+        }
+    }
+
+    {
+        unique_lock<boost::shared_mutex> lock(mMutexConnections);
+        mBackupConnectedKeyFrameIdWeights.clear();
+        for(KeyFrameWeights::const_iterator it = mConnectedKeyFrameWeights.begin(), end = mConnectedKeyFrameWeights.end(); it != end; ++it)
+        {
+            if(spKF.count(it->first))
+                mBackupConnectedKeyFrameIdWeights[it->first->mnId] = it->second;
+        }
+
+        mBackupParentId = (mpParent && spKF.count(mpParent)) ? (long long int)mpParent->mnId : -1;
+
+        mvBackupChildrensId.clear();
+        for(set<KeyFrame*>::const_iterator it = mspChildrens.begin(); it != mspChildrens.end(); ++it)
+            if(spKF.count(*it))
+                mvBackupChildrensId.push_back((*it)->mnId);
+
+        mvBackupLoopEdgesId.clear();
+        for(set<KeyFrame*>::const_iterator it = mspLoopEdges.begin(); it != mspLoopEdges.end(); ++it)
+            if(spKF.count(*it))
+                mvBackupLoopEdgesId.push_back((*it)->mnId);
+
+        mvBackupMergeEdgesId.clear();
+        for(set<KeyFrame*>::const_iterator it = mspMergeEdges.begin(); it != mspMergeEdges.end(); ++it)
+            if(spKF.count(*it))
+                mvBackupMergeEdgesId.push_back((*it)->mnId);
+    }
+
+    mBackupPrevKFId = (mPrevKF && spKF.count(mPrevKF)) ? (long long int)mPrevKF->mnId : -1;
+    mBackupNextKFId = (mNextKF && spKF.count(mNextKF)) ? (long long int)mNextKF->mnId : -1;
+
+    mnBackupIdCamera = -1;
+    if(mpCamera)
+    {
+        mnBackupIdCamera = mpCamera->GetId();
+        spCam.insert(mpCamera);
+    }
+
+    mnBackupIdCamera2 = -1;
+    if(mpCamera2)
+    {
+        mnBackupIdCamera2 = mpCamera2->GetId();
+        spCam.insert(mpCamera2);
+    }
 }
 
-void KeyFrame::SetKeyFrameDatabase(KeyFrameDatabase* pKFDB)
+void KeyFrame::PostLoad(map<long unsigned int, KeyFrame*>& mpKFid, map<long unsigned int, MapPoint*>& mpMPid, map<unsigned int, GeometricCamera*>& mpCamId)
 {
-    mpKeyFrameDB = pKFDB;
+    {
+        unique_lock<boost::shared_mutex> lock(mMutexFeatures);
+        mvpMapPoints.assign(N, static_cast<MapPoint*>(NULL));
+        for(int i=0, iend=min((int)mvBackupMapPointsId.size(),N); i<iend; i++)
+        {
+            if(mvBackupMapPointsId[i] < 0)
+                continue;
+
+            map<long unsigned int, MapPoint*>::iterator it = mpMPid.find(mvBackupMapPointsId[i]);
+            if(it != mpMPid.end())
+                mvpMapPoints[i] = it->second;
+        }
+    }
+
+    {
+        unique_lock<boost::shared_mutex> lock(mMutexConnections);
+        mConnectedKeyFrameWeights.clear();
+        for(map<long unsigned int,int>::const_iterator it = mBackupConnectedKeyFrameIdWeights.begin(); it != mBackupConnectedKeyFrameIdWeights.end(); ++it)
+        {
+            map<long unsigned int, KeyFrame*>::iterator itKF = mpKFid.find(it->first);
+            if(itKF != mpKFid.end())
+                mConnectedKeyFrameWeights[itKF->second] = it->second;
+        }
+
+        mpParent = static_cast<KeyFrame*>(NULL);
+        if(mBackupParentId >= 0 && mpKFid.count(mBackupParentId))
+            mpParent = mpKFid[mBackupParentId];
+
+        mspChildrens.clear();
+        for(size_t i=0; i<mvBackupChildrensId.size(); i++)
+            if(mpKFid.count(mvBackupChildrensId[i]))
+                mspChildrens.insert(mpKFid[mvBackupChildrensId[i]]);
+
+        mspLoopEdges.clear();
+        for(size_t i=0; i<mvBackupLoopEdgesId.size(); i++)
+            if(mpKFid.count(mvBackupLoopEdgesId[i]))
+                mspLoopEdges.insert(mpKFid[mvBackupLoopEdgesId[i]]);
+
+        mspMergeEdges.clear();
+        for(size_t i=0; i<mvBackupMergeEdgesId.size(); i++)
+            if(mpKFid.count(mvBackupMergeEdgesId[i]))
+                mspMergeEdges.insert(mpKFid[mvBackupMergeEdgesId[i]]);
+    }
+
+    mPrevKF = (mBackupPrevKFId >= 0 && mpKFid.count(mBackupPrevKFId)) ? mpKFid[mBackupPrevKFId] : static_cast<KeyFrame*>(NULL);
+    mNextKF = (mBackupNextKFId >= 0 && mpKFid.count(mBackupNextKFId)) ? mpKFid[mBackupNextKFId] : static_cast<KeyFrame*>(NULL);
+
+    mpCamera = (mnBackupIdCamera >= 0 && mpCamId.count(mnBackupIdCamera)) ? mpCamId[mnBackupIdCamera] : static_cast<GeometricCamera*>(NULL);
+    mpCamera2 = (mnBackupIdCamera2 >= 0 && mpCamId.count(mnBackupIdCamera2)) ? mpCamId[mnBackupIdCamera2] : static_cast<GeometricCamera*>(NULL);
+
+    mbNotErase = !mspLoopEdges.empty();
+    mbToBeErased = false;
+    mbBad = false;
+
+    // Derived pose members, ordered covisibility and flat feature and BoW vectors are cheap to recompute
+    SetPose_(Tcw_);
+    UpdateBestCovisibles();
+    mFlatFeatVec.Build(mFeatVec);
+    mFlatBowVec.Build(mBowVec);
+
+    if(mTlr.rows >= 3 && mTlr.cols == 4)
+    {
+        this->Tlr_ = cv::Matx44f(mTlr.at<float>(0,0),mTlr.at<float>(0,1),mTlr.at<float>(0,2),mTlr.at<float>(0,3),
+                                 mTlr.at<float>(1,0),mTlr.at<float>(1,1),mTlr.at<float>(1,2),mTlr.at<float>(1,3),
+                                 mTlr.at<float>(2,0),mTlr.at<float>(2,1),mTlr.at<float>(2,2),mTlr.at<float>(2,3),
+                                 0.f,0.f,0.f,1.f);
+    }
+
+    {
+        unique_lock<mutex> lock(mMutexGrid);
+        mGrid.Clear();
+        mGridRight.Clear();
+        mbGridReady = false;
+    }
+
+    mvBackupMapPointsId.clear();
+    mBackupConnectedKeyFrameIdWeights.clear();
+    mvBackupChildrensId.clear();
+    mvBackupLoopEdgesId.clear();
+    mvBackupMergeEdgesId.clear();
 }
 
 cv::Matx33f KeyFrame::GetRotation_() {
-    unique_lock<mutex> lock(mMutexPose);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexPose);
     return Tcw_.get_minor<3,3>(0,0);
 }
 
 cv::Matx31f KeyFrame::GetTranslation_() {
-    unique_lock<mutex> lock(mMutexPose);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexPose);
     return Tcw_.get_minor<3,1>(0,3);
 }
 
 cv::Matx31f KeyFrame::GetCameraCenter_() {
-    unique_lock<mutex> lock(mMutexPose);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexPose);
     return Ow_;
 }
 
 cv::Matx33f KeyFrame::GetRightRotation_() {
-    unique_lock<mutex> lock(mMutexPose);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexPose);
     cv::Matx33f Rrl = Tlr_.get_minor<3,3>(0,0).t();
     cv::Matx33f Rlw = Tcw_.get_minor<3,3>(0,0);
     cv::Matx33f Rrw = Rrl * Rlw;
@@ -1092,7 +1520,7 @@ cv::Matx33f KeyFrame::GetRightRotation_() {
 }
 
 cv::Matx31f KeyFrame::GetRightTranslation_() {
-    unique_lock<mutex> lock(mMutexPose);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexPose);
     cv::Matx33f Rrl = Tlr_.get_minor<3,3>(0,0).t();
     cv::Matx31f tlw = Tcw_.get_minor<3,1>(0,3);
     cv::Matx31f trl = - Rrl * Tlr_.get_minor<3,1>(0,3);
@@ -1103,7 +1531,7 @@ cv::Matx31f KeyFrame::GetRightTranslation_() {
 }
 
 cv::Matx44f KeyFrame::GetRightPose_() {
-    unique_lock<mutex> lock(mMutexPose);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexPose);
 
     cv::Matx33f Rrl = Tlr_.get_minor<3,3>(0,0).t();
     cv::Matx33f Rlw = Tcw_.get_minor<3,3>(0,0);
@@ -1123,7 +1551,7 @@ cv::Matx44f KeyFrame::GetRightPose_() {
 }
 
 cv::Matx31f KeyFrame::GetRightCameraCenter_() {
-    unique_lock<mutex> lock(mMutexPose);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexPose);
     cv::Matx33f Rwl = Tcw_.get_minor<3,3>(0,0).t();
     cv::Matx31f tlr = Tlr_.get_minor<3,1>(0,3);
 
@@ -1136,13 +1564,14 @@ cv::Matx31f KeyFrame::UnprojectStereo_(int i) {
     const float z = mvDepth[i];
     if(z>0)
     {
-        const float u = mvKeys[i].pt.x;
-        const float v = mvKeys[i].pt.y;
+        const cv::KeyPoint &kp = GetKeyPoint(i);
+        const float u = kp.pt.x;
+        const float v = kp.pt.y;
         const float x = (u-cx)*z*invfx;
         const float y = (v-cy)*z*invfy;
         cv::Matx31f x3Dc(x,y,z);
 
-        unique_lock<mutex> lock(mMutexPose);
+        boost::shared_lock<boost::shared_mutex> lock(mMutexPose);
         return Twc_.get_minor<3,3>(0,0) * x3Dc + Twc_.get_minor<3,1>(0,3);
     }
     else
@@ -1151,10 +1580,16 @@ cv::Matx31f KeyFrame::UnprojectStereo_(int i) {
 
 cv::Matx44f KeyFrame::GetPose_()
 {
-    unique_lock<mutex> lock(mMutexPose);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexPose);
     return Tcw_;
 }
 
+cv::Matx44f KeyFrame::GetPoseInverse_()
+{
+    boost::shared_lock<boost::shared_mutex> lock(mMutexPose);
+    return Twc_;
+}
+
 
 
 } //namespace ORB_SLAM
@@ -20,6 +20,8 @@
 #include "KeyFrameDatabase.h"
 
 #include "KeyFrame.h"
+#include "ThreadPool.h"
+#include "VocabularyLoader.h"
 #include "Thirdparty/DBoW2/DBoW2/BowVector.h"
 
 #include<mutex>
@@ -30,117 +32,427 @@ namespace ORB_SLAM3
 {
 
 KeyFrameDatabase::KeyFrameDatabase (const ORBVocabulary &voc):
-    mpVoc(&voc)
+    mpVoc(&voc), mpThreadPool(static_cast<ThreadPool*>(NULL)), mnGlobalShortlist(0), mnGlobalDim(256),
+    mnAddedSeq(0), mnGeneration(0), mbInvertedFileReady(false)
 {
-    mvInvertedFile.resize(voc.size());
+    // Otherwise sized when the first keyframe is added or queried
+    if(VocabularyLoader::IsLoaded(&voc))
+        EnsureInvertedFile();
 }
 
+void KeyFrameDatabase::EnsureInvertedFile()
+{
+    std::call_once(mInvertedFileOnce, [this]
+    {
+        VocabularyLoader::WaitUntilLoaded(mpVoc);
+        mvInvertedFile.resize(mpVoc->size());
+        mbInvertedFileReady.store(true, std::memory_order_release);
+    });
+}
 
-void KeyFrameDatabase::add(KeyFrame *pKF)
+size_t KeyFrameDatabase::InvertedFileWords() const
+{
+    return mbInvertedFileReady.load(std::memory_order_acquire) ? mvInvertedFile.size() : 0;
+}
+
+void KeyFrameDatabase::SetThreadPool(ThreadPool* pThreadPool)
+{
+    mpThreadPool = pThreadPool;
+}
+
+void KeyFrameDatabase::SetGlobalShortlist(const int nShortlist, const int nDim)
+{
+    unique_lock<mutex> lock(mMutexGlobalIndex);
+    mnGlobalShortlist = max(nShortlist,0);
+    if(nDim>0)
+        mnGlobalDim = nDim;
+    mmGlobalIndex.clear();
+}
+
+GlobalDescriptorIndex& KeyFrameDatabase::GlobalIndex(Map* pMap)
+{
+    map<Map*,GlobalDescriptorIndex>::iterator it = mmGlobalIndex.find(pMap);
+    if(it==mmGlobalIndex.end())
+        it = mmGlobalIndex.insert(make_pair(pMap,GlobalDescriptorIndex(mnGlobalDim))).first;
+    return it->second;
+}
+
+void KeyFrameDatabase::AddToGlobalIndex(KeyFrame* pKF)
+{
+    vector<float> vDesc;
+    GlobalDescriptorIndex::ComputeDescriptor(pKF->mBowVec,mnGlobalDim,vDesc);
+
+    unique_lock<mutex> lock(mMutexGlobalIndex);
+    GlobalIndex(pKF->GetMap()).Add(pKF,vDesc);
+}
+
+bool KeyFrameDatabase::GlobalShortlist(const DBoW2::BowVector &vBowVec, const eMapScope scope, const Map* pMap, vector<KeyFrame*> &vpKFs)
+{
+    if(mnGlobalShortlist<=0)
+        return false;
+
+    vector<float> vQuery;
+    GlobalDescriptorIndex::ComputeDescriptor(vBowVec,mnGlobalDim,vQuery);
+
+    vpKFs.clear();
+    vector<KeyFrame*> vpMapKFs;
+    unique_lock<mutex> lock(mMutexGlobalIndex);
+    for(map<Map*,GlobalDescriptorIndex>::iterator it=mmGlobalIndex.begin(); it!=mmGlobalIndex.end(); it++)
+    {
+        if((scope==ONLY_MAP && it->first!=pMap) || (scope==OTHER_MAPS && it->first==pMap))
+            continue;
+
+        const GlobalDescriptorIndex &index = it->second;
+        if(int(index.Size())<=mnGlobalShortlist)
+            index.GetKeyFrames(vpMapKFs);
+        else
+            index.Search(vQuery,mnGlobalShortlist,2*mnGlobalShortlist,vpMapKFs);
+        vpKFs.insert(vpKFs.end(),vpMapKFs.begin(),vpMapKFs.end());
+    }
+    return true;
+}
+
+void KeyFrameDatabase::CompareBow(const FlatBowVector &v1, const FlatBowVector &v2, int &nCommonWords, float &score)
+{
+    score = FlatBowVector::L1Score(v1, v2, nCommonWords);
+}
+
+
+KeyFrameDatabase::PostingList& KeyFrameDatabase::WordPostings::Partition(Map* pMap)
+{
+    for(size_t p=0, pend=mvPartitions.size(); p<pend; p++)
+    {
+        if(mvPartitions[p].mpMap==pMap)
+            return mvPartitions[p];
+    }
+
+    mvPartitions.push_back(PostingList());
+    mvPartitions.back().mpMap = pMap;
+    return mvPartitions.back();
+}
+
+KeyFrameDatabase::PostingList& KeyFrameDatabase::MapPartition(const unsigned int wordId, Map* pMap)
 {
-    unique_lock<mutex> lock(mMutex);
+    WordPostings &word = mvInvertedFile[wordId];
+    const size_t nPartitions = word.mvPartitions.size();
+    PostingList &posting = word.Partition(pMap);
+    if(word.mvPartitions.size() != nPartitions)
+    {
+        unique_lock<mutex> lock(mMutexMapWords);
+        mmMapWords[pMap].push_back(wordId);
+    }
+    return posting;
+}
+
+void KeyFrameDatabase::GetMapWords(const Map* pMap, const bool bForget, vector<unsigned int> vWords[NUM_SHARDS])
+{
+    unique_lock<mutex> lock(mMutexMapWords);
+    unordered_map<const Map*, vector<unsigned int> >::iterator it = mmMapWords.find(pMap);
+    if(it == mmMapWords.end())
+        return;
+
+    const vector<unsigned int> &vMapWords = it->second;
+    for(size_t i=0; i<vMapWords.size(); i++)
+        vWords[vMapWords[i]%NUM_SHARDS].push_back(vMapWords[i]);
+    if(bForget)
+        mmMapWords.erase(it);
+}
 
+void KeyFrameDatabase::add(KeyFrame *pKF)
+{
+    EnsureInvertedFile();
+    Map* pMap = pKF->GetMap();
     for(DBoW2::BowVector::const_iterator vit= pKF->mBowVec.begin(), vend=pKF->mBowVec.end(); vit!=vend; vit++)
-        mvInvertedFile[vit->first].push_back(pKF);
+    {
+        InvertedFileEntry entry;
+        entry.pKF = pKF;
+        entry.nKFId = pKF->mnId;
+        entry.weight = vit->second;
+
+        unique_lock<KeyFrameDatabaseMutex> lock(WordMutex(vit->first));
+        MapPartition(vit->first,pMap).mvEntries.push_back(entry);
+    }
+
+    if(mnGlobalShortlist>0)
+        AddToGlobalIndex(pKF);
+
+    unique_lock<mutex> lock(mMutexSessions);
+    mdpAddedLog.push_back(pKF);
+    if(mdpAddedLog.size() > ADDED_LOG_SIZE)
+        mdpAddedLog.pop_front();
+    mnAddedSeq++;
 }
 
 void KeyFrameDatabase::erase(KeyFrame* pKF)
 {
-    unique_lock<mutex> lock(mMutex);
+    EnsureInvertedFile();
+    Map* pMap = pKF->GetMap();
+
+    {
+        unique_lock<mutex> lock(mMutexGlobalIndex);
+        for(map<Map*,GlobalDescriptorIndex>::iterator it=mmGlobalIndex.begin(); it!=mmGlobalIndex.end(); it++)
+            it->second.Remove(pKF);
+    }
 
     // Erase elements in the Inverse File for the entry
     for(DBoW2::BowVector::const_iterator vit=pKF->mBowVec.begin(), vend=pKF->mBowVec.end(); vit!=vend; vit++)
     {
-        // List of keyframes that share the word
-        list<KeyFrame*> &lKFs =   mvInvertedFile[vit->first];
+        // List of keyframes that share the word. The partition of the map of the keyframe goes
+        // first, it is only elsewhere if its map changed and was not repartitioned yet
+        unique_lock<KeyFrameDatabaseMutex> lock(WordMutex(vit->first));
+        vector<PostingList> &vPartitions = mvInvertedFile[vit->first].mvPartitions;
 
-        for(list<KeyFrame*>::iterator lit=lKFs.begin(), lend= lKFs.end(); lit!=lend; lit++)
+        bool bErased = false;
+        for(int pass=0; pass<2 && !bErased; pass++)
         {
-            if(pKF==*lit)
+            for(size_t p=0, pend=vPartitions.size(); p<pend && !bErased; p++)
             {
-                lKFs.erase(lit);
-                break;
+                PostingList &posting = vPartitions[p];
+                if((pass==0) != (posting.mpMap==pMap))
+                    continue;
+
+                for(vector<InvertedFileEntry>::iterator lit=posting.mvEntries.begin(), lend=posting.mvEntries.end(); lit!=lend; lit++)
+                {
+                    if(lit->pKF==pKF)
+                    {
+                        // Leave a tombstone, the list is compacted once half of it is erased
+                        lit->pKF = static_cast<KeyFrame*>(NULL);
+                        posting.mnErased++;
+                        if(2*posting.mnErased > posting.mvEntries.size())
+                            posting.Compact();
+                        bErased = true;
+                        break;
+                    }
+                }
             }
         }
     }
 }
 
+void KeyFrameDatabase::PostingList::Compact()
+{
+    vector<InvertedFileEntry>::iterator itEnd = mvEntries.begin();
+    for(vector<InvertedFileEntry>::iterator lit=mvEntries.begin(), lend=mvEntries.end(); lit!=lend; lit++)
+    {
+        if(lit->pKF)
+            *(itEnd++) = *lit;
+    }
+    mvEntries.erase(itEnd, mvEntries.end());
+    mnErased = 0;
+}
+
 void KeyFrameDatabase::clear()
 {
-    mvInvertedFile.clear();
-    mvInvertedFile.resize(mpVoc->size());
+    // Only the words used by some map are visited
+    vector<unsigned int> vWords[NUM_SHARDS];
+    {
+        unique_lock<mutex> lock(mMutexMapWords);
+        for(unordered_map<const Map*, vector<unsigned int> >::const_iterator it=mmMapWords.begin(); it!=mmMapWords.end(); it++)
+        {
+            for(size_t i=0; i<it->second.size(); i++)
+                vWords[it->second[i]%NUM_SHARDS].push_back(it->second[i]);
+        }
+        mmMapWords.clear();
+    }
+
+    for(int s=0; s<NUM_SHARDS; s++)
+    {
+        if(vWords[s].empty())
+            continue;
+        unique_lock<KeyFrameDatabaseMutex> lock(mvShardMutex[s]);
+        for(size_t i=0; i<vWords[s].size(); i++)
+            vector<PostingList>().swap(mvInvertedFile[vWords[s][i]].mvPartitions);
+    }
+
+    {
+        unique_lock<mutex> lock(mMutexSessions);
+        mnGeneration++;
+    }
+
+    unique_lock<mutex> lock(mMutexGlobalIndex);
+    mmGlobalIndex.clear();
+}
+
+size_t KeyFrameDatabase::InvertedFileMemory()
+{
+    size_t nBytes = InvertedFileWords()>0 ? mvInvertedFile.capacity()*sizeof(WordPostings) : 0;
+    for(int s=0; s<NUM_SHARDS; s++)
+    {
+        unique_lock<KeyFrameDatabaseMutex> lock(mvShardMutex[s]);
+        for(size_t i=s, iend=InvertedFileWords(); i<iend; i+=NUM_SHARDS)
+        {
+            const vector<PostingList> &vPartitions = mvInvertedFile[i].mvPartitions;
+            nBytes += vPartitions.capacity()*sizeof(PostingList);
+            for(size_t p=0; p<vPartitions.size(); p++)
+                nBytes += vPartitions[p].mvEntries.capacity()*sizeof(InvertedFileEntry);
+        }
+    }
+
+    unique_lock<mutex> lock(mMutexGlobalIndex);
+    for(map<Map*,GlobalDescriptorIndex>::iterator it=mmGlobalIndex.begin(); it!=mmGlobalIndex.end(); it++)
+        nBytes += it->second.Memory();
+    return nBytes;
 }
 
 void KeyFrameDatabase::clearMap(Map* pMap)
 {
-    unique_lock<mutex> lock(mMutex);
+    // Only the words where the map has a partition are visited, the partition goes as a whole.
+    // Keyframes moved to the map by a merge are repartitioned before Loop Closing takes a reset
+    // request, so none of them is left in the partitions of other maps
+    vector<unsigned int> vWords[NUM_SHARDS];
+    GetMapWords(pMap, true, vWords);
 
-    // Erase elements in the Inverse File for the entry
-    for(std::vector<list<KeyFrame*> >::iterator vit=mvInvertedFile.begin(), vend=mvInvertedFile.end(); vit!=vend; vit++)
+    for(int s=0; s<NUM_SHARDS; s++)
     {
-        // List of keyframes that share the word
-        list<KeyFrame*> &lKFs =  *vit;
-
-        for(list<KeyFrame*>::iterator lit=lKFs.begin(), lend= lKFs.end(); lit!=lend;)
+        if(vWords[s].empty())
+            continue;
+        unique_lock<KeyFrameDatabaseMutex> lock(mvShardMutex[s]);
+        for(size_t i=0; i<vWords[s].size(); i++)
         {
-            KeyFrame* pKFi = *lit;
-            if(pMap == pKFi->GetMap())
+            vector<PostingList> &vPartitions = mvInvertedFile[vWords[s][i]].mvPartitions;
+            for(vector<PostingList>::iterator pit=vPartitions.begin(); pit!=vPartitions.end(); pit++)
             {
-                lit = lKFs.erase(lit);
-                // Dont delete the KF because the class Map clean all the KF when it is destroyed
+                if(pit->mpMap == pMap)
+                {
+                    vPartitions.erase(pit);
+                    break;
+                }
             }
-            else
+        }
+    }
+
+    {
+        // The keyframes of the map are destroyed with it
+        unique_lock<mutex> lock(mMutexSessions);
+        mnGeneration++;
+    }
+
+    unique_lock<mutex> lock(mMutexGlobalIndex);
+    mmGlobalIndex.erase(pMap);
+}
+
+void KeyFrameDatabase::RepartitionMap(Map* pMap)
+{
+    // The moved keyframes are in the partitions of the map
+    vector<unsigned int> vWords[NUM_SHARDS];
+    GetMapWords(pMap, false, vWords);
+
+    bool bMapLeft = false;
+    for(int s=0; s<NUM_SHARDS; s++)
+    {
+        if(vWords[s].empty())
+            continue;
+        unique_lock<KeyFrameDatabaseMutex> lock(mvShardMutex[s]);
+        for(size_t w=0; w<vWords[s].size(); w++)
+        {
+            const unsigned int i = vWords[s][w];
+            WordPostings &word = mvInvertedFile[i];
+
+            // Partition() may reallocate the partitions, so the moved entries are collected first
+            vector<InvertedFileEntry> vMoved;
+            for(size_t p=0, pend=word.mvPartitions.size(); p<pend; p++)
             {
-                ++lit;
+                PostingList &posting = word.mvPartitions[p];
+                if(posting.mpMap != pMap)
+                    continue;
+
+                for(vector<InvertedFileEntry>::iterator lit=posting.mvEntries.begin(), lend=posting.mvEntries.end(); lit!=lend; lit++)
+                {
+                    if(lit->pKF && lit->pKF->GetMap() != pMap)
+                    {
+                        vMoved.push_back(*lit);
+                        lit->pKF = static_cast<KeyFrame*>(NULL);
+                        posting.mnErased++;
+                    }
+                }
+                if(posting.mnErased > 0)
+                    posting.Compact();
+                if(posting.mvEntries.empty())
+                    word.mvPartitions.erase(word.mvPartitions.begin()+p);
+                else
+                    bMapLeft = true;
+                break;
             }
+
+            for(size_t j=0; j<vMoved.size(); j++)
+                MapPartition(i,vMoved[j].pKF->GetMap()).mvEntries.push_back(vMoved[j]);
         }
     }
+
+    // A map merged as a whole has no partition left
+    if(!bMapLeft)
+    {
+        unique_lock<mutex> lock(mMutexMapWords);
+        mmMapWords.erase(pMap);
+    }
+
+    unique_lock<mutex> lock(mMutexGlobalIndex);
+    map<Map*,GlobalDescriptorIndex>::iterator itIndex = mmGlobalIndex.find(pMap);
+    if(itIndex == mmGlobalIndex.end())
+        return;
+
+    vector<KeyFrame*> vpKFs;
+    itIndex->second.GetKeyFrames(vpKFs);
+    vector<float> vDesc;
+    for(size_t i=0; i<vpKFs.size(); i++)
+    {
+        Map* pMapi = vpKFs[i]->GetMap();
+        if(pMapi == pMap)
+            continue;
+        itIndex->second.Remove(vpKFs[i]);
+        GlobalDescriptorIndex::ComputeDescriptor(vpKFs[i]->mBowVec,mnGlobalDim,vDesc);
+        GlobalIndex(pMapi).Add(vpKFs[i],vDesc);
+    }
+    if(itIndex->second.Size() == 0)
+        mmGlobalIndex.erase(itIndex);
 }
 
 vector<KeyFrame*> KeyFrameDatabase::DetectLoopCandidates(KeyFrame* pKF, float minScore)
 {
+    EnsureInvertedFile();
     set<KeyFrame*> spConnectedKeyFrames = pKF->GetConnectedKeyFrames();
-    list<KeyFrame*> lKFsSharingWords;
+    vector<KeyFrame*> vpKFsSharingWords;
 
     // Search all keyframes that share a word with current keyframes
     // Discard keyframes connected to the query keyframe
     {
-        unique_lock<mutex> lock(mMutex);
-
         for(DBoW2::BowVector::const_iterator vit=pKF->mBowVec.begin(), vend=pKF->mBowVec.end(); vit != vend; vit++)
         {
-            list<KeyFrame*> &lKFs =   mvInvertedFile[vit->first];
-
-            for(list<KeyFrame*>::iterator lit=lKFs.begin(), lend= lKFs.end(); lit!=lend; lit++)
+            unique_lock<KeyFrameDatabaseMutex> lock(WordMutex(vit->first));
+            ForEachEntry(vit->first, ONLY_MAP, pKF->GetMap(), [&](const InvertedFileEntry &entry)
             {
-                KeyFrame* pKFi=*lit;
+                KeyFrame* pKFi=entry.pKF;
+                if(!pKFi)
+                    return;
                 if(pKFi->GetMap()==pKF->GetMap()) // For consider a loop candidate it a candidate it must be in the same map
                 {
                     if(pKFi->mnLoopQuery!=pKF->mnId)
                     {
                         pKFi->mnLoopWords=0;
+                        pKFi->mLoopScore=0;
                         if(!spConnectedKeyFrames.count(pKFi))
                         {
                             pKFi->mnLoopQuery=pKF->mnId;
-                            lKFsSharingWords.push_back(pKFi);
+                            vpKFsSharingWords.push_back(pKFi);
                         }
                     }
                     pKFi->mnLoopWords++;
+                    pKFi->mLoopScore+=min<float>(vit->second,entry.weight);
                 }
 
 
-            }
+            });
         }
     }
 
-    if(lKFsSharingWords.empty())
+    if(vpKFsSharingWords.empty())
         return vector<KeyFrame*>();
 
     list<pair<float,KeyFrame*> > lScoreAndMatch;
 
     // Only compare against those keyframes that share enough words
     int maxCommonWords=0;
-    for(list<KeyFrame*>::iterator lit=lKFsSharingWords.begin(), lend= lKFsSharingWords.end(); lit!=lend; lit++)
+    for(vector<KeyFrame*>::iterator lit=vpKFsSharingWords.begin(), lend=vpKFsSharingWords.end(); lit!=lend; lit++)
     {
         if((*lit)->mnLoopWords>maxCommonWords)
             maxCommonWords=(*lit)->mnLoopWords;
@@ -148,23 +460,26 @@ vector<KeyFrame*> KeyFrameDatabase::DetectLoopCandidates(KeyFrame* pKF, float mi
 
     int minCommonWords = maxCommonWords*0.8f;
 
-    int nscores=0;
-
-    // Compute similarity score. Retain the matches whose score is higher than minScore
-    for(list<KeyFrame*>::iterator lit=lKFsSharingWords.begin(), lend= lKFsSharingWords.end(); lit!=lend; lit++)
+    vector<KeyFrame*> vpKFsToScore;
+    vpKFsToScore.reserve(vpKFsSharingWords.size());
+    for(vector<KeyFrame*>::iterator lit=vpKFsSharingWords.begin(), lend=vpKFsSharingWords.end(); lit!=lend; lit++)
     {
-        KeyFrame* pKFi = *lit;
+        if((*lit)->mnLoopWords>minCommonWords)
+            vpKFsToScore.push_back(*lit);
+    }
 
-        if(pKFi->mnLoopWords>minCommonWords)
-        {
-            nscores++;
+    // Compute similarity score. Retain the matches whose score is higher than minScore
+    vector<float> vScores;
+    ComputeScores(pKF->mBowVec,vpKFsToScore,&KeyFrame::mLoopScore,vScores);
 
-            float si = mpVoc->score(pKF->mBowVec,pKFi->mBowVec);
+    for(size_t i=0, iend=vpKFsToScore.size(); i<iend; i++)
+    {
+        KeyFrame* pKFi = vpKFsToScore[i];
+        const float si = vScores[i];
 
-            pKFi->mLoopScore = si;
-            if(si>=minScore)
-                lScoreAndMatch.push_back(make_pair(si,pKFi));
-        }
+        pKFi->mLoopScore = si;
+        if(si>=minScore)
+            lScoreAndMatch.push_back(make_pair(si,pKFi));
     }
 
     if(lScoreAndMatch.empty())
@@ -227,61 +542,65 @@ vector<KeyFrame*> KeyFrameDatabase::DetectLoopCandidates(KeyFrame* pKF, float mi
 
 void KeyFrameDatabase::DetectCandidates(KeyFrame* pKF, float minScore,vector<KeyFrame*>& vpLoopCand, vector<KeyFrame*>& vpMergeCand)
 {
+    EnsureInvertedFile();
     set<KeyFrame*> spConnectedKeyFrames = pKF->GetConnectedKeyFrames();
-    list<KeyFrame*> lKFsSharingWordsLoop,lKFsSharingWordsMerge;
+    vector<KeyFrame*> vpKFsSharingWordsLoop, vpKFsSharingWordsMerge;
 
     // Search all keyframes that share a word with current keyframes
     // Discard keyframes connected to the query keyframe
     {
-        unique_lock<mutex> lock(mMutex);
-
         for(DBoW2::BowVector::const_iterator vit=pKF->mBowVec.begin(), vend=pKF->mBowVec.end(); vit != vend; vit++)
         {
-            list<KeyFrame*> &lKFs = mvInvertedFile[vit->first];
-
-            for(list<KeyFrame*>::iterator lit=lKFs.begin(), lend= lKFs.end(); lit!=lend; lit++)
+            unique_lock<KeyFrameDatabaseMutex> lock(WordMutex(vit->first));
+            ForEachEntry(vit->first, ALL_MAPS, static_cast<Map*>(NULL), [&](const InvertedFileEntry &entry)
             {
-                KeyFrame* pKFi=*lit;
+                KeyFrame* pKFi=entry.pKF;
+                if(!pKFi)
+                    return;
                 if(pKFi->GetMap()==pKF->GetMap()) // For consider a loop candidate it a candidate it must be in the same map
                 {
                     if(pKFi->mnLoopQuery!=pKF->mnId)
                     {
                         pKFi->mnLoopWords=0;
+                        pKFi->mLoopScore=0;
                         if(!spConnectedKeyFrames.count(pKFi))
                         {
                             pKFi->mnLoopQuery=pKF->mnId;
-                            lKFsSharingWordsLoop.push_back(pKFi);
+                            vpKFsSharingWordsLoop.push_back(pKFi);
                         }
                     }
                     pKFi->mnLoopWords++;
+                    pKFi->mLoopScore+=min<float>(vit->second,entry.weight);
                 }
                 else if(!pKFi->GetMap()->IsBad())
                 {
                     if(pKFi->mnMergeQuery!=pKF->mnId)
                     {
                         pKFi->mnMergeWords=0;
+                        pKFi->mMergeScore=0;
                         if(!spConnectedKeyFrames.count(pKFi))
                         {
                             pKFi->mnMergeQuery=pKF->mnId;
-                            lKFsSharingWordsMerge.push_back(pKFi);
+                            vpKFsSharingWordsMerge.push_back(pKFi);
                         }
                     }
                     pKFi->mnMergeWords++;
+                    pKFi->mMergeScore+=min<float>(vit->second,entry.weight);
                 }
-            }
+            });
         }
     }
 
-    if(lKFsSharingWordsLoop.empty() && lKFsSharingWordsMerge.empty())
+    if(vpKFsSharingWordsLoop.empty() && vpKFsSharingWordsMerge.empty())
         return;
 
-    if(!lKFsSharingWordsLoop.empty())
+    if(!vpKFsSharingWordsLoop.empty())
     {
         list<pair<float,KeyFrame*> > lScoreAndMatch;
 
         // Only compare against those keyframes that share enough words
         int maxCommonWords=0;
-        for(list<KeyFrame*>::iterator lit=lKFsSharingWordsLoop.begin(), lend= lKFsSharingWordsLoop.end(); lit!=lend; lit++)
+        for(vector<KeyFrame*>::iterator lit=vpKFsSharingWordsLoop.begin(), lend=vpKFsSharingWordsLoop.end(); lit!=lend; lit++)
         {
             if((*lit)->mnLoopWords>maxCommonWords)
                 maxCommonWords=(*lit)->mnLoopWords;
@@ -289,23 +608,26 @@ void KeyFrameDatabase::DetectCandidates(KeyFrame* pKF, float minScore,vector<Key
 
         int minCommonWords = maxCommonWords*0.8f;
 
-        int nscores=0;
-
-        // Compute similarity score. Retain the matches whose score is higher than minScore
-        for(list<KeyFrame*>::iterator lit=lKFsSharingWordsLoop.begin(), lend= lKFsSharingWordsLoop.end(); lit!=lend; lit++)
+        vector<KeyFrame*> vpKFsToScore;
+        vpKFsToScore.reserve(vpKFsSharingWordsLoop.size());
+        for(vector<KeyFrame*>::iterator lit=vpKFsSharingWordsLoop.begin(), lend=vpKFsSharingWordsLoop.end(); lit!=lend; lit++)
         {
-            KeyFrame* pKFi = *lit;
+            if((*lit)->mnLoopWords>minCommonWords)
+                vpKFsToScore.push_back(*lit);
+        }
 
-            if(pKFi->mnLoopWords>minCommonWords)
-            {
-                nscores++;
+        // Compute similarity score. Retain the matches whose score is higher than minScore
+        vector<float> vScores;
+        ComputeScores(pKF->mBowVec,vpKFsToScore,&KeyFrame::mLoopScore,vScores);
 
-                float si = mpVoc->score(pKF->mBowVec,pKFi->mBowVec);
+        for(size_t i=0, iend=vpKFsToScore.size(); i<iend; i++)
+        {
+            KeyFrame* pKFi = vpKFsToScore[i];
+            const float si = vScores[i];
 
-                pKFi->mLoopScore = si;
-                if(si>=minScore)
-                    lScoreAndMatch.push_back(make_pair(si,pKFi));
-            }
+            pKFi->mLoopScore = si;
+            if(si>=minScore)
+                lScoreAndMatch.push_back(make_pair(si,pKFi));
         }
 
         if(!lScoreAndMatch.empty())
@@ -363,13 +685,13 @@ void KeyFrameDatabase::DetectCandidates(KeyFrame* pKF, float minScore,vector<Key
 
     }
 
-    if(!lKFsSharingWordsMerge.empty())
+    if(!vpKFsSharingWordsMerge.empty())
     {
         list<pair<float,KeyFrame*> > lScoreAndMatch;
 
         // Only compare against those keyframes that share enough words
         int maxCommonWords=0;
-        for(list<KeyFrame*>::iterator lit=lKFsSharingWordsMerge.begin(), lend=lKFsSharingWordsMerge.end(); lit!=lend; lit++)
+        for(vector<KeyFrame*>::iterator lit=vpKFsSharingWordsMerge.begin(), lend=vpKFsSharingWordsMerge.end(); lit!=lend; lit++)
         {
             if((*lit)->mnMergeWords>maxCommonWords)
                 maxCommonWords=(*lit)->mnMergeWords;
@@ -377,23 +699,26 @@ void KeyFrameDatabase::DetectCandidates(KeyFrame* pKF, float minScore,vector<Key
 
         int minCommonWords = maxCommonWords*0.8f;
 
-        int nscores=0;
-
-        // Compute similarity score. Retain the matches whose score is higher than minScore
-        for(list<KeyFrame*>::iterator lit=lKFsSharingWordsMerge.begin(), lend=lKFsSharingWordsMerge.end(); lit!=lend; lit++)
+        vector<KeyFrame*> vpKFsToScore;
+        vpKFsToScore.reserve(vpKFsSharingWordsMerge.size());
+        for(vector<KeyFrame*>::iterator lit=vpKFsSharingWordsMerge.begin(), lend=vpKFsSharingWordsMerge.end(); lit!=lend; lit++)
         {
-            KeyFrame* pKFi = *lit;
+            if((*lit)->mnMergeWords>minCommonWords)
+                vpKFsToScore.push_back(*lit);
+        }
 
-            if(pKFi->mnMergeWords>minCommonWords)
-            {
-                nscores++;
+        // Compute similarity score. Retain the matches whose score is higher than minScore
+        vector<float> vScores;
+        ComputeScores(pKF->mBowVec,vpKFsToScore,&KeyFrame::mMergeScore,vScores);
 
-                float si = mpVoc->score(pKF->mBowVec,pKFi->mBowVec);
+        for(size_t i=0, iend=vpKFsToScore.size(); i<iend; i++)
+        {
+            KeyFrame* pKFi = vpKFsToScore[i];
+            const float si = vScores[i];
 
-                pKFi->mMergeScore = si;
-                if(si>=minScore)
-                    lScoreAndMatch.push_back(make_pair(si,pKFi));
-            }
+            pKFi->mMergeScore = si;
+            if(si>=minScore)
+                lScoreAndMatch.push_back(make_pair(si,pKFi));
         }
 
         if(!lScoreAndMatch.empty())
@@ -453,57 +778,60 @@ void KeyFrameDatabase::DetectCandidates(KeyFrame* pKF, float minScore,vector<Key
 
     for(DBoW2::BowVector::const_iterator vit=pKF->mBowVec.begin(), vend=pKF->mBowVec.end(); vit != vend; vit++)
     {
-        list<KeyFrame*> &lKFs = mvInvertedFile[vit->first];
-
-        for(list<KeyFrame*>::iterator lit=lKFs.begin(), lend= lKFs.end(); lit!=lend; lit++)
+        unique_lock<KeyFrameDatabaseMutex> lock(WordMutex(vit->first));
+        ForEachEntry(vit->first, ALL_MAPS, static_cast<Map*>(NULL), [&](const InvertedFileEntry &entry)
         {
-            KeyFrame* pKFi=*lit;
+            KeyFrame* pKFi=entry.pKF;
+            if(!pKFi)
+                return;
             pKFi->mnLoopQuery=-1;
             pKFi->mnMergeQuery=-1;
-        }
+        });
     }
 
 }
 
 void KeyFrameDatabase::DetectBestCandidates(KeyFrame *pKF, vector<KeyFrame*> &vpLoopCand, vector<KeyFrame*> &vpMergeCand, int nMinWords)
 {
-    list<KeyFrame*> lKFsSharingWords;
+    EnsureInvertedFile();
+    vector<KeyFrame*> vpKFsSharingWords;
     set<KeyFrame*> spConnectedKF;
 
     // Search all keyframes that share a word with current frame
     {
-        unique_lock<mutex> lock(mMutex);
-
         spConnectedKF = pKF->GetConnectedKeyFrames();
 
         for(DBoW2::BowVector::const_iterator vit=pKF->mBowVec.begin(), vend=pKF->mBowVec.end(); vit != vend; vit++)
         {
-            list<KeyFrame*> &lKFs =   mvInvertedFile[vit->first];
-
-            for(list<KeyFrame*>::iterator lit=lKFs.begin(), lend= lKFs.end(); lit!=lend; lit++)
+            unique_lock<KeyFrameDatabaseMutex> lock(WordMutex(vit->first));
+            ForEachEntry(vit->first, ALL_MAPS, static_cast<Map*>(NULL), [&](const InvertedFileEntry &entry)
             {
-                KeyFrame* pKFi=*lit;
+                KeyFrame* pKFi=entry.pKF;
+                if(!pKFi)
+                    return;
                 if(spConnectedKF.find(pKFi) != spConnectedKF.end())
                 {
-                    continue;
+                    return;
                 }
                 if(pKFi->mnPlaceRecognitionQuery!=pKF->mnId)
                 {
                     pKFi->mnPlaceRecognitionWords=0;
+                    pKFi->mPlaceRecognitionScore=0;
                     pKFi->mnPlaceRecognitionQuery=pKF->mnId;
-                    lKFsSharingWords.push_back(pKFi);
+                    vpKFsSharingWords.push_back(pKFi);
                 }
                pKFi->mnPlaceRecognitionWords++;
+               pKFi->mPlaceRecognitionScore+=min<float>(vit->second,entry.weight);
 
-            }
+            });
         }
     }
-    if(lKFsSharingWords.empty())
+    if(vpKFsSharingWords.empty())
         return;
 
     // Only compare against those keyframes that share enough words
     int maxCommonWords=0;
-    for(list<KeyFrame*>::iterator lit=lKFsSharingWords.begin(), lend= lKFsSharingWords.end(); lit!=lend; lit++)
+    for(vector<KeyFrame*>::iterator lit=vpKFsSharingWords.begin(), lend=vpKFsSharingWords.end(); lit!=lend; lit++)
     {
         if((*lit)->mnPlaceRecognitionWords>maxCommonWords)
             maxCommonWords=(*lit)->mnPlaceRecognitionWords;
@@ -518,20 +846,25 @@ void KeyFrameDatabase::DetectBestCandidates(KeyFrame *pKF, vector<KeyFrame*> &vp
 
     list<pair<float,KeyFrame*> > lScoreAndMatch;
 
-    int nscores=0;
+    vector<KeyFrame*> vpKFsToScore;
+    vpKFsToScore.reserve(vpKFsSharingWords.size());
+    for(vector<KeyFrame*>::iterator lit=vpKFsSharingWords.begin(), lend=vpKFsSharingWords.end(); lit!=lend; lit++)
+    {
+        if((*lit)->mnPlaceRecognitionWords>minCommonWords)
+            vpKFsToScore.push_back(*lit);
+    }
+
+    // Compute similarity score (in parallel if there are many candidates)
+    vector<float> vScores;
+    ComputeScores(pKF->mBowVec,vpKFsToScore,&KeyFrame::mPlaceRecognitionScore,vScores);
 
-    // Compute similarity score.
-    for(list<KeyFrame*>::iterator lit=lKFsSharingWords.begin(), lend= lKFsSharingWords.end(); lit!=lend; lit++)
+    for(size_t i=0, iend=vpKFsToScore.size(); i<iend; i++)
     {
-        KeyFrame* pKFi = *lit;
+        KeyFrame* pKFi = vpKFsToScore[i];
+        const float si = vScores[i];
 
-        if(pKFi->mnPlaceRecognitionWords>minCommonWords)
-        {
-            nscores++;
-            float si = mpVoc->score(pKF->mBowVec,pKFi->mBowVec);
-            pKFi->mPlaceRecognitionScore=si;
-            lScoreAndMatch.push_back(make_pair(si,pKFi));
-        }
+        pKFi->mPlaceRecognitionScore = si;
+        lScoreAndMatch.push_back(make_pair(si,pKFi));
     }
 
     if(lScoreAndMatch.empty())
@@ -601,45 +934,101 @@ bool compFirst(const pair<float, KeyFrame*> & a, const pair<float, KeyFrame*> &
 }
 
 
-void KeyFrameDatabase::DetectNBestCandidates(KeyFrame *pKF, vector<KeyFrame*> &vpLoopCand, vector<KeyFrame*> &vpMergeCand, int nNumCandidates)
+void KeyFrameDatabase::DetectNBestCandidates(KeyFrame *pKF, vector<KeyFrame*> &vpLoopCand, vector<KeyFrame*> &vpMergeCand, int nNumCandidates,
+                                             const eMapScope scope, QuerySession* pSession)
 {
-    list<KeyFrame*> lKFsSharingWords;
+    EnsureInvertedFile();
+    vector<KeyFrame*> vpKFsSharingWords;
     set<KeyFrame*> spConnectedKF;
+    // Scores of the candidates computed when needed (negative until then)
+    bool bLazyScores = false;
 
-    // Search all keyframes that share a word with current frame
+    vector<KeyFrame*> vpShortlist;
+    if(GlobalShortlist(pKF->mBowVec, scope, pKF->GetMap(), vpShortlist))
+    {
+        // Same words and scores as from the inverted file, for the shortlisted keyframes only
+        spConnectedKF = pKF->GetConnectedKeyFrames();
+        for(size_t i=0; i<vpShortlist.size(); i++)
+        {
+            KeyFrame* pKFi = vpShortlist[i];
+            if(pKFi==pKF || spConnectedKF.count(pKFi))
+                continue;
+            int nCommonWords;
+            float score;
+            CompareBow(pKF->mFlatBowVec, pKFi->mFlatBowVec, nCommonWords, score);
+            if(nCommonWords==0)
+                continue;
+            pKFi->mnPlaceRecognitionQuery=pKF->mnId;
+            pKFi->mnPlaceRecognitionWords=nCommonWords;
+            pKFi->mPlaceRecognitionScore=score;
+            vpKFsSharingWords.push_back(pKFi);
+        }
+    }
+    // Keyframes sharing words with the current one, from the common words kept by the session
+    else if(pSession)
     {
-        unique_lock<mutex> lock(mMutex);
+        spConnectedKF = pKF->GetConnectedKeyFrames();
+        UpdateSession(*pSession, pKF->mFlatBowVec);
 
+        const Map* pMap = pKF->GetMap();
+        unordered_map<long unsigned int, QuerySession::CommonWords> &mCommon = pSession->mmCommonWords;
+        for(unordered_map<long unsigned int, QuerySession::CommonWords>::iterator it=mCommon.begin(); it!=mCommon.end(); )
+        {
+            KeyFrame* pKFi = it->second.pKF;
+            if(pKFi->isBad())
+            {
+                it = mCommon.erase(it);
+                continue;
+            }
+            const bool bSameMap = pKFi->GetMap()==pMap;
+            if(pKFi!=pKF && !spConnectedKF.count(pKFi) &&
+               !(scope==ONLY_MAP && !bSameMap) && !(scope==OTHER_MAPS && bSameMap))
+            {
+                pKFi->mnPlaceRecognitionQuery=pKF->mnId;
+                pKFi->mnPlaceRecognitionWords=it->second.nWords;
+                pKFi->mPlaceRecognitionScore=-1.f;
+                vpKFsSharingWords.push_back(pKFi);
+            }
+            it++;
+        }
+        bLazyScores = true;
+    }
+    // Search all keyframes that share a word with current frame
+    else
+    {
         spConnectedKF = pKF->GetConnectedKeyFrames();
 
         for(DBoW2::BowVector::const_iterator vit=pKF->mBowVec.begin(), vend=pKF->mBowVec.end(); vit != vend; vit++)
         {
-            list<KeyFrame*> &lKFs =   mvInvertedFile[vit->first];
-
-            for(list<KeyFrame*>::iterator lit=lKFs.begin(), lend= lKFs.end(); lit!=lend; lit++)
+            unique_lock<KeyFrameDatabaseMutex> lock(WordMutex(vit->first));
+            ForEachEntry(vit->first, scope, pKF->GetMap(), [&](const InvertedFileEntry &entry)
             {
-                KeyFrame* pKFi=*lit;
+                KeyFrame* pKFi=entry.pKF;
+                if(!pKFi)
+                    return;
                 if(pKFi->mnPlaceRecognitionQuery!=pKF->mnId)
                 {
                     pKFi->mnPlaceRecognitionWords=0;
+                    pKFi->mPlaceRecognitionScore=0;
                     if(!spConnectedKF.count(pKFi))
                     {
 
                         pKFi->mnPlaceRecognitionQuery=pKF->mnId;
-                        lKFsSharingWords.push_back(pKFi);
+                        vpKFsSharingWords.push_back(pKFi);
                     }
                 }
                 pKFi->mnPlaceRecognitionWords++;
+                pKFi->mPlaceRecognitionScore+=min<float>(vit->second,entry.weight);
 
-            }
+            });
         }
     }
-    if(lKFsSharingWords.empty())
+    if(vpKFsSharingWords.empty())
         return;
 
     // Only compare against those keyframes that share enough words
     int maxCommonWords=0;
-    for(list<KeyFrame*>::iterator lit=lKFsSharingWords.begin(), lend= lKFsSharingWords.end(); lit!=lend; lit++)
+    for(vector<KeyFrame*>::iterator lit=vpKFsSharingWords.begin(), lend=vpKFsSharingWords.end(); lit!=lend; lit++)
     {
         if((*lit)->mnPlaceRecognitionWords>maxCommonWords)
             maxCommonWords=(*lit)->mnPlaceRecognitionWords;
@@ -649,20 +1038,33 @@ void KeyFrameDatabase::DetectNBestCandidates(KeyFrame *pKF, vector<KeyFrame*> &v
 
     list<pair<float,KeyFrame*> > lScoreAndMatch;
 
-    int nscores=0;
+    vector<KeyFrame*> vpKFsToScore;
+    vpKFsToScore.reserve(vpKFsSharingWords.size());
+    for(vector<KeyFrame*>::iterator lit=vpKFsSharingWords.begin(), lend=vpKFsSharingWords.end(); lit!=lend; lit++)
+    {
+        if((*lit)->mnPlaceRecognitionWords>minCommonWords)
+            vpKFsToScore.push_back(*lit);
+    }
 
-    // Compute similarity score.
-    for(list<KeyFrame*>::iterator lit=lKFsSharingWords.begin(), lend= lKFsSharingWords.end(); lit!=lend; lit++)
+    // The L1 score that would have been accumulated from the posting lists
+    int nCommonWords;
+    if(bLazyScores)
     {
-        KeyFrame* pKFi = *lit;
+        for(size_t i=0; i<vpKFsToScore.size(); i++)
+            CompareBow(pKF->mFlatBowVec, vpKFsToScore[i]->mFlatBowVec, nCommonWords, vpKFsToScore[i]->mPlaceRecognitionScore);
+    }
 
-        if(pKFi->mnPlaceRecognitionWords>minCommonWords)
-        {
-            nscores++;
-            float si = mpVoc->score(pKF->mBowVec,pKFi->mBowVec);
-            pKFi->mPlaceRecognitionScore=si;
-            lScoreAndMatch.push_back(make_pair(si,pKFi));
-        }
+    // Compute similarity score (in parallel if there are many candidates)
+    vector<float> vScores;
+    ComputeScores(pKF->mBowVec,vpKFsToScore,&KeyFrame::mPlaceRecognitionScore,vScores);
+
+    for(size_t i=0, iend=vpKFsToScore.size(); i<iend; i++)
+    {
+        KeyFrame* pKFi = vpKFsToScore[i];
+        const float si = vScores[i];
+
+        pKFi->mPlaceRecognitionScore = si;
+        lScoreAndMatch.push_back(make_pair(si,pKFi));
     }
 
     if(lScoreAndMatch.empty())
@@ -686,6 +1088,9 @@ void KeyFrameDatabase::DetectNBestCandidates(KeyFrame *pKF, vector<KeyFrame*> &v
             if(pKF2->mnPlaceRecognitionQuery!=pKF->mnId)
                 continue;
 
+            if(pKF2->mPlaceRecognitionScore<0)
+                CompareBow(pKF->mFlatBowVec, pKF2->mFlatBowVec, nCommonWords, pKF2->mPlaceRecognitionScore);
+
             accScore+=pKF2->mPlaceRecognitionScore;
             if(pKF2->mPlaceRecognitionScore>bestScore)
             {
@@ -710,7 +1115,11 @@ void KeyFrameDatabase::DetectNBestCandidates(KeyFrame *pKF, vector<KeyFrame*> &v
     {
         KeyFrame* pKFi = it->second;
         if(pKFi->isBad())
+        {
+            i++;
+            it++;
             continue;
+        }
 
         if(!spAlreadyAddedKF.count(pKFi))
         {
@@ -730,37 +1139,170 @@ void KeyFrameDatabase::DetectNBestCandidates(KeyFrame *pKF, vector<KeyFrame*> &v
 }
 
 
-vector<KeyFrame*> KeyFrameDatabase::DetectRelocalizationCandidates(Frame *F, Map* pMap)
+void KeyFrameDatabase::UpdateSession(QuerySession &session, const FlatBowVector &vBowVec)
 {
-    list<KeyFrame*> lKFsSharingWords;
+    const size_t nWords = vBowVec.Size();
 
-    // Search all keyframes that share a word with current frame
+    // Words that entered and left the query since the last one of the session
+    vector<unsigned int> vEntered, vLeft;
+    if(session.mbValid)
     {
-        unique_lock<mutex> lock(mMutex);
+        vector<unsigned int>::const_iterator it1 = session.mvWords.begin();
+        size_t i2 = 0;
+        while(it1!=session.mvWords.end() || i2<nWords)
+        {
+            if(i2==nWords || (it1!=session.mvWords.end() && *it1<vBowVec.WordId(i2)))
+                vLeft.push_back(*it1++);
+            else if(it1==session.mvWords.end() || vBowVec.WordId(i2)<*it1)
+                vEntered.push_back(vBowVec.WordId(i2++));
+            else
+            {
+                it1++;
+                i2++;
+            }
+        }
+    }
 
-        for(DBoW2::BowVector::const_iterator vit=F->mBowVec.begin(), vend=F->mBowVec.end(); vit != vend; vit++)
+    // Keyframes added since, their common words are counted from their bags of words
+    vector<KeyFrame*> vpAdded;
+    bool bRebuild = !session.mbValid || vEntered.size()+vLeft.size() >= nWords;
+    {
+        unique_lock<mutex> lock(mMutexSessions);
+        const unsigned long nNewAdded = mnAddedSeq - session.mnAddedSeq;
+        if(session.mnGeneration!=mnGeneration || nNewAdded>mdpAddedLog.size())
+            bRebuild = true;
+        else if(!bRebuild)
+            vpAdded.assign(mdpAddedLog.end()-nNewAdded, mdpAddedLog.end());
+        session.mnGeneration = mnGeneration;
+        session.mnAddedSeq = mnAddedSeq;
+    }
+
+    unordered_map<long unsigned int, QuerySession::CommonWords> &mCommon = session.mmCommonWords;
+    if(bRebuild)
+    {
+        mCommon.clear();
+        for(size_t i=0; i<nWords; i++)
         {
-            list<KeyFrame*> &lKFs =   mvInvertedFile[vit->first];
+            unique_lock<KeyFrameDatabaseMutex> lock(WordMutex(vBowVec.WordId(i)));
+            ForEachEntry(vBowVec.WordId(i), ALL_MAPS, static_cast<Map*>(NULL), [&](const InvertedFileEntry &entry)
+            {
+                if(!entry.pKF)
+                    return;
+                QuerySession::CommonWords &common = mCommon[entry.nKFId];
+                if(common.nWords==0)
+                    common.pKF = entry.pKF;
+                common.nWords++;
+            });
+        }
+    }
+    else
+    {
+        set<long unsigned int> sAddedIds;
+        for(size_t i=0; i<vpAdded.size(); i++)
+            sAddedIds.insert(vpAdded[i]->mnId);
 
-            for(list<KeyFrame*>::iterator lit=lKFs.begin(), lend= lKFs.end(); lit!=lend; lit++)
+        for(size_t i=0; i<vLeft.size(); i++)
+        {
+            unique_lock<KeyFrameDatabaseMutex> lock(WordMutex(vLeft[i]));
+            ForEachEntry(vLeft[i], ALL_MAPS, static_cast<Map*>(NULL), [&](const InvertedFileEntry &entry)
             {
-                KeyFrame* pKFi=*lit;
+                if(!entry.pKF || sAddedIds.count(entry.nKFId))
+                    return;
+                unordered_map<long unsigned int, QuerySession::CommonWords>::iterator it = mCommon.find(entry.nKFId);
+                if(it!=mCommon.end() && --it->second.nWords<=0)
+                    mCommon.erase(it);
+            });
+        }
+
+        for(size_t i=0; i<vEntered.size(); i++)
+        {
+            unique_lock<KeyFrameDatabaseMutex> lock(WordMutex(vEntered[i]));
+            ForEachEntry(vEntered[i], ALL_MAPS, static_cast<Map*>(NULL), [&](const InvertedFileEntry &entry)
+            {
+                if(!entry.pKF || sAddedIds.count(entry.nKFId))
+                    return;
+                QuerySession::CommonWords &common = mCommon[entry.nKFId];
+                if(common.nWords==0)
+                    common.pKF = entry.pKF;
+                common.nWords++;
+            });
+        }
+
+        // Also replaces the count of the keyframes that were added again
+        for(size_t i=0; i<vpAdded.size(); i++)
+        {
+            int nCommonWords;
+            float score;
+            CompareBow(vBowVec, vpAdded[i]->mFlatBowVec, nCommonWords, score);
+            if(nCommonWords>0)
+            {
+                QuerySession::CommonWords &common = mCommon[vpAdded[i]->mnId];
+                common.pKF = vpAdded[i];
+                common.nWords = nCommonWords;
+            }
+            else
+                mCommon.erase(vpAdded[i]->mnId);
+        }
+    }
+
+    session.mvWords.clear();
+    session.mvWords.reserve(nWords);
+    for(size_t i=0; i<nWords; i++)
+        session.mvWords.push_back(vBowVec.WordId(i));
+    session.mbValid = true;
+}
+
+vector<KeyFrame*> KeyFrameDatabase::DetectRelocalizationCandidates(Frame *F, Map* pMap, const eMapScope scope)
+{
+    EnsureInvertedFile();
+    vector<KeyFrame*> vpKFsSharingWords;
+
+    vector<KeyFrame*> vpShortlist;
+    if(GlobalShortlist(F->mBowVec, scope, pMap, vpShortlist))
+    {
+        for(size_t i=0; i<vpShortlist.size(); i++)
+        {
+            KeyFrame* pKFi = vpShortlist[i];
+            int nCommonWords;
+            float score;
+            CompareBow(F->mFlatBowVec, pKFi->mFlatBowVec, nCommonWords, score);
+            if(nCommonWords==0)
+                continue;
+            pKFi->mnRelocQuery=F->mnId;
+            pKFi->mnRelocWords=nCommonWords;
+            pKFi->mRelocScore=score;
+            vpKFsSharingWords.push_back(pKFi);
+        }
+    }
+    // Search all keyframes that share a word with current frame
+    else
+    {
+        for(DBoW2::BowVector::const_iterator vit=F->mBowVec.begin(), vend=F->mBowVec.end(); vit != vend; vit++)
+        {
+            unique_lock<KeyFrameDatabaseMutex> lock(WordMutex(vit->first));
+            ForEachEntry(vit->first, scope, pMap, [&](const InvertedFileEntry &entry)
+            {
+                KeyFrame* pKFi=entry.pKF;
+                if(!pKFi)
+                    return;
                 if(pKFi->mnRelocQuery!=F->mnId)
                 {
                     pKFi->mnRelocWords=0;
+                    pKFi->mRelocScore=0;
                     pKFi->mnRelocQuery=F->mnId;
-                    lKFsSharingWords.push_back(pKFi);
+                    vpKFsSharingWords.push_back(pKFi);
                 }
                 pKFi->mnRelocWords++;
-            }
+                pKFi->mRelocScore+=min<float>(vit->second,entry.weight);
+            });
         }
     }
-    if(lKFsSharingWords.empty())
+    if(vpKFsSharingWords.empty())
         return vector<KeyFrame*>();
 
     // Only compare against those keyframes that share enough words
     int maxCommonWords=0;
-    for(list<KeyFrame*>::iterator lit=lKFsSharingWords.begin(), lend= lKFsSharingWords.end(); lit!=lend; lit++)
+    for(vector<KeyFrame*>::iterator lit=vpKFsSharingWords.begin(), lend=vpKFsSharingWords.end(); lit!=lend; lit++)
     {
         if((*lit)->mnRelocWords>maxCommonWords)
             maxCommonWords=(*lit)->mnRelocWords;
@@ -770,20 +1312,25 @@ vector<KeyFrame*> KeyFrameDatabase::DetectRelocalizationCandidates(Frame *F, Map
 
     list<pair<float,KeyFrame*> > lScoreAndMatch;
 
-    int nscores=0;
+    vector<KeyFrame*> vpKFsToScore;
+    vpKFsToScore.reserve(vpKFsSharingWords.size());
+    for(vector<KeyFrame*>::iterator lit=vpKFsSharingWords.begin(), lend=vpKFsSharingWords.end(); lit!=lend; lit++)
+    {
+        if((*lit)->mnRelocWords>minCommonWords)
+            vpKFsToScore.push_back(*lit);
+    }
 
-    // Compute similarity score.
-    for(list<KeyFrame*>::iterator lit=lKFsSharingWords.begin(), lend= lKFsSharingWords.end(); lit!=lend; lit++)
+    // Compute similarity score (in parallel if there are many candidates)
+    vector<float> vScores;
+    ComputeScores(F->mBowVec,vpKFsToScore,&KeyFrame::mRelocScore,vScores);
+
+    for(size_t i=0, iend=vpKFsToScore.size(); i<iend; i++)
     {
-        KeyFrame* pKFi = *lit;
+        KeyFrame* pKFi = vpKFsToScore[i];
+        const float si = vScores[i];
 
-        if(pKFi->mnRelocWords>minCommonWords)
-        {
-            nscores++;
-            float si = mpVoc->score(F->mBowVec,pKFi->mBowVec);
-            pKFi->mRelocScore=si;
-            lScoreAndMatch.push_back(make_pair(si,pKFi));
-        }
+        pKFi->mRelocScore = si;
+        lScoreAndMatch.push_back(make_pair(si,pKFi));
     }
 
     if(lScoreAndMatch.empty())
@@ -831,7 +1378,9 @@ vector<KeyFrame*> KeyFrameDatabase::DetectRelocalizationCandidates(Frame *F, Map
         if(si>minScoreToRetain)
         {
             KeyFrame* pKFi = it->second;
-            if (pKFi->GetMap() != pMap)
+            // The best covisible keyframe may have moved to another map meanwhile
+            Map* pMapKF = pKFi->GetMap();
+            if((scope==ONLY_MAP && pMapKF!=pMap) || (scope==OTHER_MAPS && (pMapKF==pMap || pMapKF->IsBad())))
                 continue;
             if(!spAlreadyAddedKF.count(pKFi))
             {
@@ -844,14 +1393,137 @@ vector<KeyFrame*> KeyFrameDatabase::DetectRelocalizationCandidates(Frame *F, Map
     return vpRelocCandidates;
 }
 
+void KeyFrameDatabase::ComputeScores(const DBoW2::BowVector &vBowVec, const vector<KeyFrame*> &vpKFs, float KeyFrame::*pAccScore, vector<float> &vScores) const
+{
+    const int N = vpKFs.size();
+    vScores.resize(N);
+
+    // The L1 score of two normalized vectors is the sum over their common words of the smallest
+    // weight. It was accumulated from the posting lists while searching the candidates
+    if(mpVoc->getScoringType() == DBoW2::L1_NORM)
+    {
+        for(int i=0; i<N; i++)
+            vScores[i] = vpKFs[i]->*pAccScore;
+        return;
+    }
+
+    // Other scorings need the full bags of words. Scores are independent, small sets are not
+    // worth the dispatch to the pool
+    const int nBlock = 32;
+    if(!mpThreadPool || N<2*nBlock)
+    {
+        for(int i=0; i<N; i++)
+            vScores[i] = mpVoc->score(vBowVec,vpKFs[i]->mBowVec);
+        return;
+    }
+
+    mpThreadPool->ParallelFor(0, (N+nBlock-1)/nBlock, [&](int b){
+        const int iend = min(N,(b+1)*nBlock);
+        for(int i=b*nBlock; i<iend; i++)
+            vScores[i] = mpVoc->score(vBowVec,vpKFs[i]->mBowVec);
+    });
+}
+
 void KeyFrameDatabase::SetORBVocabulary(ORBVocabulary* pORBVoc)
 {
     ORBVocabulary** ptr;
     ptr = (ORBVocabulary**)( &mpVoc );
     *ptr = pORBVoc;
 
+    EnsureInvertedFile();
     mvInvertedFile.clear();
     mvInvertedFile.resize(mpVoc->size());
+    {
+        unique_lock<mutex> lockWords(mMutexMapWords);
+        mmMapWords.clear();
+    }
+
+    unique_lock<mutex> lock(mMutexSessions);
+    mnGeneration++;
+}
+
+void KeyFrameDatabase::PreSave()
+{
+    // Called with the SLAM threads stopped
+    mvBackupInvertedFileWords.clear();
+    mvBackupInvertedFileOffsets.clear();
+    mvBackupInvertedFileKFIds.clear();
+
+    // The partitions are not stored, they are rebuilt from the maps of the loaded keyframes
+    for(size_t i=0, iend=InvertedFileWords(); i<iend; i++)
+    {
+        const size_t nOffset = mvBackupInvertedFileKFIds.size();
+        ForEachEntry(i, ALL_MAPS, static_cast<Map*>(NULL), [&](const InvertedFileEntry &entry)
+        {
+            if(entry.pKF)
+                mvBackupInvertedFileKFIds.push_back(entry.nKFId);
+        });
+        if(mvBackupInvertedFileKFIds.size() == nOffset)
+            continue;
+
+        mvBackupInvertedFileWords.push_back(i);
+        mvBackupInvertedFileOffsets.push_back(nOffset);
+    }
+}
+
+void KeyFrameDatabase::PostLoad(map<long unsigned int, KeyFrame*> &mpKFid)
+{
+    // Called before the SLAM threads are launched
+    EnsureInvertedFile();
+    mvInvertedFile.clear();
+    mvInvertedFile.resize(mpVoc->size());
+    mmMapWords.clear();
+
+    const size_t nWords = mvBackupInvertedFileWords.size();
+    for(size_t i=0; i<nWords; i++)
+    {
+        const unsigned int wordId = mvBackupInvertedFileWords[i];
+        if(wordId >= mvInvertedFile.size())
+            continue;
+
+        const size_t begin = mvBackupInvertedFileOffsets[i];
+        const size_t end = (i+1<nWords) ? mvBackupInvertedFileOffsets[i+1] : mvBackupInvertedFileKFIds.size();
+
+        WordPostings &word = mvInvertedFile[wordId];
+        for(size_t j=begin; j<end; j++)
+        {
+            // Keyframes that were not saved with the atlas are dropped
+            map<long unsigned int, KeyFrame*>::iterator it = mpKFid.find(mvBackupInvertedFileKFIds[j]);
+            if(it == mpKFid.end())
+                continue;
+
+            // The weight is taken back from the loaded bag of words
+            KeyFrame* pKFi = it->second;
+            DBoW2::BowVector::const_iterator bit = pKFi->mBowVec.find(wordId);
+
+            InvertedFileEntry entry;
+            entry.pKF = pKFi;
+            entry.nKFId = pKFi->mnId;
+            entry.weight = (bit != pKFi->mBowVec.end()) ? bit->second : 0.f;
+            MapPartition(wordId,pKFi->GetMap()).mvEntries.push_back(entry);
+        }
+    }
+
+    mvBackupInvertedFileWords.clear();
+    mvBackupInvertedFileOffsets.clear();
+    mvBackupInvertedFileKFIds.clear();
+
+    {
+        unique_lock<mutex> lock(mMutexSessions);
+        mnGeneration++;
+    }
+
+    // The global descriptors are not stored, they are computed again from the bags of words
+    if(mnGlobalShortlist>0)
+    {
+        {
+            unique_lock<mutex> lock(mMutexGlobalIndex);
+            mmGlobalIndex.clear();
+        }
+        for(map<long unsigned int, KeyFrame*>::iterator it=mpKFid.begin(); it!=mpKFid.end(); it++)
+            if(!it->second->isBad())
+                AddToGlobalIndex(it->second);
+    }
 }
 
 } //namespace ORB_SLAM
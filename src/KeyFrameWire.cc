@@ -0,0 +1,607 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "KeyFrameWire.h"
+#include "KeyFrame.h"
+#include "MapPoint.h"
+#include "Map.h"
+
+#include <Eigen/Geometry>
+
+#include <algorithm>
+#include <cmath>
+
+namespace ORB_SLAM3
+{
+
+template<class T>
+static void Put(std::vector<char> &buffer, const T &value)
+{
+    const char* p = reinterpret_cast<const char*>(&value);
+    buffer.insert(buffer.end(), p, p+sizeof(T));
+}
+
+static void PutFloats(std::vector<char> &buffer, const float* p, const int n)
+{
+    buffer.insert(buffer.end(), reinterpret_cast<const char*>(p), reinterpret_cast<const char*>(p+n));
+}
+
+static void PutBias(std::vector<char> &buffer, const IMU::Bias &b)
+{
+    const float v[6] = {b.bax, b.bay, b.baz, b.bwx, b.bwy, b.bwz};
+    PutFloats(buffer, v, 6);
+}
+
+// LEB128
+static void PutVarint(std::vector<char> &buffer, unsigned long long value)
+{
+    while(value>=0x80)
+    {
+        buffer.push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    buffer.push_back(static_cast<char>(value));
+}
+
+// Bounds checked reads of a payload
+class WireReader
+{
+public:
+    WireReader(const char* data, const size_t size): mpData(data), mnSize(size), mnPos(0), mbOk(true) {}
+
+    template<class T>
+    T Get()
+    {
+        T value = T();
+        GetBytes(&value, sizeof(T));
+        return value;
+    }
+
+    void GetBytes(void* dst, const size_t n)
+    {
+        if(!mbOk || mnSize-mnPos < n)
+        {
+            mbOk = false;
+            return;
+        }
+        memcpy(dst, mpData+mnPos, n);
+        mnPos += n;
+    }
+
+    void GetFloats(float* p, const int n)
+    {
+        GetBytes(p, n*sizeof(float));
+    }
+
+    IMU::Bias GetBias()
+    {
+        float v[6];
+        GetFloats(v, 6);
+        return IMU::Bias(v[0], v[1], v[2], v[3], v[4], v[5]);
+    }
+
+    cv::Mat GetMat(const int rows, const int cols)
+    {
+        cv::Mat M(rows, cols, CV_32F);
+        GetFloats(M.ptr<float>(), rows*cols);
+        return M;
+    }
+
+    unsigned long long GetVarint()
+    {
+        unsigned long long value = 0;
+        for(int shift=0; shift<64; shift+=7)
+        {
+            const unsigned char byte = Get<unsigned char>();
+            value |= static_cast<unsigned long long>(byte & 0x7f) << shift;
+            if(!(byte & 0x80))
+                return value;
+        }
+        mbOk = false;
+        return 0;
+    }
+
+    // False after a read past the end, or if bEnd and there are bytes left
+    bool Ok(const bool bEnd = true) const { return mbOk && (!bEnd || mnPos==mnSize); }
+
+    size_t Remaining() const { return mnSize-mnPos; }
+
+private:
+    const char* mpData;
+    size_t mnSize;
+    size_t mnPos;
+    bool mbOk;
+};
+
+size_t KeyFrameWire::BeginMessage(const char type, std::vector<char> &buffer)
+{
+    Put(buffer, type);
+    const size_t pos = buffer.size();
+    Put(buffer, static_cast<unsigned int>(0));
+    return pos;
+}
+
+void KeyFrameWire::EndMessage(const size_t pos, std::vector<char> &buffer)
+{
+    const unsigned int size = buffer.size()-pos-sizeof(unsigned int);
+    memcpy(&buffer[pos], &size, sizeof(size));
+}
+
+void KeyFrameWire::EncodeKeyFrame(KeyFrame* pKF, const unsigned int nAgentId, std::vector<char> &buffer, MapUpdateState* pState)
+{
+    const size_t pos = BeginMessage('K', buffer);
+
+    Put(buffer, nAgentId);
+    Put(buffer, static_cast<unsigned long long>(pKF->mnId));
+    Put(buffer, static_cast<unsigned long long>(pKF->GetMap()->GetId()));
+    Put(buffer, pKF->mTimeStamp);
+
+    const cv::Mat Tcw = pKF->GetPose();
+    for(int r=0; r<3; r++)
+        for(int c=0; c<4; c++)
+            Put(buffer, Tcw.at<float>(r,c));
+    if(pState)
+        pState->mKFPoses[pKF->mnId] = cv::Matx44f(Tcw.ptr<float>());
+    Put(buffer, pKF->fx);
+    Put(buffer, pKF->fy);
+    Put(buffer, pKF->cx);
+    Put(buffer, pKF->cy);
+    Put(buffer, pKF->mfScaleFactor);
+
+    // Only the keypoints of the left image
+    const std::vector<MapPoint*> vpMPs = pKF->GetMapPointMatches();
+    const int N = pKF->NLeft==-1 ? pKF->N : pKF->NLeft;
+    std::vector<MapPoint*> vpSent;
+    vpSent.reserve(N);
+
+    buffer.reserve(buffer.size() + 4 + N*60 + 4);
+    Put(buffer, static_cast<unsigned int>(N));
+    for(int i=0; i<N; i++)
+    {
+        const cv::KeyPoint &kp = pKF->mvKeysUn[i];
+        Put(buffer, static_cast<unsigned short>(std::min(std::max(kp.pt.x*8.f+0.5f, 0.f), 65535.f)));
+        Put(buffer, static_cast<unsigned short>(std::min(std::max(kp.pt.y*8.f+0.5f, 0.f), 65535.f)));
+        Put(buffer, static_cast<unsigned char>(kp.octave));
+        Put(buffer, static_cast<unsigned char>(static_cast<int>(kp.angle*256.f/360.f+0.5f) & 0xff));
+
+        const unsigned char* pDesc = pKF->mDescriptors.ptr<unsigned char>(i);
+        buffer.insert(buffer.end(), reinterpret_cast<const char*>(pDesc), reinterpret_cast<const char*>(pDesc)+32);
+
+        unsigned short idx = 0xffff;
+        MapPoint* pMP = vpMPs[i];
+        if(pMP && !pMP->isBad() && vpSent.size()<0xffff)
+        {
+            idx = vpSent.size();
+            vpSent.push_back(pMP);
+        }
+        Put(buffer, idx);
+    }
+
+    Put(buffer, static_cast<unsigned int>(vpSent.size()));
+    for(size_t i=0; i<vpSent.size(); i++)
+    {
+        const cv::Mat Xw = vpSent[i]->GetWorldPos();
+        Put(buffer, static_cast<unsigned long long>(vpSent[i]->mnId));
+        Put(buffer, Xw.at<float>(0));
+        Put(buffer, Xw.at<float>(1));
+        Put(buffer, Xw.at<float>(2));
+        if(pState)
+            pState->mPoints[vpSent[i]->mnId] = cv::Point3f(Xw.at<float>(0), Xw.at<float>(1), Xw.at<float>(2));
+    }
+
+    // The first keyframe of a map has no preintegration
+    IMU::Preintegrated* pImu = pKF->bImu ? pKF->mpImuPreintegrated : static_cast<IMU::Preintegrated*>(NULL);
+    Put(buffer, static_cast<unsigned char>(pImu ? 1 : 0));
+    if(pImu)
+    {
+        const cv::Mat Vw = pKF->GetVelocity();
+        for(int i=0; i<3; i++)
+            Put(buffer, Vw.empty() ? 0.f : Vw.at<float>(i));
+        PutBias(buffer, pKF->GetImuBias());
+
+        Put(buffer, pImu->dT);
+        PutBias(buffer, pImu->GetOriginalBias());
+
+        const cv::Matx33f dR = pImu->GetOriginalDeltaRotation_();
+        Eigen::Quaternionf q(Eigen::Map<const Eigen::Matrix<float,3,3,Eigen::RowMajor> >(dR.val));
+        q.normalize();
+        if(q.w()<0)
+            q.coeffs() *= -1.f;
+        Put(buffer, q.x());
+        Put(buffer, q.y());
+        Put(buffer, q.z());
+        PutFloats(buffer, pImu->GetOriginalDeltaVelocity_().val, 3);
+        PutFloats(buffer, pImu->GetOriginalDeltaPosition_().val, 3);
+
+        PutFloats(buffer, pImu->JRg.val, 9);
+        PutFloats(buffer, pImu->JVg.val, 9);
+        PutFloats(buffer, pImu->JVa.val, 9);
+        PutFloats(buffer, pImu->JPg.val, 9);
+        PutFloats(buffer, pImu->JPa.val, 9);
+        for(int r=0; r<15; r++)
+            for(int c=r; c<15; c++)
+                Put(buffer, pImu->C(r,c));
+    }
+
+    EndMessage(pos, buffer);
+}
+
+bool KeyFrameWire::DecodeKeyFrame(const char* data, const size_t size, KeyFrameMessage &msg)
+{
+    WireReader reader(data, size);
+
+    msg.nAgentId = reader.Get<unsigned int>();
+    msg.nKFId = reader.Get<unsigned long long>();
+    msg.nMapId = reader.Get<unsigned long long>();
+    msg.timestamp = reader.Get<double>();
+
+    msg.Tcw = cv::Mat::eye(4,4,CV_32F);
+    for(int r=0; r<3; r++)
+        for(int c=0; c<4; c++)
+            msg.Tcw.at<float>(r,c) = reader.Get<float>();
+    msg.fx = reader.Get<float>();
+    msg.fy = reader.Get<float>();
+    msg.cx = reader.Get<float>();
+    msg.cy = reader.Get<float>();
+    msg.fScaleFactor = reader.Get<float>();
+
+    const unsigned int N = reader.Get<unsigned int>();
+    if(!reader.Ok(false) || reader.Remaining() < static_cast<size_t>(N)*40)
+        return false;
+
+    msg.vKeysUn.resize(N);
+    msg.descriptors.create(N, 32, CV_8U);
+    msg.vPointIdx.resize(N);
+    for(unsigned int i=0; i<N; i++)
+    {
+        cv::KeyPoint &kp = msg.vKeysUn[i];
+        kp.pt.x = reader.Get<unsigned short>()/8.f;
+        kp.pt.y = reader.Get<unsigned short>()/8.f;
+        kp.octave = reader.Get<unsigned char>();
+        kp.angle = reader.Get<unsigned char>()*360.f/256.f;
+        reader.GetBytes(msg.descriptors.ptr<unsigned char>(i), 32);
+        const unsigned short idx = reader.Get<unsigned short>();
+        msg.vPointIdx[i] = idx==0xffff ? -1 : idx;
+    }
+
+    const unsigned int M = reader.Get<unsigned int>();
+    if(!reader.Ok(false) || reader.Remaining() < static_cast<size_t>(M)*20)
+        return false;
+
+    msg.vPointIds.resize(M);
+    msg.vPoints.resize(M);
+    for(unsigned int i=0; i<M; i++)
+    {
+        msg.vPointIds[i] = reader.Get<unsigned long long>();
+        msg.vPoints[i].x = reader.Get<float>();
+        msg.vPoints[i].y = reader.Get<float>();
+        msg.vPoints[i].z = reader.Get<float>();
+    }
+
+    for(unsigned int i=0; i<N; i++)
+        if(msg.vPointIdx[i]>=static_cast<int>(M))
+            return false;
+
+    msg.bImu = reader.Get<unsigned char>()!=0;
+    if(msg.bImu)
+    {
+        InertialMessage &imu = msg.imu;
+        imu.Vw = reader.GetMat(3,1);
+        imu.bias = reader.GetBias();
+
+        imu.dT = reader.Get<float>();
+        imu.preintegrationBias = reader.GetBias();
+
+        float q[3];
+        reader.GetFloats(q, 3);
+        const float w = sqrt(std::max(0.f, 1.f-q[0]*q[0]-q[1]*q[1]-q[2]*q[2]));
+        const Eigen::Matrix3f dR = Eigen::Quaternionf(w, q[0], q[1], q[2]).normalized().toRotationMatrix();
+        imu.dR.create(3,3,CV_32F);
+        for(int r=0; r<3; r++)
+            for(int c=0; c<3; c++)
+                imu.dR.at<float>(r,c) = dR(r,c);
+        imu.dV = reader.GetMat(3,1);
+        imu.dP = reader.GetMat(3,1);
+
+        imu.JRg = reader.GetMat(3,3);
+        imu.JVg = reader.GetMat(3,3);
+        imu.JVa = reader.GetMat(3,3);
+        imu.JPg = reader.GetMat(3,3);
+        imu.JPa = reader.GetMat(3,3);
+        imu.C.create(15,15,CV_32F);
+        for(int r=0; r<15; r++)
+            for(int c=r; c<15; c++)
+            {
+                imu.C.at<float>(r,c) = reader.Get<float>();
+                imu.C.at<float>(c,r) = imu.C.at<float>(r,c);
+            }
+    }
+
+    return reader.Ok();
+}
+
+void MapUpdateState::Add(const KeyFrameMessage &msg)
+{
+    mKFPoses[msg.nKFId] = cv::Matx44f(msg.Tcw.ptr<float>());
+    for(size_t i=0; i<msg.vPointIds.size(); i++)
+        mPoints[msg.vPointIds[i]] = msg.vPoints[i];
+}
+
+// Delta encoding of the map updates
+static const float POSE_DELTA_T = 1e-4f;    // m
+static const float POSE_DELTA_R = 1e-5f;    // rad
+static const float POINT_DELTA = 1e-4f;     // m
+
+// Pose from the reference and its delta (t in POSE_DELTA_T, rotation vector in POSE_DELTA_R).
+// Encoder and decoder both call it so that they keep the same reference
+static cv::Matx44f ApplyPoseDelta(const cv::Matx44f &Tref, const short* q)
+{
+    const Eigen::Vector3f w(q[3]*POSE_DELTA_R, q[4]*POSE_DELTA_R, q[5]*POSE_DELTA_R);
+    const float angle = w.norm();
+    const Eigen::Matrix3f dR = angle>0 ? Eigen::AngleAxisf(angle, w/angle).toRotationMatrix() : Eigen::Matrix3f::Identity();
+
+    cv::Matx44f T = cv::Matx44f::eye();
+    for(int r=0; r<3; r++)
+    {
+        for(int c=0; c<3; c++)
+            T(r,c) = dR(r,0)*Tref(0,c) + dR(r,1)*Tref(1,c) + dR(r,2)*Tref(2,c);
+        T(r,3) = Tref(r,3) + q[r]*POSE_DELTA_T;
+    }
+    return T;
+}
+
+static bool Quantize(const float value, const float step, short &q)
+{
+    const float v = value/step;
+    if(!(fabs(v)<32767.f))
+        return false;
+    q = static_cast<short>(v>0 ? v+0.5f : v-0.5f);
+    return true;
+}
+
+template<class T>
+static std::vector<size_t> SortedOrder(const std::vector<T> &vIds)
+{
+    std::vector<size_t> vOrder(vIds.size());
+    for(size_t i=0; i<vOrder.size(); i++)
+        vOrder[i] = i;
+    std::sort(vOrder.begin(), vOrder.end(), [&vIds](const size_t a, const size_t b){ return vIds[a]<vIds[b]; });
+    return vOrder;
+}
+
+void KeyFrameWire::EncodeMapUpdate(const MapUpdateMessage &msg, MapUpdateState &state, std::vector<char> &buffer)
+{
+    const size_t pos = BeginMessage('U', buffer);
+
+    Put(buffer, msg.nAgentId);
+    Put(buffer, msg.nMapId);
+
+    const std::vector<size_t> vKFOrder = SortedOrder(msg.vKFIds);
+    Put(buffer, static_cast<unsigned int>(vKFOrder.size()));
+    unsigned long long nPrevId = 0;
+    for(size_t k=0; k<vKFOrder.size(); k++)
+    {
+        const size_t i = vKFOrder[k];
+        const unsigned long long id = msg.vKFIds[i];
+        const cv::Matx44f T(msg.vKFPoses[i].ptr<float>());
+
+        short q[6];
+        bool bFull = true;
+        std::unordered_map<unsigned long long, cv::Matx44f>::iterator it = state.mKFPoses.find(id);
+        if(it!=state.mKFPoses.end())
+        {
+            const cv::Matx44f &Tref = it->second;
+            Eigen::Matrix3f dR;
+            for(int r=0; r<3; r++)
+                for(int c=0; c<3; c++)
+                    dR(r,c) = T(r,0)*Tref(c,0) + T(r,1)*Tref(c,1) + T(r,2)*Tref(c,2);
+            const Eigen::AngleAxisf aa(dR);
+            const Eigen::Vector3f w = aa.angle()*aa.axis();
+
+            bFull = !(Quantize(T(0,3)-Tref(0,3), POSE_DELTA_T, q[0]) && Quantize(T(1,3)-Tref(1,3), POSE_DELTA_T, q[1]) &&
+                      Quantize(T(2,3)-Tref(2,3), POSE_DELTA_T, q[2]) && Quantize(w[0], POSE_DELTA_R, q[3]) &&
+                      Quantize(w[1], POSE_DELTA_R, q[4]) && Quantize(w[2], POSE_DELTA_R, q[5]));
+        }
+
+        PutVarint(buffer, ((id-nPrevId)<<1) | (bFull ? 1 : 0));
+        nPrevId = id;
+        if(bFull)
+        {
+            for(int r=0; r<3; r++)
+                for(int c=0; c<4; c++)
+                    Put(buffer, T(r,c));
+            state.mKFPoses[id] = T;
+        }
+        else
+        {
+            for(int j=0; j<6; j++)
+                Put(buffer, q[j]);
+            it->second = ApplyPoseDelta(it->second, q);
+        }
+    }
+
+    const std::vector<size_t> vPointOrder = SortedOrder(msg.vPointIds);
+    Put(buffer, static_cast<unsigned int>(vPointOrder.size()));
+    nPrevId = 0;
+    for(size_t k=0; k<vPointOrder.size(); k++)
+    {
+        const size_t i = vPointOrder[k];
+        const unsigned long long id = msg.vPointIds[i];
+        const cv::Point3f &X = msg.vPoints[i];
+
+        short q[3];
+        bool bFull = true;
+        std::unordered_map<unsigned long long, cv::Point3f>::iterator it = state.mPoints.find(id);
+        if(it!=state.mPoints.end())
+            bFull = !(Quantize(X.x-it->second.x, POINT_DELTA, q[0]) && Quantize(X.y-it->second.y, POINT_DELTA, q[1]) &&
+                      Quantize(X.z-it->second.z, POINT_DELTA, q[2]));
+
+        PutVarint(buffer, ((id-nPrevId)<<1) | (bFull ? 1 : 0));
+        nPrevId = id;
+        if(bFull)
+        {
+            Put(buffer, X.x);
+            Put(buffer, X.y);
+            Put(buffer, X.z);
+            state.mPoints[id] = X;
+        }
+        else
+        {
+            for(int j=0; j<3; j++)
+                Put(buffer, q[j]);
+            it->second += cv::Point3f(q[0]*POINT_DELTA, q[1]*POINT_DELTA, q[2]*POINT_DELTA);
+        }
+    }
+
+    EndMessage(pos, buffer);
+}
+
+bool KeyFrameWire::DecodeMapUpdate(const char* data, const size_t size, MapUpdateState &state, MapUpdateMessage &msg)
+{
+    WireReader reader(data, size);
+
+    msg.nAgentId = reader.Get<unsigned int>();
+    msg.nMapId = reader.Get<unsigned long long>();
+    msg.vKFIds.clear();
+    msg.vKFPoses.clear();
+    msg.vPointIds.clear();
+    msg.vPoints.clear();
+
+    const unsigned int K = reader.Get<unsigned int>();
+    unsigned long long nPrevId = 0;
+    for(unsigned int k=0; k<K && reader.Ok(false); k++)
+    {
+        const unsigned long long code = reader.GetVarint();
+        const unsigned long long id = nPrevId + (code>>1);
+        nPrevId = id;
+
+        if(code & 1)
+        {
+            cv::Matx44f T = cv::Matx44f::eye();
+            for(int r=0; r<3; r++)
+                for(int c=0; c<4; c++)
+                    T(r,c) = reader.Get<float>();
+            state.mKFPoses[id] = T;
+        }
+        else
+        {
+            short q[6];
+            for(int j=0; j<6; j++)
+                q[j] = reader.Get<short>();
+            std::unordered_map<unsigned long long, cv::Matx44f>::iterator it = state.mKFPoses.find(id);
+            if(it==state.mKFPoses.end())
+                continue;
+            it->second = ApplyPoseDelta(it->second, q);
+        }
+
+        msg.vKFIds.push_back(id);
+        msg.vKFPoses.push_back(cv::Mat(state.mKFPoses[id]).clone());
+    }
+
+    const unsigned int P = reader.Get<unsigned int>();
+    nPrevId = 0;
+    for(unsigned int k=0; k<P && reader.Ok(false); k++)
+    {
+        const unsigned long long code = reader.GetVarint();
+        const unsigned long long id = nPrevId + (code>>1);
+        nPrevId = id;
+
+        if(code & 1)
+        {
+            cv::Point3f X;
+            X.x = reader.Get<float>();
+            X.y = reader.Get<float>();
+            X.z = reader.Get<float>();
+            state.mPoints[id] = X;
+        }
+        else
+        {
+            short q[3];
+            for(int j=0; j<3; j++)
+                q[j] = reader.Get<short>();
+            std::unordered_map<unsigned long long, cv::Point3f>::iterator it = state.mPoints.find(id);
+            if(it==state.mPoints.end())
+                continue;
+            it->second += cv::Point3f(q[0]*POINT_DELTA, q[1]*POINT_DELTA, q[2]*POINT_DELTA);
+        }
+
+        msg.vPointIds.push_back(id);
+        msg.vPoints.push_back(state.mPoints[id]);
+    }
+
+    return reader.Ok();
+}
+
+void KeyFrameWire::EncodeHello(const unsigned int nAgentId, std::vector<char> &buffer)
+{
+    const size_t pos = BeginMessage('H', buffer);
+    Put(buffer, nAgentId);
+    Put(buffer, static_cast<unsigned short>(VERSION));
+    EndMessage(pos, buffer);
+}
+
+bool KeyFrameWire::DecodeHello(const char* data, const size_t size, unsigned int &nAgentId)
+{
+    WireReader reader(data, size);
+    nAgentId = reader.Get<unsigned int>();
+    const unsigned short version = reader.Get<unsigned short>();
+    return reader.Ok() && version==VERSION;
+}
+
+void KeyFrameWire::EncodeAlignment(const unsigned int nAgentId, const unsigned long long nMapId,
+                                   const unsigned int nOtherAgentId, const unsigned long long nOtherMapId,
+                                   const unsigned int nInliers, const float s, const cv::Mat &R, const cv::Mat &t,
+                                   std::vector<char> &buffer)
+{
+    const size_t pos = BeginMessage('A', buffer);
+    Put(buffer, nAgentId);
+    Put(buffer, nMapId);
+    Put(buffer, nOtherAgentId);
+    Put(buffer, nOtherMapId);
+    Put(buffer, nInliers);
+    Put(buffer, s);
+    for(int r=0; r<3; r++)
+        for(int c=0; c<3; c++)
+            Put(buffer, R.at<float>(r,c));
+    for(int r=0; r<3; r++)
+        Put(buffer, t.at<float>(r));
+    EndMessage(pos, buffer);
+}
+
+bool KeyFrameWire::DecodeAlignment(const char* data, const size_t size, unsigned int &nAgentId, unsigned long long &nMapId,
+                                   unsigned int &nOtherAgentId, unsigned long long &nOtherMapId, unsigned int &nInliers,
+                                   float &s, cv::Mat &R, cv::Mat &t)
+{
+    WireReader reader(data, size);
+    nAgentId = reader.Get<unsigned int>();
+    nMapId = reader.Get<unsigned long long>();
+    nOtherAgentId = reader.Get<unsigned int>();
+    nOtherMapId = reader.Get<unsigned long long>();
+    nInliers = reader.Get<unsigned int>();
+    s = reader.Get<float>();
+    R.create(3,3,CV_32F);
+    for(int r=0; r<3; r++)
+        for(int c=0; c<3; c++)
+            R.at<float>(r,c) = reader.Get<float>();
+    t.create(3,1,CV_32F);
+    for(int r=0; r<3; r++)
+        t.at<float>(r) = reader.Get<float>();
+    return reader.Ok();
+}
+
+} //namespace ORB_SLAM3
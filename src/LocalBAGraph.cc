@@ -0,0 +1,141 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "LocalBAGraph.h"
+#include "KeyFrame.h"
+#include "MapPoint.h"
+
+#include "Thirdparty/g2o/g2o/solvers/linear_solver_eigen.h"
+
+#include <vector>
+
+namespace ORB_SLAM3
+{
+
+LocalBAGraph::LocalBAGraph(): mnGeneration(0)
+{
+    g2o::BlockSolver_6_3::LinearSolverType * linearSolver =
+            new g2o::LinearSolverEigen<g2o::BlockSolver_6_3::PoseMatrixType>();
+    g2o::BlockSolver_6_3 * solver_ptr = new g2o::BlockSolver_6_3(linearSolver);
+
+    // Owned (and freed) by mOptimizer
+    mpAlgorithm = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
+    mOptimizer.setAlgorithm(mpAlgorithm);
+    mOptimizer.setVerbose(false);
+}
+
+LocalBAGraph::~LocalBAGraph()
+{
+    Clear();
+}
+
+void LocalBAGraph::BeginWindow()
+{
+    mnGeneration++;
+}
+
+void LocalBAGraph::EndWindow()
+{
+    // Edges first: removing a vertex also deletes the edges still attached to it
+    for(std::map<EdgeKey, std::pair<g2o::OptimizableGraph::Edge*, unsigned long> >::iterator it=mmEdges.begin(); it!=mmEdges.end();)
+    {
+        if(it->second.second != mnGeneration)
+        {
+            mOptimizer.removeEdge(it->second.first);
+            it = mmEdges.erase(it);
+        }
+        else
+            it++;
+    }
+
+    for(std::map<unsigned long, std::pair<g2o::VertexSBAPointXYZ*, unsigned long> >::iterator it=mmMPVertices.begin(); it!=mmMPVertices.end();)
+    {
+        if(it->second.second != mnGeneration)
+        {
+            mOptimizer.removeVertex(it->second.first);
+            it = mmMPVertices.erase(it);
+        }
+        else
+            it++;
+    }
+
+    for(std::map<unsigned long, std::pair<g2o::VertexSE3Expmap*, unsigned long> >::iterator it=mmKFVertices.begin(); it!=mmKFVertices.end();)
+    {
+        if(it->second.second != mnGeneration)
+        {
+            mOptimizer.removeVertex(it->second.first);
+            it = mmKFVertices.erase(it);
+        }
+        else
+            it++;
+    }
+}
+
+void LocalBAGraph::Clear()
+{
+    mOptimizer.clear();
+    mmEdges.clear();
+    mmMPVertices.clear();
+    mmKFVertices.clear();
+}
+
+g2o::VertexSE3Expmap* LocalBAGraph::KeyFrameVertex(KeyFrame* pKF)
+{
+    std::map<unsigned long, std::pair<g2o::VertexSE3Expmap*, unsigned long> >::iterator it = mmKFVertices.find(pKF->mnId);
+    if(it != mmKFVertices.end())
+    {
+        it->second.second = mnGeneration;
+        return it->second.first;
+    }
+
+    g2o::VertexSE3Expmap* vSE3 = new g2o::VertexSE3Expmap();
+    vSE3->setId(KeyFrameId(pKF));
+    mOptimizer.addVertex(vSE3);
+    mmKFVertices[pKF->mnId] = std::make_pair(vSE3, mnGeneration);
+    return vSE3;
+}
+
+g2o::VertexSBAPointXYZ* LocalBAGraph::MapPointVertex(MapPoint* pMP)
+{
+    std::map<unsigned long, std::pair<g2o::VertexSBAPointXYZ*, unsigned long> >::iterator it = mmMPVertices.find(pMP->mnId);
+    if(it != mmMPVertices.end())
+    {
+        it->second.second = mnGeneration;
+        return it->second.first;
+    }
+
+    g2o::VertexSBAPointXYZ* vPoint = new g2o::VertexSBAPointXYZ();
+    vPoint->setId(MapPointId(pMP));
+    vPoint->setMarginalized(true);
+    mOptimizer.addVertex(vPoint);
+    mmMPVertices[pMP->mnId] = std::make_pair(vPoint, mnGeneration);
+    return vPoint;
+}
+
+// Keyframes and map points are interleaved so that ids do not depend on the window content
+int LocalBAGraph::KeyFrameId(KeyFrame* pKF) const
+{
+    return 2*pKF->mnId;
+}
+
+int LocalBAGraph::MapPointId(MapPoint* pMP) const
+{
+    return 2*pMP->mnId+1;
+}
+
+} //namespace ORB_SLAM3
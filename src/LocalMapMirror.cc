@@ -0,0 +1,223 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "LocalMapMirror.h"
+#include "MapPoint.h"
+#include "Frame.h"
+#include "ORBmatcher.h"
+#include "GeometricCamera.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace ORB_SLAM3
+{
+
+LocalMapMirror::LocalMapMirror()
+{
+}
+
+void LocalMapMirror::Points::resize(size_t n)
+{
+    mvpMapPoints.resize(n);
+    mvnId.resize(n);
+    mvnVersion.resize(n);
+    mvX.resize(n); mvY.resize(n); mvZ.resize(n);
+    mvNx.resize(n); mvNy.resize(n); mvNz.resize(n);
+    mvMinDist.resize(n); mvMaxDist.resize(n); mvScaleDist.resize(n);
+    if(static_cast<size_t>(mDescriptors.rows)<n)
+        mDescriptors.create(std::max<int>(n,2*mDescriptors.rows),ORBmatcher::DESCRIPTOR_BYTES,CV_8U);
+}
+
+void LocalMapMirror::Projection::Keep(const std::vector<int> &vKeep)
+{
+    const size_t n = vKeep.size();
+    for(size_t k=0; k<n; k++)
+    {
+        const int j = vKeep[k];
+        mvProjPoint[k] = mvProjPoint[j];
+        mvProjU[k] = mvProjU[j];
+        mvProjV[k] = mvProjV[j];
+        mvProjUR[k] = mvProjUR[j];
+        mvProjDepth[k] = mvProjDepth[j];
+        mvProjViewCos[k] = mvProjViewCos[j];
+        mvProjLevel[k] = mvProjLevel[j];
+    }
+    mvProjPoint.resize(n);
+    mvProjU.resize(n); mvProjV.resize(n); mvProjUR.resize(n);
+    mvProjDepth.resize(n); mvProjViewCos.resize(n); mvProjLevel.resize(n);
+}
+
+int LocalMapMirror::Refresh(const std::vector<MapPoint*> &vpMapPoints)
+{
+    std::swap(mPoints,mPrevPoints);
+    const Points &prev = mPrevPoints;
+    Points &cur = mPoints;
+
+    const size_t N = vpMapPoints.size();
+    cur.resize(N);
+
+    int nRead = 0;
+    for(size_t i=0; i<N; i++)
+    {
+        MapPoint* pMP = vpMapPoints[i];
+
+        // The version is read before the data, a change in between is caught by the next Refresh
+        const unsigned int nVersion = pMP->GetViewVersion();
+        const int j = pMP->mnTrackMirrorIndex;
+        pMP->mnTrackMirrorIndex = i;
+
+        cur.mvpMapPoints[i] = pMP;
+        cur.mvnId[i] = pMP->mnId;
+        cur.mvnVersion[i] = nVersion;
+
+        if(j>=0 && static_cast<size_t>(j)<prev.size() && prev.mvpMapPoints[j]==pMP &&
+           prev.mvnId[j]==pMP->mnId && prev.mvnVersion[j]==nVersion)
+        {
+            cur.mvX[i] = prev.mvX[j]; cur.mvY[i] = prev.mvY[j]; cur.mvZ[i] = prev.mvZ[j];
+            cur.mvNx[i] = prev.mvNx[j]; cur.mvNy[i] = prev.mvNy[j]; cur.mvNz[i] = prev.mvNz[j];
+            cur.mvMinDist[i] = prev.mvMinDist[j];
+            cur.mvMaxDist[i] = prev.mvMaxDist[j];
+            cur.mvScaleDist[i] = prev.mvScaleDist[j];
+            std::memcpy(cur.mDescriptors.ptr(i),prev.mDescriptors.ptr(j),ORBmatcher::DESCRIPTOR_BYTES);
+            continue;
+        }
+
+        cv::Matx31f Pos, Normal;
+        pMP->GetViewingGeometry(Pos,Normal,cur.mvMinDist[i],cur.mvMaxDist[i]);
+        cur.mvX[i] = Pos(0); cur.mvY[i] = Pos(1); cur.mvZ[i] = Pos(2);
+        cur.mvNx[i] = Normal(0); cur.mvNy[i] = Normal(1); cur.mvNz[i] = Normal(2);
+        cur.mvScaleDist[i] = cur.mvMaxDist[i]/1.2f;
+
+        const cv::Mat descriptor = pMP->GetDescriptor();
+        if(!descriptor.empty())
+            std::memcpy(cur.mDescriptors.ptr(i),descriptor.ptr(),ORBmatcher::DESCRIPTOR_BYTES);
+        else
+            std::memset(cur.mDescriptors.ptr(i),0,ORBmatcher::DESCRIPTOR_BYTES);
+        nRead++;
+    }
+
+    return nRead;
+}
+
+void LocalMapMirror::Clear()
+{
+    mPoints.resize(0);
+    mPrevPoints.resize(0);
+}
+
+int LocalMapMirror::PointIndex(MapPoint* pMP) const
+{
+    const int j = pMP->mnTrackMirrorIndex;
+    if(j<0 || static_cast<size_t>(j)>=mPoints.size() || mPoints.mvpMapPoints[j]!=pMP)
+        return -1;
+    return j;
+}
+
+int LocalMapMirror::ProjectPoints(const Frame &F, const float viewingCosLimit, Projection &p) const
+{
+    const Points &pts = mPoints;
+    if(p.mvPointStamp.size()<pts.size())
+        p.mvPointStamp.resize(pts.size(),0);
+
+    // Do not search map points already matched
+    const unsigned long stamp = ++p.mnStamp;
+    p.mvbKeyMatched.assign(F.N,0);
+    for(int i=0; i<F.N; i++)
+    {
+        MapPoint* pMP = F.mvpMapPoints[i];
+        if(!pMP)
+            continue;
+        const int ip = PointIndex(pMP);
+        if(ip>=0)
+            p.mvPointStamp[ip] = stamp;
+        if(pMP->Observations()>0)
+            p.mvbKeyMatched[i] = 1;
+    }
+
+    std::vector<int> &vPoints = p.mvProjPoint;
+    vPoints.clear();
+    for(size_t i=0; i<pts.size(); i++)
+        if(p.mvPointStamp[i]!=stamp)
+            vPoints.push_back(i);
+
+    const int N = vPoints.size();
+    p.mvProjU.resize(N); p.mvProjV.resize(N); p.mvProjUR.resize(N);
+    p.mvProjDepth.resize(N); p.mvProjViewCos.resize(N); p.mvProjLevel.resize(N);
+    if(N==0)
+        return 0;
+
+    const float r00 = F.mRcwx(0,0), r01 = F.mRcwx(0,1), r02 = F.mRcwx(0,2);
+    const float r10 = F.mRcwx(1,0), r11 = F.mRcwx(1,1), r12 = F.mRcwx(1,2);
+    const float r20 = F.mRcwx(2,0), r21 = F.mRcwx(2,1), r22 = F.mRcwx(2,2);
+    const float tx = F.mtcwx(0), ty = F.mtcwx(1), tz = F.mtcwx(2);
+    const float ox = F.mOwx(0), oy = F.mOwx(1), oz = F.mOwx(2);
+
+    std::vector<float> vPcX(N), vPcY(N), vPcZ(N), vDist(N);
+    for(int j=0; j<N; j++)
+    {
+        const int i = vPoints[j];
+        const float x = pts.mvX[i], y = pts.mvY[i], z = pts.mvZ[i];
+        vPcX[j] = r00*x + r01*y + r02*z + tx;
+        vPcY[j] = r10*x + r11*y + r12*z + ty;
+        vPcZ[j] = r20*x + r21*y + r22*z + tz;
+
+        const float pox = x-ox, poy = y-oy, poz = z-oz;
+        const float dist = std::sqrt(pox*pox + poy*poy + poz*poz);
+        vDist[j] = dist;
+        p.mvProjViewCos[j] = (pox*pts.mvNx[i] + poy*pts.mvNy[i] + poz*pts.mvNz[i])/dist;
+    }
+
+    F.mpCamera->projectMany(vPcX.data(),vPcY.data(),vPcZ.data(),N,p.mvProjU.data(),p.mvProjV.data());
+
+    // Keep the points in the frustum, in place
+    int n = 0;
+    for(int j=0; j<N; j++)
+    {
+        const int i = vPoints[j];
+        const float u = p.mvProjU[j], v = p.mvProjV[j];
+        if(vPcZ[j]<0.0f || u<F.mnMinX || u>F.mnMaxX || v<F.mnMinY || v>F.mnMaxY)
+            continue;
+        if(vDist[j]<pts.mvMinDist[i] || vDist[j]>pts.mvMaxDist[i] || p.mvProjViewCos[j]<viewingCosLimit)
+            continue;
+
+        int nScale = std::ceil(std::log(pts.mvScaleDist[i]/vDist[j])/F.mfLogScaleFactor);
+        if(nScale<0)
+            nScale = 0;
+        else if(nScale>=F.mnScaleLevels)
+            nScale = F.mnScaleLevels-1;
+
+        vPoints[n] = i;
+        p.mvProjU[n] = u;
+        p.mvProjV[n] = v;
+        p.mvProjUR[n] = u - F.mbf/vPcZ[j];
+        p.mvProjDepth[n] = std::sqrt(vPcX[j]*vPcX[j] + vPcY[j]*vPcY[j] + vPcZ[j]*vPcZ[j]);
+        p.mvProjViewCos[n] = p.mvProjViewCos[j];
+        p.mvProjLevel[n] = nScale;
+        n++;
+    }
+
+    vPoints.resize(n);
+    p.mvProjU.resize(n); p.mvProjV.resize(n); p.mvProjUR.resize(n);
+    p.mvProjDepth.resize(n); p.mvProjViewCos.resize(n); p.mvProjLevel.resize(n);
+
+    return n;
+}
+
+} //namespace ORB_SLAM3
@@ -22,10 +22,25 @@
 #include "ORBmatcher.h"
 #include "Optimizer.h"
 #include "Converter.h"
+#include "ImuInitializer.h"
 #include "Config.h"
+#include "Metrics.h"
+#include "EpochManager.h"
+#include "ThreadPool.h"
+#include "LocalMappingScheduler.h"
+#include "Tracer.h"
+#include "ReplayLog.h"
+#include "AgentClient.h"
+#include "ObjectPool.h"
+#include "Triangulator.h"
+#include "PowerGovernor.h"
+#include "TrajectoryStore.h"
 
 #include<mutex>
 #include<chrono>
+#include<atomic>
+#include<algorithm>
+#include<unordered_set>
 
 
 namespace ORB_SLAM3
@@ -33,9 +48,28 @@ namespace ORB_SLAM3
 
 LocalMapping::LocalMapping(System* pSys, Atlas *pAtlas, const float bMonocular, bool bInertial, const string &_strSeqName):
     mpSystem(pSys), mbMonocular(bMonocular), mbInertial(bInertial), mbResetRequested(false), mbResetRequestedActiveMap(false), mbFinishRequested(false), mbFinished(true), mpAtlas(pAtlas), bInitializing(false),
-    mbAbortBA(false), mbStopped(false), mbStopRequested(false), mbNotStop(false), mbAcceptKeyFrames(true),
+    mbWakeUp(false), mbAbortBA(false), mbStopped(false), mbStopRequested(false), mbNotStop(false), mbAcceptKeyFrames(true),
     mbNewInit(false), mIdxInit(0), mScale(1.0), mInitSect(0), mbNotBA1(true), mbNotBA2(true), infoInertial(Eigen::MatrixXd::Zero(9,9))
 {
+    mpThreadPool = static_cast<ThreadPool*>(NULL);
+    mpTrajectoryStore = static_cast<TrajectoryStore*>(NULL);
+    mpMetrics = static_cast<Metrics*>(NULL);
+    mpReplayLog = static_cast<ReplayLog*>(NULL);
+    mpAgentClient = static_cast<AgentClient*>(NULL);
+    mbReplayTurn = false;
+    mpLocalBAGraph = new LocalBAGraph();
+    mpScheduler = static_cast<LocalMappingScheduler*>(NULL);
+    mpPowerGovernor = static_cast<PowerGovernor*>(NULL);
+    mbInBurst = false;
+    mThInertialRelin = 0.f;
+    mnInertialSmootherWindow = 0;
+    mThKFCullingBudget = 0.f;
+    mbSpeculativePreprocessing = false;
+    mnMaxKeyFrames = 0;
+    mnMaxMapPoints = 0;
+    mFastImuInitTime = 0.f;
+    mbOfflineMapping = false;
+
     mnMatchesInliers = 0;
 
     mbBadImu = false;
@@ -52,6 +86,12 @@ LocalMapping::LocalMapping(System* pSys, Atlas *pAtlas, const float bMonocular,
 
 }
 
+LocalMapping::~LocalMapping()
+{
+    delete mpLocalBAGraph;
+    delete mpScheduler;
+}
+
 void LocalMapping::SetLoopCloser(LoopClosing* pLoopCloser)
 {
     mpLoopCloser = pLoopCloser;
@@ -62,14 +102,75 @@ void LocalMapping::SetTracker(Tracking *pTracker)
     mpTracker=pTracker;
 }
 
+void LocalMapping::SetThreadPool(ThreadPool *pThreadPool)
+{
+    mpThreadPool=pThreadPool;
+}
+
+void LocalMapping::SetTrajectoryStore(TrajectoryStore *pTrajectoryStore)
+{
+    mpTrajectoryStore=pTrajectoryStore;
+}
+
+void LocalMapping::SetMetrics(Metrics *pMetrics)
+{
+    mpMetrics=pMetrics;
+}
+
+void LocalMapping::SetThreadScheduling(const ThreadScheduling &sched)
+{
+    mThreadScheduling = sched;
+}
+
+void LocalMapping::SetReplayLog(ReplayLog *pReplayLog)
+{
+    mpReplayLog=pReplayLog;
+    if(mpReplayLog)
+    {
+        mpReplayLog->SetWakeUp(ReplayLog::LOCAL_MAPPING_KEYFRAME, [this]{ WakeUp(); });
+        mpReplayLog->SetWakeUp(ReplayLog::LOCAL_MAPPING_DEFERRED, [this]{ WakeUp(); });
+    }
+}
+
+void LocalMapping::SetAgentClient(AgentClient *pAgentClient)
+{
+    mpAgentClient=pAgentClient;
+}
+
+void LocalMapping::EnableScheduler(const float fKeyFrameBudget)
+{
+    delete mpScheduler;
+    mpScheduler = new LocalMappingScheduler(fKeyFrameBudget);
+}
+
+void LocalMapping::SetPowerGovernor(PowerGovernor *pGovernor)
+{
+    mpPowerGovernor=pGovernor;
+}
+
 void LocalMapping::Run()
 {
     //^ Run
     //^ mbFinished : While 문을 돌고 있는지 아닌지를 체크하는 Flag 
     mbFinished = false; //mbFinished는 초기값 true입니다. run 함수가 종료될때 true로 다시 반환합니다.
 
+    //^ 삭제된 map point들의 메모리 회수를 위해 thread 등록
+    EpochManager::ThreadRegistration epochRegistration;
+    ORB_TRACE_THREAD_NAME("LocalMapping");
+    ORB_LOCK_THREAD_NAME("LocalMapping");
+    //^ pool에 보내는 작업은 Tracking의 작업보다 뒤, global BA보다 먼저 실행됨
+    ThreadPool::PriorityScope poolPriority(ThreadPool::MAPPING);
+
+    if(!mThreadScheduling.IsDefault())
+        mThreadScheduling.Apply();
+
     while(1)    //while문 시작 
     {
+        //^ 이전 iteration에서 얻은 pointer는 더 이상 사용하지 않음 (Quiescent point)
+        //^ 단, 대기 중인 keyframe들은 아직 observation으로 등록되지 않은 map point를 가지고 있으므로 queue가 빈 경우에만
+        if(!CheckNewKeyFrames())
+            EpochManager::Quiescent();
+
         //^ Cannot accept keyframe now because LM is busy
         // Tracking will see that Local Mapping is busy
         SetAcceptKeyFrames(false);  
@@ -78,10 +179,20 @@ void LocalMapping::Run()
 
         //^ Check if key frames list is empty
         // Check if there are keyframes in the queue
-        if(CheckNewKeyFrames() && !mbBadImu)    //checknewkeyframes 함수 : newkeyframe 리스트가 empty인지 아닌지 판단해주는 함수입니다. 
+        //^ replay에서는 record 당시 처리가 끝난 시점(Tracking frame)까지 기다림
+        //^ low-power mode에서는 burst가 모일 때까지 기다림
+        bool bBurstDue = true;
+        if(mpPowerGovernor)
+        {
+            unique_lock<mutex> lock(mMutexNewKFs);
+            bBurstDue = BurstDue();
+        }
+        if(CheckNewKeyFrames() && !mbBadImu && bBurstDue && (!mpReplayLog || mpReplayLog->HasTurn(ReplayLog::LOCAL_MAPPING_KEYFRAME)))    //checknewkeyframes 함수 : newkeyframe 리스트가 empty인지 아닌지 판단해주는 함수입니다. 
                                                 //mbBadimu 함수 imu가 재대로 안들어올때 true를 반환해주게 되어있습니다. 
                                                 //해당 두 함수에 관한 true가 형성될때 if문이 가동됩니다.
         {
+            ORB_TRACE_SCOPE("LocalMapping::KeyFrame");
+            mbReplayTurn = true;
 
 #ifdef REGISTER_TIMES
             double timeLBA_ms = 0;
@@ -89,6 +200,9 @@ void LocalMapping::Run()
 
             std::chrono::steady_clock::time_point time_StartProcessKF = std::chrono::steady_clock::now();
 #endif
+            const Metrics::Clock::time_point time_StartKF = Metrics::Clock::now();
+            if(mpScheduler)
+                mpScheduler->BeginKeyFrame();
             //^ Keyframe 전처리
             // BoW conversion and insertion in Map
             ProcessNewKeyFrame();   //new keyframe 기본작업을 합니다. 여기서 current keyframe이 update됩니다.
@@ -98,7 +212,12 @@ void LocalMapping::Run()
             double timeProcessKF = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(time_EndProcessKF - time_StartProcessKF).count();
             vdKFInsert_ms.push_back(timeProcessKF);
 #endif
-            //^ mlpRecentAddedMapPoints 정리
+            if(mpMetrics)
+            {
+                mpMetrics->Record(Metrics::KEYFRAME_PROCESSING, time_StartKF);
+                mpMetrics->RecordKeyFrameInserted(mpCurrentKeyFrame->mnFrameId);
+            }
+            //^ mlRecentAddedMapPoints 정리
             //^ Redundant Map Points
             // Check recent MapPoints
             MapPointCulling();      //각 keyframe별 mappoint를 모으는 작업을 합니다. 
@@ -115,7 +234,22 @@ void LocalMapping::Run()
             mbAbortBA = false;  //해당 flag는 local mapping을 중단해야할때 true로 전환되는 flag입니다. 
                                 //따라서 local mapping을 진행하고 있으므로 false로 선언합니다.
 
-            if(!CheckNewKeyFrames())
+            //scheduler가 fusion이나 culling을 미루면 idle 시간에 처리합니다.
+            bool bDeferFuse = false;
+            bool bDeferCull = false;
+
+            if(mpScheduler)
+            {
+                if(ShouldRun(LocalMappingScheduler::SEARCH_IN_NEIGHBORS))
+                {
+                    const LocalMappingScheduler::Clock::time_point time_StartFuse = LocalMappingScheduler::Clock::now();
+                    SearchInNeighbors();
+                    mpScheduler->Record(LocalMappingScheduler::SEARCH_IN_NEIGHBORS, time_StartFuse);
+                }
+                else
+                    bDeferFuse = true;
+            }
+            else if(!CheckNewKeyFrames())
             {
                 // Find more matches in neighbor keyframes and fuse point duplications
                 //해당함수는 위의 설명대로 neighbor keyframes와 매칭하여 duplications point들을 제거합니다.
@@ -134,14 +268,18 @@ void LocalMapping::Run()
             진행하면서 변수 각각의 설명을 하겠습니다.
             */
             bool b_doneLBA = false;
+            const Metrics::Clock::time_point time_StartLBA = Metrics::Clock::now();
             int num_FixedKF_BA = 0;
             int num_OptKF_BA = 0;
             int num_MPs_BA = 0;
             int num_edges_BA = 0;
 
             //^ BA
-            if(!CheckNewKeyFrames() && !stopRequested())    //stopRequested flag가 정상이고 CheckNewKeyFrames가 정상적으로 clear 되어있으면
-                                                             //if문이 시작됩니다.
+            //scheduler가 있으면 queue에 KeyFrame이 있어도 budget 안에 들어오면 BA를 진행합니다.
+            //offline mapping에서는 queue와 상관없이 항상 BA를 진행합니다.
+            const bool bRunBA = mpScheduler ? ShouldRun(LocalMappingScheduler::LOCAL_BA) : (mbOfflineMapping || !CheckNewKeyFrames());
+            if(bRunBA && !stopRequested())    //stopRequested flag가 정상이고 CheckNewKeyFrames가 정상적으로 clear 되어있으면
+                                              //if문이 시작됩니다.
             {
                 //^ Local BA
                 if(mpAtlas->KeyFramesInMap()>2)     //Current map 상에서 사용되고있는 keyframe의 갯수가 3개 이상일때 시작합니다. 
@@ -182,13 +320,15 @@ void LocalMapping::Run()
 
                         //optimizer 함수를 좀 자세히 들여다 보아야 정확한 실행루트를 이해할 수 있습니다. 
                         //간단하게 설명하자면 LocalInertialBA는 imu센서의 acc, vel, pose, gyro 데이터와 visual의 keypoint, mappoint들을 조합하여 BA를 진행합니다.
-                        Optimizer::LocalInertialBA(mpCurrentKeyFrame, &mbAbortBA, mpCurrentKeyFrame->GetMap(),num_FixedKF_BA,num_OptKF_BA,num_MPs_BA,num_edges_BA, bLarge, !mpCurrentKeyFrame->GetMap()->GetIniertialBA2());
+                        Optimizer::LocalInertialBA(mpCurrentKeyFrame, &mbAbortBA, mpCurrentKeyFrame->GetMap(),num_FixedKF_BA,num_OptKF_BA,num_MPs_BA,num_edges_BA, bLarge, !mpCurrentKeyFrame->GetMap()->GetIniertialBA2(), mThInertialRelin, mnInertialSmootherWindow);
                         b_doneLBA = true;
                     }
                     else
                     {   //LocalBundleAdjustment는 위의 LocalInertialBA와 다르게 visual data만 이용하여 BA를 진행합니다.
-                        Optimizer::LocalBundleAdjustment(mpCurrentKeyFrame,&mbAbortBA, mpCurrentKeyFrame->GetMap(),num_FixedKF_BA,num_OptKF_BA,num_MPs_BA,num_edges_BA);
+                        Optimizer::LocalBundleAdjustment(mpCurrentKeyFrame,&mbAbortBA, mpCurrentKeyFrame->GetMap(),num_FixedKF_BA,num_OptKF_BA,num_MPs_BA,num_edges_BA,mpLocalBAGraph);
                         b_doneLBA = true;
+                        if(mpMetrics)
+                            mpMetrics->SetGauge(Metrics::LOCAL_BA_ITERATIONS, Optimizer::GetLastIterationStats().nIterations);
                     }
 
                 }//따라서 여기까지 BA 최적화까지 진행함을 알수 있습니다.
@@ -212,6 +352,10 @@ void LocalMapping::Run()
                 }
 
 #endif
+                if(b_doneLBA && mpMetrics)
+                    mpMetrics->Record(Metrics::LOCAL_BA, time_StartLBA);
+                if(b_doneLBA && mpScheduler)
+                    mpScheduler->Record(LocalMappingScheduler::LOCAL_BA, time_StartLBA);
                 //^ IMU Initialization
                 // Initialize IMU here
                 // imu가 들어가있는 경우인데도 Imu initialized가 되지않았을때 해당 if문이 진행됩니다.
@@ -226,7 +370,20 @@ void LocalMapping::Run()
 
                 // Check redundant local Keyframes
                 // 불필요한 keyFrame제거를 위해 KeyFrameCulling 함수를 진행합니다.
-                KeyFrameCulling();
+                if(!mpScheduler)
+                    KeyFrameCulling();
+                else if(ShouldRun(LocalMappingScheduler::KEYFRAME_CULLING))
+                {
+                    const LocalMappingScheduler::Clock::time_point time_StartCulling = LocalMappingScheduler::Clock::now();
+                    KeyFrameCulling();
+                    mpScheduler->Record(LocalMappingScheduler::KEYFRAME_CULLING, time_StartCulling);
+                }
+                else
+                    bDeferCull = true;
+
+                // Map size bounded by the keyframe and map point budgets (repeated routes)
+                if((mnMaxKeyFrames>0 || mnMaxMapPoints>0) && !CheckNewKeyFrames())
+                    EnforceMapBudget();
 
 #ifdef REGISTER_TIMES
                 std::chrono::steady_clock::time_point time_EndKFCulling = std::chrono::steady_clock::now();
@@ -294,6 +451,22 @@ void LocalMapping::Run()
                     }
                 }
             }
+            else if(mpScheduler)
+                bDeferCull = true;
+
+            if(bDeferFuse || bDeferCull)
+            {
+                DeferredWork work;
+                work.pKF = mpCurrentKeyFrame;
+                work.bFuse = bDeferFuse;
+                work.bCull = bDeferCull;
+                mlDeferredWork.push_back(work);
+
+                // Work on old keyframes is worth less, the newer ones already cover their neighbors
+                const size_t nMaxDeferred = 10;
+                if(mlDeferredWork.size()>nMaxDeferred)
+                    mlDeferredWork.pop_front();
+            }
 
 #ifdef REGISTER_TIMES
             vdLBA_ms.push_back(timeLBA_ms);
@@ -303,6 +476,9 @@ void LocalMapping::Run()
             //loopcloser에서 새로들어온 currentKeyFrame을 insert 시켜줍니다. (map update)
             mpLoopCloser->InsertKeyFrame(mpCurrentKeyFrame);
 
+            if(mpAgentClient)
+                mpAgentClient->SendKeyFrame(mpCurrentKeyFrame);
+
 
 #ifdef REGISTER_TIMES
             std::chrono::steady_clock::time_point time_EndLocalMap = std::chrono::steady_clock::now();
@@ -310,6 +486,16 @@ void LocalMapping::Run()
             double timeLocalMap = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(time_EndLocalMap - time_StartProcessKF).count();
             vdLMTotal_ms.push_back(timeLocalMap);
 #endif
+            if(mpMetrics)
+            {
+                mpMetrics->Record(Metrics::LOCAL_MAPPING_TOTAL, time_StartKF);
+                mpMetrics->RecordMapUpdated(mpCurrentKeyFrame->mnFrameId);
+            }
+            mpAtlas->PublishMapEvents(MapEvents::LOCAL_MAPPING);
+
+            mbReplayTurn = false;
+            if(mpReplayLog)
+                mpReplayLog->WorkDone(ReplayLog::LOCAL_MAPPING_KEYFRAME);
         }
         //^ mlNewKeyFrames가 없을 때
         //^ Stop request가 왔는지 체크
@@ -320,15 +506,27 @@ void LocalMapping::Run()
             //^ Stop 요청이 오면 stop이 풀릴 떄까지(mLocalMapper->Release()가 호출될 때까지)
             //^ 대기
             //^ 예시 : LoopClosing -> CorrectLoop()
-            while(isStopped() && !CheckFinish())
             {
-                usleep(3000);
+                ORB_TRACE_SCOPE("LocalMapping::Stopped");
+                unique_lock<mutex> lock(mMutexStop);
+                mcvStop.wait(lock, [this]{ return !mbStopped || CheckFinish(); });
             }
             
             //^ finish request가 왔으면 전체 while 문 out
             if(CheckFinish())
                 break;
         }
+        //^ 새로운 KeyFrame이 없을 때 scheduler가 미뤄둔 fusion/culling 처리
+        else if(!mlDeferredWork.empty() && !mbBadImu && (!mpReplayLog || mpReplayLog->HasTurn(ReplayLog::LOCAL_MAPPING_DEFERRED)))
+        {
+            // Background work, Tracking can insert keyframes meanwhile
+            SetAcceptKeyFrames(true);
+            mbReplayTurn = true;
+            ProcessDeferredWork();
+            mbReplayTurn = false;
+            if(mpReplayLog)
+                mpReplayLog->WorkDone(ReplayLog::LOCAL_MAPPING_DEFERRED);
+        }
 
         //^ Reset 요청 있었다면 LM에서 사용하는 parameter들 Reset 실행
         //^ RequestedReset : tracking에서
@@ -344,8 +542,8 @@ void LocalMapping::Run()
         if(CheckFinish())
             break;
 
-        //^ LM 주기
-        usleep(3000);
+        //^ 새로운 KeyFrame 또는 요청이 올 때까지 대기
+        WaitForWork();
     }
 
     //^ Stop : while 문 내에서 잠시 대기
@@ -358,25 +556,129 @@ void LocalMapping::Run()
 void LocalMapping::InsertKeyFrame(KeyFrame *pKF)
 {
     unique_lock<mutex> lock(mMutexNewKFs);
+    if(mlNewKeyFrames.empty())
+    {
+        // The previous burst is over, this keyframe starts the next one
+        mbInBurst = false;
+        mTimeFirstQueued = std::chrono::steady_clock::now();
+    }
     mlNewKeyFrames.push_back(pKF);
-    mbAbortBA=true;
+    if(mbSpeculativePreprocessing && mpThreadPool && mpThreadPool->GetNumThreads()>0)
+    {
+        ThreadPool::PriorityScope scope(ThreadPool::MAPPING);
+        mmSpeculativeWork[pKF] = mpThreadPool->Submit([pKF]{ pKF->ComputeBoW(); });
+    }
+    if(!mbOfflineMapping)
+        mbAbortBA=true;
+    if(mpMetrics)
+        mpMetrics->SetGauge(Metrics::LOCAL_MAPPING_QUEUE, mlNewKeyFrames.size());
+    mcvNewKFs.notify_one();
 }
 
 bool LocalMapping::CheckNewKeyFrames()
+{
+    bool bNewKFs;
+    {
+        unique_lock<mutex> lock(mMutexNewKFs);
+        bNewKFs = !mlNewKeyFrames.empty();
+    }
+
+    //^ keyframe 처리 중의 확인 결과는 Tracking의 timing에 따라 달라지므로 record/replay
+    if(mpReplayLog && mbReplayTurn)
+        return mpReplayLog->Decide(ReplayLog::LOCAL_MAPPING_QUEUE, bNewKFs) && bNewKFs;
+    return bNewKFs;
+}
+
+bool LocalMapping::ShouldRun(const LocalMappingScheduler::Stage stage)
+{
+    static const ReplayLog::eDecision vDecisions[] = {ReplayLog::LOCAL_MAPPING_FUSE, ReplayLog::LOCAL_MAPPING_BA, ReplayLog::LOCAL_MAPPING_CULLING};
+
+    // The budget depends on the measured times
+    const bool bRun = mpScheduler->ShouldRun(stage, KeyframesInQueue());
+    if(mpReplayLog)
+        return mpReplayLog->Decide(vDecisions[stage], bRun);
+    return bRun;
+}
+
+void LocalMapping::WaitForWork()
+{
+    // Postponed work is done as soon as nothing else is pending. On replay the work waits for
+    // its turn, which wakes the thread up
+    if(!mpReplayLog && !mlDeferredWork.empty() && !mbBadImu)
+        return;
+
+    unique_lock<mutex> lock(mMutexNewKFs);
+    // The timeout only bounds the wait for state that is not signalled (e.g. mbBadImu being cleared)
+    std::chrono::milliseconds timeout(100);
+    if(mpPowerGovernor && !mlNewKeyFrames.empty())
+    {
+        // An incomplete burst is started when its first keyframe can not wait any longer
+        const std::chrono::steady_clock::time_point due = mTimeFirstQueued +
+                std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float>(mpPowerGovernor->GetMaxDelay()));
+        const std::chrono::milliseconds left = std::chrono::duration_cast<std::chrono::milliseconds>(due - std::chrono::steady_clock::now()) + std::chrono::milliseconds(1);
+        timeout = std::max(std::chrono::milliseconds(0), std::min(timeout, left));
+    }
+    mcvNewKFs.wait_for(lock, timeout,
+                       [this]{ return mbWakeUp || (!mpReplayLog && !mlNewKeyFrames.empty() && !mbBadImu && BurstDue()); });
+    mbWakeUp = false;
+}
+
+bool LocalMapping::BurstDue()
+{
+    // Replay follows the recorded processing order, offline mapping has no frame rate to save power on
+    if(!mpPowerGovernor || mbOfflineMapping || (mpReplayLog && mpReplayLog->GetMode()==ReplayLog::REPLAY))
+        return true;
+    if(mlNewKeyFrames.empty())
+        return false;
+
+    if(!mbInBurst)
+    {
+        const float waited = std::chrono::duration_cast<std::chrono::duration<float> >(std::chrono::steady_clock::now() - mTimeFirstQueued).count();
+        mbInBurst = (int)mlNewKeyFrames.size()>=mpPowerGovernor->GetBurstSize() || waited>=mpPowerGovernor->GetMaxDelay();
+    }
+    return mbInBurst;
+}
+
+void LocalMapping::WakeUp()
 {
     unique_lock<mutex> lock(mMutexNewKFs);
-    return(!mlNewKeyFrames.empty());
+    mbWakeUp = true;
+    mcvNewKFs.notify_one();
+}
+
+void LocalMapping::WaitSpeculativeWork()
+{
+    // The queued keyframes are about to be dropped, their tasks must not outlive them
+    map<KeyFrame*, std::future<void> > mPending;
+    {
+        unique_lock<mutex> lock(mMutexNewKFs);
+        mPending.swap(mmSpeculativeWork);
+    }
+    for(map<KeyFrame*, std::future<void> >::iterator mit=mPending.begin(); mit!=mPending.end(); mit++)
+        mit->second.wait();
 }
 
 void LocalMapping::ProcessNewKeyFrame()
 {
+    ORB_TRACE_SCOPE("LocalMapping::ProcessNewKeyFrame");
+    std::future<void> speculative;
     {
         unique_lock<mutex> lock(mMutexNewKFs);
         mpCurrentKeyFrame = mlNewKeyFrames.front();
         mlNewKeyFrames.pop_front();
+        if(mpMetrics)
+            mpMetrics->SetGauge(Metrics::LOCAL_MAPPING_QUEUE, mlNewKeyFrames.size());
+        map<KeyFrame*, std::future<void> >::iterator mit = mmSpeculativeWork.find(mpCurrentKeyFrame);
+        if(mit!=mmSpeculativeWork.end())
+        {
+            speculative = std::move(mit->second);
+            mmSpeculativeWork.erase(mit);
+        }
     }
 
-    // Compute Bags of Words structures
+    // Compute Bags of Words structures (already done if the speculative task ran)
+    if(speculative.valid())
+        speculative.wait();
     mpCurrentKeyFrame->ComputeBoW();
 
     // Associate MapPoints to the new keyframe and update normal and descriptor
@@ -397,9 +699,25 @@ void LocalMapping::ProcessNewKeyFrame()
                 }
                 else // this can only happen for new stereo points inserted by the Tracking
                 {
-                    mlpRecentAddedMapPoints.push_back(pMP);
+                    // Tracking leaves them out of the map (no handle yet), they are added here
+                    if(!pMP->GetHandle().IsValid())
+                    {
+                        // Their normal and descriptor come from the left view only
+                        if(mpCurrentKeyFrame->NLeft != -1)
+                        {
+                            pMP->UpdateNormalAndDepth();
+                            pMP->ComputeDistinctiveDescriptors();
+                        }
+                        mpAtlas->AddMapPoint(pMP);
+                    }
+                    mlRecentAddedMapPoints.push_back(make_pair(pMP->GetMap(),pMP->GetHandle()));
                 }
             }
+            else
+            {
+                // No observation will erase it from this keyframe, it must not outlive the point
+                mpCurrentKeyFrame->EraseMapPointMatch(i);
+            }
         }
     }
 
@@ -420,10 +738,11 @@ void LocalMapping::EmptyQueue()
 
 void LocalMapping::MapPointCulling()
 {
+    ORB_TRACE_SCOPE("LocalMapping::MapPointCulling");
     // Check Recent Added MapPoints
-    // lit = mlpRecentAddedMapPoints의 시작 index
+    // lit = mlRecentAddedMapPoints의 시작 index
     // CurrentKFid = mpCurrentKeyFrame ID
-    list<MapPoint*>::iterator lit = mlpRecentAddedMapPoints.begin();
+    list<pair<Map*,EntityHandle> >::iterator lit = mlRecentAddedMapPoints.begin();
     const unsigned long int nCurrentKFid = mpCurrentKeyFrame->mnId;
 
     // nThObs = mbMonocular인 경우 2, 그 외에는 3
@@ -435,51 +754,52 @@ void LocalMapping::MapPointCulling()
         nThObs = 3;
     const int cnThObs = nThObs;
 
-    // borrar = mlpRecentAddedMapPoints의 사이즈를 저장
-    int borrar = mlpRecentAddedMapPoints.size();
+    // borrar = mlRecentAddedMapPoints의 사이즈를 저장
+    int borrar = mlRecentAddedMapPoints.size();
 
-    // lit이 mlpRecentAddedMapPoints의 마지막 index가 될떄까지  while문 수행
+    // lit이 mlRecentAddedMapPoints의 마지막 index가 될떄까지  while문 수행
 
 
     // *pMP = lit의 포인터 저장
     // pMP의 조건에 따라서 pMP와 lit 재정의
     // 1. pMP가 isBad인 경우
-    // -- 현재의 mlpRecentAddedMapPoints를 지우고 그 다음 index 반환
+    // -- 현재의 mlRecentAddedMapPoints를 지우고 그 다음 index 반환
 
     // 2. pMP의 GetFoundRatio가 0.25f
     // -- GetFoundRatio = mnFound/mnVisible
     // -- pMP를 SetBadFlag로 설정
-    // -- 현재의 mlpRecentAddedMapPoints를 지우고 그 다음 index 반환
+    // -- 현재의 mlRecentAddedMapPoints를 지우고 그 다음 index 반환
 
     // 3. CurrentKFid와 pMP의 mnFisrtKFid의 차이가 2 이상인 경우 && pMP의 Observations이 cnThObs보다 작은경우
     // -- pMP를 SetBadFlag로 설정
-    // -- 현재의 mlpRecentAddedMapPoints를 지우고 그 다음 index 반환
+    // -- 현재의 mlRecentAddedMapPoints를 지우고 그 다음 index 반환
 
     // 4. CurrentKFid와 pMP의 mnFisrtKFid의 차이가 3 이상인 경우
-    // -- 현재의 mlpRecentAddedMapPoints를 지우고 그 다음 index 반환
+    // -- 현재의 mlRecentAddedMapPoints를 지우고 그 다음 index 반환
 
     // 5. 그 이외 경우
     // lit 증가
     // borrar 감소
 
-    while(lit!=mlpRecentAddedMapPoints.end())
+    while(lit!=mlRecentAddedMapPoints.end())
     {
-        MapPoint* pMP = *lit;
+        //^ 이미 삭제(reclaim)된 map point일 수 있으므로 pointer 대신 handle로 확인
+        MapPoint* pMP = lit->first->GetMapPoint(lit->second);
 
-        if(pMP->isBad())
-            lit = mlpRecentAddedMapPoints.erase(lit);
+        if(!pMP || pMP->isBad())
+            lit = mlRecentAddedMapPoints.erase(lit);
         else if(pMP->GetFoundRatio()<0.25f)
         {
             pMP->SetBadFlag();
-            lit = mlpRecentAddedMapPoints.erase(lit);
+            lit = mlRecentAddedMapPoints.erase(lit);
         }
         else if(((int)nCurrentKFid-(int)pMP->mnFirstKFid)>=2 && pMP->Observations()<=cnThObs)
         {
             pMP->SetBadFlag();
-            lit = mlpRecentAddedMapPoints.erase(lit);
+            lit = mlRecentAddedMapPoints.erase(lit);
         }
         else if(((int)nCurrentKFid-(int)pMP->mnFirstKFid)>=3)
-            lit = mlpRecentAddedMapPoints.erase(lit);
+            lit = mlRecentAddedMapPoints.erase(lit);
         else
         {
             lit++;
@@ -491,6 +811,7 @@ void LocalMapping::MapPointCulling()
 
 void LocalMapping::CreateNewMapPoints()
 {
+    ORB_TRACE_SCOPE("LocalMapping::CreateNewMapPoints");
     // Stereo인 경우
     int nn = 10; // nn은 새로운 MapPoint를 생성하기 위하여 가져올 인접 keyframe의 개수
     
@@ -529,18 +850,6 @@ void LocalMapping::CreateNewMapPoints()
     // ORBmatcher의 threshold를 설정 (0.6)
     float th = 0.6f;
 
-    ORBmatcher matcher(th,false); // ORBmatcher 생성
-
-    auto Rcw1 = mpCurrentKeyFrame->GetRotation_();          // CurrentKeyframe의 Rotatiom matrix를 가져옴(3x3)
-    auto Rwc1 = Rcw1.t();                                   // transpose를 수행
-    auto tcw1 = mpCurrentKeyFrame->GetTranslation_();       // CurrentKeyframe의 translate matrix를 가져옴(3x1)
-    cv::Matx44f Tcw1{Rcw1(0,0),Rcw1(0,1),Rcw1(0,2),tcw1(0), // Transforamtion matirx을 생성 (4x4)
-                     Rcw1(1,0),Rcw1(1,1),Rcw1(1,2),tcw1(1),
-                     Rcw1(2,0),Rcw1(2,1),Rcw1(2,2),tcw1(2),
-                     0.f,0.f,0.f,1.f};
-
-    auto Ow1 = mpCurrentKeyFrame->GetCameraCenter_();       // Current Keyframe의 카메라 중심값을 가져옴
-
     // Getting intrinsic parameters of camera
     const float &fx1 = mpCurrentKeyFrame->fx;        // fx
     const float &fy1 = mpCurrentKeyFrame->fy;        // fy
@@ -553,13 +862,31 @@ void LocalMapping::CreateNewMapPoints()
 
     // Search matches with epipolar restriction and triangulate
     // 에피폴라 제한이 있는 검색 일치 및 삼각 측량
-    for(size_t i=0; i<vpNeighKFs.size(); i++) // 인접 keyframe만큼 반복문 수행
+    // 인접 keyframe마다 독립적으로 수행 (thread pool), map point 생성은 아래에서 순서대로 수행
+    const int nNeighKFs = vpNeighKFs.size();
+    vector<vector<pair<size_t,size_t> > > vvTriangulatedIdx(nNeighKFs);
+    vector<vector<cv::Matx31f> > vvTriangulatedX3D(nNeighKFs);
+
+    auto triangulate = [&](int i)
     {
-        if(i>0 && CheckNewKeyFrames()) // i가 0보다 작거나, 새로운 keyframe이 없으면 종료
+        if(i>0 && CheckNewKeyFrames()) // 새로운 keyframe이 들어오면 나머지 인접 keyframe은 생략
             return;
 
         KeyFrame* pKF2 = vpNeighKFs[i]; // 인접 keyframe을 가져옴
 
+        // One matcher and one copy of the current keyframe pose per task (the fisheye case switches camera)
+        ORBmatcher matcher(th,false); // ORBmatcher 생성
+
+        auto Rcw1 = mpCurrentKeyFrame->GetRotation_();          // CurrentKeyframe의 Rotatiom matrix를 가져옴(3x3)
+        auto Rwc1 = Rcw1.t();                                   // transpose를 수행
+        auto tcw1 = mpCurrentKeyFrame->GetTranslation_();       // CurrentKeyframe의 translate matrix를 가져옴(3x1)
+        cv::Matx44f Tcw1{Rcw1(0,0),Rcw1(0,1),Rcw1(0,2),tcw1(0), // Transforamtion matirx을 생성 (4x4)
+                         Rcw1(1,0),Rcw1(1,1),Rcw1(1,2),tcw1(1),
+                         Rcw1(2,0),Rcw1(2,1),Rcw1(2,2),tcw1(2),
+                         0.f,0.f,0.f,1.f};
+
+        auto Ow1 = mpCurrentKeyFrame->GetCameraCenter_();       // Current Keyframe의 카메라 중심값을 가져옴
+
         // pCamera1: CurrentKeyframe
         // pCamera2: Neighbor Keyframe
         GeometricCamera* pCamera1 = mpCurrentKeyFrame->mpCamera, *pCamera2 = pKF2->mpCamera;
@@ -576,7 +903,7 @@ void LocalMapping::CreateNewMapPoints()
         {
             // 인접 keyframe의 baseline이 초기 Baseline인 보다 작으면, Skip
             if(baseline<pKF2->mb) 
-            continue;
+            return;
         }
         // Mono 또는 Mono-IMU인 경우
         else
@@ -592,7 +919,7 @@ void LocalMapping::CreateNewMapPoints()
 
             // ratioBaselineDepth 값이 0.01보다 작으면 skip
             if(ratioBaselineDepth<0.01)
-                continue;
+                return;
         }
 
         // Compute Fundamental Matrix
@@ -638,6 +965,8 @@ void LocalMapping::CreateNewMapPoints()
 
         // Triangulate each match
         const int nmatches = vMatchedIndices.size(); // fundamental matrix를 이용하여 tracking에 실패한 point들을 재추적 정보
+        vvTriangulatedIdx[i].reserve(nmatches);
+        vvTriangulatedX3D[i].reserve(nmatches);
         for(int ikp=0; ikp<nmatches; ikp++)
         {
             const int &idx1 = vMatchedIndices[ikp].first;  // Prev KF의 point id
@@ -650,7 +979,7 @@ void LocalMapping::CreateNewMapPoints()
             //             false) Curr KF의 right->(idx1-currKF.NLeft) 의 KeysUn 값을 가져옴 // 어떤 의미인지 몰르겠음
             // mvKeysRight는 fisheye에서만 사용되는 변수 (//KeyPoints in the right image (for stereo fisheye, coordinates are needed))
             const cv::KeyPoint &kp1 = (mpCurrentKeyFrame -> NLeft == -1) ? mpCurrentKeyFrame->mvKeysUn[idx1]
-                                                                         : (idx1 < mpCurrentKeyFrame -> NLeft) ? mpCurrentKeyFrame -> mvKeys[idx1]
+                                                                         : (idx1 < mpCurrentKeyFrame -> NLeft) ? mpCurrentKeyFrame -> GetKeyPoint(idx1)
             
                                                                                                                : mpCurrentKeyFrame -> mvKeysRight[idx1 - mpCurrentKeyFrame -> NLeft];
             // mvuRight: negative value for monocular points
@@ -668,7 +997,7 @@ void LocalMapping::CreateNewMapPoints()
             //             false) Neighbor KF의 right->(idx2-NeighborKF.NLeft) 의 KeysUn 값을 가져옴 // 어떤 의미인지 몰르겠음
             // (return) = (조건문) ? (true) : (false)
             const cv::KeyPoint &kp2 = (pKF2 -> NLeft == -1) ? pKF2->mvKeysUn[idx2]
-                                                            : (idx2 < pKF2 -> NLeft) ? pKF2 -> mvKeys[idx2]
+                                                            : (idx2 < pKF2 -> NLeft) ? pKF2 -> GetKeyPoint(idx2)
                                                                                      : pKF2 -> mvKeysRight[idx2 - pKF2 -> NLeft];
 
             // mvuRight: negative value for monocular points
@@ -796,28 +1125,9 @@ void LocalMapping::CreateNewMapPoints()
                 // Cyrill Stachniss교수님 강의: https://www.youtube.com/watch?v=3NcQbZu6xt8                
                 // https://imkaywu.github.io/blog/2017/07/triangulation/                
                 // https://www.youtube.com/watch?v=oFZQykvEw14
-                cv::Matx14f A_r0 = xn1(0) * Tcw1.row(2) - Tcw1.row(0);
-                cv::Matx14f A_r1 = xn1(1) * Tcw1.row(2) - Tcw1.row(1);
-                cv::Matx14f A_r2 = xn2(0) * Tcw2.row(2) - Tcw2.row(0);
-                cv::Matx14f A_r3 = xn2(1) * Tcw2.row(2) - Tcw2.row(1);
-                cv::Matx44f A{A_r0(0), A_r0(1), A_r0(2), A_r0(3),
-                              A_r1(0), A_r1(1), A_r1(2), A_r1(3),
-                              A_r2(0), A_r2(1), A_r2(2), A_r2(3),
-                              A_r3(0), A_r3(1), A_r3(2), A_r3(3)};
-
-                cv::Matx44f u,vt;
-                cv::Matx41f w;                
-                cv::SVD::compute(A,w,u,vt,cv::SVD::MODIFY_A| cv::SVD::FULL_UV); // SVD 계산 (cv::SVD::FULL_UV는 u와 vt가 직교행렬 생성에 대한 flag)
-
-                cv::Matx41f x3D_h = vt.row(3).t(); // 3차원 x
-
-                if(x3D_h(3)==0)
+                // 4x4 SVD 대신 고정 크기 closed-form 계산 (Triangulator), 무한대 point는 제외
+                if(!Triangulator::Triangulate(Tcw1,Tcw2,cv::Point2f(xn1(0),xn1(1)),cv::Point2f(xn2(0),xn2(1)),x3D))
                     continue;
-
-                // Euclidean coordinates
-                x3D = x3D_h.get_minor<3,1>(0,0) / x3D_h(3); // [X Y Z 1]
-                // 위에랑 아래랑 같은 의미 코드 (opencv 버전에 따라서 위에 것이 컴파일이 안될 수도 있는데, 아래로 수정하면됨)
-                //x3D = cv::Matx31f(x3D_h.get_minor<3,1>(0,0)(0) / x3D_h(3), x3D_h.get_minor<3,1>(0,0)(1) /  x3D_h(3), x3D_h.get_minor<3,1>(0,0)(2) / x3D_h(3));
                 bEstimated = true;
 
             }
@@ -931,7 +1241,33 @@ void LocalMapping::CreateNewMapPoints()
 
             // Triangulation is succesfull
             // 지금까지 skip되지 않고 조건을 만족하면, 삼각측량 값을 3D mappint로 사용
-            cv::Mat x3D_(x3D);
+            vvTriangulatedIdx[i].push_back(make_pair(idx1,idx2));
+            vvTriangulatedX3D[i].push_back(x3D);
+        }
+    };
+
+    if(mpThreadPool && nNeighKFs>1)
+        mpThreadPool->ParallelFor(0, nNeighKFs, triangulate);
+    else
+        for(int i=0; i<nNeighKFs; i++)
+            triangulate(i);
+
+    // The points of this keyframe take consecutive free blocks of the pool
+    ObjectPool<MapPoint>::Instance().SortFreeList();
+
+    // Insert the new points in neighbor order. A keypoint of the current keyframe matched by several
+    // neighbors keeps the point of the first one, as in the serial search where it was already taken
+    for(int i=0; i<nNeighKFs; i++)
+    {
+        KeyFrame* pKF2 = vpNeighKFs[i];
+        for(size_t j=0, jend=vvTriangulatedIdx[i].size(); j<jend; j++)
+        {
+            const size_t idx1 = vvTriangulatedIdx[i][j].first;
+            const size_t idx2 = vvTriangulatedIdx[i][j].second;
+            if(mpCurrentKeyFrame->GetMapPoint(idx1) || pKF2->GetMapPoint(idx2))
+                continue;
+
+            cv::Mat x3D_(vvTriangulatedX3D[i][j]);
             MapPoint* pMP = new MapPoint(x3D_,mpCurrentKeyFrame,mpAtlas->GetCurrentMap());
 
             pMP->AddObservation(mpCurrentKeyFrame,idx1); // observation 값 추가 // 기존에 존재하는 map-point인지, 새로운 map-point인지 점검과정이 포함됨
@@ -947,13 +1283,14 @@ void LocalMapping::CreateNewMapPoints()
             pMP->UpdateNormalAndDepth();                 // 3D점에서 카메라까지의 normal vector와 depth값을 update
 
             mpAtlas->AddMapPoint(pMP);                   // Map point 추가 (AtlasMap)
-            mlpRecentAddedMapPoints.push_back(pMP);      // Map point 추가 (RecentMap)
+            mlRecentAddedMapPoints.push_back(make_pair(pMP->GetMap(),pMP->GetHandle()));      // Map point 추가 (RecentMap)
         }
     }
 }
 
 void LocalMapping::SearchInNeighbors()
 {
+    ORB_TRACE_SCOPE("LocalMapping::SearchInNeighbors");
     // Retrieve neighbor keyframes
     int nn = 10; //nn 10으로 초기화합니다. 
     if(mbMonocular) //monocular일때 nn을 20으로 초기화합니다. 
@@ -1018,13 +1355,46 @@ void LocalMapping::SearchInNeighbors()
 
     ORBmatcher matcher; //ORB matcher를 선언합니다. 
     vector<MapPoint*> vpMapPointMatches = mpCurrentKeyFrame->GetMapPointMatches(); //GetMapPointMatches를 vector로 저장하여 사용합니다. 
-    //해당 vector를 for문 돌립니다. 
-    for(vector<KeyFrame*>::iterator vit=vpTargetKFs.begin(), vend=vpTargetKFs.end(); vit!=vend; vit++)
+
+    // Target keyframes are fused in parallel (thread pool). Each task only adds observations to its own keyframe,
+    // the duplicated points are replaced afterwards in target order.
+    const int nTargetKFs = vpTargetKFs.size();
+    vector<vector<pair<MapPoint*,MapPoint*> > > vvReplacements(nTargetKFs);
+    auto fuseTarget = [&](int i)
     {
-        KeyFrame* pKFi = *vit; //각 N번째 target KF들을 사용합니다. 
+        KeyFrame* pKFi = vpTargetKFs[i]; //각 N번째 target KF들을 사용합니다. 
+        ORBmatcher matcherTarget;
+
+        matcherTarget.Fuse(pKFi,vpMapPointMatches,3.0,false,&vvReplacements[i]); //target KF과 MapPointMatches의 KF과 비교하여 중복되는 map point를 찾습니다. 
+        if(pKFi->NLeft != -1) matcherTarget.Fuse(pKFi,vpMapPointMatches,3.0,true,&vvReplacements[i]); //fisheye camera 일 경우입니다. 
+    };
 
-        matcher.Fuse(pKFi,vpMapPointMatches); //target KF과 MapPointMatches의 KF과 비교하여 중복되는 map point를 찾습니다. 
-        if(pKFi->NLeft != -1) matcher.Fuse(pKFi,vpMapPointMatches,true); //fisheye camera 일 경우입니다. 
+    if(mpThreadPool && nTargetKFs>1)
+        mpThreadPool->ParallelFor(0, nTargetKFs, fuseTarget);
+    else
+        for(int i=0; i<nTargetKFs; i++)
+            fuseTarget(i);
+
+    // A point may have been matched by several targets or already replaced by an earlier pair:
+    // follow the replacements and keep the point with more observations, as Fuse does
+    for(int i=0; i<nTargetKFs; i++)
+    {
+        for(size_t j=0, jend=vvReplacements[i].size(); j<jend; j++)
+        {
+            MapPoint* pMP = vvReplacements[i][j].first;
+            MapPoint* pMPinKF = vvReplacements[i][j].second;
+            while(pMP && pMP->isBad())
+                pMP = pMP->GetReplaced();
+            while(pMPinKF && pMPinKF->isBad())
+                pMPinKF = pMPinKF->GetReplaced();
+            if(!pMP || !pMPinKF || pMP==pMPinKF)
+                continue;
+
+            if(pMPinKF->Observations()>pMP->Observations())
+                pMP->Replace(pMPinKF);
+            else
+                pMPinKF->Replace(pMP);
+        }
     }
 
     if (mbAbortBA) //AbortBA flag가 true일때 종료합니다. 즉 새로운 keyframe이 들어오고있으면 return합니다. 
@@ -1119,6 +1489,8 @@ void LocalMapping::RequestStop()
     mbStopRequested = true;                 //local mapping을 중단하는 flag
     unique_lock<mutex> lock2(mMutexNewKFs);
     mbAbortBA = true;                       //new keyframe이 새로 insert될때 local mapping 기능을 중단하기 위한 flag
+    mbWakeUp = true;
+    mcvNewKFs.notify_one();
 }
 
 bool LocalMapping::Stop()
@@ -1127,6 +1499,7 @@ bool LocalMapping::Stop()
     if(mbStopRequested && !mbNotStop)       //requested가 true거나 Notstop이 false일때 실행됩니다. 
     {
         mbStopped = true;
+        mcvStop.notify_all();
         cout << "Local Mapping STOP" << endl;
         return true;
     }
@@ -1140,6 +1513,13 @@ bool LocalMapping::isStopped()
     return mbStopped;
 }
 
+void LocalMapping::WaitUntilStopped()
+{
+    ORB_TRACE_SCOPE("LocalMapping::WaitUntilStopped");
+    unique_lock<mutex> lock(mMutexStop);
+    mcvStop.wait(lock, [this]{ return mbStopped; });
+}
+
 bool LocalMapping::stopRequested()
 {
     unique_lock<mutex> lock(mMutexStop);
@@ -1154,8 +1534,14 @@ void LocalMapping::Release()
         return;
     mbStopped = false; //stop 관련 bool 타입 변수들을 전부 false처리합니다. 
     mbStopRequested = false;
+    mcvStop.notify_all();
+    WaitSpeculativeWork();
     for(list<KeyFrame*>::iterator lit = mlNewKeyFrames.begin(), lend=mlNewKeyFrames.end(); lit!=lend; lit++) //여태 들어온 keyframe을 삭제합니다. 
-        delete *lit;
+    {
+        if(mpTrajectoryStore)
+            mpTrajectoryStore->EraseKeyFrame(*lit);
+        EpochManager::Retire(*lit, (*lit)->GetMap()->GetReclaimGracePeriod());
+    }
     mlNewKeyFrames.clear(); //여태 들어온 keyframe에 속해있는 관련 data, information을 삭제합니다. 
 
     cout << "Local Mapping RELEASE" << endl; // local mapping한것이 release됩니다. 한국말로는 배포정도...?
@@ -1193,6 +1579,7 @@ void LocalMapping::InterruptBA()
 
 void LocalMapping::KeyFrameCulling()
 {
+    ORB_TRACE_SCOPE("LocalMapping::KeyFrameCulling");
     // Check redundant keyframes (only local keyframes)
     // A keyframe is considered redundant if the 90% of the MapPoints it sees, are seen
     // in at least other 3 keyframes (in the same or finer scale)
@@ -1221,7 +1608,6 @@ void LocalMapping::KeyFrameCulling()
         redundant_th = 0.5; // 중복되는 비율 0.5로 선언
 
     const bool bInitImu = mpAtlas->isImuInitialized();  // Atlas에 IMU 초기화가 되어있는지 bInitImu 변수로 확인
-    int count=0;    // KeyFrame의 갯수를 세는 변수
 
     // Compoute last KF from optimizable window:
     unsigned int last_ID;   // Last KeyFrame ID를 저장할 변수
@@ -1239,160 +1625,344 @@ void LocalMapping::KeyFrameCulling()
     }
 
 
-    // Local Key Frames를 for문을 활용하여 순회
-    for(vector<KeyFrame*>::iterator vit=vpLocalKeyFrames.begin(), vend=vpLocalKeyFrames.end(); vit!=vend; vit++)
+    // 최대 101개의 Local KeyFrame까지 확인 (mbAbortBA일 때는 21개)
+    const int nKFs = min(int(vpLocalKeyFrames.size()), 101);
+
+    // 중복 여부 확인은 Map을 읽기만 하므로 Key Frame마다 병렬로 진행
+    // 새로운 KeyFrame이 들어오거나 time budget을 넘으면 나머지 Key Frame은 확인하지 않고 유지
+    const std::chrono::steady_clock::time_point time_Start = std::chrono::steady_clock::now();
+    vector<char> vbChecked(nKFs,false);
+    vector<char> vbRedundant(nKFs,false);
+    std::atomic<bool> bAbort(false);
+
+    auto checkKF = [&](int i)
     {
-        count++;    // count를 1 증가
-        KeyFrame* pKF = *vit;
+        if(bAbort)
+            return;
+        if((i>20 && mbAbortBA) || (mThKFCullingBudget>0 &&
+           std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(std::chrono::steady_clock::now()-time_Start).count()>mThKFCullingBudget))
+        {
+            bAbort = true;
+            return;
+        }
 
-        if((pKF->mnId==pKF->GetMap()->GetInitKFid()) || pKF->isBad())   // Init Key Frame ID이거나 KeyFrame이 Bad일 경우
-            continue;   // Skip
-        const vector<MapPoint*> vpMapPoints = pKF->GetMapPointMatches();    // KeyFrame에서 관찰된 Map Points들을 벡터로 저장
+        KeyFrame* pKF = vpLocalKeyFrames[i];
+        if((pKF->mnId!=pKF->GetMap()->GetInitKFid()) && !pKF->isBad())   // Init Key Frame ID이거나 KeyFrame이 Bad일 경우 Skip
+            vbRedundant[i] = IsRedundantKeyFrame(pKF, redundant_th);
+        vbChecked[i] = true;
+    };
+
+    if(mpThreadPool && nKFs>1)
+        mpThreadPool->ParallelFor(0, nKFs, checkKF);
+    else
+        for(int i=0; i<nKFs; i++)
+            checkKF(i);
 
-        int nObs = 3;   // Observation 갯수 선언
-        const int thObs=nObs;   // Observation Threshold 갯수 선언
-        int nRedundantObservations=0;   // 중복되는 Observation을 Count하기 위한 변수
-        int nMPs=0; // Map Point의 갯수를 Count하기 위한 변수
+    // 결정을 Local Key Frames 순서대로 적용. 앞에서 제거된 Key Frame이 있으면 Map Point의 Observation이
+    // 줄었으므로 중복 여부를 다시 확인 (직렬 처리와 같은 결과)
+    int nCulled = 0;
+    for(int i=0; i<nKFs; i++)
+    {
+        if(!vbChecked[i] || !vbRedundant[i])
+            continue;
+
+        KeyFrame* pKF = vpLocalKeyFrames[i];
+        if(pKF->isBad())
+            continue;
+        if(nCulled>0 && !IsRedundantKeyFrame(pKF, redundant_th))
+            continue;
 
-        // for문을 활용하여 Key Frame에서 관찰된 Map point 순회
-        for(size_t i=0, iend=vpMapPoints.size(); i<iend; i++)
+        if (mbInertial) // IMU를 사용할 경우
         {
-            MapPoint* pMP = vpMapPoints[i]; // 하나의 Map Point를 포인터로 가르킨다.
-            if(pMP)
+            if (mpAtlas->KeyFramesInMap()<=Nd)  // Atlas에 있는 Key Frame의 갯수를 가져와서 Nd(LIBA와 같은 KeyFrame의 갯수)와 비교
+            // Atlas에 있는 KeyFrame의 갯수가 Nd보다 더 작거나 같은 경우
+                continue;   // Skip
+
+            if(pKF->mnId > (mpCurrentKeyFrame->mnId-2)) // Key Frame의 ID가 Current Key Frame의 ID -2 보다 큰 경우
+                continue;   // Skip
+
+            if(pKF->mPrevKF && pKF->mNextKF)    // Prev Key Frame과 Next Key Frame이 모두 존재한다면
             {
-                if(!pMP->isBad())   // Map Point가 Bad가 아니라면
+                const float t = pKF->mNextKF->mTimeStamp-pKF->mPrevKF->mTimeStamp;  
+                // Next KeyFrame의 Timestamp와 Prev KeyFrame의 Timestamp의 차이 계산
+
+                if((bInitImu && (pKF->mnId<last_ID) && t<3.) || (t<0.5))
+                // IMU 초기화를 완료한 상태이고, KeyFrame의 ID가 last_ID보다 작고, Timestamp가 3 미만일 경우이거나,
+                // Timestamp가 0.5 미만일 경우 (Prev KeyFrame과 Next KeyFrame이 너무 차이가 없을 경우)
                 {
-                    if(!mbMonocular)    // Monocular mode가 아닐 경우
-                    {
-                        if(pKF->mvDepth[i]>pKF->mThDepth || pKF->mvDepth[i]<0)  //Depth값이 부정확할 때 (Threshold Depth보다 크거나, 0보다 작을 때)
-                            continue;   // Skip
-                    }
+                    // KeyFrame 제거
+                    pKF->mNextKF->mpImuPreintegrated->MergePrevious(pKF->mpImuPreintegrated);
+                    pKF->mNextKF->mPrevKF = pKF->mPrevKF;
+                    pKF->mPrevKF->mNextKF = pKF->mNextKF;
+                    pKF->mNextKF = NULL;
+                    pKF->mPrevKF = NULL;
+                    pKF->SetBadFlag();  // Key Frame의 Graph와 관련된 값들을 모두 Erase (Weight, Observation, Parent 등등..) 
+                    nCulled++;
+                }
+                else if(!mpCurrentKeyFrame->GetMap()->GetIniertialBA2() && (cv::norm(pKF->GetImuPosition()-pKF->mPrevKF->GetImuPosition())<0.02) && (t<3))
+                // KeyFrame이 존재하는 Map에 Inertial BA2가 되어 있지 않고,
+                // 현재 IMU position과 이전 IMU position에 대한 Norm값이 0.02미만이고,
+                // Timestamp의 값이 3미만일 경우
+                {
+                    // KeyFrame 제거
+                    pKF->mNextKF->mpImuPreintegrated->MergePrevious(pKF->mpImuPreintegrated);
+                    pKF->mNextKF->mPrevKF = pKF->mPrevKF;
+                    pKF->mPrevKF->mNextKF = pKF->mNextKF;
+                    pKF->mNextKF = NULL;
+                    pKF->mPrevKF = NULL;
+                    pKF->SetBadFlag();  // Key Frame의 Graph와 관련된 값들을 모두 Erase (Weight, Observation, Parent 등등..) 
+                    nCulled++;
+                }
+            }
+        }
+        else    // IMU를 사용하지 않을 경우
+        {
+            pKF->SetBadFlag();  // Key Frame의 Graph와 관련된 값들을 모두 Erase (Weight, Observation, Parent 등등..) 
+            nCulled++;
+        }
+    }
+}
 
-                    nMPs++; // Map Point 갯수 1 증가
+void LocalMapping::EnforceMapBudget()
+{
+    ORB_TRACE_SCOPE("LocalMapping::EnforceMapBudget");
+
+    // Removed per call, the budget is reached over a few keyframes instead of stalling one
+    const int MAX_BUDGET_KEYFRAMES = 5;
+    const int MAX_BUDGET_MAPPOINTS = 2000;
+    // Keyframes of the local inertial BA window, and their points, are never removed
+    const int Nd = 21;
+
+    Map* pMap = mpCurrentKeyFrame->GetMap();
+    const unsigned long nWindowStart = mpCurrentKeyFrame->mnId>Nd ? mpCurrentKeyFrame->mnId-Nd : 0;
+    const bool bInitImu = pMap->isImuInitialized();
+    const unsigned long nInitKFid = pMap->GetInitKFid();
+    KeyFrame* pOriginKF = pMap->GetOriginKF();
+
+    // Tracking works on the covisible keyframes of the current one, they are kept as well
+    vector<KeyFrame*> vpLocalKFs = mpCurrentKeyFrame->GetVectorCovisibleKeyFrames();
+    vpLocalKFs.push_back(mpCurrentKeyFrame);
+    const unordered_set<KeyFrame*> sLocalKFs(vpLocalKFs.begin(), vpLocalKFs.end());
+
+    if(mnMaxKeyFrames>0 && (int)pMap->KeyFramesInMap()>mnMaxKeyFrames)
+    {
+        const Map::KeyFramesSnapshot pKFs = pMap->GetKeyFramesSnapshot();
+        vector<KeyFrame*> vpCandidates;
+        vpCandidates.reserve(pKFs->size());
+        for(KeyFrame* pKF : *pKFs)
+        {
+            if(pKF->isBad() || pKF->mnId>=nWindowStart || pKF->mnId==nInitKFid || pKF==pOriginKF || sLocalKFs.count(pKF))
+                continue;
+            // Inertial keyframes leave the IMU chain: the preintegration of the next one spans both
+            if(mbInertial && (!pKF->mPrevKF || !pKF->mNextKF || pKF->mNextKF->mTimeStamp-pKF->mPrevKF->mTimeStamp>=(bInitImu ? 3.0 : 0.5)))
+                continue;
+            vpCandidates.push_back(pKF);
+        }
 
-                    if(pMP->Observations()>thObs)   
-                    // Map Point의 Observation이 (하나의 Map point가 서로 다른 Key Frame에서 관찰되는 수) Threshold보다 클 때
-                    {
-                        // 현재 Key Frame의 ScaleLevel (이미지에서 scale) 값을 가져온다. 참고 - Scale Space와 이미지 피라미드(image pyramid) [https://www.whydsp.org/247]
-                        // 참고 그림 - https://en.wikipedia.org/wiki/Pyramid_(image_processing)#/media/File:Image_pyramid.svg
-                        // NLeft는 KeyPoint를 담고 있는 벡터의 갯수
-                        // 만역 Key Frmae에서 KeyPoint를 담고 있는 벡터의 갯수가 -1 (없다면) Undistorted Keypoint의 octave를 scaleLevel로 대입
-                        //      i(iterator를 돌고 있는 Map point)가 KeyFrame의 NLeft보다 작을 경우 i번째 MapPoint가 관찰된 octave를 저장
-                        //          그렇지 않을 경우 mvKeysRight(Right image에서 관찰된 Map point)의 octave를 대입
-                        const int &scaleLevel = (pKF -> NLeft == -1) ? pKF->mvKeysUn[i].octave
-                                                                     : (i < pKF -> NLeft) ? pKF -> mvKeys[i].octave
-                                                                                          : pKF -> mvKeysRight[i].octave;
-                        
-                        // Current Frame의 Map point를 관찰하고 있는 여러 Keyframe을 observation 변수를 이용하여 저장
-                        const map<KeyFrame*, tuple<int,int>> observations = pMP->GetObservations();
+        // 기여도 계산은 Map을 읽기만 하므로 Key Frame마다 병렬로 진행
+        const int nCandidates = vpCandidates.size();
+        vector<pair<int,KeyFrame*> > vContributions(nCandidates);
+        auto scoreKF = [&](int i)
+        {
+            vContributions[i] = make_pair(KeyFrameContribution(vpCandidates[i]), vpCandidates[i]);
+        };
+        if(mpThreadPool && nCandidates>1)
+            mpThreadPool->ParallelFor(0, nCandidates, scoreKF);
+        else
+            for(int i=0; i<nCandidates; i++)
+                scoreKF(i);
 
-                        int nObs=0; // Observation 갯수 선언
+        const int nExcess = min((int)pMap->KeyFramesInMap()-mnMaxKeyFrames, MAX_BUDGET_KEYFRAMES);
+        const int nSelected = min(nExcess, nCandidates);
+        partial_sort(vContributions.begin(), vContributions.begin()+nSelected, vContributions.end(),
+                     [](const pair<int,KeyFrame*> &a, const pair<int,KeyFrame*> &b){ return a.first<b.first || (a.first==b.first && a.second->mnId<b.second->mnId); });
 
-                        // 하나의 Map point를 관찰하고 있는 KeyFrame에 대해서 Observation이라는 구조를 활용하여 순회
-                        for(map<KeyFrame*, tuple<int,int>>::const_iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
-                        {
-                            KeyFrame* pKFi = mit->first;    // Map point를 관찰하고 있는 Key Frame을 pointer로 선언
-                            if(pKFi==pKF)   // Line 1030에서 선언한 Key Frame과 같은 Key Frame일 경우
-                                continue;   // Skip
-
-                            tuple<int,int> indexes = mit->second;
-                            int leftIndex = get<0>(indexes), rightIndex = get<1>(indexes);
-
-                            // Index를 활용하여 ScaleLeveli를 계산
-                            // NLeft == -1 일 때, Undistorted Keypoints를 활용
-                            // leftIndex != -1 일 때, Keypoints를 활용
-                            // rightIndex != -1 일 때, Right Keypoints를 활용
-                            int scaleLeveli = -1;
-                            if(pKFi -> NLeft == -1)
-                                scaleLeveli = pKFi->mvKeysUn[leftIndex].octave;
-                            else {
-                                if (leftIndex != -1) {
-                                    scaleLeveli = pKFi->mvKeys[leftIndex].octave;
-                                }
-                                if (rightIndex != -1) {
-                                    int rightLevel = pKFi->mvKeysRight[rightIndex - pKFi->NLeft].octave;
-                                    scaleLeveli = (scaleLeveli == -1 || scaleLeveli > rightLevel) ? rightLevel
-                                                                                                  : scaleLeveli;
-                                }
-                            }
+        // 앞에서 제거된 Key Frame이 이웃이면 Map Point의 observation이 줄었으므로 기여도를 다시 확인
+        for(int i=0; i<nSelected; i++)
+        {
+            KeyFrame* pKF = vContributions[i].second;
+            if(pKF->isBad() || (i>0 && KeyFrameContribution(pKF)>vContributions[nSelected-1].first))
+                continue;
 
-                            if(scaleLeveli<=scaleLevel+1)   // ScaleLeveli가 현재 Key Frame의 ScaleLevel + 1보다 이하일 경우
-                            {
-                                nObs++; // Observation 갯수 1 증가
-                                if(nObs>thObs)  // Observation 갯수가 3을 초과할 경우
-                                    break;  // Observation에 대한 for문을 빠져나온다.
-                            }
-                        }
+            if(mbInertial)
+            {
+                pKF->mNextKF->mpImuPreintegrated->MergePrevious(pKF->mpImuPreintegrated);
+                pKF->mNextKF->mPrevKF = pKF->mPrevKF;
+                pKF->mPrevKF->mNextKF = pKF->mNextKF;
+                pKF->mNextKF = NULL;
+                pKF->mPrevKF = NULL;
+            }
+            // Spanning tree, covisibility, essential graph and keyframe database are updated here
+            pKF->SetBadFlag();
+        }
+    }
 
+    if(mnMaxMapPoints>0 && (int)pMap->MapPointsInMap()>mnMaxMapPoints)
+    {
+        unordered_set<MapPoint*> sLocalMPs;
+        for(KeyFrame* pKF : vpLocalKFs)
+        {
+            const vector<MapPoint*> vpMPs = pKF->GetMapPointMatches();
+            sLocalMPs.insert(vpMPs.begin(), vpMPs.end());
+        }
 
-                        if(nObs>thObs)  // Observation 갯수가 3을 초과할 경우
-                        {
-                            nRedundantObservations++;   // 중복되는 Observation을 Count 1 증가
-                        }
-                    }
-                }
-            }
-        }   // Map point 순회에 대한 for문에 대한 괄호
+        // Least observed points first, then the ones least often found when they were visible
+        const Map::MapPointsSnapshot pMPs = pMap->GetMapPointsSnapshot();
+        vector<pair<pair<int,float>,MapPoint*> > vCandidates;
+        vCandidates.reserve(pMPs->size());
+        for(MapPoint* pMP : *pMPs)
+        {
+            if(pMP->isBad() || pMP->mnFirstKFid>=(long int)nWindowStart || sLocalMPs.count(pMP))
+                continue;
+            vCandidates.push_back(make_pair(make_pair(pMP->Observations(), pMP->GetFoundRatio()), pMP));
+        }
+
+        const int nExcess = min((int)pMap->MapPointsInMap()-mnMaxMapPoints, MAX_BUDGET_MAPPOINTS);
+        const int nSelected = min(nExcess, (int)vCandidates.size());
+        partial_sort(vCandidates.begin(), vCandidates.begin()+nSelected, vCandidates.end(),
+                     [](const pair<pair<int,float>,MapPoint*> &a, const pair<pair<int,float>,MapPoint*> &b){ return a.first<b.first; });
+        for(int i=0; i<nSelected; i++)
+            vCandidates[i].second->SetBadFlag();
+    }
+}
+
+int LocalMapping::KeyFrameContribution(KeyFrame* pKF)
+{
+    const int thObs = 3;
+    const vector<MapPoint*> vpMapPoints = pKF->GetMapPointMatches();
+
+    int nContribution = 0;
+    for(size_t i=0, iend=vpMapPoints.size(); i<iend; i++)
+    {
+        MapPoint* pMP = vpMapPoints[i];
+        if(pMP && !pMP->isBad() && pMP->Observations()<=thObs)
+            nContribution++;
+    }
+    return nContribution;
+}
+
+void LocalMapping::ProcessDeferredWork()
+{
+    ORB_TRACE_SCOPE("LocalMapping::ProcessDeferredWork");
+    const DeferredWork work = mlDeferredWork.front();
+    mlDeferredWork.pop_front();
+
+    KeyFrame* pKF = work.pKF;
+    if(pKF->isBad() || pKF->GetMap()!=mpAtlas->GetCurrentMap())
+        return;
 
-        // 중복되는 Observation의 갯수가 중복되는 비율 * Map Point의 갯수를 넘을 때  
-        // 증복되는 Key Frame을 제거하는 과정
-        if(nRedundantObservations>redundant_th*nMPs)
+    // SearchInNeighbors and KeyFrameCulling work on mpCurrentKeyFrame
+    KeyFrame* pCurrentKF = mpCurrentKeyFrame;
+    mpCurrentKeyFrame = pKF;
+    mbAbortBA = false;  // 새로운 KeyFrame이 들어오면 InsertKeyFrame에서 true가 되어 중단됩니다.
+
+    if(work.bFuse)
+    {
+        const LocalMappingScheduler::Clock::time_point time_StartFuse = LocalMappingScheduler::Clock::now();
+        SearchInNeighbors();
+        mpScheduler->Record(LocalMappingScheduler::SEARCH_IN_NEIGHBORS, time_StartFuse);
+    }
+    if(work.bCull && !CheckNewKeyFrames())
+    {
+        const LocalMappingScheduler::Clock::time_point time_StartCulling = LocalMappingScheduler::Clock::now();
+        KeyFrameCulling();
+        mpScheduler->Record(LocalMappingScheduler::KEYFRAME_CULLING, time_StartCulling);
+    }
+
+    mpCurrentKeyFrame = pCurrentKF;
+}
+
+bool LocalMapping::IsRedundantKeyFrame(KeyFrame* pKF, const float redundant_th)
+{
+    const vector<MapPoint*> vpMapPoints = pKF->GetMapPointMatches();    // KeyFrame에서 관찰된 Map Points들을 벡터로 저장
+
+    int nObs = 3;   // Observation 갯수 선언
+    const int thObs=nObs;   // Observation Threshold 갯수 선언
+    int nRedundantObservations=0;   // 중복되는 Observation을 Count하기 위한 변수
+    int nMPs=0; // Map Point의 갯수를 Count하기 위한 변수
+
+    // for문을 활용하여 Key Frame에서 관찰된 Map point 순회
+    for(size_t i=0, iend=vpMapPoints.size(); i<iend; i++)
+    {
+        MapPoint* pMP = vpMapPoints[i]; // 하나의 Map Point를 포인터로 가르킨다.
+        if(pMP)
         {
-            if (mbInertial) // IMU를 사용할 경우
+            if(!pMP->isBad())   // Map Point가 Bad가 아니라면
             {
-                if (mpAtlas->KeyFramesInMap()<=Nd)  // Atlas에 있는 Key Frame의 갯수를 가져와서 Nd(LIBA와 같은 KeyFrame의 갯수)와 비교
-                // Atlas에 있는 KeyFrame의 갯수가 Nd보다 더 작거나 같은 경우
-                    continue;   // Skip
+                if(!mbMonocular)    // Monocular mode가 아닐 경우
+                {
+                    if(pKF->mvDepth[i]>pKF->mThDepth || pKF->mvDepth[i]<0)  //Depth값이 부정확할 때 (Threshold Depth보다 크거나, 0보다 작을 때)
+                        continue;   // Skip
+                }
 
-                if(pKF->mnId > (mpCurrentKeyFrame->mnId-2)) // Key Frame의 ID가 Current Key Frame의 ID -2 보다 큰 경우
-                    continue;   // Skip
+                nMPs++; // Map Point 갯수 1 증가
 
-                if(pKF->mPrevKF && pKF->mNextKF)    // Prev Key Frame과 Next Key Frame이 모두 존재한다면
+                if(pMP->Observations()>thObs)   
+                // Map Point의 Observation이 (하나의 Map point가 서로 다른 Key Frame에서 관찰되는 수) Threshold보다 클 때
                 {
-                    const float t = pKF->mNextKF->mTimeStamp-pKF->mPrevKF->mTimeStamp;  
-                    // Next KeyFrame의 Timestamp와 Prev KeyFrame의 Timestamp의 차이 계산
-
-                    if((bInitImu && (pKF->mnId<last_ID) && t<3.) || (t<0.5))
-                    // IMU 초기화를 완료한 상태이고, KeyFrame의 ID가 last_ID보다 작고, Timestamp가 3 미만일 경우이거나,
-                    // Timestamp가 0.5 미만일 경우 (Prev KeyFrame과 Next KeyFrame이 너무 차이가 없을 경우)
+                    // 현재 Key Frame의 ScaleLevel (이미지에서 scale) 값을 가져온다. 참고 - Scale Space와 이미지 피라미드(image pyramid) [https://www.whydsp.org/247]
+                    // 참고 그림 - https://en.wikipedia.org/wiki/Pyramid_(image_processing)#/media/File:Image_pyramid.svg
+                    // NLeft는 KeyPoint를 담고 있는 벡터의 갯수
+                    // 만역 Key Frmae에서 KeyPoint를 담고 있는 벡터의 갯수가 -1 (없다면) Undistorted Keypoint의 octave를 scaleLevel로 대입
+                    //      i(iterator를 돌고 있는 Map point)가 KeyFrame의 NLeft보다 작을 경우 i번째 MapPoint가 관찰된 octave를 저장
+                    //          그렇지 않을 경우 mvKeysRight(Right image에서 관찰된 Map point)의 octave를 대입
+                    const int &scaleLevel = (pKF -> NLeft == -1) ? pKF->mvKeysUn[i].octave
+                                                                 : (i < pKF -> NLeft) ? pKF -> GetKeyPoint(i).octave
+                                                                                      : pKF -> mvKeysRight[i].octave;
+                    
+                    // Current Frame의 Map point를 관찰하고 있는 여러 Keyframe을 observation 변수를 이용하여 저장
+                    const ObservationMap observations = pMP->GetObservations();
+
+                    int nObs=0; // Observation 갯수 선언
+
+                    // 하나의 Map point를 관찰하고 있는 KeyFrame에 대해서 Observation이라는 구조를 활용하여 순회
+                    for(ObservationMap::const_iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
                     {
-                        // KeyFrame 제거
-                        pKF->mNextKF->mpImuPreintegrated->MergePrevious(pKF->mpImuPreintegrated);
-                        pKF->mNextKF->mPrevKF = pKF->mPrevKF;
-                        pKF->mPrevKF->mNextKF = pKF->mNextKF;
-                        pKF->mNextKF = NULL;
-                        pKF->mPrevKF = NULL;
-                        pKF->SetBadFlag();  // Key Frame의 Graph와 관련된 값들을 모두 Erase (Weight, Observation, Parent 등등..) 
+                        KeyFrame* pKFi = mit->first;    // Map point를 관찰하고 있는 Key Frame을 pointer로 선언
+                        if(pKFi==pKF)   // Line 1030에서 선언한 Key Frame과 같은 Key Frame일 경우
+                            continue;   // Skip
+
+                        tuple<int,int> indexes = mit->second;
+                        int leftIndex = get<0>(indexes), rightIndex = get<1>(indexes);
+
+                        // Index를 활용하여 ScaleLeveli를 계산
+                        // NLeft == -1 일 때, Undistorted Keypoints를 활용
+                        // leftIndex != -1 일 때, Keypoints를 활용
+                        // rightIndex != -1 일 때, Right Keypoints를 활용
+                        int scaleLeveli = -1;
+                        if(pKFi -> NLeft == -1)
+                            scaleLeveli = pKFi->mvKeysUn[leftIndex].octave;
+                        else {
+                            if (leftIndex != -1) {
+                                scaleLeveli = pKFi->GetKeyPoint(leftIndex).octave;
+                            }
+                            if (rightIndex != -1) {
+                                int rightLevel = pKFi->mvKeysRight[rightIndex - pKFi->NLeft].octave;
+                                scaleLeveli = (scaleLeveli == -1 || scaleLeveli > rightLevel) ? rightLevel
+                                                                                              : scaleLeveli;
+                            }
+                        }
+
+                        if(scaleLeveli<=scaleLevel+1)   // ScaleLeveli가 현재 Key Frame의 ScaleLevel + 1보다 이하일 경우
+                        {
+                            nObs++; // Observation 갯수 1 증가
+                            if(nObs>thObs)  // Observation 갯수가 3을 초과할 경우
+                                break;  // Observation에 대한 for문을 빠져나온다.
+                        }
                     }
-                    else if(!mpCurrentKeyFrame->GetMap()->GetIniertialBA2() && (cv::norm(pKF->GetImuPosition()-pKF->mPrevKF->GetImuPosition())<0.02) && (t<3))
-                    // KeyFrame이 존재하는 Map에 Inertial BA2가 되어 있지 않고,
-                    // 현재 IMU position과 이전 IMU position에 대한 Norm값이 0.02미만이고,
-                    // Timestamp의 값이 3미만일 경우
+
+
+                    if(nObs>thObs)  // Observation 갯수가 3을 초과할 경우
                     {
-                        // KeyFrame 제거
-                        pKF->mNextKF->mpImuPreintegrated->MergePrevious(pKF->mpImuPreintegrated);
-                        pKF->mNextKF->mPrevKF = pKF->mPrevKF;
-                        pKF->mPrevKF->mNextKF = pKF->mNextKF;
-                        pKF->mNextKF = NULL;
-                        pKF->mPrevKF = NULL;
-                        pKF->SetBadFlag();  // Key Frame의 Graph와 관련된 값들을 모두 Erase (Weight, Observation, Parent 등등..) 
+                        nRedundantObservations++;   // 중복되는 Observation을 Count 1 증가
                     }
                 }
             }
-            else    // IMU를 사용하지 않을 경우
-            {
-                pKF->SetBadFlag();  // Key Frame의 Graph와 관련된 값들을 모두 Erase (Weight, Observation, Parent 등등..) 
-            }
         }
+    }   // Map point 순회에 대한 for문에 대한 괄호
 
-
-        if((count > 20 && mbAbortBA) || count>100)  // count는 Local KeyFrame에 대한 for문을 돌 때마다 1증가 (Line 1029)
-        // 20번 이상 KeyFrame에 대한 for문을 돌면서 mbAbortBA값이 true인 경우이거나
-        // 100번 이상 KeyFrame에 대한 for문을 돈 경우
-        {
-            break;  // Local Key Frames를 순회하는 for문을 빠져 나온다.
-        }
-    }
+    // 중복되는 Observation의 갯수가 중복되는 비율 * Map Point의 갯수를 넘을 때 중복되는 Key Frame
+    return nRedundantObservations>redundant_th*nMPs;
 }
 
 
@@ -1440,16 +2010,12 @@ void LocalMapping::RequestReset()
         cout << "LM: Map reset recieved" << endl;
         mbResetRequested = true;
     }
+    WakeUp();
     cout << "LM: Map reset, waiting..." << endl;
 
-    while(1)
     {
-        {
-            unique_lock<mutex> lock2(mMutexReset);
-            if(!mbResetRequested)
-                break;
-        }
-        usleep(3000);
+        unique_lock<mutex> lock2(mMutexReset);
+        mcvReset.wait(lock2, [this]{ return !mbResetRequested; });
     }
     cout << "LM: Map reset, Done!!!" << endl;
 }
@@ -1465,16 +2031,12 @@ void LocalMapping::RequestResetActiveMap(Map* pMap)
         //^ LocalMapping에서는 이 pMap이 따로 사용되지는 않음.
         mpMapToReset = pMap;
     }
+    WakeUp();
     cout << "LM: Active map reset, waiting..." << endl;
 
-    while(1)
     {
-        {
-            unique_lock<mutex> lock2(mMutexReset);
-            if(!mbResetRequestedActiveMap)
-                break;
-        }
-        usleep(3000);
+        unique_lock<mutex> lock2(mMutexReset);
+        mcvReset.wait(lock2, [this]{ return !mbResetRequestedActiveMap; });
     }
     cout << "LM: Active map reset, Done!!!" << endl;
 }
@@ -1483,7 +2045,7 @@ void LocalMapping::ResetIfRequested()
 {
     //^ Reset이 하는 일
     //^ 1. Inertial parameter 초기화
-    //^ 2. mlNewKeyFrames, mlpRecentAddedMapPoints clear
+    //^ 2. mlNewKeyFrames, mlRecentAddedMapPoints clear
     bool executed_reset = false;
     {
         unique_lock<mutex> lock(mMutexReset);
@@ -1496,8 +2058,11 @@ void LocalMapping::ResetIfRequested()
 
             cout << "LM: Reseting Atlas in Local Mapping..." << endl;
             
+            WaitSpeculativeWork();
             mlNewKeyFrames.clear();
-            mlpRecentAddedMapPoints.clear();
+            mlRecentAddedMapPoints.clear();
+            mlDeferredWork.clear();
+            mpLocalBAGraph->Clear();
             mbResetRequested=false;
             mbResetRequestedActiveMap = false;
 
@@ -1519,8 +2084,11 @@ void LocalMapping::ResetIfRequested()
         if(mbResetRequestedActiveMap) {
             executed_reset = true;
             cout << "LM: Reseting current map in Local Mapping..." << endl;
+            WaitSpeculativeWork();
             mlNewKeyFrames.clear();
-            mlpRecentAddedMapPoints.clear();
+            mlRecentAddedMapPoints.clear();
+            mlDeferredWork.clear();
+            mpLocalBAGraph->Clear();
 
             // Inertial parameters
             mTinit = 0.f;
@@ -1533,14 +2101,25 @@ void LocalMapping::ResetIfRequested()
         }
     }
     if(executed_reset)
+    {
+        mcvReset.notify_all();
         cout << "LM: Reset free the mutex" << endl;
+    }
 
 }
 
 void LocalMapping::RequestFinish()
 {
-    unique_lock<mutex> lock(mMutexFinish);
-    mbFinishRequested = true;
+    {
+        unique_lock<mutex> lock(mMutexFinish);
+        mbFinishRequested = true;
+    }
+    WakeUp();
+    {
+        // A stopped Run() waits on mcvStop
+        unique_lock<mutex> lock(mMutexStop);
+        mcvStop.notify_all();
+    }
 }
 
 bool LocalMapping::CheckFinish()
@@ -1555,6 +2134,7 @@ void LocalMapping::SetFinish()
     mbFinished = true;    
     unique_lock<mutex> lock2(mMutexStop);
     mbStopped = true;
+    mcvStop.notify_all();
 }
 
 bool LocalMapping::isFinished()
@@ -1565,6 +2145,7 @@ bool LocalMapping::isFinished()
 
 void LocalMapping::InitializeIMU(float priorG, float priorA, bool bFIBA)
 {
+    ORB_TRACE_SCOPE("LocalMapping::InitializeIMU");
     if (mbResetRequested)   // Map Reset이 Request된 경우
         return;     // InitialzieIMU 수행 끝
 
@@ -1582,7 +2163,12 @@ void LocalMapping::InitializeIMU(float priorG, float priorA, bool bFIBA)
         nMinKF = 10;
     }
 
-    if(mpAtlas->KeyFramesInMap()<nMinKF)    // Map에 존재하는 Key Frame의 갯수가 nMinKF보다 작을 경우
+    // 첫 초기화는 closed-form 초기화가 성공하면 더 일찍 끝날 수 있다 (실패하면 minTime까지 기다린 후 기존 방법으로)
+    const bool bFastInit = mFastImuInitTime>0.f && !mpCurrentKeyFrame->GetMap()->isImuInitialized();
+    const float minTimeInit = bFastInit ? std::min(mFastImuInitTime,minTime) : minTime;
+    const int nMinKFInit = bFastInit ? 5 : nMinKF;
+
+    if(mpAtlas->KeyFramesInMap()<nMinKFInit)    // Map에 존재하는 Key Frame의 갯수가 nMinKF보다 작을 경우
         return;    // InitialzieIMU 수행 끝
 
     // Retrieve all keyframe in temporal order
@@ -1596,13 +2182,13 @@ void LocalMapping::InitializeIMU(float priorG, float priorA, bool bFIBA)
     lpKF.push_front(pKF);
     vector<KeyFrame*> vpKF(lpKF.begin(),lpKF.end());    // list에 담을 KeyFrame을 Vector 자료구조를 이용해서 담는다.
 
-    if(vpKF.size()<nMinKF)  // vpKF의 갯수가 최소 KeyFrame의 갯수보다 작을 경우
+    if(vpKF.size()<nMinKFInit)  // vpKF의 갯수가 최소 KeyFrame의 갯수보다 작을 경우
         return;     // InitialzieIMU 수행 끝
 
     mFirstTs=vpKF.front()->mTimeStamp;  
     // 가장 첫번째 KeyFrame (Current Key Frame에서 가장 먼 TimeStamp를 가진 KeyFrame)의 TimeStamp를 가져온다.
 
-    if(mpCurrentKeyFrame->mTimeStamp-mFirstTs<minTime)  // Current KeyFrame의 TimeStamp와 첫번째 TimeStamp의 차이가 minTime이하 일 경우
+    if(mpCurrentKeyFrame->mTimeStamp-mFirstTs<minTimeInit)  // Current KeyFrame의 TimeStamp와 첫번째 TimeStamp의 차이가 minTime이하 일 경우
     // KeyFrame 간 TimeStamp가 얼마 안 떨어졌을 경우
         return;     // InitialzieIMU 수행 끝
 
@@ -1620,9 +2206,34 @@ void LocalMapping::InitializeIMU(float priorG, float priorA, bool bFIBA)
 
     const int N = vpKF.size();  // KeyFrame의 갯수를 N으로 선언
     IMU::Bias b(0,0,0,0,0,0);   // IMU bias값 초기화
+    bool bClosedForm = false;   // closed-form 초기화 결과로 InertialOptimization을 시작하는지
+
+    // Closed-form initialization: gyro bias, velocities, gravity and scale by linear least squares
+    if (bFastInit)
+    {
+        ImuInitializer initializer;
+        if(initializer.Solve(vpKF,!mbMonocular))
+        {
+            // Key Frame의 velocity와 bias를 설정 (InertialOptimization의 초기값)
+            initializer.Apply(vpKF);
+            mRwg = initializer.GetRwg();
+            mScale = initializer.GetScale();
+            mbg = initializer.GetGyroBias();
+            mba.setZero();
+            mTinit = mpCurrentKeyFrame->mTimeStamp-mFirstTs;
+            bClosedForm = true;
+            cout << "Closed-form IMU initialization: scale " << mScale << ", gyro bias " << mbg.transpose() << endl;
+        }
+        else if(mpCurrentKeyFrame->mTimeStamp-mFirstTs<minTime || N<nMinKF)
+        {
+            // 아직 motion이 부족하다: 다음 Key Frame에서 다시 시도
+            bInitializing=false;
+            return;
+        }
+    }
 
     // Compute and KF velocities mRwg estimation
-    if (!mpCurrentKeyFrame->GetMap()->isImuInitialized())
+    if (!bClosedForm && !mpCurrentKeyFrame->GetMap()->isImuInitialized())
     // Current Key Frame의 Map이 IMU Initialize가 안되어 있을 경우
     {
         // 참고하면 좋은 그림 - 해당 논문 Figure 1 : https://www.mdpi.com/2072-4292/12/18/3048/html
@@ -1658,21 +2269,22 @@ void LocalMapping::InitializeIMU(float priorG, float priorA, bool bFIBA)
         cvRwg = IMU::ExpSO3(vzg);
         mRwg = Converter::toMatrix3d(cvRwg);
         mTinit = mpCurrentKeyFrame->mTimeStamp-mFirstTs;    // TimeStamp 차이를 활용하여 Tinit 계산
+        mScale=1.0;
     }
-    else    //  Current Key Frame의 Map이 IMU Initialize가 되어 있을 경우
+    else if (!bClosedForm)    //  Current Key Frame의 Map이 IMU Initialize가 되어 있을 경우
     {
         mRwg = Eigen::Matrix3d::Identity(); // 단위행렬 - 회전이 없다
         mbg = Converter::toVector3d(mpCurrentKeyFrame->GetGyroBias());  // Gyro Bias 값을 대입
         mba = Converter::toVector3d(mpCurrentKeyFrame->GetAccBias());   // Acc Bias 값을 대입
+        mScale=1.0;
     }
 
-    mScale=1.0;
-
     mInitTime = mpTracker->mLastFrame.mTimeStamp-vpKF.front()->mTimeStamp;
     // 초기화함수 선언 (딱히 쓰이는 곳은 없음)
 
     std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();    // 현재 시간 측정
-    Optimizer::InertialOptimization(mpAtlas->GetCurrentMap(), mRwg, mScale, mbg, mba, mbMonocular, infoInertial, false, false, priorG, priorA);
+    // closed-form 초기화 후에는 refinement만 필요하므로 iteration 수를 줄인다
+    Optimizer::InertialOptimization(mpAtlas->GetCurrentMap(), mRwg, mScale, mbg, mba, mbMonocular, infoInertial, false, false, priorG, priorA, bClosedForm ? 30 : 200);
     // Optimizer::InertialOptimization() 중 첫번째 함수
     // Inertial Optimization으로 Key Frame의 Pose, KeyFrame에 새로운 velocities and IMU biases, Scale값도 다시 계산
     std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();    // 현재 시간 측정 
@@ -1687,7 +2299,7 @@ void LocalMapping::InitializeIMU(float priorG, float priorA, bool bFIBA)
     // Before this line we are not changing the map
     // 다음 Line부터 IMU Initialize를 통해 map point들이 수정될 수 있다.
 
-    unique_lock<mutex> lock(mpAtlas->GetCurrentMap()->mMutexMapUpdate);
+    unique_lock<MapUpdateMutex> lock(mpAtlas->GetCurrentMap()->mMutexMapUpdate);
     std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();    // 현재 시간 측정 
     if ((fabs(mScale-1.f)>0.00001)||!mbMonocular)   // fabs()는 절대값 구하는 함수
     // Scale 값이 1.0 근처가 아니거나 Stereo Mode, Stereo-Inertial 모드일 경우
@@ -1697,6 +2309,8 @@ void LocalMapping::InitializeIMU(float priorG, float priorA, bool bFIBA)
         // Updated Scale값을 Tracking에 적용
         mpTracker->UpdateFrameIMU(mScale,vpKF[0]->GetImuBias(),mpCurrentKeyFrame);
     }
+    // bias가 크게 바뀐 KeyFrame은 Full Inertial BA 전에 다시 적분
+    ReintegrateKeyFrames(vpKF);
     std::chrono::steady_clock::time_point t3 = std::chrono::steady_clock::now();    // 현재 시간 측정 
 
     // Check if initialization OK
@@ -1719,6 +2333,9 @@ void LocalMapping::InitializeIMU(float priorG, float priorA, bool bFIBA)
             // Full Inertial Bundle Adjustment로 Camera pose, Camera velocity, Map point, IMU bias 값을 Update
     }
 
+    if (bFIBA)
+        ReintegrateKeyFrames(mpAtlas->GetCurrentMap()->GetAllKeyFrames());
+
     std::chrono::steady_clock::time_point t5 = std::chrono::steady_clock::now();    // 현재 시간 측정 
 
     // If initialization is OK - 초기화를 모두 진행 했다면
@@ -1742,10 +2359,13 @@ void LocalMapping::InitializeIMU(float priorG, float priorA, bool bFIBA)
     mnKFs=vpKF.size();  // KeyFrame의 갯수를 vpKF의 갯수를 대입
     mIdxInit++; // 초기화 진행 Index Update
 
+    WaitSpeculativeWork();
     for(list<KeyFrame*>::iterator lit = mlNewKeyFrames.begin(), lend=mlNewKeyFrames.end(); lit!=lend; lit++)
     {
         (*lit)->SetBadFlag();   // Key Frame을 제거하기전 KeyFrame에 대한 Graph 관계에 대한 초기화 과정을 진행 - 삭제를 하므로
-        delete *lit;    // KeyFrame을 삭제
+        if(mpTrajectoryStore)
+            mpTrajectoryStore->EraseKeyFrame(*lit);
+        EpochManager::Retire(*lit, (*lit)->GetMap()->GetReclaimGracePeriod());    // KeyFrame을 삭제 (다른 thread에서 더 이상 참조하지 않을 때)
     }
 
     mlNewKeyFrames.clear(); // mlNewKeyFrames Clear로 초기화
@@ -1761,6 +2381,7 @@ void LocalMapping::InitializeIMU(float priorG, float priorA, bool bFIBA)
 
 void LocalMapping::ScaleRefinement()
 {
+    ORB_TRACE_SCOPE("LocalMapping::ScaleRefinement");
      // Minimum number of keyframes to compute a solution
     // Minimum time (seconds) between first and last keyframe to compute a solution. Make the difference between monocular and stereo
     // unique_lock<mutex> lock0(mMutexImuInit);
@@ -1795,6 +2416,12 @@ void LocalMapping::ScaleRefinement()
     mRwg = Eigen::Matrix3d::Identity(); //3x3 단위행렬을 생성합니다.
     mScale=1.0; //mScale을 1.0으로 초기화합니다. 
 
+    {
+        //local inertial BA에서 bias가 크게 바뀐 KeyFrame은 최적화 전에 다시 적분합니다.
+        unique_lock<MapUpdateMutex> lock(mpAtlas->GetCurrentMap()->mMutexMapUpdate);
+        ReintegrateKeyFrames(vpKF);
+    }
+
     std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now(); //최적화 시작지점 기록
     Optimizer::InertialOptimization(mpAtlas->GetCurrentMap(), mRwg, mScale); //초기값으로부터 optimizer 시작 (해당부분은 scale값과 중력방향만 최적합니다.)
     std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now(); //optimizer 종료지점 기록
@@ -1808,7 +2435,7 @@ void LocalMapping::ScaleRefinement()
     //해당 1e-1보다 크게되면 initializing이 재대로 되었다고 판단하고 사용한다.
 
     // Before this line we are not changing the map
-    unique_lock<mutex> lock(mpAtlas->GetCurrentMap()->mMutexMapUpdate);
+    unique_lock<MapUpdateMutex> lock(mpAtlas->GetCurrentMap()->mMutexMapUpdate);
     std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
     if ((fabs(mScale-1.f)>0.00001)||!mbMonocular) //해당 조건을 만족하면 업데이트를 시작합니다.
     {
@@ -1817,10 +2444,13 @@ void LocalMapping::ScaleRefinement()
     }
     std::chrono::steady_clock::time_point t3 = std::chrono::steady_clock::now(); //업데이트 종료시점 기록
 
+    WaitSpeculativeWork();
     for(list<KeyFrame*>::iterator lit = mlNewKeyFrames.begin(), lend=mlNewKeyFrames.end(); lit!=lend; lit++) //해당과정에서 setbadflag가 존재하는 keyframe은 제거합니다.
     {
         (*lit)->SetBadFlag();
-        delete *lit;
+        if(mpTrajectoryStore)
+            mpTrajectoryStore->EraseKeyFrame(*lit);
+        EpochManager::Retire(*lit, (*lit)->GetMap()->GetReclaimGracePeriod());
     }
 
     mlNewKeyFrames.clear(); //new keyframe 초기화
@@ -1835,6 +2465,34 @@ void LocalMapping::ScaleRefinement()
 
 
 
+void LocalMapping::ReintegrateKeyFrames(const vector<KeyFrame*> &vpKFs)
+{
+    // Rotation correction (rad) above which the first order bias update is not trusted
+    const float thRot = 0.01f;
+
+    vector<KeyFrame*> vpToCheck;
+    vpToCheck.reserve(vpKFs.size());
+    for(size_t i=0; i<vpKFs.size(); i++)
+    {
+        KeyFrame* pKFi = vpKFs[i];
+        if(pKFi && !pKFi->isBad() && pKFi->mPrevKF && pKFi->mpImuPreintegrated)
+            vpToCheck.push_back(pKFi);
+    }
+
+    const int nKFs = vpToCheck.size();
+    // 각 KeyFrame의 preintegration은 자신의 mutex로 보호되므로 서로 독립적으로 다시 적분 가능
+    auto reintegrate = [&](int i)
+    {
+        vpToCheck[i]->mpImuPreintegrated->ReintegrateIfNeeded(thRot);
+    };
+
+    if(mpThreadPool && nKFs>1)
+        mpThreadPool->ParallelFor(0, nKFs, reintegrate);
+    else
+        for(int i=0; i<nKFs; i++)
+            reintegrate(i);
+}
+
 bool LocalMapping::IsInitializing()
 {
     return bInitializing;
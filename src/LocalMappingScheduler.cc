@@ -0,0 +1,63 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "LocalMappingScheduler.h"
+
+namespace ORB_SLAM3
+{
+
+// Weight of the last measurement in the stage costs
+static const double COST_SMOOTHING = 0.2;
+
+LocalMappingScheduler::LocalMappingScheduler(const float fBudget): mfBudget(fBudget), mTimeStartKF(Clock::now())
+{
+    for(int i=0; i<NUM_STAGES; i++)
+    {
+        mvCost[i] = 0.0;
+        mvbMeasured[i] = false;
+    }
+}
+
+void LocalMappingScheduler::BeginKeyFrame()
+{
+    mTimeStartKF = Clock::now();
+}
+
+bool LocalMappingScheduler::ShouldRun(const Stage stage, const int nQueued) const
+{
+    // Nothing waiting, or the cost is not known yet
+    if(nQueued<=0 || !mvbMeasured[stage])
+        return true;
+
+    const double elapsed = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(Clock::now() - mTimeStartKF).count();
+    return elapsed + mvCost[stage] <= mfBudget/nQueued;
+}
+
+void LocalMappingScheduler::Record(const Stage stage, const Clock::time_point &tStart)
+{
+    const double ms = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(Clock::now() - tStart).count();
+    if(!mvbMeasured[stage])
+    {
+        mvCost[stage] = ms;
+        mvbMeasured[stage] = true;
+    }
+    else
+        mvCost[stage] = (1.0-COST_SMOOTHING)*mvCost[stage] + COST_SMOOTHING*ms;
+}
+
+} //namespace ORB_SLAM
@@ -0,0 +1,155 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "LockProfiler.h"
+#include "Metrics.h"
+
+#include <algorithm>
+#include <sstream>
+
+namespace ORB_SLAM3
+{
+
+namespace
+{
+
+struct LockStats
+{
+    std::atomic<unsigned long> nAcquisitions;
+    LatencyHistogram wait;
+    LatencyHistogram hold;
+    std::atomic<unsigned long> vnHolderCount[LockProfiler::MAX_THREADS];
+    std::atomic<unsigned long long> vnHolderWaitNs[LockProfiler::MAX_THREADS];
+};
+
+LockStats gvLocks[LockProfiler::NUM_LOCKS];
+
+std::atomic<int> gnNextSlot(0);
+std::atomic<const char*> gvThreadNames[LockProfiler::MAX_THREADS];
+
+thread_local int tnSlot = -1;
+
+} // namespace
+
+void LockProfiler::SetThreadName(const char* name)
+{
+    const int slot = ThreadSlot();
+    if(slot<MAX_THREADS-1)
+        gvThreadNames[slot].store(name, std::memory_order_relaxed);
+}
+
+int LockProfiler::ThreadSlot()
+{
+    if(tnSlot<0)
+        tnSlot = std::min(gnNextSlot.fetch_add(1, std::memory_order_relaxed), MAX_THREADS-1);
+    return tnSlot;
+}
+
+void LockProfiler::RecordAcquisition(const Lock lock)
+{
+    gvLocks[lock].nAcquisitions.fetch_add(1, std::memory_order_relaxed);
+}
+
+void LockProfiler::RecordWait(const Lock lock, const double ms, const int holder)
+{
+    LockStats &s = gvLocks[lock];
+    s.wait.Record(ms);
+
+    // The holder may have released the lock before it was read
+    if(holder>=0)
+    {
+        s.vnHolderCount[holder].fetch_add(1, std::memory_order_relaxed);
+        s.vnHolderWaitNs[holder].fetch_add((unsigned long long)(ms*1e6), std::memory_order_relaxed);
+    }
+}
+
+void LockProfiler::RecordHold(const Lock lock, const double ms)
+{
+    gvLocks[lock].hold.Record(ms);
+}
+
+std::vector<LockProfiler::LockSnapshot> LockProfiler::GetSnapshots()
+{
+    const int nThreads = std::min(gnNextSlot.load(std::memory_order_relaxed), (int)MAX_THREADS);
+
+    std::vector<LockSnapshot> vSnapshots(NUM_LOCKS);
+    for(int i=0; i<NUM_LOCKS; i++)
+    {
+        const LockStats &s = gvLocks[i];
+        LockSnapshot &ls = vSnapshots[i];
+        ls.name = LockName(static_cast<Lock>(i));
+        ls.acquisitions = s.nAcquisitions.load(std::memory_order_relaxed);
+        ls.contended = s.wait.Count();
+        ls.waitSum = s.wait.Sum();
+        ls.waitP50 = s.wait.Percentile(0.5);
+        ls.waitP90 = s.wait.Percentile(0.9);
+        ls.waitP99 = s.wait.Percentile(0.99);
+        ls.waitMax = s.wait.Max();
+        ls.holdSum = s.hold.Sum();
+        ls.holdP99 = s.hold.Percentile(0.99);
+        ls.holdMax = s.hold.Max();
+
+        for(int t=0; t<nThreads; t++)
+        {
+            HolderSnapshot h;
+            h.count = s.vnHolderCount[t].load(std::memory_order_relaxed);
+            if(h.count==0)
+                continue;
+            h.wait = s.vnHolderWaitNs[t].load(std::memory_order_relaxed)*1e-6;
+
+            const char* name = gvThreadNames[t].load(std::memory_order_relaxed);
+            if(t==MAX_THREADS-1)
+                h.thread = "other";
+            else if(name)
+                h.thread = name;
+            else
+            {
+                std::ostringstream os;
+                os << "thread_" << t;
+                h.thread = os.str();
+            }
+            ls.vHolders.push_back(h);
+        }
+    }
+    return vSnapshots;
+}
+
+void LockProfiler::Reset()
+{
+    for(int i=0; i<NUM_LOCKS; i++)
+    {
+        LockStats &s = gvLocks[i];
+        s.nAcquisitions.store(0, std::memory_order_relaxed);
+        s.wait.Reset();
+        s.hold.Reset();
+        for(int t=0; t<MAX_THREADS; t++)
+        {
+            s.vnHolderCount[t].store(0, std::memory_order_relaxed);
+            s.vnHolderWaitNs[t].store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+const char* LockProfiler::LockName(const Lock lock)
+{
+    static const char* vNames[NUM_LOCKS] = {
+        "map_update", "atlas", "keyframe_database"};
+    return vNames[lock];
+}
+
+} //namespace ORB_SLAM3
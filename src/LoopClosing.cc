@@ -24,6 +24,13 @@
 #include "Optimizer.h"
 #include "ORBmatcher.h"
 #include "G2oTypes.h"
+#include "Metrics.h"
+#include "ThreadPool.h"
+#include "EpochManager.h"
+#include "Tracer.h"
+#include "ReplayLog.h"
+#include "PlaceRecognitionScheduler.h"
+#include "PowerGovernor.h"
 
 #include<mutex>
 #include<thread>
@@ -38,6 +45,17 @@ LoopClosing::LoopClosing(Atlas *pAtlas, KeyFrameDatabase *pDB, ORBVocabulary *pV
     mbStopGBA(false), mpThreadGBA(NULL), mbFixScale(bFixScale), mnFullBAIdx(0), mnLoopNumCoincidences(0), mnMergeNumCoincidences(0),
     mbLoopDetected(false), mbMergeDetected(false), mnLoopNumNotFound(0), mnMergeNumNotFound(0)
 {
+    mbWakeUp = false;
+    mpThreadPool = static_cast<ThreadPool*>(NULL);
+    mpMetrics = static_cast<Metrics*>(NULL);
+    mpReplayLog = static_cast<ReplayLog*>(NULL);
+    mpScheduler = static_cast<PlaceRecognitionScheduler*>(NULL);
+    mpPowerGovernor = static_cast<PowerGovernor*>(NULL);
+    mbNonBlockingCorrection = false;
+    mnGBARoundIterations = 0;
+    mpDeferredGBAMap = static_cast<Map*>(NULL);
+    mnDeferredGBALoopKF = 0;
+
     mnCovisibilityConsistencyTh = 3;
     mpLastCurrentKF = static_cast<KeyFrame*>(NULL);
 }
@@ -47,6 +65,40 @@ void LoopClosing::SetTracker(Tracking *pTracker)
     mpTracker=pTracker;
 }
 
+void LoopClosing::SetThreadPool(ThreadPool *pThreadPool)
+{
+    mpThreadPool=pThreadPool;
+}
+
+void LoopClosing::SetMetrics(Metrics *pMetrics)
+{
+    mpMetrics=pMetrics;
+}
+
+void LoopClosing::SetThreadScheduling(const ThreadScheduling &sched, const ThreadScheduling &schedGBA)
+{
+    mThreadScheduling = sched;
+    mGBAThreadScheduling = schedGBA;
+}
+
+void LoopClosing::SetReplayLog(ReplayLog *pReplayLog)
+{
+    mpReplayLog=pReplayLog;
+    if(mpReplayLog)
+        mpReplayLog->SetWakeUp(ReplayLog::LOOP_CLOSING_KEYFRAME, [this]{ WakeUp(); });
+}
+
+void LoopClosing::EnableScheduler(const float fKeyFrameBudget)
+{
+    delete mpScheduler;
+    mpScheduler = new PlaceRecognitionScheduler(fKeyFrameBudget);
+}
+
+void LoopClosing::SetPowerGovernor(PowerGovernor *pGovernor)
+{
+    mpPowerGovernor=pGovernor;
+}
+
 void LoopClosing::SetLocalMapper(LocalMapping *pLocalMapper)
 {
     mpLocalMapper=pLocalMapper;
@@ -57,11 +109,31 @@ void LoopClosing::Run()
 {
     mbFinished =false;
 
+    EpochManager::ThreadRegistration epochRegistration;
+    ORB_TRACE_THREAD_NAME("LoopClosing");
+    ORB_LOCK_THREAD_NAME("LoopClosing");
+    // Pool tasks go after the tracking ones and before the global BA ones
+    ThreadPool::PriorityScope poolPriority(ThreadPool::MAPPING);
+
+    if(!mThreadScheduling.IsDefault())
+        mThreadScheduling.Apply();
+
     while(1)
     {
+        // No pointer obtained in a previous iteration is used from here on
+        EpochManager::Quiescent();
+
         //NEW LOOP AND MERGE DETECTION ALGORITHM
         //----------------------------
-        if(CheckNewKeyFrames())
+        // On replay the keyframe waits until the frame at which it was done in the recording,
+        // in low-power mode until enough keyframes are queued
+        bool bQueryDue = true;
+        if(mpPowerGovernor)
+        {
+            unique_lock<mutex> lock(mMutexLoopQueue);
+            bQueryDue = QueryDue();
+        }
+        if(CheckNewKeyFrames() && bQueryDue && (!mpReplayLog || mpReplayLog->HasTurn(ReplayLog::LOOP_CLOSING_KEYFRAME)))
         {
             if(mpLastCurrentKF)
             {
@@ -72,7 +144,10 @@ void LoopClosing::Run()
             timeDetectBoW = 0;
             std::chrono::steady_clock::time_point time_StartDetectBoW = std::chrono::steady_clock::now();
 #endif
+            const Metrics::Clock::time_point time_StartDetect = Metrics::Clock::now();
             bool bDetected = NewDetectCommonRegions();
+            if(mpMetrics)
+                mpMetrics->Record(Metrics::LOOP_DETECTION, time_StartDetect);
 #ifdef REGISTER_TIMES
             std::chrono::steady_clock::time_point time_EndDetectBoW = std::chrono::steady_clock::now();
             double timeDetect = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(time_EndDetectBoW - time_StartDetectBoW).count();
@@ -116,9 +191,12 @@ void LoopClosing::Run()
                                 mnMergeNumCoincidences = 0;
                                 mvpMergeMatchedMPs.clear();
                                 mvpMergeMPs.clear();
+                                mMergeRegion = ProjectionRegion();
                                 mnMergeNumNotFound = 0;
                                 mbMergeDetected = false;
                                 Verbose::PrintMess("scale bad estimated. Abort merging", Verbose::VERBOSITY_NORMAL);
+                                if(mpReplayLog)
+                                    mpReplayLog->WorkDone(ReplayLog::LOOP_CLOSING_KEYFRAME);
                                 continue;
                             }
                             // If inertial, force only yaw
@@ -139,10 +217,23 @@ void LoopClosing::Run()
 #ifdef REGISTER_TIMES
                         std::chrono::steady_clock::time_point time_StartMerge = std::chrono::steady_clock::now();
 #endif
+                        const Metrics::Clock::time_point time_StartMergeMetric = Metrics::Clock::now();
+                        const long unsigned int nCurrentMapId = mpCurrentKF->GetMap()->GetId();
+                        const long unsigned int nMergeMapId = mpMergeMatchedKF->GetMap()->GetId();
                         if (mpTracker->mSensor==System::IMU_MONOCULAR ||mpTracker->mSensor==System::IMU_STEREO)
                             MergeLocal2();
                         else
                             MergeLocal();
+                        if(mpMetrics)
+                            mpMetrics->Record(Metrics::MAP_MERGE, time_StartMergeMetric);
+
+                        // The current keyframe is in the map that remains
+                        if(mpAtlas->GetMapEvents())
+                        {
+                            const long unsigned int nIntoMapId = mpCurrentKF->GetMap()->GetId();
+                            mpAtlas->GetMapEvents()->MapMerged(nIntoMapId==nCurrentMapId ? nMergeMapId : nCurrentMapId, nIntoMapId);
+                        }
+                        mpAtlas->PublishMapEvents(MapEvents::MAP_MERGE);
 #ifdef REGISTER_TIMES
                         std::chrono::steady_clock::time_point time_EndMerge = std::chrono::steady_clock::now();
                         double timeMerge = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(time_EndMerge - time_StartMerge).count();
@@ -160,6 +251,7 @@ void LoopClosing::Run()
                     mnMergeNumCoincidences = 0;
                     mvpMergeMatchedMPs.clear();
                     mvpMergeMPs.clear();
+                    mMergeRegion = ProjectionRegion();
                     mnMergeNumNotFound = 0;
                     mbMergeDetected = false;
 
@@ -171,6 +263,7 @@ void LoopClosing::Run()
                         mnLoopNumCoincidences = 0;
                         mvpLoopMatchedMPs.clear();
                         mvpLoopMPs.clear();
+                        mLoopRegion = ProjectionRegion();
                         mnLoopNumNotFound = 0;
                         mbLoopDetected = false;
                     }
@@ -215,7 +308,10 @@ void LoopClosing::Run()
 #ifdef REGISTER_TIMES
                             std::chrono::steady_clock::time_point time_StartLoop = std::chrono::steady_clock::now();
 #endif
+                            const Metrics::Clock::time_point time_StartCorrection = Metrics::Clock::now();
                             CorrectLoop();
+                            if(mpMetrics)
+                                mpMetrics->Record(Metrics::LOOP_CORRECTION, time_StartCorrection);
 #ifdef REGISTER_TIMES
                             std::chrono::steady_clock::time_point time_EndLoop = std::chrono::steady_clock::now();
                             double timeLoop = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(time_EndLoop - time_StartLoop).count();
@@ -233,7 +329,10 @@ void LoopClosing::Run()
 #ifdef REGISTER_TIMES
                         std::chrono::steady_clock::time_point time_StartLoop = std::chrono::steady_clock::now();
 #endif
+                        const Metrics::Clock::time_point time_StartCorrection = Metrics::Clock::now();
                         CorrectLoop();
+                        if(mpMetrics)
+                            mpMetrics->Record(Metrics::LOOP_CORRECTION, time_StartCorrection);
 
 #ifdef REGISTER_TIMES
                         std::chrono::steady_clock::time_point time_EndLoop = std::chrono::steady_clock::now();
@@ -241,6 +340,7 @@ void LoopClosing::Run()
                         vTimeLoopTotal_ms.push_back(timeLoop);
 #endif
                     }
+                    mpAtlas->PublishMapEvents(MapEvents::LOOP_CORRECTION);
 
                     // Reset all variables
                     mpLoopLastCurrentKF->SetErase();
@@ -248,21 +348,46 @@ void LoopClosing::Run()
                     mnLoopNumCoincidences = 0;
                     mvpLoopMatchedMPs.clear();
                     mvpLoopMPs.clear();
+                    mLoopRegion = ProjectionRegion();
                     mnLoopNumNotFound = 0;
                     mbLoopDetected = false;
                 }
 
             }
             mpLastCurrentKF = mpCurrentKF;
+
+            // Spilling is done here so that no map is released while it is being matched or merged.
+            // The maps of the candidates still being verified are matched again with the next keyframe.
+            if(!mbMergeDetected && !mbLoopDetected)
+            {
+                Atlas::ResidencyLease lease(mpAtlas);
+                if(mnMergeNumCoincidences>0)
+                    lease.Add(mpMergeMatchedKF->GetMap());
+                if(mnLoopNumCoincidences>0)
+                    lease.Add(mpLoopMatchedKF->GetMap());
+                mpAtlas->EnforceMemoryBudget();
+            }
+
+            if(mpReplayLog)
+                mpReplayLog->WorkDone(ReplayLog::LOOP_CLOSING_KEYFRAME);
         }
 
         ResetIfRequested();
 
+        // Submaps left by the last loop correction, a few per iteration so that the map is locked briefly
+        if(!mlPendingSubmaps.empty())
+        {
+            ApplyPendingSubmaps(4);
+            mpAtlas->PublishMapEvents(MapEvents::LOOP_CORRECTION);
+        }
+
         if(CheckFinish()){
+            ApplyPendingSubmaps(-1);
             break;
         }
 
-        usleep(5000);
+        if(mlPendingSubmaps.empty())
+            WaitForWork();
     }
 
     SetFinish();
@@ -272,7 +397,14 @@ void LoopClosing::InsertKeyFrame(KeyFrame *pKF)
 {
     unique_lock<mutex> lock(mMutexLoopQueue);
     if(pKF->mnId!=0)
+    {
+        if(mlpLoopKeyFrameQueue.empty())
+            mTimeFirstQueued = std::chrono::steady_clock::now();
         mlpLoopKeyFrameQueue.push_back(pKF); // LoopClosing detection을 위한 Queue에 CurrentKeyFrame을 추가
+    }
+    if(mpMetrics)
+        mpMetrics->SetGauge(Metrics::LOOP_CLOSING_QUEUE, mlpLoopKeyFrameQueue.size());
+    mcvLoopQueue.notify_one();
 }
 
 bool LoopClosing::CheckNewKeyFrames()
@@ -281,8 +413,50 @@ bool LoopClosing::CheckNewKeyFrames()
     return(!mlpLoopKeyFrameQueue.empty()); // DB의 값이 존재하면 True, 존재하지 않으면 False
 } 
 
+void LoopClosing::WaitForWork()
+{
+    unique_lock<mutex> lock(mMutexLoopQueue);
+    std::chrono::milliseconds timeout(100);
+    if(mpPowerGovernor && !mlpLoopKeyFrameQueue.empty())
+    {
+        // An incomplete stride is queried when its first keyframe can not wait any longer
+        const std::chrono::steady_clock::time_point due = mTimeFirstQueued +
+                std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float>(mpPowerGovernor->GetMaxDelay()));
+        const std::chrono::milliseconds left = std::chrono::duration_cast<std::chrono::milliseconds>(due - std::chrono::steady_clock::now()) + std::chrono::milliseconds(1);
+        timeout = std::max(std::chrono::milliseconds(0), std::min(timeout, left));
+    }
+    // On replay the queued keyframes wait for their turn, which wakes the thread up
+    mcvLoopQueue.wait_for(lock, timeout,
+                          [this]{ return mbWakeUp || (!mpReplayLog && !mlpLoopKeyFrameQueue.empty() && QueryDue()); });
+    mbWakeUp = false;
+}
+
+bool LoopClosing::QueryDue()
+{
+    // Replay follows the recorded coalescing decisions
+    if(!mpPowerGovernor || (mpReplayLog && mpReplayLog->GetMode()==ReplayLog::REPLAY))
+        return true;
+    if(mlpLoopKeyFrameQueue.empty())
+        return false;
+
+    // A common region is being verified with the next keyframes, one by one
+    if(mnLoopNumCoincidences>0 || mnMergeNumCoincidences>0)
+        return true;
+
+    const float waited = std::chrono::duration_cast<std::chrono::duration<float> >(std::chrono::steady_clock::now() - mTimeFirstQueued).count();
+    return (int)mlpLoopKeyFrameQueue.size()>=mpPowerGovernor->GetLoopStride() || waited>=mpPowerGovernor->GetMaxDelay();
+}
+
+void LoopClosing::WakeUp()
+{
+    unique_lock<mutex> lock(mMutexLoopQueue);
+    mbWakeUp = true;
+    mcvLoopQueue.notify_one();
+}
+
 bool LoopClosing::NewDetectCommonRegions()
 {
+    ORB_TRACE_SCOPE("LoopClosing::NewDetectCommonRegions");
     // VI. Map Merging And Loop Closing (In ORB-SLAM3 paper)
     // - A. PLACE RECOGNITION
     // 1 . DBOW2 candidate keyframes                   : Atals DBoW2 DB를 이용하여 가장 유사한 3개의 KF를 검색
@@ -299,10 +473,46 @@ bool LoopClosing::NewDetectCommonRegions()
     
     // ===========================================================================================================================================================================
     // 초기 설정부분
+    vector<KeyFrame*> vpCoalescedKFs;
     {
         unique_lock<mutex> lock(mMutexLoopQueue);   // LoopDetection을 위해서 새로운 Keyframe이 mlpLoopKeyFrameQueue에 추가되지 않도록 lock을 걸음
-        mpCurrentKF = mlpLoopKeyFrameQueue.front(); // 가장 최근의 KF를 가져옴
-        mlpLoopKeyFrameQueue.pop_front();           // mlpLoopKeyFrameQueue 가장 최근의 KF를 Queue에서 제거
+
+        //^ scheduler: queue가 밀려 있으면 queue의 keyframe들을 novelty가 가장 높은 keyframe 하나의 query로 합침
+        //^ low-power mode: stride개의 keyframe 중 가장 최근 것 하나만 query
+        //^ 연속된 keyframe으로 공통 영역을 검증하는 중(coincidence > 0)에는 합치지 않음
+        int nTake = 1;
+        if((mpScheduler || mpPowerGovernor) && mnLoopNumCoincidences==0 && mnMergeNumCoincidences==0)
+        {
+            const int nQueued = mlpLoopKeyFrameQueue.size();
+            if(mpScheduler && mpScheduler->ShouldCoalesce(nQueued))
+                nTake = nQueued;
+            if(mpPowerGovernor)
+                nTake = std::max(nTake, std::min(nQueued, mpPowerGovernor->GetLoopStride()));
+            if(mpReplayLog)
+                nTake = std::max(1, std::min(mpReplayLog->Decide(ReplayLog::LOOP_CLOSING_COALESCE, nTake), nQueued));
+        }
+
+        if(nTake>1)
+        {
+            list<KeyFrame*>::iterator itEnd = mlpLoopKeyFrameQueue.begin();
+            advance(itEnd, nTake);
+            vpCoalescedKFs.assign(mlpLoopKeyFrameQueue.begin(), itEnd);
+            mlpLoopKeyFrameQueue.erase(mlpLoopKeyFrameQueue.begin(), itEnd);
+
+            const int nSelected = mpScheduler ? mpScheduler->SelectKeyFrame(vpCoalescedKFs, mpORBVocabulary) : nTake-1;
+            mpCurrentKF = vpCoalescedKFs[nSelected];
+            vpCoalescedKFs.erase(vpCoalescedKFs.begin()+nSelected);
+        }
+        else
+        {
+            mpCurrentKF = mlpLoopKeyFrameQueue.front(); // 가장 최근의 KF를 가져옴
+            mlpLoopKeyFrameQueue.pop_front();           // mlpLoopKeyFrameQueue 가장 최근의 KF를 Queue에서 제거
+        }
+        // The remaining keyframes start a new stride (their insertion times are not kept)
+        if(!mlpLoopKeyFrameQueue.empty())
+            mTimeFirstQueued = std::chrono::steady_clock::now();
+        if(mpMetrics)
+            mpMetrics->SetGauge(Metrics::LOOP_CLOSING_QUEUE, mlpLoopKeyFrameQueue.size());
         
         // Avoid that a keyframe can be erased while it is being process by this thread
         // 다른 모듈에서 KF를 제거하지 못하도록 방지
@@ -316,6 +526,12 @@ bool LoopClosing::NewDetectCommonRegions()
 
         mpLastMap = mpCurrentKF->GetMap(); // Map class로부터 현재 map정보의 pointer를 가져옴
     }
+
+    // The coalesced keyframes are not queried, but later keyframes can find them
+    for(size_t i=0; i<vpCoalescedKFs.size(); i++)
+        mpKeyFrameDB->add(vpCoalescedKFs[i]);
+    if(!vpCoalescedKFs.empty())
+        Verbose::PrintMess("PR: " + to_string(vpCoalescedKFs.size()+1) + " queued keyframes coalesced into one query", Verbose::VERBOSITY_DEBUG);
     
     // mpLastMap->IsInertial(): IMU 사용 유무 및 IMU 초기화 유무
     // mpLastMap->GetIniertialBA1(): LoopClosing::Run()내의 LoopClosing::MergeLocal2()함수에서 Map에대한 IMU 초기화를 해줌
@@ -328,7 +544,7 @@ bool LoopClosing::NewDetectCommonRegions()
     
     // 스테레오 카메라 사용 유무
     // KeyFrame의 개수가 5개 미만인경우
-    if(mpTracker->mSensor == System::STEREO && mpLastMap->GetAllKeyFrames().size() < 5) //12
+    if(mpTracker->mSensor == System::STEREO && mpLastMap->KeyFramesInMap() < 5) //12
     {
         mpKeyFrameDB->add(mpCurrentKF);
         mpCurrentKF->SetErase();
@@ -337,7 +553,7 @@ bool LoopClosing::NewDetectCommonRegions()
 
     // Keyframe의 개수
     // KeyFrame의 개수가 12개 미만인경우
-    if(mpLastMap->GetAllKeyFrames().size() < 12)
+    if(mpLastMap->KeyFramesInMap() < 12)
     {
         mpKeyFrameDB->add(mpCurrentKF);
         mpCurrentKF->SetErase();
@@ -384,7 +600,7 @@ bool LoopClosing::NewDetectCommonRegions()
 
         // 변환행렬에 대한 각 가설을 찾기 위해 3d-3d 일치의 최소 집합을 사용하는 Horn 알고리즘을 사용
         vector<MapPoint*> vpMatchedMPs;      // vpMatchedMPs = vpBestMatchedMapPoints,  map point와 일치하는 점 숫자
-        bool bCommonRegion = DetectAndReffineSim3FromLastKF(mpCurrentKF, mpLoopMatchedKF, gScw, numProjMatches, mvpLoopMPs, vpMatchedMPs);
+        bool bCommonRegion = DetectAndReffineSim3FromLastKF(mpCurrentKF, mpLoopMatchedKF, gScw, numProjMatches, mvpLoopMPs, vpMatchedMPs, mLoopRegion);
 
         // mvpLoopMPs = best Map points, vpMatchedMPs = best Matched Map points
         // RANSAC을 활용해서 Km Local window의 map point를 Ka의 것과 더 잘 정렬하는 변환 행렬 활용하기 위함
@@ -420,6 +636,7 @@ bool LoopClosing::NewDetectCommonRegions()
                 mnLoopNumCoincidences = 0;
                 mvpLoopMatchedMPs.clear();
                 mvpLoopMPs.clear();
+                mLoopRegion = ProjectionRegion();
                 mnLoopNumNotFound = 0;
             }
         }
@@ -444,7 +661,7 @@ bool LoopClosing::NewDetectCommonRegions()
 
         // DetectAndReffineSim3FromLastKF()는 CurrentKF와 잠재적 LoopKF영역에 대하여 공통뷰가 존재하는 Transformation & ProjectionMatching을 통해 검사
         // ProjectionMatching point의 개수가 일정개수 이상이면 True를 반환
-        bool bCommonRegion = DetectAndReffineSim3FromLastKF(mpCurrentKF, mpMergeMatchedKF, gScw, numProjMatches, mvpMergeMPs, vpMatchedMPs);
+        bool bCommonRegion = DetectAndReffineSim3FromLastKF(mpCurrentKF, mpMergeMatchedKF, gScw, numProjMatches, mvpMergeMPs, vpMatchedMPs, mMergeRegion);
         if(bCommonRegion)
         {
             bMergeDetectedInKF = true; // Merge할 KF이 존재한다고 설정
@@ -470,6 +687,7 @@ bool LoopClosing::NewDetectCommonRegions()
                 mnMergeNumCoincidences = 0;
                 mvpMergeMatchedMPs.clear();
                 mvpMergeMPs.clear();
+                mMergeRegion = ProjectionRegion();
                 mnMergeNumNotFound = 0;
             }
 
@@ -496,6 +714,7 @@ bool LoopClosing::NewDetectCommonRegions()
     // vpLoopBowCand: ActiveMap에 대한 KF 후보군
     // vpMergeBowCand: StoredMap에 대한 KF 후보군
     vector<KeyFrame*> vpMergeBowCand, vpLoopBowCand;
+    const PlaceRecognitionScheduler::Clock::time_point time_StartQuery = PlaceRecognitionScheduler::Clock::now();
 
     // 위의 5.A.3과 5.A.4에서 bMergeDetectedInKF와 bLoopDetectedInKF를 감지하지 못한 경우 == True
     // bMergeDetectedInKF : Merge KF를 감지 못함
@@ -513,7 +732,21 @@ bool LoopClosing::NewDetectCommonRegions()
         // @param mpCurrentKF: CurrentKF
         // @param vpLoopBowCand: ActiveMap에 대한 KF 후보군
         // @param vpMergeBowCand: StoredMap에 대한 KF 후보군
-        mpKeyFrameDB->DetectNBestCandidates(mpCurrentKF, vpLoopBowCand, vpMergeBowCand,3);
+        // The scheduler bounds the candidates to verify to what fits in the keyframe budget
+        int nCandidates = 3;
+        if(mpScheduler)
+        {
+            nCandidates = mpScheduler->NumCandidates();
+            if(mpReplayLog)
+                nCandidates = mpReplayLog->Decide(ReplayLog::LOOP_CLOSING_CANDIDATES, nCandidates);
+        }
+        // Only the partitions of the maps still to search are scored
+        const KeyFrameDatabase::eMapScope scope = bLoopDetectedInKF ? KeyFrameDatabase::OTHER_MAPS :
+                                                  (bMergeDetectedInKF ? KeyFrameDatabase::ONLY_MAP : KeyFrameDatabase::ALL_MAPS);
+        mpKeyFrameDB->DetectNBestCandidates(mpCurrentKF, vpLoopBowCand, vpMergeBowCand, nCandidates, scope, &mBowSession);
+        // Merge candidates may come from a map whose features were spilled to disk
+        for(size_t i=0; i<vpMergeBowCand.size(); i++)
+            mpAtlas->EnsureResident(vpMergeBowCand[i]->GetMap());
 #ifdef REGISTER_TIMES
         std::chrono::steady_clock::time_point time_EndDetectBoW = std::chrono::steady_clock::now();
         timeDetectBoW = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(time_EndDetectBoW - time_StartDetectBoW).count();
@@ -552,7 +785,10 @@ bool LoopClosing::NewDetectCommonRegions()
         mbMergeDetected = DetectCommonRegionsFromBoW(vpMergeBowCand, mpMergeMatchedKF, mpMergeLastCurrentKF, mg2oMergeSlw, mnMergeNumCoincidences, mvpMergeMPs, mvpMergeMatchedMPs);
     }
 
-    
+
+    if(mpScheduler)
+        mpScheduler->Record(mpCurrentKF, vpLoopBowCand.size()+vpMergeBowCand.size(), time_StartQuery);
+
     mpKeyFrameDB->add(mpCurrentKF); // CurrentKF에서 Bag-of-word를 추출하고 DB에 저장
 
     // Merged KF 또는 LoopDetected KF을 발견한 경우 True를 반환
@@ -571,10 +807,10 @@ bool LoopClosing::NewDetectCommonRegions()
 }
 
 bool LoopClosing::DetectAndReffineSim3FromLastKF(KeyFrame* pCurrentKF, KeyFrame* pMatchedKF, g2o::Sim3 &gScw, int &nNumProjMatches,
-                                                 std::vector<MapPoint*> &vpMPs, std::vector<MapPoint*> &vpMatchedMPs)
+                                                 std::vector<MapPoint*> &vpMPs, std::vector<MapPoint*> &vpMatchedMPs, ProjectionRegion &region)
 {
    set<MapPoint*> spAlreadyMatchedMPs; //container 선언
-    nNumProjMatches = FindMatchesByProjection(pCurrentKF, pMatchedKF, gScw, spAlreadyMatchedMPs, vpMPs, vpMatchedMPs); 
+    nNumProjMatches = FindMatchesByProjection(pCurrentKF, pMatchedKF, gScw, spAlreadyMatchedMPs, vpMPs, vpMatchedMPs, region); 
     //best covisiblity를 가진 keyframe과 현재 covisibility keyframe을 비교하여 둘과 matching이 되는 keyframe을 저정한뒤
     //해당 keyframe에서 mappoint를 추출하고 orb matcher 0.9 기준으로 걸러내고 
     //이후 걸러진 mappoint들을 searchbyprojection을 통해 (by hamming distance) 최종 num을 뽑아냄.
@@ -610,7 +846,7 @@ bool LoopClosing::DetectAndReffineSim3FromLastKF(KeyFrame* pCurrentKF, KeyFrame*
             vector<MapPoint*> vpMatchedMP; //vecter 선언
             vpMatchedMP.resize(mpCurrentKF->GetMapPointMatches().size(), static_cast<MapPoint*>(NULL));  //vecter resize
 
-            nNumProjMatches = FindMatchesByProjection(pCurrentKF, pMatchedKF, gScw_estimation, spAlreadyMatchedMPs, vpMPs, vpMatchedMPs); //다시한번 Find matches (vpMatchedMP 변경)
+            nNumProjMatches = FindMatchesByProjection(pCurrentKF, pMatchedKF, gScw_estimation, spAlreadyMatchedMPs, vpMPs, vpMatchedMPs, region); //다시한번 Find matches (vpMatchedMP 변경)
             if(nNumProjMatches >= nProjMatchesRep) //추출된 map point의 갯수가 nProjMatchesRep보다 클때 성공
             {
                 gScw = gScw_estimation;
@@ -634,27 +870,44 @@ bool LoopClosing::DetectCommonRegionsFromBoW(std::vector<KeyFrame*> &vpBowCand,
 
     int nNumCovisibles = 5;
 
-    ORBmatcher matcherBoW(0.9, true);
-    ORBmatcher matcher(0.75, true);
-    int nNumGuidedMatching = 0;
-
-    KeyFrame* pBestMatchedKF;
-    int nBestMatchesReproj = 0;
-    int nBestNumCoindicendes = 0;
-    g2o::Sim3 g2oBestScw;
-    std::vector<MapPoint*> vpBestMapPoints;
-    std::vector<MapPoint*> vpBestMatchedMapPoints;
+    bool bFixedScale = mbFixScale;
+    if(mpTracker->mSensor==System::IMU_MONOCULAR && !mpCurrentKF->GetMap()->GetIniertialBA2())
+        bFixedScale=false;
 
-    int numCandidates = vpBowCand.size();
-    vector<int> vnStage(numCandidates, 0);
-    vector<int> vnMatchesStage(numCandidates, 0);
+    const int numCandidates = vpBowCand.size();
+    const size_t nCurrentMPs = mpCurrentKF->GetMapPointMatches().size();
+    const vector<KeyFrame*> vpCurrentCovKFs = mpCurrentKF->GetBestCovisibilityKeyFrames(nNumCovisibles);
 
-    int index = 0;
-    for(KeyFrame* pKFi : vpBowCand)
+    // Result of the verification of each candidate
+    struct CandidateResult
     {
-        if(!pKFi || pKFi->isBad())
-            continue;
+        CandidateResult(): nMatchesReproj(0), nNumCoincidences(0), pMatchedKF(static_cast<KeyFrame*>(NULL)) {}
+        int nMatchesReproj;
+        int nNumCoincidences;
+        KeyFrame* pMatchedKF;
+        g2o::Sim3 g2oScw;
+        std::vector<MapPoint*> vpMapPoints;
+        std::vector<MapPoint*> vpMatchedMapPoints;
+    };
+    vector<CandidateResult,Eigen::aligned_allocator<CandidateResult> > vResults(numCandidates);
+
+    //^ 후보들은 서로 독립적이므로 병렬로 검증. 검증(3개 이상의 coincidence)에 성공한 후보 중 index가 가장 작은 것을 사용하고,
+    //^ 그보다 뒤의 후보들은 중단. 앞의 후보들은 끝까지 진행하므로 결과는 thread timing에 의존하지 않음
+    std::mutex mutexVerified;
+    int nFirstVerified = numCandidates;
+    auto isAborted = [&](int i){
+        unique_lock<mutex> lock(mutexVerified);
+        return nFirstVerified < i;
+    };
+
+    auto verifyCandidate = [&](int i)
+    {
+        KeyFrame* pKFi = vpBowCand[i];
+        if(!pKFi || pKFi->isBad() || isAborted(i))
+            return;
 
+        ORBmatcher matcherBoW(0.9, true);
+        ORBmatcher matcher(0.75, true);
 
         // Current KF against KF with covisibles version
         std::vector<KeyFrame*> vpCovKFi = pKFi->GetBestCovisibilityKeyFrames(nNumCovisibles);
@@ -669,8 +922,8 @@ bool LoopClosing::DetectCommonRegionsFromBoW(std::vector<KeyFrame*> &vpBowCand,
         KeyFrame* pMostBoWMatchesKF = pKFi;
         int nMostBoWNumMatches = 0;
 
-        std::vector<MapPoint*> vpMatchedPoints = std::vector<MapPoint*>(mpCurrentKF->GetMapPointMatches().size(), static_cast<MapPoint*>(NULL));
-        std::vector<KeyFrame*> vpKeyFrameMatchedMP = std::vector<KeyFrame*>(mpCurrentKF->GetMapPointMatches().size(), static_cast<KeyFrame*>(NULL));
+        std::vector<MapPoint*> vpMatchedPoints = std::vector<MapPoint*>(nCurrentMPs, static_cast<MapPoint*>(NULL));
+        std::vector<KeyFrame*> vpKeyFrameMatchedMP = std::vector<KeyFrame*>(nCurrentMPs, static_cast<KeyFrame*>(NULL));
 
         int nIndexMostBoWMatchesKF=0;
         for(int j=0; j<vpCovKFi.size(); ++j)
@@ -712,172 +965,163 @@ bool LoopClosing::DetectCommonRegionsFromBoW(std::vector<KeyFrame*> &vpBowCand,
             }
         }
 
-        if(!bAbortByNearKF && numBoWMatches >= nBoWMatches) // TODO pick a good threshold
+        if(bAbortByNearKF || numBoWMatches < nBoWMatches) // TODO pick a good threshold
+            return;
+
+        // Geometric validation
+        Sim3Solver solver = Sim3Solver(mpCurrentKF, pMostBoWMatchesKF, vpMatchedPoints, bFixedScale, vpKeyFrameMatchedMP);
+        solver.SetRansacParameters(0.99, nBoWInliers, 300); // at least 15 inliers
+        solver.SetSamplingStrategy(RansacSampler::PROSAC, true);
+
+        bool bNoMore = false;
+        vector<bool> vbInliers;
+        int nInliers;
+        bool bConverge = false;
+        cv::Mat mTcm;
+        while(!bConverge && !bNoMore)
         {
-            // Geometric validation
+            if(isAborted(i))
+                return;
+            mTcm = solver.iterate(20,bNoMore, vbInliers, nInliers, bConverge);
+        }
 
-            bool bFixedScale = mbFixScale;
-            if(mpTracker->mSensor==System::IMU_MONOCULAR && !mpCurrentKF->GetMap()->GetIniertialBA2())
-                bFixedScale=false;
+        if(!bConverge || isAborted(i))
+            return;
 
-            Sim3Solver solver = Sim3Solver(mpCurrentKF, pMostBoWMatchesKF, vpMatchedPoints, bFixedScale, vpKeyFrameMatchedMP);
-            solver.SetRansacParameters(0.99, nBoWInliers, 300); // at least 15 inliers
+        vpCovKFi.clear();
+        vpCovKFi = pMostBoWMatchesKF->GetBestCovisibilityKeyFrames(nNumCovisibles);
+        vpCovKFi.push_back(pMostBoWMatchesKF);
 
-            bool bNoMore = false;
-            vector<bool> vbInliers;
-            int nInliers;
-            bool bConverge = false;
-            cv::Mat mTcm;
-            while(!bConverge && !bNoMore)
+        set<MapPoint*> spMapPoints;
+        vector<MapPoint*> vpMapPoints;
+        vector<KeyFrame*> vpKeyFrames;
+        for(KeyFrame* pCovKFi : vpCovKFi)
+        {
+            for(MapPoint* pCovMPij : pCovKFi->GetMapPointMatches())
             {
-                mTcm = solver.iterate(20,bNoMore, vbInliers, nInliers, bConverge);
-            }
+                if(!pCovMPij || pCovMPij->isBad())
+                    continue;
 
-            if(bConverge)
-            {
-                vpCovKFi.clear();
-                vpCovKFi = pMostBoWMatchesKF->GetBestCovisibilityKeyFrames(nNumCovisibles);
-                int nInitialCov = vpCovKFi.size();
-                vpCovKFi.push_back(pMostBoWMatchesKF);
-                set<KeyFrame*> spCheckKFs(vpCovKFi.begin(), vpCovKFi.end());
-
-                set<MapPoint*> spMapPoints;
-                vector<MapPoint*> vpMapPoints;
-                vector<KeyFrame*> vpKeyFrames;
-                for(KeyFrame* pCovKFi : vpCovKFi)
+                if(spMapPoints.find(pCovMPij) == spMapPoints.end())
                 {
-                    for(MapPoint* pCovMPij : pCovKFi->GetMapPointMatches())
-                    {
-                        if(!pCovMPij || pCovMPij->isBad())
-                            continue;
-
-                        if(spMapPoints.find(pCovMPij) == spMapPoints.end())
-                        {
-                            spMapPoints.insert(pCovMPij);
-                            vpMapPoints.push_back(pCovMPij);
-                            vpKeyFrames.push_back(pCovKFi);
-                        }
-                    }
+                    spMapPoints.insert(pCovMPij);
+                    vpMapPoints.push_back(pCovMPij);
+                    vpKeyFrames.push_back(pCovKFi);
                 }
+            }
+        }
 
-                g2o::Sim3 gScm(Converter::toMatrix3d(solver.GetEstimatedRotation()),Converter::toVector3d(solver.GetEstimatedTranslation()),solver.GetEstimatedScale());
-                g2o::Sim3 gSmw(Converter::toMatrix3d(pMostBoWMatchesKF->GetRotation()),Converter::toVector3d(pMostBoWMatchesKF->GetTranslation()),1.0);
-                g2o::Sim3 gScw = gScm*gSmw; // Similarity matrix of current from the world position
-                cv::Mat mScw = Converter::toCvMat(gScw);
-
+        g2o::Sim3 gScm(Converter::toMatrix3d(solver.GetEstimatedRotation()),Converter::toVector3d(solver.GetEstimatedTranslation()),solver.GetEstimatedScale());
+        g2o::Sim3 gSmw(Converter::toMatrix3d(pMostBoWMatchesKF->GetRotation()),Converter::toVector3d(pMostBoWMatchesKF->GetTranslation()),1.0);
+        g2o::Sim3 gScw = gScm*gSmw; // Similarity matrix of current from the world position
+        cv::Mat mScw = Converter::toCvMat(gScw);
 
-                vector<MapPoint*> vpMatchedMP;
-                vpMatchedMP.resize(mpCurrentKF->GetMapPointMatches().size(), static_cast<MapPoint*>(NULL));
-                vector<KeyFrame*> vpMatchedKF;
-                vpMatchedKF.resize(mpCurrentKF->GetMapPointMatches().size(), static_cast<KeyFrame*>(NULL));
-                int numProjMatches = matcher.SearchByProjection(mpCurrentKF, mScw, vpMapPoints, vpKeyFrames, vpMatchedMP, vpMatchedKF, 8, 1.5);
+        vector<MapPoint*> vpMatchedMP;
+        vpMatchedMP.resize(nCurrentMPs, static_cast<MapPoint*>(NULL));
+        vector<KeyFrame*> vpMatchedKF;
+        vpMatchedKF.resize(nCurrentMPs, static_cast<KeyFrame*>(NULL));
+        int numProjMatches = matcher.SearchByProjection(mpCurrentKF, mScw, vpMapPoints, vpKeyFrames, vpMatchedMP, vpMatchedKF, 8, 1.5);
 
-                if(numProjMatches >= nProjMatches)
-                {
-                    // Optimize Sim3 transformation with every matches
-                    Eigen::Matrix<double, 7, 7> mHessian7x7;
+        if(numProjMatches < nProjMatches || isAborted(i))
+            return;
 
-                    bool bFixedScale = mbFixScale;
-                    if(mpTracker->mSensor==System::IMU_MONOCULAR && !mpCurrentKF->GetMap()->GetIniertialBA2())
-                        bFixedScale=false;
+        // Optimize Sim3 transformation with every matches
+        Eigen::Matrix<double, 7, 7> mHessian7x7;
 
-                    int numOptMatches = Optimizer::OptimizeSim3(mpCurrentKF, pKFi, vpMatchedMP, gScm, 10, mbFixScale, mHessian7x7, true);
+        int numOptMatches = Optimizer::OptimizeSim3(mpCurrentKF, pKFi, vpMatchedMP, gScm, 10, mbFixScale, mHessian7x7, true);
 
-                    if(numOptMatches >= nSim3Inliers)
-                    {
-                        g2o::Sim3 gSmw(Converter::toMatrix3d(pMostBoWMatchesKF->GetRotation()),Converter::toVector3d(pMostBoWMatchesKF->GetTranslation()),1.0);
-                        g2o::Sim3 gScw = gScm*gSmw; // Similarity matrix of current from the world position
-                        cv::Mat mScw = Converter::toCvMat(gScw);
+        if(numOptMatches < nSim3Inliers || isAborted(i))
+            return;
 
-                        vector<MapPoint*> vpMatchedMP;
-                        vpMatchedMP.resize(mpCurrentKF->GetMapPointMatches().size(), static_cast<MapPoint*>(NULL));
-                        int numProjOptMatches = matcher.SearchByProjection(mpCurrentKF, mScw, vpMapPoints, vpMatchedMP, 5, 1.0);
+        gScw = gScm*gSmw;
+        mScw = Converter::toCvMat(gScw);
 
-                        if(numProjOptMatches >= nProjOptMatches)
-                        {
-                            int nNumKFs = 0;
-                            // Check the Sim3 transformation with the current KeyFrame covisibles
-                            vector<KeyFrame*> vpCurrentCovKFs = mpCurrentKF->GetBestCovisibilityKeyFrames(nNumCovisibles);
-                            int j = 0;
-                            while(nNumKFs < 3 && j<vpCurrentCovKFs.size())
-                            {
-                                KeyFrame* pKFj = vpCurrentCovKFs[j];
-                                cv::Mat mTjc = pKFj->GetPose() * mpCurrentKF->GetPoseInverse();
-                                g2o::Sim3 gSjc(Converter::toMatrix3d(mTjc.rowRange(0, 3).colRange(0, 3)),Converter::toVector3d(mTjc.rowRange(0, 3).col(3)),1.0);
-                                g2o::Sim3 gSjw = gSjc * gScw;
-                                int numProjMatches_j = 0;
-                                vector<MapPoint*> vpMatchedMPs_j;
-                                bool bValid = DetectCommonRegionsFromLastKF(pKFj,pMostBoWMatchesKF, gSjw,numProjMatches_j, vpMapPoints, vpMatchedMPs_j);
-
-                                if(bValid)
-                                {
-                                    nNumKFs++;
-                                }
+        vpMatchedMP.assign(nCurrentMPs, static_cast<MapPoint*>(NULL));
+        int numProjOptMatches = matcher.SearchByProjection(mpCurrentKF, mScw, vpMapPoints, vpMatchedMP, 5, 1.0);
 
-                                j++;
-                            }
+        if(numProjOptMatches < nProjOptMatches)
+            return;
 
-                            if(nNumKFs < 3)
-                            {
-                                vnStage[index] = 8;
-                                vnMatchesStage[index] = nNumKFs;
-                            }
+        int nNumKFs = 0;
+        // Check the Sim3 transformation with the current KeyFrame covisibles (same region of pMostBoWMatchesKF for all)
+        ProjectionRegion region;
+        int j = 0;
+        while(nNumKFs < 3 && j<vpCurrentCovKFs.size())
+        {
+            KeyFrame* pKFj = vpCurrentCovKFs[j];
+            cv::Mat mTjc = pKFj->GetPose() * mpCurrentKF->GetPoseInverse();
+            g2o::Sim3 gSjc(Converter::toMatrix3d(mTjc.rowRange(0, 3).colRange(0, 3)),Converter::toVector3d(mTjc.rowRange(0, 3).col(3)),1.0);
+            g2o::Sim3 gSjw = gSjc * gScw;
+            int numProjMatches_j = 0;
+            vector<MapPoint*> vpMatchedMPs_j;
+            bool bValid = DetectCommonRegionsFromLastKF(pKFj,pMostBoWMatchesKF, gSjw,numProjMatches_j, vpMapPoints, vpMatchedMPs_j, region);
+
+            if(bValid)
+            {
+                nNumKFs++;
+            }
 
-                            if(nBestMatchesReproj < numProjOptMatches)
-                            {
-                                nBestMatchesReproj = numProjOptMatches;
-                                nBestNumCoindicendes = nNumKFs;
-                                pBestMatchedKF = pMostBoWMatchesKF;
-                                g2oBestScw = gScw;
-                                vpBestMapPoints = vpMapPoints;
-                                vpBestMatchedMapPoints = vpMatchedMP;
-                            }
+            j++;
+        }
 
+        CandidateResult &result = vResults[i];
+        result.nMatchesReproj = numProjOptMatches;
+        result.nNumCoincidences = nNumKFs;
+        result.pMatchedKF = pMostBoWMatchesKF;
+        result.g2oScw = gScw;
+        result.vpMapPoints = vpMapPoints;
+        result.vpMatchedMapPoints = vpMatchedMP;
 
-                        }
+        if(nNumKFs >= 3)
+        {
+            unique_lock<mutex> lock(mutexVerified);
+            nFirstVerified = std::min(nFirstVerified, i);
+        }
+    };
 
-                    }
+    if(mpThreadPool && numCandidates>1)
+        mpThreadPool->ParallelFor(0, numCandidates, verifyCandidate);
+    else
+        for(int i=0; i<numCandidates && nFirstVerified==numCandidates; i++)
+            verifyCandidate(i);
 
-                }
+    // Without a verified candidate, the one with most reprojection matches keeps the coincidences count
+    int nBest = nFirstVerified;
+    if(nBest == numCandidates)
+    {
+        int nBestMatchesReproj = 0;
+        for(int i=0; i<numCandidates; i++)
+        {
+            if(vResults[i].nMatchesReproj > nBestMatchesReproj)
+            {
+                nBestMatchesReproj = vResults[i].nMatchesReproj;
+                nBest = i;
             }
         }
-        index++;
     }
 
-    if(nBestMatchesReproj > 0)
+    if(nBest < numCandidates)
     {
+        CandidateResult &best = vResults[nBest];
         pLastCurrentKF = mpCurrentKF;
-        nNumCoincidences = nBestNumCoindicendes;
-        pMatchedKF2 = pBestMatchedKF;
+        nNumCoincidences = best.nNumCoincidences;
+        pMatchedKF2 = best.pMatchedKF;
         pMatchedKF2->SetNotErase();
-        g2oScw = g2oBestScw;
-        vpMPs = vpBestMapPoints;
-        vpMatchedMPs = vpBestMatchedMapPoints;
+        g2oScw = best.g2oScw;
+        vpMPs.swap(best.vpMapPoints);
+        vpMatchedMPs.swap(best.vpMatchedMapPoints);
 
         return nNumCoincidences >= 3;
     }
-    else
-    {
-        int maxStage = -1;
-        int maxMatched;
-        for(int i=0; i<vnStage.size(); ++i)
-        {
-            if(vnStage[i] > maxStage)
-            {
-                maxStage = vnStage[i];
-                maxMatched = vnMatchesStage[i];
-            }
-        }
 
-    }
     return false;
 }
 
 bool LoopClosing::DetectCommonRegionsFromLastKF(KeyFrame* pCurrentKF, KeyFrame* pMatchedKF, g2o::Sim3 &gScw, int &nNumProjMatches,
-                                                std::vector<MapPoint*> &vpMPs, std::vector<MapPoint*> &vpMatchedMPs)
+                                                std::vector<MapPoint*> &vpMPs, std::vector<MapPoint*> &vpMatchedMPs, ProjectionRegion &region)
 {
     set<MapPoint*> spAlreadyMatchedMPs(vpMatchedMPs.begin(), vpMatchedMPs.end()); //Matched map point들을 container 형태로 선언 
-    nNumProjMatches = FindMatchesByProjection(pCurrentKF, pMatchedKF, gScw, spAlreadyMatchedMPs, vpMPs, vpMatchedMPs); //위의 선언된 map point들을 pCurrentKF, pMatchedKF에서 matching하고 최적화
+    nNumProjMatches = FindMatchesByProjection(pCurrentKF, pMatchedKF, gScw, spAlreadyMatchedMPs, vpMPs, vpMatchedMPs, region); //위의 선언된 map point들을 pCurrentKF, pMatchedKF에서 matching하고 최적화
 
     int nProjMatches = 30; //기준치 선언
     if(nNumProjMatches >= nProjMatches)
@@ -889,50 +1133,76 @@ bool LoopClosing::DetectCommonRegionsFromLastKF(KeyFrame* pCurrentKF, KeyFrame*
     return false;
 }
 
-int LoopClosing::FindMatchesByProjection(KeyFrame* pCurrentKF, KeyFrame* pMatchedKFw, g2o::Sim3 &g2oScw,
-                                         set<MapPoint*> &spMatchedMPinOrigin, vector<MapPoint*> &vpMapPoints,
-                                         vector<MapPoint*> &vpMatchedMapPoints)
+void LoopClosing::UpdateProjectionRegion(KeyFrame* pMatchedKF, ProjectionRegion &region)
 {
+    //^ 같은 matched KF이고 region KF들의 covisibility와 match가 그대로면 이전 검증의 map point들을 재사용 (bad가 된 point만 제거)
+    bool bReuse = region.pMatchedKF==pMatchedKF && !region.vpKFs.empty();
+    for(size_t i=0; bReuse && i<region.nGraphKFs; i++)
+        bReuse = region.vpKFs[i]->GetGraphVersion()==region.vnGraphVersions[i];
+    for(size_t i=0; bReuse && i<region.vpKFs.size(); i++)
+        bReuse = region.vpKFs[i]->GetMatchesVersion()==region.vnMatchesVersions[i];
+
+    if(bReuse)
+    {
+        size_t nKept = 0;
+        for(size_t i=0; i<region.vpMapPoints.size(); i++)
+            if(!region.vpMapPoints[i]->isBad())
+                region.vpMapPoints[nKept++] = region.vpMapPoints[i];
+        region.vpMapPoints.resize(nKept);
+        return;
+    }
+
     int nNumCovisibles = 5; //covisible 기준치 선언
-    vector<KeyFrame*> vpCovKFm = pMatchedKFw->GetBestCovisibilityKeyFrames(nNumCovisibles); //MatchedKF에서 기준치보다 작은 사이즈의 mvpOrderedConnectedKeyFrames를 반환.
-                                                                                            //mvpOrderedConnectedKeyFrames는 best covisible KF을 추출하는 함수에서 나온 KF이다.
-    int nInitialCov = vpCovKFm.size(); //초기 covisible KF 선언
-    vpCovKFm.push_back(pMatchedKFw); //pMatchedKFw push back
-    set<KeyFrame*> spCheckKFs(vpCovKFm.begin(), vpCovKFm.end()); //spCheckKFs container 선언
-    set<KeyFrame*> spCurrentCovisbles = pCurrentKF->GetConnectedKeyFrames(); //spCurrentCovisbles container 선언, CurrentKF에서 GetConnectedKeyFrames 즉, weight 값을 가져옴.
-    for(int i=0; i<nInitialCov; ++i) //for문 시작
-    {
-        vector<KeyFrame*> vpKFs = vpCovKFm[i]->GetBestCovisibilityKeyFrames(nNumCovisibles); //위 함수와 동일
-        int nInserted = 0; //시작점
-        int j = 0; //시작점
-        while(j < vpKFs.size() && nInserted < nNumCovisibles) //while문 시작
-        {
-            if(spCheckKFs.find(vpKFs[j]) == spCheckKFs.end() && spCurrentCovisbles.find(vpKFs[j]) == spCurrentCovisbles.end())
-            {
-                spCheckKFs.insert(vpKFs[j]); //위 조건문 통과하면 spCheckKFs에 입력하고 
-                ++nInserted; //nInserted값 증가
-            }
-            ++j; //j 증가
-        }
-        vpCovKFm.insert(vpCovKFm.end(), vpKFs.begin(), vpKFs.end()); //container에 insert
+    region.pMatchedKF = pMatchedKF;
+
+    // Versions are read before the lists, a change in between makes the region stale next time
+    const unsigned long nMatchedGraphVersion = pMatchedKF->GetGraphVersion();
+    vector<KeyFrame*> vpCovKFm = pMatchedKF->GetBestCovisibilityKeyFrames(nNumCovisibles); //MatchedKF에서 기준치보다 작은 사이즈의 mvpOrderedConnectedKeyFrames를 반환.
+
+    //^ 순서: matched KF의 best covisible, matched KF, 각 best covisible의 best covisible (중복 제거, map point 순서는 그대로)
+    region.vpKFs = vpCovKFm;
+    region.vpKFs.push_back(pMatchedKF);
+    region.nGraphKFs = region.vpKFs.size();
+    region.vnGraphVersions.resize(region.nGraphKFs);
+    for(size_t i=0; i<vpCovKFm.size(); i++)
+        region.vnGraphVersions[i] = vpCovKFm[i]->GetGraphVersion();
+    region.vnGraphVersions.back() = nMatchedGraphVersion;
+
+    set<KeyFrame*> spRegionKFs(region.vpKFs.begin(), region.vpKFs.end());
+    for(size_t i=0; i<vpCovKFm.size(); i++)
+    {
+        const vector<KeyFrame*> vpKFs = vpCovKFm[i]->GetBestCovisibilityKeyFrames(nNumCovisibles);
+        for(size_t j=0; j<vpKFs.size(); j++)
+            if(spRegionKFs.insert(vpKFs[j]).second)
+                region.vpKFs.push_back(vpKFs[j]);
     }
+
+    region.vnMatchesVersions.resize(region.vpKFs.size());
     set<MapPoint*> spMapPoints; //Mappoint container 선언
-    vpMapPoints.clear(); //Map point clear
-    vpMatchedMapPoints.clear(); //vpMatchedMapPoints clear
-    for(KeyFrame* pKFi : vpCovKFm) //for문 시작
+    region.vpMapPoints.clear();
+    for(size_t i=0; i<region.vpKFs.size(); i++)
     {
+        KeyFrame* pKFi = region.vpKFs[i];
+        region.vnMatchesVersions[i] = pKFi->GetMatchesVersion();
         for(MapPoint* pMPij : pKFi->GetMapPointMatches()) //GetMapPointMatches 추출
         {
             if(!pMPij || pMPij->isBad()) //결국 vpCovKFm에서 뽑은 pMPij가 is Bad이거나 없거나 하면 
                 continue; //그냥 지나간다.
 
-            if(spMapPoints.find(pMPij) == spMapPoints.end()) //pMPij와 end값 비교하고 (초기값은 end)
-            {
-                spMapPoints.insert(pMPij); //같다면 spMapPoints에 pMPij insert
-                vpMapPoints.push_back(pMPij); //vpMapPointsdpeh insert
-            }
+            if(spMapPoints.insert(pMPij).second)
+                region.vpMapPoints.push_back(pMPij);
         }
     }
+}
+
+int LoopClosing::FindMatchesByProjection(KeyFrame* pCurrentKF, KeyFrame* pMatchedKFw, g2o::Sim3 &g2oScw,
+                                         set<MapPoint*> &spMatchedMPinOrigin, vector<MapPoint*> &vpMapPoints,
+                                         vector<MapPoint*> &vpMatchedMapPoints, ProjectionRegion &region)
+{
+    //^ pMatchedKFw 주변 region의 map point들 (변하지 않았으면 이전 검증에서 모은 것)
+    UpdateProjectionRegion(pMatchedKFw, region);
+    vpMapPoints = region.vpMapPoints;
+    vpMatchedMapPoints.clear(); //vpMatchedMapPoints clear
 
     cv::Mat mScw = Converter::toCvMat(g2oScw);
 
@@ -946,6 +1216,7 @@ int LoopClosing::FindMatchesByProjection(KeyFrame* pCurrentKF, KeyFrame* pMatche
 
 void LoopClosing::CorrectLoop()
 {
+    ORB_TRACE_SCOPE("LoopClosing::CorrectLoop");
     cout << "Loop detected!" << endl;
 
     // Send a stop signal to Local Mapping
@@ -957,28 +1228,16 @@ void LoopClosing::CorrectLoop()
 
 
     // If a Global Bundle Adjustment is running, abort it
-    // Global Bundle Adjustment가 수행될 경우, 이를 중단합니다.
+    // Global Bundle Adjustment가 수행될 경우, 이를 중단합니다. (완료된 iteration의 결과는 유지)
     cout << "Request GBA abort" << endl;
-    if(isRunningGBA())      // GBA가 실행되고 있는지 확인 : mbRunningGBA이라는 변수의 상태 확인
-    {
-        unique_lock<mutex> lock(mMutexGBA);
-        mbStopGBA = true;   // mbStopGBA를 true로 바꾸므로써, 중단했다는 것을 알려줌
+    StopGBA();
 
-        mnFullBAIdx++;  // Bundle Adjustment Index 1 증가
-
-        if(mpThreadGBA)
-        {
-            cout << "GBA running... Abort!" << endl;
-            mpThreadGBA->detach();  // 쓰레드를 떼어내서 독립적으로 작동하게끔한다.
-            delete mpThreadGBA; // 쓰레드 메모리 해제 - 참고 : C++ 스레드의 분류와 사용법[https://m.blog.naver.com/PostView.naver?isHttpsRedirect=true&blogId=ghoism51&logNo=220190125981]  
-        }
-    }
+    // The submaps of the previous loop are moved before this one is corrected (its GBA is replaced by the new one)
+    mpDeferredGBAMap = static_cast<Map*>(NULL);
+    ApplyPendingSubmaps(-1);
 
     // Wait until Local Mapping has effectively stopped
-    while(!mpLocalMapper->isStopped())  // Stop일 때까지 while문을 계속 돈다.
-    {
-        usleep(1000);   // usleep을 이용하여 Local Mapping이 Stop할 때가지 잠시 대기 1000 micro second
-    }
+    mpLocalMapper->WaitUntilStopped();
 
     // Ensure current keyframe is updated
     cout << "start updating connections" << endl;
@@ -1002,7 +1261,9 @@ void LoopClosing::CorrectLoop()
     // 참고 : https://m.blog.naver.com/PostView.naver?isHttpsRedirect=true&blogId=muri1004&logNo=221276270566
     {
         // Get Map Mutex
-        unique_lock<mutex> lock(pLoopMap->mMutexMapUpdate);
+        ORB_TRACE_BEGIN(traceWaitMap, "LoopClosing::WaitMapUpdate");
+        unique_lock<MapUpdateMutex> lock(pLoopMap->mMutexMapUpdate);
+        ORB_TRACE_END(traceWaitMap);
 
         const bool bImuInit = pLoopMap->isImuInitialized(); // IMU가 Initialzied 되어 있으면 true, 되어 있지 않으면 false로 선언
 
@@ -1188,17 +1449,58 @@ void LoopClosing::CorrectLoop()
     if(mpTracker->mSensor==System::IMU_MONOCULAR && !mpCurrentKF->GetMap()->GetIniertialBA2())
         bFixedScale=false;
 
-    // IMU를 사용 && IMU가 초기화 완료된 경우
-    if(pLoopMap->IsInertial() && pLoopMap->isImuInitialized())
+    // With submaps only the graph of their anchors is optimized, so the correction does not grow with the map.
+    // The submaps around the loop are moved now and the rest later by Run(), nearest first
+    bool bSubmapCorrection = false;
+    if(pLoopMap->GetKeyFramesPerSubmap()>0 && !(pLoopMap->IsInertial() && pLoopMap->isImuInitialized()))
     {
-        // (x,y,z,yaw)값을 최적화
-        Optimizer::OptimizeEssentialGraph4DoF(pLoopMap, mpLoopMatchedKF, mpCurrentKF, NonCorrectedSim3, CorrectedSim3, LoopConnections);
+        SubmapAndPose InitialSubmapSim3, OptimizedSubmapSim3;
+        if(Optimizer::OptimizeSubmapGraph(pLoopMap, mpLoopMatchedKF, mpCurrentKF, NonCorrectedSim3, CorrectedSim3, LoopConnections,
+                                          bFixedScale, InitialSubmapSim3, OptimizedSubmapSim3))
+        {
+            ApplySubmapCorrection(pLoopMap, NonCorrectedSim3, CorrectedSim3, InitialSubmapSim3, OptimizedSubmapSim3);
+            bSubmapCorrection = true;
+        }
     }
-    else // IMU를 사용하지 않는 경우
+
+    if(!bSubmapCorrection)
     {
-        // (x,y,z,roll,pitch,yaw,scale)값을 최적화
-        // "Fast Relocalisation and Loop Closing in Keyframe-Based SLAM"
-        Optimizer::OptimizeEssentialGraph(pLoopMap, mpLoopMatchedKF, mpCurrentKF, NonCorrectedSim3, CorrectedSim3, LoopConnections, bFixedScale);
+        // Non-blocking mode: the local map around the loop is already corrected and fused, so Local Mapping
+        // can go on while the essential graph is optimized. The result is applied afterwards with Local Mapping stopped.
+        KeyFrameAndPose InitialSim3, OptimizedSim3;
+        KeyFrameAndPose* pInitialSim3 = static_cast<KeyFrameAndPose*>(NULL);
+        KeyFrameAndPose* pOptimizedSim3 = static_cast<KeyFrameAndPose*>(NULL);
+        if(mbNonBlockingCorrection)
+        {
+            pInitialSim3 = &InitialSim3;
+            pOptimizedSim3 = &OptimizedSim3;
+            mpLocalMapper->Release();
+        }
+
+        // IMU를 사용 && IMU가 초기화 완료된 경우
+        const bool b4DoF = pLoopMap->IsInertial() && pLoopMap->isImuInitialized();
+        if(b4DoF)
+        {
+            // (x,y,z,yaw)값을 최적화
+            Optimizer::OptimizeEssentialGraph4DoF(pLoopMap, mpLoopMatchedKF, mpCurrentKF, NonCorrectedSim3, CorrectedSim3, LoopConnections,
+                                                  pInitialSim3, pOptimizedSim3);
+        }
+        else // IMU를 사용하지 않는 경우
+        {
+            // (x,y,z,roll,pitch,yaw,scale)값을 최적화
+            // "Fast Relocalisation and Loop Closing in Keyframe-Based SLAM"
+            Optimizer::OptimizeEssentialGraph(pLoopMap, mpLoopMatchedKF, mpCurrentKF, NonCorrectedSim3, CorrectedSim3, LoopConnections, bFixedScale,
+                                              pInitialSim3, pOptimizedSim3);
+            if(mpMetrics)
+                mpMetrics->SetGauge(Metrics::ESSENTIAL_GRAPH_ITERATIONS, Optimizer::GetLastIterationStats().nIterations);
+        }
+
+        if(mbNonBlockingCorrection)
+        {
+            mpLocalMapper->RequestStop();
+            mpLocalMapper->WaitUntilStopped();
+            ApplyEssentialGraphCorrection(pLoopMap, InitialSim3, OptimizedSim3, b4DoF);
+        }
     }
 
     // 큰 변화에 대한 알림
@@ -1216,13 +1518,16 @@ void LoopClosing::CorrectLoop()
     // "True" == (IMU 초기화 || KF 개수 200개 미만 && AtalsMap 개수 1개)
     if(!pLoopMap->isImuInitialized() || (pLoopMap->KeyFramesInMap()<200 && mpAtlas->CountMaps()==1))
     {
-        mbRunningGBA = true;
-        mbFinishedGBA = false;
-        mbStopGBA = false;
-        
         // GBA 수행
         // LoopKF과 CurrKF 및 covisibility KF들의 pose와 map-point들을 최적화
-        mpThreadGBA = new thread(&LoopClosing::RunGlobalBundleAdjustment, this, pLoopMap, mpCurrentKF->mnId);
+        // Submap이 남아 있으면 모두 보정된 뒤에 시작
+        if(mlPendingSubmaps.empty())
+            LaunchGlobalBundleAdjustment(pLoopMap, mpCurrentKF->mnId);
+        else
+        {
+            mpDeferredGBAMap = pLoopMap;
+            mnDeferredGBALoopKF = mpCurrentKF->mnId;
+        }
     }
 
     // Loop closed. Release Local Mapping.
@@ -1232,98 +1537,370 @@ void LoopClosing::CorrectLoop()
     mLastLoopKFid = mpCurrentKF->mnId; //TODO old varible, it is not use in the new algorithm
 }
 
-void LoopClosing::MergeLocal()
+void LoopClosing::ApplyEssentialGraphCorrection(Map* pMap, const KeyFrameAndPose &InitialSim3, const KeyFrameAndPose &OptimizedSim3, const bool b4DoF)
 {
-    Verbose::PrintMess("MERGE: Merge Visual detected!!!!", Verbose::VERBOSITY_NORMAL);
-
-    int numTemporalKFs = 15;
-
-    //Relationship to rebuild the essential graph, it is used two times, first in the local window and later in the rest of the map
-    KeyFrame* pNewChild;
-    KeyFrame* pNewParent;
-
-    vector<KeyFrame*> vpLocalCurrentWindowKFs;
-    vector<KeyFrame*> vpMergeConnectedKFs;
+    unique_lock<MapUpdateMutex> lock(pMap->mMutexMapUpdate);
+
+    const Map::KeyFrameGraphSnapshot pGraph = pMap->GetKeyFrameGraph();
+    const Map::KeyFrameGraph &graph = *pGraph;
+    const vector<KeyFrame*> &vpKFs = graph.vpKeyFrames;
+    const Map::MapPointsSnapshot pMPs = pMap->GetMapPointsSnapshot();
+    const vector<MapPoint*> &vpMPs = *pMPs;
+    const unsigned long int nMaxKFid = max(pMap->GetMaxKFid(), graph.vnIds.empty() ? 0UL : graph.vnIds.back());
+
+    // Similarity of the world that takes each keyframe from its initial to its optimized pose
+    vector<g2o::Sim3,Eigen::aligned_allocator<g2o::Sim3> > vCorrection(nMaxKFid+1);
+    vector<bool> vbCorrected(nMaxKFid+1,false);
+    for(KeyFrameAndPose::const_iterator mit=OptimizedSim3.begin(), mend=OptimizedSim3.end(); mit!=mend; mit++)
+    {
+        KeyFrameAndPose::const_iterator iti = InitialSim3.find(mit->first);
+        if(iti==InitialSim3.end() || mit->first->mnId>nMaxKFid)
+            continue;
 
-    // Flag that is true only when we stopped a running BA, in this case we need relaunch at the end of the merge
-    bool bRelaunchBA = false;
+        vCorrection[mit->first->mnId] = mit->second.inverse()*iti->second;
+        vbCorrected[mit->first->mnId] = true;
+    }
 
-    Verbose::PrintMess("MERGE: Check Full Bundle Adjustment", Verbose::VERBOSITY_DEBUG);
-    // If a Global Bundle Adjustment is running, abort it
-    if(isRunningGBA())
+    // Keyframes inserted during the optimization follow their closest ancestor in the spanning tree,
+    // walked on the parent indices of the keyframe graph (by increasing id, as vpKFs)
+    for(int i=0; i<graph.size(); i++)
     {
-        unique_lock<mutex> lock(mMutexGBA);
-        mbStopGBA = true;
+        KeyFrame* pKFi = vpKFs[i];
+        if(pKFi->isBad() || vbCorrected[pKFi->mnId])
+            continue;
 
-        mnFullBAIdx++;
+        int p = graph.vParent[i];
+        for(int j=0; p>=0 && !vbCorrected[graph.vnIds[p]] && j<graph.size(); j++)
+            p = graph.vParent[p];
 
-        if(mpThreadGBA)
+        if(p>=0 && vbCorrected[graph.vnIds[p]])
         {
-            mpThreadGBA->detach();
-            delete mpThreadGBA;
+            vCorrection[pKFi->mnId] = vCorrection[graph.vnIds[p]];
+            vbCorrected[pKFi->mnId] = true;
         }
-        bRelaunchBA = true;
     }
 
-    Verbose::PrintMess("MERGE: Request Stop Local Mapping", Verbose::VERBOSITY_DEBUG);
-    mpLocalMapper->RequestStop();
-    // Wait until Local Mapping has effectively stopped
-    while(!mpLocalMapper->isStopped())
+    // Poses are corrected incrementally so that Local BA updates done meanwhile are kept
+    // SE3 Pose Recovering. Sim3:[sR t;0 1] -> SE3:[R t/s;0 1]
+    for(size_t i=0; i<vpKFs.size(); i++)
     {
-        usleep(1000);
-    }
-    Verbose::PrintMess("MERGE: Local Map stopped", Verbose::VERBOSITY_DEBUG);
+        KeyFrame* pKFi = vpKFs[i];
+        if(pKFi->isBad() || !vbCorrected[pKFi->mnId])
+            continue;
 
-    mpLocalMapper->EmptyQueue();
+        g2o::Sim3 Siw(Converter::toMatrix3d(pKFi->GetRotation_()),Converter::toVector3d(pKFi->GetTranslation_()),1.0);
+        g2o::Sim3 CorrectedSiw = Siw*vCorrection[pKFi->mnId].inverse();
 
-    // Merge map will become in the new active map with the local window of KFs and MPs from the current map.
-    // Later, the elements of the current map will be transform to the new active map reference, in order to keep real time tracking
-    Map* pCurrentMap = mpCurrentKF->GetMap();
-    Map* pMergeMap = mpMergeMatchedKF->GetMap();
+        Eigen::Matrix3d eigR = CorrectedSiw.rotation().toRotationMatrix();
+        Eigen::Vector3d eigt = CorrectedSiw.translation();
+        double s = CorrectedSiw.scale();
 
-    // Ensure current keyframe is updated
-    mpCurrentKF->UpdateConnections();
+        eigt *=(1./s); //[R t/s;0 1]
 
-    //Get the current KF and its neighbors(visual->covisibles; inertial->temporal+covisibles)
-    set<KeyFrame*> spLocalWindowKFs;
-    //Get MPs in the welding area from the current map
-    set<MapPoint*> spLocalWindowMPs;
-    if(pCurrentMap->IsInertial() && pMergeMap->IsInertial()) //TODO Check the correct initialization
+        pKFi->SetPose(Converter::toCvSE3(eigR,eigt));
+    }
+
+    // Same reference keyframe for the points as in the essential graph optimization: the 4DoF one
+    // always takes the reference keyframe of the point
+    for(size_t i=0, iend=vpMPs.size(); i<iend; i++)
     {
-        KeyFrame* pKFi = mpCurrentKF;
-        int nInserted = 0;
-        while(pKFi && nInserted < numTemporalKFs)
-        {
-            spLocalWindowKFs.insert(pKFi);
-            pKFi = mpCurrentKF->mPrevKF;
-            nInserted++;
+        MapPoint* pMP = vpMPs[i];
+        if(pMP->isBad())
+            continue;
 
-            set<MapPoint*> spMPi = pKFi->GetMapPoints();
-            spLocalWindowMPs.insert(spMPi.begin(), spMPi.end());
-        }
+        unsigned long int nIDr;
+        if(!b4DoF && pMP->mnCorrectedByKF==mpCurrentKF->mnId)
+            nIDr = pMP->mnCorrectedReference;
+        else
+            nIDr = pMP->GetReferenceKeyFrame()->mnId;
 
-        pKFi = mpCurrentKF->mNextKF;
-        while(pKFi)
-        {
-            spLocalWindowKFs.insert(pKFi);
+        if(nIDr>nMaxKFid || !vbCorrected[nIDr])
+            continue;
 
-            set<MapPoint*> spMPi = pKFi->GetMapPoints();
-            spLocalWindowMPs.insert(spMPi.begin(), spMPi.end());
-        }
+        Eigen::Matrix<double,3,1> eigP3Dw = Converter::toVector3d(pMP->GetWorldPos2());
+        pMP->SetWorldPos(Converter::toCvMat(vCorrection[nIDr].map(eigP3Dw)));
+        pMP->UpdateNormalAndDepth();
     }
-    else
+
+    pMap->IncreaseChangeIndex();
+}
+
+void LoopClosing::ApplySubmapCorrection(Map* pMap, const KeyFrameAndPose &NonCorrectedSim3, const KeyFrameAndPose &CorrectedSim3,
+                                        const SubmapAndPose &InitialSim3, const SubmapAndPose &OptimizedSim3)
+{
+    const long int nSubmaps = pMap->NumSubmaps();
+
+    // Loop correction of the window as a similarity of the world (CorrectedSiw = Siw*L^-1)
+    const g2o::Sim3 L = CorrectedSim3.find(mpCurrentKF)->second.inverse()*NonCorrectedSim3.find(mpCurrentKF)->second;
+
+    // Similarity of the world that takes each anchor from its initial to its optimized pose
+    vector<g2o::Sim3,Eigen::aligned_allocator<g2o::Sim3> > vCorrection(nSubmaps);
+    vector<bool> vbCorrected(nSubmaps,false);
+    for(SubmapAndPose::const_iterator mit=OptimizedSim3.begin(), mend=OptimizedSim3.end(); mit!=mend; mit++)
     {
-        spLocalWindowKFs.insert(mpCurrentKF);
+        SubmapAndPose::const_iterator iti = InitialSim3.find(mit->first);
+        if(iti==InitialSim3.end() || mit->first>=nSubmaps)
+            continue;
+
+        vCorrection[mit->first] = mit->second.inverse()*iti->second;
+        vbCorrected[mit->first] = true;
     }
 
-    vector<KeyFrame*> vpCovisibleKFs = mpCurrentKF->GetBestCovisibilityKeyFrames(numTemporalKFs);
-    spLocalWindowKFs.insert(vpCovisibleKFs.begin(), vpCovisibleKFs.end());
-    const int nMaxTries = 3;
-    int nNumTries = 0;
-    while(spLocalWindowKFs.size() < numTemporalKFs && nNumTries < nMaxTries)
+    // The submaps of the loop window and of the other side of the loop are moved now
+    vector<bool> vbWindow(nSubmaps,false);
+    vector<bool> vbNow(nSubmaps,false);
+    map<long unsigned int,long int> mWindowSubmaps;
+    for(KeyFrameAndPose::const_iterator mit=CorrectedSim3.begin(), mend=CorrectedSim3.end(); mit!=mend; mit++)
     {
-        vector<KeyFrame*> vpNewCovKFs;
-        vpNewCovKFs.empty();
+        const long int nSubmap = mit->first->mnSubmapId;
+        vbWindow[nSubmap] = vbNow[nSubmap] = true;
+        mWindowSubmaps[mit->first->mnId] = nSubmap;
+    }
+
+    vector<KeyFrame*> vpLoopSideKFs = mpLoopMatchedKF->GetVectorCovisibleKeyFrames();
+    vpLoopSideKFs.push_back(mpLoopMatchedKF);
+    for(size_t i=0; i<vpLoopSideKFs.size(); i++)
+    {
+        const long int nSubmap = vpLoopSideKFs[i]->mnSubmapId;
+        if(nSubmap>=0 && nSubmap<nSubmaps)
+            vbNow[nSubmap] = true;
+    }
+
+    // Points follow the submap of their reference keyframe (the one of the loop window if the loop moved them)
+    vector<vector<pair<MapPoint*,bool> > > vvpNowMPs(nSubmaps);
+    vector<vector<EntityHandle> > vvLaterMPs(nSubmaps);
+    const Map::MapPointsSnapshot pMPs = pMap->GetMapPointsSnapshot();
+    const vector<MapPoint*> &vpMPs = *pMPs;
+    for(size_t i=0, iend=vpMPs.size(); i<iend; i++)
+    {
+        MapPoint* pMP = vpMPs[i];
+        if(pMP->isBad())
+            continue;
+
+        long int nSubmap = -1;
+        const bool bLooped = pMP->mnCorrectedByKF==mpCurrentKF->mnId;
+        if(bLooped)
+        {
+            map<long unsigned int,long int>::const_iterator it = mWindowSubmaps.find(pMP->mnCorrectedReference);
+            if(it!=mWindowSubmaps.end())
+                nSubmap = it->second;
+        }
+        else if(pMP->GetReferenceKeyFrame())
+            nSubmap = pMP->GetReferenceKeyFrame()->mnSubmapId;
+
+        if(nSubmap<0 || nSubmap>=nSubmaps || !vbCorrected[nSubmap])
+            continue;
+
+        if(vbNow[nSubmap])
+            vvpNowMPs[nSubmap].push_back(make_pair(pMP,bLooped));
+        else
+            vvLaterMPs[nSubmap].push_back(pMP->GetHandle());
+    }
+
+    {
+        unique_lock<MapUpdateMutex> lock(pMap->mMutexMapUpdate);
+
+        for(long int s=0; s<nSubmaps; s++)
+        {
+            if(!vbNow[s] || !vbCorrected[s])
+                continue;
+
+            // What the loop did not move yet in a submap of the window also gets the loop correction
+            const g2o::Sim3 CorrectionNotLooped = vbWindow[s] ? vCorrection[s]*L : vCorrection[s];
+
+            const vector<KeyFrame*> vpKFs = pMap->GetSubmapKeyFrames(s);
+            for(size_t i=0; i<vpKFs.size(); i++)
+                CorrectKeyFrame(vpKFs[i], CorrectedSim3.count(vpKFs[i]) ? vCorrection[s] : CorrectionNotLooped);
+
+            const vector<pair<MapPoint*,bool> > &vpSubmapMPs = vvpNowMPs[s];
+            for(size_t i=0; i<vpSubmapMPs.size(); i++)
+                CorrectMapPoint(vpSubmapMPs[i].first, vpSubmapMPs[i].second ? vCorrection[s] : CorrectionNotLooped);
+        }
+
+        pMap->IncreaseChangeIndex();
+    }
+
+    // The others wait, ordered by their distance (in submaps) to the ones moved now
+    vector<pair<long int,long int> > vDistances;
+    for(long int s=0; s<nSubmaps; s++)
+    {
+        if(vbNow[s] || !vbCorrected[s])
+            continue;
+
+        long int nDistance = nSubmaps;
+        for(long int t=0; t<nSubmaps; t++)
+            if(vbNow[t])
+                nDistance = min(nDistance, abs(s-t));
+        vDistances.push_back(make_pair(nDistance,s));
+    }
+    sort(vDistances.begin(),vDistances.end());
+
+    for(size_t i=0; i<vDistances.size(); i++)
+    {
+        const long int s = vDistances[i].second;
+        PendingSubmap pending;
+        pending.pMap = pMap;
+        pending.nSubmap = s;
+        pending.Correction = vCorrection[s];
+        pending.vMapPoints.swap(vvLaterMPs[s]);
+        mlPendingSubmaps.push_back(pending);
+    }
+
+    Verbose::PrintMess("Loop corrected in "+to_string(nSubmaps-vDistances.size())+" submaps, "+to_string(vDistances.size())+" pending",
+                       Verbose::VERBOSITY_NORMAL);
+}
+
+void LoopClosing::ApplyPendingSubmaps(const int nMax)
+{
+    for(int n=0; !mlPendingSubmaps.empty() && (nMax<0 || n<nMax); n++)
+    {
+        PendingSubmap &pending = mlPendingSubmaps.front();
+        Map* pMap = pending.pMap;
+
+        {
+            unique_lock<MapUpdateMutex> lock(pMap->mMutexMapUpdate);
+
+            const vector<KeyFrame*> vpKFs = pMap->GetSubmapKeyFrames(pending.nSubmap);
+            for(size_t i=0; i<vpKFs.size(); i++)
+                CorrectKeyFrame(vpKFs[i], pending.Correction);
+
+            // Points erased meanwhile are no longer found by their handle
+            for(size_t i=0; i<pending.vMapPoints.size(); i++)
+            {
+                MapPoint* pMP = pMap->GetMapPoint(pending.vMapPoints[i]);
+                if(pMP && !pMP->isBad())
+                    CorrectMapPoint(pMP, pending.Correction);
+            }
+
+            pMap->IncreaseChangeIndex();
+        }
+
+        mlPendingSubmaps.pop_front();
+    }
+
+    if(mlPendingSubmaps.empty() && mpDeferredGBAMap)
+    {
+        if(!CheckFinish())
+            LaunchGlobalBundleAdjustment(mpDeferredGBAMap, mnDeferredGBALoopKF);
+        mpDeferredGBAMap = static_cast<Map*>(NULL);
+    }
+}
+
+void LoopClosing::LaunchGlobalBundleAdjustment(Map* pMap, unsigned long nLoopKF)
+{
+    mbRunningGBA = true;
+    mbFinishedGBA = false;
+    mbStopGBA = false;
+
+    mpThreadGBA = new thread(&LoopClosing::RunGlobalBundleAdjustment, this, pMap, nLoopKF);
+}
+
+void LoopClosing::CorrectKeyFrame(KeyFrame* pKF, const g2o::Sim3 &Correction)
+{
+    // SE3 Pose Recovering. Sim3:[sR t;0 1] -> SE3:[R t/s;0 1]
+    g2o::Sim3 Siw(Converter::toMatrix3d(pKF->GetRotation_()),Converter::toVector3d(pKF->GetTranslation_()),1.0);
+    g2o::Sim3 CorrectedSiw = Siw*Correction.inverse();
+
+    Eigen::Matrix3d eigR = CorrectedSiw.rotation().toRotationMatrix();
+    Eigen::Vector3d eigt = CorrectedSiw.translation();
+    double s = CorrectedSiw.scale();
+
+    eigt *=(1./s); //[R t/s;0 1]
+
+    pKF->SetPose(Converter::toCvSE3(eigR,eigt));
+}
+
+void LoopClosing::CorrectMapPoint(MapPoint* pMP, const g2o::Sim3 &Correction)
+{
+    Eigen::Matrix<double,3,1> eigP3Dw = Converter::toVector3d(pMP->GetWorldPos2());
+    pMP->SetWorldPos(Converter::toCvMat(Correction.map(eigP3Dw)));
+    pMP->UpdateNormalAndDepth();
+}
+
+void LoopClosing::MergeLocal()
+{
+    ORB_TRACE_SCOPE("LoopClosing::MergeLocal");
+    Verbose::PrintMess("MERGE: Merge Visual detected!!!!", Verbose::VERBOSITY_NORMAL);
+
+    int numTemporalKFs = 15;
+
+    //Relationship to rebuild the essential graph, it is used two times, first in the local window and later in the rest of the map
+    KeyFrame* pNewChild;
+    KeyFrame* pNewParent;
+
+    vector<KeyFrame*> vpLocalCurrentWindowKFs;
+    vector<KeyFrame*> vpMergeConnectedKFs;
+
+    // Flag that is true only when we stopped a running BA, in this case we need relaunch at the end of the merge
+    bool bRelaunchBA = false;
+
+    Verbose::PrintMess("MERGE: Check Full Bundle Adjustment", Verbose::VERBOSITY_DEBUG);
+    // If a Global Bundle Adjustment is running, abort it
+    if(StopGBA())
+        bRelaunchBA = true;
+
+    // The submaps still pending from the last loop are moved before merging, and its GBA is run after it
+    if(mpDeferredGBAMap)
+        bRelaunchBA = true;
+    mpDeferredGBAMap = static_cast<Map*>(NULL);
+    ApplyPendingSubmaps(-1);
+
+    // Non-blocking mode: the welding window is selected while Local Mapping goes on, it is only stopped to weld it
+    if(!mbNonBlockingCorrection)
+    {
+        mpLocalMapper->RequestStop();
+        mpLocalMapper->WaitUntilStopped();
+        mpLocalMapper->EmptyQueue();
+    }
+
+    // Merge map will become in the new active map with the local window of KFs and MPs from the current map.
+    // Later, the elements of the current map will be transform to the new active map reference, in order to keep real time tracking
+    Map* pCurrentMap = mpCurrentKF->GetMap();
+    Map* pMergeMap = mpMergeMatchedKF->GetMap();
+
+    // Ensure current keyframe is updated
+    mpCurrentKF->UpdateConnections();
+
+    //Get the current KF and its neighbors(visual->covisibles; inertial->temporal+covisibles)
+    set<KeyFrame*> spLocalWindowKFs;
+    //Get MPs in the welding area from the current map
+    set<MapPoint*> spLocalWindowMPs;
+    if(pCurrentMap->IsInertial() && pMergeMap->IsInertial()) //TODO Check the correct initialization
+    {
+        KeyFrame* pKFi = mpCurrentKF;
+        int nInserted = 0;
+        while(pKFi && nInserted < numTemporalKFs)
+        {
+            spLocalWindowKFs.insert(pKFi);
+            pKFi = mpCurrentKF->mPrevKF;
+            nInserted++;
+
+            set<MapPoint*> spMPi = pKFi->GetMapPoints();
+            spLocalWindowMPs.insert(spMPi.begin(), spMPi.end());
+        }
+
+        pKFi = mpCurrentKF->mNextKF;
+        while(pKFi)
+        {
+            spLocalWindowKFs.insert(pKFi);
+
+            set<MapPoint*> spMPi = pKFi->GetMapPoints();
+            spLocalWindowMPs.insert(spMPi.begin(), spMPi.end());
+        }
+    }
+    else
+    {
+        spLocalWindowKFs.insert(mpCurrentKF);
+    }
+
+    vector<KeyFrame*> vpCovisibleKFs = mpCurrentKF->GetBestCovisibilityKeyFrames(numTemporalKFs);
+    spLocalWindowKFs.insert(vpCovisibleKFs.begin(), vpCovisibleKFs.end());
+    const int nMaxTries = 3;
+    int nNumTries = 0;
+    while(spLocalWindowKFs.size() < numTemporalKFs && nNumTries < nMaxTries)
+    {
+        vector<KeyFrame*> vpNewCovKFs;
+        vpNewCovKFs.empty();
         for(KeyFrame* pKFi : spLocalWindowKFs)
         {
             vector<KeyFrame*> vpKFiCov = pKFi->GetBestCovisibilityKeyFrames(numTemporalKFs/2);
@@ -1341,15 +1918,6 @@ void LoopClosing::MergeLocal()
         nNumTries++;
     }
 
-    for(KeyFrame* pKFi : spLocalWindowKFs)
-    {
-        if(!pKFi || pKFi->isBad())
-            continue;
-
-        set<MapPoint*> spMPs = pKFi->GetMapPoints();
-        spLocalWindowMPs.insert(spMPs.begin(), spMPs.end());
-    }
-
     set<KeyFrame*> spMergeConnectedKFs;
     if(pCurrentMap->IsInertial() && pMergeMap->IsInertial()) //TODO Check the correct initialization
     {
@@ -1406,6 +1974,9 @@ void LoopClosing::MergeLocal()
     vpCheckFuseMapPoint.reserve(spMapPointMerge.size());
     std::copy(spMapPointMerge.begin(), spMapPointMerge.end(), std::back_inserter(vpCheckFuseMapPoint));
 
+    // The merge moves the whole current map with a single similarity of the world: CorrectedSiw = Siw*MergeCorrection^-1
+    // and MergeCorrection applied to the points. It is taken from the current keyframe now and applied later to the
+    // poses found then, so that the updates of Local Mapping done meanwhile are kept
     cv::Mat Twc = mpCurrentKF->GetPoseInverse();
 
     cv::Mat Rwc = Twc.rowRange(0,3).colRange(0,3);
@@ -1414,120 +1985,131 @@ void LoopClosing::MergeLocal()
     g2o::Sim3 g2oNonCorrectedScw = g2oNonCorrectedSwc.inverse();
     g2o::Sim3 g2oCorrectedScw = mg2oMergeScw;
 
-    KeyFrameAndPose vCorrectedSim3, vNonCorrectedSim3;
-    vCorrectedSim3[mpCurrentKF]=g2oCorrectedScw;
-    vNonCorrectedSim3[mpCurrentKF]=g2oNonCorrectedScw;
+    const g2o::Sim3 MergeCorrection = g2oCorrectedScw.inverse()*g2oNonCorrectedScw;
+    const cv::Mat Rcor = Converter::toCvMat(MergeCorrection.rotation().toRotationMatrix());
+    const double sMerge = g2oCorrectedScw.scale();
+    const unsigned long int nWindowMaxKFid = pCurrentMap->GetMaxKFid();
 
-    for(KeyFrame* pKFi : spLocalWindowKFs)
-    {
-        if(!pKFi || pKFi->isBad())
-        {
-            continue;
-        }
+    Verbose::PrintMess("MERGE: Request Stop Local Mapping", Verbose::VERBOSITY_DEBUG);
+    mpLocalMapper->RequestStop();
+    // Wait until Local Mapping has effectively stopped
+    mpLocalMapper->WaitUntilStopped();
+    Verbose::PrintMess("MERGE: Local Map stopped", Verbose::VERBOSITY_DEBUG);
 
-        g2o::Sim3 g2oCorrectedSiw;
+    mpLocalMapper->EmptyQueue();
 
-        if(pKFi!=mpCurrentKF)
-        {
-            cv::Mat Tiw = pKFi->GetPose();
-            cv::Mat Riw = Tiw.rowRange(0,3).colRange(0,3);
-            cv::Mat tiw = Tiw.rowRange(0,3).col(3);
-            g2o::Sim3 g2oSiw(Converter::toMatrix3d(Riw),Converter::toVector3d(tiw),1.0);
-            //Pose without correction
-            vNonCorrectedSim3[pKFi]=g2oSiw;
-
-            cv::Mat Tic = Tiw*Twc;
-            cv::Mat Ric = Tic.rowRange(0,3).colRange(0,3);
-            cv::Mat tic = Tic.rowRange(0,3).col(3);
-            g2o::Sim3 g2oSic(Converter::toMatrix3d(Ric),Converter::toVector3d(tic),1.0);
-            g2oCorrectedSiw = g2oSic*mg2oMergeScw;
-            vCorrectedSim3[pKFi]=g2oCorrectedSiw;
-        }
-        else
+    // Keyframes inserted since the window was selected are the newest ones, next to the tracked frame
+    if(pCurrentMap->GetMaxKFid()>nWindowMaxKFid)
+    {
+        vector<KeyFrame*> vpKFs = pCurrentMap->GetAllKeyFrames();
+        for(KeyFrame* pKFi : vpKFs)
         {
-            g2oCorrectedSiw = g2oCorrectedScw;
+            if(pKFi && !pKFi->isBad() && pKFi->mnId>nWindowMaxKFid)
+                spLocalWindowKFs.insert(pKFi);
         }
-        pKFi->mTcwMerge  = pKFi->GetPose();
+    }
 
-        // Update keyframe pose with corrected Sim3. First transform Sim3 to SE3 (scale translation)
-        Eigen::Matrix3d eigR = g2oCorrectedSiw.rotation().toRotationMatrix();
-        Eigen::Vector3d eigt = g2oCorrectedSiw.translation();
-        double s = g2oCorrectedSiw.scale();
+    for(KeyFrame* pKFi : spLocalWindowKFs)
+    {
+        if(!pKFi || pKFi->isBad())
+            continue;
 
-        pKFi->mfScale = s;
-        eigt *=(1./s); //[R t/s;0 1]
+        set<MapPoint*> spMPs = pKFi->GetMapPoints();
+        spLocalWindowMPs.insert(spMPs.begin(), spMPs.end());
+    }
 
-        cv::Mat correctedTiw = Converter::toCvSE3(eigR,eigt);
+    KeyFrameAndPose vCorrectedSim3, vNonCorrectedSim3;
 
-        pKFi->mTcwMerge = correctedTiw;
+    {
+        unique_lock<MapUpdateMutex> currentLock(pCurrentMap->mMutexMapUpdate); // We update the current map with the Merge information
+        unique_lock<MapUpdateMutex> mergeLock(pMergeMap->mMutexMapUpdate); // We remove the Kfs and MPs in the merged area from the old map
 
-        if(pCurrentMap->isImuInitialized())
+        // The window is welded in parallel, only the map containers are updated serially
+        const bool bImuInitialized = pCurrentMap->isImuInitialized();
+        vector<KeyFrame*> vpWindowKFs;
+        vpWindowKFs.reserve(spLocalWindowKFs.size());
+        for(KeyFrame* pKFi : spLocalWindowKFs)
         {
-            Eigen::Matrix3d Rcor = eigR.transpose()*vNonCorrectedSim3[pKFi].rotation().toRotationMatrix();
-            pKFi->mVwbMerge = Converter::toCvMat(Rcor)*pKFi->GetVelocity();
+            if(pKFi && !pKFi->isBad())
+                vpWindowKFs.push_back(pKFi);
         }
 
-    }
+        const int nWindowKFs = vpWindowKFs.size();
+        vector<g2o::Sim3,Eigen::aligned_allocator<g2o::Sim3> > vWindowNonCorrectedSiw(nWindowKFs), vWindowCorrectedSiw(nWindowKFs);
+        auto weldWindowKF = [&](int i)
+        {
+            KeyFrame* pKFi = vpWindowKFs[i];
 
-    for(MapPoint* pMPi : spLocalWindowMPs)
-    {
-        if(!pMPi || pMPi->isBad())
-            continue;
+            //Pose without correction
+            vWindowNonCorrectedSiw[i] = g2o::Sim3(Converter::toMatrix3d(pKFi->GetRotation_()),Converter::toVector3d(pKFi->GetTranslation_()),1.0);
+            const g2o::Sim3 g2oCorrectedSiw = vWindowNonCorrectedSiw[i]*MergeCorrection.inverse();
+            vWindowCorrectedSiw[i] = g2oCorrectedSiw;
 
-        KeyFrame* pKFref = pMPi->GetReferenceKeyFrame();
-        g2o::Sim3 g2oCorrectedSwi = vCorrectedSim3[pKFref].inverse();
-        g2o::Sim3 g2oNonCorrectedSiw = vNonCorrectedSim3[pKFref];
+            // Update keyframe pose with corrected Sim3. First transform Sim3 to SE3 (scale translation)
+            Eigen::Matrix3d eigR = g2oCorrectedSiw.rotation().toRotationMatrix();
+            Eigen::Vector3d eigt = g2oCorrectedSiw.translation();
+            double s = g2oCorrectedSiw.scale();
 
-        // Project with non-corrected pose and project back with corrected pose
-        cv::Mat P3Dw = pMPi->GetWorldPos();
-        Eigen::Matrix<double,3,1> eigP3Dw = Converter::toVector3d(P3Dw);
-        Eigen::Matrix<double,3,1> eigCorrectedP3Dw = g2oCorrectedSwi.map(g2oNonCorrectedSiw.map(eigP3Dw));
-        Eigen::Matrix3d eigR = g2oCorrectedSwi.rotation().toRotationMatrix();
-        Eigen::Matrix3d Rcor = eigR * g2oNonCorrectedSiw.rotation().toRotationMatrix();
+            pKFi->mfScale = s;
+            eigt *=(1./s); //[R t/s;0 1]
 
-        cv::Mat cvCorrectedP3Dw = Converter::toCvMat(eigCorrectedP3Dw);
+            pKFi->mTcwBefMerge = pKFi->GetPose();
+            pKFi->mTwcBefMerge = pKFi->GetPoseInverse();
+            pKFi->SetPose(Converter::toCvSE3(eigR,eigt));
 
-        pMPi->mPosMerge = cvCorrectedP3Dw;
-        pMPi->mNormalVectorMerge = Converter::toCvMat(Rcor) * pMPi->GetNormal();
-    }
+            if(bImuInitialized)
+                pKFi->SetVelocity(Rcor*pKFi->GetVelocity());
+        };
 
-    {
-        unique_lock<mutex> currentLock(pCurrentMap->mMutexMapUpdate); // We update the current map with the Merge information
-        unique_lock<mutex> mergeLock(pMergeMap->mMutexMapUpdate); // We remove the Kfs and MPs in the merged area from the old map
+        if(mpThreadPool && nWindowKFs>1)
+            mpThreadPool->ParallelFor(0, nWindowKFs, weldWindowKF);
+        else
+            for(int i=0; i<nWindowKFs; i++)
+                weldWindowKF(i);
 
-        for(KeyFrame* pKFi : spLocalWindowKFs)
+        for(int i=0; i<nWindowKFs; i++)
         {
-            if(!pKFi || pKFi->isBad())
-            {
-                continue;
-            }
-
-            pKFi->mTcwBefMerge = pKFi->GetPose();
-            pKFi->mTwcBefMerge = pKFi->GetPoseInverse();
-            pKFi->SetPose(pKFi->mTcwMerge);
+            KeyFrame* pKFi = vpWindowKFs[i];
+            vNonCorrectedSim3[pKFi] = vWindowNonCorrectedSiw[i];
+            vCorrectedSim3[pKFi] = vWindowCorrectedSiw[i];
 
             // Make sure connections are updated
             pKFi->UpdateMap(pMergeMap);
             pKFi->mnMergeCorrectedForKF = mpCurrentKF->mnId;
-            pMergeMap->AddKeyFrame(pKFi);
+            // Erased before it is added, the entity stores only resolve the handle of the last insertion
             pCurrentMap->EraseKeyFrame(pKFi);
-
-            if(pCurrentMap->isImuInitialized())
-            {
-                pKFi->SetVelocity(pKFi->mVwbMerge);
-            }
+            pMergeMap->AddKeyFrame(pKFi);
         }
 
+        vector<MapPoint*> vpWindowMPs;
+        vpWindowMPs.reserve(spLocalWindowMPs.size());
         for(MapPoint* pMPi : spLocalWindowMPs)
         {
-            if(!pMPi || pMPi->isBad())
-                continue;
+            if(pMPi && !pMPi->isBad())
+                vpWindowMPs.push_back(pMPi);
+        }
+
+        // Some observations of the window points are in keyframes not moved yet, the normal is rotated instead of recomputed
+        auto weldWindowMP = [&](int i)
+        {
+            MapPoint* pMPi = vpWindowMPs[i];
+            Eigen::Matrix<double,3,1> eigP3Dw = Converter::toVector3d(pMPi->GetWorldPos2());
+            pMPi->SetWorldPos(Converter::toCvMat(MergeCorrection.map(eigP3Dw)));
+            pMPi->SetNormalVector(Rcor*pMPi->GetNormal());
+        };
+
+        const int nWindowMPs = vpWindowMPs.size();
+        if(mpThreadPool && nWindowMPs>1)
+            mpThreadPool->ParallelFor(0, nWindowMPs, weldWindowMP);
+        else
+            for(int i=0; i<nWindowMPs; i++)
+                weldWindowMP(i);
 
-            pMPi->SetWorldPos(pMPi->mPosMerge);
-            pMPi->SetNormalVector(pMPi->mNormalVectorMerge);
+        for(MapPoint* pMPi : vpWindowMPs)
+        {
             pMPi->UpdateMap(pMergeMap);
-            pMergeMap->AddMapPoint(pMPi);
             pCurrentMap->EraseMapPoint(pMPi);
+            pMergeMap->AddMapPoint(pMPi);
         }
 
         mpAtlas->ChangeMap(pMergeMap);
@@ -1535,6 +2117,9 @@ void LoopClosing::MergeLocal()
         pMergeMap->IncreaseChangeIndex();
     }
 
+    // The database is partitioned by map, the welded keyframes go to the merged map
+    mpKeyFrameDB->RepartitionMap(pCurrentMap);
+
 
     //Rebuild the essential graph in the local window
     pCurrentMap->GetOriginKF()->SetFirstConnection(false);
@@ -1619,93 +2204,89 @@ void LoopClosing::MergeLocal()
         {
             if(mpTracker->mSensor == System::MONOCULAR)
             {
-                unique_lock<mutex> currentLock(pCurrentMap->mMutexMapUpdate); // We update the current map with the Merge information
+                // The current map is not tracked any more, only this lock is taken and Local Mapping goes on
+                unique_lock<MapUpdateMutex> currentLock(pCurrentMap->mMutexMapUpdate); // We update the current map with the Merge information
 
+                const bool bImuInitialized = pCurrentMap->isImuInitialized();
+                vector<KeyFrame*> vpOutsideKFs;
+                vpOutsideKFs.reserve(vpCurrentMapKFs.size());
                 for(KeyFrame* pKFi : vpCurrentMapKFs)
                 {
-                    if(!pKFi || pKFi->isBad() || pKFi->GetMap() != pCurrentMap)
-                    {
-                        continue;
-                    }
-
-                    g2o::Sim3 g2oCorrectedSiw;
-
-                    cv::Mat Tiw = pKFi->GetPose();
-                    cv::Mat Riw = Tiw.rowRange(0,3).colRange(0,3);
-                    cv::Mat tiw = Tiw.rowRange(0,3).col(3);
-                    g2o::Sim3 g2oSiw(Converter::toMatrix3d(Riw),Converter::toVector3d(tiw),1.0);
-                    //Pose without correction
-                    vNonCorrectedSim3[pKFi]=g2oSiw;
-
-                    cv::Mat Tic = Tiw*Twc;
-                    cv::Mat Ric = Tic.rowRange(0,3).colRange(0,3);
-                    cv::Mat tic = Tic.rowRange(0,3).col(3);
-                    g2o::Sim3 g2oSim(Converter::toMatrix3d(Ric),Converter::toVector3d(tic),1.0);
-                    g2oCorrectedSiw = g2oSim*mg2oMergeScw;
-                    vCorrectedSim3[pKFi]=g2oCorrectedSiw;
-
-                    // Update keyframe pose with corrected Sim3. First transform Sim3 to SE3 (scale translation)
-                    Eigen::Matrix3d eigR = g2oCorrectedSiw.rotation().toRotationMatrix();
-                    Eigen::Vector3d eigt = g2oCorrectedSiw.translation();
-                    double s = g2oCorrectedSiw.scale();
-
-                    pKFi->mfScale = s;
-                    eigt *=(1./s); //[R t/s;0 1]
+                    if(pKFi && !pKFi->isBad() && pKFi->GetMap() == pCurrentMap)
+                        vpOutsideKFs.push_back(pKFi);
+                }
 
-                    cv::Mat correctedTiw = Converter::toCvSE3(eigR,eigt);
+                auto correctOutsideKF = [&](int i)
+                {
+                    KeyFrame* pKFi = vpOutsideKFs[i];
 
+                    pKFi->mfScale = sMerge;
                     pKFi->mTcwBefMerge = pKFi->GetPose();
                     pKFi->mTwcBefMerge = pKFi->GetPoseInverse();
 
-                    pKFi->SetPose(correctedTiw);
+                    CorrectKeyFrame(pKFi, MergeCorrection);
 
-                    if(pCurrentMap->isImuInitialized())
-                    {
-                        Eigen::Matrix3d Rcor = eigR.transpose()*vNonCorrectedSim3[pKFi].rotation().toRotationMatrix();
-                        pKFi->SetVelocity(Converter::toCvMat(Rcor)*pKFi->GetVelocity()); // TODO: should add here scale s
-                    }
+                    if(bImuInitialized)
+                        pKFi->SetVelocity(Rcor*pKFi->GetVelocity()); // TODO: should add here scale s
+                };
 
-                }
+                const int nOutsideKFs = vpOutsideKFs.size();
+                if(mpThreadPool && nOutsideKFs>1)
+                    mpThreadPool->ParallelFor(0, nOutsideKFs, correctOutsideKF);
+                else
+                    for(int i=0; i<nOutsideKFs; i++)
+                        correctOutsideKF(i);
+
+                vector<MapPoint*> vpOutsideMPs;
+                vpOutsideMPs.reserve(vpCurrentMapMPs.size());
                 for(MapPoint* pMPi : vpCurrentMapMPs)
                 {
-                    if(!pMPi || pMPi->isBad()|| pMPi->GetMap() != pCurrentMap)
-                        continue;
-
-                    KeyFrame* pKFref = pMPi->GetReferenceKeyFrame();
-                    g2o::Sim3 g2oCorrectedSwi = vCorrectedSim3[pKFref].inverse();
-                    g2o::Sim3 g2oNonCorrectedSiw = vNonCorrectedSim3[pKFref];
-
-                    // Project with non-corrected pose and project back with corrected pose
-                    cv::Mat P3Dw = pMPi->GetWorldPos();
-                    Eigen::Matrix<double,3,1> eigP3Dw = Converter::toVector3d(P3Dw);
-                    Eigen::Matrix<double,3,1> eigCorrectedP3Dw = g2oCorrectedSwi.map(g2oNonCorrectedSiw.map(eigP3Dw));
+                    if(pMPi && !pMPi->isBad() && pMPi->GetMap() == pCurrentMap)
+                        vpOutsideMPs.push_back(pMPi);
+                }
 
-                    cv::Mat cvCorrectedP3Dw = Converter::toCvMat(eigCorrectedP3Dw);
-                    pMPi->SetWorldPos(cvCorrectedP3Dw);
+                auto correctOutsideMP = [&](int i)
+                {
+                    CorrectMapPoint(vpOutsideMPs[i], MergeCorrection);
+                };
 
-                    pMPi->UpdateNormalAndDepth();
-                }
+                const int nOutsideMPs = vpOutsideMPs.size();
+                if(mpThreadPool && nOutsideMPs>1)
+                    mpThreadPool->ParallelFor(0, nOutsideMPs, correctOutsideMP);
+                else
+                    for(int i=0; i<nOutsideMPs; i++)
+                        correctOutsideMP(i);
             }
         }
 
-        mpLocalMapper->RequestStop();
-        // Wait until Local Mapping has effectively stopped
-        while(!mpLocalMapper->isStopped())
+        // Non-blocking mode: the essential graph is optimized while Local Mapping goes on, and its result is
+        // applied below as the loop correction does (ApplyEssentialGraphCorrection)
+        const bool bEssentialGraph = mpTracker->mSensor != System::MONOCULAR;
+        KeyFrameAndPose InitialSim3, OptimizedSim3;
+        if(bEssentialGraph && mbNonBlockingCorrection)
         {
-            usleep(1000);
+            Optimizer::OptimizeEssentialGraph(mpCurrentKF, vpMergeConnectedKFs, vpLocalCurrentWindowKFs, vpCurrentMapKFs, vpCurrentMapMPs,
+                                              &InitialSim3, &OptimizedSim3);
         }
 
+        mpLocalMapper->RequestStop();
+        // Wait until Local Mapping has effectively stopped
+        mpLocalMapper->WaitUntilStopped();
+
         // Optimize graph (and update the loop position for each element form the begining to the end)
-        if(mpTracker->mSensor != System::MONOCULAR)
+        if(bEssentialGraph)
         {
-            Optimizer::OptimizeEssentialGraph(mpCurrentKF, vpMergeConnectedKFs, vpLocalCurrentWindowKFs, vpCurrentMapKFs, vpCurrentMapMPs);
+            if(mbNonBlockingCorrection)
+                ApplyEssentialGraphCorrection(pCurrentMap, InitialSim3, OptimizedSim3, false);
+            else
+                Optimizer::OptimizeEssentialGraph(mpCurrentKF, vpMergeConnectedKFs, vpLocalCurrentWindowKFs, vpCurrentMapKFs, vpCurrentMapMPs);
         }
 
 
         {
             // Get Merge Map Mutex
-            unique_lock<mutex> currentLock(pCurrentMap->mMutexMapUpdate); // We update the current map with the Merge information
-            unique_lock<mutex> mergeLock(pMergeMap->mMutexMapUpdate); // We remove the Kfs and MPs in the merged area from the old map
+            unique_lock<MapUpdateMutex> currentLock(pCurrentMap->mMutexMapUpdate); // We update the current map with the Merge information
+            unique_lock<MapUpdateMutex> mergeLock(pMergeMap->mMutexMapUpdate); // We remove the Kfs and MPs in the merged area from the old map
 
             for(KeyFrame* pKFi : vpCurrentMapKFs)
             {
@@ -1716,8 +2297,8 @@ void LoopClosing::MergeLocal()
 
                 // Make sure connections are updated
                 pKFi->UpdateMap(pMergeMap);
-                pMergeMap->AddKeyFrame(pKFi);
                 pCurrentMap->EraseKeyFrame(pKFi);
+                pMergeMap->AddKeyFrame(pKFi);
             }
 
             for(MapPoint* pMPi : vpCurrentMapMPs)
@@ -1726,14 +2307,16 @@ void LoopClosing::MergeLocal()
                     continue;
 
                 pMPi->UpdateMap(pMergeMap);
-                pMergeMap->AddMapPoint(pMPi);
                 pCurrentMap->EraseMapPoint(pMPi);
+                pMergeMap->AddMapPoint(pMPi);
             }
         }
     }
 
     mpLocalMapper->Release();
 
+    mpKeyFrameDB->RepartitionMap(pCurrentMap);
+
     Verbose::PrintMess("MERGE:Completed!!!!!", Verbose::VERBOSITY_DEBUG);
 
     if(bRelaunchBA && (!pCurrentMap->isImuInitialized() || (pCurrentMap->KeyFramesInMap()<200 && mpAtlas->CountMaps()==1)))
@@ -1758,6 +2341,7 @@ void LoopClosing::MergeLocal()
 
 void LoopClosing::MergeLocal2()
 {
+    ORB_TRACE_SCOPE("LoopClosing::MergeLocal2");
     cout << "Merge detected!!!!" << endl;   // Merge할 부분을 찾았다고 출력
 
     int numTemporalKFs = 11; //TODO (set by parameter): Temporal KFs in the local window if the map is inertial.
@@ -1780,44 +2364,53 @@ void LoopClosing::MergeLocal2()
 
     cout << "Check Full Bundle Adjustment" << endl; 
     // If a Global Bundle Adjustment is running, abort it
-    if(isRunningGBA())      // GBA가 실행되고 있는지 확인 : mbRunningGBA이라는 변수의 상태 확인
-    {
-        unique_lock<mutex> lock(mMutexGBA);
-        mbStopGBA = true;   // mbStopGBA를 true로 바꾸므로써, 중단했다는 것을 알려줌
-
-        mnFullBAIdx++;  // Bundle Adjustment Index 1 증가
-
-        if(mpThreadGBA)
-        {
-            cout << "GBA running... Abort!" << endl;
-            mpThreadGBA->detach();  // 쓰레드를 떼어내서 독립적으로 작동하게끔한다.
-            delete mpThreadGBA; // 쓰레드 메모리 해제 - 참고 : C++ 스레드의 분류와 사용법[https://m.blog.naver.com/PostView.naver?isHttpsRedirect=true&blogId=ghoism51&logNo=220190125981]  
-        }
+    if(StopGBA())      // GBA가 실행되고 있었으면 중단 (완료된 iteration의 결과는 유지)
         bRelaunchBA = true; // 실행중인 Bundle Adjustment를 중지했으므로 true로 값을 바꿈
-    }
-
 
-    cout << "Request Stop Local Mapping" << endl;
-    mpLocalMapper->RequestStop();   // Stop일 때까지 while문을 계속 돈다.
-    // Wait until Local Mapping has effectively stopped
-    while(!mpLocalMapper->isStopped())
-    {
-        usleep(1000);
-    }
-    cout << "Local Map stopped" << endl;
+    // 지난 loop에서 보정이 남은 submap을 먼저 보정 (미뤄둔 GBA는 merge 후에 실행)
+    if(mpDeferredGBAMap)
+        bRelaunchBA = true;
+    mpDeferredGBAMap = static_cast<Map*>(NULL);
+    ApplyPendingSubmaps(-1);
 
     // 병합 맵(Merge Map)은 현재 맵(Current Map)의 KF 및 MP의 로컬 창(Local window)과 함께 새 활성 맵(new active map)이 됩니다.
     // 나중에 실시간 추적을 유지하기 위해 현재 지도(Current Map)의 요소가 새로운 활성 지도(new active map) 참조로 변환됩니다.
     Map* pCurrentMap = mpCurrentKF->GetMap();
     Map* pMergeMap = mpMergeMatchedKF->GetMap();
 
+    // Non-blocking mode: Current Map이 BA1까지 끝났으면 mSold_new는 중력축 회전(yaw)과 translation뿐이므로 (scale 1),
+    // 추적 중인 Current Map 대신 추적되지 않는 Merge Map을 역변환으로 Current Map 좌표계로 옮긴다.
+    // Tracking과 Local Mapping은 그동안 계속 동작하고, 아래의 welding 동안만 멈춘다.
+    const bool bMoveMergeMap = mbNonBlockingCorrection && pCurrentMap->GetIniertialBA1();
+    if(bMoveMergeMap)
+    {
+        const g2o::Sim3 Snew_old = mSold_new.inverse();
+        cv::Mat R_no = Converter::toCvMat(Snew_old.rotation().toRotationMatrix());
+        cv::Mat t_no = Converter::toCvMat(Snew_old.translation());
+
+        unique_lock<MapUpdateMutex> lock(pMergeMap->mMutexMapUpdate);
+        pMergeMap->ApplyScaledRotation(R_no,1.0f,false,t_no);
+    }
+
+    cout << "Request Stop Local Mapping" << endl;
+    mpLocalMapper->RequestStop();   // Local Mapping에 Stop 요청
+    // Wait until Local Mapping has effectively stopped
+    mpLocalMapper->WaitUntilStopped();
+    cout << "Local Map stopped" << endl;
+
+    if(bMoveMergeMap)
+    {
+        unique_lock<MapUpdateMutex> lock(pCurrentMap->mMutexMapUpdate);
+        mpLocalMapper->EmptyQueue();
+    }
+    else
     {
         // 변수명 on은 old_new의 줄임말로 추정
         float s_on = mSold_new.scale(); // Local Window KeyFrame to Current Key Frame의 Sim3에서 scale 값  
         cv::Mat R_on = Converter::toCvMat(mSold_new.rotation().toRotationMatrix()); // Sim3에서 Rotation Matrix
         cv::Mat t_on = Converter::toCvMat(mSold_new.translation()); // Sim3에서 translation vector
 
-        unique_lock<mutex> lock(mpAtlas->GetCurrentMap()->mMutexMapUpdate); // lock으로 Current Map이 변하지 않도록 한다.
+        unique_lock<MapUpdateMutex> lock(mpAtlas->GetCurrentMap()->mMutexMapUpdate); // lock으로 Current Map이 변하지 않도록 한다.
 
         // LocalMapping에서  mlNewKeyFrames에 데이터가 없애기 위해 사용하는 함수 
         // (Current Key Frame에 mlNewKeyFrames의 첫번째 원소를 계속 대입)
@@ -1847,7 +2440,7 @@ void LoopClosing::MergeLocal2()
         // 두번째 껏 :  void static InertialOptimization(Map *pMap, Eigen::Vector3d &bg, Eigen::Vector3d &ba, float priorG = 1e2, float priorA = 1e6);
         // Current Map 최적화 (bias 값 업데이트)
         IMU::Bias b (ba[0],ba[1],ba[2],bg[0],bg[1],bg[2]);  // 바뀐 bias을 활용해서 b라는 변수로 초기화
-        unique_lock<mutex> lock(mpAtlas->GetCurrentMap()->mMutexMapUpdate); // Map update가 되지 않도록 lock
+        unique_lock<MapUpdateMutex> lock(mpAtlas->GetCurrentMap()->mMutexMapUpdate); // Map update가 되지 않도록 lock
         mpTracker->UpdateFrameIMU(1.0f,b,mpTracker->GetLastKeyFrame()); // IMU와 관련된 값들을 Key Frame에 update
 
         // Set map initialized
@@ -1863,9 +2456,9 @@ void LoopClosing::MergeLocal2()
     {
         // Get Merge Map Mutex (This section stops tracking!!)
         // Merge Map을 lock을 걸어둔다. (Tracking을 멈춘다.)
-        unique_lock<mutex> currentLock(pCurrentMap->mMutexMapUpdate); // We update the current map with the Merge information
+        unique_lock<MapUpdateMutex> currentLock(pCurrentMap->mMutexMapUpdate); // We update the current map with the Merge information
         // Merge 정보를 이용하여 Current Map을 Update한다.
-        unique_lock<mutex> mergeLock(pMergeMap->mMutexMapUpdate); // We remove the Kfs and MPs in the merged area from the old map
+        unique_lock<MapUpdateMutex> mergeLock(pMergeMap->mMutexMapUpdate); // We remove the Kfs and MPs in the merged area from the old map
         // Merge map update - Old map에서 얻은 Key Frames와 Map points들을 제거한다.
 
         vector<KeyFrame*> vpMergeMapKFs = pMergeMap->GetAllKeyFrames(); // Merge Map으로부터 Key Frames를 가져와 vector에 저장 (pointer 형식)
@@ -1882,8 +2475,8 @@ void LoopClosing::MergeLocal2()
 
             // Make sure connections are updated
             pKFi->UpdateMap(pCurrentMap);   // Key Frame의 Map을 Current Map으로 update
+            pMergeMap->EraseKeyFrame(pKFi); // Merge map에 있는 Key Frame 제거 (handle은 마지막으로 추가된 map의 것만 유효하므로 먼저 제거)
             pCurrentMap->AddKeyFrame(pKFi); // Current Map에도 Key Frame 추가
-            pMergeMap->EraseKeyFrame(pKFi); // Merge map에 있는 Key Frame 제거
         }
         // 위 for문의 결과 : Merge Map Key Frames >> Current Map Key Frames로 업데이트
 
@@ -1894,8 +2487,8 @@ void LoopClosing::MergeLocal2()
                 continue; // Skip
 
             pMPi->UpdateMap(pCurrentMap);   // Map point의 Map을 Current Map으로 update
-            pCurrentMap->AddMapPoint(pMPi); // Current Map에도 Map point 추가
             pMergeMap->EraseMapPoint(pMPi); // Merge map에 있는 Map point 제거
+            pCurrentMap->AddMapPoint(pMPi); // Current Map에도 Map point 추가
         }
         // 위 for문의 결과 : Merge Map Map points >> Current Map Map points로 업데이트
 
@@ -1912,6 +2505,9 @@ void LoopClosing::MergeLocal2()
         }
     }
 
+    // The database is partitioned by map, the keyframes of the merge map go to the current map
+    mpKeyFrameDB->RepartitionMap(pMergeMap);
+
     // Essential Graph Rebuilding
 
     // Q. mpMergeMatchedKF는 Merge Map에 있는 Key Frame 하나를 pointer로 가르키는 건지?
@@ -2026,72 +2622,79 @@ void LoopClosing::MergeLocal2()
 
 void LoopClosing::SearchAndFuse(const KeyFrameAndPose &CorrectedPosesMap, vector<MapPoint*> &vpMapPoints)
 {
-    ORBmatcher matcher(0.8);
-
-    int total_replaces = 0;
-
+    vector<KeyFrame*> vpKFs;
+    vector<cv::Mat> vScw;
+    vpKFs.reserve(CorrectedPosesMap.size());
+    vScw.reserve(CorrectedPosesMap.size());
     for(KeyFrameAndPose::const_iterator mit=CorrectedPosesMap.begin(), mend=CorrectedPosesMap.end(); mit!=mend;mit++)
     {
-        int num_replaces = 0;
-        KeyFrame* pKFi = mit->first;
-        Map* pMap = pKFi->GetMap();
-
-        g2o::Sim3 g2oScw = mit->second;
-        cv::Mat cvScw = Converter::toCvMat(g2oScw);
-
-        vector<MapPoint*> vpReplacePoints(vpMapPoints.size(),static_cast<MapPoint*>(NULL));
-        int numFused = matcher.Fuse(pKFi,cvScw,vpMapPoints,4,vpReplacePoints);
-
-        // Get Map Mutex
-        unique_lock<mutex> lock(pMap->mMutexMapUpdate);
-        const int nLP = vpMapPoints.size();
-        for(int i=0; i<nLP;i++)
-        {
-            MapPoint* pRep = vpReplacePoints[i];
-            if(pRep)
-            {
+        vpKFs.push_back(mit->first);
+        vScw.push_back(Converter::toCvMat(mit->second));
+    }
 
+    SearchAndFuse(vpKFs,vScw,vpMapPoints);
+}
 
-                num_replaces += 1;
-                pRep->Replace(vpMapPoints[i]);
 
-            }
-        }
+void LoopClosing::SearchAndFuse(const vector<KeyFrame*> &vConectedKFs, vector<MapPoint*> &vpMapPoints)
+{
+    vector<cv::Mat> vScw;
+    vScw.reserve(vConectedKFs.size());
+    for(auto mit=vConectedKFs.begin(), mend=vConectedKFs.end(); mit!=mend;mit++)
+        vScw.push_back((*mit)->GetPose());
 
-        total_replaces += num_replaces;
-    }
+    SearchAndFuse(vConectedKFs,vScw,vpMapPoints);
 }
 
-
-void LoopClosing::SearchAndFuse(const vector<KeyFrame*> &vConectedKFs, vector<MapPoint*> &vpMapPoints)
+void LoopClosing::SearchAndFuse(const vector<KeyFrame*> &vpKFs, const vector<cv::Mat> &vScw, vector<MapPoint*> &vpMapPoints)
 {
-    ORBmatcher matcher(0.8);
+    const int nKFs = vpKFs.size();
+    const int nLP = vpMapPoints.size();
+
+    // Projection and matching only touch the keyframe of each task (new observations are added there),
+    // the points to replace are collected and replaced afterwards in keyframe order
+    vector<vector<MapPoint*> > vvpReplacePoints(nKFs);
+    auto fuse = [&](int i)
+    {
+        ORBmatcher matcher(0.8);
+        vvpReplacePoints[i].resize(nLP,static_cast<MapPoint*>(NULL));
+        matcher.Fuse(vpKFs[i],vScw[i],vpMapPoints,4,vvpReplacePoints[i]);
+    };
+
+    if(mpThreadPool && nKFs>1)
+        mpThreadPool->ParallelFor(0, nKFs, fuse);
+    else
+        for(int i=0; i<nKFs; i++)
+            fuse(i);
 
     int total_replaces = 0;
 
-    for(auto mit=vConectedKFs.begin(), mend=vConectedKFs.end(); mit!=mend;mit++)
+    for(int i=0; i<nKFs; i++)
     {
-        int num_replaces = 0;
-        KeyFrame* pKF = (*mit);
-        Map* pMap = pKF->GetMap();
-        cv::Mat cvScw = pKF->GetPose();
-
-        vector<MapPoint*> vpReplacePoints(vpMapPoints.size(),static_cast<MapPoint*>(NULL));
-        matcher.Fuse(pKF,cvScw,vpMapPoints,4,vpReplacePoints);
+        Map* pMap = vpKFs[i]->GetMap();
+        const vector<MapPoint*> &vpReplacePoints = vvpReplacePoints[i];
 
         // Get Map Mutex
-        unique_lock<mutex> lock(pMap->mMutexMapUpdate);
-        const int nLP = vpMapPoints.size();
-        for(int i=0; i<nLP;i++)
+        unique_lock<MapUpdateMutex> lock(pMap->mMutexMapUpdate);
+        for(int j=0; j<nLP;j++)
         {
-            MapPoint* pRep = vpReplacePoints[i];
-            if(pRep)
-            {
-                num_replaces += 1;
-                pRep->Replace(vpMapPoints[i]);
-            }
+            MapPoint* pRep = vpReplacePoints[j];
+            if(!pRep)
+                continue;
+
+            // Several keyframes may have matched the same point or an earlier pair may have replaced
+            // either side: follow the replacements and skip pairs that are already fused or dead
+            MapPoint* pMP = vpMapPoints[j];
+            while(pRep && pRep->isBad())
+                pRep = pRep->GetReplaced();
+            while(pMP && pMP->isBad())
+                pMP = pMP->GetReplaced();
+            if(!pRep || !pMP || pRep==pMP)
+                continue;
+
+            total_replaces += 1;
+            pRep->Replace(pMP);
         }
-        total_replaces += num_replaces;
     }
 }
 
@@ -2103,16 +2706,10 @@ void LoopClosing::RequestReset()
         unique_lock<mutex> lock(mMutexReset);
         mbResetRequested = true;
     }
+    WakeUp();
 
-    while(1)
-    {
-        {
-        unique_lock<mutex> lock2(mMutexReset);
-        if(!mbResetRequested)
-            break;
-        }
-        usleep(5000);
-    }
+    unique_lock<mutex> lock2(mMutexReset);
+    mcvReset.wait(lock2, [this]{ return !mbResetRequested; });
 }
 
 void LoopClosing::RequestResetActiveMap(Map *pMap)
@@ -2122,16 +2719,10 @@ void LoopClosing::RequestResetActiveMap(Map *pMap)
         mbResetActiveMapRequested = true;
         mpMapToReset = pMap;
     }
+    WakeUp();
 
-    while(1)
-    {
-        {
-            unique_lock<mutex> lock2(mMutexReset);
-            if(!mbResetActiveMapRequested)
-                break;
-        }
-        usleep(3000);
-    }
+    unique_lock<mutex> lock2(mMutexReset);
+    mcvReset.wait(lock2, [this]{ return !mbResetActiveMapRequested; });
 }
 
 void LoopClosing::ResetIfRequested()
@@ -2141,6 +2732,10 @@ void LoopClosing::ResetIfRequested()
     {
         cout << "Loop closer reset requested..." << endl;
         mlpLoopKeyFrameQueue.clear();
+        mlPendingSubmaps.clear();
+        mpDeferredGBAMap = static_cast<Map*>(NULL);
+        mLoopRegion = ProjectionRegion();
+        mMergeRegion = ProjectionRegion();
         mLastLoopKFid=0;
         mbResetRequested=false;
         mbResetActiveMapRequested = false;
@@ -2159,71 +2754,235 @@ void LoopClosing::ResetIfRequested()
                 ++it;
         }
 
+        for(list<PendingSubmap, Eigen::aligned_allocator<PendingSubmap> >::iterator it=mlPendingSubmaps.begin(); it!=mlPendingSubmaps.end();)
+        {
+            if(it->pMap == mpMapToReset)
+                it = mlPendingSubmaps.erase(it);
+            else
+                ++it;
+        }
+        if(mpDeferredGBAMap == mpMapToReset)
+            mpDeferredGBAMap = static_cast<Map*>(NULL);
+        mLoopRegion = ProjectionRegion();
+        mMergeRegion = ProjectionRegion();
+
         mLastLoopKFid=mpAtlas->GetLastInitKFid();
         mbResetActiveMapRequested=false;
 
     }
+    mcvReset.notify_all();
+}
+
+bool LoopClosing::StopGBA()
+{
+    if(!isRunningGBA())
+        return false;
+
+    // The GBA thread applies its partial result with Local Mapping stopped
+    mpLocalMapper->RequestStop();
+
+    thread* pThreadGBA;
+    {
+        unique_lock<mutex> lock(mMutexGBA);
+        mbStopGBA = true;
+        pThreadGBA = mpThreadGBA;
+        mpThreadGBA = static_cast<thread*>(NULL);
+    }
+
+    if(pThreadGBA)
+    {
+        cout << "GBA running... Abort!" << endl;
+        // g2o stops at the end of the current iteration
+        pThreadGBA->join();
+        delete pThreadGBA;
+    }
+
+    unique_lock<mutex> lock(mMutexGBA);
+    mnFullBAIdx++;
+    mbRunningGBA = false;
+
+    return true;
 }
 
 void LoopClosing::RunGlobalBundleAdjustment(Map* pActiveMap, unsigned long nLoopKF)
 {
+    ORB_TRACE_THREAD_NAME("GlobalBA");
+    ORB_LOCK_THREAD_NAME("GlobalBA");
+    ThreadPool::PriorityScope poolPriority(ThreadPool::BACKGROUND);
+    ORB_TRACE_SCOPE("LoopClosing::RunGlobalBundleAdjustment");
+
+    if(!mGBAThreadScheduling.IsDefault())
+        mGBAThreadScheduling.Apply();
+
+    // On replay the GBA runs when it ended in the recording, or not at all if it was stopped
+    if(mpReplayLog)
+        mpReplayLog->WaitTurn(ReplayLog::GLOBAL_BA, &mbStopGBA);
+
     Verbose::PrintMess("Starting Global Bundle Adjustment", Verbose::VERBOSITY_NORMAL);
 
+    // Nothing is reclaimed while the BA holds the map entities
+    EpochManager::ThreadRegistration epochRegistration;
+
     const bool bImuInit = pActiveMap->isImuInitialized();
 
+    const int nIterations = bImuInit ? 7 : 10;
+    const int nRoundIterations = mnGBARoundIterations>0 ? min(mnGBARoundIterations,nIterations) : nIterations;
+    int nDoneIterations = 0;
+
+    // Rounds of nRoundIterations, each one published to the map before the next one is built from it
+    while(true)
+    {
+        // Stopped between two rounds: the last one is already in the map
+        if(nDoneIterations>0 && mbStopGBA)
+        {
+            unique_lock<mutex> lock(mMutexGBA);
+            mbFinishedGBA = true;
+            mbRunningGBA = false;
+            break;
+        }
+
 #ifdef REGISTER_TIMES
-    std::chrono::steady_clock::time_point time_StartFGBA = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::time_point time_StartFGBA = std::chrono::steady_clock::now();
 #endif
 
-    if(!bImuInit)
-        Optimizer::GlobalBundleAdjustemnt(pActiveMap,10,&mbStopGBA,nLoopKF,false);
-    else
-        Optimizer::FullInertialBA(pActiveMap,7,false,nLoopKF,&mbStopGBA);
+        const int nRound = min(nRoundIterations, nIterations-nDoneIterations);
+        if(!bImuInit)
+            Optimizer::GlobalBundleAdjustemnt(pActiveMap,nRound,&mbStopGBA,nLoopKF,false);
+        else
+            Optimizer::FullInertialBA(pActiveMap,nRound,false,nLoopKF,&mbStopGBA);
+        nDoneIterations += nRound;
+        const bool bLastRound = nDoneIterations>=nIterations;
 
 #ifdef REGISTER_TIMES
-    std::chrono::steady_clock::time_point time_StartMapUpdate = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::time_point time_StartMapUpdate = std::chrono::steady_clock::now();
 
-    double timeFullGBA = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(time_StartMapUpdate - time_StartFGBA).count();
-    vTimeFullGBA_ms.push_back(timeFullGBA);
+        double timeFullGBA = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(time_StartMapUpdate - time_StartFGBA).count();
+        vTimeFullGBA_ms.push_back(timeFullGBA);
 #endif
 
 
-    int idx =  mnFullBAIdx;
+        int idx =  mnFullBAIdx;
 
-    // Update all MapPoints and KeyFrames
-    // Local Mapping was active during BA, that means that there might be new keyframes
-    // not included in the Global BA and they are not consistent with the updated map.
-    // We need to propagate the correction through the spanning tree
-    {
-        unique_lock<mutex> lock(mMutexGBA);
-        if(idx!=mnFullBAIdx)
-            return;
+        // Update all MapPoints and KeyFrames
+        // Local Mapping was active during BA, that means that there might be new keyframes
+        // not included in the Global BA and they are not consistent with the updated map.
+        // We need to propagate the correction through the spanning tree
+        {
+            unique_lock<mutex> lock(mMutexGBA);
+            if(idx!=mnFullBAIdx)
+                return;
 
-        if(!bImuInit && pActiveMap->isImuInitialized())
-            return;
+            if(!bImuInit && pActiveMap->isImuInitialized())
+                return;
 
-        if(!mbStopGBA)
-        {
-            Verbose::PrintMess("Global Bundle Adjustment finished", Verbose::VERBOSITY_NORMAL);
-            Verbose::PrintMess("Updating map ...", Verbose::VERBOSITY_NORMAL);
+            // When interrupted by StopGBA() the iterations completed so far are kept as well (if the
+            // optimizer got to write them), so that the next GBA resumes from the refined map
+            const bool bInterrupted = mbStopGBA;
+            if(!bInterrupted || pActiveMap->GetOriginKF()->mnBAGlobalForKF==nLoopKF)
+            {
+                if(bInterrupted)
+                    Verbose::PrintMess("Global Bundle Adjustment interrupted, keeping its partial result", Verbose::VERBOSITY_NORMAL);
+                else if(!bLastRound)
+                    Verbose::PrintMess("Global Bundle Adjustment round finished ("+to_string(nDoneIterations)+"/"+to_string(nIterations)+" iterations)", Verbose::VERBOSITY_NORMAL);
+                else
+                    Verbose::PrintMess("Global Bundle Adjustment finished", Verbose::VERBOSITY_NORMAL);
+                Verbose::PrintMess("Updating map ...", Verbose::VERBOSITY_NORMAL);
 
-            mpLocalMapper->RequestStop();
-            
-            // Wait until Local Mapping has effectively stopped
-            while(!mpLocalMapper->isStopped() && !mpLocalMapper->isFinished())
+                ApplyGlobalBundleAdjustment(pActiveMap, nLoopKF, !bLastRound && !bInterrupted);
+
+                // StopGBA() leaves Local Mapping stopped for the correction that interrupted us
+                if(!bInterrupted)
+                    mpLocalMapper->Release();
+
+                mpAtlas->PublishMapEvents(MapEvents::GLOBAL_BA);
+                Verbose::PrintMess("Map updated!", Verbose::VERBOSITY_NORMAL);
+            }
+
+            if(bLastRound || bInterrupted)
             {
-                usleep(1000);
+                mbFinishedGBA = true;
+                mbRunningGBA = false;
+
+                if(mpReplayLog && !bInterrupted)
+                    mpReplayLog->WorkDone(ReplayLog::GLOBAL_BA);
             }
 
-            // Get Map Mutex
-            unique_lock<mutex> lock(pActiveMap->mMutexMapUpdate);
+#ifdef REGISTER_TIMES
+            std::chrono::steady_clock::time_point time_EndMapUpdate = std::chrono::steady_clock::now();
+
+            double timeMapUpdate = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(time_EndMapUpdate - time_StartMapUpdate).count();
+            vTimeMapUpdate_ms.push_back(timeMapUpdate);
+
+            double timeGBA = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(time_EndMapUpdate - time_StartFGBA).count();
+            vTimeGBATotal_ms.push_back(timeGBA);
+#endif
+
+            if(bLastRound || bInterrupted)
+                break;
+        }
+    }
+}
+
+void LoopClosing::ApplyGlobalBundleAdjustment(Map* pActiveMap, unsigned long nLoopKF, const bool bIntermediate)
+{
+    // Blocks of 256 points (or keyframes) run on the worker pool
+    const int nBlock = 256;
+    auto forBlocks = [&](const int n, const std::function<void(int)> &f){
+        const int nBlocks = (n+nBlock-1)/nBlock;
+        if(mpThreadPool && nBlocks>1)
+            mpThreadPool->ParallelFor(0, nBlocks, f);
+        else
+            for(int b=0; b<nBlocks; b++)
+                f(b);
+    };
+
+    // The positions optimized by the BA are read before Local Mapping is stopped and the map
+    // locked (only this thread writes mPosGBA), so that the critical section just swaps them in
+    const Map::MapPointsSnapshot pMPsGBA = pActiveMap->GetMapPointsSnapshot();
+    const vector<MapPoint*> &vpMPsGBA = *pMPsGBA;
+    const int nMPsGBA = vpMPsGBA.size();
+    vector<cv::Matx31f> vPosGBA(nMPsGBA);
+    vector<char> vbInGBA(nMPsGBA,0);
+
+    forBlocks(nMPsGBA, [&](int b){
+        const int iend = min(nMPsGBA,(b+1)*nBlock);
+        for(int i=b*nBlock; i<iend; i++)
+        {
+            MapPoint* pMP = vpMPsGBA[i];
+            if(pMP->mnBAGlobalForKF!=nLoopKF || pMP->mPosGBA.empty())
+                continue;
+            const cv::Mat &pos = pMP->mPosGBA;
+            vPosGBA[i] = cv::Matx31f(pos.at<float>(0), pos.at<float>(1), pos.at<float>(2));
+            vbInGBA[i] = 1;
+        }
+    });
+
+    mpLocalMapper->RequestStop();
+    
+    // Wait until Local Mapping has effectively stopped
+    mpLocalMapper->WaitUntilStopped();
+
+    // Get Map Mutex
+    ORB_TRACE_BEGIN(traceWaitMap, "LoopClosing::WaitMapUpdate");
+    unique_lock<MapUpdateMutex> lock(pActiveMap->mMutexMapUpdate);
+    ORB_TRACE_END(traceWaitMap);
 
-            // Correct keyframes starting at map first keyframe
-            list<KeyFrame*> lpKFtoCheck(pActiveMap->mvpKeyFrameOrigins.begin(),pActiveMap->mvpKeyFrameOrigins.end());
+    // Correct keyframes starting at map first keyframe, one level of the spanning tree at a
+    // time. A keyframe only writes itself and its children, which have no other parent, so the
+    // keyframes of a level are corrected in parallel
+    vector<KeyFrame*> vpLevel(pActiveMap->mvpKeyFrameOrigins.begin(),pActiveMap->mvpKeyFrameOrigins.end());
+    vector<vector<KeyFrame*> > vvpChilds;
 
-            while(!lpKFtoCheck.empty())
+    while(!vpLevel.empty())
+    {
+        const int nLevel = vpLevel.size();
+        vvpChilds.assign(nLevel, vector<KeyFrame*>());
+
+        forBlocks(nLevel, [&](int b){
+            const int iend = min(nLevel,(b+1)*nBlock);
+            for(int i=b*nBlock; i<iend; i++)
             {
-                KeyFrame* pKF = lpKFtoCheck.front();
+                KeyFrame* pKF = vpLevel[i];
                 const set<KeyFrame*> sChilds = pKF->GetChilds();
                 cv::Mat Twc = pKF->GetPoseInverse();
                 for(set<KeyFrame*>::const_iterator sit=sChilds.begin();sit!=sChilds.end();sit++)
@@ -2251,7 +3010,7 @@ void LoopClosing::RunGlobalBundleAdjustment(Map* pActiveMap, unsigned long nLoop
                         pChild->mnBAGlobalForKF=nLoopKF;
 
                     }
-                    lpKFtoCheck.push_back(pChild);
+                    vvpChilds[i].push_back(pChild);
                 }
 
                 pKF->mTcwBefGBA = pKF->GetPose();
@@ -2265,79 +3024,85 @@ void LoopClosing::RunGlobalBundleAdjustment(Map* pActiveMap, unsigned long nLoop
 
                     assert(!pKF->mVwbGBA.empty());
                     pKF->SetVelocity(pKF->mVwbGBA);
-                    pKF->SetNewBias(pKF->mBiasGBA);                    
+                    pKF->SetNewBias(pKF->mBiasGBA);
                 }
-
-                lpKFtoCheck.pop_front();
             }
+        });
 
-            // Correct MapPoints
-            const vector<MapPoint*> vpMPs = pActiveMap->GetAllMapPoints();
-
-            for(size_t i=0; i<vpMPs.size(); i++)
-            {
-                MapPoint* pMP = vpMPs[i];
-
-                if(pMP->isBad())
-                    continue;
+        vpLevel.clear();
+        for(int i=0; i<nLevel; i++)
+            vpLevel.insert(vpLevel.end(), vvpChilds[i].begin(), vvpChilds[i].end());
+    }
 
-                if(pMP->mnBAGlobalForKF==nLoopKF)
-                {
-                    // If optimized by Global BA, just update
-                    pMP->SetWorldPos(pMP->mPosGBA);
-                }
-                else
-                {
-                    // Update according to the correction of its reference keyframe
-                    KeyFrame* pRefKF = pMP->GetReferenceKeyFrame();
+    // Correct MapPoints. Every point only reads keyframes already corrected above, so they are
+    // updated in parallel blocks: first the ones optimized by the BA, with the positions read
+    // before, then the ones created meanwhile, through their reference keyframe
+    forBlocks(nMPsGBA, [&](int b){
+        const int iend = min(nMPsGBA,(b+1)*nBlock);
+        for(int i=b*nBlock; i<iend; i++)
+        {
+            if(vbInGBA[i] && !vpMPsGBA[i]->isBad())
+                vpMPsGBA[i]->SetWorldPos2(vPosGBA[i]);
+        }
+    });
 
-                    if(pRefKF->mnBAGlobalForKF!=nLoopKF)
-                        continue;
+    const Map::MapPointsSnapshot pMPs = pActiveMap->GetMapPointsSnapshot();
+    const vector<MapPoint*> &vpMPs = *pMPs;
+    const int nMPs = vpMPs.size();
 
-                    if(pRefKF->mTcwBefGBA.empty())
-                        continue;
+    forBlocks(nMPs, [&](int b){
+        const int iend = min(nMPs,(b+1)*nBlock);
+        for(int i=b*nBlock; i<iend; i++)
+        {
+            MapPoint* pMP = vpMPs[i];
 
-                    // Map to non-corrected camera
-                    cv::Mat Rcw = pRefKF->mTcwBefGBA.rowRange(0,3).colRange(0,3);
-                    cv::Mat tcw = pRefKF->mTcwBefGBA.rowRange(0,3).col(3);
-                    cv::Mat Xc = Rcw*pMP->GetWorldPos()+tcw;
+            if(pMP->isBad() || pMP->mnBAGlobalForKF==nLoopKF)
+                continue;
 
-                    // Backproject using corrected camera
-                    cv::Mat Twc = pRefKF->GetPoseInverse();
-                    cv::Mat Rwc = Twc.rowRange(0,3).colRange(0,3);
-                    cv::Mat twc = Twc.rowRange(0,3).col(3);
+            // Update according to the correction of its reference keyframe
+            KeyFrame* pRefKF = pMP->GetReferenceKeyFrame();
 
-                    pMP->SetWorldPos(Rwc*Xc+twc);
-                }
-            }
+            if(pRefKF->mnBAGlobalForKF!=nLoopKF)
+                continue;
 
-            pActiveMap->InformNewBigChange();
-            pActiveMap->IncreaseChangeIndex();
+            if(pRefKF->mTcwBefGBA.empty())
+                continue;
 
-            mpLocalMapper->Release();
+            // Map to non-corrected camera
+            const cv::Matx44f TcwBef = pRefKF->mTcwBefGBA;
+            const cv::Matx31f Xc = TcwBef.get_minor<3,3>(0,0)*pMP->GetWorldPos2()+TcwBef.get_minor<3,1>(0,3);
 
-            Verbose::PrintMess("Map updated!", Verbose::VERBOSITY_NORMAL);
+            // Backproject using corrected camera
+            const cv::Matx44f Twc = pRefKF->GetPoseInverse_();
+            pMP->SetWorldPos2(Twc.get_minor<3,3>(0,0)*Xc+Twc.get_minor<3,1>(0,3));
         }
+    });
 
-        mbFinishedGBA = true;
-        mbRunningGBA = false;
+    // The points of this round that the next one leaves out (without enough observations) are then
+    // corrected through their reference keyframe instead of getting this round's position again
+    if(bIntermediate)
+    {
+        forBlocks(nMPsGBA, [&](int b){
+            const int iend = min(nMPsGBA,(b+1)*nBlock);
+            for(int i=b*nBlock; i<iend; i++)
+            {
+                if(vbInGBA[i])
+                    vpMPsGBA[i]->mnBAGlobalForKF = 0;
+            }
+        });
     }
 
-#ifdef REGISTER_TIMES
-    std::chrono::steady_clock::time_point time_EndMapUpdate = std::chrono::steady_clock::now();
-
-    double timeMapUpdate = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(time_EndMapUpdate - time_StartMapUpdate).count();
-    vTimeMapUpdate_ms.push_back(timeMapUpdate);
-
-    double timeGBA = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(time_EndMapUpdate - time_StartFGBA).count();
-    vTimeGBATotal_ms.push_back(timeGBA);
-#endif
+    pActiveMap->InformNewBigChange();
+    pActiveMap->IncreaseChangeIndex();
 }
 
 void LoopClosing::RequestFinish()
 {
-    unique_lock<mutex> lock(mMutexFinish);
-    mbFinishRequested = true;
+    {
+        unique_lock<mutex> lock(mMutexFinish);
+        mbFinishRequested = true;
+    }
+    WakeUp();
 }
 
 bool LoopClosing::CheckFinish()
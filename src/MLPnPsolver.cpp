@@ -46,20 +46,61 @@
 ******************************************************************************/
 
 #include "MLPnPsolver.h"
+#include "ORBmatcher.h"
 
 #include <Eigen/Sparse>
 
 
 namespace ORB_SLAM3 {
+    MLPnPsolver::MLPnPsolver():
+            mnInliersi(0), mnIterations(0), mnBestInliers(0), N(0), mRansacProb(0.99), mRansacMinInliers(8),
+            mRansacMaxIts(300), mRansacEpsilon(0.4), mRansacMinSet(6), mSampling(RansacSampler::UNIFORM),
+            mbSPRT(false), mpCamera(static_cast<GeometricCamera*>(NULL)){
+    }
+
     MLPnPsolver::MLPnPsolver(const Frame &F, const vector<MapPoint *> &vpMapPointMatches):
-            mnInliersi(0), mnIterations(0), mnBestInliers(0), N(0), mpCamera(F.mpCamera){
+            mnInliersi(0), mnIterations(0), mnBestInliers(0), N(0), mpCamera(F.mpCamera),
+            mSampling(RansacSampler::UNIFORM), mbSPRT(false){
+        Reset(F,vpMapPointMatches);
+    }
+
+    MLPnPsolver::~MLPnPsolver(){
+    }
+
+    void MLPnPsolver::Reset(const Frame &F, const vector<MapPoint *> &vpMapPointMatches){
+        mnInliersi = 0;
+        mnIterations = 0;
+        mnBestInliers = 0;
+        mpCamera = F.mpCamera;
+        mSampling = RansacSampler::UNIFORM;
+        mbSPRT = false;
+
+        // clear() keeps the capacity, so the buffers only grow
         mvpMapPointMatches = vpMapPointMatches;
-        mvBearingVecs.reserve(F.mvpMapPoints.size());
-        mvP2D.reserve(F.mvpMapPoints.size());
-        mvSigma2.reserve(F.mvpMapPoints.size());
-        mvP3Dw.reserve(F.mvpMapPoints.size());
-        mvKeyPointIndices.reserve(F.mvpMapPoints.size());
-        mvAllIndices.reserve(F.mvpMapPoints.size());
+        mvBearingVecs.clear();
+        mvP2D.clear();
+        mvSigma2.clear();
+        mvP3Dw.clear();
+        mvKeyPointIndices.clear();
+        mvAllIndices.clear();
+        mvQuality.clear();
+        mvbBestInliers.clear();
+        mvbRefinedInliers.clear();
+
+        const size_t nMax = F.mvpMapPoints.size();
+        mvBearingVecs.reserve(nMax);
+        mvP2D.reserve(nMax);
+        mvSigma2.reserve(nMax);
+        mvP3Dw.reserve(nMax);
+        mvKeyPointIndices.reserve(nMax);
+        mvAllIndices.reserve(nMax);
+        mvQuality.reserve(nMax);
+        mvRefineIndices.reserve(nMax);
+        mvPoints3.reserve(nMax);
+        mvNullspaces.reserve(nMax);
+        mvWeights.reserve(nMax);
+        mvResiduals.reserve(nMax);
+        mvJacobians.reserve(nMax);
 
         int idx = 0;
         for(size_t i = 0, iend = mvpMapPointMatches.size(); i < iend; i++){
@@ -87,6 +128,8 @@ namespace ORB_SLAM3 {
                     mvKeyPointIndices.push_back(i);
                     mvAllIndices.push_back(idx);
 
+                    mvQuality.push_back(ORBmatcher::DescriptorDistance(pMP->GetDescriptor(),F.mDescriptors.row(i)));
+
                     idx++;
                 }
             }
@@ -107,44 +150,22 @@ namespace ORB_SLAM3 {
 	        return cv::Mat();
 	    }
 
-	    vector<size_t> vAvailableIndices;
-
 	    int nCurrentIterations = 0;
 	    while(mnIterations<mRansacMaxIts || nCurrentIterations<nIterations)
 	    {
 	        nCurrentIterations++;
 	        mnIterations++;
 
-	        vAvailableIndices = mvAllIndices;
-
-            //Bearing vectors and 3D points used for this ransac iteration
-            bearingVectors_t bearingVecs(mRansacMinSet);
-            points_t p3DS(mRansacMinSet);
-            vector<int> indexes(mRansacMinSet);
-
-	        // Get min set of points
+	        // Get min set of points (indices into the correspondences, no copy)
+	        mSampler.Sample(mvSample);
 	        for(short i = 0; i < mRansacMinSet; ++i)
-	        {
-	            int randi = DUtils::Random::RandomInt(0, vAvailableIndices.size()-1);
-
-	            int idx = vAvailableIndices[randi];
-
-                bearingVecs[i] = mvBearingVecs[idx];
-                p3DS[i] = mvP3Dw[idx];
-                indexes[i] = i;
-
-	            vAvailableIndices[randi] = vAvailableIndices.back();
-	            vAvailableIndices.pop_back();
-	        }
-
-            //By the moment, we are using MLPnP without covariance info
-            cov3_mats_t covs(1);
+	            mvMinSetIndices[i] = mvSample[i];
 
             //Result
             transformation_t result;
 
 	        // Compute camera pose
-            computePose(bearingVecs,p3DS,covs,indexes,result);
+            computePose(mvBearingVecs,mvP3Dw,mvCovariances,mvMinSetIndices,result);
 
             //Save result
             mRi[0][0] = result(0,0);
@@ -162,7 +183,8 @@ namespace ORB_SLAM3 {
             mti[0] = result(0,3);mti[1] = result(1,3);mti[2] = result(2,3);
 
 	        // Check inliers
-	        CheckInliers();
+	        if(!CheckInliers(mbSPRT))
+	            continue;
 
 	        if(mnInliersi>=mRansacMinInliers)
 	        {
@@ -221,6 +243,7 @@ namespace ORB_SLAM3 {
 	    mRansacMaxIts = maxIterations;
 	    mRansacEpsilon = epsilon;
 	    mRansacMinSet = minSet;
+	    mvMinSetIndices.resize(mRansacMinSet);
 
 	    N = mvP2D.size(); // number of correspondences
 
@@ -250,14 +273,26 @@ namespace ORB_SLAM3 {
 	    mvMaxError.resize(mvSigma2.size());
 	    for(size_t i=0; i<mvSigma2.size(); i++)
 	        mvMaxError[i] = mvSigma2[i]*th2;
+
+	    ConfigureSampler();
+	}
+
+	void MLPnPsolver::SetSamplingStrategy(RansacSampler::eSampling sampling, bool bSPRT){
+	    mSampling = sampling;
+	    mbSPRT = bSPRT;
+
+	    ConfigureSampler();
 	}
 
-    void MLPnPsolver::CheckInliers(){
-        mnInliersi=0;
+	void MLPnPsolver::ConfigureSampler(){
+	    // A minimal MLPnP solve costs about as much as checking a couple hundred correspondences
+	    mSampler.Configure(mSampling,mbSPRT,mvQuality,mRansacMinSet,mRansacMaxIts,mRansacEpsilon,200.f);
+	}
 
-        for(int i=0; i<N; i++)
+    bool MLPnPsolver::CheckInliers(bool bSPRT){
+        auto isInlier = [this](size_t i)
         {
-            point_t p = mvP3Dw[i];
+            const point_t &p = mvP3Dw[i];
             cv::Point3f P3Dw(p(0),p(1),p(2));
             cv::Point2f P2D = mvP2D[i];
 
@@ -273,52 +308,28 @@ namespace ORB_SLAM3 {
 
             float error2 = distX*distX+distY*distY;
 
-            if(error2<mvMaxError[i])
-            {
-                mvbInliersi[i]=true;
-                mnInliersi++;
-            }
-            else
-            {
-                mvbInliersi[i]=false;
-            }
-        }
+            return error2<mvMaxError[i];
+        };
+
+        return mSampler.Evaluate(isInlier,mvbInliersi,mnInliersi,bSPRT);
     }
 
     bool MLPnPsolver::Refine(){
-        vector<int> vIndices;
-        vIndices.reserve(mvbBestInliers.size());
+        mvRefineIndices.clear();
 
         for(size_t i=0; i<mvbBestInliers.size(); i++)
         {
             if(mvbBestInliers[i])
             {
-                vIndices.push_back(i);
+                mvRefineIndices.push_back(i);
             }
         }
 
-        //Bearing vectors and 3D points used for this ransac iteration
-        bearingVectors_t bearingVecs;
-        points_t p3DS;
-        vector<int> indexes;
-
-        for(size_t i=0; i<vIndices.size(); i++)
-        {
-            int idx = vIndices[i];
-
-            bearingVecs.push_back(mvBearingVecs[idx]);
-            p3DS.push_back(mvP3Dw[idx]);
-            indexes.push_back(i);
-        }
-
-        //By the moment, we are using MLPnP without covariance info
-        cov3_mats_t covs(1);
-
         //Result
         transformation_t result;
 
-        // Compute camera pose
-        computePose(bearingVecs,p3DS,covs,indexes,result);
+        // Compute camera pose with all the inliers
+        computePose(mvBearingVecs,mvP3Dw,mvCovariances,mvRefineIndices,result);
 
         // Check inliers
         CheckInliers();
@@ -349,25 +360,24 @@ namespace ORB_SLAM3 {
 
         bool planar = false;
         // compute the nullspace of all vectors
-        std::vector<Eigen::MatrixXd> nullspaces(numberCorrespondences);
-        Eigen::MatrixXd points3(3, numberCorrespondences);
-        points_t points3v(numberCorrespondences);
-        points4_t points4v(numberCorrespondences);
+        // (buffers of the solver: resize does not allocate once they have grown to N)
+        mvNullspaces.resize(numberCorrespondences);
+        mvPoints3.resize(numberCorrespondences);
+        Eigen::Matrix3d planarTest = Eigen::Matrix3d::Zero();
         for (size_t i = 0; i < numberCorrespondences; i++) {
-            bearingVector_t f_current = f[indices[i]];
-            points3.col(i) = p[indices[i]];
+            const bearingVector_t &f_current = f[indices[i]];
             // nullspace of right vector
-            Eigen::JacobiSVD<Eigen::MatrixXd, Eigen::HouseholderQRPreconditioner>
+            Eigen::JacobiSVD<Eigen::Matrix<double, 1, 3>, Eigen::HouseholderQRPreconditioner>
                     svd_f(f_current.transpose(), Eigen::ComputeFullV);
-            nullspaces[i] = svd_f.matrixV().block(0, 1, 3, 2);
-            points3v[i] = p[indices[i]];
+            mvNullspaces[i] = svd_f.matrixV().block<3, 2>(0, 1);
+            mvPoints3[i] = p[indices[i]];
+            planarTest += mvPoints3[i] * mvPoints3[i].transpose();
         }
 
         //////////////////////////////////////
         // 1. test if we have a planar scene
         //////////////////////////////////////
 
-        Eigen::Matrix3d planarTest = points3 * points3.transpose();
         Eigen::FullPivHouseholderQR<Eigen::Matrix3d> rankTest(planarTest);
         Eigen::Matrix3d eigenRot;
         eigenRot.setIdentity();
@@ -382,134 +392,129 @@ namespace ORB_SLAM3 {
             Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> eigen_solver(planarTest);
             eigenRot = eigen_solver.eigenvectors().real();
             eigenRot.transposeInPlace();
-            for (size_t i = 0; i < numberCorrespondences; i++)
-                points3.col(i) = eigenRot * points3.col(i);
         }
         //////////////////////////////////////
         // 2. stochastic model
         //////////////////////////////////////
-        Eigen::SparseMatrix<double> P(2 * numberCorrespondences,
-                                      2 * numberCorrespondences);
+        // block diagonal: one 2x2 weight per correspondence (identity if no covariance)
         bool use_cov = false;
-        P.setIdentity(); // standard
 
         // if we do have covariance information
         // -> fill covariance matrix
         if (covMats.size() == numberCorrespondences) {
             use_cov = true;
-            int l = 0;
+            mvWeights.resize(numberCorrespondences);
             for (size_t i = 0; i < numberCorrespondences; ++i) {
                 // invert matrix
-                cov2_mat_t temp = nullspaces[i].transpose() * covMats[i] * nullspaces[i];
-                temp = temp.inverse().eval();
-                P.coeffRef(l, l) = temp(0, 0);
-                P.coeffRef(l, l + 1) = temp(0, 1);
-                P.coeffRef(l + 1, l) = temp(1, 0);
-                P.coeffRef(l + 1, l + 1) = temp(1, 1);
-                l += 2;
+                cov2_mat_t temp = mvNullspaces[i].transpose() * covMats[i] * mvNullspaces[i];
+                mvWeights[i] = temp.inverse();
             }
         }
 
         //////////////////////////////////////
         // 3. fill the design matrix A
         //////////////////////////////////////
-        const int rowsA = 2 * numberCorrespondences;
-        int colsA = 12;
-        Eigen::MatrixXd A;
-        if (planar) {
-            colsA = 9;
-            A = Eigen::MatrixXd(rowsA, 9);
-        } else
-            A = Eigen::MatrixXd(rowsA, 12);
-        A.setZero();
+        // the two rows of each correspondence are added straight to the normal equations
+        // A^T*P*A (12x12, or 9x9 in the planar case), so A is never stored
+        const int colsA = planar ? 9 : 12;
+        Eigen::Matrix<double, 12, 12> AtPA;
+        AtPA.setZero();
+        Eigen::Matrix<double, 2, 12> Ai;
+        Ai.setZero();
 
         // fill design matrix
-        if (planar) {
-            for (size_t i = 0; i < numberCorrespondences; ++i) {
-                point_t pt3_current = points3.col(i);
+        for (size_t i = 0; i < numberCorrespondences; ++i) {
+            const nullspace_t &ns = mvNullspaces[i];
+            if (planar) {
+                const point_t pt3_current = eigenRot * mvPoints3[i];
 
                 // r12
-                A(2 * i, 0) = nullspaces[i](0, 0) * pt3_current[1];
-                A(2 * i + 1, 0) = nullspaces[i](0, 1) * pt3_current[1];
+                Ai(0, 0) = ns(0, 0) * pt3_current[1];
+                Ai(1, 0) = ns(0, 1) * pt3_current[1];
                 // r13
-                A(2 * i, 1) = nullspaces[i](0, 0) * pt3_current[2];
-                A(2 * i + 1, 1) = nullspaces[i](0, 1) * pt3_current[2];
+                Ai(0, 1) = ns(0, 0) * pt3_current[2];
+                Ai(1, 1) = ns(0, 1) * pt3_current[2];
                 // r22
-                A(2 * i, 2) = nullspaces[i](1, 0) * pt3_current[1];
-                A(2 * i + 1, 2) = nullspaces[i](1, 1) * pt3_current[1];
+                Ai(0, 2) = ns(1, 0) * pt3_current[1];
+                Ai(1, 2) = ns(1, 1) * pt3_current[1];
                 // r23
-                A(2 * i, 3) = nullspaces[i](1, 0) * pt3_current[2];
-                A(2 * i + 1, 3) = nullspaces[i](1, 1) * pt3_current[2];
+                Ai(0, 3) = ns(1, 0) * pt3_current[2];
+                Ai(1, 3) = ns(1, 1) * pt3_current[2];
                 // r32
-                A(2 * i, 4) = nullspaces[i](2, 0) * pt3_current[1];
-                A(2 * i + 1, 4) = nullspaces[i](2, 1) * pt3_current[1];
+                Ai(0, 4) = ns(2, 0) * pt3_current[1];
+                Ai(1, 4) = ns(2, 1) * pt3_current[1];
                 // r33
-                A(2 * i, 5) = nullspaces[i](2, 0) * pt3_current[2];
-                A(2 * i + 1, 5) = nullspaces[i](2, 1) * pt3_current[2];
+                Ai(0, 5) = ns(2, 0) * pt3_current[2];
+                Ai(1, 5) = ns(2, 1) * pt3_current[2];
                 // t1
-                A(2 * i, 6) = nullspaces[i](0, 0);
-                A(2 * i + 1, 6) = nullspaces[i](0, 1);
+                Ai(0, 6) = ns(0, 0);
+                Ai(1, 6) = ns(0, 1);
                 // t2
-                A(2 * i, 7) = nullspaces[i](1, 0);
-                A(2 * i + 1, 7) = nullspaces[i](1, 1);
+                Ai(0, 7) = ns(1, 0);
+                Ai(1, 7) = ns(1, 1);
                 // t3
-                A(2 * i, 8) = nullspaces[i](2, 0);
-                A(2 * i + 1, 8) = nullspaces[i](2, 1);
-            }
-        } else {
-            for (size_t i = 0; i < numberCorrespondences; ++i) {
-                point_t pt3_current = points3.col(i);
+                Ai(0, 8) = ns(2, 0);
+                Ai(1, 8) = ns(2, 1);
+            } else {
+                const point_t &pt3_current = mvPoints3[i];
 
                 // r11
-                A(2 * i, 0) = nullspaces[i](0, 0) * pt3_current[0];
-                A(2 * i + 1, 0) = nullspaces[i](0, 1) * pt3_current[0];
+                Ai(0, 0) = ns(0, 0) * pt3_current[0];
+                Ai(1, 0) = ns(0, 1) * pt3_current[0];
                 // r12
-                A(2 * i, 1) = nullspaces[i](0, 0) * pt3_current[1];
-                A(2 * i + 1, 1) = nullspaces[i](0, 1) * pt3_current[1];
+                Ai(0, 1) = ns(0, 0) * pt3_current[1];
+                Ai(1, 1) = ns(0, 1) * pt3_current[1];
                 // r13
-                A(2 * i, 2) = nullspaces[i](0, 0) * pt3_current[2];
-                A(2 * i + 1, 2) = nullspaces[i](0, 1) * pt3_current[2];
+                Ai(0, 2) = ns(0, 0) * pt3_current[2];
+                Ai(1, 2) = ns(0, 1) * pt3_current[2];
                 // r21
-                A(2 * i, 3) = nullspaces[i](1, 0) * pt3_current[0];
-                A(2 * i + 1, 3) = nullspaces[i](1, 1) * pt3_current[0];
+                Ai(0, 3) = ns(1, 0) * pt3_current[0];
+                Ai(1, 3) = ns(1, 1) * pt3_current[0];
                 // r22
-                A(2 * i, 4) = nullspaces[i](1, 0) * pt3_current[1];
-                A(2 * i + 1, 4) = nullspaces[i](1, 1) * pt3_current[1];
+                Ai(0, 4) = ns(1, 0) * pt3_current[1];
+                Ai(1, 4) = ns(1, 1) * pt3_current[1];
                 // r23
-                A(2 * i, 5) = nullspaces[i](1, 0) * pt3_current[2];
-                A(2 * i + 1, 5) = nullspaces[i](1, 1) * pt3_current[2];
+                Ai(0, 5) = ns(1, 0) * pt3_current[2];
+                Ai(1, 5) = ns(1, 1) * pt3_current[2];
                 // r31
-                A(2 * i, 6) = nullspaces[i](2, 0) * pt3_current[0];
-                A(2 * i + 1, 6) = nullspaces[i](2, 1) * pt3_current[0];
+                Ai(0, 6) = ns(2, 0) * pt3_current[0];
+                Ai(1, 6) = ns(2, 1) * pt3_current[0];
                 // r32
-                A(2 * i, 7) = nullspaces[i](2, 0) * pt3_current[1];
-                A(2 * i + 1, 7) = nullspaces[i](2, 1) * pt3_current[1];
+                Ai(0, 7) = ns(2, 0) * pt3_current[1];
+                Ai(1, 7) = ns(2, 1) * pt3_current[1];
                 // r33
-                A(2 * i, 8) = nullspaces[i](2, 0) * pt3_current[2];
-                A(2 * i + 1, 8) = nullspaces[i](2, 1) * pt3_current[2];
+                Ai(0, 8) = ns(2, 0) * pt3_current[2];
+                Ai(1, 8) = ns(2, 1) * pt3_current[2];
                 // t1
-                A(2 * i, 9) = nullspaces[i](0, 0);
-                A(2 * i + 1, 9) = nullspaces[i](0, 1);
+                Ai(0, 9) = ns(0, 0);
+                Ai(1, 9) = ns(0, 1);
                 // t2
-                A(2 * i, 10) = nullspaces[i](1, 0);
-                A(2 * i + 1, 10) = nullspaces[i](1, 1);
+                Ai(0, 10) = ns(1, 0);
+                Ai(1, 10) = ns(1, 1);
                 // t3
-                A(2 * i, 11) = nullspaces[i](2, 0);
-                A(2 * i + 1, 11) = nullspaces[i](2, 1);
+                Ai(0, 11) = ns(2, 0);
+                Ai(1, 11) = ns(2, 1);
             }
-        }
 
-        //////////////////////////////////////
-        // 4. solve least squares
-        //////////////////////////////////////
-        Eigen::MatrixXd AtPA;
-        if (use_cov)
-            AtPA = A.transpose() * P * A; // setting up the full normal equations seems to be unstable
-        else
-            AtPA = A.transpose() * A;
+            //////////////////////////////////////
+            // 4. set up the least squares
+            //////////////////////////////////////
+            if (use_cov)
+                AtPA.noalias() += Ai.transpose() * mvWeights[i] * Ai;
+            else
+                AtPA.noalias() += Ai.transpose() * Ai;
+        }
 
-        Eigen::JacobiSVD<Eigen::MatrixXd> svd_A(AtPA, Eigen::ComputeFullV);
-        Eigen::MatrixXd result1 = svd_A.matrixV().col(colsA - 1);
+        // solve least squares
+        Eigen::Matrix<double, 12, 1> result1;
+        result1.setZero();
+        if (planar) {
+            Eigen::JacobiSVD<Eigen::Matrix<double, 9, 9> > svd_A(AtPA.topLeftCorner<9, 9>(), Eigen::ComputeFullV);
+            result1.head<9>() = svd_A.matrixV().col(colsA - 1);
+        } else {
+            Eigen::JacobiSVD<Eigen::Matrix<double, 12, 12> > svd_A(AtPA, Eigen::ComputeFullV);
+            result1 = svd_A.matrixV().col(colsA - 1);
+        }
 
         ////////////////////////////////
         // now we treat the results differently,
@@ -532,7 +537,7 @@ namespace ORB_SLAM3 {
 
             double scale = 1.0 / std::sqrt(std::abs(tmp.col(1).norm() * tmp.col(2).norm()));
             // find best rotation matrix in frobenius sense
-            Eigen::JacobiSVD<Eigen::MatrixXd> svd_R_frob(tmp, Eigen::ComputeFullU | Eigen::ComputeFullV);
+            Eigen::JacobiSVD<Eigen::Matrix3d> svd_R_frob(tmp, Eigen::ComputeFullU | Eigen::ComputeFullV);
             rotation_t Rout1 = svd_R_frob.matrixU() * svd_R_frob.matrixV().transpose();
             // test if we found a good rotation matrix
             if (Rout1.determinant() < 0)
@@ -554,7 +559,7 @@ namespace ORB_SLAM3 {
             R2.col(1) = -Rout1.col(1);
             R2.col(2) = Rout1.col(2);
 
-            vector<transformation_t, Eigen::aligned_allocator<transformation_t>> Ts(4);
+            transformation_t Ts[4];
             Ts[0].block<3, 3>(0, 0) = R1;
             Ts[0].block<3, 1>(0, 3) = t;
             Ts[1].block<3, 3>(0, 0) = R1;
@@ -564,20 +569,18 @@ namespace ORB_SLAM3 {
             Ts[3].block<3, 3>(0, 0) = R2;
             Ts[3].block<3, 1>(0, 3) = -t;
 
-            vector<double> normVal(4);
+            double normVal[4];
             for (int i = 0; i < 4; ++i) {
                 point_t reproPt;
                 double norms = 0.0;
                 for (int p = 0; p < 6; ++p) {
-                    reproPt = Ts[i].block<3, 3>(0, 0) * points3v[p] + Ts[i].block<3, 1>(0, 3);
+                    reproPt = Ts[i].block<3, 3>(0, 0) * mvPoints3[p] + Ts[i].block<3, 1>(0, 3);
                     reproPt = reproPt / reproPt.norm();
                     norms += (1.0 - reproPt.transpose() * f[indices[p]]);
                 }
                 normVal[i] = norms;
             }
-            std::vector<double>::iterator
-                    findMinRepro = std::min_element(std::begin(normVal), std::end(normVal));
-            int idx = std::distance(std::begin(normVal), findMinRepro);
+            int idx = std::distance(normVal, std::min_element(normVal, normVal + 4));
             Rout = Ts[idx].block<3, 3>(0, 0);
             tout = Ts[idx].block<3, 1>(0, 3);
         } else // non-planar
@@ -591,7 +594,7 @@ namespace ORB_SLAM3 {
                            std::pow(std::abs(tmp.col(0).norm() * tmp.col(1).norm() * tmp.col(2).norm()), 1.0 / 3.0);
             //double scale = 1.0 / std::sqrt(std::abs(tmp.col(0).norm() * tmp.col(1).norm()));
             // find best rotation matrix in frobenius sense
-            Eigen::JacobiSVD<Eigen::MatrixXd> svd_R_frob(tmp, Eigen::ComputeFullU | Eigen::ComputeFullV);
+            Eigen::JacobiSVD<Eigen::Matrix3d> svd_R_frob(tmp, Eigen::ComputeFullU | Eigen::ComputeFullV);
             Rout = svd_R_frob.matrixU() * svd_R_frob.matrixV().transpose();
             // test if we found a good rotation matrix
             if (Rout.determinant() < 0)
@@ -600,8 +603,8 @@ namespace ORB_SLAM3 {
             tout = Rout * (scale * translation_t(result1(9, 0), result1(10, 0), result1(11, 0)));
 
             // find correct direction in terms of reprojection error, just take the first 6 correspondences
-            vector<double> error(2);
-            vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d>> Ts(2);
+            double error[2];
+            Eigen::Matrix4d Ts[2];
             for (int s = 0; s < 2; ++s) {
                 error[s] = 0.0;
                 Ts[s] = Eigen::Matrix4d::Identity();
@@ -612,7 +615,7 @@ namespace ORB_SLAM3 {
                     Ts[s].block<3, 1>(0, 3) = -tout;
                 Ts[s] = Ts[s].inverse().eval();
                 for (int p = 0; p < 6; ++p) {
-                    bearingVector_t v = Ts[s].block<3, 3>(0, 0) * points3v[p] + Ts[s].block<3, 1>(0, 3);
+                    bearingVector_t v = Ts[s].block<3, 3>(0, 0) * mvPoints3[p] + Ts[s].block<3, 1>(0, 3);
                     v = v / v.norm();
                     error[s] += (1.0 - v.transpose() * f[indices[p]]);
                 }
@@ -629,7 +632,7 @@ namespace ORB_SLAM3 {
         // 5. gauss newton
         //////////////////////////////////////
         rodrigues_t omega = rot2rodrigues(Rout);
-        Eigen::VectorXd minx(6);
+        pose_vector_t minx;
         minx[0] = omega[0];
         minx[1] = omega[1];
         minx[2] = omega[2];
@@ -637,7 +640,7 @@ namespace ORB_SLAM3 {
         minx[4] = tout[1];
         minx[5] = tout[2];
 
-        mlpnp_gn(minx, points3v, nullspaces, P, use_cov);
+        mlpnp_gn(minx, mvPoints3, mvNullspaces, mvWeights, use_cov);
 
         Rout = rodrigues2rot(rodrigues_t(minx[0], minx[1], minx[2]));
         tout = translation_t(minx[3], minx[4], minx[5]);
@@ -680,8 +683,8 @@ namespace ORB_SLAM3 {
         return omega;
     }
 
-    void MLPnPsolver::mlpnp_gn(Eigen::VectorXd &x, const points_t &pts, const std::vector<Eigen::MatrixXd> &nullspaces,
-                               const Eigen::SparseMatrix<double> Kll, bool use_cov) {
+    void MLPnPsolver::mlpnp_gn(pose_vector_t &x, const points_t &pts, const nullspaces_t &nullspaces,
+                               const cov2_mats_t &Kll, bool use_cov) {
         const int numObservations = pts.size();
         const int numUnknowns = 6;
         // check redundancy
@@ -690,113 +693,89 @@ namespace ORB_SLAM3 {
         // =============
         // set all matrices up
         // =============
-
-        Eigen::VectorXd r(2 * numObservations);
-        Eigen::VectorXd rd(2 * numObservations);
-        Eigen::MatrixXd Jac(2 * numObservations, numUnknowns);
-        Eigen::VectorXd g(numUnknowns, 1);
-        Eigen::VectorXd dx(numUnknowns, 1); // result vector
-
-        Jac.setZero();
-        r.setZero();
-        dx.setZero();
-        g.setZero();
+        // residuals and jacobians per observation (buffers of the solver), normal equations fixed-size
+        mvResiduals.resize(numObservations);
+        mvJacobians.resize(numObservations);
+        Eigen::Matrix<double, 6, 6> A;
+        pose_vector_t g; // system vector
+        pose_vector_t dx; // result vector
 
         int it_cnt = 0;
         bool stop = false;
         const int maxIt = 5;
         double epsP = 1e-5;
 
-        Eigen::MatrixXd JacTSKll;
-        Eigen::MatrixXd A;
         // solve simple gradient descent
         while (it_cnt < maxIt && !stop) {
             mlpnp_residuals_and_jacs(x, pts,
                                      nullspaces,
-                                     r, Jac, true);
-
-            if (use_cov)
-                JacTSKll = Jac.transpose() * Kll;
-            else
-                JacTSKll = Jac.transpose();
-
-            A = JacTSKll * Jac;
+                                     mvResiduals, mvJacobians, true);
 
             // get system matrix
-            g = JacTSKll * r;
+            A.setZero();
+            g.setZero();
+            for (int i = 0; i < numObservations; ++i) {
+                const jacobian_t &Jac = mvJacobians[i];
+                if (use_cov) {
+                    const Eigen::Matrix<double, 6, 2> JacTSKll = Jac.transpose() * Kll[i];
+                    A.noalias() += JacTSKll * Jac;
+                    g.noalias() += JacTSKll * mvResiduals[i];
+                } else {
+                    A.noalias() += Jac.transpose() * Jac;
+                    g.noalias() += Jac.transpose() * mvResiduals[i];
+                }
+            }
 
             // solve
-            Eigen::LDLT<Eigen::MatrixXd> chol(A);
+            Eigen::LDLT<Eigen::Matrix<double, 6, 6> > chol(A);
             dx = chol.solve(g);
             // this is to prevent the solution from falling into a wrong minimum
             // if the linear estimate is spurious
             if (dx.array().abs().maxCoeff() > 5.0 || dx.array().abs().minCoeff() > 1.0)
                 break;
             // observation update
-            Eigen::MatrixXd dl = Jac * dx;
-            if (dl.array().abs().maxCoeff() < epsP) {
+            double dlMax = 0.0;
+            for (int i = 0; i < numObservations; ++i)
+                dlMax = std::max(dlMax, (mvJacobians[i] * dx).cwiseAbs().maxCoeff());
+            x = x - dx;
+            if (dlMax < epsP) {
                 stop = true;
-                x = x - dx;
                 break;
-            } else
-                x = x - dx;
+            }
 
             ++it_cnt;
         }//while
         // result
     }
 
-    void MLPnPsolver::mlpnp_residuals_and_jacs(const Eigen::VectorXd &x, const points_t &pts,
-                                               const std::vector<Eigen::MatrixXd> &nullspaces, Eigen::VectorXd &r,
-                                               Eigen::MatrixXd &fjac, bool getJacs) {
+    void MLPnPsolver::mlpnp_residuals_and_jacs(const pose_vector_t &x, const points_t &pts,
+                                               const nullspaces_t &nullspaces, residuals_t &r,
+                                               jacobians_t &fjac, bool getJacs) {
         rodrigues_t w(x[0], x[1], x[2]);
         translation_t T(x[3], x[4], x[5]);
 
         rotation_t R = rodrigues2rot(w);
-        int ii = 0;
-
-        Eigen::MatrixXd jacs(2, 6);
 
         for (int i = 0; i < pts.size(); ++i)
         {
             Eigen::Vector3d ptCam = R*pts[i] + T;
             ptCam /= ptCam.norm();
 
-            r[ii] = nullspaces[i].col(0).transpose()*ptCam;
-            r[ii + 1] = nullspaces[i].col(1).transpose()*ptCam;
+            r[i] = nullspaces[i].transpose()*ptCam;
             if (getJacs)
             {
-                // jacs
+                // jacs of r and s
                 mlpnpJacs(pts[i],
                           nullspaces[i].col(0), nullspaces[i].col(1),
                           w, T,
-                          jacs);
-
-                // r
-                fjac(ii, 0) = jacs(0, 0);
-                fjac(ii, 1) = jacs(0, 1);
-                fjac(ii, 2) = jacs(0, 2);
-
-                fjac(ii, 3) = jacs(0, 3);
-                fjac(ii, 4) = jacs(0, 4);
-                fjac(ii, 5) = jacs(0, 5);
-                // s
-                fjac(ii + 1, 0) = jacs(1, 0);
-                fjac(ii + 1, 1) = jacs(1, 1);
-                fjac(ii + 1, 2) = jacs(1, 2);
-
-                fjac(ii + 1, 3) = jacs(1, 3);
-                fjac(ii + 1, 4) = jacs(1, 4);
-                fjac(ii + 1, 5) = jacs(1, 5);
-
+                          fjac[i]);
             }
-            ii += 2;
         }
     }
 
     void MLPnPsolver::mlpnpJacs(const point_t& pt, const Eigen::Vector3d& nullspace_r,
             					const Eigen::Vector3d& nullspace_s, const rodrigues_t& w,
-            					const translation_t& t, Eigen::MatrixXd& jacs){
+            					const translation_t& t, jacobian_t& jacs){
     	double r1 = nullspace_r[0];
 		double r2 = nullspace_r[1];
 		double r3 = nullspace_r[2];
@@ -18,36 +18,45 @@
 
 
 #include "Map.h"
+#include "MapEvents.h"
+#include "EpochManager.h"
+#include "SystemContext.h"
 
 #include<mutex>
 
 namespace ORB_SLAM3
 {
 
-long unsigned int Map::nNextId=0;
+std::atomic<long unsigned int> Map::nNextId(0);
 
 Map::Map():mnMaxKFid(0),mnBigChangeIdx(0), mbImuInitialized(false), mnMapChange(0), mpFirstRegionKF(static_cast<KeyFrame*>(NULL)),
-mbFail(false), mIsInUse(false), mHasTumbnail(false), mbBad(false), mnMapChangeNotified(0), mbIsInertial(false), mbIMU_BA1(false), mbIMU_BA2(false)
+mbFail(false), mIsInUse(false), mHasTumbnail(false), mbBad(false), mnMapChangeNotified(0), mbIsInertial(false), mbIMU_BA1(false), mbIMU_BA2(false),
+mnKeyFramesSnapshotVersion(0), mnMapPointsSnapshotVersion(0), mpEvents(static_cast<MapEvents*>(NULL)),
+mpContext(static_cast<SystemContext*>(NULL))
 {
     mnId=nNextId++;
     mThumbnail = static_cast<GLubyte*>(NULL);
+    mpKFinitial = mpKFlowerID = static_cast<KeyFrame*>(NULL);
 }
 
 Map::Map(int initKFid):mnInitKFid(initKFid), mnMaxKFid(initKFid),mnLastLoopKFid(initKFid), mnBigChangeIdx(0), mIsInUse(false),
                        mHasTumbnail(false), mbBad(false), mbImuInitialized(false), mpFirstRegionKF(static_cast<KeyFrame*>(NULL)),
-                       mnMapChange(0), mbFail(false), mnMapChangeNotified(0), mbIsInertial(false), mbIMU_BA1(false), mbIMU_BA2(false)
+                       mnMapChange(0), mbFail(false), mnMapChangeNotified(0), mbIsInertial(false), mbIMU_BA1(false), mbIMU_BA2(false),
+mnKeyFramesSnapshotVersion(0), mnMapPointsSnapshotVersion(0), mpEvents(static_cast<MapEvents*>(NULL)),
+mpContext(static_cast<SystemContext*>(NULL))
 {
     mnId=nNextId++;
     mThumbnail = static_cast<GLubyte*>(NULL);
+    mpKFinitial = mpKFlowerID = static_cast<KeyFrame*>(NULL);
 }
 
 Map::~Map()
 {
     //TODO: erase all points from memory
-    mspMapPoints.clear();
+    mMapPoints.Clear();
 
     //TODO: erase all keyframes from memory
-    mspKeyFrames.clear();
+    mKeyFrames.Clear();
 
     if(mThumbnail)
         delete mThumbnail;
@@ -59,14 +68,20 @@ Map::~Map()
 
 void Map::AddKeyFrame(KeyFrame *pKF)
 {
-    unique_lock<mutex> lock(mMutexMap);
-    if(mspKeyFrames.empty()){
+    {
+        // Read under the index lock, a concurrent UpdateKeyFramePosition reads the center again after it
+        unique_lock<boost::shared_mutex> lockIdx(mMutexSpatialIndex);
+        mKeyFrameIndex.Insert(pKF,pKF->GetCameraCenter_());
+    }
+
+    unique_lock<boost::shared_mutex> lock(mMutexMap);
+    if(mKeyFrames.empty()){
         cout << "First KF:" << pKF->mnId << "; Map init KF:" << mnInitKFid << endl;
         mnInitKFid = pKF->mnId;
         mpKFinitial = pKF;
         mpKFlowerID = pKF;
     }
-    mspKeyFrames.insert(pKF);
+    mKeyFrames.Insert(pKF);
     if(pKF->mnId>mnMaxKFid)
     {
         mnMaxKFid=pKF->mnId;
@@ -75,30 +90,65 @@ void Map::AddKeyFrame(KeyFrame *pKF)
     {
         mpKFlowerID = pKF;
     }
+    lock.unlock();
+
+    AddToSubmap(pKF);
+
+    if(mpEvents && mpEvents->IsActive())
+    {
+        // Read under the lock of UpdateKeyFramePosition, so that a concurrent move is not overwritten by an older pose
+        unique_lock<mutex> lockEvents(mMutexPositionEvents);
+        mpEvents->KeyFrameAdded(pKF->mnId,mnId,pKF->GetPose_());
+    }
 }
 
 void Map::AddMapPoint(MapPoint *pMP)
 {
-    unique_lock<mutex> lock(mMutexMap);
-    mspMapPoints.insert(pMP);
+    {
+        unique_lock<boost::shared_mutex> lock(mMutexMap);
+        mMapPoints.Insert(pMP);
+    }
+
+    {
+        // Read under the index lock, a concurrent UpdateMapPointPosition reads the position again after it
+        unique_lock<boost::shared_mutex> lockIdx(mMutexSpatialIndex);
+        mMapPointIndex.Insert(pMP,pMP->GetWorldPos2());
+    }
+
+    if(mpEvents && mpEvents->IsActive())
+    {
+        // Read under the lock of UpdateMapPointPosition, so that a concurrent move is not overwritten by an older position
+        unique_lock<mutex> lockEvents(mMutexPositionEvents);
+        mpEvents->PointAdded(pMP->mnId,mnId,pMP->GetWorldPos2());
+    }
 }
 
 void Map::SetImuInitialized()
 {
-    unique_lock<mutex> lock(mMutexMap);
+    unique_lock<boost::shared_mutex> lock(mMutexMap);
     mbImuInitialized = true;
 }
 
 bool Map::isImuInitialized()
 {
-    unique_lock<mutex> lock(mMutexMap);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexMap);
     return mbImuInitialized;
 }
 
 void Map::EraseMapPoint(MapPoint *pMP)
 {
-    unique_lock<mutex> lock(mMutexMap);
-    mspMapPoints.erase(pMP);
+    {
+        unique_lock<boost::shared_mutex> lockIdx(mMutexSpatialIndex);
+        mMapPointIndex.Erase(pMP);
+    }
+
+    {
+        unique_lock<boost::shared_mutex> lock(mMutexMap);
+        mMapPoints.Erase(pMP);
+    }
+
+    if(mpEvents && mpEvents->IsActive())
+        mpEvents->PointRemoved(pMP->mnId,mnId);
 
     // TODO: This only erase the pointer.
     // Delete the MapPoint
@@ -106,13 +156,13 @@ void Map::EraseMapPoint(MapPoint *pMP)
 
 void Map::EraseKeyFrame(KeyFrame *pKF)
 {
-    unique_lock<mutex> lock(mMutexMap);
-    mspKeyFrames.erase(pKF);
-    if(mspKeyFrames.size()>0)
+    unique_lock<boost::shared_mutex> lock(mMutexMap);
+    mKeyFrames.Erase(pKF);
+    if(mKeyFrames.size()>0)
     {
         if(pKF->mnId == mpKFlowerID->mnId)
         {
-            vector<KeyFrame*> vpKFs = vector<KeyFrame*>(mspKeyFrames.begin(),mspKeyFrames.end());
+            vector<KeyFrame*> vpKFs = vector<KeyFrame*>(mKeyFrames.begin(),mKeyFrames.end());
             sort(vpKFs.begin(),vpKFs.end(),KeyFrame::lId);
             mpKFlowerID = vpKFs[0];
         }
@@ -121,6 +171,24 @@ void Map::EraseKeyFrame(KeyFrame *pKF)
     {
         mpKFlowerID = 0;
     }
+    lock.unlock();
+
+    {
+        unique_lock<boost::shared_mutex> lockIdx(mMutexSpatialIndex);
+        mKeyFrameIndex.Erase(pKF);
+    }
+
+    {
+        unique_lock<mutex> lockSubmaps(mMutexSubmaps);
+        if(pKF->mnSubmapId>=0 && pKF->mnSubmapId<(long int)mvvpSubmapKeyFrames.size())
+        {
+            vector<KeyFrame*> &vpSubmapKFs = mvvpSubmapKeyFrames[pKF->mnSubmapId];
+            vpSubmapKFs.erase(std::remove(vpSubmapKFs.begin(),vpSubmapKFs.end(),pKF),vpSubmapKFs.end());
+        }
+    }
+
+    if(mpEvents && mpEvents->IsActive())
+        mpEvents->KeyFrameRemoved(pKF->mnId,mnId);
 
     // TODO: This only erase the pointer.
     // Delete the MapPoint
@@ -128,71 +196,118 @@ void Map::EraseKeyFrame(KeyFrame *pKF)
 
 void Map::SetReferenceMapPoints(const vector<MapPoint *> &vpMPs)
 {
-    unique_lock<mutex> lock(mMutexMap);
+    unique_lock<boost::shared_mutex> lock(mMutexMap);
     mvpReferenceMapPoints = vpMPs;
 }
 
 void Map::InformNewBigChange()
 {
-    unique_lock<mutex> lock(mMutexMap);
+    unique_lock<boost::shared_mutex> lock(mMutexMap);
     mnBigChangeIdx++;
 }
 
 int Map::GetLastBigChangeIdx()
 {
-    unique_lock<mutex> lock(mMutexMap);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexMap);
     return mnBigChangeIdx;
 }
 
 vector<KeyFrame*> Map::GetAllKeyFrames()
 {
-    unique_lock<mutex> lock(mMutexMap);
-    return vector<KeyFrame*>(mspKeyFrames.begin(),mspKeyFrames.end());
+    return *GetKeyFramesSnapshot();
 }
 
 vector<MapPoint*> Map::GetAllMapPoints()
 {
-    unique_lock<mutex> lock(mMutexMap);
-    return vector<MapPoint*>(mspMapPoints.begin(),mspMapPoints.end());
+    return *GetMapPointsSnapshot();
+}
+
+Map::KeyFramesSnapshot Map::GetKeyFramesSnapshot()
+{
+    boost::shared_lock<boost::shared_mutex> lock(mMutexMap);
+    unique_lock<mutex> lockSnapshots(mMutexSnapshots);
+    if(!mpKeyFramesSnapshot || mnKeyFramesSnapshotVersion!=mKeyFrames.Version())
+    {
+        mpKeyFramesSnapshot = std::make_shared<vector<KeyFrame*> >(mKeyFrames.begin(),mKeyFrames.end());
+        mnKeyFramesSnapshotVersion = mKeyFrames.Version();
+    }
+    return mpKeyFramesSnapshot;
+}
+
+Map::MapPointsSnapshot Map::GetMapPointsSnapshot()
+{
+    boost::shared_lock<boost::shared_mutex> lock(mMutexMap);
+    unique_lock<mutex> lockSnapshots(mMutexSnapshots);
+    if(!mpMapPointsSnapshot || mnMapPointsSnapshotVersion!=mMapPoints.Version())
+    {
+        mpMapPointsSnapshot = std::make_shared<vector<MapPoint*> >(mMapPoints.begin(),mMapPoints.end());
+        mnMapPointsSnapshotVersion = mMapPoints.Version();
+    }
+    return mpMapPointsSnapshot;
+}
+
+void Map::AccumulateMemory(MemoryUsage &usage)
+{
+    const KeyFramesSnapshot pKFs = GetKeyFramesSnapshot();
+    for(size_t i=0; i<pKFs->size(); i++)
+        (*pKFs)[i]->AccumulateMemory(usage);
+
+    const MapPointsSnapshot pMPs = GetMapPointsSnapshot();
+    for(size_t i=0; i<pMPs->size(); i++)
+        (*pMPs)[i]->AccumulateMemory(usage);
+
+    usage.nMaps++;
 }
 
 long unsigned int Map::MapPointsInMap()
 {
-    unique_lock<mutex> lock(mMutexMap);
-    return mspMapPoints.size();
+    boost::shared_lock<boost::shared_mutex> lock(mMutexMap);
+    return mMapPoints.size();
 }
 
 long unsigned int Map::KeyFramesInMap()
 {
-    unique_lock<mutex> lock(mMutexMap);
-    return mspKeyFrames.size();
+    boost::shared_lock<boost::shared_mutex> lock(mMutexMap);
+    return mKeyFrames.size();
 }
 
 vector<MapPoint*> Map::GetReferenceMapPoints()
 {
-    unique_lock<mutex> lock(mMutexMap);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexMap);
     return mvpReferenceMapPoints;
 }
 
+KeyFrame* Map::GetKeyFrame(const EntityHandle &h)
+{
+    boost::shared_lock<boost::shared_mutex> lock(mMutexMap);
+    return mKeyFrames.Get(h);
+}
+
+MapPoint* Map::GetMapPoint(const EntityHandle &h)
+{
+    boost::shared_lock<boost::shared_mutex> lock(mMutexMap);
+    return mMapPoints.Get(h);
+}
+
 long unsigned int Map::GetId()
 {
     return mnId;
 }
 long unsigned int Map::GetInitKFid()
 {
-    unique_lock<mutex> lock(mMutexMap);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexMap);
     return mnInitKFid;
 }
 
 void Map::SetInitKFid(long unsigned int initKFif)
 {
-    unique_lock<mutex> lock(mMutexMap);
+    unique_lock<boost::shared_mutex> lock(mMutexMap);
     mnInitKFid = initKFif;
 }
 
 long unsigned int Map::GetMaxKFid()
 {
-    unique_lock<mutex> lock(mMutexMap);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexMap);
     return mnMaxKFid;
 }
 
@@ -213,18 +328,18 @@ void Map::SetStoredMap()
 
 void Map::clear()
 {
-//    for(set<MapPoint*>::iterator sit=mspMapPoints.begin(), send=mspMapPoints.end(); sit!=send; sit++)
+//    for(EntityStore<MapPoint>::const_iterator sit=mMapPoints.begin(), send=mMapPoints.end(); sit!=send; sit++)
 //        delete *sit;
 
-    for(set<KeyFrame*>::iterator sit=mspKeyFrames.begin(), send=mspKeyFrames.end(); sit!=send; sit++)
+    for(EntityStore<KeyFrame>::const_iterator sit=mKeyFrames.begin(), send=mKeyFrames.end(); sit!=send; sit++)
     {
         KeyFrame* pKF = *sit;
         pKF->UpdateMap(static_cast<Map*>(NULL));
 //        delete *sit;
     }
 
-    mspMapPoints.clear();
-    mspKeyFrames.clear();
+    mMapPoints.Clear();
+    mKeyFrames.Clear();
     mnMaxKFid = mnInitKFid;
     mnLastLoopKFid = 0;
     mbImuInitialized = false;
@@ -232,6 +347,30 @@ void Map::clear()
     mvpKeyFrameOrigins.clear();
     mbIMU_BA1 = false;
     mbIMU_BA2 = false;
+
+    {
+        unique_lock<mutex> lockGraph(mMutexKeyFrameGraph);
+        mpKeyFrameGraph.reset();
+    }
+
+    {
+        unique_lock<mutex> lockSubmaps(mMutexSubmaps);
+        mvvpSubmapKeyFrames.clear();
+    }
+
+    {
+        // Freeing the cells takes time linear in the map, it is left to the next reclamation
+        SpatialIndex<MapPoint>* pMapPointIndex = new SpatialIndex<MapPoint>();
+        SpatialIndex<KeyFrame>* pKeyFrameIndex = new SpatialIndex<KeyFrame>();
+        unique_lock<boost::shared_mutex> lockIdx(mMutexSpatialIndex);
+        pMapPointIndex->Swap(mMapPointIndex);
+        pKeyFrameIndex->Swap(mKeyFrameIndex);
+        EpochManager::Retire(pMapPointIndex, GetReclaimGracePeriod());
+        EpochManager::Retire(pKeyFrameIndex, GetReclaimGracePeriod());
+    }
+
+    if(mpEvents && mpEvents->IsActive())
+        mpEvents->MapCleared(mnId);
 }
 
 bool Map::IsInUse()
@@ -251,7 +390,7 @@ bool Map::IsBad()
 
 void Map::RotateMap(const cv::Mat &R)
 {
-    unique_lock<mutex> lock(mMutexMap);
+    unique_lock<boost::shared_mutex> lock(mMutexMap);
 
     cv::Mat Txw = cv::Mat::eye(4,4,CV_32F);
     R.copyTo(Txw.rowRange(0,3).colRange(0,3));
@@ -266,7 +405,7 @@ void Map::RotateMap(const cv::Mat &R)
     cv::Mat Ryw = Tyw.rowRange(0,3).colRange(0,3);
     cv::Mat tyw = Tyw.rowRange(0,3).col(3);
 
-    for(set<KeyFrame*>::iterator sit=mspKeyFrames.begin(); sit!=mspKeyFrames.end(); sit++)
+    for(EntityStore<KeyFrame>::const_iterator sit=mKeyFrames.begin(); sit!=mKeyFrames.end(); sit++)
     {
         KeyFrame* pKF = *sit;
         cv::Mat Twc = pKF->GetPoseInverse();
@@ -278,7 +417,7 @@ void Map::RotateMap(const cv::Mat &R)
         cv::Mat Vw = pKF->GetVelocity();
         pKF->SetVelocity(Ryw*Vw);
     }
-    for(set<MapPoint*>::iterator sit=mspMapPoints.begin(); sit!=mspMapPoints.end(); sit++)
+    for(EntityStore<MapPoint>::const_iterator sit=mMapPoints.begin(); sit!=mMapPoints.end(); sit++)
     {
         MapPoint* pMP = *sit;
         pMP->SetWorldPos(Ryw*pMP->GetWorldPos()+tyw);
@@ -288,7 +427,7 @@ void Map::RotateMap(const cv::Mat &R)
 
 void Map::ApplyScaledRotation(const cv::Mat &R, const float s, const bool bScaledVel, const cv::Mat t)
 {
-    unique_lock<mutex> lock(mMutexMap);
+    unique_lock<boost::shared_mutex> lock(mMutexMap);
 
     // Body position (IMU) of first keyframe is fixed to (0,0,0)
     cv::Mat Txw = cv::Mat::eye(4,4,CV_32F);
@@ -301,7 +440,7 @@ void Map::ApplyScaledRotation(const cv::Mat &R, const float s, const bool bScale
     cv::Mat Ryw = Tyw.rowRange(0,3).colRange(0,3);
     cv::Mat tyw = Tyw.rowRange(0,3).col(3);
 
-    for(set<KeyFrame*>::iterator sit=mspKeyFrames.begin(); sit!=mspKeyFrames.end(); sit++)
+    for(EntityStore<KeyFrame>::const_iterator sit=mKeyFrames.begin(); sit!=mKeyFrames.end(); sit++)
     {
         KeyFrame* pKF = *sit;
         cv::Mat Twc = pKF->GetPoseInverse();
@@ -311,6 +450,7 @@ void Map::ApplyScaledRotation(const cv::Mat &R, const float s, const bool bScale
         Tcy.rowRange(0,3).colRange(0,3) = Tyc.rowRange(0,3).colRange(0,3).t();
         Tcy.rowRange(0,3).col(3) = -Tcy.rowRange(0,3).colRange(0,3)*Tyc.rowRange(0,3).col(3);
         pKF->SetPose(Tcy);
+        pKF->ResetInertialPrior();
         cv::Mat Vw = pKF->GetVelocity();
         if(!bScaledVel)
             pKF->SetVelocity(Ryw*Vw);
@@ -318,7 +458,7 @@ void Map::ApplyScaledRotation(const cv::Mat &R, const float s, const bool bScale
             pKF->SetVelocity(Ryw*Vw*s);
 
     }
-    for(set<MapPoint*>::iterator sit=mspMapPoints.begin(); sit!=mspMapPoints.end(); sit++)
+    for(EntityStore<MapPoint>::const_iterator sit=mMapPoints.begin(); sit!=mMapPoints.end(); sit++)
     {
         MapPoint* pMP = *sit;
         pMP->SetWorldPos(s*Ryw*pMP->GetWorldPos()+tyw);
@@ -329,37 +469,37 @@ void Map::ApplyScaledRotation(const cv::Mat &R, const float s, const bool bScale
 
 void Map::SetInertialSensor()
 {
-    unique_lock<mutex> lock(mMutexMap);
+    unique_lock<boost::shared_mutex> lock(mMutexMap);
     mbIsInertial = true;
 }
 
 bool Map::IsInertial()
 {
-    unique_lock<mutex> lock(mMutexMap);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexMap);
     return mbIsInertial;
 }
 
 void Map::SetIniertialBA1()
 {
-    unique_lock<mutex> lock(mMutexMap);
+    unique_lock<boost::shared_mutex> lock(mMutexMap);
     mbIMU_BA1 = true;
 }
 
 void Map::SetIniertialBA2()
 {
-    unique_lock<mutex> lock(mMutexMap);
+    unique_lock<boost::shared_mutex> lock(mMutexMap);
     mbIMU_BA2 = true;
 }
 
 bool Map::GetIniertialBA1()
 {
-    unique_lock<mutex> lock(mMutexMap);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexMap);
     return mbIMU_BA1;
 }
 
 bool Map::GetIniertialBA2()
 {
-    unique_lock<mutex> lock(mMutexMap);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexMap);
     return mbIMU_BA2;
 }
 
@@ -390,7 +530,7 @@ void Map::PrintEssentialGraph()
         vstrHeader.push_back("--");
         vpChilds.push_back(pKFi);
     }
-    for(int i=0; i<vpChilds.size() && count <= (mspKeyFrames.size()+10); ++i)
+    for(int i=0; i<vpChilds.size() && count <= (mKeyFrames.size()+10); ++i)
     {
         count++;
         string strHeader = vstrHeader[i];
@@ -405,7 +545,7 @@ void Map::PrintEssentialGraph()
             vstrHeader.push_back(strHeader+"--");
         }
     }
-    if (count == (mspKeyFrames.size()+10))
+    if (count == (mKeyFrames.size()+10))
         cout << "CYCLE!!"    << endl;
 
     cout << "------------------" << endl << "End of the essential graph" << endl;
@@ -431,11 +571,11 @@ bool Map::CheckEssentialGraph(){
 
     set<KeyFrame*> spChilds = pFirstKF->GetChilds();
     vector<KeyFrame*> vpChilds;
-    vpChilds.reserve(mspKeyFrames.size());
+    vpChilds.reserve(mKeyFrames.size());
     for(KeyFrame* pKFi : spChilds)
         vpChilds.push_back(pKFi);
 
-    for(int i=0; i<vpChilds.size() && count <= (mspKeyFrames.size()+10); ++i)
+    for(int i=0; i<vpChilds.size() && count <= (mKeyFrames.size()+10); ++i)
     {
         count++;
         KeyFrame* pKFi = vpChilds[i];
@@ -444,13 +584,333 @@ bool Map::CheckEssentialGraph(){
             vpChilds.push_back(pKFj);
     }
 
-    cout << "count/tot" << count << "/" << mspKeyFrames.size() << endl;
-    if (count != (mspKeyFrames.size()-1))
+    cout << "count/tot" << count << "/" << mKeyFrames.size() << endl;
+    if (count != (mKeyFrames.size()-1))
         return false;
     else
         return true;
 }
 
+int Map::KeyFrameGraph::Index(const KeyFrame* pKF) const
+{
+    vector<long unsigned int>::const_iterator it = lower_bound(vnIds.begin(),vnIds.end(),pKF->mnId);
+    if(it==vnIds.end() || *it!=pKF->mnId || vpKeyFrames[it-vnIds.begin()]!=pKF)
+        return -1;
+    return it-vnIds.begin();
+}
+
+Map::KeyFrameGraphSnapshot Map::GetKeyFrameGraph()
+{
+    unique_lock<mutex> lock(mMutexKeyFrameGraph);
+
+    vector<KeyFrame*> vpKFs(*GetKeyFramesSnapshot());
+    sort(vpKFs.begin(),vpKFs.end(),KeyFrame::lId);
+
+    // Versions before the rows: a change while they are read shows up in the next call
+    const int N = vpKFs.size();
+    vector<unsigned long> vnVersions(N);
+    for(int i=0; i<N; i++)
+        vnVersions[i] = vpKFs[i]->GetGraphVersion();
+
+    const KeyFrameGraphSnapshot pPrev = mpKeyFrameGraph;
+    if(pPrev && pPrev->vpKeyFrames==vpKFs && pPrev->vnVersions==vnVersions)
+        return pPrev;
+
+    std::shared_ptr<KeyFrameGraph> pGraph = std::make_shared<KeyFrameGraph>();
+    KeyFrameGraph &graph = *pGraph;
+    graph.vpKeyFrames = vpKFs;
+    graph.vnVersions = vnVersions;
+    graph.vnIds.resize(N);
+    for(int i=0; i<N; i++)
+        graph.vnIds[i] = vpKFs[i]->mnId;
+
+    graph.vParent.assign(N,-1);
+    graph.vChildBegin.reserve(N+1);
+    graph.vLoopBegin.reserve(N+1);
+    graph.vCovBegin.reserve(N+1);
+    if(pPrev)
+    {
+        graph.vChildren.reserve(pPrev->vChildren.size());
+        graph.vLoopEdges.reserve(pPrev->vLoopEdges.size());
+        graph.vCovisibles.reserve(pPrev->vCovisibles.size());
+        graph.vCovWeights.reserve(pPrev->vCovWeights.size());
+    }
+
+    // The keyframe getters take the keyframe mutexes, the map mutex is not held here
+    vector<KeyFrame*> vpCovisibles;
+    vector<int> vWeights;
+    for(int i=0; i<N; i++)
+    {
+        KeyFrame* pKF = vpKFs[i];
+        graph.vChildBegin.push_back(graph.vChildren.size());
+        graph.vLoopBegin.push_back(graph.vLoopEdges.size());
+        graph.vCovBegin.push_back(graph.vCovisibles.size());
+
+        const int p = pPrev ? pPrev->Index(pKF) : -1;
+        if(p>=0 && pPrev->vnVersions[p]==vnVersions[i])
+        {
+            // Unchanged keyframe: its rows are copied with the indices of the new graph
+            const KeyFrameGraph &prev = *pPrev;
+            if(prev.vParent[p]>=0)
+                graph.vParent[i] = graph.Index(prev.vpKeyFrames[prev.vParent[p]]);
+            for(int k=prev.vChildBegin[p]; k<prev.vChildBegin[p+1]; k++)
+            {
+                const int j = graph.Index(prev.vpKeyFrames[prev.vChildren[k]]);
+                if(j>=0)
+                    graph.vChildren.push_back(j);
+            }
+            for(int k=prev.vLoopBegin[p]; k<prev.vLoopBegin[p+1]; k++)
+            {
+                const int j = graph.Index(prev.vpKeyFrames[prev.vLoopEdges[k]]);
+                if(j>=0)
+                    graph.vLoopEdges.push_back(j);
+            }
+            for(int k=prev.vCovBegin[p]; k<prev.vCovBegin[p+1]; k++)
+            {
+                const int j = graph.Index(prev.vpKeyFrames[prev.vCovisibles[k]]);
+                if(j>=0)
+                {
+                    graph.vCovisibles.push_back(j);
+                    graph.vCovWeights.push_back(prev.vCovWeights[k]);
+                }
+            }
+            continue;
+        }
+
+        KeyFrame* pParent = pKF->GetParent();
+        if(pParent)
+            graph.vParent[i] = graph.Index(pParent);
+
+        const set<KeyFrame*> spChildren = pKF->GetChilds();
+        for(set<KeyFrame*>::const_iterator sit=spChildren.begin(), send=spChildren.end(); sit!=send; sit++)
+        {
+            const int j = graph.Index(*sit);
+            if(j>=0)
+                graph.vChildren.push_back(j);
+        }
+
+        const set<KeyFrame*> spLoopEdges = pKF->GetLoopEdges();
+        for(set<KeyFrame*>::const_iterator sit=spLoopEdges.begin(), send=spLoopEdges.end(); sit!=send; sit++)
+        {
+            const int j = graph.Index(*sit);
+            if(j>=0)
+                graph.vLoopEdges.push_back(j);
+        }
+
+        pKF->GetOrderedCovisibles(vpCovisibles, vWeights);
+        for(size_t k=0; k<vpCovisibles.size(); k++)
+        {
+            const int j = vpCovisibles[k] ? graph.Index(vpCovisibles[k]) : -1;
+            if(j>=0)
+            {
+                graph.vCovisibles.push_back(j);
+                graph.vCovWeights.push_back(vWeights[k]);
+            }
+        }
+    }
+    graph.vChildBegin.push_back(graph.vChildren.size());
+    graph.vLoopBegin.push_back(graph.vLoopEdges.size());
+    graph.vCovBegin.push_back(graph.vCovisibles.size());
+
+    mpKeyFrameGraph = pGraph;
+    return mpKeyFrameGraph;
+}
+
+void Map::GetEssentialGraph(const int nMinFeat, const vector<KeyFrame*> &vpKFs, vector<EssentialEdges> &vEdges)
+{
+    const KeyFrameGraphSnapshot pGraph = GetKeyFrameGraph();
+    const KeyFrameGraph &graph = *pGraph;
+
+    vEdges.resize(vpKFs.size());
+    for(size_t n=0, nend=vpKFs.size(); n<nend; n++)
+    {
+        EssentialEdges &edges = vEdges[n];
+        edges.pParent = static_cast<KeyFrame*>(NULL);
+        edges.bParentCovisible = false;
+        edges.vpLoopEdges.clear();
+        edges.vpCovisibles.clear();
+
+        // Keyframes erased from the map have no edges
+        const int i = graph.Index(vpKFs[n]);
+        if(i<0)
+            continue;
+
+        const long unsigned int nId = graph.vnIds[i];
+        const int p = graph.vParent[i];
+        if(p>=0)
+            edges.pParent = graph.vpKeyFrames[p];
+
+        for(int k=graph.vLoopBegin[i]; k<graph.vLoopBegin[i+1]; k++)
+        {
+            const int j = graph.vLoopEdges[k];
+            if(graph.vnIds[j]<nId)
+                edges.vpLoopEdges.push_back(graph.vpKeyFrames[j]);
+        }
+
+        // By decreasing weight, the first one below nMinFeat ends the row
+        for(int k=graph.vCovBegin[i]; k<graph.vCovBegin[i+1] && graph.vCovWeights[k]>=nMinFeat; k++)
+        {
+            const int j = graph.vCovisibles[k];
+            if(graph.vnIds[j]>=nId)
+                continue;
+            if(j==p)
+            {
+                edges.bParentCovisible = true;
+                continue;
+            }
+            if(find(graph.vChildren.begin()+graph.vChildBegin[i], graph.vChildren.begin()+graph.vChildBegin[i+1], j)!=graph.vChildren.begin()+graph.vChildBegin[i+1])
+                continue;
+            if(find(graph.vLoopEdges.begin()+graph.vLoopBegin[i], graph.vLoopEdges.begin()+graph.vLoopBegin[i+1], j)!=graph.vLoopEdges.begin()+graph.vLoopBegin[i+1])
+                continue;
+            edges.vpCovisibles.push_back(graph.vpKeyFrames[j]);
+        }
+    }
+}
+
+int Map::GetKeyFramesPerSubmap()
+{
+    return Context().mnKeyFramesPerSubmap;
+}
+
+void Map::AddToSubmap(KeyFrame* pKF)
+{
+    const int nKeyFramesPerSubmap = GetKeyFramesPerSubmap();
+    if(nKeyFramesPerSubmap<=0)
+        return;
+
+    unique_lock<mutex> lockSubmaps(mMutexSubmaps);
+    if(mvvpSubmapKeyFrames.empty() || (int)mvvpSubmapKeyFrames.back().size()>=nKeyFramesPerSubmap)
+        mvvpSubmapKeyFrames.push_back(vector<KeyFrame*>());
+    mvvpSubmapKeyFrames.back().push_back(pKF);
+    pKF->mnSubmapId = mvvpSubmapKeyFrames.size()-1;
+}
+
+int Map::NumSubmaps()
+{
+    unique_lock<mutex> lockSubmaps(mMutexSubmaps);
+    return mvvpSubmapKeyFrames.size();
+}
+
+vector<KeyFrame*> Map::GetSubmapKeyFrames(const long int nSubmap)
+{
+    vector<KeyFrame*> vpKFs;
+    unique_lock<mutex> lockSubmaps(mMutexSubmaps);
+    if(nSubmap<0 || nSubmap>=(long int)mvvpSubmapKeyFrames.size())
+        return vpKFs;
+
+    const vector<KeyFrame*> &vpSubmapKFs = mvvpSubmapKeyFrames[nSubmap];
+    vpKFs.reserve(vpSubmapKFs.size());
+    for(size_t i=0; i<vpSubmapKFs.size(); i++)
+        if(!vpSubmapKFs[i]->isBad())
+            vpKFs.push_back(vpSubmapKFs[i]);
+    return vpKFs;
+}
+
+KeyFrame* Map::GetSubmapAnchor(const long int nSubmap)
+{
+    unique_lock<mutex> lockSubmaps(mMutexSubmaps);
+    if(nSubmap<0 || nSubmap>=(long int)mvvpSubmapKeyFrames.size())
+        return static_cast<KeyFrame*>(NULL);
+
+    const vector<KeyFrame*> &vpSubmapKFs = mvvpSubmapKeyFrames[nSubmap];
+    for(size_t i=0; i<vpSubmapKFs.size(); i++)
+        if(!vpSubmapKFs[i]->isBad())
+            return vpSubmapKFs[i];
+    return static_cast<KeyFrame*>(NULL);
+}
+
+void Map::UpdateMapPointPosition(MapPoint* pMP, const cv::Matx31f &pos)
+{
+    {
+        // The position is read again under the lock: of two concurrent moves the last one stays
+        unique_lock<boost::shared_mutex> lockIdx(mMutexSpatialIndex);
+        mMapPointIndex.Update(pMP,pMP->GetWorldPos2());
+    }
+
+    if(!mpEvents || !mpEvents->IsActive())
+        return;
+
+    unique_lock<mutex> lockEvents(mMutexPositionEvents);
+    mpEvents->PointMoved(pMP->mnId,mnId,pos);
+}
+
+void Map::UpdateKeyFramePosition(KeyFrame* pKF)
+{
+    {
+        unique_lock<boost::shared_mutex> lockIdx(mMutexSpatialIndex);
+        mKeyFrameIndex.Update(pKF,pKF->GetCameraCenter_());
+    }
+
+    if(!mpEvents || !mpEvents->IsActive())
+        return;
+
+    unique_lock<mutex> lockEvents(mMutexPositionEvents);
+    mpEvents->KeyFrameMoved(pKF->mnId,mnId,pKF->GetPose_());
+}
+
+vector<MapPoint*> Map::GetMapPointsInRadius(const cv::Matx31f &center, const float r)
+{
+    vector<MapPoint*> vpMPs;
+    boost::shared_lock<boost::shared_mutex> lock(mMutexSpatialIndex);
+    mMapPointIndex.GetInRadius(center,r,vpMPs);
+    return vpMPs;
+}
+
+vector<MapPoint*> Map::GetMapPointsInFrustum(const cv::Matx44f &Tcw, GeometricCamera* pCamera, const float minX, const float maxX,
+                                             const float minY, const float maxY, const float maxDepth)
+{
+    vector<MapPoint*> vpMPs;
+    boost::shared_lock<boost::shared_mutex> lock(mMutexSpatialIndex);
+    mMapPointIndex.GetInFrustum(Tcw,pCamera,minX,maxX,minY,maxY,maxDepth,vpMPs);
+    return vpMPs;
+}
+
+void Map::FilterMapPointsInFrustum(const vector<SpatialIndex<MapPoint>::Frustum> &vFrustums, vector<MapPoint*> &vpMPs)
+{
+    boost::shared_lock<boost::shared_mutex> lock(mMutexSpatialIndex);
+    mMapPointIndex.FilterInFrustum(vFrustums,vpMPs);
+}
+
+vector<KeyFrame*> Map::GetKeyFramesInRadius(const cv::Matx31f &center, const float r)
+{
+    vector<KeyFrame*> vpKFs;
+    boost::shared_lock<boost::shared_mutex> lock(mMutexSpatialIndex);
+    mKeyFrameIndex.GetInRadius(center,r,vpKFs);
+    return vpKFs;
+}
+
+void Map::SetMapEvents(MapEvents* pEvents)
+{
+    mpEvents = pEvents;
+}
+
+void Map::SetSystemContext(SystemContext* pContext)
+{
+    mpContext = pContext;
+}
+
+const SystemContext& Map::Context()
+{
+    // Maps out of a System (tools, benchmarks) take the default settings
+    static const SystemContext defaultContext;
+    return mpContext ? *mpContext : defaultContext;
+}
+
+const OptimizerSettings& Map::GetOptimizerSettings()
+{
+    return Context().mOptimizer;
+}
+
+int Map::GetMaxDescriptorObservations()
+{
+    return Context().mnMaxDescriptorObservations;
+}
+
+int Map::GetReclaimGracePeriod()
+{
+    return Context().mnReclaimGracePeriod;
+}
+
 void Map::ChangeId(long unsigned int nId)
 {
     mnId = nId;
@@ -458,7 +918,7 @@ void Map::ChangeId(long unsigned int nId)
 
 unsigned int Map::GetLowerKFID()
 {
-    unique_lock<mutex> lock(mMutexMap);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexMap);
     if (mpKFlowerID) {
         return mpKFlowerID->mnId;
     }
@@ -467,27 +927,138 @@ unsigned int Map::GetLowerKFID()
 
 int Map::GetMapChangeIndex()
 {
-    unique_lock<mutex> lock(mMutexMap);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexMap);
     return mnMapChange;
 }
 
 void Map::IncreaseChangeIndex()
 {
-    unique_lock<mutex> lock(mMutexMap);
+    unique_lock<boost::shared_mutex> lock(mMutexMap);
     mnMapChange++;
 }
 
 int Map::GetLastMapChange()
 {
-    unique_lock<mutex> lock(mMutexMap);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexMap);
     return mnMapChangeNotified;
 }
 
 void Map::SetLastMapChange(int currentChangeId)
 {
-    unique_lock<mutex> lock(mMutexMap);
+    unique_lock<boost::shared_mutex> lock(mMutexMap);
     mnMapChangeNotified = currentChangeId;
 }
 
+void Map::PreSave(std::set<GeometricCamera*> &spCams)
+{
+    unique_lock<boost::shared_mutex> lock(mMutexMap);
+
+    // Bad elements are left out, references to them are dropped by the elements themselves
+    set<KeyFrame*> spKF;
+    for(EntityStore<KeyFrame>::const_iterator sit=mKeyFrames.begin(), send=mKeyFrames.end(); sit!=send; sit++)
+        if(*sit && !(*sit)->isBad())
+            spKF.insert(*sit);
+
+    set<MapPoint*> spMP;
+    for(EntityStore<MapPoint>::const_iterator sit=mMapPoints.begin(), send=mMapPoints.end(); sit!=send; sit++)
+        if(*sit && !(*sit)->isBad())
+            spMP.insert(*sit);
+
+    mvpBackupKeyFrames.assign(spKF.begin(), spKF.end());
+    mvpBackupMapPoints.assign(spMP.begin(), spMP.end());
+
+    for(size_t i=0; i<mvpBackupMapPoints.size(); i++)
+        mvpBackupMapPoints[i]->PreSave(spKF, spMP);
+
+    for(size_t i=0; i<mvpBackupKeyFrames.size(); i++)
+        mvpBackupKeyFrames[i]->PreSave(spKF, spMP, spCams);
+
+    mvBackupKeyFrameOriginsId.clear();
+    for(size_t i=0; i<mvpKeyFrameOrigins.size(); i++)
+        if(spKF.count(mvpKeyFrameOrigins[i]))
+            mvBackupKeyFrameOriginsId.push_back(mvpKeyFrameOrigins[i]->mnId);
+
+    mnBackupKFinitialID = (mpKFinitial && spKF.count(mpKFinitial)) ? (long long int)mpKFinitial->mnId : -1;
+    mnBackupKFlowerID = (mpKFlowerID && spKF.count(mpKFlowerID)) ? (long long int)mpKFlowerID->mnId : -1;
+}
+
+void Map::PostLoad(KeyFrameDatabase* pKFDB, ORBVocabulary* pORBVoc, std::map<unsigned int, GeometricCamera*> &mpCams)
+{
+    unique_lock<boost::shared_mutex> lock(mMutexMap);
+
+    map<long unsigned int, KeyFrame*> mpKFid;
+    for(size_t i=0; i<mvpBackupKeyFrames.size(); i++)
+    {
+        KeyFrame* pKFi = mvpBackupKeyFrames[i];
+        if(pKFi)
+            mpKFid[pKFi->mnId] = pKFi;
+    }
+
+    map<long unsigned int, MapPoint*> mpMPid;
+    for(size_t i=0; i<mvpBackupMapPoints.size(); i++)
+    {
+        MapPoint* pMPi = mvpBackupMapPoints[i];
+        if(pMPi)
+            mpMPid[pMPi->mnId] = pMPi;
+    }
+
+    mMapPoints.Clear();
+    for(map<long unsigned int, MapPoint*>::iterator it=mpMPid.begin(); it!=mpMPid.end(); ++it)
+    {
+        MapPoint* pMPi = it->second;
+        pMPi->UpdateMap(this);
+        pMPi->PostLoad(mpKFid, mpMPid);
+        mMapPoints.Insert(pMPi);
+    }
+
+    mKeyFrames.Clear();
+    {
+        unique_lock<mutex> lockSubmaps(mMutexSubmaps);
+        mvvpSubmapKeyFrames.clear();
+    }
+    for(map<long unsigned int, KeyFrame*>::iterator it=mpKFid.begin(); it!=mpKFid.end(); ++it)
+    {
+        KeyFrame* pKFi = it->second;
+        pKFi->UpdateMap(this);
+        pKFi->SetORBVocabulary(pORBVoc);
+        pKFi->SetKeyFrameDatabase(pKFDB);
+        pKFi->PostLoad(mpKFid, mpMPid, mpCams);
+        mKeyFrames.Insert(pKFi);
+        AddToSubmap(pKFi);
+    }
+
+    {
+        unique_lock<boost::shared_mutex> lockIdx(mMutexSpatialIndex);
+        mMapPointIndex.Clear();
+        mKeyFrameIndex.Clear();
+        for(EntityStore<MapPoint>::const_iterator sit=mMapPoints.begin(); sit!=mMapPoints.end(); sit++)
+            mMapPointIndex.Insert(*sit,(*sit)->GetWorldPos2());
+        for(EntityStore<KeyFrame>::const_iterator sit=mKeyFrames.begin(); sit!=mKeyFrames.end(); sit++)
+            mKeyFrameIndex.Insert(*sit,(*sit)->GetCameraCenter_());
+    }
+
+    mvpKeyFrameOrigins.clear();
+    for(size_t i=0; i<mvBackupKeyFrameOriginsId.size(); i++)
+        if(mpKFid.count(mvBackupKeyFrameOriginsId[i]))
+            mvpKeyFrameOrigins.push_back(mpKFid[mvBackupKeyFrameOriginsId[i]]);
+
+    mpKFinitial = mnBackupKFinitialID >= 0 && mpKFid.count(mnBackupKFinitialID) ? mpKFid[mnBackupKFinitialID] : static_cast<KeyFrame*>(NULL);
+    mpKFlowerID = mnBackupKFlowerID >= 0 && mpKFid.count(mnBackupKFlowerID) ? mpKFid[mnBackupKFlowerID] : static_cast<KeyFrame*>(NULL);
+    if(!mpKFinitial && !mpKFid.empty())
+        mpKFinitial = mpKFid.begin()->second;
+    if(!mpKFlowerID && !mpKFid.empty())
+        mpKFlowerID = mpKFid.begin()->second;
+
+    mvpReferenceMapPoints.clear();
+    mpFirstRegionKF = static_cast<KeyFrame*>(NULL);
+    mbBad = false;
+    mbFail = false;
+    mnMapChange = 0;
+    mnMapChangeNotified = 0;
+
+    mvpBackupKeyFrames.clear();
+    mvpBackupMapPoints.clear();
+    mvBackupKeyFrameOriginsId.clear();
+}
 
 } //namespace ORB_SLAM3
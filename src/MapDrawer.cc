@@ -27,7 +27,9 @@ namespace ORB_SLAM3
 {
 
 
-MapDrawer::MapDrawer(Atlas* pAtlas, const string &strSettingPath):mpAtlas(pAtlas)
+MapDrawer::MapDrawer(Atlas* pAtlas, const string &strSettingPath):mpAtlas(pAtlas),
+    mpPointsMap(static_cast<Map*>(NULL)), mnPointsChange(-1), mnPoints(0),
+    mpKeyFramesMap(static_cast<Map*>(NULL)), mnKeyFramesChange(-1), mnKeyFrames(0)
 {
     cv::FileStorage fSettings(strSettingPath, cv::FileStorage::READ);
 
@@ -120,174 +122,368 @@ bool MapDrawer::ParseViewerParamFile(cv::FileStorage &fSettings)
     return !b_miss_params;
 }
 
-void MapDrawer::DrawMapPoints()
+// Upload v to the buffer, growing it (with margin) when it is too small
+static void UploadBuffer(pangolin::GlBuffer &vbo, const vector<float> &v, const GLuint count_per_element)
 {
-    const vector<MapPoint*> &vpMPs = mpAtlas->GetAllMapPoints();
-    const vector<MapPoint*> &vpRefMPs = mpAtlas->GetReferenceMapPoints();
+    const GLuint n = v.size()/count_per_element;
+    if(n==0)
+        return;
 
-    set<MapPoint*> spRefMPs(vpRefMPs.begin(), vpRefMPs.end());
+    if(n>vbo.num_elements)
+        vbo.Reinitialise(pangolin::GlArrayBuffer, 2*n, GL_FLOAT, count_per_element, GL_DYNAMIC_DRAW);
 
-    if(vpMPs.empty())
+    vbo.Upload(v.data(), v.size()*sizeof(float));
+}
+
+// Draw the first n vertices of the buffer, with per vertex colors if pColors is not NULL
+static void DrawBuffer(pangolin::GlBuffer &vbo, const GLenum mode, const GLsizei n, pangolin::GlBuffer* pColors)
+{
+    if(n==0)
         return;
 
-    glPointSize(mPointSize);
-    glBegin(GL_POINTS);
-    glColor3f(0.0,0.0,0.0);
+    if(pColors)
+    {
+        pColors->Bind();
+        glColorPointer(3, GL_FLOAT, 0, 0);
+        glEnableClientState(GL_COLOR_ARRAY);
+    }
+
+    vbo.Bind();
+    glVertexPointer(3, GL_FLOAT, 0, 0);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glDrawArrays(mode, 0, n);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    vbo.Unbind();
+
+    if(pColors)
+    {
+        glDisableClientState(GL_COLOR_ARRAY);
+        pColors->Unbind();
+    }
+}
+
+void MapDrawer::UpdatePointsBuffer(Map* pMap)
+{
+    const int nChange = pMap->GetMapChangeIndex();
+    const long unsigned int nPoints = pMap->MapPointsInMap();
+    if(pMap==mpPointsMap && nChange==mnPointsChange && nPoints==mnPoints)
+        return;
+
+    if(pMap!=mpPointsMap)
+    {
+        mmPointSlots.clear();
+        mvpSlotPoints.clear();
+        mvSlotPos.clear();
+    }
+    mpPointsMap = pMap;
+    mnPointsChange = nChange;
+    mnPoints = nPoints;
+
+    const Map::MapPointsSnapshot pMPs = pMap->GetMapPointsSnapshot();
+    const vector<MapPoint*> &vpMPs = *pMPs;
+
+    vector<bool> vbSeen(mvpSlotPoints.size(),false);
+    vector<bool> vbDirty(mvpSlotPoints.size(),false);
 
-    for(size_t i=0, iend=vpMPs.size(); i<iend;i++)
+    for(size_t i=0, iend=vpMPs.size(); i<iend; i++)
     {
-        if(vpMPs[i]->isBad() || spRefMPs.count(vpMPs[i]))
+        MapPoint* pMP = vpMPs[i];
+        if(pMP->isBad())
             continue;
-        cv::Mat pos = vpMPs[i]->GetWorldPos();
-        glVertex3f(pos.at<float>(0),pos.at<float>(1),pos.at<float>(2));
+
+        const cv::Mat Xw = pMP->GetWorldPos();
+        const float pos[3] = {Xw.at<float>(0), Xw.at<float>(1), Xw.at<float>(2)};
+
+        unordered_map<MapPoint*,size_t>::iterator it = mmPointSlots.find(pMP);
+        if(it==mmPointSlots.end())
+        {
+            mmPointSlots[pMP] = mvpSlotPoints.size();
+            mvpSlotPoints.push_back(pMP);
+            mvSlotPos.push_back(pos[0]);
+            mvSlotPos.push_back(pos[1]);
+            mvSlotPos.push_back(pos[2]);
+            vbSeen.push_back(true);
+            vbDirty.push_back(true);
+        }
+        else
+        {
+            const size_t s = it->second;
+            vbSeen[s] = true;
+            float* p = &mvSlotPos[3*s];
+            if(p[0]!=pos[0] || p[1]!=pos[1] || p[2]!=pos[2])
+            {
+                p[0] = pos[0];
+                p[1] = pos[1];
+                p[2] = pos[2];
+                vbDirty[s] = true;
+            }
+        }
+    }
+
+    // Points that are bad or no longer in the map: the last slot is moved into the hole
+    for(size_t s=0; s<mvpSlotPoints.size();)
+    {
+        if(vbSeen[s])
+        {
+            s++;
+            continue;
+        }
+
+        mmPointSlots.erase(mvpSlotPoints[s]);
+        const size_t last = mvpSlotPoints.size()-1;
+        if(s!=last)
+        {
+            mvpSlotPoints[s] = mvpSlotPoints[last];
+            mvSlotPos[3*s] = mvSlotPos[3*last];
+            mvSlotPos[3*s+1] = mvSlotPos[3*last+1];
+            mvSlotPos[3*s+2] = mvSlotPos[3*last+2];
+            vbSeen[s] = vbSeen[last];
+            vbDirty[s] = true;
+            mmPointSlots[mvpSlotPoints[s]] = s;
+        }
+        mvpSlotPoints.pop_back();
+        mvSlotPos.resize(3*last);
+        vbSeen.pop_back();
+        vbDirty.pop_back();
+    }
+
+    const size_t nSlots = mvpSlotPoints.size();
+    if(nSlots>mPointsVbo.num_elements)
+    {
+        UploadBuffer(mPointsVbo, mvSlotPos, 3);
+        return;
     }
-    glEnd();
 
+    // Upload only the runs of changed slots
+    for(size_t s=0; s<nSlots;)
+    {
+        if(!vbDirty[s])
+        {
+            s++;
+            continue;
+        }
+
+        size_t e = s;
+        while(e<nSlots && vbDirty[e])
+            e++;
+        mPointsVbo.Upload(&mvSlotPos[3*s], 3*(e-s)*sizeof(float), 3*s*sizeof(float));
+        s = e;
+    }
+}
+
+void MapDrawer::DrawMapPoints()
+{
+    Map* pMap = mpAtlas->GetCurrentMap();
+    if(!pMap)
+        return;
+
+    UpdatePointsBuffer(pMap);
+
+    const vector<MapPoint*> &vpRefMPs = mpAtlas->GetReferenceMapPoints();
+
+    // Reference points first: the same points in the buffer fail the depth test afterwards
     glPointSize(mPointSize);
     glBegin(GL_POINTS);
     glColor3f(1.0,0.0,0.0);
 
-    for(set<MapPoint*>::iterator sit=spRefMPs.begin(), send=spRefMPs.end(); sit!=send; sit++)
+    for(vector<MapPoint*>::const_iterator vit=vpRefMPs.begin(), vend=vpRefMPs.end(); vit!=vend; vit++)
     {
-        if((*sit)->isBad())
+        if(!(*vit) || (*vit)->isBad())
             continue;
-        cv::Mat pos = (*sit)->GetWorldPos();
+        cv::Mat pos = (*vit)->GetWorldPos();
         glVertex3f(pos.at<float>(0),pos.at<float>(1),pos.at<float>(2));
 
     }
 
     glEnd();
+
+    glPointSize(mPointSize);
+    glColor3f(0.0,0.0,0.0);
+    DrawBuffer(mPointsVbo, GL_POINTS, mvpSlotPoints.size(), static_cast<pangolin::GlBuffer*>(NULL));
 }
 
-void MapDrawer::DrawKeyFrames(const bool bDrawKF, const bool bDrawGraph, const bool bDrawInertialGraph)
+void MapDrawer::UpdateKeyFramesBuffer(Map* pMap)
 {
+    const int nChange = pMap->GetMapChangeIndex();
+    const long unsigned int nKFs = pMap->KeyFramesInMap();
+    if(pMap==mpKeyFramesMap && nChange==mnKeyFramesChange && nKFs==mnKeyFrames)
+        return;
+
+    mpKeyFramesMap = pMap;
+    mnKeyFramesChange = nChange;
+    mnKeyFrames = nKFs;
+
     const float &w = mKeyFrameSize;
     const float h = w*0.75;
     const float z = w*0.6;
 
-    const vector<KeyFrame*> vpKFs = mpAtlas->GetAllKeyFrames();
+    // Frustum as 8 segments in the camera frame
+    const float frustum[16][3] = {{0,0,0},{w,h,z},{0,0,0},{w,-h,z},{0,0,0},{-w,-h,z},{0,0,0},{-w,h,z},
+                                  {w,h,z},{w,-h,z},{-w,h,z},{-w,-h,z},{-w,h,z},{w,h,z},{-w,-h,z},{w,-h,z}};
 
-    if(bDrawKF)
-    {
-        for(size_t i=0; i<vpKFs.size(); i++)
-        {
-            KeyFrame* pKF = vpKFs[i];
-            cv::Mat Twc = pKF->GetPoseInverse().t();
-            unsigned int index_color = pKF->mnOriginMapId;
+    const Map::KeyFramesSnapshot pKFs = pMap->GetKeyFramesSnapshot();
+    const vector<KeyFrame*> &vpKFs = *pKFs;
 
-            glPushMatrix();
+    mvpFirstKFs.clear();
+    mvFrustumPos.clear();
+    mvFrustumColor.clear();
+    mvGraphPos.clear();
+    mvInertialPos.clear();
 
-            glMultMatrixf(Twc.ptr<GLfloat>(0));
+    for(size_t i=0; i<vpKFs.size(); i++)
+    {
+        KeyFrame* pKF = vpKFs[i];
 
-            if(!pKF->GetParent()) // It is the first KF in the map
-            {
-                glLineWidth(mKeyFrameLineWidth*5);
-                glColor3f(1.0f,0.0f,0.0f);
-                glBegin(GL_LINES);
-            }
-            else
+        // Frustum
+        if(!pKF->GetParent()) // It is the first KF in the map
+        {
+            mvpFirstKFs.push_back(pKF);
+        }
+        else
+        {
+            const cv::Mat Twc = pKF->GetPoseInverse();
+            const float* color = mfFrameColors[pKF->mnOriginMapId];
+            for(int j=0; j<16; j++)
             {
-                glLineWidth(mKeyFrameLineWidth);
-                glColor3f(mfFrameColors[index_color][0],mfFrameColors[index_color][1],mfFrameColors[index_color][2]);
-                glBegin(GL_LINES);
+                for(int r=0; r<3; r++)
+                {
+                    mvFrustumPos.push_back(Twc.at<float>(r,0)*frustum[j][0] + Twc.at<float>(r,1)*frustum[j][1] +
+                                           Twc.at<float>(r,2)*frustum[j][2] + Twc.at<float>(r,3));
+                    mvFrustumColor.push_back(color[r]);
+                }
             }
+        }
 
-            glVertex3f(0,0,0);
-            glVertex3f(w,h,z);
-            glVertex3f(0,0,0);
-            glVertex3f(w,-h,z);
-            glVertex3f(0,0,0);
-            glVertex3f(-w,-h,z);
-            glVertex3f(0,0,0);
-            glVertex3f(-w,h,z);
-
-            glVertex3f(w,h,z);
-            glVertex3f(w,-h,z);
-
-            glVertex3f(-w,h,z);
-            glVertex3f(-w,-h,z);
+        const cv::Matx31f Ow = pKF->GetCameraCenter_();
 
-            glVertex3f(-w,h,z);
-            glVertex3f(w,h,z);
+        // Covisibility Graph
+        const vector<KeyFrame*> vCovKFs = pKF->GetCovisiblesByWeight(100);
+        for(vector<KeyFrame*>::const_iterator vit=vCovKFs.begin(), vend=vCovKFs.end(); vit!=vend; vit++)
+        {
+            if((*vit)->mnId<pKF->mnId)
+                continue;
+            const cv::Matx31f Ow2 = (*vit)->GetCameraCenter_();
+            mvGraphPos.insert(mvGraphPos.end(), Ow.val, Ow.val+3);
+            mvGraphPos.insert(mvGraphPos.end(), Ow2.val, Ow2.val+3);
+        }
 
-            glVertex3f(-w,-h,z);
-            glVertex3f(w,-h,z);
-            glEnd();
+        // Spanning tree
+        KeyFrame* pParent = pKF->GetParent();
+        if(pParent)
+        {
+            const cv::Matx31f Owp = pParent->GetCameraCenter_();
+            mvGraphPos.insert(mvGraphPos.end(), Ow.val, Ow.val+3);
+            mvGraphPos.insert(mvGraphPos.end(), Owp.val, Owp.val+3);
+        }
 
-            glPopMatrix();
+        // Loops
+        set<KeyFrame*> sLoopKFs = pKF->GetLoopEdges();
+        for(set<KeyFrame*>::iterator sit=sLoopKFs.begin(), send=sLoopKFs.end(); sit!=send; sit++)
+        {
+            if((*sit)->mnId<pKF->mnId)
+                continue;
+            const cv::Matx31f Owl = (*sit)->GetCameraCenter_();
+            mvGraphPos.insert(mvGraphPos.end(), Ow.val, Ow.val+3);
+            mvGraphPos.insert(mvGraphPos.end(), Owl.val, Owl.val+3);
+        }
 
-            glEnd();
+        // Inertial links
+        KeyFrame* pNext = pKF->mNextKF;
+        if(pNext)
+        {
+            const cv::Matx31f Own = pNext->GetCameraCenter_();
+            mvInertialPos.insert(mvInertialPos.end(), Ow.val, Ow.val+3);
+            mvInertialPos.insert(mvInertialPos.end(), Own.val, Own.val+3);
         }
     }
 
-    if(bDrawGraph)
+    UploadBuffer(mFrustumVbo, mvFrustumPos, 3);
+    UploadBuffer(mFrustumColorVbo, mvFrustumColor, 3);
+    UploadBuffer(mGraphVbo, mvGraphPos, 3);
+    UploadBuffer(mInertialVbo, mvInertialPos, 3);
+}
+
+void MapDrawer::DrawKeyFrameFrustum(KeyFrame* pKF)
+{
+    const float &w = mKeyFrameSize;
+    const float h = w*0.75;
+    const float z = w*0.6;
+
+    cv::Mat Twc = pKF->GetPoseInverse().t();
+    unsigned int index_color = pKF->mnOriginMapId;
+
+    glPushMatrix();
+
+    glMultMatrixf(Twc.ptr<GLfloat>(0));
+
+    if(!pKF->GetParent()) // It is the first KF in the map
+    {
+        glLineWidth(mKeyFrameLineWidth*5);
+        glColor3f(1.0f,0.0f,0.0f);
+        glBegin(GL_LINES);
+    }
+    else
     {
-        glLineWidth(mGraphLineWidth);
-        glColor4f(0.0f,1.0f,0.0f,0.6f);
+        glLineWidth(mKeyFrameLineWidth);
+        glColor3f(mfFrameColors[index_color][0],mfFrameColors[index_color][1],mfFrameColors[index_color][2]);
         glBegin(GL_LINES);
+    }
 
-        for(size_t i=0; i<vpKFs.size(); i++)
-        {
-            // Covisibility Graph
-            const vector<KeyFrame*> vCovKFs = vpKFs[i]->GetCovisiblesByWeight(100);
-            cv::Mat Ow = vpKFs[i]->GetCameraCenter();
-            if(!vCovKFs.empty())
-            {
-                for(vector<KeyFrame*>::const_iterator vit=vCovKFs.begin(), vend=vCovKFs.end(); vit!=vend; vit++)
-                {
-                    if((*vit)->mnId<vpKFs[i]->mnId)
-                        continue;
-                    cv::Mat Ow2 = (*vit)->GetCameraCenter();
-                    glVertex3f(Ow.at<float>(0),Ow.at<float>(1),Ow.at<float>(2));
-                    glVertex3f(Ow2.at<float>(0),Ow2.at<float>(1),Ow2.at<float>(2));
-                }
-            }
+    glVertex3f(0,0,0);
+    glVertex3f(w,h,z);
+    glVertex3f(0,0,0);
+    glVertex3f(w,-h,z);
+    glVertex3f(0,0,0);
+    glVertex3f(-w,-h,z);
+    glVertex3f(0,0,0);
+    glVertex3f(-w,h,z);
 
-            // Spanning tree
-            KeyFrame* pParent = vpKFs[i]->GetParent();
-            if(pParent)
-            {
-                cv::Mat Owp = pParent->GetCameraCenter();
-                glVertex3f(Ow.at<float>(0),Ow.at<float>(1),Ow.at<float>(2));
-                glVertex3f(Owp.at<float>(0),Owp.at<float>(1),Owp.at<float>(2));
-            }
+    glVertex3f(w,h,z);
+    glVertex3f(w,-h,z);
 
-            // Loops
-            set<KeyFrame*> sLoopKFs = vpKFs[i]->GetLoopEdges();
-            for(set<KeyFrame*>::iterator sit=sLoopKFs.begin(), send=sLoopKFs.end(); sit!=send; sit++)
-            {
-                if((*sit)->mnId<vpKFs[i]->mnId)
-                    continue;
-                cv::Mat Owl = (*sit)->GetCameraCenter();
-                glVertex3f(Ow.at<float>(0),Ow.at<float>(1),Ow.at<float>(2));
-                glVertex3f(Owl.at<float>(0),Owl.at<float>(1),Owl.at<float>(2));
-            }
-        }
+    glVertex3f(-w,h,z);
+    glVertex3f(-w,-h,z);
 
-        glEnd();
-    }
+    glVertex3f(-w,h,z);
+    glVertex3f(w,h,z);
+
+    glVertex3f(-w,-h,z);
+    glVertex3f(w,-h,z);
+    glEnd();
 
-    if(bDrawInertialGraph && mpAtlas->isImuInitialized())
+    glPopMatrix();
+}
+
+void MapDrawer::DrawKeyFrames(const bool bDrawKF, const bool bDrawGraph, const bool bDrawInertialGraph)
+{
+    Map* pCurrentMap = mpAtlas->GetCurrentMap();
+
+    if(pCurrentMap)
     {
-        glLineWidth(mGraphLineWidth);
-        glColor4f(1.0f,0.0f,0.0f,0.6f);
-        glBegin(GL_LINES);
+        UpdateKeyFramesBuffer(pCurrentMap);
 
-        //Draw inertial links
-        for(size_t i=0; i<vpKFs.size(); i++)
+        if(bDrawKF)
         {
-            KeyFrame* pKFi = vpKFs[i];
-            cv::Mat Ow = pKFi->GetCameraCenter();
-            KeyFrame* pNext = pKFi->mNextKF;
-            if(pNext)
-            {
-                cv::Mat Owp = pNext->GetCameraCenter();
-                glVertex3f(Ow.at<float>(0),Ow.at<float>(1),Ow.at<float>(2));
-                glVertex3f(Owp.at<float>(0),Owp.at<float>(1),Owp.at<float>(2));
-            }
+            for(size_t i=0; i<mvpFirstKFs.size(); i++)
+                DrawKeyFrameFrustum(mvpFirstKFs[i]);
+
+            glLineWidth(mKeyFrameLineWidth);
+            DrawBuffer(mFrustumVbo, GL_LINES, mvFrustumPos.size()/3, &mFrustumColorVbo);
         }
 
-        glEnd();
+        if(bDrawGraph)
+        {
+            glLineWidth(mGraphLineWidth);
+            glColor4f(0.0f,1.0f,0.0f,0.6f);
+            DrawBuffer(mGraphVbo, GL_LINES, mvGraphPos.size()/3, static_cast<pangolin::GlBuffer*>(NULL));
+        }
+
+        if(bDrawInertialGraph && mpAtlas->isImuInitialized())
+        {
+            glLineWidth(mGraphLineWidth);
+            glColor4f(1.0f,0.0f,0.0f,0.6f);
+            DrawBuffer(mInertialVbo, GL_LINES, mvInertialPos.size()/3, static_cast<pangolin::GlBuffer*>(NULL));
+        }
     }
 
     vector<Map*> vpMaps = mpAtlas->GetAllMaps();
@@ -296,58 +492,14 @@ void MapDrawer::DrawKeyFrames(const bool bDrawKF, const bool bDrawGraph, const b
     {
         for(Map* pMap : vpMaps)
         {
-            if(pMap == mpAtlas->GetCurrentMap())
+            if(pMap == pCurrentMap)
                 continue;
 
-            vector<KeyFrame*> vpKFs = pMap->GetAllKeyFrames();
+            const Map::KeyFramesSnapshot pKFs = pMap->GetKeyFramesSnapshot();
+            const vector<KeyFrame*> &vpKFs = *pKFs;
 
             for(size_t i=0; i<vpKFs.size(); i++)
-            {
-                KeyFrame* pKF = vpKFs[i];
-                cv::Mat Twc = pKF->GetPoseInverse().t();
-                unsigned int index_color = pKF->mnOriginMapId;
-
-                glPushMatrix();
-
-                glMultMatrixf(Twc.ptr<GLfloat>(0));
-
-                if(!vpKFs[i]->GetParent()) // It is the first KF in the map
-                {
-                    glLineWidth(mKeyFrameLineWidth*5);
-                    glColor3f(1.0f,0.0f,0.0f);
-                    glBegin(GL_LINES);
-                }
-                else
-                {
-                    glLineWidth(mKeyFrameLineWidth);
-                    glColor3f(mfFrameColors[index_color][0],mfFrameColors[index_color][1],mfFrameColors[index_color][2]);
-                    glBegin(GL_LINES);
-                }
-
-                glVertex3f(0,0,0);
-                glVertex3f(w,h,z);
-                glVertex3f(0,0,0);
-                glVertex3f(w,-h,z);
-                glVertex3f(0,0,0);
-                glVertex3f(-w,-h,z);
-                glVertex3f(0,0,0);
-                glVertex3f(-w,h,z);
-
-                glVertex3f(w,h,z);
-                glVertex3f(w,-h,z);
-
-                glVertex3f(-w,h,z);
-                glVertex3f(-w,-h,z);
-
-                glVertex3f(-w,h,z);
-                glVertex3f(w,h,z);
-
-                glVertex3f(-w,-h,z);
-                glVertex3f(w,-h,z);
-                glEnd();
-
-                glPopMatrix();
-            }
+                DrawKeyFrameFrustum(vpKFs[i]);
         }
     }
 }
@@ -0,0 +1,284 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "MapEvents.h"
+
+#include "Atlas.h"
+#include "Map.h"
+#include "MapPoint.h"
+#include "KeyFrame.h"
+
+using namespace std;
+
+namespace ORB_SLAM3
+{
+
+bool MapEvents::Batch::empty() const
+{
+    return vPointsAdded.empty() && vPointsMoved.empty() && vPointsRemoved.empty() &&
+           vKeyFramesAdded.empty() && vKeyFramesMoved.empty() && vKeyFramesRemoved.empty() &&
+           vMerges.empty() && vMapsCleared.empty();
+}
+
+MapEvents::MapEvents(): mbActive(false), mnNextSubscriber(0), mnSeq(0)
+{
+}
+
+int MapEvents::Subscribe(const Callback &callback, Atlas* pAtlas)
+{
+    unique_lock<mutex> lockPublish(mMutexPublish);
+    const int nId = mnNextSubscriber++;
+    mvSubscribers.push_back(make_pair(nId, callback));
+
+    // Collected from now on, so that nothing that changes while the snapshot is read is missed
+    mbActive.store(true, memory_order_relaxed);
+
+    if(pAtlas)
+    {
+        Batch batch;
+        batch.nSeq = mnSeq++;
+        batch.cause = SNAPSHOT;
+        const vector<Map*> vpMaps = pAtlas->GetAllMaps();
+        for(size_t i=0; i<vpMaps.size(); i++)
+            AppendMap(vpMaps[i], batch);
+        callback(batch);
+    }
+
+    return nId;
+}
+
+void MapEvents::Unsubscribe(const int nId)
+{
+    unique_lock<mutex> lockPublish(mMutexPublish);
+    for(size_t i=0; i<mvSubscribers.size(); i++)
+    {
+        if(mvSubscribers[i].first == nId)
+        {
+            mvSubscribers.erase(mvSubscribers.begin()+i);
+            break;
+        }
+    }
+
+    if(mvSubscribers.empty())
+    {
+        mbActive.store(false, memory_order_relaxed);
+
+        unique_lock<mutex> lock(mMutexPending);
+        mmPointsAdded.clear();
+        mmPointsMoved.clear();
+        msPointsRemoved.clear();
+        mmKeyFramesAdded.clear();
+        mmKeyFramesMoved.clear();
+        msKeyFramesRemoved.clear();
+        mvMerges.clear();
+        mvMapsCleared.clear();
+    }
+}
+
+void MapEvents::AppendMap(Map* pMap, Batch &batch)
+{
+    const long unsigned int nMapId = pMap->GetId();
+
+    const Map::MapPointsSnapshot pMPs = pMap->GetMapPointsSnapshot();
+    const vector<MapPoint*> &vpMPs = *pMPs;
+    for(size_t i=0; i<vpMPs.size(); i++)
+    {
+        MapPoint* pMP = vpMPs[i];
+        if(!pMP || pMP->isBad())
+            continue;
+        PointUpdate update;
+        update.nId = pMP->mnId;
+        update.nMapId = nMapId;
+        update.pos = pMP->GetWorldPos2();
+        batch.vPointsAdded.push_back(update);
+    }
+
+    const Map::KeyFramesSnapshot pKFs = pMap->GetKeyFramesSnapshot();
+    const vector<KeyFrame*> &vpKFs = *pKFs;
+    for(size_t i=0; i<vpKFs.size(); i++)
+    {
+        KeyFrame* pKF = vpKFs[i];
+        if(!pKF || pKF->isBad())
+            continue;
+        KeyFrameUpdate update;
+        update.nId = pKF->mnId;
+        update.nMapId = nMapId;
+        update.Tcw = pKF->GetPose_();
+        batch.vKeyFramesAdded.push_back(update);
+    }
+}
+
+void MapEvents::PointAdded(const long unsigned int nId, const long unsigned int nMapId, const cv::Matx31f &pos)
+{
+    unique_lock<mutex> lock(mMutexPending);
+    msPointsRemoved.erase(nId);
+    mmPointsMoved.erase(nId);
+    PointUpdate &update = mmPointsAdded[nId];
+    update.nId = nId;
+    update.nMapId = nMapId;
+    update.pos = pos;
+}
+
+void MapEvents::PointMoved(const long unsigned int nId, const long unsigned int nMapId, const cv::Matx31f &pos)
+{
+    unique_lock<mutex> lock(mMutexPending);
+    unordered_map<long unsigned int, PointUpdate>::iterator it = mmPointsAdded.find(nId);
+    PointUpdate &update = it!=mmPointsAdded.end() ? it->second : mmPointsMoved[nId];
+    update.nId = nId;
+    update.nMapId = nMapId;
+    update.pos = pos;
+}
+
+void MapEvents::PointRemoved(const long unsigned int nId, const long unsigned int nMapId)
+{
+    unique_lock<mutex> lock(mMutexPending);
+    unordered_map<long unsigned int, PointUpdate>::iterator it = mmPointsAdded.find(nId);
+    if(it!=mmPointsAdded.end())
+    {
+        // Moved to another map (merge), still there
+        if(it->second.nMapId != nMapId)
+            return;
+        // Also sent when created within the batch, the subscriber may have it from its snapshot
+        mmPointsAdded.erase(it);
+    }
+
+    it = mmPointsMoved.find(nId);
+    if(it!=mmPointsMoved.end())
+    {
+        if(it->second.nMapId != nMapId)
+            return;
+        mmPointsMoved.erase(it);
+    }
+    msPointsRemoved.insert(nId);
+}
+
+void MapEvents::KeyFrameAdded(const long unsigned int nId, const long unsigned int nMapId, const cv::Matx44f &Tcw)
+{
+    unique_lock<mutex> lock(mMutexPending);
+    msKeyFramesRemoved.erase(nId);
+    mmKeyFramesMoved.erase(nId);
+    KeyFrameUpdate &update = mmKeyFramesAdded[nId];
+    update.nId = nId;
+    update.nMapId = nMapId;
+    update.Tcw = Tcw;
+}
+
+void MapEvents::KeyFrameMoved(const long unsigned int nId, const long unsigned int nMapId, const cv::Matx44f &Tcw)
+{
+    unique_lock<mutex> lock(mMutexPending);
+    unordered_map<long unsigned int, KeyFrameUpdate>::iterator it = mmKeyFramesAdded.find(nId);
+    KeyFrameUpdate &update = it!=mmKeyFramesAdded.end() ? it->second : mmKeyFramesMoved[nId];
+    update.nId = nId;
+    update.nMapId = nMapId;
+    update.Tcw = Tcw;
+}
+
+void MapEvents::KeyFrameRemoved(const long unsigned int nId, const long unsigned int nMapId)
+{
+    unique_lock<mutex> lock(mMutexPending);
+    unordered_map<long unsigned int, KeyFrameUpdate>::iterator it = mmKeyFramesAdded.find(nId);
+    if(it!=mmKeyFramesAdded.end())
+    {
+        if(it->second.nMapId != nMapId)
+            return;
+        mmKeyFramesAdded.erase(it);
+    }
+
+    it = mmKeyFramesMoved.find(nId);
+    if(it!=mmKeyFramesMoved.end())
+    {
+        if(it->second.nMapId != nMapId)
+            return;
+        mmKeyFramesMoved.erase(it);
+    }
+    msKeyFramesRemoved.insert(nId);
+}
+
+template<class T>
+static void EraseMap(unordered_map<long unsigned int, T> &mUpdates, const long unsigned int nMapId)
+{
+    for(typename unordered_map<long unsigned int, T>::iterator it=mUpdates.begin(); it!=mUpdates.end();)
+    {
+        if(it->second.nMapId == nMapId)
+            it = mUpdates.erase(it);
+        else
+            it++;
+    }
+}
+
+void MapEvents::MapCleared(const long unsigned int nMapId)
+{
+    unique_lock<mutex> lock(mMutexPending);
+    EraseMap(mmPointsAdded, nMapId);
+    EraseMap(mmPointsMoved, nMapId);
+    EraseMap(mmKeyFramesAdded, nMapId);
+    EraseMap(mmKeyFramesMoved, nMapId);
+    mvMapsCleared.push_back(nMapId);
+}
+
+void MapEvents::MapMerged(const long unsigned int nMergedMapId, const long unsigned int nIntoMapId)
+{
+    unique_lock<mutex> lock(mMutexPending);
+    MapMerge merge;
+    merge.nMergedMapId = nMergedMapId;
+    merge.nIntoMapId = nIntoMapId;
+    mvMerges.push_back(merge);
+}
+
+template<class T>
+static void MoveValues(unordered_map<long unsigned int, T> &mUpdates, vector<T> &vUpdates)
+{
+    vUpdates.reserve(mUpdates.size());
+    for(typename unordered_map<long unsigned int, T>::const_iterator it=mUpdates.begin(); it!=mUpdates.end(); it++)
+        vUpdates.push_back(it->second);
+    mUpdates.clear();
+}
+
+void MapEvents::Publish(const Cause cause)
+{
+    if(!IsActive())
+        return;
+
+    // Taken and delivered under the same lock, so the batches arrive in the order they were taken
+    unique_lock<mutex> lockPublish(mMutexPublish);
+
+    Batch batch;
+    {
+        unique_lock<mutex> lock(mMutexPending);
+        MoveValues(mmPointsAdded, batch.vPointsAdded);
+        MoveValues(mmPointsMoved, batch.vPointsMoved);
+        batch.vPointsRemoved.assign(msPointsRemoved.begin(), msPointsRemoved.end());
+        msPointsRemoved.clear();
+        MoveValues(mmKeyFramesAdded, batch.vKeyFramesAdded);
+        MoveValues(mmKeyFramesMoved, batch.vKeyFramesMoved);
+        batch.vKeyFramesRemoved.assign(msKeyFramesRemoved.begin(), msKeyFramesRemoved.end());
+        msKeyFramesRemoved.clear();
+        batch.vMerges.swap(mvMerges);
+        batch.vMapsCleared.swap(mvMapsCleared);
+    }
+
+    if(batch.empty())
+        return;
+
+    batch.nSeq = mnSeq++;
+    batch.cause = cause;
+    for(size_t i=0; i<mvSubscribers.size(); i++)
+        mvSubscribers[i].second(batch);
+}
+
+} //namespace ORB_SLAM3
@@ -18,34 +18,74 @@
 
 #include "MapPoint.h"
 #include "ORBmatcher.h"
+#include "ObjectPool.h"
+#include "EpochManager.h"
 
 #include<mutex>
+#include<set>
+#include<algorithm>
+#include<thread>
 
 namespace ORB_SLAM3
 {
 
-long unsigned int MapPoint::nNextId=0;
-mutex MapPoint::mGlobalMutex;
+// Keypoint slots (left and right) of an observation
+static inline int ObservationSlots(const tuple<int,int> &indexes)
+{
+    return (get<0>(indexes) != -1) + (get<1>(indexes) != -1);
+}
+
+// Adds (sign=1) or removes (sign=-1) the covisibility counted between every pair of observing keyframes
+static void UpdateCovisibility(const ObservationMap &observations, int sign)
+{
+    for(ObservationMap::const_iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+    {
+        const int nSlots = ObservationSlots(mit->second);
+        for(ObservationMap::const_iterator mit2=observations.begin(); mit2!=mend; mit2++)
+        {
+            if(mit2->first != mit->first)
+                mit->first->IncreaseCovisibility(mit2->first, sign*nSlots);
+        }
+    }
+}
+
+std::atomic<long unsigned int> MapPoint::nNextId(0);
+
+void* MapPoint::operator new(size_t size)
+{
+    // Derived classes do not fit in the pool blocks
+    if(size!=sizeof(MapPoint))
+        return ::operator new(size);
+    return ObjectPool<MapPoint>::Instance().Allocate();
+}
+
+void MapPoint::operator delete(void* p, size_t size)
+{
+    if(size!=sizeof(MapPoint))
+        ::operator delete(p);
+    else
+        ObjectPool<MapPoint>::Instance().Deallocate(p);
+}
 
 MapPoint::MapPoint():
     mnFirstKFid(0), mnFirstFrame(0), nObs(0), mnTrackReferenceForFrame(0),
-    mnLastFrameSeen(0), mnBALocalForKF(0), mnFuseCandidateForKF(0), mnLoopPointForKF(0), mnCorrectedByKF(0),
-    mnCorrectedReference(0), mnBAGlobalForKF(0), mnVisible(1), mnFound(1), mbBad(false),
-    mpReplaced(static_cast<MapPoint*>(NULL))
+    mnLastFrameSeen(0), mnTrackMirrorIndex(-1), mnBALocalForKF(0), mnFuseCandidateForKF(0), mnLoopPointForKF(0), mnCorrectedByKF(0),
+    mnCorrectedReference(0), mnBAGlobalForKF(0), mpHostKF(static_cast<KeyFrame*>(NULL)), mpRefKF(static_cast<KeyFrame*>(NULL)),
+    mnVisible(1), mnFound(1), mbBad(false), mpReplaced(static_cast<MapPoint*>(NULL)), mfMinDistance(0), mfMaxDistance(0),
+    mpMap(static_cast<Map*>(NULL)), mnNormalSum(0), mbNormalSumValid(false), mnNormalVersion(0)
 {
     mpReplaced = static_cast<MapPoint*>(NULL);
 }
 
 MapPoint::MapPoint(const cv::Mat &Pos, KeyFrame *pRefKF, Map* pMap):
     mnFirstKFid(pRefKF->mnId), mnFirstFrame(pRefKF->mnFrameId), nObs(0), mnTrackReferenceForFrame(0),
-    mnLastFrameSeen(0), mnBALocalForKF(0), mnFuseCandidateForKF(0), mnLoopPointForKF(0), mnCorrectedByKF(0),
+    mnLastFrameSeen(0), mnTrackMirrorIndex(-1), mnBALocalForKF(0), mnFuseCandidateForKF(0), mnLoopPointForKF(0), mnCorrectedByKF(0),
     mnCorrectedReference(0), mnBAGlobalForKF(0), mpRefKF(pRefKF), mnVisible(1), mnFound(1), mbBad(false),
     mpReplaced(static_cast<MapPoint*>(NULL)), mfMinDistance(0), mfMaxDistance(0), mpMap(pMap),
-    mnOriginMapId(pMap->GetId())
+    mnOriginMapId(pMap->GetId()), mpHostKF(static_cast<KeyFrame*>(NULL)), mnNormalSum(0), mbNormalSumValid(false),
+    mnNormalVersion(0)
 {
-    Pos.copyTo(mWorldPos);
     mWorldPosx = cv::Matx31f(Pos.at<float>(0), Pos.at<float>(1), Pos.at<float>(2));
-    mNormalVector = cv::Mat::zeros(3,1,CV_32F);
     mNormalVectorx = cv::Matx31f::zeros();
 
     mbTrackInViewR = false;
@@ -58,17 +98,17 @@ MapPoint::MapPoint(const cv::Mat &Pos, KeyFrame *pRefKF, Map* pMap):
 
 MapPoint::MapPoint(const double invDepth, cv::Point2f uv_init, KeyFrame* pRefKF, KeyFrame* pHostKF, Map* pMap):
     mnFirstKFid(pRefKF->mnId), mnFirstFrame(pRefKF->mnFrameId), nObs(0), mnTrackReferenceForFrame(0),
-    mnLastFrameSeen(0), mnBALocalForKF(0), mnFuseCandidateForKF(0), mnLoopPointForKF(0), mnCorrectedByKF(0),
+    mnLastFrameSeen(0), mnTrackMirrorIndex(-1), mnBALocalForKF(0), mnFuseCandidateForKF(0), mnLoopPointForKF(0), mnCorrectedByKF(0),
     mnCorrectedReference(0), mnBAGlobalForKF(0), mpRefKF(pRefKF), mnVisible(1), mnFound(1), mbBad(false),
     mpReplaced(static_cast<MapPoint*>(NULL)), mfMinDistance(0), mfMaxDistance(0), mpMap(pMap),
-    mnOriginMapId(pMap->GetId())
+    mnOriginMapId(pMap->GetId()), mnNormalSum(0), mbNormalSumValid(false), mnNormalVersion(0)
 {
     mInvDepth=invDepth;
     mInitU=(double)uv_init.x;
     mInitV=(double)uv_init.y;
     mpHostKF = pHostKF;
 
-    mNormalVector = cv::Mat::zeros(3,1,CV_32F);
+    mWorldPosx = cv::Matx31f::zeros();
     mNormalVectorx = cv::Matx31f::zeros();
 
     // Worldpos is not set
@@ -78,14 +118,23 @@ MapPoint::MapPoint(const double invDepth, cv::Point2f uv_init, KeyFrame* pRefKF,
 }
 
 MapPoint::MapPoint(const cv::Mat &Pos, Map* pMap, Frame* pFrame, const int &idxF):
-    mnFirstKFid(-1), mnFirstFrame(pFrame->mnId), nObs(0), mnTrackReferenceForFrame(0), mnLastFrameSeen(0),
+    mnFirstKFid(-1), mnFirstFrame(pFrame->mnId), nObs(0), mnTrackReferenceForFrame(0), mnLastFrameSeen(0), mnTrackMirrorIndex(-1),
     mnBALocalForKF(0), mnFuseCandidateForKF(0),mnLoopPointForKF(0), mnCorrectedByKF(0),
     mnCorrectedReference(0), mnBAGlobalForKF(0), mpRefKF(static_cast<KeyFrame*>(NULL)), mnVisible(1),
-    mnFound(1), mbBad(false), mpReplaced(NULL), mpMap(pMap), mnOriginMapId(pMap->GetId())
+    mnFound(1), mbBad(false), mpReplaced(NULL), mpMap(pMap), mnOriginMapId(pMap->GetId()),
+    mpHostKF(static_cast<KeyFrame*>(NULL)), mnNormalSum(0), mbNormalSumValid(false), mnNormalVersion(0)
 {
-    Pos.copyTo(mWorldPos);
     mWorldPosx = cv::Matx31f(Pos.at<float>(0), Pos.at<float>(1), Pos.at<float>(2));
 
+    InitFromObservation(pFrame,idxF);
+
+    // MapPoints can be created from Tracking and Local Mapping. This mutex avoid conflicts with id.
+    unique_lock<mutex> lock(mpMap->mMutexPointCreation);
+    mnId=nNextId++;
+}
+
+void MapPoint::InitFromObservation(Frame* pFrame, const int &idxF)
+{
     cv::Mat Ow;
     if(pFrame -> Nleft == -1 || idxF < pFrame -> Nleft){
         Ow = pFrame->GetCameraCenter();
@@ -97,13 +146,10 @@ MapPoint::MapPoint(const cv::Mat &Pos, Map* pMap, Frame* pFrame, const int &idxF
 
         Ow = Rwl * tlr + twl;
     }
-    mNormalVector = mWorldPos - Ow;
-    mNormalVector = mNormalVector/cv::norm(mNormalVector);
-    mNormalVectorx = cv::Matx31f(mNormalVector.at<float>(0), mNormalVector.at<float>(1), mNormalVector.at<float>(2));
-
-
-    cv::Mat PC = Pos - Ow;
+    const cv::Matx31f PC = mWorldPosx - cv::Matx31f(Ow.at<float>(0), Ow.at<float>(1), Ow.at<float>(2));
     const float dist = cv::norm(PC);
+    mNormalVectorx = PC*(1.f/dist);
+
     const int level = (pFrame -> Nleft == -1) ? pFrame->mvKeysUn[idxF].octave
                                               : (idxF < pFrame -> Nleft) ? pFrame->mvKeys[idxF].octave
                                                                          : pFrame -> mvKeysRight[idxF].octave;
@@ -114,68 +160,112 @@ MapPoint::MapPoint(const cv::Mat &Pos, Map* pMap, Frame* pFrame, const int &idxF
     mfMinDistance = mfMaxDistance/pFrame->mvScaleFactors[nLevels-1];
 
     pFrame->mDescriptors.row(idxF).copyTo(mDescriptor);
-
-    // MapPoints can be created from Tracking and Local Mapping. This mutex avoid conflicts with id.
-    unique_lock<mutex> lock(mpMap->mMutexPointCreation);
-    mnId=nNextId++;
 }
 
 void MapPoint::SetWorldPos(const cv::Mat &Pos)
 {
-    unique_lock<mutex> lock2(mGlobalMutex);
-    unique_lock<mutex> lock(mMutexPos);
-    Pos.copyTo(mWorldPos);
-    mWorldPosx = cv::Matx31f(Pos.at<float>(0), Pos.at<float>(1), Pos.at<float>(2));
+    SetWorldPos2(cv::Matx31f(Pos.at<float>(0), Pos.at<float>(1), Pos.at<float>(2)));
+}
+
+void MapPoint::SetWorldPos2(const cv::Matx31f &posx)
+{
+    {
+        unique_lock<boost::shared_mutex> lock(mMutexPos);
+        //^ 쓰는 동안 버전이 홀수라서 낙관적 읽기는 재시도한다
+        const unsigned int v = mnPosVersion.load(memory_order_relaxed);
+        mnPosVersion.store(v+1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        mWorldPosx = posx;
+        mnPosVersion.store(v+2, memory_order_release);
+        mbNormalSumValid = false;
+        mnNormalVersion++;
+        mnViewVersion.fetch_add(1, memory_order_release);
+    }
+
+    Map* pMap = GetMap();
+    if(pMap)
+        pMap->UpdateMapPointPosition(this,posx);
 }
 
 cv::Mat MapPoint::GetWorldPos()
 {
-    unique_lock<mutex> lock(mMutexPos);
-    return mWorldPos.clone();
+    return cv::Mat(GetWorldPos2());
 }
 
 cv::Mat MapPoint::GetNormal()
 {
-    unique_lock<mutex> lock(mMutexPos);
-    return mNormalVector.clone();
+    boost::shared_lock<boost::shared_mutex> lock(mMutexPos);
+    return cv::Mat(mNormalVectorx);
 }
 
 cv::Matx31f MapPoint::GetWorldPos2()
 {
-    unique_lock<mutex> lock(mMutexPos);
-    return mWorldPosx;
+    while(true)
+    {
+        const unsigned int v = mnPosVersion.load(memory_order_acquire);
+        if(!(v&1))
+        {
+            const cv::Matx31f pos = mWorldPosx;
+            atomic_thread_fence(memory_order_acquire);
+            if(mnPosVersion.load(memory_order_relaxed)==v)
+                return pos;
+        }
+        //^ 쓰기 중이면 그 쓰기만 끝나기를 기다린다
+        this_thread::yield();
+    }
 }
 
 cv::Matx31f MapPoint::GetNormal2()
 {
-    unique_lock<mutex> lock(mMutexPos);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexPos);
     return mNormalVectorx;
 }
 
+void MapPoint::GetViewingGeometry(cv::Matx31f &Pos, cv::Matx31f &Normal, float &minDistance, float &maxDistance)
+{
+    boost::shared_lock<boost::shared_mutex> lock(mMutexPos);
+    Pos = mWorldPosx;
+    Normal = mNormalVectorx;
+    minDistance = 0.8f*mfMinDistance;
+    maxDistance = 1.2f*mfMaxDistance;
+}
+
 KeyFrame* MapPoint::GetReferenceKeyFrame()
 {
-    unique_lock<mutex> lock(mMutexFeatures);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexFeatures);
     return mpRefKF;
 }
 
 void MapPoint::AddObservation(KeyFrame* pKF, int idx)
 {
-    unique_lock<mutex> lock(mMutexFeatures);
+    unique_lock<boost::shared_mutex> lock(mMutexFeatures);
     tuple<int,int> indexes;
 
-    if(mObservations.count(pKF)){
+    const bool bNewKF = !mObservations.count(pKF);
+    if(!bNewKF){
         indexes = mObservations[pKF];
     }
     else{
         indexes = tuple<int,int>(-1,-1);
     }
 
-    if(pKF -> NLeft != -1 && idx >= pKF -> NLeft){
-        get<1>(indexes) = idx;
-    }
-    else{
-        get<0>(indexes) = idx;
+    const bool bRight = pKF -> NLeft != -1 && idx >= pKF -> NLeft;
+    int &side = bRight ? get<1>(indexes) : get<0>(indexes);
+    if(side == -1)
+    {
+        mvPendingNormalObs.push_back(make_pair(pKF,bRight));
+
+        // A new slot of pKF sees this point, together with every keyframe already observing it
+        for(ObservationMap::const_iterator mit=mObservations.begin(), mend=mObservations.end(); mit!=mend; mit++)
+        {
+            if(mit->first == pKF)
+                continue;
+            pKF->IncreaseCovisibility(mit->first,1);
+            if(bNewKF)
+                mit->first->IncreaseCovisibility(pKF,ObservationSlots(mit->second));
+        }
     }
+    side = idx;
 
     mObservations[pKF]=indexes;
 
@@ -189,7 +279,7 @@ void MapPoint::EraseObservation(KeyFrame* pKF)
 {
     bool bBad=false;
     {
-        unique_lock<mutex> lock(mMutexFeatures);
+        unique_lock<boost::shared_mutex> lock(mMutexFeatures);
         if(mObservations.count(pKF))
         {
             tuple<int,int> indexes = mObservations[pKF];
@@ -207,6 +297,19 @@ void MapPoint::EraseObservation(KeyFrame* pKF)
 
             mObservations.erase(pKF);
 
+            const int nSlots = ObservationSlots(indexes);
+            for(ObservationMap::const_iterator mit=mObservations.begin(), mend=mObservations.end(); mit!=mend; mit++)
+            {
+                pKF->IncreaseCovisibility(mit->first,-nSlots);
+                mit->first->IncreaseCovisibility(pKF,-ObservationSlots(mit->second));
+            }
+
+            {
+                unique_lock<boost::shared_mutex> lock2(mMutexPos);
+                mbNormalSumValid = false;
+                mnNormalVersion++;
+            }
+
             if(mpRefKF==pKF)
                 mpRefKF=mObservations.begin()->first;
 
@@ -221,29 +324,32 @@ void MapPoint::EraseObservation(KeyFrame* pKF)
 }
 
 
-std::map<KeyFrame*, std::tuple<int,int>>  MapPoint::GetObservations()
+ObservationMap  MapPoint::GetObservations()
 {
-    unique_lock<mutex> lock(mMutexFeatures);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexFeatures);
     return mObservations;
 }
 
 int MapPoint::Observations()
 {
-    unique_lock<mutex> lock(mMutexFeatures);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexFeatures);
     return nObs;
 }
 
 void MapPoint::SetBadFlag()
 {
-    map<KeyFrame*, tuple<int,int>> obs;
+    ObservationMap obs;
+    bool bWasBad;
     {
-        unique_lock<mutex> lock1(mMutexFeatures);
-        unique_lock<mutex> lock2(mMutexPos);
+        unique_lock<boost::shared_mutex> lock1(mMutexFeatures);
+        unique_lock<boost::shared_mutex> lock2(mMutexPos);
+        bWasBad = mbBad;
         mbBad=true;
         obs = mObservations;
         mObservations.clear();
+        UpdateCovisibility(obs,-1);
     }
-    for(map<KeyFrame*, tuple<int,int>>::iterator mit=obs.begin(), mend=obs.end(); mit!=mend; mit++)
+    for(ObservationMap::iterator mit=obs.begin(), mend=obs.end(); mit!=mend; mit++)
     {
         KeyFrame* pKF = mit->first;
         int leftIndex = get<0>(mit -> second), rightIndex = get<1>(mit -> second);
@@ -256,12 +362,16 @@ void MapPoint::SetBadFlag()
     }
 
     mpMap->EraseMapPoint(this);
+
+    // Freed once no thread can still hold a pointer to it
+    if(!bWasBad)
+        EpochManager::Retire(this, mpMap->GetReclaimGracePeriod());
 }
 
 MapPoint* MapPoint::GetReplaced()
 {
-    unique_lock<mutex> lock1(mMutexFeatures);
-    unique_lock<mutex> lock2(mMutexPos);
+    boost::shared_lock<boost::shared_mutex> lock1(mMutexFeatures);
+    boost::shared_lock<boost::shared_mutex> lock2(mMutexPos);
     return mpReplaced;
 }
 
@@ -271,19 +381,22 @@ void MapPoint::Replace(MapPoint* pMP)
         return;
 
     int nvisible, nfound;
-    map<KeyFrame*,tuple<int,int>> obs;
+    ObservationMap obs;
+    bool bWasBad;
     {
-        unique_lock<mutex> lock1(mMutexFeatures);
-        unique_lock<mutex> lock2(mMutexPos);
+        unique_lock<boost::shared_mutex> lock1(mMutexFeatures);
+        unique_lock<boost::shared_mutex> lock2(mMutexPos);
         obs=mObservations;
         mObservations.clear();
+        UpdateCovisibility(obs,-1);
+        bWasBad = mbBad;
         mbBad=true;
         nvisible = mnVisible;
         nfound = mnFound;
         mpReplaced = pMP;
     }
 
-    for(map<KeyFrame*,tuple<int,int>>::iterator mit=obs.begin(), mend=obs.end(); mit!=mend; mit++)
+    for(ObservationMap::iterator mit=obs.begin(), mend=obs.end(); mit!=mend; mit++)
     {
         // Replace measurement in keyframe
         KeyFrame* pKF = mit->first;
@@ -317,44 +430,44 @@ void MapPoint::Replace(MapPoint* pMP)
     pMP->ComputeDistinctiveDescriptors();
 
     mpMap->EraseMapPoint(this);
+
+    // GetReplaced() stays valid for the threads that still hold this point, pMP is retired later than this one
+    if(!bWasBad)
+        EpochManager::Retire(this, mpMap->GetReclaimGracePeriod());
 }
 
 bool MapPoint::isBad()
 {
-    unique_lock<mutex> lock1(mMutexFeatures,std::defer_lock);
-    unique_lock<mutex> lock2(mMutexPos,std::defer_lock);
-    lock(lock1, lock2);
+    boost::shared_lock<boost::shared_mutex> lock1(mMutexFeatures);
+    boost::shared_lock<boost::shared_mutex> lock2(mMutexPos);
 
     return mbBad;
 }
 
 void MapPoint::IncreaseVisible(int n)
 {
-    unique_lock<mutex> lock(mMutexFeatures);
+    unique_lock<boost::shared_mutex> lock(mMutexFeatures);
     mnVisible+=n;
 }
 
 void MapPoint::IncreaseFound(int n)
 {
-    unique_lock<mutex> lock(mMutexFeatures);
+    unique_lock<boost::shared_mutex> lock(mMutexFeatures);
     mnFound+=n;
 }
 
 float MapPoint::GetFoundRatio()
 {
-    unique_lock<mutex> lock(mMutexFeatures);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexFeatures);
     return static_cast<float>(mnFound)/mnVisible;
 }
 
 void MapPoint::ComputeDistinctiveDescriptors()
 {
-    // Retrieve all observed descriptors
-    vector<cv::Mat> vDescriptors;
-
-    map<KeyFrame*,tuple<int,int>> observations;
+    ObservationMap observations;
 
     {
-        unique_lock<mutex> lock1(mMutexFeatures);
+        boost::shared_lock<boost::shared_mutex> lock1(mMutexFeatures);
         if(mbBad)
             return;
         observations=mObservations;
@@ -363,51 +476,106 @@ void MapPoint::ComputeDistinctiveDescriptors()
     if(observations.empty())
         return;
 
-    vDescriptors.reserve(observations.size());
+    const int nMaxDescriptorObs = GetMap()->GetMaxDescriptorObservations();
 
-    for(map<KeyFrame*,tuple<int,int>>::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
-    {
-        KeyFrame* pKF = mit->first;
+    unique_lock<mutex> lock(mMutexDescriptorSamples);
 
-        if(!pKF->isBad()){
-            tuple<int,int> indexes = mit -> second;
-            int leftIndex = get<0>(indexes), rightIndex = get<1>(indexes);
-
-            if(leftIndex != -1){
-                vDescriptors.push_back(pKF->mDescriptors.row(leftIndex));
-            }
-            if(rightIndex != -1){
-                vDescriptors.push_back(pKF->mDescriptors.row(rightIndex));
-            }
+    // Drop the samples whose observation was erased, replaced or whose keyframe is bad
+    vector<DescriptorSample> &vSamples = mvDescriptorSamples;
+    bool bChanged = false;
+    for(size_t i=0; i<vSamples.size(); )
+    {
+        ObservationMap::const_iterator mit = observations.find(vSamples[i].pKF);
+        if(mit!=observations.end() && !mit->first->isBad() &&
+                (get<0>(mit->second)==vSamples[i].idx || get<1>(mit->second)==vSamples[i].idx))
+        {
+            i++;
+            continue;
         }
+
+        EraseDescriptorSample(i);
+        bChanged = true;
     }
 
-    if(vDescriptors.empty())
-        return;
+    // Forget the evicted observations that were erased, the same index may be observed again later
+    for(set<pair<KeyFrame*,int> >::iterator sit=msDescriptorEvicted.begin(); sit!=msDescriptorEvicted.end(); )
+    {
+        ObservationMap::const_iterator mit = observations.find(sit->first);
+        if(mit!=observations.end() && (get<0>(mit->second)==sit->second || get<1>(mit->second)==sit->second))
+            sit++;
+        else
+            msDescriptorEvicted.erase(sit++);
+    }
 
-    // Compute distances between them
-    const size_t N = vDescriptors.size();
+    // Retrieve the observed descriptors not sampled yet, each one is compared once with the current samples
+    set<pair<KeyFrame*,int> > sSampled(msDescriptorEvicted);
+    for(size_t i=0; i<vSamples.size(); i++)
+        sSampled.insert(make_pair(vSamples[i].pKF,vSamples[i].idx));
 
-    float Distances[N][N];
-    for(size_t i=0;i<N;i++)
+    vector<uint16_t> vDists;
+    for(ObservationMap::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
     {
-        Distances[i][i]=0;
-        for(size_t j=i+1;j<N;j++)
+        KeyFrame* pKF = mit->first;
+
+        if(pKF->isBad())
+            continue;
+
+        const int vIndexes[2] = {get<0>(mit->second), get<1>(mit->second)};
+        for(int k=0; k<2; k++)
         {
-            int distij = ORBmatcher::DescriptorDistance(vDescriptors[i],vDescriptors[j]);
-            Distances[i][j]=distij;
-            Distances[j][i]=distij;
+            if(vIndexes[k] == -1 || sSampled.count(make_pair(pKF,vIndexes[k])))
+                continue;
+
+            DescriptorSample sample;
+            sample.pKF = pKF;
+            sample.idx = vIndexes[k];
+            // A row would share the whole descriptor matrix of the keyframe, keeping it in memory after it is released
+            pKF->mDescriptors.row(vIndexes[k]).copyTo(sample.descriptor);
+            sample.vDists.resize(vSamples.size()+1,0);
+            for(size_t j=0; j<vSamples.size(); j++)
+            {
+                const uint16_t distij = ORBmatcher::DescriptorDistance(sample.descriptor,vSamples[j].descriptor);
+                sample.vDists[j] = distij;
+                vSamples[j].vDists.push_back(distij);
+            }
+            vSamples.push_back(sample);
+
+            // Over the cap the sample farthest from the rest (largest median distance) is evicted,
+            // the oldest one on ties, so newer observations replace the outlying or stale ones
+            size_t nEvict = vSamples.size()-1;
+            if(nMaxDescriptorObs>0 && vSamples.size()>(size_t)nMaxDescriptorObs)
+            {
+                int WorstMedian = -1;
+                for(size_t i=0; i<vSamples.size(); i++)
+                {
+                    const int median = MedianDistance(vSamples[i].vDists,vDists);
+                    if(median>WorstMedian || (median==WorstMedian && vSamples[i].pKF->mnId<vSamples[nEvict].pKF->mnId))
+                    {
+                        WorstMedian = median;
+                        nEvict = i;
+                    }
+                }
+
+                msDescriptorEvicted.insert(make_pair(vSamples[nEvict].pKF,vSamples[nEvict].idx));
+                const bool bNewEvicted = nEvict==vSamples.size()-1;
+                EraseDescriptorSample(nEvict);
+                if(bNewEvicted)
+                    continue;
+            }
+            bChanged = true;
         }
     }
 
+    if(vSamples.empty() || !bChanged)
+        return;
+
     // Take the descriptor with least median distance to the rest
+    const size_t N = vSamples.size();
     int BestMedian = INT_MAX;
     int BestIdx = 0;
     for(size_t i=0;i<N;i++)
     {
-        vector<int> vDists(Distances[i],Distances[i]+N);
-        sort(vDists.begin(),vDists.end());
-        int median = vDists[0.5*(N-1)];
+        const int median = MedianDistance(vSamples[i].vDists,vDists);
 
         if(median<BestMedian)
         {
@@ -417,20 +585,65 @@ void MapPoint::ComputeDistinctiveDescriptors()
     }
 
     {
-        unique_lock<mutex> lock(mMutexFeatures);
-        mDescriptor = vDescriptors[BestIdx].clone();
+        unique_lock<boost::shared_mutex> lock(mMutexFeatures);
+        mDescriptor = vSamples[BestIdx].descriptor.clone();
+        mnViewVersion.fetch_add(1, memory_order_release);
     }
 }
 
+void MapPoint::EraseDescriptorSample(const size_t i)
+{
+    mvDescriptorSamples.erase(mvDescriptorSamples.begin()+i);
+    for(size_t j=0; j<mvDescriptorSamples.size(); j++)
+        mvDescriptorSamples[j].vDists.erase(mvDescriptorSamples[j].vDists.begin()+i);
+}
+
+int MapPoint::MedianDistance(const vector<uint16_t> &vDists, vector<uint16_t> &vTmp)
+{
+    vTmp = vDists;
+    const size_t m = (vTmp.size()-1)/2;
+    nth_element(vTmp.begin(),vTmp.begin()+m,vTmp.end());
+    return vTmp[m];
+}
+
+void MapPoint::AccumulateMemory(MemoryUsage &usage)
+{
+    size_t nBytes = sizeof(MapPoint);
+    size_t nDescriptorBytes = 0;
+    {
+        boost::shared_lock<boost::shared_mutex> lock(mMutexFeatures);
+        nBytes += mObservations.size()*sizeof(ObservationMap::value_type);
+        nDescriptorBytes += mDescriptor.total()*mDescriptor.elemSize();
+    }
+    {
+        unique_lock<mutex> lock(mMutexNormalSum);
+        nBytes += mvPendingNormalObs.capacity()*sizeof(pair<KeyFrame*,bool>);
+    }
+    {
+        unique_lock<mutex> lock(mMutexDescriptorSamples);
+        nDescriptorBytes += mvDescriptorSamples.capacity()*sizeof(DescriptorSample);
+        nDescriptorBytes += msDescriptorEvicted.size()*sizeof(pair<KeyFrame*,int>);
+        for(size_t i=0; i<mvDescriptorSamples.size(); i++)
+        {
+            const DescriptorSample &sample = mvDescriptorSamples[i];
+            nDescriptorBytes += sample.descriptor.total()*sample.descriptor.elemSize() + sample.vDists.capacity()*sizeof(uint16_t);
+        }
+    }
+
+    usage.nMapPoints += nBytes;
+    usage.nMapPointDescriptors += nDescriptorBytes;
+    usage.nMapPointCount++;
+}
+
 cv::Mat MapPoint::GetDescriptor()
 {
-    unique_lock<mutex> lock(mMutexFeatures);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexFeatures);
     return mDescriptor.clone();
 }
 
 tuple<int,int> MapPoint::GetIndexInKeyFrame(KeyFrame *pKF)
 {
-    unique_lock<mutex> lock(mMutexFeatures);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexFeatures);
     if(mObservations.count(pKF))
         return mObservations[pKF];
     else
@@ -439,62 +652,93 @@ tuple<int,int> MapPoint::GetIndexInKeyFrame(KeyFrame *pKF)
 
 bool MapPoint::IsInKeyFrame(KeyFrame *pKF)
 {
-    unique_lock<mutex> lock(mMutexFeatures);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexFeatures);
     return (mObservations.count(pKF));
 }
 
 void MapPoint::UpdateNormalAndDepth()
 {
-    map<KeyFrame*,tuple<int,int>> observations;
+    unique_lock<mutex> lockNormal(mMutexNormalSum);
+
+    ObservationMap observations;
+    vector<pair<KeyFrame*,bool> > vNewObs;
     KeyFrame* pRefKF;
-    cv::Mat Pos;
+    tuple<int,int> refIndexes;
+    cv::Matx31f Posx;
+    bool bIncremental;
+    unsigned long nVersion;
     {
-        unique_lock<mutex> lock1(mMutexFeatures);
-        unique_lock<mutex> lock2(mMutexPos);
+        unique_lock<boost::shared_mutex> lock1(mMutexFeatures);
+        boost::shared_lock<boost::shared_mutex> lock2(mMutexPos);
         if(mbBad)
             return;
-        observations=mObservations;
+        if(mObservations.empty())
+            return;
+
+        bIncremental = mbNormalSumValid;
+        if(bIncremental)
+            vNewObs.swap(mvPendingNormalObs);
+        else
+        {
+            observations=mObservations;
+            mvPendingNormalObs.clear();
+        }
+
         pRefKF=mpRefKF;
-        Pos = mWorldPos.clone();
+        ObservationMap::const_iterator mitRef = mObservations.find(pRefKF);
+        refIndexes = mitRef!=mObservations.end() ? mitRef->second : tuple<int,int>();
+        Posx = mWorldPosx;
+        nVersion = mnNormalVersion;
     }
 
-    if(observations.empty())
-        return;
+    cv::Matx31f normal = bIncremental ? mNormalSum : cv::Matx31f::zeros();
+    int n = bIncremental ? mnNormalSum : 0;
 
-    cv::Mat normal = cv::Mat::zeros(3,1,CV_32F);
-    int n=0;
-    for(map<KeyFrame*,tuple<int,int>>::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+    if(bIncremental)
     {
-        KeyFrame* pKF = mit->first;
-
-        tuple<int,int> indexes = mit -> second;
-        int leftIndex = get<0>(indexes), rightIndex = get<1>(indexes);
-
-        if(leftIndex != -1){
-            cv::Mat Owi = pKF->GetCameraCenter();
-            cv::Mat normali = mWorldPos - Owi;
-            normal = normal + normali/cv::norm(normali);
+        for(size_t i=0; i<vNewObs.size(); i++)
+        {
+            const cv::Matx31f Owi = vNewObs[i].second ? vNewObs[i].first->GetRightCameraCenter_()
+                                                      : vNewObs[i].first->GetCameraCenter_();
+            const cv::Matx31f normali = Posx - Owi;
+            normal += normali*(1.f/cv::norm(normali));
             n++;
         }
-        if(rightIndex != -1){
-            cv::Mat Owi = pKF->GetRightCameraCenter();
-            cv::Mat normali = mWorldPos - Owi;
-            normal = normal + normali/cv::norm(normali);
-            n++;
+    }
+    else
+    {
+        for(ObservationMap::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+        {
+            KeyFrame* pKF = mit->first;
+
+            tuple<int,int> indexes = mit -> second;
+            int leftIndex = get<0>(indexes), rightIndex = get<1>(indexes);
+
+            if(leftIndex != -1){
+                const cv::Matx31f normali = Posx - pKF->GetCameraCenter_();
+                normal += normali*(1.f/cv::norm(normali));
+                n++;
+            }
+            if(rightIndex != -1){
+                const cv::Matx31f normali = Posx - pKF->GetRightCameraCenter_();
+                normal += normali*(1.f/cv::norm(normali));
+                n++;
+            }
         }
     }
 
-    cv::Mat PC = Pos - pRefKF->GetCameraCenter();
-    const float dist = cv::norm(PC);
+    if(n==0)
+        return;
+
+    const float dist = cv::norm(Posx - pRefKF->GetCameraCenter_());
 
-    tuple<int ,int> indexes = observations[pRefKF];
-    int leftIndex = get<0>(indexes), rightIndex = get<1>(indexes);
+    int leftIndex = get<0>(refIndexes), rightIndex = get<1>(refIndexes);
     int level;
     if(pRefKF -> NLeft == -1){
         level = pRefKF->mvKeysUn[leftIndex].octave;
     }
     else if(leftIndex != -1){
-        level = pRefKF -> mvKeys[leftIndex].octave;
+        level = pRefKF -> GetKeyPoint(leftIndex).octave;
     }
     else{
         level = pRefKF -> mvKeysRight[rightIndex - pRefKF -> NLeft].octave;
@@ -504,30 +748,35 @@ void MapPoint::UpdateNormalAndDepth()
     const int nLevels = pRefKF->mnScaleLevels;
 
     {
-        unique_lock<mutex> lock3(mMutexPos);
+        unique_lock<boost::shared_mutex> lock3(mMutexPos);
         mfMaxDistance = dist*levelScaleFactor;
         mfMinDistance = mfMaxDistance/pRefKF->mvScaleFactors[nLevels-1];
-        mNormalVector = normal/n;
-        mNormalVectorx = cv::Matx31f(mNormalVector.at<float>(0), mNormalVector.at<float>(1), mNormalVector.at<float>(2));
+        mNormalVectorx = normal*(1.f/n);
+
+        // The sum stays valid only if the point did not move meanwhile
+        mNormalSum = normal;
+        mnNormalSum = n;
+        mbNormalSumValid = (nVersion == mnNormalVersion);
+        mnViewVersion.fetch_add(1, memory_order_release);
     }
 }
 
 void MapPoint::SetNormalVector(cv::Mat& normal)
 {
-    unique_lock<mutex> lock3(mMutexPos);
-    mNormalVector = normal;
-    mNormalVectorx = cv::Matx31f(mNormalVector.at<float>(0), mNormalVector.at<float>(1), mNormalVector.at<float>(2));
+    unique_lock<boost::shared_mutex> lock3(mMutexPos);
+    mNormalVectorx = cv::Matx31f(normal.at<float>(0), normal.at<float>(1), normal.at<float>(2));
+    mnViewVersion.fetch_add(1, memory_order_release);
 }
 
 float MapPoint::GetMinDistanceInvariance()
 {
-    unique_lock<mutex> lock(mMutexPos);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexPos);
     return 0.8f*mfMinDistance;
 }
 
 float MapPoint::GetMaxDistanceInvariance()
 {
-    unique_lock<mutex> lock(mMutexPos);
+    boost::shared_lock<boost::shared_mutex> lock(mMutexPos);
     return 1.2f*mfMaxDistance;
 }
 
@@ -535,7 +784,7 @@ int MapPoint::PredictScale(const float &currentDist, KeyFrame* pKF)
 {
     float ratio;
     {
-        unique_lock<mutex> lock(mMutexPos);
+        boost::shared_lock<boost::shared_mutex> lock(mMutexPos);
         ratio = mfMaxDistance/currentDist;
     }
 
@@ -552,7 +801,7 @@ int MapPoint::PredictScale(const float &currentDist, Frame* pF)
 {
     float ratio;
     {
-        unique_lock<mutex> lock(mMutexPos);
+        boost::shared_lock<boost::shared_mutex> lock(mMutexPos);
         ratio = mfMaxDistance/currentDist;
     }
 
@@ -577,4 +826,58 @@ void MapPoint::UpdateMap(Map* pMap)
     mpMap = pMap;
 }
 
+void MapPoint::PreSave(set<KeyFrame*>& spKF, set<MapPoint*>& spMP)
+{
+    unique_lock<boost::shared_mutex> lock(mMutexFeatures);
+
+    mBackupObservationsId1.clear();
+    mBackupObservationsId2.clear();
+    for(ObservationMap::const_iterator it = mObservations.begin(), end = mObservations.end(); it != end; ++it)
+    {
+        KeyFrame* pKFi = it->first;
+        if(!spKF.count(pKFi))
+            continue;
+
+        mBackupObservationsId1[pKFi->mnId] = get<0>(it->second);
+        mBackupObservationsId2[pKFi->mnId] = get<1>(it->second);
+    }
+
+    mBackupRefKFId = (mpRefKF && spKF.count(mpRefKF)) ? (long long int)mpRefKF->mnId : -1;
+    mBackupHostKFId = (mpHostKF && spKF.count(mpHostKF)) ? (long long int)mpHostKF->mnId : -1;
+}
+
+void MapPoint::PostLoad(map<long unsigned int, KeyFrame*>& mpKFid, map<long unsigned int, MapPoint*>& mpMPid)
+{
+    unique_lock<boost::shared_mutex> lock(mMutexFeatures);
+    unique_lock<boost::shared_mutex> lock2(mMutexPos);
+
+    mObservations.clear();
+    for(map<long unsigned int,int>::const_iterator it = mBackupObservationsId1.begin(), end = mBackupObservationsId1.end(); it != end; ++it)
+    {
+        map<long unsigned int, KeyFrame*>::iterator itKF = mpKFid.find(it->first);
+        if(itKF == mpKFid.end())
+            continue;
+
+        mObservations[itKF->second] = tuple<int,int>(it->second, mBackupObservationsId2[it->first]);
+    }
+
+    UpdateCovisibility(mObservations,1);
+
+    mpRefKF = static_cast<KeyFrame*>(NULL);
+    if(mBackupRefKFId >= 0 && mpKFid.count(mBackupRefKFId))
+        mpRefKF = mpKFid[mBackupRefKFId];
+    else if(!mObservations.empty())
+        mpRefKF = mObservations.begin()->first;
+
+    mpHostKF = static_cast<KeyFrame*>(NULL);
+    if(mBackupHostKFId >= 0 && mpKFid.count(mBackupHostKFId))
+        mpHostKF = mpKFid[mBackupHostKFId];
+
+    mpReplaced = static_cast<MapPoint*>(NULL);
+    mbBad = false;
+
+    mBackupObservationsId1.clear();
+    mBackupObservationsId2.clear();
+}
+
 } //namespace ORB_SLAM
@@ -0,0 +1,215 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "MapRefiner.h"
+
+#include "Map.h"
+#include "KeyFrame.h"
+#include "MapPoint.h"
+#include "LocalMapping.h"
+#include "ORBmatcher.h"
+#include "Optimizer.h"
+#include "ThreadPool.h"
+
+#include <iostream>
+
+using namespace std;
+
+namespace ORB_SLAM3
+{
+
+MapRefiner::MapRefiner(LocalMapping* pLocalMapper, ThreadPool* pThreadPool, const int nBAIterations):
+    mpLocalMapper(pLocalMapper), mpThreadPool(pThreadPool), mnBAIterations(nBAIterations)
+{
+}
+
+MapRefiner::Stats MapRefiner::Refine(Map* pMap, const bool bFuse, const bool bCullKeyFrames)
+{
+    Stats stats = {0, 0, 0};
+
+    if(bFuse)
+    {
+        stats.nFused = FuseMapPoints(pMap);
+        UpdateMap(pMap, true);
+        cout << "  fused " << stats.nFused << " map points" << endl;
+    }
+
+    if(bCullKeyFrames && !pMap->IsInertial())
+    {
+        stats.nCulledKeyFrames = CullKeyFrames(pMap);
+        cout << "  culled " << stats.nCulledKeyFrames << " keyframes" << endl;
+    }
+
+    stats.nCulledMapPoints = CullMapPoints(pMap);
+    cout << "  culled " << stats.nCulledMapPoints << " map points" << endl;
+
+    GlobalBundleAdjustment(pMap);
+    UpdateMap(pMap, false);
+
+    pMap->IncreaseChangeIndex();
+    return stats;
+}
+
+int MapRefiner::FuseMapPoints(Map* pMap)
+{
+    ORBmatcher matcher;
+    int nFused = 0;
+
+    // Fusion replaces points seen by other keyframes, it runs one keyframe at a time
+    const Map::KeyFramesSnapshot pKFs = pMap->GetKeyFramesSnapshot();
+    const vector<KeyFrame*> &vpKFs = *pKFs;
+    for(size_t i=0; i<vpKFs.size(); i++)
+    {
+        KeyFrame* pKF = vpKFs[i];
+        if(pKF->isBad())
+            continue;
+
+        vector<MapPoint*> vpFuseCandidates;
+        const vector<KeyFrame*> vpNeighKFs = pKF->GetBestCovisibilityKeyFrames(20);
+        for(size_t j=0; j<vpNeighKFs.size(); j++)
+        {
+            KeyFrame* pKFi = vpNeighKFs[j];
+            if(pKFi->isBad())
+                continue;
+
+            const vector<MapPoint*> vpMapPointsKFi = pKFi->GetMapPointMatches();
+            for(size_t k=0; k<vpMapPointsKFi.size(); k++)
+            {
+                MapPoint* pMP = vpMapPointsKFi[k];
+                if(!pMP || pMP->isBad() || pMP->mnFuseCandidateForKF==pKF->mnId)
+                    continue;
+                pMP->mnFuseCandidateForKF = pKF->mnId;
+                vpFuseCandidates.push_back(pMP);
+            }
+        }
+
+        nFused += matcher.Fuse(pKF, vpFuseCandidates);
+        if(pKF->NLeft != -1)
+            nFused += matcher.Fuse(pKF, vpFuseCandidates, 3.0, true);
+    }
+
+    return nFused;
+}
+
+int MapRefiner::CullKeyFrames(Map* pMap)
+{
+    const Map::KeyFramesSnapshot pKFs = pMap->GetKeyFramesSnapshot();
+    const vector<KeyFrame*> &vpKFs = *pKFs;
+    const int nKFs = vpKFs.size();
+    const float redundant_th = 0.9f;
+    const unsigned long nInitKFid = pMap->GetInitKFid();
+    KeyFrame* pOriginKF = pMap->GetOriginKF();
+
+    // The redundancy test only reads the map, it runs on all the keyframes in parallel
+    vector<char> vbRedundant(nKFs,false);
+    auto checkKF = [&](int i)
+    {
+        KeyFrame* pKF = vpKFs[i];
+        if(pKF->mnId!=nInitKFid && pKF!=pOriginKF && !pKF->isBad())
+            vbRedundant[i] = mpLocalMapper->IsRedundantKeyFrame(pKF, redundant_th);
+    };
+    if(mpThreadPool && nKFs>1)
+        mpThreadPool->ParallelFor(0, nKFs, checkKF);
+    else
+        for(int i=0; i<nKFs; i++)
+            checkKF(i);
+
+    // The keyframes culled before reduce the observations of the points, the test is repeated
+    int nCulled = 0;
+    for(int i=0; i<nKFs; i++)
+    {
+        KeyFrame* pKF = vpKFs[i];
+        if(!vbRedundant[i] || pKF->isBad())
+            continue;
+        if(nCulled>0 && !mpLocalMapper->IsRedundantKeyFrame(pKF, redundant_th))
+            continue;
+
+        pKF->SetBadFlag();
+        nCulled++;
+    }
+
+    return nCulled;
+}
+
+int MapRefiner::CullMapPoints(Map* pMap)
+{
+    const Map::MapPointsSnapshot pMPs = pMap->GetMapPointsSnapshot();
+    const vector<MapPoint*> &vpMPs = *pMPs;
+
+    int nCulled = 0;
+    for(size_t i=0; i<vpMPs.size(); i++)
+    {
+        MapPoint* pMP = vpMPs[i];
+        if(pMP->isBad() || pMP->Observations()>=2)
+            continue;
+        pMP->SetBadFlag();
+        nCulled++;
+    }
+
+    return nCulled;
+}
+
+void MapRefiner::GlobalBundleAdjustment(Map* pMap)
+{
+    // The results are written to the map directly (loop keyframe 0 for the inertial BA, the origin
+    // keyframe for the visual one)
+    if(pMap->isImuInitialized())
+    {
+        cout << "  full inertial BA, " << mnBAIterations << " iterations" << endl;
+        Optimizer::FullInertialBA(pMap, mnBAIterations, false, 0);
+    }
+    else
+    {
+        cout << "  global BA, " << mnBAIterations << " iterations" << endl;
+        Optimizer::GlobalBundleAdjustemnt(pMap, mnBAIterations, NULL, pMap->GetOriginKF()->mnId, true);
+    }
+}
+
+void MapRefiner::UpdateMap(Map* pMap, const bool bDescriptors)
+{
+    // A point only writes its own descriptor, normal and depth
+    const Map::MapPointsSnapshot pMPs = pMap->GetMapPointsSnapshot();
+    const vector<MapPoint*> &vpMPs = *pMPs;
+    auto updateMP = [&](int i)
+    {
+        MapPoint* pMP = vpMPs[i];
+        if(pMP->isBad())
+            return;
+        if(bDescriptors)
+            pMP->ComputeDistinctiveDescriptors();
+        pMP->UpdateNormalAndDepth();
+    };
+    if(mpThreadPool && vpMPs.size()>1)
+        mpThreadPool->ParallelFor(0, vpMPs.size(), updateMP);
+    else
+        for(size_t i=0; i<vpMPs.size(); i++)
+            updateMP(i);
+
+    // Connections are updated in both keyframes of every pair
+    if(!bDescriptors)
+        return;
+    const Map::KeyFramesSnapshot pKFs = pMap->GetKeyFramesSnapshot();
+    const vector<KeyFrame*> &vpKFs = *pKFs;
+    for(size_t i=0; i<vpKFs.size(); i++)
+    {
+        if(!vpKFs[i]->isBad())
+            vpKFs[i]->UpdateConnections();
+    }
+}
+
+} //namespace ORB_SLAM
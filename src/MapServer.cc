@@ -0,0 +1,602 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "MapServer.h"
+#include "ORBmatcher.h"
+#include "RansacSampler.h"
+
+#include <Eigen/Dense>
+#include <Eigen/Geometry>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+namespace ORB_SLAM3
+{
+
+MapServer::MapServer(ORBVocabulary* pVoc, const int port, const int nMinInliers):
+    mpVocabulary(pVoc), mnPort(port), mnMinInliers(std::max(nMinInliers,3)), mListenSocket(-1), mnQuery(0),
+    mnKeyFrames(0), mbFinishRequested(false), mbFinished(false)
+{
+    mvInvertedFile.resize(mpVocabulary->size());
+}
+
+MapServer::~MapServer()
+{
+    for(size_t i=0; i<mvConnections.size(); i++)
+        close(mvConnections[i].socket);
+    if(mListenSocket>=0)
+        close(mListenSocket);
+}
+
+void MapServer::Run()
+{
+    if(!Listen())
+    {
+        std::cerr << "Map server: cannot listen on port " << mnPort << std::endl;
+        SetFinish();
+        return;
+    }
+
+    std::cout << "Map server listening on port " << mnPort << std::endl;
+
+    std::vector<pollfd> vPoll;
+    while(!CheckFinish())
+    {
+        vPoll.resize(mvConnections.size()+1);
+        vPoll[0].fd = mListenSocket;
+        vPoll[0].events = POLLIN;
+        for(size_t i=0; i<mvConnections.size(); i++)
+        {
+            vPoll[i+1].fd = mvConnections[i].socket;
+            vPoll[i+1].events = POLLIN;
+        }
+
+        if(poll(vPoll.data(), vPoll.size(), 100)<=0)
+            continue;
+
+        // Closed connections are removed after the loop, new ones are polled next time
+        std::vector<bool> vbClosed(mvConnections.size(), false);
+        for(size_t i=0; i<mvConnections.size(); i++)
+        {
+            if(vPoll[i+1].revents & (POLLIN | POLLHUP | POLLERR))
+                vbClosed[i] = !Receive(mvConnections[i]);
+        }
+
+        for(int i=mvConnections.size()-1; i>=0; i--)
+        {
+            if(vbClosed[i])
+            {
+                CloseConnection(mvConnections[i]);
+                mvConnections.erase(mvConnections.begin()+i);
+            }
+        }
+
+        if(vPoll[0].revents & POLLIN)
+            AcceptClient();
+    }
+
+    SetFinish();
+}
+
+bool MapServer::Listen()
+{
+    mListenSocket = socket(AF_INET, SOCK_STREAM, 0);
+    if(mListenSocket<0)
+        return false;
+
+    int reuse = 1;
+    setsockopt(mListenSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(mnPort);
+
+    if(bind(mListenSocket, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))<0 || listen(mListenSocket, 16)<0)
+    {
+        close(mListenSocket);
+        mListenSocket = -1;
+        return false;
+    }
+
+    return true;
+}
+
+void MapServer::AcceptClient()
+{
+    Connection connection;
+    connection.socket = accept(mListenSocket, NULL, NULL);
+    if(connection.socket<0)
+        return;
+
+    connection.nAgentId = -1;
+    mvConnections.push_back(connection);
+}
+
+bool MapServer::Receive(Connection &connection)
+{
+    char data[65536];
+    const ssize_t n = recv(connection.socket, data, sizeof(data), 0);
+    if(n<=0)
+        return false;
+
+    connection.vBuffer.insert(connection.vBuffer.end(), data, data+n);
+    return KeyFrameWire::ConsumeMessages(connection.vBuffer, [&](const char type, const char* payload, const size_t size)
+        {
+            ProcessMessage(connection, type, payload, size);
+        });
+}
+
+void MapServer::CloseConnection(Connection &connection)
+{
+    close(connection.socket);
+    if(connection.nAgentId>=0)
+        std::cout << "Map server: agent " << connection.nAgentId << " disconnected" << std::endl;
+}
+
+bool MapServer::Send(const int socket, const std::vector<char> &buffer)
+{
+    const char* data = buffer.data();
+    size_t size = buffer.size();
+    while(size>0)
+    {
+        const ssize_t n = send(socket, data, size, MSG_NOSIGNAL);
+        if(n<=0)
+            return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+void MapServer::ProcessMessage(Connection &connection, const char type, const char* data, const size_t size)
+{
+    if(type=='H')
+    {
+        unsigned int nAgentId;
+        if(KeyFrameWire::DecodeHello(data, size, nAgentId))
+        {
+            connection.nAgentId = nAgentId;
+            std::cout << "Map server: agent " << nAgentId << " connected" << std::endl;
+        }
+        return;
+    }
+
+    // Nothing is accepted before the hello
+    if(connection.nAgentId<0)
+        return;
+
+    if(type=='K')
+    {
+        KeyFrameMessage msg;
+        if(KeyFrameWire::DecodeKeyFrame(data, size, msg) && msg.nAgentId==static_cast<unsigned int>(connection.nAgentId))
+            ProcessKeyFrame(msg);
+        else
+            std::cerr << "Map server: malformed keyframe from agent " << connection.nAgentId << std::endl;
+    }
+    else if(type=='U')
+        ProcessMapUpdate(connection.nAgentId, data, size);
+}
+
+void MapServer::ProcessMapUpdate(const unsigned int nAgentId, const char* data, const size_t size)
+{
+    AgentState &agent = mmAgents[nAgentId];
+
+    MapUpdateMessage msg;
+    if(!KeyFrameWire::DecodeMapUpdate(data, size, agent.references, msg) || msg.nAgentId!=nAgentId)
+    {
+        std::cerr << "Map server: malformed map update from agent " << nAgentId << std::endl;
+        return;
+    }
+
+    // The positions are read from the references, only the keyframe records need the new pose and map
+    for(size_t i=0; i<msg.vKFIds.size(); i++)
+    {
+        std::unordered_map<unsigned long long, ServerKeyFrame*>::iterator it = agent.mKeyFrames.find(msg.vKFIds[i]);
+        if(it==agent.mKeyFrames.end())
+            continue;
+        it->second->msg.Tcw = msg.vKFPoses[i];
+        it->second->msg.nMapId = msg.nMapId;
+    }
+}
+
+void MapServer::ProcessKeyFrame(const KeyFrameMessage &msg)
+{
+    mdKeyFrames.push_back(ServerKeyFrame());
+    ServerKeyFrame* pKF = &mdKeyFrames.back();
+    pKF->msg = msg;
+    pKF->mnQuery = 0;
+    pKF->mnWords = 0;
+    mpVocabulary->transform(msg.descriptors.ptr<unsigned char>(), msg.descriptors.step, msg.descriptors.rows,
+                            pKF->mBowVec, pKF->mFeatVec, 4);
+
+    AgentState &agent = mmAgents[msg.nAgentId];
+    agent.references.Add(msg);
+    agent.mKeyFrames[msg.nKFId] = pKF;
+
+    const std::vector<ServerKeyFrame*> vpCandidates = DetectCandidates(pKF);
+    for(size_t i=0; i<vpCandidates.size(); i++)
+    {
+        ServerKeyFrame* pCandidate = vpCandidates[i];
+        if(IsAligned(msg.nAgentId, msg.nMapId, pCandidate->msg.nAgentId, pCandidate->msg.nMapId))
+            continue;
+
+        Alignment alignment;
+        if(ComputeAlignment(pKF, pCandidate, alignment))
+        {
+            {
+                std::unique_lock<std::mutex> lock(mMutexAlignments);
+                mvAlignments.push_back(alignment);
+            }
+            std::cout << "Map server: map " << alignment.nMap1 << " of agent " << alignment.nAgent1 << " overlaps map "
+                      << alignment.nMap2 << " of agent " << alignment.nAgent2 << " (" << alignment.nInliers << " inliers)" << std::endl;
+            Notify(alignment);
+        }
+    }
+
+    for(DBoW2::BowVector::const_iterator vit=pKF->mBowVec.begin(), vend=pKF->mBowVec.end(); vit!=vend; vit++)
+        mvInvertedFile[vit->first].push_back(pKF);
+
+    std::unique_lock<std::mutex> lock(mMutexAlignments);
+    mnKeyFrames = mdKeyFrames.size();
+}
+
+std::vector<MapServer::ServerKeyFrame*> MapServer::DetectCandidates(ServerKeyFrame* pKF)
+{
+    const int nMaxCandidates = 3;
+    mnQuery++;
+
+    // Keyframes of the other agents sharing words with the query
+    std::vector<ServerKeyFrame*> vpSharing;
+    for(DBoW2::BowVector::const_iterator vit=pKF->mBowVec.begin(), vend=pKF->mBowVec.end(); vit!=vend; vit++)
+    {
+        const std::vector<ServerKeyFrame*> &vpKFs = mvInvertedFile[vit->first];
+        for(size_t i=0; i<vpKFs.size(); i++)
+        {
+            ServerKeyFrame* pKFi = vpKFs[i];
+            if(pKFi->msg.nAgentId==pKF->msg.nAgentId)
+                continue;
+
+            if(pKFi->mnQuery!=mnQuery)
+            {
+                pKFi->mnQuery = mnQuery;
+                pKFi->mnWords = 0;
+                vpSharing.push_back(pKFi);
+            }
+            pKFi->mnWords++;
+        }
+    }
+
+    if(vpSharing.empty())
+        return std::vector<ServerKeyFrame*>();
+
+    // As KeyFrameDatabase, only the keyframes sharing at least 80% of the words of the best one are scored
+    int nMaxWords = 0;
+    for(size_t i=0; i<vpSharing.size(); i++)
+        nMaxWords = std::max(nMaxWords, vpSharing[i]->mnWords);
+    const int nMinWords = 0.8f*nMaxWords;
+
+    std::vector<std::pair<float,ServerKeyFrame*> > vScoreAndKF;
+    for(size_t i=0; i<vpSharing.size(); i++)
+    {
+        ServerKeyFrame* pKFi = vpSharing[i];
+        if(pKFi->mnWords<nMinWords || IsAligned(pKF->msg.nAgentId, pKF->msg.nMapId, pKFi->msg.nAgentId, pKFi->msg.nMapId))
+            continue;
+        vScoreAndKF.push_back(std::make_pair(static_cast<float>(mpVocabulary->score(pKF->mBowVec, pKFi->mBowVec)), pKFi));
+    }
+
+    std::sort(vScoreAndKF.begin(), vScoreAndKF.end(),
+              [](const std::pair<float,ServerKeyFrame*> &a, const std::pair<float,ServerKeyFrame*> &b){ return a.first>b.first; });
+
+    std::vector<ServerKeyFrame*> vpCandidates;
+    for(size_t i=0; i<vScoreAndKF.size() && static_cast<int>(vpCandidates.size())<nMaxCandidates; i++)
+        vpCandidates.push_back(vScoreAndKF[i].second);
+
+    return vpCandidates;
+}
+
+bool MapServer::ComputeAlignment(ServerKeyFrame* pKF1, ServerKeyFrame* pKF2, Alignment &alignment)
+{
+    const KeyFrameMessage &msg1 = pKF1->msg;
+    const KeyFrameMessage &msg2 = pKF2->msg;
+
+    // Matches between keypoints with map points in the same vocabulary node, as ORBmatcher::SearchByBoW
+    std::vector<int> vMatches12(msg1.vKeysUn.size(), -1);
+    std::vector<int> vMatchedDist2(msg2.vKeysUn.size(), 256);
+    std::vector<int> vMatched21(msg2.vKeysUn.size(), -1);
+    const float fRatio = 0.75f;
+
+    DBoW2::FeatureVector::const_iterator f1it = pKF1->mFeatVec.begin();
+    DBoW2::FeatureVector::const_iterator f2it = pKF2->mFeatVec.begin();
+    const DBoW2::FeatureVector::const_iterator f1end = pKF1->mFeatVec.end();
+    const DBoW2::FeatureVector::const_iterator f2end = pKF2->mFeatVec.end();
+    while(f1it!=f1end && f2it!=f2end)
+    {
+        if(f1it->first==f2it->first)
+        {
+            for(size_t i1=0; i1<f1it->second.size(); i1++)
+            {
+                const unsigned int idx1 = f1it->second[i1];
+                if(msg1.vPointIdx[idx1]<0)
+                    continue;
+
+                const cv::Mat d1 = msg1.descriptors.row(idx1);
+                int bestDist1 = 256, bestDist2 = 256, bestIdx2 = -1;
+                for(size_t i2=0; i2<f2it->second.size(); i2++)
+                {
+                    const unsigned int idx2 = f2it->second[i2];
+                    if(msg2.vPointIdx[idx2]<0)
+                        continue;
+
+                    const int dist = ORBmatcher::DescriptorDistance(d1, msg2.descriptors.row(idx2));
+                    if(dist<bestDist1)
+                    {
+                        bestDist2 = bestDist1;
+                        bestDist1 = dist;
+                        bestIdx2 = idx2;
+                    }
+                    else if(dist<bestDist2)
+                        bestDist2 = dist;
+                }
+
+                if(bestIdx2>=0 && bestDist1<=ORBmatcher::TH_LOW && bestDist1<fRatio*bestDist2 && bestDist1<vMatchedDist2[bestIdx2])
+                {
+                    if(vMatched21[bestIdx2]>=0)
+                        vMatches12[vMatched21[bestIdx2]] = -1;
+                    vMatches12[idx1] = bestIdx2;
+                    vMatched21[bestIdx2] = idx1;
+                    vMatchedDist2[bestIdx2] = bestDist1;
+                }
+            }
+            f1it++;
+            f2it++;
+        }
+        else if(f1it->first<f2it->first)
+            f1it = pKF1->mFeatVec.lower_bound(f2it->first);
+        else
+            f2it = pKF2->mFeatVec.lower_bound(f1it->first);
+    }
+
+    std::vector<int> vIdx1, vIdx2;
+    std::vector<float> vQuality;
+    for(size_t idx1=0; idx1<vMatches12.size(); idx1++)
+    {
+        if(vMatches12[idx1]<0)
+            continue;
+        vIdx1.push_back(idx1);
+        vIdx2.push_back(vMatches12[idx1]);
+        vQuality.push_back(vMatchedDist2[vMatches12[idx1]]);
+    }
+
+    const int N = vIdx1.size();
+    if(N<mnMinInliers)
+        return false;
+
+    // Current world points of the matches in each map, and the poses to check the reprojections
+    const std::unordered_map<unsigned long long, cv::Point3f> &mPoints1 = mmAgents[msg1.nAgentId].references.mPoints;
+    const std::unordered_map<unsigned long long, cv::Point3f> &mPoints2 = mmAgents[msg2.nAgentId].references.mPoints;
+    Eigen::Matrix3Xd P1(3,N), P2(3,N);
+    for(int i=0; i<N; i++)
+    {
+        const cv::Point3f &X1 = mPoints1.find(msg1.vPointIds[msg1.vPointIdx[vIdx1[i]]])->second;
+        const cv::Point3f &X2 = mPoints2.find(msg2.vPointIds[msg2.vPointIdx[vIdx2[i]]])->second;
+        P1.col(i) << X1.x, X1.y, X1.z;
+        P2.col(i) << X2.x, X2.y, X2.z;
+    }
+
+    Eigen::Matrix4d Tcw1, Tcw2;
+    for(int r=0; r<4; r++)
+        for(int c=0; c<4; c++)
+        {
+            Tcw1(r,c) = msg1.Tcw.at<float>(r,c);
+            Tcw2(r,c) = msg2.Tcw.at<float>(r,c);
+        }
+
+    // Reprojection error of X (world point of the map of msg) in msg, chi2 with 2 dof at 99%
+    auto isConsistent = [](const KeyFrameMessage &msg, const Eigen::Matrix4d &Tcw, const Eigen::Vector3d &X, const int idx)
+    {
+        const Eigen::Vector3d Xc = Tcw.topLeftCorner<3,3>()*X + Tcw.topRightCorner<3,1>();
+        if(Xc[2]<=0)
+            return false;
+        const cv::KeyPoint &kp = msg.vKeysUn[idx];
+        const double du = msg.fx*Xc[0]/Xc[2] + msg.cx - kp.pt.x;
+        const double dv = msg.fy*Xc[1]/Xc[2] + msg.cy - kp.pt.y;
+        const double sigma2 = pow(msg.fScaleFactor, 2*kp.octave);
+        return (du*du+dv*dv) < 9.21*sigma2;
+    };
+
+    std::vector<bool> vbInliers(N,false), vbBestInliers;
+    int nBestInliers = 0;
+    Eigen::Matrix4d bestS12 = Eigen::Matrix4d::Identity();
+
+    auto evaluate = [&](const Eigen::Matrix4d &S12, std::vector<bool> &vbIn)
+    {
+        const Eigen::Matrix4d S21 = S12.inverse();
+        int nIn = 0;
+        for(int i=0; i<N; i++)
+        {
+            const Eigen::Vector3d X21 = S12.topLeftCorner<3,3>()*P2.col(i) + S12.topRightCorner<3,1>();
+            const Eigen::Vector3d X12 = S21.topLeftCorner<3,3>()*P1.col(i) + S21.topRightCorner<3,1>();
+            vbIn[i] = isConsistent(msg1, Tcw1, X21, vIdx1[i]) && isConsistent(msg2, Tcw2, X12, vIdx2[i]);
+            if(vbIn[i])
+                nIn++;
+        }
+        return nIn;
+    };
+
+    const int nMaxIterations = 300;
+    RansacSampler sampler;
+    sampler.Configure(RansacSampler::PROSAC, false, vQuality, 3, nMaxIterations, static_cast<float>(mnMinInliers)/N, 50.f);
+
+    std::vector<size_t> vSample;
+    Eigen::Matrix3d Q1, Q2;
+    for(int it=0; it<nMaxIterations; it++)
+    {
+        sampler.Sample(vSample);
+        for(int j=0; j<3; j++)
+        {
+            Q1.col(j) = P1.col(vSample[j]);
+            Q2.col(j) = P2.col(vSample[j]);
+        }
+
+        const Eigen::Matrix4d S12 = Eigen::umeyama(Q2, Q1, true);
+        if(!S12.allFinite())
+            continue;
+
+        const int nInliers = evaluate(S12, vbInliers);
+        if(nInliers>nBestInliers)
+        {
+            nBestInliers = nInliers;
+            vbBestInliers = vbInliers;
+            bestS12 = S12;
+        }
+    }
+
+    if(nBestInliers<mnMinInliers)
+        return false;
+
+    // Refine with all the inliers
+    Eigen::Matrix3Xd I1(3,nBestInliers), I2(3,nBestInliers);
+    for(int i=0, j=0; i<N; i++)
+    {
+        if(vbBestInliers[i])
+        {
+            I1.col(j) = P1.col(i);
+            I2.col(j) = P2.col(i);
+            j++;
+        }
+    }
+    const Eigen::Matrix4d S12 = Eigen::umeyama(I2, I1, true);
+    if(S12.allFinite())
+    {
+        const int nInliers = evaluate(S12, vbInliers);
+        if(nInliers>=nBestInliers)
+        {
+            nBestInliers = nInliers;
+            bestS12 = S12;
+        }
+    }
+
+    if(nBestInliers<mnMinInliers)
+        return false;
+
+    const Eigen::Matrix3d sR = bestS12.topLeftCorner<3,3>();
+    const double s = std::cbrt(sR.determinant());
+
+    alignment.nAgent1 = msg1.nAgentId;
+    alignment.nMap1 = msg1.nMapId;
+    alignment.nAgent2 = msg2.nAgentId;
+    alignment.nMap2 = msg2.nMapId;
+    alignment.nInliers = nBestInliers;
+    alignment.s = s;
+    alignment.R.create(3,3,CV_32F);
+    alignment.t.create(3,1,CV_32F);
+    for(int r=0; r<3; r++)
+    {
+        for(int c=0; c<3; c++)
+            alignment.R.at<float>(r,c) = sR(r,c)/s;
+        alignment.t.at<float>(r) = bestS12(r,3);
+    }
+
+    return true;
+}
+
+bool MapServer::IsAligned(const unsigned int nAgent1, const unsigned long long nMap1, const unsigned int nAgent2, const unsigned long long nMap2)
+{
+    std::unique_lock<std::mutex> lock(mMutexAlignments);
+    for(size_t i=0; i<mvAlignments.size(); i++)
+    {
+        const Alignment &a = mvAlignments[i];
+        if((a.nAgent1==nAgent1 && a.nMap1==nMap1 && a.nAgent2==nAgent2 && a.nMap2==nMap2) ||
+           (a.nAgent1==nAgent2 && a.nMap1==nMap2 && a.nAgent2==nAgent1 && a.nMap2==nMap1))
+            return true;
+    }
+    return false;
+}
+
+void MapServer::Notify(const Alignment &alignment)
+{
+    // Each agent gets the Sim3 that maps the other map into its own
+    const float s21 = 1.f/alignment.s;
+    const cv::Mat R21 = alignment.R.t();
+    const cv::Mat t21 = -s21*R21*alignment.t;
+
+    for(size_t i=0; i<mvConnections.size(); i++)
+    {
+        const int nAgentId = mvConnections[i].nAgentId;
+        std::vector<char> buffer;
+        if(nAgentId==static_cast<int>(alignment.nAgent1))
+            KeyFrameWire::EncodeAlignment(alignment.nAgent1, alignment.nMap1, alignment.nAgent2, alignment.nMap2,
+                                          alignment.nInliers, alignment.s, alignment.R, alignment.t, buffer);
+        else if(nAgentId==static_cast<int>(alignment.nAgent2))
+            KeyFrameWire::EncodeAlignment(alignment.nAgent2, alignment.nMap2, alignment.nAgent1, alignment.nMap1,
+                                          alignment.nInliers, s21, R21, t21, buffer);
+        else
+            continue;
+
+        // A failed connection is closed on its next read
+        Send(mvConnections[i].socket, buffer);
+    }
+}
+
+std::vector<MapServer::Alignment> MapServer::GetAlignments()
+{
+    std::unique_lock<std::mutex> lock(mMutexAlignments);
+    return mvAlignments;
+}
+
+size_t MapServer::KeyFramesInServer()
+{
+    std::unique_lock<std::mutex> lock(mMutexAlignments);
+    return mnKeyFrames;
+}
+
+void MapServer::RequestFinish()
+{
+    std::unique_lock<std::mutex> lock(mMutexFinish);
+    mbFinishRequested = true;
+}
+
+bool MapServer::CheckFinish()
+{
+    std::unique_lock<std::mutex> lock(mMutexFinish);
+    return mbFinishRequested;
+}
+
+void MapServer::SetFinish()
+{
+    std::unique_lock<std::mutex> lock(mMutexFinish);
+    mbFinished = true;
+}
+
+bool MapServer::isFinished()
+{
+    std::unique_lock<std::mutex> lock(mMutexFinish);
+    return mbFinished;
+}
+
+} //namespace ORB_SLAM3
@@ -0,0 +1,285 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "MapStreamer.h"
+#include "Atlas.h"
+#include "Map.h"
+#include "KeyFrame.h"
+#include "MapPoint.h"
+#include "EpochManager.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <iostream>
+
+namespace ORB_SLAM3
+{
+
+MapStreamer::MapStreamer(Atlas* pAtlas, const int port, const float fps):
+    mpAtlas(pAtlas), mnPort(port), mfFPS(fps>0 ? fps : 10.f), mListenSocket(-1), mClientSocket(-1),
+    mbNewPose(false), mpSentMap(static_cast<Map*>(NULL)), mnSentChange(-1), mnSentKFs(0), mnSentMPs(0),
+    mbFinishRequested(false), mbFinished(false)
+{
+}
+
+void MapStreamer::Run()
+{
+    if(!Listen())
+    {
+        std::cerr << "Map stream: cannot listen on port " << mnPort << std::endl;
+        SetFinish();
+        return;
+    }
+
+    std::cout << "Map stream listening on port " << mnPort << std::endl;
+
+    // CollectUpdates walks map points and keyframes of the current map
+    EpochManager::ThreadRegistration epochRegistration;
+
+    while(!CheckFinish())
+    {
+        EpochManager::Quiescent();
+
+        if(mClientSocket<0)
+            AcceptClient();
+
+        if(mClientSocket>=0)
+        {
+            mvBuffer.clear();
+            CollectUpdates();
+            if(!mvBuffer.empty() && !Send(mvBuffer.data(), mvBuffer.size()))
+                CloseClient();
+        }
+
+        usleep(1e6/mfFPS);
+    }
+
+    CloseClient();
+    close(mListenSocket);
+    mListenSocket = -1;
+
+    SetFinish();
+}
+
+void MapStreamer::SetCurrentCameraPose(const cv::Mat &Tcw)
+{
+    unique_lock<mutex> lock(mMutexPose);
+    Tcw.copyTo(mCameraPose);
+    mbNewPose = true;
+}
+
+bool MapStreamer::Listen()
+{
+    mListenSocket = socket(AF_INET, SOCK_STREAM, 0);
+    if(mListenSocket<0)
+        return false;
+
+    int reuse = 1;
+    setsockopt(mListenSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(mnPort);
+
+    if(bind(mListenSocket, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))<0 || listen(mListenSocket, 1)<0)
+    {
+        close(mListenSocket);
+        mListenSocket = -1;
+        return false;
+    }
+
+    // accept() is polled from the stream loop
+    fcntl(mListenSocket, F_SETFL, fcntl(mListenSocket, F_GETFL, 0) | O_NONBLOCK);
+
+    return true;
+}
+
+void MapStreamer::AcceptClient()
+{
+    mClientSocket = accept(mListenSocket, NULL, NULL);
+    if(mClientSocket<0)
+        return;
+
+    // A new client gets everything
+    mpSentMap = static_cast<Map*>(NULL);
+    {
+        unique_lock<mutex> lock(mMutexPose);
+        mbNewPose = !mCameraPose.empty();
+    }
+    std::cout << "Map stream: client connected" << std::endl;
+}
+
+void MapStreamer::CloseClient()
+{
+    if(mClientSocket<0)
+        return;
+
+    close(mClientSocket);
+    mClientSocket = -1;
+    std::cout << "Map stream: client disconnected" << std::endl;
+}
+
+bool MapStreamer::Send(const char* data, size_t size)
+{
+    while(size>0)
+    {
+        const ssize_t n = send(mClientSocket, data, size, MSG_NOSIGNAL);
+        if(n<=0)
+            return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+size_t MapStreamer::AppendHeader(const char type, const unsigned int count)
+{
+    Append(type);
+    const size_t pos = mvBuffer.size();
+    Append(count);
+    return pos;
+}
+
+void MapStreamer::CollectUpdates()
+{
+    {
+        unique_lock<mutex> lock(mMutexPose);
+        if(mbNewPose)
+        {
+            AppendHeader('C', 1);
+            for(int r=0; r<3; r++)
+                for(int c=0; c<4; c++)
+                    Append(mCameraPose.at<float>(r,c));
+            mbNewPose = false;
+        }
+    }
+
+    Map* pMap = mpAtlas->GetCurrentMap();
+    if(pMap!=mpSentMap)
+    {
+        mpSentMap = pMap;
+        mnSentChange = -1;
+        mmSentKFPoses.clear();
+        mmSentMPPositions.clear();
+
+        AppendHeader('M', 1);
+        Append(static_cast<unsigned long long>(pMap->GetId()));
+    }
+
+    // Points and keyframes only move on map changes (BA, loop closure) or when they are created
+    const int nChange = pMap->GetMapChangeIndex();
+    const long unsigned int nKFs = pMap->KeyFramesInMap();
+    const long unsigned int nMPs = pMap->MapPointsInMap();
+    if(nChange==mnSentChange && nKFs==mnSentKFs && nMPs==mnSentMPs)
+        return;
+
+    mnSentChange = nChange;
+    mnSentKFs = nKFs;
+    mnSentMPs = nMPs;
+
+    const Map::KeyFramesSnapshot pKFs = pMap->GetKeyFramesSnapshot();
+    const vector<KeyFrame*> &vpKFs = *pKFs;
+    size_t posCount = AppendHeader('K', 0);
+    unsigned int nSent = 0;
+    for(size_t i=0; i<vpKFs.size(); i++)
+    {
+        KeyFrame* pKF = vpKFs[i];
+        if(pKF->isBad())
+            continue;
+
+        const cv::Mat Tcw = pKF->GetPose();
+        std::array<float,12> pose;
+        for(int r=0; r<3; r++)
+            for(int c=0; c<4; c++)
+                pose[4*r+c] = Tcw.at<float>(r,c);
+
+        std::unordered_map<long unsigned int, std::array<float,12> >::iterator it = mmSentKFPoses.find(pKF->mnId);
+        if(it!=mmSentKFPoses.end() && it->second==pose)
+            continue;
+        mmSentKFPoses[pKF->mnId] = pose;
+
+        Append(static_cast<unsigned long long>(pKF->mnId));
+        for(int j=0; j<12; j++)
+            Append(pose[j]);
+        nSent++;
+    }
+    if(nSent>0)
+        memcpy(&mvBuffer[posCount], &nSent, sizeof(nSent));
+    else
+        mvBuffer.resize(posCount-1);
+
+    const Map::MapPointsSnapshot pMPs = pMap->GetMapPointsSnapshot();
+    const vector<MapPoint*> &vpMPs = *pMPs;
+    posCount = AppendHeader('P', 0);
+    nSent = 0;
+    for(size_t i=0; i<vpMPs.size(); i++)
+    {
+        MapPoint* pMP = vpMPs[i];
+        if(pMP->isBad())
+            continue;
+
+        const cv::Mat Xw = pMP->GetWorldPos();
+        const std::array<float,3> pos = {{Xw.at<float>(0), Xw.at<float>(1), Xw.at<float>(2)}};
+
+        std::unordered_map<long unsigned int, std::array<float,3> >::iterator it = mmSentMPPositions.find(pMP->mnId);
+        if(it!=mmSentMPPositions.end() && it->second==pos)
+            continue;
+        mmSentMPPositions[pMP->mnId] = pos;
+
+        Append(static_cast<unsigned long long>(pMP->mnId));
+        for(int j=0; j<3; j++)
+            Append(pos[j]);
+        nSent++;
+    }
+    if(nSent>0)
+        memcpy(&mvBuffer[posCount], &nSent, sizeof(nSent));
+    else
+        mvBuffer.resize(posCount-1);
+}
+
+void MapStreamer::RequestFinish()
+{
+    unique_lock<mutex> lock(mMutexFinish);
+    mbFinishRequested = true;
+}
+
+bool MapStreamer::CheckFinish()
+{
+    unique_lock<mutex> lock(mMutexFinish);
+    return mbFinishRequested;
+}
+
+void MapStreamer::SetFinish()
+{
+    unique_lock<mutex> lock(mMutexFinish);
+    mbFinished = true;
+}
+
+bool MapStreamer::isFinished()
+{
+    unique_lock<mutex> lock(mMutexFinish);
+    return mbFinished;
+}
+
+} //namespace ORB_SLAM3
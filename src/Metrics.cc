@@ -0,0 +1,416 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Metrics.h"
+
+#include <cmath>
+#include <algorithm>
+#include <sstream>
+#include <climits>
+
+namespace ORB_SLAM3
+{
+
+static const double MIN_BUCKET_MS = 1e-3;
+static const int BUCKETS_PER_OCTAVE = 4;
+
+static void AtomicMax(std::atomic<unsigned long long> &a, const unsigned long long v)
+{
+    unsigned long long cur = a.load(std::memory_order_relaxed);
+    while(v > cur && !a.compare_exchange_weak(cur, v, std::memory_order_relaxed));
+}
+
+LatencyHistogram::LatencyHistogram()
+{
+    Reset();
+}
+
+double LatencyHistogram::BucketBound(const int i)
+{
+    return MIN_BUCKET_MS*std::pow(2.0, double(i)/BUCKETS_PER_OCTAVE);
+}
+
+void LatencyHistogram::Record(const double ms)
+{
+    int b = 0;
+    if(ms > MIN_BUCKET_MS)
+        b = std::min(NUM_BUCKETS-1, (int)std::ceil(BUCKETS_PER_OCTAVE*std::log2(ms/MIN_BUCKET_MS)));
+
+    const unsigned long long ns = ms > 0 ? (unsigned long long)(ms*1e6) : 0;
+    mvBuckets[b].fetch_add(1, std::memory_order_relaxed);
+    mnCount.fetch_add(1, std::memory_order_relaxed);
+    mnSumNs.fetch_add(ns, std::memory_order_relaxed);
+    AtomicMax(mnMaxNs, ns);
+}
+
+void LatencyHistogram::Reset()
+{
+    for(int i=0; i<NUM_BUCKETS; i++)
+        mvBuckets[i].store(0, std::memory_order_relaxed);
+    mnCount.store(0, std::memory_order_relaxed);
+    mnSumNs.store(0, std::memory_order_relaxed);
+    mnMaxNs.store(0, std::memory_order_relaxed);
+}
+
+unsigned long LatencyHistogram::Count() const
+{
+    return mnCount.load(std::memory_order_relaxed);
+}
+
+double LatencyHistogram::Sum() const
+{
+    return mnSumNs.load(std::memory_order_relaxed)*1e-6;
+}
+
+double LatencyHistogram::Max() const
+{
+    return mnMaxNs.load(std::memory_order_relaxed)*1e-6;
+}
+
+double LatencyHistogram::Percentile(const double q) const
+{
+    // Buckets are read one by one while other threads may be recording, so the total is
+    // taken from the buckets themselves
+    unsigned long vCounts[NUM_BUCKETS];
+    unsigned long nTotal = 0;
+    for(int i=0; i<NUM_BUCKETS; i++)
+    {
+        vCounts[i] = mvBuckets[i].load(std::memory_order_relaxed);
+        nTotal += vCounts[i];
+    }
+    if(nTotal == 0)
+        return 0.0;
+
+    const double rank = std::max(1.0, std::ceil(q*nTotal));
+    unsigned long nAcc = 0;
+    for(int i=0; i<NUM_BUCKETS; i++)
+    {
+        nAcc += vCounts[i];
+        if(nAcc >= rank)
+            return std::min(BucketBound(i), Max());
+    }
+    return Max();
+}
+
+static void ClearFrame(Metrics::FrameTelemetry &f, const unsigned long frameId)
+{
+    f.frameId = frameId;
+    f.timestamp = 0.0;
+    f.tInput = -1.0;
+    f.tExtracted = -1.0;
+    f.tTracked = -1.0;
+    f.bKeyFrame = false;
+    f.tKeyFrameInserted = -1.0;
+    f.tMapUpdated = -1.0;
+    f.captureToPose = -1.0;
+    f.mapAge = -1.0;
+    f.localMappingQueue = 0;
+}
+
+static long long SteadyNs(const Metrics::Clock::time_point &t)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+}
+
+Metrics::Metrics(): mtStart(Clock::now()), mbSystemClockTimestamps(false), mnLastMapUpdateNs(0), mvFrames(FRAME_HISTORY)
+{
+    for(int i=0; i<NUM_GAUGES; i++)
+        mvGauges[i].store(0.0, std::memory_order_relaxed);
+    for(int i=0; i<FRAME_HISTORY; i++)
+        ClearFrame(mvFrames[i], ULONG_MAX);
+}
+
+double Metrics::ElapsedMs(const Clock::time_point &t) const
+{
+    return std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(t - mtStart).count();
+}
+
+const char* Metrics::StageName(const Stage stage)
+{
+    static const char* vNames[NUM_STAGES] = {
+        "orb_extraction", "stereo_match", "pose_prediction", "track_local_map", "pose_optimization",
+        "new_keyframe", "track_total", "keyframe_processing", "local_ba", "local_mapping_total",
+        "loop_detection", "loop_correction", "map_merge", "input_to_pose", "capture_to_pose", "pose_to_map_update",
+        "map_age"};
+    return vNames[stage];
+}
+
+const char* Metrics::GaugeName(const Gauge gauge)
+{
+    static const char* vNames[NUM_GAUGES] = {
+        "local_mapping_queue", "loop_closing_queue", "tracked_map_points", "tracking_degradations",
+        "memory_keyframes_bytes", "memory_keyframe_features_bytes", "memory_imu_preintegration_bytes",
+        "memory_map_points_bytes", "memory_map_point_descriptors_bytes", "memory_keyframe_database_bytes",
+        "memory_vocabulary_bytes", "memory_vocabulary_mapped_bytes", "memory_total_bytes",
+        "frame_cpu_time_ms", "power_level", "pose_optimization_iterations", "local_ba_iterations",
+        "essential_graph_iterations"};
+    return vNames[gauge];
+}
+
+void Metrics::SetMemoryUsage(const MemoryUsage &usage)
+{
+    SetGauge(MEMORY_KEYFRAMES, usage.nKeyFrames);
+    SetGauge(MEMORY_KEYFRAME_FEATURES, usage.nKeyFrameFeatures);
+    SetGauge(MEMORY_IMU_PREINTEGRATION, usage.nImuPreintegration);
+    SetGauge(MEMORY_MAP_POINTS, usage.nMapPoints);
+    SetGauge(MEMORY_MAP_POINT_DESCRIPTORS, usage.nMapPointDescriptors);
+    SetGauge(MEMORY_KEYFRAME_DATABASE, usage.nKeyFrameDatabase);
+    SetGauge(MEMORY_VOCABULARY, usage.nVocabulary);
+    SetGauge(MEMORY_VOCABULARY_MAPPED, usage.nVocabularyMapped);
+    SetGauge(MEMORY_TOTAL, usage.Total());
+}
+
+void Metrics::SetSystemClockTimestamps(const bool bSystemClock)
+{
+    mbSystemClockTimestamps.store(bSystemClock, std::memory_order_relaxed);
+}
+
+void Metrics::RecordFrameTracked(const unsigned long frameId, const double timestamp, const Clock::time_point &tInput,
+                                 const Clock::time_point &tExtracted, const bool bKeyFrame)
+{
+    const Clock::time_point tNow = Clock::now();
+
+    FrameTelemetry f;
+    ClearFrame(f, frameId);
+    f.timestamp = timestamp;
+    if(tInput != Clock::time_point())
+        f.tInput = ElapsedMs(tInput);
+    if(tExtracted != Clock::time_point())
+        f.tExtracted = ElapsedMs(tExtracted);
+    f.tTracked = ElapsedMs(tNow);
+    f.bKeyFrame = bKeyFrame;
+    f.localMappingQueue = static_cast<int>(GetGauge(LOCAL_MAPPING_QUEUE));
+
+    if(f.tInput >= 0)
+        Record(INPUT_TO_POSE, f.tTracked - f.tInput);
+
+    if(mbSystemClockTimestamps.load(std::memory_order_relaxed))
+    {
+        const double now = std::chrono::duration_cast<std::chrono::duration<double> >(
+                    std::chrono::system_clock::now().time_since_epoch()).count();
+        f.captureToPose = 1000.0*(now - timestamp);
+        Record(CAPTURE_TO_POSE, f.captureToPose);
+    }
+
+    const long long lastUpdateNs = mnLastMapUpdateNs.load(std::memory_order_relaxed);
+    if(lastUpdateNs > 0)
+    {
+        f.mapAge = std::max(0LL, SteadyNs(tNow) - lastUpdateNs)*1e-6;
+        Record(MAP_AGE, f.mapAge);
+    }
+
+    std::unique_lock<std::mutex> lock(mMutexFrames);
+    FrameTelemetry &slot = mvFrames[frameId % FRAME_HISTORY];
+    // Local Mapping may take the keyframe before the tracking of its frame is recorded
+    if(slot.frameId == frameId)
+    {
+        f.tKeyFrameInserted = slot.tKeyFrameInserted;
+        f.tMapUpdated = slot.tMapUpdated;
+        if(f.tMapUpdated >= 0)
+            Record(POSE_TO_MAP_UPDATE, f.tMapUpdated - f.tTracked);
+    }
+    slot = f;
+}
+
+void Metrics::RecordKeyFrameInserted(const unsigned long frameId)
+{
+    const double t = ElapsedMs(Clock::now());
+
+    std::unique_lock<std::mutex> lock(mMutexFrames);
+    FrameTelemetry &slot = mvFrames[frameId % FRAME_HISTORY];
+    if(slot.frameId != frameId)
+        ClearFrame(slot, frameId);
+    slot.tKeyFrameInserted = t;
+}
+
+void Metrics::RecordMapUpdated(const unsigned long frameId)
+{
+    const Clock::time_point tNow = Clock::now();
+    mnLastMapUpdateNs.store(SteadyNs(tNow), std::memory_order_relaxed);
+
+    std::unique_lock<std::mutex> lock(mMutexFrames);
+    FrameTelemetry &slot = mvFrames[frameId % FRAME_HISTORY];
+    if(slot.frameId != frameId)
+        ClearFrame(slot, frameId);
+    slot.tMapUpdated = ElapsedMs(tNow);
+    if(slot.tTracked >= 0)
+        Record(POSE_TO_MAP_UPDATE, slot.tMapUpdated - slot.tTracked);
+}
+
+std::vector<Metrics::FrameTelemetry> Metrics::GetFrameTelemetry() const
+{
+    std::vector<FrameTelemetry> vFrames;
+    {
+        std::unique_lock<std::mutex> lock(mMutexFrames);
+        for(int i=0; i<FRAME_HISTORY; i++)
+            if(mvFrames[i].tTracked >= 0)
+                vFrames.push_back(mvFrames[i]);
+    }
+
+    std::sort(vFrames.begin(), vFrames.end(), [](const FrameTelemetry &a, const FrameTelemetry &b){
+        return a.frameId < b.frameId;
+    });
+    return vFrames;
+}
+
+std::vector<Metrics::StageSnapshot> Metrics::GetStageSnapshots() const
+{
+    std::vector<StageSnapshot> vSnapshots(NUM_STAGES);
+    for(int i=0; i<NUM_STAGES; i++)
+    {
+        const LatencyHistogram &h = mvStages[i];
+        StageSnapshot &s = vSnapshots[i];
+        s.name = StageName(static_cast<Stage>(i));
+        s.count = h.Count();
+        s.sum = h.Sum();
+        s.p50 = h.Percentile(0.5);
+        s.p90 = h.Percentile(0.9);
+        s.p99 = h.Percentile(0.99);
+        s.max = h.Max();
+    }
+    return vSnapshots;
+}
+
+std::vector<LockProfiler::LockSnapshot> Metrics::GetLockSnapshots() const
+{
+#ifdef ORB_SLAM3_LOCK_PROFILING
+    return LockProfiler::GetSnapshots();
+#else
+    return std::vector<LockProfiler::LockSnapshot>();
+#endif
+}
+
+std::vector<AllocationProfiler::SpanSnapshot> Metrics::GetAllocationSnapshots() const
+{
+#ifdef ORB_SLAM3_ALLOC_PROFILING
+    return AllocationProfiler::GetSpanSnapshots();
+#else
+    return std::vector<AllocationProfiler::SpanSnapshot>();
+#endif
+}
+
+std::vector<AllocationProfiler::ThreadSnapshot> Metrics::GetThreadAllocationSnapshots() const
+{
+#ifdef ORB_SLAM3_ALLOC_PROFILING
+    return AllocationProfiler::GetThreadSnapshots();
+#else
+    return std::vector<AllocationProfiler::ThreadSnapshot>();
+#endif
+}
+
+std::string Metrics::ExportPrometheus() const
+{
+    std::ostringstream os;
+    os << "# HELP orbslam3_stage_latency_ms Latency of the SLAM pipeline stages in milliseconds\n";
+    os << "# TYPE orbslam3_stage_latency_ms summary\n";
+
+    const std::vector<StageSnapshot> vSnapshots = GetStageSnapshots();
+    for(size_t i=0; i<vSnapshots.size(); i++)
+    {
+        const StageSnapshot &s = vSnapshots[i];
+        os << "orbslam3_stage_latency_ms{stage=\"" << s.name << "\",quantile=\"0.5\"} " << s.p50 << "\n";
+        os << "orbslam3_stage_latency_ms{stage=\"" << s.name << "\",quantile=\"0.9\"} " << s.p90 << "\n";
+        os << "orbslam3_stage_latency_ms{stage=\"" << s.name << "\",quantile=\"0.99\"} " << s.p99 << "\n";
+        os << "orbslam3_stage_latency_ms_sum{stage=\"" << s.name << "\"} " << s.sum << "\n";
+        os << "orbslam3_stage_latency_ms_count{stage=\"" << s.name << "\"} " << s.count << "\n";
+    }
+
+    for(int i=0; i<NUM_GAUGES; i++)
+    {
+        const std::string name = std::string("orbslam3_") + GaugeName(static_cast<Gauge>(i));
+        os << "# TYPE " << name << " gauge\n";
+        os << name << " " << GetGauge(static_cast<Gauge>(i)) << "\n";
+    }
+
+    const std::vector<LockProfiler::LockSnapshot> vLocks = GetLockSnapshots();
+    if(!vLocks.empty())
+    {
+        os << "# HELP orbslam3_lock_wait_ms Time blocked on the contended acquisitions of the core locks\n";
+        os << "# TYPE orbslam3_lock_wait_ms summary\n";
+        for(size_t i=0; i<vLocks.size(); i++)
+        {
+            const LockProfiler::LockSnapshot &l = vLocks[i];
+            os << "orbslam3_lock_wait_ms{lock=\"" << l.name << "\",quantile=\"0.5\"} " << l.waitP50 << "\n";
+            os << "orbslam3_lock_wait_ms{lock=\"" << l.name << "\",quantile=\"0.9\"} " << l.waitP90 << "\n";
+            os << "orbslam3_lock_wait_ms{lock=\"" << l.name << "\",quantile=\"0.99\"} " << l.waitP99 << "\n";
+            os << "orbslam3_lock_wait_ms_sum{lock=\"" << l.name << "\"} " << l.waitSum << "\n";
+            os << "orbslam3_lock_wait_ms_count{lock=\"" << l.name << "\"} " << l.contended << "\n";
+        }
+        os << "# TYPE orbslam3_lock_hold_ms_sum counter\n";
+        for(size_t i=0; i<vLocks.size(); i++)
+            os << "orbslam3_lock_hold_ms_sum{lock=\"" << vLocks[i].name << "\"} " << vLocks[i].holdSum << "\n";
+        os << "# TYPE orbslam3_lock_acquisitions counter\n";
+        for(size_t i=0; i<vLocks.size(); i++)
+            os << "orbslam3_lock_acquisitions{lock=\"" << vLocks[i].name << "\"} " << vLocks[i].acquisitions << "\n";
+        os << "# HELP orbslam3_lock_wait_by_holder_ms Time waited on the core locks by the thread that held them\n";
+        os << "# TYPE orbslam3_lock_wait_by_holder_ms counter\n";
+        for(size_t i=0; i<vLocks.size(); i++)
+            for(size_t j=0; j<vLocks[i].vHolders.size(); j++)
+                os << "orbslam3_lock_wait_by_holder_ms{lock=\"" << vLocks[i].name << "\",holder=\""
+                   << vLocks[i].vHolders[j].thread << "\"} " << vLocks[i].vHolders[j].wait << "\n";
+    }
+
+    const std::vector<AllocationProfiler::SpanSnapshot> vSpans = GetAllocationSnapshots();
+    if(!vSpans.empty())
+    {
+        os << "# HELP orbslam3_span_allocations Heap allocations (operator new) done in the tracing spans\n";
+        os << "# TYPE orbslam3_span_allocations summary\n";
+        for(size_t i=0; i<vSpans.size(); i++)
+        {
+            const AllocationProfiler::SpanSnapshot &a = vSpans[i];
+            os << "orbslam3_span_allocations_sum{span=\"" << a.name << "\",thread=\"" << a.thread << "\"} " << a.allocations << "\n";
+            os << "orbslam3_span_allocations_count{span=\"" << a.name << "\",thread=\"" << a.thread << "\"} " << a.count << "\n";
+        }
+        os << "# TYPE orbslam3_span_allocated_bytes counter\n";
+        for(size_t i=0; i<vSpans.size(); i++)
+            os << "orbslam3_span_allocated_bytes{span=\"" << vSpans[i].name << "\",thread=\"" << vSpans[i].thread << "\"} " << vSpans[i].bytes << "\n";
+        os << "# TYPE orbslam3_span_allocations_max gauge\n";
+        for(size_t i=0; i<vSpans.size(); i++)
+            os << "orbslam3_span_allocations_max{span=\"" << vSpans[i].name << "\",thread=\"" << vSpans[i].thread << "\"} " << vSpans[i].maxAllocations << "\n";
+
+        const std::vector<AllocationProfiler::ThreadSnapshot> vThreads = GetThreadAllocationSnapshots();
+        os << "# HELP orbslam3_thread_allocations Heap allocations of the SLAM threads\n";
+        os << "# TYPE orbslam3_thread_allocations counter\n";
+        for(size_t i=0; i<vThreads.size(); i++)
+            os << "orbslam3_thread_allocations{thread=\"" << vThreads[i].thread << "\"} " << vThreads[i].allocations << "\n";
+        os << "# TYPE orbslam3_thread_allocated_bytes counter\n";
+        for(size_t i=0; i<vThreads.size(); i++)
+            os << "orbslam3_thread_allocated_bytes{thread=\"" << vThreads[i].thread << "\"} " << vThreads[i].bytes << "\n";
+    }
+
+    return os.str();
+}
+
+void Metrics::Reset()
+{
+    for(int i=0; i<NUM_STAGES; i++)
+        mvStages[i].Reset();
+    {
+        std::unique_lock<std::mutex> lock(mMutexFrames);
+        for(int i=0; i<FRAME_HISTORY; i++)
+            ClearFrame(mvFrames[i], ULONG_MAX);
+    }
+#ifdef ORB_SLAM3_LOCK_PROFILING
+    LockProfiler::Reset();
+#endif
+#ifdef ORB_SLAM3_ALLOC_PROFILING
+    AllocationProfiler::Reset();
+#endif
+}
+
+} //namespace ORB_SLAM
@@ -59,6 +59,10 @@
 #include <iostream>
 
 #include "ORBextractor.h"
+#include "ThreadPool.h"
+#include "FastDetector.h"
+#include "OrbDescriptor.h"
+#include "PyramidBuilder.h"
 
 
 using namespace cv;
@@ -72,79 +76,6 @@ namespace ORB_SLAM3
     const int EDGE_THRESHOLD = 19;
 
 
-    static float IC_Angle(const Mat& image, Point2f pt,  const vector<int> & u_max)
-    {
-        int m_01 = 0, m_10 = 0;
-
-        const uchar* center = &image.at<uchar> (cvRound(pt.y), cvRound(pt.x));
-
-        // Treat the center line differently, v=0
-        for (int u = -HALF_PATCH_SIZE; u <= HALF_PATCH_SIZE; ++u)
-            m_10 += u * center[u];
-
-        // Go line by line in the circuI853lar patch
-        int step = (int)image.step1();
-        for (int v = 1; v <= HALF_PATCH_SIZE; ++v)
-        {
-            // Proceed over the two lines
-            int v_sum = 0;
-            int d = u_max[v];
-            for (int u = -d; u <= d; ++u)
-            {
-                int val_plus = center[u + v*step], val_minus = center[u - v*step];
-                v_sum += (val_plus - val_minus);
-                m_10 += u * (val_plus + val_minus);
-            }
-            m_01 += v * v_sum;
-        }
-
-        return fastAtan2((float)m_01, (float)m_10);
-    }
-
-
-    const float factorPI = (float)(CV_PI/180.f);
-    static void computeOrbDescriptor(const KeyPoint& kpt,
-                                     const Mat& img, const Point* pattern,
-                                     uchar* desc)
-    {
-        float angle = (float)kpt.angle*factorPI;
-        float a = (float)cos(angle), b = (float)sin(angle);
-
-        const uchar* center = &img.at<uchar>(cvRound(kpt.pt.y), cvRound(kpt.pt.x));
-        const int step = (int)img.step;
-
-#define GET_VALUE(idx) \
-        center[cvRound(pattern[idx].x*b + pattern[idx].y*a)*step + \
-               cvRound(pattern[idx].x*a - pattern[idx].y*b)]
-
-
-        for (int i = 0; i < 32; ++i, pattern += 16)
-        {
-            int t0, t1, val;
-            t0 = GET_VALUE(0); t1 = GET_VALUE(1);
-            val = t0 < t1;
-            t0 = GET_VALUE(2); t1 = GET_VALUE(3);
-            val |= (t0 < t1) << 1;
-            t0 = GET_VALUE(4); t1 = GET_VALUE(5);
-            val |= (t0 < t1) << 2;
-            t0 = GET_VALUE(6); t1 = GET_VALUE(7);
-            val |= (t0 < t1) << 3;
-            t0 = GET_VALUE(8); t1 = GET_VALUE(9);
-            val |= (t0 < t1) << 4;
-            t0 = GET_VALUE(10); t1 = GET_VALUE(11);
-            val |= (t0 < t1) << 5;
-            t0 = GET_VALUE(12); t1 = GET_VALUE(13);
-            val |= (t0 < t1) << 6;
-            t0 = GET_VALUE(14); t1 = GET_VALUE(15);
-            val |= (t0 < t1) << 7;
-
-            desc[i] = (uchar)val;
-        }
-
-#undef GET_VALUE
-    }
-
-
     static int bit_pattern_31_[256*4] =
             {
                     8,-3, 9,5/*mean (0), correlation (0)*/,
@@ -408,7 +339,8 @@ namespace ORB_SLAM3
     ORBextractor::ORBextractor(int _nfeatures, float _scaleFactor, int _nlevels,
                                int _iniThFAST, int _minThFAST):
             nfeatures(_nfeatures), scaleFactor(_scaleFactor), nlevels(_nlevels),
-            iniThFAST(_iniThFAST), minThFAST(_minThFAST)
+            iniThFAST(_iniThFAST), minThFAST(_minThFAST), mnActiveLevels(_nlevels), mnFirstLevel(0),
+            mnFocusCellSize(0), mfFocusCoverage(0.f), mnFocusPhase(0), mpThreadPool(NULL), mbParallelLevels(false), mpRowSource(NULL)
     {
         mvScaleFactor.resize(nlevels);
         mvLevelSigma2.resize(nlevels);
@@ -429,19 +361,12 @@ namespace ORB_SLAM3
         }
 
         mvImagePyramid.resize(nlevels);
+        mvPyramidBuffers.resize(nlevels);
+        mvBlurBuffers.resize(nlevels);
+        mvvAllKeypoints.resize(nlevels);
+        mvvOutputRows.resize(nlevels);
 
-        mnFeaturesPerLevel.resize(nlevels);
-        float factor = 1.0f / scaleFactor;
-        float nDesiredFeaturesPerScale = nfeatures*(1 - factor)/(1 - (float)pow((double)factor, (double)nlevels));
-
-        int sumFeatures = 0;
-        for( int level = 0; level < nlevels-1; level++ )
-        {
-            mnFeaturesPerLevel[level] = cvRound(nDesiredFeaturesPerScale);
-            sumFeatures += mnFeaturesPerLevel[level];
-            nDesiredFeaturesPerScale *= factor;
-        }
-        mnFeaturesPerLevel[nlevels-1] = std::max(nfeatures - sumFeatures, 0);
+        ComputeFeaturesPerLevel();
 
         const int npoints = 512;
         const Point* pattern0 = (const Point*)bit_pattern_31_;
@@ -465,18 +390,39 @@ namespace ORB_SLAM3
             umax[v] = v0;
             ++v0;
         }
+
+        mOrbDescriptor.Init(pattern, umax);
     }
 
-    static void computeOrientation(const Mat& image, vector<KeyPoint>& keypoints, const vector<int>& umax)
+    void ORBextractor::ComputeFeaturesPerLevel()
     {
-        for (vector<KeyPoint>::iterator keypoint = keypoints.begin(),
-                     keypointEnd = keypoints.end(); keypoint != keypointEnd; ++keypoint)
+        mnFeaturesPerLevel.assign(nlevels, 0);
+        float factor = 1.0f / scaleFactor;
+        float nDesiredFeaturesPerScale = nfeatures*(1 - factor)/(1 - (float)pow((double)factor, (double)mnActiveLevels));
+
+        int sumFeatures = 0;
+        for( int level = 0; level < mnActiveLevels-1; level++ )
         {
-            keypoint->angle = IC_Angle(image, keypoint->pt, umax);
+            mnFeaturesPerLevel[level] = cvRound(nDesiredFeaturesPerScale);
+            sumFeatures += mnFeaturesPerLevel[level];
+            nDesiredFeaturesPerScale *= factor;
         }
+        mnFeaturesPerLevel[mnActiveLevels-1] = std::max(nfeatures - sumFeatures, 0);
     }
 
-    void ExtractorNode::DivideNode(ExtractorNode &n1, ExtractorNode &n2, ExtractorNode &n3, ExtractorNode &n4)
+    void ORBextractor::SetFeatureBudget(const int nFeatures, const int nLevels)
+    {
+        const int nActiveLevels = std::min(std::max(nLevels, 1), nlevels);
+        if(nFeatures == nfeatures && nActiveLevels == mnActiveLevels)
+            return;
+
+        nfeatures = std::max(nFeatures, 0);
+        mnActiveLevels = nActiveLevels;
+        ComputeFeaturesPerLevel();
+    }
+
+    void ExtractorNode::DivideNode(ExtractorNode &n1, ExtractorNode &n2, ExtractorNode &n3, ExtractorNode &n4,
+                                   const vector<cv::KeyPoint> &vKeys, vector<int> &vIndices, vector<int> &vScratch) const
     {
         const int halfX = ceil(static_cast<float>(UR.x-UL.x)/2);
         const int halfY = ceil(static_cast<float>(BR.y-UL.y)/2);
@@ -486,52 +432,50 @@ namespace ORB_SLAM3
         n1.UR = cv::Point2i(UL.x+halfX,UL.y);
         n1.BL = cv::Point2i(UL.x,UL.y+halfY);
         n1.BR = cv::Point2i(UL.x+halfX,UL.y+halfY);
-        n1.vKeys.reserve(vKeys.size());
 
         n2.UL = n1.UR;
         n2.UR = UR;
         n2.BL = n1.BR;
         n2.BR = cv::Point2i(UR.x,UL.y+halfY);
-        n2.vKeys.reserve(vKeys.size());
 
         n3.UL = n1.BL;
         n3.UR = n1.BR;
         n3.BL = BL;
         n3.BR = cv::Point2i(n1.BR.x,BL.y);
-        n3.vKeys.reserve(vKeys.size());
 
         n4.UL = n3.UR;
         n4.UR = n2.BR;
         n4.BL = n3.BR;
         n4.BR = BR;
-        n4.vKeys.reserve(vKeys.size());
 
-        //Associate points to childs
-        for(size_t i=0;i<vKeys.size();i++)
+        //Associate points to childs (stable partition of the range in four)
+        int vCount[4] = {0,0,0,0};
+        for(int i=nBegin; i<nEnd; i++)
         {
-            const cv::KeyPoint &kp = vKeys[i];
-            if(kp.pt.x<n1.UR.x)
-            {
-                if(kp.pt.y<n1.BR.y)
-                    n1.vKeys.push_back(kp);
-                else
-                    n3.vKeys.push_back(kp);
-            }
-            else if(kp.pt.y<n1.BR.y)
-                n2.vKeys.push_back(kp);
-            else
-                n4.vKeys.push_back(kp);
+            const cv::KeyPoint &kp = vKeys[vIndices[i]];
+            const int child = (kp.pt.x<n1.UR.x) ? ((kp.pt.y<n1.BR.y) ? 0 : 2) : ((kp.pt.y<n1.BR.y) ? 1 : 3);
+            vScratch[i] = child;
+            vCount[child]++;
         }
 
-        if(n1.vKeys.size()==1)
-            n1.bNoMore = true;
-        if(n2.vKeys.size()==1)
-            n2.bNoMore = true;
-        if(n3.vKeys.size()==1)
-            n3.bNoMore = true;
-        if(n4.vKeys.size()==1)
-            n4.bNoMore = true;
+        ExtractorNode* vpChilds[4] = {&n1,&n2,&n3,&n4};
+        int vPos[4];
+        int begin = nBegin;
+        for(int c=0; c<4; c++)
+        {
+            vpChilds[c]->nBegin = begin;
+            vpChilds[c]->nEnd = begin+vCount[c];
+            vpChilds[c]->bNoMore = vCount[c]==1;
+            vPos[c] = begin;
+            begin += vCount[c];
+        }
 
+        // vScratch[i] holds the child of position i, so the indices go through a second buffer
+        int* pSorted = &vScratch[0] + vScratch.size()/2;
+        for(int i=nBegin; i<nEnd; i++)
+            pSorted[vPos[vScratch[i]]++ - nBegin] = vIndices[i];
+        for(int i=nBegin; i<nEnd; i++)
+            vIndices[i] = pSorted[i-nBegin];
     }
 
     vector<cv::KeyPoint> ORBextractor::DistributeOctTree(const vector<cv::KeyPoint>& vToDistributeKeys, const int &minX,
@@ -542,194 +486,159 @@ namespace ORB_SLAM3
 
         const float hX = static_cast<float>(maxX-minX)/nIni;
 
-        list<ExtractorNode> lNodes;
+        const int nKeys = vToDistributeKeys.size();
 
-        vector<ExtractorNode*> vpIniNodes;
-        vpIniNodes.resize(nIni);
+        // Keypoint indices grouped by node, every node of the tree is a range of this buffer
+        vector<int> vIndices(nKeys);
+        vector<int> vScratch(2*nKeys);
 
+        // Nodes (erased ones are just unlinked) and their list, new nodes go to the front
+        vector<ExtractorNode> vNodes;
+        vNodes.reserve(nIni+4*min(nKeys,4*N));
+        int head = -1;
+        int nNodes = 0;
+
+        auto pushFront = [&](ExtractorNode node)
+        {
+            node.prev = -1;
+            node.next = head;
+            vNodes.push_back(node);
+            const int id = vNodes.size()-1;
+            if(head>=0)
+                vNodes[head].prev = id;
+            head = id;
+            nNodes++;
+            return id;
+        };
+
+        auto erase = [&](const int id)
+        {
+            const int next = vNodes[id].next;
+            const int prev = vNodes[id].prev;
+            if(prev>=0)
+                vNodes[prev].next = next;
+            else
+                head = next;
+            if(next>=0)
+                vNodes[next].prev = prev;
+            nNodes--;
+            return next;
+        };
+
+        //Associate points to the initial nodes
+        vector<int> vIniCount(nIni+1,0);
+        for(int i=0; i<nKeys; i++)
+        {
+            const int node = vToDistributeKeys[i].pt.x/hX;
+            vScratch[i] = node;
+            vIniCount[node+1]++;
+        }
         for(int i=0; i<nIni; i++)
+            vIniCount[i+1] += vIniCount[i];
+
+        // Non empty initial nodes, in order
+        for(int i=nIni-1; i>=0; i--)
         {
+            if(vIniCount[i+1]==vIniCount[i])
+                continue;
+
             ExtractorNode ni;
             ni.UL = cv::Point2i(hX*static_cast<float>(i),0);
             ni.UR = cv::Point2i(hX*static_cast<float>(i+1),0);
             ni.BL = cv::Point2i(ni.UL.x,maxY-minY);
             ni.BR = cv::Point2i(ni.UR.x,maxY-minY);
-            ni.vKeys.reserve(vToDistributeKeys.size());
-
-            lNodes.push_back(ni);
-            vpIniNodes[i] = &lNodes.back();
+            ni.nBegin = vIniCount[i];
+            ni.nEnd = vIniCount[i+1];
+            ni.bNoMore = ni.size()==1;
+            pushFront(ni);
         }
 
-        //Associate points to childs
-        for(size_t i=0;i<vToDistributeKeys.size();i++)
         {
-            const cv::KeyPoint &kp = vToDistributeKeys[i];
-            vpIniNodes[kp.pt.x/hX]->vKeys.push_back(kp);
+            vector<int> vPos(vIniCount.begin(),vIniCount.end()-1);
+            for(int i=0; i<nKeys; i++)
+                vIndices[vPos[vScratch[i]]++] = i;
         }
 
-        list<ExtractorNode>::iterator lit = lNodes.begin();
+        bool bFinish = false;
+
+        int iteration = 0;
 
-        while(lit!=lNodes.end())
+        vector<pair<int,int> > vSizeAndNode;
+        vSizeAndNode.reserve(nNodes*4);
+
+        // Divides a node, adds its non empty childs at the front and unlinks it. Childs that can
+        // still be divided are added to vSizeAndNode. Returns the node that followed it.
+        auto divide = [&](const int id)
         {
-            if(lit->vKeys.size()==1)
+            ExtractorNode vChilds[4];
+            vNodes[id].DivideNode(vChilds[0],vChilds[1],vChilds[2],vChilds[3],vToDistributeKeys,vIndices,vScratch);
+
+            // Add childs if they contain points
+            for(int c=0; c<4; c++)
             {
-                lit->bNoMore=true;
-                lit++;
+                if(vChilds[c].size()>0)
+                {
+                    const int child = pushFront(vChilds[c]);
+                    if(vChilds[c].size()>1)
+                        vSizeAndNode.push_back(make_pair(vChilds[c].size(),child));
+                }
             }
-            else if(lit->vKeys.empty())
-                lit = lNodes.erase(lit);
-            else
-                lit++;
-        }
-
-        bool bFinish = false;
-
-        int iteration = 0;
 
-        vector<pair<int,ExtractorNode*> > vSizeAndPointerToNode;
-        vSizeAndPointerToNode.reserve(lNodes.size()*4);
+            return erase(id);
+        };
 
         while(!bFinish)
         {
             iteration++;
 
-            int prevSize = lNodes.size();
+            int prevSize = nNodes;
 
-            lit = lNodes.begin();
+            int lit = head;
 
-            int nToExpand = 0;
+            vSizeAndNode.clear();
 
-            vSizeAndPointerToNode.clear();
-
-            while(lit!=lNodes.end())
+            while(lit>=0)
             {
-                if(lit->bNoMore)
+                if(vNodes[lit].bNoMore)
                 {
                     // If node only contains one point do not subdivide and continue
-                    lit++;
+                    lit = vNodes[lit].next;
                     continue;
                 }
-                else
-                {
-                    // If more than one point, subdivide
-                    ExtractorNode n1,n2,n3,n4;
-                    lit->DivideNode(n1,n2,n3,n4);
 
-                    // Add childs if they contain points
-                    if(n1.vKeys.size()>0)
-                    {
-                        lNodes.push_front(n1);
-                        if(n1.vKeys.size()>1)
-                        {
-                            nToExpand++;
-                            vSizeAndPointerToNode.push_back(make_pair(n1.vKeys.size(),&lNodes.front()));
-                            lNodes.front().lit = lNodes.begin();
-                        }
-                    }
-                    if(n2.vKeys.size()>0)
-                    {
-                        lNodes.push_front(n2);
-                        if(n2.vKeys.size()>1)
-                        {
-                            nToExpand++;
-                            vSizeAndPointerToNode.push_back(make_pair(n2.vKeys.size(),&lNodes.front()));
-                            lNodes.front().lit = lNodes.begin();
-                        }
-                    }
-                    if(n3.vKeys.size()>0)
-                    {
-                        lNodes.push_front(n3);
-                        if(n3.vKeys.size()>1)
-                        {
-                            nToExpand++;
-                            vSizeAndPointerToNode.push_back(make_pair(n3.vKeys.size(),&lNodes.front()));
-                            lNodes.front().lit = lNodes.begin();
-                        }
-                    }
-                    if(n4.vKeys.size()>0)
-                    {
-                        lNodes.push_front(n4);
-                        if(n4.vKeys.size()>1)
-                        {
-                            nToExpand++;
-                            vSizeAndPointerToNode.push_back(make_pair(n4.vKeys.size(),&lNodes.front()));
-                            lNodes.front().lit = lNodes.begin();
-                        }
-                    }
-
-                    lit=lNodes.erase(lit);
-                    continue;
-                }
+                // If more than one point, subdivide
+                lit = divide(lit);
             }
 
+            const int nToExpand = vSizeAndNode.size();
+
             // Finish if there are more nodes than required features
             // or all nodes contain just one point
-            if((int)lNodes.size()>=N || (int)lNodes.size()==prevSize)
+            if(nNodes>=N || nNodes==prevSize)
             {
                 bFinish = true;
             }
-            else if(((int)lNodes.size()+nToExpand*3)>N)
+            else if((nNodes+nToExpand*3)>N)
             {
 
                 while(!bFinish)
                 {
 
-                    prevSize = lNodes.size();
+                    prevSize = nNodes;
 
-                    vector<pair<int,ExtractorNode*> > vPrevSizeAndPointerToNode = vSizeAndPointerToNode;
-                    vSizeAndPointerToNode.clear();
+                    vector<pair<int,int> > vPrevSizeAndNode = vSizeAndNode;
+                    vSizeAndNode.clear();
 
-                    sort(vPrevSizeAndPointerToNode.begin(),vPrevSizeAndPointerToNode.end());
-                    for(int j=vPrevSizeAndPointerToNode.size()-1;j>=0;j--)
+                    sort(vPrevSizeAndNode.begin(),vPrevSizeAndNode.end());
+                    for(int j=vPrevSizeAndNode.size()-1;j>=0;j--)
                     {
-                        ExtractorNode n1,n2,n3,n4;
-                        vPrevSizeAndPointerToNode[j].second->DivideNode(n1,n2,n3,n4);
-
-                        // Add childs if they contain points
-                        if(n1.vKeys.size()>0)
-                        {
-                            lNodes.push_front(n1);
-                            if(n1.vKeys.size()>1)
-                            {
-                                vSizeAndPointerToNode.push_back(make_pair(n1.vKeys.size(),&lNodes.front()));
-                                lNodes.front().lit = lNodes.begin();
-                            }
-                        }
-                        if(n2.vKeys.size()>0)
-                        {
-                            lNodes.push_front(n2);
-                            if(n2.vKeys.size()>1)
-                            {
-                                vSizeAndPointerToNode.push_back(make_pair(n2.vKeys.size(),&lNodes.front()));
-                                lNodes.front().lit = lNodes.begin();
-                            }
-                        }
-                        if(n3.vKeys.size()>0)
-                        {
-                            lNodes.push_front(n3);
-                            if(n3.vKeys.size()>1)
-                            {
-                                vSizeAndPointerToNode.push_back(make_pair(n3.vKeys.size(),&lNodes.front()));
-                                lNodes.front().lit = lNodes.begin();
-                            }
-                        }
-                        if(n4.vKeys.size()>0)
-                        {
-                            lNodes.push_front(n4);
-                            if(n4.vKeys.size()>1)
-                            {
-                                vSizeAndPointerToNode.push_back(make_pair(n4.vKeys.size(),&lNodes.front()));
-                                lNodes.front().lit = lNodes.begin();
-                            }
-                        }
-
-                        lNodes.erase(vPrevSizeAndPointerToNode[j].second->lit);
+                        divide(vPrevSizeAndNode[j].second);
 
-                        if((int)lNodes.size()>=N)
+                        if(nNodes>=N)
                             break;
                     }
 
-                    if((int)lNodes.size()>=N || (int)lNodes.size()==prevSize)
+                    if(nNodes>=N || nNodes==prevSize)
                         bFinish = true;
 
                 }
@@ -739,22 +648,22 @@ namespace ORB_SLAM3
         // Retain the best point in each node
         vector<cv::KeyPoint> vResultKeys;
         vResultKeys.reserve(nfeatures);
-        for(list<ExtractorNode>::iterator lit=lNodes.begin(); lit!=lNodes.end(); lit++)
+        for(int lit=head; lit>=0; lit=vNodes[lit].next)
         {
-            vector<cv::KeyPoint> &vNodeKeys = lit->vKeys;
-            cv::KeyPoint* pKP = &vNodeKeys[0];
-            float maxResponse = pKP->response;
+            const ExtractorNode &node = vNodes[lit];
+            int best = vIndices[node.nBegin];
+            float maxResponse = vToDistributeKeys[best].response;
 
-            for(size_t k=1;k<vNodeKeys.size();k++)
+            for(int k=node.nBegin+1; k<node.nEnd; k++)
             {
-                if(vNodeKeys[k].response>maxResponse)
+                if(vToDistributeKeys[vIndices[k]].response>maxResponse)
                 {
-                    pKP = &vNodeKeys[k];
-                    maxResponse = vNodeKeys[k].response;
+                    best = vIndices[k];
+                    maxResponse = vToDistributeKeys[best].response;
                 }
             }
 
-            vResultKeys.push_back(*pKP);
+            vResultKeys.push_back(vToDistributeKeys[best]);
         }
 
         return vResultKeys;
@@ -764,117 +673,181 @@ namespace ORB_SLAM3
     {
         allKeypoints.resize(nlevels);
 
+        // Levels are independent once the pyramid is built
+        if(mbParallelLevels)
+        {
+            mpThreadPool->ParallelFor(0, nlevels, [&](int level){
+                ComputeKeyPointsOctTreeLevel(level, allKeypoints[level]);
+            });
+        }
+        else
+        {
+            for (int level = 0; level < nlevels; ++level)
+                ComputeKeyPointsOctTreeLevel(level, allKeypoints[level]);
+        }
+    }
+
+    void ORBextractor::ComputeKeyPointsOctTreeLevel(const int level, vector<KeyPoint> &keypoints)
+    {
+        // Levels above the feature budget and below the first level are not built
+        if(level >= mnActiveLevels || level < FirstLevel())
+        {
+            keypoints.clear();
+            return;
+        }
+
         const float W = 35;
 
-        for (int level = 0; level < nlevels; ++level)
+        const int minBorderX = EDGE_THRESHOLD-3;
+        const int minBorderY = minBorderX;
+        const int maxBorderX = mvImagePyramid[level].cols-EDGE_THRESHOLD+3;
+        const int maxBorderY = mvImagePyramid[level].rows-EDGE_THRESHOLD+3;
+
+        vector<cv::KeyPoint> vToDistributeKeys;
+        vToDistributeKeys.reserve(nfeatures*10);
+
+        const float width = (maxBorderX-minBorderX);
+        const float height = (maxBorderY-minBorderY);
+
+        const int nCols = width/W;
+        const int nRows = height/W;
+        const int wCell = ceil(width/nCols);
+        const int hCell = ceil(height/nRows);
+
+        // FAST used to run on each cell (its region plus 3 pixels at each side), again with minThFAST
+        // when no corner was above iniThFAST. The cells partition the detection area, so a single
+        // pass over the level at the lower threshold gives the corners of both thresholds, which
+        // are then bucketed into the cells (in the cell order of the old loop).
+        const cv::Mat &image = mvImagePyramid[level];
+        vector<FastCorner> vCorners;
+        if(mFocusMask.empty())
+            FastDetector::Detect(image.data, image.step, minBorderX+3, minBorderY+3, maxBorderX-3, maxBorderY-3,
+                                 min(iniThFAST,minThFAST), vCorners);
+        else
+            DetectFocused(level, minBorderX+3, minBorderY+3, maxBorderX-3, maxBorderY-3, nCols, nRows, wCell, hCell, vCorners);
+
+        const int nCells = nCols*nRows;
+        const int nCorners = vCorners.size();
+        vector<int> vCellStart(nCells+1,0);
+        vector<int> vCornerCell(nCorners);
+        vector<bool> vbCellIni(nCells,false);
+        for(int i=0; i<nCorners; i++)
         {
-            const int minBorderX = EDGE_THRESHOLD-3;
-            const int minBorderY = minBorderX;
-            const int maxBorderX = mvImagePyramid[level].cols-EDGE_THRESHOLD+3;
-            const int maxBorderY = mvImagePyramid[level].rows-EDGE_THRESHOLD+3;
+            const FastCorner &corner = vCorners[i];
+            const int cx = min((corner.x-minBorderX-3)/wCell, nCols-1);
+            const int cy = min((corner.y-minBorderY-3)/hCell, nRows-1);
+            const int cell = cy*nCols+cx;
+            vCornerCell[i] = cell;
+            vCellStart[cell+1]++;
+            if(corner.score>=iniThFAST)
+                vbCellIni[cell] = true;
+        }
+        for(int c=0; c<nCells; c++)
+            vCellStart[c+1] += vCellStart[c];
 
-            vector<cv::KeyPoint> vToDistributeKeys;
-            vToDistributeKeys.reserve(nfeatures*10);
+        vector<int> vCellCorners(nCorners);
+        for(int i=0; i<nCorners; i++)
+            vCellCorners[vCellStart[vCornerCell[i]]++] = i;
 
-            const float width = (maxBorderX-minBorderX);
-            const float height = (maxBorderY-minBorderY);
+        for(int i=0; i<nCorners; i++)
+        {
+            const FastCorner &corner = vCorners[vCellCorners[i]];
+            if(vbCellIni[vCornerCell[vCellCorners[i]]] && corner.score<iniThFAST)
+                continue;
+            vToDistributeKeys.push_back(cv::KeyPoint(corner.x-minBorderX, corner.y-minBorderY, 7.f, -1, corner.score));
+        }
 
-            const int nCols = width/W;
-            const int nRows = height/W;
-            const int wCell = ceil(width/nCols);
-            const int hCell = ceil(height/nRows);
+        keypoints.reserve(nfeatures);
 
-            for(int i=0; i<nRows; i++)
-            {
-                const float iniY =minBorderY+i*hCell;
-                float maxY = iniY+hCell+6;
+        keypoints = DistributeOctTree(vToDistributeKeys, minBorderX, maxBorderX,
+                                      minBorderY, maxBorderY,mnFeaturesPerLevel[level], level);
 
-                if(iniY>=maxBorderY-3)
-                    continue;
-                if(maxY>maxBorderY)
-                    maxY = maxBorderY;
+        const int scaledPatchSize = PATCH_SIZE*mvScaleFactor[level];
 
-                for(int j=0; j<nCols; j++)
-                {
-                    const float iniX =minBorderX+j*wCell;
-                    float maxX = iniX+wCell+6;
-                    if(iniX>=maxBorderX-6)
-                        continue;
-                    if(maxX>maxBorderX)
-                        maxX = maxBorderX;
+        // Add border to coordinates and scale information
+        const int nkps = keypoints.size();
+        for(int i=0; i<nkps ; i++)
+        {
+            keypoints[i].pt.x+=minBorderX;
+            keypoints[i].pt.y+=minBorderY;
+            keypoints[i].octave=level;
+            keypoints[i].size = scaledPatchSize;
+        }
 
-                    vector<cv::KeyPoint> vKeysCell;
+        // compute orientations
+        mOrbDescriptor.ComputeOrientation(mvImagePyramid[level], keypoints);
+    }
 
-                    FAST(mvImagePyramid[level].rowRange(iniY,maxY).colRange(iniX,maxX),
-                         vKeysCell,iniThFAST,true);
+    void ORBextractor::SetFocusMask(const cv::Mat &mask, const int nCellSize, const float fCoverage)
+    {
+        mFocusMask = mask;
+        mnFocusCellSize = nCellSize;
+        mfFocusCoverage = fCoverage;
+    }
 
-                    /*if(bRight && j <= 13){
-                        FAST(mvImagePyramid[level].rowRange(iniY,maxY).colRange(iniX,maxX),
-                             vKeysCell,10,true);
-                    }
-                    else if(!bRight && j >= 16){
-                        FAST(mvImagePyramid[level].rowRange(iniY,maxY).colRange(iniX,maxX),
-                             vKeysCell,10,true);
-                    }
-                    else{
-                        FAST(mvImagePyramid[level].rowRange(iniY,maxY).colRange(iniX,maxX),
-                             vKeysCell,iniThFAST,true);
-                    }*/
+    void ORBextractor::DetectFocused(const int level, const int x0, const int y0, const int x1, const int y1,
+                                     const int nCols, const int nRows, const int wCell, const int hCell, vector<FastCorner> &vCorners)
+    {
+        const cv::Mat &image = mvImagePyramid[level];
+        const float scale = mvScaleFactor[level];
+        const int stride = mfFocusCoverage > 0 ? max(1, cvRound(1.f/mfFocusCoverage)) : 0;
 
+        vCorners.clear();
+        vector<FastCorner> vRunCorners;
+        for(int cy = 0; cy < nRows; cy++)
+        {
+            const int cellY0 = y0+cy*hCell;
+            const int cellY1 = cy == nRows-1 ? y1 : min(cellY0+hCell, y1);
+            if(cellY0 >= cellY1)
+                continue;
 
-                    if(vKeysCell.empty())
-                    {
-                        FAST(mvImagePyramid[level].rowRange(iniY,maxY).colRange(iniX,maxX),
-                             vKeysCell,minThFAST,true);
-                        /*if(bRight && j <= 13){
-                            FAST(mvImagePyramid[level].rowRange(iniY,maxY).colRange(iniX,maxX),
-                                 vKeysCell,5,true);
-                        }
-                        else if(!bRight && j >= 16){
-                            FAST(mvImagePyramid[level].rowRange(iniY,maxY).colRange(iniX,maxX),
-                                 vKeysCell,5,true);
-                        }
-                        else{
-                            FAST(mvImagePyramid[level].rowRange(iniY,maxY).colRange(iniX,maxX),
-                                 vKeysCell,minThFAST,true);
-                        }*/
-                    }
+            // Rows of the mask under this row of cells
+            const int my0 = min(int(cellY0*scale)/mnFocusCellSize, mFocusMask.rows-1);
+            const int my1 = min(int(cellY1*scale)/mnFocusCellSize, mFocusMask.rows-1);
 
-                    if(!vKeysCell.empty())
+            // Contiguous focused cells are detected together
+            int runStart = -1;
+            for(int cx = 0; cx <= nCols; cx++)
+            {
+                bool bActive = false;
+                if(cx < nCols)
+                {
+                    const int cellX0 = x0+cx*wCell;
+                    const int cellX1 = cx == nCols-1 ? x1 : min(cellX0+wCell, x1);
+                    const int mx0 = min(int(cellX0*scale)/mnFocusCellSize, mFocusMask.cols-1);
+                    const int mx1 = min(int(cellX1*scale)/mnFocusCellSize, mFocusMask.cols-1);
+                    for(int my = my0; my <= my1 && !bActive; my++)
                     {
-                        for(vector<cv::KeyPoint>::iterator vit=vKeysCell.begin(); vit!=vKeysCell.end();vit++)
+                        const uchar* pMask = mFocusMask.ptr<uchar>(my);
+                        for(int mx = mx0; mx <= mx1; mx++)
                         {
-                            (*vit).pt.x+=j*wCell;
-                            (*vit).pt.y+=i*hCell;
-                            vToDistributeKeys.push_back(*vit);
+                            if(pMask[mx])
+                            {
+                                bActive = true;
+                                break;
+                            }
                         }
                     }
 
+                    // Coarse coverage of the rest of the image
+                    if(!bActive && stride > 0)
+                        bActive = (cx + 3*cy + mnFocusPhase) % stride == 0;
                 }
-            }
-
-            vector<KeyPoint> & keypoints = allKeypoints[level];
-            keypoints.reserve(nfeatures);
-
-            keypoints = DistributeOctTree(vToDistributeKeys, minBorderX, maxBorderX,
-                                          minBorderY, maxBorderY,mnFeaturesPerLevel[level], level);
 
-            const int scaledPatchSize = PATCH_SIZE*mvScaleFactor[level];
-
-            // Add border to coordinates and scale information
-            const int nkps = keypoints.size();
-            for(int i=0; i<nkps ; i++)
-            {
-                keypoints[i].pt.x+=minBorderX;
-                keypoints[i].pt.y+=minBorderY;
-                keypoints[i].octave=level;
-                keypoints[i].size = scaledPatchSize;
+                if(bActive && runStart < 0)
+                    runStart = cx;
+                else if(!bActive && runStart >= 0)
+                {
+                    // Non maximum suppression stops at the ends of the run
+                    const int runX0 = x0+runStart*wCell;
+                    const int runX1 = cx == nCols ? x1 : min(x0+cx*wCell, x1);
+                    FastDetector::Detect(image.data, image.step, runX0, cellY0, runX1, cellY1,
+                                         min(iniThFAST,minThFAST), vRunCorners);
+                    vCorners.insert(vCorners.end(), vRunCorners.begin(), vRunCorners.end());
+                    runStart = -1;
+                }
             }
         }
-
-        // compute orientations
-        for (int level = 0; level < nlevels; ++level)
-            computeOrientation(mvImagePyramid[level], allKeypoints[level], umax);
     }
 
     void ORBextractor::ComputeKeyPointsOld(std::vector<std::vector<KeyPoint> > &allKeypoints)
@@ -1053,16 +1026,7 @@ namespace ORB_SLAM3
 
         // and compute orientations
         for (int level = 0; level < nlevels; ++level)
-            computeOrientation(mvImagePyramid[level], allKeypoints[level], umax);
-    }
-
-    static void computeDescriptors(const Mat& image, vector<KeyPoint>& keypoints, Mat& descriptors,
-                                   const vector<Point>& pattern)
-    {
-        descriptors = Mat::zeros((int)keypoints.size(), 32, CV_8UC1);
-
-        for (size_t i = 0; i < keypoints.size(); i++)
-            computeOrbDescriptor(keypoints[i], image, &pattern[0], descriptors.ptr((int)i));
+            mOrbDescriptor.ComputeOrientation(mvImagePyramid[level], allKeypoints[level]);
     }
 
     int ORBextractor::operator()( InputArray _image, InputArray _mask, vector<KeyPoint>& _keypoints,
@@ -1073,12 +1037,17 @@ namespace ORB_SLAM3
             return -1;
 
         Mat image = _image.getMat();
-        assert(image.type() == CV_8UC1 );
+        assert(mpRowSource || image.type() == CV_8UC1 );
+        mImageSize = image.size();
 
         // Pre-compute the scale pyramid
         ComputePyramid(image);
+        mpRowSource = NULL;
+
+        if(!mFocusMask.empty())
+            mnFocusPhase++;
 
-        vector < vector<KeyPoint> > allKeypoints;
+        vector < vector<KeyPoint> > &allKeypoints = mvvAllKeypoints;
         ComputeKeyPointsOctTree(allKeypoints);
         //ComputeKeyPointsOld(allKeypoints);
 
@@ -1091,87 +1060,102 @@ namespace ORB_SLAM3
             _descriptors.release();
         else
         {
+            // Reuses the caller's matrix when it already has the right size
             _descriptors.create(nkeypoints, 32, CV_8U);
             descriptors = _descriptors.getMat();
         }
 
         //_keypoints.clear();
         //_keypoints.reserve(nkeypoints);
-        _keypoints = vector<cv::KeyPoint>(nkeypoints);
+        _keypoints.resize(nkeypoints);
 
-        int offset = 0;
+        // Output row of every keypoint
         //Modified for speeding up stereo fisheye matching
         int monoIndex = 0, stereoIndex = nkeypoints-1;
         for (int level = 0; level < nlevels; ++level)
         {
-            vector<KeyPoint>& keypoints = allKeypoints[level];
-            int nkeypointsLevel = (int)keypoints.size();
-
-            if(nkeypointsLevel==0)
-                continue;
-
-            // preprocess the resized image
-            Mat workingMat = mvImagePyramid[level].clone();
-            GaussianBlur(workingMat, workingMat, Size(7, 7), 2, 2, BORDER_REFLECT_101);
-
-            // Compute the descriptors
-            //Mat desc = descriptors.rowRange(offset, offset + nkeypointsLevel);
-            Mat desc = cv::Mat(nkeypointsLevel, 32, CV_8U);
-            computeDescriptors(workingMat, keypoints, desc, pattern);
-
-            offset += nkeypointsLevel;
+            const vector<KeyPoint>& keypoints = allKeypoints[level];
+            vector<int>& vOutputRows = mvvOutputRows[level];
+            vOutputRows.resize(keypoints.size());
+
+            const float scale = mvScaleFactor[level]; //getScale(level, firstLevel, scaleFactor);
+            for (size_t i = 0; i < keypoints.size(); i++){
+                const float x = level != 0 ? keypoints[i].pt.x*scale : keypoints[i].pt.x;
+                if(x >= vLappingArea[0] && x <= vLappingArea[1])
+                    vOutputRows[i] = stereoIndex--;
+                else
+                    vOutputRows[i] = monoIndex++;
+            }
+        }
 
+        // Compute the descriptors of every level straight into their output rows
+        // (in parallel if there is a pool)
+        if(mbParallelLevels)
+        {
+            mpThreadPool->ParallelFor(0, nlevels, [&](int level){
+                ComputeDescriptorsLevel(level, allKeypoints[level], mvvOutputRows[level], descriptors);
+            });
+        }
+        else
+        {
+            for (int level = 0; level < nlevels; ++level)
+                ComputeDescriptorsLevel(level, allKeypoints[level], mvvOutputRows[level], descriptors);
+        }
 
-            float scale = mvScaleFactor[level]; //getScale(level, firstLevel, scaleFactor);
-            int i = 0;
-            for (vector<KeyPoint>::iterator keypoint = keypoints.begin(),
-                         keypointEnd = keypoints.end(); keypoint != keypointEnd; ++keypoint){
+        for (int level = 0; level < nlevels; ++level)
+        {
+            vector<KeyPoint>& keypoints = allKeypoints[level];
+            const vector<int>& vOutputRows = mvvOutputRows[level];
 
-                // Scale keypoint coordinates
+            // Scale keypoint coordinates
+            float scale = mvScaleFactor[level];
+            for (size_t i = 0; i < keypoints.size(); i++){
                 if (level != 0){
-                    keypoint->pt *= scale;
-                }
-
-                if(keypoint->pt.x >= vLappingArea[0] && keypoint->pt.x <= vLappingArea[1]){
-                    _keypoints.at(stereoIndex) = (*keypoint);
-                    desc.row(i).copyTo(descriptors.row(stereoIndex));
-                    stereoIndex--;
+                    keypoints[i].pt *= scale;
                 }
-                else{
-                    _keypoints.at(monoIndex) = (*keypoint);
-                    desc.row(i).copyTo(descriptors.row(monoIndex));
-                    monoIndex++;
-                }
-                i++;
+                _keypoints[vOutputRows[i]] = keypoints[i];
             }
         }
         //cout << "[ORBextractor]: extracted " << _keypoints.size() << " KeyPoints" << endl;
         return monoIndex;
     }
 
+    void ORBextractor::ComputeDescriptorsLevel(const int level, const vector<KeyPoint> &keypoints, const vector<int> &vOutputRows, Mat &descriptors)
+    {
+        if(keypoints.empty())
+            return;
+
+        // The level was blurred along with the pyramid
+        mOrbDescriptor.ComputeDescriptors(mvBlurBuffers[level], keypoints, vOutputRows, descriptors);
+    }
+
     void ORBextractor::ComputePyramid(cv::Mat image)
     {
-        for (int level = 0; level < nlevels; ++level)
+        const int nFirstLevel = FirstLevel();
+        for (int level = 0; level < nFirstLevel; ++level)
+            mvImagePyramid[level] = Mat();
+
+        for (int level = nFirstLevel; level < mnActiveLevels; ++level)
         {
             float scale = mvInvScaleFactor[level];
             Size sz(cvRound((float)image.cols*scale), cvRound((float)image.rows*scale));
             Size wholeSize(sz.width + EDGE_THRESHOLD*2, sz.height + EDGE_THRESHOLD*2);
-            Mat temp(wholeSize, image.type()), masktemp;
-            mvImagePyramid[level] = temp(Rect(EDGE_THRESHOLD, EDGE_THRESHOLD, sz.width, sz.height));
-
-            // Compute the resized image
-            if( level != 0 )
-            {
-                resize(mvImagePyramid[level-1], mvImagePyramid[level], sz, 0, 0, INTER_LINEAR);
 
-                copyMakeBorder(mvImagePyramid[level], temp, EDGE_THRESHOLD, EDGE_THRESHOLD, EDGE_THRESHOLD, EDGE_THRESHOLD,
-                               BORDER_REFLECT_101+BORDER_ISOLATED);
-            }
-            else
-            {
-                copyMakeBorder(image, temp, EDGE_THRESHOLD, EDGE_THRESHOLD, EDGE_THRESHOLD, EDGE_THRESHOLD,
-                               BORDER_REFLECT_101);
-            }
+            // The bordered level images and the blurred levels are kept between frames and
+            // only reallocated if the input size changes
+            Mat &temp = mvPyramidBuffers[level];
+            temp.create(wholeSize, image.type());
+            mvImagePyramid[level] = temp(Rect(EDGE_THRESHOLD, EDGE_THRESHOLD, sz.width, sz.height));
+            mvBlurBuffers[level].create(sz, image.type());
+
+            // Resize (level 0 is a copy or comes from the row source, a reduced first level is
+            // resized from the image), border and blur in one pass
+            const Mat &src = level != nFirstLevel ? mvImagePyramid[level-1] : image;
+            Mat &dst = mvImagePyramid[level];
+            mPyramidBuilder.Build(src.data, src.step, src.cols, src.rows,
+                                  dst.data, dst.step, dst.cols, dst.rows, EDGE_THRESHOLD,
+                                  mvBlurBuffers[level].data, mvBlurBuffers[level].step,
+                                  level == 0 ? mpRowSource : NULL);
         }
 
     }
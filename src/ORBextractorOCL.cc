@@ -0,0 +1,89 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/ocl.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "ORBextractorOCL.h"
+
+using namespace cv;
+using namespace std;
+
+namespace ORB_SLAM3
+{
+
+// Border of the levels, as in ORBextractor
+const int EDGE_THRESHOLD_OCL = 19;
+
+ORBextractorOCL::ORBextractorOCL(int _nfeatures, float _scaleFactor, int _nlevels,
+                                 int _iniThFAST, int _minThFAST):
+    ORBextractor(_nfeatures, _scaleFactor, _nlevels, _iniThFAST, _minThFAST)
+{
+    mvULevels.resize(nlevels);
+    mvUBordered.resize(nlevels);
+    mvUBlur.resize(nlevels);
+}
+
+bool ORBextractorOCL::IsAvailable()
+{
+    if(!cv::ocl::haveOpenCL())
+        return false;
+    cv::ocl::setUseOpenCL(true);
+    return cv::ocl::useOpenCL();
+}
+
+void ORBextractorOCL::ComputePyramid(cv::Mat image)
+{
+    const int nFirstLevel = FirstLevel();
+    for (int level = 0; level < nFirstLevel; ++level)
+        mvImagePyramid[level] = Mat();
+
+    image.copyTo(mUImage);
+
+    // The calls are queued on the device, the levels are downloaded once they are all enqueued
+    for (int level = nFirstLevel; level < mnActiveLevels; ++level)
+    {
+        const float scale = mvInvScaleFactor[level];
+        const Size sz(cvRound((float)image.cols*scale), cvRound((float)image.rows*scale));
+
+        // Level 0 is the image, a reduced first level is resized from the image and the others
+        // from the previous level, as in ORBextractor
+        const UMat &src = level != nFirstLevel ? mvULevels[level-1] : mUImage;
+        if(src.size() == sz)
+            src.copyTo(mvULevels[level]);
+        else
+            resize(src, mvULevels[level], sz, 0, 0, INTER_LINEAR);
+
+        copyMakeBorder(mvULevels[level], mvUBordered[level], EDGE_THRESHOLD_OCL, EDGE_THRESHOLD_OCL,
+                       EDGE_THRESHOLD_OCL, EDGE_THRESHOLD_OCL, BORDER_REFLECT_101);
+        GaussianBlur(mvULevels[level], mvUBlur[level], Size(7, 7), 2, 2, BORDER_REFLECT_101);
+    }
+
+    for (int level = nFirstLevel; level < mnActiveLevels; ++level)
+    {
+        // Host buffers kept between frames as in ORBextractor, mvImagePyramid are views into them
+        Mat &temp = mvPyramidBuffers[level];
+        mvUBordered[level].copyTo(temp);
+        const Size sz = mvULevels[level].size();
+        mvImagePyramid[level] = temp(Rect(EDGE_THRESHOLD_OCL, EDGE_THRESHOLD_OCL, sz.width, sz.height));
+        mvUBlur[level].copyTo(mvBlurBuffers[level]);
+    }
+}
+
+} //namespace ORB_SLAM
@@ -18,6 +18,7 @@
 
 
 #include "ORBmatcher.h"
+#include "Tracer.h"
 
 #include<limits.h>
 
@@ -27,6 +28,13 @@
 #include "Thirdparty/DBoW2/DBoW2/FeatureVector.h"
 
 #include<stdint-gcc.h>
+#include<cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include<immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include<arm_neon.h>
+#endif
 
 using namespace std;
 
@@ -36,13 +44,56 @@ namespace ORB_SLAM3
 const int ORBmatcher::TH_HIGH = 100;
 const int ORBmatcher::TH_LOW = 50;
 const int ORBmatcher::HISTO_LENGTH = 30;
+const int ORBmatcher::DESCRIPTOR_BYTES = 32;
+
+ORBmatcher::ORBmatcher(float nnratio, bool checkOri): mfNNratio(nnratio), mbCheckOrientation(checkOri),
+    mScratch(ThreadScratch()), mvCandidateIdx(mScratch.vCandidateIdx), mvCandidateDesc(mScratch.vCandidateDesc),
+    mvAreaIndices(mScratch.vAreaIndices)
+{
+}
+
+ORBmatcher::Scratch& ORBmatcher::ThreadScratch()
+{
+    static thread_local Scratch scratch;
+    return scratch;
+}
 
-ORBmatcher::ORBmatcher(float nnratio, bool checkOri): mfNNratio(nnratio), mbCheckOrientation(checkOri)
+vector<int>* ORBmatcher::RotationHistogram()
 {
+    vector<vector<int> > &vRotHist = mScratch.vRotHist;
+    if(vRotHist.empty())
+    {
+        vRotHist.resize(HISTO_LENGTH);
+        for(int i=0;i<HISTO_LENGTH;i++)
+            vRotHist[i].reserve(500);
+    }
+    else
+    {
+        for(int i=0;i<HISTO_LENGTH;i++)
+            vRotHist[i].clear();
+    }
+    return vRotHist.data();
 }
 
 int ORBmatcher::SearchByProjection(Frame &F, const vector<MapPoint*> &vpMapPoints, const float th, const bool bFarPoints, const float thFarPoints)
 {
+    ORB_TRACE_SCOPE("ORBmatcher::SearchByProjection");
+    switch(F.mCameraSetup)
+    {
+    case CAMERA_SPLIT:
+        return SearchByProjectionLocal<CAMERA_SPLIT>(F,vpMapPoints,th,bFarPoints,thFarPoints);
+    case CAMERA_RECTIFIED:
+        return SearchByProjectionLocal<CAMERA_RECTIFIED>(F,vpMapPoints,th,bFarPoints,thFarPoints);
+    default:
+        return SearchByProjectionLocal<CAMERA_MONOCULAR>(F,vpMapPoints,th,bFarPoints,thFarPoints);
+    }
+}
+
+template<int Setup>
+int ORBmatcher::SearchByProjectionLocal(Frame &F, const vector<MapPoint*> &vpMapPoints, const float th, const bool bFarPoints, const float thFarPoints)
+{
+    typedef CameraSetupTraits<Setup> Traits;
+
     int nmatches=0, left = 0, right = 0;
 
     const bool bFactor = th!=1.0;
@@ -69,19 +120,14 @@ int ORBmatcher::SearchByProjection(Frame &F, const vector<MapPoint*> &vpMapPoint
             if(bFactor)
                 r*=th;
 
-            const vector<size_t> vIndices =
-                    F.GetFeaturesInArea(pMP->mTrackProjX,pMP->mTrackProjY,r*F.mvScaleFactors[nPredictedLevel],nPredictedLevel-1,nPredictedLevel);
+            F.GetFeaturesInArea(pMP->mTrackProjX,pMP->mTrackProjY,r*F.mvScaleFactors[nPredictedLevel],mvAreaIndices,nPredictedLevel-1,nPredictedLevel);
+            const vector<size_t> &vIndices = mvAreaIndices;
 
             if(!vIndices.empty()){
                 const cv::Mat MPdescriptor = pMP->GetDescriptor();
 
-                int bestDist=256;
-                int bestLevel= -1;
-                int bestDist2=256;
-                int bestLevel2 = -1;
-                int bestIdx =-1 ;
-
-                // Get best and second matches with near keypoints
+                // Gather near keypoints not already matched
+                ClearCandidates();
                 for(vector<size_t>::const_iterator vit=vIndices.begin(), vend=vIndices.end(); vit!=vend; vit++)
                 {
                     const size_t idx = *vit;
@@ -90,35 +136,22 @@ int ORBmatcher::SearchByProjection(Frame &F, const vector<MapPoint*> &vpMapPoint
                         if(F.mvpMapPoints[idx]->Observations()>0)
                             continue;
 
-                    if(F.Nleft == -1 && F.mvuRight[idx]>0)
+                    if(Traits::bRightCoords && F.mvuRight[idx]>0)
                     {
                         const float er = fabs(pMP->mTrackProjXR-F.mvuRight[idx]);
                         if(er>r*F.mvScaleFactors[nPredictedLevel])
                             continue;
                     }
 
-                    const cv::Mat &d = F.mDescriptors.row(idx);
+                    AddCandidate(F.mDescriptors,idx);
+                }
 
-                    const int dist = DescriptorDistance(MPdescriptor,d);
+                // Get best and second matches with near keypoints
+                int bestDist, bestIdx, bestDist2, bestIdx2;
+                MatchCandidates(MPdescriptor,bestDist,bestIdx,bestDist2,bestIdx2);
 
-                    if(dist<bestDist)
-                    {
-                        bestDist2=bestDist;
-                        bestDist=dist;
-                        bestLevel2 = bestLevel;
-                        bestLevel = (F.Nleft == -1) ? F.mvKeysUn[idx].octave
-                                                    : (idx < F.Nleft) ? F.mvKeys[idx].octave
-                                                                      : F.mvKeysRight[idx - F.Nleft].octave;
-                        bestIdx=idx;
-                    }
-                    else if(dist<bestDist2)
-                    {
-                        bestLevel2 = (F.Nleft == -1) ? F.mvKeysUn[idx].octave
-                                                     : (idx < F.Nleft) ? F.mvKeys[idx].octave
-                                                                       : F.mvKeysRight[idx - F.Nleft].octave;
-                        bestDist2=dist;
-                    }
-                }
+                const int bestLevel = (bestIdx == -1) ? -1 : F.mKeysSoA.mvOctave[bestIdx];
+                const int bestLevel2 = (bestIdx2 == -1) ? -1 : F.mKeysSoA.mvOctave[bestIdx2];
 
                 // Apply ratio to second match (only if best and second are in the same scale level)
                 if(bestDist<=TH_HIGH)
@@ -129,7 +162,7 @@ int ORBmatcher::SearchByProjection(Frame &F, const vector<MapPoint*> &vpMapPoint
                     if(bestLevel!=bestLevel2 || bestDist<=mfNNratio*bestDist2){
                         F.mvpMapPoints[bestIdx]=pMP;
 
-                        if(F.Nleft != -1 && F.mvLeftToRightMatch[bestIdx] != -1){ //Also match with the stereo observation at right camera
+                        if(Traits::bSplit && F.mvLeftToRightMatch[bestIdx] != -1){ //Also match with the stereo observation at right camera
                             F.mvpMapPoints[F.mvLeftToRightMatch[bestIdx] + F.Nleft] = pMP;
                             nmatches++;
                             right++;
@@ -142,26 +175,21 @@ int ORBmatcher::SearchByProjection(Frame &F, const vector<MapPoint*> &vpMapPoint
             }
         }
 
-        if(F.Nleft != -1 && pMP->mbTrackInViewR){
+        if(Traits::bSplit && pMP->mbTrackInViewR){
             const int &nPredictedLevel = pMP->mnTrackScaleLevelR;
             if(nPredictedLevel != -1){
                 float r = RadiusByViewingCos(pMP->mTrackViewCosR);
 
-                const vector<size_t> vIndices =
-                        F.GetFeaturesInArea(pMP->mTrackProjXR,pMP->mTrackProjYR,r*F.mvScaleFactors[nPredictedLevel],nPredictedLevel-1,nPredictedLevel,true);
+                F.GetFeaturesInArea(pMP->mTrackProjXR,pMP->mTrackProjYR,r*F.mvScaleFactors[nPredictedLevel],mvAreaIndices,nPredictedLevel-1,nPredictedLevel,true);
+                const vector<size_t> &vIndices = mvAreaIndices;
 
                 if(vIndices.empty())
                     continue;
 
                 const cv::Mat MPdescriptor = pMP->GetDescriptor();
 
-                int bestDist=256;
-                int bestLevel= -1;
-                int bestDist2=256;
-                int bestLevel2 = -1;
-                int bestIdx =-1 ;
-
-                // Get best and second matches with near keypoints
+                // Gather near keypoints not already matched
+                ClearCandidates();
                 for(vector<size_t>::const_iterator vit=vIndices.begin(), vend=vIndices.end(); vit!=vend; vit++)
                 {
                     const size_t idx = *vit;
@@ -170,25 +198,15 @@ int ORBmatcher::SearchByProjection(Frame &F, const vector<MapPoint*> &vpMapPoint
                         if(F.mvpMapPoints[idx + F.Nleft]->Observations()>0)
                             continue;
 
+                    AddCandidate(F.mDescriptors,idx + F.Nleft,idx);
+                }
 
-                    const cv::Mat &d = F.mDescriptors.row(idx + F.Nleft);
+                // Get best and second matches with near keypoints
+                int bestDist, bestIdx, bestDist2, bestIdx2;
+                MatchCandidates(MPdescriptor,bestDist,bestIdx,bestDist2,bestIdx2);
 
-                    const int dist = DescriptorDistance(MPdescriptor,d);
-
-                    if(dist<bestDist)
-                    {
-                        bestDist2=bestDist;
-                        bestDist=dist;
-                        bestLevel2 = bestLevel;
-                        bestLevel = F.mvKeysRight[idx].octave;
-                        bestIdx=idx;
-                    }
-                    else if(dist<bestDist2)
-                    {
-                        bestLevel2 = F.mvKeysRight[idx].octave;
-                        bestDist2=dist;
-                    }
-                }
+                const int bestLevel = (bestIdx == -1) ? -1 : F.mKeysSoA.mvOctave[bestIdx + F.Nleft];
+                const int bestLevel2 = (bestIdx2 == -1) ? -1 : F.mKeysSoA.mvOctave[bestIdx2 + F.Nleft];
 
                 // Apply ratio to second match (only if best and second are in the same scale level)
                 if(bestDist<=TH_HIGH)
@@ -196,7 +214,7 @@ int ORBmatcher::SearchByProjection(Frame &F, const vector<MapPoint*> &vpMapPoint
                     if(bestLevel==bestLevel2 && bestDist>mfNNratio*bestDist2)
                         continue;
 
-                    if(F.Nleft != -1 && F.mvRightToLeftMatch[bestIdx] != -1){ //Also match with the stereo observation at right camera
+                    if(F.mvRightToLeftMatch[bestIdx] != -1){ //Also match with the stereo observation at right camera
                         F.mvpMapPoints[F.mvRightToLeftMatch[bestIdx]] = pMP;
                         nmatches++;
                         left++;
@@ -213,6 +231,174 @@ int ORBmatcher::SearchByProjection(Frame &F, const vector<MapPoint*> &vpMapPoint
     return nmatches;
 }
 
+int ORBmatcher::SearchByProjection(Frame &F, const FrozenMap &map, FrozenMap::LocalWindow &w, const float th, const bool bFarPoints, const float thFarPoints)
+{
+    ORB_TRACE_SCOPE("ORBmatcher::SearchByProjection");
+    if(F.mCameraSetup==CAMERA_MONOCULAR)
+        return SearchByProjectionArrays<CAMERA_MONOCULAR>(F,map.mDescriptors,map.mvpMapPoints,w,th,bFarPoints,thFarPoints);
+    else
+        return SearchByProjectionArrays<CAMERA_RECTIFIED>(F,map.mDescriptors,map.mvpMapPoints,w,th,bFarPoints,thFarPoints);
+}
+
+int ORBmatcher::SearchByProjection(Frame &F, const LocalMapMirror &mirror, LocalMapMirror::Projection &p, const float th, const bool bFarPoints, const float thFarPoints)
+{
+    ORB_TRACE_SCOPE("ORBmatcher::SearchByProjection");
+    const LocalMapMirror::Points &pts = mirror.mPoints;
+    if(F.mCameraSetup==CAMERA_MONOCULAR)
+        return SearchByProjectionArrays<CAMERA_MONOCULAR>(F,pts.mDescriptors,pts.mvpMapPoints,p,th,bFarPoints,thFarPoints);
+    else
+        return SearchByProjectionArrays<CAMERA_RECTIFIED>(F,pts.mDescriptors,pts.mvpMapPoints,p,th,bFarPoints,thFarPoints);
+}
+
+template<int Setup, class Window>
+int ORBmatcher::SearchByProjectionArrays(Frame &F, const cv::Mat &descriptors, const vector<MapPoint*> &vpMapPoints, Window &w, const float th, const bool bFarPoints, const float thFarPoints)
+{
+    typedef CameraSetupTraits<Setup> Traits;
+
+    int nmatches=0;
+
+    const bool bFactor = th!=1.0;
+
+    for(size_t i=0; i<w.mvProjPoint.size(); i++)
+    {
+        if(bFarPoints && w.mvProjDepth[i]>thFarPoints)
+            continue;
+
+        const int nPredictedLevel = w.mvProjLevel[i];
+
+        // The size of the window will depend on the viewing direction
+        float r = RadiusByViewingCos(w.mvProjViewCos[i]);
+
+        if(bFactor)
+            r*=th;
+
+        F.GetFeaturesInArea(w.mvProjU[i],w.mvProjV[i],r*F.mvScaleFactors[nPredictedLevel],mvAreaIndices,nPredictedLevel-1,nPredictedLevel);
+        const vector<size_t> &vIndices = mvAreaIndices;
+
+        if(vIndices.empty())
+            continue;
+
+        // Gather near keypoints not already matched to a map point
+        ClearCandidates();
+        for(vector<size_t>::const_iterator vit=vIndices.begin(), vend=vIndices.end(); vit!=vend; vit++)
+        {
+            const size_t idx = *vit;
+
+            if(w.mvbKeyMatched[idx])
+                continue;
+
+            if(Traits::bRightCoords && F.mvuRight[idx]>0)
+            {
+                const float er = fabs(w.mvProjUR[i]-F.mvuRight[idx]);
+                if(er>r*F.mvScaleFactors[nPredictedLevel])
+                    continue;
+            }
+
+            AddCandidate(F.mDescriptors,idx);
+        }
+
+        // Get best and second matches with near keypoints
+        int bestDist, bestIdx, bestDist2, bestIdx2;
+        MatchCandidates(descriptors.row(w.mvProjPoint[i]),bestDist,bestIdx,bestDist2,bestIdx2);
+
+        const int bestLevel = (bestIdx == -1) ? -1 : F.mKeysSoA.mvOctave[bestIdx];
+        const int bestLevel2 = (bestIdx2 == -1) ? -1 : F.mKeysSoA.mvOctave[bestIdx2];
+
+        // Apply ratio to second match (only if best and second are in the same scale level)
+        if(bestDist<=TH_HIGH)
+        {
+            if(bestLevel==bestLevel2 && bestDist>mfNNratio*bestDist2)
+                continue;
+
+            F.mvpMapPoints[bestIdx]=vpMapPoints[w.mvProjPoint[i]];
+            w.mvbKeyMatched[bestIdx]=1;
+            nmatches++;
+        }
+    }
+
+    return nmatches;
+}
+
+int ORBmatcher::SearchByProjectionRig(Frame &F, const vector<MapPoint*> &vpMapPoints, const float th)
+{
+    int nmatches=0;
+
+    const cv::Mat &Tbw = F.mTcw;
+    const cv::Matx33f Rbw(Tbw.at<float>(0,0), Tbw.at<float>(0,1), Tbw.at<float>(0,2),
+                          Tbw.at<float>(1,0), Tbw.at<float>(1,1), Tbw.at<float>(1,2),
+                          Tbw.at<float>(2,0), Tbw.at<float>(2,1), Tbw.at<float>(2,2));
+    const cv::Matx31f tbw(Tbw.at<float>(0,3), Tbw.at<float>(1,3), Tbw.at<float>(2,3));
+
+    for(size_t v=0; v<F.mvRigViews.size(); v++)
+    {
+        RigView &view = F.mvRigViews[v];
+        if(view.size()==0)
+            continue;
+
+        // Pose and center of the rig camera
+        const cv::Matx33f Rcw = view.Rcb*Rbw;
+        const cv::Matx31f tcw = view.Rcb*tbw + view.tcb;
+        const cv::Matx31f Ow = -Rcw.t()*tcw;
+
+        for(size_t iMP=0; iMP<vpMapPoints.size(); iMP++)
+        {
+            MapPoint* pMP = vpMapPoints[iMP];
+            if(!pMP || pMP->isBad())
+                continue;
+
+            // Same checks as Frame::isInFrustum
+            const cv::Matx31f Px = pMP->GetWorldPos2();
+            const cv::Matx31f Pc = Rcw*Px + tcw;
+            if(Pc(2)<=0.0f)
+                continue;
+
+            const cv::Point2f uv = view.pCamera->project(Pc);
+            if(uv.x<view.mnMinX || uv.x>view.mnMaxX || uv.y<view.mnMinY || uv.y>view.mnMaxY)
+                continue;
+
+            const cv::Matx31f PO = Px - Ow;
+            const float dist = cv::norm(PO);
+            if(dist<pMP->GetMinDistanceInvariance() || dist>pMP->GetMaxDistanceInvariance())
+                continue;
+
+            const float viewCos = PO.dot(pMP->GetNormal2())/dist;
+            if(viewCos<0.5f)
+                continue;
+
+            const int nPredictedLevel = pMP->PredictScale(dist,&F);
+            const float r = th*RadiusByViewingCos(viewCos)*F.mvScaleFactors[nPredictedLevel];
+
+            view.GetFeaturesInArea(uv.x,uv.y,r,mvAreaIndices,nPredictedLevel-1,nPredictedLevel);
+            if(mvAreaIndices.empty())
+                continue;
+
+            // Near keypoints not already matched
+            ClearCandidates();
+            for(vector<size_t>::const_iterator vit=mvAreaIndices.begin(), vend=mvAreaIndices.end(); vit!=vend; vit++)
+                if(!view.mvpMapPoints[*vit])
+                    AddCandidate(view.mDescriptors,*vit);
+
+            int bestDist, bestIdx, bestDist2, bestIdx2;
+            MatchCandidates(pMP->GetDescriptor(),bestDist,bestIdx,bestDist2,bestIdx2);
+
+            // Ratio to the second match only if both are in the same scale level
+            if(bestDist<=TH_HIGH)
+            {
+                const int bestLevel = view.mvKeysUn[bestIdx].octave;
+                const int bestLevel2 = (bestIdx2 == -1) ? -1 : view.mvKeysUn[bestIdx2].octave;
+                if(bestLevel==bestLevel2 && bestDist>mfNNratio*bestDist2)
+                    continue;
+
+                view.mvpMapPoints[bestIdx]=pMP;
+                view.mvbOutlier[bestIdx]=false;
+                nmatches++;
+            }
+        }
+    }
+
+    return nmatches;
+}
+
 float ORBmatcher::RadiusByViewingCos(const float &viewCos)
 {
     if(viewCos>0.998)
@@ -269,32 +455,48 @@ bool ORBmatcher::CheckDistEpipolarLine2(const cv::KeyPoint &kp1, const cv::KeyPo
 int ORBmatcher::SearchByBoW(KeyFrame* pKF,Frame &F, vector<MapPoint*> &vpMapPointMatches)
 {
     const vector<MapPoint*> vpMapPointsKF = pKF->GetMapPointMatches();
+    return SearchByBoW(pKF,vpMapPointsKF.data(),true,F,vpMapPointMatches);
+}
 
+int ORBmatcher::SearchByBoW(const FrozenMap &map, const int nKF, Frame &F, vector<MapPoint*> &vpMapPointMatches)
+{
+    // Bad points are not in the snapshot
+    return SearchByBoW(map.mvpKeyFrames[nKF],map.mvpMatchMapPoints.data()+map.mvMatchStart[nKF],false,F,vpMapPointMatches);
+}
+
+int ORBmatcher::SearchByBoW(KeyFrame* pKF, MapPoint* const* vpMapPointsKF, const bool bCheckBad, Frame &F, vector<MapPoint*> &vpMapPointMatches)
+{
     vpMapPointMatches = vector<MapPoint*>(F.N,static_cast<MapPoint*>(NULL));
 
-    const DBoW2::FeatureVector &vFeatVecKF = pKF->mFeatVec;
+    const FlatFeatureVector &featVecKF = pKF->mFlatFeatVec;
+    const FlatFeatureVector &featVecF = F.mFlatFeatVec;
+    const size_t nNodesKF = featVecKF.Nodes();
+    const size_t nNodesF = featVecF.Nodes();
 
     int nmatches=0;
 
-    vector<int> rotHist[HISTO_LENGTH];
-    for(int i=0;i<HISTO_LENGTH;i++)
-        rotHist[i].reserve(500);
+    vector<int>* rotHist = RotationHistogram();
     const float factor = 1.0f/HISTO_LENGTH;
 
+    // Distances from a keyframe descriptor to the frame descriptors of the node
+    vector<int> &vDists = mScratch.vnMatches1;
+
     // We perform the matching over ORB that belong to the same vocabulary node (at a certain level)
-    DBoW2::FeatureVector::const_iterator KFit = vFeatVecKF.begin();
-    DBoW2::FeatureVector::const_iterator Fit = F.mFeatVec.begin();
-    DBoW2::FeatureVector::const_iterator KFend = vFeatVecKF.end();
-    DBoW2::FeatureVector::const_iterator Fend = F.mFeatVec.end();
+    size_t nKF = 0, nF = 0;
 
-    while(KFit != KFend && Fit != Fend)
+    while(nKF < nNodesKF && nF < nNodesF)
     {
-        if(KFit->first == Fit->first)
+        if(featVecKF.NodeId(nKF) == featVecF.NodeId(nF))
         {
-            const vector<unsigned int> vIndicesKF = KFit->second;
-            const vector<unsigned int> vIndicesF = Fit->second;
+            const unsigned int* vIndicesKF = featVecKF.Begin(nKF);
+            const size_t nIndicesKF = featVecKF.Size(nKF);
+            const unsigned int* vIndicesF = featVecF.Begin(nF);
+            const size_t nIndicesF = featVecF.Size(nF);
+
+            // The frame descriptors of the node are gathered on the first keyframe point to match
+            bool bGathered = false;
 
-            for(size_t iKF=0; iKF<vIndicesKF.size(); iKF++)
+            for(size_t iKF=0; iKF<nIndicesKF; iKF++)
             {
                 const unsigned int realIdxKF = vIndicesKF[iKF];
 
@@ -303,10 +505,19 @@ int ORBmatcher::SearchByBoW(KeyFrame* pKF,Frame &F, vector<MapPoint*> &vpMapPoin
                 if(!pMP)
                     continue;
 
-                if(pMP->isBad())
+                if(bCheckBad && pMP->isBad())
                     continue;
 
-                const cv::Mat &dKF= pKF->mDescriptors.row(realIdxKF);
+                if(!bGathered)
+                {
+                    ClearCandidates();
+                    for(size_t iF=0; iF<nIndicesF; iF++)
+                        AddCandidate(F.mDescriptors,vIndicesF[iF]);
+                    vDists.resize(nIndicesF);
+                    bGathered = true;
+                }
+
+                DescriptorDistances(pKF->mDescriptors.ptr<unsigned char>(realIdxKF),mvCandidateDesc.data(),nIndicesF,vDists.data());
 
                 int bestDist1=256;
                 int bestIdxF =-1 ;
@@ -316,7 +527,7 @@ int ORBmatcher::SearchByBoW(KeyFrame* pKF,Frame &F, vector<MapPoint*> &vpMapPoin
                 int bestIdxFR =-1 ;
                 int bestDist2R=256;
 
-                for(size_t iF=0; iF<vIndicesF.size(); iF++)
+                for(size_t iF=0; iF<nIndicesF; iF++)
                 {
                     if(F.Nleft == -1){
                         const unsigned int realIdxF = vIndicesF[iF];
@@ -324,9 +535,7 @@ int ORBmatcher::SearchByBoW(KeyFrame* pKF,Frame &F, vector<MapPoint*> &vpMapPoin
                         if(vpMapPointMatches[realIdxF])
                             continue;
 
-                        const cv::Mat &dF = F.mDescriptors.row(realIdxF);
-
-                        const int dist =  DescriptorDistance(dKF,dF);
+                        const int dist = vDists[iF];
 
                         if(dist<bestDist1)
                         {
@@ -345,9 +554,7 @@ int ORBmatcher::SearchByBoW(KeyFrame* pKF,Frame &F, vector<MapPoint*> &vpMapPoin
                         if(vpMapPointMatches[realIdxF])
                             continue;
 
-                        const cv::Mat &dF = F.mDescriptors.row(realIdxF);
-
-                        const int dist =  DescriptorDistance(dKF,dF);
+                        const int dist = vDists[iF];
 
                         if(realIdxF < F.Nleft && dist<bestDist1){
                             bestDist2=bestDist1;
@@ -379,11 +586,11 @@ int ORBmatcher::SearchByBoW(KeyFrame* pKF,Frame &F, vector<MapPoint*> &vpMapPoin
                         const cv::KeyPoint &kp =
                                 (!pKF->mpCamera2) ? pKF->mvKeysUn[realIdxKF] :
                                 (realIdxKF >= pKF -> NLeft) ? pKF -> mvKeysRight[realIdxKF - pKF -> NLeft]
-                                                            : pKF -> mvKeys[realIdxKF];
+                                                            : pKF -> GetKeyPoint(realIdxKF);
 
                         if(mbCheckOrientation)
                         {
-                            cv::KeyPoint &Fkp =
+                            const cv::KeyPoint &Fkp =
                                     (!pKF->mpCamera2 || F.Nleft == -1) ? F.mvKeys[bestIdxF] :
                                     (bestIdxF >= F.Nleft) ? F.mvKeysRight[bestIdxF - F.Nleft]
                                                           : F.mvKeys[bestIdxF];
@@ -409,11 +616,11 @@ int ORBmatcher::SearchByBoW(KeyFrame* pKF,Frame &F, vector<MapPoint*> &vpMapPoin
                             const cv::KeyPoint &kp =
                                     (!pKF->mpCamera2) ? pKF->mvKeysUn[realIdxKF] :
                                     (realIdxKF >= pKF -> NLeft) ? pKF -> mvKeysRight[realIdxKF - pKF -> NLeft]
-                                                                : pKF -> mvKeys[realIdxKF];
+                                                                : pKF -> GetKeyPoint(realIdxKF);
 
                             if(mbCheckOrientation)
                             {
-                                cv::KeyPoint &Fkp =
+                                const cv::KeyPoint &Fkp =
                                         (!F.mpCamera2) ? F.mvKeys[bestIdxFR] :
                                         (bestIdxFR >= F.Nleft) ? F.mvKeysRight[bestIdxFR - F.Nleft]
                                                                : F.mvKeys[bestIdxFR];
@@ -434,16 +641,16 @@ int ORBmatcher::SearchByBoW(KeyFrame* pKF,Frame &F, vector<MapPoint*> &vpMapPoin
 
             }
 
-            KFit++;
-            Fit++;
+            nKF++;
+            nF++;
         }
-        else if(KFit->first < Fit->first)
+        else if(featVecKF.NodeId(nKF) < featVecF.NodeId(nF))
         {
-            KFit = vFeatVecKF.lower_bound(Fit->first);
+            nKF = featVecKF.LowerBound(nKF,featVecF.NodeId(nF));
         }
         else
         {
-            Fit = F.mFeatVec.lower_bound(KFit->first);
+            nF = featVecF.LowerBound(nF,featVecKF.NodeId(nKF));
         }
     }
 
@@ -542,7 +749,8 @@ int ORBmatcher::SearchByProjection(KeyFrame* pKF, cv::Mat Scw, const vector<MapP
         // Search in a radius
         const float radius = th*pKF->mvScaleFactors[nPredictedLevel];
 
-        const vector<size_t> vIndices = pKF->GetFeaturesInArea(uv.x,uv.y,radius);
+        pKF->GetFeaturesInArea(uv.x,uv.y,radius,mvAreaIndices);
+        const vector<size_t> &vIndices = mvAreaIndices;
 
         if(vIndices.empty())
             continue;
@@ -550,8 +758,7 @@ int ORBmatcher::SearchByProjection(KeyFrame* pKF, cv::Mat Scw, const vector<MapP
         // Match to the most similar keypoint in the radius
         const cv::Mat dMP = pMP->GetDescriptor();
 
-        int bestDist = 256;
-        int bestIdx = -1;
+        ClearCandidates();
         for(vector<size_t>::const_iterator vit=vIndices.begin(), vend=vIndices.end(); vit!=vend; vit++)
         {
             const size_t idx = *vit;
@@ -563,17 +770,12 @@ int ORBmatcher::SearchByProjection(KeyFrame* pKF, cv::Mat Scw, const vector<MapP
             if(kpLevel<nPredictedLevel-1 || kpLevel>nPredictedLevel)
                 continue;
 
-            const cv::Mat &dKF = pKF->mDescriptors.row(idx);
-
-            const int dist = DescriptorDistance(dMP,dKF);
-
-            if(dist<bestDist)
-            {
-                bestDist = dist;
-                bestIdx = idx;
-            }
+            AddCandidate(pKF->mDescriptors,idx);
         }
 
+        int bestDist, bestIdx, bestDist2, bestIdx2;
+        MatchCandidates(dMP,bestDist,bestIdx,bestDist2,bestIdx2);
+
         if(bestDist<=TH_LOW*ratioHamming)
         {
             vpMatched[bestIdx]=pMP;
@@ -659,7 +861,8 @@ int ORBmatcher::SearchByProjection(KeyFrame* pKF, cv::Mat Scw, const std::vector
         // Search in a radius
         const float radius = th*pKF->mvScaleFactors[nPredictedLevel];
 
-        const vector<size_t> vIndices = pKF->GetFeaturesInArea(u,v,radius);
+        pKF->GetFeaturesInArea(u,v,radius,mvAreaIndices);
+        const vector<size_t> &vIndices = mvAreaIndices;
 
         if(vIndices.empty())
             continue;
@@ -703,18 +906,26 @@ int ORBmatcher::SearchByProjection(KeyFrame* pKF, cv::Mat Scw, const std::vector
     return nmatches;
 }
 
-int ORBmatcher::SearchForInitialization(Frame &F1, Frame &F2, vector<cv::Point2f> &vbPrevMatched, vector<int> &vnMatches12, int windowSize)
+int ORBmatcher::SearchForInitialization(Frame &F1, Frame &F2, vector<cv::Point2f> &vbPrevMatched, vector<int> &vnMatches12, int windowSize, int trackWindowSize)
 {
     int nmatches=0;
-    vnMatches12 = vector<int>(F1.mvKeysUn.size(),-1);
 
-    vector<int> rotHist[HISTO_LENGTH];
-    for(int i=0;i<HISTO_LENGTH;i++)
-        rotHist[i].reserve(500);
+    // Keypoints still tracked from the previous frame
+    vector<bool> &vbTracked = mScratch.vbMatched1;
+    vbTracked.assign(F1.mvKeysUn.size(),false);
+    if(trackWindowSize>0 && vnMatches12.size()==F1.mvKeysUn.size())
+        for(size_t i1=0, iend1=vnMatches12.size(); i1<iend1; i1++)
+            vbTracked[i1] = vnMatches12[i1]>=0;
+
+    vnMatches12.assign(F1.mvKeysUn.size(),-1);
+
+    vector<int>* rotHist = RotationHistogram();
     const float factor = 1.0f/HISTO_LENGTH;
 
-    vector<int> vMatchedDistance(F2.mvKeysUn.size(),INT_MAX);
-    vector<int> vnMatches21(F2.mvKeysUn.size(),-1);
+    vector<int> &vMatchedDistance = mScratch.vnMatches1;
+    vMatchedDistance.assign(F2.mvKeysUn.size(),INT_MAX);
+    vector<int> &vnMatches21 = mScratch.vnMatches2;
+    vnMatches21.assign(F2.mvKeysUn.size(),-1);
 
     for(size_t i1=0, iend1=F1.mvKeysUn.size(); i1<iend1; i1++)
     {
@@ -723,7 +934,8 @@ int ORBmatcher::SearchForInitialization(Frame &F1, Frame &F2, vector<cv::Point2f
         if(level1>0)
             continue;
 
-        vector<size_t> vIndices2 = F2.GetFeaturesInArea(vbPrevMatched[i1].x,vbPrevMatched[i1].y, windowSize,level1,level1);
+        F2.GetFeaturesInArea(vbPrevMatched[i1].x,vbPrevMatched[i1].y, vbTracked[i1] ? trackWindowSize : windowSize,mvAreaIndices,level1,level1);
+        vector<size_t> &vIndices2 = mvAreaIndices;
 
         if(vIndices2.empty())
             continue;
@@ -823,38 +1035,43 @@ int ORBmatcher::SearchForInitialization(Frame &F1, Frame &F2, vector<cv::Point2f
 int ORBmatcher::SearchByBoW(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &vpMatches12)
 {
     const vector<cv::KeyPoint> &vKeysUn1 = pKF1->mvKeysUn;
-    const DBoW2::FeatureVector &vFeatVec1 = pKF1->mFeatVec;
+    const FlatFeatureVector &featVec1 = pKF1->mFlatFeatVec;
     const vector<MapPoint*> vpMapPoints1 = pKF1->GetMapPointMatches();
     const cv::Mat &Descriptors1 = pKF1->mDescriptors;
 
     const vector<cv::KeyPoint> &vKeysUn2 = pKF2->mvKeysUn;
-    const DBoW2::FeatureVector &vFeatVec2 = pKF2->mFeatVec;
+    const FlatFeatureVector &featVec2 = pKF2->mFlatFeatVec;
     const vector<MapPoint*> vpMapPoints2 = pKF2->GetMapPointMatches();
     const cv::Mat &Descriptors2 = pKF2->mDescriptors;
 
     vpMatches12 = vector<MapPoint*>(vpMapPoints1.size(),static_cast<MapPoint*>(NULL));
-    vector<bool> vbMatched2(vpMapPoints2.size(),false);
+    vector<bool> &vbMatched2 = mScratch.vbMatched2;
+    vbMatched2.assign(vpMapPoints2.size(),false);
 
-    vector<int> rotHist[HISTO_LENGTH];
-    for(int i=0;i<HISTO_LENGTH;i++)
-        rotHist[i].reserve(500);
+    vector<int>* rotHist = RotationHistogram();
 
     const float factor = 1.0f/HISTO_LENGTH;
 
     int nmatches = 0;
 
-    DBoW2::FeatureVector::const_iterator f1it = vFeatVec1.begin();
-    DBoW2::FeatureVector::const_iterator f2it = vFeatVec2.begin();
-    DBoW2::FeatureVector::const_iterator f1end = vFeatVec1.end();
-    DBoW2::FeatureVector::const_iterator f2end = vFeatVec2.end();
+    // Distances from a descriptor of pKF1 to the candidates of pKF2 in the node
+    vector<int> &vDists = mScratch.vnMatches1;
+
+    const size_t nNodes1 = featVec1.Nodes();
+    const size_t nNodes2 = featVec2.Nodes();
+    size_t n1 = 0, n2 = 0;
 
-    while(f1it != f1end && f2it != f2end)
+    while(n1 < nNodes1 && n2 < nNodes2)
     {
-        if(f1it->first == f2it->first)
+        if(featVec1.NodeId(n1) == featVec2.NodeId(n2))
         {
-            for(size_t i1=0, iend1=f1it->second.size(); i1<iend1; i1++)
+            // Candidates of pKF2: keypoints of the node with a good map point, gathered on the
+            // first point of pKF1 to match
+            bool bGathered = false;
+
+            for(const unsigned int* pIdx1=featVec1.Begin(n1), *pEnd1=featVec1.End(n1); pIdx1!=pEnd1; pIdx1++)
             {
-                const size_t idx1 = f1it->second[i1];
+                const size_t idx1 = *pIdx1;
                 if(pKF1 -> NLeft != -1 && idx1 >= pKF1 -> mvKeysUn.size()){
                     continue;
                 }
@@ -865,31 +1082,44 @@ int ORBmatcher::SearchByBoW(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
                 if(pMP1->isBad())
                     continue;
 
-                const cv::Mat &d1 = Descriptors1.row(idx1);
+                if(!bGathered)
+                {
+                    ClearCandidates();
+                    for(const unsigned int* pIdx2=featVec2.Begin(n2), *pEnd2=featVec2.End(n2); pIdx2!=pEnd2; pIdx2++)
+                    {
+                        const size_t idx2 = *pIdx2;
 
-                int bestDist1=256;
-                int bestIdx2 =-1 ;
-                int bestDist2=256;
+                        if(pKF2 -> NLeft != -1 && idx2 >= pKF2 -> mvKeysUn.size()){
+                            continue;
+                        }
 
-                for(size_t i2=0, iend2=f2it->second.size(); i2<iend2; i2++)
-                {
-                    const size_t idx2 = f2it->second[i2];
+                        MapPoint* pMP2 = vpMapPoints2[idx2];
+                        if(!pMP2 || pMP2->isBad())
+                            continue;
 
-                    if(pKF2 -> NLeft != -1 && idx2 >= pKF2 -> mvKeysUn.size()){
-                        continue;
+                        AddCandidate(Descriptors2,idx2);
                     }
+                    vDists.resize(mvCandidateIdx.size());
+                    bGathered = true;
+                }
 
-                    MapPoint* pMP2 = vpMapPoints2[idx2];
+                if(mvCandidateIdx.empty())
+                    break;
 
-                    if(vbMatched2[idx2] || !pMP2)
-                        continue;
+                DescriptorDistances(Descriptors1.ptr<unsigned char>(idx1),mvCandidateDesc.data(),mvCandidateIdx.size(),vDists.data());
 
-                    if(pMP2->isBad())
-                        continue;
+                int bestDist1=256;
+                int bestIdx2 =-1 ;
+                int bestDist2=256;
 
-                    const cv::Mat &d2 = Descriptors2.row(idx2);
+                for(size_t i2=0, iend2=mvCandidateIdx.size(); i2<iend2; i2++)
+                {
+                    const size_t idx2 = mvCandidateIdx[i2];
+
+                    if(vbMatched2[idx2])
+                        continue;
 
-                    int dist = DescriptorDistance(d1,d2);
+                    int dist = vDists[i2];
 
                     if(dist<bestDist1)
                     {
@@ -926,16 +1156,16 @@ int ORBmatcher::SearchByBoW(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
                 }
             }
 
-            f1it++;
-            f2it++;
+            n1++;
+            n2++;
         }
-        else if(f1it->first < f2it->first)
+        else if(featVec1.NodeId(n1) < featVec2.NodeId(n2))
         {
-            f1it = vFeatVec1.lower_bound(f2it->first);
+            n1 = featVec1.LowerBound(n1,featVec2.NodeId(n2));
         }
         else
         {
-            f2it = vFeatVec2.lower_bound(f1it->first);
+            n2 = featVec2.LowerBound(n2,featVec1.NodeId(n1));
         }
     }
 
@@ -1008,12 +1238,12 @@ int ORBmatcher::SearchForTriangulation(KeyFrame *pKF1, KeyFrame *pKF2, cv::Mat F
     // Compare only ORB that share the same node
 
     int nmatches=0;
-    vector<bool> vbMatched2(pKF2->N,false);
-    vector<int> vMatches12(pKF1->N,-1);
+    vector<bool> &vbMatched2 = mScratch.vbMatched2;
+    vbMatched2.assign(pKF2->N,false);
+    vector<int> &vMatches12 = mScratch.vnMatches1;
+    vMatches12.assign(pKF1->N,-1);
 
-    vector<int> rotHist[HISTO_LENGTH];
-    for(int i=0;i<HISTO_LENGTH;i++)
-        rotHist[i].reserve(500);
+    vector<int>* rotHist = RotationHistogram();
 
     const float factor = 1.0f/HISTO_LENGTH;
 
@@ -1046,7 +1276,7 @@ int ORBmatcher::SearchForTriangulation(KeyFrame *pKF1, KeyFrame *pKF2, cv::Mat F
 
 
                 const cv::KeyPoint &kp1 = (pKF1 -> NLeft == -1) ? pKF1->mvKeysUn[idx1]
-                                                                : (idx1 < pKF1 -> NLeft) ? pKF1 -> mvKeys[idx1]
+                                                                : (idx1 < pKF1 -> NLeft) ? pKF1 -> GetKeyPoint(idx1)
                                                                                          : pKF1 -> mvKeysRight[idx1 - pKF1 -> NLeft];
 
                 const bool bRight1 = (pKF1 -> NLeft == -1 || idx1 < pKF1 -> NLeft) ? false
@@ -1081,7 +1311,7 @@ int ORBmatcher::SearchForTriangulation(KeyFrame *pKF1, KeyFrame *pKF2, cv::Mat F
                         continue;
 
                     const cv::KeyPoint &kp2 = (pKF2 -> NLeft == -1) ? pKF2->mvKeysUn[idx2]
-                                                                    : (idx2 < pKF2 -> NLeft) ? pKF2 -> mvKeys[idx2]
+                                                                    : (idx2 < pKF2 -> NLeft) ? pKF2 -> GetKeyPoint(idx2)
                                                                                              : pKF2 -> mvKeysRight[idx2 - pKF2 -> NLeft];
                     const bool bRight2 = (pKF2 -> NLeft == -1 || idx2 < pKF2 -> NLeft) ? false
                                                                                        : true;
@@ -1139,7 +1369,7 @@ int ORBmatcher::SearchForTriangulation(KeyFrame *pKF1, KeyFrame *pKF2, cv::Mat F
                 if(bestIdx2>=0)
                 {
                     const cv::KeyPoint &kp2 = (pKF2 -> NLeft == -1) ? pKF2->mvKeysUn[bestIdx2]
-                                                                    : (bestIdx2 < pKF2 -> NLeft) ? pKF2 -> mvKeys[bestIdx2]
+                                                                    : (bestIdx2 < pKF2 -> NLeft) ? pKF2 -> GetKeyPoint(bestIdx2)
                                                                                                  : pKF2 -> mvKeysRight[bestIdx2 - pKF2 -> NLeft];
                     vMatches12[idx1]=bestIdx2;
                     nmatches++;
@@ -1246,17 +1476,23 @@ int ORBmatcher::SearchForTriangulation(KeyFrame *pKF1, KeyFrame *pKF2, cv::Mat F
             trr = pKF1->GetRightRotation_() * (-pKF2->GetRightRotation_().t() * pKF2->GetRightTranslation_()) + pKF1->GetRightTranslation_();
         }
 
+        // Pinhole cameras without a second camera (the usual case): F12 is the fundamental matrix that
+        // Pinhole::epipolarConstrain_ would rebuild for every pair, the candidates of each BoW node
+        // are gathered once and checked for all the keypoints of pKF1 in batches
+        const bool bBatch = !pKF1->mpCamera2 && !pKF2->mpCamera2 &&
+                            pCamera1->GetType()==pCamera1->CAM_PINHOLE && pCamera2->GetType()==pCamera2->CAM_PINHOLE;
+
         // Find matches between not tracked keypoints
         // Matching speed-up by ORB Vocabulary
         // Compare only ORB that share the same node
 
         int nmatches=0;
-        vector<bool> vbMatched2(pKF2->N,false);
-        vector<int> vMatches12(pKF1->N,-1);
+        vector<bool> &vbMatched2 = mScratch.vbMatched2;
+        vbMatched2.assign(pKF2->N,false);
+        vector<int> &vMatches12 = mScratch.vnMatches1;
+        vMatches12.assign(pKF1->N,-1);
 
-        vector<int> rotHist[HISTO_LENGTH];
-        for(int i=0;i<HISTO_LENGTH;i++)
-            rotHist[i].reserve(500);
+        vector<int>* rotHist = RotationHistogram();
 
         const float factor = 1.0f/HISTO_LENGTH;
 
@@ -1269,6 +1505,9 @@ int ORBmatcher::SearchForTriangulation(KeyFrame *pKF1, KeyFrame *pKF2, cv::Mat F
         {
             if(f1it->first == f2it->first)
             {
+                if(bBatch)
+                    AddTriangulationCandidates(pKF2,f2it->second,ep,bOnlyStereo);
+
                 for(size_t i1=0, iend1=f1it->second.size(); i1<iend1; i1++)
                 {
                     const size_t idx1 = f1it->second[i1];
@@ -1289,7 +1528,7 @@ int ORBmatcher::SearchForTriangulation(KeyFrame *pKF1, KeyFrame *pKF2, cv::Mat F
 
 
                     const cv::KeyPoint &kp1 = (pKF1 -> NLeft == -1) ? pKF1->mvKeysUn[idx1]
-                                                                    : (idx1 < pKF1 -> NLeft) ? pKF1 -> mvKeys[idx1]
+                                                                    : (idx1 < pKF1 -> NLeft) ? pKF1 -> GetKeyPoint(idx1)
                                                                                              : pKF1 -> mvKeysRight[idx1 - pKF1 -> NLeft];
 
                     const bool bRight1 = (pKF1 -> NLeft == -1 || idx1 < pKF1 -> NLeft) ? false
@@ -1300,89 +1539,94 @@ int ORBmatcher::SearchForTriangulation(KeyFrame *pKF1, KeyFrame *pKF2, cv::Mat F
                     int bestDist = TH_LOW;
                     int bestIdx2 = -1;
 
-                    for(size_t i2=0, iend2=f2it->second.size(); i2<iend2; i2++)
+                    if(bBatch)
+                        bestIdx2 = BestTriangulationCandidate(pKF1->mDescriptors.ptr<unsigned char>(idx1),kp1.pt,F12,bStereo1,bCoarse);
+                    else
                     {
-                        size_t idx2 = f2it->second[i2];
-
-                        MapPoint* pMP2 = pKF2->GetMapPoint(idx2);
-
-                        // If we have already matched or there is a MapPoint skip
-                        if(vbMatched2[idx2] || pMP2)
-                            continue;
+                        for(size_t i2=0, iend2=f2it->second.size(); i2<iend2; i2++)
+                        {
+                            size_t idx2 = f2it->second[i2];
 
-                        const bool bStereo2 = (!pKF2->mpCamera2 &&  pKF2->mvuRight[idx2]>=0);
+                            MapPoint* pMP2 = pKF2->GetMapPoint(idx2);
 
-                        if(bOnlyStereo)
-                            if(!bStereo2)
+                            // If we have already matched or there is a MapPoint skip
+                            if(vbMatched2[idx2] || pMP2)
                                 continue;
 
-                        const cv::Mat &d2 = pKF2->mDescriptors.row(idx2);
+                            const bool bStereo2 = (!pKF2->mpCamera2 &&  pKF2->mvuRight[idx2]>=0);
 
-                        const int dist = DescriptorDistance(d1,d2);
+                            if(bOnlyStereo)
+                                if(!bStereo2)
+                                    continue;
 
-                        if(dist>TH_LOW || dist>bestDist)
-                            continue;
+                            const cv::Mat &d2 = pKF2->mDescriptors.row(idx2);
 
-                        const cv::KeyPoint &kp2 = (pKF2 -> NLeft == -1) ? pKF2->mvKeysUn[idx2]
-                                                                        : (idx2 < pKF2 -> NLeft) ? pKF2 -> mvKeys[idx2]
-                                                                                                 : pKF2 -> mvKeysRight[idx2 - pKF2 -> NLeft];
-                        const bool bRight2 = (pKF2 -> NLeft == -1 || idx2 < pKF2 -> NLeft) ? false
-                                                                                           : true;
+                            const int dist = DescriptorDistance(d1,d2);
 
-                        if(!bStereo1 && !bStereo2 && !pKF1->mpCamera2)
-                        {
-                            const float distex = ep.x-kp2.pt.x;
-                            const float distey = ep.y-kp2.pt.y;
-                            if(distex*distex+distey*distey<100*pKF2->mvScaleFactors[kp2.octave])
-                            {
+                            if(dist>TH_LOW || dist>bestDist)
                                 continue;
-                            }
-                        }
 
-                        if(pKF1->mpCamera2 && pKF2->mpCamera2){
-                            if(bRight1 && bRight2){
-                                R12 = Rrr;
-                                t12 = trr;
+                            const cv::KeyPoint &kp2 = (pKF2 -> NLeft == -1) ? pKF2->mvKeysUn[idx2]
+                                                                            : (idx2 < pKF2 -> NLeft) ? pKF2 -> GetKeyPoint(idx2)
+                                                                                                     : pKF2 -> mvKeysRight[idx2 - pKF2 -> NLeft];
+                            const bool bRight2 = (pKF2 -> NLeft == -1 || idx2 < pKF2 -> NLeft) ? false
+                                                                                               : true;
 
-                                pCamera1 = pKF1->mpCamera2;
-                                pCamera2 = pKF2->mpCamera2;
+                            if(!bStereo1 && !bStereo2 && !pKF1->mpCamera2)
+                            {
+                                const float distex = ep.x-kp2.pt.x;
+                                const float distey = ep.y-kp2.pt.y;
+                                if(distex*distex+distey*distey<100*pKF2->mvScaleFactors[kp2.octave])
+                                {
+                                    continue;
+                                }
                             }
-                            else if(bRight1 && !bRight2){
-                                R12 = Rrl;
-                                t12 = trl;
 
-                                pCamera1 = pKF1->mpCamera2;
-                                pCamera2 = pKF2->mpCamera;
-                            }
-                            else if(!bRight1 && bRight2){
-                                R12 = Rlr;
-                                t12 = tlr;
+                            if(pKF1->mpCamera2 && pKF2->mpCamera2){
+                                if(bRight1 && bRight2){
+                                    R12 = Rrr;
+                                    t12 = trr;
+
+                                    pCamera1 = pKF1->mpCamera2;
+                                    pCamera2 = pKF2->mpCamera2;
+                                }
+                                else if(bRight1 && !bRight2){
+                                    R12 = Rrl;
+                                    t12 = trl;
+
+                                    pCamera1 = pKF1->mpCamera2;
+                                    pCamera2 = pKF2->mpCamera;
+                                }
+                                else if(!bRight1 && bRight2){
+                                    R12 = Rlr;
+                                    t12 = tlr;
+
+                                    pCamera1 = pKF1->mpCamera;
+                                    pCamera2 = pKF2->mpCamera2;
+                                }
+                                else{
+                                    R12 = Rll;
+                                    t12 = tll;
+
+                                    pCamera1 = pKF1->mpCamera;
+                                    pCamera2 = pKF2->mpCamera;
+                                }
 
-                                pCamera1 = pKF1->mpCamera;
-                                pCamera2 = pKF2->mpCamera2;
                             }
-                            else{
-                                R12 = Rll;
-                                t12 = tll;
-
-                                pCamera1 = pKF1->mpCamera;
-                                pCamera2 = pKF2->mpCamera;
-                            }
-
-                        }
 
 
-                        if(pCamera1->epipolarConstrain_(pCamera2,kp1,kp2,R12,t12,pKF1->mvLevelSigma2[kp1.octave],pKF2->mvLevelSigma2[kp2.octave])||bCoarse) // MODIFICATION_2
-                        {
-                            bestIdx2 = idx2;
-                            bestDist = dist;
+                            if(pCamera1->epipolarConstrain_(pCamera2,kp1,kp2,R12,t12,pKF1->mvLevelSigma2[kp1.octave],pKF2->mvLevelSigma2[kp2.octave])||bCoarse) // MODIFICATION_2
+                            {
+                                bestIdx2 = idx2;
+                                bestDist = dist;
+                            }
                         }
                     }
 
                     if(bestIdx2>=0)
                     {
                         const cv::KeyPoint &kp2 = (pKF2 -> NLeft == -1) ? pKF2->mvKeysUn[bestIdx2]
-                                                                        : (bestIdx2 < pKF2 -> NLeft) ? pKF2 -> mvKeys[bestIdx2]
+                                                                        : (bestIdx2 < pKF2 -> NLeft) ? pKF2 -> GetKeyPoint(bestIdx2)
                                                                                                      : pKF2 -> mvKeysRight[bestIdx2 - pKF2 -> NLeft];
                         vMatches12[idx1]=bestIdx2;
                         nmatches++;
@@ -1474,14 +1718,14 @@ int ORBmatcher::SearchForTriangulation(KeyFrame *pKF1, KeyFrame *pKF2, cv::Mat F
         // Compare only ORB that share the same node
 
         int nmatches=0;
-        vector<bool> vbMatched2(pKF2->N,false);
-        vector<int> vMatches12(pKF1->N,-1);
+        vector<bool> &vbMatched2 = mScratch.vbMatched2;
+        vbMatched2.assign(pKF2->N,false);
+        vector<int> &vMatches12 = mScratch.vnMatches1;
+        vMatches12.assign(pKF1->N,-1);
 
         vector<cv::Mat> vMatchesPoints12(pKF1 -> N);
 
-        vector<int> rotHist[HISTO_LENGTH];
-        for(int i=0;i<HISTO_LENGTH;i++)
-            rotHist[i].reserve(500);
+        vector<int>* rotHist = RotationHistogram();
 
         const float factor = 1.0f/HISTO_LENGTH;
 
@@ -1505,7 +1749,7 @@ int ORBmatcher::SearchForTriangulation(KeyFrame *pKF1, KeyFrame *pKF2, cv::Mat F
                         continue;
 
                     const cv::KeyPoint &kp1 = (pKF1 -> NLeft == -1) ? pKF1->mvKeysUn[idx1]
-                                                                    : (idx1 < pKF1 -> NLeft) ? pKF1 -> mvKeys[idx1]
+                                                                    : (idx1 < pKF1 -> NLeft) ? pKF1 -> GetKeyPoint(idx1)
                                                                                              : pKF1 -> mvKeysRight[idx1 - pKF1 -> NLeft];
 
                     const bool bRight1 = (pKF1 -> NLeft == -1 || idx1 < pKF1 -> NLeft) ? false
@@ -1539,7 +1783,7 @@ int ORBmatcher::SearchForTriangulation(KeyFrame *pKF1, KeyFrame *pKF2, cv::Mat F
 
 
                         const cv::KeyPoint &kp2 = (pKF2 -> NLeft == -1) ? pKF2->mvKeysUn[idx2]
-                                                                        : (idx2 < pKF2 -> NLeft) ? pKF2 -> mvKeys[idx2]
+                                                                        : (idx2 < pKF2 -> NLeft) ? pKF2 -> GetKeyPoint(idx2)
                                                                                                  : pKF2 -> mvKeysRight[idx2 - pKF2 -> NLeft];
                         const bool bRight2 = (pKF2 -> NLeft == -1 || idx2 < pKF2 -> NLeft) ? false
                                                                                            : true;
@@ -1572,7 +1816,7 @@ int ORBmatcher::SearchForTriangulation(KeyFrame *pKF1, KeyFrame *pKF2, cv::Mat F
                     if(bestIdx2>=0)
                     {
                         const cv::KeyPoint &kp2 = (pKF2 -> NLeft == -1) ? pKF2->mvKeysUn[bestIdx2]
-                                                                        : (bestIdx2 < pKF2 -> NLeft) ? pKF2 -> mvKeys[bestIdx2]
+                                                                        : (bestIdx2 < pKF2 -> NLeft) ? pKF2 -> GetKeyPoint(bestIdx2)
                                                                                                      : pKF2 -> mvKeysRight[bestIdx2 - pKF2 -> NLeft];
                         vMatches12[idx1]=bestIdx2;
                         vMatchesPoints12[idx1] = bestPoint;
@@ -1640,7 +1884,8 @@ int ORBmatcher::SearchForTriangulation(KeyFrame *pKF1, KeyFrame *pKF2, cv::Mat F
         return nmatches;
     }
 
-int ORBmatcher::Fuse(KeyFrame *pKF, const vector<MapPoint *> &vpMapPoints, const float th, const bool bRight)
+int ORBmatcher::Fuse(KeyFrame *pKF, const vector<MapPoint *> &vpMapPoints, const float th, const bool bRight,
+                     vector<pair<MapPoint*,MapPoint*> >* pvReplacements)
 {
     cv::Mat Rcw,tcw, Ow;
     GeometricCamera* pCamera;
@@ -1746,7 +1991,8 @@ int ORBmatcher::Fuse(KeyFrame *pKF, const vector<MapPoint *> &vpMapPoints, const
         // Search in a radius
         const float radius = th*pKF->mvScaleFactors[nPredictedLevel];
 
-        const vector<size_t> vIndices = pKF->GetFeaturesInArea(uv.x,uv.y,radius,bRight);
+        pKF->GetFeaturesInArea(uv.x,uv.y,radius,mvAreaIndices,bRight);
+        const vector<size_t> &vIndices = mvAreaIndices;
 
         if(vIndices.empty())
         {
@@ -1764,7 +2010,7 @@ int ORBmatcher::Fuse(KeyFrame *pKF, const vector<MapPoint *> &vpMapPoints, const
         {
             size_t idx = *vit;
             const cv::KeyPoint &kp = (pKF -> NLeft == -1) ? pKF->mvKeysUn[idx]
-                                                          : (!bRight) ? pKF -> mvKeys[idx]
+                                                          : (!bRight) ? pKF -> GetKeyPoint(idx)
                                                                       : pKF -> mvKeysRight[idx];
 
             const int &kpLevel= kp.octave;
@@ -1819,7 +2065,9 @@ int ORBmatcher::Fuse(KeyFrame *pKF, const vector<MapPoint *> &vpMapPoints, const
             {
                 if(!pMPinKF->isBad())
                 {
-                    if(pMPinKF->Observations()>pMP->Observations())
+                    if(pvReplacements)
+                        pvReplacements->push_back(make_pair(pMP,pMPinKF));
+                    else if(pMPinKF->Observations()>pMP->Observations())
                         pMP->Replace(pMPinKF);
                     else
                         pMPinKF->Replace(pMP);
@@ -1913,7 +2161,8 @@ int ORBmatcher::Fuse(KeyFrame *pKF, cv::Mat Scw, const vector<MapPoint *> &vpPoi
         // Search in a radius
         const float radius = th*pKF->mvScaleFactors[nPredictedLevel];
 
-        const vector<size_t> vIndices = pKF->GetFeaturesInArea(uv.x,uv.y,radius);
+        pKF->GetFeaturesInArea(uv.x,uv.y,radius,mvAreaIndices);
+        const vector<size_t> &vIndices = mvAreaIndices;
 
         if(vIndices.empty())
             continue;
@@ -1991,8 +2240,10 @@ int ORBmatcher::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint*> &
     const vector<MapPoint*> vpMapPoints2 = pKF2->GetMapPointMatches();
     const int N2 = vpMapPoints2.size();
 
-    vector<bool> vbAlreadyMatched1(N1,false);
-    vector<bool> vbAlreadyMatched2(N2,false);
+    vector<bool> &vbAlreadyMatched1 = mScratch.vbMatched1;
+    vbAlreadyMatched1.assign(N1,false);
+    vector<bool> &vbAlreadyMatched2 = mScratch.vbMatched2;
+    vbAlreadyMatched2.assign(N2,false);
 
     for(int i=0; i<N1; i++)
     {
@@ -2006,8 +2257,10 @@ int ORBmatcher::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint*> &
         }
     }
 
-    vector<int> vnMatch1(N1,-1);
-    vector<int> vnMatch2(N2,-1);
+    vector<int> &vnMatch1 = mScratch.vnMatches1;
+    vnMatch1.assign(N1,-1);
+    vector<int> &vnMatch2 = mScratch.vnMatches2;
+    vnMatch2.assign(N2,-1);
 
     // Transform from KF1 to KF2 and search
     for(int i1=0; i1<N1; i1++)
@@ -2053,7 +2306,8 @@ int ORBmatcher::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint*> &
         // Search in a radius
         const float radius = th*pKF2->mvScaleFactors[nPredictedLevel];
 
-        const vector<size_t> vIndices = pKF2->GetFeaturesInArea(u,v,radius);
+        pKF2->GetFeaturesInArea(u,v,radius,mvAreaIndices);
+        const vector<size_t> &vIndices = mvAreaIndices;
 
         if(vIndices.empty())
             continue;
@@ -2133,7 +2387,8 @@ int ORBmatcher::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint*> &
         // Search in a radius of 2.5*sigma(ScaleLevel)
         const float radius = th*pKF1->mvScaleFactors[nPredictedLevel];
 
-        const vector<size_t> vIndices = pKF1->GetFeaturesInArea(u,v,radius);
+        pKF1->GetFeaturesInArea(u,v,radius,mvAreaIndices);
+        const vector<size_t> &vIndices = mvAreaIndices;
 
         if(vIndices.empty())
             continue;
@@ -2192,12 +2447,27 @@ int ORBmatcher::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint*> &
 
     int ORBmatcher::SearchByProjection(Frame &CurrentFrame, const Frame &LastFrame, const float th, const bool bMono)
     {
+        ORB_TRACE_SCOPE("ORBmatcher::SearchByProjectionLast");
+        switch(CurrentFrame.mCameraSetup)
+        {
+        case CAMERA_SPLIT:
+            return SearchByProjectionLast<CAMERA_SPLIT>(CurrentFrame,LastFrame,th,bMono);
+        case CAMERA_RECTIFIED:
+            return SearchByProjectionLast<CAMERA_RECTIFIED>(CurrentFrame,LastFrame,th,bMono);
+        default:
+            return SearchByProjectionLast<CAMERA_MONOCULAR>(CurrentFrame,LastFrame,th,bMono);
+        }
+    }
+
+    template<int Setup>
+    int ORBmatcher::SearchByProjectionLast(Frame &CurrentFrame, const Frame &LastFrame, const float th, const bool bMono)
+    {
+        typedef CameraSetupTraits<Setup> Traits;
+
         int nmatches = 0;
 
         // Rotation Histogram (to check rotation consistency)
-        vector<int> rotHist[HISTO_LENGTH];
-        for(int i=0;i<HISTO_LENGTH;i++)
-            rotHist[i].reserve(500);
+        vector<int>* rotHist = RotationHistogram();
         const float factor = 1.0f/HISTO_LENGTH;
 
         //^ Current Frame Wolrd pose
@@ -2223,7 +2493,7 @@ int ORBmatcher::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint*> &
                 {
                     // Project
                     //^ LastFrame MapPoint world pose
-                    cv::Mat x3Dw = pMP->GetWorldPos()
+                    cv::Mat x3Dw = pMP->GetWorldPos();
                     //^ LastFrame MapPoint world pose -> CurrentFrame에 대한 LastFrame MapPoint pose로 transformation
                     //^ = LastFrame MapPoint를 CurrentFrame으로 projection
                     cv::Mat x3Dc = Rcw*x3Dw+tcw;
@@ -2243,20 +2513,19 @@ int ORBmatcher::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint*> &
                     if(uv.y<CurrentFrame.mnMinY || uv.y>CurrentFrame.mnMaxY)
                         continue;
 
-                    int nLastOctave = (LastFrame.Nleft == -1 || i < LastFrame.Nleft) ? LastFrame.mvKeys[i].octave
-                                                                                     : LastFrame.mvKeysRight[i - LastFrame.Nleft].octave;
+                    int nLastOctave = LastFrame.mKeysSoA.mvOctave[i];
 
                     // Search in a window. Size depends on scale
                     float radius = th*CurrentFrame.mvScaleFactors[nLastOctave];
 
-                    vector<size_t> vIndices2;
+                    vector<size_t> &vIndices2 = mvAreaIndices;
 
                     if(bForward)
-                        vIndices2 = CurrentFrame.GetFeaturesInArea(uv.x,uv.y, radius, nLastOctave);
+                        CurrentFrame.GetFeaturesInArea(uv.x,uv.y, radius, vIndices2, nLastOctave);
                     else if(bBackward)
-                        vIndices2 = CurrentFrame.GetFeaturesInArea(uv.x,uv.y, radius, 0, nLastOctave);
+                        CurrentFrame.GetFeaturesInArea(uv.x,uv.y, radius, vIndices2, 0, nLastOctave);
                     else
-                        vIndices2 = CurrentFrame.GetFeaturesInArea(uv.x,uv.y, radius, nLastOctave-1, nLastOctave+1);
+                        CurrentFrame.GetFeaturesInArea(uv.x,uv.y, radius, vIndices2, nLastOctave-1, nLastOctave+1);
 
                     if(vIndices2.empty())
                         continue;
@@ -2264,9 +2533,7 @@ int ORBmatcher::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint*> &
                     //^ LastFrame의 descriptor
                     const cv::Mat dMP = pMP->GetDescriptor();
 
-                    int bestDist = 256;
-                    int bestIdx2 = -1;
-
+                    ClearCandidates();
                     for(vector<size_t>::const_iterator vit=vIndices2.begin(), vend=vIndices2.end(); vit!=vend; vit++)
                     {
                         const size_t i2 = *vit;
@@ -2275,7 +2542,7 @@ int ORBmatcher::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint*> &
                             if(CurrentFrame.mvpMapPoints[i2]->Observations()>0)
                                 continue;
 
-                        if(CurrentFrame.Nleft == -1 && CurrentFrame.mvuRight[i2]>0)
+                        if(Traits::bRightCoords && CurrentFrame.mvuRight[i2]>0)
                         {
                             const float ur = uv.x - CurrentFrame.mbf*invzc;
                             const float er = fabs(ur - CurrentFrame.mvuRight[i2]);
@@ -2284,18 +2551,13 @@ int ORBmatcher::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint*> &
                         }
 
                         //^ CurrentFrame의 Descriptor
-                        const cv::Mat &d = CurrentFrame.mDescriptors.row(i2);
-
-                        //^ LastFrame과 CurrentFrame의 descriptor 간 distance
-                        const int dist = DescriptorDistance(dMP,d);
-
-                        if(dist<bestDist)
-                        {
-                            bestDist=dist;
-                            bestIdx2=i2;
-                        }
+                        AddCandidate(CurrentFrame.mDescriptors,i2);
                     }
 
+                    //^ LastFrame과 CurrentFrame의 descriptor 간 distance
+                    int bestDist, bestIdx2, bestDist2, bestIdx22;
+                    MatchCandidates(dMP,bestDist,bestIdx2,bestDist2,bestIdx22);
+
                     //^ Best distance가 최대 threshold보다 작을 때(최대 margin)
                     if(bestDist<=TH_HIGH)
                     {
@@ -2305,14 +2567,7 @@ int ORBmatcher::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint*> &
 
                         if(mbCheckOrientation)
                         {
-                            cv::KeyPoint kpLF = (LastFrame.Nleft == -1) ? LastFrame.mvKeysUn[i]
-                                                                        : (i < LastFrame.Nleft) ? LastFrame.mvKeys[i]
-                                                                                                : LastFrame.mvKeysRight[i - LastFrame.Nleft];
-
-                            cv::KeyPoint kpCF = (CurrentFrame.Nleft == -1) ? CurrentFrame.mvKeysUn[bestIdx2]
-                                                                           : (bestIdx2 < CurrentFrame.Nleft) ? CurrentFrame.mvKeys[bestIdx2]
-                                                                                                             : CurrentFrame.mvKeysRight[bestIdx2 - CurrentFrame.Nleft];
-                            float rot = kpLF.angle-kpCF.angle;
+                            float rot = LastFrame.mKeysSoA.mvAngle[i]-CurrentFrame.mKeysSoA.mvAngle[bestIdx2];
                             if(rot<0.0)
                                 rot+=360.0f;
                             int bin = round(rot*factor);
@@ -2322,31 +2577,28 @@ int ORBmatcher::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint*> &
                             rotHist[bin].push_back(bestIdx2);
                         }
                     }
-                    if(CurrentFrame.Nleft != -1){
+                    if(Traits::bSplit){
                         cv::Mat x3Dr = CurrentFrame.mTrl.colRange(0,3).rowRange(0,3) * x3Dc + CurrentFrame.mTrl.col(3);
 
                         cv::Point2f uv = CurrentFrame.mpCamera->project(x3Dr);
 
-                        int nLastOctave = (LastFrame.Nleft == -1 || i < LastFrame.Nleft) ? LastFrame.mvKeys[i].octave
-                                                                                         : LastFrame.mvKeysRight[i - LastFrame.Nleft].octave;
+                        int nLastOctave = LastFrame.mKeysSoA.mvOctave[i];
 
                         // Search in a window. Size depends on scale
                         float radius = th*CurrentFrame.mvScaleFactors[nLastOctave];
 
-                        vector<size_t> vIndices2;
+                        vector<size_t> &vIndices2 = mvAreaIndices;
 
                         if(bForward)
-                            vIndices2 = CurrentFrame.GetFeaturesInArea(uv.x,uv.y, radius, nLastOctave, -1,true);
+                            CurrentFrame.GetFeaturesInArea(uv.x,uv.y, radius, vIndices2, nLastOctave, -1,true);
                         else if(bBackward)
-                            vIndices2 = CurrentFrame.GetFeaturesInArea(uv.x,uv.y, radius, 0, nLastOctave, true);
+                            CurrentFrame.GetFeaturesInArea(uv.x,uv.y, radius, vIndices2, 0, nLastOctave, true);
                         else
-                            vIndices2 = CurrentFrame.GetFeaturesInArea(uv.x,uv.y, radius, nLastOctave-1, nLastOctave+1, true);
+                            CurrentFrame.GetFeaturesInArea(uv.x,uv.y, radius, vIndices2, nLastOctave-1, nLastOctave+1, true);
 
                         const cv::Mat dMP = pMP->GetDescriptor();
 
-                        int bestDist = 256;
-                        int bestIdx2 = -1;
-
+                        ClearCandidates();
                         for(vector<size_t>::const_iterator vit=vIndices2.begin(), vend=vIndices2.end(); vit!=vend; vit++)
                         {
                             const size_t i2 = *vit;
@@ -2354,30 +2606,19 @@ int ORBmatcher::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint*> &
                                 if(CurrentFrame.mvpMapPoints[i2 + CurrentFrame.Nleft]->Observations()>0)
                                     continue;
 
-                            const cv::Mat &d = CurrentFrame.mDescriptors.row(i2 + CurrentFrame.Nleft);
-
-                            const int dist = DescriptorDistance(dMP,d);
-
-                            if(dist<bestDist)
-                            {
-                                bestDist=dist;
-                                bestIdx2=i2;
-                            }
+                            AddCandidate(CurrentFrame.mDescriptors,i2 + CurrentFrame.Nleft,i2);
                         }
 
+                        int bestDist, bestIdx2, bestDist2, bestIdx22;
+                        MatchCandidates(dMP,bestDist,bestIdx2,bestDist2,bestIdx22);
+
                         if(bestDist<=TH_HIGH)
                         {
                             CurrentFrame.mvpMapPoints[bestIdx2 + CurrentFrame.Nleft]=pMP;
                             nmatches++;
                             if(mbCheckOrientation)
                             {
-                                cv::KeyPoint kpLF = (LastFrame.Nleft == -1) ? LastFrame.mvKeysUn[i]
-                                                                            : (i < LastFrame.Nleft) ? LastFrame.mvKeys[i]
-                                                                                                    : LastFrame.mvKeysRight[i - LastFrame.Nleft];
-
-                                cv::KeyPoint kpCF = CurrentFrame.mvKeysRight[bestIdx2];
-
-                                float rot = kpLF.angle-kpCF.angle;
+                                float rot = LastFrame.mKeysSoA.mvAngle[i]-CurrentFrame.mKeysSoA.mvAngle[bestIdx2 + CurrentFrame.Nleft];
                                 if(rot<0.0)
                                     rot+=360.0f;
                                 int bin = round(rot*factor);
@@ -2427,9 +2668,7 @@ int ORBmatcher::SearchByProjection(Frame &CurrentFrame, KeyFrame *pKF, const set
     const cv::Mat Ow = -Rcw.t()*tcw;
 
     // Rotation Histogram (to check rotation consistency)
-    vector<int> rotHist[HISTO_LENGTH];
-    for(int i=0;i<HISTO_LENGTH;i++)
-        rotHist[i].reserve(500);
+    vector<int>* rotHist = RotationHistogram();
     const float factor = 1.0f/HISTO_LENGTH;
 
     const vector<MapPoint*> vpMPs = pKF->GetMapPointMatches();
@@ -2469,7 +2708,8 @@ int ORBmatcher::SearchByProjection(Frame &CurrentFrame, KeyFrame *pKF, const set
                 // Search in a window
                 const float radius = th*CurrentFrame.mvScaleFactors[nPredictedLevel];
 
-                const vector<size_t> vIndices2 = CurrentFrame.GetFeaturesInArea(uv.x, uv.y, radius, nPredictedLevel-1, nPredictedLevel+1);
+                CurrentFrame.GetFeaturesInArea(uv.x, uv.y, radius, mvAreaIndices, nPredictedLevel-1, nPredictedLevel+1);
+                const vector<size_t> &vIndices2 = mvAreaIndices;
 
                 if(vIndices2.empty())
                     continue;
@@ -2503,7 +2743,7 @@ int ORBmatcher::SearchByProjection(Frame &CurrentFrame, KeyFrame *pKF, const set
 
                     if(mbCheckOrientation)
                     {
-                        float rot = pKF->mvKeysUn[i].angle-CurrentFrame.mvKeysUn[bestIdx2].angle;
+                        float rot = pKF->mvKeysUn[i].angle-CurrentFrame.mKeysSoA.mvAngle[bestIdx2];
                         if(rot<0.0)
                             rot+=360.0f;
                         int bin = round(rot*factor);
@@ -2542,6 +2782,113 @@ int ORBmatcher::SearchByProjection(Frame &CurrentFrame, KeyFrame *pKF, const set
     return nmatches;
 }
 
+int ORBmatcher::SearchByProjection(Frame &CurrentFrame, const FrozenMap &map, const int nKF, const set<MapPoint*> &sAlreadyFound, const float th , const int ORBdist)
+{
+    int nmatches = 0;
+
+    const cv::Mat Rcw = CurrentFrame.mTcw.rowRange(0,3).colRange(0,3);
+    const cv::Mat tcw = CurrentFrame.mTcw.rowRange(0,3).col(3);
+    const cv::Mat Ow = -Rcw.t()*tcw;
+    const cv::Matx33f Rcwx = Rcw;
+    const cv::Matx31f tcwx = tcw;
+    const cv::Matx31f Owx = Ow;
+
+    // Rotation Histogram (to check rotation consistency)
+    vector<int>* rotHist = RotationHistogram();
+    const float factor = 1.0f/HISTO_LENGTH;
+
+    KeyFrame* pKF = map.mvpKeyFrames[nKF];
+    const int start = map.mvMatchStart[nKF];
+
+    for(int i=0, iend=map.mvMatchStart[nKF+1]-start; i<iend; i++)
+    {
+        const int ip = map.mvMatchPoint[start+i];
+        if(ip<0 || sAlreadyFound.count(map.mvpMapPoints[ip]))
+            continue;
+
+        //Project
+        const cv::Matx31f x3Dw(map.mvX[ip],map.mvY[ip],map.mvZ[ip]);
+        const cv::Matx31f x3Dc = Rcwx*x3Dw+tcwx;
+
+        const cv::Point2f uv = CurrentFrame.mpCamera->project(x3Dc);
+
+        if(uv.x<CurrentFrame.mnMinX || uv.x>CurrentFrame.mnMaxX)
+            continue;
+        if(uv.y<CurrentFrame.mnMinY || uv.y>CurrentFrame.mnMaxY)
+            continue;
+
+        // Depth must be inside the scale pyramid of the image
+        const float dist3D = cv::norm(x3Dw-Owx);
+        if(dist3D<map.mvMinDist[ip] || dist3D>map.mvMaxDist[ip])
+            continue;
+
+        // Compute predicted scale level
+        int nPredictedLevel = ceil(log(map.mvScaleDist[ip]/dist3D)/CurrentFrame.mfLogScaleFactor);
+        if(nPredictedLevel<0)
+            nPredictedLevel = 0;
+        else if(nPredictedLevel>=CurrentFrame.mnScaleLevels)
+            nPredictedLevel = CurrentFrame.mnScaleLevels-1;
+
+        // Search in a window
+        const float radius = th*CurrentFrame.mvScaleFactors[nPredictedLevel];
+
+        CurrentFrame.GetFeaturesInArea(uv.x, uv.y, radius, mvAreaIndices, nPredictedLevel-1, nPredictedLevel+1);
+        const vector<size_t> &vIndices2 = mvAreaIndices;
+
+        if(vIndices2.empty())
+            continue;
+
+        ClearCandidates();
+        for(vector<size_t>::const_iterator vit=vIndices2.begin(); vit!=vIndices2.end(); vit++)
+            if(!CurrentFrame.mvpMapPoints[*vit])
+                AddCandidate(CurrentFrame.mDescriptors,*vit);
+
+        int bestDist, bestIdx2, bestDist2, bestIdx22;
+        MatchCandidates(map.mDescriptors.row(ip),bestDist,bestIdx2,bestDist2,bestIdx22);
+
+        if(bestDist<=ORBdist)
+        {
+            CurrentFrame.mvpMapPoints[bestIdx2]=map.mvpMapPoints[ip];
+            nmatches++;
+
+            if(mbCheckOrientation)
+            {
+                float rot = pKF->mvKeysUn[i].angle-CurrentFrame.mKeysSoA.mvAngle[bestIdx2];
+                if(rot<0.0)
+                    rot+=360.0f;
+                int bin = round(rot*factor);
+                if(bin==HISTO_LENGTH)
+                    bin=0;
+                assert(bin>=0 && bin<HISTO_LENGTH);
+                rotHist[bin].push_back(bestIdx2);
+            }
+        }
+    }
+
+    if(mbCheckOrientation)
+    {
+        int ind1=-1;
+        int ind2=-1;
+        int ind3=-1;
+
+        ComputeThreeMaxima(rotHist,HISTO_LENGTH,ind1,ind2,ind3);
+
+        for(int i=0; i<HISTO_LENGTH; i++)
+        {
+            if(i!=ind1 && i!=ind2 && i!=ind3)
+            {
+                for(size_t j=0, jend=rotHist[i].size(); j<jend; j++)
+                {
+                    CurrentFrame.mvpMapPoints[rotHist[i][j]]=NULL;
+                    nmatches--;
+                }
+            }
+        }
+    }
+
+    return nmatches;
+}
+
 void ORBmatcher::ComputeThreeMaxima(vector<int>* histo, const int L, int &ind1, int &ind2, int &ind3)
 {
     int max1=0;
@@ -2586,12 +2933,20 @@ void ORBmatcher::ComputeThreeMaxima(vector<int>* histo, const int L, int &ind1,
 }
 
 
+// Hamming distance kernels for 256-bit ORB descriptors.
+// The best kernel supported by the running CPU is selected once at load time.
+namespace
+{
+
+typedef int (*DistanceKernel)(const unsigned char *pa, const unsigned char *pb);
+typedef void (*DistanceBatchKernel)(const unsigned char *pa, const unsigned char *pB, const size_t stride, const int N, int *pDists);
+
 // Bit set count operation from
 // http://graphics.stanford.edu/~seander/bithacks.html#CountBitsSetParallel
-int ORBmatcher::DescriptorDistance(const cv::Mat &a, const cv::Mat &b)
+inline int DistanceScalar(const unsigned char *pa8, const unsigned char *pb8)
 {
-    const int *pa = a.ptr<int32_t>();
-    const int *pb = b.ptr<int32_t>();
+    const int *pa = reinterpret_cast<const int*>(pa8);
+    const int *pb = reinterpret_cast<const int*>(pb8);
 
     int dist=0;
 
@@ -2606,4 +2961,293 @@ int ORBmatcher::DescriptorDistance(const cv::Mat &a, const cv::Mat &b)
     return dist;
 }
 
+void DistanceBatchScalar(const unsigned char *pa, const unsigned char *pB, const size_t stride, const int N, int *pDists)
+{
+    for(int i=0; i<N; i++, pB+=stride)
+        pDists[i] = DistanceScalar(pa,pB);
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ORB_DISTANCE_X86
+
+__attribute__((target("popcnt")))
+inline int DistancePopcnt(const unsigned char *pa, const unsigned char *pb)
+{
+    uint64_t a[4], b[4];
+    memcpy(a,pa,32);
+    memcpy(b,pb,32);
+    return __builtin_popcountll(a[0]^b[0]) + __builtin_popcountll(a[1]^b[1]) +
+           __builtin_popcountll(a[2]^b[2]) + __builtin_popcountll(a[3]^b[3]);
+}
+
+__attribute__((target("popcnt")))
+void DistanceBatchPopcnt(const unsigned char *pa, const unsigned char *pB, const size_t stride, const int N, int *pDists)
+{
+    for(int i=0; i<N; i++, pB+=stride)
+        pDists[i] = DistancePopcnt(pa,pB);
+}
+
+// Nibble lookup popcount (Mula et al.), 32 bytes per descriptor in one register
+__attribute__((target("avx2")))
+inline int DistanceAVX2(const unsigned char *pa, const unsigned char *pb)
+{
+    const __m256i lookup = _mm256_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,
+                                            0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+    const __m256i low_mask = _mm256_set1_epi8(0x0f);
+
+    const __m256i v = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(pa)),
+                                       _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pb)));
+    const __m256i lo = _mm256_and_si256(v,low_mask);
+    const __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v,4),low_mask);
+    const __m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lookup,lo),_mm256_shuffle_epi8(lookup,hi));
+    const __m256i sum = _mm256_sad_epu8(cnt,_mm256_setzero_si256());
+
+    const __m128i sum128 = _mm_add_epi64(_mm256_castsi256_si128(sum),_mm256_extracti128_si256(sum,1));
+    return _mm_cvtsi128_si32(sum128) + _mm_extract_epi16(sum128,4);
+}
+
+__attribute__((target("avx2")))
+void DistanceBatchAVX2(const unsigned char *pa, const unsigned char *pB, const size_t stride, const int N, int *pDists)
+{
+    for(int i=0; i<N; i++, pB+=stride)
+        pDists[i] = DistanceAVX2(pa,pB);
+}
+
+#if defined(__GNUC__) && !defined(__clang__) && (__GNUC__ >= 8)
+#define ORB_DISTANCE_AVX512
+__attribute__((target("avx512vpopcntdq,avx512vl,avx2")))
+inline int DistanceAVX512(const unsigned char *pa, const unsigned char *pb)
+{
+    const __m256i v = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(pa)),
+                                       _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pb)));
+    const __m256i cnt = _mm256_popcnt_epi64(v);
+    const __m128i sum128 = _mm_add_epi64(_mm256_castsi256_si128(cnt),_mm256_extracti128_si256(cnt,1));
+    return _mm_cvtsi128_si32(sum128) + _mm_extract_epi16(sum128,4);
+}
+
+__attribute__((target("avx512vpopcntdq,avx512vl,avx2")))
+void DistanceBatchAVX512(const unsigned char *pa, const unsigned char *pB, const size_t stride, const int N, int *pDists)
+{
+    for(int i=0; i<N; i++, pB+=stride)
+        pDists[i] = DistanceAVX512(pa,pB);
+}
+#endif
+
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define ORB_DISTANCE_NEON
+
+inline int DistanceNEON(const unsigned char *pa, const unsigned char *pb)
+{
+    const uint8x16_t v0 = veorq_u8(vld1q_u8(pa),vld1q_u8(pb));
+    const uint8x16_t v1 = veorq_u8(vld1q_u8(pa+16),vld1q_u8(pb+16));
+    const uint8x16_t cnt = vaddq_u8(vcntq_u8(v0),vcntq_u8(v1));
+#if defined(__aarch64__)
+    return vaddlvq_u8(cnt);
+#else
+    const uint64x2_t sum = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(cnt)));
+    return (int)(vgetq_lane_u64(sum,0) + vgetq_lane_u64(sum,1));
+#endif
+}
+
+void DistanceBatchNEON(const unsigned char *pa, const unsigned char *pB, const size_t stride, const int N, int *pDists)
+{
+    for(int i=0; i<N; i++, pB+=stride)
+        pDists[i] = DistanceNEON(pa,pB);
+}
+#endif
+
+struct DistanceKernels
+{
+    DistanceKernel single;
+    DistanceBatchKernel batch;
+    const char* name;
+};
+
+DistanceKernels SelectDistanceKernels()
+{
+    DistanceKernels k = {&DistanceScalar, &DistanceBatchScalar, "scalar"};
+#if defined(ORB_DISTANCE_X86)
+    __builtin_cpu_init();
+#if defined(ORB_DISTANCE_AVX512)
+    if(__builtin_cpu_supports("avx512vpopcntdq") && __builtin_cpu_supports("avx512vl"))
+    {
+        k.single = &DistanceAVX512; k.batch = &DistanceBatchAVX512; k.name = "avx512-vpopcntdq";
+        return k;
+    }
+#endif
+    if(__builtin_cpu_supports("avx2"))
+    {
+        k.single = &DistanceAVX2; k.batch = &DistanceBatchAVX2; k.name = "avx2";
+    }
+    else if(__builtin_cpu_supports("popcnt"))
+    {
+        k.single = &DistancePopcnt; k.batch = &DistanceBatchPopcnt; k.name = "popcnt";
+    }
+#elif defined(ORB_DISTANCE_NEON)
+    k.single = &DistanceNEON; k.batch = &DistanceBatchNEON; k.name = "neon";
+#endif
+    return k;
+}
+
+const DistanceKernels gDistanceKernels = SelectDistanceKernels();
+
+} // anonymous namespace
+
+void ORBmatcher::BestDescriptorMatches(const unsigned char *pQuery, const unsigned char *pCandidates, const int N,
+                                       int &bestDist, int &bestIdx, int &bestDist2, int &bestIdx2)
+{
+    bestDist = 256;
+    bestIdx = -1;
+    bestDist2 = 256;
+    bestIdx2 = -1;
+
+    // Distances are computed in chunks to keep the buffer on the stack
+    const int CHUNK = 64;
+    int vDists[CHUNK];
+    for(int i0=0; i0<N; i0+=CHUNK)
+    {
+        const int n = min(CHUNK,N-i0);
+        gDistanceKernels.batch(pQuery,pCandidates+i0*DESCRIPTOR_BYTES,DESCRIPTOR_BYTES,n,vDists);
+        for(int j=0; j<n; j++)
+        {
+            const int dist = vDists[j];
+            if(dist<bestDist)
+            {
+                bestDist2=bestDist;
+                bestIdx2=bestIdx;
+                bestDist=dist;
+                bestIdx=i0+j;
+            }
+            else if(dist<bestDist2)
+            {
+                bestDist2=dist;
+                bestIdx2=i0+j;
+            }
+        }
+    }
+}
+
+void ORBmatcher::ClearCandidates()
+{
+    mvCandidateIdx.clear();
+    mvCandidateDesc.clear();
+}
+
+void ORBmatcher::AddCandidate(const cv::Mat &descriptors, const size_t row, const size_t idx)
+{
+    const unsigned char* d = descriptors.ptr<unsigned char>(row);
+    mvCandidateDesc.insert(mvCandidateDesc.end(),d,d+DESCRIPTOR_BYTES);
+    mvCandidateIdx.push_back(idx);
+}
+
+void ORBmatcher::MatchCandidates(const cv::Mat &query, int &bestDist, int &bestIdx, int &bestDist2, int &bestIdx2) const
+{
+    BestDescriptorMatches(query.ptr<unsigned char>(),mvCandidateDesc.empty() ? NULL : &mvCandidateDesc[0],mvCandidateIdx.size(),
+                          bestDist,bestIdx,bestDist2,bestIdx2);
+    if(bestIdx!=-1)
+        bestIdx = mvCandidateIdx[bestIdx];
+    if(bestIdx2!=-1)
+        bestIdx2 = mvCandidateIdx[bestIdx2];
+}
+
+void ORBmatcher::AddTriangulationCandidates(KeyFrame* pKF2, const vector<unsigned int> &vIndices2, const cv::Point2f &ep, const bool bOnlyStereo)
+{
+    ClearCandidates();
+    mScratch.vCandidateX.clear();
+    mScratch.vCandidateY.clear();
+    mScratch.vCandidateTh.clear();
+    mScratch.vCandidateNearEpipole.clear();
+
+    for(size_t i2=0, iend2=vIndices2.size(); i2<iend2; i2++)
+    {
+        const size_t idx2 = vIndices2[i2];
+
+        // If there is a MapPoint skip
+        if(pKF2->GetMapPoint(idx2))
+            continue;
+
+        const bool bStereo2 = pKF2->mvuRight[idx2]>=0;
+        if(bOnlyStereo && !bStereo2)
+            continue;
+
+        const cv::KeyPoint &kp2 = pKF2->mvKeysUn[idx2];
+        const float distex = ep.x-kp2.pt.x;
+        const float distey = ep.y-kp2.pt.y;
+
+        AddCandidate(pKF2->mDescriptors,idx2);
+        mScratch.vCandidateX.push_back(kp2.pt.x);
+        mScratch.vCandidateY.push_back(kp2.pt.y);
+        mScratch.vCandidateTh.push_back(3.84f*pKF2->mvLevelSigma2[kp2.octave]);
+        mScratch.vCandidateNearEpipole.push_back(!bStereo2 && distex*distex+distey*distey<100*pKF2->mvScaleFactors[kp2.octave]);
+    }
+}
+
+int ORBmatcher::BestTriangulationCandidate(const unsigned char* pDesc1, const cv::Point2f &x1, const cv::Matx33f &F12, const bool bStereo1, const bool bCoarse)
+{
+    const int N = mvCandidateIdx.size();
+    if(N==0)
+        return -1;
+
+    vector<int> &vDist = mScratch.vCandidateDist;
+    vector<unsigned char> &vbOK = mScratch.vCandidateEpipolarOK;
+    vDist.resize(N);
+    vbOK.resize(N);
+    DescriptorDistances(pDesc1,&mvCandidateDesc[0],N,&vDist[0]);
+
+    // Epipolar line in second image l = x1'F12 = [a b c], squared distance num^2/den below the
+    // threshold (no division, and false for den==0 as in Pinhole::epipolarConstrain_)
+    const float a = x1.x*F12(0,0)+x1.y*F12(1,0)+F12(2,0);
+    const float b = x1.x*F12(0,1)+x1.y*F12(1,1)+F12(2,1);
+    const float c = x1.x*F12(0,2)+x1.y*F12(1,2)+F12(2,2);
+    const float den = a*a+b*b;
+
+    const float* pX = &mScratch.vCandidateX[0];
+    const float* pY = &mScratch.vCandidateY[0];
+    const float* pTh = &mScratch.vCandidateTh[0];
+    const unsigned char* pNear = &mScratch.vCandidateNearEpipole[0];
+    unsigned char* pOK = &vbOK[0];
+    const unsigned char nearMask = bStereo1 ? 0 : 1;
+    const unsigned char coarse = bCoarse ? 1 : 0;
+    for(int j=0; j<N; j++)
+    {
+        const float num = a*pX[j]+b*pY[j]+c;
+        pOK[j] = ((num*num<pTh[j]*den) | coarse) & (1 ^ (pNear[j] & nearMask));
+    }
+
+    // Same choice as the sequential loop: the last of the best distances up to TH_LOW
+    int bestDist = TH_LOW;
+    int bestIdx2 = -1;
+    for(int j=0; j<N; j++)
+    {
+        if(pOK[j] && vDist[j]<=bestDist)
+        {
+            bestDist = vDist[j];
+            bestIdx2 = mvCandidateIdx[j];
+        }
+    }
+    return bestIdx2;
+}
+
+int ORBmatcher::DescriptorDistance(const cv::Mat &a, const cv::Mat &b)
+{
+    return gDistanceKernels.single(a.ptr<unsigned char>(),b.ptr<unsigned char>());
+}
+
+void ORBmatcher::DescriptorDistances(const cv::Mat &a, const cv::Mat &B, int *pDists)
+{
+    if(B.rows==0)
+        return;
+    gDistanceKernels.batch(a.ptr<unsigned char>(),B.ptr<unsigned char>(),B.step[0],B.rows,pDists);
+}
+
+void ORBmatcher::DescriptorDistances(const unsigned char *pa, const unsigned char *pB, const int N, int *pDists)
+{
+    gDistanceKernels.batch(pa,pB,DESCRIPTOR_BYTES,N,pDists);
+}
+
+const char* ORBmatcher::DescriptorDistanceKernel()
+{
+    return gDistanceKernels.name;
+}
+
 } //namespace ORB_SLAM
@@ -47,6 +47,11 @@ namespace ORB_SLAM3 {
 
 
     void EdgeSE3ProjectXYZOnlyPose::linearizeOplus() {
+        linearizeOplusT<GeometricCamera>();
+    }
+
+    template<class CameraModel>
+    void EdgeSE3ProjectXYZOnlyPose::linearizeOplusT() {
         g2o::VertexSE3Expmap * vi = static_cast<g2o::VertexSE3Expmap *>(_vertices[0]);
         Eigen::Vector3d xyz_trans = vi->estimate().map(Xw);
 
@@ -59,7 +64,20 @@ namespace ORB_SLAM3 {
                      -z , 0.f, x, 0.f, 1.f, 0.f,
                      y ,  -x , 0.f, 0.f, 0.f, 1.f;
 
-        _jacobianOplusXi = -pCamera->projectJac(xyz_trans) * SE3deriv;
+        _jacobianOplusXi = -CameraProjectJac<CameraModel>(pCamera,xyz_trans) * SE3deriv;
+    }
+
+    template void EdgeSE3ProjectXYZOnlyPose::linearizeOplusT<Pinhole>();
+    template void EdgeSE3ProjectXYZOnlyPose::linearizeOplusT<KannalaBrandt8>();
+
+    EdgeSE3ProjectXYZOnlyPose* NewEdgeSE3ProjectXYZOnlyPose(GeometricCamera* pCamera) {
+        EdgeSE3ProjectXYZOnlyPose* e;
+        if(pCamera->GetType() == pCamera->CAM_PINHOLE)
+            e = new EdgeSE3ProjectXYZOnlyPoseT<Pinhole>();
+        else
+            e = new EdgeSE3ProjectXYZOnlyPoseT<KannalaBrandt8>();
+        e->pCamera = pCamera;
+        return e;
     }
 
     bool EdgeSE3ProjectXYZOnlyPoseToBody::read(std::istream& is){
@@ -137,6 +155,11 @@ namespace ORB_SLAM3 {
 
 
     void EdgeSE3ProjectXYZ::linearizeOplus() {
+        linearizeOplusT<GeometricCamera>();
+    }
+
+    template<class CameraModel>
+    void EdgeSE3ProjectXYZ::linearizeOplusT() {
         g2o::VertexSE3Expmap * vj = static_cast<g2o::VertexSE3Expmap *>(_vertices[1]);
         g2o::SE3Quat T(vj->estimate());
         g2o::VertexSBAPointXYZ* vi = static_cast<g2o::VertexSBAPointXYZ*>(_vertices[0]);
@@ -147,7 +170,7 @@ namespace ORB_SLAM3 {
         double y = xyz_trans[1];
         double z = xyz_trans[2];
 
-        auto projectJac = -pCamera->projectJac(xyz_trans);
+        const Eigen::Matrix<double,2,3> projectJac = -CameraProjectJac<CameraModel>(pCamera,xyz_trans);
 
         _jacobianOplusXi =  projectJac * T.rotation().toRotationMatrix();
 
@@ -159,6 +182,19 @@ namespace ORB_SLAM3 {
         _jacobianOplusXj = projectJac * SE3deriv;
     }
 
+    template void EdgeSE3ProjectXYZ::linearizeOplusT<Pinhole>();
+    template void EdgeSE3ProjectXYZ::linearizeOplusT<KannalaBrandt8>();
+
+    EdgeSE3ProjectXYZ* NewEdgeSE3ProjectXYZ(GeometricCamera* pCamera) {
+        EdgeSE3ProjectXYZ* e;
+        if(pCamera->GetType() == pCamera->CAM_PINHOLE)
+            e = new EdgeSE3ProjectXYZT<Pinhole>();
+        else
+            e = new EdgeSE3ProjectXYZT<KannalaBrandt8>();
+        e->pCamera = pCamera;
+        return e;
+    }
+
     EdgeSE3ProjectXYZToBody::EdgeSE3ProjectXYZToBody() : BaseBinaryEdge<2, Eigen::Vector2d, g2o::VertexSBAPointXYZ, g2o::VertexSE3Expmap>() {
     }
 
@@ -39,13 +39,99 @@
 #include "Converter.h"
 
 #include<mutex>
+#include<memory>
 
 #include "OptimizableTypes.h"
+#include "PoseSolver.h"
+#include "InertialPoseSolver.h"
+#include "VisualBASolver.h"
+#include "Sim3Refiner.h"
+#include "Tracer.h"
+#include "SystemContext.h"
 
 
 namespace ORB_SLAM3
 {
 
+thread_local Optimizer::IterationStats Optimizer::mstLastStats;
+
+Optimizer::IterationStats Optimizer::GetLastIterationStats()
+{
+    return mstLastStats;
+}
+
+// Order in which the points of vpMP enter a full BA problem: by the keyframe that first observed
+// them, then by creation. The map sets come in pointer order; in this order the points of a
+// keyframe are neighbours, and so are their edges, Hessian blocks and Schur complement terms.
+static vector<size_t> FirstObservationOrder(const vector<MapPoint*> &vpMP)
+{
+    vector<pair<pair<long int,long unsigned int>,size_t> > vKeys(vpMP.size());
+    for(size_t i=0; i<vpMP.size(); i++)
+        vKeys[i] = make_pair(make_pair(vpMP[i]->mnFirstKFid, vpMP[i]->mnId), i);
+    sort(vKeys.begin(), vKeys.end());
+
+    vector<size_t> vOrder(vpMP.size());
+    for(size_t i=0; i<vKeys.size(); i++)
+        vOrder[i] = vKeys[i].second;
+    return vOrder;
+}
+
+// Keyframe of a VisualBASolver problem, with the right camera of a rig and the stereo calibration
+static int AddKeyFrameToSolver(VisualBASolver &solver, KeyFrame* pKF, const bool bFixed)
+{
+    const g2o::SE3Quat Tcw = Converter::toSE3Quat(pKF->GetPose_());
+
+    Eigen::Matrix3d Rrl = Eigen::Matrix3d::Identity();
+    Eigen::Vector3d trl = Eigen::Vector3d::Zero();
+    if(pKF->mpCamera2)
+    {
+        Rrl = Converter::toMatrix3d(pKF->mTrl.rowRange(0,3).colRange(0,3));
+        trl = Converter::toVector3d(pKF->mTrl.rowRange(0,3).col(3));
+    }
+
+    return solver.AddKeyFrame(Tcw.rotation().toRotationMatrix(), Tcw.translation(), bFixed,
+                              pKF->mpCamera, pKF->mpCamera2, Rrl, trl, pKF->fx, pKF->fy, pKF->cx, pKF->cy, pKF->mbf);
+}
+
+// Observations of a map point in a keyframe, the same as the edges of the g2o graphs: monocular or
+// stereo in the left image and monocular in the right camera of a rig. If pvObs is given, the
+// keyframe and point of every added observation are appended to it.
+static void AddObservationsToSolver(VisualBASolver &solver, KeyFrame* pKF, const int nKF, MapPoint* pMP, const int nPoint,
+                                    const tuple<int,int> &indexes, const double deltaMono, const double deltaStereo,
+                                    const double deltaRight, vector<pair<KeyFrame*,MapPoint*> >* pvObs)
+{
+    const int leftIndex = get<0>(indexes);
+    if(leftIndex != -1)
+    {
+        const cv::KeyPoint &kpUn = pKF->mvKeysUn[leftIndex];
+        const float &invSigma2 = pKF->mvInvLevelSigma2[kpUn.octave];
+        const float kp_ur = pKF->mvuRight[leftIndex];
+
+        if(kp_ur<0)
+            solver.AddObservation(VisualBASolver::MONO, nKF, nPoint, kpUn.pt.x, kpUn.pt.y, 0.0, invSigma2, deltaMono);
+        else
+            solver.AddObservation(VisualBASolver::STEREO, nKF, nPoint, kpUn.pt.x, kpUn.pt.y, kp_ur, invSigma2, deltaStereo);
+
+        if(pvObs)
+            pvObs->push_back(make_pair(pKF,pMP));
+    }
+
+    if(pKF->mpCamera2)
+    {
+        const int rightIndex = get<1>(indexes);
+        if(rightIndex != -1 && rightIndex-pKF->NLeft < (int)pKF->mvKeysRight.size())
+        {
+            const cv::KeyPoint &kp = pKF->mvKeysRight[rightIndex-pKF->NLeft];
+            const float &invSigma2 = pKF->mvInvLevelSigma2[kp.octave];
+
+            solver.AddObservation(VisualBASolver::MONO_RIGHT, nKF, nPoint, kp.pt.x, kp.pt.y, 0.0, invSigma2, deltaRight);
+
+            if(pvObs)
+                pvObs->push_back(make_pair(pKF,pMP));
+        }
+    }
+}
+
 bool sortByVal(const pair<MapPoint*, int> &a, const pair<MapPoint*, int> &b)
 {
     return (a.second < b.second);
@@ -53,24 +139,33 @@ bool sortByVal(const pair<MapPoint*, int> &a, const pair<MapPoint*, int> &b)
 
 void Optimizer::GlobalBundleAdjustemnt(Map* pMap, int nIterations, bool* pbStopFlag, const unsigned long nLoopKF, const bool bRobust)
 {
-    vector<KeyFrame*> vpKFs = pMap->GetAllKeyFrames();
-    vector<MapPoint*> vpMP = pMap->GetAllMapPoints();
-    BundleAdjustment(vpKFs,vpMP,nIterations,pbStopFlag, nLoopKF, bRobust);
+    ORB_TRACE_SCOPE("Optimizer::GlobalBundleAdjustemnt");
+    const Map::KeyFramesSnapshot pKFs = pMap->GetKeyFramesSnapshot();
+    const Map::MapPointsSnapshot pMPs = pMap->GetMapPointsSnapshot();
+    BundleAdjustment(*pKFs,*pMPs,nIterations,pbStopFlag, nLoopKF, bRobust);
 }
 
 
 void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<MapPoint *> &vpMP,
                                  int nIterations, bool* pbStopFlag, const unsigned long nLoopKF, const bool bRobust)
 {
+    Map* pMap = vpKFs[0]->GetMap();
+    const OptimizerSettings &settings = pMap->GetOptimizerSettings();
+    if(settings.visualBAEngine == OptimizerSettings::VISUAL_BA_NATIVE)
+    {
+        BundleAdjustmentNative(vpKFs, vpMP, nIterations, pbStopFlag, nLoopKF, bRobust);
+        return;
+    }
+
+    ORB_TRACE_SCOPE("Optimizer::BundleAdjustment");
     vector<bool> vbNotIncludedMP;
     vbNotIncludedMP.resize(vpMP.size());
 
-    Map* pMap = vpKFs[0]->GetMap();
-
+    g2o::GraphArena arena;
     g2o::SparseOptimizer optimizer;
     g2o::BlockSolver_6_3::LinearSolverType * linearSolver;
 
-    linearSolver = new g2o::LinearSolverEigen<g2o::BlockSolver_6_3::PoseMatrixType>();
+    linearSolver = NewSparseLinearSolver<g2o::BlockSolver_6_3>(settings);
 
     g2o::BlockSolver_6_3 * solver_ptr = new g2o::BlockSolver_6_3(linearSolver);
 
@@ -121,7 +216,7 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
         if(pKF->isBad())
             continue;
         g2o::VertexSE3Expmap * vSE3 = new g2o::VertexSE3Expmap();
-        vSE3->setEstimate(Converter::toSE3Quat(pKF->GetPose()));
+        vSE3->setEstimate(Converter::toSE3Quat(pKF->GetPose_()));
         vSE3->setId(pKF->mnId);
         vSE3->setFixed(pKF->mnId==pMap->GetInitKFid());
         optimizer.addVertex(vSE3);
@@ -134,23 +229,25 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
 
     // Set MapPoint vertices
 
-    for(size_t i=0; i<vpMP.size(); i++)
+    const vector<size_t> vOrder = FirstObservationOrder(vpMP);
+    for(size_t o=0; o<vOrder.size(); o++)
     {
+        const size_t i = vOrder[o];
         MapPoint* pMP = vpMP[i];
         if(pMP->isBad())
             continue;
         g2o::VertexSBAPointXYZ* vPoint = new g2o::VertexSBAPointXYZ();
-        vPoint->setEstimate(Converter::toVector3d(pMP->GetWorldPos()));
+        vPoint->setEstimate(Converter::toVector3d(pMP->GetWorldPos2()));
         const int id = pMP->mnId+maxKFid+1;
         vPoint->setId(id);
         vPoint->setMarginalized(true);
         optimizer.addVertex(vPoint);
 
-       const map<KeyFrame*,tuple<int,int>> observations = pMP->GetObservations();
+       const ObservationMap observations = pMP->GetObservations();
 
         int nEdges = 0;
         //SET EDGES
-        for(map<KeyFrame*,tuple<int,int>>::const_iterator mit=observations.begin(); mit!=observations.end(); mit++)
+        for(ObservationMap::const_iterator mit=observations.begin(); mit!=observations.end(); mit++)
         {
             KeyFrame* pKF = mit->first;
             if(pKF->isBad() || pKF->mnId>maxKFid)
@@ -168,7 +265,7 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
                 Eigen::Matrix<double,2,1> obs;
                 obs << kpUn.pt.x, kpUn.pt.y;
 
-                ORB_SLAM3::EdgeSE3ProjectXYZ* e = new ORB_SLAM3::EdgeSE3ProjectXYZ();
+                ORB_SLAM3::EdgeSE3ProjectXYZ* e = ORB_SLAM3::NewEdgeSE3ProjectXYZ(pKF->mpCamera);
 
                 e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(id)));
                 e->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(pKF->mnId)));
@@ -275,6 +372,45 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
         }
     }
 
+    // Rig cameras of the keyframes, on the points with a vertex: each one sees the world from Tcb*Tcw
+    for(size_t i=0; i<vpKFs.size(); i++)
+    {
+        KeyFrame* pKF = vpKFs[i];
+        if(pKF->mvRigCameras.empty() || pKF->isBad())
+            continue;
+
+        const vector<KeyFrame::RigObservation> vRigObs = pKF->GetRigObservations();
+        for(size_t j=0; j<vRigObs.size(); j++)
+        {
+            const KeyFrame::RigObservation &rigObs = vRigObs[j];
+            const int id = rigObs.pMP->mnId+maxKFid+1;
+            if(optimizer.vertex(id) == NULL || optimizer.vertex(pKF->mnId) == NULL)
+                continue;
+
+            const KeyFrame::RigCamera &cam = pKF->mvRigCameras[rigObs.nCamera];
+            Eigen::Matrix<double,2,1> obs;
+            obs << rigObs.kpUn.pt.x, rigObs.kpUn.pt.y;
+
+            ORB_SLAM3::EdgeSE3ProjectXYZToBody *e = new ORB_SLAM3::EdgeSE3ProjectXYZToBody();
+
+            e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(id)));
+            e->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(pKF->mnId)));
+            e->setMeasurement(obs);
+            const float &invSigma2 = pKF->mvInvLevelSigma2[rigObs.kpUn.octave];
+            e->setInformation(Eigen::Matrix2d::Identity()*invSigma2);
+
+            g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+            e->setRobustKernel(rk);
+            rk->setDelta(thHuber2D);
+
+            e->mTrl = Converter::toSE3Quat(cam.Tcb);
+
+            e->pCamera = cam.pCamera;
+
+            optimizer.addEdge(e);
+        }
+    }
+
     // Optimize!
     optimizer.setVerbose(false);
     optimizer.initializeOptimization();
@@ -294,7 +430,7 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
         g2o::SE3Quat SE3quat = vSE3->estimate();
         if(nLoopKF==pMap->GetOriginKF()->mnId)
         {
-            pKF->SetPose(Converter::toCvMat(SE3quat));
+            pKF->SetPose_(Converter::toMatx44f(SE3quat));
         }
         else
         {
@@ -382,7 +518,7 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
 
         if(nLoopKF==pMap->GetOriginKF()->mnId)
         {
-            pMP->SetWorldPos(Converter::toCvMat(vPoint->estimate()));
+            pMP->SetWorldPos2(Converter::toMatx31f(vPoint->estimate()));
             pMP->UpdateNormalAndDepth();
         }
         else
@@ -394,17 +530,126 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
     }
 }
 
+void Optimizer::BundleAdjustmentNative(const vector<KeyFrame *> &vpKFs, const vector<MapPoint *> &vpMP,
+                                       int nIterations, bool* pbStopFlag, const unsigned long nLoopKF, const bool bRobust)
+{
+    ORB_TRACE_SCOPE("Optimizer::BundleAdjustmentNative");
+    Map* pMap = vpKFs[0]->GetMap();
+    const OptimizerSettings &settings = pMap->GetOptimizerSettings();
+
+    VisualBASolver solver;
+    solver.Reset(settings.pThreadPool);
+    solver.SetStopFlag(pbStopFlag);
+    if(settings.linearSolver == OptimizerSettings::LINEAR_SOLVER_PCG)
+        solver.SetLinearSolver(VisualBASolver::PCG);
+    if(settings.bVisualBASingle)
+        solver.SetPrecision(VisualBASolver::SINGLE);
+
+    const double thHuber2D = sqrt(5.99);
+    const double thHuber3D = sqrt(7.815);
+
+    // Keyframes, the first one of the map fixed
+    map<KeyFrame*,int> mKFIndex;
+    vector<int> vKFIndex(vpKFs.size(), -1);
+    for(size_t i=0; i<vpKFs.size(); i++)
+    {
+        KeyFrame* pKF = vpKFs[i];
+        if(pKF->isBad())
+            continue;
+        vKFIndex[i] = AddKeyFrameToSolver(solver, pKF, pKF->mnId==pMap->GetInitKFid());
+        mKFIndex[pKF] = vKFIndex[i];
+    }
+
+    // Points seen by those keyframes
+    vector<int> vMPIndex(vpMP.size(), -1);
+    const vector<size_t> vOrder = FirstObservationOrder(vpMP);
+    for(size_t o=0; o<vOrder.size(); o++)
+    {
+        const size_t i = vOrder[o];
+        MapPoint* pMP = vpMP[i];
+        if(pMP->isBad())
+            continue;
+
+        const ObservationMap observations = pMP->GetObservations();
+        for(ObservationMap::const_iterator mit=observations.begin(); mit!=observations.end(); mit++)
+        {
+            KeyFrame* pKF = mit->first;
+            if(pKF->isBad())
+                continue;
+            map<KeyFrame*,int>::const_iterator kit = mKFIndex.find(pKF);
+            if(kit==mKFIndex.end())
+                continue;
+
+            if(vMPIndex[i]<0)
+                vMPIndex[i] = solver.AddPoint(Converter::toVector3d(pMP->GetWorldPos2()));
+
+            AddObservationsToSolver(solver, pKF, kit->second, pMP, vMPIndex[i], mit->second,
+                                    bRobust ? thHuber2D : 0.0, bRobust ? thHuber3D : 0.0, thHuber2D,
+                                    static_cast<vector<pair<KeyFrame*,MapPoint*> >*>(NULL));
+        }
+    }
+
+    solver.Optimize(nIterations);
+    Verbose::PrintMess("BA: End of the optimization", Verbose::VERBOSITY_NORMAL);
+
+    // Recover optimized data
+    Eigen::Matrix3d Rcw;
+    Eigen::Vector3d tcw;
+    for(size_t i=0; i<vpKFs.size(); i++)
+    {
+        KeyFrame* pKF = vpKFs[i];
+        if(vKFIndex[i]<0 || pKF->isBad())
+            continue;
+
+        solver.GetPose(vKFIndex[i], Rcw, tcw);
+        const g2o::SE3Quat SE3quat(Rcw, tcw);
+        if(nLoopKF==pMap->GetOriginKF()->mnId)
+        {
+            pKF->SetPose_(Converter::toMatx44f(SE3quat));
+        }
+        else
+        {
+            pKF->mTcwGBA.create(4,4,CV_32F);
+            Converter::toCvMat(SE3quat).copyTo(pKF->mTcwGBA);
+            pKF->mnBAGlobalForKF = nLoopKF;
+        }
+    }
+
+    for(size_t i=0; i<vpMP.size(); i++)
+    {
+        MapPoint* pMP = vpMP[i];
+        if(vMPIndex[i]<0 || pMP->isBad())
+            continue;
+
+        if(nLoopKF==pMap->GetOriginKF()->mnId)
+        {
+            pMP->SetWorldPos2(Converter::toMatx31f(solver.GetPoint(vMPIndex[i])));
+            pMP->UpdateNormalAndDepth();
+        }
+        else
+        {
+            pMP->mPosGBA.create(3,1,CV_32F);
+            Converter::toCvMat(solver.GetPoint(vMPIndex[i])).copyTo(pMP->mPosGBA);
+            pMP->mnBAGlobalForKF = nLoopKF;
+        }
+    }
+}
+
 void Optimizer::FullInertialBA(Map *pMap, int its, const bool bFixLocal, const long unsigned int nLoopId, bool *pbStopFlag, bool bInit, float priorG, float priorA, Eigen::VectorXd *vSingVal, bool *bHess)
 {
+    ORB_TRACE_SCOPE("Optimizer::FullInertialBA");
     long unsigned int maxKFid = pMap->GetMaxKFid();
-    const vector<KeyFrame*> vpKFs = pMap->GetAllKeyFrames();
-    const vector<MapPoint*> vpMPs = pMap->GetAllMapPoints();
+    const Map::KeyFramesSnapshot pKFs = pMap->GetKeyFramesSnapshot();
+    const vector<KeyFrame*> &vpKFs = *pKFs;
+    const Map::MapPointsSnapshot pMPs = pMap->GetMapPointsSnapshot();
+    const vector<MapPoint*> &vpMPs = *pMPs;
 
     // Setup optimizer
+    g2o::GraphArena arena;
     g2o::SparseOptimizer optimizer;
     g2o::BlockSolverX::LinearSolverType * linearSolver;
 
-    linearSolver = new g2o::LinearSolverEigen<g2o::BlockSolverX::PoseMatrixType>();
+    linearSolver = NewSparseLinearSolver<g2o::BlockSolverX>(pMap->GetOptimizerSettings());
 
     g2o::BlockSolverX * solver_ptr = new g2o::BlockSolverX(linearSolver);
 
@@ -555,11 +800,11 @@ void Optimizer::FullInertialBA(Map *pMap, int its, const bool bFixLocal, const l
                     EdgeGyroRW* egr= new EdgeGyroRW();
                     egr->setVertex(0,VG1);
                     egr->setVertex(1,VG2);
-                    cv::Mat cvInfoG = pKFi->mpImuPreintegrated->C.rowRange(9,12).colRange(9,12).inv(cv::DECOMP_SVD);
+                    const cv::Matx33f cvInfoG = pKFi->mpImuPreintegrated->C.get_minor<3,3>(9,9).inv(cv::DECOMP_SVD);
                     Eigen::Matrix3d InfoG;
                     for(int r=0;r<3;r++)
                         for(int c=0;c<3;c++)
-                            InfoG(r,c)=cvInfoG.at<float>(r,c);
+                            InfoG(r,c)=cvInfoG(r,c);
                     egr->setInformation(InfoG);
                     egr->computeError();
                     optimizer.addEdge(egr);
@@ -567,11 +812,11 @@ void Optimizer::FullInertialBA(Map *pMap, int its, const bool bFixLocal, const l
                     EdgeAccRW* ear = new EdgeAccRW();
                     ear->setVertex(0,VA1);
                     ear->setVertex(1,VA2);
-                    cv::Mat cvInfoA = pKFi->mpImuPreintegrated->C.rowRange(12,15).colRange(12,15).inv(cv::DECOMP_SVD);
+                    const cv::Matx33f cvInfoA = pKFi->mpImuPreintegrated->C.get_minor<3,3>(12,12).inv(cv::DECOMP_SVD);
                     Eigen::Matrix3d InfoA;
                     for(int r=0;r<3;r++)
                         for(int c=0;c<3;c++)
-                            InfoA(r,c)=cvInfoA.at<float>(r,c);
+                            InfoA(r,c)=cvInfoA(r,c);
                     ear->setInformation(InfoA);
                     ear->computeError();
                     optimizer.addEdge(ear);
@@ -614,19 +859,19 @@ void Optimizer::FullInertialBA(Map *pMap, int its, const bool bFixLocal, const l
     {
         MapPoint* pMP = vpMPs[i];
         g2o::VertexSBAPointXYZ* vPoint = new g2o::VertexSBAPointXYZ();
-        vPoint->setEstimate(Converter::toVector3d(pMP->GetWorldPos()));
+        vPoint->setEstimate(Converter::toVector3d(pMP->GetWorldPos2()));
         unsigned long id = pMP->mnId+iniMPid+1;
         vPoint->setId(id);
         vPoint->setMarginalized(true);
         optimizer.addVertex(vPoint);
 
-        const map<KeyFrame*,tuple<int,int>> observations = pMP->GetObservations();
+        const ObservationMap observations = pMP->GetObservations();
 
 
         bool bAllFixed = true;
 
         //Set edges
-        for(map<KeyFrame*,tuple<int,int>>::const_iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+        for(ObservationMap::const_iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
         {
             KeyFrame* pKFi = mit->first;
 
@@ -644,7 +889,7 @@ void Optimizer::FullInertialBA(Map *pMap, int its, const bool bFixLocal, const l
                     Eigen::Matrix<double,2,1> obs;
                     obs << kpUn.pt.x, kpUn.pt.y;
 
-                    EdgeMono* e = new EdgeMono(0);
+                    EdgeMono* e = NewEdgeMono(pKFi->mpCamera,0);
 
                     g2o::OptimizableGraph::Vertex* VP = dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(pKFi->mnId));
                     if(bAllFixed)
@@ -671,7 +916,7 @@ void Optimizer::FullInertialBA(Map *pMap, int its, const bool bFixLocal, const l
                     Eigen::Matrix<double,3,1> obs;
                     obs << kpUn.pt.x, kpUn.pt.y, kp_ur;
 
-                    EdgeStereo* e = new EdgeStereo(0);
+                    EdgeStereo* e = NewEdgeStereo(pKFi->mpCamera,0);
 
                     g2o::OptimizableGraph::Vertex* VP = dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(pKFi->mnId));
                     if(bAllFixed)
@@ -702,7 +947,7 @@ void Optimizer::FullInertialBA(Map *pMap, int its, const bool bFixLocal, const l
                         kpUn = pKFi->mvKeysRight[rightIndex];
                         obs << kpUn.pt.x, kpUn.pt.y;
 
-                        EdgeMono *e = new EdgeMono(1);
+                        EdgeMono *e = NewEdgeMono(pKFi->mpCamera2,1);
 
                         g2o::OptimizableGraph::Vertex* VP = dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(pKFi->mnId));
                         if(bAllFixed)
@@ -812,7 +1057,7 @@ void Optimizer::FullInertialBA(Map *pMap, int its, const bool bFixLocal, const l
 
         if(nLoopId==0)
         {
-            pMP->SetWorldPos(Converter::toCvMat(vPoint->estimate()));
+            pMP->SetWorldPos2(Converter::toMatx31f(vPoint->estimate()));
             pMP->UpdateNormalAndDepth();
         }
         else
@@ -828,198 +1073,105 @@ void Optimizer::FullInertialBA(Map *pMap, int its, const bool bFixLocal, const l
 }
 
 
-int Optimizer::PoseOptimization(Frame *pFrame)
+// Observations of the matched map points of the frame for PoseOptimization, one version per
+// camera configuration (SensorConfig.h). Returns their number.
+template<int Setup>
+static int AddPoseObservations(PoseSolver &solver, Frame *pFrame, vector<int> &vnIndexObs)
 {
-    g2o::SparseOptimizer optimizer;
-    g2o::BlockSolver_6_3::LinearSolverType * linearSolver;
-
-    linearSolver = new g2o::LinearSolverDense<g2o::BlockSolver_6_3::PoseMatrixType>();
-
-    g2o::BlockSolver_6_3 * solver_ptr = new g2o::BlockSolver_6_3(linearSolver);
+    typedef CameraSetupTraits<Setup> Traits;
 
-    g2o::OptimizationAlgorithmLevenberg* solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
-    optimizer.setAlgorithm(solver);
-
-    int nInitialCorrespondences=0;
-
-    // Set Frame vertex
-    g2o::VertexSE3Expmap * vSE3 = new g2o::VertexSE3Expmap();
-    vSE3->setEstimate(Converter::toSE3Quat(pFrame->mTcw));
-    vSE3->setId(0);
-    vSE3->setFixed(false);
-    optimizer.addVertex(vSE3);
-
-    // Set MapPoint vertices
+    int nObs=0;
     const int N = pFrame->N;
-
-    vector<ORB_SLAM3::EdgeSE3ProjectXYZOnlyPose*> vpEdgesMono;
-    vector<ORB_SLAM3::EdgeSE3ProjectXYZOnlyPoseToBody *> vpEdgesMono_FHR;
-    vector<size_t> vnIndexEdgeMono, vnIndexEdgeRight;
-    vpEdgesMono.reserve(N);
-    vpEdgesMono_FHR.reserve(N);
-    vnIndexEdgeMono.reserve(N);
-    vnIndexEdgeRight.reserve(N);
-
-    vector<g2o::EdgeStereoSE3ProjectXYZOnlyPose*> vpEdgesStereo;
-    vector<size_t> vnIndexEdgeStereo;
-    vpEdgesStereo.reserve(N);
-    vnIndexEdgeStereo.reserve(N);
-
-    const float deltaMono = sqrt(5.991);
-    const float deltaStereo = sqrt(7.815);
-
-    {
-    unique_lock<mutex> lock(MapPoint::mGlobalMutex);
-
-    //^ Construct Graph
     for(int i=0; i<N; i++)
     {
         //^ CurrentFrame에서 Matching된 MapPoints들에 대해서...
         MapPoint* pMP = pFrame->mvpMapPoints[i];
-        if(pMP)
-        {
-            //Conventional SLAM
-            if(!pFrame->mpCamera2){
-                // Monocular observation
-                if(pFrame->mvuRight[i]<0)
-                {
-                    nInitialCorrespondences++;
-                    pFrame->mvbOutlier[i] = false;
-
-                    Eigen::Matrix<double,2,1> obs;
-                    const cv::KeyPoint &kpUn = pFrame->mvKeysUn[i];
-                    obs << kpUn.pt.x, kpUn.pt.y;
-
-                    ORB_SLAM3::EdgeSE3ProjectXYZOnlyPose* e = new ORB_SLAM3::EdgeSE3ProjectXYZOnlyPose();
-
-                    e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(0)));
-                    e->setMeasurement(obs);
-                    const float invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave];
-                    e->setInformation(Eigen::Matrix2d::Identity()*invSigma2);
-
-                    g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
-                    e->setRobustKernel(rk);
-                    rk->setDelta(deltaMono);
-
-                    e->pCamera = pFrame->mpCamera;
-                    cv::Mat Xw = pMP->GetWorldPos();
-                    e->Xw[0] = Xw.at<float>(0);
-                    e->Xw[1] = Xw.at<float>(1);
-                    e->Xw[2] = Xw.at<float>(2);
-
-                    optimizer.addEdge(e);
-
-                    vpEdgesMono.push_back(e);
-                    vnIndexEdgeMono.push_back(i);
-                }
-                else  // Stereo observation
-                {
-                    nInitialCorrespondences++;
-                    pFrame->mvbOutlier[i] = false;
-
-                    //SET EDGE
-                    Eigen::Matrix<double,3,1> obs;
-                    const cv::KeyPoint &kpUn = pFrame->mvKeysUn[i];
-                    const float &kp_ur = pFrame->mvuRight[i];
-                    obs << kpUn.pt.x, kpUn.pt.y, kp_ur;
-
-                    g2o::EdgeStereoSE3ProjectXYZOnlyPose* e = new g2o::EdgeStereoSE3ProjectXYZOnlyPose();
-
-                    e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(0)));
-                    e->setMeasurement(obs);
-                    const float invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave];
-                    Eigen::Matrix3d Info = Eigen::Matrix3d::Identity()*invSigma2;
-                    e->setInformation(Info);
-
-                    g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
-                    e->setRobustKernel(rk);
-                    rk->setDelta(deltaStereo);
-
-                    e->fx = pFrame->fx;
-                    e->fy = pFrame->fy;
-                    e->cx = pFrame->cx;
-                    e->cy = pFrame->cy;
-                    e->bf = pFrame->mbf;
-                    cv::Mat Xw = pMP->GetWorldPos();
-                    e->Xw[0] = Xw.at<float>(0);
-                    e->Xw[1] = Xw.at<float>(1);
-                    e->Xw[2] = Xw.at<float>(2);
-
-                    optimizer.addEdge(e);
-
-                    vpEdgesStereo.push_back(e);
-                    vnIndexEdgeStereo.push_back(i);
-                }
-            }
-            //SLAM with respect a rigid body
-            else{
-                nInitialCorrespondences++;
-
-                cv::KeyPoint kpUn;
-
-                if (i < pFrame->Nleft) {    //Left camera observation
-                    kpUn = pFrame->mvKeys[i];
-
-                    pFrame->mvbOutlier[i] = false;
-
-                    Eigen::Matrix<double, 2, 1> obs;
-                    obs << kpUn.pt.x, kpUn.pt.y;
-
-                    ORB_SLAM3::EdgeSE3ProjectXYZOnlyPose *e = new ORB_SLAM3::EdgeSE3ProjectXYZOnlyPose();
-
-                    e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex *>(optimizer.vertex(0)));
-                    e->setMeasurement(obs);
-                    const float invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave];
-                    e->setInformation(Eigen::Matrix2d::Identity() * invSigma2);
+        if(!pMP)
+            continue;
 
-                    g2o::RobustKernelHuber *rk = new g2o::RobustKernelHuber;
-                    e->setRobustKernel(rk);
-                    rk->setDelta(deltaMono);
+        // Monocular observation (left camera in stereo fisheye)
+        PoseSolver::eObsType type = PoseSolver::MONO;
+        if(Traits::bSplit)
+        {
+            if(i >= pFrame->Nleft)   //Right camera observation
+                type = PoseSolver::MONO_RIGHT;
+        }
+        else if(Traits::bRightCoords && pFrame->mvuRight[i]>=0)  // Stereo observation
+            type = PoseSolver::STEREO;
 
-                    e->pCamera = pFrame->mpCamera;
-                    cv::Mat Xw = pMP->GetWorldPos();
-                    e->Xw[0] = Xw.at<float>(0);
-                    e->Xw[1] = Xw.at<float>(1);
-                    e->Xw[2] = Xw.at<float>(2);
+        nObs++;
+        pFrame->mvbOutlier[i] = false;
 
-                    optimizer.addEdge(e);
+        const float invSigma2 = pFrame->mvInvLevelSigma2[pFrame->mKeysSoA.mvOctave[i]];
+        solver.AddObservation(type, Converter::toVector3d(pMP->GetWorldPos2()),
+                              pFrame->mKeysSoA.mvX[i], pFrame->mKeysSoA.mvY[i], pFrame->mvuRight[i], invSigma2);
+        vnIndexObs.push_back(i);
+    }
+    return nObs;
+}
 
-                    vpEdgesMono.push_back(e);
-                    vnIndexEdgeMono.push_back(i);
-                }
-                else {   //Right camera observation
-                    kpUn = pFrame->mvKeysRight[i - pFrame->Nleft];
+int Optimizer::PoseOptimization(Frame *pFrame)
+{
+    ORB_TRACE_SCOPE("Optimizer::PoseOptimization");
+    // Pose-only problem solved without a g2o graph. The solver keeps its buffers between
+    // frames, one per thread (tracking and relocalization may run it concurrently).
+    static thread_local PoseSolver solver;
 
-                    Eigen::Matrix<double, 2, 1> obs;
-                    obs << kpUn.pt.x, kpUn.pt.y;
+    int nInitialCorrespondences=0;
 
-                    pFrame->mvbOutlier[i] = false;
+    const float deltaMono = sqrt(5.991);
+    const float deltaStereo = sqrt(7.815);
 
-                    ORB_SLAM3::EdgeSE3ProjectXYZOnlyPoseToBody *e = new ORB_SLAM3::EdgeSE3ProjectXYZOnlyPoseToBody();
+    Eigen::Matrix3d Rrl = Eigen::Matrix3d::Identity();
+    Eigen::Vector3d trl = Eigen::Vector3d::Zero();
+    if(pFrame->mpCamera2)
+    {
+        Rrl = Converter::toMatrix3d(pFrame->mTrl.rowRange(0,3).colRange(0,3));
+        trl = Converter::toVector3d(pFrame->mTrl.rowRange(0,3).col(3));
+    }
 
-                    e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex *>(optimizer.vertex(0)));
-                    e->setMeasurement(obs);
-                    const float invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave];
-                    e->setInformation(Eigen::Matrix2d::Identity() * invSigma2);
+    solver.Reset(pFrame->mpCamera, pFrame->mpCamera2, Rrl, trl,
+                 pFrame->fx, pFrame->fy, pFrame->cx, pFrame->cy, pFrame->mbf, deltaMono, deltaStereo);
 
-                    g2o::RobustKernelHuber *rk = new g2o::RobustKernelHuber;
-                    e->setRobustKernel(rk);
-                    rk->setDelta(deltaMono);
+    // Frame index of each observation of the solver
+    static thread_local vector<int> vnIndexObs;
+    static thread_local vector<pair<int,int> > vRigIndexObs;
+    vnIndexObs.clear();
 
-                    e->pCamera = pFrame->mpCamera2;
-                    cv::Mat Xw = pMP->GetWorldPos();
-                    e->Xw[0] = Xw.at<float>(0);
-                    e->Xw[1] = Xw.at<float>(1);
-                    e->Xw[2] = Xw.at<float>(2);
+    {
+    //^ Construct problem
+    switch(pFrame->mCameraSetup)
+    {
+    case CAMERA_SPLIT:
+        nInitialCorrespondences = AddPoseObservations<CAMERA_SPLIT>(solver, pFrame, vnIndexObs);
+        break;
+    case CAMERA_RECTIFIED:
+        nInitialCorrespondences = AddPoseObservations<CAMERA_RECTIFIED>(solver, pFrame, vnIndexObs);
+        break;
+    default:
+        nInitialCorrespondences = AddPoseObservations<CAMERA_MONOCULAR>(solver, pFrame, vnIndexObs);
+    }
 
-                    e->mTrl = Converter::toSE3Quat(pFrame->mTrl);
+    // Observations of the additional cameras of a rig, after the ones of the frame: (view, keypoint)
+    vRigIndexObs.clear();
+    for(size_t v=0; v<pFrame->mvRigViews.size(); v++)
+    {
+        RigView &view = pFrame->mvRigViews[v];
+        int nRigCamera = -1;
+        for(int i=0, iend=view.size(); i<iend; i++)
+        {
+            MapPoint* pMP = view.mvpMapPoints[i];
+            if(!pMP)
+                continue;
 
-                    optimizer.addEdge(e);
+            if(nRigCamera<0)
+                nRigCamera = solver.AddRigCamera(view.pCamera, Converter::toMatrix3d(view.Rcb), Converter::toVector3d(view.tcb));
 
-                    vpEdgesMono_FHR.push_back(e);
-                    vnIndexEdgeRight.push_back(i);
-                }
-            }
+            view.mvbOutlier[i] = false;
+            const cv::KeyPoint &kp = view.mvKeysUn[i];
+            solver.AddRigObservation(nRigCamera, Converter::toVector3d(pMP->GetWorldPos2()), kp.pt.x, kp.pt.y, pFrame->mvInvLevelSigma2[kp.octave]);
+            vRigIndexObs.push_back(make_pair((int)v,i));
+            nInitialCorrespondences++;
         }
     }
     }
@@ -1033,111 +1185,72 @@ int Optimizer::PoseOptimization(Frame *pFrame)
     const float chi2Stereo[4]={7.815,7.815,7.815, 7.815};
     const int its[4]={10,10,10,10};    
 
+    const Eigen::Matrix3d Rcw0 = Converter::toMatrix3d(pFrame->mTcw.rowRange(0,3).colRange(0,3));
+    const Eigen::Vector3d tcw0 = Converter::toVector3d(pFrame->mTcw.rowRange(0,3).col(3));
+    Eigen::Matrix3d Rcw = Rcw0;
+    Eigen::Vector3d tcw = tcw0;
+
     //^ Optimize
+    static const OptimizerSettings defaultSettings;
+    const OptimizerSettings::ConvergenceCriteria convergence =
+            pFrame->mpContext ? pFrame->mpContext->mOptimizer.convergence : defaultSettings.convergence;
+    solver.SetConvergence(convergence.relativeDecrease, convergence.updateNorm);
+
+    IterationStats stats;
     int nBad=0;
+    bool bRepeat = false;
+    const int nObs = solver.NumObservations();
     for(size_t it=0; it<4; it++)
     {
-
-        vSE3->setEstimate(Converter::toSE3Quat(pFrame->mTcw));
-        optimizer.initializeOptimization(0);
-        optimizer.optimize(its[it]);
-
-        nBad=0;
-        for(size_t i=0, iend=vpEdgesMono.size(); i<iend; i++)
-        {
-            ORB_SLAM3::EdgeSE3ProjectXYZOnlyPose* e = vpEdgesMono[i];
-
-            const size_t idx = vnIndexEdgeMono[i];
-
-            if(pFrame->mvbOutlier[idx])
-            {
-                e->computeError();
-            }
-
-            const float chi2 = e->chi2();
-
-            if(chi2>chi2Mono[it])
-            {                
-                pFrame->mvbOutlier[idx]=true;
-                e->setLevel(1);
-                nBad++;
-            }
-            else
-            {
-                pFrame->mvbOutlier[idx]=false;
-                e->setLevel(0);
-            }
-
-            if(it==2)
-                e->setRobustKernel(0);
-        }
-
-        for(size_t i=0, iend=vpEdgesMono_FHR.size(); i<iend; i++)
+        bool bChanged = false;
+        if(!bRepeat)
         {
-            ORB_SLAM3::EdgeSE3ProjectXYZOnlyPoseToBody* e = vpEdgesMono_FHR[i];
+            Rcw = Rcw0;
+            tcw = tcw0;
+            stats.nIterations += solver.Optimize(Rcw, tcw, its[it]);
+            stats.nRounds++;
 
-            const size_t idx = vnIndexEdgeRight[i];
-
-            if(pFrame->mvbOutlier[idx])
+            nBad=0;
+            const int nFrameObs = vnIndexObs.size();
+            for(int j=0; j<nObs; j++)
             {
-                e->computeError();
-            }
+                const float chi2 = solver.Chi2(j);
+                const float th = solver.GetType(j)==PoseSolver::STEREO ? chi2Stereo[it] : chi2Mono[it];
+                const bool bOutlier = chi2>th;
 
-            const float chi2 = e->chi2();
+                if(j<nFrameObs)
+                    pFrame->mvbOutlier[vnIndexObs[j]]=bOutlier;
+                else
+                {
+                    const pair<int,int> &obs = vRigIndexObs[j-nFrameObs];
+                    pFrame->mvRigViews[obs.first].mvbOutlier[obs.second]=bOutlier;
+                }
 
-            if(chi2>chi2Mono[it])
-            {
-                pFrame->mvbOutlier[idx]=true;
-                e->setLevel(1);
-                nBad++;
-            }
-            else
-            {
-                pFrame->mvbOutlier[idx]=false;
-                e->setLevel(0);
+                if(solver.IsActive(j)==bOutlier)
+                    bChanged = true;
+                solver.SetActive(j, !bOutlier);
+                if(bOutlier)
+                    nBad++;
             }
-
-            if(it==2)
-                e->setRobustKernel(0);
         }
 
-        for(size_t i=0, iend=vpEdgesStereo.size(); i<iend; i++)
-        {
-            g2o::EdgeStereoSE3ProjectXYZOnlyPose* e = vpEdgesStereo[i];
-
-            const size_t idx = vnIndexEdgeStereo[i];
-
-            if(pFrame->mvbOutlier[idx])
-            {
-                e->computeError();
-            }
-
-            const float chi2 = e->chi2();
-
-            if(chi2>chi2Stereo[it])
-            {
-                pFrame->mvbOutlier[idx]=true;
-                e->setLevel(1);
-                nBad++;
-            }
-            else
-            {                
-                e->setLevel(0);
-                pFrame->mvbOutlier[idx]=false;
-            }
-
-            if(it==2)
-                e->setRobustKernel(0);
-        }
+        const bool bWasRobust = solver.IsRobust();
+        if(it==2)
+            solver.SetRobust(false);
 
-        if(optimizer.edges().size()<10)
+        if(nObs<10)
             break;
-    }    
+
+        // Every round starts from the initial pose: with the same active set, kernel, thresholds
+        // and iterations the next round would reproduce this one and is skipped. Only with
+        // convergence criteria set, the default keeps its fixed rounds.
+        bRepeat = convergence.Enabled() && !bChanged && it<3 && bWasRobust==solver.IsRobust() &&
+                  chi2Mono[it]==chi2Mono[it+1] && chi2Stereo[it]==chi2Stereo[it+1] && its[it]==its[it+1];
+    }
+    mstLastStats = stats;
 
     // Recover optimized pose and return number of inliers
-    g2o::VertexSE3Expmap* vSE3_recov = static_cast<g2o::VertexSE3Expmap*>(optimizer.vertex(0));
-    g2o::SE3Quat SE3quat_recov = vSE3_recov->estimate();
-    cv::Mat pose = Converter::toCvMat(SE3quat_recov);
+    cv::Mat pose = Converter::toCvSE3(Rcw, tcw);
     pFrame->SetPose(pose);
 
     return nInitialCorrespondences-nBad;
@@ -1145,6 +1258,7 @@ int Optimizer::PoseOptimization(Frame *pFrame)
 
 void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, vector<KeyFrame*> &vpNonEnoughOptKFs)
 {
+    ORB_TRACE_SCOPE("Optimizer::LocalBundleAdjustment");
     // Local KeyFrames: First Breath Search from Current Keyframe
     list<KeyFrame*> lLocalKeyFrames;
 
@@ -1202,8 +1316,8 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, vector<Ke
     list<KeyFrame*> lFixedCameras;
     for(list<MapPoint*>::iterator lit=lLocalMapPoints.begin(), lend=lLocalMapPoints.end(); lit!=lend; lit++)
     {
-        map<KeyFrame*,tuple<int,int>> observations = (*lit)->GetObservations();
-        for(map<KeyFrame*,tuple<int,int>>::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+        ObservationMap observations = (*lit)->GetObservations();
+        for(ObservationMap::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
         {
             KeyFrame* pKFi = mit->first;
 
@@ -1261,6 +1375,7 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, vector<Ke
     }
 
     // Setup optimizer
+    g2o::GraphArena arena;
     g2o::SparseOptimizer optimizer;
     g2o::BlockSolver_6_3::LinearSolverType * linearSolver;
 
@@ -1285,7 +1400,7 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, vector<Ke
     {
         KeyFrame* pKFi = *lit;
         g2o::VertexSE3Expmap * vSE3 = new g2o::VertexSE3Expmap();
-        vSE3->setEstimate(Converter::toSE3Quat(pKFi->GetPose()));
+        vSE3->setEstimate(Converter::toSE3Quat(pKFi->GetPose_()));
         vSE3->setId(pKFi->mnId);
         vSE3->setFixed(pKFi->mnId==pCurrentMap->GetInitKFid());
         optimizer.addVertex(vSE3);
@@ -1298,7 +1413,7 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, vector<Ke
     {
         KeyFrame* pKFi = *lit;
         g2o::VertexSE3Expmap * vSE3 = new g2o::VertexSE3Expmap();
-        vSE3->setEstimate(Converter::toSE3Quat(pKFi->GetPose()));
+        vSE3->setEstimate(Converter::toSE3Quat(pKFi->GetPose_()));
         vSE3->setId(pKFi->mnId);
         vSE3->setFixed(true);
         optimizer.addVertex(vSE3);
@@ -1347,17 +1462,17 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, vector<Ke
     {
         MapPoint* pMP = *lit;
         g2o::VertexSBAPointXYZ* vPoint = new g2o::VertexSBAPointXYZ();
-        vPoint->setEstimate(Converter::toVector3d(pMP->GetWorldPos()));
+        vPoint->setEstimate(Converter::toVector3d(pMP->GetWorldPos2()));
         int id = pMP->mnId+maxKFid+1;
         vPoint->setId(id);
         vPoint->setMarginalized(true);
         optimizer.addVertex(vPoint);
         nPoints++;
 
-        const map<KeyFrame*,tuple<int,int>> observations = pMP->GetObservations();
+        const ObservationMap observations = pMP->GetObservations();
 
         //Set edges
-        for(map<KeyFrame*,tuple<int,int>>::const_iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+        for(ObservationMap::const_iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
         {
             KeyFrame* pKFi = mit->first;
 
@@ -1372,7 +1487,7 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, vector<Ke
                     Eigen::Matrix<double,2,1> obs;
                     obs << kpUn.pt.x, kpUn.pt.y;
 
-                    ORB_SLAM3::EdgeSE3ProjectXYZ* e = new ORB_SLAM3::EdgeSE3ProjectXYZ();
+                    ORB_SLAM3::EdgeSE3ProjectXYZ* e = ORB_SLAM3::NewEdgeSE3ProjectXYZ(pKFi->mpCamera);
 
                     e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(id)));
                     e->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(pKFi->mnId)));
@@ -1588,7 +1703,7 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, vector<Ke
     bool bWriteStats = false;
 
     // Get Map Mutex
-    unique_lock<mutex> lock(pCurrentMap->mMutexMapUpdate);
+    unique_lock<MapUpdateMutex> lock(pCurrentMap->mMutexMapUpdate);
 
     if(!vToErase.empty())
     {
@@ -1613,7 +1728,7 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, vector<Ke
         cv::Mat Tco_cn = pKFi->GetPose() * Tiw.inv();
         cv::Vec3d trasl = Tco_cn.rowRange(0,3).col(3);
         double dist = cv::norm(trasl);
-        pKFi->SetPose(Converter::toCvMat(SE3quat));
+        pKFi->SetPose_(Converter::toMatx44f(SE3quat));
 
         pKFi->mnNumberOfOpt += numPerform_it;
         if(pKFi->mnNumberOfOpt < 10)
@@ -1627,15 +1742,16 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, vector<Ke
     {
         MapPoint* pMP = *lit;
         g2o::VertexSBAPointXYZ* vPoint = static_cast<g2o::VertexSBAPointXYZ*>(optimizer.vertex(pMP->mnId+maxKFid+1));
-        pMP->SetWorldPos(Converter::toCvMat(vPoint->estimate()));
+        pMP->SetWorldPos2(Converter::toMatx31f(vPoint->estimate()));
         pMP->UpdateNormalAndDepth();
     }
 
     pCurrentMap->IncreaseChangeIndex();
 }
 
-void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap, int& num_fixedKF, int& num_OptKF, int& num_MPs, int& num_edges)
+void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap, int& num_fixedKF, int& num_OptKF, int& num_MPs, int& num_edges, LocalBAGraph* pGraph)
 {    
+    ORB_TRACE_SCOPE("Optimizer::LocalBundleAdjustment");
     // Local KeyFrames: First Breath Search from Current Keyframe
     list<KeyFrame*> lLocalKeyFrames;
 
@@ -1685,8 +1801,8 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
     list<KeyFrame*> lFixedCameras;
     for(list<MapPoint*>::iterator lit=lLocalMapPoints.begin(), lend=lLocalMapPoints.end(); lit!=lend; lit++)
     {
-        map<KeyFrame*,tuple<int,int>> observations = (*lit)->GetObservations();
-        for(map<KeyFrame*,tuple<int,int>>::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+        ObservationMap observations = (*lit)->GetObservations();
+        for(ObservationMap::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
         {
             KeyFrame* pKFi = mit->first;
 
@@ -1743,37 +1859,42 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
         return;
     }
 
-    // Setup optimizer
-    g2o::SparseOptimizer optimizer;
-    g2o::BlockSolver_6_3::LinearSolverType * linearSolver;
-
-    linearSolver = new g2o::LinearSolverEigen<g2o::BlockSolver_6_3::PoseMatrixType>();
-
-    g2o::BlockSolver_6_3 * solver_ptr = new g2o::BlockSolver_6_3(linearSolver);
-
-    g2o::OptimizationAlgorithmLevenberg* solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
-    if (pMap->IsInertial())
-        solver->setUserLambdaInit(100.0);
+    const OptimizerSettings &settings = pMap->GetOptimizerSettings();
+    if(settings.visualBAEngine == OptimizerSettings::VISUAL_BA_NATIVE)
+    {
+        num_OptKF = lLocalKeyFrames.size();
+        LocalBundleAdjustmentNative(pKF, pbStopFlag, pMap, lLocalKeyFrames, lFixedCameras, lLocalMapPoints, num_edges);
+        return;
+    }
 
-    optimizer.setAlgorithm(solver);
-    optimizer.setVerbose(false);
+    // Setup optimizer. Without a persistent graph a temporary one is built for this call only,
+    // otherwise the vertices, edges and solver of the previous window are reused.
+    unique_ptr<g2o::GraphArena> pArena;
+    unique_ptr<LocalBAGraph> pTmpGraph;
+    if(!pGraph)
+    {
+        pArena.reset(new g2o::GraphArena());
+        pTmpGraph.reset(new LocalBAGraph());
+        pGraph = pTmpGraph.get();
+    }
+    pGraph->BeginWindow();
 
-    if(pbStopFlag)
-        optimizer.setForceStopFlag(pbStopFlag);
+    g2o::SparseOptimizer& optimizer = pGraph->GetOptimizer();
+    g2o::OptimizationAlgorithmLevenberg* solver = pGraph->GetAlgorithm();
+    solver->setUserLambdaInit(pMap->IsInertial() ? 100.0 : 0.0);
+    // The algorithm of a persistent graph outlives the call, the criteria are applied every time
+    solver->setConvergenceCriteria(settings.convergence.relativeDecrease, settings.convergence.updateNorm);
+    mstLastStats = IterationStats();
 
-    unsigned long maxKFid = 0;
+    optimizer.setForceStopFlag(pbStopFlag);
 
     // Set Local KeyFrame vertices
     for(list<KeyFrame*>::iterator lit=lLocalKeyFrames.begin(), lend=lLocalKeyFrames.end(); lit!=lend; lit++)
     {
         KeyFrame* pKFi = *lit;
-        g2o::VertexSE3Expmap * vSE3 = new g2o::VertexSE3Expmap();
-        vSE3->setEstimate(Converter::toSE3Quat(pKFi->GetPose()));
-        vSE3->setId(pKFi->mnId);
+        g2o::VertexSE3Expmap * vSE3 = pGraph->KeyFrameVertex(pKFi);
+        vSE3->setEstimate(Converter::toSE3Quat(pKFi->GetPose_()));
         vSE3->setFixed(pKFi->mnId==pMap->GetInitKFid());
-        optimizer.addVertex(vSE3);
-        if(pKFi->mnId>maxKFid)
-            maxKFid=pKFi->mnId;
     }
     num_OptKF = lLocalKeyFrames.size();
 
@@ -1781,13 +1902,9 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
     for(list<KeyFrame*>::iterator lit=lFixedCameras.begin(), lend=lFixedCameras.end(); lit!=lend; lit++)
     {
         KeyFrame* pKFi = *lit;
-        g2o::VertexSE3Expmap * vSE3 = new g2o::VertexSE3Expmap();
-        vSE3->setEstimate(Converter::toSE3Quat(pKFi->GetPose()));
-        vSE3->setId(pKFi->mnId);
+        g2o::VertexSE3Expmap * vSE3 = pGraph->KeyFrameVertex(pKFi);
+        vSE3->setEstimate(Converter::toSE3Quat(pKFi->GetPose_()));
         vSE3->setFixed(true);
-        optimizer.addVertex(vSE3);
-        if(pKFi->mnId>maxKFid)
-            maxKFid=pKFi->mnId;
     }
 
     // Set MapPoint vertices
@@ -1830,18 +1947,14 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
     for(list<MapPoint*>::iterator lit=lLocalMapPoints.begin(), lend=lLocalMapPoints.end(); lit!=lend; lit++)
     {
         MapPoint* pMP = *lit;
-        g2o::VertexSBAPointXYZ* vPoint = new g2o::VertexSBAPointXYZ();
-        vPoint->setEstimate(Converter::toVector3d(pMP->GetWorldPos()));
-        int id = pMP->mnId+maxKFid+1;
-        vPoint->setId(id);
-        vPoint->setMarginalized(true);
-        optimizer.addVertex(vPoint);
+        g2o::VertexSBAPointXYZ* vPoint = pGraph->MapPointVertex(pMP);
+        vPoint->setEstimate(Converter::toVector3d(pMP->GetWorldPos2()));
         nPoints++;
 
-        const map<KeyFrame*,tuple<int,int>> observations = pMP->GetObservations();
+        const ObservationMap observations = pMP->GetObservations();
 
         //Set edges
-        for(map<KeyFrame*,tuple<int,int>>::const_iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+        for(ObservationMap::const_iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
         {
             KeyFrame* pKFi = mit->first;
 
@@ -1856,21 +1969,17 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
                     Eigen::Matrix<double,2,1> obs;
                     obs << kpUn.pt.x, kpUn.pt.y;
 
-                    ORB_SLAM3::EdgeSE3ProjectXYZ* e = new ORB_SLAM3::EdgeSE3ProjectXYZ();
+                    ORB_SLAM3::EdgeSE3ProjectXYZ* e = pGraph->GetEdge<ORB_SLAM3::EdgeSE3ProjectXYZ>(pKFi, pMP, LocalBAGraph::MONO,
+                                                                                              &ORB_SLAM3::NewEdgeSE3ProjectXYZ, pKFi->mpCamera);
 
-                    e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(id)));
-                    e->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(pKFi->mnId)));
                     e->setMeasurement(obs);
                     const float &invSigma2 = pKFi->mvInvLevelSigma2[kpUn.octave];
                     e->setInformation(Eigen::Matrix2d::Identity()*invSigma2);
 
-                    g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
-                    e->setRobustKernel(rk);
-                    rk->setDelta(thHuberMono);
+                    e->robustKernel()->setDelta(thHuberMono);
 
                     e->pCamera = pKFi->mpCamera;
 
-                    optimizer.addEdge(e);
                     vpEdgesMono.push_back(e);
                     vpEdgeKFMono.push_back(pKFi);
                     vpMapPointEdgeMono.push_back(pMP);
@@ -1884,18 +1993,14 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
                     const float kp_ur = pKFi->mvuRight[get<0>(mit->second)];
                     obs << kpUn.pt.x, kpUn.pt.y, kp_ur;
 
-                    g2o::EdgeStereoSE3ProjectXYZ* e = new g2o::EdgeStereoSE3ProjectXYZ();
+                    g2o::EdgeStereoSE3ProjectXYZ* e = pGraph->GetEdge<g2o::EdgeStereoSE3ProjectXYZ>(pKFi, pMP, LocalBAGraph::STEREO);
 
-                    e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(id)));
-                    e->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(pKFi->mnId)));
                     e->setMeasurement(obs);
                     const float &invSigma2 = pKFi->mvInvLevelSigma2[kpUn.octave];
                     Eigen::Matrix3d Info = Eigen::Matrix3d::Identity()*invSigma2;
                     e->setInformation(Info);
 
-                    g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
-                    e->setRobustKernel(rk);
-                    rk->setDelta(thHuberStereo);
+                    e->robustKernel()->setDelta(thHuberStereo);
 
                     e->fx = pKFi->fx;
                     e->fy = pKFi->fy;
@@ -1903,7 +2008,6 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
                     e->cy = pKFi->cy;
                     e->bf = pKFi->mbf;
 
-                    optimizer.addEdge(e);
                     vpEdgesStereo.push_back(e);
                     vpEdgeKFStereo.push_back(pKFi);
                     vpMapPointEdgeStereo.push_back(pMP);
@@ -1921,23 +2025,18 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
                         cv::KeyPoint kp = pKFi->mvKeysRight[rightIndex];
                         obs << kp.pt.x, kp.pt.y;
 
-                        ORB_SLAM3::EdgeSE3ProjectXYZToBody *e = new ORB_SLAM3::EdgeSE3ProjectXYZToBody();
+                        ORB_SLAM3::EdgeSE3ProjectXYZToBody *e = pGraph->GetEdge<ORB_SLAM3::EdgeSE3ProjectXYZToBody>(pKFi, pMP, LocalBAGraph::BODY);
 
-                        e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(id)));
-                        e->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(pKFi->mnId)));
                         e->setMeasurement(obs);
                         const float &invSigma2 = pKFi->mvInvLevelSigma2[kp.octave];
                         e->setInformation(Eigen::Matrix2d::Identity()*invSigma2);
 
-                        g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
-                        e->setRobustKernel(rk);
-                        rk->setDelta(thHuberMono);
+                        e->robustKernel()->setDelta(thHuberMono);
 
                         e->mTrl = Converter::toSE3Quat(pKFi->mTrl);
 
                         e->pCamera = pKFi->mpCamera2;
 
-                        optimizer.addEdge(e);
                         vpEdgesBody.push_back(e);
                         vpEdgeKFBody.push_back(pKFi);
                         vpMapPointEdgeBody.push_back(pMP);
@@ -1948,8 +2047,60 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
             }
         }
     }
+
+    // Rig cameras of the keyframes, on the points of the window: the rig is optimized as one body,
+    // each camera seeing the world from Tcb*Tcw
+    vector<ORB_SLAM3::EdgeSE3ProjectXYZToBody*> vpEdgesRig;
+    vector<KeyFrame*> vpEdgeKFRig;
+    vector<MapPoint*> vpMapPointEdgeRig;
+    vector<int> vnEdgeCameraRig;
+    for(int nList=0; nList<2; nList++)
+    {
+        const list<KeyFrame*> &lKFs = nList==0 ? lLocalKeyFrames : lFixedCameras;
+        for(list<KeyFrame*>::const_iterator lit=lKFs.begin(), lend=lKFs.end(); lit!=lend; lit++)
+        {
+            KeyFrame* pKFi = *lit;
+            if(pKFi->mvRigCameras.empty() || pKFi->isBad())
+                continue;
+
+            const vector<KeyFrame::RigObservation> vRigObs = pKFi->GetRigObservations();
+            for(size_t j=0; j<vRigObs.size(); j++)
+            {
+                const KeyFrame::RigObservation &rigObs = vRigObs[j];
+                MapPoint* pMP = rigObs.pMP;
+                if(pMP->mnBALocalForKF!=pKF->mnId || pMP->GetMap()!=pCurrentMap)
+                    continue;
+
+                const KeyFrame::RigCamera &cam = pKFi->mvRigCameras[rigObs.nCamera];
+                Eigen::Matrix<double,2,1> obs;
+                obs << rigObs.kpUn.pt.x, rigObs.kpUn.pt.y;
+
+                ORB_SLAM3::EdgeSE3ProjectXYZToBody *e = pGraph->GetEdge<ORB_SLAM3::EdgeSE3ProjectXYZToBody>(pKFi, pMP, LocalBAGraph::RIG+rigObs.nCamera);
+
+                e->setMeasurement(obs);
+                const float &invSigma2 = pKFi->mvInvLevelSigma2[rigObs.kpUn.octave];
+                e->setInformation(Eigen::Matrix2d::Identity()*invSigma2);
+
+                e->robustKernel()->setDelta(thHuberMono);
+
+                e->mTrl = Converter::toSE3Quat(cam.Tcb);
+
+                e->pCamera = cam.pCamera;
+
+                vpEdgesRig.push_back(e);
+                vpEdgeKFRig.push_back(pKFi);
+                vpMapPointEdgeRig.push_back(pMP);
+                vnEdgeCameraRig.push_back(rigObs.nCamera);
+
+                nEdges++;
+            }
+        }
+    }
     num_edges = nEdges;
 
+    // Free what left the window before the solver structure is built
+    pGraph->EndWindow();
+
     if(pbStopFlag)
         if(*pbStopFlag)
             return;
@@ -1957,8 +2108,11 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
     optimizer.initializeOptimization();
 
     std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
-    optimizer.optimize(5);
+    IterationStats stats;
+    stats.nIterations = optimizer.optimize(5);
+    stats.nRounds = 1;
     std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    mstLastStats = stats;
 
     bool bDoMore= true;
 
@@ -2003,21 +2157,45 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
         int nStereoBadObs = 0;
         for(size_t i=0, iend=vpEdgesStereo.size(); i<iend;i++)
         {
-            g2o::EdgeStereoSE3ProjectXYZ* e = vpEdgesStereo[i];
-            MapPoint* pMP = vpMapPointEdgeStereo[i];
+            g2o::EdgeStereoSE3ProjectXYZ* e = vpEdgesStereo[i];
+            MapPoint* pMP = vpMapPointEdgeStereo[i];
+
+            if(pMP->isBad())
+                continue;
+
+            if(e->chi2()>7.815 || !e->isDepthPositive())
+            {
+                nStereoBadObs++;
+            }
+        }
+
+        int nRigBadObs = 0;
+        for(size_t i=0, iend=vpEdgesRig.size(); i<iend;i++)
+        {
+            ORB_SLAM3::EdgeSE3ProjectXYZToBody* e = vpEdgesRig[i];
+            MapPoint* pMP = vpMapPointEdgeRig[i];
 
             if(pMP->isBad())
                 continue;
 
-            if(e->chi2()>7.815 || !e->isDepthPositive())
+            if(e->chi2()>5.991 || !e->isDepthPositive())
             {
-                nStereoBadObs++;
+                nRigBadObs++;
             }
         }
 
+        // A first pass that converged without outliers leaves nothing for the second one to fix
+        const bool bConverged = convergence.Enabled() && stats.nIterations>0 && stats.nIterations<5 &&
+                                nMonoBadObs+nBodyBadObs+nStereoBadObs+nRigBadObs==0;
+
         // Optimize again
-        optimizer.initializeOptimization(0);
-        optimizer.optimize(10);
+        if(!bConverged)
+        {
+            optimizer.initializeOptimization(0);
+            stats.nIterations += optimizer.optimize(10);
+            stats.nRounds++;
+            mstLastStats = stats;
+        }
 
     }
 
@@ -2070,8 +2248,22 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
         }
     }
 
+    // Rig outliers are only dropped from the keyframe, they are not observations of the point
+    vector<size_t> vRigToErase;
+    for(size_t i=0, iend=vpEdgesRig.size(); i<iend;i++)
+    {
+        ORB_SLAM3::EdgeSE3ProjectXYZToBody* e = vpEdgesRig[i];
+        MapPoint* pMP = vpMapPointEdgeRig[i];
+
+        if(pMP->isBad())
+            continue;
+
+        if(e->chi2()>5.991 || !e->isDepthPositive())
+            vRigToErase.push_back(i);
+    }
+
     // Get Map Mutex
-    unique_lock<mutex> lock(pMap->mMutexMapUpdate);
+    unique_lock<MapUpdateMutex> lock(pMap->mMutexMapUpdate);
 
     if(!vToErase.empty())
     {
@@ -2084,15 +2276,18 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
         }
     }
 
+    for(size_t i=0;i<vRigToErase.size();i++)
+        vpEdgeKFRig[vRigToErase[i]]->EraseRigObservation(vnEdgeCameraRig[vRigToErase[i]], vpMapPointEdgeRig[vRigToErase[i]]);
+
     // Recover optimized data
     //Keyframes
     bool bShowStats = false;
     for(list<KeyFrame*>::iterator lit=lLocalKeyFrames.begin(), lend=lLocalKeyFrames.end(); lit!=lend; lit++)
     {
         KeyFrame* pKFi = *lit;
-        g2o::VertexSE3Expmap* vSE3 = static_cast<g2o::VertexSE3Expmap*>(optimizer.vertex(pKFi->mnId));
+        g2o::VertexSE3Expmap* vSE3 = pGraph->KeyFrameVertex(pKFi);
         g2o::SE3Quat SE3quat = vSE3->estimate();
-        pKFi->SetPose(Converter::toCvMat(SE3quat));
+        pKFi->SetPose_(Converter::toMatx44f(SE3quat));
 
     }
 
@@ -2100,8 +2295,8 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
     for(list<MapPoint*>::iterator lit=lLocalMapPoints.begin(), lend=lLocalMapPoints.end(); lit!=lend; lit++)
     {
         MapPoint* pMP = *lit;
-        g2o::VertexSBAPointXYZ* vPoint = static_cast<g2o::VertexSBAPointXYZ*>(optimizer.vertex(pMP->mnId+maxKFid+1));
-        pMP->SetWorldPos(Converter::toCvMat(vPoint->estimate()));
+        g2o::VertexSBAPointXYZ* vPoint = pGraph->MapPointVertex(pMP);
+        pMP->SetWorldPos2(Converter::toMatx31f(vPoint->estimate()));
         pMP->UpdateNormalAndDepth();
     }
 
@@ -2109,25 +2304,140 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
     pMap->IncreaseChangeIndex();
 }
 
+void Optimizer::LocalBundleAdjustmentNative(KeyFrame* pKF, bool *pbStopFlag, Map *pMap, const list<KeyFrame*> &lLocalKeyFrames,
+                                            const list<KeyFrame*> &lFixedCameras, const list<MapPoint*> &lLocalMapPoints, int& num_edges)
+{
+    ORB_TRACE_SCOPE("Optimizer::LocalBundleAdjustmentNative");
+    Map* pCurrentMap = pKF->GetMap();
+
+    // The buffers of the solver keep their capacity from one local BA to the next
+    static thread_local VisualBASolver solver;
+    const OptimizerSettings &settings = pMap->GetOptimizerSettings();
+    solver.Reset(settings.pThreadPool);
+    solver.SetStopFlag(pbStopFlag);
+    solver.SetLambdaInit(pMap->IsInertial() ? 100.0 : 0.0);
+    if(settings.bVisualBASingle)
+        solver.SetPrecision(VisualBASolver::SINGLE);
+
+    map<KeyFrame*,int> mKFIndex;
+    for(list<KeyFrame*>::const_iterator lit=lLocalKeyFrames.begin(), lend=lLocalKeyFrames.end(); lit!=lend; lit++)
+        mKFIndex[*lit] = AddKeyFrameToSolver(solver, *lit, (*lit)->mnId==pMap->GetInitKFid());
+    for(list<KeyFrame*>::const_iterator lit=lFixedCameras.begin(), lend=lFixedCameras.end(); lit!=lend; lit++)
+        mKFIndex[*lit] = AddKeyFrameToSolver(solver, *lit, true);
+
+    const double thHuberMono = sqrt(5.991);
+    const double thHuberStereo = sqrt(7.815);
+
+    // Keyframe and point of every observation, in the order of the solver
+    vector<pair<KeyFrame*,MapPoint*> > vObs;
+    vObs.reserve(lLocalMapPoints.size()*(lLocalKeyFrames.size()+lFixedCameras.size()));
+
+    for(list<MapPoint*>::const_iterator lit=lLocalMapPoints.begin(), lend=lLocalMapPoints.end(); lit!=lend; lit++)
+    {
+        MapPoint* pMP = *lit;
+        const int nPoint = solver.AddPoint(Converter::toVector3d(pMP->GetWorldPos2()));
+
+        const ObservationMap observations = pMP->GetObservations();
+        for(ObservationMap::const_iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+        {
+            KeyFrame* pKFi = mit->first;
+            if(pKFi->isBad() || pKFi->GetMap() != pCurrentMap)
+                continue;
+            map<KeyFrame*,int>::const_iterator kit = mKFIndex.find(pKFi);
+            if(kit==mKFIndex.end())
+                continue;
+
+            AddObservationsToSolver(solver, pKFi, kit->second, pMP, nPoint, mit->second,
+                                    thHuberMono, thHuberStereo, thHuberMono, &vObs);
+        }
+    }
+    num_edges = solver.NumObservations();
+
+    if(pbStopFlag)
+        if(*pbStopFlag)
+            return;
+
+    solver.Optimize(5);
+
+    bool bDoMore= true;
+
+    if(pbStopFlag)
+        if(*pbStopFlag)
+            bDoMore = false;
+
+    // Optimize again
+    if(bDoMore)
+        solver.Optimize(10);
+
+    // Check inlier observations
+    vector<pair<KeyFrame*,MapPoint*> > vToErase;
+    for(size_t i=0; i<vObs.size(); i++)
+    {
+        if(vObs[i].second->isBad())
+            continue;
+
+        const double th = solver.GetType(i)==VisualBASolver::STEREO ? 7.815 : 5.991;
+        if(solver.Chi2(i)>th || !solver.IsDepthPositive(i))
+            vToErase.push_back(vObs[i]);
+    }
+
+    // Get Map Mutex
+    unique_lock<MapUpdateMutex> lock(pMap->mMutexMapUpdate);
+
+    for(size_t i=0;i<vToErase.size();i++)
+    {
+        KeyFrame* pKFi = vToErase[i].first;
+        MapPoint* pMPi = vToErase[i].second;
+        pKFi->EraseMapPointMatch(pMPi);
+        pMPi->EraseObservation(pKFi);
+    }
+
+    // Recover optimized data
+    Eigen::Matrix3d Rcw;
+    Eigen::Vector3d tcw;
+    for(list<KeyFrame*>::const_iterator lit=lLocalKeyFrames.begin(), lend=lLocalKeyFrames.end(); lit!=lend; lit++)
+    {
+        solver.GetPose(mKFIndex[*lit], Rcw, tcw);
+        (*lit)->SetPose_(Converter::toMatx44f(g2o::SE3Quat(Rcw, tcw)));
+    }
+
+    int nPoint = 0;
+    for(list<MapPoint*>::const_iterator lit=lLocalMapPoints.begin(), lend=lLocalMapPoints.end(); lit!=lend; lit++, nPoint++)
+    {
+        MapPoint* pMP = *lit;
+        pMP->SetWorldPos2(Converter::toMatx31f(solver.GetPoint(nPoint)));
+        pMP->UpdateNormalAndDepth();
+    }
+
+    pMap->IncreaseChangeIndex();
+}
+
 
 void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* pCurKF,
                                        const LoopClosing::KeyFrameAndPose &NonCorrectedSim3,
                                        const LoopClosing::KeyFrameAndPose &CorrectedSim3,
-                                       const map<KeyFrame *, set<KeyFrame *> > &LoopConnections, const bool &bFixScale)
+                                       const map<KeyFrame *, set<KeyFrame *> > &LoopConnections, const bool &bFixScale,
+                                       LoopClosing::KeyFrameAndPose* pInitialSim3, LoopClosing::KeyFrameAndPose* pOptimizedSim3)
 {   
+    ORB_TRACE_SCOPE("Optimizer::OptimizeEssentialGraph");
     // Setup optimizer
+    g2o::GraphArena arena;
     g2o::SparseOptimizer optimizer;
     optimizer.setVerbose(false);
+    const OptimizerSettings &settings = pMap->GetOptimizerSettings();
     g2o::BlockSolver_7_3::LinearSolverType * linearSolver =
-           new g2o::LinearSolverEigen<g2o::BlockSolver_7_3::PoseMatrixType>();
+           NewSparseLinearSolver<g2o::BlockSolver_7_3>(settings);
     g2o::BlockSolver_7_3 * solver_ptr= new g2o::BlockSolver_7_3(linearSolver);
     g2o::OptimizationAlgorithmLevenberg* solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
 
     solver->setUserLambdaInit(1e-16);
+    solver->setConvergenceCriteria(settings.convergence.relativeDecrease, settings.convergence.updateNorm);
     optimizer.setAlgorithm(solver);
 
-    const vector<KeyFrame*> vpKFs = pMap->GetAllKeyFrames();
-    const vector<MapPoint*> vpMPs = pMap->GetAllMapPoints();
+    const Map::KeyFramesSnapshot pKFs = pMap->GetKeyFramesSnapshot();
+    const vector<KeyFrame*> &vpKFs = *pKFs;
+    const Map::MapPointsSnapshot pMPs = pMap->GetMapPointsSnapshot();
+    const vector<MapPoint*> &vpMPs = *pMPs;
 
     const unsigned int nMaxKFid = pMap->GetMaxKFid();
 
@@ -2145,7 +2455,7 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
     for(size_t i=0, iend=vpKFs.size(); i<iend;i++)
     {
         KeyFrame* pKF = vpKFs[i];
-        if(pKF->isBad())
+        if(pKF->isBad() || pKF->mnId>nMaxKFid)
             continue;
         g2o::VertexSim3Expmap* VSim3 = new g2o::VertexSim3Expmap();
 
@@ -2160,8 +2470,8 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
         }
         else
         {
-            Eigen::Matrix<double,3,3> Rcw = Converter::toMatrix3d(pKF->GetRotation());
-            Eigen::Matrix<double,3,1> tcw = Converter::toVector3d(pKF->GetTranslation());
+            Eigen::Matrix<double,3,3> Rcw = Converter::toMatrix3d(pKF->GetRotation_());
+            Eigen::Matrix<double,3,1> tcw = Converter::toVector3d(pKF->GetTranslation_());
             g2o::Sim3 Siw(Rcw,tcw,1.0);
             vScw[nIDi] = Siw;
             VSim3->setEstimate(Siw);
@@ -2191,6 +2501,8 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
     {
         KeyFrame* pKF = mit->first;
         const long unsigned int nIDi = pKF->mnId;
+        if(nIDi>nMaxKFid || !vpVertices[nIDi])
+            continue;
         const set<KeyFrame*> &spConnections = mit->second;
         const g2o::Sim3 Siw = vScw[nIDi];
         const g2o::Sim3 Swi = Siw.inverse();
@@ -2198,6 +2510,8 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
         for(set<KeyFrame*>::const_iterator sit=spConnections.begin(), send=spConnections.end(); sit!=send; sit++)
         {
             const long unsigned int nIDj = (*sit)->mnId;
+            if(nIDj>nMaxKFid || !vpVertices[nIDj])
+                continue;
             if((nIDi!=pCurKF->mnId || nIDj!=pLoopKF->mnId) && pKF->GetWeight(*sit)<minFeat)
                 continue;
 
@@ -2221,6 +2535,11 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
     int count_cov = 0;
     int count_imu = 0;
     int count_kf = 0;
+
+    // Only the keyframes whose connections changed since the last correction are queried again
+    vector<Map::EssentialEdges> vEssentialEdges;
+    pMap->GetEssentialGraph(minFeat,vpKFs,vEssentialEdges);
+
     // Set normal edges
     for(size_t i=0, iend=vpKFs.size(); i<iend; i++)
     {
@@ -2229,6 +2548,10 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
 
         const int nIDi = pKF->mnId;
 
+        // Keyframes created or culled after the vertices were set (only when Local Mapping keeps running)
+        if(pKF->mnId>nMaxKFid || !vpVertices[nIDi])
+            continue;
+
         g2o::Sim3 Swi;
 
         LoopClosing::KeyFrameAndPose::const_iterator iti = NonCorrectedSim3.find(pKF);
@@ -2238,10 +2561,11 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
         else
             Swi = vScw[nIDi].inverse();
 
-        KeyFrame* pParentKF = pKF->GetParent();
+        const Map::EssentialEdges &edges = vEssentialEdges[i];
+        KeyFrame* pParentKF = edges.pParent;
 
         // Spanning tree edge
-        if(pParentKF)
+        if(pParentKF && pParentKF->mnId<=nMaxKFid && vpVertices[pParentKF->mnId])
         {
             int nIDj = pParentKF->mnId;
 
@@ -2267,70 +2591,64 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
         }
 
         // Loop edges
-        const set<KeyFrame*> sLoopEdges = pKF->GetLoopEdges();
-        for(set<KeyFrame*>::const_iterator sit=sLoopEdges.begin(), send=sLoopEdges.end(); sit!=send; sit++)
+        for(vector<KeyFrame*>::const_iterator vit=edges.vpLoopEdges.begin(), vend=edges.vpLoopEdges.end(); vit!=vend; vit++)
         {
-            KeyFrame* pLKF = *sit;
-            if(pLKF->mnId<pKF->mnId)
-            {
-                g2o::Sim3 Slw;
+            KeyFrame* pLKF = *vit;
+            if(!vpVertices[pLKF->mnId])
+                continue;
 
-                LoopClosing::KeyFrameAndPose::const_iterator itl = NonCorrectedSim3.find(pLKF);
+            g2o::Sim3 Slw;
 
-                if(itl!=NonCorrectedSim3.end())
-                    Slw = itl->second;
-                else
-                    Slw = vScw[pLKF->mnId];
+            LoopClosing::KeyFrameAndPose::const_iterator itl = NonCorrectedSim3.find(pLKF);
 
-                g2o::Sim3 Sli = Slw * Swi;
-                g2o::EdgeSim3* el = new g2o::EdgeSim3();
-                el->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(pLKF->mnId)));
-                el->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(nIDi)));
-                el->setMeasurement(Sli);
-                el->information() = matLambda;
-                optimizer.addEdge(el);
-                count_kf++;
-                count_loop++;
-            }
+            if(itl!=NonCorrectedSim3.end())
+                Slw = itl->second;
+            else
+                Slw = vScw[pLKF->mnId];
+
+            g2o::Sim3 Sli = Slw * Swi;
+            g2o::EdgeSim3* el = new g2o::EdgeSim3();
+            el->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(pLKF->mnId)));
+            el->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(nIDi)));
+            el->setMeasurement(Sli);
+            el->information() = matLambda;
+            optimizer.addEdge(el);
+            count_kf++;
+            count_loop++;
         }
 
         // Covisibility graph edges
-        const vector<KeyFrame*> vpConnectedKFs = pKF->GetCovisiblesByWeight(minFeat);
-        for(vector<KeyFrame*>::const_iterator vit=vpConnectedKFs.begin(); vit!=vpConnectedKFs.end(); vit++)
+        for(vector<KeyFrame*>::const_iterator vit=edges.vpCovisibles.begin(); vit!=edges.vpCovisibles.end(); vit++)
         {
             KeyFrame* pKFn = *vit;
-            if(pKFn && pKFn!=pParentKF && !pKF->hasChild(pKFn) && !sLoopEdges.count(pKFn))
-            {
-                if(!pKFn->isBad() && pKFn->mnId<pKF->mnId)
-                {
-                    if(sInsertedEdges.count(make_pair(min(pKF->mnId,pKFn->mnId),max(pKF->mnId,pKFn->mnId))))
-                        continue;
+            if(pKFn->isBad() || !vpVertices[pKFn->mnId])
+                continue;
+            if(sInsertedEdges.count(make_pair(min(pKF->mnId,pKFn->mnId),max(pKF->mnId,pKFn->mnId))))
+                continue;
 
-                    g2o::Sim3 Snw;
+            g2o::Sim3 Snw;
 
-                    LoopClosing::KeyFrameAndPose::const_iterator itn = NonCorrectedSim3.find(pKFn);
+            LoopClosing::KeyFrameAndPose::const_iterator itn = NonCorrectedSim3.find(pKFn);
 
-                    if(itn!=NonCorrectedSim3.end())
-                        Snw = itn->second;
-                    else
-                        Snw = vScw[pKFn->mnId];
+            if(itn!=NonCorrectedSim3.end())
+                Snw = itn->second;
+            else
+                Snw = vScw[pKFn->mnId];
 
-                    g2o::Sim3 Sni = Snw * Swi;
+            g2o::Sim3 Sni = Snw * Swi;
 
-                    g2o::EdgeSim3* en = new g2o::EdgeSim3();
-                    en->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(pKFn->mnId)));
-                    en->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(nIDi)));
-                    en->setMeasurement(Sni);
-                    en->information() = matLambda;
-                    optimizer.addEdge(en);
-                    count_kf++;
-                    count_cov++;
-                }
-            }
+            g2o::EdgeSim3* en = new g2o::EdgeSim3();
+            en->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(pKFn->mnId)));
+            en->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(nIDi)));
+            en->setMeasurement(Sni);
+            en->information() = matLambda;
+            optimizer.addEdge(en);
+            count_kf++;
+            count_cov++;
         }
 
         // Inertial edges if inertial
-        if(pKF->bImu && pKF->mPrevKF)
+        if(pKF->bImu && pKF->mPrevKF && vpVertices[pKF->mPrevKF->mnId])
         {
             g2o::Sim3 Spw;
             LoopClosing::KeyFrameAndPose::const_iterator itp = NonCorrectedSim3.find(pKF->mPrevKF);
@@ -2355,10 +2673,29 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
     optimizer.initializeOptimization();
     optimizer.computeActiveErrors();
     float err0 = optimizer.activeRobustChi2();
-    optimizer.optimize(20);
+    IterationStats stats;
+    stats.nIterations = optimizer.optimize(20);
+    stats.nRounds = 1;
+    mstLastStats = stats;
     optimizer.computeActiveErrors();
     float errEnd = optimizer.activeRobustChi2();
-    unique_lock<mutex> lock(pMap->mMutexMapUpdate);
+
+    if(pOptimizedSim3)
+    {
+        for(size_t i=0;i<vpKFs.size();i++)
+        {
+            KeyFrame* pKFi = vpKFs[i];
+            if(pKFi->mnId>nMaxKFid || !vpVertices[pKFi->mnId])
+                continue;
+
+            (*pOptimizedSim3)[pKFi] = vpVertices[pKFi->mnId]->estimate();
+            if(pInitialSim3)
+                (*pInitialSim3)[pKFi] = vScw[pKFi->mnId];
+        }
+        return;
+    }
+
+    unique_lock<MapUpdateMutex> lock(pMap->mMutexMapUpdate);
 
     // SE3 Pose Recovering. Sim3:[sR t;0 1] -> SE3:[R t/s;0 1]
     for(size_t i=0;i<vpKFs.size();i++)
@@ -2366,6 +2703,8 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
         KeyFrame* pKFi = vpKFs[i];
 
         const int nIDi = pKFi->mnId;
+        if(pKFi->mnId>nMaxKFid || !vpVertices[nIDi])
+            continue;
 
         g2o::VertexSim3Expmap* VSim3 = static_cast<g2o::VertexSim3Expmap*>(optimizer.vertex(nIDi));
         g2o::Sim3 CorrectedSiw =  VSim3->estimate();
@@ -2400,7 +2739,8 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
             KeyFrame* pRefKF = pMP->GetReferenceKeyFrame();
             nIDr = pRefKF->mnId;
         }
-
+        if(nIDr>nMaxKFid || !vpVertices[nIDr])
+            continue;
 
         g2o::Sim3 Srw = vScw[nIDr];
         g2o::Sim3 correctedSwr = vCorrectedSwc[nIDr];
@@ -2418,13 +2758,185 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
     pMap->IncreaseChangeIndex();
 }
 
+bool Optimizer::OptimizeSubmapGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* pCurKF,
+                                    const LoopClosing::KeyFrameAndPose &NonCorrectedSim3,
+                                    const LoopClosing::KeyFrameAndPose &CorrectedSim3,
+                                    const map<KeyFrame *, set<KeyFrame *> > &LoopConnections,
+                                    const bool &bFixScale,
+                                    LoopClosing::SubmapAndPose &InitialSim3,
+                                    LoopClosing::SubmapAndPose &OptimizedSim3)
+{
+    ORB_TRACE_SCOPE("Optimizer::OptimizeSubmapGraph");
+    const long int nSubmaps = pMap->NumSubmaps();
+    if(nSubmaps<3)
+        return false;
+
+    LoopClosing::KeyFrameAndPose::const_iterator itCur = CorrectedSim3.find(pCurKF);
+    LoopClosing::KeyFrameAndPose::const_iterator itCurNC = NonCorrectedSim3.find(pCurKF);
+    if(itCur==CorrectedSim3.end() || itCurNC==NonCorrectedSim3.end())
+        return false;
+
+    // Loop correction as a similarity of the world: CorrectedSiw = Siw*Linv in the loop window
+    const g2o::Sim3 Linv = itCurNC->second.inverse()*itCur->second;
+
+    // Submaps with keyframes of the loop window
+    vector<bool> vbWindow(nSubmaps,false);
+    for(LoopClosing::KeyFrameAndPose::const_iterator mit=CorrectedSim3.begin(), mend=CorrectedSim3.end(); mit!=mend; mit++)
+    {
+        const long int nSubmap = mit->first->mnSubmapId;
+        if(nSubmap<0 || nSubmap>=nSubmaps)
+            return false;
+        vbWindow[nSubmap] = true;
+    }
+
+    // The submap of the origin keyframe is fixed, it can not be moved by the loop
+    KeyFrame* pOriginKF = pMap->GetOriginKF();
+    if(!pOriginKF || pOriginKF->mnSubmapId<0 || pOriginKF->mnSubmapId>=nSubmaps || vbWindow[pOriginKF->mnSubmapId])
+        return false;
+
+    // Setup optimizer
+    g2o::GraphArena arena;
+    g2o::SparseOptimizer optimizer;
+    optimizer.setVerbose(false);
+    g2o::BlockSolver_7_3::LinearSolverType * linearSolver =
+           NewSparseLinearSolver<g2o::BlockSolver_7_3>(pMap->GetOptimizerSettings());
+    g2o::BlockSolver_7_3 * solver_ptr= new g2o::BlockSolver_7_3(linearSolver);
+    g2o::OptimizationAlgorithmLevenberg* solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
+
+    solver->setUserLambdaInit(1e-16);
+    optimizer.setAlgorithm(solver);
+
+    // Anchor vertices, with their pose before (vSaw) and after (vSinit) the loop correction
+    vector<g2o::Sim3,Eigen::aligned_allocator<g2o::Sim3> > vSaw(nSubmaps);
+    vector<g2o::Sim3,Eigen::aligned_allocator<g2o::Sim3> > vSinit(nSubmaps);
+    vector<g2o::VertexSim3Expmap*> vpVertices(nSubmaps,static_cast<g2o::VertexSim3Expmap*>(NULL));
+
+    for(long int s=0; s<nSubmaps; s++)
+    {
+        KeyFrame* pAnchorKF = pMap->GetSubmapAnchor(s);
+        if(!pAnchorKF)
+            continue;
+
+        LoopClosing::KeyFrameAndPose::const_iterator it = NonCorrectedSim3.find(pAnchorKF);
+        if(it!=NonCorrectedSim3.end())
+            vSaw[s] = it->second;
+        else
+            vSaw[s] = g2o::Sim3(Converter::toMatrix3d(pAnchorKF->GetRotation_()),Converter::toVector3d(pAnchorKF->GetTranslation_()),1.0);
+        vSinit[s] = vbWindow[s] ? vSaw[s]*Linv : vSaw[s];
+
+        g2o::VertexSim3Expmap* VSim3 = new g2o::VertexSim3Expmap();
+        VSim3->setEstimate(vSinit[s]);
+        VSim3->setId(s);
+        VSim3->setMarginalized(false);
+        VSim3->_fix_scale = bFixScale;
+        if(s==pOriginKF->mnSubmapId)
+            VSim3->setFixed(true);
+
+        optimizer.addVertex(VSim3);
+        vpVertices[s] = VSim3;
+    }
+
+    const int minFeat = 100;
+    const Eigen::Matrix<double,7,7> matLambda = Eigen::Matrix<double,7,7>::Identity();
+    set<pair<long int,long int> > sInsertedEdges;
+
+    auto addEdge = [&](const long int si, const long int sj, const g2o::Sim3 &Sji){
+        g2o::EdgeSim3* e = new g2o::EdgeSim3();
+        e->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(sj)));
+        e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(si)));
+        e->setMeasurement(Sji);
+        e->information() = matLambda;
+        optimizer.addEdge(e);
+        sInsertedEdges.insert(make_pair(min(si,sj),max(si,sj)));
+    };
+
+    // Loop edges between the submaps joined by the loop, measured after the correction
+    int count_loop = 0;
+    for(map<KeyFrame *, set<KeyFrame *> >::const_iterator mit = LoopConnections.begin(), mend=LoopConnections.end(); mit!=mend; mit++)
+    {
+        KeyFrame* pKF = mit->first;
+        const long int si = pKF->mnSubmapId;
+        if(si<0 || si>=nSubmaps || !vpVertices[si])
+            continue;
+
+        const set<KeyFrame*> &spConnections = mit->second;
+        for(set<KeyFrame*>::const_iterator sit=spConnections.begin(), send=spConnections.end(); sit!=send; sit++)
+        {
+            const long int sj = (*sit)->mnSubmapId;
+            if(sj<0 || sj>=nSubmaps || sj==si || !vpVertices[sj])
+                continue;
+            if((pKF!=pCurKF || *sit!=pLoopKF) && pKF->GetWeight(*sit)<minFeat)
+                continue;
+            if(sInsertedEdges.count(make_pair(min(si,sj),max(si,sj))))
+                continue;
+
+            addEdge(si, sj, vSinit[sj]*vSinit[si].inverse());
+            count_loop++;
+        }
+    }
+
+    // Essential graph edges between different submaps, measured before the correction
+    const Map::KeyFramesSnapshot pKFs = pMap->GetKeyFramesSnapshot();
+    const vector<KeyFrame*> &vpKFs = *pKFs;
+    vector<Map::EssentialEdges> vEssentialEdges;
+    pMap->GetEssentialGraph(minFeat,vpKFs,vEssentialEdges);
+
+    int count_edges = 0;
+    for(size_t i=0, iend=vpKFs.size(); i<iend; i++)
+    {
+        const long int si = vpKFs[i]->mnSubmapId;
+        if(si<0 || si>=nSubmaps || !vpVertices[si])
+            continue;
+
+        const Map::EssentialEdges &edges = vEssentialEdges[i];
+        vector<KeyFrame*> vpNeighbors(edges.vpLoopEdges);
+        vpNeighbors.insert(vpNeighbors.end(),edges.vpCovisibles.begin(),edges.vpCovisibles.end());
+        if(edges.pParent)
+            vpNeighbors.push_back(edges.pParent);
+
+        for(size_t j=0; j<vpNeighbors.size(); j++)
+        {
+            const long int sj = vpNeighbors[j]->mnSubmapId;
+            if(sj<0 || sj>=nSubmaps || sj==si || !vpVertices[sj] || vpNeighbors[j]->isBad())
+                continue;
+            if(sInsertedEdges.count(make_pair(min(si,sj),max(si,sj))))
+                continue;
+
+            addEdge(si, sj, vSaw[sj]*vSaw[si].inverse());
+            count_edges++;
+        }
+    }
+
+    if(count_loop==0)
+        return false;
+
+    Verbose::PrintMess("Submap graph: "+to_string(optimizer.vertices().size())+" anchors, "+to_string(count_edges)+" edges, "+
+                       to_string(count_loop)+" loop edges", Verbose::VERBOSITY_DEBUG);
+
+    // Optimize!
+    optimizer.initializeOptimization();
+    optimizer.optimize(20);
+
+    for(long int s=0; s<nSubmaps; s++)
+    {
+        if(!vpVertices[s])
+            continue;
+        InitialSim3[s] = vSinit[s];
+        OptimizedSim3[s] = vpVertices[s]->estimate();
+    }
+
+    return true;
+}
+
 void Optimizer::OptimizeEssentialGraph6DoF(KeyFrame* pCurKF, vector<KeyFrame*> &vpFixedKFs, vector<KeyFrame*> &vpFixedCorrectedKFs,
                                        vector<KeyFrame*> &vpNonFixedKFs, vector<MapPoint*> &vpNonCorrectedMPs, double scale)
 {
+    ORB_TRACE_SCOPE("Optimizer::OptimizeEssentialGraph6DoF");
+    g2o::GraphArena arena;
     g2o::SparseOptimizer optimizer;
     optimizer.setVerbose(false);
     g2o::BlockSolver_6_3::LinearSolverType * linearSolver =
-           new g2o::LinearSolverEigen<g2o::BlockSolver_6_3::PoseMatrixType>();
+           NewSparseLinearSolver<g2o::BlockSolver_6_3>(pCurKF->GetMap()->GetOptimizerSettings());
     g2o::BlockSolver_6_3 * solver_ptr= new g2o::BlockSolver_6_3(linearSolver);
     g2o::OptimizationAlgorithmLevenberg* solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
 
@@ -2452,8 +2964,8 @@ void Optimizer::OptimizeEssentialGraph6DoF(KeyFrame* pCurKF, vector<KeyFrame*> &
 
         const int nIDi = pKFi->mnId;
 
-        Eigen::Matrix<double,3,3> Rcw = Converter::toMatrix3d(pKFi->GetRotation());
-        Eigen::Matrix<double,3,1> tcw = Converter::toVector3d(pKFi->GetTranslation());
+        Eigen::Matrix<double,3,3> Rcw = Converter::toMatrix3d(pKFi->GetRotation_());
+        Eigen::Matrix<double,3,1> tcw = Converter::toVector3d(pKFi->GetTranslation_());
         g2o::SE3Quat Siw(Rcw,tcw);
         vScw[nIDi] = Siw;
         vCorrectedSwc[nIDi]=Siw.inverse();
@@ -2480,8 +2992,8 @@ void Optimizer::OptimizeEssentialGraph6DoF(KeyFrame* pCurKF, vector<KeyFrame*> &
 
         const int nIDi = pKFi->mnId;
 
-        Eigen::Matrix<double,3,3> Rcw = Converter::toMatrix3d(pKFi->GetRotation());
-        Eigen::Matrix<double,3,1> tcw = Converter::toVector3d(pKFi->GetTranslation());
+        Eigen::Matrix<double,3,3> Rcw = Converter::toMatrix3d(pKFi->GetRotation_());
+        Eigen::Matrix<double,3,1> tcw = Converter::toVector3d(pKFi->GetTranslation_());
         g2o::SE3Quat Siw(Rcw,tcw);
         vScw[nIDi] = Siw;
         vCorrectedSwc[nIDi]=Siw.inverse(); // This KFs mustn't be corrected
@@ -2518,8 +3030,8 @@ void Optimizer::OptimizeEssentialGraph6DoF(KeyFrame* pCurKF, vector<KeyFrame*> &
 
         g2o::VertexSE3Expmap* VSE3 = new g2o::VertexSE3Expmap();
 
-        Eigen::Matrix<double,3,3> Rcw = Converter::toMatrix3d(pKFi->GetRotation());
-        Eigen::Matrix<double,3,1> tcw = Converter::toVector3d(pKFi->GetTranslation()) / scale;
+        Eigen::Matrix<double,3,3> Rcw = Converter::toMatrix3d(pKFi->GetRotation_());
+        Eigen::Matrix<double,3,1> tcw = Converter::toVector3d(pKFi->GetTranslation_()) / scale;
         g2o::SE3Quat Siw(Rcw,tcw);
         vScw_bef[nIDi] = Siw;
         VSE3->setEstimate(Siw);
@@ -2673,7 +3185,7 @@ void Optimizer::OptimizeEssentialGraph6DoF(KeyFrame* pCurKF, vector<KeyFrame*> &
     optimizer.initializeOptimization();
     optimizer.optimize(20);
 
-    unique_lock<mutex> lock(pMap->mMutexMapUpdate);
+    unique_lock<MapUpdateMutex> lock(pMap->mMutexMapUpdate);
 
     // SE3 Pose Recovering. Sim3:[sR t;0 1] -> SE3:[R t/s;0 1]
     for(KeyFrame* pKFi : vpNonFixedKFs)
@@ -2741,12 +3253,15 @@ void Optimizer::OptimizeEssentialGraph6DoF(KeyFrame* pCurKF, vector<KeyFrame*> &
 }
 
 void Optimizer::OptimizeEssentialGraph(KeyFrame* pCurKF, vector<KeyFrame*> &vpFixedKFs, vector<KeyFrame*> &vpFixedCorrectedKFs,
-                                       vector<KeyFrame*> &vpNonFixedKFs, vector<MapPoint*> &vpNonCorrectedMPs)
+                                       vector<KeyFrame*> &vpNonFixedKFs, vector<MapPoint*> &vpNonCorrectedMPs,
+                                       LoopClosing::KeyFrameAndPose* pInitialSim3, LoopClosing::KeyFrameAndPose* pOptimizedSim3)
 {
+    ORB_TRACE_SCOPE("Optimizer::OptimizeEssentialGraph");
+    g2o::GraphArena arena;
     g2o::SparseOptimizer optimizer;
     optimizer.setVerbose(false);
     g2o::BlockSolver_7_3::LinearSolverType * linearSolver =
-           new g2o::LinearSolverEigen<g2o::BlockSolver_7_3::PoseMatrixType>();
+           NewSparseLinearSolver<g2o::BlockSolver_7_3>(pCurKF->GetMap()->GetOptimizerSettings());
     g2o::BlockSolver_7_3 * solver_ptr= new g2o::BlockSolver_7_3(linearSolver);
     g2o::OptimizationAlgorithmLevenberg* solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
 
@@ -2772,8 +3287,8 @@ void Optimizer::OptimizeEssentialGraph(KeyFrame* pCurKF, vector<KeyFrame*> &vpFi
 
         const int nIDi = pKFi->mnId;
 
-        Eigen::Matrix<double,3,3> Rcw = Converter::toMatrix3d(pKFi->GetRotation());
-        Eigen::Matrix<double,3,1> tcw = Converter::toVector3d(pKFi->GetTranslation());
+        Eigen::Matrix<double,3,3> Rcw = Converter::toMatrix3d(pKFi->GetRotation_());
+        Eigen::Matrix<double,3,1> tcw = Converter::toVector3d(pKFi->GetTranslation_());
         g2o::Sim3 Siw(Rcw,tcw,1.0);
         vScw[nIDi] = Siw;
         vCorrectedSwc[nIDi]=Siw.inverse(); // This KFs mustn't be corrected
@@ -2801,8 +3316,8 @@ void Optimizer::OptimizeEssentialGraph(KeyFrame* pCurKF, vector<KeyFrame*> &vpFi
 
         const int nIDi = pKFi->mnId;
 
-        Eigen::Matrix<double,3,3> Rcw = Converter::toMatrix3d(pKFi->GetRotation());
-        Eigen::Matrix<double,3,1> tcw = Converter::toVector3d(pKFi->GetTranslation());
+        Eigen::Matrix<double,3,3> Rcw = Converter::toMatrix3d(pKFi->GetRotation_());
+        Eigen::Matrix<double,3,1> tcw = Converter::toVector3d(pKFi->GetTranslation_());
         g2o::Sim3 Siw(Rcw,tcw,1.0);
         vCorrectedSwc[nIDi]=Siw.inverse(); // This KFs mustn't be corrected
         VSim3->setEstimate(Siw);
@@ -2837,8 +3352,8 @@ void Optimizer::OptimizeEssentialGraph(KeyFrame* pCurKF, vector<KeyFrame*> &vpFi
 
         g2o::VertexSim3Expmap* VSim3 = new g2o::VertexSim3Expmap();
 
-        Eigen::Matrix<double,3,3> Rcw = Converter::toMatrix3d(pKFi->GetRotation());
-        Eigen::Matrix<double,3,1> tcw = Converter::toVector3d(pKFi->GetTranslation());
+        Eigen::Matrix<double,3,3> Rcw = Converter::toMatrix3d(pKFi->GetRotation_());
+        Eigen::Matrix<double,3,1> tcw = Converter::toVector3d(pKFi->GetTranslation_());
         g2o::Sim3 Siw(Rcw,tcw,1.0);
         vScw[nIDi] = Siw;
         VSim3->setEstimate(Siw);
@@ -2946,8 +3461,23 @@ void Optimizer::OptimizeEssentialGraph(KeyFrame* pCurKF, vector<KeyFrame*> &vpFi
     optimizer.initializeOptimization();
     optimizer.optimize(20);
 
+    if(pOptimizedSim3)
+    {
+        // Only the keyframes that were free in the graph, the welded ones start from their pose before the merge
+        for(KeyFrame* pKFi : vpNonFixedKFs)
+        {
+            const int nIDi = pKFi->mnId;
+            if(pKFi->isBad() || !vpVertices[nIDi] || vpVertices[nIDi]->fixed())
+                continue;
+
+            (*pOptimizedSim3)[pKFi] = vpVertices[nIDi]->estimate();
+            if(pInitialSim3)
+                (*pInitialSim3)[pKFi] = vScw[nIDi];
+        }
+        return;
+    }
 
-    unique_lock<mutex> lock(pMap->mMutexMapUpdate);
+    unique_lock<MapUpdateMutex> lock(pMap->mMutexMapUpdate);
 
     // SE3 Pose Recovering. Sim3:[sR t;0 1] -> SE3:[R t/s;0 1]
     for(KeyFrame* pKFi : vpNonFixedKFs)
@@ -3019,20 +3549,24 @@ void Optimizer::OptimizeEssentialGraph(KeyFrame* pCurKF,
                                        const LoopClosing::KeyFrameAndPose &NonCorrectedSim3,
                                        const LoopClosing::KeyFrameAndPose &CorrectedSim3)
 {
+    ORB_TRACE_SCOPE("Optimizer::OptimizeEssentialGraph");
     // Setup optimizer
     Map* pMap = pCurKF->GetMap();
+    g2o::GraphArena arena;
     g2o::SparseOptimizer optimizer;
     optimizer.setVerbose(false);
     g2o::BlockSolver_7_3::LinearSolverType * linearSolver =
-           new g2o::LinearSolverEigen<g2o::BlockSolver_7_3::PoseMatrixType>();
+           NewSparseLinearSolver<g2o::BlockSolver_7_3>(pMap->GetOptimizerSettings());
     g2o::BlockSolver_7_3 * solver_ptr= new g2o::BlockSolver_7_3(linearSolver);
     g2o::OptimizationAlgorithmLevenberg* solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
 
     solver->setUserLambdaInit(1e-16);
     optimizer.setAlgorithm(solver);
 
-    const vector<KeyFrame*> vpKFs = pMap->GetAllKeyFrames();
-    const vector<MapPoint*> vpMPs = pMap->GetAllMapPoints();
+    const Map::KeyFramesSnapshot pKFs = pMap->GetKeyFramesSnapshot();
+    const vector<KeyFrame*> &vpKFs = *pKFs;
+    const Map::MapPointsSnapshot pMPs = pMap->GetMapPointsSnapshot();
+    const vector<MapPoint*> &vpMPs = *pMPs;
 
     const unsigned int nMaxKFid = pMap->GetMaxKFid();
 
@@ -3052,8 +3586,8 @@ void Optimizer::OptimizeEssentialGraph(KeyFrame* pCurKF,
 
         const int nIDi = pKF->mnId;
 
-        Eigen::Matrix<double,3,3> Rcw = Converter::toMatrix3d(pKF->GetRotation());
-        Eigen::Matrix<double,3,1> tcw = Converter::toVector3d(pKF->GetTranslation());
+        Eigen::Matrix<double,3,3> Rcw = Converter::toMatrix3d(pKF->GetRotation_());
+        Eigen::Matrix<double,3,1> tcw = Converter::toVector3d(pKF->GetTranslation_());
         g2o::Sim3 Siw(Rcw,tcw,1.0);
         vScw[nIDi] = Siw;
         VSim3->setEstimate(Siw);
@@ -3189,7 +3723,7 @@ void Optimizer::OptimizeEssentialGraph(KeyFrame* pCurKF,
     optimizer.setVerbose(false);
     optimizer.optimize(20);
 
-    unique_lock<mutex> lock(pMap->mMutexMapUpdate);
+    unique_lock<MapUpdateMutex> lock(pMap->mMutexMapUpdate);
 
     // SE3 Pose Recovering. Sim3:[sR t;0 1] -> SE3:[R t/s;0 1]
     for(size_t i=0;i<vpKFs.size();i++)
@@ -3250,6 +3784,8 @@ void Optimizer::OptimizeEssentialGraph(KeyFrame* pCurKF,
 
 int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &vpMatches1, g2o::Sim3 &g2oS12, const float th2, const bool bFixScale)
 {
+    ORB_TRACE_SCOPE("Optimizer::OptimizeSim3");
+    g2o::GraphArena arena;
     g2o::SparseOptimizer optimizer;
     g2o::BlockSolverX::LinearSolverType * linearSolver;
 
@@ -3449,15 +3985,13 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
 int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &vpMatches1, g2o::Sim3 &g2oS12, const float th2,
                             const bool bFixScale, Eigen::Matrix<double,7,7> &mAcumHessian, const bool bAllPoints)
 {
-    g2o::SparseOptimizer optimizer;
-    g2o::BlockSolverX::LinearSolverType * linearSolver;
-
-    linearSolver = new g2o::LinearSolverDense<g2o::BlockSolverX::PoseMatrixType>();
-
-    g2o::BlockSolverX * solver_ptr = new g2o::BlockSolverX(linearSolver);
+    ORB_TRACE_SCOPE("Optimizer::OptimizeSim3");
+    // Sim3-only problem solved without a g2o graph (the points are fixed). The solver keeps its
+    // buffers between calls, one per thread (loop and merge verification may run it concurrently).
+    static thread_local Sim3Refiner solver;
 
-    g2o::OptimizationAlgorithmLevenberg* solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
-    optimizer.setAlgorithm(solver);
+    const float deltaHuber = sqrt(th2);
+    solver.Reset(pKF1->mpCamera, pKF2->mpCamera, bFixScale, deltaHuber);
 
     // Camera poses
     const cv::Mat R1w = pKF1->GetRotation();
@@ -3465,38 +3999,13 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
     const cv::Mat R2w = pKF2->GetRotation();
     const cv::Mat t2w = pKF2->GetTranslation();
 
-    // Set Sim3 vertex
-    ORB_SLAM3::VertexSim3Expmap * vSim3 = new ORB_SLAM3::VertexSim3Expmap();
-    vSim3->_fix_scale=bFixScale;
-    vSim3->setEstimate(g2oS12);
-    vSim3->setId(0);
-    vSim3->setFixed(false);
-    vSim3->pCamera1 = pKF1->mpCamera;
-    vSim3->pCamera2 = pKF2->mpCamera;
-    optimizer.addVertex(vSim3);
-
-    // Set MapPoint vertices
+    // Correspondences with a point in both keyframes
     const int N = vpMatches1.size();
     const vector<MapPoint*> vpMapPoints1 = pKF1->GetMapPointMatches();
-    vector<ORB_SLAM3::EdgeSim3ProjectXYZ*> vpEdges12;
-    vector<ORB_SLAM3::EdgeInverseSim3ProjectXYZ*> vpEdges21;
     vector<size_t> vnIndexEdge;
-    vector<bool> vbIsInKF2;
-
-    vnIndexEdge.reserve(2*N);
-    vpEdges12.reserve(2*N);
-    vpEdges21.reserve(2*N);
-    vbIsInKF2.reserve(2*N);
-
-    const float deltaHuber = sqrt(th2);
+    vnIndexEdge.reserve(N);
 
     int nCorrespondences = 0;
-    int nBadMPs = 0;
-    int nInKF2 = 0;
-    int nOutKF2 = 0;
-    int nMatchWithoutMP = 0;
-
-    vector<int> vIdsOnlyInKF2;
 
     for(int i=0; i<N; i++)
     {
@@ -3506,66 +4015,21 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
         MapPoint* pMP1 = vpMapPoints1[i];
         MapPoint* pMP2 = vpMatches1[i];
 
-        const int id1 = 2*i+1;
-        const int id2 = 2*(i+1);
+        //The 3D position in KF1 doesn't exist
+        if(!pMP1 || pMP1->isBad() || pMP2->isBad())
+            continue;
 
         const int i2 = get<0>(pMP2->GetIndexInKeyFrame(pKF2));
 
-        cv::Mat P3D1c;
-        cv::Mat P3D2c;
-
-        if(pMP1 && pMP2)
-        {
-            if(!pMP1->isBad() && !pMP2->isBad())
-            {
-                g2o::VertexSBAPointXYZ* vPoint1 = new g2o::VertexSBAPointXYZ();
-                cv::Mat P3D1w = pMP1->GetWorldPos();
-                P3D1c = R1w*P3D1w + t1w;
-                vPoint1->setEstimate(Converter::toVector3d(P3D1c));
-                vPoint1->setId(id1);
-                vPoint1->setFixed(true);
-                optimizer.addVertex(vPoint1);
-
-                g2o::VertexSBAPointXYZ* vPoint2 = new g2o::VertexSBAPointXYZ();
-                cv::Mat P3D2w = pMP2->GetWorldPos();
-                P3D2c = R2w*P3D2w + t2w;
-                vPoint2->setEstimate(Converter::toVector3d(P3D2c));
-                vPoint2->setId(id2);
-                vPoint2->setFixed(true);
-                optimizer.addVertex(vPoint2);
-            }
-            else
-            {
-                nBadMPs++;
-                continue;
-            }
-        }
-        else
-        {
-            nMatchWithoutMP++;
-
-            //The 3D position in KF1 doesn't exist
-            if(!pMP2->isBad())
-            {
-                g2o::VertexSBAPointXYZ* vPoint2 = new g2o::VertexSBAPointXYZ();
-                cv::Mat P3D2w = pMP2->GetWorldPos();
-                P3D2c = R2w*P3D2w + t2w;
-                vPoint2->setEstimate(Converter::toVector3d(P3D2c));
-                vPoint2->setId(id2);
-                vPoint2->setFixed(true);
-                optimizer.addVertex(vPoint2);
-
-                vIdsOnlyInKF2.push_back(id2);
-            }
-            continue;
-        }
-
         if(i2<0 && !bAllPoints)
         {
             Verbose::PrintMess("    Remove point -> i2: " + to_string(i2) + "; bAllPoints: " + to_string(bAllPoints), Verbose::VERBOSITY_DEBUG);
             continue;
         }
 
+        const cv::Mat P3D1c = R1w*pMP1->GetWorldPos() + t1w;
+        const cv::Mat P3D2c = R2w*pMP2->GetWorldPos() + t2w;
+
         if(P3D2c.at<float>(2) < 0)
         {
             Verbose::PrintMess("Sim3: Z coordinate is negative", Verbose::VERBOSITY_DEBUG);
@@ -3574,35 +4038,19 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
 
         nCorrespondences++;
 
-        // Set edge x1 = S12*X2
-        Eigen::Matrix<double,2,1> obs1;
+        // x1 = S12*X2
         const cv::KeyPoint &kpUn1 = pKF1->mvKeysUn[i];
-        obs1 << kpUn1.pt.x, kpUn1.pt.y;
-
-        ORB_SLAM3::EdgeSim3ProjectXYZ* e12 = new ORB_SLAM3::EdgeSim3ProjectXYZ();
-
-        e12->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(id2)));
-        e12->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(0)));
-        e12->setMeasurement(obs1);
-        const float &invSigmaSquare1 = pKF1->mvInvLevelSigma2[kpUn1.octave];
-        e12->setInformation(Eigen::Matrix2d::Identity()*invSigmaSquare1);
-
-        g2o::RobustKernelHuber* rk1 = new g2o::RobustKernelHuber;
-        e12->setRobustKernel(rk1);
-        rk1->setDelta(deltaHuber);
-        optimizer.addEdge(e12);
+        const Eigen::Vector2d obs1(kpUn1.pt.x, kpUn1.pt.y);
+        const float invSigmaSquare1 = pKF1->mvInvLevelSigma2[kpUn1.octave];
 
-        // Set edge x2 = S21*X1
-        Eigen::Matrix<double,2,1> obs2;
-        cv::KeyPoint kpUn2;
-        bool inKF2;
+        // x2 = S21*X1
+        Eigen::Vector2d obs2;
+        int octave2;
         if(i2 >= 0)
         {
-            kpUn2 = pKF2->mvKeysUn[i2];
+            const cv::KeyPoint &kpUn2 = pKF2->mvKeysUn[i2];
             obs2 << kpUn2.pt.x, kpUn2.pt.y;
-            inKF2 = true;
-
-            nInKF2++;
+            octave2 = kpUn2.octave;
         }
         else
         {
@@ -3611,68 +4059,38 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
             float y = P3D2c.at<float>(1)*invz;
 
             obs2 << x, y;
-            kpUn2 = cv::KeyPoint(cv::Point2f(x, y), pMP2->mnTrackScaleLevel);
-
-            inKF2 = false;
-            nOutKF2++;
+            octave2 = pMP2->mnTrackScaleLevel;
         }
+        const float invSigmaSquare2 = pKF2->mvInvLevelSigma2[octave2];
 
-        ORB_SLAM3::EdgeInverseSim3ProjectXYZ* e21 = new ORB_SLAM3::EdgeInverseSim3ProjectXYZ();
-
-        e21->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(id1)));
-        e21->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(0)));
-        e21->setMeasurement(obs2);
-        float invSigmaSquare2 = pKF2->mvInvLevelSigma2[kpUn2.octave];
-        e21->setInformation(Eigen::Matrix2d::Identity()*invSigmaSquare2);
-
-        g2o::RobustKernelHuber* rk2 = new g2o::RobustKernelHuber;
-        e21->setRobustKernel(rk2);
-        rk2->setDelta(deltaHuber);
-        optimizer.addEdge(e21);
-
-        vpEdges12.push_back(e12);
-        vpEdges21.push_back(e21);
+        solver.AddCorrespondence(Converter::toVector3d(P3D1c), Converter::toVector3d(P3D2c),
+                                 obs1, invSigmaSquare1, obs2, invSigmaSquare2);
         vnIndexEdge.push_back(i);
-
-        vbIsInKF2.push_back(inKF2);
     }
 
+    Eigen::Matrix3d R12 = g2oS12.rotation().toRotationMatrix();
+    Eigen::Vector3d t12 = g2oS12.translation();
+    double s12 = g2oS12.scale();
+
     // Optimize!
-    optimizer.initializeOptimization();
-    optimizer.optimize(5);
+    solver.Optimize(R12, t12, s12, 5);
 
     // Check inliers
     int nBad=0;
-    int nBadOutKF2 = 0;
-    for(size_t i=0; i<vpEdges12.size();i++)
+    for(size_t i=0; i<vnIndexEdge.size();i++)
     {
-        ORB_SLAM3::EdgeSim3ProjectXYZ* e12 = vpEdges12[i];
-        ORB_SLAM3::EdgeInverseSim3ProjectXYZ* e21 = vpEdges21[i];
-        if(!e12 || !e21)
-            continue;
-
-        if(e12->chi2()>th2 || e21->chi2()>th2)
+        if(solver.Chi2Image1(i)>th2 || solver.Chi2Image2(i)>th2)
         {
             size_t idx = vnIndexEdge[i];
             vpMatches1[idx]=static_cast<MapPoint*>(NULL);
-            optimizer.removeEdge(e12);
-            optimizer.removeEdge(e21);
-            vpEdges12[i]=static_cast<ORB_SLAM3::EdgeSim3ProjectXYZ*>(NULL);
-            vpEdges21[i]=static_cast<ORB_SLAM3::EdgeInverseSim3ProjectXYZ*>(NULL);
+            solver.SetActive(i, false);
             nBad++;
-
-            if(!vbIsInKF2[i])
-            {
-                nBadOutKF2++;
-            }
-            continue;
         }
-
-        //Check if remove the robust adjustment improve the result
-        e12->setRobustKernel(0);
-        e21->setRobustKernel(0);
     }
 
+    //Check if remove the robust adjustment improve the result
+    solver.SetRobust(false);
+
     int nMoreIterations;
     if(nBad>0)
         nMoreIterations=10;
@@ -3683,23 +4101,16 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
         return 0;
 
     // Optimize again only with inliers
-
-    optimizer.initializeOptimization();
-    optimizer.optimize(nMoreIterations);
+    solver.Optimize(R12, t12, s12, nMoreIterations);
 
     int nIn = 0;
     mAcumHessian = Eigen::MatrixXd::Zero(7, 7);
-    for(size_t i=0; i<vpEdges12.size();i++)
+    for(size_t i=0; i<vnIndexEdge.size();i++)
     {
-        ORB_SLAM3::EdgeSim3ProjectXYZ* e12 = vpEdges12[i];
-        ORB_SLAM3::EdgeInverseSim3ProjectXYZ* e21 = vpEdges21[i];
-        if(!e12 || !e21)
+        if(!solver.IsActive(i))
             continue;
 
-        e12->computeError();
-        e21->computeError();
-
-        if(e12->chi2()>th2 || e21->chi2()>th2)
+        if(solver.Chi2Image1(i)>th2 || solver.Chi2Image2(i)>th2)
         {
             size_t idx = vnIndexEdge[i];
             vpMatches1[idx]=static_cast<MapPoint*>(NULL);
@@ -3711,8 +4122,7 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
     }
 
     // Recover optimized Sim3
-    g2o::VertexSim3Expmap* vSim3_recov = static_cast<g2o::VertexSim3Expmap*>(optimizer.vertex(0));
-    g2oS12= vSim3_recov->estimate();
+    g2oS12 = g2o::Sim3(R12, t12, s12);
 
     return nIn;
 }
@@ -3720,6 +4130,8 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
 int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &vpMatches1, vector<KeyFrame*> &vpMatches1KF, g2o::Sim3 &g2oS12, const float th2,
                             const bool bFixScale, Eigen::Matrix<double,7,7> &mAcumHessian, const bool bAllPoints)
 {
+    ORB_TRACE_SCOPE("Optimizer::OptimizeSim3");
+    g2o::GraphArena arena;
     g2o::SparseOptimizer optimizer;
     g2o::BlockSolverX::LinearSolverType * linearSolver;
 
@@ -3956,8 +4368,9 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
 }
 
 
-void Optimizer::LocalInertialBA(KeyFrame *pKF, bool *pbStopFlag, Map *pMap, int& num_fixedKF, int& num_OptKF, int& num_MPs, int& num_edges, bool bLarge, bool bRecInit)
+void Optimizer::LocalInertialBA(KeyFrame *pKF, bool *pbStopFlag, Map *pMap, int& num_fixedKF, int& num_OptKF, int& num_MPs, int& num_edges, bool bLarge, bool bRecInit, float thRelin, int nSmootherWindow)
 {
+    ORB_TRACE_SCOPE("Optimizer::LocalInertialBA");
     Map* pCurrentMap = pKF->GetMap();
 
     int maxOpt=10;
@@ -3967,6 +4380,11 @@ void Optimizer::LocalInertialBA(KeyFrame *pKF, bool *pbStopFlag, Map *pMap, int&
         maxOpt=25;
         opt_it=4;
     }
+    // Fixed-lag smoother: the information of the keyframes that left the window is kept as a prior
+    // on the keyframe just before it, so a shorter window is enough
+    const bool bSmoother = nSmootherWindow>0 && !bRecInit;
+    if(bSmoother)
+        maxOpt = std::min(maxOpt,nSmootherWindow);
     const int Nd = std::min((int)pCurrentMap->KeyFramesInMap()-2,maxOpt);
     const unsigned long maxKFid = pKF->mnId;
 
@@ -4023,6 +4441,16 @@ void Optimizer::LocalInertialBA(KeyFrame *pKF, bool *pbStopFlag, Map *pMap, int&
         vpOptimizableKFs.pop_back();
     }
 
+    // With a valid prior the keyframe before the window is optimized under it instead of being fixed
+    KeyFrame* pKFb = static_cast<KeyFrame*>(NULL);
+    std::shared_ptr<ConstraintPoseImu> pPriorB;
+    if(bSmoother && !vpOptimizableKFs.empty() && vpOptimizableKFs.back()->mPrevKF)
+    {
+        pKFb = vpOptimizableKFs.back()->mPrevKF;
+        if(pKFb->bImu && !pKFb->isBad())
+            pPriorB = pKFb->GetInertialPrior();
+    }
+
     // Optimizable visual KFs
     const int maxCovKF = 0;
     for(int i=0, iend=vpNeighsKFs.size(); i<iend; i++)
@@ -4058,8 +4486,8 @@ void Optimizer::LocalInertialBA(KeyFrame *pKF, bool *pbStopFlag, Map *pMap, int&
 
     for(list<MapPoint*>::iterator lit=lLocalMapPoints.begin(), lend=lLocalMapPoints.end(); lit!=lend; lit++)
     {
-        map<KeyFrame*,tuple<int,int>> observations = (*lit)->GetObservations();
-        for(map<KeyFrame*,tuple<int,int>>::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+        ObservationMap observations = (*lit)->GetObservations();
+        for(ObservationMap::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
         {
             KeyFrame* pKFi = mit->first;
 
@@ -4080,6 +4508,7 @@ void Optimizer::LocalInertialBA(KeyFrame *pKF, bool *pbStopFlag, Map *pMap, int&
     bool bNonFixed = (lFixedKeyFrames.size() == 0);
 
     // Setup optimizer
+    g2o::GraphArena arena;
     g2o::SparseOptimizer optimizer;
     g2o::BlockSolverX::LinearSolverType * linearSolver;
     linearSolver = new g2o::LinearSolverEigen<g2o::BlockSolverX::PoseMatrixType>();
@@ -4101,7 +4530,14 @@ void Optimizer::LocalInertialBA(KeyFrame *pKF, bool *pbStopFlag, Map *pMap, int&
 
 
     // Set Local temporal KeyFrame vertices
+    // With a relinearization threshold, older keyframes of the window whose last update (and that of
+    // their newer neighbour) stayed below it are considered converged and kept at their estimate, so only
+    // the part of the window that is still moving is solved (fluid relinearization in the iSAM2 sense).
+    // The change propagates one keyframe per call towards the back of the window.
+    const int nAlwaysFree = 3;
+    const bool bIncremental = thRelin>0 && !bRecInit;
     N=vpOptimizableKFs.size();
+    vector<bool> vbFrozen(N,false);
     num_fixedKF = 0;
     num_OptKF = 0;
     num_MPs = 0;
@@ -4110,27 +4546,38 @@ void Optimizer::LocalInertialBA(KeyFrame *pKF, bool *pbStopFlag, Map *pMap, int&
     {
         KeyFrame* pKFi = vpOptimizableKFs[i];
 
+        if(bIncremental && i>=nAlwaysFree)
+        {
+            const float upd = pKFi->mfInertialBAUpdate;
+            const float updNewer = vpOptimizableKFs[i-1]->mfInertialBAUpdate;
+            vbFrozen[i] = upd>=0 && upd<thRelin && updNewer>=0 && updNewer<thRelin;
+        }
+        const bool bFixed = vbFrozen[i];
+
         VertexPose * VP = new VertexPose(pKFi);
         VP->setId(pKFi->mnId);
-        VP->setFixed(false);
+        VP->setFixed(bFixed);
         optimizer.addVertex(VP);
 
         if(pKFi->bImu)
         {
             VertexVelocity* VV = new VertexVelocity(pKFi);
             VV->setId(maxKFid+3*(pKFi->mnId)+1);
-            VV->setFixed(false);
+            VV->setFixed(bFixed);
             optimizer.addVertex(VV);
             VertexGyroBias* VG = new VertexGyroBias(pKFi);
             VG->setId(maxKFid+3*(pKFi->mnId)+2);
-            VG->setFixed(false);
+            VG->setFixed(bFixed);
             optimizer.addVertex(VG);
             VertexAccBias* VA = new VertexAccBias(pKFi);
             VA->setId(maxKFid+3*(pKFi->mnId)+3);
-            VA->setFixed(false);
+            VA->setFixed(bFixed);
             optimizer.addVertex(VA);
         }
-        num_OptKF++;
+        if(bFixed)
+            num_fixedKF++;
+        else
+            num_OptKF++;
     }
 
     // Set Local visual KeyFrame vertices
@@ -4149,27 +4596,44 @@ void Optimizer::LocalInertialBA(KeyFrame *pKF, bool *pbStopFlag, Map *pMap, int&
     for(list<KeyFrame*>::iterator lit=lFixedKeyFrames.begin(), lend=lFixedKeyFrames.end(); lit!=lend; lit++)
     {
         KeyFrame* pKFi = *lit;
+        const bool bFixed = !(pPriorB && pKFi==pKFb);
         VertexPose * VP = new VertexPose(pKFi);
         VP->setId(pKFi->mnId);
-        VP->setFixed(true);
+        VP->setFixed(bFixed);
         optimizer.addVertex(VP);
 
         if(pKFi->bImu) // This should be done only for keyframe just before temporal window
         {
             VertexVelocity* VV = new VertexVelocity(pKFi);
             VV->setId(maxKFid+3*(pKFi->mnId)+1);
-            VV->setFixed(true);
+            VV->setFixed(bFixed);
             optimizer.addVertex(VV);
             VertexGyroBias* VG = new VertexGyroBias(pKFi);
             VG->setId(maxKFid+3*(pKFi->mnId)+2);
-            VG->setFixed(true);
+            VG->setFixed(bFixed);
             optimizer.addVertex(VG);
             VertexAccBias* VA = new VertexAccBias(pKFi);
             VA->setId(maxKFid+3*(pKFi->mnId)+3);
-            VA->setFixed(true);
+            VA->setFixed(bFixed);
             optimizer.addVertex(VA);
         }
-        num_fixedKF++;
+        if(bFixed)
+            num_fixedKF++;
+        else
+            num_OptKF++;
+    }
+
+    // Prior of the marginalized keyframes
+    EdgePriorPoseImu* epb = static_cast<EdgePriorPoseImu*>(NULL);
+    if(pPriorB)
+    {
+        epb = new EdgePriorPoseImu(pPriorB.get());
+        epb->setVertex(0,optimizer.vertex(pKFb->mnId));
+        epb->setVertex(1,optimizer.vertex(maxKFid+3*(pKFb->mnId)+1));
+        epb->setVertex(2,optimizer.vertex(maxKFid+3*(pKFb->mnId)+2));
+        epb->setVertex(3,optimizer.vertex(maxKFid+3*(pKFb->mnId)+3));
+        optimizer.addEdge(epb);
+        num_edges++;
     }
 
     // Create intertial constraints
@@ -4213,12 +4677,12 @@ void Optimizer::LocalInertialBA(KeyFrame *pKF, bool *pbStopFlag, Map *pMap, int&
             vei[i]->setVertex(4,dynamic_cast<g2o::OptimizableGraph::Vertex*>(VP2));
             vei[i]->setVertex(5,dynamic_cast<g2o::OptimizableGraph::Vertex*>(VV2));
 
-            if(i==N-1 || bRecInit)
+            if((i==N-1 && !pPriorB) || bRecInit)
             {
                 // All inertial residuals are included without robust cost function, but not that one linking the
                 // last optimizable keyframe inside of the local window and the first fixed keyframe out. The
                 // information matrix for this measurement is also downweighted. This is done to avoid accumulating
-                // error due to fixing variables.
+                // error due to fixing variables. Not needed when that keyframe is free under its prior.
                 g2o::RobustKernelHuber* rki = new g2o::RobustKernelHuber;
                 vei[i]->setRobustKernel(rki);
                 if(i==N-1)
@@ -4230,12 +4694,12 @@ void Optimizer::LocalInertialBA(KeyFrame *pKF, bool *pbStopFlag, Map *pMap, int&
             vegr[i] = new EdgeGyroRW();
             vegr[i]->setVertex(0,VG1);
             vegr[i]->setVertex(1,VG2);
-            cv::Mat cvInfoG = pKFi->mpImuPreintegrated->C.rowRange(9,12).colRange(9,12).inv(cv::DECOMP_SVD);
+            const cv::Matx33f cvInfoG = pKFi->mpImuPreintegrated->C.get_minor<3,3>(9,9).inv(cv::DECOMP_SVD);
             Eigen::Matrix3d InfoG;
 
             for(int r=0;r<3;r++)
                 for(int c=0;c<3;c++)
-                    InfoG(r,c)=cvInfoG.at<float>(r,c);
+                    InfoG(r,c)=cvInfoG(r,c);
             vegr[i]->setInformation(InfoG);
             optimizer.addEdge(vegr[i]);
             num_edges++;
@@ -4243,11 +4707,11 @@ void Optimizer::LocalInertialBA(KeyFrame *pKF, bool *pbStopFlag, Map *pMap, int&
             vear[i] = new EdgeAccRW();
             vear[i]->setVertex(0,VA1);
             vear[i]->setVertex(1,VA2);
-            cv::Mat cvInfoA = pKFi->mpImuPreintegrated->C.rowRange(12,15).colRange(12,15).inv(cv::DECOMP_SVD);
+            const cv::Matx33f cvInfoA = pKFi->mpImuPreintegrated->C.get_minor<3,3>(12,12).inv(cv::DECOMP_SVD);
             Eigen::Matrix3d InfoA;
             for(int r=0;r<3;r++)
                 for(int c=0;c<3;c++)
-                    InfoA(r,c)=cvInfoA.at<float>(r,c);
+                    InfoA(r,c)=cvInfoA(r,c);
             vear[i]->setInformation(InfoA);           
 
             optimizer.addEdge(vear[i]);
@@ -4305,16 +4769,16 @@ void Optimizer::LocalInertialBA(KeyFrame *pKF, bool *pbStopFlag, Map *pMap, int&
     {
         MapPoint* pMP = *lit;
         g2o::VertexSBAPointXYZ* vPoint = new g2o::VertexSBAPointXYZ();
-        vPoint->setEstimate(Converter::toVector3d(pMP->GetWorldPos()));
+        vPoint->setEstimate(Converter::toVector3d(pMP->GetWorldPos2()));
 
         unsigned long id = pMP->mnId+iniMPid+1;
         vPoint->setId(id);
         vPoint->setMarginalized(true);
         optimizer.addVertex(vPoint);
-        const map<KeyFrame*,tuple<int,int>> observations = pMP->GetObservations();
+        const ObservationMap observations = pMP->GetObservations();
 
         // Create visual constraints
-        for(map<KeyFrame*,tuple<int,int>>::const_iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+        for(ObservationMap::const_iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
         {
             KeyFrame* pKFi = mit->first;
 
@@ -4336,7 +4800,7 @@ void Optimizer::LocalInertialBA(KeyFrame *pKF, bool *pbStopFlag, Map *pMap, int&
                     Eigen::Matrix<double,2,1> obs;
                     obs << kpUn.pt.x, kpUn.pt.y;
 
-                    EdgeMono* e = new EdgeMono(0);
+                    EdgeMono* e = NewEdgeMono(pKFi->mpCamera,0);
 
                     e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(id)));
                     e->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(pKFi->mnId)));
@@ -4369,7 +4833,7 @@ void Optimizer::LocalInertialBA(KeyFrame *pKF, bool *pbStopFlag, Map *pMap, int&
                     Eigen::Matrix<double,3,1> obs;
                     obs << kpUn.pt.x, kpUn.pt.y, kp_ur;
 
-                    EdgeStereo* e = new EdgeStereo(0);
+                    EdgeStereo* e = NewEdgeStereo(pKFi->mpCamera,0);
 
                     e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(id)));
                     e->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(pKFi->mnId)));
@@ -4405,7 +4869,7 @@ void Optimizer::LocalInertialBA(KeyFrame *pKF, bool *pbStopFlag, Map *pMap, int&
                         cv::KeyPoint kp = pKFi->mvKeysRight[rightIndex];
                         obs << kp.pt.x, kp.pt.y;
 
-                        EdgeMono* e = new EdgeMono(1);
+                        EdgeMono* e = NewEdgeMono(pKFi->mpCamera2,1);
 
                         e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(id)));
                         e->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(pKFi->mnId)));
@@ -4488,7 +4952,7 @@ void Optimizer::LocalInertialBA(KeyFrame *pKF, bool *pbStopFlag, Map *pMap, int&
     }
 
     // Get Map Mutex and erase outliers
-    unique_lock<mutex> lock(pMap->mMutexMapUpdate);
+    unique_lock<MapUpdateMutex> lock(pMap->mMutexMapUpdate);
 
     if((2*err < err_end || isnan(err) || isnan(err_end)) && !bLarge)
     {
@@ -4525,11 +4989,15 @@ void Optimizer::LocalInertialBA(KeyFrame *pKF, bool *pbStopFlag, Map *pMap, int&
     for(int i=0; i<N; i++)
     {
         KeyFrame* pKFi = vpOptimizableKFs[i];
+        pKFi->mnBALocalForKF=0;
+        if(vbFrozen[i])
+            continue;
 
+        const cv::Mat Ow = pKFi->GetCameraCenter();
         VertexPose* VP = static_cast<VertexPose*>(optimizer.vertex(pKFi->mnId));
         cv::Mat Tcw = Converter::toCvSE3(VP->estimate().Rcw[0], VP->estimate().tcw[0]);
         pKFi->SetPose(Tcw);
-        pKFi->mnBALocalForKF=0;
+        pKFi->mfInertialBAUpdate = cv::norm(pKFi->GetCameraCenter()-Ow);
 
         if(pKFi->bImu)
         {
@@ -4554,12 +5022,69 @@ void Optimizer::LocalInertialBA(KeyFrame *pKF, bool *pbStopFlag, Map *pMap, int&
         pKFi->mnBALocalForKF=0;
     }
 
+    // Smoother: marginalize the keyframe before the window (and its prior) into a prior on the oldest
+    // keyframe of the window, which is the one before the window in the next call. The visual edges of
+    // the marginalized keyframe are not folded in: it stays in the map and enters later windows as a
+    // fixed keyframe, so its observations would be counted twice
+    if(pKFb && vei[N-1])
+    {
+        if(pPriorB)
+        {
+            VertexPose* VP = static_cast<VertexPose*>(optimizer.vertex(pKFb->mnId));
+            VertexVelocity* VV = static_cast<VertexVelocity*>(optimizer.vertex(maxKFid+3*(pKFb->mnId)+1));
+            VertexGyroBias* VG = static_cast<VertexGyroBias*>(optimizer.vertex(maxKFid+3*(pKFb->mnId)+2));
+            VertexAccBias* VA = static_cast<VertexAccBias*>(optimizer.vertex(maxKFid+3*(pKFb->mnId)+3));
+            pKFb->SetPose(Converter::toCvSE3(VP->estimate().Rcw[0], VP->estimate().tcw[0]));
+            pKFb->SetVelocity(Converter::toCvMat(VV->estimate()));
+            Vector6d b;
+            b << VG->estimate(), VA->estimate();
+            pKFb->SetNewBias(IMU::Bias(b[3],b[4],b[5],b[0],b[1],b[2]));
+        }
+
+        // State: [pose vel bg ba] of the keyframe before the window (0:14) and of the oldest one in it (15:29)
+        Eigen::Matrix<double,30,30> H;
+        H.setZero();
+
+        H.block<24,24>(0,0) += vei[N-1]->GetHessian();
+
+        Eigen::Matrix<double,6,6> Hgr = vegr[N-1]->GetHessian();
+        H.block<3,3>(9,9) += Hgr.block<3,3>(0,0);
+        H.block<3,3>(9,24) += Hgr.block<3,3>(0,3);
+        H.block<3,3>(24,9) += Hgr.block<3,3>(3,0);
+        H.block<3,3>(24,24) += Hgr.block<3,3>(3,3);
+
+        Eigen::Matrix<double,6,6> Har = vear[N-1]->GetHessian();
+        H.block<3,3>(12,12) += Har.block<3,3>(0,0);
+        H.block<3,3>(12,27) += Har.block<3,3>(0,3);
+        H.block<3,3>(27,12) += Har.block<3,3>(3,0);
+        H.block<3,3>(27,27) += Har.block<3,3>(3,3);
+
+        // Without a prior the keyframe before the window was fixed: condition on it instead
+        Eigen::Matrix<double,15,15> Hm;
+        if(pPriorB)
+        {
+            H.block<15,15>(0,0) += epb->GetHessian();
+            Hm = MarginalizePreviousFrame(H);
+        }
+        else
+            Hm = H.block<15,15>(15,15);
+
+        KeyFrame* pKFo = vpOptimizableKFs[N-1];
+        VertexPose* VP = static_cast<VertexPose*>(optimizer.vertex(pKFo->mnId));
+        VertexVelocity* VV = static_cast<VertexVelocity*>(optimizer.vertex(maxKFid+3*(pKFo->mnId)+1));
+        VertexGyroBias* VG = static_cast<VertexGyroBias*>(optimizer.vertex(maxKFid+3*(pKFo->mnId)+2));
+        VertexAccBias* VA = static_cast<VertexAccBias*>(optimizer.vertex(maxKFid+3*(pKFo->mnId)+3));
+        pKFo->SetInertialPrior(std::shared_ptr<ConstraintPoseImu>(new ConstraintPoseImu(VP->estimate().Rwb,VP->estimate().twb,
+                                                                                        VV->estimate(),VG->estimate(),VA->estimate(),Hm)));
+        pKFb->ResetInertialPrior();
+    }
+
     //Points
     for(list<MapPoint*>::iterator lit=lLocalMapPoints.begin(), lend=lLocalMapPoints.end(); lit!=lend; lit++)
     {
         MapPoint* pMP = *lit;
         g2o::VertexSBAPointXYZ* vPoint = static_cast<g2o::VertexSBAPointXYZ*>(optimizer.vertex(pMP->mnId+iniMPid+1));
-        pMP->SetWorldPos(Converter::toCvMat(vPoint->estimate()));
+        pMP->SetWorldPos2(Converter::toMatx31f(vPoint->estimate()));
         pMP->UpdateNormalAndDepth();
     }
 
@@ -4567,6 +5092,23 @@ void Optimizer::LocalInertialBA(KeyFrame *pKF, bool *pbStopFlag, Map *pMap, int&
 
 }
 
+// Pseudo-inverse of the symmetric block to marginalize. The singular values of a symmetric
+// matrix are the absolute values of its eigenvalues, so this is the same as the SVD based
+// pseudo-inverse (threshold 1e-6) through the cheaper self-adjoint eigensolver.
+template<class MatrixType>
+static MatrixType PseudoInverseSym(const MatrixType &Hb)
+{
+    Eigen::SelfAdjointEigenSolver<MatrixType> es(Hb);
+    typename Eigen::SelfAdjointEigenSolver<MatrixType>::RealVectorType eigenvalues_inv = es.eigenvalues();
+    for (int i=0; i<eigenvalues_inv.size(); ++i)
+    {
+        if (fabs(eigenvalues_inv(i))>1e-6)
+            eigenvalues_inv(i)=1.0/eigenvalues_inv(i);
+        else eigenvalues_inv(i)=0;
+    }
+    return es.eigenvectors()*eigenvalues_inv.asDiagonal()*es.eigenvectors().transpose();
+}
+
 Eigen::MatrixXd Optimizer::Marginalize(const Eigen::MatrixXd &H, const int &start, const int &end)
 {
     // Goal
@@ -4581,74 +5123,53 @@ Eigen::MatrixXd Optimizer::Marginalize(const Eigen::MatrixXd &H, const int &star
     // Size of block after block to marginalize
     const int c = H.cols() - (end+1);
 
-    // Reorder as follows:
-    // a  | ab | ac       a  | ac | ab
-    // ba | b  | bc  -->  ca | c  | cb
-    // ca | cb | c        ba | bc | b
+    // Schur complement computed in place on the blocks a and c, without reordering H:
+    // [a* ac*; ca* c*] = [a ac; ca c] - [ab; cb]*inv(b)*[ba bc]
+    const Eigen::MatrixXd invHb = PseudoInverseSym<Eigen::MatrixXd>(H.block(a,a,b,b));
 
-    Eigen::MatrixXd Hn = Eigen::MatrixXd::Zero(H.rows(),H.cols());
+    // inv(b)*[ba bc]
+    Eigen::MatrixXd invHbBa, invHbBc;
     if(a>0)
-    {
-        Hn.block(0,0,a,a) = H.block(0,0,a,a);
-        Hn.block(0,a+c,a,b) = H.block(0,a,a,b);
-        Hn.block(a+c,0,b,a) = H.block(a,0,b,a);
-    }
-    if(a>0 && c>0)
-    {
-        Hn.block(0,a,a,c) = H.block(0,a+b,a,c);
-        Hn.block(a,0,c,a) = H.block(a+b,0,c,a);
-    }
+        invHbBa = invHb*H.block(a,0,b,a);
     if(c>0)
-    {
-        Hn.block(a,a,c,c) = H.block(a+b,a+b,c,c);
-        Hn.block(a,a+c,c,b) = H.block(a+b,a,c,b);
-        Hn.block(a+c,a,b,c) = H.block(a,a+b,b,c);
-    }
-    Hn.block(a+c,a+c,b,b) = H.block(a,a,b,b);
+        invHbBc = invHb*H.block(a,a+b,b,c);
 
-    // Perform marginalization (Schur complement)
-    Eigen::JacobiSVD<Eigen::MatrixXd> svd(Hn.block(a+c,a+c,b,b),Eigen::ComputeThinU | Eigen::ComputeThinV);
-    Eigen::JacobiSVD<Eigen::MatrixXd>::SingularValuesType singularValues_inv=svd.singularValues();
-    for (int i=0; i<b; ++i)
-    {
-        if (singularValues_inv(i)>1e-6)
-            singularValues_inv(i)=1.0/singularValues_inv(i);
-        else singularValues_inv(i)=0;
-    }
-    Eigen::MatrixXd invHb = svd.matrixV()*singularValues_inv.asDiagonal()*svd.matrixU().transpose();
-    Hn.block(0,0,a+c,a+c) = Hn.block(0,0,a+c,a+c) - Hn.block(0,a+c,a+c,b)*invHb*Hn.block(a+c,0,b,a+c);
-    Hn.block(a+c,a+c,b,b) = Eigen::MatrixXd::Zero(b,b);
-    Hn.block(0,a+c,a+c,b) = Eigen::MatrixXd::Zero(a+c,b);
-    Hn.block(a+c,0,b,a+c) = Eigen::MatrixXd::Zero(b,a+c);
-
-    // Inverse reorder
-    // a*  | ac* | 0       a*  | 0 | ac*
-    // ca* | c*  | 0  -->  0   | 0 | 0
-    // 0   | 0   | 0       ca* | 0 | c*
     Eigen::MatrixXd res = Eigen::MatrixXd::Zero(H.rows(),H.cols());
     if(a>0)
-    {
-        res.block(0,0,a,a) = Hn.block(0,0,a,a);
-        res.block(0,a,a,b) = Hn.block(0,a+c,a,b);
-        res.block(a,0,b,a) = Hn.block(a+c,0,b,a);
-    }
+        res.block(0,0,a,a) = H.block(0,0,a,a) - H.block(0,a,a,b)*invHbBa;
     if(a>0 && c>0)
     {
-        res.block(0,a+b,a,c) = Hn.block(0,a,a,c);
-        res.block(a+b,0,c,a) = Hn.block(a,0,c,a);
+        res.block(0,a+b,a,c) = H.block(0,a+b,a,c) - H.block(0,a,a,b)*invHbBc;
+        res.block(a+b,0,c,a) = H.block(a+b,0,c,a) - H.block(a+b,a,c,b)*invHbBa;
     }
     if(c>0)
-    {
-        res.block(a+b,a+b,c,c) = Hn.block(a,a,c,c);
-        res.block(a+b,a,c,b) = Hn.block(a,a+c,c,b);
-        res.block(a,a+b,b,c) = Hn.block(a+c,a,b,c);
-    }
-
-    res.block(a,a,b,b) = Hn.block(a+c,a+c,b,b);
+        res.block(a+b,a+b,c,c) = H.block(a+b,a+b,c,c) - H.block(a+b,a,c,b)*invHbBc;
 
     return res;
 }
 
+Eigen::Matrix<double,15,15> Optimizer::MarginalizePreviousFrame(const Eigen::Matrix<double,30,30> &H)
+{
+    // State: previous frame p = [pose vel bg ba](0:14), current frame c = [pose vel bg ba](15:29).
+    // The current biases are only linked to the previous ones by the random walk edges, so the
+    // blocks (bg_c, p) and (ba_c, p) are zero except for (bg_c, bg_p) and (ba_c, ba_p).
+    const Eigen::Matrix<double,15,15> invHpp = PseudoInverseSym<Eigen::Matrix<double,15,15> >(H.block<15,15>(0,0));
+
+    // X = inv(Hpp)*Hpc, using the zero blocks of Hpc
+    Eigen::Matrix<double,15,15> X;
+    X.leftCols<9>().noalias() = invHpp*H.block<15,9>(0,15);
+    X.middleCols<3>(9).noalias() = invHpp.middleCols<3>(9)*H.block<3,3>(9,24);
+    X.rightCols<3>().noalias() = invHpp.rightCols<3>()*H.block<3,3>(12,27);
+
+    // Hcc - Hcp*X, using the zero blocks of Hcp
+    Eigen::Matrix<double,15,15> Hm = H.block<15,15>(15,15);
+    Hm.topRows<9>().noalias() -= H.block<9,15>(15,0)*X;
+    Hm.middleRows<3>(9).noalias() -= H.block<3,3>(24,9)*X.middleRows<3>(9);
+    Hm.bottomRows<3>().noalias() -= H.block<3,3>(27,12)*X.bottomRows<3>();
+
+    return Hm;
+}
+
 Eigen::MatrixXd Optimizer::Condition(const Eigen::MatrixXd &H, const int &start, const int &end)
 {
     // Size of block before block to condition
@@ -4683,14 +5204,17 @@ Eigen::MatrixXd Optimizer::Sparsify(const Eigen::MatrixXd &H, const int &start1,
 }
 
 
-void Optimizer::InertialOptimization(Map *pMap, Eigen::Matrix3d &Rwg, double &scale, Eigen::Vector3d &bg, Eigen::Vector3d &ba, bool bMono, Eigen::MatrixXd  &covInertial, bool bFixedVel, bool bGauss, float priorG, float priorA)
+void Optimizer::InertialOptimization(Map *pMap, Eigen::Matrix3d &Rwg, double &scale, Eigen::Vector3d &bg, Eigen::Vector3d &ba, bool bMono, Eigen::MatrixXd  &covInertial, bool bFixedVel, bool bGauss, float priorG, float priorA, int nIterations)
 {
+    ORB_TRACE_SCOPE("Optimizer::InertialOptimization");
     Verbose::PrintMess("inertial optimization", Verbose::VERBOSITY_NORMAL);
-    int its = 200; // Check number of iterations
+    int its = nIterations; // Check number of iterations
     long unsigned int maxKFid = pMap->GetMaxKFid();
-    const vector<KeyFrame*> vpKFs = pMap->GetAllKeyFrames();
+    const Map::KeyFramesSnapshot pKFs = pMap->GetKeyFramesSnapshot();
+    const vector<KeyFrame*> &vpKFs = *pKFs;
 
     // Setup optimizer
+    g2o::GraphArena arena;
     g2o::SparseOptimizer optimizer;
     g2o::BlockSolverX::LinearSolverType * linearSolver;
 
@@ -4870,11 +5394,14 @@ void Optimizer::InertialOptimization(Map *pMap, Eigen::Matrix3d &Rwg, double &sc
 
 void Optimizer::InertialOptimization(Map *pMap, Eigen::Vector3d &bg, Eigen::Vector3d &ba, float priorG, float priorA)
 {
+    ORB_TRACE_SCOPE("Optimizer::InertialOptimization");
     int its = 200;
     long unsigned int maxKFid = pMap->GetMaxKFid();
-    const vector<KeyFrame*> vpKFs = pMap->GetAllKeyFrames();
+    const Map::KeyFramesSnapshot pKFs = pMap->GetKeyFramesSnapshot();
+    const vector<KeyFrame*> &vpKFs = *pKFs;
 
     // Setup optimizer
+    g2o::GraphArena arena;
     g2o::SparseOptimizer optimizer;
     g2o::BlockSolverX::LinearSolverType * linearSolver;
 
@@ -5031,10 +5558,12 @@ void Optimizer::InertialOptimization(Map *pMap, Eigen::Vector3d &bg, Eigen::Vect
 
 void Optimizer::InertialOptimization(vector<KeyFrame*> vpKFs, Eigen::Vector3d &bg, Eigen::Vector3d &ba, float priorG, float priorA)
 {
+    ORB_TRACE_SCOPE("Optimizer::InertialOptimization");
     int its = 200;
     long unsigned int maxKFid = vpKFs[0]->GetMap()->GetMaxKFid();
 
     // Setup optimizer
+    g2o::GraphArena arena;
     g2o::SparseOptimizer optimizer;
     g2o::BlockSolverX::LinearSolverType * linearSolver;
 
@@ -5192,11 +5721,14 @@ void Optimizer::InertialOptimization(vector<KeyFrame*> vpKFs, Eigen::Vector3d &b
 
 void Optimizer::InertialOptimization(Map *pMap, Eigen::Matrix3d &Rwg, double &scale)
 {
+    ORB_TRACE_SCOPE("Optimizer::InertialOptimization");
     int its = 10;
     long unsigned int maxKFid = pMap->GetMaxKFid();
-    const vector<KeyFrame*> vpKFs = pMap->GetAllKeyFrames();
+    const Map::KeyFramesSnapshot pKFs = pMap->GetKeyFramesSnapshot();
+    const vector<KeyFrame*> &vpKFs = *pKFs;
 
     // Setup optimizer
+    g2o::GraphArena arena;
     g2o::SparseOptimizer optimizer;
     g2o::BlockSolverX::LinearSolverType * linearSolver;
 
@@ -5295,8 +5827,10 @@ void Optimizer::InertialOptimization(Map *pMap, Eigen::Matrix3d &Rwg, double &sc
 
 void Optimizer::MergeBundleAdjustmentVisual(KeyFrame* pCurrentKF, vector<KeyFrame*> vpWeldingKFs, vector<KeyFrame*> vpFixedKFs, bool *pbStopFlag)
 {
+    ORB_TRACE_SCOPE("Optimizer::MergeBundleAdjustmentVisual");
     vector<MapPoint*> vpMPs;
 
+    g2o::GraphArena arena;
     g2o::SparseOptimizer optimizer;
     g2o::BlockSolver_6_3::LinearSolverType * linearSolver;
 
@@ -5322,7 +5856,7 @@ void Optimizer::MergeBundleAdjustmentVisual(KeyFrame* pCurrentKF, vector<KeyFram
         pKFi->mnBALocalForKF = pCurrentKF->mnId;
 
         g2o::VertexSE3Expmap * vSE3 = new g2o::VertexSE3Expmap();
-        vSE3->setEstimate(Converter::toSE3Quat(pKFi->GetPose()));
+        vSE3->setEstimate(Converter::toSE3Quat(pKFi->GetPose_()));
         vSE3->setId(pKFi->mnId);
         vSE3->setFixed(false);
         optimizer.addVertex(vSE3);
@@ -5353,7 +5887,7 @@ void Optimizer::MergeBundleAdjustmentVisual(KeyFrame* pCurrentKF, vector<KeyFram
         pKFi->mnBALocalForKF = pCurrentKF->mnId;
 
         g2o::VertexSE3Expmap * vSE3 = new g2o::VertexSE3Expmap();
-        vSE3->setEstimate(Converter::toSE3Quat(pKFi->GetPose()));
+        vSE3->setEstimate(Converter::toSE3Quat(pKFi->GetPose_()));
         vSE3->setId(pKFi->mnId);
         vSE3->setFixed(true);
         optimizer.addVertex(vSE3);
@@ -5407,17 +5941,17 @@ void Optimizer::MergeBundleAdjustmentVisual(KeyFrame* pCurrentKF, vector<KeyFram
             continue;
 
         g2o::VertexSBAPointXYZ* vPoint = new g2o::VertexSBAPointXYZ();
-        vPoint->setEstimate(Converter::toVector3d(pMPi->GetWorldPos()));
+        vPoint->setEstimate(Converter::toVector3d(pMPi->GetWorldPos2()));
         const int id = pMPi->mnId+maxKFid+1;
         vPoint->setId(id);
         vPoint->setMarginalized(true);
         optimizer.addVertex(vPoint);
 
 
-        const map<KeyFrame*,tuple<int,int>> observations = pMPi->GetObservations();
+        const ObservationMap observations = pMPi->GetObservations();
         int nEdges = 0;
         //SET EDGES
-        for(map<KeyFrame*,tuple<int,int>>::const_iterator mit=observations.begin(); mit!=observations.end(); mit++)
+        for(ObservationMap::const_iterator mit=observations.begin(); mit!=observations.end(); mit++)
         {
 
             KeyFrame* pKF = mit->first;
@@ -5582,7 +6116,7 @@ void Optimizer::MergeBundleAdjustmentVisual(KeyFrame* pCurrentKF, vector<KeyFram
     }
 
     // Get Map Mutex
-    unique_lock<mutex> lock(pCurrentKF->GetMap()->mMutexMapUpdate);
+    unique_lock<MapUpdateMutex> lock(pCurrentKF->GetMap()->mMutexMapUpdate);
 
     if(!vToErase.empty())
     {
@@ -5605,7 +6139,7 @@ void Optimizer::MergeBundleAdjustmentVisual(KeyFrame* pCurrentKF, vector<KeyFram
 
         g2o::VertexSE3Expmap* vSE3 = static_cast<g2o::VertexSE3Expmap*>(optimizer.vertex(pKFi->mnId));
         g2o::SE3Quat SE3quat = vSE3->estimate();
-        pKFi->SetPose(Converter::toCvMat(SE3quat));
+        pKFi->SetPose_(Converter::toMatx44f(SE3quat));
 
     }
 
@@ -5616,7 +6150,7 @@ void Optimizer::MergeBundleAdjustmentVisual(KeyFrame* pCurrentKF, vector<KeyFram
             continue;
 
         g2o::VertexSBAPointXYZ* vPoint = static_cast<g2o::VertexSBAPointXYZ*>(optimizer.vertex(pMPi->mnId+maxKFid+1));
-        pMPi->SetWorldPos(Converter::toCvMat(vPoint->estimate()));
+        pMPi->SetWorldPos2(Converter::toMatx31f(vPoint->estimate()));
         pMPi->UpdateNormalAndDepth();
 
     }
@@ -5624,10 +6158,12 @@ void Optimizer::MergeBundleAdjustmentVisual(KeyFrame* pCurrentKF, vector<KeyFram
 
 void Optimizer::LocalBundleAdjustment(KeyFrame* pMainKF,vector<KeyFrame*> vpAdjustKF, vector<KeyFrame*> vpFixedKF, bool *pbStopFlag)
 {
+    ORB_TRACE_SCOPE("Optimizer::LocalBundleAdjustment");
     bool bShowImages = false;
 
     vector<MapPoint*> vpMPs;
 
+    g2o::GraphArena arena;
     g2o::SparseOptimizer optimizer;
     g2o::BlockSolver_6_3::LinearSolverType * linearSolver;
 
@@ -5660,7 +6196,7 @@ void Optimizer::LocalBundleAdjustment(KeyFrame* pMainKF,vector<KeyFrame*> vpAdju
         pKFi->mnBALocalForMerge = pMainKF->mnId;
 
         g2o::VertexSE3Expmap * vSE3 = new g2o::VertexSE3Expmap();
-        vSE3->setEstimate(Converter::toSE3Quat(pKFi->GetPose()));
+        vSE3->setEstimate(Converter::toSE3Quat(pKFi->GetPose_()));
         vSE3->setId(pKFi->mnId);
         vSE3->setFixed(true);
         optimizer.addVertex(vSE3);
@@ -5693,7 +6229,7 @@ void Optimizer::LocalBundleAdjustment(KeyFrame* pMainKF,vector<KeyFrame*> vpAdju
         pKFi->mnBALocalForKF = pMainKF->mnId;
 
         g2o::VertexSE3Expmap * vSE3 = new g2o::VertexSE3Expmap();
-        vSE3->setEstimate(Converter::toSE3Quat(pKFi->GetPose()));
+        vSE3->setEstimate(Converter::toSE3Quat(pKFi->GetPose_()));
         vSE3->setId(pKFi->mnId);
         optimizer.addVertex(vSE3);
         if(pKFi->mnId>maxKFid)
@@ -5752,17 +6288,17 @@ void Optimizer::LocalBundleAdjustment(KeyFrame* pMainKF,vector<KeyFrame*> vpAdju
             continue;
 
         g2o::VertexSBAPointXYZ* vPoint = new g2o::VertexSBAPointXYZ();
-        vPoint->setEstimate(Converter::toVector3d(pMPi->GetWorldPos()));
+        vPoint->setEstimate(Converter::toVector3d(pMPi->GetWorldPos2()));
         const int id = pMPi->mnId+maxKFid+1;
         vPoint->setId(id);
         vPoint->setMarginalized(true);
         optimizer.addVertex(vPoint);
 
 
-        const map<KeyFrame*,tuple<int,int>> observations = pMPi->GetObservations();
+        const ObservationMap observations = pMPi->GetObservations();
         int nEdges = 0;
         //SET EDGES
-        for(map<KeyFrame*,tuple<int,int>>::const_iterator mit=observations.begin(); mit!=observations.end(); mit++)
+        for(ObservationMap::const_iterator mit=observations.begin(); mit!=observations.end(); mit++)
         {
 
             KeyFrame* pKF = mit->first;
@@ -5779,7 +6315,7 @@ void Optimizer::LocalBundleAdjustment(KeyFrame* pMainKF,vector<KeyFrame*> vpAdju
                 Eigen::Matrix<double,2,1> obs;
                 obs << kpUn.pt.x, kpUn.pt.y;
 
-                ORB_SLAM3::EdgeSE3ProjectXYZ* e = new ORB_SLAM3::EdgeSE3ProjectXYZ();
+                ORB_SLAM3::EdgeSE3ProjectXYZ* e = ORB_SLAM3::NewEdgeSE3ProjectXYZ(pKF->mpCamera);
 
 
                 e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(id)));
@@ -5959,7 +6495,7 @@ void Optimizer::LocalBundleAdjustment(KeyFrame* pMainKF,vector<KeyFrame*> vpAdju
     Verbose::PrintMess("LBA: Second optimization, there are " + to_string(badMonoMP) + " monocular and " + to_string(badStereoMP) + " sterero bad edges", Verbose::VERBOSITY_DEBUG);
 
     // Get Map Mutex
-    unique_lock<mutex> lock(pMainKF->GetMap()->mMutexMapUpdate);
+    unique_lock<MapUpdateMutex> lock(pMainKF->GetMap()->mMutexMapUpdate);
 
     if(!vToErase.empty())
     {
@@ -6005,8 +6541,8 @@ void Optimizer::LocalBundleAdjustment(KeyFrame* pMainKF,vector<KeyFrame*> vpAdju
         if(pMPi->isBad())
             continue;
 
-        const map<KeyFrame*,tuple<int,int>> observations = pMPi->GetObservations();
-        for(map<KeyFrame*,tuple<int,int>>::const_iterator mit=observations.begin(); mit!=observations.end(); mit++)
+        const ObservationMap observations = pMPi->GetObservations();
+        for(ObservationMap::const_iterator mit=observations.begin(); mit!=observations.end(); mit++)
         {
 
             KeyFrame* pKF = mit->first;
@@ -6115,7 +6651,7 @@ void Optimizer::LocalBundleAdjustment(KeyFrame* pMainKF,vector<KeyFrame*> vpAdju
             continue;
 
         g2o::VertexSBAPointXYZ* vPoint = static_cast<g2o::VertexSBAPointXYZ*>(optimizer.vertex(pMPi->mnId+maxKFid+1));
-        pMPi->SetWorldPos(Converter::toCvMat(vPoint->estimate()));
+        pMPi->SetWorldPos2(Converter::toMatx31f(vPoint->estimate()));
         pMPi->UpdateNormalAndDepth();
 
     }
@@ -6124,6 +6660,7 @@ void Optimizer::LocalBundleAdjustment(KeyFrame* pMainKF,vector<KeyFrame*> vpAdju
 
 void Optimizer::MergeInertialBA(KeyFrame* pCurrKF, KeyFrame* pMergeKF, bool *pbStopFlag, Map *pMap, LoopClosing::KeyFrameAndPose &corrPoses)
 {
+    ORB_TRACE_SCOPE("Optimizer::MergeInertialBA");
     const int Nd = 6;
     const unsigned long maxKFid = pCurrKF->mnId;
 
@@ -6276,6 +6813,7 @@ void Optimizer::MergeInertialBA(KeyFrame* pCurrKF, KeyFrame* pMergeKF, bool *pbS
         }
     }
 
+    g2o::GraphArena arena;
     g2o::SparseOptimizer optimizer;
     g2o::BlockSolverX::LinearSolverType * linearSolver;
     linearSolver = new g2o::LinearSolverEigen<g2o::BlockSolverX::PoseMatrixType>();
@@ -6421,23 +6959,23 @@ void Optimizer::MergeInertialBA(KeyFrame* pCurrKF, KeyFrame* pMergeKF, bool *pbS
             vegr[i] = new EdgeGyroRW();
             vegr[i]->setVertex(0,VG1);
             vegr[i]->setVertex(1,VG2);
-            cv::Mat cvInfoG = pKFi->mpImuPreintegrated->C.rowRange(9,12).colRange(9,12).inv(cv::DECOMP_SVD);
+            const cv::Matx33f cvInfoG = pKFi->mpImuPreintegrated->C.get_minor<3,3>(9,9).inv(cv::DECOMP_SVD);
             Eigen::Matrix3d InfoG;
 
             for(int r=0;r<3;r++)
                 for(int c=0;c<3;c++)
-                    InfoG(r,c)=cvInfoG.at<float>(r,c);
+                    InfoG(r,c)=cvInfoG(r,c);
             vegr[i]->setInformation(InfoG);
             optimizer.addEdge(vegr[i]);
 
             vear[i] = new EdgeAccRW();
             vear[i]->setVertex(0,VA1);
             vear[i]->setVertex(1,VA2);
-            cv::Mat cvInfoA = pKFi->mpImuPreintegrated->C.rowRange(12,15).colRange(12,15).inv(cv::DECOMP_SVD);
+            const cv::Matx33f cvInfoA = pKFi->mpImuPreintegrated->C.get_minor<3,3>(12,12).inv(cv::DECOMP_SVD);
             Eigen::Matrix3d InfoA;
             for(int r=0;r<3;r++)
                 for(int c=0;c<3;c++)
-                    InfoA(r,c)=cvInfoA.at<float>(r,c);
+                    InfoA(r,c)=cvInfoA(r,c);
             vear[i]->setInformation(InfoA);
             optimizer.addEdge(vear[i]);
         }
@@ -6485,17 +7023,17 @@ void Optimizer::MergeInertialBA(KeyFrame* pCurrKF, KeyFrame* pMergeKF, bool *pbS
             continue;
 
         g2o::VertexSBAPointXYZ* vPoint = new g2o::VertexSBAPointXYZ();
-        vPoint->setEstimate(Converter::toVector3d(pMP->GetWorldPos()));
+        vPoint->setEstimate(Converter::toVector3d(pMP->GetWorldPos2()));
 
         unsigned long id = pMP->mnId+iniMPid+1;
         vPoint->setId(id);
         vPoint->setMarginalized(true);
         optimizer.addVertex(vPoint);
 
-        const map<KeyFrame*,tuple<int,int>> observations = pMP->GetObservations();
+        const ObservationMap observations = pMP->GetObservations();
 
         // Create visual constraints
-        for(map<KeyFrame*,tuple<int,int>>::const_iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+        for(ObservationMap::const_iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
         {
             KeyFrame* pKFi = mit->first;
 
@@ -6523,7 +7061,7 @@ void Optimizer::MergeInertialBA(KeyFrame* pCurrKF, KeyFrame* pMergeKF, bool *pbS
                     Eigen::Matrix<double,2,1> obs;
                     obs << kpUn.pt.x, kpUn.pt.y;
 
-                    EdgeMono* e = new EdgeMono();
+                    EdgeMono* e = NewEdgeMono(pKFi->mpCamera);
                     e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(id)));
                     e->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(pKFi->mnId)));
                     e->setMeasurement(obs);
@@ -6544,7 +7082,7 @@ void Optimizer::MergeInertialBA(KeyFrame* pCurrKF, KeyFrame* pMergeKF, bool *pbS
                     Eigen::Matrix<double,3,1> obs;
                     obs << kpUn.pt.x, kpUn.pt.y, kp_ur;
 
-                    EdgeStereo* e = new EdgeStereo();
+                    EdgeStereo* e = NewEdgeStereo(pKFi->mpCamera);
 
                     e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(id)));
                     e->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(pKFi->mnId)));
@@ -6614,7 +7152,7 @@ void Optimizer::MergeInertialBA(KeyFrame* pCurrKF, KeyFrame* pMergeKF, bool *pbS
     }
 
     // Get Map Mutex and erase outliers
-    unique_lock<mutex> lock(pMap->mMutexMapUpdate);
+    unique_lock<MapUpdateMutex> lock(pMap->mMutexMapUpdate);
     if(!vToErase.empty())
     {
         for(size_t i=0;i<vToErase.size();i++)
@@ -6687,7 +7225,7 @@ void Optimizer::MergeInertialBA(KeyFrame* pCurrKF, KeyFrame* pMergeKF, bool *pbS
     {
         MapPoint* pMP = *lit;
         g2o::VertexSBAPointXYZ* vPoint = static_cast<g2o::VertexSBAPointXYZ*>(optimizer.vertex(pMP->mnId+iniMPid+1));
-        pMP->SetWorldPos(Converter::toCvMat(vPoint->estimate()));
+        pMP->SetWorldPos2(Converter::toMatx31f(vPoint->estimate()));
         pMP->UpdateNormalAndDepth();
     }
 
@@ -6696,16 +7234,10 @@ void Optimizer::MergeInertialBA(KeyFrame* pCurrKF, KeyFrame* pMergeKF, bool *pbS
 
 int Optimizer::PoseInertialOptimizationLastKeyFrame(Frame *pFrame, bool bRecInit)
 {
-    g2o::SparseOptimizer optimizer;
-    g2o::BlockSolverX::LinearSolverType * linearSolver;
-
-    linearSolver = new g2o::LinearSolverDense<g2o::BlockSolverX::PoseMatrixType>();
-
-    g2o::BlockSolverX * solver_ptr = new g2o::BlockSolverX(linearSolver);
-
-    g2o::OptimizationAlgorithmGaussNewton* solver = new g2o::OptimizationAlgorithmGaussNewton(solver_ptr);
-    optimizer.setVerbose(false);
-    optimizer.setAlgorithm(solver);
+    ORB_TRACE_SCOPE("Optimizer::PoseInertialOptimizationLastKeyFrame");
+    // Fixed-size Gauss-Newton over the 15 free dimensions, no SparseOptimizer/BlockSolverX per frame
+    g2o::GraphArena arena;
+    InertialPoseSolver<15> solver;
 
     int nInitialMonoCorrespondences=0;
     int nInitialStereoCorrespondences=0;
@@ -6715,19 +7247,19 @@ int Optimizer::PoseInertialOptimizationLastKeyFrame(Frame *pFrame, bool bRecInit
     VertexPose* VP = new VertexPose(pFrame);
     VP->setId(0);
     VP->setFixed(false);
-    optimizer.addVertex(VP);
+    solver.AddVertex(VP,0);
     VertexVelocity* VV = new VertexVelocity(pFrame);
     VV->setId(1);
     VV->setFixed(false);
-    optimizer.addVertex(VV);
+    solver.AddVertex(VV,6);
     VertexGyroBias* VG = new VertexGyroBias(pFrame);
     VG->setId(2);
     VG->setFixed(false);
-    optimizer.addVertex(VG);
+    solver.AddVertex(VG,9);
     VertexAccBias* VA = new VertexAccBias(pFrame);
     VA->setId(3);
     VA->setFixed(false);
-    optimizer.addVertex(VA);
+    solver.AddVertex(VA,12);
 
     // Set MapPoint vertices
     const int N = pFrame->N;
@@ -6748,30 +7280,22 @@ int Optimizer::PoseInertialOptimizationLastKeyFrame(Frame *pFrame, bool bRecInit
 
 
     {
-        unique_lock<mutex> lock(MapPoint::mGlobalMutex);
-
         for(int i=0; i<N; i++)
         {
             MapPoint* pMP = pFrame->mvpMapPoints[i];
             if(pMP)
             {
-                cv::KeyPoint kpUn;
 
                 // Left monocular observation
                 if((!bRight && pFrame->mvuRight[i]<0) || i < Nleft)
                 {
-                    if(i < Nleft) // pair left-right
-                        kpUn = pFrame->mvKeys[i];
-                    else
-                        kpUn = pFrame->mvKeysUn[i];
-
                     nInitialMonoCorrespondences++;
                     pFrame->mvbOutlier[i] = false;
 
                     Eigen::Matrix<double,2,1> obs;
-                    obs << kpUn.pt.x, kpUn.pt.y;
+                    obs << pFrame->mKeysSoA.mvX[i], pFrame->mKeysSoA.mvY[i];
 
-                    EdgeMonoOnlyPose* e = new EdgeMonoOnlyPose(pMP->GetWorldPos(),0);
+                    EdgeMonoOnlyPose* e = NewEdgeMonoOnlyPose(pFrame->mpCamera,pMP->GetWorldPos(),0);
 
                     e->setVertex(0,VP);
                     e->setMeasurement(obs);
@@ -6779,14 +7303,14 @@ int Optimizer::PoseInertialOptimizationLastKeyFrame(Frame *pFrame, bool bRecInit
                     // Add here uncerteinty
                     const float unc2 = pFrame->mpCamera->uncertainty2(obs);
 
-                    const float invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave]/unc2;
+                    const float invSigma2 = pFrame->mvInvLevelSigma2[pFrame->mKeysSoA.mvOctave[i]]/unc2;
                     e->setInformation(Eigen::Matrix2d::Identity()*invSigma2);
 
                     g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
                     e->setRobustKernel(rk);
                     rk->setDelta(thHuberMono);
 
-                    optimizer.addEdge(e);
+                    solver.AddEdge(e);
 
                     vpEdgesMono.push_back(e);
                     vnIndexEdgeMono.push_back(i);
@@ -6797,12 +7321,11 @@ int Optimizer::PoseInertialOptimizationLastKeyFrame(Frame *pFrame, bool bRecInit
                     nInitialStereoCorrespondences++;
                     pFrame->mvbOutlier[i] = false;
 
-                    kpUn = pFrame->mvKeysUn[i];
                     const float kp_ur = pFrame->mvuRight[i];
                     Eigen::Matrix<double,3,1> obs;
-                    obs << kpUn.pt.x, kpUn.pt.y, kp_ur;
+                    obs << pFrame->mKeysSoA.mvX[i], pFrame->mKeysSoA.mvY[i], kp_ur;
 
-                    EdgeStereoOnlyPose* e = new EdgeStereoOnlyPose(pMP->GetWorldPos());
+                    EdgeStereoOnlyPose* e = NewEdgeStereoOnlyPose(pFrame->mpCamera,pMP->GetWorldPos());
 
                     e->setVertex(0, VP);
                     e->setMeasurement(obs);
@@ -6810,14 +7333,14 @@ int Optimizer::PoseInertialOptimizationLastKeyFrame(Frame *pFrame, bool bRecInit
                     // Add here uncerteinty
                     const float unc2 = pFrame->mpCamera->uncertainty2(obs.head(2));
 
-                    const float &invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave]/unc2;
+                    const float &invSigma2 = pFrame->mvInvLevelSigma2[pFrame->mKeysSoA.mvOctave[i]]/unc2;
                     e->setInformation(Eigen::Matrix3d::Identity()*invSigma2);
 
                     g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
                     e->setRobustKernel(rk);
                     rk->setDelta(thHuberStereo);
 
-                    optimizer.addEdge(e);
+                    solver.AddEdge(e);
 
                     vpEdgesStereo.push_back(e);
                     vnIndexEdgeStereo.push_back(i);
@@ -6829,11 +7352,10 @@ int Optimizer::PoseInertialOptimizationLastKeyFrame(Frame *pFrame, bool bRecInit
                     nInitialMonoCorrespondences++;
                     pFrame->mvbOutlier[i] = false;
 
-                    kpUn = pFrame->mvKeysRight[i - Nleft];
                     Eigen::Matrix<double,2,1> obs;
-                    obs << kpUn.pt.x, kpUn.pt.y;
+                    obs << pFrame->mKeysSoA.mvX[i], pFrame->mKeysSoA.mvY[i];
 
-                    EdgeMonoOnlyPose* e = new EdgeMonoOnlyPose(pMP->GetWorldPos(),1);
+                    EdgeMonoOnlyPose* e = NewEdgeMonoOnlyPose(pFrame->mpCamera2,pMP->GetWorldPos(),1);
 
                     e->setVertex(0,VP);
                     e->setMeasurement(obs);
@@ -6841,14 +7363,14 @@ int Optimizer::PoseInertialOptimizationLastKeyFrame(Frame *pFrame, bool bRecInit
                     // Add here uncerteinty
                     const float unc2 = pFrame->mpCamera->uncertainty2(obs);
 
-                    const float invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave]/unc2;
+                    const float invSigma2 = pFrame->mvInvLevelSigma2[pFrame->mKeysSoA.mvOctave[i]]/unc2;
                     e->setInformation(Eigen::Matrix2d::Identity()*invSigma2);
 
                     g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
                     e->setRobustKernel(rk);
                     rk->setDelta(thHuberMono);
 
-                    optimizer.addEdge(e);
+                    solver.AddEdge(e);
 
                     vpEdgesMono.push_back(e);
                     vnIndexEdgeMono.push_back(i);
@@ -6862,19 +7384,19 @@ int Optimizer::PoseInertialOptimizationLastKeyFrame(Frame *pFrame, bool bRecInit
     VertexPose* VPk = new VertexPose(pKF);
     VPk->setId(4);
     VPk->setFixed(true);
-    optimizer.addVertex(VPk);
+    solver.AddVertex(VPk,-1);
     VertexVelocity* VVk = new VertexVelocity(pKF);
     VVk->setId(5);
     VVk->setFixed(true);
-    optimizer.addVertex(VVk);
+    solver.AddVertex(VVk,-1);
     VertexGyroBias* VGk = new VertexGyroBias(pKF);
     VGk->setId(6);
     VGk->setFixed(true);
-    optimizer.addVertex(VGk);
+    solver.AddVertex(VGk,-1);
     VertexAccBias* VAk = new VertexAccBias(pKF);
     VAk->setId(7);
     VAk->setFixed(true);
-    optimizer.addVertex(VAk);
+    solver.AddVertex(VAk,-1);
 
     EdgeInertial* ei = new EdgeInertial(pFrame->mpImuPreintegrated);
 
@@ -6884,29 +7406,29 @@ int Optimizer::PoseInertialOptimizationLastKeyFrame(Frame *pFrame, bool bRecInit
     ei->setVertex(3, VAk);
     ei->setVertex(4, VP);
     ei->setVertex(5, VV);
-    optimizer.addEdge(ei);
+    solver.AddEdge(ei);
 
     EdgeGyroRW* egr = new EdgeGyroRW();
     egr->setVertex(0,VGk);
     egr->setVertex(1,VG);
-    cv::Mat cvInfoG = pFrame->mpImuPreintegrated->C.rowRange(9,12).colRange(9,12).inv(cv::DECOMP_SVD);
+    const cv::Matx33f cvInfoG = pFrame->mpImuPreintegrated->C.get_minor<3,3>(9,9).inv(cv::DECOMP_SVD);
     Eigen::Matrix3d InfoG;
     for(int r=0;r<3;r++)
         for(int c=0;c<3;c++)
-            InfoG(r,c)=cvInfoG.at<float>(r,c);
+            InfoG(r,c)=cvInfoG(r,c);
     egr->setInformation(InfoG);
-    optimizer.addEdge(egr);
+    solver.AddEdge(egr);
 
     EdgeAccRW* ear = new EdgeAccRW();
     ear->setVertex(0,VAk);
     ear->setVertex(1,VA);
-    cv::Mat cvInfoA = pFrame->mpImuPreintegrated->C.rowRange(12,15).colRange(12,15).inv(cv::DECOMP_SVD);
+    const cv::Matx33f cvInfoA = pFrame->mpImuPreintegrated->C.get_minor<3,3>(12,12).inv(cv::DECOMP_SVD);
     Eigen::Matrix3d InfoA;
     for(int r=0;r<3;r++)
         for(int c=0;c<3;c++)
-            InfoA(r,c)=cvInfoA.at<float>(r,c);
+            InfoA(r,c)=cvInfoA(r,c);
     ear->setInformation(InfoA);
-    optimizer.addEdge(ear);
+    solver.AddEdge(ear);
 
     // We perform 4 optimizations, after each optimization we classify observation as inlier/outlier
     // At the next optimization, outliers are not included, but at the end they can be classified as inliers again.
@@ -6924,8 +7446,7 @@ int Optimizer::PoseInertialOptimizationLastKeyFrame(Frame *pFrame, bool bRecInit
     bool bOut = false;
     for(size_t it=0; it<4; it++)
     {
-        optimizer.initializeOptimization(0);
-        optimizer.optimize(its[it]);
+        solver.Optimize(its[it]);
 
         nBad=0;
         nBadMono = 0;
@@ -7001,7 +7522,7 @@ int Optimizer::PoseInertialOptimizationLastKeyFrame(Frame *pFrame, bool bRecInit
         nInliers = nInliersMono + nInliersStereo;
         nBad = nBadMono + nBadStereo;
 
-        if(optimizer.edges().size()<10)
+        if(solver.NumEdges()<10)
         {
             cout << "PIOLKF: NOT ENOUGH EDGES" << endl;
             break;
@@ -7091,16 +7612,10 @@ int Optimizer::PoseInertialOptimizationLastKeyFrame(Frame *pFrame, bool bRecInit
 
 int Optimizer::PoseInertialOptimizationLastFrame(Frame *pFrame, bool bRecInit)
 {
-    g2o::SparseOptimizer optimizer;
-    g2o::BlockSolverX::LinearSolverType * linearSolver;
-
-    linearSolver = new g2o::LinearSolverDense<g2o::BlockSolverX::PoseMatrixType>();
-
-    g2o::BlockSolverX * solver_ptr = new g2o::BlockSolverX(linearSolver);
-
-    g2o::OptimizationAlgorithmGaussNewton* solver = new g2o::OptimizationAlgorithmGaussNewton(solver_ptr);
-    optimizer.setAlgorithm(solver);
-    optimizer.setVerbose(false);
+    ORB_TRACE_SCOPE("Optimizer::PoseInertialOptimizationLastFrame");
+    // Fixed-size Gauss-Newton over the 30 free dimensions, no SparseOptimizer/BlockSolverX per frame
+    g2o::GraphArena arena;
+    InertialPoseSolver<30> solver;
 
     int nInitialMonoCorrespondences=0;
     int nInitialStereoCorrespondences=0;
@@ -7110,19 +7625,19 @@ int Optimizer::PoseInertialOptimizationLastFrame(Frame *pFrame, bool bRecInit)
     VertexPose* VP = new VertexPose(pFrame);
     VP->setId(0);
     VP->setFixed(false);
-    optimizer.addVertex(VP);
+    solver.AddVertex(VP,15);
     VertexVelocity* VV = new VertexVelocity(pFrame);
     VV->setId(1);
     VV->setFixed(false);
-    optimizer.addVertex(VV);
+    solver.AddVertex(VV,21);
     VertexGyroBias* VG = new VertexGyroBias(pFrame);
     VG->setId(2);
     VG->setFixed(false);
-    optimizer.addVertex(VG);
+    solver.AddVertex(VG,24);
     VertexAccBias* VA = new VertexAccBias(pFrame);
     VA->setId(3);
     VA->setFixed(false);
-    optimizer.addVertex(VA);
+    solver.AddVertex(VA,27);
 
     // Set MapPoint vertices
     const int N = pFrame->N;
@@ -7142,29 +7657,21 @@ int Optimizer::PoseInertialOptimizationLastFrame(Frame *pFrame, bool bRecInit)
     const float thHuberStereo = sqrt(7.815);
 
     {
-        unique_lock<mutex> lock(MapPoint::mGlobalMutex);
-
         for(int i=0; i<N; i++)
         {
             MapPoint* pMP = pFrame->mvpMapPoints[i];
             if(pMP)
             {
-                cv::KeyPoint kpUn;
                 // Left monocular observation
                 if((!bRight && pFrame->mvuRight[i]<0) || i < Nleft)
                 {
-                    if(i < Nleft) // pair left-right
-                        kpUn = pFrame->mvKeys[i];
-                    else
-                        kpUn = pFrame->mvKeysUn[i];
-
                     nInitialMonoCorrespondences++;
                     pFrame->mvbOutlier[i] = false;
 
                     Eigen::Matrix<double,2,1> obs;
-                    obs << kpUn.pt.x, kpUn.pt.y;
+                    obs << pFrame->mKeysSoA.mvX[i], pFrame->mKeysSoA.mvY[i];
 
-                    EdgeMonoOnlyPose* e = new EdgeMonoOnlyPose(pMP->GetWorldPos(),0);
+                    EdgeMonoOnlyPose* e = NewEdgeMonoOnlyPose(pFrame->mpCamera,pMP->GetWorldPos(),0);
 
                     e->setVertex(0,VP);
                     e->setMeasurement(obs);
@@ -7172,14 +7679,14 @@ int Optimizer::PoseInertialOptimizationLastFrame(Frame *pFrame, bool bRecInit)
                     // Add here uncerteinty
                     const float unc2 = pFrame->mpCamera->uncertainty2(obs);
 
-                    const float invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave]/unc2;
+                    const float invSigma2 = pFrame->mvInvLevelSigma2[pFrame->mKeysSoA.mvOctave[i]]/unc2;
                     e->setInformation(Eigen::Matrix2d::Identity()*invSigma2);
 
                     g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
                     e->setRobustKernel(rk);
                     rk->setDelta(thHuberMono);
 
-                    optimizer.addEdge(e);
+                    solver.AddEdge(e);
 
                     vpEdgesMono.push_back(e);
                     vnIndexEdgeMono.push_back(i);
@@ -7190,12 +7697,11 @@ int Optimizer::PoseInertialOptimizationLastFrame(Frame *pFrame, bool bRecInit)
                     nInitialStereoCorrespondences++;
                     pFrame->mvbOutlier[i] = false;
 
-                    kpUn = pFrame->mvKeysUn[i];
                     const float kp_ur = pFrame->mvuRight[i];
                     Eigen::Matrix<double,3,1> obs;
-                    obs << kpUn.pt.x, kpUn.pt.y, kp_ur;
+                    obs << pFrame->mKeysSoA.mvX[i], pFrame->mKeysSoA.mvY[i], kp_ur;
 
-                    EdgeStereoOnlyPose* e = new EdgeStereoOnlyPose(pMP->GetWorldPos());
+                    EdgeStereoOnlyPose* e = NewEdgeStereoOnlyPose(pFrame->mpCamera,pMP->GetWorldPos());
 
                     e->setVertex(0, VP);
                     e->setMeasurement(obs);
@@ -7203,14 +7709,14 @@ int Optimizer::PoseInertialOptimizationLastFrame(Frame *pFrame, bool bRecInit)
                     // Add here uncerteinty
                     const float unc2 = pFrame->mpCamera->uncertainty2(obs.head(2));
 
-                    const float &invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave]/unc2;
+                    const float &invSigma2 = pFrame->mvInvLevelSigma2[pFrame->mKeysSoA.mvOctave[i]]/unc2;
                     e->setInformation(Eigen::Matrix3d::Identity()*invSigma2);
 
                     g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
                     e->setRobustKernel(rk);
                     rk->setDelta(thHuberStereo);
 
-                    optimizer.addEdge(e);
+                    solver.AddEdge(e);
 
                     vpEdgesStereo.push_back(e);
                     vnIndexEdgeStereo.push_back(i);
@@ -7222,11 +7728,10 @@ int Optimizer::PoseInertialOptimizationLastFrame(Frame *pFrame, bool bRecInit)
                     nInitialMonoCorrespondences++;
                     pFrame->mvbOutlier[i] = false;
 
-                    kpUn = pFrame->mvKeysRight[i - Nleft];
                     Eigen::Matrix<double,2,1> obs;
-                    obs << kpUn.pt.x, kpUn.pt.y;
+                    obs << pFrame->mKeysSoA.mvX[i], pFrame->mKeysSoA.mvY[i];
 
-                    EdgeMonoOnlyPose* e = new EdgeMonoOnlyPose(pMP->GetWorldPos(),1);
+                    EdgeMonoOnlyPose* e = NewEdgeMonoOnlyPose(pFrame->mpCamera2,pMP->GetWorldPos(),1);
 
                     e->setVertex(0,VP);
                     e->setMeasurement(obs);
@@ -7234,14 +7739,14 @@ int Optimizer::PoseInertialOptimizationLastFrame(Frame *pFrame, bool bRecInit)
                     // Add here uncerteinty
                     const float unc2 = pFrame->mpCamera->uncertainty2(obs);
 
-                    const float invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave]/unc2;
+                    const float invSigma2 = pFrame->mvInvLevelSigma2[pFrame->mKeysSoA.mvOctave[i]]/unc2;
                     e->setInformation(Eigen::Matrix2d::Identity()*invSigma2);
 
                     g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
                     e->setRobustKernel(rk);
                     rk->setDelta(thHuberMono);
 
-                    optimizer.addEdge(e);
+                    solver.AddEdge(e);
 
                     vpEdgesMono.push_back(e);
                     vnIndexEdgeMono.push_back(i);
@@ -7258,19 +7763,19 @@ int Optimizer::PoseInertialOptimizationLastFrame(Frame *pFrame, bool bRecInit)
     VertexPose* VPk = new VertexPose(pFp);
     VPk->setId(4);
     VPk->setFixed(false);
-    optimizer.addVertex(VPk);
+    solver.AddVertex(VPk,0);
     VertexVelocity* VVk = new VertexVelocity(pFp);
     VVk->setId(5);
     VVk->setFixed(false);
-    optimizer.addVertex(VVk);
+    solver.AddVertex(VVk,6);
     VertexGyroBias* VGk = new VertexGyroBias(pFp);
     VGk->setId(6);
     VGk->setFixed(false);
-    optimizer.addVertex(VGk);
+    solver.AddVertex(VGk,9);
     VertexAccBias* VAk = new VertexAccBias(pFp);
     VAk->setId(7);
     VAk->setFixed(false);
-    optimizer.addVertex(VAk);
+    solver.AddVertex(VAk,12);
 
     EdgeInertial* ei = new EdgeInertial(pFrame->mpImuPreintegratedFrame);
 
@@ -7280,29 +7785,29 @@ int Optimizer::PoseInertialOptimizationLastFrame(Frame *pFrame, bool bRecInit)
     ei->setVertex(3, VAk);
     ei->setVertex(4, VP);
     ei->setVertex(5, VV);
-    optimizer.addEdge(ei);
+    solver.AddEdge(ei);
 
     EdgeGyroRW* egr = new EdgeGyroRW();
     egr->setVertex(0,VGk);
     egr->setVertex(1,VG);
-    cv::Mat cvInfoG = pFrame->mpImuPreintegratedFrame->C.rowRange(9,12).colRange(9,12).inv(cv::DECOMP_SVD);
+    const cv::Matx33f cvInfoG = pFrame->mpImuPreintegratedFrame->C.get_minor<3,3>(9,9).inv(cv::DECOMP_SVD);
     Eigen::Matrix3d InfoG;
     for(int r=0;r<3;r++)
         for(int c=0;c<3;c++)
-            InfoG(r,c)=cvInfoG.at<float>(r,c);
+            InfoG(r,c)=cvInfoG(r,c);
     egr->setInformation(InfoG);
-    optimizer.addEdge(egr);
+    solver.AddEdge(egr);
 
     EdgeAccRW* ear = new EdgeAccRW();
     ear->setVertex(0,VAk);
     ear->setVertex(1,VA);
-    cv::Mat cvInfoA = pFrame->mpImuPreintegratedFrame->C.rowRange(12,15).colRange(12,15).inv(cv::DECOMP_SVD);
+    const cv::Matx33f cvInfoA = pFrame->mpImuPreintegratedFrame->C.get_minor<3,3>(12,12).inv(cv::DECOMP_SVD);
     Eigen::Matrix3d InfoA;
     for(int r=0;r<3;r++)
         for(int c=0;c<3;c++)
-            InfoA(r,c)=cvInfoA.at<float>(r,c);
+            InfoA(r,c)=cvInfoA(r,c);
     ear->setInformation(InfoA);
-    optimizer.addEdge(ear);
+    solver.AddEdge(ear);
 
     if (!pFp->mpcpi)
         Verbose::PrintMess("pFp->mpcpi does not exist!!!\nPrevious Frame " + to_string(pFp->mnId), Verbose::VERBOSITY_NORMAL);
@@ -7316,7 +7821,7 @@ int Optimizer::PoseInertialOptimizationLastFrame(Frame *pFrame, bool bRecInit)
     g2o::RobustKernelHuber* rkp = new g2o::RobustKernelHuber;
     ep->setRobustKernel(rkp);
     rkp->setDelta(5);
-    optimizer.addEdge(ep);
+    solver.AddEdge(ep);
 
     // We perform 4 optimizations, after each optimization we classify observation as inlier/outlier
     // At the next optimization, outliers are not included, but at the end they can be classified as inliers again.
@@ -7333,8 +7838,7 @@ int Optimizer::PoseInertialOptimizationLastFrame(Frame *pFrame, bool bRecInit)
     int nInliers=0;
     for(size_t it=0; it<4; it++)
     {
-        optimizer.initializeOptimization(0);
-        optimizer.optimize(its[it]);
+        solver.Optimize(its[it]);
 
         nBad=0;
         nBadMono = 0;
@@ -7409,7 +7913,7 @@ int Optimizer::PoseInertialOptimizationLastFrame(Frame *pFrame, bool bRecInit)
         nInliers = nInliersMono + nInliersStereo;
         nBad = nBadMono + nBadStereo;
 
-        if(optimizer.edges().size()<10)
+        if(solver.NumEdges()<10)
         {
             cout << "PIOLF: NOT ENOUGH EDGES" << endl;
             break;
@@ -7507,9 +8011,9 @@ int Optimizer::PoseInertialOptimizationLastFrame(Frame *pFrame, bool bRecInit)
             tot_out++;
     }
 
-    H = Marginalize(H,0,14);
+    const Eigen::Matrix<double,15,15> Hm = MarginalizePreviousFrame(H);
 
-    pFrame->mpcpi = new ConstraintPoseImu(VP->estimate().Rwb,VP->estimate().twb,VV->estimate(),VG->estimate(),VA->estimate(),H.block<15,15>(15,15));
+    pFrame->mpcpi = new ConstraintPoseImu(VP->estimate().Rwb,VP->estimate().twb,VV->estimate(),VG->estimate(),VA->estimate(),Hm);
     delete pFp->mpcpi;
     pFp->mpcpi = NULL;
 
@@ -7523,23 +8027,28 @@ int Optimizer::PoseInertialOptimizationLastFrame(Frame *pFrame, bool bRecInit)
 void Optimizer::OptimizeEssentialGraph4DoF(Map* pMap, KeyFrame* pLoopKF, KeyFrame* pCurKF,
                                        const LoopClosing::KeyFrameAndPose &NonCorrectedSim3,
                                        const LoopClosing::KeyFrameAndPose &CorrectedSim3,
-                                       const map<KeyFrame *, set<KeyFrame *> > &LoopConnections)
+                                       const map<KeyFrame *, set<KeyFrame *> > &LoopConnections,
+                                       LoopClosing::KeyFrameAndPose* pInitialSim3, LoopClosing::KeyFrameAndPose* pOptimizedSim3)
 {
+    ORB_TRACE_SCOPE("Optimizer::OptimizeEssentialGraph4DoF");
     typedef g2o::BlockSolver< g2o::BlockSolverTraits<4, 4> > BlockSolver_4_4;
 
     // Setup optimizer
+    g2o::GraphArena arena;
     g2o::SparseOptimizer optimizer;
     optimizer.setVerbose(false);
     g2o::BlockSolverX::LinearSolverType * linearSolver =
-            new g2o::LinearSolverEigen<g2o::BlockSolverX::PoseMatrixType>();
+            NewSparseLinearSolver<g2o::BlockSolverX>(pMap->GetOptimizerSettings());
     g2o::BlockSolverX * solver_ptr = new g2o::BlockSolverX(linearSolver);
 
     g2o::OptimizationAlgorithmLevenberg* solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
 
     optimizer.setAlgorithm(solver);
 
-    const vector<KeyFrame*> vpKFs = pMap->GetAllKeyFrames();
-    const vector<MapPoint*> vpMPs = pMap->GetAllMapPoints();
+    const Map::KeyFramesSnapshot pKFs = pMap->GetKeyFramesSnapshot();
+    const vector<KeyFrame*> &vpKFs = *pKFs;
+    const Map::MapPointsSnapshot pMPs = pMap->GetMapPointsSnapshot();
+    const vector<MapPoint*> &vpMPs = *pMPs;
 
     const unsigned int nMaxKFid = pMap->GetMaxKFid();
 
@@ -7553,7 +8062,7 @@ void Optimizer::OptimizeEssentialGraph4DoF(Map* pMap, KeyFrame* pLoopKF, KeyFram
     for(size_t i=0, iend=vpKFs.size(); i<iend;i++)
     {
         KeyFrame* pKF = vpKFs[i];
-        if(pKF->isBad())
+        if(pKF->isBad() || pKF->mnId>nMaxKFid)
             continue;
 
         VertexPose4DoF* V4DoF;
@@ -7572,8 +8081,8 @@ void Optimizer::OptimizeEssentialGraph4DoF(Map* pMap, KeyFrame* pLoopKF, KeyFram
         }
         else
         {
-            Eigen::Matrix<double,3,3> Rcw = Converter::toMatrix3d(pKF->GetRotation());
-            Eigen::Matrix<double,3,1> tcw = Converter::toVector3d(pKF->GetTranslation());
+            Eigen::Matrix<double,3,3> Rcw = Converter::toMatrix3d(pKF->GetRotation_());
+            Eigen::Matrix<double,3,1> tcw = Converter::toVector3d(pKF->GetTranslation_());
             g2o::Sim3 Siw(Rcw,tcw,1.0);
             vScw[nIDi] = Siw;
             V4DoF = new VertexPose4DoF(pKF);
@@ -7603,6 +8112,8 @@ void Optimizer::OptimizeEssentialGraph4DoF(Map* pMap, KeyFrame* pLoopKF, KeyFram
     {
         KeyFrame* pKF = mit->first;
         const long unsigned int nIDi = pKF->mnId;
+        if(nIDi>nMaxKFid || !vpVertices[nIDi])
+            continue;
         const set<KeyFrame*> &spConnections = mit->second;
         const g2o::Sim3 Siw = vScw[nIDi];
         const g2o::Sim3 Swi = Siw.inverse();
@@ -7610,6 +8121,8 @@ void Optimizer::OptimizeEssentialGraph4DoF(Map* pMap, KeyFrame* pLoopKF, KeyFram
         for(set<KeyFrame*>::const_iterator sit=spConnections.begin(), send=spConnections.end(); sit!=send; sit++)
         {
             const long unsigned int nIDj = (*sit)->mnId;
+            if(nIDj>nMaxKFid || !vpVertices[nIDj])
+                continue;
             if((nIDi!=pCurKF->mnId || nIDj!=pLoopKF->mnId) && pKF->GetWeight(*sit)<minFeat)
                 continue;
 
@@ -7632,6 +8145,9 @@ void Optimizer::OptimizeEssentialGraph4DoF(Map* pMap, KeyFrame* pLoopKF, KeyFram
         }
     }
 
+    vector<Map::EssentialEdges> vEssentialEdges;
+    pMap->GetEssentialGraph(minFeat,vpKFs,vEssentialEdges);
+
     // 1. Set normal edges
     for(size_t i=0, iend=vpKFs.size(); i<iend; i++)
     {
@@ -7639,6 +8155,12 @@ void Optimizer::OptimizeEssentialGraph4DoF(Map* pMap, KeyFrame* pLoopKF, KeyFram
 
         const int nIDi = pKF->mnId;
 
+        // Keyframes created or culled after the vertices were set (only when Local Mapping keeps running)
+        if(pKF->mnId>nMaxKFid || !vpVertices[nIDi])
+            continue;
+
+        const Map::EssentialEdges &edges = vEssentialEdges[i];
+
         g2o::Sim3 Siw;
 
         // Use noncorrected poses for posegraph edges
@@ -7680,7 +8202,7 @@ void Optimizer::OptimizeEssentialGraph4DoF(Map* pMap, KeyFrame* pLoopKF, KeyFram
 
         // 1.1.1 Inertial edges
         KeyFrame* prevKF = pKF->mPrevKF;
-        if(prevKF)
+        if(prevKF && vpVertices[prevKF->mnId])
         {
             int nIDj = prevKF->mnId;
 
@@ -7707,11 +8229,10 @@ void Optimizer::OptimizeEssentialGraph4DoF(Map* pMap, KeyFrame* pLoopKF, KeyFram
         }
 
         // 1.2 Loop edges
-        const set<KeyFrame*> sLoopEdges = pKF->GetLoopEdges();
-        for(set<KeyFrame*>::const_iterator sit=sLoopEdges.begin(), send=sLoopEdges.end(); sit!=send; sit++)
+        for(vector<KeyFrame*>::const_iterator vit=edges.vpLoopEdges.begin(), vend=edges.vpLoopEdges.end(); vit!=vend; vit++)
         {
-            KeyFrame* pLKF = *sit;
-            if(pLKF->mnId<pKF->mnId)
+            KeyFrame* pLKF = *vit;
+            if(vpVertices[pLKF->mnId])
             {
                 g2o::Sim3 Swl;
 
@@ -7736,14 +8257,17 @@ void Optimizer::OptimizeEssentialGraph4DoF(Map* pMap, KeyFrame* pLoopKF, KeyFram
             }
         }
 
-        // 1.3 Covisibility graph edges
-        const vector<KeyFrame*> vpConnectedKFs = pKF->GetCovisiblesByWeight(minFeat);
+        // 1.3 Covisibility graph edges. There is no spanning tree edge here, so the parent is a covisible
+        // like any other
+        vector<KeyFrame*> vpConnectedKFs = edges.vpCovisibles;
+        if(edges.bParentCovisible)
+            vpConnectedKFs.push_back(edges.pParent);
         for(vector<KeyFrame*>::const_iterator vit=vpConnectedKFs.begin(); vit!=vpConnectedKFs.end(); vit++)
         {
             KeyFrame* pKFn = *vit;
-            if(pKFn && pKFn!=pParentKF && pKFn!=prevKF && pKFn!=pKF->mNextKF && !pKF->hasChild(pKFn) && !sLoopEdges.count(pKFn))
+            if(pKFn!=pParentKF && pKFn!=prevKF && pKFn!=pKF->mNextKF)
             {
-                if(!pKFn->isBad() && pKFn->mnId<pKF->mnId)
+                if(!pKFn->isBad() && vpVertices[pKFn->mnId])
                 {
                     if(sInsertedEdges.count(make_pair(min(pKF->mnId,pKFn->mnId),max(pKF->mnId,pKFn->mnId))))
                         continue;
@@ -7776,7 +8300,23 @@ void Optimizer::OptimizeEssentialGraph4DoF(Map* pMap, KeyFrame* pLoopKF, KeyFram
     optimizer.computeActiveErrors();
     optimizer.optimize(20);
 
-    unique_lock<mutex> lock(pMap->mMutexMapUpdate);
+    if(pOptimizedSim3)
+    {
+        for(size_t i=0;i<vpKFs.size();i++)
+        {
+            KeyFrame* pKFi = vpKFs[i];
+            if(pKFi->mnId>nMaxKFid || !vpVertices[pKFi->mnId])
+                continue;
+
+            VertexPose4DoF* Vi = vpVertices[pKFi->mnId];
+            (*pOptimizedSim3)[pKFi] = g2o::Sim3(Vi->estimate().Rcw[0],Vi->estimate().tcw[0],1.);
+            if(pInitialSim3)
+                (*pInitialSim3)[pKFi] = vScw[pKFi->mnId];
+        }
+        return;
+    }
+
+    unique_lock<MapUpdateMutex> lock(pMap->mMutexMapUpdate);
 
     // SE3 Pose Recovering. Sim3:[sR t;0 1] -> SE3:[R t/s;0 1]
     for(size_t i=0;i<vpKFs.size();i++)
@@ -7784,6 +8324,8 @@ void Optimizer::OptimizeEssentialGraph4DoF(Map* pMap, KeyFrame* pLoopKF, KeyFram
         KeyFrame* pKFi = vpKFs[i];
 
         const int nIDi = pKFi->mnId;
+        if(pKFi->mnId>nMaxKFid || !vpVertices[nIDi])
+            continue;
 
         VertexPose4DoF* Vi = static_cast<VertexPose4DoF*>(optimizer.vertex(nIDi));
         Eigen::Matrix3d Ri = Vi->estimate().Rcw[0];
@@ -7808,6 +8350,8 @@ void Optimizer::OptimizeEssentialGraph4DoF(Map* pMap, KeyFrame* pLoopKF, KeyFram
 
         KeyFrame* pRefKF = pMP->GetReferenceKeyFrame();
         nIDr = pRefKF->mnId;
+        if(nIDr>nMaxKFid || !vpVertices[nIDr])
+            continue;
 
         g2o::Sim3 Srw = vScw[nIDr];
         g2o::Sim3 correctedSwr = vCorrectedSwc[nIDr];
@@ -0,0 +1,243 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "OrbDescriptor.h"
+
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+namespace ORB_SLAM3
+{
+
+// The moments read 32 pixels per row, u in [-HALF_PATCH,HALF_PATCH+1]
+static const int HALF_PATCH = 15;
+static const int ROW_WIDTH = 32;
+
+void OrbDescriptor::Init(const std::vector<cv::Point> &pattern, const std::vector<int> &umax)
+{
+    CV_Assert(umax.size()==HALF_PATCH+1 && pattern.size()==512);
+
+    mvUMax = umax;
+
+    mvWeightU.assign((HALF_PATCH+1)*ROW_WIDTH, 0);
+    mvWeightV.assign((HALF_PATCH+1)*ROW_WIDTH, 0);
+    for(int v=0; v<=HALF_PATCH; v++)
+    {
+        for(int u=-umax[v]; u<=umax[v]; u++)
+        {
+            mvWeightU[v*ROW_WIDTH+u+HALF_PATCH] = u;
+            mvWeightV[v*ROW_WIDTH+u+HALF_PATCH] = v;
+        }
+    }
+
+    // Rotated as computeOrbDescriptor did for an angle at the center of the bin
+    mvRotatedPattern.resize(ANGLE_BINS*2*pattern.size());
+    for(int bin=0; bin<ANGLE_BINS; bin++)
+    {
+        const float angle = static_cast<float>(bin*2.0*CV_PI/ANGLE_BINS);
+        const float a = (float)cos(angle), b = (float)sin(angle);
+        signed char* pRotated = &mvRotatedPattern[bin*2*pattern.size()];
+        for(size_t i=0; i<pattern.size(); i++)
+        {
+            pRotated[2*i] = static_cast<signed char>(cvRound(pattern[i].x*a - pattern[i].y*b));
+            pRotated[2*i+1] = static_cast<signed char>(cvRound(pattern[i].x*b + pattern[i].y*a));
+        }
+    }
+}
+
+void OrbDescriptor::Moments(const unsigned char* pCenter, const int step, int &m01, int &m10) const
+{
+    const short* pWU = &mvWeightU[0];
+    const short* pWV = &mvWeightV[0];
+
+#if defined(__SSE2__)
+    const __m128i vZero = _mm_setzero_si128();
+    const unsigned char* pRow = pCenter-HALF_PATCH;
+
+    // Center line, v=0
+    __m128i acc10 = vZero, acc01 = vZero;
+    for(int k=0; k<ROW_WIDTH; k+=16)
+    {
+        const __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pRow+k));
+        acc10 = _mm_add_epi32(acc10, _mm_madd_epi16(_mm_unpacklo_epi8(p,vZero), _mm_loadu_si128(reinterpret_cast<const __m128i*>(pWU+k))));
+        acc10 = _mm_add_epi32(acc10, _mm_madd_epi16(_mm_unpackhi_epi8(p,vZero), _mm_loadu_si128(reinterpret_cast<const __m128i*>(pWU+k+8))));
+    }
+
+    // The two lines at +v and -v
+    for(int v=1; v<=HALF_PATCH; v++)
+    {
+        const unsigned char* pPlus = pRow+v*step;
+        const unsigned char* pMinus = pRow-v*step;
+        const short* pU = pWU+v*ROW_WIDTH;
+        const short* pV = pWV+v*ROW_WIDTH;
+        for(int k=0; k<ROW_WIDTH; k+=16)
+        {
+            const __m128i plus = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pPlus+k));
+            const __m128i minus = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pMinus+k));
+            const __m128i plusLo = _mm_unpacklo_epi8(plus,vZero), plusHi = _mm_unpackhi_epi8(plus,vZero);
+            const __m128i minusLo = _mm_unpacklo_epi8(minus,vZero), minusHi = _mm_unpackhi_epi8(minus,vZero);
+
+            acc10 = _mm_add_epi32(acc10, _mm_madd_epi16(_mm_add_epi16(plusLo,minusLo), _mm_loadu_si128(reinterpret_cast<const __m128i*>(pU+k))));
+            acc10 = _mm_add_epi32(acc10, _mm_madd_epi16(_mm_add_epi16(plusHi,minusHi), _mm_loadu_si128(reinterpret_cast<const __m128i*>(pU+k+8))));
+            acc01 = _mm_add_epi32(acc01, _mm_madd_epi16(_mm_sub_epi16(plusLo,minusLo), _mm_loadu_si128(reinterpret_cast<const __m128i*>(pV+k))));
+            acc01 = _mm_add_epi32(acc01, _mm_madd_epi16(_mm_sub_epi16(plusHi,minusHi), _mm_loadu_si128(reinterpret_cast<const __m128i*>(pV+k+8))));
+        }
+    }
+
+    int s10[4], s01[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(s10), acc10);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(s01), acc01);
+    m10 = s10[0]+s10[1]+s10[2]+s10[3];
+    m01 = s01[0]+s01[1]+s01[2]+s01[3];
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    const unsigned char* pRow = pCenter-HALF_PATCH;
+
+    int32x4_t acc10 = vdupq_n_s32(0), acc01 = vdupq_n_s32(0);
+    for(int k=0; k<ROW_WIDTH; k+=8)
+    {
+        const int16x8_t p = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(pRow+k)));
+        const int16x8_t w = vld1q_s16(pWU+k);
+        acc10 = vmlal_s16(acc10, vget_low_s16(p), vget_low_s16(w));
+        acc10 = vmlal_s16(acc10, vget_high_s16(p), vget_high_s16(w));
+    }
+
+    for(int v=1; v<=HALF_PATCH; v++)
+    {
+        const unsigned char* pPlus = pRow+v*step;
+        const unsigned char* pMinus = pRow-v*step;
+        const short* pU = pWU+v*ROW_WIDTH;
+        const short* pV = pWV+v*ROW_WIDTH;
+        for(int k=0; k<ROW_WIDTH; k+=8)
+        {
+            const int16x8_t plus = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(pPlus+k)));
+            const int16x8_t minus = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(pMinus+k)));
+            const int16x8_t sum = vaddq_s16(plus,minus);
+            const int16x8_t diff = vsubq_s16(plus,minus);
+            const int16x8_t wu = vld1q_s16(pU+k);
+            const int16x8_t wv = vld1q_s16(pV+k);
+            acc10 = vmlal_s16(acc10, vget_low_s16(sum), vget_low_s16(wu));
+            acc10 = vmlal_s16(acc10, vget_high_s16(sum), vget_high_s16(wu));
+            acc01 = vmlal_s16(acc01, vget_low_s16(diff), vget_low_s16(wv));
+            acc01 = vmlal_s16(acc01, vget_high_s16(diff), vget_high_s16(wv));
+        }
+    }
+
+    int s10[4], s01[4];
+    vst1q_s32(s10, acc10);
+    vst1q_s32(s01, acc01);
+    m10 = s10[0]+s10[1]+s10[2]+s10[3];
+    m01 = s01[0]+s01[1]+s01[2]+s01[3];
+#else
+    (void)pWU; (void)pWV;
+    m01 = 0;
+    m10 = 0;
+
+    // Treat the center line differently, v=0
+    for(int u=-HALF_PATCH; u<=HALF_PATCH; ++u)
+        m10 += u*pCenter[u];
+
+    // Go line by line in the circular patch
+    for(int v=1; v<=HALF_PATCH; ++v)
+    {
+        // Proceed over the two lines
+        int v_sum = 0;
+        const int d = mvUMax[v];
+        for(int u=-d; u<=d; ++u)
+        {
+            const int val_plus = pCenter[u + v*step], val_minus = pCenter[u - v*step];
+            v_sum += (val_plus - val_minus);
+            m10 += u*(val_plus + val_minus);
+        }
+        m01 += v*v_sum;
+    }
+#endif
+}
+
+void OrbDescriptor::ComputeOrientation(const cv::Mat &image, std::vector<cv::KeyPoint> &keypoints) const
+{
+    const int step = static_cast<int>(image.step1());
+    for(size_t i=0; i<keypoints.size(); i++)
+    {
+        cv::KeyPoint &kp = keypoints[i];
+        int m01, m10;
+        Moments(&image.at<uchar>(cvRound(kp.pt.y), cvRound(kp.pt.x)), step, m01, m10);
+        kp.angle = cv::fastAtan2(static_cast<float>(m01), static_cast<float>(m10));
+    }
+}
+
+void OrbDescriptor::ComputeDescriptors(const cv::Mat &image, const std::vector<cv::KeyPoint> &keypoints,
+                                       const std::vector<int> &vOutputRows, cv::Mat &descriptors) const
+{
+    const int step = static_cast<int>(image.step);
+    const int nBinPoints = mvRotatedPattern.size()/ANGLE_BINS;
+
+    for(size_t i=0; i<keypoints.size(); i++)
+    {
+        const cv::KeyPoint &kp = keypoints[i];
+        const unsigned char* pCenter = &image.at<uchar>(cvRound(kp.pt.y), cvRound(kp.pt.x));
+
+        int bin = cvRound(kp.angle*(ANGLE_BINS/360.f));
+        if(bin>=ANGLE_BINS)
+            bin -= ANGLE_BINS;
+        else if(bin<0)
+            bin += ANGLE_BINS;
+        const signed char* pPoint = &mvRotatedPattern[bin*nBinPoints];
+
+        uchar* desc = descriptors.ptr(vOutputRows[i]);
+
+        // 16 tests per step, test j of the step gives bit j%8 of byte 2*step+j/8
+        for(int s=0; s<16; s++)
+        {
+            unsigned char t0[16], t1[16];
+            for(int j=0; j<16; j++, pPoint+=4)
+            {
+                t0[j] = pCenter[pPoint[1]*step + pPoint[0]];
+                t1[j] = pCenter[pPoint[3]*step + pPoint[2]];
+            }
+
+            int bits;
+#if defined(__SSE2__)
+            // Unsigned t0<t1 as a signed comparison of the values shifted by 128
+            const __m128i vSign = _mm_set1_epi8(static_cast<char>(0x80));
+            const __m128i v0 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(t0)), vSign);
+            const __m128i v1 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(t1)), vSign);
+            bits = _mm_movemask_epi8(_mm_cmplt_epi8(v0,v1));
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+            static const uint8_t BIT[16] = {1,2,4,8,16,32,64,128,1,2,4,8,16,32,64,128};
+            const uint8x16_t vLess = vandq_u8(vcltq_u8(vld1q_u8(t0),vld1q_u8(t1)), vld1q_u8(BIT));
+            const uint8x8_t vPair = vpadd_u8(vget_low_u8(vLess),vget_high_u8(vLess));
+            const uint8x8_t vQuad = vpadd_u8(vPair,vPair);
+            const uint8x8_t vByte = vpadd_u8(vQuad,vQuad);
+            bits = vget_lane_u8(vByte,0) | (vget_lane_u8(vByte,1)<<8);
+#else
+            bits = 0;
+            for(int j=0; j<16; j++)
+                bits |= (t0[j]<t1[j]) << j;
+#endif
+            desc[2*s] = static_cast<uchar>(bits);
+            desc[2*s+1] = static_cast<uchar>(bits>>8);
+        }
+    }
+}
+
+} //namespace ORB_SLAM3
@@ -0,0 +1,90 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "PlaceRecognitionScheduler.h"
+#include "KeyFrame.h"
+
+namespace ORB_SLAM3
+{
+
+// Weight of the last measurement in the candidate cost
+static const double COST_SMOOTHING = 0.2;
+
+PlaceRecognitionScheduler::PlaceRecognitionScheduler(const float fBudget): mfBudget(fBudget), mCandidateCost(0.0), mbMeasured(false)
+{
+}
+
+bool PlaceRecognitionScheduler::ShouldCoalesce(const int nQueued) const
+{
+    if(nQueued<=1 || !mbMeasured)
+        return false;
+
+    return nQueued*NumCandidates()*mCandidateCost > mfBudget;
+}
+
+int PlaceRecognitionScheduler::SelectKeyFrame(const std::vector<KeyFrame*> &vpKFs, ORBVocabulary* pVoc) const
+{
+    if(mLastBowVec.empty())
+        return vpKFs.size()-1;
+
+    // Ties go to the newest keyframe
+    const bool bL1 = pVoc->getScoringType()==DBoW2::L1_NORM;
+    int nBest = vpKFs.size()-1;
+    float bestScore = 1.f;
+    for(int i=vpKFs.size()-1; i>=0; i--)
+    {
+        int nCommonWords;
+        const float score = bL1 ? FlatBowVector::L1Score(vpKFs[i]->mFlatBowVec, mLastFlatBowVec, nCommonWords)
+                                : pVoc->score(vpKFs[i]->mBowVec, mLastBowVec);
+        if(score < bestScore)
+        {
+            bestScore = score;
+            nBest = i;
+        }
+    }
+    return nBest;
+}
+
+int PlaceRecognitionScheduler::NumCandidates() const
+{
+    if(!mbMeasured || mCandidateCost<=0.0)
+        return MAX_CANDIDATES;
+
+    const int n = mfBudget/mCandidateCost;
+    return n<1 ? 1 : (n>MAX_CANDIDATES ? MAX_CANDIDATES : n);
+}
+
+void PlaceRecognitionScheduler::Record(KeyFrame* pKF, const int nCandidates, const Clock::time_point &tStart)
+{
+    mLastBowVec = pKF->mBowVec;
+    mLastFlatBowVec = pKF->mFlatBowVec;
+
+    if(nCandidates<=0)
+        return;
+
+    const double ms = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(Clock::now() - tStart).count()/nCandidates;
+    if(!mbMeasured)
+    {
+        mCandidateCost = ms;
+        mbMeasured = true;
+    }
+    else
+        mCandidateCost = (1.0-COST_SMOOTHING)*mCandidateCost + COST_SMOOTHING*ms;
+}
+
+} //namespace ORB_SLAM
@@ -0,0 +1,352 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "PoseSolver.h"
+#include "CameraModels/CameraProjection.h"
+
+#include <Eigen/Dense>
+
+#include <cmath>
+#include <limits>
+
+namespace ORB_SLAM3
+{
+
+void PoseSolver::ExpSE3(const Vector6d &update, Eigen::Matrix3d &R, Eigen::Vector3d &t)
+{
+    const Eigen::Vector3d omega = update.head<3>();
+    const Eigen::Vector3d upsilon = update.tail<3>();
+
+    const double theta = omega.norm();
+    Eigen::Matrix3d Omega;
+    Omega << 0.0, -omega[2], omega[1],
+             omega[2], 0.0, -omega[0],
+             -omega[1], omega[0], 0.0;
+    const Eigen::Matrix3d Omega2 = Omega*Omega;
+
+    Eigen::Matrix3d V;
+    if(theta<1e-5)
+    {
+        R = Eigen::Matrix3d::Identity() + Omega + 0.5*Omega2;
+        V = Eigen::Matrix3d::Identity() + 0.5*Omega;
+    }
+    else
+    {
+        const double theta2 = theta*theta;
+        R = Eigen::Matrix3d::Identity() + sin(theta)/theta*Omega + (1.0-cos(theta))/theta2*Omega2;
+        V = Eigen::Matrix3d::Identity() + (1.0-cos(theta))/theta2*Omega + (theta-sin(theta))/(theta2*theta)*Omega2;
+    }
+
+    t = V*upsilon;
+}
+
+PoseSolver::PoseSolver(): mpCamera(NULL), mpCamera2(NULL), mRrl(Eigen::Matrix3d::Identity()),
+    mtrl(Eigen::Vector3d::Zero()), mfx(0), mfy(0), mcx(0), mcy(0), mbf(0), mDeltaMono(0), mDeltaStereo(0),
+    mbRobust(true), mMinRelativeDecrease(0), mMinUpdateNorm(0)
+{
+}
+
+void PoseSolver::Reset(GeometricCamera* pCamera, GeometricCamera* pCamera2,
+                       const Eigen::Matrix3d &Rrl, const Eigen::Vector3d &trl,
+                       const double fx, const double fy, const double cx, const double cy, const double bf,
+                       const double deltaMono, const double deltaStereo)
+{
+    mpCamera = pCamera;
+    mpCamera2 = pCamera2;
+    mRrl = Rrl;
+    mtrl = trl;
+    mfx = fx; mfy = fy; mcx = cx; mcy = cy; mbf = bf;
+    mDeltaMono = deltaMono;
+    mDeltaStereo = deltaStereo;
+    mbRobust = true;
+
+    // clear() keeps the capacity
+    mvpRigCameras.clear(); mvRigRcb.clear(); mvRigtcb.clear();
+    mvType.clear(); mvRigCamera.clear(); mvbActive.clear();
+    mvXw.clear(); mvYw.clear(); mvZw.clear();
+    mvU.clear(); mvV.clear(); mvUr.clear();
+    mvInfo.clear(); mvChi2.clear();
+}
+
+int PoseSolver::AddObservation(const eObsType type, const Eigen::Vector3d &Xw, const double u, const double v, const double ur,
+                               const double invSigma2)
+{
+    mvType.push_back(type);
+    mvRigCamera.push_back(-1);
+    mvbActive.push_back(true);
+    mvXw.push_back(Xw[0]); mvYw.push_back(Xw[1]); mvZw.push_back(Xw[2]);
+    mvU.push_back(u); mvV.push_back(v); mvUr.push_back(ur);
+    mvInfo.push_back(invSigma2);
+    mvChi2.push_back(0.0);
+
+    return mvType.size()-1;
+}
+
+int PoseSolver::AddRigCamera(GeometricCamera* pCamera, const Eigen::Matrix3d &Rcb, const Eigen::Vector3d &tcb)
+{
+    mvpRigCameras.push_back(pCamera);
+    mvRigRcb.push_back(Rcb);
+    mvRigtcb.push_back(tcb);
+    return mvpRigCameras.size()-1;
+}
+
+int PoseSolver::AddRigObservation(const int nRigCamera, const Eigen::Vector3d &Xw, const double u, const double v, const double invSigma2)
+{
+    const int i = AddObservation(MONO_RIG, Xw, u, v, 0.0, invSigma2);
+    mvRigCamera[i] = nRigCamera;
+    return i;
+}
+
+void PoseSolver::TransformPoints(const Eigen::Matrix3d &Rcw, const Eigen::Vector3d &tcw)
+{
+    const size_t N = mvXw.size();
+    mvXc.resize(N); mvYc.resize(N); mvZc.resize(N);
+
+    const double r00 = Rcw(0,0), r01 = Rcw(0,1), r02 = Rcw(0,2);
+    const double r10 = Rcw(1,0), r11 = Rcw(1,1), r12 = Rcw(1,2);
+    const double r20 = Rcw(2,0), r21 = Rcw(2,1), r22 = Rcw(2,2);
+    const double t0 = tcw[0], t1 = tcw[1], t2 = tcw[2];
+
+    const double* pX = mvXw.data();
+    const double* pY = mvYw.data();
+    const double* pZ = mvZw.data();
+    double* pXc = mvXc.data();
+    double* pYc = mvYc.data();
+    double* pZc = mvZc.data();
+
+    // Plain loop over the arrays so that the compiler can vectorize it
+    for(size_t i=0; i<N; i++)
+    {
+        pXc[i] = r00*pX[i] + r01*pY[i] + r02*pZ[i] + t0;
+        pYc[i] = r10*pX[i] + r11*pY[i] + r12*pZ[i] + t1;
+        pZc[i] = r20*pX[i] + r21*pY[i] + r22*pZ[i] + t2;
+    }
+}
+
+void PoseSolver::Residual(const int i, Eigen::Vector3d &e, Eigen::Matrix<double,3,6>* pJ) const
+{
+    const Eigen::Vector3d Xc(mvXc[i], mvYc[i], mvZc[i]);
+
+    Eigen::Matrix<double,3,6> SE3deriv;
+    if(pJ)
+    {
+        SE3deriv << 0.0, Xc[2], -Xc[1], 1.0, 0.0, 0.0,
+                    -Xc[2], 0.0, Xc[0], 0.0, 1.0, 0.0,
+                    Xc[1], -Xc[0], 0.0, 0.0, 0.0, 1.0;
+    }
+
+    switch(mvType[i])
+    {
+    case MONO:
+    {
+        e.head<2>() = Eigen::Vector2d(mvU[i], mvV[i]) - CameraProject<GeometricCamera>(mpCamera, Xc);
+        e[2] = 0.0;
+        if(pJ)
+        {
+            pJ->topRows<2>() = -CameraProjectJac<GeometricCamera>(mpCamera, Xc)*SE3deriv;
+            pJ->row(2).setZero();
+        }
+        break;
+    }
+    case MONO_RIGHT:
+    {
+        const Eigen::Vector3d Xr = mRrl*Xc + mtrl;
+        e.head<2>() = Eigen::Vector2d(mvU[i], mvV[i]) - CameraProject<GeometricCamera>(mpCamera2, Xr);
+        e[2] = 0.0;
+        if(pJ)
+        {
+            pJ->topRows<2>() = -CameraProjectJac<GeometricCamera>(mpCamera2, Xr)*mRrl*SE3deriv;
+            pJ->row(2).setZero();
+        }
+        break;
+    }
+    case MONO_RIG:
+    {
+        const int c = mvRigCamera[i];
+        const Eigen::Vector3d Xr = mvRigRcb[c]*Xc + mvRigtcb[c];
+        e.head<2>() = Eigen::Vector2d(mvU[i], mvV[i]) - CameraProject<GeometricCamera>(mvpRigCameras[c], Xr);
+        e[2] = 0.0;
+        if(pJ)
+        {
+            pJ->topRows<2>() = -CameraProjectJac<GeometricCamera>(mvpRigCameras[c], Xr)*mvRigRcb[c]*SE3deriv;
+            pJ->row(2).setZero();
+        }
+        break;
+    }
+    case STEREO:
+    {
+        const double invz = 1.0/Xc[2];
+        const double u = mfx*Xc[0]*invz + mcx;
+        e << mvU[i] - u, mvV[i] - (mfy*Xc[1]*invz + mcy), mvUr[i] - (u - mbf*invz);
+        if(pJ)
+        {
+            const double invz2 = invz*invz;
+            Eigen::Matrix3d projJac;
+            projJac << mfx*invz, 0.0, -mfx*Xc[0]*invz2,
+                       0.0, mfy*invz, -mfy*Xc[1]*invz2,
+                       mfx*invz, 0.0, (mbf-mfx*Xc[0])*invz2;
+            *pJ = -projJac*SE3deriv;
+        }
+        break;
+    }
+    }
+}
+
+double PoseSolver::Robustify(const double chi2, const double delta, double &w) const
+{
+    // Huber, as g2o::RobustKernelHuber (only the first derivative weights the system)
+    if(!mbRobust || chi2<=delta*delta)
+    {
+        w = 1.0;
+        return chi2;
+    }
+
+    const double sqrte = sqrt(chi2);
+    w = delta/sqrte;
+    return 2.0*sqrte*delta - delta*delta;
+}
+
+double PoseSolver::Linearize(Matrix6d* pH, Vector6d* pg)
+{
+    double cost = 0.0;
+    Eigen::Vector3d e;
+    Eigen::Matrix<double,3,6> J;
+
+    const int N = mvType.size();
+    for(int i=0; i<N; i++)
+    {
+        if(!mvbActive[i])
+            continue;
+
+        Residual(i, e, pH ? &J : NULL);
+
+        const double chi2 = mvInfo[i]*e.squaredNorm();
+        double w;
+        cost += Robustify(chi2, mvType[i]==STEREO ? mDeltaStereo : mDeltaMono, w);
+
+        if(pH)
+        {
+            const double wi = w*mvInfo[i];
+            pH->noalias() += wi*J.transpose()*J;
+            pg->noalias() += wi*J.transpose()*e;
+        }
+    }
+
+    return cost;
+}
+
+void PoseSolver::ComputeChi2()
+{
+    Eigen::Vector3d e;
+    const int N = mvType.size();
+    for(int i=0; i<N; i++)
+    {
+        Residual(i, e, NULL);
+        mvChi2[i] = mvInfo[i]*e.squaredNorm();
+    }
+}
+
+int PoseSolver::Optimize(Eigen::Matrix3d &Rcw, Eigen::Vector3d &tcw, const int nIterations)
+{
+    int nActive = 0;
+    for(size_t i=0; i<mvbActive.size(); i++)
+        if(mvbActive[i])
+            nActive++;
+
+    // Levenberg-Marquardt as g2o::OptimizationAlgorithmLevenberg
+    const int maxTrialsAfterFailure = 10;
+    double lambda = 0.0;
+    double ni = 2.0;
+
+    int nIterationsRun = 0;
+    for(int iter=0; iter<nIterations && nActive>0; iter++)
+    {
+        nIterationsRun++;
+        TransformPoints(Rcw, tcw);
+
+        Matrix6d H = Matrix6d::Zero();
+        Vector6d g = Vector6d::Zero();
+        double currentChi = Linearize(&H, &g);
+
+        if(iter==0)
+        {
+            lambda = 1e-5*H.diagonal().maxCoeff();
+            ni = 2.0;
+        }
+
+        const double iniChi = currentChi;
+        double updateNorm = 0.0;
+        double rho = 0.0;
+        int qmax = 0;
+        do
+        {
+            qmax++;
+
+            Matrix6d Hl = H;
+            Hl.diagonal().array() += lambda;
+            const Vector6d dx = Hl.ldlt().solve(-g);
+
+            Eigen::Matrix3d Rexp;
+            Eigen::Vector3d texp;
+            ExpSE3(dx, Rexp, texp);
+            const Eigen::Quaterniond q = Eigen::Quaterniond(Rexp*Rcw).normalized();
+            const Eigen::Matrix3d Rnew = q.toRotationMatrix();
+            const Eigen::Vector3d tnew = Rexp*tcw + texp;
+
+            TransformPoints(Rnew, tnew);
+            double tempChi = Linearize(NULL, NULL);
+            if(!std::isfinite(tempChi))
+                tempChi = std::numeric_limits<double>::max();
+
+            const double scale = dx.dot(lambda*dx - g) + 1e-3;
+            rho = (currentChi - tempChi)/scale;
+
+            if(rho>0 && std::isfinite(tempChi))
+            {
+                const double alpha = std::min(1.0 - pow(2.0*rho - 1.0, 3), 2.0/3.0);
+                lambda *= std::max(1.0/3.0, alpha);
+                ni = 2.0;
+                currentChi = tempChi;
+                Rcw = Rnew;
+                tcw = tnew;
+                updateNorm = dx.norm();
+            }
+            else
+            {
+                lambda *= ni;
+                ni *= 2.0;
+            }
+        }
+        while(rho<0 && qmax<maxTrialsAfterFailure);
+
+        if(qmax==maxTrialsAfterFailure || rho==0)
+            break;
+
+        // Converged: the accepted step barely changed the cost or the pose
+        if((mMinRelativeDecrease>0 && iniChi-currentChi<mMinRelativeDecrease*iniChi) ||
+           (mMinUpdateNorm>0 && updateNorm<mMinUpdateNorm))
+            break;
+    }
+
+    TransformPoints(Rcw, tcw);
+    ComputeChi2();
+
+    return nIterationsRun;
+}
+
+} //namespace ORB_SLAM3
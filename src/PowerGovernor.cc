@@ -0,0 +1,82 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "PowerGovernor.h"
+
+#include <algorithm>
+#include <time.h>
+
+namespace ORB_SLAM3
+{
+
+// Weight of the last frame in the averaged CPU time
+static const double TIME_SMOOTHING = 0.1;
+// Frames to wait after a change, so that the average reflects it
+static const int LEVEL_HOLD = 20;
+// Spare time needed to go down a level
+static const double LOWER_MARGIN = 1.5;
+
+PowerGovernor::PowerGovernor(const float fBudget, const int nMaxLevel, const float fMaxDelay):
+    mfBudget(fBudget), mnMaxLevel(std::max(nMaxLevel,0)), mfMaxDelay(fMaxDelay), mLastCpuTime(ProcessCpuTime()),
+    mFrameCpuTime(0.0), mbMeasured(false), mnHold(LEVEL_HOLD), mnLevel(std::min(1,mnMaxLevel))
+{
+}
+
+double PowerGovernor::ProcessCpuTime()
+{
+    timespec ts;
+    if(clock_gettime(CLOCK_PROCESS_CPUTIME_ID,&ts)!=0)
+        return 0.0;
+    return ts.tv_sec*1e3 + ts.tv_nsec*1e-6;
+}
+
+void PowerGovernor::Update()
+{
+    const double cpuTime = ProcessCpuTime();
+    const double frameMs = cpuTime-mLastCpuTime;
+    mLastCpuTime = cpuTime;
+
+    if(!mbMeasured)
+    {
+        mFrameCpuTime = frameMs;
+        mbMeasured = true;
+    }
+    else
+        mFrameCpuTime = (1.0-TIME_SMOOTHING)*mFrameCpuTime + TIME_SMOOTHING*frameMs;
+
+    if(mnHold>0)
+    {
+        mnHold--;
+        return;
+    }
+
+    int nLevel = mnLevel.load(std::memory_order_relaxed);
+    if(mFrameCpuTime>mfBudget && nLevel<mnMaxLevel)
+    {
+        nLevel++;
+        mnHold = LEVEL_HOLD;
+    }
+    else if(mFrameCpuTime*LOWER_MARGIN<mfBudget && nLevel>0)
+    {
+        nLevel--;
+        mnHold = LEVEL_HOLD;
+    }
+    mnLevel.store(nLevel, std::memory_order_relaxed);
+}
+
+} //namespace ORB_SLAM
@@ -0,0 +1,292 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "PyramidBuilder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+namespace ORB_SLAM3
+{
+
+// Bilinear weights in 11 bits (INTER_RESIZE_COEF_BITS of OpenCV)
+static const int RESIZE_ONE = 2048;
+
+// 7 tap Gaussian, sigma 2, in 8 bits (sum 256)
+static const int BLUR_RADIUS = 3;
+static const int BLUR_ROWS = 2*BLUR_RADIUS+1;
+static const unsigned short BLUR_KERNEL[BLUR_ROWS] = {18, 33, 49, 56, 49, 33, 18};
+
+static inline int Reflect101(const int i, const int n)
+{
+    return i<0 ? -i : (i>=n ? 2*n-2-i : i);
+}
+
+int PyramidBuilder::ResizedRow(const unsigned char* pSrc, const size_t srcStep, const int sy, const int dw, const int avoidSlot)
+{
+    if(mnResizedRow[0]==sy)
+        return 0;
+    if(mnResizedRow[1]==sy)
+        return 1;
+
+    int slot;
+    if(avoidSlot>=0)
+        slot = 1-avoidSlot;
+    else
+        slot = mnResizedRow[0]<=mnResizedRow[1] ? 0 : 1;
+
+    const unsigned char* S = pSrc+sy*srcStep;
+    short* D = &mvResizedRows[slot*dw];
+    const int* pOffset = &mvXOffset[0];
+    const short* pAlpha = &mvXAlpha[0];
+    for(int dx=0; dx<dw; dx++)
+    {
+        const int sx = pOffset[dx];
+        D[dx] = static_cast<short>((S[sx]*pAlpha[2*dx] + S[sx+1]*pAlpha[2*dx+1])>>4);
+    }
+
+    mnResizedRow[slot] = sy;
+    return slot;
+}
+
+void PyramidBuilder::BlurRowHorizontal(const unsigned char* pRow, const int w, unsigned short* pOut)
+{
+    int x = 0;
+
+    // The kernel is symmetric, pixels at the same distance are added first
+#if defined(__SSE2__)
+    const __m128i vZero = _mm_setzero_si128();
+    const __m128i k0 = _mm_set1_epi16(BLUR_KERNEL[0]);
+    const __m128i k1 = _mm_set1_epi16(BLUR_KERNEL[1]);
+    const __m128i k2 = _mm_set1_epi16(BLUR_KERNEL[2]);
+    const __m128i k3 = _mm_set1_epi16(BLUR_KERNEL[3]);
+    for(; x+16<=w; x+=16)
+    {
+        const unsigned char* p = pRow+x;
+        __m128i v[BLUR_ROWS];
+        for(int t=0; t<BLUR_ROWS; t++)
+            v[t] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p+t-BLUR_RADIUS));
+
+        __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(v[3],vZero),k3);
+        __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(v[3],vZero),k3);
+        lo = _mm_add_epi16(lo,_mm_mullo_epi16(_mm_add_epi16(_mm_unpacklo_epi8(v[2],vZero),_mm_unpacklo_epi8(v[4],vZero)),k2));
+        hi = _mm_add_epi16(hi,_mm_mullo_epi16(_mm_add_epi16(_mm_unpackhi_epi8(v[2],vZero),_mm_unpackhi_epi8(v[4],vZero)),k2));
+        lo = _mm_add_epi16(lo,_mm_mullo_epi16(_mm_add_epi16(_mm_unpacklo_epi8(v[1],vZero),_mm_unpacklo_epi8(v[5],vZero)),k1));
+        hi = _mm_add_epi16(hi,_mm_mullo_epi16(_mm_add_epi16(_mm_unpackhi_epi8(v[1],vZero),_mm_unpackhi_epi8(v[5],vZero)),k1));
+        lo = _mm_add_epi16(lo,_mm_mullo_epi16(_mm_add_epi16(_mm_unpacklo_epi8(v[0],vZero),_mm_unpacklo_epi8(v[6],vZero)),k0));
+        hi = _mm_add_epi16(hi,_mm_mullo_epi16(_mm_add_epi16(_mm_unpackhi_epi8(v[0],vZero),_mm_unpackhi_epi8(v[6],vZero)),k0));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pOut+x),lo);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pOut+x+8),hi);
+    }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    for(; x+8<=w; x+=8)
+    {
+        const unsigned char* p = pRow+x;
+        uint16x8_t acc = vmulq_n_u16(vmovl_u8(vld1_u8(p)),BLUR_KERNEL[3]);
+        acc = vmlaq_n_u16(acc,vaddl_u8(vld1_u8(p-1),vld1_u8(p+1)),BLUR_KERNEL[2]);
+        acc = vmlaq_n_u16(acc,vaddl_u8(vld1_u8(p-2),vld1_u8(p+2)),BLUR_KERNEL[1]);
+        acc = vmlaq_n_u16(acc,vaddl_u8(vld1_u8(p-3),vld1_u8(p+3)),BLUR_KERNEL[0]);
+        vst1q_u16(pOut+x,acc);
+    }
+#endif
+
+    for(; x<w; x++)
+    {
+        const unsigned char* p = pRow+x;
+        pOut[x] = static_cast<unsigned short>(p[0]*BLUR_KERNEL[3] + (p[-1]+p[1])*BLUR_KERNEL[2] +
+                                              (p[-2]+p[2])*BLUR_KERNEL[1] + (p[-3]+p[3])*BLUR_KERNEL[0]);
+    }
+}
+
+void PyramidBuilder::BlurRowVertical(const unsigned short* const* pRows, const int w, unsigned char* pOut)
+{
+    int x = 0;
+
+    // Rows hold up to 255*256, every term is (row*kernel)>>8 truncated, the sum is rounded
+#if defined(__SSE2__)
+    __m128i k[BLUR_ROWS];
+    for(int t=0; t<BLUR_ROWS; t++)
+        k[t] = _mm_set1_epi16(static_cast<short>(BLUR_KERNEL[t]<<8));
+    const __m128i vHalf = _mm_set1_epi16(128);
+    for(; x+16<=w; x+=16)
+    {
+        __m128i lo = vHalf, hi = vHalf;
+        for(int t=0; t<BLUR_ROWS; t++)
+        {
+            lo = _mm_add_epi16(lo,_mm_mulhi_epu16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pRows[t]+x)),k[t]));
+            hi = _mm_add_epi16(hi,_mm_mulhi_epu16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pRows[t]+x+8)),k[t]));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pOut+x),_mm_packus_epi16(_mm_srli_epi16(lo,8),_mm_srli_epi16(hi,8)));
+    }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    for(; x+8<=w; x+=8)
+    {
+        uint16x8_t acc = vdupq_n_u16(128);
+        for(int t=0; t<BLUR_ROWS; t++)
+        {
+            const uint16x8_t r = vld1q_u16(pRows[t]+x);
+            const uint16_t kt = BLUR_KERNEL[t]<<8;
+            acc = vaddq_u16(acc,vcombine_u16(vshrn_n_u32(vmull_n_u16(vget_low_u16(r),kt),16),
+                                             vshrn_n_u32(vmull_n_u16(vget_high_u16(r),kt),16)));
+        }
+        vst1_u8(pOut+x,vmovn_u16(vshrq_n_u16(acc,8)));
+    }
+#endif
+
+    for(; x<w; x++)
+    {
+        unsigned int sum = 128;
+        for(int t=0; t<BLUR_ROWS; t++)
+            sum += (static_cast<unsigned int>(pRows[t][x])*(BLUR_KERNEL[t]<<8))>>16;
+        pOut[x] = static_cast<unsigned char>(sum>>8);
+    }
+}
+
+void PyramidBuilder::Build(const unsigned char* pSrc, const size_t srcStep, const int sw, const int sh,
+                           unsigned char* pDst, const size_t dstStep, const int dw, const int dh, const int border,
+                           unsigned char* pBlur, const size_t blurStep, PyramidRowSource* pRowSource)
+{
+    const bool bResize = sw!=dw || sh!=dh;
+    double scaleY = 0;
+    if(bResize)
+    {
+        // Source positions as cv::resize, the last column always has a pixel to its right
+        const double scaleX = 1.0/(static_cast<double>(dw)/sw);
+        scaleY = 1.0/(static_cast<double>(dh)/sh);
+        mvXOffset.resize(dw);
+        mvXAlpha.resize(2*dw);
+        for(int dx=0; dx<dw; dx++)
+        {
+            float fx = static_cast<float>((dx+0.5)*scaleX-0.5);
+            int sx = static_cast<int>(std::floor(fx));
+            fx -= sx;
+            if(sx<0)
+            {
+                fx = 0;
+                sx = 0;
+            }
+            if(sx>=sw-1)
+            {
+                fx = 1.f;
+                sx = sw-2;
+            }
+            mvXOffset[dx] = sx;
+            mvXAlpha[2*dx] = static_cast<short>(lrintf((1.f-fx)*RESIZE_ONE));
+            mvXAlpha[2*dx+1] = static_cast<short>(lrintf(fx*RESIZE_ONE));
+        }
+        mvResizedRows.resize(2*dw);
+        mnResizedRow[0] = mnResizedRow[1] = -1;
+    }
+
+    mvBlurRows.resize(BLUR_ROWS*dw);
+    const unsigned short* pBlurRows[BLUR_ROWS];
+
+    for(int y=0; y<dh+BLUR_RADIUS; y++)
+    {
+        if(y<dh)
+        {
+            unsigned char* pRow = pDst+y*dstStep;
+            if(bResize)
+            {
+                const float fy = static_cast<float>((y+0.5)*scaleY-0.5);
+                const int sy = static_cast<int>(std::floor(fy));
+                const short b1 = static_cast<short>(lrintf((fy-sy)*RESIZE_ONE));
+                const short b0 = static_cast<short>(lrintf((1.f-(fy-sy))*RESIZE_ONE));
+                const int slot0 = ResizedRow(pSrc,srcStep,std::min(std::max(sy,0),sh-1),dw,-1);
+                const int slot1 = ResizedRow(pSrc,srcStep,std::min(std::max(sy+1,0),sh-1),dw,slot0);
+                const short* S0 = &mvResizedRows[slot0*dw];
+                const short* S1 = &mvResizedRows[slot1*dw];
+
+                // ((S0*b0)>>16 + (S1*b1)>>16 + 2)>>2, as the SIMD path of cv::resize
+                int x = 0;
+#if defined(__SSE2__)
+                const __m128i vb0 = _mm_set1_epi16(b0), vb1 = _mm_set1_epi16(b1);
+                const __m128i vTwo = _mm_set1_epi16(2);
+                for(; x+16<=dw; x+=16)
+                {
+                    __m128i lo = _mm_add_epi16(_mm_mulhi_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(S0+x)),vb0),
+                                               _mm_mulhi_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(S1+x)),vb1));
+                    __m128i hi = _mm_add_epi16(_mm_mulhi_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(S0+x+8)),vb0),
+                                               _mm_mulhi_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(S1+x+8)),vb1));
+                    lo = _mm_srai_epi16(_mm_add_epi16(lo,vTwo),2);
+                    hi = _mm_srai_epi16(_mm_add_epi16(hi,vTwo),2);
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(pRow+x),_mm_packus_epi16(lo,hi));
+                }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+                for(; x+8<=dw; x+=8)
+                {
+                    const int16x8_t s0 = vld1q_s16(S0+x), s1 = vld1q_s16(S1+x);
+                    const int16x4_t lo = vadd_s16(vshrn_n_s32(vmull_n_s16(vget_low_s16(s0),b0),16),
+                                                  vshrn_n_s32(vmull_n_s16(vget_low_s16(s1),b1),16));
+                    const int16x4_t hi = vadd_s16(vshrn_n_s32(vmull_n_s16(vget_high_s16(s0),b0),16),
+                                                  vshrn_n_s32(vmull_n_s16(vget_high_s16(s1),b1),16));
+                    vst1_u8(pRow+x,vqmovun_s16(vshrq_n_s16(vaddq_s16(vcombine_s16(lo,hi),vdupq_n_s16(2)),2)));
+                }
+#endif
+                for(; x<dw; x++)
+                {
+                    const int v = (((S0[x]*b0)>>16) + ((S1[x]*b1)>>16) + 2)>>2;
+                    pRow[x] = static_cast<unsigned char>(std::min(std::max(v,0),255));
+                }
+            }
+            else if(pRowSource)
+            {
+                pRowSource->GetRow(y,pRow);
+            }
+            else
+            {
+                memcpy(pRow,pSrc+y*srcStep,dw);
+            }
+
+            for(int k=1; k<=border; k++)
+            {
+                pRow[-k] = pRow[k];
+                pRow[dw-1+k] = pRow[dw-1-k];
+            }
+
+            BlurRowHorizontal(pRow,dw,&mvBlurRows[(y%BLUR_ROWS)*dw]);
+        }
+
+        // Vertical blur of the row BLUR_RADIUS above, all its rows are in the ring
+        const int yb = y-BLUR_RADIUS;
+        if(yb>=0)
+        {
+            for(int t=0; t<BLUR_ROWS; t++)
+                pBlurRows[t] = &mvBlurRows[(Reflect101(yb+t-BLUR_RADIUS,dh)%BLUR_ROWS)*dw];
+            BlurRowVertical(pBlurRows,dw,pBlur+yb*blurStep);
+        }
+    }
+
+    // Top and bottom borders, corners included
+    const size_t rowBytes = dw+2*border;
+    for(int k=1; k<=border; k++)
+    {
+        memcpy(pDst-k*dstStep-border, pDst+k*dstStep-border, rowBytes);
+        memcpy(pDst+(dh-1+k)*dstStep-border, pDst+(dh-1-k)*dstStep-border, rowBytes);
+    }
+}
+
+} //namespace ORB_SLAM3
@@ -0,0 +1,168 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "RansacSampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "Thirdparty/DBoW2/DUtils/Random.h"
+
+namespace ORB_SLAM3
+{
+
+// Initial probability of a correspondence being consistent with a bad hypothesis
+static const double SPRT_INITIAL_DELTA = 0.05;
+
+RansacSampler::RansacSampler(): mSampling(UNIFORM), mbSPRT(false), N(0), mnMinSet(0), mnSubset(0), mnSamples(0),
+    mdEpsilon(0), mdDelta(0), mdA(std::numeric_limits<double>::max()), mdModelCost(0), mdDeltaThreshold(0),
+    mdSumDelta(0), mnRejected(0)
+{
+}
+
+void RansacSampler::Configure(eSampling sampling, bool bSPRT, const std::vector<float> &vQuality, int nMinSet, int nMaxIts,
+                              float epsilon, float modelCost)
+{
+    mSampling = sampling;
+    mbSPRT = bSPRT;
+    N = vQuality.size();
+    mnMinSet = nMinSet;
+    mnSamples = 0;
+
+    mvOrder.resize(N);
+    for(int i=0; i<N; i++)
+        mvOrder[i] = i;
+    mvSequence = mvOrder;
+
+    if(N<mnMinSet)
+    {
+        mSampling = UNIFORM;
+        mbSPRT = false;
+        return;
+    }
+
+    if(mSampling==PROSAC)
+    {
+        std::stable_sort(mvOrder.begin(),mvOrder.end(),[&vQuality](size_t a, size_t b){return vQuality[a]<vQuality[b];});
+
+        // T_n: expected number of samples drawn only from the n best correspondences out of nMaxIts samples.
+        // T'_n is the sample at which the subset grows to n, T'_{n+1} = T'_n + ceil(T_{n+1} - T_n)
+        mvGrowth.assign(N+1,0);
+        double Tn = std::max(nMaxIts,1);
+        for(int i=0; i<mnMinSet; i++)
+            Tn *= static_cast<double>(mnMinSet-i)/(N-i);
+
+        mvGrowth[mnMinSet] = 1;
+        for(int n=mnMinSet; n<N; n++)
+        {
+            const double Tn1 = Tn*(n+1)/(n+1-mnMinSet);
+            mvGrowth[n+1] = mvGrowth[n] + static_cast<int>(std::ceil(Tn1-Tn));
+            Tn = Tn1;
+        }
+        mnSubset = mnMinSet;
+    }
+
+    if(mbSPRT)
+    {
+        mvVerificationOrder = mvOrder;
+        for(int i=N-1; i>0; i--)
+            std::swap(mvVerificationOrder[i],mvVerificationOrder[DUtils::Random::RandomInt(0,i)]);
+
+        mdEpsilon = std::min(std::max(static_cast<double>(epsilon),0.1),0.99);
+        mdDelta = SPRT_INITIAL_DELTA;
+        mdModelCost = modelCost;
+        mdSumDelta = 0;
+        mnRejected = 0;
+        ComputeThreshold();
+    }
+}
+
+void RansacSampler::Sample(std::vector<size_t> &vSample)
+{
+    vSample.clear();
+    mnSamples++;
+
+    int nPool = N;
+    if(mSampling==PROSAC)
+    {
+        while(mnSubset<N && mvGrowth[mnSubset+1]<=mnSamples)
+            mnSubset++;
+
+        // Until every correspondence is available, each sample holds the last one added to the subset
+        if(mnSubset<N)
+        {
+            vSample.push_back(mvOrder[mnSubset-1]);
+            nPool = mnSubset-1;
+        }
+    }
+
+    // The minimal sets are small, so duplicates are rejected rather than shuffling an index pool
+    while(static_cast<int>(vSample.size())<mnMinSet)
+    {
+        const size_t idx = mvOrder[DUtils::Random::RandomInt(0,nPool-1)];
+        if(std::find(vSample.begin(),vSample.end(),idx)==vSample.end())
+            vSample.push_back(idx);
+    }
+}
+
+void RansacSampler::RejectHypothesis(int nConsistent, int nTested)
+{
+    // delta is re-estimated from the rejected (bad) hypotheses
+    mdSumDelta += static_cast<double>(nConsistent)/nTested;
+    mnRejected++;
+
+    const double delta = std::max(mdSumDelta/mnRejected,0.01);
+    if(std::fabs(delta-mdDeltaThreshold)>0.1*mdDeltaThreshold)
+    {
+        mdDelta = delta;
+        ComputeThreshold();
+    }
+}
+
+void RansacSampler::AcceptHypothesis(int nInliers)
+{
+    // epsilon follows the best hypothesis found so far
+    const double epsilon = static_cast<double>(nInliers)/N;
+    if(epsilon>mdEpsilon)
+    {
+        mdEpsilon = std::min(epsilon,0.99);
+        ComputeThreshold();
+    }
+}
+
+void RansacSampler::ComputeThreshold()
+{
+    mdDeltaThreshold = mdDelta;
+
+    // Bad hypotheses cannot be told apart from good ones, verify every correspondence
+    if(mdDelta>=mdEpsilon)
+    {
+        mdA = std::numeric_limits<double>::max();
+        return;
+    }
+
+    // A = tM*C + 1 + log(A), solved by fixed point iteration
+    const double C = (1.0-mdDelta)*std::log((1.0-mdDelta)/(1.0-mdEpsilon)) + mdDelta*std::log(mdDelta/mdEpsilon);
+    const double A0 = mdModelCost*C + 1.0;
+    mdA = A0;
+    for(int i=0; i<10; i++)
+        mdA = A0 + std::log(mdA);
+}
+
+} //namespace ORB_SLAM
@@ -0,0 +1,130 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "RelocalizationCache.h"
+#include "Frame.h"
+#include "KeyFrame.h"
+#include "MapPoint.h"
+#include "ORBmatcher.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace ORB_SLAM3
+{
+
+RelocalizationCache::Query::Query(const Frame &F): mFeatVec(F.mFlatFeatVec)
+{
+    const size_t nBytes = ORBmatcher::DESCRIPTOR_BYTES;
+    if(mFeatVec.Empty())
+        return;
+
+    const unsigned int* pBegin = mFeatVec.Begin(0);
+    const unsigned int* pEnd = mFeatVec.End(mFeatVec.Nodes()-1);
+    mvDescriptors.resize((pEnd-pBegin)*nBytes);
+    unsigned char* pDst = mvDescriptors.data();
+    for(const unsigned int* pIdx=pBegin; pIdx!=pEnd; pIdx++, pDst+=nBytes)
+        memcpy(pDst, F.mDescriptors.ptr<unsigned char>(*pIdx), nBytes);
+}
+
+std::shared_ptr<const RelocalizationCache> RelocalizationCache::Build(KeyFrame* pKF)
+{
+    std::shared_ptr<RelocalizationCache> pCache = std::make_shared<RelocalizationCache>();
+    const FlatFeatureVector &featVec = pKF->mFlatFeatVec;
+    const std::vector<MapPoint*> vpMapPoints = pKF->GetMapPointMatches();
+
+    // (observations, node, keypoint) of the keypoints with a good map point
+    struct Point
+    {
+        int nObs;
+        DBoW2::NodeId nodeId;
+        unsigned int idx;
+    };
+    std::vector<Point> vPoints;
+    vPoints.reserve(vpMapPoints.size());
+    for(size_t n=0, nend=featVec.Nodes(); n<nend; n++)
+    {
+        for(const unsigned int* pIdx=featVec.Begin(n); pIdx!=featVec.End(n); pIdx++)
+        {
+            MapPoint* pMP = *pIdx<vpMapPoints.size() ? vpMapPoints[*pIdx] : static_cast<MapPoint*>(NULL);
+            if(!pMP || pMP->isBad())
+                continue;
+            Point p;
+            p.nObs = pMP->Observations();
+            p.nodeId = featVec.NodeId(n);
+            p.idx = *pIdx;
+            vPoints.push_back(p);
+        }
+    }
+
+    //^ 관측 수가 많은 MAX_POINTS개만 남기고, Score의 merge를 위해 node 순서로 정렬
+    if(vPoints.size() > size_t(MAX_POINTS))
+    {
+        std::nth_element(vPoints.begin(), vPoints.begin()+MAX_POINTS, vPoints.end(),
+                         [](const Point &a, const Point &b){ return a.nObs>b.nObs; });
+        vPoints.resize(MAX_POINTS);
+    }
+    std::sort(vPoints.begin(), vPoints.end(), [](const Point &a, const Point &b){ return a.nodeId<b.nodeId; });
+
+    const size_t nBytes = ORBmatcher::DESCRIPTOR_BYTES;
+    pCache->mvNodeIds.resize(vPoints.size());
+    pCache->mvDescriptors.resize(vPoints.size()*nBytes);
+    for(size_t i=0; i<vPoints.size(); i++)
+    {
+        pCache->mvNodeIds[i] = vPoints[i].nodeId;
+        memcpy(pCache->mvDescriptors.data()+i*nBytes, pKF->mDescriptors.ptr<unsigned char>(vPoints[i].idx), nBytes);
+    }
+    return pCache;
+}
+
+int RelocalizationCache::Score(const Query &query, const int thDist) const
+{
+    const FlatFeatureVector &featVec = query.mFeatVec;
+    if(featVec.Empty() || mvNodeIds.empty())
+        return 0;
+
+    const size_t nBytes = ORBmatcher::DESCRIPTOR_BYTES;
+    const unsigned int* pBegin = featVec.Begin(0);
+    std::vector<int> vDists;
+
+    int nScore = 0;
+    size_t nF = 0;
+    for(size_t i=0; i<mvNodeIds.size(); i++)
+    {
+        nF = featVec.LowerBound(nF, mvNodeIds[i]);
+        if(nF==featVec.Nodes())
+            break;
+        if(featVec.NodeId(nF)!=mvNodeIds[i])
+            continue;
+
+        const int N = featVec.Size(nF);
+        vDists.resize(N);
+        ORBmatcher::DescriptorDistances(mvDescriptors.data()+i*nBytes, query.mvDescriptors.data()+(featVec.Begin(nF)-pBegin)*nBytes,
+                                        N, vDists.data());
+        if(*std::min_element(vDists.begin(), vDists.end()) <= thDist)
+            nScore++;
+    }
+    return nScore;
+}
+
+size_t RelocalizationCache::MemoryBytes() const
+{
+    return sizeof(RelocalizationCache) + mvNodeIds.capacity()*sizeof(DBoW2::NodeId) + mvDescriptors.capacity();
+}
+
+} //namespace ORB_SLAM
@@ -0,0 +1,310 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ReplayLog.h"
+
+#include <opencv2/highgui/highgui.hpp>
+
+#include <sys/stat.h>
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+namespace ORB_SLAM3
+{
+
+// A thread that does not finish its recorded work in this time has diverged from the recording
+static const int TURN_TIMEOUT_S = 120;
+
+ReplayLog::ReplayLog(const std::string &strDir, const eMode mode, const int sensor):
+    mStrDir(strDir[strDir.size()-1]=='/' ? strDir : strDir+"/"), mMode(mode), mnSensor(sensor), mnFrame(0),
+    mnInputs(0), mnNextEvent(0), mnTurn(-1), mbReleased(false)
+{
+    for(int i=0; i<NUM_DECISIONS; i++)
+        mvnNextDecision[i] = 0;
+}
+
+ReplayLog::~ReplayLog()
+{
+    Release();
+    if(mLog.is_open())
+        mLog.close();
+}
+
+ReplayLog* ReplayLog::Open(const std::string &strDir, const eMode mode, const int sensor)
+{
+    if(strDir.empty())
+        return static_cast<ReplayLog*>(NULL);
+
+    ReplayLog* pLog = new ReplayLog(strDir, mode, sensor);
+    if(mode==RECORD)
+    {
+        mkdir(pLog->mStrDir.c_str(), 0755);
+        mkdir((pLog->mStrDir+"images").c_str(), 0755);
+        pLog->mLog.open((pLog->mStrDir+"replay.txt").c_str());
+        if(!pLog->mLog.is_open())
+        {
+            std::cerr << "ERROR: cannot create the recording in " << strDir << std::endl;
+            delete pLog;
+            return static_cast<ReplayLog*>(NULL);
+        }
+        pLog->mLog << std::setprecision(17);
+        pLog->mLog << "ORB_SLAM3_REPLAY 1 " << sensor << "\n";
+    }
+    else if(!pLog->Load())
+    {
+        std::cerr << "ERROR: " << strDir << " does not hold a recording" << std::endl;
+        delete pLog;
+        return static_cast<ReplayLog*>(NULL);
+    }
+
+    return pLog;
+}
+
+bool ReplayLog::Load()
+{
+    std::ifstream f((mStrDir+"replay.txt").c_str());
+    std::string strLine;
+    if(!std::getline(f, strLine))
+        return false;
+
+    std::istringstream header(strLine);
+    std::string strMagic;
+    int version;
+    header >> strMagic >> version >> mnSensor;
+    if(strMagic!="ORB_SLAM3_REPLAY" || version!=1)
+        return false;
+
+    std::vector<IMU::Point> vImu;
+    while(std::getline(f, strLine))
+    {
+        std::istringstream ss(strLine);
+        char type;
+        if(!(ss >> type))
+            continue;
+
+        if(type=='I')
+        {
+            double t;
+            float ax, ay, az, gx, gy, gz;
+            ss >> t >> ax >> ay >> az >> gx >> gy >> gz;
+            vImu.push_back(IMU::Point(ax,ay,az,gx,gy,gz,t));
+        }
+        else if(type=='F')
+        {
+            Frame frame;
+            size_t nIms;
+            ss >> frame.timestamp >> nIms;
+            frame.vstrImages.resize(nIms);
+            for(size_t i=0; i<nIms; i++)
+                ss >> frame.vstrImages[i];
+            frame.vImu.swap(vImu);
+            mvFrames.push_back(frame);
+        }
+        else if(type=='E')
+        {
+            Event e;
+            ss >> e.work >> e.nFrame;
+            if(e.work>=0 && e.work<NUM_WORK)
+                mvEvents.push_back(e);
+        }
+        else if(type=='D')
+        {
+            int decision, value;
+            ss >> decision >> value;
+            if(decision>=0 && decision<NUM_DECISIONS)
+                mvDecisions[decision].push_back(value);
+        }
+    }
+
+    return !mvFrames.empty();
+}
+
+void ReplayLog::WriteImage(const cv::Mat &im, const std::string &strFile)
+{
+    // PNG is lossless for 8 and 16 bit images, the rest (float depth) goes through FileStorage
+    if(im.depth()==CV_8U || im.depth()==CV_16U)
+    {
+        std::vector<int> vParams;
+        vParams.push_back(cv::IMWRITE_PNG_COMPRESSION);
+        vParams.push_back(1);
+        cv::imwrite(mStrDir+strFile, im, vParams);
+    }
+    else
+    {
+        cv::FileStorage fs(mStrDir+strFile, cv::FileStorage::WRITE);
+        fs << "image" << im;
+    }
+}
+
+void ReplayLog::LoadImages(const size_t i, std::vector<cv::Mat> &vIms) const
+{
+    const Frame &frame = mvFrames[i];
+    vIms.resize(frame.vstrImages.size());
+    for(size_t j=0; j<frame.vstrImages.size(); j++)
+    {
+        const std::string &strFile = frame.vstrImages[j];
+        if(strFile.size()>4 && strFile.compare(strFile.size()-4, 4, ".png")==0)
+            vIms[j] = cv::imread(mStrDir+strFile, cv::IMREAD_UNCHANGED);
+        else
+        {
+            cv::FileStorage fs(mStrDir+strFile, cv::FileStorage::READ);
+            fs["image"] >> vIms[j];
+        }
+    }
+}
+
+void ReplayLog::RecordInput(const std::vector<cv::Mat> &vIms, const double timestamp, const std::vector<IMU::Point> &vImu)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    if(mMode!=RECORD)
+        return;
+
+    for(size_t i=0; i<vImu.size(); i++)
+    {
+        const IMU::Point &p = vImu[i];
+        mLog << "I " << p.t << " " << p.a.x << " " << p.a.y << " " << p.a.z << " "
+             << p.w.x << " " << p.w.y << " " << p.w.z << "\n";
+    }
+
+    mLog << "F " << timestamp << " " << vIms.size();
+    for(size_t i=0; i<vIms.size(); i++)
+    {
+        std::ostringstream ss;
+        ss << "images/" << std::setfill('0') << std::setw(6) << mnInputs << "_" << i
+           << (vIms[i].depth()==CV_8U || vIms[i].depth()==CV_16U ? ".png" : ".yml.gz");
+        WriteImage(vIms[i], ss.str());
+        mLog << " " << ss.str();
+    }
+    mLog << "\n";
+
+    mnInputs++;
+}
+
+void ReplayLog::BeginFrame()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    if(mMode==RECORD)
+    {
+        mnFrame++;
+        return;
+    }
+
+    // Work that ended before this frame in the recording
+    while(!mbReleased && mnNextEvent<mvEvents.size() && mvEvents[mnNextEvent].nFrame<=mnFrame)
+    {
+        const int work = mvEvents[mnNextEvent].work;
+        mnTurn = work;
+        mcvTurn.notify_all();
+
+        if(mvWakeUp[work])
+        {
+            lock.unlock();
+            mvWakeUp[work]();
+            lock.lock();
+        }
+
+        if(!mcvTurn.wait_for(lock, std::chrono::seconds(TURN_TIMEOUT_S), [this]{ return mnTurn<0 || mbReleased; }))
+        {
+            std::cerr << "Replay: the recorded work " << work << " before frame " << mnFrame
+                      << " was not done, continuing without serializing the threads" << std::endl;
+            mbReleased = true;
+            mcvTurn.notify_all();
+        }
+        mnNextEvent++;
+    }
+
+    mnFrame++;
+}
+
+bool ReplayLog::Decide(const eDecision decision, const bool bValue)
+{
+    return Decide(decision, bValue ? 1 : 0)!=0;
+}
+
+int ReplayLog::Decide(const eDecision decision, const int nValue)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    if(mMode==RECORD)
+    {
+        mLog << "D " << decision << " " << nValue << "\n";
+        return nValue;
+    }
+
+    if(mbReleased || mvnNextDecision[decision]>=mvDecisions[decision].size())
+        return nValue;
+    return mvDecisions[decision][mvnNextDecision[decision]++];
+}
+
+bool ReplayLog::HasTurn(const eWork work)
+{
+    if(mMode==RECORD)
+        return true;
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    return mbReleased || mnTurn==work;
+}
+
+void ReplayLog::WaitTurn(const eWork work, const bool* pbCancel)
+{
+    if(mMode==RECORD)
+        return;
+
+    // pbCancel is not signalled, so it is polled
+    std::unique_lock<std::mutex> lock(mMutex);
+    while(!mbReleased && mnTurn!=work && !*pbCancel)
+        mcvTurn.wait_for(lock, std::chrono::milliseconds(10));
+}
+
+void ReplayLog::WorkDone(const eWork work)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    if(mMode==RECORD)
+    {
+        mLog << "E " << work << " " << mnFrame << "\n";
+        return;
+    }
+
+    if(mnTurn==work)
+    {
+        mnTurn = -1;
+        mcvTurn.notify_all();
+    }
+}
+
+void ReplayLog::SetWakeUp(const eWork work, const std::function<void()> &wakeUp)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    mvWakeUp[work] = wakeUp;
+}
+
+void ReplayLog::Release()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    mbReleased = true;
+    mcvTurn.notify_all();
+    if(mLog.is_open())
+        mLog.flush();
+}
+
+} //namespace ORB_SLAM3
@@ -0,0 +1,248 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SharedMapPublisher.h"
+
+#include <chrono>
+#include <iostream>
+#include <new>
+
+using namespace std;
+
+namespace ORB_SLAM3
+{
+
+SharedMapPublisher::SharedMapPublisher(const string &strName, const size_t nMaxMapPoints, const size_t nMaxKeyFrames, const float fMapFPS):
+    mStrName(strName), mpHeader(static_cast<SharedMapHeader*>(NULL)), mnSize(0), mfMapFPS(fMapFPS), mbMapChanged(false),
+    mbFinishRequested(false), mbFinished(false)
+{
+    // A region left by a previous run is replaced, its readers have to open the new one
+    shm_unlink(mStrName.c_str());
+    const int fd = shm_open(mStrName.c_str(), O_CREAT | O_RDWR, 0644);
+    if(fd < 0)
+    {
+        cerr << "Cannot create the shared memory region " << mStrName << endl;
+        return;
+    }
+
+    const size_t nSize = SharedMapRegionSize(nMaxMapPoints, nMaxKeyFrames);
+    void* p = MAP_FAILED;
+    if(ftruncate(fd, nSize) == 0)
+        p = mmap(NULL, nSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(p == MAP_FAILED)
+    {
+        cerr << "Cannot map " << nSize << " bytes of shared memory for " << mStrName << endl;
+        shm_unlink(mStrName.c_str());
+        return;
+    }
+
+    mpHeader = new (p) SharedMapHeader();
+    mnSize = nSize;
+    mpHeader->maxMapPoints = nMaxMapPoints;
+    mpHeader->maxKeyFrames = nMaxKeyFrames;
+    const size_t nBufferSize = nMaxMapPoints*sizeof(SharedMapPoint) + nMaxKeyFrames*sizeof(SharedKeyFrame);
+    mpHeader->mapBufferOffset[0] = sizeof(SharedMapHeader);
+    mpHeader->mapBufferOffset[1] = sizeof(SharedMapHeader) + nBufferSize;
+    mpHeader->regionSize = nSize;
+    for(int b=0; b<2; b++)
+    {
+        mpHeader->poseSeq[b].store(0, memory_order_relaxed);
+        mpHeader->mapSeq[b].store(0, memory_order_relaxed);
+        mpHeader->nMapPoints[b] = 0;
+        mpHeader->nKeyFrames[b] = 0;
+        mpHeader->truncated[b] = 0;
+    }
+    mpHeader->nPoses.store(0, memory_order_relaxed);
+    mpHeader->nMaps.store(0, memory_order_relaxed);
+    mpHeader->layoutVersion = SharedMapHeader::LAYOUT_VERSION;
+    atomic_thread_fence(memory_order_release);
+    mpHeader->magic = SharedMapHeader::MAGIC;
+}
+
+SharedMapPublisher::~SharedMapPublisher()
+{
+    if(!mpHeader)
+        return;
+    munmap(mpHeader, mnSize);
+    shm_unlink(mStrName.c_str());
+}
+
+void SharedMapPublisher::Run()
+{
+    const chrono::microseconds period((long long)(1e6/max(mfMapFPS,0.01f)));
+    while(!CheckFinish())
+    {
+        WriteMap();
+
+        unique_lock<mutex> lock(mMutexMap);
+        mcvMap.wait_for(lock, period);
+    }
+
+    // Final map
+    WriteMap();
+    SetFinish();
+}
+
+void SharedMapPublisher::PublishPose(const double timestamp, const cv::Mat &Tcw, const int trackingState)
+{
+    if(!mpHeader)
+        return;
+
+    // The buffer that is not current
+    const uint64_t n = mpHeader->nPoses.load(memory_order_relaxed);
+    const int b = n%2;
+    const uint64_t seq = mpHeader->poseSeq[b].load(memory_order_relaxed);
+    mpHeader->poseSeq[b].store(seq+1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    SharedPose &pose = mpHeader->pose[b];
+    pose.timestamp = timestamp;
+    pose.trackingState = trackingState;
+    pose.valid = Tcw.empty() ? 0 : 1;
+    for(int i=0; i<4; i++)
+        for(int j=0; j<4; j++)
+            pose.Tcw[4*i+j] = Tcw.empty() ? (i==j ? 1.f : 0.f) : Tcw.at<float>(i,j);
+
+    mpHeader->poseSeq[b].store(seq+2, memory_order_release);
+    mpHeader->nPoses.store(n+1, memory_order_release);
+}
+
+void SharedMapPublisher::OnMapEvents(const MapEvents::Batch &batch)
+{
+    unique_lock<mutex> lock(mMutexMap);
+
+    for(size_t i=0; i<batch.vMapsCleared.size(); i++)
+    {
+        const long unsigned int nMapId = batch.vMapsCleared[i];
+        for(unordered_map<long unsigned int, SharedMapPoint>::iterator it=mmPoints.begin(); it!=mmPoints.end();)
+        {
+            if(it->second.mapId == nMapId)
+                it = mmPoints.erase(it);
+            else
+                it++;
+        }
+        for(unordered_map<long unsigned int, SharedKeyFrame>::iterator it=mmKeyFrames.begin(); it!=mmKeyFrames.end();)
+        {
+            if(it->second.mapId == nMapId)
+                it = mmKeyFrames.erase(it);
+            else
+                it++;
+        }
+    }
+
+    const vector<MapEvents::PointUpdate>* vvPoints[2] = {&batch.vPointsAdded, &batch.vPointsMoved};
+    for(int k=0; k<2; k++)
+    {
+        const vector<MapEvents::PointUpdate> &vUpdates = *vvPoints[k];
+        for(size_t i=0; i<vUpdates.size(); i++)
+        {
+            SharedMapPoint &point = mmPoints[vUpdates[i].nId];
+            point.id = vUpdates[i].nId;
+            point.mapId = vUpdates[i].nMapId;
+            point.pos[0] = vUpdates[i].pos(0);
+            point.pos[1] = vUpdates[i].pos(1);
+            point.pos[2] = vUpdates[i].pos(2);
+            point.pad = 0.f;
+        }
+    }
+    for(size_t i=0; i<batch.vPointsRemoved.size(); i++)
+        mmPoints.erase(batch.vPointsRemoved[i]);
+
+    const vector<MapEvents::KeyFrameUpdate>* vvKFs[2] = {&batch.vKeyFramesAdded, &batch.vKeyFramesMoved};
+    for(int k=0; k<2; k++)
+    {
+        const vector<MapEvents::KeyFrameUpdate> &vUpdates = *vvKFs[k];
+        for(size_t i=0; i<vUpdates.size(); i++)
+        {
+            SharedKeyFrame &kf = mmKeyFrames[vUpdates[i].nId];
+            kf.id = vUpdates[i].nId;
+            kf.mapId = vUpdates[i].nMapId;
+            for(int j=0; j<16; j++)
+                kf.Tcw[j] = vUpdates[i].Tcw.val[j];
+        }
+    }
+    for(size_t i=0; i<batch.vKeyFramesRemoved.size(); i++)
+        mmKeyFrames.erase(batch.vKeyFramesRemoved[i]);
+
+    mbMapChanged = true;
+}
+
+void SharedMapPublisher::WriteMap()
+{
+    if(!mpHeader)
+        return;
+
+    unique_lock<mutex> lock(mMutexMap);
+    if(!mbMapChanged)
+        return;
+
+    const uint64_t n = mpHeader->nMaps.load(memory_order_relaxed);
+    const int b = n%2;
+    const uint64_t seq = mpHeader->mapSeq[b].load(memory_order_relaxed);
+    mpHeader->mapSeq[b].store(seq+1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    char* pBuffer = reinterpret_cast<char*>(mpHeader) + mpHeader->mapBufferOffset[b];
+    SharedMapPoint* pPoints = reinterpret_cast<SharedMapPoint*>(pBuffer);
+    SharedKeyFrame* pKFs = reinterpret_cast<SharedKeyFrame*>(pBuffer + mpHeader->maxMapPoints*sizeof(SharedMapPoint));
+
+    uint64_t nPoints = 0;
+    for(unordered_map<long unsigned int, SharedMapPoint>::const_iterator it=mmPoints.begin(); it!=mmPoints.end() && nPoints<mpHeader->maxMapPoints; it++)
+        pPoints[nPoints++] = it->second;
+    uint64_t nKFs = 0;
+    for(unordered_map<long unsigned int, SharedKeyFrame>::const_iterator it=mmKeyFrames.begin(); it!=mmKeyFrames.end() && nKFs<mpHeader->maxKeyFrames; it++)
+        pKFs[nKFs++] = it->second;
+    mpHeader->nMapPoints[b] = nPoints;
+    mpHeader->nKeyFrames[b] = nKFs;
+    mpHeader->truncated[b] = (nPoints<mmPoints.size() || nKFs<mmKeyFrames.size()) ? 1 : 0;
+
+    mpHeader->mapSeq[b].store(seq+2, memory_order_release);
+    mpHeader->nMaps.store(n+1, memory_order_release);
+    mbMapChanged = false;
+}
+
+void SharedMapPublisher::RequestFinish()
+{
+    {
+        unique_lock<mutex> lock(mMutexFinish);
+        mbFinishRequested = true;
+    }
+    unique_lock<mutex> lock(mMutexMap);
+    mcvMap.notify_one();
+}
+
+bool SharedMapPublisher::CheckFinish()
+{
+    unique_lock<mutex> lock(mMutexFinish);
+    return mbFinishRequested;
+}
+
+void SharedMapPublisher::SetFinish()
+{
+    unique_lock<mutex> lock(mMutexFinish);
+    mbFinished = true;
+}
+
+bool SharedMapPublisher::isFinished()
+{
+    unique_lock<mutex> lock(mMutexFinish);
+    return mbFinished;
+}
+
+} //namespace ORB_SLAM3
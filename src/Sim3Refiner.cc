@@ -0,0 +1,272 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Sim3Refiner.h"
+#include "CameraModels/CameraProjection.h"
+
+#include <Eigen/Dense>
+
+#include <cmath>
+#include <limits>
+
+namespace ORB_SLAM3
+{
+
+// Skew-symmetric matrix of v, [v]x*w = v x w
+static inline Eigen::Matrix3d Skew(const double x, const double y, const double z)
+{
+    Eigen::Matrix3d S;
+    S << 0.0, -z, y,
+         z, 0.0, -x,
+         -y, x, 0.0;
+    return S;
+}
+
+Sim3Refiner::Sim3Refiner(): mpCamera1(NULL), mpCamera2(NULL), mbFixScale(false), mDelta(0), mbRobust(true)
+{
+}
+
+void Sim3Refiner::Reset(GeometricCamera* pCamera1, GeometricCamera* pCamera2, const bool bFixScale, const double delta)
+{
+    mpCamera1 = pCamera1;
+    mpCamera2 = pCamera2;
+    mbFixScale = bFixScale;
+    mDelta = delta;
+    mbRobust = true;
+
+    // clear() keeps the capacity
+    mvbActive.clear();
+    mvX1.clear(); mvY1.clear(); mvZ1.clear();
+    mvX2.clear(); mvY2.clear(); mvZ2.clear();
+    mvU1.clear(); mvV1.clear(); mvInfo1.clear();
+    mvU2.clear(); mvV2.clear(); mvInfo2.clear();
+    mvChi2_1.clear(); mvChi2_2.clear();
+}
+
+int Sim3Refiner::AddCorrespondence(const Eigen::Vector3d &X1, const Eigen::Vector3d &X2,
+                                   const Eigen::Vector2d &obs1, const double invSigma2_1,
+                                   const Eigen::Vector2d &obs2, const double invSigma2_2)
+{
+    mvbActive.push_back(true);
+    mvX1.push_back(X1[0]); mvY1.push_back(X1[1]); mvZ1.push_back(X1[2]);
+    mvX2.push_back(X2[0]); mvY2.push_back(X2[1]); mvZ2.push_back(X2[2]);
+    mvU1.push_back(obs1[0]); mvV1.push_back(obs1[1]); mvInfo1.push_back(invSigma2_1);
+    mvU2.push_back(obs2[0]); mvV2.push_back(obs2[1]); mvInfo2.push_back(invSigma2_2);
+    mvChi2_1.push_back(0.0); mvChi2_2.push_back(0.0);
+
+    return mvbActive.size()-1;
+}
+
+void Sim3Refiner::TransformPoints(const Eigen::Matrix3d &R12, const Eigen::Vector3d &t12, const double s12)
+{
+    const size_t N = mvX1.size();
+    mvX21.resize(N); mvY21.resize(N); mvZ21.resize(N);
+    mvX12.resize(N); mvY12.resize(N); mvZ12.resize(N);
+
+    // x1 = A*x2 + a, x2 = B*x1 + b
+    const Eigen::Matrix3d A = s12*R12;
+    const Eigen::Vector3d a = t12;
+    const Eigen::Matrix3d B = R12.transpose()/s12;
+    const Eigen::Vector3d b = -B*t12;
+
+    // Plain loops over the arrays so that the compiler can vectorize them
+    for(size_t i=0; i<N; i++)
+    {
+        mvX21[i] = A(0,0)*mvX2[i] + A(0,1)*mvY2[i] + A(0,2)*mvZ2[i] + a[0];
+        mvY21[i] = A(1,0)*mvX2[i] + A(1,1)*mvY2[i] + A(1,2)*mvZ2[i] + a[1];
+        mvZ21[i] = A(2,0)*mvX2[i] + A(2,1)*mvY2[i] + A(2,2)*mvZ2[i] + a[2];
+    }
+
+    for(size_t i=0; i<N; i++)
+    {
+        mvX12[i] = B(0,0)*mvX1[i] + B(0,1)*mvY1[i] + B(0,2)*mvZ1[i] + b[0];
+        mvY12[i] = B(1,0)*mvX1[i] + B(1,1)*mvY1[i] + B(1,2)*mvZ1[i] + b[1];
+        mvZ12[i] = B(2,0)*mvX1[i] + B(2,1)*mvY1[i] + B(2,2)*mvZ1[i] + b[2];
+    }
+}
+
+double Sim3Refiner::Robustify(const double chi2, double &w) const
+{
+    // Huber, as g2o::RobustKernelHuber (only the first derivative weights the system)
+    if(!mbRobust || chi2<=mDelta*mDelta)
+    {
+        w = 1.0;
+        return chi2;
+    }
+
+    const double sqrte = sqrt(chi2);
+    w = mDelta/sqrte;
+    return 2.0*sqrte*mDelta - mDelta*mDelta;
+}
+
+double Sim3Refiner::Linearize(const Eigen::Matrix3d &R12, const double s12, Matrix7d* pH, Vector7d* pg)
+{
+    double cost = 0.0;
+    const Eigen::Matrix3d B = R12.transpose()/s12;
+
+    Eigen::Matrix<double,3,7> dY, dZ;
+    Eigen::Matrix<double,2,7> J;
+
+    const int N = mvbActive.size();
+    for(int i=0; i<N; i++)
+    {
+        if(!mvbActive[i])
+            continue;
+
+        // Image 1: e1 = obs1 - pi1(Y), Y = S12*X2. With the left update dY/d(omega,upsilon,sigma) = [-[Y]x | I | Y]
+        const Eigen::Vector3d Y(mvX21[i], mvY21[i], mvZ21[i]);
+        const Eigen::Vector2d e1 = Eigen::Vector2d(mvU1[i], mvV1[i]) - CameraProject<GeometricCamera>(mpCamera1, Y);
+        double w1;
+        cost += Robustify(mvInfo1[i]*e1.squaredNorm(), w1);
+
+        // Image 2: e2 = obs2 - pi2(Z), Z = S12^-1*X1. dZ/d(omega,upsilon,sigma) = B*[[X1]x | -I | -X1]
+        const Eigen::Vector3d Z(mvX12[i], mvY12[i], mvZ12[i]);
+        const Eigen::Vector2d e2 = Eigen::Vector2d(mvU2[i], mvV2[i]) - CameraProject<GeometricCamera>(mpCamera2, Z);
+        double w2;
+        cost += Robustify(mvInfo2[i]*e2.squaredNorm(), w2);
+
+        if(!pH)
+            continue;
+
+        dY.block<3,3>(0,0) = -Skew(Y[0], Y[1], Y[2]);
+        dY.block<3,3>(0,3).setIdentity();
+        dY.col(6) = Y;
+
+        const Eigen::Vector3d X1(mvX1[i], mvY1[i], mvZ1[i]);
+        dZ.block<3,3>(0,0) = B*Skew(X1[0], X1[1], X1[2]);
+        dZ.block<3,3>(0,3) = -B;
+        dZ.col(6) = -B*X1;
+
+        if(mbFixScale)
+        {
+            dY.col(6).setZero();
+            dZ.col(6).setZero();
+        }
+
+        const double wi1 = w1*mvInfo1[i];
+        J = -CameraProjectJac<GeometricCamera>(mpCamera1, Y)*dY;
+        pH->noalias() += wi1*J.transpose()*J;
+        pg->noalias() += wi1*J.transpose()*e1;
+
+        const double wi2 = w2*mvInfo2[i];
+        J = -CameraProjectJac<GeometricCamera>(mpCamera2, Z)*dZ;
+        pH->noalias() += wi2*J.transpose()*J;
+        pg->noalias() += wi2*J.transpose()*e2;
+    }
+
+    return cost;
+}
+
+void Sim3Refiner::ComputeChi2()
+{
+    const int N = mvbActive.size();
+    for(int i=0; i<N; i++)
+    {
+        const Eigen::Vector2d e1 = Eigen::Vector2d(mvU1[i], mvV1[i]) -
+                CameraProject<GeometricCamera>(mpCamera1, Eigen::Vector3d(mvX21[i], mvY21[i], mvZ21[i]));
+        const Eigen::Vector2d e2 = Eigen::Vector2d(mvU2[i], mvV2[i]) -
+                CameraProject<GeometricCamera>(mpCamera2, Eigen::Vector3d(mvX12[i], mvY12[i], mvZ12[i]));
+        mvChi2_1[i] = mvInfo1[i]*e1.squaredNorm();
+        mvChi2_2[i] = mvInfo2[i]*e2.squaredNorm();
+    }
+}
+
+void Sim3Refiner::Optimize(Eigen::Matrix3d &R12, Eigen::Vector3d &t12, double &s12, const int nIterations)
+{
+    int nActive = 0;
+    for(size_t i=0; i<mvbActive.size(); i++)
+        if(mvbActive[i])
+            nActive++;
+
+    // Levenberg-Marquardt as g2o::OptimizationAlgorithmLevenberg
+    const int maxTrialsAfterFailure = 10;
+    double lambda = 0.0;
+    double ni = 2.0;
+
+    for(int iter=0; iter<nIterations && nActive>0; iter++)
+    {
+        TransformPoints(R12, t12, s12);
+
+        Matrix7d H = Matrix7d::Zero();
+        Vector7d g = Vector7d::Zero();
+        double currentChi = Linearize(R12, s12, &H, &g);
+
+        if(iter==0)
+        {
+            lambda = 1e-5*H.diagonal().maxCoeff();
+            ni = 2.0;
+        }
+
+        double rho = 0.0;
+        int qmax = 0;
+        do
+        {
+            qmax++;
+
+            // With fixed scale the last row and column are zero and the damping keeps the system regular
+            Matrix7d Hl = H;
+            Hl.diagonal().array() += lambda;
+            const Vector7d dx = Hl.ldlt().solve(-g);
+
+            // S12 <- exp(dx)*S12, exp(dx): x -> e^sigma*Exp(omega)*x + upsilon
+            const Eigen::Vector3d omega = dx.head<3>();
+            const double theta = omega.norm();
+            const Eigen::Quaterniond dq = theta>1e-10 ?
+                        Eigen::Quaterniond(Eigen::AngleAxisd(theta, omega/theta)) : Eigen::Quaterniond::Identity();
+            const Eigen::Matrix3d Rexp = dq.toRotationMatrix();
+            const double sexp = mbFixScale ? 1.0 : exp(dx[6]);
+
+            const Eigen::Matrix3d Rnew = Eigen::Quaterniond(Rexp*R12).normalized().toRotationMatrix();
+            const Eigen::Vector3d tnew = sexp*(Rexp*t12) + dx.segment<3>(3);
+            const double snew = sexp*s12;
+
+            TransformPoints(Rnew, tnew, snew);
+            double tempChi = Linearize(Rnew, snew, NULL, NULL);
+            if(!std::isfinite(tempChi))
+                tempChi = std::numeric_limits<double>::max();
+
+            const double scale = dx.dot(lambda*dx - g) + 1e-3;
+            rho = (currentChi - tempChi)/scale;
+
+            if(rho>0 && std::isfinite(tempChi))
+            {
+                const double alpha = std::min(1.0 - pow(2.0*rho - 1.0, 3), 2.0/3.0);
+                lambda *= std::max(1.0/3.0, alpha);
+                ni = 2.0;
+                currentChi = tempChi;
+                R12 = Rnew;
+                t12 = tnew;
+                s12 = snew;
+            }
+            else
+            {
+                lambda *= ni;
+                ni *= 2.0;
+            }
+        }
+        while(rho<0 && qmax<maxTrialsAfterFailure);
+
+        if(qmax==maxTrialsAfterFailure || rho==0)
+            break;
+    }
+
+    TransformPoints(R12, t12, s12);
+    ComputeChi2();
+}
+
+} //namespace ORB_SLAM3
@@ -22,6 +22,7 @@
 #include <vector>
 #include <cmath>
 #include <opencv2/core/core.hpp>
+#include <Eigen/Dense>
 
 #include "KeyFrame.h"
 #include "ORBmatcher.h"
@@ -31,10 +32,12 @@
 namespace ORB_SLAM3
 {
 
+// Correspondences checked at a time by CheckInliers
+static const int SIM3_CHECK_BLOCK = 64;
 
 Sim3Solver::Sim3Solver(KeyFrame *pKF1, KeyFrame *pKF2, const vector<MapPoint *> &vpMatched12, const bool bFixScale,
                        vector<KeyFrame*> vpKeyFrameMatchedMP):
-    mnIterations(0), mnBestInliers(0), mbFixScale(bFixScale),
+    mnIterations(0), mnBestInliers(0), mbFixScale(bFixScale), mSampling(RansacSampler::UNIFORM), mbSPRT(false),
     pCamera1(pKF1->mpCamera), pCamera2(pKF2->mpCamera)
 {
     bool bDifferentKFs = false;
@@ -55,8 +58,8 @@ Sim3Solver::Sim3Solver(KeyFrame *pKF1, KeyFrame *pKF2, const vector<MapPoint *>
     mvpMapPoints2.reserve(mN1);
     mvpMatches12 = vpMatched12;
     mvnIndices1.reserve(mN1);
-    mvX3Dc1.reserve(mN1);
-    mvX3Dc2.reserve(mN1);
+    mvX1.reserve(mN1); mvY1.reserve(mN1); mvZ1.reserve(mN1);
+    mvX2.reserve(mN1); mvY2.reserve(mN1); mvZ2.reserve(mN1);
 
     cv::Mat Rcw1 = pKF1->GetRotation();
     cv::Mat tcw1 = pKF1->GetTranslation();
@@ -64,6 +67,7 @@ Sim3Solver::Sim3Solver(KeyFrame *pKF1, KeyFrame *pKF2, const vector<MapPoint *>
     cv::Mat tcw2 = pKF2->GetTranslation();
 
     mvAllIndices.reserve(mN1);
+    mvQuality.reserve(mN1);
 
     size_t idx=0;
 
@@ -104,21 +108,32 @@ Sim3Solver::Sim3Solver(KeyFrame *pKF1, KeyFrame *pKF2, const vector<MapPoint *>
             mvnIndices1.push_back(i1);
 
             cv::Mat X3D1w = pMP1->GetWorldPos();
-            mvX3Dc1.push_back(Rcw1*X3D1w+tcw1);
+            cv::Mat X3D1c = Rcw1*X3D1w+tcw1;
+            mvX1.push_back(X3D1c.at<float>(0));
+            mvY1.push_back(X3D1c.at<float>(1));
+            mvZ1.push_back(X3D1c.at<float>(2));
 
             cv::Mat X3D2w = pMP2->GetWorldPos();
-            mvX3Dc2.push_back(Rcw2*X3D2w+tcw2);
+            cv::Mat X3D2c = Rcw2*X3D2w+tcw2;
+            mvX2.push_back(X3D2c.at<float>(0));
+            mvY2.push_back(X3D2c.at<float>(1));
+            mvZ2.push_back(X3D2c.at<float>(2));
 
             mvAllIndices.push_back(idx);
             idx++;
+
+            mvQuality.push_back(ORBmatcher::DescriptorDistance(pMP1->GetDescriptor(),pMP2->GetDescriptor()));
         }
     }
 
     mK1 = pKF1->mK;
     mK2 = pKF2->mK;
 
-    FromCameraToImage(mvX3Dc1,mvP1im1,pCamera1);
-    FromCameraToImage(mvX3Dc2,mvP2im2,pCamera2);
+    const int nMatches = mvX1.size();
+    mvU1.resize(nMatches); mvV1.resize(nMatches);
+    mvU2.resize(nMatches); mvV2.resize(nMatches);
+    pCamera1->projectMany(mvX1.data(),mvY1.data(),mvZ1.data(),nMatches,mvU1.data(),mvV1.data());
+    pCamera2->projectMany(mvX2.data(),mvY2.data(),mvZ2.data(),nMatches,mvU2.data(),mvV2.data());
 
     SetRansacParameters();
 }
@@ -147,6 +162,23 @@ void Sim3Solver::SetRansacParameters(double probability, int minInliers, int max
     mRansacMaxIts = max(1,min(nIterations,mRansacMaxIts));
 
     mnIterations = 0;
+
+    ConfigureSampler();
+}
+
+void Sim3Solver::SetSamplingStrategy(RansacSampler::eSampling sampling, bool bSPRT)
+{
+    mSampling = sampling;
+    mbSPRT = bSPRT;
+
+    ConfigureSampler();
+}
+
+void Sim3Solver::ConfigureSampler()
+{
+    // Horn's closed form on 3 points costs about as much as checking a few tens of correspondences
+    const float epsilon = N>0 ? (float)mRansacMinInliers/N : 0.f;
+    mSampler.Configure(mSampling,mbSPRT,mvQuality,3,mRansacMaxIts,epsilon,50.f);
 }
 
 cv::Mat Sim3Solver::iterate(int nIterations, bool &bNoMore, vector<bool> &vbInliers, int &nInliers)
@@ -161,10 +193,8 @@ cv::Mat Sim3Solver::iterate(int nIterations, bool &bNoMore, vector<bool> &vbInli
         return cv::Mat();
     }
 
-    vector<size_t> vAvailableIndices;
-
-    cv::Mat P3Dc1i(3,3,CV_32F);
-    cv::Mat P3Dc2i(3,3,CV_32F);
+    Eigen::Matrix3f P3Dc1i;
+    Eigen::Matrix3f P3Dc2i;
 
     int nCurrentIterations = 0;
     while(mnIterations<mRansacMaxIts && nCurrentIterations<nIterations)
@@ -172,34 +202,26 @@ cv::Mat Sim3Solver::iterate(int nIterations, bool &bNoMore, vector<bool> &vbInli
         nCurrentIterations++;
         mnIterations++;
 
-        vAvailableIndices = mvAllIndices;
-
         // Get min set of points
+        mSampler.Sample(mvSample);
         for(short i = 0; i < 3; ++i)
         {
-            int randi = DUtils::Random::RandomInt(0, vAvailableIndices.size()-1);
-
-            int idx = vAvailableIndices[randi];
-
-            mvX3Dc1[idx].copyTo(P3Dc1i.col(i));
-            mvX3Dc2[idx].copyTo(P3Dc2i.col(i));
+            int idx = mvSample[i];
 
-            vAvailableIndices[randi] = vAvailableIndices.back();
-            vAvailableIndices.pop_back();
+            P3Dc1i.col(i) << mvX1[idx], mvY1[idx], mvZ1[idx];
+            P3Dc2i.col(i) << mvX2[idx], mvY2[idx], mvZ2[idx];
         }
 
         ComputeSim3(P3Dc1i,P3Dc2i);
 
-        CheckInliers();
+        if(!CheckInliers(mbSPRT))
+            continue;
 
         if(mnInliersi>=mnBestInliers)
         {
             mvbBestInliers = mvbInliersi;
             mnBestInliers = mnInliersi;
-            mBestT12 = mT12i.clone();
-            mBestRotation = mR12i.clone();
-            mBestTranslation = mt12i.clone();
-            mBestScale = ms12i;
+            StoreBest();
 
             if(mnInliersi>mRansacMinInliers)
             {
@@ -231,10 +253,8 @@ cv::Mat Sim3Solver::iterate(int nIterations, bool &bNoMore, vector<bool> &vbInli
         return cv::Mat();
     }
 
-    vector<size_t> vAvailableIndices;
-
-    cv::Mat P3Dc1i(3,3,CV_32F);
-    cv::Mat P3Dc2i(3,3,CV_32F);
+    Eigen::Matrix3f P3Dc1i;
+    Eigen::Matrix3f P3Dc2i;
 
     int nCurrentIterations = 0;
 
@@ -245,34 +265,26 @@ cv::Mat Sim3Solver::iterate(int nIterations, bool &bNoMore, vector<bool> &vbInli
         nCurrentIterations++;
         mnIterations++;
 
-        vAvailableIndices = mvAllIndices;
-
         // Get min set of points
+        mSampler.Sample(mvSample);
         for(short i = 0; i < 3; ++i)
         {
-            int randi = DUtils::Random::RandomInt(0, vAvailableIndices.size()-1);
+            int idx = mvSample[i];
 
-            int idx = vAvailableIndices[randi];
-
-            mvX3Dc1[idx].copyTo(P3Dc1i.col(i));
-            mvX3Dc2[idx].copyTo(P3Dc2i.col(i));
-
-            vAvailableIndices[randi] = vAvailableIndices.back();
-            vAvailableIndices.pop_back();
+            P3Dc1i.col(i) << mvX1[idx], mvY1[idx], mvZ1[idx];
+            P3Dc2i.col(i) << mvX2[idx], mvY2[idx], mvZ2[idx];
         }
 
         ComputeSim3(P3Dc1i,P3Dc2i);
 
-        CheckInliers();
+        if(!CheckInliers(mbSPRT))
+            continue;
 
         if(mnInliersi>=mnBestInliers)
         {
             mvbBestInliers = mvbInliersi;
             mnBestInliers = mnInliersi;
-            mBestT12 = mT12i.clone();
-            mBestRotation = mR12i.clone();
-            mBestTranslation = mt12i.clone();
-            mBestScale = ms12i;
+            StoreBest();
 
             if(mnInliersi>mRansacMinInliers)
             {
@@ -302,157 +314,159 @@ cv::Mat Sim3Solver::find(vector<bool> &vbInliers12, int &nInliers)
     return iterate(mRansacMaxIts,bFlag,vbInliers12,nInliers);
 }
 
-void Sim3Solver::ComputeCentroid(cv::Mat &P, cv::Mat &Pr, cv::Mat &C)
-{
-    cv::reduce(P,C,1,cv::REDUCE_SUM);
-    C = C/P.cols;
-
-    for(int i=0; i<P.cols; i++)
-    {
-        Pr.col(i)=P.col(i)-C;
-    }
-}
-
-void Sim3Solver::ComputeSim3(cv::Mat &P1, cv::Mat &P2)
+void Sim3Solver::ComputeSim3(const Eigen::Matrix3f &P1f, const Eigen::Matrix3f &P2f)
 {
     // Custom implementation of:
     // Horn 1987, Closed-form solution of absolute orientataion using unit quaternions
+    // (fixed-size matrices, computed in double)
 
-    // Step 1: Centroid and relative coordinates
+    const Eigen::Matrix3d P1 = P1f.cast<double>();
+    const Eigen::Matrix3d P2 = P2f.cast<double>();
 
-    cv::Mat Pr1(P1.size(),P1.type()); // Relative coordinates to centroid (set 1)
-    cv::Mat Pr2(P2.size(),P2.type()); // Relative coordinates to centroid (set 2)
-    cv::Mat O1(3,1,Pr1.type()); // Centroid of P1
-    cv::Mat O2(3,1,Pr2.type()); // Centroid of P2
+    // Step 1: Centroid and relative coordinates
 
-    ComputeCentroid(P1,Pr1,O1);
-    ComputeCentroid(P2,Pr2,O2);
+    const Eigen::Vector3d O1 = P1.rowwise().mean(); // Centroid of P1
+    const Eigen::Vector3d O2 = P2.rowwise().mean(); // Centroid of P2
+    const Eigen::Matrix3d Pr1 = P1.colwise()-O1; // Relative coordinates to centroid (set 1)
+    const Eigen::Matrix3d Pr2 = P2.colwise()-O2; // Relative coordinates to centroid (set 2)
 
     // Step 2: Compute M matrix
 
-    cv::Mat M = Pr2*Pr1.t();
+    const Eigen::Matrix3d M = Pr2*Pr1.transpose();
 
     // Step 3: Compute N matrix
 
     double N11, N12, N13, N14, N22, N23, N24, N33, N34, N44;
 
-    cv::Mat N(4,4,P1.type());
-
-    N11 = M.at<float>(0,0)+M.at<float>(1,1)+M.at<float>(2,2);
-    N12 = M.at<float>(1,2)-M.at<float>(2,1);
-    N13 = M.at<float>(2,0)-M.at<float>(0,2);
-    N14 = M.at<float>(0,1)-M.at<float>(1,0);
-    N22 = M.at<float>(0,0)-M.at<float>(1,1)-M.at<float>(2,2);
-    N23 = M.at<float>(0,1)+M.at<float>(1,0);
-    N24 = M.at<float>(2,0)+M.at<float>(0,2);
-    N33 = -M.at<float>(0,0)+M.at<float>(1,1)-M.at<float>(2,2);
-    N34 = M.at<float>(1,2)+M.at<float>(2,1);
-    N44 = -M.at<float>(0,0)-M.at<float>(1,1)+M.at<float>(2,2);
-
-    N = (cv::Mat_<float>(4,4) << N11, N12, N13, N14,
-                                 N12, N22, N23, N24,
-                                 N13, N23, N33, N34,
-                                 N14, N24, N34, N44);
-
+    N11 = M(0,0)+M(1,1)+M(2,2);
+    N12 = M(1,2)-M(2,1);
+    N13 = M(2,0)-M(0,2);
+    N14 = M(0,1)-M(1,0);
+    N22 = M(0,0)-M(1,1)-M(2,2);
+    N23 = M(0,1)+M(1,0);
+    N24 = M(2,0)+M(0,2);
+    N33 = -M(0,0)+M(1,1)-M(2,2);
+    N34 = M(1,2)+M(2,1);
+    N44 = -M(0,0)-M(1,1)+M(2,2);
+
+    Eigen::Matrix4d Nq;
+    Nq << N11, N12, N13, N14,
+          N12, N22, N23, N24,
+          N13, N23, N33, N34,
+          N14, N24, N34, N44;
 
     // Step 4: Eigenvector of the highest eigenvalue
 
-    cv::Mat eval, evec;
-
-    cv::eigen(N,eval,evec); //evec[0] is the quaternion of the desired rotation
-
-    cv::Mat vec(1,3,evec.type());
-    (evec.row(0).colRange(1,4)).copyTo(vec); //extract imaginary part of the quaternion (sin*axis)
-
-    // Rotation angle. sin is the norm of the imaginary part, cos is the real part
-    double ang=atan2(norm(vec),evec.at<float>(0,0));
-
-    vec = 2*ang*vec/norm(vec); //Angle-axis representation. quaternion angle is the half
-
-    mR12i.create(3,3,P1.type());
-
-    cv::Rodrigues(vec,mR12i); // computes the rotation matrix from angle-axis
+    // eigenvalues in increasing order, the last eigenvector is the quaternion (w,x,y,z) of the desired rotation
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix4d> eigenSolver(Nq);
+    const Eigen::Vector4d q = eigenSolver.eigenvectors().col(3);
+    const Eigen::Matrix3d R = Eigen::Quaterniond(q[0],q[1],q[2],q[3]).normalized().toRotationMatrix();
 
     // Step 5: Rotate set 2
 
-    cv::Mat P3 = mR12i*Pr2;
+    const Eigen::Matrix3d P3 = R*Pr2;
 
     // Step 6: Scale
 
+    double s = 1.0;
     if(!mbFixScale)
-    {
-        double nom = Pr1.dot(P3);
-        cv::Mat aux_P3(P3.size(),P3.type());
-        aux_P3=P3;
-        cv::pow(P3,2,aux_P3);
-        double den = 0;
-
-        for(int i=0; i<aux_P3.rows; i++)
-        {
-            for(int j=0; j<aux_P3.cols; j++)
-            {
-                den+=aux_P3.at<float>(i,j);
-            }
-        }
-
-        ms12i = nom/den;
-    }
-    else
-        ms12i = 1.0f;
+        s = Pr1.cwiseProduct(P3).sum()/P3.squaredNorm();
 
     // Step 7: Translation
 
-    mt12i.create(1,3,P1.type());
-    mt12i = O1 - ms12i*mR12i*O2;
+    const Eigen::Vector3d t = O1 - s*R*O2;
 
     // Step 8: Transformation
 
-    // Step 8.1 T12
-    mT12i = cv::Mat::eye(4,4,P1.type());
-
-    cv::Mat sR = ms12i*mR12i;
+    mR12i = R.cast<float>();
+    mt12i = t.cast<float>();
+    ms12i = s;
 
-    sR.copyTo(mT12i.rowRange(0,3).colRange(0,3));
-    mt12i.copyTo(mT12i.rowRange(0,3).col(3));
+    // Step 8.1 T12
+    msR12i = (s*R).cast<float>();
 
     // Step 8.2 T21
-
-    mT21i = cv::Mat::eye(4,4,P1.type());
-
-    cv::Mat sRinv = (1.0/ms12i)*mR12i.t();
-
-    sRinv.copyTo(mT21i.rowRange(0,3).colRange(0,3));
-    cv::Mat tinv = -sRinv*mt12i;
-    tinv.copyTo(mT21i.rowRange(0,3).col(3));
+    const Eigen::Matrix3d sRinv = R.transpose()/s;
+    msR21i = sRinv.cast<float>();
+    mt21i = (-sRinv*t).cast<float>();
 }
 
-
-void Sim3Solver::CheckInliers()
+void Sim3Solver::StoreBest()
 {
-    vector<cv::Mat> vP1im2, vP2im1;
-    Project(mvX3Dc2,vP2im1,mT12i,pCamera1);
-    Project(mvX3Dc1,vP1im2,mT21i,pCamera2);
-
-    mnInliersi=0;
+    mBestT12 = cv::Mat::eye(4,4,CV_32F);
+    mBestRotation.create(3,3,CV_32F);
+    mBestTranslation.create(3,1,CV_32F);
+    for(int r=0; r<3; r++)
+    {
+        for(int c=0; c<3; c++)
+        {
+            mBestT12.at<float>(r,c) = msR12i(r,c);
+            mBestRotation.at<float>(r,c) = mR12i(r,c);
+        }
+        mBestT12.at<float>(r,3) = mt12i[r];
+        mBestTranslation.at<float>(r) = mt12i[r];
+    }
+    mBestScale = ms12i;
+}
 
-    for(size_t i=0; i<mvP1im1.size(); i++)
+void Sim3Solver::CheckBlock(const size_t* pIndices, const int n, unsigned char* pbConsistent)
+{
+    float X[SIM3_CHECK_BLOCK], Y[SIM3_CHECK_BLOCK], Z[SIM3_CHECK_BLOCK];
+    float U[SIM3_CHECK_BLOCK], V[SIM3_CHECK_BLOCK];
+    float err1[SIM3_CHECK_BLOCK];
+
+    // Points of camera 2 in camera 1, reprojection error in image 1
+    const Eigen::Matrix3f &A = msR12i;
+    const Eigen::Vector3f &a = mt12i;
+    for(int k=0; k<n; k++)
     {
-        cv::Mat dist1 = mvP1im1[i]-vP2im1[i];
-        cv::Mat dist2 = vP1im2[i]-mvP2im2[i];
+        const size_t i = pIndices[k];
+        X[k] = A(0,0)*mvX2[i]+A(0,1)*mvY2[i]+A(0,2)*mvZ2[i]+a[0];
+        Y[k] = A(1,0)*mvX2[i]+A(1,1)*mvY2[i]+A(1,2)*mvZ2[i]+a[1];
+        Z[k] = A(2,0)*mvX2[i]+A(2,1)*mvY2[i]+A(2,2)*mvZ2[i]+a[2];
+    }
+    pCamera1->projectMany(X,Y,Z,n,U,V);
+    for(int k=0; k<n; k++)
+    {
+        const size_t i = pIndices[k];
+        const float du = mvU1[i]-U[k];
+        const float dv = mvV1[i]-V[k];
+        err1[k] = du*du+dv*dv;
+    }
 
-        const float err1 = dist1.dot(dist1);
-        const float err2 = dist2.dot(dist2);
+    // Points of camera 1 in camera 2, reprojection error in image 2
+    const Eigen::Matrix3f &B = msR21i;
+    const Eigen::Vector3f &b = mt21i;
+    for(int k=0; k<n; k++)
+    {
+        const size_t i = pIndices[k];
+        X[k] = B(0,0)*mvX1[i]+B(0,1)*mvY1[i]+B(0,2)*mvZ1[i]+b[0];
+        Y[k] = B(1,0)*mvX1[i]+B(1,1)*mvY1[i]+B(1,2)*mvZ1[i]+b[1];
+        Z[k] = B(2,0)*mvX1[i]+B(2,1)*mvY1[i]+B(2,2)*mvZ1[i]+b[2];
+    }
+    pCamera2->projectMany(X,Y,Z,n,U,V);
+    for(int k=0; k<n; k++)
+    {
+        const size_t i = pIndices[k];
+        const float du = U[k]-mvU2[i];
+        const float dv = V[k]-mvV2[i];
+        const float err2 = du*du+dv*dv;
 
-        if(err1<mvnMaxError1[i] && err2<mvnMaxError2[i])
-        {
-            mvbInliersi[i]=true;
-            mnInliersi++;
-        }
-        else
-            mvbInliersi[i]=false;
+        pbConsistent[k] = err1[k]<mvnMaxError1[i] && err2<mvnMaxError2[i];
     }
 }
 
+bool Sim3Solver::CheckInliers(bool bSPRT)
+{
+    // Correspondences are checked by blocks, so that at most one block is checked after SPRT rejects
+    auto checkBlock = [this](const size_t* pIndices, const int n, unsigned char* pbConsistent)
+    {
+        CheckBlock(pIndices,n,pbConsistent);
+    };
+
+    return mSampler.EvaluateBlocks(checkBlock,SIM3_CHECK_BLOCK,mvbInliersi,mnInliersi,bSPRT);
+}
+
 
 cv::Mat Sim3Solver::GetEstimatedRotation()
 {
@@ -489,20 +503,4 @@ void Sim3Solver::Project(const vector<cv::Mat> &vP3Dw, vector<cv::Mat> &vP2D, cv
     }
 }
 
-void Sim3Solver::FromCameraToImage(const vector<cv::Mat> &vP3Dc, vector<cv::Mat> &vP2D, GeometricCamera* pCamera)
-{
-    vP2D.clear();
-    vP2D.reserve(vP3Dc.size());
-
-    for(size_t i=0, iend=vP3Dc.size(); i<iend; i++)
-    {
-        const float invz = 1/(vP3Dc[i].at<float>(2));
-        const float x = vP3Dc[i].at<float>(0);
-        const float y = vP3Dc[i].at<float>(1);
-        const float z = vP3Dc[i].at<float>(2);
-
-        vP2D.push_back(pCamera->projectMat(cv::Point3f(x,y,z)));
-    }
-}
-
 } //namespace ORB_SLAM
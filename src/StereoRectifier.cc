@@ -0,0 +1,164 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "StereoRectifier.h"
+
+#include <opencv2/opencv.hpp>
+
+namespace ORB_SLAM3
+{
+
+// Fractions of the fixed point maps (INTER_BITS of OpenCV)
+static const int REMAP_BITS = 5;
+static const int REMAP_SIZE = 1<<REMAP_BITS;
+static const int REMAP_MASK = REMAP_SIZE-1;
+
+// Gray value of a pixel as cv::cvtColor (weights of 14 bits)
+template<int CN, bool bRGB>
+static inline int Gray(const unsigned char* p)
+{
+    if(CN==1)
+        return p[0];
+    const int r = bRGB ? p[0] : p[2];
+    const int b = bRGB ? p[2] : p[0];
+    return (r*4899 + p[1]*9617 + b*1868 + (1<<13)) >> 14;
+}
+
+// Gray value of pixel (x,y), 0 outside the image
+template<int CN, bool bRGB>
+static inline int GrayOrZero(const cv::Mat &im, const int x, const int y)
+{
+    if(x<0 || y<0 || x>=im.cols || y>=im.rows)
+        return 0;
+    return Gray<CN,bRGB>(im.data+y*im.step+x*CN);
+}
+
+template<int CN, bool bRGB>
+static void RemapRow(const cv::Mat &im, const short* pMap1, const unsigned short* pMap2, const int w, unsigned char* pRow)
+{
+    const int cols = im.cols, rows = im.rows;
+    const size_t step = im.step;
+    for(int x=0; x<w; x++)
+    {
+        const int sx = pMap1[2*x], sy = pMap1[2*x+1];
+        const int fx = pMap2[x] & REMAP_MASK, fy = pMap2[x] >> REMAP_BITS;
+
+        int v00, v01, v10, v11;
+        if(sx>=0 && sy>=0 && sx<cols-1 && sy<rows-1)
+        {
+            const unsigned char* p = im.data+sy*step+sx*CN;
+            v00 = Gray<CN,bRGB>(p);
+            v01 = Gray<CN,bRGB>(p+CN);
+            v10 = Gray<CN,bRGB>(p+step);
+            v11 = Gray<CN,bRGB>(p+step+CN);
+        }
+        else
+        {
+            v00 = GrayOrZero<CN,bRGB>(im,sx,sy);
+            v01 = GrayOrZero<CN,bRGB>(im,sx+1,sy);
+            v10 = GrayOrZero<CN,bRGB>(im,sx,sy+1);
+            v11 = GrayOrZero<CN,bRGB>(im,sx+1,sy+1);
+        }
+
+        const int top = v00*(REMAP_SIZE-fx) + v01*fx;
+        const int bottom = v10*(REMAP_SIZE-fx) + v11*fx;
+        pRow[x] = static_cast<unsigned char>((top*(REMAP_SIZE-fy) + bottom*fy + (1<<(2*REMAP_BITS-1))) >> (2*REMAP_BITS));
+    }
+}
+
+StereoRectifier::StereoRectifier(const cv::Mat &K_l, const cv::Mat &D_l, const cv::Mat &R_l, const cv::Mat &P_l, const cv::Size &size_l,
+                                 const cv::Mat &K_r, const cv::Mat &D_r, const cv::Mat &R_r, const cv::Mat &P_r, const cv::Size &size_r)
+{
+    mCams[0].size = size_l;
+    mCams[1].size = size_r;
+    cv::initUndistortRectifyMap(K_l,D_l,R_l,P_l.rowRange(0,3).colRange(0,3),size_l,CV_16SC2,mCams[0].map1,mCams[0].map2);
+    cv::initUndistortRectifyMap(K_r,D_r,R_r,P_r.rowRange(0,3).colRange(0,3),size_r,CV_16SC2,mCams[1].map1,mCams[1].map2);
+}
+
+StereoRectifier* StereoRectifier::FromSettings(cv::FileStorage &fSettings)
+{
+    cv::Mat K_l, K_r, P_l, P_r, R_l, R_r, D_l, D_r;
+    fSettings["LEFT.K"] >> K_l;
+    fSettings["RIGHT.K"] >> K_r;
+    fSettings["LEFT.P"] >> P_l;
+    fSettings["RIGHT.P"] >> P_r;
+    fSettings["LEFT.R"] >> R_l;
+    fSettings["RIGHT.R"] >> R_r;
+    fSettings["LEFT.D"] >> D_l;
+    fSettings["RIGHT.D"] >> D_r;
+
+    const int rows_l = fSettings["LEFT.height"];
+    const int cols_l = fSettings["LEFT.width"];
+    const int rows_r = fSettings["RIGHT.height"];
+    const int cols_r = fSettings["RIGHT.width"];
+
+    if(K_l.empty() || K_r.empty() || P_l.empty() || P_r.empty() || R_l.empty() || R_r.empty() || D_l.empty() || D_r.empty() ||
+       rows_l==0 || rows_r==0 || cols_l==0 || cols_r==0)
+        return static_cast<StereoRectifier*>(NULL);
+
+    return new StereoRectifier(K_l,D_l,R_l,P_l,cv::Size(cols_l,rows_l),K_r,D_r,R_r,P_r,cv::Size(cols_r,rows_r));
+}
+
+PyramidRowSource* StereoRectifier::Source(const int cam, const cv::Mat &im, const bool bRGB)
+{
+    CV_Assert(im.size()==mCams[cam].size && im.depth()==CV_8U);
+    mSources[cam].Set(&mCams[cam],im,bRGB);
+    return &mSources[cam];
+}
+
+void StereoRectifier::Rectify(const int cam, const cv::Mat &im, const bool bRGB, cv::Mat &imRect)
+{
+    PyramidRowSource* pSource = Source(cam,im,bRGB);
+    imRect.create(mCams[cam].size,CV_8UC1);
+    for(int y=0; y<imRect.rows; y++)
+        pSource->GetRow(y,imRect.ptr<unsigned char>(y));
+}
+
+void StereoRectifier::RowSource::Set(const Camera* pCam, const cv::Mat &im, const bool bRGB)
+{
+    mpCam = pCam;
+    mIm = im;
+    mbRGB = bRGB;
+}
+
+void StereoRectifier::RowSource::GetRow(const int y, unsigned char* pRow)
+{
+    const short* pMap1 = mpCam->map1.ptr<short>(y);
+    const unsigned short* pMap2 = mpCam->map2.ptr<unsigned short>(y);
+    const int w = mpCam->size.width;
+
+    switch(mIm.channels())
+    {
+    case 3:
+        if(mbRGB)
+            RemapRow<3,true>(mIm,pMap1,pMap2,w,pRow);
+        else
+            RemapRow<3,false>(mIm,pMap1,pMap2,w,pRow);
+        break;
+    case 4:
+        if(mbRGB)
+            RemapRow<4,true>(mIm,pMap1,pMap2,w,pRow);
+        else
+            RemapRow<4,false>(mIm,pMap1,pMap2,w,pRow);
+        break;
+    default:
+        RemapRow<1,false>(mIm,pMap1,pMap2,w,pRow);
+    }
+}
+
+} //namespace ORB_SLAM3
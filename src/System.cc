@@ -20,9 +20,28 @@
 
 #include "System.h"
 #include "Converter.h"
+#include "ThreadPool.h"
+#include "AtlasArchive.h"
+#include "Metrics.h"
+#include "Optimizer.h"
+#include "EpochManager.h"
+#include "MapStreamer.h"
+#include "TileStreamer.h"
+#include "TrajectoryWriter.h"
+#include "TrajectoryStore.h"
+#include "AgentClient.h"
+#include "SharedMapPublisher.h"
+#include "TrajectoryFile.h"
+#include "Tracer.h"
+#include "ReplayLog.h"
+#include "MapRefiner.h"
+#include "ThreadScheduling.h"
+#include "PowerGovernor.h"
+#include "VocabularyLoader.h"
 #include <thread>
 #include <pangolin/pangolin.h>
 #include <iomanip>
+#include <cstring>
 #include <openssl/md5.h>
 #include <boost/serialization/base_object.hpp>
 #include <boost/serialization/string.hpp>
@@ -38,10 +57,55 @@ namespace ORB_SLAM3
 
 Verbose::eLevel Verbose::th = Verbose::VERBOSITY_NORMAL;
 
+ORBVocabulary* System::LoadVocabulary(const string &strVocFile)
+{
+    cout << endl << "Loading ORB Vocabulary. This could take a while..." << endl;
+
+    ORBVocabulary* pVocabulary = new ORBVocabulary();
+    // Binary vocabularies (see Examples/Tools/bin_vocabulary) are memory mapped
+    if(!VocabularyLoader::Load(pVocabulary, strVocFile))
+    {
+        cerr << "Wrong path to vocabulary. " << endl;
+        cerr << "Falied to open at: " << strVocFile << endl;
+        delete pVocabulary;
+        return static_cast<ORBVocabulary*>(NULL);
+    }
+    cout << "Vocabulary loaded!" << endl << endl;
+    return pVocabulary;
+}
+
+ORBVocabulary* System::LoadVocabularyAsync(const string &strVocFile)
+{
+    cout << endl << "Loading ORB Vocabulary in the background" << endl;
+
+    ORBVocabulary* pVocabulary = new ORBVocabulary();
+    if(!VocabularyLoader::LoadAsync(pVocabulary, strVocFile))
+    {
+        cerr << "Wrong path to vocabulary. " << endl;
+        cerr << "Falied to open at: " << strVocFile << endl;
+        delete pVocabulary;
+        return static_cast<ORBVocabulary*>(NULL);
+    }
+    return pVocabulary;
+}
+
 System::System(const string &strVocFile, const string &strSettingsFile, const eSensor sensor,
                const bool bUseViewer, const int initFr, const string &strSequence, const string &strLoadingFile):
-    mSensor(sensor), mpViewer(static_cast<Viewer*>(NULL)), mbReset(false), mbResetActiveMap(false),
-    mbActivateLocalizationMode(false), mbDeactivateLocalizationMode(false)
+    System(LoadVocabularyAsync(strVocFile), strSettingsFile, sensor, bUseViewer, initFr, strSequence, strLoadingFile)
+{
+}
+
+System::System(ORBVocabulary* pVocabulary, const string &strSettingsFile, const eSensor sensor,
+               const bool bUseViewer, const int initFr, const string &strSequence, const string &strLoadingFile):
+    mSensor(sensor), mpVocabulary(pVocabulary), mpViewer(static_cast<Viewer*>(NULL)), mpMapStreamer(static_cast<MapStreamer*>(NULL)), mptMapStreamer(static_cast<thread*>(NULL)),
+    mpTileStreamer(static_cast<TileStreamer*>(NULL)), mptTileStreamer(static_cast<thread*>(NULL)),
+    mpTrajectoryWriter(static_cast<TrajectoryWriter*>(NULL)), mptTrajectoryWriter(static_cast<thread*>(NULL)), mpTrajectoryStore(static_cast<TrajectoryStore*>(NULL)), mpAgentClient(static_cast<AgentClient*>(NULL)), mptAgentClient(static_cast<thread*>(NULL)),
+    mpSharedMap(static_cast<SharedMapPublisher*>(NULL)), mptSharedMap(static_cast<thread*>(NULL)), mnSharedMapSubscription(-1), mptImuPreintegration(static_cast<thread*>(NULL)), mptPipelinePreprocess(static_cast<thread*>(NULL)),
+    mptPipelineTracking(static_cast<thread*>(NULL)), mnPipelinePending(0), mbPipelineTracking(false),
+    mbPipelinePreprocessDone(false), mbFinishPipeline(false), mDropPolicy(BLOCK), mnInputQueueSize(1), mfCandidateInterval(0.5),
+    mfLastCandidateTime(-1.0), mnDroppedFrames(0), mpReplayLog(static_cast<ReplayLog*>(NULL)), mpPowerGovernor(static_cast<PowerGovernor*>(NULL)), mbReset(false), mbResetActiveMap(false),
+    mbActivateLocalizationMode(false), mbDeactivateLocalizationMode(false), mbImuStreamed(false), mfImuWaitTime(0.02),
+    mTrackingDegradations(0)
 {
     // Output welcome message
     cout << endl <<
@@ -74,29 +138,247 @@ System::System(const string &strVocFile, const string &strSettingsFile, const eS
 
     bool loadedAtlas = false;
 
-    //----
-    //Load ORB Vocabulary
-    cout << endl << "Loading ORB Vocabulary. This could take a while..." << endl;
+    mStrLoadAtlasFromFile = strLoadingFile;
+    cv::FileNode nodeAtlas = fsSettings["System.LoadAtlasFromFile"];
+    if(mStrLoadAtlasFromFile.empty() && !nodeAtlas.empty() && nodeAtlas.isString())
+        mStrLoadAtlasFromFile = nodeAtlas.string();
+    cv::FileNode nodeLazy = fsSettings["System.LazyAtlasLoad"];
+    mbLazyAtlasLoad = !nodeLazy.empty() && nodeLazy.isInt() && nodeLazy.operator int() != 0;
+    nodeAtlas = fsSettings["System.SaveAtlasToFile"];
+    if(!nodeAtlas.empty() && nodeAtlas.isString())
+        mStrSaveAtlasToFile = nodeAtlas.string();
+    cv::FileNode nodeTrace = fsSettings["System.TraceFile"];
+    if(!nodeTrace.empty() && nodeTrace.isString())
+        mStrTraceFile = nodeTrace.string();
+
+    //Backlog policy of the pipelined tracking (Submit*)
+    cv::FileNode nodeDrop = fsSettings["System.DropPolicy"];
+    if(!nodeDrop.empty() && nodeDrop.isString())
+    {
+        const string strPolicy = nodeDrop.string();
+        if(strPolicy == "drop_oldest")
+            mDropPolicy = DROP_OLDEST;
+        else if(strPolicy == "keep_latest")
+            mDropPolicy = KEEP_LATEST;
+        else if(strPolicy == "keep_keyframes")
+            mDropPolicy = KEEP_KEYFRAME_CANDIDATES;
+        else if(strPolicy != "block")
+            cerr << "Unknown System.DropPolicy " << strPolicy << ", images are not dropped" << endl;
+    }
+    cv::FileNode nodeQueue = fsSettings["System.InputQueueSize"];
+    if(!nodeQueue.empty() && nodeQueue.isInt() && nodeQueue.operator int() > 0)
+        mnInputQueueSize = nodeQueue.operator int();
+    cv::FileNode nodeInterval = fsSettings["System.KeyFrameCandidateInterval"];
+    if(!nodeInterval.empty() && nodeInterval.isReal())
+        mfCandidateInterval = nodeInterval.real();
+    cv::FileNode nodeImuWait = fsSettings["System.ImuWaitMs"];
+    if(!nodeImuWait.empty() && nodeImuWait.isReal())
+        mfImuWaitTime = nodeImuWait.real()/1000.0;
 
-    mpVocabulary = new ORBVocabulary();
-    bool bVocLoad = mpVocabulary->loadFromTextFile(strVocFile);
-    if(!bVocLoad)
+    //----
+    //ORB Vocabulary (loaded by the caller or by the other constructor)
+    if(!mpVocabulary)
     {
-        cerr << "Wrong path to vocabulary. " << endl;
-        cerr << "Falied to open at: " << strVocFile << endl;
+        cerr << "No ORB vocabulary" << endl;
         exit(-1);
     }
-    cout << "Vocabulary loaded!" << endl << endl;
+
+    //Offline map building from recordings: no frame or keyframe is dropped, tracking waits for Local
+    //Mapping instead, and the mapping stages use all the cores unless System.nThreads says otherwise
+    bool bOfflineMapping = false;
+    cv::FileNode nodeOffline = fsSettings["System.OfflineMapping"];
+    if(!nodeOffline.empty() && nodeOffline.isInt() && nodeOffline.operator int())
+    {
+        bOfflineMapping = true;
+        if(mDropPolicy != BLOCK)
+            cerr << "System.DropPolicy is ignored in offline mapping" << endl;
+        mDropPolicy = BLOCK;
+    }
+
+    //Low-power (duty-cycled) operation: Local Mapping and place recognition work in bursts to keep the
+    //CPU time per frame under System.LowPowerFrameBudget (ms), the cores sleep in between. No worker
+    //threads are kept unless System.nThreads says otherwise and the viewer is not started
+    bool bLowPower = false;
+    cv::FileNode nodeLowPower = fsSettings["System.LowPower"];
+    if(!nodeLowPower.empty() && nodeLowPower.isInt() && nodeLowPower.operator int())
+    {
+        if(bOfflineMapping)
+            cerr << "System.LowPower is ignored in offline mapping" << endl;
+        else
+            bLowPower = true;
+    }
+
+    //Create the worker pool shared by all the threads
+    int nPoolThreads = bOfflineMapping ? max((int)thread::hardware_concurrency(),2) : (bLowPower ? 0 : 2);
+    cv::FileNode nodeThreads = fsSettings["System.nThreads"];
+    if(!nodeThreads.empty() && nodeThreads.isInt())
+        nPoolThreads = max(nodeThreads.operator int(),0);
+    mpThreadPool = new ThreadPool(nPoolThreads);
+    cout << "Worker threads: " << nPoolThreads << endl;
+
+    if(bLowPower)
+    {
+        float fFrameBudget = 20.f;
+        cv::FileNode nodeFrameBudget = fsSettings["System.LowPowerFrameBudget"];
+        if(!nodeFrameBudget.empty() && nodeFrameBudget.isReal() && nodeFrameBudget.real() > 0)
+            fFrameBudget = nodeFrameBudget.real();
+
+        int nMaxBurst = 4;
+        cv::FileNode nodeMaxBurst = fsSettings["System.LowPowerMaxBurst"];
+        if(!nodeMaxBurst.empty() && nodeMaxBurst.isInt() && nodeMaxBurst.operator int() > 0)
+            nMaxBurst = nodeMaxBurst.operator int();
+
+        float fMaxDelay = 1.f;
+        cv::FileNode nodeMaxDelay = fsSettings["System.LowPowerMaxDelay"];
+        if(!nodeMaxDelay.empty() && nodeMaxDelay.isReal() && nodeMaxDelay.real() > 0)
+            fMaxDelay = nodeMaxDelay.real();
+
+        mpPowerGovernor = new PowerGovernor(fFrameBudget, nMaxBurst-1, fMaxDelay);
+        cout << "Low-power mode, CPU budget: " << fFrameBudget << " ms per frame, bursts of up to " << nMaxBurst << " keyframes" << endl;
+    }
+
+    mpMetrics = new Metrics();
+    //Timestamps taken from the system clock (UNIX time) give the latency from the capture to the pose
+    cv::FileNode nodeClock = fsSettings["System.TimestampClock"];
+    if(!nodeClock.empty() && nodeClock.isString())
+    {
+        if(nodeClock.string() == "system")
+            mpMetrics->SetSystemClockTimestamps(true);
+        else if(nodeClock.string() != "sensor")
+            cerr << "Unknown System.TimestampClock " << nodeClock.string() << ", capture latency is not measured" << endl;
+    }
 
     //Create KeyFrame Database
     mpKeyFrameDatabase = new KeyFrameDatabase(*mpVocabulary);
+    mpKeyFrameDatabase->SetThreadPool(mpThreadPool);
+
+    //Approximate nearest neighbour shortlist of place recognition candidates (large maps)
+    cv::FileNode nodeShortlist = fsSettings["KeyFrameDatabase.GlobalShortlist"];
+    if(!nodeShortlist.empty() && nodeShortlist.isInt() && nodeShortlist.operator int() > 0)
+    {
+        int nGlobalDim = 256;
+        cv::FileNode nodeGlobalDim = fsSettings["KeyFrameDatabase.GlobalDescriptorDim"];
+        if(!nodeGlobalDim.empty() && nodeGlobalDim.isInt())
+            nGlobalDim = nodeGlobalDim.operator int();
+        mpKeyFrameDatabase->SetGlobalShortlist(nodeShortlist.operator int(), nGlobalDim);
+        cout << "Place recognition shortlist: " << nodeShortlist.operator int() << " keyframes per map" << endl;
+    }
+
+    //Keyframes per submap, loop corrections optimize the graph of submap anchors (0: whole essential graph).
+    //Read before the atlas is loaded, the submaps of the loaded maps are rebuilt with it
+    cv::FileNode nodeSubmap = fsSettings["Map.KeyFramesPerSubmap"];
+    if(!nodeSubmap.empty() && nodeSubmap.isInt() && nodeSubmap.operator int() > 0)
+    {
+        mContext.mnKeyFramesPerSubmap = nodeSubmap.operator int();
+        cout << "Submaps of " << mContext.mnKeyFramesPerSubmap << " keyframes" << endl;
+    }
+
+    //Create the Atlas, starting from a saved one if requested
+    if(!mStrLoadAtlasFromFile.empty())
+    {
+        mpAtlas = new Atlas();
+        loadedAtlas = LoadAtlas(mStrLoadAtlasFromFile, BINARY_FILE);
+        if(loadedAtlas)
+        {
+            // The new session always starts in a new map. Old maps are reached through
+            // place recognition (map merging)
+            mpAtlas->CreateNewMap();
+        }
+        else
+        {
+            delete mpAtlas;
+            mpKeyFrameDatabase->clear();
+        }
+    }
+
+    if(!loadedAtlas)
+        mpAtlas = new Atlas(0);
+    mpAtlas->SetSystemContext(&mContext);
 
-    //Create the Atlas
-    mpAtlas = new Atlas(0);
+    //Changes of the maps for the subscribers (SubscribeMapEvents)
+    mpMapEvents = new MapEvents();
+    mpAtlas->SetMapEvents(mpMapEvents);
 
     if (mSensor==IMU_STEREO || mSensor==IMU_MONOCULAR)
         mpAtlas->SetInertialSensor();
 
+    //Features of inactive maps are moved to disk past this budget (0 keeps everything in memory)
+    cv::FileNode nodeBudget = fsSettings["Atlas.MemoryBudgetMB"];
+    if(!nodeBudget.empty() && nodeBudget.isInt() && nodeBudget.operator int() > 0)
+    {
+        string strSpillDir = "/tmp";
+        cv::FileNode nodeSpillDir = fsSettings["Atlas.SpillDirectory"];
+        if(!nodeSpillDir.empty() && nodeSpillDir.isString())
+            strSpillDir = nodeSpillDir.string();
+        mpAtlas->SetMemoryBudget(size_t(nodeBudget.operator int())*1024*1024, strSpillDir);
+        cout << "Atlas memory budget: " << nodeBudget.operator int() << " MB, spilling to " << strSpillDir << endl;
+    }
+
+    //Sparse linear solver of full BA and essential graph (eigen by default, cholmod if compiled in, pcg)
+    cv::FileNode nodeSolver = fsSettings["Optimizer.LinearSolver"];
+    if(!nodeSolver.empty() && nodeSolver.isString())
+    {
+        if(nodeSolver.string() == "cholmod")
+        {
+            if(mContext.mOptimizer.SetLinearSolverType(OptimizerSettings::LINEAR_SOLVER_CHOLMOD))
+                cout << "Using CHOLMOD for full BA and essential graph" << endl;
+            else
+                cerr << "CHOLMOD not available in this build, using the Eigen solver" << endl;
+        }
+        else if(nodeSolver.string() == "pcg")
+        {
+            mContext.mOptimizer.SetLinearSolverType(OptimizerSettings::LINEAR_SOLVER_PCG);
+            cout << "Using PCG for full BA and essential graph" << endl;
+        }
+        else if(nodeSolver.string() != "eigen")
+            cerr << "Unknown Optimizer.LinearSolver " << nodeSolver.string() << ", using the Eigen solver" << endl;
+    }
+
+    //Engine of the visual-only full and local BA (g2o by default, native solver on the worker pool)
+    cv::FileNode nodeVisualBA = fsSettings["Optimizer.VisualBA"];
+    if(!nodeVisualBA.empty() && nodeVisualBA.isString())
+    {
+        if(nodeVisualBA.string() == "native")
+        {
+            mContext.mOptimizer.visualBAEngine = OptimizerSettings::VISUAL_BA_NATIVE;
+            mContext.mOptimizer.pThreadPool = mpThreadPool;
+            cout << "Using the native solver for visual BA" << endl;
+        }
+        else if(nodeVisualBA.string() != "g2o")
+            cerr << "Unknown Optimizer.VisualBA " << nodeVisualBA.string() << ", using g2o" << endl;
+    }
+
+    //Arithmetic of the residuals of the native visual BA
+    cv::FileNode nodeBAPrecision = fsSettings["Optimizer.VisualBAPrecision"];
+    if(!nodeBAPrecision.empty() && nodeBAPrecision.isString())
+    {
+        if(nodeBAPrecision.string() == "single")
+        {
+            mContext.mOptimizer.bVisualBASingle = true;
+            cout << "Using single-precision residuals in the native visual BA" << endl;
+        }
+        else if(nodeBAPrecision.string() != "double")
+            cerr << "Unknown Optimizer.VisualBAPrecision " << nodeBAPrecision.string() << ", using double" << endl;
+    }
+
+    //Convergence criteria of the pose optimization, local BA and essential graph (0: fixed iterations)
+    cv::FileNode nodeRelDecrease = fsSettings["Optimizer.ConvergenceRelativeDecrease"];
+    if(!nodeRelDecrease.empty() && nodeRelDecrease.isReal())
+        mContext.mOptimizer.convergence.relativeDecrease = nodeRelDecrease.real();
+    cv::FileNode nodeUpdateNorm = fsSettings["Optimizer.ConvergenceUpdateNorm"];
+    if(!nodeUpdateNorm.empty() && nodeUpdateNorm.isReal())
+        mContext.mOptimizer.convergence.updateNorm = nodeUpdateNorm.real();
+
+    //Extra epochs a culled keyframe or map point is kept before its memory is reclaimed
+    cv::FileNode nodeGrace = fsSettings["Memory.ReclaimGracePeriod"];
+    if(!nodeGrace.empty() && nodeGrace.isInt())
+        mContext.mnReclaimGracePeriod = max(nodeGrace.operator int(),0);
+
+    //Observed descriptors considered for the distinctive descriptor of each map point (0: all)
+    cv::FileNode nodeDescObs = fsSettings["MapPoint.MaxDescriptorObservations"];
+    if(!nodeDescObs.empty() && nodeDescObs.isInt())
+        mContext.mnMaxDescriptorObservations = max(nodeDescObs.operator int(),0);
+
     //Create Drawers. These are used by the Viewer
     mpFrameDrawer = new FrameDrawer(mpAtlas);
     mpMapDrawer = new MapDrawer(mpAtlas, strSettingsFile);
@@ -105,10 +387,95 @@ System::System(const string &strVocFile, const string &strSettingsFile, const eS
     //(it will live in the main thread of execution, the one that called this constructor)
     cout << "Seq. Name: " << strSequence << endl;
     mpTracker = new Tracking(this, mpVocabulary, mpFrameDrawer, mpMapDrawer,
-                             mpAtlas, mpKeyFrameDatabase, strSettingsFile, mSensor, strSequence);
+                             mpAtlas, mpKeyFrameDatabase, &mContext, strSettingsFile, mSensor, strSequence);
+
+    //Preintegrate the IMU measurements on arrival instead of when the next frame is tracked
+    cv::FileNode nodeIncPreint = fsSettings["IMU.IncrementalPreintegration"];
+    if((mSensor==IMU_MONOCULAR || mSensor==IMU_STEREO) && !nodeIncPreint.empty() && nodeIncPreint.isInt() && nodeIncPreint.operator int())
+    {
+        StartImuPreintegration();
+        cout << "Incremental IMU preintegration" << endl;
+    }
+
+    //Trajectory written while running, Tracking then only keeps the last frames in memory
+    cv::FileNode nodeTrajStream = fsSettings["System.TrajectoryStream"];
+    if(!nodeTrajStream.empty() && nodeTrajStream.isString())
+    {
+        mpTrajectoryWriter = new TrajectoryWriter(nodeTrajStream.string());
+        if(mpTrajectoryWriter->IsOpen())
+        {
+            int nHistory = 1000;
+            cv::FileNode nodeHistory = fsSettings["System.TrajectoryHistory"];
+            if(!nodeHistory.empty() && nodeHistory.isInt() && nodeHistory.operator int() > 0)
+                nHistory = nodeHistory.operator int();
+
+            mptTrajectoryWriter = new thread(&TrajectoryWriter::Run, mpTrajectoryWriter);
+            mpTracker->SetTrajectoryWriter(mpTrajectoryWriter, nHistory);
+            cout << "Streaming trajectory to " << nodeTrajStream.string() << ", last " << nHistory << " frames kept in memory" << endl;
+        }
+        else
+        {
+            cerr << "Cannot open trajectory stream " << nodeTrajStream.string() << endl;
+            delete mpTrajectoryWriter;
+            mpTrajectoryWriter = static_cast<TrajectoryWriter*>(NULL);
+        }
+    }
+
+    //Last frames indexed by time for the pose queries (GetPoseAtTime)
+    cv::FileNode nodeTrajStore = fsSettings["System.TrajectoryStoreSize"];
+    if(!nodeTrajStore.empty() && nodeTrajStore.isInt() && nodeTrajStore.operator int() > 0)
+    {
+        mpTrajectoryStore = new TrajectoryStore(nodeTrajStore.operator int());
+        mpTracker->SetTrajectoryStore(mpTrajectoryStore);
+        cout << "Trajectory store of the last " << nodeTrajStore.operator int() << " frames" << endl;
+    }
+
+    //Last pose and snapshot of the maps in shared memory for the other processes (SharedMapLayout.h)
+    cv::FileNode nodeShm = fsSettings["SharedMemory.Name"];
+    if(!nodeShm.empty() && nodeShm.isString())
+    {
+        int nMaxMPs = 500000;
+        cv::FileNode nodeMaxMPs = fsSettings["SharedMemory.MaxMapPoints"];
+        if(!nodeMaxMPs.empty() && nodeMaxMPs.isInt() && nodeMaxMPs.operator int() > 0)
+            nMaxMPs = nodeMaxMPs.operator int();
+        int nMaxKFs = 20000;
+        cv::FileNode nodeMaxKFs = fsSettings["SharedMemory.MaxKeyFrames"];
+        if(!nodeMaxKFs.empty() && nodeMaxKFs.isInt() && nodeMaxKFs.operator int() > 0)
+            nMaxKFs = nodeMaxKFs.operator int();
+        float fMapFPS = 2.f;
+        cv::FileNode nodeMapFPS = fsSettings["SharedMemory.MapFPS"];
+        if(!nodeMapFPS.empty() && nodeMapFPS.isReal() && nodeMapFPS.real() > 0)
+            fMapFPS = nodeMapFPS.real();
+
+        mpSharedMap = new SharedMapPublisher(nodeShm.string(), nMaxMPs, nMaxKFs, fMapFPS);
+        if(mpSharedMap->IsOpen())
+        {
+            mptSharedMap = new thread(&SharedMapPublisher::Run, mpSharedMap);
+            mnSharedMapSubscription = SubscribeMapEvents(std::bind(&SharedMapPublisher::OnMapEvents, mpSharedMap, std::placeholders::_1));
+            cout << "Publishing the pose and the map in shared memory " << nodeShm.string() << endl;
+        }
+        else
+        {
+            delete mpSharedMap;
+            mpSharedMap = static_cast<SharedMapPublisher*>(NULL);
+        }
+    }
+
+    //CPU affinity and scheduling of the SLAM threads (Thread.<name>.*), each thread applies its own
+    //when it starts. Tracking runs on the caller thread, it is set on the first frame tracked
+    vector<ThreadScheduling> vThreadSchedulings;
+    const char* vThreadNames[] = {"Tracking", "LocalMapping", "LoopClosing", "Viewer", "GBA"};
+    for(int i=0; i<5; i++)
+    {
+        vThreadSchedulings.push_back(ThreadScheduling::Read(fsSettings, vThreadNames[i]));
+        if(!vThreadSchedulings.back().IsDefault())
+            cout << vThreadNames[i] << " thread: " << vThreadSchedulings.back().ToString() << endl;
+    }
+    mpTracker->SetThreadScheduling(vThreadSchedulings[0]);
 
     //Initialize the Local Mapping thread and launch
     mpLocalMapper = new LocalMapping(this, mpAtlas, mSensor==MONOCULAR || mSensor==IMU_MONOCULAR, mSensor==IMU_MONOCULAR || mSensor==IMU_STEREO, strSequence);
+    mpLocalMapper->SetThreadScheduling(vThreadSchedulings[1]);
     mptLocalMapping = new thread(&ORB_SLAM3::LocalMapping::Run,mpLocalMapper);
     mpLocalMapper->mThFarPoints = fsSettings["thFarPoints"];
     if(mpLocalMapper->mThFarPoints!=0)
@@ -119,20 +486,171 @@ System::System(const string &strVocFile, const string &strSettingsFile, const eS
     else
         mpLocalMapper->mbFarPoints = false;
 
+    //Keyframes of the local inertial BA window that moved less than this are not re-solved
+    cv::FileNode nodeRelin = fsSettings["LocalMapping.InertialRelinThreshold"];
+    if(!nodeRelin.empty() && nodeRelin.isReal() && nodeRelin.real() > 0)
+    {
+        mpLocalMapper->mThInertialRelin = nodeRelin.real();
+        cout << "Incremental local inertial BA, relinearization threshold: " << mpLocalMapper->mThInertialRelin << " m" << endl;
+    }
+
+    //Keyframes leaving the local inertial BA window are marginalized into a prior instead of fixed
+    cv::FileNode nodeSmoother = fsSettings["LocalMapping.InertialSmootherWindow"];
+    if(!nodeSmoother.empty() && nodeSmoother.isInt() && nodeSmoother.operator int() > 0)
+    {
+        mpLocalMapper->mnInertialSmootherWindow = nodeSmoother.operator int();
+        cout << "Fixed-lag inertial smoother, window: " << mpLocalMapper->mnInertialSmootherWindow << " keyframes" << endl;
+    }
+
+    //Keyframes not checked for redundancy within this time are kept
+    cv::FileNode nodeCullingBudget = fsSettings["LocalMapping.KFCullingBudget"];
+    if(!bOfflineMapping && !nodeCullingBudget.empty() && nodeCullingBudget.isReal() && nodeCullingBudget.real() > 0)
+        mpLocalMapper->mThKFCullingBudget = nodeCullingBudget.real();
+
+    //Keyframes and map points per map past which the least informative ones are removed (0: no limit)
+    cv::FileNode nodeMaxKFs = fsSettings["LocalMapping.MaxKeyFrames"];
+    if(!nodeMaxKFs.empty() && nodeMaxKFs.isInt() && nodeMaxKFs.operator int() > 0)
+        mpLocalMapper->mnMaxKeyFrames = nodeMaxKFs.operator int();
+    cv::FileNode nodeMaxMPs = fsSettings["LocalMapping.MaxMapPoints"];
+    if(!nodeMaxMPs.empty() && nodeMaxMPs.isInt() && nodeMaxMPs.operator int() > 0)
+        mpLocalMapper->mnMaxMapPoints = nodeMaxMPs.operator int();
+    if(mpLocalMapper->mnMaxKeyFrames > 0 || mpLocalMapper->mnMaxMapPoints > 0)
+        cout << "Map budget: " << mpLocalMapper->mnMaxKeyFrames << " keyframes, " << mpLocalMapper->mnMaxMapPoints << " map points (0: no limit)" << endl;
+
+    //Closed-form IMU initialization after this many seconds of keyframes (0: disabled)
+    cv::FileNode nodeFastImuInit = fsSettings["LocalMapping.FastImuInitTime"];
+    if(!nodeFastImuInit.empty() && nodeFastImuInit.isReal() && nodeFastImuInit.real() > 0)
+    {
+        // At least 5 keyframes in that time
+        mpLocalMapper->mFastImuInitTime = nodeFastImuInit.real();
+        mpTracker->SetImuInitKeyFrameInterval(std::min(0.25f,mpLocalMapper->mFastImuInitTime/4.f));
+    }
+
+    //Bag of words of the queued keyframes computed on the thread pool ahead of their processing
+    cv::FileNode nodeSpeculative = fsSettings["LocalMapping.SpeculativePreprocessing"];
+    if(!nodeSpeculative.empty() && nodeSpeculative.isInt() && nodeSpeculative.operator int() != 0)
+    {
+        mpLocalMapper->mbSpeculativePreprocessing = true;
+        cout << "Local Mapping speculative preprocessing of queued keyframes" << endl;
+    }
+
+    //Fusion, local BA and keyframe culling are fitted to this time per keyframe (ms) while keyframes are queued
+    cv::FileNode nodeKFBudget = fsSettings["LocalMapping.KeyFrameBudget"];
+    if(!bOfflineMapping && !nodeKFBudget.empty() && nodeKFBudget.isReal() && nodeKFBudget.real() > 0)
+    {
+        mpLocalMapper->EnableScheduler(nodeKFBudget.real());
+        cout << "Local Mapping stage scheduler, keyframe budget: " << nodeKFBudget.real() << " ms" << endl;
+    }
+
+    if(bOfflineMapping)
+    {
+        mpLocalMapper->mbOfflineMapping = true;
+        mpTracker->SetOfflineMapping(true);
+        cout << "Offline mapping: keyframes are not dropped, tracking waits for Local Mapping" << endl;
+    }
+
     //Initialize the Loop Closing thread and launch
     mpLoopCloser = new LoopClosing(mpAtlas, mpKeyFrameDatabase, mpVocabulary, mSensor!=MONOCULAR); // mSensor!=MONOCULAR);
+    mpLoopCloser->SetThreadScheduling(vThreadSchedulings[2], vThreadSchedulings[4]);
     mptLoopClosing = new thread(&ORB_SLAM3::LoopClosing::Run, mpLoopCloser);
 
+    //Local Mapping is only stopped to fuse the loop and to apply the essential graph result
+    cv::FileNode nodeNonBlocking = fsSettings["LoopClosing.NonBlockingCorrection"];
+    if(!nodeNonBlocking.empty() && nodeNonBlocking.isInt() && nodeNonBlocking.operator int())
+    {
+        mpLoopCloser->mbNonBlockingCorrection = true;
+        cout << "Non-blocking loop correction" << endl;
+    }
+
+    cv::FileNode nodeGBARound = fsSettings["LoopClosing.GBARoundIterations"];
+    if(!nodeGBARound.empty() && nodeGBARound.isInt() && nodeGBARound.operator int() > 0)
+    {
+        mpLoopCloser->mnGBARoundIterations = nodeGBARound.operator int();
+        cout << "Global BA published every " << mpLoopCloser->mnGBARoundIterations << " iterations" << endl;
+    }
+
+    //Place recognition is fitted to this time per keyframe (ms), queued keyframes are coalesced when it falls behind
+    cv::FileNode nodePRBudget = fsSettings["LoopClosing.KeyFrameBudget"];
+    if(!nodePRBudget.empty() && nodePRBudget.isReal() && nodePRBudget.real() > 0)
+    {
+        mpLoopCloser->EnableScheduler(nodePRBudget.real());
+        cout << "Place recognition scheduler, keyframe budget: " << nodePRBudget.real() << " ms" << endl;
+    }
+
     //Initialize the Viewer thread and launch
-    if(bUseViewer)
+    if(bUseViewer && bLowPower)
+        cout << "Low-power mode: the viewer is not started" << endl;
+    if(bUseViewer && !bLowPower)
     {
         mpViewer = new Viewer(this, mpFrameDrawer,mpMapDrawer,mpTracker,strSettingsFile);
+        mpViewer->SetThreadScheduling(vThreadSchedulings[3]);
         mptViewer = new thread(&Viewer::Run, mpViewer);
         mpTracker->SetViewer(mpViewer);
         mpLoopCloser->mpViewer = mpViewer;
         mpViewer->both = mpFrameDrawer->both;
     }
 
+    //Compact map stream for a remote viewer. Without the local viewer the drawers are not fed at all
+    cv::FileNode nodeStreamPort = fsSettings["Viewer.StreamPort"];
+    if(!nodeStreamPort.empty() && nodeStreamPort.isInt() && nodeStreamPort.operator int() > 0)
+    {
+        float fStreamFPS = 10.f;
+        cv::FileNode nodeStreamFPS = fsSettings["Viewer.StreamFPS"];
+        if(!nodeStreamFPS.empty() && nodeStreamFPS.isReal())
+            fStreamFPS = nodeStreamFPS.real();
+
+        mpMapStreamer = new MapStreamer(mpAtlas, nodeStreamPort.operator int(), fStreamFPS);
+        mptMapStreamer = new thread(&MapStreamer::Run, mpMapStreamer);
+        mpTracker->SetMapStreamer(mpMapStreamer);
+    }
+
+    //Features of the current map kept in memory only around the camera in localization mode
+    cv::FileNode nodeTileSize = fsSettings["Atlas.TileSize"];
+    if(!nodeTileSize.empty() && nodeTileSize.isReal() && nodeTileSize.real() > 0)
+    {
+        float fTileRadius = nodeTileSize.real();
+        cv::FileNode nodeTileRadius = fsSettings["Atlas.TileRadius"];
+        if(!nodeTileRadius.empty() && nodeTileRadius.isReal())
+            fTileRadius = nodeTileRadius.real();
+        float fTilePrefetch = 2.f;
+        cv::FileNode nodeTilePrefetch = fsSettings["Atlas.TilePrefetch"];
+        if(!nodeTilePrefetch.empty() && nodeTilePrefetch.isReal())
+            fTilePrefetch = nodeTilePrefetch.real();
+        string strTileDir = "/tmp";
+        cv::FileNode nodeSpillDir = fsSettings["Atlas.SpillDirectory"];
+        if(!nodeSpillDir.empty() && nodeSpillDir.isString())
+            strTileDir = nodeSpillDir.string();
+
+        mpTileStreamer = new TileStreamer(nodeTileSize.real(), fTileRadius, fTilePrefetch, strTileDir);
+        mptTileStreamer = new thread(&TileStreamer::Run, mpTileStreamer);
+        mpTracker->SetTileStreamer(mpTileStreamer);
+    }
+
+    //Agent of a map server shared with other robots (Examples/Tools/map_server)
+    cv::FileNode nodeAgentHost = fsSettings["Agent.ServerHost"];
+    if(!nodeAgentHost.empty() && nodeAgentHost.isString())
+    {
+        int nAgentPort = 7400;
+        cv::FileNode nodeAgentPort = fsSettings["Agent.ServerPort"];
+        if(!nodeAgentPort.empty() && nodeAgentPort.isInt() && nodeAgentPort.operator int() > 0)
+            nAgentPort = nodeAgentPort.operator int();
+
+        int nAgentId = 0;
+        cv::FileNode nodeAgentId = fsSettings["Agent.Id"];
+        if(!nodeAgentId.empty() && nodeAgentId.isInt() && nodeAgentId.operator int() >= 0)
+            nAgentId = nodeAgentId.operator int();
+
+        float fUpdatePeriod = 1.f;
+        cv::FileNode nodeUpdatePeriod = fsSettings["Agent.UpdatePeriod"];
+        if(!nodeUpdatePeriod.empty() && nodeUpdatePeriod.isReal() && nodeUpdatePeriod.real() > 0)
+            fUpdatePeriod = nodeUpdatePeriod.real();
+
+        mpAgentClient = new AgentClient(mpAtlas, nodeAgentHost.string(), nAgentPort, nAgentId, fUpdatePeriod);
+        mptAgentClient = new thread(&AgentClient::Run, mpAgentClient);
+        mpLocalMapper->SetAgentClient(mpAgentClient);
+        cout << "Agent " << nAgentId << " of the map server " << nodeAgentHost.string() << ":" << nAgentPort << endl;
+    }
+
     //Set pointers between threads
     mpTracker->SetLocalMapper(mpLocalMapper);
     mpTracker->SetLoopClosing(mpLoopCloser);
@@ -143,19 +661,38 @@ System::System(const string &strVocFile, const string &strSettingsFile, const eS
     mpLoopCloser->SetTracker(mpTracker);
     mpLoopCloser->SetLocalMapper(mpLocalMapper);
 
+    mpTracker->SetThreadPool(mpThreadPool);
+    mpLocalMapper->SetThreadPool(mpThreadPool);
+    mpLoopCloser->SetThreadPool(mpThreadPool);
+
+    mpLocalMapper->SetTrajectoryStore(mpTrajectoryStore);
+
+    mpTracker->SetMetrics(mpMetrics);
+    mpLocalMapper->SetMetrics(mpMetrics);
+    mpLoopCloser->SetMetrics(mpMetrics);
+
+    mpTracker->SetPowerGovernor(mpPowerGovernor);
+    mpLocalMapper->SetPowerGovernor(mpPowerGovernor);
+    mpLoopCloser->SetPowerGovernor(mpPowerGovernor);
+
+    cv::FileNode nodeRecord = fsSettings["System.RecordDir"];
+    if(!nodeRecord.empty() && nodeRecord.isString())
+    {
+        ReplayLog* pReplayLog = ReplayLog::Open(nodeRecord.string(), ReplayLog::RECORD, mSensor);
+        if(pReplayLog)
+        {
+            cout << "Recording the run in " << nodeRecord.string() << endl;
+            SetReplayLog(pReplayLog);
+        }
+    }
+
     // Fix verbosity
     Verbose::SetTh(Verbose::VERBOSITY_QUIET);
 
 }
 
-cv::Mat System::TrackStereo(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timestamp, const vector<IMU::Point>& vImuMeas, string filename)
+void System::CheckModeChangeAndReset()
 {
-    if(mSensor!=STEREO && mSensor!=IMU_STEREO)
-    {
-        cerr << "ERROR: you called TrackStereo but input sensor was not set to Stereo nor Stereo-Inertial." << endl;
-        exit(-1);
-    }   
-
     // Check mode change
     {
         unique_lock<mutex> lock(mMutexMode);
@@ -164,10 +701,7 @@ cv::Mat System::TrackStereo(const cv::Mat &imLeft, const cv::Mat &imRight, const
             mpLocalMapper->RequestStop();
 
             // Wait until Local Mapping has effectively stopped
-            while(!mpLocalMapper->isStopped())
-            {
-                usleep(1000);
-            }
+            mpLocalMapper->WaitUntilStopped();
 
             mpTracker->InformOnlyTracking(true);
             mbActivateLocalizationMode = false;
@@ -175,6 +709,9 @@ cv::Mat System::TrackStereo(const cv::Mat &imLeft, const cv::Mat &imRight, const
         if(mbDeactivateLocalizationMode)
         {
             mpTracker->InformOnlyTracking(false);
+            // Local Mapping reads the features of any keyframe
+            if(mpTileStreamer)
+                mpTileStreamer->LoadAll();
             mpLocalMapper->Release();
             mbDeactivateLocalizationMode = false;
         }
@@ -186,153 +723,480 @@ cv::Mat System::TrackStereo(const cv::Mat &imLeft, const cv::Mat &imRight, const
         if(mbReset)
         {
             mpTracker->Reset();
-            cout << "Reset stereo..." << endl;
             mbReset = false;
             mbResetActiveMap = false;
+            mpAtlas->PublishMapEvents(MapEvents::RESET);
         }
         else if(mbResetActiveMap)
         {
             mpTracker->ResetActiveMap();
             mbResetActiveMap = false;
+            mpAtlas->PublishMapEvents(MapEvents::RESET);
         }
     }
+}
+
+bool System::isModeChangeOrResetRequested()
+{
+    {
+        unique_lock<mutex> lock(mMutexMode);
+        if(mbActivateLocalizationMode || mbDeactivateLocalizationMode)
+            return true;
+    }
+
+    unique_lock<mutex> lock(mMutexReset);
+    return mbReset || mbResetActiveMap;
+}
+
+cv::Mat System::TrackStereo(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timestamp, const vector<IMU::Point>& vImuMeas, string filename)
+{
+    const Metrics::Clock::time_point tInput = Metrics::Clock::now();
+
+    if(mSensor!=STEREO && mSensor!=IMU_STEREO)
+    {
+        cerr << "ERROR: you called TrackStereo but input sensor was not set to Stereo nor Stereo-Inertial." << endl;
+        exit(-1);
+    }   
+
+    CheckModeChangeAndReset();
+
+    if(mpReplayLog)
+    {
+        mpReplayLog->RecordInput(vector<cv::Mat>{imLeft,imRight}, timestamp, vImuMeas);
+        mpReplayLog->BeginFrame();
+    }
 
     if (mSensor == System::IMU_STEREO)
         for(size_t i_imu = 0; i_imu < vImuMeas.size(); i_imu++)
             mpTracker->GrabImuData(vImuMeas[i_imu]);
+    if (mSensor == System::IMU_STEREO && mbImuStreamed)
+        WaitForStreamedImu(timestamp);
 
+    mpTracker->SetInputTime(tInput);
     cv::Mat Tcw = mpTracker->GrabImageStereo(imLeft,imRight,timestamp,filename);
 
     unique_lock<mutex> lock2(mMutexState);
     mTrackingState = mpTracker->mState;
+    mTrackingDegradations = mpTracker->GetDegradations();
     mTrackedMapPoints = mpTracker->mCurrentFrame.mvpMapPoints;
     mTrackedKeyPointsUn = mpTracker->mCurrentFrame.mvKeysUn;
+    lock2.unlock();
+
+    PublishTrackedPose(timestamp,Tcw);
+
+    return Tcw;
+}
+
+cv::Mat System::TrackStereoDepth(const cv::Mat &imLeft, const cv::Mat &imDepth, const bool bDisparity, const double &timestamp, const vector<IMU::Point>& vImuMeas, string filename)
+{
+    const Metrics::Clock::time_point tInput = Metrics::Clock::now();
+
+    if(mSensor!=STEREO && mSensor!=IMU_STEREO)
+    {
+        cerr << "ERROR: you called TrackStereoDepth but input sensor was not set to Stereo nor Stereo-Inertial." << endl;
+        exit(-1);
+    }
+
+    CheckModeChangeAndReset();
+
+    if(mpReplayLog)
+    {
+        mpReplayLog->RecordInput(vector<cv::Mat>{imLeft,imDepth}, timestamp, vImuMeas);
+        mpReplayLog->BeginFrame();
+    }
+
+    if (mSensor == System::IMU_STEREO)
+        for(size_t i_imu = 0; i_imu < vImuMeas.size(); i_imu++)
+            mpTracker->GrabImuData(vImuMeas[i_imu]);
+    if (mSensor == System::IMU_STEREO && mbImuStreamed)
+        WaitForStreamedImu(timestamp);
+
+    mpTracker->SetInputTime(tInput);
+    cv::Mat Tcw = mpTracker->GrabImageStereoDepth(imLeft,imDepth,bDisparity,timestamp,filename);
+
+    unique_lock<mutex> lock2(mMutexState);
+    mTrackingState = mpTracker->mState;
+    mTrackingDegradations = mpTracker->GetDegradations();
+    mTrackedMapPoints = mpTracker->mCurrentFrame.mvpMapPoints;
+    mTrackedKeyPointsUn = mpTracker->mCurrentFrame.mvKeysUn;
+    lock2.unlock();
+
+    PublishTrackedPose(timestamp,Tcw);
 
     return Tcw;
 }
 
 cv::Mat System::TrackRGBD(const cv::Mat &im, const cv::Mat &depthmap, const double &timestamp, string filename)
 {
+    const Metrics::Clock::time_point tInput = Metrics::Clock::now();
+
     if(mSensor!=RGBD)
     {
         cerr << "ERROR: you called TrackRGBD but input sensor was not set to RGBD." << endl;
         exit(-1);
     }    
 
-    // Check mode change
+    CheckModeChangeAndReset();
+
+    if(mpReplayLog)
     {
-        unique_lock<mutex> lock(mMutexMode);
-        if(mbActivateLocalizationMode)
-        {
-            mpLocalMapper->RequestStop();
+        mpReplayLog->RecordInput(vector<cv::Mat>{im,depthmap}, timestamp, vector<IMU::Point>());
+        mpReplayLog->BeginFrame();
+    }
 
-            // Wait until Local Mapping has effectively stopped
-            while(!mpLocalMapper->isStopped())
-            {
-                usleep(1000);
-            }
+    mpTracker->SetInputTime(tInput);
+    cv::Mat Tcw = mpTracker->GrabImageRGBD(im,depthmap,timestamp,filename);
 
-            mpTracker->InformOnlyTracking(true);
-            mbActivateLocalizationMode = false;
-        }
-        if(mbDeactivateLocalizationMode)
-        {
-            mpTracker->InformOnlyTracking(false);
-            mpLocalMapper->Release();
-            mbDeactivateLocalizationMode = false;
-        }
+    unique_lock<mutex> lock2(mMutexState);
+    mTrackingState = mpTracker->mState;
+    mTrackingDegradations = mpTracker->GetDegradations();
+    mTrackedMapPoints = mpTracker->mCurrentFrame.mvpMapPoints;
+    mTrackedKeyPointsUn = mpTracker->mCurrentFrame.mvKeysUn;
+    lock2.unlock();
+
+    PublishTrackedPose(timestamp,Tcw);
+    return Tcw;
+}
+
+cv::Mat System::TrackMonocular(const cv::Mat &im, const double &timestamp, const vector<IMU::Point>& vImuMeas, string filename)
+{
+    const Metrics::Clock::time_point tInput = Metrics::Clock::now();
+
+    if(mSensor!=MONOCULAR && mSensor!=IMU_MONOCULAR)
+    {
+        cerr << "ERROR: you called TrackMonocular but input sensor was not set to Monocular nor Monocular-Inertial." << endl;
+        exit(-1);
     }
 
-    // Check reset
+    CheckModeChangeAndReset();
+
+    if(mpReplayLog)
     {
-        unique_lock<mutex> lock(mMutexReset);
-        if(mbReset)
-        {
-            mpTracker->Reset();
-            mbReset = false;
-            mbResetActiveMap = false;
-        }
-        else if(mbResetActiveMap)
-        {
-            mpTracker->ResetActiveMap();
-            mbResetActiveMap = false;
-        }
+        mpReplayLog->RecordInput(vector<cv::Mat>(1,im), timestamp, vImuMeas);
+        mpReplayLog->BeginFrame();
     }
 
+    if (mSensor == System::IMU_MONOCULAR)
+        for(size_t i_imu = 0; i_imu < vImuMeas.size(); i_imu++)
+            mpTracker->GrabImuData(vImuMeas[i_imu]);
+    if (mSensor == System::IMU_MONOCULAR && mbImuStreamed)
+        WaitForStreamedImu(timestamp);
 
-    cv::Mat Tcw = mpTracker->GrabImageRGBD(im,depthmap,timestamp,filename);
+    mpTracker->SetInputTime(tInput);
+    cv::Mat Tcw = mpTracker->GrabImageMonocular(im,timestamp,filename);
 
     unique_lock<mutex> lock2(mMutexState);
     mTrackingState = mpTracker->mState;
+    mTrackingDegradations = mpTracker->GetDegradations();
     mTrackedMapPoints = mpTracker->mCurrentFrame.mvpMapPoints;
     mTrackedKeyPointsUn = mpTracker->mCurrentFrame.mvKeysUn;
+    lock2.unlock();
+
+    PublishTrackedPose(timestamp,Tcw);
+
     return Tcw;
 }
 
-cv::Mat System::TrackMonocular(const cv::Mat &im, const double &timestamp, const vector<IMU::Point>& vImuMeas, string filename)
+cv::Mat System::TrackStereoRig(const cv::Mat &imLeft, const cv::Mat &imRight, const vector<cv::Mat> &vImRig, const double &timestamp, const vector<IMU::Point>& vImuMeas, string filename)
 {
-    if(mSensor!=MONOCULAR && mSensor!=IMU_MONOCULAR)
+    // Images not used (frames tracked with optical flow) are not kept for the next call
+    mpTracker->SetRigImages(vImRig);
+    cv::Mat Tcw = TrackStereo(imLeft,imRight,timestamp,vImuMeas,filename);
+    mpTracker->SetRigImages(vector<cv::Mat>());
+    return Tcw;
+}
+
+cv::Mat System::TrackMonocularRig(const cv::Mat &im, const vector<cv::Mat> &vImRig, const double &timestamp, const vector<IMU::Point>& vImuMeas, string filename)
+{
+    mpTracker->SetRigImages(vImRig);
+    cv::Mat Tcw = TrackMonocular(im,timestamp,vImuMeas,filename);
+    mpTracker->SetRigImages(vector<cv::Mat>());
+    return Tcw;
+}
+
+// cv::Mat headers over the caller's buffers (no copy, OpenCV does not take ownership). The
+// tracker lets go of them before returning, so the caller can reuse the memory right away.
+cv::Mat System::TrackStereo(const unsigned char* pLeft, const unsigned char* pRight, const int width, const int height, const size_t step, const double &timestamp, const vector<IMU::Point>& vImuMeas, string filename)
+{
+    const cv::Mat imLeft(height,width,CV_8UC1,const_cast<unsigned char*>(pLeft),step);
+    const cv::Mat imRight(height,width,CV_8UC1,const_cast<unsigned char*>(pRight),step);
+
+    cv::Mat Tcw = TrackStereo(imLeft,imRight,timestamp,vImuMeas,filename);
+    mpTracker->ReleaseInputImages();
+
+    return Tcw;
+}
+
+cv::Mat System::TrackRGBD(const unsigned char* pIm, const size_t step, const float* pDepth, const size_t depthStep, const int width, const int height, const double &timestamp, string filename)
+{
+    const cv::Mat im(height,width,CV_8UC1,const_cast<unsigned char*>(pIm),step);
+    const cv::Mat depthmap(height,width,CV_32F,const_cast<float*>(pDepth),depthStep);
+
+    cv::Mat Tcw = TrackRGBD(im,depthmap,timestamp,filename);
+    mpTracker->ReleaseInputImages();
+
+    return Tcw;
+}
+
+cv::Mat System::TrackMonocular(const unsigned char* pIm, const int width, const int height, const size_t step, const double &timestamp, const vector<IMU::Point>& vImuMeas, string filename)
+{
+    const cv::Mat im(height,width,CV_8UC1,const_cast<unsigned char*>(pIm),step);
+
+    cv::Mat Tcw = TrackMonocular(im,timestamp,vImuMeas,filename);
+    mpTracker->ReleaseInputImages();
+
+    return Tcw;
+}
+
+
+
+void System::SubmitStereo(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timestamp, const vector<IMU::Point>& vImuMeas, string filename)
+{
+    const Metrics::Clock::time_point tInput = Metrics::Clock::now();
+
+    if(mSensor!=STEREO && mSensor!=IMU_STEREO)
     {
-        cerr << "ERROR: you called TrackMonocular but input sensor was not set to Monocular nor Monocular-Inertial." << endl;
+        cerr << "ERROR: you called SubmitStereo but input sensor was not set to Stereo nor Stereo-Inertial." << endl;
         exit(-1);
     }
 
-    // Check mode change
+    PipelineInput input;
+    input.im = imLeft;
+    input.imRight = imRight;
+    input.timestamp = timestamp;
+    input.tInput = tInput;
+    if(mSensor == System::IMU_STEREO)
+        input.vImuMeas = vImuMeas;
+    input.filename = filename;
+
+    SubmitToPipeline(input);
+}
+
+void System::SubmitRGBD(const cv::Mat &im, const cv::Mat &depthmap, const double &timestamp, string filename)
+{
+    const Metrics::Clock::time_point tInput = Metrics::Clock::now();
+
+    if(mSensor!=RGBD)
     {
-        unique_lock<mutex> lock(mMutexMode);
-        if(mbActivateLocalizationMode)
-        {
-            mpLocalMapper->RequestStop();
+        cerr << "ERROR: you called SubmitRGBD but input sensor was not set to RGBD." << endl;
+        exit(-1);
+    }
 
-            // Wait until Local Mapping has effectively stopped
-            while(!mpLocalMapper->isStopped())
+    PipelineInput input;
+    input.im = im;
+    input.imRight = depthmap;
+    input.timestamp = timestamp;
+    input.tInput = tInput;
+    input.filename = filename;
+
+    SubmitToPipeline(input);
+}
+
+void System::SubmitToPipeline(const PipelineInput &input)
+{
+    unique_lock<mutex> lock(mMutexPipeline);
+    if(!mptPipelinePreprocess)
+    {
+        mptPipelinePreprocess = new thread(&ORB_SLAM3::System::RunPipelinePreprocess, this);
+        mptPipelineTracking = new thread(&ORB_SLAM3::System::RunPipelineTracking, this);
+    }
+
+    if(mpReplayLog)
+        mpReplayLog->RecordInput(vector<cv::Mat>{input.im,input.imRight}, input.timestamp, input.vImuMeas);
+
+    PipelineInput newInput = input;
+    newInput.bKeyFrameCandidate = mfLastCandidateTime<0 || input.timestamp-mfLastCandidateTime>=mfCandidateInterval;
+    if(newInput.bKeyFrameCandidate)
+        mfLastCandidateTime = input.timestamp;
+
+    // Up to mnInputQueueSize sets of images wait while the previous one is preprocessed. A replay
+    // log has every input recorded, so nothing is dropped with it
+    if(mDropPolicy==BLOCK || mpReplayLog)
+        mcvPipeline.wait(lock, [&]{return mlPipelineInput.size()<mnInputQueueSize;});
+    else if(mDropPolicy==KEEP_LATEST)
+    {
+        while(!mlPipelineInput.empty())
+            DropPipelineInput(mlPipelineInput.begin(), newInput);
+    }
+    else
+    {
+        while(mlPipelineInput.size()>=mnInputQueueSize)
+        {
+            // Oldest images, for KEEP_KEYFRAME_CANDIDATES the oldest that are not a candidate
+            // (or the oldest candidate if all are)
+            list<PipelineInput>::iterator itDrop = mlPipelineInput.begin();
+            if(mDropPolicy==KEEP_KEYFRAME_CANDIDATES)
             {
-                usleep(1000);
+                for(list<PipelineInput>::iterator it=mlPipelineInput.begin(); it!=mlPipelineInput.end(); it++)
+                {
+                    if(!it->bKeyFrameCandidate)
+                    {
+                        itDrop = it;
+                        break;
+                    }
+                }
             }
+            DropPipelineInput(itDrop, newInput);
+        }
+    }
 
-            mpTracker->InformOnlyTracking(true);
-            mbActivateLocalizationMode = false;
+    mlPipelineInput.push_back(newInput);
+    mnPipelinePending++;
+    mcvPipeline.notify_all();
+}
+
+void System::DropPipelineInput(list<PipelineInput>::iterator it, PipelineInput &newInput)
+{
+    // The IMU preintegration between the tracked frames has to cover the dropped images
+    list<PipelineInput>::iterator itNext = std::next(it);
+    vector<IMU::Point> &vNextImu = itNext==mlPipelineInput.end() ? newInput.vImuMeas : itNext->vImuMeas;
+    vNextImu.insert(vNextImu.begin(), it->vImuMeas.begin(), it->vImuMeas.end());
+
+    mlPipelineInput.erase(it);
+    mnPipelinePending--;
+    mnDroppedFrames++;
+}
+
+unsigned long System::GetDroppedFrames()
+{
+    unique_lock<mutex> lock(mMutexPipeline);
+    return mnDroppedFrames;
+}
+
+bool System::GetNextResult(double &timestamp, cv::Mat &Tcw, bool bWait)
+{
+    unique_lock<mutex> lock(mMutexPipeline);
+    if(bWait)
+        mcvPipeline.wait(lock, [&]{return !mlPipelineResults.empty() || mnPipelinePending==0;});
+
+    if(mlPipelineResults.empty())
+        return false;
+
+    timestamp = mlPipelineResults.front().first;
+    Tcw = mlPipelineResults.front().second;
+    mlPipelineResults.pop_front();
+    mnPipelinePending--;
+
+    return true;
+}
+
+void System::RunPipelinePreprocess()
+{
+    while(true)
+    {
+        PipelineInput input;
+        {
+            unique_lock<mutex> lock(mMutexPipeline);
+            mcvPipeline.wait(lock, [&]{return !mlPipelineInput.empty() || mbFinishPipeline;});
+            if(mlPipelineInput.empty())
+                break;
+
+            input = mlPipelineInput.front();
+            mlPipelineInput.pop_front();
+            mcvPipeline.notify_all();
         }
-        if(mbDeactivateLocalizationMode)
+
+        // Mode changes and resets modify the tracker, so they wait until it is idle. The
+        // tracking thread cannot start a new frame meanwhile as only this thread fills its queue.
+        if(isModeChangeOrResetRequested())
         {
-            mpTracker->InformOnlyTracking(false);
-            mpLocalMapper->Release();
-            mbDeactivateLocalizationMode = false;
+            {
+                unique_lock<mutex> lock(mMutexPipeline);
+                mcvPipeline.wait(lock, [&]{return mlPipelineFrames.empty() && !mbPipelineTracking;});
+            }
+            CheckModeChangeAndReset();
         }
-    }
 
-    // Check reset
-    {
-        unique_lock<mutex> lock(mMutexReset);
-        if(mbReset)
+        PipelineFrame frame;
+        if(mSensor == RGBD)
+            mpTracker->PreprocessRGBD(input.im,input.imRight,input.timestamp,input.filename,frame.frame,frame.imGray);
+        else
         {
-            mpTracker->Reset();
-            mbReset = false;
-            mbResetActiveMap = false;
+            mpTracker->PreprocessStereo(input.im,input.imRight,input.timestamp,input.filename,frame.frame,frame.imGray);
+            frame.imRight = input.imRight;
         }
-        else if(mbResetActiveMap)
+        frame.vImuMeas.swap(input.vImuMeas);
+        frame.tInput = input.tInput;
+
         {
-            cout << "SYSTEM-> Reseting active map in monocular case" << endl;
-            mpTracker->ResetActiveMap();
-            mbResetActiveMap = false;
+            unique_lock<mutex> lock(mMutexPipeline);
+            mcvPipeline.wait(lock, [&]{return mlPipelineFrames.empty();});
+            mlPipelineFrames.push_back(frame);
+            mcvPipeline.notify_all();
         }
     }
 
-    if (mSensor == System::IMU_MONOCULAR)
-        for(size_t i_imu = 0; i_imu < vImuMeas.size(); i_imu++)
-            mpTracker->GrabImuData(vImuMeas[i_imu]);
+    unique_lock<mutex> lock(mMutexPipeline);
+    mbPipelinePreprocessDone = true;
+    mcvPipeline.notify_all();
+}
+
+void System::RunPipelineTracking()
+{
+    while(true)
+    {
+        PipelineFrame frame;
+        {
+            unique_lock<mutex> lock(mMutexPipeline);
+            mcvPipeline.wait(lock, [&]{return !mlPipelineFrames.empty() || mbPipelinePreprocessDone;});
+            if(mlPipelineFrames.empty())
+                break;
+
+            frame = mlPipelineFrames.front();
+            mlPipelineFrames.pop_front();
+            mbPipelineTracking = true;
+            mcvPipeline.notify_all();
+        }
+
+        if(mpReplayLog)
+            mpReplayLog->BeginFrame();
+
+        for(size_t i_imu = 0; i_imu < frame.vImuMeas.size(); i_imu++)
+            mpTracker->GrabImuData(frame.vImuMeas[i_imu]);
+        if(mSensor==IMU_STEREO && mbImuStreamed)
+            WaitForStreamedImu(frame.frame.mTimeStamp);
 
-    cv::Mat Tcw = mpTracker->GrabImageMonocular(im,timestamp,filename);
+        mpTracker->SetInputTime(frame.tInput);
+        cv::Mat Tcw = mpTracker->TrackPreprocessed(frame.frame,frame.imGray,frame.imRight);
 
-    unique_lock<mutex> lock2(mMutexState);
-    mTrackingState = mpTracker->mState;
-    mTrackedMapPoints = mpTracker->mCurrentFrame.mvpMapPoints;
-    mTrackedKeyPointsUn = mpTracker->mCurrentFrame.mvKeysUn;
+        {
+            unique_lock<mutex> lock2(mMutexState);
+            mTrackingState = mpTracker->mState;
+            mTrackingDegradations = mpTracker->GetDegradations();
+            mTrackedMapPoints = mpTracker->mCurrentFrame.mvpMapPoints;
+            mTrackedKeyPointsUn = mpTracker->mCurrentFrame.mvKeysUn;
+        }
 
-    return Tcw;
+        PublishTrackedPose(frame.frame.mTimeStamp,Tcw);
+
+        unique_lock<mutex> lock(mMutexPipeline);
+        mlPipelineResults.push_back(std::make_pair(frame.frame.mTimeStamp,Tcw));
+        mbPipelineTracking = false;
+        mcvPipeline.notify_all();
+    }
+
+    // Registered by the tracker on the first frame
+    EpochManager::UnregisterThread();
 }
 
+void System::StopPipeline()
+{
+    {
+        unique_lock<mutex> lock(mMutexPipeline);
+        if(!mptPipelinePreprocess)
+            return;
+        mbFinishPipeline = true;
+        mcvPipeline.notify_all();
+    }
 
+    // The frames already submitted are still tracked
+    mptPipelinePreprocess->join();
+    mptPipelineTracking->join();
+    delete mptPipelinePreprocess;
+    delete mptPipelineTracking;
+    mptPipelinePreprocess = static_cast<thread*>(NULL);
+    mptPipelineTracking = static_cast<thread*>(NULL);
+}
 
 void System::ActivateLocalizationMode()
 {
@@ -373,6 +1237,23 @@ void System::ResetActiveMap()
 
 void System::Shutdown()
 {
+    StopPipeline();
+
+    // The work still queued is done without waiting for the frames that will not come
+    if(mpReplayLog)
+        mpReplayLog->Release();
+
+    {
+        unique_lock<mutex> lock(mMutexImuPreintegration);
+        if(mptImuPreintegration)
+        {
+            mpTracker->GetImuPreintegrator()->RequestFinish();
+            mptImuPreintegration->join();
+            delete mptImuPreintegration;
+            mptImuPreintegration = static_cast<thread*>(NULL);
+        }
+    }
+
     mpLocalMapper->RequestFinish();
     mpLoopCloser->RequestFinish();
     if(mpViewer)
@@ -381,6 +1262,16 @@ void System::Shutdown()
         while(!mpViewer->isFinished())
             usleep(5000);
     }
+    if(mpMapStreamer)
+    {
+        mpMapStreamer->RequestFinish();
+        mptMapStreamer->join();
+    }
+    if(mpTileStreamer)
+    {
+        mpTileStreamer->RequestFinish();
+        mptTileStreamer->join();
+    }
 
     // Wait until all thread have effectively stopped
     while(!mpLocalMapper->isFinished() || !mpLoopCloser->isFinished() || mpLoopCloser->isRunningGBA())
@@ -397,6 +1288,36 @@ void System::Shutdown()
         usleep(5000);
     }
 
+    // Local Mapping does not queue more keyframes for the server
+    if(mpAgentClient && mptAgentClient->joinable())
+    {
+        mpAgentClient->RequestFinish();
+        mptAgentClient->join();
+    }
+
+    // Final keyframe poses, once Local Mapping and Loop Closing are done
+    if(mpTrajectoryWriter && mptTrajectoryWriter->joinable())
+    {
+        mpTrajectoryWriter->RequestFinish();
+        mptTrajectoryWriter->join();
+    }
+
+    // Final map, then the region is removed (the readers keep what they mapped)
+    if(mpSharedMap && mptSharedMap->joinable())
+    {
+        UnsubscribeMapEvents(mnSharedMapSubscription);
+        mpSharedMap->RequestFinish();
+        mptSharedMap->join();
+        delete mpSharedMap;
+        mpSharedMap = static_cast<SharedMapPublisher*>(NULL);
+    }
+
+    if(!mStrSaveAtlasToFile.empty())
+        SaveAtlas(mStrSaveAtlasToFile, BINARY_FILE);
+
+    if(!mStrTraceFile.empty())
+        SaveTrace(mStrTraceFile);
+
     if(mpViewer)
         pangolin::BindToContext("ORB-SLAM2: Map Viewer");
 
@@ -410,6 +1331,8 @@ void System::Shutdown()
 void System::SaveTrajectoryTUM(const string &filename)
 {
     cout << endl << "Saving camera trajectory to " << filename << " ..." << endl;
+    if(mpTrajectoryWriter)
+        cout << "Only the last frames are kept in memory, the full trajectory is in the trajectory stream" << endl;
     if(mSensor==MONOCULAR)
     {
         cerr << "ERROR: SaveTrajectoryTUM cannot be used for monocular." << endl;
@@ -504,6 +1427,8 @@ void System::SaveTrajectoryEuRoC(const string &filename)
 {
 
     cout << endl << "Saving trajectory to " << filename << " ..." << endl;
+    if(mpTrajectoryWriter)
+        cout << "Only the last frames are kept in memory, the full trajectory is in the trajectory stream" << endl;
     /*if(mSensor==MONOCULAR)
     {
         cerr << "ERROR: SaveTrajectoryEuRoC cannot be used for monocular." << endl;
@@ -515,9 +1440,9 @@ void System::SaveTrajectoryEuRoC(const string &filename)
     int numMaxKFs = 0;
     for(Map* pMap :vpMaps)
     {
-        if(pMap->GetAllKeyFrames().size() > numMaxKFs)
+        if(pMap->KeyFramesInMap() > numMaxKFs)
         {
-            numMaxKFs = pMap->GetAllKeyFrames().size();
+            numMaxKFs = pMap->KeyFramesInMap();
             pBiggerMap = pMap;
         }
     }
@@ -608,9 +1533,9 @@ void System::SaveKeyFrameTrajectoryEuRoC(const string &filename)
     int numMaxKFs = 0;
     for(Map* pMap :vpMaps)
     {
-        if(pMap->GetAllKeyFrames().size() > numMaxKFs)
+        if(pMap->KeyFramesInMap() > numMaxKFs)
         {
-            numMaxKFs = pMap->GetAllKeyFrames().size();
+            numMaxKFs = pMap->KeyFramesInMap();
             pBiggerMap = pMap;
         }
     }
@@ -649,9 +1574,112 @@ void System::SaveKeyFrameTrajectoryEuRoC(const string &filename)
     f.close();
 }
 
+void System::SaveTrajectoryBinary(const string &filename)
+{
+    cout << endl << "Saving binary trajectory to " << filename << " ..." << endl;
+    if(mpTrajectoryWriter)
+        cout << "Only the last frames are kept in memory, the full trajectory is in the trajectory stream" << endl;
+
+    const bool bImu = mSensor==IMU_MONOCULAR || mSensor==IMU_STEREO;
+
+    vector<TrajectoryFile::Record> vRecords;
+    vRecords.reserve(mpTracker->mlRelativeFramePoses.size());
+
+    // Frame pose is stored relative to its reference keyframe, as in SaveTrajectoryTUM
+    list<ORB_SLAM3::KeyFrame*>::iterator lRit = mpTracker->mlpReferences.begin();
+    list<double>::iterator lT = mpTracker->mlFrameTimes.begin();
+    list<bool>::iterator lbL = mpTracker->mlbLost.begin();
+    for(list<cv::Mat>::iterator lit=mpTracker->mlRelativeFramePoses.begin(),
+        lend=mpTracker->mlRelativeFramePoses.end();lit!=lend;lit++, lRit++, lT++, lbL++)
+    {
+        if(*lbL)
+            continue;
+
+        KeyFrame* pKF = *lRit;
+        if(!pKF)
+            continue;
+
+        cv::Mat Trw = cv::Mat::eye(4,4,CV_32F);
+
+        // If the reference keyframe was culled, traverse the spanning tree to get a suitable keyframe.
+        while(pKF->isBad())
+        {
+            Trw = Trw*pKF->mTcp;
+            pKF = pKF->GetParent();
+        }
+
+        Map* pMap = pKF->GetMap();
+        if(!pMap)
+            continue;
+
+        Trw = Trw*pKF->GetPose();
+
+        cv::Mat Tcw = (*lit)*Trw;
+        if(bImu)
+            Tcw = pKF->mImuCalib.Tbc*Tcw;
+        cv::Mat Rwc = Tcw.rowRange(0,3).colRange(0,3).t();
+        cv::Mat twc = -Rwc*Tcw.rowRange(0,3).col(3);
+        vector<float> q = Converter::toQuaternion(Rwc);
+
+        TrajectoryFile::Record r;
+        memset(&r, 0, sizeof(r));
+        r.timestamp = *lT;
+        r.keyFrameId = pKF->mnId;
+        r.mapId = pMap->GetId();
+        for(int i=0; i<3; i++)
+            r.t[i] = twc.at<float>(i);
+        for(int i=0; i<4; i++)
+            r.q[i] = q[i];
+        vRecords.push_back(r);
+    }
+
+    if(!TrajectoryFile::Save(filename, vRecords, bImu ? TrajectoryFile::BODY_FRAME : 0))
+        cerr << "Cannot write " << filename << endl;
+}
+
+void System::SaveKeyFrameTrajectoryBinary(const string &filename)
+{
+    cout << endl << "Saving binary keyframe trajectory to " << filename << " ..." << endl;
+
+    const bool bImu = mSensor==IMU_MONOCULAR || mSensor==IMU_STEREO;
+
+    vector<TrajectoryFile::Record> vRecords;
+    vector<Map*> vpMaps = mpAtlas->GetAllMaps();
+    for(Map* pMap : vpMaps)
+    {
+        vector<KeyFrame*> vpKFs = pMap->GetAllKeyFrames();
+        for(size_t i=0; i<vpKFs.size(); i++)
+        {
+            KeyFrame* pKF = vpKFs[i];
+            if(pKF->isBad())
+                continue;
+
+            cv::Mat Twc = bImu ? pKF->GetImuPose() : pKF->GetPoseInverse();
+            vector<float> q = Converter::toQuaternion(Twc.rowRange(0,3).colRange(0,3));
+
+            TrajectoryFile::Record r;
+            memset(&r, 0, sizeof(r));
+            r.timestamp = pKF->mTimeStamp;
+            r.keyFrameId = pKF->mnId;
+            r.mapId = pMap->GetId();
+            r.flags = TrajectoryFile::KEYFRAME;
+            for(int j=0; j<3; j++)
+                r.t[j] = Twc.at<float>(j,3);
+            for(int j=0; j<4; j++)
+                r.q[j] = q[j];
+            vRecords.push_back(r);
+        }
+    }
+
+    if(!TrajectoryFile::Save(filename, vRecords, bImu ? TrajectoryFile::BODY_FRAME : 0))
+        cerr << "Cannot write " << filename << endl;
+}
+
 void System::SaveTrajectoryKITTI(const string &filename)
 {
     cout << endl << "Saving camera trajectory to " << filename << " ..." << endl;
+    if(mpTrajectoryWriter)
+        cout << "Only the last frames are kept in memory, the full trajectory is in the trajectory stream" << endl;
     if(mSensor==MONOCULAR)
     {
         cerr << "ERROR: SaveTrajectoryKITTI cannot be used for monocular." << endl;
@@ -708,6 +1736,12 @@ int System::GetTrackingState()
     return mTrackingState;
 }
 
+int System::GetTrackingDegradations()
+{
+    unique_lock<mutex> lock(mMutexState);
+    return mTrackingDegradations;
+}
+
 vector<MapPoint*> System::GetTrackedMapPoints()
 {
     unique_lock<mutex> lock(mMutexState);
@@ -720,6 +1754,84 @@ vector<cv::KeyPoint> System::GetTrackedKeyPointsUn()
     return mTrackedKeyPointsUn;
 }
 
+bool System::GetImuPrediction(double &timestamp, cv::Mat &Twb, cv::Mat &Vwb)
+{
+    return mpTracker->GetImuPrediction(timestamp, Twb, Vwb);
+}
+
+bool System::GetPoseAtTime(const double timestamp, cv::Mat &Tcw)
+{
+    if(!mpTrajectoryStore)
+        return false;
+    return mpTrajectoryStore->GetPose(timestamp, Tcw);
+}
+
+bool System::GetTrajectoryTimeRange(double &firstTime, double &lastTime)
+{
+    if(!mpTrajectoryStore)
+        return false;
+    return mpTrajectoryStore->GetTimeRange(firstTime, lastTime);
+}
+
+bool System::SetImuPoseCallback(const IMU::Preintegrator::PoseCallback &callback)
+{
+    if(mSensor!=IMU_MONOCULAR && mSensor!=IMU_STEREO)
+        return false;
+
+    mpTracker->GetImuPreintegrator()->SetPoseCallback(callback);
+    if(callback)
+        StartImuPreintegration();
+    return true;
+}
+
+void System::GrabImuData(const IMU::Point &imuMeasurement)
+{
+    if(mSensor!=IMU_MONOCULAR && mSensor!=IMU_STEREO)
+        return;
+
+    mbImuStreamed = true;
+    mpTracker->GrabImuData(imuMeasurement);
+}
+
+void System::WaitForStreamedImu(const double &timestamp)
+{
+    if(!mpTracker->WaitForImu(timestamp,mfImuWaitTime))
+        Verbose::PrintMess("IMU data late, tracking the image without it", Verbose::VERBOSITY_NORMAL);
+}
+
+void System::SetTrackedPoseCallback(const TrackedPoseCallback &callback)
+{
+    unique_lock<mutex> lock(mMutexPoseCallback);
+    mTrackedPoseCallback = callback;
+}
+
+int System::SubscribeMapEvents(const MapEvents::Callback &callback)
+{
+    return mpMapEvents->Subscribe(callback, mpAtlas);
+}
+
+void System::UnsubscribeMapEvents(const int nId)
+{
+    mpMapEvents->Unsubscribe(nId);
+}
+
+void System::PublishTrackedPose(const double &timestamp, const cv::Mat &Tcw)
+{
+    if(mpSharedMap)
+        mpSharedMap->PublishPose(timestamp,Tcw,mpTracker->mState);
+
+    unique_lock<mutex> lock(mMutexPoseCallback);
+    if(mTrackedPoseCallback)
+        mTrackedPoseCallback(timestamp,Tcw);
+}
+
+void System::StartImuPreintegration()
+{
+    unique_lock<mutex> lock(mMutexImuPreintegration);
+    if(!mptImuPreintegration)
+        mptImuPreintegration = new thread(&ORB_SLAM3::IMU::Preintegrator::Run, mpTracker->GetImuPreintegrator());
+}
+
 double System::GetTimeFromIMUInit()
 {
     double aux = mpLocalMapper->GetCurrKFTime()-mpLocalMapper->mFirstTs;
@@ -762,6 +1874,331 @@ void System::ChangeDataset()
     mpTracker->NewDataset();
 }
 
+ThreadPool* System::GetThreadPool()
+{
+    return mpThreadPool;
+}
+
+Atlas* System::GetAtlas()
+{
+    return mpAtlas;
+}
+
+ORBVocabulary* System::GetVocabulary()
+{
+    return mpVocabulary;
+}
+
+Metrics* System::GetMetrics()
+{
+    return mpMetrics;
+}
+
+string System::ExportMetrics()
+{
+    GetMemoryUsage();
+    return mpMetrics->ExportPrometheus();
+}
+
+MemoryUsage System::GetMemoryUsage()
+{
+    MemoryUsage usage = mpAtlas->GetMemoryUsage();
+    usage.nKeyFrameDatabase = mpKeyFrameDatabase->InvertedFileMemory();
+    // Not counted while it is being loaded
+    if(VocabularyLoader::IsLoaded(mpVocabulary))
+    {
+        usage.nVocabulary = mpVocabulary->memoryUsage();
+        usage.nVocabularyMapped = mpVocabulary->mappedSize();
+    }
+
+    mpMetrics->SetMemoryUsage(usage);
+    return usage;
+}
+
+ReplayLog* System::StartReplay(const string &strDir)
+{
+    if(mpReplayLog)
+    {
+        cerr << "ERROR: the run is already recorded or replayed" << endl;
+        return static_cast<ReplayLog*>(NULL);
+    }
+
+    ReplayLog* pReplayLog = ReplayLog::Open(strDir, ReplayLog::REPLAY, mSensor);
+    if(!pReplayLog)
+        return static_cast<ReplayLog*>(NULL);
+
+    if(pReplayLog->GetSensor()!=mSensor)
+    {
+        cerr << "ERROR: " << strDir << " was recorded with another sensor" << endl;
+        delete pReplayLog;
+        return static_cast<ReplayLog*>(NULL);
+    }
+
+    cout << "Replaying " << pReplayLog->NumFrames() << " frames from " << strDir << endl;
+    SetReplayLog(pReplayLog);
+    return pReplayLog;
+}
+
+void System::SetReplayLog(ReplayLog* pReplayLog)
+{
+    mpReplayLog = pReplayLog;
+    mpTracker->SetReplayLog(mpReplayLog);
+    mpLocalMapper->SetReplayLog(mpReplayLog);
+    mpLoopCloser->SetReplayLog(mpReplayLog);
+}
+
+int System::RefineAtlas(const int nIterations, const bool bFuse, const bool bCullKeyFrames)
+{
+    mpLocalMapper->RequestStop();
+    mpLocalMapper->WaitUntilStopped();
+
+    // Refinement is offline, it takes all the cores and not the pool of System.nThreads
+    const unsigned int nCores = std::max(1u, std::thread::hardware_concurrency());
+    ThreadPool threadPool(nCores);
+    MapRefiner refiner(mpLocalMapper, &threadPool, nIterations);
+
+    int nRefined = 0;
+    vector<Map*> vpMaps = mpAtlas->GetAllMaps();
+    for(size_t i=0; i<vpMaps.size(); i++)
+    {
+        Map* pMap = vpMaps[i];
+        if(pMap->IsBad() || pMap->KeyFramesInMap()<3)
+            continue;
+
+        cout << "Refining map " << pMap->GetId() << " (" << pMap->KeyFramesInMap() << " keyframes, "
+             << pMap->MapPointsInMap() << " map points)" << endl;
+        unique_lock<MapUpdateMutex> lock(pMap->mMutexMapUpdate);
+        refiner.Refine(pMap, bFuse, bCullKeyFrames);
+        nRefined++;
+    }
+
+    mpLocalMapper->Release();
+
+    return nRefined;
+}
+
+// Atlas file header. The version must be increased with every change of the stored layout
+static const string ATLAS_FILE_MAGIC = "ORB-SLAM3 Atlas";
+static const int ATLAS_FILE_VERSION = 2;
+
+bool System::SaveAtlas(const string &filename, const int type)
+{
+    cout << endl << "Saving atlas to " << filename << " ..." << endl;
+
+    // The tiled map is written with all its features
+    if(mpTileStreamer)
+        mpTileStreamer->LoadAll();
+    mpAtlas->PreSave();
+    mpKeyFrameDatabase->PreSave();
+
+    string strMagic = ATLAS_FILE_MAGIC;
+    int nVersion = ATLAS_FILE_VERSION;
+    string strVocChecksum = CalculateCheckSum();
+    int nSensor = mSensor;
+
+    try
+    {
+        if(type == TEXT_FILE)
+        {
+            std::ofstream ofs(filename.c_str());
+            boost::archive::text_oarchive oa(ofs);
+            oa << strMagic << nVersion << strVocChecksum << nSensor;
+            oa << *mpAtlas;
+            oa << *mpKeyFrameDatabase;
+        }
+        else
+        {
+            // Chunked file, the sections are encoded and compressed on the thread pool
+            AtlasArchive archive;
+            archive.AddSection("header", [&](std::ostream &os)
+            {
+                boost::archive::binary_oarchive oa(os);
+                oa << strMagic << nVersion << strVocChecksum << nSensor;
+            });
+            mpAtlas->AddSections(archive);
+            archive.AddSection("database", [this](std::ostream &os)
+            {
+                boost::archive::binary_oarchive oa(os);
+                oa << *mpKeyFrameDatabase;
+            });
+            if(!archive.Write(filename, mpThreadPool))
+                return false;
+            cout << "Atlas file: " << archive.GetStoredBytes()/(1024*1024) << " MB (" << archive.GetRawBytes()/(1024*1024) << " MB uncompressed)" << endl;
+        }
+    }
+    catch(const std::exception &e)
+    {
+        cerr << "ERROR: the atlas could not be saved to " << filename << ": " << e.what() << endl;
+        return false;
+    }
+
+    cout << "Atlas saved!" << endl;
+    return true;
+}
+
+bool System::SaveTrace(const string &filename)
+{
+#ifdef ORB_SLAM3_TRACING
+    return Tracer::SaveChromeTrace(filename);
+#else
+    cerr << "ERROR: cannot save the trace " << filename << ", ORB-SLAM3 was built without WITH_TRACING" << endl;
+    return false;
+#endif
+}
+
+bool System::LoadAtlas(const string &filename, const int type)
+{
+    cout << endl << "Loading atlas from " << filename << " ..." << endl;
+
+    std::ifstream ifs;
+    if(type == TEXT_FILE)
+        ifs.open(filename.c_str());
+    else
+        ifs.open(filename.c_str(), std::ios::binary);
+    if(!ifs.good())
+    {
+        cerr << "ERROR: the atlas file " << filename << " does not exist" << endl;
+        return false;
+    }
+
+    string strMagic, strVocChecksum;
+    int nVersion, nSensor;
+
+    try
+    {
+        if(type == TEXT_FILE)
+        {
+            boost::archive::text_iarchive ia(ifs);
+            ia >> strMagic >> nVersion >> strVocChecksum >> nSensor;
+            if(strMagic != ATLAS_FILE_MAGIC || nVersion != ATLAS_FILE_VERSION)
+            {
+                cerr << "ERROR: " << filename << " is not an atlas file of version " << ATLAS_FILE_VERSION << endl;
+                return false;
+            }
+            if(strVocChecksum != CalculateCheckSum())
+            {
+                cerr << "ERROR: the atlas was built with a different vocabulary" << endl;
+                return false;
+            }
+            ia >> *mpAtlas;
+            ia >> *mpKeyFrameDatabase;
+        }
+        else if(AtlasArchive::IsArchive(filename))
+        {
+            AtlasArchive archive;
+            if(!archive.Open(filename))
+                return false;
+
+            vector<pair<string, AtlasArchive::Decoder> > vHeader;
+            vHeader.push_back(make_pair(string("header"), AtlasArchive::Decoder([&](std::istream &is)
+            {
+                boost::archive::binary_iarchive ia(is);
+                ia >> strMagic >> nVersion >> strVocChecksum >> nSensor;
+            })));
+            if(!archive.Read(vHeader, mpThreadPool))
+                return false;
+            if(strMagic != ATLAS_FILE_MAGIC || nVersion != ATLAS_FILE_VERSION)
+            {
+                cerr << "ERROR: " << filename << " is not an atlas file of version " << ATLAS_FILE_VERSION << endl;
+                return false;
+            }
+            if(strVocChecksum != CalculateCheckSum())
+            {
+                cerr << "ERROR: the atlas was built with a different vocabulary" << endl;
+                return false;
+            }
+
+            // The database postings are independent of the maps, read with their last sections
+            if(!mpAtlas->ReadSections(archive, mpThreadPool, mbLazyAtlasLoad))
+                return false;
+            vector<pair<string, AtlasArchive::Decoder> > vDatabase;
+            vDatabase.push_back(make_pair(string("database"), AtlasArchive::Decoder([this](std::istream &is)
+            {
+                boost::archive::binary_iarchive ia(is);
+                ia >> *mpKeyFrameDatabase;
+            })));
+            if(!archive.Read(vDatabase, mpThreadPool))
+                return false;
+        }
+        else
+        {
+            // Single archive of the files written before the chunked format
+            boost::archive::binary_iarchive ia(ifs);
+            ia >> strMagic >> nVersion >> strVocChecksum >> nSensor;
+            if(strMagic != ATLAS_FILE_MAGIC || nVersion != ATLAS_FILE_VERSION)
+            {
+                cerr << "ERROR: " << filename << " is not an atlas file of version " << ATLAS_FILE_VERSION << endl;
+                return false;
+            }
+            if(strVocChecksum != CalculateCheckSum())
+            {
+                cerr << "ERROR: the atlas was built with a different vocabulary" << endl;
+                return false;
+            }
+            ia >> *mpAtlas;
+            ia >> *mpKeyFrameDatabase;
+        }
+    }
+    catch(const std::exception &e)
+    {
+        cerr << "ERROR: the atlas could not be loaded from " << filename << ": " << e.what() << endl;
+        return false;
+    }
+
+    if(nSensor != mSensor)
+        cout << "WARNING: the atlas was built with a different sensor configuration" << endl;
+
+    mpAtlas->SetKeyFrameDababase(mpKeyFrameDatabase);
+    mpAtlas->SetORBVocabulary(mpVocabulary);
+    mpAtlas->SetSystemContext(&mContext);
+    mpAtlas->PostLoad();
+
+    map<long unsigned int, KeyFrame*> mpKFid;
+    vector<Map*> vpMaps = mpAtlas->GetAllMaps();
+    for(size_t i=0; i<vpMaps.size(); i++)
+    {
+        vector<KeyFrame*> vpKFs = vpMaps[i]->GetAllKeyFrames();
+        for(size_t j=0; j<vpKFs.size(); j++)
+            mpKFid[vpKFs[j]->mnId] = vpKFs[j];
+    }
+    mpKeyFrameDatabase->PostLoad(mpKFid);
+
+    cout << "Atlas loaded: " << vpMaps.size() << " maps, " << mpKFid.size() << " keyframes" << endl;
+    return true;
+}
+
+string System::CalculateCheckSum()
+{
+    // Hash of the tree shape and of the word descriptors, so the text and the binary
+    // files of the same vocabulary give the same value
+    VocabularyLoader::WaitUntilLoaded(mpVocabulary);
+
+    MD5_CTX md5Context;
+    MD5_Init(&md5Context);
+
+    int shape[3] = {mpVocabulary->getBranchingFactor(), mpVocabulary->getDepthLevels(), (int)mpVocabulary->size()};
+    MD5_Update(&md5Context, shape, sizeof(shape));
+    for(unsigned int i=0, iend=mpVocabulary->size(); i<iend; i++)
+    {
+        const cv::Mat word = mpVocabulary->getWord(i);
+        if(word.isContinuous())
+            MD5_Update(&md5Context, word.data, word.total()*word.elemSize());
+    }
+
+    unsigned char c[MD5_DIGEST_LENGTH];
+    MD5_Final(c, &md5Context);
+
+    string checksum;
+    for(int i=0; i<MD5_DIGEST_LENGTH; i++)
+    {
+        char aux[3];
+        sprintf(aux, "%02x", c[i]);
+        checksum += aux;
+    }
+
+    return checksum;
+}
+
 #ifdef REGISTER_TIMES
 void System::InsertRectTime(double& time)
 {
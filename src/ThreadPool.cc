@@ -0,0 +1,236 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ThreadPool.h"
+
+namespace ORB_SLAM3
+{
+
+// Pool and queue of the worker running on this thread (NULL/-1 out of the pools)
+static thread_local ThreadPool* tpWorkerPool = static_cast<ThreadPool*>(NULL);
+static thread_local int tnWorker = -1;
+static thread_local ThreadPool::Priority tPriority = ThreadPool::TRACKING;
+
+ThreadPool::PriorityScope::PriorityScope(const Priority priority): mPrevious(tPriority)
+{
+    tPriority = priority;
+}
+
+ThreadPool::PriorityScope::~PriorityScope()
+{
+    tPriority = mPrevious;
+}
+
+ThreadPool::Priority ThreadPool::GetThreadPriority()
+{
+    return tPriority;
+}
+
+ThreadPool::ThreadPool(int nThreads): mnQueued(0), mbFinish(false)
+{
+    for(int i=0; i<nThreads; i++)
+        mvpWorkers.push_back(std::unique_ptr<Worker>(new Worker()));
+    for(int i=0; i<nThreads; i++)
+        mvThreads.push_back(std::thread(&ThreadPool::Run,this,i));
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::unique_lock<std::mutex> lock(mMutexQueue);
+        mbFinish = true;
+    }
+    mcvTasks.notify_all();
+
+    for(size_t i=0; i<mvThreads.size(); i++)
+        mvThreads[i].join();
+}
+
+void ThreadPool::Push(Task &&task)
+{
+    const Priority priority = tPriority;
+    if(tpWorkerPool==this)
+    {
+        Worker &worker = *mvpWorkers[tnWorker];
+        std::unique_lock<std::mutex> lock(worker.mMutex);
+        worker.mvqTasks[priority].push_back(std::move(task));
+    }
+    else
+    {
+        std::unique_lock<std::mutex> lock(mMutexQueue);
+        mvqShared[priority].push_back(std::move(task));
+    }
+    mnQueued++;
+}
+
+void ThreadPool::Notify(const int nTasks)
+{
+    // Taking the mutex orders the notification after the check of a worker going to sleep
+    {
+        std::unique_lock<std::mutex> lock(mMutexQueue);
+    }
+    if(nTasks==1)
+        mcvTasks.notify_one();
+    else
+        mcvTasks.notify_all();
+}
+
+bool ThreadPool::Pop(const int nWorker, Task &task, Priority &priority)
+{
+    const int nWorkers = mvpWorkers.size();
+    for(int p=0; p<NUM_PRIORITIES; p++)
+    {
+        {
+            Worker &worker = *mvpWorkers[nWorker];
+            std::unique_lock<std::mutex> lock(worker.mMutex);
+            if(!worker.mvqTasks[p].empty())
+            {
+                task = std::move(worker.mvqTasks[p].back());
+                worker.mvqTasks[p].pop_back();
+                priority = static_cast<Priority>(p);
+                mnQueued--;
+                return true;
+            }
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(mMutexQueue);
+            if(!mvqShared[p].empty())
+            {
+                task = std::move(mvqShared[p].front());
+                mvqShared[p].pop_front();
+                priority = static_cast<Priority>(p);
+                mnQueued--;
+                return true;
+            }
+        }
+
+        for(int k=1; k<nWorkers; k++)
+        {
+            Worker &victim = *mvpWorkers[(nWorker+k)%nWorkers];
+            std::unique_lock<std::mutex> lock(victim.mMutex);
+            if(!victim.mvqTasks[p].empty())
+            {
+                task = std::move(victim.mvqTasks[p].front());
+                victim.mvqTasks[p].pop_front();
+                priority = static_cast<Priority>(p);
+                mnQueued--;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+std::future<void> ThreadPool::Submit(const std::function<void()> &task)
+{
+    Task pt(task);
+    std::future<void> fut = pt.get_future();
+
+    if(mvThreads.empty())
+    {
+        pt();
+        return fut;
+    }
+
+    Push(std::move(pt));
+    Notify(1);
+
+    return fut;
+}
+
+void ThreadPool::ParallelFor(int begin, int end, const std::function<void(int)> &f)
+{
+    const int n = end-begin;
+    if(n<=0)
+        return;
+
+    if(n==1 || mvThreads.empty())
+    {
+        for(int i=begin; i<end; i++)
+            f(i);
+        return;
+    }
+
+    // Iterations are claimed from a shared counter by the caller and by the helpers.
+    // Helpers that start after the loop is exhausted just return, so the caller never
+    // waits for a task that was not started.
+    struct Shared
+    {
+        std::atomic<int> next;
+        int nDone;
+        std::mutex mutex;
+        std::condition_variable cv;
+    };
+    std::shared_ptr<Shared> pShared = std::make_shared<Shared>();
+    pShared->next = begin;
+    pShared->nDone = 0;
+
+    const std::function<void(int)>* pf = &f;
+    auto work = [pShared, pf, end]()
+    {
+        int nLocal = 0;
+        for(int i=pShared->next++; i<end; i=pShared->next++)
+        {
+            (*pf)(i);
+            nLocal++;
+        }
+        if(nLocal>0)
+        {
+            std::unique_lock<std::mutex> lock(pShared->mutex);
+            pShared->nDone += nLocal;
+            pShared->cv.notify_all();
+        }
+    };
+
+    const int nHelpers = std::min<int>(mvThreads.size(),n-1);
+    for(int i=0; i<nHelpers; i++)
+        Push(Task(work));
+    Notify(nHelpers);
+
+    work();
+
+    std::unique_lock<std::mutex> lock(pShared->mutex);
+    while(pShared->nDone<n)
+        pShared->cv.wait(lock);
+}
+
+void ThreadPool::Run(const int nWorker)
+{
+    tpWorkerPool = this;
+    tnWorker = nWorker;
+
+    while(true)
+    {
+        Task task;
+        Priority priority;
+        if(Pop(nWorker, task, priority))
+        {
+            PriorityScope scope(priority);
+            task();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mMutexQueue);
+        mcvTasks.wait(lock, [this]{ return mbFinish || mnQueued.load()>0; });
+        if(mbFinish && mnQueued.load()==0)
+            return;
+    }
+}
+
+} //namespace ORB_SLAM
@@ -0,0 +1,202 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ThreadScheduling.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+
+namespace ORB_SLAM3
+{
+
+// "0,2,4-7" style list, false if malformed
+static bool ParseCpuList(const string &strList, vector<int> &vCpus)
+{
+    vCpus.clear();
+    stringstream ss(strList);
+    string strItem;
+    while(getline(ss, strItem, ','))
+    {
+        const size_t dash = strItem.find('-');
+        char* pEnd;
+        const long first = strtol(strItem.c_str(), &pEnd, 10);
+        if(pEnd == strItem.c_str() || first < 0)
+            return false;
+        long last = first;
+        if(dash != string::npos)
+        {
+            const char* pLast = strItem.c_str() + dash + 1;
+            last = strtol(pLast, &pEnd, 10);
+            if(pEnd == pLast || last < first)
+                return false;
+        }
+        for(long cpu=first; cpu<=last; cpu++)
+            vCpus.push_back(cpu);
+    }
+    return !vCpus.empty();
+}
+
+ThreadScheduling::ThreadScheduling():
+    mnPolicy(-1), mnPriority(0), mbNice(false), mnNice(0)
+{
+}
+
+ThreadScheduling ThreadScheduling::Read(const cv::FileStorage &fsSettings, const string &strThread)
+{
+    ThreadScheduling sched;
+    sched.mStrThread = strThread;
+    const string strPrefix = "Thread." + strThread + ".";
+
+    cv::FileNode nodeCpus = fsSettings[strPrefix + "Cpus"];
+    if(!nodeCpus.empty())
+    {
+        const string strCpus = nodeCpus.isInt() ? to_string(nodeCpus.operator int()) : nodeCpus.string();
+        if(!ParseCpuList(strCpus, sched.mvCpus))
+            cerr << "Invalid " << strPrefix << "Cpus " << strCpus << ", ignored" << endl;
+    }
+
+    cv::FileNode nodePolicy = fsSettings[strPrefix + "Policy"];
+    if(!nodePolicy.empty() && nodePolicy.isString())
+    {
+        const string strPolicy = nodePolicy.string();
+        if(strPolicy == "other")
+            sched.mnPolicy = SCHED_OTHER;
+        else if(strPolicy == "batch")
+            sched.mnPolicy = SCHED_BATCH;
+        else if(strPolicy == "idle")
+            sched.mnPolicy = SCHED_IDLE;
+        else if(strPolicy == "fifo")
+            sched.mnPolicy = SCHED_FIFO;
+        else if(strPolicy == "rr")
+            sched.mnPolicy = SCHED_RR;
+        else
+            cerr << "Unknown " << strPrefix << "Policy " << strPolicy << ", ignored" << endl;
+    }
+
+    cv::FileNode nodePriority = fsSettings[strPrefix + "Priority"];
+    if(!nodePriority.empty() && nodePriority.isInt())
+    {
+        sched.mnPriority = nodePriority.operator int();
+        // A priority alone means the default real-time policy
+        if(sched.mnPolicy == -1)
+            sched.mnPolicy = SCHED_FIFO;
+    }
+    if((sched.mnPolicy == SCHED_FIFO || sched.mnPolicy == SCHED_RR) && sched.mnPriority <= 0)
+        sched.mnPriority = 1;
+
+    cv::FileNode nodeNice = fsSettings[strPrefix + "Nice"];
+    if(!nodeNice.empty() && nodeNice.isInt())
+    {
+        sched.mbNice = true;
+        sched.mnNice = nodeNice.operator int();
+    }
+
+    return sched;
+}
+
+bool ThreadScheduling::IsDefault() const
+{
+    return mvCpus.empty() && mnPolicy == -1 && !mbNice;
+}
+
+bool ThreadScheduling::Apply() const
+{
+    bool bOk = true;
+
+    if(!mvCpus.empty())
+    {
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        for(size_t i=0; i<mvCpus.size(); i++)
+            CPU_SET(mvCpus[i], &cpuset);
+        const int err = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+        if(err != 0)
+        {
+            cerr << mStrThread << ": cannot set the CPU affinity (" << strerror(err) << ")" << endl;
+            bOk = false;
+        }
+    }
+
+    if(mnPolicy != -1)
+    {
+        sched_param param;
+        param.sched_priority = (mnPolicy == SCHED_FIFO || mnPolicy == SCHED_RR) ? mnPriority : 0;
+        const int err = pthread_setschedparam(pthread_self(), mnPolicy, &param);
+        if(err != 0)
+        {
+            cerr << mStrThread << ": cannot set the scheduling policy (" << strerror(err) << ")" << endl;
+            bOk = false;
+        }
+    }
+
+    // The nice value of a thread (not of the whole process) is set through its thread id
+    if(mbNice)
+    {
+        const pid_t tid = syscall(SYS_gettid);
+        if(setpriority(PRIO_PROCESS, tid, mnNice) != 0)
+        {
+            cerr << mStrThread << ": cannot set the nice value (" << strerror(errno) << ")" << endl;
+            bOk = false;
+        }
+    }
+
+    return bOk;
+}
+
+string ThreadScheduling::ToString() const
+{
+    stringstream ss;
+    if(!mvCpus.empty())
+    {
+        ss << "cpus";
+        for(size_t i=0; i<mvCpus.size(); i++)
+            ss << (i==0 ? " " : ",") << mvCpus[i];
+    }
+    if(mnPolicy != -1)
+    {
+        if(ss.tellp() > 0)
+            ss << ", ";
+        switch(mnPolicy)
+        {
+            case SCHED_OTHER: ss << "other"; break;
+            case SCHED_BATCH: ss << "batch"; break;
+            case SCHED_IDLE: ss << "idle"; break;
+            case SCHED_FIFO: ss << "fifo " << mnPriority; break;
+            case SCHED_RR: ss << "rr " << mnPriority; break;
+        }
+    }
+    if(mbNice)
+    {
+        if(ss.tellp() > 0)
+            ss << ", ";
+        ss << "nice " << mnNice;
+    }
+    return ss.str();
+}
+
+} //namespace ORB_SLAM
@@ -0,0 +1,375 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "TileStreamer.h"
+#include "Map.h"
+#include "KeyFrame.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+
+namespace ORB_SLAM3
+{
+
+TileStreamer::TileStreamer(const float fTileSize, const float fRadius, const float fPrefetch, const std::string &strDir):
+    mfTileSize(fTileSize), mfRadius(fRadius>0 ? fRadius : fTileSize), mfPrefetch(fPrefetch>0 ? fPrefetch : 0.f), mStrDir(strDir),
+    mpMap(static_cast<Map*>(NULL)), mnMapId(0), mnBusy(0), mbWriteError(false), mPos(0,0,0), mVel(0,0,0),
+    mLastTimestamp(0), mbHasPos(false), mbFinishRequested(false), mbFinished(false)
+{
+    if(!mStrDir.empty() && mStrDir[mStrDir.size()-1] != '/')
+        mStrDir += "/";
+}
+
+void TileStreamer::Run()
+{
+    while(!CheckFinish())
+    {
+        bool bWork = false;
+        {
+            std::unique_lock<std::mutex> lock(mMutexTiles);
+            if(mpMap && mbHasPos)
+            {
+                // Nearest spilled tile that is needed
+                std::map<TileKey,Tile>::iterator itLoad = mmTiles.end();
+                float bestDist = 0;
+                for(std::map<TileKey,Tile>::iterator it=mmTiles.begin(); it!=mmTiles.end(); it++)
+                {
+                    if(it->second.mState!=SPILLED || !IsWanted(it->first,mfRadius))
+                        continue;
+                    const float dist = DistanceToTile(it->first,mPos);
+                    if(itLoad==mmTiles.end() || dist<bestDist)
+                    {
+                        itLoad = it;
+                        bestDist = dist;
+                    }
+                }
+
+                if(itLoad!=mmTiles.end())
+                {
+                    LoadTile(lock,itLoad->first,itLoad->second);
+                    bWork = true;
+                }
+                else
+                {
+                    // Tiles out of range, with some margin so that a camera moving along a tile
+                    // border does not write and load it over and over
+                    std::map<TileKey,Tile>::iterator itWrite = mmTiles.end();
+                    for(std::map<TileKey,Tile>::iterator it=mmTiles.begin(); it!=mmTiles.end(); it++)
+                    {
+                        Tile &tile = it->second;
+                        if(tile.mState==WRITTEN && IsWanted(it->first,mfRadius))
+                            tile.mState = RESIDENT;
+                        else if(tile.mState==RESIDENT && !IsWanted(it->first,1.5f*mfRadius))
+                        {
+                            if(tile.mbOnDisk)
+                                tile.mState = WRITTEN;
+                            else if(itWrite==mmTiles.end() && !mbWriteError)
+                                itWrite = it;
+                        }
+                    }
+
+                    if(itWrite!=mmTiles.end())
+                    {
+                        const TileKey key = itWrite->first;
+                        Tile &tile = itWrite->second;
+                        tile.mState = WRITING;
+                        mnBusy++;
+                        lock.unlock();
+                        const bool bOk = WriteTile(key,tile.mvpKeyFrames);
+                        lock.lock();
+                        mnBusy--;
+                        tile.mbOnDisk = bOk;
+                        tile.mState = bOk ? WRITTEN : RESIDENT;
+                        if(!bOk)
+                            mbWriteError = true;
+                        mcvTiles.notify_all();
+                        bWork = true;
+                    }
+                }
+            }
+        }
+
+        if(!bWork)
+            usleep(20000);
+    }
+
+    SetFinish();
+}
+
+void TileStreamer::Update(Map* pMap, const cv::Matx31f &Ow, const double &timestamp)
+{
+    std::unique_lock<std::mutex> lock(mMutexTiles);
+
+    if(pMap!=mpMap || (pMap && pMap->GetId()!=mnMapId))
+    {
+        if(mpMap)
+            DropTiles(lock,true);
+        if(pMap)
+            BuildTiles(pMap);
+    }
+    if(!mpMap)
+        return;
+
+    if(mbHasPos && timestamp>mLastTimestamp)
+    {
+        const cv::Matx31f vel = (Ow-mPos)*(1.f/float(timestamp-mLastTimestamp));
+        mVel = 0.7f*mVel + 0.3f*vel;
+    }
+    else
+        mVel = cv::Matx31f(0,0,0);
+    mPos = Ow;
+    mLastTimestamp = timestamp;
+    mbHasPos = true;
+
+    // Release the tiles already on disk that are still out of range. Only this thread reads the
+    // features in localization mode, so nothing is using them
+    for(std::map<TileKey,Tile>::iterator it=mmTiles.begin(); it!=mmTiles.end(); it++)
+    {
+        Tile &tile = it->second;
+        if(tile.mState!=WRITTEN || IsWanted(it->first,mfRadius))
+            continue;
+        for(size_t i=0; i<tile.mvpKeyFrames.size(); i++)
+            if(!tile.mvpKeyFrames[i]->AreFeaturesReleased())
+                tile.mvpKeyFrames[i]->ReleaseFeatures();
+        tile.mState = SPILLED;
+    }
+}
+
+void TileStreamer::EnsureResident(KeyFrame* pKF)
+{
+    std::unique_lock<std::mutex> lock(mMutexTiles);
+    while(mpMap)
+    {
+        std::map<KeyFrame*,TileKey>::iterator itKF = mmKFTile.find(pKF);
+        if(itKF==mmKFTile.end())
+            return;
+        Tile &tile = mmTiles[itKF->second];
+        if(tile.mState==LOADING)
+        {
+            mcvTiles.wait(lock);
+            continue;
+        }
+        if(tile.mState==SPILLED)
+            LoadTile(lock,itKF->second,tile);
+        return;
+    }
+}
+
+void TileStreamer::LoadAll()
+{
+    std::unique_lock<std::mutex> lock(mMutexTiles);
+    DropTiles(lock,true);
+}
+
+void TileStreamer::Clear()
+{
+    std::unique_lock<std::mutex> lock(mMutexTiles);
+    DropTiles(lock,false);
+}
+
+void TileStreamer::BuildTiles(Map* pMap)
+{
+    mpMap = pMap;
+    mnMapId = pMap->GetId();
+    mbHasPos = false;
+    mbWriteError = false;
+    mVel = cv::Matx31f(0,0,0);
+
+    const Map::KeyFramesSnapshot pKFs = pMap->GetKeyFramesSnapshot();
+    const std::vector<KeyFrame*> &vpKFs = *pKFs;
+    for(size_t i=0; i<vpKFs.size(); i++)
+    {
+        KeyFrame* pKF = vpKFs[i];
+        if(pKF->isBad() || pKF->AreFeaturesReleased())
+            continue;
+        const cv::Matx31f Ow = pKF->GetCameraCenter_();
+        TileKey key;
+        for(int j=0; j<3; j++)
+            key[j] = int(std::floor(Ow(j)/mfTileSize));
+        mmTiles[key].mvpKeyFrames.push_back(pKF);
+        mmKFTile[pKF] = key;
+    }
+
+    std::cout << "Tiled map " << mnMapId << ": " << mmKFTile.size() << " keyframes in " << mmTiles.size()
+              << " tiles of " << mfTileSize << " m" << std::endl;
+}
+
+void TileStreamer::DropTiles(std::unique_lock<std::mutex> &lock, const bool bLoad)
+{
+    while(mnBusy>0)
+        mcvTiles.wait(lock);
+
+    for(std::map<TileKey,Tile>::iterator it=mmTiles.begin(); it!=mmTiles.end(); it++)
+    {
+        Tile &tile = it->second;
+        if(bLoad && tile.mState==SPILLED)
+            ReadTile(it->first,tile.mvpKeyFrames);
+        if(tile.mbOnDisk)
+            std::remove(TileFileName(it->first).c_str());
+    }
+
+    mmTiles.clear();
+    mmKFTile.clear();
+    mpMap = static_cast<Map*>(NULL);
+    mbHasPos = false;
+}
+
+float TileStreamer::DistanceToTile(const TileKey &key, const cv::Matx31f &p) const
+{
+    float d2 = 0;
+    for(int j=0; j<3; j++)
+    {
+        const float lo = key[j]*mfTileSize;
+        const float hi = lo+mfTileSize;
+        const float d = p(j)<lo ? lo-p(j) : (p(j)>hi ? p(j)-hi : 0.f);
+        d2 += d*d;
+    }
+    return std::sqrt(d2);
+}
+
+bool TileStreamer::IsWanted(const TileKey &key, const float fRadius) const
+{
+    // Current position and the predicted path, every quarter of the prefetch time
+    const int nSteps = mfPrefetch>0 ? 4 : 0;
+    for(int s=0; s<=nSteps; s++)
+    {
+        const cv::Matx31f p = mPos + mVel*(mfPrefetch*s/std::max(nSteps,1));
+        if(DistanceToTile(key,p)<=fRadius)
+            return true;
+    }
+    return false;
+}
+
+std::string TileStreamer::TileFileName(const TileKey &key) const
+{
+    return mStrDir + "map_" + std::to_string(mnMapId) + "_tile_" + std::to_string(key[0]) + "_" +
+           std::to_string(key[1]) + "_" + std::to_string(key[2]) + ".tile";
+}
+
+bool TileStreamer::WriteTile(const TileKey &key, const std::vector<KeyFrame*> &vpKFs)
+{
+    const std::string strFile = TileFileName(key);
+    std::ofstream ofs(strFile.c_str(), std::ios::binary);
+    if(!ofs.is_open())
+    {
+        std::cerr << "Cannot write tile file " << strFile << std::endl;
+        return false;
+    }
+
+    {
+        boost::archive::binary_oarchive oa(ofs);
+        size_t nKFs = vpKFs.size();
+        oa << nKFs;
+        for(size_t i=0; i<vpKFs.size(); i++)
+        {
+            long unsigned int nId = vpKFs[i]->mnId;
+            oa << nId;
+            vpKFs[i]->SaveFeatures(oa);
+        }
+    }
+
+    if(!ofs.good())
+    {
+        std::cerr << "Failed to write tile file " << strFile << std::endl;
+        ofs.close();
+        std::remove(strFile.c_str());
+        return false;
+    }
+    ofs.close();
+    return true;
+}
+
+bool TileStreamer::ReadTile(const TileKey &key, const std::vector<KeyFrame*> &vpKFs)
+{
+    const std::string strFile = TileFileName(key);
+    std::ifstream ifs(strFile.c_str(), std::ios::binary);
+    if(!ifs.is_open())
+    {
+        std::cerr << "Cannot read tile file " << strFile << std::endl;
+        return false;
+    }
+
+    std::map<long unsigned int, KeyFrame*> mpKFid;
+    for(size_t i=0; i<vpKFs.size(); i++)
+        mpKFid[vpKFs[i]->mnId] = vpKFs[i];
+
+    {
+        boost::archive::binary_iarchive ia(ifs);
+        size_t nKFs;
+        ia >> nKFs;
+        KeyFrame discarded;
+        for(size_t i=0; i<nKFs; i++)
+        {
+            long unsigned int nId;
+            ia >> nId;
+            std::map<long unsigned int, KeyFrame*>::iterator it = mpKFid.find(nId);
+            if(it != mpKFid.end() && it->second->AreFeaturesReleased())
+                it->second->LoadFeatures(ia);
+            else
+                discarded.LoadFeatures(ia);
+        }
+    }
+    ifs.close();
+    return true;
+}
+
+void TileStreamer::LoadTile(std::unique_lock<std::mutex> &lock, const TileKey &key, Tile &tile)
+{
+    tile.mState = LOADING;
+    mnBusy++;
+    lock.unlock();
+    ReadTile(key,tile.mvpKeyFrames);
+    lock.lock();
+    mnBusy--;
+    // Even if the file could not be read, so that nobody waits for it forever
+    tile.mState = RESIDENT;
+    mcvTiles.notify_all();
+}
+
+void TileStreamer::RequestFinish()
+{
+    std::unique_lock<std::mutex> lock(mMutexFinish);
+    mbFinishRequested = true;
+}
+
+bool TileStreamer::CheckFinish()
+{
+    std::unique_lock<std::mutex> lock(mMutexFinish);
+    return mbFinishRequested;
+}
+
+void TileStreamer::SetFinish()
+{
+    std::unique_lock<std::mutex> lock(mMutexFinish);
+    mbFinished = true;
+}
+
+bool TileStreamer::isFinished()
+{
+    std::unique_lock<std::mutex> lock(mMutexFinish);
+    return mbFinished;
+}
+
+} //namespace ORB_SLAM3
@@ -0,0 +1,178 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "Tracer.h"
+
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace ORB_SLAM3
+{
+
+namespace
+{
+
+struct TraceEvent
+{
+    const char* name;
+    long long startNs;
+    long long durationNs;
+};
+
+// Written only by its thread, kept after the thread finishes so that it can be saved
+struct ThreadBuffer
+{
+    ThreadBuffer(const int id) : tid(id), name(NULL), events(new TraceEvent[Tracer::BUFFER_SIZE]), head(0) {}
+
+    const int tid;
+    std::atomic<const char*> name;
+    std::unique_ptr<TraceEvent[]> events;
+    // Number of spans recorded, the last BUFFER_SIZE are in the buffer
+    std::atomic<size_t> head;
+};
+
+std::mutex& RegistryMutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+std::vector<std::unique_ptr<ThreadBuffer> >& Registry()
+{
+    static std::vector<std::unique_ptr<ThreadBuffer> > buffers;
+    return buffers;
+}
+
+ThreadBuffer* GetThreadBuffer()
+{
+    static thread_local ThreadBuffer* pBuffer = NULL;
+    if(!pBuffer)
+    {
+        std::unique_lock<std::mutex> lock(RegistryMutex());
+        std::vector<std::unique_ptr<ThreadBuffer> > &buffers = Registry();
+        buffers.push_back(std::unique_ptr<ThreadBuffer>(new ThreadBuffer(buffers.size()+1)));
+        pBuffer = buffers.back().get();
+    }
+    return pBuffer;
+}
+
+long long ToNs(const Tracer::Clock::time_point &t)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+}
+
+void WriteJsonString(std::ostream &os, const char* s)
+{
+    os << '"';
+    for(; *s; s++)
+    {
+        if(*s=='"' || *s=='\\')
+            os << '\\';
+        os << *s;
+    }
+    os << '"';
+}
+
+} // namespace
+
+void Tracer::SetThreadName(const char* name)
+{
+    GetThreadBuffer()->name.store(name, std::memory_order_relaxed);
+}
+
+void Tracer::Record(const char* name, const Clock::time_point &tStart, const Clock::time_point &tEnd)
+{
+    ThreadBuffer* pBuffer = GetThreadBuffer();
+    const size_t head = pBuffer->head.load(std::memory_order_relaxed);
+
+    TraceEvent &event = pBuffer->events[head % BUFFER_SIZE];
+    event.name = name;
+    event.startNs = ToNs(tStart);
+    event.durationNs = ToNs(tEnd) - event.startNs;
+
+    pBuffer->head.store(head+1, std::memory_order_release);
+}
+
+bool Tracer::SaveChromeTrace(const std::string &filename)
+{
+    std::ofstream f(filename.c_str());
+    if(!f.is_open())
+    {
+        std::cerr << "ERROR: Cannot write the trace " << filename << std::endl;
+        return false;
+    }
+
+    std::unique_lock<std::mutex> lock(RegistryMutex());
+    const std::vector<std::unique_ptr<ThreadBuffer> > &buffers = Registry();
+
+    // Timestamps relative to the first span kept
+    long long t0 = -1;
+    for(size_t i=0; i<buffers.size(); i++)
+    {
+        const size_t head = buffers[i]->head.load(std::memory_order_acquire);
+        const size_t first = head>BUFFER_SIZE ? head-BUFFER_SIZE : 0;
+        for(size_t j=first; j<head; j++)
+        {
+            const long long t = buffers[i]->events[j % BUFFER_SIZE].startNs;
+            if(t0<0 || t<t0)
+                t0 = t;
+        }
+    }
+
+    size_t nSpans = 0;
+    f << std::fixed << std::setprecision(3);
+    f << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool bFirst = true;
+    for(size_t i=0; i<buffers.size(); i++)
+    {
+        const ThreadBuffer* pBuffer = buffers[i].get();
+        const char* name = pBuffer->name.load(std::memory_order_relaxed);
+
+        f << (bFirst ? "" : ",") << std::endl << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << pBuffer->tid << ",\"args\":{\"name\":";
+        if(name)
+            WriteJsonString(f, name);
+        else
+            f << "\"Thread " << pBuffer->tid << "\"";
+        f << "}}";
+        bFirst = false;
+
+        const size_t head = pBuffer->head.load(std::memory_order_acquire);
+        const size_t first = head>BUFFER_SIZE ? head-BUFFER_SIZE : 0;
+        for(size_t j=first; j<head; j++)
+        {
+            const TraceEvent &event = pBuffer->events[j % BUFFER_SIZE];
+            f << "," << std::endl << "{\"name\":";
+            WriteJsonString(f, event.name);
+            f << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << pBuffer->tid << ",\"ts\":" << (event.startNs-t0)/1e3
+              << ",\"dur\":" << event.durationNs/1e3 << "}";
+            nSpans++;
+        }
+    }
+    f << std::endl << "]}" << std::endl;
+
+    std::cout << "Trace with " << nSpans << " spans of " << buffers.size() << " threads saved to " << filename << std::endl;
+    return f.good();
+}
+
+} //namespace ORB_SLAM3
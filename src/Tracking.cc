@@ -28,11 +28,31 @@
 #include "Initializer.h"
 #include "G2oTypes.h"
 #include "Optimizer.h"
+#include "ThreadPool.h"
+#include "SystemContext.h"
+#include "Metrics.h"
+#include "EpochManager.h"
+#include "MapStreamer.h"
+#include "TileStreamer.h"
+#include "TrajectoryWriter.h"
+#include "TrajectoryStore.h"
+#include "Tracer.h"
+#include "ReplayLog.h"
+#include "FeatureBudgetController.h"
+#include "TrackingDeadline.h"
+#include "StereoRectifier.h"
+#include "CameraRig.h"
+#include "Triangulator.h"
+#include "PowerGovernor.h"
+#include "RelocalizationCache.h"
+#include "ORBextractorOCL.h"
 
 #include <iostream>
 
 #include <mutex>
+#include <atomic>
 #include <chrono>
+#include <limits>
 #include <include/CameraModels/Pinhole.h>
 #include <include/CameraModels/KannalaBrandt8.h>
 #include <include/MLPnPsolver.h>
@@ -42,6 +62,46 @@ using namespace std;
 namespace ORB_SLAM3
 {
 
+// Focused extraction: cell size (pixels) of the focus masks and inliers needed to use them
+const int FOCUS_CELL_SIZE = 16;
+const int FOCUS_MIN_INLIERS = 100;
+
+// Dual resolution: inliers needed to track the frames at reduced resolution
+const int DUAL_RES_MIN_INLIERS = 100;
+
+// Optical flow tracking: Lucas-Kanade window and pyramid levels, forward-backward error (pixels)
+// and inliers needed to keep tracking by flow
+const int FLOW_WIN_SIZE = 21;
+const int FLOW_LEVELS = 3;
+const float FLOW_MAX_FB_ERROR = 1.f;
+const int FLOW_MIN_INLIERS = 50;
+
+// Offline mapping: keyframes that may wait in the Local Mapping queue before tracking stops
+const int OFFLINE_MAX_QUEUED_KEYFRAMES = 2;
+
+// Deadline: fewer local map points than this are not worth searching
+const int DEADLINE_MIN_LOCAL_POINTS = 100;
+
+// Relocalization: candidates fully verified by default when there are more (Tracking.RelocalizationCandidates)
+const int RELOC_DEFAULT_CANDIDATES = 10;
+
+// 3x4 pose as the 4x4 matrix of the spatial index queries
+static cv::Matx44f PoseMatrix(const cv::Matx34f &T)
+{
+    return cv::Matx44f(T(0,0),T(0,1),T(0,2),T(0,3),
+                       T(1,0),T(1,1),T(1,2),T(1,3),
+                       T(2,0),T(2,1),T(2,2),T(2,3),
+                       0.f,0.f,0.f,1.f);
+}
+
+// ORB extractor of the configured backend (ORBextractor.Backend)
+static FeatureExtractor* NewORBextractor(const bool bOpenCL, int nFeatures, float fScaleFactor, int nLevels, int fIniThFAST, int fMinThFAST)
+{
+    if(bOpenCL)
+        return new ORBextractorOCL(nFeatures,fScaleFactor,nLevels,fIniThFAST,fMinThFAST);
+    return new ORBextractor(nFeatures,fScaleFactor,nLevels,fIniThFAST,fMinThFAST);
+}
+
 /* system, orbvocabulary, framedrawer, mapdrawer, atlas, keyframedatabase --> 각각의 class들을 포인터로 선언, 나중에 tracking중에 해당 클래스의 변수들을 가져올때 대부분 사용한다.
 
 strSettingPath, sensor, nameSeq --> 상수로 선언함으로써 나중에 고정변수로 사용한다.
@@ -77,12 +137,12 @@ mbCreatedMap
 mpCamera2 
 */
 
-Tracking::Tracking(System *pSys, ORBVocabulary* pVoc, FrameDrawer *pFrameDrawer, MapDrawer *pMapDrawer, Atlas *pAtlas, KeyFrameDatabase* pKFDB, const string &strSettingPath, const int sensor, const string &_nameSeq):
+Tracking::Tracking(System *pSys, ORBVocabulary* pVoc, FrameDrawer *pFrameDrawer, MapDrawer *pMapDrawer, Atlas *pAtlas, KeyFrameDatabase* pKFDB, SystemContext* pContext, const string &strSettingPath, const int sensor, const string &_nameSeq):
     mState(NO_IMAGES_YET), mSensor(sensor), mTrackedFr(0), mbStep(false),
-    mbOnlyTracking(false), mbMapUpdated(false), mbVO(false), mpORBVocabulary(pVoc), mpKeyFrameDB(pKFDB),
-    mpInitializer(static_cast<Initializer*>(NULL)), mpSystem(pSys), mpViewer(NULL),
+    mbOnlyTracking(false), mbMapUpdated(false), mbVO(false), mpORBVocabulary(pVoc), mpKeyFrameDB(pKFDB), mpContext(pContext),
+    mpInitializer(static_cast<Initializer*>(NULL)), mbLocalMapCached(false), mbLocalKeyFramesReused(false), mnLocalMirrorFrameId(static_cast<long unsigned int>(-1)), mpFrozenMap(static_cast<FrozenMap*>(NULL)), mpSystem(pSys), mpViewer(NULL), mpMapStreamer(NULL), mpTileStreamer(NULL), mpTrajectoryWriter(NULL), mnTrajectoryHistory(0), mpTrajectoryStore(NULL),
     mpFrameDrawer(pFrameDrawer), mpMapDrawer(pMapDrawer), mpAtlas(pAtlas), mnLastRelocFrameId(0), time_recently_lost(5.0), time_recently_lost_visual(2.0),
-    mnInitialFrameId(0), mbCreatedMap(false), mnFirstFrameId(0), mpCamera2(nullptr)
+    mnInitialFrameId(0), mbCreatedMap(false), mnFirstFrameId(0), mImuPreintegrator(&mImuQueue), mpCamera2(nullptr)
 {
     //해당 함수는 tracking을 하기 위한 초기값 세팅의 시작으로 볼수 있습니다.
 
@@ -98,12 +158,50 @@ Tracking::Tracking(System *pSys, ORBVocabulary* pVoc, FrameDrawer *pFrameDrawer,
 
     // Load ORB parameters
     //camera parameter와 마찬가지로 ORB parameter를 불러와서 연산을 합니다. 해당 parameter들도 example파일에서 .yaml파일에 보면 나와있습니다.
+    mpORBextractorLeft = mpORBextractorRight = mpIniORBextractor = static_cast<FeatureExtractor*>(NULL);
+    mbParallelExtraction = false;
+    mpFeatureBudget = static_cast<FeatureBudgetController*>(NULL);
+    mpPowerGovernor = static_cast<PowerGovernor*>(NULL);
+    mfFocusRadius = 0.f;
+    mfFocusCoverage = 0.25f;
+    mbFocusFullFrame = false;
+    mbDualResolution = false;
+    mbReducedNext = false;
+    mbFullResolutionNext = false;
+    mbOfflineMapping = false;
+    mfImuInitKFInterval = 0.25f;
+    mbFlowTracking = false;
+    mnFlowMinPoints = 80;
+    mbFlowNext = false;
+    mbFlowExtractNext = false;
+    mpThreadPool = static_cast<ThreadPool*>(NULL);
+    mpMetrics = static_cast<Metrics*>(NULL);
+    mpReplayLog = static_cast<ReplayLog*>(NULL);
     bool b_parse_orb = ParseORBParamFile(fSettings);
     if(!b_parse_orb) //camera 부분과 마찬가지입니다. 
     {
         std::cout << "*Error with the ORB parameters in the config file*" << std::endl;
     }
 
+    // Optional: rectify the stereo images here with LEFT.* and RIGHT.*, fused with the gray conversion
+    // and the first pyramid level of the extractors, instead of giving rectified images
+    mpStereoRectifier = static_cast<StereoRectifier*>(NULL);
+    cv::FileNode nodeRectify = fSettings["Stereo.Rectify"];
+    if((sensor==System::STEREO || sensor==System::IMU_STEREO) && !mpCamera2 &&
+       !nodeRectify.empty() && nodeRectify.isInt() && nodeRectify.operator int() != 0)
+    {
+        mpStereoRectifier = StereoRectifier::FromSettings(fSettings);
+        if(mpStereoRectifier)
+            cout << endl << "Stereo rectification in the tracking" << endl;
+        else
+            cerr << "Stereo.Rectify: calibration parameters to rectify stereo are missing, the images must be rectified" << endl;
+    }
+
+    // Optional: additional cameras of a rig that constrain the pose of the frames (Rig.*)
+    mpCameraRig = static_cast<CameraRig*>(NULL);
+    if(sensor!=System::RGBD)
+        mpCameraRig = CameraRig::FromSettings(fSettings);
+
     initID = 0; lastID = 0; //초기값 선언
 
     // Load IMU parameters
@@ -125,6 +223,45 @@ Tracking::Tracking(System *pSys, ORBVocabulary* pVoc, FrameDrawer *pFrameDrawer,
 
     mnNumDataset = 0; //dataset number 초기화
 
+    // Optional: time (ms) a frame may take from its extraction to the end of its tracking. To meet
+    // it the Tracking skips the wider motion model search, shrinks the local map or outputs the
+    // motion model pose
+    mpDeadline = static_cast<TrackingDeadline*>(NULL);
+    mnDegradations = TrackingDeadline::NONE;
+    mnLocalPointsSearched = 0;
+    cv::FileNode nodeDeadline = fSettings["Tracking.Deadline"];
+    if(!nodeDeadline.empty() && nodeDeadline.isReal() && nodeDeadline.real() > 0)
+    {
+        mpDeadline = new TrackingDeadline(nodeDeadline.real(),DEADLINE_MIN_LOCAL_POINTS);
+        cout << endl << "Tracking Deadline: " << nodeDeadline.real() << " ms" << endl;
+    }
+
+    // Optional: candidates of a relocalization that go through the full matching and MLPnP, the best
+    // ranked by their RelocalizationCache (0 verifies all of them)
+    mnRelocCandidates = RELOC_DEFAULT_CANDIDATES;
+    cv::FileNode nodeRelocCandidates = fSettings["Tracking.RelocalizationCandidates"];
+    if(!nodeRelocCandidates.empty() && nodeRelocCandidates.isInt() && nodeRelocCandidates.operator int() >= 0)
+        mnRelocCandidates = nodeRelocCandidates.operator int();
+
+    // Optional: when lost, look for the frame in the other maps of the Atlas and continue in the map
+    // found instead of starting a new one (not with IMU, the inertial state is not recovered)
+    mbAtlasRelocalization = sensor!=System::IMU_MONOCULAR && sensor!=System::IMU_STEREO;
+    cv::FileNode nodeAtlasReloc = fSettings["Tracking.AtlasRelocalization"];
+    if(mbAtlasRelocalization && !nodeAtlasReloc.empty() && nodeAtlasReloc.isInt())
+        mbAtlasRelocalization = nodeAtlasReloc.operator int() != 0;
+
+    // Optional: radius (map units) around the camera in which the spatial index of the map adds
+    // keyframes and points in the frustum to the local map, and culls the search of the local points
+    // (0: local map from the covisibility graph only)
+    mfSpatialLocalMapRadius = 0.f;
+    mnLocalKFMapPoints = 0;
+    cv::FileNode nodeSpatialLocalMap = fSettings["Tracking.SpatialLocalMap"];
+    if(!nodeSpatialLocalMap.empty() && nodeSpatialLocalMap.isReal() && nodeSpatialLocalMap.real() > 0)
+    {
+        mfSpatialLocalMapRadius = nodeSpatialLocalMap.real();
+        cout << endl << "Spatial local map radius: " << mfSpatialLocalMapRadius << endl;
+    }
+
     if(!b_parse_cam || !b_parse_orb || !b_parse_imu) //cam, orb, imu에 대한 parsing이 재대로 이루어졌는지 체크합니다. 
     {
         std::cerr << "**ERROR in the config file, the format is not correct**" << std::endl;
@@ -532,7 +669,14 @@ void Tracking::PrintTimeStats()
 
 Tracking::~Tracking()
 {
-
+    // The reconstruction of the monocular initializer uses the camera
+    if(mIniReconstructionDone.valid())
+        mIniReconstructionDone.wait();
+    delete mpFrozenMap;
+    delete mpFeatureBudget;
+    delete mpDeadline;
+    delete mpStereoRectifier;
+    delete mpCameraRig;
 }
 
 bool Tracking::ParseCamParamFile(cv::FileStorage &fSettings) //cam parameter들을 parsing하는 함수입니다. 
@@ -984,6 +1128,18 @@ bool Tracking::ParseCamParamFile(cv::FileStorage &fSettings) //cam parameter들
             }
         }
 
+        // Optional lookup table for the unprojection, instead of a Newton solve per keypoint
+        node = fSettings["Camera.unprojectionLUTSize"];
+        if(!b_miss_params && !node.empty() && node.isInt() && node.operator int() > 0)
+        {
+            const int nLUTSize = node.operator int();
+            static_cast<KannalaBrandt8*>(mpCamera)->BuildUnprojectLUT(nLUTSize);
+            if(mpCamera2)
+                static_cast<KannalaBrandt8*>(mpCamera2)->BuildUnprojectLUT(nLUTSize);
+
+            std::cout << "- unprojection LUT size: " << nLUTSize << std::endl;
+        }
+
         if(b_miss_params)
         {
             return false;
@@ -1053,6 +1209,16 @@ bool Tracking::ParseCamParamFile(cv::FileStorage &fSettings) //cam parameter들
 
     }
 
+    // Stereo cameras may give their own disparity or depth map (System::TrackStereoDepth), scaled by
+    // the optional DepthMapFactor (1 by default)
+    if(mSensor==System::STEREO || mSensor==System::IMU_STEREO)
+    {
+        mDepthMapFactor = 1.0f;
+        cv::FileNode node = fSettings["DepthMapFactor"];
+        if(!node.empty() && node.isReal() && fabs(node.real())>=1e-5)
+            mDepthMapFactor = 1.0f/node.real();
+    }
+
     if(mSensor==System::RGBD)
     {
         cv::FileNode node = fSettings["DepthMapFactor"];
@@ -1148,13 +1314,35 @@ bool Tracking::ParseORBParamFile(cv::FileStorage &fSettings) //ORB parameter들
         return false;
     }
 
-    mpORBextractorLeft = new ORBextractor(nFeatures,fScaleFactor,nLevels,fIniThFAST,fMinThFAST);
+    // Optional: process the pyramid levels on the system thread pool (1 = sequential)
+    int nExtractorThreads = 1;
+    node = fSettings["ORBextractor.nThreads"];
+    if(!node.empty() && node.isInt())
+        nExtractorThreads = node.operator int();
+    mbParallelExtraction = nExtractorThreads>1;
+
+    // Optional: "opencl" builds the scale pyramid on an OpenCL device (same features as "cpu")
+    bool bOpenCL = false;
+    node = fSettings["ORBextractor.Backend"];
+    if(!node.empty() && node.isString())
+    {
+        if(node.string() == "opencl")
+        {
+            bOpenCL = ORBextractorOCL::IsAvailable();
+            if(!bOpenCL)
+                std::cerr << "*No OpenCL device available, ORB extraction on the CPU*" << std::endl;
+        }
+        else if(node.string() != "cpu")
+            std::cerr << "*Unknown ORBextractor.Backend " << node.string() << ", ORB extraction on the CPU*" << std::endl;
+    }
+
+    mpORBextractorLeft = NewORBextractor(bOpenCL,nFeatures,fScaleFactor,nLevels,fIniThFAST,fMinThFAST);
 
     if(mSensor==System::STEREO || mSensor==System::IMU_STEREO)
-        mpORBextractorRight = new ORBextractor(nFeatures,fScaleFactor,nLevels,fIniThFAST,fMinThFAST);
+        mpORBextractorRight = NewORBextractor(bOpenCL,nFeatures,fScaleFactor,nLevels,fIniThFAST,fMinThFAST);
 
     if(mSensor==System::MONOCULAR || mSensor==System::IMU_MONOCULAR)
-        mpIniORBextractor = new ORBextractor(5*nFeatures,fScaleFactor,nLevels,fIniThFAST,fMinThFAST);
+        mpIniORBextractor = NewORBextractor(bOpenCL,5*nFeatures,fScaleFactor,nLevels,fIniThFAST,fMinThFAST);
 
     cout << endl << "ORB Extractor Parameters: " << endl;
     cout << "- Number of Features: " << nFeatures << endl;
@@ -1162,6 +1350,98 @@ bool Tracking::ParseORBParamFile(cv::FileStorage &fSettings) //ORB parameter들
     cout << "- Scale Factor: " << fScaleFactor << endl;
     cout << "- Initial Fast Threshold: " << fIniThFAST << endl;
     cout << "- Minimum Fast Threshold: " << fMinThFAST << endl;
+    cout << "- Parallel Extraction: " << (mbParallelExtraction ? "yes" : "no") << endl;
+    cout << "- Backend: " << (bOpenCL ? "OpenCL" : "CPU") << endl;
+
+    // Optional: keypoint grid of the frames (cells), given or derived from the image size and the
+    // number of features, for high resolution cameras where the default 64x48 cells get too large
+    int nGridCols = 0, nGridRows = 0;
+    node = fSettings["Camera.gridCols"];
+    if(!node.empty() && node.isInt())
+        nGridCols = node.operator int();
+    node = fSettings["Camera.gridRows"];
+    if(!node.empty() && node.isInt())
+        nGridRows = node.operator int();
+    node = fSettings["Camera.gridAuto"];
+    if((nGridCols<=0 || nGridRows<=0) && !node.empty() && node.isInt() && node.operator int() != 0)
+    {
+        const cv::FileNode nodeWidth = fSettings["Camera.width"];
+        const cv::FileNode nodeHeight = fSettings["Camera.height"];
+        if(nodeWidth.isInt() && nodeHeight.isInt())
+            FeatureGrid::SizeFor(nodeWidth.operator int(),nodeHeight.operator int(),nFeatures,nGridCols,nGridRows);
+        else
+            std::cerr << "*Camera.gridAuto needs Camera.width and Camera.height, default grid used*" << std::endl;
+    }
+    if(nGridCols>0 && nGridRows>0)
+    {
+        mpCamera->SetFeatureGrid(nGridCols,nGridRows);
+        if(mpCamera2)
+            mpCamera2->SetFeatureGrid(nGridCols,nGridRows);
+        cout << "- Feature Grid: " << nGridCols << "x" << nGridRows << " cells" << endl;
+    }
+
+    // Optional: adapt the features and pyramid levels so that extraction and tracking fit in
+    // this time (ms) per frame
+    node = fSettings["ORBextractor.FrameBudget"];
+    if(!node.empty() && node.isReal() && node.real() > 0)
+    {
+        int nMinFeatures = nFeatures/2, nMaxFeatures = nFeatures*3/2, nMinLevels = std::max(nLevels-2,1);
+        node = fSettings["ORBextractor.minFeatures"];
+        if(!node.empty() && node.isInt())
+            nMinFeatures = node.operator int();
+        node = fSettings["ORBextractor.maxFeatures"];
+        if(!node.empty() && node.isInt())
+            nMaxFeatures = node.operator int();
+        node = fSettings["ORBextractor.minLevels"];
+        if(!node.empty() && node.isInt())
+            nMinLevels = node.operator int();
+
+        const float fFrameBudget = fSettings["ORBextractor.FrameBudget"].real();
+        mpFeatureBudget = new FeatureBudgetController(fFrameBudget,nFeatures,nMinFeatures,nMaxFeatures,nLevels,nMinLevels);
+
+        cout << "- Frame Budget: " << fFrameBudget << " ms, " << nMinFeatures << "-" << nMaxFeatures
+             << " features, " << nMinLevels << "-" << nLevels << " levels" << endl;
+    }
+
+    // Optional: between keyframes detect only within this radius (pixels) of the predicted
+    // projections of the map points, plus FocusCoverage of the rest of the image
+    node = fSettings["ORBextractor.FocusRadius"];
+    if(!node.empty() && node.isReal() && node.real() > 0)
+    {
+        mfFocusRadius = node.real();
+        node = fSettings["ORBextractor.FocusCoverage"];
+        if(!node.empty() && node.isReal())
+            mfFocusCoverage = node.real();
+
+        cout << "- Focus Radius: " << mfFocusRadius << " px, coverage " << mfFocusCoverage << endl;
+    }
+
+    // Optional: extract the frames between keyframes without the first pyramid level, keyframes
+    // are taken from frames at full resolution
+    node = fSettings["ORBextractor.DualResolution"];
+    if(!node.empty() && node.isInt() && node.operator int() != 0)
+    {
+        mbDualResolution = true;
+        cout << "- Dual Resolution: non-keyframes from level 1 (" << 1.0f/mpORBextractorLeft->GetScaleFactor() << "x)" << endl;
+    }
+
+    // Optional: track the frames between keyframes with optical flow, extracting only when a
+    // keyframe is due or fewer than FlowMinPoints map points survive the flow
+    node = fSettings["ORBextractor.OpticalFlow"];
+    if(!node.empty() && node.isInt() && node.operator int() != 0)
+    {
+        if(mSensor==System::IMU_MONOCULAR || mSensor==System::IMU_STEREO)
+            cout << "- Optical Flow: not available with IMU, ignored" << endl;
+        else
+        {
+            mbFlowTracking = true;
+            node = fSettings["ORBextractor.FlowMinPoints"];
+            if(!node.empty() && node.isInt())
+                mnFlowMinPoints = node.operator int();
+
+            cout << "- Optical Flow: at least " << mnFlowMinPoints << " points" << endl;
+        }
+    }
 
     return true;
 }
@@ -1276,6 +1556,36 @@ void Tracking::SetLocalMapper(LocalMapping *pLocalMapper)
     mpLocalMapper=pLocalMapper; // Localmapping.cc 포인터 클래스 선언
 }
 
+void Tracking::SetThreadPool(ThreadPool *pThreadPool)
+{
+    mpThreadPool = pThreadPool;
+
+    // The left and right extractors of a stereo frame run on the pool, and each of them can also
+    // split its pyramid levels on it
+    if(mpORBextractorLeft)
+        mpORBextractorLeft->SetThreadPool(pThreadPool,mbParallelExtraction);
+    if(mpORBextractorRight)
+        mpORBextractorRight->SetThreadPool(pThreadPool,mbParallelExtraction);
+    if(mpIniORBextractor)
+        mpIniORBextractor->SetThreadPool(pThreadPool,mbParallelExtraction);
+}
+
+void Tracking::SetMetrics(Metrics *pMetrics)
+{
+    mpMetrics = pMetrics;
+}
+
+void Tracking::SetReplayLog(ReplayLog *pReplayLog)
+{
+    mpReplayLog = pReplayLog;
+}
+
+void Tracking::SetThreadScheduling(const ThreadScheduling &sched)
+{
+    mThreadScheduling = sched;
+    mScheduledThread = std::thread::id();
+}
+
 void Tracking::SetLoopClosing(LoopClosing *pLoopClosing)
 {
     mpLoopClosing=pLoopClosing;    // Loopclosing.cc 포인터 클래스 선언
@@ -1286,6 +1596,280 @@ void Tracking::SetViewer(Viewer *pViewer)
     mpViewer=pViewer;   // Viewer.cc 포인터 클래스 선언 
 }
 
+void Tracking::SetMapStreamer(MapStreamer *pMapStreamer)
+{
+    mpMapStreamer=pMapStreamer;   // MapStreamer.cc 포인터 클래스 선언
+}
+
+void Tracking::SetPowerGovernor(PowerGovernor *pGovernor)
+{
+    mpPowerGovernor=pGovernor;
+}
+
+void Tracking::SetTileStreamer(TileStreamer *pTileStreamer)
+{
+    mpTileStreamer=pTileStreamer;   // TileStreamer.cc 포인터 클래스 선언
+}
+
+void Tracking::SetTrajectoryWriter(TrajectoryWriter *pTrajectoryWriter, const int nHistory)
+{
+    mpTrajectoryWriter=pTrajectoryWriter;
+    mnTrajectoryHistory=nHistory;
+}
+
+void Tracking::SetTrajectoryStore(TrajectoryStore *pTrajectoryStore)
+{
+    mpTrajectoryStore=pTrajectoryStore;
+}
+
+void Tracking::PublishCameraPose(const cv::Mat &Tcw)
+{
+    // Without viewer nobody reads the drawers
+    if(mpViewer)
+        mpMapDrawer->SetCurrentCameraPose(Tcw);
+    if(mpMapStreamer)
+        mpMapStreamer->SetCurrentCameraPose(Tcw);
+}
+
+void Tracking::ApplyFeatureBudget()
+{
+    if(!mpFeatureBudget)
+        return;
+
+    //^ 초기화용 extractor(mpIniORBextractor)는 고정된 feature 수를 유지
+    const int nFeatures = mpFeatureBudget->GetFeatures();
+    const int nLevels = mpFeatureBudget->GetLevels();
+    mpORBextractorLeft->SetFeatureBudget(nFeatures,nLevels);
+    if(mpORBextractorRight)
+        mpORBextractorRight->SetFeatureBudget(nFeatures,nLevels);
+}
+
+void Tracking::UpdateFeatureBudget(const double extractMs, const double trackMs)
+{
+    if(!mpFeatureBudget)
+        return;
+
+    // Lost frames count as weak tracking, more features help relocalization
+    mpFeatureBudget->Update(extractMs+trackMs, mState==OK ? mnMatchesInliers : 0);
+}
+
+void Tracking::UpdatePowerGovernor()
+{
+    if(!mpPowerGovernor)
+        return;
+
+    mpPowerGovernor->Update();
+    if(mpMetrics)
+    {
+        mpMetrics->SetGauge(Metrics::FRAME_CPU_TIME, mpPowerGovernor->GetFrameCpuTime());
+        mpMetrics->SetGauge(Metrics::POWER_LEVEL, mpPowerGovernor->GetLevel());
+    }
+}
+
+void Tracking::ApplyFocusMask()
+{
+    if(mfFocusRadius<=0)
+        return;
+
+    //^ 초기화용 extractor(mpIniORBextractor)는 항상 전체 이미지에서 추출
+    unique_lock<mutex> lock(mMutexFocus);
+    mpORBextractorLeft->SetFocusMask(mFocusMaskLeft,FOCUS_CELL_SIZE,mfFocusCoverage);
+    if(mpORBextractorRight)
+        mpORBextractorRight->SetFocusMask(mFocusMaskRight,FOCUS_CELL_SIZE,mfFocusCoverage);
+}
+
+void Tracking::UpdateFocusRegions()
+{
+    if(mfFocusRadius<=0)
+        return;
+
+    cv::Mat maskLeft, maskRight;
+
+    // Only while tracking is solid; after a deferred keyframe the next frame is a full one
+    if(mState==OK && !mVelocity.empty() && !mbFocusFullFrame && mnMatchesInliers>=FOCUS_MIN_INLIERS && !mImGray.empty())
+    {
+        const int nCols = (mImGray.cols+FOCUS_CELL_SIZE-1)/FOCUS_CELL_SIZE;
+        const int nRows = (mImGray.rows+FOCUS_CELL_SIZE-1)/FOCUS_CELL_SIZE;
+        maskLeft = cv::Mat::zeros(nRows,nCols,CV_8U);
+        // The right image of a rectified pair shares the rows, for other rigs it is extracted entirely
+        const bool bRight = mpORBextractorRight && !mpCamera2;
+        if(bRight)
+            maskRight = cv::Mat::zeros(nRows,nCols,CV_8U);
+
+        const cv::Mat Tcw = mVelocity*mCurrentFrame.mTcw;
+        const cv::Mat Rcw = Tcw.rowRange(0,3).colRange(0,3);
+        const cv::Mat tcw = Tcw.rowRange(0,3).col(3);
+        const int r = cvCeil(mfFocusRadius/FOCUS_CELL_SIZE);
+
+        auto mark = [&](cv::Mat &mask, const float u, const float v)
+        {
+            const int cx = cvFloor(u/FOCUS_CELL_SIZE), cy = cvFloor(v/FOCUS_CELL_SIZE);
+            for(int y=max(cy-r,0); y<=min(cy+r,nRows-1); y++)
+            {
+                uchar* pMask = mask.ptr<uchar>(y);
+                for(int x=max(cx-r,0); x<=min(cx+r,nCols-1); x++)
+                    pMask[x] = 1;
+            }
+        };
+
+        auto project = [&](MapPoint* pMP)
+        {
+            if(!pMP || pMP->isBad())
+                return;
+            const cv::Mat x3Dc = Rcw*pMP->GetWorldPos()+tcw;
+            const float z = x3Dc.at<float>(2);
+            if(z<=0)
+                return;
+            const cv::Point2f uv = mpCamera->project(x3Dc);
+            if(uv.x < -mfFocusRadius || uv.y < -mfFocusRadius || uv.x >= mImGray.cols+mfFocusRadius || uv.y >= mImGray.rows+mfFocusRadius)
+                return;
+            mark(maskLeft,uv.x,uv.y);
+            if(bRight)
+                mark(maskRight,uv.x-mbf/z,uv.y);
+        };
+
+        for(int i=0; i<mCurrentFrame.N; i++)
+            project(mCurrentFrame.mvpMapPoints[i]);
+        for(vector<MapPoint*>::iterator vit=mvpLocalMapPoints.begin(), vend=mvpLocalMapPoints.end(); vit!=vend; vit++)
+            project(*vit);
+    }
+    mbFocusFullFrame = false;
+
+    unique_lock<mutex> lock(mMutexFocus);
+    mFocusMaskLeft = maskLeft;
+    mFocusMaskRight = maskRight;
+}
+
+void Tracking::ApplyResolution()
+{
+    if(!mbDualResolution)
+        return;
+
+    //^ 초기화용 extractor(mpIniORBextractor)는 항상 full resolution
+    const int nFirstLevel = mbReducedNext ? 1 : 0;
+    mpORBextractorLeft->SetFirstLevel(nFirstLevel);
+    if(mpORBextractorRight)
+        mpORBextractorRight->SetFirstLevel(nFirstLevel);
+}
+
+void Tracking::UpdateResolution()
+{
+    if(!mbDualResolution)
+        return;
+
+    // Full resolution for a deferred keyframe and while tracking is weak (initialization,
+    // relocalization, few inliers). A frame already extracted for the pipeline is not affected, a
+    // keyframe due on it is deferred again
+    mbReducedNext = mState==OK && mnMatchesInliers>=DUAL_RES_MIN_INLIERS && !mbFullResolutionNext;
+    mbFullResolutionNext = false;
+}
+
+bool Tracking::BuildFlowFrame(const cv::Mat &im, const double &timestamp, const string &filename, Frame &frame, cv::Mat &imGray)
+{
+    // A reset may come between the decision and this frame
+    if(!mbFlowNext || mState!=OK || mVelocity.empty() || mvFlowPyramid.empty())
+        return false;
+
+    std::chrono::steady_clock::time_point time_StartFlow = std::chrono::steady_clock::now();
+
+    imGray = im;
+    if(imGray.channels()==3)
+        cvtColor(imGray,imGray,mbRGB ? cv::COLOR_RGB2GRAY : cv::COLOR_BGR2GRAY);
+    else if(imGray.channels()==4)
+        cvtColor(imGray,imGray,mbRGB ? cv::COLOR_RGBA2GRAY : cv::COLOR_BGRA2GRAY);
+
+    // Map points of the last frame, starting from the displacement of their projection predicted
+    // by the motion model
+    const cv::Mat Tcw = mVelocity*mLastFrame.mTcw;
+    const cv::Mat Rcw = Tcw.rowRange(0,3).colRange(0,3);
+    const cv::Mat tcw = Tcw.rowRange(0,3).col(3);
+
+    vector<int> vIndices;
+    vector<cv::Point2f> vPrev, vNext;
+    vIndices.reserve(mLastFrame.N);
+    vPrev.reserve(mLastFrame.N);
+    vNext.reserve(mLastFrame.N);
+    for(int i=0; i<mLastFrame.N; i++)
+    {
+        MapPoint* pMP = mLastFrame.mvpMapPoints[i];
+        if(!pMP || mLastFrame.mvbOutlier[i] || pMP->isBad())
+            continue;
+
+        const cv::Mat x3Dc = Rcw*pMP->GetWorldPos()+tcw;
+        if(x3Dc.at<float>(2)<=0)
+            continue;
+
+        const cv::Point2f uv = mpCamera->project(x3Dc);
+        vIndices.push_back(i);
+        vPrev.push_back(mLastFrame.mvKeys[i].pt);
+        vNext.push_back(mLastFrame.mvKeys[i].pt + (uv - mLastFrame.mvKeysUn[i].pt));
+    }
+
+    if((int)vIndices.size()<mnFlowMinPoints)
+        return false;
+
+    const cv::Size winSize(FLOW_WIN_SIZE,FLOW_WIN_SIZE);
+    const cv::TermCriteria criteria(cv::TermCriteria::COUNT+cv::TermCriteria::EPS,20,0.03);
+    cv::buildOpticalFlowPyramid(imGray,mvFlowPyramidNext,winSize,FLOW_LEVELS);
+
+    vector<uchar> vStatus, vStatusBack;
+    vector<float> vError;
+    cv::calcOpticalFlowPyrLK(mvFlowPyramid,mvFlowPyramidNext,vPrev,vNext,vStatus,vError,winSize,FLOW_LEVELS,criteria,cv::OPTFLOW_USE_INITIAL_FLOW);
+
+    // Forward-backward check: the point has to flow back to where it was
+    vector<cv::Point2f> vBack = vPrev;
+    cv::calcOpticalFlowPyrLK(mvFlowPyramidNext,mvFlowPyramid,vNext,vBack,vStatusBack,vError,winSize,FLOW_LEVELS,criteria,cv::OPTFLOW_USE_INITIAL_FLOW);
+
+    int nTracked = 0;
+    for(size_t i=0; i<vIndices.size(); i++)
+    {
+        const cv::Point2f &pt = vNext[i];
+        if(!vStatus[i] || !vStatusBack[i] || cv::norm(vBack[i]-vPrev[i])>FLOW_MAX_FB_ERROR)
+            continue;
+        if(pt.x<0 || pt.y<0 || pt.x>=imGray.cols || pt.y>=imGray.rows)
+            continue;
+        vIndices[nTracked] = vIndices[i];
+        vNext[nTracked] = pt;
+        nTracked++;
+    }
+
+    if(nTracked<mnFlowMinPoints)
+    {
+        mvFlowPyramidNext.clear();
+        return false;
+    }
+    vIndices.resize(nTracked);
+    vNext.resize(nTracked);
+
+    frame = Frame(mLastFrame,timestamp,vIndices,vNext);
+    frame.mNameFile = filename;
+
+    std::chrono::steady_clock::time_point time_EndFlow = std::chrono::steady_clock::now();
+    frame.mTimeORB_Ext = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(time_EndFlow - time_StartFlow).count();
+
+    return true;
+}
+
+void Tracking::UpdateFlowState()
+{
+    if(!mbFlowTracking)
+        return;
+
+    // Flow needs a reliable pose and velocity; frames are extracted again after a deferred keyframe
+    // and when the keyframe forced by the frame count is due
+    mbFlowNext = mState==OK && !mbOnlyTracking && !mpCamera2 && !mVelocity.empty() && !mbFlowExtractNext &&
+                 mnMatchesInliers>=mnFlowMinPoints && mCurrentFrame.mnId+1<mnLastKeyFrameId+mMaxFrames;
+    mbFlowExtractNext = false;
+
+    if(!mbFlowNext)
+        mvFlowPyramid.clear();
+    else if(mCurrentFrame.mbFlowTracked)
+        mvFlowPyramid.swap(mvFlowPyramidNext);
+    else
+        cv::buildOpticalFlowPyramid(mImGray,mvFlowPyramid,cv::Size(FLOW_WIN_SIZE,FLOW_WIN_SIZE),FLOW_LEVELS);
+    mvFlowPyramidNext.clear();
+}
+
 void Tracking::SetStepByStep(bool bSet)
 {
     bStepByStep = bSet;   // bool 타입 변수 선언
@@ -1296,133 +1880,323 @@ void Tracking::SetStepByStep(bool bSet)
 cv::Mat Tracking::GrabImageStereo(const cv::Mat &imRectLeft, const cv::Mat &imRectRight, const double &timestamp, string filename) 
 //imRectleft 왼쪽 이미지, imrectright 오른쪽 이미지, timestamp, filename 선언 --> stereo image data를 불러옴
 {
-    mImGray = imRectLeft;   //left image를 가져옵니다. 
+    Frame frame;
+    cv::Mat imGray;
+    // Flow frames track the rectified left image
+    cv::Mat imFlow = imRectLeft;
+    if(mpStereoRectifier && mbFlowNext)
+        mpStereoRectifier->Rectify(0,imRectLeft,mbRGB,imFlow);
+    if(!BuildFlowFrame(imFlow,timestamp,filename,frame,imGray))
+        PreprocessStereo(imRectLeft,imRectRight,timestamp,filename,frame,imGray);
+
+    return TrackPreprocessed(frame,imGray,imRectRight);
+}
+
+void Tracking::PreprocessStereo(const cv::Mat &imRectLeft, const cv::Mat &imRectRight, const double &timestamp, string filename, Frame &frame, cv::Mat &imGray)
+{
+    imGray = imRectLeft;   //left image를 가져옵니다. 
     cv::Mat imGrayRight = imRectRight; //right image를 가져옵니다. 
-    mImRight = imRectRight; //right image를 가져옵니다. 
 
-    if(mImGray.channels()==3) //image가 channel이 3개면, 즉 color image data면 실행됩니다. 
+    // Before the row sources, which the extractors refuse at reduced resolution
+    ApplyResolution();
+
+    // Built-in rectification: the extractors read the rectified gray rows of the input images while
+    // building their first pyramid level (whole rectified images only if they cannot)
+    bool bRectifiedInExtractor = false;
+    if(mpStereoRectifier)
+    {
+        if(mpORBextractorLeft->SetImageRowSource(mpStereoRectifier->Source(0,imRectLeft,mbRGB)) &&
+           mpORBextractorRight->SetImageRowSource(mpStereoRectifier->Source(1,imRectRight,mbRGB)))
+        {
+            bRectifiedInExtractor = true;
+        }
+        else
+        {
+            mpORBextractorLeft->SetImageRowSource(static_cast<PyramidRowSource*>(NULL));
+            mpStereoRectifier->Rectify(0,imRectLeft,mbRGB,imGray);
+            mpStereoRectifier->Rectify(1,imRectRight,mbRGB,imGrayRight);
+        }
+    }
+    else if(imGray.channels()==3) //image가 channel이 3개면, 즉 color image data면 실행됩니다. 
     {
         if(mbRGB) //rgb 데이터라면 
         {
-            cvtColor(mImGray,mImGray,cv::COLOR_RGB2GRAY);   //image를 gray scale로 변환합니다. 
+            cvtColor(imGray,imGray,cv::COLOR_RGB2GRAY);   //image를 gray scale로 변환합니다. 
             cvtColor(imGrayRight,imGrayRight,cv::COLOR_RGB2GRAY); //마찬가지로 gray scale로 변환합니다. 
         }
         else //rgb가 아닌 bgr일때
         {
-            cvtColor(mImGray,mImGray,cv::COLOR_BGR2GRAY); //image를 gray scale로 변환합니다. 
+            cvtColor(imGray,imGray,cv::COLOR_BGR2GRAY); //image를 gray scale로 변환합니다. 
             cvtColor(imGrayRight,imGrayRight,cv::COLOR_BGR2GRAY); //image를 gray scale로 변환합니다. 
         }
     }
-    else if(mImGray.channels()==4)  //image가 rgba일때 --> alpha값이 추가된 데이터 --> 각 픽셀의 투명도를 뜻함. 딱히...
+    else if(imGray.channels()==4)  //image가 rgba일때 --> alpha값이 추가된 데이터 --> 각 픽셀의 투명도를 뜻함. 딱히...
     {
         if(mbRGB)
         {
-            cvtColor(mImGray,mImGray,cv::COLOR_RGBA2GRAY); //마찬가지로 모두 gray scale로 변환
+            cvtColor(imGray,imGray,cv::COLOR_RGBA2GRAY); //마찬가지로 모두 gray scale로 변환
             cvtColor(imGrayRight,imGrayRight,cv::COLOR_RGBA2GRAY);
         }
         else
         {
-            cvtColor(mImGray,mImGray,cv::COLOR_BGRA2GRAY);
+            cvtColor(imGray,imGray,cv::COLOR_BGRA2GRAY);
             cvtColor(imGrayRight,imGrayRight,cv::COLOR_BGRA2GRAY);
         }
     }
 
+    ApplyFeatureBudget();
+    ApplyFocusMask();
+    BeginRigExtraction();
+
     if (mSensor == System::STEREO && !mpCamera2) //stereo이고 fisheye가 아닐때를 의미합니다. 
-        mCurrentFrame = Frame(mImGray,imGrayRight,timestamp,mpORBextractorLeft,mpORBextractorRight,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth,mpCamera);
+        frame = Frame(imGray,imGrayRight,timestamp,mpORBextractorLeft,mpORBextractorRight,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth,mpCamera,mpContext);
     else if(mSensor == System::STEREO && mpCamera2) //stereo이고 fisheye일때를 의미합니다. --> 차이점은 mpCamera2가 들어갑니다. 즉 lapping 포인트를 고려하느냐 안하느냐의 차이점입니다. 
-        mCurrentFrame = Frame(mImGray,imGrayRight,timestamp,mpORBextractorLeft,mpORBextractorRight,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth,mpCamera,mpCamera2,mTlr);
+        frame = Frame(imGray,imGrayRight,timestamp,mpORBextractorLeft,mpORBextractorRight,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth,mpCamera,mpCamera2,mTlr,mpContext);
     else if(mSensor == System::IMU_STEREO && !mpCamera2) //imu stereo이고 pinhole 일때를 의미합니다. 
-        mCurrentFrame = Frame(mImGray,imGrayRight,timestamp,mpORBextractorLeft,mpORBextractorRight,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth,mpCamera,&mLastFrame,*mpImuCalib); //추가적인 parameter는 lastframe과 imuclib가 있습니다. 해당기능은 위에서 설명했습니다. 
+        frame = Frame(imGray,imGrayRight,timestamp,mpORBextractorLeft,mpORBextractorRight,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth,mpCamera,mpContext,static_cast<Frame*>(NULL),*mpImuCalib); //추가적인 parameter는 lastframe과 imuclib가 있습니다. lastframe은 TrackPreprocessed에서 연결합니다. 
     else if(mSensor == System::IMU_STEREO && mpCamera2) //imu stereo이고 fisheye일때를 의미합니다. 
-        mCurrentFrame = Frame(mImGray,imGrayRight,timestamp,mpORBextractorLeft,mpORBextractorRight,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth,mpCamera,mpCamera2,mTlr,&mLastFrame,*mpImuCalib);
+        frame = Frame(imGray,imGrayRight,timestamp,mpORBextractorLeft,mpORBextractorRight,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth,mpCamera,mpCamera2,mTlr,mpContext,static_cast<Frame*>(NULL),*mpImuCalib);
 
-    mCurrentFrame.mNameFile = filename;
-    mCurrentFrame.mnDataset = mnNumDataset;
+    EndRigExtraction(frame);
+
+    // The rectified left image is the first pyramid level of the extractor, copied as the
+    // extractor overwrites it with the next image
+    if(bRectifiedInExtractor)
+        imGray = mpORBextractorLeft->mvImagePyramid[0].clone();
+
+    frame.mNameFile = filename;
 
 #ifdef REGISTER_TIMES
-    vdORBExtract_ms.push_back(mCurrentFrame.mTimeORB_Ext);
-    vdStereoMatch_ms.push_back(mCurrentFrame.mTimeStereoMatch);
+    vdORBExtract_ms.push_back(frame.mTimeORB_Ext);
+    vdStereoMatch_ms.push_back(frame.mTimeStereoMatch);
 #endif
+    if(mpMetrics)
+    {
+        mpMetrics->Record(Metrics::ORB_EXTRACTION, frame.mTimeORB_Ext);
+        mpMetrics->Record(Metrics::STEREO_MATCH, frame.mTimeStereoMatch);
+    }
+    frame.mTimeExtracted = Metrics::Clock::now();
+}
+
+cv::Mat Tracking::TrackPreprocessed(const Frame &frame, const cv::Mat &imGray, const cv::Mat &imRight)
+{
+    mImGray = imGray;
+    mImRight = imRight;
+
+    mCurrentFrame = frame;
+    if(mSensor==System::IMU_STEREO || mSensor==System::IMU_MONOCULAR)
+        mCurrentFrame.SetPrevFrame(&mLastFrame);
+    mCurrentFrame.mnDataset = mnNumDataset;
 
+    const Metrics::Clock::time_point time_StartTrack = Metrics::Clock::now();
+    // Flow frames are built right before their tracking
+    if(mCurrentFrame.mTimeExtracted == Metrics::Clock::time_point())
+        mCurrentFrame.mTimeExtracted = time_StartTrack;
+    if(mpDeadline)
+        mpDeadline->BeginFrame(mCurrentFrame.mTimeORB_Ext+mCurrentFrame.mTimeStereoMatch);
     Track();
+    ReportDegradations();
+    const double trackMs = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(Metrics::Clock::now() - time_StartTrack).count();
+    if(mpMetrics)
+        mpMetrics->Record(Metrics::TRACK_TOTAL, trackMs);
+    RecordFrameTelemetry();
+    UpdateFeatureBudget(mCurrentFrame.mTimeORB_Ext+mCurrentFrame.mTimeStereoMatch, trackMs);
+    UpdatePowerGovernor();
+    UpdateFocusRegions();
+    UpdateResolution();
+    UpdateFlowState();
 
     return mCurrentFrame.mTcw.clone();
 }
 
 
-cv::Mat Tracking::GrabImageRGBD(const cv::Mat &imRGB,const cv::Mat &imD, const double &timestamp, string filename) //해당 study에서는 stereo만 진행하고 있으므로 이외의 type은 제외합니다. 
+cv::Mat Tracking::GrabImageStereoDepth(const cv::Mat &imRectLeft, const cv::Mat &imDepth, const bool bDisparity, const double &timestamp, string filename)
 {
-    
-    mImGray = imRGB;
-    cv::Mat imDepth = imD;
+    if(mpCamera2)
+    {
+        cerr << "ERROR: the disparity or depth of the camera needs a rectified (pinhole) stereo camera" << endl;
+        exit(-1);
+    }
 
-    if(mImGray.channels()==3)
+    Frame frame;
+    cv::Mat imGray;
+    cv::Mat imFlow = imRectLeft;
+    if(mpStereoRectifier && mbFlowNext)
+        mpStereoRectifier->Rectify(0,imRectLeft,mbRGB,imFlow);
+    if(!BuildFlowFrame(imFlow,timestamp,filename,frame,imGray))
+        PreprocessStereoDepth(imRectLeft,imDepth,bDisparity,timestamp,filename,frame,imGray);
+
+    return TrackPreprocessed(frame,imGray);
+}
+
+void Tracking::PreprocessStereoDepth(const cv::Mat &imRectLeft, const cv::Mat &imDepth, const bool bDisparity, const double &timestamp, string filename, Frame &frame, cv::Mat &imGray)
+{
+    imGray = imRectLeft;
+    cv::Mat imD = imDepth;
+
+    // The map of the device is registered to the rectified left image, only that image is rectified
+    if(mpStereoRectifier)
+        mpStereoRectifier->Rectify(0,imRectLeft,mbRGB,imGray);
+    else if(imGray.channels()==3)
     {
         if(mbRGB)
-            cvtColor(mImGray,mImGray,cv::COLOR_RGB2GRAY);
+            cvtColor(imGray,imGray,cv::COLOR_RGB2GRAY);
         else
-            cvtColor(mImGray,mImGray,cv::COLOR_BGR2GRAY);
+            cvtColor(imGray,imGray,cv::COLOR_BGR2GRAY);
     }
-    else if(mImGray.channels()==4)
+    else if(imGray.channels()==4)
     {
         if(mbRGB)
-            cvtColor(mImGray,mImGray,cv::COLOR_RGBA2GRAY);
+            cvtColor(imGray,imGray,cv::COLOR_RGBA2GRAY);
         else
-            cvtColor(mImGray,mImGray,cv::COLOR_BGRA2GRAY);
+            cvtColor(imGray,imGray,cv::COLOR_BGRA2GRAY);
     }
 
-    if((fabs(mDepthMapFactor-1.0f)>1e-5) || imDepth.type()!=CV_32F)
-        imDepth.convertTo(imDepth,CV_32F,mDepthMapFactor);
+    // As in PreprocessRGBD, only 8-bit maps are converted whole
+    float depthFactor = mDepthMapFactor;
+    if(imD.type()!=CV_16U && imD.type()!=CV_32F)
+    {
+        cv::Mat imDepthScaled;
+        imDepth.convertTo(imDepthScaled,CV_32F,mDepthMapFactor);
+        imD = imDepthScaled;
+        depthFactor = 1.0f;
+    }
 
-    mCurrentFrame = Frame(mImGray,imDepth,timestamp,mpORBextractorLeft,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth,mpCamera);
+    ApplyResolution();
+    ApplyFeatureBudget();
+    ApplyFocusMask();
+    BeginRigExtraction();
 
-    mCurrentFrame.mNameFile = filename;
-    mCurrentFrame.mnDataset = mnNumDataset;
+    //^ right image의 ORB extraction과 stereo matching 없이 device의 disparity/depth로 mvuRight, mvDepth를 구합니다.
+    if(mSensor == System::IMU_STEREO)
+        frame = Frame(imGray,imD,depthFactor,bDisparity,timestamp,mpORBextractorLeft,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth,mpCamera,mpContext,static_cast<Frame*>(NULL),*mpImuCalib);
+    else
+        frame = Frame(imGray,imD,depthFactor,bDisparity,timestamp,mpORBextractorLeft,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth,mpCamera,mpContext);
+
+    EndRigExtraction(frame);
+
+    frame.mNameFile = filename;
 
 #ifdef REGISTER_TIMES
-    vdORBExtract_ms.push_back(mCurrentFrame.mTimeORB_Ext);
+    vdORBExtract_ms.push_back(frame.mTimeORB_Ext);
+    vdStereoMatch_ms.push_back(frame.mTimeStereoMatch);
 #endif
+    if(mpMetrics)
+    {
+        mpMetrics->Record(Metrics::ORB_EXTRACTION, frame.mTimeORB_Ext);
+        mpMetrics->Record(Metrics::STEREO_MATCH, frame.mTimeStereoMatch);
+    }
+    frame.mTimeExtracted = Metrics::Clock::now();
+}
 
-    Track();
 
-    return mCurrentFrame.mTcw.clone();
-}
+cv::Mat Tracking::GrabImageRGBD(const cv::Mat &imRGB,const cv::Mat &imD, const double &timestamp, string filename) //해당 study에서는 stereo만 진행하고 있으므로 이외의 type은 제외합니다. 
+{
+    Frame frame;
+    cv::Mat imGray;
+    if(!BuildFlowFrame(imRGB,timestamp,filename,frame,imGray))
+        PreprocessRGBD(imRGB,imD,timestamp,filename,frame,imGray);
 
+    return TrackPreprocessed(frame,imGray);
+}
 
-cv::Mat Tracking::GrabImageMonocular(const cv::Mat &im, const double &timestamp, string filename)//해당 study에서는 stereo만 진행하고 있으므로 이외의 type은 제외합니다. 
+void Tracking::PreprocessRGBD(const cv::Mat &imRGB, const cv::Mat &imD, const double &timestamp, string filename, Frame &frame, cv::Mat &imGray)
 {
-    mImGray = im;
+    imGray = imRGB;
+    cv::Mat imDepth = imD;
 
-    if(mImGray.channels()==3)
+    if(imGray.channels()==3)
     {
         if(mbRGB)
-            cvtColor(mImGray,mImGray,cv::COLOR_RGB2GRAY);
+            cvtColor(imGray,imGray,cv::COLOR_RGB2GRAY);
         else
-            cvtColor(mImGray,mImGray,cv::COLOR_BGR2GRAY);
+            cvtColor(imGray,imGray,cv::COLOR_BGR2GRAY);
     }
-    else if(mImGray.channels()==4)
+    else if(imGray.channels()==4)
     {
         if(mbRGB)
-            cvtColor(mImGray,mImGray,cv::COLOR_RGBA2GRAY);
+            cvtColor(imGray,imGray,cv::COLOR_RGBA2GRAY);
         else
-            cvtColor(mImGray,mImGray,cv::COLOR_BGRA2GRAY);
+            cvtColor(imGray,imGray,cv::COLOR_BGRA2GRAY);
     }
 
-    if (mSensor == System::MONOCULAR)
+    // 16-bit and float depth maps are read as they are at the keypoints, scaled by the frame.
+    // Other types are converted whole (into a new matrix, not to overwrite the caller's depth map)
+    float depthFactor = mDepthMapFactor;
+    if(imDepth.type()!=CV_16U && imDepth.type()!=CV_32F)
     {
-        if(mState==NOT_INITIALIZED || mState==NO_IMAGES_YET ||(lastID - initID) < mMaxFrames)
-            mCurrentFrame = Frame(mImGray,timestamp,mpIniORBextractor,mpORBVocabulary,mpCamera,mDistCoef,mbf,mThDepth);
-        else
-            mCurrentFrame = Frame(mImGray,timestamp,mpORBextractorLeft,mpORBVocabulary,mpCamera,mDistCoef,mbf,mThDepth);
+        cv::Mat imDepthScaled;
+        imD.convertTo(imDepthScaled,CV_32F,mDepthMapFactor);
+        imDepth = imDepthScaled;
+        depthFactor = 1.0f;
     }
-    else if(mSensor == System::IMU_MONOCULAR)
-    {
+
+    ApplyResolution();
+    ApplyFeatureBudget();
+    ApplyFocusMask();
+    frame = Frame(imGray,imDepth,depthFactor,timestamp,mpORBextractorLeft,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth,mpCamera,mpContext);
+
+    frame.mNameFile = filename;
+
+#ifdef REGISTER_TIMES
+    vdORBExtract_ms.push_back(frame.mTimeORB_Ext);
+#endif
+    if(mpMetrics)
+        mpMetrics->Record(Metrics::ORB_EXTRACTION, frame.mTimeORB_Ext);
+    frame.mTimeExtracted = Metrics::Clock::now();
+}
+
+
+cv::Mat Tracking::GrabImageMonocular(const cv::Mat &im, const double &timestamp, string filename)//해당 study에서는 stereo만 진행하고 있으므로 이외의 type은 제외합니다. 
+{
+    mImGray = im;
+
+    if(mImGray.channels()==3)
+    {
+        if(mbRGB)
+            cvtColor(mImGray,mImGray,cv::COLOR_RGB2GRAY);
+        else
+            cvtColor(mImGray,mImGray,cv::COLOR_BGR2GRAY);
+    }
+    else if(mImGray.channels()==4)
+    {
+        if(mbRGB)
+            cvtColor(mImGray,mImGray,cv::COLOR_RGBA2GRAY);
+        else
+            cvtColor(mImGray,mImGray,cv::COLOR_BGRA2GRAY);
+    }
+
+    Frame flowFrame;
+    cv::Mat imFlow;
+    if(BuildFlowFrame(mImGray,timestamp,filename,flowFrame,imFlow))
+        mCurrentFrame = flowFrame;
+    else if (mSensor == System::MONOCULAR)
+    {
+        ApplyResolution();
+    ApplyFeatureBudget();
+        ApplyFocusMask();
+        BeginRigExtraction();
+
+        if(mState==NOT_INITIALIZED || mState==NO_IMAGES_YET ||(lastID - initID) < mMaxFrames)
+            mCurrentFrame = Frame(mImGray,timestamp,mpIniORBextractor,mpORBVocabulary,mpCamera,mDistCoef,mbf,mThDepth,mpContext);
+        else
+            mCurrentFrame = Frame(mImGray,timestamp,mpORBextractorLeft,mpORBVocabulary,mpCamera,mDistCoef,mbf,mThDepth,mpContext);
+        EndRigExtraction(mCurrentFrame);
+    }
+    else if(mSensor == System::IMU_MONOCULAR)
+    {
+        ApplyResolution();
+    ApplyFeatureBudget();
+        ApplyFocusMask();
+        BeginRigExtraction();
+
         if(mState==NOT_INITIALIZED || mState==NO_IMAGES_YET)
         {
-            mCurrentFrame = Frame(mImGray,timestamp,mpIniORBextractor,mpORBVocabulary,mpCamera,mDistCoef,mbf,mThDepth,&mLastFrame,*mpImuCalib);
+            mCurrentFrame = Frame(mImGray,timestamp,mpIniORBextractor,mpORBVocabulary,mpCamera,mDistCoef,mbf,mThDepth,mpContext,&mLastFrame,*mpImuCalib);
         }
         else
-            mCurrentFrame = Frame(mImGray,timestamp,mpORBextractorLeft,mpORBVocabulary,mpCamera,mDistCoef,mbf,mThDepth,&mLastFrame,*mpImuCalib);
+            mCurrentFrame = Frame(mImGray,timestamp,mpORBextractorLeft,mpORBVocabulary,mpCamera,mDistCoef,mbf,mThDepth,mpContext,&mLastFrame,*mpImuCalib);
+        EndRigExtraction(mCurrentFrame);
     }
 
     if (mState==NO_IMAGES_YET)
@@ -1431,21 +2205,72 @@ cv::Mat Tracking::GrabImageMonocular(const cv::Mat &im, const double &timestamp,
     mCurrentFrame.mNameFile = filename;
     mCurrentFrame.mnDataset = mnNumDataset;
 
+    if(!mCurrentFrame.mbFlowTracked)
+    {
 #ifdef REGISTER_TIMES
-    vdORBExtract_ms.push_back(mCurrentFrame.mTimeORB_Ext);
+        vdORBExtract_ms.push_back(mCurrentFrame.mTimeORB_Ext);
 #endif
+        if(mpMetrics)
+            mpMetrics->Record(Metrics::ORB_EXTRACTION, mCurrentFrame.mTimeORB_Ext);
+    }
 
     lastID = mCurrentFrame.mnId;
+    const Metrics::Clock::time_point time_StartTrack = Metrics::Clock::now();
+    // Flow frames are built right before their tracking
+    if(mCurrentFrame.mTimeExtracted == Metrics::Clock::time_point())
+        mCurrentFrame.mTimeExtracted = time_StartTrack;
+    if(mpDeadline)
+        mpDeadline->BeginFrame(mCurrentFrame.mTimeORB_Ext+mCurrentFrame.mTimeStereoMatch);
     Track();
+    ReportDegradations();
+    const double trackMs = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(Metrics::Clock::now() - time_StartTrack).count();
+    if(mpMetrics)
+        mpMetrics->Record(Metrics::TRACK_TOTAL, trackMs);
+    RecordFrameTelemetry();
+    UpdateFeatureBudget(mCurrentFrame.mTimeORB_Ext+mCurrentFrame.mTimeStereoMatch, trackMs);
+    UpdatePowerGovernor();
+    UpdateFocusRegions();
+    UpdateResolution();
+    UpdateFlowState();
 
     return mCurrentFrame.mTcw.clone();
 }
 
+void Tracking::RecordFrameTelemetry()
+{
+    if(mpMetrics)
+    {
+        const bool bKeyFrame = mpLastKeyFrame && mpLastKeyFrame->mnFrameId==mCurrentFrame.mnId;
+        mpMetrics->RecordFrameTracked(mCurrentFrame.mnId,mCurrentFrame.mTimeStamp,mTimeInput,mCurrentFrame.mTimeExtracted,bKeyFrame);
+    }
+    mTimeInput = Metrics::Clock::time_point();
+}
+
+void Tracking::ReleaseInputImages()
+{
+    mImGray.release();
+    mImRight.release();
+}
+
 
 void Tracking::GrabImuData(const IMU::Point &imuMeasurement)
 {
-    unique_lock<mutex> lock(mMutexImuQueue); //mutex로 선언된 mMutexImuQueue를 lock하고
-    mlQueueImuData.push_back(imuMeasurement); //mlQueueImuData에 새로운 imuMeasurement를 입력합니다. 
+    //^ lock-free queue에 새로운 imuMeasurement를 입력합니다. tracking thread를 기다리지 않습니다.
+    if(!mImuQueue.Push(imuMeasurement))
+        Verbose::PrintMess("IMU queue full, measurement dropped", Verbose::VERBOSITY_NORMAL);
+}
+
+bool Tracking::WaitForImu(const double &timestamp, const double &timeout)
+{
+    //^ preintegration은 frame 이후의 첫 imu data까지 사용하므로, 그 data가 들어올 때까지 기다립니다.
+    std::chrono::steady_clock::time_point tStart = std::chrono::steady_clock::now();
+    while(mImuQueue.LastTimestamp() < timestamp)
+    {
+        if(std::chrono::duration_cast<std::chrono::duration<double> >(std::chrono::steady_clock::now()-tStart).count() > timeout)
+            return false;
+        usleep(200);
+    }
+    return true;
 }
 
 void Tracking::PreintegrateIMU()
@@ -1460,94 +2285,20 @@ void Tracking::PreintegrateIMU()
     }
 
     mvImuFromLastFrame.clear(); //preframe이 존재하고 lastframe에 있던 imu data를 clear합니다. 
-    mvImuFromLastFrame.reserve(mlQueueImuData.size()); //memory size를 기존 queue size만큼 늘려줍니다. 
-    if(mlQueueImuData.size() == 0) //만약 queue size가 0일때 실행합니다. 
+
+    //^ prev frame부터 current frame까지의 imu데이터를 preintegration 합니다. worker thread가 미리 적분한 부분은 다시 하지 않고,
+    //^ 마지막 구간만 적분합니다. mpImuPreintegratedFromLastKF에도 같은 구간이 적분됩니다.
+    //^ 마지막 imu데이터는 다음 frame 구간을 위해 남습니다.
+    IMU::Preintegrated* pImuPreintegratedFromLastFrame = mImuPreintegrator.FinishInterval(mCurrentFrame.mpPrevFrame->mTimeStamp, mCurrentFrame.mTimeStamp,
+                                                                                          mLastFrame.mImuBias, mCurrentFrame.mImuCalib,
+                                                                                          mpImuPreintegratedFromLastKF, mvImuFromLastFrame);
+    if(!pImuPreintegratedFromLastFrame) //imu 데이터가 존재하지 않는 경우
     {
-        Verbose::PrintMess("Not IMU data in mlQueueImuData!!", Verbose::VERBOSITY_NORMAL); //queue size가 0이라는 의미는 imu데이터가 존재하지 않는다는 의미입니다. 
+        Verbose::PrintMess("Not IMU data in mImuQueue!!", Verbose::VERBOSITY_NORMAL); //queue size가 0이라는 의미는 imu데이터가 존재하지 않는다는 의미입니다. 
         mCurrentFrame.setIntegrated(); //imu pre integrated 값을 true로 반환하게 됩니다. 즉 setIntegrated 함수가 실행되면 imu값을 받지 않게됩니다. 
         return;
     }
 
-    while(true) //while문 start
-    {
-        bool bSleep = false; //초기값 선언
-        {
-            unique_lock<mutex> lock(mMutexImuQueue); //imu queue를 생성합니다.
-            if(!mlQueueImuData.empty()) //imu 데이터가 존재하는 경우
-            {
-                IMU::Point* m = &mlQueueImuData.front(); //queue의 가장 오래된 imu데이터 주소값을 가져옵니다. 
-                cout.precision(17); //소수점자리수를 17개로 설정
-                if(m->t < mCurrentFrame.mpPrevFrame->mTimeStamp-0.001l) // 가장 오래된 imu데이터에서 t값(time_stamp)을 가져온뒤 바로 이전 frame의 time stamp -0.001과 비교합니다. 만약 더 크다면 prev frame보다 최신의 imu 데이터라고 볼수 있습니다. 
-                {
-                    mlQueueImuData.pop_front(); //front의 imu를 삭제합니다. 
-                }
-                else if(m->t < mCurrentFrame.mTimeStamp-0.001l)  //prev frame보다는 최신데이터이게되면 current frame과 비교합니다. imu데이터들을 저장한뒤 버리고를 반복합니다. 
-                {
-                    mvImuFromLastFrame.push_back(*m); 
-                    mlQueueImuData.pop_front();
-                }
-                else
-                {
-                    mvImuFromLastFrame.push_back(*m); //가장 최신의 imu들은 저장합니다. 
-                    break;
-                }
-            }
-            else //imu데이터가 존재하지 않는다면 
-            {
-                break;
-                bSleep = true;
-            }
-        }
-        if(bSleep)
-            usleep(500); //500milli sec
-    }
-
-
-        const int n = mvImuFromLastFrame.size()-1; //n을 from last frame size의 -1로 선언합니다. 이유는 vector로 선언했기때문입니다. 
-    IMU::Preintegrated* pImuPreintegratedFromLastFrame = new IMU::Preintegrated(mLastFrame.mImuBias,mCurrentFrame.mImuCalib); //Preintegration of Imu Measurements 선언
-
-    for(int i=0; i<n; i++) //lastframe에 있는 imu 데이터를 모두 수행합니다. 
-    {
-        float tstep; //tstep float형태로 선언합니다.
-        cv::Point3f acc, angVel;  //point 형태로 acc, angVel 선언합니다. 
-        if((i==0) && (i<(n-1)))  //i가 0이고 n-1보다 작을때, 즉 lastframe에 포함된 imu가 갯수가 1이상일때의 초기값을 의미합니다. 
-        {
-            float tab = mvImuFromLastFrame[i+1].t - mvImuFromLastFrame[i].t; // 각각 i번째 imu 데이터의 timestamp값을 빼줍니다. 즉 imu 데이터의 시간 간격을 tab에 저장합니다. 
-            float tini = mvImuFromLastFrame[i].t - mCurrentFrame.mpPrevFrame->mTimeStamp; //바로 직전 imu데이터의 stamp와 lastframe의 i번째 imu데이터와 시간 간격을 tini에 저장합니다. 
-            acc = (mvImuFromLastFrame[i].a + mvImuFromLastFrame[i+1].a -  (mvImuFromLastFrame[i+1].a - mvImuFromLastFrame[i].a)*(tini/tab))*0.5f; //이부분 같은 경우는 맨 처음부분인데 해당부분은 frame과 정확한 매칭이 어려워서 
-            angVel = (mvImuFromLastFrame[i].w + mvImuFromLastFrame[i+1].w - (mvImuFromLastFrame[i+1].w - mvImuFromLastFrame[i].w)*(tini/tab))*0.5f; //medium 적분에 보정값을 넣어줍니다. --> (mvImuFromLastFrame[i+1].w - mvImuFromLastFrame[i].w)*(tini/tab)
-            tstep = mvImuFromLastFrame[i+1].t - mCurrentFrame.mpPrevFrame -> mTimeStamp; //tstep은 tini 다음 step을 의미합니다. --> 음수값일텐데....?
-        }    
-        else if(i<(n-1))
-        {
-            acc = (mvImuFromLastFrame[i].a+mvImuFromLastFrame[i+1].a)*0.5f; //일반 medium 적분입니다. 
-            angVel = (mvImuFromLastFrame[i].w+mvImuFromLastFrame[i+1].w)*0.5f; //동일합니다. 
-            tstep = mvImuFromLastFrame[i+1].t-mvImuFromLastFrame[i].t; //다음 step의 time을 의미합니다. 
-        }
-        else if((i>0) && (i==(n-1)))
-        {
-            float tab = mvImuFromLastFrame[i+1].t-mvImuFromLastFrame[i].t; //time offset 값입니다. 
-            float tend = mvImuFromLastFrame[i+1].t-mCurrentFrame.mTimeStamp; // 마지막의 imu데이터와 가장 최신의 frame의 시간을 뺀 값입니다. 
-            acc = (mvImuFromLastFrame[i].a+mvImuFromLastFrame[i+1].a-
-                    (mvImuFromLastFrame[i+1].a-mvImuFromLastFrame[i].a)*(tend/tab))*0.5f; // 맨 처음부분과 동일하게 마지막부분도 frame과의 timestamp가 동일하게 맞기 힘듭니다. 따라서 
-            angVel = (mvImuFromLastFrame[i].w+mvImuFromLastFrame[i+1].w- // 보정값을 넣어줍니다. 
-                    (mvImuFromLastFrame[i+1].w-mvImuFromLastFrame[i].w)*(tend/tab))*0.5f;
-            tstep = mCurrentFrame.mTimeStamp-mvImuFromLastFrame[i].t; 
-        }
-        else if((i==0) && (i==(n-1)))
-        {
-            acc = mvImuFromLastFrame[i].a;
-            angVel = mvImuFromLastFrame[i].w;
-            tstep = mCurrentFrame.mTimeStamp-mCurrentFrame.mpPrevFrame->mTimeStamp;
-        }
-
-        if (!mpImuPreintegratedFromLastKF)
-            cout << "mpImuPreintegratedFromLastKF does not exist" << endl;
-        mpImuPreintegratedFromLastKF-> (acc,angVel,tstep); //해당 acc, angVel, tstep을 mpImuPreintegratedFromLastKF에 저장합니다. 
-        pImuPreintegratedFromLastFrame->IntegrateNewMeasurement(acc,angVel,tstep); //직전의 position을 저장한 뒤, Update delta rotation,
-        //Compute rotation parts of matrices A and B, Update rotation jacobian wrt bias correction, Total integrated time 작업을 합니다. 
-    }
-
     mCurrentFrame.mpImuPreintegratedFrame = pImuPreintegratedFromLastFrame; // CurrentFrame class의 imupreintegratedFrame pointer에다가 pImuPreintegratedFromLastFrame을 저장합니다.
     mCurrentFrame.mpImuPreintegrated = mpImuPreintegratedFromLastKF; // CurrentFrame class의 mpImuPreintegrated pointer에다가 mpImuPreintegratedFromLastKF을 저장합니다.
     mCurrentFrame.mpLastKeyFrame = mpLastKeyFrame; //마찬가지입니다!
@@ -1558,6 +2309,31 @@ void Tracking::PreintegrateIMU()
 }
 
 
+void Tracking::StartImuPreintegration()
+{
+    //^ bias와 mpImuPreintegratedFromLastKF가 이 frame에서 확정된 뒤에 시작합니다. 이후에 바뀌면 다음 frame에서 처음부터 적분합니다.
+    Map* pCurrentMap = mpAtlas->GetCurrentMap();
+    if(pCurrentMap->isImuInitialized() && !mLastFrame.mTcw.empty() && !mLastFrame.mVw.empty())
+        mImuPreintegrator.StartInterval(mLastFrame.mTimeStamp, mLastFrame.mImuBias, mLastFrame.mImuCalib, mpImuPreintegratedFromLastKF,
+                                        mLastFrame.GetImuRotation(), mLastFrame.GetImuPosition(), mLastFrame.mVw);
+    else
+        mImuPreintegrator.StartInterval(mLastFrame.mTimeStamp, mLastFrame.mImuBias, mLastFrame.mImuCalib, mpImuPreintegratedFromLastKF);
+}
+
+bool Tracking::GetImuPrediction(double &timestamp, cv::Mat &Twb, cv::Mat &Vwb)
+{
+    cv::Matx33f Rwb;
+    cv::Matx31f twb, vwb;
+    if(!mImuPreintegrator.GetPrediction(timestamp, Rwb, twb, vwb))
+        return false;
+
+    Twb = cv::Mat::eye(4,4,CV_32F);
+    cv::Mat(Rwb).copyTo(Twb.rowRange(0,3).colRange(0,3));
+    cv::Mat(twb).copyTo(Twb.rowRange(0,3).col(3));
+    Vwb = cv::Mat(vwb);
+    return true;
+}
+
 bool Tracking::PredictStateIMU()
 {
     if(!mCurrentFrame.mpPrevFrame)  //CurrentFrame에서 previous Frame이 존재하지 않을때입니다. 
@@ -1632,7 +2408,7 @@ void Tracking::ComputeGyroBias(const vector<Frame*> &vpFs, float &bwx,  float &b
         Frame* pF2 = vpFs[i]; //대상하는 bias의 앞 bias입니다.
         Frame* pF1 = vpFs[i-1]; //현재 대상이 되는 bias값입니다. 
         cv::Mat VisionR = pF1->GetImuRotation().t() * pF2->GetImuRotation(); //각 두개의 frame의 imu값을 곱합니다. (최종 rotation값, GT값으로 볼수있습니다.)
-        cv::Mat JRg = pF2->mpImuPreintegratedFrame->JRg; //bias compute되기 전 original bias값입니다. 
+        cv::Mat JRg = cv::Mat(pF2->mpImuPreintegratedFrame->JRg); //bias compute되기 전 original bias값입니다. 
         cv::Mat E = pF2->mpImuPreintegratedFrame->GetUpdatedDeltaRotation().t() * VisionR; //delta rotation값과 vision R값을 곱해서 변화된 vision R값을 구합니다. 
         cv::Mat e = IMU::LogSO3(E); //logSO3로 다시 변환합니다. 
         assert(fabs(pF2->mTimeStamp - pF1->mTimeStamp - pF2->mpImuPreintegratedFrame->dT) < 0.01); //이건 오류메세지를 뽑기위한 라인입니다. 디버깅 작업이라고 할수 있습니다. 
@@ -1677,8 +2453,8 @@ void Tracking::ComputeVelocitiesAccBias(const vector<Frame*> &vpFs, float &bax,
         cv::Mat Rwb1 = pF1->GetImuRotation();
         cv::Mat dP12 = pF2->mpImuPreintegratedFrame->GetUpdatedDeltaPosition(); 
         cv::Mat dV12 = pF2->mpImuPreintegratedFrame->GetUpdatedDeltaVelocity();
-        cv::Mat JP12 = pF2->mpImuPreintegratedFrame->JPa;
-        cv::Mat JV12 = pF2->mpImuPreintegratedFrame->JVa;
+        cv::Mat JP12 = cv::Mat(pF2->mpImuPreintegratedFrame->JPa);
+        cv::Mat JV12 = cv::Mat(pF2->mpImuPreintegratedFrame->JVa);
         float t12 = pF2->mpImuPreintegratedFrame->dT;
         // Position p2=p1+v1*t+0.5*g*t^2+R1*dP12
         J.rowRange(6*i,6*i+3).colRange(3*i,3*i+3) += cv::Mat::eye(3,3,CV_32F)*t12;
@@ -1717,6 +2493,20 @@ void Tracking::ComputeVelocitiesAccBias(const vector<Frame*> &vpFs, float &bax,
 
 void Tracking::Track()
 {
+    //^ 이전 frame에서 얻은 pointer 중 mLastFrame 외에는 사용하지 않음 (grace period로 보호됨).
+    //^ 메모리 회수는 다른 thread에서 수행 (tracking latency 유지)
+    EpochManager::Quiescent(false);
+
+    ORB_TRACE_THREAD_NAME("Tracking");
+    ORB_LOCK_THREAD_NAME("Tracking");
+    ORB_TRACE_SCOPE("Tracking::Track");
+
+    //^ Tracking은 caller thread에서 실행되므로 scheduling 설정은 그 thread가 처음 track할 때 적용
+    if(!mThreadScheduling.IsDefault() && mScheduledThread!=std::this_thread::get_id())
+    {
+        mThreadScheduling.Apply();
+        mScheduledThread = std::this_thread::get_id();
+    }
 
     if (bStepByStep)
     {
@@ -1739,8 +2529,7 @@ void Tracking::Track()
         if(mLastFrame.mTimeStamp>mCurrentFrame.mTimeStamp)
         {
             cerr << "ERROR: Frame with a timestamp older than previous frame detected!" << endl;
-            unique_lock<mutex> lock(mMutexImuQueue);
-            mlQueueImuData.clear();
+            mImuPreintegrator.Clear();
             CreateMapInAtlas();
             return;
         }
@@ -1773,6 +2562,16 @@ void Tracking::Track()
         }
     }
 
+    //^ TrackReferenceKeyFrame이나 Relocalization을 거칠 것으로 예상되는 frame은 BoW 계산을 thread pool에서 미리 시작한다.
+    //^ IMU preintegration과 map update lock을 기다리는 동안 계산되며, 예측이 틀려도 pool의 시간만 사용한다.
+    if(!mbOnlyTracking)
+    {
+        if((mState==OK && ((mVelocity.empty() && !pCurrentMap->isImuInitialized()) || mCurrentFrame.mnId<mnLastRelocFrameId+2)) ||
+           (mState==RECENTLY_LOST && mSensor!=System::IMU_MONOCULAR && mSensor!=System::IMU_STEREO))
+            mCurrentFrame.ComputeBoWAsync(mpThreadPool);
+    }
+    else if(mState==LOST || (mState==OK && mVelocity.empty()))
+        mCurrentFrame.ComputeBoWAsync(mpThreadPool);
 
     if ((mSensor == System::IMU_MONOCULAR || mSensor == System::IMU_STEREO) && mpLastKeyFrame)
         mCurrentFrame.SetNewBias(mpLastKeyFrame->GetImuBias());
@@ -1800,8 +2599,14 @@ void Tracking::Track()
     }
     mbCreatedMap = false;
 
+    //^ Offline mapping: keyframe을 버리는 대신 Local Mapping을 기다림 (Local Mapping도 map lock을 쓰므로 lock 전에)
+    if(mbOfflineMapping && !mbOnlyTracking)
+        WaitForLocalMapping();
+
     // Get Map Mutex -> Map cannot be changed
-    unique_lock<mutex> lock(pCurrentMap->mMutexMapUpdate);
+    ORB_TRACE_BEGIN(traceWaitMap, "Tracking::WaitMapUpdate");
+    unique_lock<MapUpdateMutex> lock(pCurrentMap->mMutexMapUpdate);
+    ORB_TRACE_END(traceWaitMap);
 
     mbMapUpdated = false;
 
@@ -1814,6 +2619,10 @@ void Tracking::Track()
         mbMapUpdated = true;
     }
 
+    //^ Localization mode에서는 map이 바뀌지 않으므로 read-only snapshot에서 local map을 찾는다 (map이 바뀌면 다시 생성)
+    if(mbOnlyTracking)
+        UpdateFrozenMap(pCurrentMap);
+
 
     if(mState==NOT_INITIALIZED)
     {
@@ -1824,7 +2633,8 @@ void Tracking::Track()
             MonocularInitialization();
         }
 
-        mpFrameDrawer->Update(this);
+        if(mpViewer)
+            mpFrameDrawer->Update(this);
 
         if(mState!=OK) // If rightly initialized, mState=OK
         {
@@ -1845,6 +2655,7 @@ void Tracking::Track()
 #ifdef REGISTER_TIMES
         std::chrono::steady_clock::time_point time_StartPosePred = std::chrono::steady_clock::now();
 #endif
+        Metrics::Clock::time_point time_StartStage = Metrics::Clock::now();
 
         // Initial camera pose estimation using motion model or relocalization (if tracking is lost)
         if(!mbOnlyTracking)
@@ -1859,7 +2670,9 @@ void Tracking::Track()
                 // Local Mapping might have changed some MapPoints tracked in last frame
                 CheckReplacedInLastFrame();
 
-                if((mVelocity.empty() && !pCurrentMap->isImuInitialized()) || mCurrentFrame.mnId<mnLastRelocFrameId+2)
+                if(mCurrentFrame.mbFlowTracked)
+                    bOK = TrackWithFlow();
+                else if((mVelocity.empty() && !pCurrentMap->isImuInitialized()) || mCurrentFrame.mnId<mnLastRelocFrameId+2)
                 {
                     //Verbose::PrintMess("TRACK: Track with respect to the reference KF ", Verbose::VERBOSITY_DEBUG);
                     bOK = TrackReferenceKeyFrame();
@@ -1927,6 +2740,11 @@ void Tracking::Track()
                         }
                     }
                 }
+                else if (mState == LOST && mbAtlasRelocalization && RelocalizationInAtlas())
+                {
+                    //^ 다른 map에서 relocalization 성공: 새 map을 만들지 않고 그 map에서 tracking을 이어간다
+                    bOK = true;
+                }
                 else if (mState == LOST)
                 {
 
@@ -2030,17 +2848,30 @@ void Tracking::Track()
         double timePosePred = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(time_EndPosePred - time_StartPosePred).count();
         vdPosePred_ms.push_back(timePosePred);
 #endif
+        if(mpMetrics)
+            mpMetrics->Record(Metrics::POSE_PREDICTION, time_StartStage);
 
 
 #ifdef REGISTER_TIMES
         std::chrono::steady_clock::time_point time_StartLMTrack = std::chrono::steady_clock::now();
 #endif
+        time_StartStage = Metrics::Clock::now();
         // If we have an initial estimation of the camera pose and matching. Track the local map.
         if(!mbOnlyTracking)
         {
-            if(bOK)
+            // Flow frames only have the features of map points already tracked, there is nothing to
+            // search for in the local map
+            if(bOK && !mCurrentFrame.mbFlowTracked)
             {
-                bOK = TrackLocalMap();
+                // Out of time for the local map, the pose of the motion model is the output
+                if(mpDeadline && mSensor!=System::IMU_MONOCULAR && mSensor!=System::IMU_STEREO &&
+                   mCurrentFrame.mnId>=mnLastRelocFrameId+mMaxFrames && mpDeadline->LocalPointsBudget()==0)
+                {
+                    mpDeadline->Apply(TrackingDeadline::SKIP_LOCAL_MAP);
+                    bOK = TrackMotionModelOnly();
+                }
+                else
+                    bOK = TrackLocalMap();
 
             }
             if(!bOK)
@@ -2079,18 +2910,6 @@ void Tracking::Track()
             }
         }
 
-        // Save frame if recent relocalization, since they are used for IMU reset (as we are making copy, it shluld be once mCurrFrame is completely modified)
-        if((mCurrentFrame.mnId<(mnLastRelocFrameId+mnFramesToResetIMU)) && (mCurrentFrame.mnId > mnFramesToResetIMU) && ((mSensor == System::IMU_MONOCULAR) || (mSensor == System::IMU_STEREO)) && pCurrentMap->isImuInitialized())
-        {
-            // TODO check this situation
-            Verbose::PrintMess("Saving pointer to frame. imu needs reset...", Verbose::VERBOSITY_NORMAL);
-            Frame* pF = new Frame(mCurrentFrame);
-            pF->mpPrevFrame = new Frame(mLastFrame);
-
-            // Load preintegration
-            pF->mpImuPreintegratedFrame = new IMU::Preintegrated(mCurrentFrame.mpImuPreintegratedFrame);
-        }
-
         if(pCurrentMap->isImuInitialized())
         {
             if(bOK)
@@ -2110,11 +2929,24 @@ void Tracking::Track()
         double timeLMTrack = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(time_EndLMTrack - time_StartLMTrack).count();
         vdLMTrack_ms.push_back(timeLMTrack);
 #endif
+        if(mpMetrics)
+        {
+            mpMetrics->Record(Metrics::TRACK_LOCAL_MAP, time_StartStage);
+            mpMetrics->SetGauge(Metrics::TRACKED_MAP_POINTS, mnMatchesInliers);
+        }
 
         // Update drawer
-        mpFrameDrawer->Update(this);
+        if(mpViewer)
+            mpFrameDrawer->Update(this);
         if(!mCurrentFrame.mTcw.empty())
-            mpMapDrawer->SetCurrentCameraPose(mCurrentFrame.mTcw);
+            PublishCameraPose(mCurrentFrame.mTcw);
+
+        //^ Localization mode에서는 현재 위치와 진행 방향 주변의 tile만 feature를 memory에 유지
+        if(mpTileStreamer && mbOnlyTracking && !mCurrentFrame.mTcw.empty())
+        {
+            const cv::Mat Ow = mCurrentFrame.GetCameraCenter();
+            mpTileStreamer->Update(mpAtlas->GetCurrentMap(), cv::Matx31f(Ow.at<float>(0),Ow.at<float>(1),Ow.at<float>(2)), mCurrentFrame.mTimeStamp);
+        }
 
         if(bOK || mState==RECENTLY_LOST)
         {
@@ -2130,7 +2962,7 @@ void Tracking::Track()
                 mVelocity = cv::Mat();
 
             if(mSensor == System::IMU_MONOCULAR || mSensor == System::IMU_STEREO)
-                mpMapDrawer->SetCurrentCameraPose(mCurrentFrame.mTcw);
+                PublishCameraPose(mCurrentFrame.mTcw);
 
             // Clean VO matches
             for(int i=0; i<mCurrentFrame.N; i++)
@@ -2155,7 +2987,30 @@ void Tracking::Track()
 #ifdef REGISTER_TIMES
             std::chrono::steady_clock::time_point time_StartNewKF = std::chrono::steady_clock::now();
 #endif
+            time_StartStage = Metrics::Clock::now();
             bool bNeedKF = NeedNewKeyFrame();
+            // A keyframe from a focused frame would lack the new features of the rest of the image,
+            // it is taken from the next (full) frame instead while tracking is good
+            if(bNeedKF && mCurrentFrame.mbFocusedExtraction && mnMatchesInliers>=FOCUS_MIN_INLIERS)
+            {
+                bNeedKF = false;
+                mbFocusFullFrame = true;
+            }
+            // Neither is there anything new in a flow frame, the next frame is extracted for the keyframe
+            if(bNeedKF && mCurrentFrame.mbFlowTracked)
+            {
+                bNeedKF = false;
+                mbFlowExtractNext = true;
+            }
+            // Nor the finest features in a reduced resolution frame, the next frame is extracted at full resolution
+            if(bNeedKF && mCurrentFrame.mbReducedResolution && mnMatchesInliers>=DUAL_RES_MIN_INLIERS)
+            {
+                bNeedKF = false;
+                mbFullResolutionNext = true;
+            }
+            // Local Mapping 상태(queue, idle)에 따라 달라지므로 record/replay
+            if(mpReplayLog)
+                bNeedKF = mpReplayLog->Decide(ReplayLog::NEW_KEYFRAME, bNeedKF);
 
 
 
@@ -2170,6 +3025,8 @@ void Tracking::Track()
             double timeNewKF = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(time_EndNewKF - time_StartNewKF).count();
             vdNewKF_ms.push_back(timeNewKF);
 #endif
+            if(mpMetrics)
+                mpMetrics->Record(Metrics::NEW_KEYFRAME, time_StartStage);
 
             // We allow points with high innovation (considererd outliers by the Huber Function)
             // pass to the new keyframe, so that bundle adjustment will finally decide
@@ -2205,6 +3062,10 @@ void Tracking::Track()
             mCurrentFrame.mpReferenceKF = mpReferenceKF;
 
         mLastFrame = Frame(mCurrentFrame);
+
+        //^ 다음 frame까지의 imu 데이터를 도착하는 대로 preintegration 합니다.
+        if(mSensor == System::IMU_MONOCULAR || mSensor == System::IMU_STEREO)
+            StartImuPreintegration();
     }
 
 
@@ -2220,6 +3081,9 @@ void Tracking::Track()
             mlpReferences.push_back(mCurrentFrame.mpReferenceKF);
             mlFrameTimes.push_back(mCurrentFrame.mTimeStamp);
             mlbLost.push_back(mState==LOST);
+
+            if(mpTrajectoryStore)
+                mpTrajectoryStore->AddFrame(mCurrentFrame.mTimeStamp, mCurrentFrame.mpReferenceKF, Tcr);
         }
         else
         {
@@ -2230,6 +3094,19 @@ void Tracking::Track()
             mlbLost.push_back(mState==LOST);
         }
 
+        if(mpTrajectoryWriter)
+        {
+            mpTrajectoryWriter->AddFrame(mlFrameTimes.back(), mlpReferences.back(), mlRelativeFramePoses.back(), mlbLost.back());
+
+            // The writer has the full trajectory, keep only what UpdateFrameIMU may still need
+            while(mlRelativeFramePoses.size()>static_cast<size_t>(mnTrajectoryHistory))
+            {
+                mlRelativeFramePoses.pop_front();
+                mlpReferences.pop_front();
+                mlFrameTimes.pop_front();
+                mlbLost.pop_front();
+            }
+        }
     }
 }
 
@@ -2351,6 +3228,7 @@ void Tracking::StereoInitialization()
         mnLastRelocFrameId = mCurrentFrame.mnId;// current key-frame에 대한 id 정보를 last-keyframe에 저장
 
         mvpLocalKeyFrames.push_back(pKFini);    // local keyframe에 저장
+        mbLocalMapCached = false;
         mvpLocalMapPoints=mpAtlas->GetAllMapPoints(); // Atlas의 map-point의 vector 포인터를 lcoal-map-point에 넘겨줌
         mpReferenceKF = pKFini; // 현재 KF를 reference KF로 설정
         mCurrentFrame.mpReferenceKF = pKFini; // 현재 KF를 currentFrame의 referenceKF로 설정
@@ -2363,7 +3241,7 @@ void Tracking::StereoInitialization()
         mpAtlas->GetCurrentMap()->mvpKeyFrameOrigins.push_back(pKFini);
 
         // Map에 point를 drawing할때 필요한 좌표계 변환 정보를 저장
-        mpMapDrawer->SetCurrentCameraPose(mCurrentFrame.mTcw);
+        PublishCameraPose(mCurrentFrame.mTcw);
 
         mState=OK;
     }
@@ -2409,52 +3287,95 @@ void Tracking::MonocularInitialization()
     {
         if (((int)mCurrentFrame.mvKeys.size()<=100)||((mSensor == System::IMU_MONOCULAR)&&(mLastFrame.mTimeStamp-mInitialFrame.mTimeStamp>1.0)))
         {
-            delete mpInitializer;
-            mpInitializer = static_cast<Initializer*>(NULL);
-            fill(mvIniMatches.begin(),mvIniMatches.end(),-1);
-
+            ResetMonocularInitializer();
             return;
         }
 
-        // Find correspondences
+        // A reconstruction finished on the pool: the map is initialized from the frame it was
+        // computed for, which takes the place of this one
+        if(mpIniReconstruction && mIniReconstructionDone.wait_for(std::chrono::seconds(0))==std::future_status::ready)
+        {
+            std::shared_ptr<IniReconstruction> pRec = mpIniReconstruction;
+            mpIniReconstruction.reset();
+            if(pRec->bOK)
+            {
+                mCurrentFrame = mIniCandidateFrame;
+                mvIniMatches.swap(pRec->vMatches);
+                mvIniP3D.swap(pRec->vP3D);
+                InitializeFromTwoViews(pRec->Rcw,pRec->tcw,pRec->vbTriangulated);
+                return;
+            }
+        }
+
+        // Find correspondences. Keypoints tracked in the last frame are searched close to where they were
         ORBmatcher matcher(0.9,true);
-        int nmatches = matcher.SearchForInitialization(mInitialFrame,mCurrentFrame,mvbPrevMatched,mvIniMatches,100);
+        int nmatches = matcher.SearchForInitialization(mInitialFrame,mCurrentFrame,mvbPrevMatched,mvIniMatches,100,30);
 
         // Check if there are enough correspondences
         if(nmatches<100)
         {
-            delete mpInitializer;
-            mpInitializer = static_cast<Initializer*>(NULL);
-            fill(mvIniMatches.begin(),mvIniMatches.end(),-1);
+            ResetMonocularInitializer();
             return;
         }
 
-        cv::Mat Rcw; // Current Camera Rotation
-        cv::Mat tcw; // Current Camera Translation
-        vector<bool> vbTriangulated; // Triangulated Correspondences (mvIniMatches)
-
-        if(mpCamera->ReconstructWithTwoViews(mInitialFrame.mvKeysUn,mCurrentFrame.mvKeysUn,mvIniMatches,Rcw,tcw,mvIniP3D,vbTriangulated))
+        // Off the tracking thread: one reconstruction at a time, the next one with the newest frame
+        if(mSensor==System::MONOCULAR && mpThreadPool && mpThreadPool->GetNumThreads()>0)
         {
-            for(size_t i=0, iend=mvIniMatches.size(); i<iend;i++)
+            if(!mIniReconstructionDone.valid() || mIniReconstructionDone.wait_for(std::chrono::seconds(0))==std::future_status::ready)
             {
-                if(mvIniMatches[i]>=0 && !vbTriangulated[i])
+                std::shared_ptr<IniReconstruction> pRec = std::make_shared<IniReconstruction>();
+                pRec->vMatches = mvIniMatches;
+                pRec->bOK = false;
+                mIniCandidateFrame = Frame(mCurrentFrame);
+
+                GeometricCamera* pCamera = mpCamera;
+                const SharedVector<cv::KeyPoint> vKeys1 = mInitialFrame.mvKeysUn;
+                const SharedVector<cv::KeyPoint> vKeys2 = mCurrentFrame.mvKeysUn;
+                mIniReconstructionDone = mpThreadPool->Submit([pCamera,pRec,vKeys1,vKeys2]
                 {
-                    mvIniMatches[i]=-1;
-                    nmatches--;
-                }
+                    pRec->bOK = pCamera->ReconstructWithTwoViews(vKeys1,vKeys2,pRec->vMatches,pRec->Rcw,pRec->tcw,pRec->vP3D,pRec->vbTriangulated);
+                });
+                mpIniReconstruction = pRec;
             }
+            return;
+        }
 
-            // Set Frame Poses
-            mInitialFrame.SetPose(cv::Mat::eye(4,4,CV_32F));
-            cv::Mat Tcw = cv::Mat::eye(4,4,CV_32F);
-            Rcw.copyTo(Tcw.rowRange(0,3).colRange(0,3));
-            tcw.copyTo(Tcw.rowRange(0,3).col(3));
-            mCurrentFrame.SetPose(Tcw);
+        cv::Mat Rcw; // Current Camera Rotation
+        cv::Mat tcw; // Current Camera Translation
+        vector<bool> vbTriangulated; // Triangulated Correspondences (mvIniMatches)
 
-            CreateInitialMapMonocular();
+        if(mpCamera->ReconstructWithTwoViews(mInitialFrame.mvKeysUn,mCurrentFrame.mvKeysUn,mvIniMatches,Rcw,tcw,mvIniP3D,vbTriangulated))
+            InitializeFromTwoViews(Rcw,tcw,vbTriangulated);
+    }
+}
 
-        }
+void Tracking::InitializeFromTwoViews(const cv::Mat &Rcw, const cv::Mat &tcw, const vector<bool> &vbTriangulated)
+{
+    for(size_t i=0, iend=mvIniMatches.size(); i<iend;i++)
+    {
+        if(mvIniMatches[i]>=0 && !vbTriangulated[i])
+            mvIniMatches[i]=-1;
     }
+
+    // Set Frame Poses
+    mInitialFrame.SetPose(cv::Mat::eye(4,4,CV_32F));
+    cv::Mat Tcw = cv::Mat::eye(4,4,CV_32F);
+    Rcw.copyTo(Tcw.rowRange(0,3).colRange(0,3));
+    tcw.copyTo(Tcw.rowRange(0,3).col(3));
+    mCurrentFrame.SetPose(Tcw);
+
+    CreateInitialMapMonocular();
+}
+
+void Tracking::ResetMonocularInitializer()
+{
+    if(mpInitializer)
+        delete mpInitializer;
+    mpInitializer = static_cast<Initializer*>(NULL);
+    fill(mvIniMatches.begin(),mvIniMatches.end(),-1);
+
+    // A reconstruction still running finishes on its own, its result is dropped
+    mpIniReconstruction.reset();
 }
 
 
@@ -2568,6 +3489,7 @@ void Tracking::CreateInitialMapMonocular()
 
     mvpLocalKeyFrames.push_back(pKFcur);
     mvpLocalKeyFrames.push_back(pKFini);
+    mbLocalMapCached = false;
     mvpLocalMapPoints=mpAtlas->GetAllMapPoints();
     mpReferenceKF = pKFcur;
     mCurrentFrame.mpReferenceKF = pKFcur;
@@ -2587,7 +3509,7 @@ void Tracking::CreateInitialMapMonocular()
 
     mpAtlas->SetReferenceMapPoints(mvpLocalMapPoints);
 
-    mpMapDrawer->SetCurrentCameraPose(pKFcur->GetPose());
+    PublishCameraPose(pKFcur->GetPose());
 
     mpAtlas->GetCurrentMap()->mvpKeyFrameOrigins.push_back(pKFini);
 
@@ -2639,6 +3561,7 @@ void Tracking::CreateMapInAtlas()
         
         // 초기화 변수에 대한 재할당
         mpInitializer = static_cast<Initializer*>(NULL);
+        mpIniReconstruction.reset();
     }
 
     // mono-imu || stereo-imu인 경우
@@ -2695,6 +3618,10 @@ bool Tracking::TrackReferenceKeyFrame()
     ORBmatcher matcher(0.7,true);
     vector<MapPoint*> vpMapPointMatches;
 
+    //^ Tiled map에서 reference KeyFrame의 feature가 disk에 있으면 먼저 읽어온다
+    if(mpTileStreamer && mbOnlyTracking)
+        mpTileStreamer->EnsureResident(mpReferenceKF);
+
     int nmatches = matcher.SearchByBoW(mpReferenceKF,mCurrentFrame,vpMapPointMatches);
 
     if(nmatches<15)
@@ -2854,14 +3781,19 @@ bool Tracking::TrackWithMotionModel()
 
     // If few matches, uses a wider window search
     // Match 되는 point의 갯수가 적을 경우 다시 Window의 Size를 키워 Match하는 point의 갯수를 찾는다.
-    if(nmatches<20)
+    if(nmatches<20 && mpDeadline && !mpDeadline->FitsWideSearch())
+        mpDeadline->Apply(TrackingDeadline::SKIP_WIDE_SEARCH);
+    else if(nmatches<20)
     {
+        const TrackingDeadline::Clock::time_point time_StartWide = TrackingDeadline::Clock::now();
         Verbose::PrintMess("Not enough matches, wider window search!!", Verbose::VERBOSITY_NORMAL);
         fill(mCurrentFrame.mvpMapPoints.begin(),mCurrentFrame.mvpMapPoints.end(),static_cast<MapPoint*>(NULL));
         // Current Frame의 MapPoint vector를 초기화
 
         nmatches = matcher.SearchByProjection(mCurrentFrame,mLastFrame,2*th,mSensor==System::MONOCULAR || mSensor==System::IMU_MONOCULAR);
         Verbose::PrintMess("Matches with wider search: " + to_string(nmatches), Verbose::VERBOSITY_NORMAL);
+        if(mpDeadline)
+            mpDeadline->RecordWideSearch(time_StartWide);
 
     }
 
@@ -2923,6 +3855,82 @@ bool Tracking::TrackWithMotionModel()
         return nmatchesMap>=10; // Outlier를 제거한 Map point의 개수에 따라 Motion model인지 아닌지 결정
 }
 
+bool Tracking::TrackWithFlow()
+{
+    // The map points come with the features, only the pose is estimated
+    mCurrentFrame.SetPose(mVelocity*mLastFrame.mTcw);
+
+    for(int i=0; i<mCurrentFrame.N; i++)
+    {
+        MapPoint* pMP = mCurrentFrame.mvpMapPoints[i];
+        if(!pMP)
+            continue;
+        MapPoint* pRep = pMP->GetReplaced();
+        if(pRep)
+            pMP = mCurrentFrame.mvpMapPoints[i] = pRep;
+        if(pMP->isBad())
+            mCurrentFrame.mvpMapPoints[i] = static_cast<MapPoint*>(NULL);
+    }
+
+    Optimizer::PoseOptimization(&mCurrentFrame);
+
+    // Discard outliers and update the statistics of the map points, as TrackLocalMap does
+    mnMatchesInliers = 0;
+    for(int i=0; i<mCurrentFrame.N; i++)
+    {
+        MapPoint* pMP = mCurrentFrame.mvpMapPoints[i];
+        if(!pMP)
+            continue;
+
+        if(mCurrentFrame.mvbOutlier[i])
+        {
+            mCurrentFrame.mvpMapPoints[i] = static_cast<MapPoint*>(NULL);
+            mCurrentFrame.mvbOutlier[i] = false;
+            pMP->mbTrackInView = false;
+            pMP->mnLastFrameSeen = mCurrentFrame.mnId;
+        }
+        else
+        {
+            pMP->IncreaseVisible();
+            pMP->IncreaseFound();
+            pMP->mnLastFrameSeen = mCurrentFrame.mnId;
+            if(pMP->Observations()>0)
+                mnMatchesInliers++;
+        }
+    }
+    mpLocalMapper->mnMatchesInliers=mnMatchesInliers;
+
+    return mnMatchesInliers>=FLOW_MIN_INLIERS;
+}
+
+bool Tracking::TrackMotionModelOnly()
+{
+    // Outliers were already discarded by TrackWithMotionModel / TrackReferenceKeyFrame
+    mnMatchesInliers = 0;
+    for(int i=0; i<mCurrentFrame.N; i++)
+    {
+        MapPoint* pMP = mCurrentFrame.mvpMapPoints[i];
+        if(!pMP || mCurrentFrame.mvbOutlier[i])
+            continue;
+        if(!mpFrozenMap)
+            pMP->IncreaseFound();
+        if(pMP->Observations()>0)
+            mnMatchesInliers++;
+    }
+    mpLocalMapper->mnMatchesInliers=mnMatchesInliers;
+
+    return mnMatchesInliers>=30;
+}
+
+void Tracking::ReportDegradations()
+{
+    mnDegradations = mpDeadline ? mpDeadline->GetApplied() : static_cast<int>(TrackingDeadline::NONE);
+    if(mpMetrics)
+        mpMetrics->SetGauge(Metrics::TRACKING_DEGRADATIONS, mnDegradations);
+    if(mnDegradations != TrackingDeadline::NONE)
+        Verbose::PrintMess("Frame " + to_string(mCurrentFrame.mnId) + " over the deadline: " + TrackingDeadline::ToString(mnDegradations), Verbose::VERBOSITY_DEBUG);
+}
+
 bool Tracking::TrackLocalMap()
 {
 
@@ -2933,6 +3941,8 @@ bool Tracking::TrackLocalMap()
 #ifdef REGISTER_TIMES
     std::chrono::steady_clock::time_point time_StartLMUpdate = std::chrono::steady_clock::now();
 #endif
+    const TrackingDeadline::Clock::time_point time_StartLocalMap = TrackingDeadline::Clock::now();
+    mnLocalPointsSearched = 0;
     UpdateLocalMap();   // Local Map을 Update
 #ifdef REGISTER_TIMES
     std::chrono::steady_clock::time_point time_StartSearchLP = std::chrono::steady_clock::now();
@@ -2942,12 +3952,14 @@ bool Tracking::TrackLocalMap()
 #endif
 
     SearchLocalPoints();    // Local Map Point를 검색 (Update하는 의미로 이해)
+    SearchRigPoints();
 #ifdef REGISTER_TIMES
     std::chrono::steady_clock::time_point time_StartPoseOpt = std::chrono::steady_clock::now();
 
     double timeSearchLP_ms = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(time_StartPoseOpt - time_StartSearchLP).count();
     vdSearchLP_ms.push_back(timeSearchLP_ms);
 #endif
+    const Metrics::Clock::time_point time_StartPoseOptimization = Metrics::Clock::now();
 
     // TOO check outliers before PO
     // Pose Optimization을 하기 전에 Outlier check
@@ -2963,7 +3975,11 @@ bool Tracking::TrackLocalMap()
 
     int inliers;
     if (!mpAtlas->isImuInitialized())   // Atlas에 IMU가 초기화 되어 있지 않다면
+    {
         Optimizer::PoseOptimization(&mCurrentFrame);    // Current Frame을 이용하여 camera pose를 최적화
+        if(mpMetrics)
+            mpMetrics->SetGauge(Metrics::POSE_OPTIMIZATION_ITERATIONS, Optimizer::GetLastIterationStats().nIterations);
+    }
     else    // Atlas에 IMU가 초기화 되어 있다면
     {
         // Current Frame의 ID보다 Last Relocalization Frame ID와 IMU를 Reset한 ID의 합이 크거나 같다면
@@ -2971,6 +3987,8 @@ bool Tracking::TrackLocalMap()
         {
             Verbose::PrintMess("TLM: PoseOptimization ", Verbose::VERBOSITY_DEBUG);
             Optimizer::PoseOptimization(&mCurrentFrame);     // Current Frame을 이용하여 camera pose를 최적화
+            if(mpMetrics)
+                mpMetrics->SetGauge(Metrics::POSE_OPTIMIZATION_ITERATIONS, Optimizer::GetLastIterationStats().nIterations);
         }
         else    // Current Frame의 ID보다 Last Relocalization Frame ID와 IMU를 Reset한 ID의 합이 작다면
         {
@@ -2994,6 +4012,8 @@ bool Tracking::TrackLocalMap()
     double timePoseOpt_ms = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(time_EndPoseOpt - time_StartPoseOpt).count();
     vdPoseOpt_ms.push_back(timePoseOpt_ms);
 #endif
+    if(mpMetrics)
+        mpMetrics->Record(Metrics::POSE_OPTIMIZATION, time_StartPoseOptimization);
 
     vnKeyFramesLM.push_back(mvpLocalKeyFrames.size());  // Local Key Frame의 size를 vnKeyFramesLM에 저장
     vnMapPointsLM.push_back(mvpLocalMapPoints.size());  // Local Map Point의 size를 vnMapPointsLM에 저장
@@ -3017,7 +4037,8 @@ bool Tracking::TrackLocalMap()
         {
             if(!mCurrentFrame.mvbOutlier[i])    // Outlier가 아니라면
             {
-                mCurrentFrame.mvpMapPoints[i]->IncreaseFound(); // Map point가 found 되었다는 변수를 증가
+                if(!mpFrozenMap)    // Frozen map의 point는 수정하지 않음
+                    mCurrentFrame.mvpMapPoints[i]->IncreaseFound(); // Map point가 found 되었다는 변수를 증가
                 if(!mbOnlyTracking) // Mapping을 진행하고 있다면 (Localization mode가 아니라는 뜻)
                 {
                     if(mCurrentFrame.mvpMapPoints[i]->Observations()>0) // Current Frame에서 Map point가 관찰이 될 경우
@@ -3031,6 +4052,24 @@ bool Tracking::TrackLocalMap()
         }
     }
 
+    // Inliers of the rig cameras also count for the tracking quality
+    for(size_t v=0; v<mCurrentFrame.mvRigViews.size(); v++)
+    {
+        RigView &view = mCurrentFrame.mvRigViews[v];
+        for(size_t i=0; i<view.mvpMapPoints.size(); i++)
+        {
+            if(!view.mvpMapPoints[i])
+                continue;
+            if(view.mvbOutlier[i])
+                view.mvpMapPoints[i] = static_cast<MapPoint*>(NULL);
+            else
+                mnMatchesInliers++;
+        }
+    }
+
+    if(mpDeadline)
+        mpDeadline->RecordLocalMap(time_StartLocalMap,mnLocalPointsSearched);
+
     // Decide if the tracking was succesful
     // More restrictive if there was a relocalization recently
     // Inlier의 갯수를 통해 Tracking이 되고 있는지 안되고 있는지 판단
@@ -3079,16 +4118,16 @@ bool Tracking::NeedNewKeyFrame()
     // Monocular-Inertial 모드거나 Stereo-Inertial 모드 그리고 Atlas에 Current Map에서 IMU 초기화가 되어있지 않을 때
     if(((mSensor == System::IMU_MONOCULAR) || (mSensor == System::IMU_STEREO)) && !mpAtlas->GetCurrentMap()->isImuInitialized())
     {
-        // Monocular-Inertial 모드이고, 현재 Frame의 Timestamp와 Last KeyFrame의 Timestamp의 차이가 0.25이상일 경우,
+        // Monocular-Inertial 모드이고, 현재 Frame의 Timestamp와 Last KeyFrame의 Timestamp의 차이가 mfImuInitKFInterval(기본 0.25) 이상일 경우,
         // Timestamp의 단위는 Unix Time (참고자료 : https://perfectacle.github.io/2018/09/25/unix-timestamp/)
-        if (mSensor == System::IMU_MONOCULAR && (mCurrentFrame.mTimeStamp-mpLastKeyFrame->mTimeStamp)>=0.25)
+        if (mSensor == System::IMU_MONOCULAR && (mCurrentFrame.mTimeStamp-mpLastKeyFrame->mTimeStamp)>=mfImuInitKFInterval)
             return true;    // 새로운 KeyFrame이 필요하다고 판단
         
-        // Stereo-Inertial 모드이고, 현재 Frame의 Timestamp와 Last KeyFrame의 Timestamp의 차이가 0.25이상일 경우,
-        else if (mSensor == System::IMU_STEREO && (mCurrentFrame.mTimeStamp-mpLastKeyFrame->mTimeStamp)>=0.25)
+        // Stereo-Inertial 모드이고, 현재 Frame의 Timestamp와 Last KeyFrame의 Timestamp의 차이가 mfImuInitKFInterval(기본 0.25) 이상일 경우,
+        else if (mSensor == System::IMU_STEREO && (mCurrentFrame.mTimeStamp-mpLastKeyFrame->mTimeStamp)>=mfImuInitKFInterval)
             return true;    // 새로운 KeyFrame이 필요하다고 판단
         
-        else    // Timestamp 차이가 0.25보다 작을 경우
+        else    // Timestamp 차이가 mfImuInitKFInterval보다 작을 경우
             return false;   // 새로운 KeyFrame이 필요하지 않다고 판단
     }
 
@@ -3133,6 +4172,9 @@ bool Tracking::NeedNewKeyFrame()
     // LocalMapping::Run()함수가 처음 진행될 때 false, 다 끝나면 true
     // bLocalMappingIdle 변수를 통해 Local Mapping이 진행되고 있는지 아닌지를 판단
     bool bLocalMappingIdle = mpLocalMapper->AcceptKeyFrames();
+    //^ Offline mapping에서는 queue 길이를 WaitForLocalMapping이 제한하므로 항상 keyframe을 넘긴다 (BA도 방해하지 않음)
+    if(mbOfflineMapping)
+        bLocalMappingIdle = true;
 
     // Check how many "close" points are being tracked and how many could be potentially created.
     // Tracking되고 있는 Point들이 얼마나 가까운지 Check
@@ -3279,6 +4321,10 @@ void Tracking::CreateNewKeyFrame()
     if(!mpLocalMapper->SetNotStop(true)) // Local Mapping이 Stop된 경우 Key Frame을 만들지 않는다.
         return;
 
+    //^ ComputeBoWAsync로 계산이 시작된 BoW가 있다면 KeyFrame이 복사할 수 있도록 가져온다. (없으면 Local Mapping에서 계산)
+    if(mCurrentFrame.isBoWPending())
+        mCurrentFrame.ComputeBoW();
+
     KeyFrame* pKF = new KeyFrame(mCurrentFrame,mpAtlas->GetCurrentMap(),mpKeyFrameDB);
     // Current Frame, Atlas에서 Current Map, 그리고 BoW를 활용한 KeyFrame DB를 활용하여 KeyFrame을 pointer로 선언
 
@@ -3376,6 +4422,9 @@ void Tracking::CreateNewKeyFrame()
 
                     MapPoint* pNewMP = new MapPoint(x3D,pKF,mpAtlas->GetCurrentMap());
                     // 위에서 구한 3차원 정보, KeyFrame, Current Map을 활용해서 새로운 Map point 생성
+                    //^ Descriptor, normal, depth는 이 frame의 관측에서 바로 가져온다. Atlas map에 추가하는 것(그리고 fisheye의
+                    //^ 두 관측으로 다시 계산하는 것)은 Local Mapping의 ProcessNewKeyFrame에서 하므로 tracking thread에는 bookkeeping만 남는다.
+                    pNewMP->InitFromObservation(&mCurrentFrame,i);
                     pNewMP->AddObservation(pKF,i);  // KeyFrame에서 Map point가 관찰이 가능하다고 알려준다. (Index를 활용해서 저장)
 
                     //Check if it is a stereo observation in order to not
@@ -3391,9 +4440,6 @@ void Tracking::CreateNewKeyFrame()
                     }
 
                     pKF->AddMapPoint(pNewMP,i); // KeyFrame에 새로운 map point를 추가
-                    pNewMP->ComputeDistinctiveDescriptors();    // Map point에 대한 ORB matcher Descriptor를 계산
-                    pNewMP->UpdateNormalAndDepth(); // Normal vector와 Depth값을 구함.
-                    mpAtlas->AddMapPoint(pNewMP);   // Atlas map에 Map point를 추가
 
                     mCurrentFrame.mvpMapPoints[i]=pNewMP;   // Current Frame의 Map Point 추가
                     nPoints++;  // Points 갯수 1증가
@@ -3428,6 +4474,12 @@ void Tracking::CreateNewKeyFrame()
 
 void Tracking::SearchLocalPoints()
 {
+    if(mpFrozenMap && mCurrentFrame.Nleft==-1)
+    {
+        SearchLocalPointsFrozen();
+        return;
+    }
+
     // Do not search map points already matched
     //^ Current frame에서 이미 매칭된 MapPoint들에 대해서, 즉 CurrentFrame의 KeyPoints
     for(vector<MapPoint*>::iterator vit=mCurrentFrame.mvpMapPoints.begin(), vend=mCurrentFrame.mvpMapPoints.end(); vit!=vend; vit++)
@@ -3455,30 +4507,60 @@ void Tracking::SearchLocalPoints()
         }
     }
 
-    int nToMatch=0;
+    //^ 이번 frame에 갱신된 mirror가 있으면 (single camera) 연속 배열에서 투영, 매칭
+    if(mCurrentFrame.Nleft==-1 && mnLocalMirrorFrameId==mCurrentFrame.mnId)
+    {
+        SearchLocalPointsMirror();
+        return;
+    }
 
     // Project points in frame and check its visibility
     //^ 이전에 찾은 LocalMapPoints 중에서
+    //^ 이미 Matching 된 LocalMapPoint와 Bad LocalMapPoint는 skip하고, 나머지를 한번에 Frustum 검사한다.
+    vector<MapPoint*> vpCandidates;
+    vpCandidates.reserve(mvpLocalMapPoints.size());
     for(vector<MapPoint*>::iterator vit=mvpLocalMapPoints.begin(), vend=mvpLocalMapPoints.end(); vit!=vend; vit++)
     {
         MapPoint* pMP = *vit;
 
-        //^ 이미 Matching 된 LocalMapPoint는 skip한다.
         if(pMP->mnLastFrameSeen == mCurrentFrame.mnId)
             continue;
-        //^ Bad LocalMapPoint는 skip한다.
         if(pMP->isBad())
             continue;
-        // Project (this fills MapPoint variables for matching)
-        //^ 그 외의 경우, 
-        //^ LocalMapPoint가 CurrentFrame의 Frustum에 들어오면,
-        if(mCurrentFrame.isInFrustum(pMP,0.5))
+        vpCandidates.push_back(pMP);
+    }
+
+    //^ Spatial index가 있으면 어느 camera에서도 보이지 않는 cell의 point는 하나씩 투영하지 않는다
+    if(mfSpatialLocalMapRadius>0.f && !vpCandidates.empty())
+    {
+        for(size_t i=0; i<vpCandidates.size(); i++)
         {
-            //^ Visible.
-            pMP->IncreaseVisible();
-            //^ Match됨.
-            nToMatch++;
+            vpCandidates[i]->mbTrackInView = false;
+            vpCandidates[i]->mbTrackInViewR = false;
         }
+
+        const float maxDepth = numeric_limits<float>::max();
+        const cv::Matx44f Tcw = mCurrentFrame.mTcw;
+        vector<SpatialIndex<MapPoint>::Frustum> vFrustums;
+        vFrustums.push_back(SpatialIndex<MapPoint>::Frustum(Tcw,mCurrentFrame.mpCamera,
+                                                            mCurrentFrame.mnMinX,mCurrentFrame.mnMaxX,mCurrentFrame.mnMinY,mCurrentFrame.mnMaxY,maxDepth));
+        if(mCurrentFrame.mpCamera2)
+            vFrustums.push_back(SpatialIndex<MapPoint>::Frustum(PoseMatrix(mCurrentFrame.mTrlx*Tcw),mCurrentFrame.mpCamera2,
+                                                                mCurrentFrame.mnMinX,mCurrentFrame.mnMaxX,mCurrentFrame.mnMinY,mCurrentFrame.mnMaxY,maxDepth));
+        mpAtlas->GetCurrentMap()->FilterMapPointsInFrustum(vFrustums,vpCandidates);
+    }
+
+    // Project (this fills MapPoint variables for matching)
+    vector<bool> vbInFrustum;
+    const int nToMatch = mCurrentFrame.isInFrustum(vpCandidates,0.5,vbInFrustum);
+
+    for(size_t i=0; i<vpCandidates.size(); i++)
+    {
+        MapPoint* pMP = vpCandidates[i];
+
+        //^ LocalMapPoint가 CurrentFrame의 Frustum에 들어오면, Visible.
+        if(vbInFrustum[i])
+            pMP->IncreaseVisible();
         //^ For visualization
         //^ LocalMapPoint 중에서 CurrentFrame의 Frustnum에 들어온 MapPoint는 ProjectPoints에 저장하여 
         //^ 나중에 Drawer에서 시각화해준다.
@@ -3489,39 +4571,176 @@ void Tracking::SearchLocalPoints()
     }
 
     //^ 하나라도 LocalMapPoints 중에서 CurrentFrame의 Frustum에 들어온게 있으면(=Has seen) 된게 있으면,
+    // Over the deadline only the points seen from more keyframes are searched
+    if(mpDeadline)
+    {
+        const int nBudget = mpDeadline->LocalPointsBudget();
+        mnLocalPointsSearched = nToMatch;
+        if(nBudget>=0 && nToMatch>nBudget)
+        {
+            vector<pair<int,MapPoint*> > vObsPoints;
+            vObsPoints.reserve(nToMatch);
+            for(size_t i=0; i<vpCandidates.size(); i++)
+                if(vbInFrustum[i])
+                    vObsPoints.push_back(make_pair(vpCandidates[i]->Observations(),vpCandidates[i]));
+            nth_element(vObsPoints.begin(),vObsPoints.begin()+nBudget,vObsPoints.end(),
+                        [](const pair<int,MapPoint*> &a, const pair<int,MapPoint*> &b){return a.first>b.first;});
+            for(size_t i=nBudget; i<vObsPoints.size(); i++)
+            {
+                vObsPoints[i].second->mbTrackInView = false;
+                vObsPoints[i].second->mbTrackInViewR = false;
+            }
+            mnLocalPointsSearched = nBudget;
+            mpDeadline->Apply(TrackingDeadline::SHRINK_LOCAL_MAP);
+        }
+    }
+
     if(nToMatch>0)
     {
         ORBmatcher matcher(0.8);
-        int th = 1;
+        const int th = LocalPointsSearchThreshold();
 
-        //^ 시스템 환경에 따라 ORB Matcher의 threshold 다름.
-        if(mSensor==System::RGBD)
-            th=3;
-        if(mpAtlas->isImuInitialized())
+        //^ LocalMapPoints의 descriptor와 CurrentFrame의 KeyPoints의 descriptor 간 matching
+        //^ Match된 KeyPoints 갯수 반환
+        //^ 그러나 쓰이진 않음.
+        //^ CurrentFrame에 Matching된 MapPoint를 저장하는 멤버인 mvpMapPoints에 Match된 KeyPoints 저장하는 함수
+        int matches = matcher.SearchByProjection(mCurrentFrame, mvpLocalMapPoints, th, mpLocalMapper->mbFarPoints, mpLocalMapper->mThFarPoints);
+    }
+}
+
+void Tracking::BeginRigExtraction()
+{
+    if(mpCameraRig && !mvImRig.empty())
+        mpCameraRig->ExtractAsync(mvImRig,mbRGB,mpThreadPool);
+    mvImRig.clear();
+}
+
+void Tracking::EndRigExtraction(Frame &frame)
+{
+    if(mpCameraRig)
+        mpCameraRig->CollectFeatures(frame);
+}
+
+void Tracking::SearchRigPoints()
+{
+    // The rig cameras only see the points of the map being built (the frozen snapshot of the
+    // localization mode has no rig support)
+    if(mCurrentFrame.mvRigViews.empty() || mpFrozenMap)
+        return;
+
+    ORBmatcher matcher(0.8);
+    matcher.SearchByProjectionRig(mCurrentFrame, mvpLocalMapPoints, LocalPointsSearchThreshold());
+}
+
+void Tracking::SearchLocalPointsFrozen()
+{
+    // Snapshot points are not modified (no visibility statistics, Local Mapping is stopped)
+    const int nToMatch = mpFrozenMap->ProjectLocalPoints(mCurrentFrame,0.5,mFrozenWindow);
+
+    //^ For visualization
+    if(mpViewer)
+    {
+        for(size_t i=0; i<mFrozenWindow.mvProjPoint.size(); i++)
         {
-            if(mpAtlas->GetCurrentMap()->GetIniertialBA2())
-                th=2;
-            else
-                th=3;
+            MapPoint* pMP = mpFrozenMap->mvpMapPoints[mFrozenWindow.mvProjPoint[i]];
+            mCurrentFrame.mmProjectPoints[pMP->mnId] = cv::Point2f(mFrozenWindow.mvProjU[i], mFrozenWindow.mvProjV[i]);
         }
-        else if(!mpAtlas->isImuInitialized() && (mSensor==System::IMU_MONOCULAR || mSensor==System::IMU_STEREO))
+    }
+
+    if(nToMatch>0)
+    {
+        ORBmatcher matcher(0.8);
+        matcher.SearchByProjection(mCurrentFrame, *mpFrozenMap, mFrozenWindow, LocalPointsSearchThreshold(), mpLocalMapper->mbFarPoints, mpLocalMapper->mThFarPoints);
+    }
+}
+
+void Tracking::SearchLocalPointsMirror()
+{
+    const LocalMapMirror::Points &points = mLocalMirror.mPoints;
+    LocalMapMirror::Projection &proj = mLocalProjection;
+    int nToMatch = mLocalMirror.ProjectPoints(mCurrentFrame,0.5,proj);
+
+    // Only the points in the frustum are touched: visibility statistics, depth read by the pose optimization
+    for(size_t i=0; i<proj.mvProjPoint.size(); i++)
+    {
+        MapPoint* pMP = points.mvpMapPoints[proj.mvProjPoint[i]];
+        pMP->IncreaseVisible();
+        pMP->mTrackDepth = proj.mvProjDepth[i];
+        //^ For visualization
+        mCurrentFrame.mmProjectPoints[pMP->mnId] = cv::Point2f(proj.mvProjU[i], proj.mvProjV[i]);
+    }
+
+    // Over the deadline only the points seen from more keyframes are searched
+    if(mpDeadline)
+    {
+        const int nBudget = mpDeadline->LocalPointsBudget();
+        mnLocalPointsSearched = nToMatch;
+        if(nBudget>=0 && nToMatch>nBudget)
         {
-            th=10;
+            vector<pair<int,int> > vObsProj;
+            vObsProj.reserve(nToMatch);
+            for(int i=0; i<nToMatch; i++)
+                vObsProj.push_back(make_pair(points.mvpMapPoints[proj.mvProjPoint[i]]->Observations(),i));
+            nth_element(vObsProj.begin(),vObsProj.begin()+nBudget,vObsProj.end(),
+                        [](const pair<int,int> &a, const pair<int,int> &b){return a.first>b.first;});
+
+            vector<int> vKeep(nBudget);
+            for(int i=0; i<nBudget; i++)
+                vKeep[i] = vObsProj[i].second;
+            sort(vKeep.begin(),vKeep.end());
+            proj.Keep(vKeep);
+
+            nToMatch = nBudget;
+            mnLocalPointsSearched = nBudget;
+            mpDeadline->Apply(TrackingDeadline::SHRINK_LOCAL_MAP);
         }
+    }
 
-        // If the camera has been relocalised recently, perform a coarser search
-        if(mCurrentFrame.mnId<mnLastRelocFrameId+2)
-            th=5;
+    if(nToMatch>0)
+    {
+        ORBmatcher matcher(0.8);
+        matcher.SearchByProjection(mCurrentFrame, mLocalMirror, proj, LocalPointsSearchThreshold(), mpLocalMapper->mbFarPoints, mpLocalMapper->mThFarPoints);
+    }
+}
 
-        if(mState==LOST || mState==RECENTLY_LOST) // Lost for less than 1 second
-            th=15;
+int Tracking::LocalPointsSearchThreshold()
+{
+    int th = 1;
 
-        //^ LocalMapPoints의 descriptor와 CurrentFrame의 KeyPoints의 descriptor 간 matching
-        //^ Match된 KeyPoints 갯수 반환
-        //^ 그러나 쓰이진 않음.
-        //^ CurrentFrame에 Matching된 MapPoint를 저장하는 멤버인 mvpMapPoints에 Match된 KeyPoints 저장하는 함수
-        int matches = matcher.SearchByProjection(mCurrentFrame, mvpLocalMapPoints, th, mpLocalMapper->mbFarPoints, mpLocalMapper->mThFarPoints);
+    //^ 시스템 환경에 따라 ORB Matcher의 threshold 다름.
+    if(mSensor==System::RGBD)
+        th=3;
+    if(mpAtlas->isImuInitialized())
+    {
+        if(mpAtlas->GetCurrentMap()->GetIniertialBA2())
+            th=2;
+        else
+            th=3;
+    }
+    else if(!mpAtlas->isImuInitialized() && (mSensor==System::IMU_MONOCULAR || mSensor==System::IMU_STEREO))
+    {
+        th=10;
     }
+
+    // If the camera has been relocalised recently, perform a coarser search
+    if(mCurrentFrame.mnId<mnLastRelocFrameId+2)
+        th=5;
+
+    if(mState==LOST || mState==RECENTLY_LOST) // Lost for less than 1 second
+        th=15;
+
+    return th;
+}
+
+void Tracking::UpdateFrozenMap(Map* pMap)
+{
+    if(mpFrozenMap && !mpFrozenMap->IsStale(pMap))
+        return;
+
+    delete mpFrozenMap;
+    mpFrozenMap = new FrozenMap(pMap);
+    Verbose::PrintMess("Frozen map for localization: " + to_string(mpFrozenMap->mvpKeyFrames.size()) + " keyframes, " +
+                       to_string(mpFrozenMap->mvpMapPoints.size()) + " points", Verbose::VERBOSITY_NORMAL);
 }
 
 void Tracking::UpdateLocalMap()
@@ -3529,21 +4748,76 @@ void Tracking::UpdateLocalMap()
     // This is for visualization
     mpAtlas->SetReferenceMapPoints(mvpLocalMapPoints);  // Local Map points들을 활용하여 Reference Map point 지정
 
+    //^ Localization mode: UpdateLocalKeyFrames, UpdateLocalPoints와 같은 결과를 snapshot 배열에서 구한다
+    if(mpFrozenMap)
+    {
+        const bool bLastFrame = mpAtlas->isImuInitialized() && mCurrentFrame.mnId>=mnLastRelocFrameId+2;
+        const bool bTemporal = mSensor==System::IMU_MONOCULAR || mSensor==System::IMU_STEREO;
+        mpFrozenMap->UpdateLocalWindow(bLastFrame ? mLastFrame : mCurrentFrame, mCurrentFrame.mpLastKeyFrame, bTemporal, mFrozenWindow);
+        mbLocalMapCached = false;
+
+        mvpLocalKeyFrames.resize(mFrozenWindow.mvKeyFrames.size());
+        for(size_t i=0; i<mvpLocalKeyFrames.size(); i++)
+            mvpLocalKeyFrames[i] = mpFrozenMap->mvpKeyFrames[mFrozenWindow.mvKeyFrames[i]];
+        mvpLocalMapPoints.resize(mFrozenWindow.mvPoints.size());
+        for(size_t i=0; i<mvpLocalMapPoints.size(); i++)
+            mvpLocalMapPoints[i] = mpFrozenMap->mvpMapPoints[mFrozenWindow.mvPoints[i]];
+
+        if(mFrozenWindow.mnKFMax>=0)
+        {
+            mpReferenceKF = mpFrozenMap->mvpKeyFrames[mFrozenWindow.mnKFMax];
+            mCurrentFrame.mpReferenceKF = mpReferenceKF;
+        }
+        return;
+    }
+
     // Local Key Frames + Local Map Points >>> Local Map
     UpdateLocalKeyFrames(); // Local KeyFrame update
     UpdateLocalPoints();    // Local Map points update
+
+    //^ projection 검색용 연속 배열 갱신: 새 point와 view version이 바뀐 point만 다시 읽는다
+    if(mCurrentFrame.Nleft==-1)
+    {
+        mLocalMirror.Refresh(mvpLocalMapPoints);
+        mnLocalMirrorFrameId = mCurrentFrame.mnId;
+    }
 }
 
 void Tracking::UpdateLocalPoints()
 {
+    //^ local keyframe들과 그 match가 이전 frame과 같다면 이전 local map point들을 재사용 (bad가 된 point만 제거)
+    bool bReuse = mbLocalKeyFramesReused;
+    for(size_t i=0; bReuse && i<mvpLocalKeyFrames.size(); i++)
+        bReuse = mvpLocalKeyFrames[i]->GetMatchesVersion()==mvnLocalKFMatchesVersions[i];
+
+    if(bReuse)
+    {
+        //^ 이전 frame의 spatial point는 버리고 다시 찾는다
+        const size_t nKFPoints = min(mnLocalKFMapPoints, mvpLocalMapPoints.size());
+        size_t nKept = 0;
+        for(size_t i=0; i<nKFPoints; i++)
+        {
+            MapPoint* pMP = mvpLocalMapPoints[i];
+            if(pMP->isBad())
+                continue;
+            pMP->mnTrackReferenceForFrame=mCurrentFrame.mnId;
+            mvpLocalMapPoints[nKept++] = pMP;
+        }
+        mvpLocalMapPoints.resize(nKept);
+        AddSpatialLocalPoints();
+        return;
+    }
+
     mvpLocalMapPoints.clear();  // Map point들이 담겨있는 Vector 초기화
+    mvnLocalKFMatchesVersions.resize(mvpLocalKeyFrames.size());
 
     int count_pts = 0;  // Map Point의 갯수를 count하기 위한 변수
 
     // Local Key Frame을 reverse로 for문 - 최신 Key Frame부터 check하기 위해서
-    for(vector<KeyFrame*>::const_reverse_iterator itKF=mvpLocalKeyFrames.rbegin(), itEndKF=mvpLocalKeyFrames.rend(); itKF!=itEndKF; ++itKF)
+    for(int iKF=static_cast<int>(mvpLocalKeyFrames.size())-1; iKF>=0; iKF--)
     {
-        KeyFrame* pKF = *itKF;
+        KeyFrame* pKF = mvpLocalKeyFrames[iKF];
+        mvnLocalKFMatchesVersions[iKF] = pKF->GetMatchesVersion();  // match를 읽기 전의 version
         const vector<MapPoint*> vpMPs = pKF->GetMapPointMatches();  // Match된 Map point들을 이용하여 vpMPs 변수 초기화
 
         // 하나의 Key Frame에 있는 Map point들을 for문을 이용하여 하나씩 순회
@@ -3563,13 +4837,49 @@ void Tracking::UpdateLocalPoints()
             }
         }
     }
+
+    AddSpatialLocalPoints();
+}
+
+void Tracking::AddSpatialLocalPoints()
+{
+    mnLocalKFMapPoints = mvpLocalMapPoints.size();
+    if(mfSpatialLocalMapRadius<=0.f)
+        return;
+
+    //^ 현재 frame의 frustum 안에서 반경 이내의 point 중 local keyframe이 관측하지 않는 것 (80개 제한 밖의 keyframe, 재방문)
+    const vector<MapPoint*> vpMPs = mpAtlas->GetCurrentMap()->GetMapPointsInFrustum(cv::Matx44f(mCurrentFrame.mTcw),
+        mCurrentFrame.mpCamera, mCurrentFrame.mnMinX, mCurrentFrame.mnMaxX, mCurrentFrame.mnMinY, mCurrentFrame.mnMaxY, mfSpatialLocalMapRadius);
+    for(size_t i=0; i<vpMPs.size(); i++)
+    {
+        MapPoint* pMP = vpMPs[i];
+        if(pMP->mnTrackReferenceForFrame==mCurrentFrame.mnId || pMP->isBad())
+            continue;
+        mvpLocalMapPoints.push_back(pMP);
+        pMP->mnTrackReferenceForFrame=mCurrentFrame.mnId;
+    }
+}
+
+void Tracking::QuerySpatialKeyFrames()
+{
+    mvpSpatialKFs.clear();
+    if(mfSpatialLocalMapRadius<=0.f)
+        return;
+
+    const vector<KeyFrame*> vpKFs = mpAtlas->GetCurrentMap()->GetKeyFramesInRadius(cv::Matx31f(mCurrentFrame.GetCameraCenter()), mfSpatialLocalMapRadius);
+    for(size_t i=0; i<vpKFs.size(); i++)
+        if(!vpKFs[i]->isBad())
+            mvpSpatialKFs.push_back(vpKFs[i]);
+
+    //^ Index는 cell 순서로 돌려주므로 id 순으로 정렬해 이전 frame의 결과와 비교한다
+    sort(mvpSpatialKFs.begin(), mvpSpatialKFs.end(), KeyFrame::lId);
 }
 
 
 void Tracking::UpdateLocalKeyFrames()
 {
     // Each map point vote for the keyframes in which it has been observed
-    map<KeyFrame*,int> keyframeCounter; // <keyFrame, 얼마나 Voting 했는지 count하기 위한 int형> 으로 map 자료구조를 활용하여 변수 선언
+    KeyFrameWeights keyframeCounter; // <keyFrame, 얼마나 Voting 했는지 count하기 위한 int형> 으로 map 자료구조를 활용하여 변수 선언
 
     // Atlas에 IMU가 초기화 되어 있지 않거나, 현재 Current Frame의 ID보다 마지막 Relocalization Frame의 ID +2가 더 클 경우
     if(!mpAtlas->isImuInitialized() || (mCurrentFrame.mnId<mnLastRelocFrameId+2))
@@ -3581,11 +4891,8 @@ void Tracking::UpdateLocalKeyFrames()
             {
                 if(!pMP->isBad())   // Map point가 Good point라면
                 {
-                    const map<KeyFrame*,tuple<int,int>> observations = pMP->GetObservations();
-                    // Current Frame의 Map point를 관찰하고 있는 여러 Keyframe을 observation 변수를 이용하여 저장
-                    // observations에는 현재 Map point를 보고 있는 Keyframe에 대한 index 정보들을 가지고 있다.  
-                    for(map<KeyFrame*,tuple<int,int>>::const_iterator it=observations.begin(), itend=observations.end(); it!=itend; it++)
-                        keyframeCounter[it->first]++;   // Voting을 진행 - for문을 통해서 map point를 보고 있는 Key frame -> 가장 많이 겹쳐져 있는 key frame 선별
+                    // Current Frame의 Map point를 관찰하고 있는 여러 Keyframe에 대해 Voting을 진행 (observation 복사 없이 순회)
+                    pMP->VisitObservations([&keyframeCounter](KeyFrame* pKFi, const std::tuple<int,int>&){keyframeCounter[pKFi]++;});
                 }
                 else    // Map point가 Bad point라면
                 {
@@ -3607,11 +4914,8 @@ void Tracking::UpdateLocalKeyFrames()
                     continue;   // Skip
                 if(!pMP->isBad())   // Map point가 Good point라면
                 {
-                    const map<KeyFrame*,tuple<int,int>> observations = pMP->GetObservations();
-                    // Last Frame의 Map point를 관찰하고 있는 여러 Keyframe을 observation 변수를 이용하여 저장
-                    // observations에는 현재 Map point를 보고 있는 Keyframe에 대한 index 정보들을 가지고 있다. 
-                    for(map<KeyFrame*,tuple<int,int>>::const_iterator it=observations.begin(), itend=observations.end(); it!=itend; it++)
-                        keyframeCounter[it->first]++;   // Voting을 진행 - for문을 통해서 map point를 보고 있는 Key frame -> 가장 많이 겹쳐져 있는 key frame 선별
+                    // Last Frame의 Map point를 관찰하고 있는 여러 Keyframe에 대해 Voting을 진행 (observation 복사 없이 순회)
+                    pMP->VisitObservations([&keyframeCounter](KeyFrame* pKFi, const std::tuple<int,int>&){keyframeCounter[pKFi]++;});
                 }
                 else    // Map point가 Bad point라면
                 {
@@ -3624,11 +4928,9 @@ void Tracking::UpdateLocalKeyFrames()
     int max=0;
     KeyFrame* pKFmax= static_cast<KeyFrame*>(NULL);
 
-    mvpLocalKeyFrames.clear();
-    mvpLocalKeyFrames.reserve(3*keyframeCounter.size());
-
     // All keyframes that observe a map point are included in the local map. Also check which keyframe shares most points
-    for(map<KeyFrame*,int>::const_iterator it=keyframeCounter.begin(), itEnd=keyframeCounter.end(); it!=itEnd; it++)
+    mvpVotedKFs.clear();
+    for(KeyFrameWeights::const_iterator it=keyframeCounter.begin(), itEnd=keyframeCounter.end(); it!=itEnd; it++)
     {
         KeyFrame* pKF = it->first;  // Key Frame을 pointer 변수를 활용하여 지정
 
@@ -3641,86 +4943,138 @@ void Tracking::UpdateLocalKeyFrames()
             pKFmax=pKF;
         }
 
-        mvpLocalKeyFrames.push_back(pKF);   // Key Frame을 Local Key Frame Vector에 담는다.  
-        pKF->mnTrackReferenceForFrame = mCurrentFrame.mnId; // 
+        mvpVotedKFs.push_back(pKF);
     }
 
-    // Include also some not-already-included keyframes that are neighbors to already-included keyframes
-    // Local Key Frame의 for문을 돌면서 인접한 포함되어 있지 않은 key frame을 포함시킨다.
-    for(vector<KeyFrame*>::const_iterator itKF=mvpLocalKeyFrames.begin(), itEndKF=mvpLocalKeyFrames.end(); itKF!=itEndKF; itKF++)
+    //^ Covisibility로 연결되지 않은 keyframe도 현재 camera 주변에 있으면 local keyframe이 된다
+    QuerySpatialKeyFrames();
+
+    const bool bTemporal = mSensor == System::IMU_MONOCULAR || mSensor == System::IMU_STEREO;
+    KeyFrame* pLastKF = bTemporal ? mCurrentFrame.mpLastKeyFrame : static_cast<KeyFrame*>(NULL);
+
+    //^ 투표 결과, 주변 keyframe과 local keyframe들의 graph가 이전 frame과 같다면 확장 결과도 같으므로 이전 local keyframe을 재사용
+    mbLocalKeyFramesReused = mbLocalMapCached && pKFmax==mpLocalMapKFmax && pLastKF==mpLocalMapLastKF && mvpVotedKFs==mvpLocalMapVotedKFs &&
+                             mvpSpatialKFs==mvpLocalMapSpatialKFs;
+    for(size_t i=0; mbLocalKeyFramesReused && i<mvpLocalKeyFrames.size(); i++)
+        mbLocalKeyFramesReused = mvpLocalKeyFrames[i]->GetGraphVersion()==mvnLocalKFGraphVersions[i];
+
+    if(mbLocalKeyFramesReused)
     {
-        // Limit the number of keyframes
-        if(mvpLocalKeyFrames.size()>80) // Key Frame Vector의 Size가 80이 넘는다면
-            break;  // for문을 빠져 나온다.
+        for(size_t i=0; i<mvpLocalKeyFrames.size(); i++)
+            mvpLocalKeyFrames[i]->mnTrackReferenceForFrame = mCurrentFrame.mnId;
+    }
+    else
+    {
+        mvpLocalMapVotedKFs.swap(mvpVotedKFs);
+        mvpLocalMapSpatialKFs.swap(mvpSpatialKFs);
+        mpLocalMapKFmax = pKFmax;
+        mpLocalMapLastKF = pLastKF;
 
-        KeyFrame* pKF = *itKF;
+        mvpLocalKeyFrames.clear();
+        mvpLocalKeyFrames.reserve(3*mvpLocalMapVotedKFs.size());
+        mvnLocalKFGraphVersions.clear();
+        mvnLocalKFGraphVersions.reserve(3*mvpLocalMapVotedKFs.size());
 
-        const vector<KeyFrame*> vNeighs = pKF->GetBestCovisibilityKeyFrames(10);    // N은 size, 가장 좋은 Covisibility를 가지고 있는 keyframe
+        for(size_t i=0; i<mvpLocalMapVotedKFs.size(); i++)
+        {
+            mvpLocalKeyFrames.push_back(mvpLocalMapVotedKFs[i]);   // Key Frame을 Local Key Frame Vector에 담는다.  
+            mvpLocalMapVotedKFs[i]->mnTrackReferenceForFrame = mCurrentFrame.mnId;
+        }
 
-        // for문을 이용하여 좋은 Covisibility를 가지고 있는 KeyFrame 순회
-        for(vector<KeyFrame*>::const_iterator itNeighKF=vNeighs.begin(), itEndNeighKF=vNeighs.end(); itNeighKF!=itEndNeighKF; itNeighKF++)
+        //^ 주변 keyframe도 확장의 시작점이 된다
+        for(size_t i=0; i<mvpLocalMapSpatialKFs.size(); i++)
         {
-            KeyFrame* pNeighKF = *itNeighKF;
-            if(!pNeighKF->isBad())  // 좋은 Key Frame이라면
+            KeyFrame* pKF = mvpLocalMapSpatialKFs[i];
+            if(pKF->mnTrackReferenceForFrame==mCurrentFrame.mnId)
+                continue;
+            mvpLocalKeyFrames.push_back(pKF);
+            pKF->mnTrackReferenceForFrame = mCurrentFrame.mnId;
+        }
+
+        // Include also some not-already-included keyframes that are neighbors to already-included keyframes
+        // Local Key Frame의 for문을 돌면서 인접한 포함되어 있지 않은 key frame을 포함시킨다.
+        // (vector가 늘어나므로 iterator 대신 index로 순회)
+        for(size_t iKF=0; iKF<mvpLocalKeyFrames.size(); iKF++)
+        {
+            // Limit the number of keyframes
+            if(mvpLocalKeyFrames.size()>80) // Key Frame Vector의 Size가 80이 넘는다면
+                break;  // for문을 빠져 나온다.
+
+            KeyFrame* pKF = mvpLocalKeyFrames[iKF];
+            mvnLocalKFGraphVersions.push_back(pKF->GetGraphVersion());  // graph를 읽기 전의 version
+
+            const vector<KeyFrame*> vNeighs = pKF->GetBestCovisibilityKeyFrames(10);    // N은 size, 가장 좋은 Covisibility를 가지고 있는 keyframe
+
+            // for문을 이용하여 좋은 Covisibility를 가지고 있는 KeyFrame 순회
+            for(vector<KeyFrame*>::const_iterator itNeighKF=vNeighs.begin(), itEndNeighKF=vNeighs.end(); itNeighKF!=itEndNeighKF; itNeighKF++)
             {
-                if(pNeighKF->mnTrackReferenceForFrame!=mCurrentFrame.mnId)
-                // 인접한 Key frame의 Reference Frame의 ID를 현재 current frame의 ID와 같지 않다면
+                KeyFrame* pNeighKF = *itNeighKF;
+                if(!pNeighKF->isBad())  // 좋은 Key Frame이라면
                 {
-                    mvpLocalKeyFrames.push_back(pNeighKF);  // 인접한 Key frame도 Local key frame으로 집어넣기
-                    pNeighKF->mnTrackReferenceForFrame=mCurrentFrame.mnId;  // 인접한 Key Frame의 Reference Frame을 Current Frame의 ID로 대입
-                    break;  // 인접한 Key Frame 순회 break;
+                    if(pNeighKF->mnTrackReferenceForFrame!=mCurrentFrame.mnId)
+                    // 인접한 Key frame의 Reference Frame의 ID를 현재 current frame의 ID와 같지 않다면
+                    {
+                        mvpLocalKeyFrames.push_back(pNeighKF);  // 인접한 Key frame도 Local key frame으로 집어넣기
+                        pNeighKF->mnTrackReferenceForFrame=mCurrentFrame.mnId;  // 인접한 Key Frame의 Reference Frame을 Current Frame의 ID로 대입
+                        break;  // 인접한 Key Frame 순회 break;
+                    }
                 }
             }
-        }
 
-        const set<KeyFrame*> spChilds = pKF->GetChilds();   // Covisibility Graph 중 자식 노드에 해당하는 Key Frame 집합을 가져온다.
-        // for문을 이용하여 좋은 Covisibility를 가지고 있는 자식 노드 KeyFrame 순회
-        for(set<KeyFrame*>::const_iterator sit=spChilds.begin(), send=spChilds.end(); sit!=send; sit++)
-        {
-            KeyFrame* pChildKF = *sit;
-            if(!pChildKF->isBad())  // 좋은 Key Frame이라면
+            const set<KeyFrame*> spChilds = pKF->GetChilds();   // Covisibility Graph 중 자식 노드에 해당하는 Key Frame 집합을 가져온다.
+            // for문을 이용하여 좋은 Covisibility를 가지고 있는 자식 노드 KeyFrame 순회
+            for(set<KeyFrame*>::const_iterator sit=spChilds.begin(), send=spChilds.end(); sit!=send; sit++)
             {
-                if(pChildKF->mnTrackReferenceForFrame!=mCurrentFrame.mnId)
-                // 자식 노드 Key frame의 Reference Frame의 ID를 현재 current frame의 ID와 같지 않다면
+                KeyFrame* pChildKF = *sit;
+                if(!pChildKF->isBad())  // 좋은 Key Frame이라면
                 {
-                    mvpLocalKeyFrames.push_back(pChildKF);  // 자식 노드 Key frame도 Local key frame으로 집어넣기
-                    pChildKF->mnTrackReferenceForFrame=mCurrentFrame.mnId;  // 자식 노드 Key Frame의 Reference Frame을 Current Frame의 ID로 대입
-                    break;  // 자식 노드 Key Frame 순회 break;
+                    if(pChildKF->mnTrackReferenceForFrame!=mCurrentFrame.mnId)
+                    // 자식 노드 Key frame의 Reference Frame의 ID를 현재 current frame의 ID와 같지 않다면
+                    {
+                        mvpLocalKeyFrames.push_back(pChildKF);  // 자식 노드 Key frame도 Local key frame으로 집어넣기
+                        pChildKF->mnTrackReferenceForFrame=mCurrentFrame.mnId;  // 자식 노드 Key Frame의 Reference Frame을 Current Frame의 ID로 대입
+                        break;  // 자식 노드 Key Frame 순회 break;
+                    }
                 }
             }
-        }
 
-        KeyFrame* pParent = pKF->GetParent();    // Covisibility Graph 중 부모 노드에 해당하는 Key Frame 집합을 가져온다.
-        if(pParent) // 부모 노드 Key Frame이 존재한다면
-        {
-            if(pParent->mnTrackReferenceForFrame!=mCurrentFrame.mnId)
-            // 부모 노드 Key frame의 Reference Frame의 ID를 현재 current frame의 ID와 같지 않다면
+            KeyFrame* pParent = pKF->GetParent();    // Covisibility Graph 중 부모 노드에 해당하는 Key Frame 집합을 가져온다.
+            if(pParent) // 부모 노드 Key Frame이 존재한다면
             {
-                mvpLocalKeyFrames.push_back(pParent);   // 부모 노드 Key frame도 Local key frame으로 집어넣기
-                pParent->mnTrackReferenceForFrame=mCurrentFrame.mnId;   // 부모 노드 Key Frame의 Reference Frame을 Current Frame의 ID로 대입
-                break;  // for문을 빠져 나온다.
+                if(pParent->mnTrackReferenceForFrame!=mCurrentFrame.mnId)
+                // 부모 노드 Key frame의 Reference Frame의 ID를 현재 current frame의 ID와 같지 않다면
+                {
+                    mvpLocalKeyFrames.push_back(pParent);   // 부모 노드 Key frame도 Local key frame으로 집어넣기
+                    pParent->mnTrackReferenceForFrame=mCurrentFrame.mnId;   // 부모 노드 Key Frame의 Reference Frame을 Current Frame의 ID로 대입
+                    break;  // for문을 빠져 나온다.
+                }
             }
         }
-    }
 
-    // Add 10 last temporal KFs (mainly for IMU)
-    // IMU모드일 때 임시적인 key frame을 update
-    if((mSensor == System::IMU_MONOCULAR || mSensor == System::IMU_STEREO) &&mvpLocalKeyFrames.size()<80)
-    {
-        KeyFrame* tempKeyFrame = mCurrentFrame.mpLastKeyFrame;  // Current Frame에서 Last Key Frame을 임시 Key Frame으로 저장
+        // Add 10 last temporal KFs (mainly for IMU)
+        // IMU모드일 때 임시적인 key frame을 update
+        if(bTemporal && mvpLocalKeyFrames.size()<80)
+        {
+            KeyFrame* tempKeyFrame = mCurrentFrame.mpLastKeyFrame;  // Current Frame에서 Last Key Frame을 임시 Key Frame으로 저장
 
-        const int Nd = 20;
-        for(int i=0; i<Nd; i++){
-            if (!tempKeyFrame)
-                break;
-            if(tempKeyFrame->mnTrackReferenceForFrame!=mCurrentFrame.mnId)
-            // 임시 노드 Key frame의 Reference Frame의 ID를 현재 current frame의 ID와 같지 않다면
-            {
-                mvpLocalKeyFrames.push_back(tempKeyFrame);  // 임시 노드 Key frame도 Local key frame으로 집어넣기
-                tempKeyFrame->mnTrackReferenceForFrame=mCurrentFrame.mnId;  // 임시 노드 Key Frame의 Reference Frame을 Current Frame의 ID로 대입
-                tempKeyFrame=tempKeyFrame->mPrevKF; // 순회를 위해 Temp Key Frame의 이전 Key Frame을 대입
+            const int Nd = 20;
+            for(int i=0; i<Nd; i++){
+                if (!tempKeyFrame)
+                    break;
+                if(tempKeyFrame->mnTrackReferenceForFrame!=mCurrentFrame.mnId)
+                // 임시 노드 Key frame의 Reference Frame의 ID를 현재 current frame의 ID와 같지 않다면
+                {
+                    mvpLocalKeyFrames.push_back(tempKeyFrame);  // 임시 노드 Key frame도 Local key frame으로 집어넣기
+                    tempKeyFrame->mnTrackReferenceForFrame=mCurrentFrame.mnId;  // 임시 노드 Key Frame의 Reference Frame을 Current Frame의 ID로 대입
+                    tempKeyFrame=tempKeyFrame->mPrevKF; // 순회를 위해 Temp Key Frame의 이전 Key Frame을 대입
+                }
             }
         }
+
+        //^ graph를 읽지 않은 keyframe (확장 전에 멈춘 경우)은 현재 version을 기록
+        for(size_t iKF=mvnLocalKFGraphVersions.size(); iKF<mvpLocalKeyFrames.size(); iKF++)
+            mvnLocalKFGraphVersions.push_back(mvpLocalKeyFrames[iKF]->GetGraphVersion());
+        mbLocalMapCached = true;
     }
 
     if(pKFmax)  // voting을 통해 선별된 가장 좋은 Key frame
@@ -3730,7 +5084,7 @@ void Tracking::UpdateLocalKeyFrames()
     }
 }
 
-bool Tracking::Relocalization()
+bool Tracking::Relocalization(const KeyFrameDatabase::eMapScope scope, KeyFrame** ppMatchedKF)
 {
     Verbose::PrintMess("Starting relocalization", Verbose::VERBOSITY_NORMAL);
     // Compute Bag of Words Vector
@@ -3742,7 +5096,7 @@ bool Tracking::Relocalization()
     // Track Lost: Query KeyFrame Database for keyframe candidates for relocalisation
     //^ Atlas에 있는 CurrentMap으로 부터 CurrentFrame의 BoW를 공유하는 KeyFrame들 중에서,
     //^ similarity score가 75% 이상인 KeyFrame들을 Relocalization 후보 Keyframe으로 뽑는다. 
-    vector<KeyFrame*> vpCandidateKFs = mpKeyFrameDB->DetectRelocalizationCandidates(&mCurrentFrame, mpAtlas->GetCurrentMap());
+    vector<KeyFrame*> vpCandidateKFs = mpKeyFrameDB->DetectRelocalizationCandidates(&mCurrentFrame, mpAtlas->GetCurrentMap(), scope);
 
     //^ 후보 KeyFrame이 없으면 Relocalization fail.
     if(vpCandidateKFs.empty()) {
@@ -3750,192 +5104,184 @@ bool Tracking::Relocalization()
         return false;
     }
 
-    const int nKFs = vpCandidateKFs.size();
-
-    // We perform first an ORB matching with each candidate
-    // If enough matches are found we setup a PnP solver
-    ORBmatcher matcher(0.75,true);
+    //^ 다른 map의 후보는 그 map이 disk로 내려갔을 수 있으므로 먼저 memory로 읽어온다.
+    //^ Lease는 Relocalization이 끝날 때까지 유지되어, 검증 중에 Loop Closing이 그 map을 다시 내리지 않는다
+    Atlas::ResidencyLease residencyLease(mpAtlas);
+    if(scope!=KeyFrameDatabase::ONLY_MAP)
+    {
+        set<Map*> spMaps;
+        for(size_t i=0; i<vpCandidateKFs.size(); i++)
+            spMaps.insert(vpCandidateKFs[i]->GetMap());
+        for(set<Map*>::iterator sit=spMaps.begin(); sit!=spMaps.end(); sit++)
+            residencyLease.Add(*sit);
+    }
 
-    vector<MLPnPsolver*> vpMLPnPsolvers;
-    vpMLPnPsolvers.resize(nKFs);
+    //^ 후보가 많으면 RelocalizationCache(관측 수가 많은 point의 descriptor 일부)로 먼저 순위를 매기고,
+    //^ 상위 mnRelocCandidates개만 전체 matching과 MLPnP로 검증한다
+    if(mnRelocCandidates>0 && int(vpCandidateKFs.size())>mnRelocCandidates)
+        RankRelocalizationCandidates(vpCandidateKFs);
 
-    
-    vector<vector<MapPoint*> > vvpMapPointMatches;
-    vvpMapPointMatches.resize(nKFs);
+    const int nKFs = vpCandidateKFs.size();
 
-    vector<bool> vbDiscarded;
-    vbDiscarded.resize(nKFs);
+    //^ Tiled map에서는 후보 KeyFrame들의 feature를 병렬 검증 전에 memory로 읽어온다
+    if(mpTileStreamer && mbOnlyTracking)
+        for(int i=0; i<nKFs; i++)
+            mpTileStreamer->EnsureResident(vpCandidateKFs[i]);
 
-    int nCandidates=0;
+    //^ 후보 KeyFrame마다 (BoW matching -> MLPnP RANSAC -> pose optimization) 검증을 독립적으로 수행하며,
+    //^ thread pool에서 후보들을 병렬로 처리한다. 한 후보가 성공하면 나머지 후보는 다음 RANSAC 단계에서 중단된다.
+    //^ 각 후보는 CurrentFrame의 복사본에서 pose를 최적화하고, 성공한 후보의 결과만 CurrentFrame에 반영한다.
+    std::atomic<bool> bMatch(false);
+    std::mutex mutexMatch;
+    Frame relocFrame;
+    KeyFrame* pRelocKF = static_cast<KeyFrame*>(NULL);
 
-    //^ 전체 후보 KeyFrame에 대해서,
-    for(int i=0; i<nKFs; i++)
+    auto verifyCandidate = [&](int i)
     {
         KeyFrame* pKF = vpCandidateKFs[i];
+        //^ Localization mode에서는 snapshot에 있는 KeyFrame의 point를 lock 없이 읽는다 (bad KeyFrame은 snapshot에 없음)
+        const int nFrozenKF = mpFrozenMap ? mpFrozenMap->KeyFrameIndex(pKF) : -1;
         //^ KeyFrame이 Bad면 discard
         //^ Bad의 의미 : 버려지는 KeyFrame, 어디선가 erase되어 메모리 해제를 기다리는 KeyFrame
-        if(pKF->isBad())
-            vbDiscarded[i] = true;
-        else
-        {
-            //^ 후보 KeyFrame의 descriptor와 CurrentFrame의 descriptor 간 matching
-            //^ vvpMapPointMatches에는 matching된 MapPoint가 담김.
-            int nmatches = matcher.SearchByBoW(pKF,mCurrentFrame,vvpMapPointMatches[i]);
-            
-            //^ match된 MapPoint가 적으면 discard
-            if(nmatches<15)
-            {
-                vbDiscarded[i] = true;
-                continue;
-            }
-            //^ match된 MapPoint가 충분하면,
-            else
-            {
-                //^ Solve PnP
-                //^ Camera의 intrinsic parameter,
-                //^ World coordinate 상의 3차원 Points,
-                //^ Image(Frame) 상의 2차원 Points
-                //^ 를 알고 있을 때 Camera pose를 예측하는 solver
-                //^ MLPnP : Maximum Likelihood solution to the Perspective-n-Point
-                MLPnPsolver* pSolver = new MLPnPsolver(mCurrentFrame,vvpMapPointMatches[i]);
-                pSolver->SetRansacParameters(0.99,10,300,6,0.5,5.991);  //This solver needs at least 6 points
-                //^ PnPsolver 객체를 현재 KeyFrame index에 저장
-                vpMLPnPsolvers[i] = pSolver;
-                nCandidates++;
-            }
-        }
-    }
-    //^ Vector 상세 설명
-    //^ 후보 KeyFrame (vpCandidateKFs)          : [a, b, c, d, e, f ...] 
-    //^ Discarded KeyFrame (vbDiscarded)        : [1, 1, 0, 1, 0, 0 ...], 0: FALSE, 1: TRUE
-    //^ MLPnPSovler 객체 (vpMLPnPsolvers)       : [-, -, S, -, S, S ...], -: NULL, S: 객체
-    //^ Match된 MapPoint (vvpMapPointMatches)   : [-, -, M, -, M, M ... ], -: NULL, M: Match된 MapPoints vector(KF의 MapPoints)  
+        if(bMatch || (nFrozenKF<0 && pKF->isBad()))
+            return;
 
-    // Alternatively perform some iterations of P4P RANSAC
-    // Until we found a camera pose supported by enough inliers
-    bool bMatch = false;
-    ORBmatcher matcher2(0.9,true);
+        // We perform first an ORB matching with each candidate
+        // If enough matches are found we setup a PnP solver
+        // (the matchers keep scratch buffers, so there is one per candidate)
+        ORBmatcher matcher(0.75,true);
 
-    //^ 후보 MLPnPsolver가 없거나 Match될 때까지,
-    while(nCandidates>0 && !bMatch)
-    {
-        //^ 후보 KeyFrame들에 대해서,
-        for(int i=0; i<nKFs; i++)
-        {
-            //^ Discarded KeyFrame은 skip
-            if(vbDiscarded[i])
-                continue;
+        //^ 후보 KeyFrame의 descriptor와 CurrentFrame의 descriptor 간 matching
+        //^ vpMapPointMatches에는 matching된 MapPoint가 담김.
+        vector<MapPoint*> vpMapPointMatches;
+        int nmatches = nFrozenKF>=0 ? matcher.SearchByBoW(*mpFrozenMap,nFrozenKF,mCurrentFrame,vpMapPointMatches)
+                                    : matcher.SearchByBoW(pKF,mCurrentFrame,vpMapPointMatches);
+
+        //^ match된 MapPoint가 적으면 discard
+        if(nmatches<15)
+            return;
 
+        //^ Solve PnP
+        //^ Camera의 intrinsic parameter, World coordinate 상의 3차원 Points, Image(Frame) 상의 2차원 Points
+        //^ 를 알고 있을 때 Camera pose를 예측하는 solver
+        //^ MLPnP : Maximum Likelihood solution to the Perspective-n-Point
+        //^ solver는 thread마다 하나를 두고 후보마다 Reset하여 buffer를 재사용한다 (RANSAC 중 memory 할당 없음)
+        static thread_local MLPnPsolver solver;
+        solver.Reset(mCurrentFrame,vpMapPointMatches);
+        solver.SetRansacParameters(0.99,10,300,6,0.5,5.991);  //This solver needs at least 6 points
+        solver.SetSamplingStrategy(RansacSampler::PROSAC,true);
+
+        Frame frame(mCurrentFrame);
+        ORBmatcher matcher2(0.9,true);
+
+        // Perform some iterations of P4P RANSAC at a time
+        // Until we found a camera pose supported by enough inliers
+        bool bNoMore = false;
+        while(!bNoMore && !bMatch)
+        {
             // Perform 5 Ransac Iterations
             vector<bool> vbInliers;
             int nInliers;
-            bool bNoMore;
 
-            //^ Match된 MapPoint들(vvpMapPointMatches)에 대해서
-            //^ 5 iterate RANSAC 수행
             //^ Tcw : RANSAC을 통해 나온 Camera pose
-            MLPnPsolver* pSolver = vpMLPnPsolvers[i];
-            cv::Mat Tcw = pSolver->iterate(5,bNoMore,vbInliers,nInliers);
-
-            //^ RANSAC Fail (1. over iteration, 2. MapPoints가 6개보다 작을 때)
-            // If Ransac reachs max. iterations discard keyframe
-            if(bNoMore)
-            {
-                vbDiscarded[i]=true;
-                nCandidates--;
-            }
+            //^ bNoMore : RANSAC Fail (1. over iteration, 2. MapPoints가 6개보다 작을 때) -> 이 후보는 discard
+            cv::Mat Tcw = solver.iterate(5,bNoMore,vbInliers,nInliers);
 
-            //^ RANSAC 성공
             // If a Camera Pose is computed, optimize
-            if(!Tcw.empty())
-            {
-                //^ RANSAC 결과 Camera Pose를 CurrentFrame의 pose로 copy
-                Tcw.copyTo(mCurrentFrame.mTcw);
+            if(Tcw.empty())
+                continue;
+
+            //^ RANSAC 결과 Camera Pose를 Frame의 pose로 copy
+            Tcw.copyTo(frame.mTcw);
 
-                set<MapPoint*> sFound; 
+            set<MapPoint*> sFound;
 
-                const int np = vbInliers.size();
+            const int np = vbInliers.size();
 
-                //^ RANSAC inlier들에 대해서,
-                for(int j=0; j<np; j++)
+            //^ RANSAC inlier들만 Frame에서 match된 MapPoint로 남김 (sFound: 중복 없음)
+            for(int j=0; j<np; j++)
+            {
+                if(vbInliers[j])
                 {
-                    //^ Inlier 이면,
-                    if(vbInliers[j])
-                    {
-                        //^ 해당 index의 MapPoint는 CurrentFrame에서 match된 MapPoint.
-                        mCurrentFrame.mvpMapPoints[j]=vvpMapPointMatches[i][j];
-                        //^ sFound(std::set) : Match된 MapPoint들 중에서 RANSAC의 inlier는 Found로 간주(중복 없음) 
-                        sFound.insert(vvpMapPointMatches[i][j]);
-                    }
-                    //^ Inlier가 아니면,
-                    else
-                        //^ 해당 index의 MapPoint는 CurrentFrame에서 NULL
-                        mCurrentFrame.mvpMapPoints[j]=NULL;
+                    frame.mvpMapPoints[j]=vpMapPointMatches[j];
+                    sFound.insert(vpMapPointMatches[j]);
                 }
-                
-                //^ Match된 MapPoint들로 graph를 이루고 graph optimization을 통해 camera pose를 구함.
-                //^ nGood : nInitialCorrespondences-nBad
-                //^ -> Initial vertex 갯수(nInitialCorrespondences)에서 optimization 결과 outlier(nBad)로 판명난 vertex 갯수를 뺀 값
-                int nGood = Optimizer::PoseOptimization(&mCurrentFrame);
+                else
+                    frame.mvpMapPoints[j]=NULL;
+            }
 
-                //^ nGood이 너무 적으면 다음 KeyFrame으로
-                if(nGood<10)
-                    continue;
+            //^ nGood : Initial vertex 갯수에서 optimization 결과 outlier로 판명난 vertex 갯수를 뺀 값
+            int nGood = Optimizer::PoseOptimization(&frame);
+
+            //^ nGood이 너무 적으면 RANSAC 계속
+            if(nGood<10)
+                continue;
+
+            for(int io =0; io<frame.N; io++)
+                if(frame.mvbOutlier[io])
+                    frame.mvpMapPoints[io]=static_cast<MapPoint*>(NULL);
 
-                //^ Outlier로 판명난 KeyPoint들은 set NULL.
-                for(int io =0; io<mCurrentFrame.N; io++)
-                    if(mCurrentFrame.mvbOutlier[io])
-                        mCurrentFrame.mvpMapPoints[io]=static_cast<MapPoint*>(NULL);
+            // If few inliers, search by projection in a coarse window and optimize again
+            if(nGood<50)
+            {
+                int nadditional = nFrozenKF>=0 ? matcher2.SearchByProjection(frame,*mpFrozenMap,nFrozenKF,sFound,10,100)
+                                               : matcher2.SearchByProjection(frame,pKF,sFound,10,100);
 
-                //^ nGood이 아쉬우면 한번 더
-                // If few inliers, search by projection in a coarse window and optimize again
-                if(nGood<50)
+                if(nadditional+nGood>=50)
                 {
-                    //^ ORB matcher의 parameter 조금더 느슨하게 해서 match되는 MapPoint 추가로 찾음
-                    int nadditional =matcher2.SearchByProjection(mCurrentFrame,vpCandidateKFs[i],sFound,10,100);
+                    nGood = Optimizer::PoseOptimization(&frame);
 
-                    //^ 추가로 match된 MapPoint와 nGood이 50이 넘으면,
-                    if(nadditional+nGood>=50)
+                    // If many inliers but still not enough, search by projection again in a narrower window
+                    // the camera has been already optimized with many points
+                    if(nGood>30 && nGood<50)
                     {
-                        //^ 한번 더 optimize
-                        nGood = Optimizer::PoseOptimization(&mCurrentFrame);
-
-                        //^ 한번 더..
-                        // If many inliers but still not enough, search by projection again in a narrower window
-                        // the camera has been already optimized with many points
-                        if(nGood>30 && nGood<50)
+                        sFound.clear();
+                        for(int ip =0; ip<frame.N; ip++)
+                            if(frame.mvpMapPoints[ip])
+                                sFound.insert(frame.mvpMapPoints[ip]);
+                        nadditional = nFrozenKF>=0 ? matcher2.SearchByProjection(frame,*mpFrozenMap,nFrozenKF,sFound,3,64)
+                                                   : matcher2.SearchByProjection(frame,pKF,sFound,3,64);
+
+                        // Final optimization
+                        if(nGood+nadditional>=50)
                         {
-                            sFound.clear();
-                            for(int ip =0; ip<mCurrentFrame.N; ip++)
-                                if(mCurrentFrame.mvpMapPoints[ip])
-                                    sFound.insert(mCurrentFrame.mvpMapPoints[ip]);
-                            //^ 이번엔 parameter 빡세게(이미 많은 points들이 optimized 되었기 때문)
-                            nadditional =matcher2.SearchByProjection(mCurrentFrame,vpCandidateKFs[i],sFound,3,64);
-
-                            //^ 진짜 마지막..
-                            // Final optimization
-                            if(nGood+nadditional>=50)
-                            {
-                                nGood = Optimizer::PoseOptimization(&mCurrentFrame);
+                            nGood = Optimizer::PoseOptimization(&frame);
 
-                                for(int io =0; io<mCurrentFrame.N; io++)
-                                    if(mCurrentFrame.mvbOutlier[io])
-                                        mCurrentFrame.mvpMapPoints[io]=NULL;
-                            }
+                            for(int io =0; io<frame.N; io++)
+                                if(frame.mvbOutlier[io])
+                                    frame.mvpMapPoints[io]=NULL;
                         }
                     }
                 }
+            }
 
-                //^ Good match
-                // If the pose is supported by enough inliers stop ransacs and continue
-                if(nGood>=50)
+            // If the pose is supported by enough inliers stop ransacs and continue
+            if(nGood>=50)
+            {
+                //^ 가장 먼저 성공한 후보의 결과를 사용하고, 다른 후보들은 중단
+                unique_lock<mutex> lock(mutexMatch);
+                if(!bMatch)
                 {
+                    relocFrame = frame;
+                    pRelocKF = pKF;
                     bMatch = true;
-                    //^ 다른 후보 KeyFrame 볼 것도 없이 break (이 정도면 relocalization 성공)
-                    break;
                 }
+                return;
             }
         }
+    };
+
+    if(mpThreadPool && nKFs>1)
+        mpThreadPool->ParallelFor(0,nKFs,verifyCandidate);
+    else
+        for(int i=0; i<nKFs; i++)
+            verifyCandidate(i);
+
+    if(bMatch)
+    {
+        mCurrentFrame.SetPose(relocFrame.mTcw);
+        mCurrentFrame.mvpMapPoints = relocFrame.mvpMapPoints;
+        mCurrentFrame.mvbOutlier = relocFrame.mvbOutlier;
     }
 
     //^ Good match가 없음.
@@ -3947,22 +5293,91 @@ bool Tracking::Relocalization()
     else
     {
         mnLastRelocFrameId = mCurrentFrame.mnId;
+        if(ppMatchedKF)
+            *ppMatchedKF = pRelocKF;
         cout << "Relocalized!!" << endl;
         return true;
     }
 }
 
+bool Tracking::RelocalizationInAtlas()
+{
+    if(mpAtlas->CountMaps()<2 || mCurrentFrame.N==0)
+        return false;
+
+    Map* pLostMap = mpAtlas->GetCurrentMap();
+    KeyFrame* pKF = static_cast<KeyFrame*>(NULL);
+    if(!Relocalization(KeyFrameDatabase::OTHER_MAPS,&pKF))
+        return false;
+
+    //^ 찾은 map을 active map으로 바꾸고, 잃어버린 map의 keyframe을 가리키는 상태를 찾은 keyframe으로 옮긴다
+    Map* pMap = pKF->GetMap();
+    mpAtlas->ChangeMap(pMap);
+    cout << "Relocalized in map " << pMap->GetId() << " (lost in map " << pLostMap->GetId() << ")" << endl;
+
+    mpReferenceKF = pKF;
+    mpLastKeyFrame = pKF;
+    mnLastKeyFrameId = mCurrentFrame.mnId;
+    mCurrentFrame.mpReferenceKF = pKF;
+    mVelocity = cv::Mat();
+    mbVO = false;
+    mbLocalMapCached = false;
+    return true;
+}
+
+void Tracking::RankRelocalizationCandidates(vector<KeyFrame*> &vpCandidateKFs)
+{
+    ORB_TRACE_SCOPE("Tracking::RankRelocalizationCandidates");
+    const RelocalizationCache::Query query(mCurrentFrame);
+    const int nKFs = vpCandidateKFs.size();
+    vector<pair<int,int> > vScoreAndIdx(nKFs);
+
+    auto scoreCandidate = [&](int i)
+    {
+        KeyFrame* pKF = vpCandidateKFs[i];
+        std::shared_ptr<const RelocalizationCache> pCache = pKF->GetRelocalizationCache();
+        //^ Tiled map에서 cache 없이 feature가 내려간 KeyFrame은 한 번만 읽어와서 cache를 만든다
+        if(!pCache && mpTileStreamer && !pKF->isBad())
+        {
+            mpTileStreamer->EnsureResident(pKF);
+            pCache = pKF->GetRelocalizationCache();
+        }
+        vScoreAndIdx[i] = make_pair(pCache ? pCache->Score(query,ORBmatcher::TH_LOW) : 0, i);
+    };
+
+    if(mpThreadPool && nKFs>1)
+        mpThreadPool->ParallelFor(0,nKFs,scoreCandidate);
+    else
+        for(int i=0; i<nKFs; i++)
+            scoreCandidate(i);
+
+    // Ties keep the order of the database
+    std::stable_sort(vScoreAndIdx.begin(), vScoreAndIdx.end(),
+                     [](const pair<int,int> &a, const pair<int,int> &b){ return a.first>b.first; });
+
+    vector<KeyFrame*> vpBest(mnRelocCandidates);
+    for(int i=0; i<mnRelocCandidates; i++)
+        vpBest[i] = vpCandidateKFs[vScoreAndIdx[i].second];
+    vpCandidateKFs.swap(vpBest);
+}
+
 void Tracking::Reset(bool bLocMap)
 {
     Verbose::PrintMess("System Reseting", Verbose::VERBOSITY_NORMAL);
 
+    if(mpTileStreamer)
+        mpTileStreamer->Clear();
+
     if(mpViewer) //mpViewer가 실해되고있을때 실행됩니다. 
     {
         mpViewer->RequestStop(); //mpViewer를 중단합니다. 
-        while(!mpViewer->isStopped()) //mpViewer가 중단됬는지 확인합니다. 
-            usleep(3000);
+        mpViewer->WaitUntilStopped(); //mpViewer가 중단될 때까지 대기합니다. 
     }
 
+    //^ Local Mapping이 queue의 keyframe을 삭제하기 전에 writer가 해당 keyframe을 버리도록 먼저 기록
+    if(mpTrajectoryWriter)
+        mpTrajectoryWriter->ResetMap(static_cast<Map*>(NULL));
+
     // Reset Local Mapping
     if (!bLocMap) //reset value인 blocalmap이 fasle일때 작동합니다. --> reset이 안됬을때
     {
@@ -3983,20 +5398,27 @@ void Tracking::Reset(bool bLocMap)
     Verbose::PrintMess("done", Verbose::VERBOSITY_NORMAL);
 
     // Clear Map (this erase MapPoints and KeyFrames)
+    delete mpFrozenMap;
+    mpFrozenMap = static_cast<FrozenMap*>(NULL);
+    mbLocalMapCached = false;
+    mLocalMirror.Clear();
+    if(mpTrajectoryStore)
+        mpTrajectoryStore->ResetMap(static_cast<Map*>(NULL));
     mpAtlas->clearAtlas(); //atlas data를 reset합니다. 
     mpAtlas->CreateNewMap(); //atlas의 maps를 reset합니다. 
     if (mSensor==System::IMU_STEREO || mSensor == System::IMU_MONOCULAR) //imu 센서가 사용됬을 경우 실행됩니다. 
         mpAtlas->SetInertialSensor(); //imu 센서를 reset합니다. 
     mnInitialFrameId = 0; //imu-frame id를 0으로 초기화합니다. 
 
-    KeyFrame::nNextId = 0; //keyframe의 next id를 0으로 초기화합니다. 
-    Frame::nNextId = 0; //frame의 next id를 0으로 초기화합니다. 
+    mpContext->mnNextKeyFrameId = 0; //keyframe의 next id를 0으로 초기화합니다. 
+    mpContext->mnNextFrameId = 0; //frame의 next id를 0으로 초기화합니다. 
     mState = NO_IMAGES_YET; //state를 초기화합니다. 
 
     if(mpInitializer) //monocular initializer부분 입니다. 
     {
         delete mpInitializer;
         mpInitializer = static_cast<Initializer*>(NULL);
+        mpIniReconstruction.reset();
     }
     mbSetInit=false;
 /////////////////////////////frame 관련 모든 parameter 및 list를 초기화 합니다. ///////////////////////////////////
@@ -4024,15 +5446,22 @@ void Tracking::ResetActiveMap(bool bLocMap)
     // 다만 현재 Map에 대해서만 Reset을 진행  
 
     Verbose::PrintMess("Active map Reseting", Verbose::VERBOSITY_NORMAL);
+
+    //^ tile이 reset되지 않는 다른 map의 것일 수도 있으므로 feature를 모두 읽어온 뒤 tiling을 해제
+    if(mpTileStreamer)
+        mpTileStreamer->LoadAll();
     if(mpViewer)
     {
         mpViewer->RequestStop();
-        while(!mpViewer->isStopped())
-            usleep(3000);
+        mpViewer->WaitUntilStopped();
     }
 
     Map* pMap = mpAtlas->GetCurrentMap();
 
+    //^ Local Mapping이 queue의 keyframe을 삭제하기 전에 writer가 해당 keyframe을 버리도록 먼저 기록
+    if(mpTrajectoryWriter)
+        mpTrajectoryWriter->ResetMap(pMap);
+
     if (!bLocMap)
     {
         Verbose::PrintMess("Reseting Local Mapper...", Verbose::VERBOSITY_NORMAL);
@@ -4051,9 +5480,15 @@ void Tracking::ResetActiveMap(bool bLocMap)
     Verbose::PrintMess("done", Verbose::VERBOSITY_NORMAL);
 
     // Clear Map (this erase MapPoints and KeyFrames)
+    delete mpFrozenMap;
+    mpFrozenMap = static_cast<FrozenMap*>(NULL);
+    mbLocalMapCached = false;
+    mLocalMirror.Clear();
+    if(mpTrajectoryStore)
+        mpTrajectoryStore->ResetMap(pMap);
     mpAtlas->clearMap();
 
-    mnLastInitFrameId = Frame::nNextId;
+    mnLastInitFrameId = mpContext->mnNextFrameId;
     mnLastRelocFrameId = mnLastInitFrameId;
     mState = NO_IMAGES_YET;
 
@@ -4061,6 +5496,7 @@ void Tracking::ResetActiveMap(bool bLocMap)
     {
         delete mpInitializer;
         mpInitializer = static_cast<Initializer*>(NULL);
+        mpIniReconstruction.reset();
     }
 
     list<bool> lbLost;
@@ -4068,7 +5504,7 @@ void Tracking::ResetActiveMap(bool bLocMap)
     cout << "mnFirstFrameId = " << mnFirstFrameId << endl;
     for(Map* pMap : mpAtlas->GetAllMaps())
     {
-        if(pMap->GetAllKeyFrames().size() > 0)
+        if(pMap->KeyFramesInMap() > 0)
         {
             if(index > pMap->GetLowerKFID())
                 index = pMap->GetLowerKFID();
@@ -4145,13 +5581,37 @@ void Tracking::ChangeCalibration(const string &strSettingPath)
     DistCoef.copyTo(mDistCoef);
 
     mbf = fSettings["Camera.bf"];
-
-    Frame::mbInitialComputations = true;
 }
 
 void Tracking::InformOnlyTracking(const bool &flag)
 {
     mbOnlyTracking = flag;
+
+    // The snapshot is built on the next frame, under the map update mutex
+    if(!mbOnlyTracking)
+    {
+        delete mpFrozenMap;
+        mpFrozenMap = static_cast<FrozenMap*>(NULL);
+    }
+}
+
+void Tracking::SetOfflineMapping(const bool bOffline)
+{
+    mbOfflineMapping = bOffline;
+}
+
+void Tracking::SetImuInitKeyFrameInterval(const float interval)
+{
+    mfImuInitKFInterval = interval;
+}
+
+void Tracking::WaitForLocalMapping()
+{
+    ORB_TRACE_SCOPE("Tracking::WaitForLocalMapping");
+    while(!mpLocalMapper->isFinished() &&
+          (mpLocalMapper->KeyframesInQueue()>=OFFLINE_MAX_QUEUED_KEYFRAMES || mpLocalMapper->isStopped() ||
+           mpLocalMapper->stopRequested() || mpLocalMapper->IsInitializing()))
+        usleep(500);
 }
 
 void Tracking::UpdateFrameIMU(const float s, const IMU::Bias &b, KeyFrame* pCurrentKeyFrame)
@@ -4178,6 +5638,11 @@ void Tracking::UpdateFrameIMU(const float s, const IMU::Bias &b, KeyFrame* pCurr
         }
     }
 
+    if(mpTrajectoryWriter)
+        mpTrajectoryWriter->ScaleMap(pMap, s);
+    if(mpTrajectoryStore)
+        mpTrajectoryStore->ScaleMap(pMap, s);
+
     mLastBias = b; //lastbias값을 가져옵니다. 
 
     mpLastKeyFrame = pCurrentKeyFrame; //current key frame을 last key frame으로 가져옵니다. 
@@ -4363,23 +5828,9 @@ void Tracking::CreateNewMapPoints()
             if(cosParallaxRays<cosParallaxStereo && cosParallaxRays>0 && (bStereo1 || bStereo2 || cosParallaxRays<0.9998))
             {
                 // Linear Triangulation Method
-                cv::Mat A(4,4,CV_32F);
-                A.row(0) = xn1.at<float>(0)*Tcw1.row(2)-Tcw1.row(0);
-                A.row(1) = xn1.at<float>(1)*Tcw1.row(2)-Tcw1.row(1);
-                A.row(2) = xn2.at<float>(0)*Tcw2.row(2)-Tcw2.row(0);
-                A.row(3) = xn2.at<float>(1)*Tcw2.row(2)-Tcw2.row(1);
-
-                cv::Mat w,u,vt;
-                cv::SVD::compute(A,w,u,vt,cv::SVD::MODIFY_A| cv::SVD::FULL_UV);
-
-                x3D = vt.row(3).t();
-
-                if(x3D.at<float>(3)==0)
+                if(!Triangulator::Triangulate(Tcw1,Tcw2,cv::Point2f(xn1.at<float>(0),xn1.at<float>(1)),
+                                              cv::Point2f(xn2.at<float>(0),xn2.at<float>(1)),x3D))
                     continue;
-
-                // Euclidean coordinates
-                x3D = x3D.rowRange(0,3)/x3D.at<float>(3);
-
             }
             else if(bStereo1 && cosParallaxStereo1<cosParallaxStereo2)
             {
@@ -0,0 +1,111 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "TrackingDeadline.h"
+
+namespace ORB_SLAM3
+{
+
+// Weight of the last measurement in the costs
+static const double COST_SMOOTHING = 0.2;
+
+TrackingDeadline::TrackingDeadline(const float fDeadline, const int nMinLocalPoints):
+    mfDeadline(fDeadline), mnMinLocalPoints(nMinLocalPoints), mfWideSearchCost(0.0), mbWideSearchMeasured(false),
+    mfLocalPointCost(0.0), mbLocalPointMeasured(false), mTimeStart(Clock::now()), mnApplied(NONE)
+{
+}
+
+void TrackingDeadline::BeginFrame(const double fSpentMs)
+{
+    mTimeStart = Clock::now() - std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double,std::milli>(fSpentMs));
+    mnApplied = NONE;
+}
+
+double TrackingDeadline::Remaining() const
+{
+    const double elapsed = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(Clock::now() - mTimeStart).count();
+    return mfDeadline - elapsed;
+}
+
+bool TrackingDeadline::FitsWideSearch() const
+{
+    const double remaining = Remaining();
+    if(!mbWideSearchMeasured)
+        return remaining > 0;
+    return mfWideSearchCost <= remaining;
+}
+
+void TrackingDeadline::RecordWideSearch(const Clock::time_point &tStart)
+{
+    const double ms = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(Clock::now() - tStart).count();
+    if(!mbWideSearchMeasured)
+    {
+        mfWideSearchCost = ms;
+        mbWideSearchMeasured = true;
+    }
+    else
+        mfWideSearchCost = (1.0-COST_SMOOTHING)*mfWideSearchCost + COST_SMOOTHING*ms;
+}
+
+int TrackingDeadline::LocalPointsBudget() const
+{
+    const double remaining = Remaining();
+    if(remaining <= 0)
+        return 0;
+    if(!mbLocalPointMeasured || mfLocalPointCost <= 0)
+        return -1;
+
+    const double nPoints = remaining/mfLocalPointCost;
+    if(nPoints < mnMinLocalPoints)
+        return 0;
+    return nPoints > 1e9 ? -1 : static_cast<int>(nPoints);
+}
+
+void TrackingDeadline::RecordLocalMap(const Clock::time_point &tStart, const int nPoints)
+{
+    if(nPoints <= 0)
+        return;
+
+    const double ms = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(Clock::now() - tStart).count();
+    const double cost = ms/nPoints;
+    if(!mbLocalPointMeasured)
+    {
+        mfLocalPointCost = cost;
+        mbLocalPointMeasured = true;
+    }
+    else
+        mfLocalPointCost = (1.0-COST_SMOOTHING)*mfLocalPointCost + COST_SMOOTHING*cost;
+}
+
+std::string TrackingDeadline::ToString(const int nDegradations)
+{
+    if(nDegradations == NONE)
+        return "none";
+
+    std::string s;
+    if(nDegradations & SKIP_WIDE_SEARCH)
+        s += "skip_wide_search,";
+    if(nDegradations & SHRINK_LOCAL_MAP)
+        s += "shrink_local_map,";
+    if(nDegradations & SKIP_LOCAL_MAP)
+        s += "skip_local_map,";
+    s.pop_back();
+    return s;
+}
+
+} //namespace ORB_SLAM
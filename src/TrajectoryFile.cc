@@ -0,0 +1,77 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "TrajectoryFile.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+namespace ORB_SLAM3
+{
+
+static_assert(sizeof(TrajectoryFile::Header)==64, "TrajectoryFile::Header must be 64 bytes");
+static_assert(sizeof(TrajectoryFile::Record)==64, "TrajectoryFile::Record must be 64 bytes");
+static_assert(sizeof(TrajectoryFile::IndexEntry)==16, "TrajectoryFile::IndexEntry must be 16 bytes");
+
+static bool RecordBefore(const TrajectoryFile::Record &r1, const TrajectoryFile::Record &r2)
+{
+    return r1.timestamp<r2.timestamp;
+}
+
+bool TrajectoryFile::Save(const std::string &filename, std::vector<Record> &vRecords, const uint32_t flags)
+{
+    std::stable_sort(vRecords.begin(), vRecords.end(), RecordBefore);
+
+    std::vector<IndexEntry> vIndex;
+    vIndex.reserve(vRecords.size()/INDEX_STRIDE+1);
+    for(size_t i=0; i<vRecords.size(); i+=INDEX_STRIDE)
+    {
+        IndexEntry entry;
+        entry.timestamp = vRecords[i].timestamp;
+        entry.record = i;
+        vIndex.push_back(entry);
+    }
+
+    Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "ORBS3TRJ", 8);
+    header.version = VERSION;
+    header.recordSize = sizeof(Record);
+    header.nRecords = vRecords.size();
+    header.indexOffset = sizeof(Header) + vRecords.size()*sizeof(Record);
+    header.nIndex = vIndex.size();
+    header.indexStride = INDEX_STRIDE;
+    header.flags = flags;
+    header.tFirst = vRecords.empty() ? 0.0 : vRecords.front().timestamp;
+    header.tLast = vRecords.empty() ? 0.0 : vRecords.back().timestamp;
+
+    std::ofstream f(filename.c_str(), std::ios::binary);
+    if(!f.is_open())
+        return false;
+
+    f.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    if(!vRecords.empty())
+        f.write(reinterpret_cast<const char*>(vRecords.data()), vRecords.size()*sizeof(Record));
+    if(!vIndex.empty())
+        f.write(reinterpret_cast<const char*>(vIndex.data()), vIndex.size()*sizeof(IndexEntry));
+
+    return f.good();
+}
+
+} //namespace ORB_SLAM
@@ -0,0 +1,210 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "TrajectoryStore.h"
+#include "KeyFrame.h"
+#include "Map.h"
+#include "Converter.h"
+
+#include <algorithm>
+
+namespace ORB_SLAM3
+{
+
+TrajectoryStore::TrajectoryStore(const size_t nCapacity): mvEntries(std::max(nCapacity,static_cast<size_t>(2))), mnFirst(0), mnSize(0)
+{
+}
+
+void TrajectoryStore::AddFrame(const double timestamp, KeyFrame* pRefKF, const cv::Mat &Tcr)
+{
+    if(!pRefKF || Tcr.empty())
+        return;
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    if(mnSize>0 && timestamp<=At(mnSize-1).timestamp)
+    {
+        mnFirst = 0;
+        mnSize = 0;
+    }
+
+    // Full ring: the oldest frame is overwritten
+    if(mnSize==mvEntries.size())
+    {
+        mnFirst = (mnFirst+1)%mvEntries.size();
+        mnSize--;
+    }
+
+    Entry &e = At(mnSize);
+    e.timestamp = timestamp;
+    e.pRefKF = pRefKF;
+    e.Tcr = cv::Matx44f(Tcr.ptr<float>());
+    mnSize++;
+}
+
+void TrajectoryStore::ScaleMap(Map* pMap, const float s)
+{
+    // Same as Tracking::UpdateFrameIMU does with mlRelativeFramePoses
+    std::unique_lock<std::mutex> lock(mMutex);
+    for(size_t i=0; i<mnSize; i++)
+    {
+        Entry &e = At(i);
+        KeyFrame* pKF = e.pRefKF;
+        while(pKF->isBad() && pKF->GetParent())
+            pKF = pKF->GetParent();
+
+        if(pKF->GetMap()==pMap)
+        {
+            e.Tcr(0,3) *= s;
+            e.Tcr(1,3) *= s;
+            e.Tcr(2,3) *= s;
+        }
+    }
+}
+
+void TrajectoryStore::ResetMap(Map* pMap)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    if(!pMap)
+    {
+        mnFirst = 0;
+        mnSize = 0;
+        return;
+    }
+
+    std::vector<bool> vbKeep(mnSize);
+    for(size_t i=0; i<mnSize; i++)
+    {
+        KeyFrame* pKF = At(i).pRefKF;
+        while(pKF->isBad() && pKF->GetParent())
+            pKF = pKF->GetParent();
+        vbKeep[i] = pKF->GetMap()!=pMap;
+    }
+    Compact(vbKeep);
+}
+
+void TrajectoryStore::EraseKeyFrame(KeyFrame* pKF)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    KeyFrame* pParent = pKF->GetParent();
+    const cv::Matx44f Tcp = (pParent && !pKF->mTcp.empty()) ? cv::Matx44f(pKF->mTcp.ptr<float>()) : cv::Matx44f::eye();
+
+    std::vector<bool> vbKeep(mnSize,true);
+    bool bDropped = false;
+    for(size_t i=0; i<mnSize; i++)
+    {
+        Entry &e = At(i);
+        if(e.pRefKF!=pKF)
+            continue;
+
+        if(pParent && !pKF->mTcp.empty())
+        {
+            e.Tcr = e.Tcr*Tcp;
+            e.pRefKF = pParent;
+        }
+        else
+        {
+            vbKeep[i] = false;
+            bDropped = true;
+        }
+    }
+
+    if(bDropped)
+        Compact(vbKeep);
+}
+
+bool TrajectoryStore::GetPose(const double timestamp, cv::Mat &Tcw)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    if(mnSize==0 || timestamp<At(0).timestamp || timestamp>At(mnSize-1).timestamp)
+        return false;
+
+    // First frame after the timestamp
+    size_t lo = 0, hi = mnSize;
+    while(lo<hi)
+    {
+        const size_t mid = (lo+hi)/2;
+        if(At(mid).timestamp<=timestamp)
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+
+    // Exact match (or the last frame)
+    const Entry &e0 = At(lo-1);
+    if(lo==mnSize || e0.timestamp==timestamp)
+    {
+        Tcw = cv::Mat(WorldPose(e0)).clone();
+        return true;
+    }
+
+    // Twc(t) = Twc0*exp(alpha*log(Twc0^-1*Twc1)), constant velocity on SE3 between the two frames
+    const Entry &e1 = At(lo);
+    const double alpha = (timestamp-e0.timestamp)/(e1.timestamp-e0.timestamp);
+    const g2o::SE3Quat Tc0w = Converter::toSE3Quat(WorldPose(e0));
+    const g2o::SE3Quat Tc1w = Converter::toSE3Quat(WorldPose(e1));
+    const g2o::SE3Quat Twc0 = Tc0w.inverse();
+    const g2o::SE3Quat Twc = Twc0*g2o::SE3Quat::exp(alpha*(Tc0w*Tc1w.inverse()).log());
+    Tcw = Converter::toCvMat(Twc.inverse());
+    return true;
+}
+
+bool TrajectoryStore::GetTimeRange(double &firstTime, double &lastTime)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    if(mnSize==0)
+        return false;
+    firstTime = At(0).timestamp;
+    lastTime = At(mnSize-1).timestamp;
+    return true;
+}
+
+size_t TrajectoryStore::Size()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    return mnSize;
+}
+
+void TrajectoryStore::Compact(const std::vector<bool> &vbKeep)
+{
+    size_t n = 0;
+    for(size_t i=0; i<mnSize; i++)
+    {
+        if(!vbKeep[i])
+            continue;
+        if(n!=i)
+            At(n) = At(i);
+        n++;
+    }
+    mnSize = n;
+}
+
+cv::Matx44f TrajectoryStore::WorldPose(const Entry &e)
+{
+    // As in System::SaveTrajectoryTUM, a culled reference is replaced by its parent
+    KeyFrame* pKF = e.pRefKF;
+    cv::Matx44f Trw = cv::Matx44f::eye();
+    while(pKF->isBad() && pKF->GetParent())
+    {
+        Trw = Trw*cv::Matx44f(pKF->mTcp.ptr<float>());
+        pKF = pKF->GetParent();
+    }
+    Trw = Trw*pKF->GetPose_();
+    return e.Tcr*Trw;
+}
+
+} //namespace ORB_SLAM
@@ -0,0 +1,246 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "TrajectoryWriter.h"
+#include "KeyFrame.h"
+#include "Map.h"
+#include "Converter.h"
+#include "EpochManager.h"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+namespace ORB_SLAM3
+{
+
+TrajectoryWriter::TrajectoryWriter(const std::string &strFile): mbFinishRequested(false), mbFinished(false)
+{
+    mFile.open(strFile.c_str());
+    mFile << std::fixed;
+}
+
+void TrajectoryWriter::Run()
+{
+    // Keyframe poses change in the other threads without notice, they are checked at this period
+    const std::chrono::milliseconds updatePeriod(1000);
+    std::chrono::steady_clock::time_point lastUpdate = std::chrono::steady_clock::now();
+
+    // The written keyframes are kept across iterations. Local Mapping only deletes keyframes
+    // (those still in its queue) on a reset, and Tracking queues the reset record before that,
+    // so they are dropped from mmWrittenKFs before they can be reclaimed
+    EpochManager::ThreadRegistration epochRegistration;
+
+    while(!CheckFinish())
+    {
+        EpochManager::Quiescent();
+
+        {
+            std::unique_lock<std::mutex> lock(mMutexQueue);
+            mcvQueue.wait_for(lock, std::chrono::milliseconds(100));
+        }
+
+        WriteRecords();
+
+        if(std::chrono::steady_clock::now()-lastUpdate>=updatePeriod)
+        {
+            UpdateKeyFrames();
+            mFile.flush();
+            lastUpdate = std::chrono::steady_clock::now();
+        }
+    }
+
+    WriteRecords();
+    UpdateKeyFrames();
+    mFile.close();
+
+    SetFinish();
+}
+
+void TrajectoryWriter::AddFrame(const double timestamp, KeyFrame* pRefKF, const cv::Mat &Tcr, const bool bLost)
+{
+    // Lost frames are not saved, as in System::SaveTrajectoryTUM
+    if(bLost || !pRefKF)
+        return;
+
+    Record r;
+    r.type = FRAME;
+    r.timestamp = timestamp;
+    r.pKF = pRefKF;
+    r.Tcr = Tcr.clone();
+
+    std::unique_lock<std::mutex> lock(mMutexQueue);
+    mqRecords.push_back(r);
+}
+
+void TrajectoryWriter::ScaleMap(Map* pMap, const float s)
+{
+    if(s==1.f)
+        return;
+
+    Record r;
+    r.type = SCALE;
+    r.pKF = static_cast<KeyFrame*>(NULL);
+    r.nMapId = pMap->GetId();
+    r.scale = s;
+
+    std::unique_lock<std::mutex> lock(mMutexQueue);
+    mqRecords.push_back(r);
+}
+
+void TrajectoryWriter::ResetMap(Map* pMap)
+{
+    Record r;
+    r.type = RESET;
+    r.pKF = static_cast<KeyFrame*>(NULL);
+    r.nMapId = pMap ? static_cast<long int>(pMap->GetId()) : -1;
+
+    std::unique_lock<std::mutex> lock(mMutexQueue);
+    mqRecords.push_back(r);
+    mcvQueue.notify_one();
+}
+
+// Tkw of the keyframe. Culled keyframes are placed with respect to their parent, as in
+// System::SaveTrajectoryTUM. Returns the map of the keyframe, NULL if it was cleared
+static Map* KeyFramePose(KeyFrame* pKF, cv::Mat &Tkw)
+{
+    cv::Mat Tkr = cv::Mat::eye(4,4,CV_32F);
+    while(pKF->isBad() && pKF->GetParent())
+    {
+        Tkr = Tkr*pKF->mTcp;
+        pKF = pKF->GetParent();
+    }
+
+    Tkw = Tkr*pKF->GetPose();
+    return pKF->GetMap();
+}
+
+void TrajectoryWriter::WritePose(const cv::Mat &T)
+{
+    const cv::Mat R = T.rowRange(0,3).colRange(0,3);
+    const std::vector<float> q = Converter::toQuaternion(R);
+    mFile << std::setprecision(9) << T.at<float>(0,3) << " " << T.at<float>(1,3) << " " << T.at<float>(2,3) << " "
+          << q[0] << " " << q[1] << " " << q[2] << " " << q[3];
+}
+
+bool TrajectoryWriter::WriteKeyFrame(KeyFrame* pKF)
+{
+    cv::Mat Tkw;
+    Map* pMap = KeyFramePose(pKF, Tkw);
+    if(!pMap)
+        return false;
+
+    WrittenKeyFrame written;
+    for(int r=0; r<3; r++)
+        for(int c=0; c<4; c++)
+            written.pose[4*r+c] = Tkw.at<float>(r,c);
+    written.nMapId = pMap->GetId();
+
+    std::unordered_map<KeyFrame*, WrittenKeyFrame>::iterator it = mmWrittenKFs.find(pKF);
+    if(it!=mmWrittenKFs.end() && it->second.pose==written.pose && it->second.nMapId==written.nMapId)
+        return true;
+    mmWrittenKFs[pKF] = written;
+
+    const cv::Mat Twk = Converter::toCvMat(Converter::toSE3Quat(Tkw).inverse());
+    mFile << "K " << pKF->mnId << " " << written.nMapId << " ";
+    WritePose(Twk);
+    mFile << std::endl;
+    return true;
+}
+
+void TrajectoryWriter::WriteRecords()
+{
+    std::deque<Record> qRecords;
+    {
+        std::unique_lock<std::mutex> lock(mMutexQueue);
+        qRecords.swap(mqRecords);
+    }
+
+    for(size_t i=0; i<qRecords.size(); i++)
+    {
+        const Record &r = qRecords[i];
+        if(r.type==FRAME)
+        {
+            if(!WriteKeyFrame(r.pKF))
+                continue;
+
+            const cv::Mat Tkc = Converter::toCvMat(Converter::toSE3Quat(r.Tcr).inverse());
+            mFile << "F " << std::setprecision(6) << r.timestamp << " " << r.pKF->mnId << " ";
+            WritePose(Tkc);
+            mFile << std::endl;
+        }
+        else if(r.type==SCALE)
+        {
+            mFile << "S " << r.nMapId << " " << std::setprecision(9) << r.scale << std::endl;
+        }
+        else
+        {
+            mFile << "R " << r.nMapId << std::endl;
+
+            // Keyframes of a reset map are not in any map anymore
+            for(std::unordered_map<KeyFrame*, WrittenKeyFrame>::iterator it=mmWrittenKFs.begin(); it!=mmWrittenKFs.end(); )
+            {
+                if(r.nMapId<0 || it->second.nMapId==r.nMapId)
+                    it = mmWrittenKFs.erase(it);
+                else
+                    ++it;
+            }
+        }
+    }
+}
+
+void TrajectoryWriter::UpdateKeyFrames()
+{
+    for(std::unordered_map<KeyFrame*, WrittenKeyFrame>::iterator it=mmWrittenKFs.begin(); it!=mmWrittenKFs.end(); )
+    {
+        // WriteKeyFrame only updates the entry of the keyframe, the iterator stays valid
+        KeyFrame* pKF = it->first;
+        ++it;
+        WriteKeyFrame(pKF);
+    }
+}
+
+void TrajectoryWriter::RequestFinish()
+{
+    {
+        std::unique_lock<std::mutex> lock(mMutexFinish);
+        mbFinishRequested = true;
+    }
+    std::unique_lock<std::mutex> lock(mMutexQueue);
+    mcvQueue.notify_one();
+}
+
+bool TrajectoryWriter::CheckFinish()
+{
+    std::unique_lock<std::mutex> lock(mMutexFinish);
+    return mbFinishRequested;
+}
+
+void TrajectoryWriter::SetFinish()
+{
+    std::unique_lock<std::mutex> lock(mMutexFinish);
+    mbFinished = true;
+}
+
+bool TrajectoryWriter::isFinished()
+{
+    std::unique_lock<std::mutex> lock(mMutexFinish);
+    return mbFinished;
+}
+
+} //namespace ORB_SLAM
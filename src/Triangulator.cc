@@ -0,0 +1,148 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Triangulator.h"
+
+#include <cmath>
+
+using namespace std;
+
+namespace ORB_SLAM3
+{
+
+static inline bool IsFinite(const cv::Point3f &x)
+{
+    return std::isfinite(x.x) && std::isfinite(x.y) && std::isfinite(x.z);
+}
+
+static void ToRowMajor34(const cv::Mat &P, double* p)
+{
+    for(int r=0; r<3; r++)
+        for(int c=0; c<4; c++)
+            p[4*r+c] = P.at<float>(r,c);
+}
+
+void Triangulator::Kernel(const double* pP1, const double* pP2, const cv::Point2f* px1, const cv::Point2f* px2, const int n, cv::Point3f* px3D)
+{
+    // Local copies, so that the outputs cannot alias them
+    double P1[12], P2[12];
+    for(int k=0; k<12; k++)
+    {
+        P1[k] = pP1[k];
+        P2[k] = pP2[k];
+    }
+
+    for(int i=0; i<n; i++)
+    {
+        const double u1 = px1[i].x, v1 = px1[i].y;
+        const double u2 = px2[i].x, v2 = px2[i].y;
+
+        // DLT equations
+        double a[4][4];
+        for(int c=0; c<4; c++)
+        {
+            a[0][c] = u1*P1[8+c]-P1[c];
+            a[1][c] = v1*P1[8+c]-P1[4+c];
+            a[2][c] = u2*P2[8+c]-P2[c];
+            a[3][c] = v2*P2[8+c]-P2[4+c];
+        }
+
+        double M[4][4];
+        for(int r=0; r<4; r++)
+            for(int c=0; c<4; c++)
+                M[r][c] = a[0][r]*a[0][c]+a[1][r]*a[1][c]+a[2][r]*a[2][c]+a[3][r]*a[3][c];
+
+        // M = L*D*L^T, with a tiny shift as M is singular for exact correspondences
+        const double eps = 1e-14*(M[0][0]+M[1][1]+M[2][2]+M[3][3]);
+        const double D0 = M[0][0]+eps;
+        const double L10 = M[0][1]/D0, L20 = M[0][2]/D0, L30 = M[0][3]/D0;
+        const double D1 = M[1][1]-L10*L10*D0+eps;
+        const double L21 = (M[1][2]-L20*L10*D0)/D1, L31 = (M[1][3]-L30*L10*D0)/D1;
+        const double D2 = M[2][2]-L20*L20*D0-L21*L21*D1+eps;
+        const double L32 = (M[2][3]-L30*L20*D0-L31*L21*D1)/D2;
+        const double D3 = M[3][3]-L30*L30*D0-L31*L31*D1-L32*L32*D2+eps;
+
+        // Inverse iteration towards the eigenvector of the smallest eigenvalue. The first one gives
+        // the least squares point with w=1. Scaled by the L1 norm, which needs no square root
+        double x0 = 0.0, x1 = 0.0, x2 = 0.0, x3 = 1.0;
+        for(int it=0; it<4; it++)
+        {
+            const double w1 = x1-L10*x0;
+            const double w2 = x2-L20*x0-L21*w1;
+            const double w3 = x3-L30*x0-L31*w1-L32*w2;
+            const double y0 = x0/D0, y1 = w1/D1, y2 = w2/D2, y3 = w3/D3;
+
+            const double z3 = y3;
+            const double z2 = y2-L32*z3;
+            const double z1 = y1-L21*z2-L31*z3;
+            const double z0 = y0-L10*z1-L20*z2-L30*z3;
+
+            const double s = 1.0/(fabs(z0)+fabs(z1)+fabs(z2)+fabs(z3));
+            x0 = z0*s; x1 = z1*s; x2 = z2*s; x3 = z3*s;
+        }
+
+        px3D[i] = cv::Point3f(x0/x3, x1/x3, x2/x3);
+    }
+}
+
+bool Triangulator::Triangulate(const cv::Matx44f &P1, const cv::Matx44f &P2, const cv::Point2f &x1, const cv::Point2f &x2, cv::Matx31f &x3D)
+{
+    double p1[12], p2[12];
+    for(int k=0; k<12; k++)
+    {
+        p1[k] = P1.val[k];
+        p2[k] = P2.val[k];
+    }
+
+    cv::Point3f x;
+    Kernel(p1,p2,&x1,&x2,1,&x);
+    x3D = cv::Matx31f(x.x,x.y,x.z);
+    return IsFinite(x);
+}
+
+bool Triangulator::Triangulate(const cv::Mat &P1, const cv::Mat &P2, const cv::Point2f &x1, const cv::Point2f &x2, cv::Mat &x3D)
+{
+    double p1[12], p2[12];
+    ToRowMajor34(P1,p1);
+    ToRowMajor34(P2,p2);
+
+    cv::Point3f x;
+    Kernel(p1,p2,&x1,&x2,1,&x);
+    x3D = (cv::Mat_<float>(3,1) << x.x, x.y, x.z);
+    return IsFinite(x);
+}
+
+void Triangulator::Triangulate(const cv::Mat &P1, const cv::Mat &P2, const vector<cv::Point2f> &vx1, const vector<cv::Point2f> &vx2,
+                               vector<cv::Point3f> &vx3D, vector<bool> &vbOK)
+{
+    const int n = vx1.size();
+    vx3D.resize(n);
+    vbOK.resize(n);
+    if(n==0)
+        return;
+
+    double p1[12], p2[12];
+    ToRowMajor34(P1,p1);
+    ToRowMajor34(P2,p2);
+
+    Kernel(p1,p2,&vx1[0],&vx2[0],n,&vx3D[0]);
+    for(int i=0; i<n; i++)
+        vbOK[i] = IsFinite(vx3D[i]);
+}
+
+} //namespace ORB_SLAM
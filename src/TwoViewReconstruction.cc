@@ -19,8 +19,16 @@
 #include "TwoViewReconstruction.h"
 
 #include "Thirdparty/DBoW2/DUtils/Random.h"
+#include "Triangulator.h"
 
 #include<thread>
+#include<algorithm>
+#include<cmath>
+#include<cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 
 using namespace std;
@@ -34,6 +42,25 @@ TwoViewReconstruction::TwoViewReconstruction(cv::Mat& K, float sigma, int iterat
     mSigma = sigma;
     mSigma2 = sigma*sigma;
     mMaxIterations = iterations;
+
+    mnWarmInliersH = 0;
+    mnWarmInliersF = 0;
+}
+
+// RANSAC iterations (between nMax/8 and nMax) giving 99% probability of having drawn at least one
+// set of 8 inliers, for an inlier ratio of nInliers/N
+static int RansacIterations(const int nInliers, const int N, const int nMax)
+{
+    const int nMin = max(1,nMax/8);
+    if(N<=0 || nInliers<=0)
+        return nMax;
+    const double p8 = pow(double(nInliers)/N,8);
+    if(p8>=1.0)
+        return nMin;
+    if(p8<1e-12)
+        return nMax;
+    const double k = ceil(log(0.01)/log(1.0-p8));
+    return k>=nMax ? nMax : max(nMin,int(k));
 }
 
 bool TwoViewReconstruction::Reconstruct(const std::vector<cv::KeyPoint>& vKeys1, const std::vector<cv::KeyPoint>& vKeys2, const vector<int> &vMatches12,
@@ -73,8 +100,10 @@ bool TwoViewReconstruction::Reconstruct(const std::vector<cv::KeyPoint>& vKeys1,
         vAllIndices.push_back(i);
     }
 
-    // Generate sets of 8 points for each RANSAC iteration
-    mvSets = vector< vector<size_t> >(mMaxIterations,vector<size_t>(8,0));
+    // Generate sets of 8 points for each RANSAC iteration (storage kept from call to call)
+    mvSets.resize(mMaxIterations);
+    for(int it=0; it<mMaxIterations; it++)
+        mvSets[it].resize(8);
 
     DUtils::Random::SeedRandOnce(0);
 
@@ -95,17 +124,89 @@ bool TwoViewReconstruction::Reconstruct(const std::vector<cv::KeyPoint>& vKeys1,
         }
     }
 
-    // Launch threads to compute in parallel a fundamental matrix and a homography
-    vector<bool> vbMatchesInliersH, vbMatchesInliersF;
-    float SH, SF;
-    cv::Mat H, F;
+    // Matched coordinates for scoring, normalized keypoints for the minimal solvers
+    mvU1.resize(N); mvV1.resize(N); mvU2.resize(N); mvV2.resize(N);
+    for(int i=0; i<N; i++)
+    {
+        const cv::Point2f &pt1 = mvKeys1[mvMatches12[i].first].pt;
+        const cv::Point2f &pt2 = mvKeys2[mvMatches12[i].second].pt;
+        mvU1[i] = pt1.x; mvV1[i] = pt1.y;
+        mvU2[i] = pt2.x; mvV2[i] = pt2.y;
+    }
+
+    Normalize(mvKeys1,mvPn1,mT1);
+    Normalize(mvKeys2,mvPn2,mT2);
 
-    thread threadH(&TwoViewReconstruction::FindHomography,this,ref(vbMatchesInliersH), ref(SH), ref(H));
-    thread threadF(&TwoViewReconstruction::FindFundamental,this,ref(vbMatchesInliersF), ref(SF), ref(F));
+    // Warm start: previous best hypotheses on the current matches
+    float SH0 = 0.f, SF0 = 0.f;
+    vector<unsigned char> vInliersH0, vInliersF0;
+    mnWarmInliersH = 0;
+    mnWarmInliersF = 0;
+    if(!mPrevH21.empty())
+    {
+        SH0 = CheckHomography(mPrevH21,mPrevH21.inv(),vInliersH0,mSigma);
+        mnWarmInliersH = count(vInliersH0.begin(),vInliersH0.end(),(unsigned char)1);
+    }
+    if(!mPrevF21.empty())
+    {
+        SF0 = CheckFundamental(mPrevF21,vInliersF0,mSigma);
+        mnWarmInliersF = count(vInliersF0.begin(),vInliersF0.end(),(unsigned char)1);
+    }
 
-    // Wait until both threads have finished
-    threadH.join();
-    threadF.join();
+    // Launch threads to compute in parallel a fundamental matrix and a homography.
+    // The iterations of each model are split in contiguous chunks, one thread per chunk
+    const int nCores = max(2u,thread::hardware_concurrency());
+    const int nChunks = max(1,min(nCores/2,mMaxIterations/16));
+
+    vector<vector<unsigned char> > vvInliersH(nChunks), vvInliersF(nChunks);
+    vector<float> vSH(nChunks,0.f), vSF(nChunks,0.f);
+    vector<cv::Mat> vH(nChunks), vF(nChunks);
+
+    vector<thread> vThreads;
+    vThreads.reserve(2*nChunks);
+    for(int c=0; c<nChunks; c++)
+    {
+        const int itBegin = c*mMaxIterations/nChunks;
+        const int itEnd = (c+1)*mMaxIterations/nChunks;
+        vThreads.push_back(thread(&TwoViewReconstruction::FindHomography,this,itBegin,itEnd,ref(vvInliersH[c]),ref(vSH[c]),ref(vH[c])));
+        vThreads.push_back(thread(&TwoViewReconstruction::FindFundamental,this,itBegin,itEnd,ref(vvInliersF[c]),ref(vSF[c]),ref(vF[c])));
+    }
+
+    // Wait until all threads have finished
+    for(size_t i=0; i<vThreads.size(); i++)
+        vThreads[i].join();
+
+    // Best hypothesis of all chunks. On ties the earliest chunk wins, as in a single serial pass
+    int bestH = 0, bestF = 0;
+    for(int c=1; c<nChunks; c++)
+    {
+        if(vSH[c]>vSH[bestH])
+            bestH = c;
+        if(vSF[c]>vSF[bestF])
+            bestF = c;
+    }
+
+    float SH = vSH[bestH], SF = vSF[bestF];
+    cv::Mat H = vH[bestH], F = vF[bestF];
+    if(SH0>SH)
+    {
+        SH = SH0;
+        H = mPrevH21;
+        vvInliersH[bestH].swap(vInliersH0);
+    }
+    if(SF0>SF)
+    {
+        SF = SF0;
+        F = mPrevF21;
+        vvInliersF[bestF].swap(vInliersF0);
+    }
+    vector<bool> vbMatchesInliersH(vvInliersH[bestH].begin(),vvInliersH[bestH].end());
+    vector<bool> vbMatchesInliersF(vvInliersF[bestF].begin(),vvInliersF[bestF].end());
+
+    if(!H.empty())
+        mPrevH21 = H.clone();
+    if(!F.empty())
+        mPrevF21 = F.clone();
 
     // Compute ratio of scores
     if(SH+SF == 0.f) return false;
@@ -126,43 +227,43 @@ bool TwoViewReconstruction::Reconstruct(const std::vector<cv::KeyPoint>& vKeys1,
     }
 }
 
-void TwoViewReconstruction::FindHomography(vector<bool> &vbMatchesInliers, float &score, cv::Mat &H21)
+void TwoViewReconstruction::FindHomography(int itBegin, int itEnd, vector<unsigned char> &vbMatchesInliers, float &score, cv::Mat &H21)
 {
     // Number of putative matches
     const int N = mvMatches12.size();
 
-    // Normalize coordinates
-    vector<cv::Point2f> vPn1, vPn2;
-    cv::Mat T1, T2;
-    Normalize(mvKeys1,vPn1, T1);
-    Normalize(mvKeys2,vPn2, T2);
-    cv::Mat T2inv = T2.inv();
+    cv::Mat T2inv = mT2.inv();
 
     // Best Results variables
     score = 0.0;
-    vbMatchesInliers = vector<bool>(N,false);
+    vbMatchesInliers = vector<unsigned char>(N,0);
 
     // Iteration variables
     vector<cv::Point2f> vPn1i(8);
     vector<cv::Point2f> vPn2i(8);
     cv::Mat H21i, H12i;
-    vector<bool> vbCurrentInliers(N,false);
+    vector<unsigned char> vbCurrentInliers(N,0);
     float currentScore;
 
+    // Iterations this chunk needs for the inliers of the best hypothesis so far (or of the warm start)
+    const int nChunkIterations = itEnd-itBegin;
+    int nBestInliers = mnWarmInliersH;
+    int nRequired = (RansacIterations(nBestInliers,N,mMaxIterations)*nChunkIterations+mMaxIterations-1)/mMaxIterations;
+
     // Perform all RANSAC iterations and save the solution with highest score
-    for(int it=0; it<mMaxIterations; it++)
+    for(int it=itBegin; it<itEnd && it-itBegin<nRequired; it++)
     {
         // Select a minimum set
         for(size_t j=0; j<8; j++)
         {
             int idx = mvSets[it][j];
 
-            vPn1i[j] = vPn1[mvMatches12[idx].first];
-            vPn2i[j] = vPn2[mvMatches12[idx].second];
+            vPn1i[j] = mvPn1[mvMatches12[idx].first];
+            vPn2i[j] = mvPn2[mvMatches12[idx].second];
         }
 
         cv::Mat Hn = ComputeH21(vPn1i,vPn2i);
-        H21i = T2inv*Hn*T1;
+        H21i = T2inv*Hn*mT1;
         H12i = H21i.inv();
 
         currentScore = CheckHomography(H21i, H12i, vbCurrentInliers, mSigma);
@@ -170,59 +271,73 @@ void TwoViewReconstruction::FindHomography(vector<bool> &vbMatchesInliers, float
         if(currentScore>score)
         {
             H21 = H21i.clone();
-            vbMatchesInliers = vbCurrentInliers;
+            vbMatchesInliers.swap(vbCurrentInliers);
             score = currentScore;
+
+            const int nInliers = count(vbMatchesInliers.begin(),vbMatchesInliers.end(),(unsigned char)1);
+            if(nInliers>nBestInliers)
+            {
+                nBestInliers = nInliers;
+                nRequired = (RansacIterations(nBestInliers,N,mMaxIterations)*nChunkIterations+mMaxIterations-1)/mMaxIterations;
+            }
         }
     }
 }
 
 
-void TwoViewReconstruction::FindFundamental(vector<bool> &vbMatchesInliers, float &score, cv::Mat &F21)
+void TwoViewReconstruction::FindFundamental(int itBegin, int itEnd, vector<unsigned char> &vbMatchesInliers, float &score, cv::Mat &F21)
 {
     // Number of putative matches
-    const int N = vbMatchesInliers.size();
+    const int N = mvMatches12.size();
 
-    // Normalize coordinates
-    vector<cv::Point2f> vPn1, vPn2;
-    cv::Mat T1, T2;
-    Normalize(mvKeys1,vPn1, T1);
-    Normalize(mvKeys2,vPn2, T2);
-    cv::Mat T2t = T2.t();
+    cv::Mat T2t = mT2.t();
 
     // Best Results variables
     score = 0.0;
-    vbMatchesInliers = vector<bool>(N,false);
+    vbMatchesInliers = vector<unsigned char>(N,0);
 
     // Iteration variables
     vector<cv::Point2f> vPn1i(8);
     vector<cv::Point2f> vPn2i(8);
     cv::Mat F21i;
-    vector<bool> vbCurrentInliers(N,false);
+    vector<unsigned char> vbCurrentInliers(N,0);
     float currentScore;
 
+    // Iterations this chunk needs for the inliers of the best hypothesis so far (or of the warm start)
+    const int nChunkIterations = itEnd-itBegin;
+    int nBestInliers = mnWarmInliersF;
+    int nRequired = (RansacIterations(nBestInliers,N,mMaxIterations)*nChunkIterations+mMaxIterations-1)/mMaxIterations;
+
     // Perform all RANSAC iterations and save the solution with highest score
-    for(int it=0; it<mMaxIterations; it++)
+    for(int it=itBegin; it<itEnd && it-itBegin<nRequired; it++)
     {
         // Select a minimum set
         for(int j=0; j<8; j++)
         {
             int idx = mvSets[it][j];
 
-            vPn1i[j] = vPn1[mvMatches12[idx].first];
-            vPn2i[j] = vPn2[mvMatches12[idx].second];
+            vPn1i[j] = mvPn1[mvMatches12[idx].first];
+            vPn2i[j] = mvPn2[mvMatches12[idx].second];
         }
 
         cv::Mat Fn = ComputeF21(vPn1i,vPn2i);
 
-        F21i = T2t*Fn*T1;
+        F21i = T2t*Fn*mT1;
 
         currentScore = CheckFundamental(F21i, vbCurrentInliers, mSigma);
 
         if(currentScore>score)
         {
             F21 = F21i.clone();
-            vbMatchesInliers = vbCurrentInliers;
+            vbMatchesInliers.swap(vbCurrentInliers);
             score = currentScore;
+
+            const int nInliers = count(vbMatchesInliers.begin(),vbMatchesInliers.end(),(unsigned char)1);
+            if(nInliers>nBestInliers)
+            {
+                nBestInliers = nInliers;
+                nRequired = (RansacIterations(nBestInliers,N,mMaxIterations)*nChunkIterations+mMaxIterations-1)/mMaxIterations;
+            }
         }
     }
 }
@@ -307,7 +422,7 @@ cv::Mat TwoViewReconstruction::ComputeF21(const vector<cv::Point2f> &vP1,const v
     return  u*cv::Mat::diag(w)*vt;
 }
 
-float TwoViewReconstruction::CheckHomography(const cv::Mat &H21, const cv::Mat &H12, vector<bool> &vbMatchesInliers, float sigma)
+float TwoViewReconstruction::CheckHomography(const cv::Mat &H21, const cv::Mat &H12, vector<unsigned char> &vbMatchesInliers, float sigma)
 {   
     const int N = mvMatches12.size();
 
@@ -333,23 +448,67 @@ float TwoViewReconstruction::CheckHomography(const cv::Mat &H21, const cv::Mat &
 
     vbMatchesInliers.resize(N);
 
+    const float *pU1 = mvU1.data(), *pV1 = mvV1.data(), *pU2 = mvU2.data(), *pV2 = mvV2.data();
+    unsigned char *pIn = vbMatchesInliers.data();
+
     float score = 0;
 
     const float th = 5.991;
 
     const float invSigmaSquare = 1.0/(sigma*sigma);
 
-    for(int i=0; i<N; i++)
+    int i=0;
+#if defined(__SSE2__)
+    // Four matches at a time, with the same operations as the scalar loop below
     {
-        bool bIn = true;
+        const __m128i vZero = _mm_setzero_si128();
+        const __m128 vTh = _mm_set1_ps(th), vInvSigma2 = _mm_set1_ps(invSigmaSquare), vOne = _mm_set1_ps(1.f);
+        __m128 vScore = _mm_setzero_ps();
+        for(; i+4<=N; i+=4)
+        {
+            const __m128 u1 = _mm_loadu_ps(pU1+i), v1 = _mm_loadu_ps(pV1+i);
+            const __m128 u2 = _mm_loadu_ps(pU2+i), v2 = _mm_loadu_ps(pV2+i);
+
+            // Reprojection error in first image
+            // x2in1 = H12*x2
+            const __m128 w2in1inv = _mm_div_ps(vOne,_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(h31inv),u2),_mm_mul_ps(_mm_set1_ps(h32inv),v2)),_mm_set1_ps(h33inv)));
+            const __m128 u2in1 = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(h11inv),u2),_mm_mul_ps(_mm_set1_ps(h12inv),v2)),_mm_set1_ps(h13inv)),w2in1inv);
+            const __m128 v2in1 = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(h21inv),u2),_mm_mul_ps(_mm_set1_ps(h22inv),v2)),_mm_set1_ps(h23inv)),w2in1inv);
+            const __m128 du1 = _mm_sub_ps(u1,u2in1), dv1 = _mm_sub_ps(v1,v2in1);
+            const __m128 chiSquare1 = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(du1,du1),_mm_mul_ps(dv1,dv1)),vInvSigma2);
+            const __m128 in1 = _mm_cmpngt_ps(chiSquare1,vTh);
+
+            // Reprojection error in second image
+            // x1in2 = H21*x1
+            const __m128 w1in2inv = _mm_div_ps(vOne,_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(h31),u1),_mm_mul_ps(_mm_set1_ps(h32),v1)),_mm_set1_ps(h33)));
+            const __m128 u1in2 = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(h11),u1),_mm_mul_ps(_mm_set1_ps(h12),v1)),_mm_set1_ps(h13)),w1in2inv);
+            const __m128 v1in2 = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(h21),u1),_mm_mul_ps(_mm_set1_ps(h22),v1)),_mm_set1_ps(h23)),w1in2inv);
+            const __m128 du2 = _mm_sub_ps(u2,u1in2), dv2 = _mm_sub_ps(v2,v1in2);
+            const __m128 chiSquare2 = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(du2,du2),_mm_mul_ps(dv2,dv2)),vInvSigma2);
+            const __m128 in2 = _mm_cmpngt_ps(chiSquare2,vTh);
+
+            vScore = _mm_add_ps(vScore,_mm_and_ps(in1,_mm_sub_ps(vTh,chiSquare1)));
+            vScore = _mm_add_ps(vScore,_mm_and_ps(in2,_mm_sub_ps(vTh,chiSquare2)));
+
+            // One byte (0 or 1) per match
+            const __m128i in = _mm_srli_epi32(_mm_castps_si128(_mm_and_ps(in1,in2)),31);
+            const int flags = _mm_cvtsi128_si32(_mm_packus_epi16(_mm_packs_epi32(in,vZero),vZero));
+            memcpy(pIn+i,&flags,4);
+        }
+        float vs[4];
+        _mm_storeu_ps(vs,vScore);
+        score = (vs[0]+vs[1])+(vs[2]+vs[3]);
+    }
+#endif
 
-        const cv::KeyPoint &kp1 = mvKeys1[mvMatches12[i].first];
-        const cv::KeyPoint &kp2 = mvKeys2[mvMatches12[i].second];
+    for(; i<N; i++)
+    {
+        bool bIn = true;
 
-        const float u1 = kp1.pt.x;
-        const float v1 = kp1.pt.y;
-        const float u2 = kp2.pt.x;
-        const float v2 = kp2.pt.y;
+        const float u1 = pU1[i];
+        const float v1 = pV1[i];
+        const float u2 = pU2[i];
+        const float v2 = pV2[i];
 
         // Reprojection error in first image
         // x2in1 = H12*x2
@@ -383,16 +542,13 @@ float TwoViewReconstruction::CheckHomography(const cv::Mat &H21, const cv::Mat &
         else
             score += th - chiSquare2;
 
-        if(bIn)
-            vbMatchesInliers[i]=true;
-        else
-            vbMatchesInliers[i]=false;
+        pIn[i] = bIn;
     }
 
     return score;
 }
 
-float TwoViewReconstruction::CheckFundamental(const cv::Mat &F21, vector<bool> &vbMatchesInliers, float sigma)
+float TwoViewReconstruction::CheckFundamental(const cv::Mat &F21, vector<unsigned char> &vbMatchesInliers, float sigma)
 {
     const int N = mvMatches12.size();
 
@@ -408,6 +564,9 @@ float TwoViewReconstruction::CheckFundamental(const cv::Mat &F21, vector<bool> &
 
     vbMatchesInliers.resize(N);
 
+    const float *pU1 = mvU1.data(), *pV1 = mvV1.data(), *pU2 = mvU2.data(), *pV2 = mvV2.data();
+    unsigned char *pIn = vbMatchesInliers.data();
+
     float score = 0;
 
     const float th = 3.841;
@@ -415,17 +574,60 @@ float TwoViewReconstruction::CheckFundamental(const cv::Mat &F21, vector<bool> &
 
     const float invSigmaSquare = 1.0/(sigma*sigma);
 
-    for(int i=0; i<N; i++)
+    int i=0;
+#if defined(__SSE2__)
+    // Four matches at a time, with the same operations as the scalar loop below
     {
-        bool bIn = true;
+        const __m128i vZero = _mm_setzero_si128();
+        const __m128 vTh = _mm_set1_ps(th), vThScore = _mm_set1_ps(thScore), vInvSigma2 = _mm_set1_ps(invSigmaSquare);
+        __m128 vScore = _mm_setzero_ps();
+        for(; i+4<=N; i+=4)
+        {
+            const __m128 u1 = _mm_loadu_ps(pU1+i), v1 = _mm_loadu_ps(pV1+i);
+            const __m128 u2 = _mm_loadu_ps(pU2+i), v2 = _mm_loadu_ps(pV2+i);
+
+            // Reprojection error in second image
+            // l2=F21x1=(a2,b2,c2)
+            const __m128 a2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(f11),u1),_mm_mul_ps(_mm_set1_ps(f12),v1)),_mm_set1_ps(f13));
+            const __m128 b2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(f21),u1),_mm_mul_ps(_mm_set1_ps(f22),v1)),_mm_set1_ps(f23));
+            const __m128 c2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(f31),u1),_mm_mul_ps(_mm_set1_ps(f32),v1)),_mm_set1_ps(f33));
+            const __m128 num2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a2,u2),_mm_mul_ps(b2,v2)),c2);
+            const __m128 squareDist1 = _mm_div_ps(_mm_mul_ps(num2,num2),_mm_add_ps(_mm_mul_ps(a2,a2),_mm_mul_ps(b2,b2)));
+            const __m128 chiSquare1 = _mm_mul_ps(squareDist1,vInvSigma2);
+            const __m128 in1 = _mm_cmpngt_ps(chiSquare1,vTh);
+
+            // Reprojection error in second image
+            // l1 =x2tF21=(a1,b1,c1)
+            const __m128 a1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(f11),u2),_mm_mul_ps(_mm_set1_ps(f21),v2)),_mm_set1_ps(f31));
+            const __m128 b1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(f12),u2),_mm_mul_ps(_mm_set1_ps(f22),v2)),_mm_set1_ps(f32));
+            const __m128 c1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(f13),u2),_mm_mul_ps(_mm_set1_ps(f23),v2)),_mm_set1_ps(f33));
+            const __m128 num1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a1,u1),_mm_mul_ps(b1,v1)),c1);
+            const __m128 squareDist2 = _mm_div_ps(_mm_mul_ps(num1,num1),_mm_add_ps(_mm_mul_ps(a1,a1),_mm_mul_ps(b1,b1)));
+            const __m128 chiSquare2 = _mm_mul_ps(squareDist2,vInvSigma2);
+            const __m128 in2 = _mm_cmpngt_ps(chiSquare2,vTh);
+
+            vScore = _mm_add_ps(vScore,_mm_and_ps(in1,_mm_sub_ps(vThScore,chiSquare1)));
+            vScore = _mm_add_ps(vScore,_mm_and_ps(in2,_mm_sub_ps(vThScore,chiSquare2)));
+
+            // One byte (0 or 1) per match
+            const __m128i in = _mm_srli_epi32(_mm_castps_si128(_mm_and_ps(in1,in2)),31);
+            const int flags = _mm_cvtsi128_si32(_mm_packus_epi16(_mm_packs_epi32(in,vZero),vZero));
+            memcpy(pIn+i,&flags,4);
+        }
+        float vs[4];
+        _mm_storeu_ps(vs,vScore);
+        score = (vs[0]+vs[1])+(vs[2]+vs[3]);
+    }
+#endif
 
-        const cv::KeyPoint &kp1 = mvKeys1[mvMatches12[i].first];
-        const cv::KeyPoint &kp2 = mvKeys2[mvMatches12[i].second];
+    for(; i<N; i++)
+    {
+        bool bIn = true;
 
-        const float u1 = kp1.pt.x;
-        const float v1 = kp1.pt.y;
-        const float u2 = kp2.pt.x;
-        const float v2 = kp2.pt.y;
+        const float u1 = pU1[i];
+        const float v1 = pV1[i];
+        const float u2 = pU2[i];
+        const float v2 = pV2[i];
 
         // Reprojection error in second image
         // l2=F21x1=(a2,b2,c2)
@@ -463,10 +665,7 @@ float TwoViewReconstruction::CheckFundamental(const cv::Mat &F21, vector<bool> &
         else
             score += thScore - chiSquare2;
 
-        if(bIn)
-            vbMatchesInliers[i]=true;
-        else
-            vbMatchesInliers[i]=false;
+        pIn[i] = bIn;
     }
 
     return score;
@@ -735,21 +934,6 @@ bool TwoViewReconstruction::ReconstructH(vector<bool> &vbMatchesInliers, cv::Mat
     return false;
 }
 
-void TwoViewReconstruction::Triangulate(const cv::KeyPoint &kp1, const cv::KeyPoint &kp2, const cv::Mat &P1, const cv::Mat &P2, cv::Mat &x3D)
-{
-    cv::Mat A(4,4,CV_32F);
-
-    A.row(0) = kp1.pt.x*P1.row(2)-P1.row(0);
-    A.row(1) = kp1.pt.y*P1.row(2)-P1.row(1);
-    A.row(2) = kp2.pt.x*P2.row(2)-P2.row(0);
-    A.row(3) = kp2.pt.y*P2.row(2)-P2.row(1);
-
-    cv::Mat u,w,vt;
-    cv::SVD::compute(A,w,u,vt,cv::SVD::MODIFY_A| cv::SVD::FULL_UV);
-    x3D = vt.row(3).t();
-    x3D = x3D.rowRange(0,3)/x3D.at<float>(3);
-}
-
 void TwoViewReconstruction::Normalize(const vector<cv::KeyPoint> &vKeys, vector<cv::Point2f> &vNormalizedPoints, cv::Mat &T)
 {
     float meanX = 0;
@@ -829,25 +1013,41 @@ int TwoViewReconstruction::CheckRT(const cv::Mat &R, const cv::Mat &t, const vec
 
     cv::Mat O2 = -R.t()*t;
 
+    // Triangulate all the inliers at once
+    vector<cv::Point2f> vx1, vx2;
+    vx1.reserve(vMatches12.size());
+    vx2.reserve(vMatches12.size());
+    for(size_t i=0, iend=vMatches12.size();i<iend;i++)
+    {
+        if(!vbMatchesInliers[i])
+            continue;
+        vx1.push_back(vKeys1[vMatches12[i].first].pt);
+        vx2.push_back(vKeys2[vMatches12[i].second].pt);
+    }
+
+    vector<cv::Point3f> vx3D;
+    vector<bool> vbFinite;
+    Triangulator::Triangulate(P1,P2,vx1,vx2,vx3D,vbFinite);
+
     int nGood=0;
 
-    for(size_t i=0, iend=vMatches12.size();i<iend;i++)
+    for(size_t i=0, iend=vMatches12.size(), j=0;i<iend;i++)
     {
         if(!vbMatchesInliers[i])
             continue;
 
         const cv::KeyPoint &kp1 = vKeys1[vMatches12[i].first];
         const cv::KeyPoint &kp2 = vKeys2[vMatches12[i].second];
-        cv::Mat p3dC1;
+        const size_t iTri = j++;
 
-        Triangulate(kp1,kp2,P1,P2,p3dC1);
-
-        if(!isfinite(p3dC1.at<float>(0)) || !isfinite(p3dC1.at<float>(1)) || !isfinite(p3dC1.at<float>(2)))
+        if(!vbFinite[iTri])
         {
             vbGood[vMatches12[i].first]=false;
             continue;
         }
 
+        cv::Mat p3dC1(vx3D[iTri]);
+
         // Check parallax
         cv::Mat normal1 = p3dC1 - O1;
         float dist1 = cv::norm(normal1);
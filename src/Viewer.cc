@@ -18,6 +18,8 @@
 
 
 #include "Viewer.h"
+#include "EpochManager.h"
+#include "Tracer.h"
 #include <pangolin/pangolin.h>
 
 #include <mutex>
@@ -132,6 +134,9 @@ void Viewer::Run()
     mbFinished = false;
     mbStopped = false;
 
+    if(!mThreadScheduling.IsDefault())
+        mThreadScheduling.Apply();
+
     pangolin::CreateWindowAndBind("ORB-SLAM3: Map Viewer",1024,768);
 
     // 3D Mouse handler requires depth testing to be enabled
@@ -181,8 +186,16 @@ void Viewer::Run()
         menuShowGraph = true;
     }
 
+    // The drawers hand out map points and keyframes, they are only used within one iteration
+    EpochManager::ThreadRegistration epochRegistration;
+    ORB_TRACE_THREAD_NAME("Viewer");
+    ORB_LOCK_THREAD_NAME("Viewer");
+
     while(1)
     {
+        EpochManager::Quiescent();
+        ORB_TRACE_BEGIN(traceDraw, "Viewer::Draw");
+
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         mpMapDrawer->GetCurrentOpenGLCameraMatrix(Twc,Ow,Twwp);
@@ -271,6 +284,7 @@ void Viewer::Run()
         }
 
         cv::imshow("ORB-SLAM3: Current Frame",toShow);
+        ORB_TRACE_END(traceDraw);
         cv::waitKey(mT);
 
         if(menuReset)
@@ -291,10 +305,8 @@ void Viewer::Run()
 
         if(Stop())
         {
-            while(isStopped())
-            {
-                usleep(3000);
-            }
+            unique_lock<mutex> lock(mMutexStop);
+            mcvStop.wait(lock, [this]{ return !mbStopped || CheckFinish(); });
         }
 
         if(CheckFinish())
@@ -306,8 +318,12 @@ void Viewer::Run()
 
 void Viewer::RequestFinish()
 {
-    unique_lock<mutex> lock(mMutexFinish);
-    mbFinishRequested = true;
+    {
+        unique_lock<mutex> lock(mMutexFinish);
+        mbFinishRequested = true;
+    }
+    unique_lock<mutex> lock(mMutexStop);
+    mcvStop.notify_all();
 }
 
 bool Viewer::CheckFinish()
@@ -341,6 +357,12 @@ bool Viewer::isStopped()
     return mbStopped;
 }
 
+void Viewer::WaitUntilStopped()
+{
+    unique_lock<mutex> lock(mMutexStop);
+    mcvStop.wait(lock, [this]{ return mbStopped; });
+}
+
 bool Viewer::Stop()
 {
     unique_lock<mutex> lock(mMutexStop);
@@ -352,6 +374,7 @@ bool Viewer::Stop()
     {
         mbStopped = true;
         mbStopRequested = false;
+        mcvStop.notify_all();
         return true;
     }
 
@@ -363,6 +386,7 @@ void Viewer::Release()
 {
     unique_lock<mutex> lock(mMutexStop);
     mbStopped = false;
+    mcvStop.notify_all();
 }
 
 void Viewer::SetTrackingPause()
@@ -370,4 +394,9 @@ void Viewer::SetTrackingPause()
     mbStopTrack = true;
 }
 
+void Viewer::SetThreadScheduling(const ThreadScheduling &sched)
+{
+    mThreadScheduling = sched;
+}
+
 }
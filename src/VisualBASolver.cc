@@ -0,0 +1,870 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "VisualBASolver.h"
+#include "PoseSolver.h"
+#include "ThreadPool.h"
+#include "CameraModels/CameraProjection.h"
+
+#include <Eigen/Dense>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace ORB_SLAM3
+{
+
+typedef Eigen::Map<Eigen::Matrix3d> Map3d;
+typedef Eigen::Map<const Eigen::Matrix3d> ConstMap3d;
+typedef Eigen::Map<Eigen::Matrix<double,6,3> > Map63d;
+typedef Eigen::Map<const Eigen::Matrix<double,6,3> > ConstMap63d;
+typedef Eigen::Map<VisualBASolver::Matrix6d> Map6d;
+typedef Eigen::Map<const VisualBASolver::Matrix6d> ConstMap6d;
+
+VisualBASolver::VisualBASolver(): mpThreadPool(static_cast<ThreadPool*>(NULL)), mpbStopFlag(static_cast<bool*>(NULL)),
+    mLambdaInit(0.0), mLinearSolver(CHOLESKY), mPrecision(DOUBLE), mbStructure(false)
+{
+}
+
+void VisualBASolver::Reset(ThreadPool* pThreadPool)
+{
+    mpThreadPool = pThreadPool;
+    mpbStopFlag = static_cast<bool*>(NULL);
+    mLambdaInit = 0.0;
+    mLinearSolver = CHOLESKY;
+    mPrecision = DOUBLE;
+    mbStructure = false;
+
+    // clear() keeps the capacity
+    mvPose.clear(); mvbFixed.clear(); mvCalib.clear();
+    mvX.clear(); mvY.clear(); mvZ.clear();
+    mvType.clear(); mvObsKF.clear(); mvObsPoint.clear();
+    mvU.clear(); mvV.clear(); mvUr.clear();
+    mvInfo.clear(); mvDelta.clear();
+}
+
+int VisualBASolver::AddKeyFrame(const Eigen::Matrix3d &Rcw, const Eigen::Vector3d &tcw, const bool bFixed,
+                                GeometricCamera* pCamera, GeometricCamera* pCamera2,
+                                const Eigen::Matrix3d &Rrl, const Eigen::Vector3d &trl,
+                                const double fx, const double fy, const double cx, const double cy, const double bf)
+{
+    for(int r=0; r<3; r++)
+        for(int c=0; c<3; c++)
+            mvPose.push_back(Rcw(r,c));
+    mvPose.push_back(tcw[0]); mvPose.push_back(tcw[1]); mvPose.push_back(tcw[2]);
+    mvbFixed.push_back(bFixed);
+
+    Calibration calib;
+    calib.pCamera = pCamera;
+    calib.pCamera2 = pCamera2;
+    calib.Rrl = Rrl;
+    calib.trl = trl;
+    calib.fx = fx; calib.fy = fy; calib.cx = cx; calib.cy = cy; calib.bf = bf;
+    mvCalib.push_back(calib);
+
+    mbStructure = false;
+    return mvbFixed.size()-1;
+}
+
+int VisualBASolver::AddPoint(const Eigen::Vector3d &Xw)
+{
+    mvX.push_back(Xw[0]); mvY.push_back(Xw[1]); mvZ.push_back(Xw[2]);
+
+    mbStructure = false;
+    return mvX.size()-1;
+}
+
+int VisualBASolver::AddObservation(const eObsType type, const int nKF, const int nPoint, const double u, const double v, const double ur,
+                                   const double invSigma2, const double delta)
+{
+    mvType.push_back(type);
+    mvObsKF.push_back(nKF);
+    mvObsPoint.push_back(nPoint);
+    mvU.push_back(u); mvV.push_back(v); mvUr.push_back(ur);
+    mvInfo.push_back(invSigma2);
+    mvDelta.push_back(delta);
+
+    mbStructure = false;
+    return mvType.size()-1;
+}
+
+void VisualBASolver::GetPose(const int i, Eigen::Matrix3d &Rcw, Eigen::Vector3d &tcw) const
+{
+    const double* T = &mvPose[12*i];
+    Rcw << T[0], T[1], T[2],
+           T[3], T[4], T[5],
+           T[6], T[7], T[8];
+    tcw << T[9], T[10], T[11];
+}
+
+void VisualBASolver::ParallelRange(const int n, const int nGrain, const std::function<void(int,int)> &f)
+{
+    const int nChunks = (n+nGrain-1)/nGrain;
+    if(mpThreadPool && nChunks>1)
+        mpThreadPool->ParallelFor(0, nChunks, [&](int i){ f(i*nGrain, std::min(n, (i+1)*nGrain)); });
+    else if(n>0)
+        f(0, n);
+}
+
+void VisualBASolver::BuildStructure()
+{
+    const int nKFs = mvbFixed.size();
+    const int nPoints = mvX.size();
+    const int nObs = mvType.size();
+
+    mvCamIdx.assign(nKFs, -1);
+    mvCamKF.clear();
+    for(int k=0; k<nKFs; k++)
+    {
+        if(mvbFixed[k])
+            continue;
+        mvCamIdx[k] = mvCamKF.size();
+        mvCamKF.push_back(k);
+    }
+    const int nCams = mvCamKF.size();
+
+    // Observations by point and by keyframe, in the order they were added
+    mvPointObsBegin.assign(nPoints+1, 0);
+    mvKFObsBegin.assign(nKFs+1, 0);
+    for(int i=0; i<nObs; i++)
+    {
+        mvPointObsBegin[mvObsPoint[i]+1]++;
+        mvKFObsBegin[mvObsKF[i]+1]++;
+    }
+    for(int j=0; j<nPoints; j++)
+        mvPointObsBegin[j+1] += mvPointObsBegin[j];
+    for(int k=0; k<nKFs; k++)
+        mvKFObsBegin[k+1] += mvKFObsBegin[k];
+
+    mvPointObs.resize(nObs);
+    mvKFObs.resize(nObs);
+    {
+        std::vector<int> vPointNext(mvPointObsBegin.begin(), mvPointObsBegin.end()-1);
+        std::vector<int> vKFNext(mvKFObsBegin.begin(), mvKFObsBegin.end()-1);
+        for(int i=0; i<nObs; i++)
+        {
+            mvPointObs[vPointNext[mvObsPoint[i]]++] = i;
+            mvKFObs[vKFNext[mvObsKF[i]]++] = i;
+        }
+    }
+
+    // Blocks of the reduced camera system: one per pair of cameras that observe a common point,
+    // plus the diagonal. Diagonal entries (no pair) come first in each block after sorting.
+    struct Entry
+    {
+        long long key;
+        int a, b;
+        bool operator<(const Entry &e) const
+        {
+            if(key!=e.key) return key<e.key;
+            if(a!=e.a) return a<e.a;
+            return b<e.b;
+        }
+    };
+    std::vector<Entry> vEntries;
+    vEntries.reserve(nCams+nObs*4);
+    for(int c=0; c<nCams; c++)
+    {
+        Entry e = {(long long)c*nCams+c, -1, -1};
+        vEntries.push_back(e);
+    }
+    for(int j=0; j<nPoints; j++)
+    {
+        for(int ia=mvPointObsBegin[j]; ia<mvPointObsBegin[j+1]; ia++)
+        {
+            const int a = mvPointObs[ia];
+            const int ca = mvCamIdx[mvObsKF[a]];
+            if(ca<0)
+                continue;
+            for(int ib=mvPointObsBegin[j]; ib<mvPointObsBegin[j+1]; ib++)
+            {
+                const int b = mvPointObs[ib];
+                const int cb = mvCamIdx[mvObsKF[b]];
+                if(cb<ca)
+                    continue;
+                Entry e = {(long long)ca*nCams+cb, a, b};
+                vEntries.push_back(e);
+            }
+        }
+    }
+    std::sort(vEntries.begin(), vEntries.end());
+
+    mvBlockCam1.clear(); mvBlockCam2.clear();
+    mvBlockPairBegin.clear(); mvPairA.clear(); mvPairB.clear();
+    for(size_t i=0; i<vEntries.size(); i++)
+    {
+        if(i==0 || vEntries[i].key!=vEntries[i-1].key)
+        {
+            mvBlockCam1.push_back(vEntries[i].key/nCams);
+            mvBlockCam2.push_back(vEntries[i].key%nCams);
+            mvBlockPairBegin.push_back(mvPairA.size());
+        }
+        if(vEntries[i].a>=0)
+        {
+            mvPairA.push_back(vEntries[i].a);
+            mvPairB.push_back(vEntries[i].b);
+        }
+    }
+    mvBlockPairBegin.push_back(mvPairA.size());
+    const int nBlocks = mvBlockCam1.size();
+
+    mRhs.resize(6*nCams);
+    mdc.resize(6*nCams);
+
+    if(mLinearSolver==PCG)
+    {
+        // Blocks of each camera, as cam1 or cam2
+        mvDiagBlock.assign(nCams, -1);
+        mvCamBlockBegin.assign(nCams+1, 0);
+        for(int b=0; b<nBlocks; b++)
+        {
+            if(mvBlockCam1[b]==mvBlockCam2[b])
+                mvDiagBlock[mvBlockCam1[b]] = b;
+            mvCamBlockBegin[mvBlockCam1[b]+1]++;
+            if(mvBlockCam1[b]!=mvBlockCam2[b])
+                mvCamBlockBegin[mvBlockCam2[b]+1]++;
+        }
+        for(int c=0; c<nCams; c++)
+            mvCamBlockBegin[c+1] += mvCamBlockBegin[c];
+        mvCamBlocks.resize(mvCamBlockBegin[nCams]);
+        std::vector<int> vNext(mvCamBlockBegin.begin(), mvCamBlockBegin.end()-1);
+        for(int b=0; b<nBlocks; b++)
+        {
+            mvCamBlocks[vNext[mvBlockCam1[b]]++] = b;
+            if(mvBlockCam1[b]!=mvBlockCam2[b])
+                mvCamBlocks[vNext[mvBlockCam2[b]]++] = b;
+        }
+
+        mvSBlock.resize(36*nBlocks);
+        mvPrecond.resize(36*nCams);
+    }
+    else
+        BuildPattern(nCams, nBlocks);
+
+    // Working buffers
+    mvPoseNew.resize(mvPose.size());
+    mvXNew.resize(nPoints); mvYNew.resize(nPoints); mvZNew.resize(nPoints);
+    mvChi2.resize(nObs); mvCost.resize(nObs); mvbDepthPositive.resize(nObs);
+    if(mPrecision==SINGLE)
+        mLinSingle.resize(nObs);
+    else
+        mLinDouble.resize(nObs);
+    mvW.resize(18*nObs); mvWHinv.resize(18*nObs);
+    mvHpp.resize(9*nPoints); mvgp.resize(3*nPoints); mvHppInv.resize(9*nPoints); mvdp.resize(3*nPoints);
+    mvHcc.resize(36*nCams); mvgc.resize(6*nCams);
+
+    mbStructure = true;
+}
+
+void VisualBASolver::BuildPattern(const int nCams, const int nBlocks)
+{
+    // Pattern of the upper triangle and position of every block element in its values
+    std::vector<Eigen::Triplet<double> > vTriplets;
+    vTriplets.reserve(nBlocks*36);
+    for(int b=0; b<nBlocks; b++)
+    {
+        const int c1 = mvBlockCam1[b], c2 = mvBlockCam2[b];
+        for(int r=0; r<6; r++)
+            for(int c=(c1==c2 ? r : 0); c<6; c++)
+                vTriplets.push_back(Eigen::Triplet<double>(6*c1+r, 6*c2+c, 0.0));
+    }
+    mS.resize(6*nCams, 6*nCams);
+    mS.setFromTriplets(vTriplets.begin(), vTriplets.end());
+    mS.makeCompressed();
+
+    mvBlockValue.assign(nBlocks*36, -1);
+    for(int b=0; b<nBlocks; b++)
+    {
+        const int c1 = mvBlockCam1[b], c2 = mvBlockCam2[b];
+        for(int r=0; r<6; r++)
+            for(int c=(c1==c2 ? r : 0); c<6; c++)
+                mvBlockValue[36*b+6*c+r] = &mS.coeffRef(6*c1+r, 6*c2+c) - mS.valuePtr();
+    }
+
+    if(nCams>0)
+        mLDLT.analyzePattern(mS);
+}
+
+// Projection and Jacobian of the camera in the arithmetic of the evaluation, as CameraProject<GeometricCamera>
+template<class Scalar>
+static inline Eigen::Matrix<Scalar,2,1> ProjectAs(GeometricCamera* pCamera, const Eigen::Matrix<Scalar,3,1> &Xc)
+{
+    if(pCamera->GetType() == pCamera->CAM_PINHOLE)
+        return Pinhole::Project(pCamera->getParameters(), Xc);
+    else
+        return KannalaBrandt8::Project(pCamera->getParameters(), Xc);
+}
+
+template<class Scalar>
+static inline Eigen::Matrix<Scalar,2,3> ProjectJacAs(GeometricCamera* pCamera, const Eigen::Matrix<Scalar,3,1> &Xc)
+{
+    if(pCamera->GetType() == pCamera->CAM_PINHOLE)
+        return Pinhole::ProjectJac(pCamera->getParameters(), Xc);
+    else
+        return KannalaBrandt8::ProjectJac(pCamera->getParameters(), Xc);
+}
+
+// The estimate as the evaluation reads it: in double as it is, in float converted into buffer
+static inline const double* EstimateAs(const std::vector<double> &v, std::vector<double> &buffer)
+{
+    return v.data();
+}
+
+static inline const float* EstimateAs(const std::vector<double> &v, std::vector<float> &buffer)
+{
+    buffer.assign(v.begin(), v.end());
+    return buffer.data();
+}
+
+double VisualBASolver::Evaluate(const std::vector<double> &vPose, const std::vector<double> &vX,
+                                const std::vector<double> &vY, const std::vector<double> &vZ, const bool bJacobians)
+{
+    if(mPrecision==SINGLE)
+        return Evaluate(vPose, vX, vY, vZ, bJacobians, mLinSingle);
+    else
+        return Evaluate(vPose, vX, vY, vZ, bJacobians, mLinDouble);
+}
+
+template<class Scalar>
+double VisualBASolver::Evaluate(const std::vector<double> &vPose, const std::vector<double> &vX,
+                                const std::vector<double> &vY, const std::vector<double> &vZ, const bool bJacobians,
+                                Linearization<Scalar> &lin)
+{
+    typedef Eigen::Matrix<Scalar,2,1> Vector2s;
+    typedef Eigen::Matrix<Scalar,3,1> Vector3s;
+    typedef Eigen::Matrix<Scalar,3,3> Matrix3s;
+
+    const int nObs = mvType.size();
+
+    const Scalar* pPose = EstimateAs(vPose, lin.vPose);
+    const Scalar* pX = EstimateAs(vX, lin.vX);
+    const Scalar* pY = EstimateAs(vY, lin.vY);
+    const Scalar* pZ = EstimateAs(vZ, lin.vZ);
+
+    ParallelRange(nObs, 1024, [&](int begin, int end)
+    {
+        const int* pKF = mvObsKF.data();
+        const int* pPoint = mvObsPoint.data();
+        Scalar* pXc = lin.vXc.data();
+        Scalar* pYc = lin.vYc.data();
+        Scalar* pZc = lin.vZc.data();
+
+        // Points in the camera frame, a plain loop over the arrays that the compiler can vectorize
+        for(int i=begin; i<end; i++)
+        {
+            const Scalar* T = pPose + 12*pKF[i];
+            const int j = pPoint[i];
+            pXc[i] = T[0]*pX[j] + T[1]*pY[j] + T[2]*pZ[j] + T[9];
+            pYc[i] = T[3]*pX[j] + T[4]*pY[j] + T[5]*pZ[j] + T[10];
+            pZc[i] = T[6]*pX[j] + T[7]*pY[j] + T[8]*pZ[j] + T[11];
+        }
+
+        // Residuals (obs - projection), robust cost and, for the system, the derivative of the
+        // residual w.r.t. the point in the camera frame. The third row is zero for 2D observations.
+        Vector3s e;
+        Matrix3s De;
+        for(int i=begin; i<end; i++)
+        {
+            const Calibration &calib = mvCalib[pKF[i]];
+            const Vector3s Xc(pXc[i], pYc[i], pZc[i]);
+            const Vector2s obs(Scalar(mvU[i]), Scalar(mvV[i]));
+
+            switch(mvType[i])
+            {
+            case MONO:
+            {
+                e.template head<2>() = obs - ProjectAs<Scalar>(calib.pCamera, Xc);
+                e[2] = Scalar(0);
+                mvbDepthPositive[i] = Xc[2]>Scalar(0);
+                if(bJacobians)
+                {
+                    De.template topRows<2>() = -ProjectJacAs<Scalar>(calib.pCamera, Xc);
+                    De.row(2).setZero();
+                }
+                break;
+            }
+            case MONO_RIGHT:
+            {
+                const Matrix3s Rrl = calib.Rrl.cast<Scalar>();
+                const Vector3s Xr = Rrl*Xc + calib.trl.cast<Scalar>();
+                e.template head<2>() = obs - ProjectAs<Scalar>(calib.pCamera2, Xr);
+                e[2] = Scalar(0);
+                mvbDepthPositive[i] = Xr[2]>Scalar(0);
+                if(bJacobians)
+                {
+                    De.template topRows<2>() = -ProjectJacAs<Scalar>(calib.pCamera2, Xr)*Rrl;
+                    De.row(2).setZero();
+                }
+                break;
+            }
+            case STEREO:
+            {
+                const Scalar fx = Scalar(calib.fx), fy = Scalar(calib.fy), bf = Scalar(calib.bf);
+                const Scalar invz = Scalar(1)/Xc[2];
+                const Scalar u = fx*Xc[0]*invz + Scalar(calib.cx);
+                e << obs[0] - u, obs[1] - (fy*Xc[1]*invz + Scalar(calib.cy)), Scalar(mvUr[i]) - (u - bf*invz);
+                mvbDepthPositive[i] = Xc[2]>Scalar(0);
+                if(bJacobians)
+                {
+                    const Scalar invz2 = invz*invz;
+                    De << -fx*invz, Scalar(0), fx*Xc[0]*invz2,
+                          Scalar(0), -fy*invz, fy*Xc[1]*invz2,
+                          -fx*invz, Scalar(0), -(bf-fx*Xc[0])*invz2;
+                }
+                break;
+            }
+            }
+
+            // Huber, as g2o::RobustKernelHuber (only the first derivative weights the system)
+            const double chi2 = mvInfo[i]*double(e.squaredNorm());
+            const double delta = mvDelta[i];
+            double w = 1.0;
+            if(delta<=0.0 || chi2<=delta*delta)
+                mvCost[i] = chi2;
+            else
+            {
+                const double sqrte = sqrt(chi2);
+                w = delta/sqrte;
+                mvCost[i] = 2.0*sqrte*delta - delta*delta;
+            }
+            mvChi2[i] = chi2;
+
+            if(bJacobians)
+            {
+                lin.vWeight[i] = Scalar(w*mvInfo[i]);
+                Eigen::Map<Vector3s>(lin.vErr.data()+3*i) = e;
+                Eigen::Map<Matrix3s>(lin.vDe.data()+9*i) = De;
+            }
+        }
+    });
+
+    double cost = 0.0;
+    for(int i=0; i<nObs; i++)
+        cost += mvCost[i];
+
+    return cost;
+}
+
+void VisualBASolver::BuildSystem()
+{
+    if(mPrecision==SINGLE)
+        BuildSystem(mLinSingle);
+    else
+        BuildSystem(mLinDouble);
+}
+
+template<class Scalar>
+void VisualBASolver::BuildSystem(const Linearization<Scalar> &lin)
+{
+    const int nPoints = mvX.size();
+    const int nCams = mvCamKF.size();
+
+    // Jacobians of an observation w.r.t. the left update of the pose and the point, in double
+    // whatever the precision of the linearization
+    auto jacobians = [this, &lin](const int i, Eigen::Matrix<double,3,6> &Jc, Eigen::Matrix3d &Jp)
+    {
+        const Eigen::Matrix3d De = Eigen::Map<const Eigen::Matrix<Scalar,3,3> >(&lin.vDe[9*i]).template cast<double>();
+        const double xc = lin.vXc[i], yc = lin.vYc[i], zc = lin.vZc[i];
+        Eigen::Matrix<double,3,6> SE3deriv;
+        SE3deriv << 0.0, zc, -yc, 1.0, 0.0, 0.0,
+                    -zc, 0.0, xc, 0.0, 1.0, 0.0,
+                    yc, -xc, 0.0, 0.0, 0.0, 1.0;
+        Jc.noalias() = De*SE3deriv;
+
+        const double* T = &mvPose[12*mvObsKF[i]];
+        Eigen::Matrix3d Rcw;
+        Rcw << T[0], T[1], T[2],
+               T[3], T[4], T[5],
+               T[6], T[7], T[8];
+        Jp.noalias() = De*Rcw;
+    };
+    auto residual = [&lin](const int i)
+    {
+        return Eigen::Vector3d(Eigen::Map<const Eigen::Matrix<Scalar,3,1> >(&lin.vErr[3*i]).template cast<double>());
+    };
+
+    // Point blocks and camera-point blocks
+    ParallelRange(nPoints, 256, [&](int begin, int end)
+    {
+        Eigen::Matrix<double,3,6> Jc;
+        Eigen::Matrix3d Jp;
+        for(int j=begin; j<end; j++)
+        {
+            Eigen::Matrix3d H = Eigen::Matrix3d::Zero();
+            Eigen::Vector3d g = Eigen::Vector3d::Zero();
+            for(int io=mvPointObsBegin[j]; io<mvPointObsBegin[j+1]; io++)
+            {
+                const int i = mvPointObs[io];
+                jacobians(i, Jc, Jp);
+                const double w = lin.vWeight[i];
+                const Eigen::Vector3d e = residual(i);
+                H.noalias() += w*Jp.transpose()*Jp;
+                g.noalias() += w*Jp.transpose()*e;
+                if(mvCamIdx[mvObsKF[i]]>=0)
+                    Map63d(&mvW[18*i]).noalias() = w*Jc.transpose()*Jp;
+            }
+            Map3d(mvHpp.data()+9*j) = H;
+            Eigen::Map<Eigen::Vector3d>(mvgp.data()+3*j) = g;
+        }
+    });
+
+    // Camera blocks
+    ParallelRange(nCams, 8, [&](int begin, int end)
+    {
+        Eigen::Matrix<double,3,6> Jc;
+        Eigen::Matrix3d Jp;
+        for(int c=begin; c<end; c++)
+        {
+            const int k = mvCamKF[c];
+            Matrix6d H = Matrix6d::Zero();
+            Vector6d g = Vector6d::Zero();
+            for(int io=mvKFObsBegin[k]; io<mvKFObsBegin[k+1]; io++)
+            {
+                const int i = mvKFObs[io];
+                jacobians(i, Jc, Jp);
+                const double w = lin.vWeight[i];
+                const Eigen::Vector3d e = residual(i);
+                H.noalias() += w*Jc.transpose()*Jc;
+                g.noalias() += w*Jc.transpose()*e;
+            }
+            Map6d(mvHcc.data()+36*c) = H;
+            Eigen::Map<Vector6d>(mvgc.data()+6*c) = g;
+        }
+    });
+}
+
+double VisualBASolver::MaxDiagonal() const
+{
+    double maxDiag = 0.0;
+    for(size_t c=0; c<mvCamKF.size(); c++)
+        for(int r=0; r<6; r++)
+            maxDiag = std::max(maxDiag, fabs(mvHcc[36*c+7*r]));
+    for(size_t j=0; j<mvX.size(); j++)
+        for(int r=0; r<3; r++)
+            maxDiag = std::max(maxDiag, fabs(mvHpp[9*j+4*r]));
+    return maxDiag;
+}
+
+bool VisualBASolver::Solve(const double lambda)
+{
+    const int nPoints = mvX.size();
+    const int nCams = mvCamKF.size();
+    const int nBlocks = mvBlockCam1.size();
+
+    // Damped point blocks are inverted and the camera-point blocks multiplied by them
+    ParallelRange(nPoints, 256, [&](int begin, int end)
+    {
+        for(int j=begin; j<end; j++)
+        {
+            Eigen::Matrix3d H = ConstMap3d(&mvHpp[9*j]);
+            H.diagonal().array() += lambda;
+            const Eigen::Matrix3d Hinv = H.inverse();
+            Map3d(mvHppInv.data()+9*j) = Hinv;
+            for(int io=mvPointObsBegin[j]; io<mvPointObsBegin[j+1]; io++)
+            {
+                const int i = mvPointObs[io];
+                if(mvCamIdx[mvObsKF[i]]>=0)
+                    Map63d(&mvWHinv[18*i]).noalias() = ConstMap63d(&mvW[18*i])*Hinv;
+            }
+        }
+    });
+
+    // Reduced camera system S = Hcc - W*inv(Hpp)*W', one block per task so that no two tasks
+    // write the same values
+    double* pS = mLinearSolver==PCG ? static_cast<double*>(NULL) : mS.valuePtr();
+    ParallelRange(nBlocks, 16, [&](int begin, int end)
+    {
+        Matrix6d S;
+        for(int b=begin; b<end; b++)
+        {
+            const int c1 = mvBlockCam1[b];
+            if(c1==mvBlockCam2[b])
+            {
+                S = ConstMap6d(&mvHcc[36*c1]);
+                S.diagonal().array() += lambda;
+            }
+            else
+                S.setZero();
+
+            for(int p=mvBlockPairBegin[b]; p<mvBlockPairBegin[b+1]; p++)
+                S.noalias() -= ConstMap63d(&mvWHinv[18*mvPairA[p]])*ConstMap63d(&mvW[18*mvPairB[p]]).transpose();
+
+            if(mLinearSolver==PCG)
+            {
+                Map6d(mvSBlock.data()+36*b) = S;
+                continue;
+            }
+
+            const int* pIdx = &mvBlockValue[36*b];
+            const double* pBlock = S.data();
+            for(int v=0; v<36; v++)
+                if(pIdx[v]>=0)
+                    pS[pIdx[v]] = pBlock[v];
+        }
+    });
+
+    // Right-hand side -gc + W*inv(Hpp)*gp
+    ParallelRange(nCams, 8, [&](int begin, int end)
+    {
+        for(int c=begin; c<end; c++)
+        {
+            const int k = mvCamKF[c];
+            Vector6d r = -Eigen::Map<const Vector6d>(&mvgc[6*c]);
+            for(int io=mvKFObsBegin[k]; io<mvKFObsBegin[k+1]; io++)
+            {
+                const int i = mvKFObs[io];
+                r.noalias() += ConstMap63d(&mvWHinv[18*i])*Eigen::Map<const Eigen::Vector3d>(&mvgp[3*mvObsPoint[i]]);
+            }
+            mRhs.segment<6>(6*c) = r;
+        }
+    });
+
+    if(nCams>0 && mLinearSolver==PCG)
+    {
+        if(!SolvePCG())
+            return false;
+    }
+    else if(nCams>0)
+    {
+        mLDLT.factorize(mS);
+        if(mLDLT.info()!=Eigen::Success)
+            return false;
+        mdc = mLDLT.solve(mRhs);
+        if(!mdc.allFinite())
+            return false;
+    }
+
+    // Back-substitution dp = inv(Hpp)*(-gp - W'*dc)
+    ParallelRange(nPoints, 256, [&](int begin, int end)
+    {
+        for(int j=begin; j<end; j++)
+        {
+            Eigen::Vector3d r = -Eigen::Map<const Eigen::Vector3d>(&mvgp[3*j]);
+            for(int io=mvPointObsBegin[j]; io<mvPointObsBegin[j+1]; io++)
+            {
+                const int i = mvPointObs[io];
+                const int c = mvCamIdx[mvObsKF[i]];
+                if(c>=0)
+                    r.noalias() -= ConstMap63d(&mvW[18*i]).transpose()*mdc.segment<6>(6*c);
+            }
+            Eigen::Map<Eigen::Vector3d>(mvdp.data()+3*j) = ConstMap3d(&mvHppInv[9*j])*r;
+        }
+    });
+
+    return true;
+}
+
+void VisualBASolver::MultiplyReduced(const Eigen::VectorXd &x, Eigen::VectorXd &y)
+{
+    // By rows of cameras, so that every task writes its own rows. Only the blocks with cam1<=cam2
+    // are stored, the camera that is cam2 of a block multiplies its transpose.
+    ParallelRange(mvCamKF.size(), 16, [&](int begin, int end)
+    {
+        for(int c=begin; c<end; c++)
+        {
+            Vector6d yc = Vector6d::Zero();
+            for(int ib=mvCamBlockBegin[c]; ib<mvCamBlockBegin[c+1]; ib++)
+            {
+                const int b = mvCamBlocks[ib];
+                const ConstMap6d S(mvSBlock.data()+36*b);
+                if(mvBlockCam1[b]==c)
+                    yc.noalias() += S*x.segment<6>(6*mvBlockCam2[b]);
+                else
+                    yc.noalias() += S.transpose()*x.segment<6>(6*mvBlockCam1[b]);
+            }
+            y.segment<6>(6*c) = yc;
+        }
+    });
+}
+
+bool VisualBASolver::SolvePCG()
+{
+    const int nCams = mvCamKF.size();
+
+    // Block Jacobi preconditioner
+    ParallelRange(nCams, 16, [&](int begin, int end)
+    {
+        for(int c=begin; c<end; c++)
+            Map6d(mvPrecond.data()+36*c) = ConstMap6d(mvSBlock.data()+36*mvDiagBlock[c]).inverse();
+    });
+
+    auto precondition = [this, nCams](const Eigen::VectorXd &r, Eigen::VectorXd &z)
+    {
+        for(int c=0; c<nCams; c++)
+            z.segment<6>(6*c) = ConstMap6d(mvPrecond.data()+36*c)*r.segment<6>(6*c);
+    };
+
+    mdc.setZero();
+    mr = mRhs;
+    mz.resize(6*nCams);
+    mAp.resize(6*nCams);
+    precondition(mr, mz);
+    mp = mz;
+    double rz = mr.dot(mz);
+
+    const double tolerance = 1e-6;
+    const double threshold = tolerance*tolerance*mRhs.squaredNorm();
+    const int maxIter = 6*nCams;
+    for(int iter=0; iter<maxIter && mr.squaredNorm()>threshold; iter++)
+    {
+        MultiplyReduced(mp, mAp);
+        const double pAp = mp.dot(mAp);
+        if(pAp<=0.0)
+            break;
+        const double alpha = rz/pAp;
+        mdc += alpha*mp;
+        mr -= alpha*mAp;
+        precondition(mr, mz);
+        const double rzNew = mr.dot(mz);
+        mp = mz + (rzNew/rz)*mp;
+        rz = rzNew;
+    }
+
+    return mdc.allFinite();
+}
+
+void VisualBASolver::Update()
+{
+    const int nKFs = mvbFixed.size();
+    const int nPoints = mvX.size();
+
+    // Left update exp(dx)*Tcw of the poses
+    for(int k=0; k<nKFs; k++)
+    {
+        const int c = mvCamIdx[k];
+        if(c<0)
+        {
+            std::copy(&mvPose[12*k], &mvPose[12*k]+12, &mvPoseNew[12*k]);
+            continue;
+        }
+
+        Eigen::Matrix3d Rcw, Rexp;
+        Eigen::Vector3d tcw, texp;
+        GetPose(k, Rcw, tcw);
+        PoseSolver::ExpSE3(mdc.segment<6>(6*c), Rexp, texp);
+        const Eigen::Quaterniond q = Eigen::Quaterniond(Rexp*Rcw).normalized();
+        const Eigen::Matrix3d Rnew = q.toRotationMatrix();
+        const Eigen::Vector3d tnew = Rexp*tcw + texp;
+
+        double* T = &mvPoseNew[12*k];
+        for(int r=0; r<3; r++)
+            for(int col=0; col<3; col++)
+                T[3*r+col] = Rnew(r,col);
+        T[9] = tnew[0]; T[10] = tnew[1]; T[11] = tnew[2];
+    }
+
+    for(int j=0; j<nPoints; j++)
+    {
+        mvXNew[j] = mvX[j] + mvdp[3*j];
+        mvYNew[j] = mvY[j] + mvdp[3*j+1];
+        mvZNew[j] = mvZ[j] + mvdp[3*j+2];
+    }
+}
+
+double VisualBASolver::PredictedDecrease(const double lambda) const
+{
+    double scale = 0.0;
+    for(size_t c=0; c<mvCamKF.size(); c++)
+    {
+        const Vector6d dc = mdc.segment<6>(6*c);
+        scale += dc.dot(lambda*dc - Eigen::Map<const Vector6d>(&mvgc[6*c]));
+    }
+    for(size_t j=0; j<mvX.size(); j++)
+    {
+        const Eigen::Map<const Eigen::Vector3d> dp(&mvdp[3*j]);
+        scale += dp.dot(lambda*dp - Eigen::Map<const Eigen::Vector3d>(&mvgp[3*j]));
+    }
+    return scale;
+}
+
+int VisualBASolver::Optimize(const int nIterations)
+{
+    if(!mbStructure)
+        BuildStructure();
+
+    // Levenberg-Marquardt as g2o::OptimizationAlgorithmLevenberg
+    const int maxTrialsAfterFailure = 10;
+    double lambda = 0.0;
+    double ni = 2.0;
+
+    int iter = 0;
+    for(; iter<nIterations && !mvType.empty(); iter++)
+    {
+        if(mpbStopFlag && *mpbStopFlag)
+            break;
+
+        double currentChi = Evaluate(mvPose, mvX, mvY, mvZ, true);
+        BuildSystem();
+
+        if(iter==0)
+        {
+            lambda = mLambdaInit>0.0 ? mLambdaInit : 1e-5*MaxDiagonal();
+            ni = 2.0;
+        }
+
+        double rho = 0.0;
+        int qmax = 0;
+        do
+        {
+            qmax++;
+
+            double tempChi = std::numeric_limits<double>::max();
+            if(Solve(lambda))
+            {
+                Update();
+                tempChi = Evaluate(mvPoseNew, mvXNew, mvYNew, mvZNew, false);
+                if(!std::isfinite(tempChi))
+                    tempChi = std::numeric_limits<double>::max();
+                const double scale = PredictedDecrease(lambda) + 1e-3;
+                rho = (currentChi - tempChi)/scale;
+            }
+            else
+                rho = -1.0;
+
+            if(rho>0 && tempChi<std::numeric_limits<double>::max())
+            {
+                const double alpha = std::min(1.0 - pow(2.0*rho - 1.0, 3), 2.0/3.0);
+                lambda *= std::max(1.0/3.0, alpha);
+                ni = 2.0;
+                currentChi = tempChi;
+                mvPose.swap(mvPoseNew);
+                mvX.swap(mvXNew); mvY.swap(mvYNew); mvZ.swap(mvZNew);
+            }
+            else
+            {
+                lambda *= ni;
+                ni *= 2.0;
+            }
+        }
+        while(rho<0 && qmax<maxTrialsAfterFailure);
+
+        if(qmax==maxTrialsAfterFailure || rho==0)
+        {
+            iter++;
+            break;
+        }
+    }
+
+    // Chi2 and depth at the final estimate
+    Evaluate(mvPose, mvX, mvY, mvZ, false);
+
+    return iter;
+}
+
+} //namespace ORB_SLAM3
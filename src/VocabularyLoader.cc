@@ -0,0 +1,91 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+* Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+*
+* ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "VocabularyLoader.h"
+
+#include <set>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <condition_variable>
+#include <cstdlib>
+
+namespace ORB_SLAM3
+{
+
+// Vocabularies being loaded. The count lets the loaded case skip the lock
+static std::mutex sMutexLoading;
+static std::condition_variable sLoaded;
+static std::set<const ORBVocabulary*> sLoading;
+static std::atomic<int> snLoading(0);
+
+bool VocabularyLoader::Load(ORBVocabulary* pVoc, const std::string &strFile)
+{
+    if(strFile.size() > 4 && strFile.compare(strFile.size() - 4, 4, ".bin") == 0)
+        return pVoc->loadFromBinaryFile(strFile);
+    return pVoc->loadFromTextFile(strFile);
+}
+
+bool VocabularyLoader::LoadAsync(ORBVocabulary* pVoc, const std::string &strFile)
+{
+    // The common error, a wrong path, is reported to the caller
+    if(!std::ifstream(strFile.c_str()).good())
+        return false;
+
+    {
+        std::unique_lock<std::mutex> lock(sMutexLoading);
+        sLoading.insert(pVoc);
+        snLoading++;
+    }
+
+    std::thread([pVoc,strFile]
+    {
+        if(!Load(pVoc,strFile))
+        {
+            std::cerr << "Wrong vocabulary file: " << strFile << std::endl;
+            exit(-1);
+        }
+        std::cout << "Vocabulary loaded!" << std::endl;
+
+        std::unique_lock<std::mutex> lock(sMutexLoading);
+        sLoading.erase(pVoc);
+        snLoading--;
+        sLoaded.notify_all();
+    }).detach();
+    return true;
+}
+
+bool VocabularyLoader::IsLoaded(const ORBVocabulary* pVoc)
+{
+    if(snLoading.load()==0)
+        return true;
+    std::unique_lock<std::mutex> lock(sMutexLoading);
+    return !sLoading.count(pVoc);
+}
+
+void VocabularyLoader::WaitUntilLoaded(const ORBVocabulary* pVoc)
+{
+    if(snLoading.load()==0)
+        return;
+    std::unique_lock<std::mutex> lock(sMutexLoading);
+    sLoaded.wait(lock, [pVoc]{ return !sLoading.count(pVoc); });
+}
+
+} //namespace ORB_SLAM